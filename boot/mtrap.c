@@ -0,0 +1,311 @@
+/*
+ * M-mode SBI calls
+ *
+ * With -bios none there is no SBI firmware, so the ecalls the kernel makes
+ * from S-mode come here: mtrap_vector (entry.S) switches to the hart's
+ * M-mode stack and calls mtrap_ecall(). The Base extension's probing and
+ * the PMU extension are implemented; anything else returns
+ * SBI_ERR_NOT_SUPPORTED, and the kernel has its own fallbacks for those
+ * (the QEMU test device for shutdown, the start mailbox for HSM).
+ *
+ * PMU counter indexes are CSR offsets: 0 is cycle, 2 instret and 3-31 the
+ * hpmcounters the hart implements (index 1, time, is not a PMU counter).
+ * cycle and instret are never inhibited, since the kernel reads cycle for
+ * its own timing; starting and stopping them only claims and releases
+ * them. An hpmcounter counts the event written to its mhpmevent: the SBI
+ * event index itself for hardware and cache events, which is what QEMU
+ * implements, or the raw selector. Every hart has its own counters and
+ * claims, and calls act on the calling hart.
+ */
+
+#include "arch/sbi.h"
+#include "kernel/config.h"
+
+#define CSR_MHPMCOUNTER(n)  (0xB00 + (n))
+#define CSR_MHPMEVENT(n)    (0x320 + (n))
+#define CSR_CYCLE           0xC00
+
+#define PMU_IDX_CYCLE       0
+#define PMU_IDX_INSTRET     2
+#define PMU_FIXED_MASK      ((1UL << PMU_IDX_CYCLE) | (1UL << PMU_IDX_INSTRET))
+#define PMU_MAX_COUNTERS    32
+
+#define csr_read_num(num) ({ unsigned long __tmp; \
+  asm volatile("csrr %0, %1" : "=r"(__tmp) : "i"(num)); \
+  __tmp; })
+
+#define csr_write_num(num, x) ({ \
+  asm volatile("csrw %0, %1" :: "i"(num), "r"(x)); })
+
+#define r_mhartid() ({ unsigned long __tmp; \
+  asm volatile("csrr %0, mhartid" : "=r"(__tmp)); \
+  __tmp; })
+
+#define r_mcountinhibit() ({ unsigned long __tmp; \
+  asm volatile("csrr %0, mcountinhibit" : "=r"(__tmp)); \
+  __tmp; })
+
+#define w_mcountinhibit(x) ({ \
+  asm volatile("csrw mcountinhibit, %0" :: "r"(x)); })
+
+#define r_mcounteren() ({ unsigned long __tmp; \
+  asm volatile("csrr %0, mcounteren" : "=r"(__tmp)); \
+  __tmp; })
+
+#define w_mcounteren(x) ({ \
+  asm volatile("csrw mcounteren, %0" :: "r"(x)); })
+
+// hpmcounter numbers, for switches over CSRs that must be immediates
+#define HPM_COUNTERS(X) \
+    X(3)  X(4)  X(5)  X(6)  X(7)  X(8)  X(9)  X(10) X(11) X(12) \
+    X(13) X(14) X(15) X(16) X(17) X(18) X(19) X(20) X(21) X(22) \
+    X(23) X(24) X(25) X(26) X(27) X(28) X(29) X(30) X(31)
+
+// Counters the harts implement (bit N: index N), the same on every hart
+static unsigned long pmu_counters;
+
+// Width of each counter in bits
+static unsigned char pmu_width[PMU_MAX_COUNTERS];
+
+// Counters claimed by counter_config_matching, per hart
+static unsigned long pmu_claimed[MAX_CPUS];
+
+static unsigned long hpm_read(unsigned long n)
+{
+    switch (n) {
+#define X(n) case n: return csr_read_num(CSR_MHPMCOUNTER(n));
+        HPM_COUNTERS(X)
+#undef X
+        default: return 0;
+    }
+}
+
+static void hpm_write(unsigned long n, unsigned long value)
+{
+    switch (n) {
+#define X(n) case n: csr_write_num(CSR_MHPMCOUNTER(n), value); break;
+        HPM_COUNTERS(X)
+#undef X
+        default: break;
+    }
+}
+
+static void hpm_set_event(unsigned long n, unsigned long event)
+{
+    switch (n) {
+#define X(n) case n: csr_write_num(CSR_MHPMEVENT(n), event); break;
+        HPM_COUNTERS(X)
+#undef X
+        default: break;
+    }
+}
+
+/*
+ * Find this hart's counters, stop the hpmcounters and let S-mode read
+ * them all. Called by mmode_init() on every hart.
+ *
+ * mcountinhibit bits of counters that do not exist are read-only zero,
+ * so writing ones and reading back finds the implemented ones without
+ * touching a CSR that might trap.
+ */
+void mtrap_pmu_init(void)
+{
+    w_mcountinhibit(~PMU_FIXED_MASK & 0xFFFFFFFFUL);
+    unsigned long hpm = r_mcountinhibit() & ~7UL;
+    pmu_counters = PMU_FIXED_MASK | hpm;
+
+    pmu_width[PMU_IDX_CYCLE] = 64;
+    pmu_width[PMU_IDX_INSTRET] = 64;
+    for (unsigned long n = 3; n < PMU_MAX_COUNTERS; n++) {
+        if (!(hpm & (1UL << n))) {
+            continue;
+        }
+        // Counter bits are WARL too: the top one that sticks is the width
+        hpm_set_event(n, 0);
+        hpm_write(n, ~0UL);
+        unsigned long all = hpm_read(n);
+        unsigned char width = 0;
+        while (width < 64 && (all >> width)) {
+            width++;
+        }
+        pmu_width[n] = width;
+        hpm_write(n, 0);
+    }
+
+    w_mcounteren(r_mcounteren() | pmu_counters);
+    pmu_claimed[r_mhartid()] = 0;
+}
+
+static sbi_ret_t pmu_result(long error, long value)
+{
+    sbi_ret_t ret;
+    ret.error = error;
+    ret.value = value;
+    return ret;
+}
+
+static unsigned long pmu_set(unsigned long base, unsigned long mask)
+{
+    return base >= PMU_MAX_COUNTERS ? 0 : (mask << base) & 0xFFFFFFFFUL;
+}
+
+static sbi_ret_t pmu_get_info(unsigned long idx)
+{
+    if (idx >= PMU_MAX_COUNTERS || !(pmu_counters & (1UL << idx))) {
+        return pmu_result(SBI_ERR_INVALID_PARAM, 0);
+    }
+    unsigned long info = (CSR_CYCLE + idx) | ((unsigned long)(pmu_width[idx] - 1) << 12);
+    return pmu_result(SBI_SUCCESS, (long)info);
+}
+
+static sbi_ret_t pmu_config_matching(unsigned long base, unsigned long mask,
+                                     unsigned long flags, unsigned long event_idx,
+                                     unsigned long event_data)
+{
+    unsigned long *claimed = &pmu_claimed[r_mhartid()];
+    unsigned long set = pmu_set(base, mask) & pmu_counters;
+    unsigned long type = SBI_PMU_EVENT_TYPE(event_idx);
+    unsigned long code = SBI_PMU_EVENT_CODE(event_idx);
+    unsigned long event;
+
+    if (set == 0) {
+        return pmu_result(SBI_ERR_INVALID_PARAM, 0);
+    }
+
+    // cycle and instret count one event each; everything else needs an
+    // hpmcounter programmed with it
+    if (type == SBI_PMU_TYPE_HW && code == SBI_PMU_HW_CPU_CYCLES) {
+        set &= 1UL << PMU_IDX_CYCLE;
+        event = 0;
+    } else if (type == SBI_PMU_TYPE_HW && code == SBI_PMU_HW_INSTRUCTIONS) {
+        set &= 1UL << PMU_IDX_INSTRET;
+        event = 0;
+    } else if ((type == SBI_PMU_TYPE_HW || type == SBI_PMU_TYPE_CACHE) && code != 0) {
+        set &= ~PMU_FIXED_MASK;
+        event = event_idx;
+    } else if (type == SBI_PMU_TYPE_RAW && event_data != 0) {
+        set &= ~PMU_FIXED_MASK;
+        event = event_data;
+    } else {
+        return pmu_result(SBI_ERR_INVALID_PARAM, 0);
+    }
+
+    unsigned long idx;
+    if (flags & SBI_PMU_CFG_FLAG_SKIP_MATCH) {
+        // The caller already holds the first counter of the set
+        idx = base;
+        if (!(set & *claimed & (1UL << idx))) {
+            return pmu_result(SBI_ERR_INVALID_PARAM, 0);
+        }
+    } else {
+        set &= ~*claimed;
+        if (set == 0) {
+            return pmu_result(SBI_ERR_NOT_SUPPORTED, 0);
+        }
+        idx = 0;
+        while (!(set & (1UL << idx))) {
+            idx++;
+        }
+        *claimed |= 1UL << idx;
+    }
+
+    if (!(PMU_FIXED_MASK & (1UL << idx))) {
+        w_mcountinhibit(r_mcountinhibit() | (1UL << idx));
+        hpm_set_event(idx, event);
+        if (flags & SBI_PMU_CFG_FLAG_CLEAR_VALUE) {
+            hpm_write(idx, 0);
+        }
+        if (flags & SBI_PMU_CFG_FLAG_AUTO_START) {
+            w_mcountinhibit(r_mcountinhibit() & ~(1UL << idx));
+        }
+    }
+    return pmu_result(SBI_SUCCESS, (long)idx);
+}
+
+static sbi_ret_t pmu_start(unsigned long base, unsigned long mask,
+                           unsigned long flags, unsigned long initial)
+{
+    unsigned long set = pmu_set(base, mask);
+
+    if (set == 0 || (set & ~pmu_claimed[r_mhartid()])) {
+        return pmu_result(SBI_ERR_INVALID_PARAM, 0);
+    }
+    set &= ~PMU_FIXED_MASK;
+    if (flags & SBI_PMU_START_FLAG_SET_INIT_VALUE) {
+        for (unsigned long n = 3; n < PMU_MAX_COUNTERS; n++) {
+            if (set & (1UL << n)) {
+                hpm_write(n, initial);
+            }
+        }
+    }
+    w_mcountinhibit(r_mcountinhibit() & ~set);
+    return pmu_result(SBI_SUCCESS, 0);
+}
+
+static sbi_ret_t pmu_stop(unsigned long base, unsigned long mask, unsigned long flags)
+{
+    unsigned long *claimed = &pmu_claimed[r_mhartid()];
+    unsigned long set = pmu_set(base, mask);
+
+    if (set == 0 || (set & ~*claimed)) {
+        return pmu_result(SBI_ERR_INVALID_PARAM, 0);
+    }
+    w_mcountinhibit(r_mcountinhibit() | (set & ~PMU_FIXED_MASK));
+    if (flags & SBI_PMU_STOP_FLAG_RESET) {
+        for (unsigned long n = 3; n < PMU_MAX_COUNTERS; n++) {
+            if (set & (1UL << n)) {
+                hpm_set_event(n, 0);
+            }
+        }
+        *claimed &= ~set;
+    }
+    return pmu_result(SBI_SUCCESS, 0);
+}
+
+/*
+ * Handle an ecall from S-mode (a7 = extension, a6 = function); called by
+ * mtrap_vector, which returns a0 and a1 to the caller past the ecall.
+ */
+sbi_ret_t mtrap_ecall(long a0, long a1, long a2, long a3, long a4, long a5,
+                      long fid, long ext)
+{
+    (void)a5;
+
+    if (ext == SBI_EXT_BASE) {
+        switch (fid) {
+            case SBI_BASE_GET_SPEC_VERSION:
+                return pmu_result(SBI_SUCCESS, 3);     // v0.3, the first with PMU
+            case SBI_BASE_PROBE_EXTENSION:
+                return pmu_result(SBI_SUCCESS, a0 == SBI_EXT_BASE || a0 == SBI_EXT_PMU);
+            default:
+                return pmu_result(SBI_ERR_NOT_SUPPORTED, 0);
+        }
+    }
+
+    if (ext == SBI_EXT_PMU) {
+        switch (fid) {
+            case SBI_PMU_NUM_COUNTERS: {
+                // Indexes are CSR offsets, so up to the highest one
+                long count = PMU_MAX_COUNTERS;
+                while (!(pmu_counters & (1UL << (count - 1)))) {
+                    count--;
+                }
+                return pmu_result(SBI_SUCCESS, count);
+            }
+            case SBI_PMU_COUNTER_GET_INFO:
+                return pmu_get_info((unsigned long)a0);
+            case SBI_PMU_COUNTER_CFG_MATCH:
+                return pmu_config_matching((unsigned long)a0, (unsigned long)a1, (unsigned long)a2,
+                                           (unsigned long)a3, (unsigned long)a4);
+            case SBI_PMU_COUNTER_START:
+                return pmu_start((unsigned long)a0, (unsigned long)a1, (unsigned long)a2,
+                                 (unsigned long)a3);
+            case SBI_PMU_COUNTER_STOP:
+                return pmu_stop((unsigned long)a0, (unsigned long)a1, (unsigned long)a2);
+            default:
+                return pmu_result(SBI_ERR_NOT_SUPPORTED, 0);
+        }
+    }
+
+    return pmu_result(SBI_ERR_NOT_SUPPORTED, 0);
+}
@@ -64,6 +64,12 @@
   asm volatile("csrr %0, mhartid" : "=r"(__tmp)); \
   __tmp; })
 
+#define w_mtvec(x) ({ \
+  asm volatile("csrw mtvec, %0" :: "r"(x)); })
+
+#define w_mscratch(x) ({ \
+  asm volatile("csrw mscratch, %0" :: "r"(x)); })
+
 #define w_tp(x) ({ \
   asm volatile("mv tp, %0" :: "r"(x)); })
 
@@ -105,10 +111,32 @@
 #define SIE_STIE (0b1L << 5)   // Bit 5: S-mode timer interrupt enable
 #define SIE_SSIE (0b1L << 1)   // Bit 1: S-mode software interrupt enable
 
+// mcause of an ecall from S-mode
+#define CAUSE_SUPERVISOR_ECALL 9
+
+// CLINT machine software interrupt pending register of a hart
+#define CLINT_MSIP(hart) ((volatile unsigned int *)(0x02000000UL + 4 * (hart)))
+
 // Forward declarations
 extern void _start(void);      // S-mode entry point in boot.S
+extern void mtrap_vector(void); // M-mode IPI forwarder in entry.S
 void kernel_main(void);        // Kernel entry point in kernel/main.c
 void timerinit(void);
+void start_secondary(unsigned long hartid);
+
+// Hart start mailbox in entry.S, written by the kernel (sbi_hart_start)
+extern volatile unsigned long hart_start_addr[];
+extern volatile unsigned long hart_start_opaque[];
+
+// mtrap_vector save area in entry.S, four slots per hart (t1, t2, S-mode
+// sp, M-mode stack top)
+extern unsigned long mtrap_scratch[];
+
+// M-mode stacks in entry.S, reused for SBI calls
+extern char stack0[];
+extern char stack_secondary[];
+
+void mtrap_pmu_init(void);      // PMU counter discovery in mtrap.c
 
 // Simple UART puts for M-mode debugging
 static void m_uart_putc(char c) {
@@ -138,9 +166,10 @@ void timerinit(void) {
     menvcfg |= (1UL << 63);  // STCE bit - enable SSTC
     w_menvcfg(menvcfg);
     
-    // Allow S-mode to access time CSR
+    // Allow S-mode to access the time and cycle CSRs
     unsigned long mcounteren = r_mcounteren();
     mcounteren |= (1 << 1);  // TM bit - allow time CSR access
+    mcounteren |= (1 << 0);  // CY bit - allow cycle CSR access (kbench)
     w_mcounteren(mcounteren);
     
     // Set stimecmp to maximum value to prevent spurious interrupts
@@ -156,16 +185,13 @@ void timerinit(void) {
 }
 
 /*
- * M-mode entry point
- * Called from entry.S after setting up stack
- * Configures M-mode CSRs and transitions to S-mode
+ * Configure M-mode for running the kernel in S-mode
+ * Shared by the boot hart and secondary harts; the caller sets mepc
  */
-void start(void)
+static void mmode_init(void)
 {
     unsigned long x = 0;
     
-    m_uart_puts("\n[M-MODE] ThunderOS starting in M-mode\n");
-    
     // Set M Previous Privilege mode to Supervisor (for mret)
     // This determines what privilege mode we'll be in after mret
     x = r_mstatus();
@@ -173,18 +199,13 @@ void start(void)
     x |= MSTATUS_MPP_S;         // Set MPP to Supervisor mode
     w_mstatus(x);
     
-    m_uart_puts("[M-MODE] Set MPP=S-mode\n");
-    
-    // Set M Exception Program Counter to _start (S-mode bootloader)
-    // After mret, PC will jump to _start in boot.S
-    w_mepc((unsigned long)_start);
-    
     // Disable paging initially (will be enabled in kernel_main)
     w_satp(0);
     
-    // Delegate all exceptions to supervisor mode
+    // Delegate all exceptions to supervisor mode but its own ecalls
     // This allows S-mode to handle page faults, illegal instructions, etc.
-    w_medeleg(0xffff);
+    // S-mode ecalls are SBI calls, answered by mtrap_ecall() (mtrap.c)
+    w_medeleg(0xffff & ~(1 << CAUSE_SUPERVISOR_ECALL));
     
     // Delegate all interrupts to supervisor mode
     // Bits: 15-0 correspond to interrupts 15-0
@@ -208,10 +229,43 @@ void start(void)
     // This sets up mie.STIE, menvcfg.STCE, and mcounteren
     timerinit();
     
+    int id = r_mhartid();
+    
+    // Take machine software interrupts (IPIs from other harts) in
+    // mtrap_vector, which passes them on to S-mode. They cannot be
+    // delegated like the rest. SBI calls run on the top of this hart's
+    // M-mode stack, unused once it leaves for S-mode.
+    unsigned long *scratch = &mtrap_scratch[id * 4];
+    scratch[3] = id == 0 ? (unsigned long)stack0 + 4096 * 4
+                         : (unsigned long)stack_secondary + 4096 * id;
+    w_mscratch((unsigned long)scratch);
+    w_mtvec((unsigned long)mtrap_vector);
+    w_mie(r_mie() | MIE_MSIE);
+    
+    // Find the performance counters and open them to S-mode
+    mtrap_pmu_init();
+    
     // Store hartid in tp register
     // This allows S-mode code to identify which hart it's running on
-    int id = r_mhartid();
     w_tp(id);
+}
+
+/*
+ * M-mode entry point
+ * Called from entry.S after setting up stack
+ * Configures M-mode CSRs and transitions to S-mode
+ */
+void start(void)
+{
+    m_uart_puts("\n[M-MODE] ThunderOS starting in M-mode\n");
+    
+    mmode_init();
+    
+    m_uart_puts("[M-MODE] Set MPP=S-mode\n");
+    
+    // Set M Exception Program Counter to _start (S-mode bootloader)
+    // After mret, PC will jump to _start in boot.S
+    w_mepc((unsigned long)_start);
     
     // Switch to supervisor mode and jump to _start in boot.S
     // mret atomically:
@@ -223,3 +277,40 @@ void start(void)
     // Never reach here
     while(1);
 }
+
+/*
+ * M-mode entry point for secondary harts
+ * Called from entry.S on its own stack with a0 = hartid
+ * 
+ * Waits for the kernel to post a start address in hart_start_addr
+ * (sbi_hart_start() in kernel/arch/riscv64/drivers/sbi.c), then enters
+ * S-mode there with a0 = hartid and a1 = hart_start_opaque, as SBI HSM
+ * hart_start would.
+ */
+void start_secondary(unsigned long hartid)
+{
+    // Only the software interrupt may wake wfi. With mstatus.MIE clear
+    // it is never taken, so no M-mode trap handler is needed.
+    w_mie(MIE_MSIE);
+    
+    while (hart_start_addr[hartid] == 0) {
+        asm volatile("wfi");
+    }
+    
+    // Acknowledge the kernel's software interrupt
+    *CLINT_MSIP(hartid) = 0;
+    w_mie(0);
+    
+    // Read the argument after the address that published it
+    asm volatile("fence rw, rw" ::: "memory");
+    
+    mmode_init();
+    w_mepc(hart_start_addr[hartid]);
+    
+    register unsigned long a0 asm("a0") = hartid;
+    register unsigned long a1 asm("a1") = hart_start_opaque[hartid];
+    asm volatile("mret" :: "r"(a0), "r"(a1));
+    
+    // Never reach here
+    while(1);
+}
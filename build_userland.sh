@@ -103,6 +103,11 @@ build_program "chown" "chown" "core"
 # System utilities
 print_section "System Utilities"
 build_program "ps" "ps" "system"
+build_program "irqstat" "irqstat" "system"
+build_program "trace" "trace" "system"
+build_program "prof" "prof" "system"
+build_program "perfstat" "perfstat" "system"
+build_program "rgctl" "rgctl" "system"
 build_program "uname" "uname" "system"
 build_program "uptime" "uptime" "system"
 build_program "whoami" "whoami" "system"
@@ -133,5 +138,60 @@ build_program "pipe_simple_test" "pipe_simple_test" "tests"
 build_program "mutex_test" "mutex_test" "tests"
 build_program "condvar_test" "condvar_test" "tests"
 build_program "rwlock_test" "rwlock_test" "tests"
+build_program "futex_test" "futex_test" "tests"
+build_program "proctable_test" "proctable_test" "tests"
+build_program "ring_test" "ring_test" "tests"
+build_program "vfork_test" "vfork_test" "tests"
+build_program "execcache_test" "execcache_test" "tests"
+build_program "fpu_test" "fpu_test" "tests"
+build_program "trap_bench" "trap_bench" "tests"
+build_program "pipesize_test" "pipesize_test" "tests"
+build_program "splice_test" "splice_test" "tests"
+build_program "poll_test" "poll_test" "tests"
+build_program "nonblock_test" "nonblock_test" "tests"
+build_program "shm_test" "shm_test" "tests"
+build_program "spsc_test" "spsc_test" "tests"
+build_program "signalfd_test" "signalfd_test" "tests"
+build_program "dcache_test" "dcache_test" "tests"
+build_program "icache_test" "icache_test" "tests"
+build_program "bcache_test" "bcache_test" "tests"
+build_program "readahead_test" "readahead_test" "tests"
+build_program "blkio_test" "blkio_test" "tests"
+build_program "asyncio_test" "asyncio_test" "tests"
+build_program "elevator_test" "elevator_test" "tests"
+build_program "delalloc_test" "delalloc_test" "tests"
+build_program "dirindex_test" "dirindex_test" "tests"
+build_program "fdtable_test" "fdtable_test" "tests"
+build_program "rwvec_test" "rwvec_test" "tests"
+build_program "largefile_test" "largefile_test" "tests"
+build_program "tmpfs_test" "tmpfs_test" "tests"
+build_program "fsync_test" "fsync_test" "tests"
+build_program "pathwalk_test" "pathwalk_test" "tests"
+build_program "rofs_test" "rofs_test" "tests"
+build_program "fb_test" "fb_test" "tests"
+build_program "socket_test" "socket_test" "tests"
+build_program "tcp_test" "tcp_test" "tests"
+build_program "unix_test" "unix_test" "tests"
+build_program "irq_test" "irq_test" "tests"
+build_program "vdso_test" "vdso_test" "tests"
+build_program "thread_test" "thread_test" "tests"
+build_program "sched_test" "sched_test" "tests"
+build_program "rgroup_test" "rgroup_test" "tests"
+build_program "stdio_test" "stdio_test" "tests"
+build_program "malloc_test" "malloc_test" "tests"
+build_program "aio_test" "aio_test" "tests"
+build_program "ksm_test" "ksm_test" "tests"
+build_program "schedlat_test" "schedlat_test" "tests"
+build_program "udp_network_test" "udp_network_test" "net"
+
+# Benchmarks (JSON lines on stdout, see userland/bench/bench.h)
+print_section "Benchmarks"
+build_program "syscall_bench" "syscall_bench" "bench"
+build_program "spawn_bench" "spawn_bench" "bench"
+build_program "pipe_bench" "pipe_bench" "bench"
+build_program "file_bench" "file_bench" "bench"
+build_program "getdents_bench" "getdents_bench" "bench"
+build_program "sync_bench" "sync_bench" "bench"
+build_program "fault_bench" "fault_bench" "bench"
 
 print_footer
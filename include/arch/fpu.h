@@ -0,0 +1,87 @@
+/*
+ * RISC-V Floating-Point Context API
+ * ThunderOS - RISC-V Operating System
+ *
+ * User processes start with the FPU off (sstatus.FS = Off). The first
+ * floating-point instruction traps; only then does the process get a
+ * register save area and the FPU turned on. From there on sstatus.FS
+ * says whether the registers changed since they were last loaded, and a
+ * context switch saves them only when they did (FS = Dirty) and loads
+ * them only for processes that have a save area. Processes that never
+ * touch floating point cost nothing.
+ *
+ * While a process is in the kernel, the FS field of the live sstatus
+ * describes its registers on this hart; the kernel itself never uses
+ * floating point.
+ */
+
+#ifndef ARCH_FPU_H
+#define ARCH_FPU_H
+
+#include <stdint.h>
+
+struct process;
+struct trap_frame;
+
+/* sstatus.FS: floating-point unit state */
+#define SSTATUS_FS_MASK     (3UL << 13)
+#define SSTATUS_FS_OFF      (0UL << 13)  /* Disabled: FP instructions trap */
+#define SSTATUS_FS_INITIAL  (1UL << 13)
+#define SSTATUS_FS_CLEAN    (2UL << 13)  /* Registers match the save area */
+#define SSTATUS_FS_DIRTY    (3UL << 13)  /* Registers written since loaded */
+
+/* Saved f0-f31 and fcsr */
+struct fp_state {
+    uint64_t f[32];
+    uint64_t fcsr;
+};
+
+/* Register save and load (kernel/arch/riscv64/fpu.S); FS must not be Off */
+void fpu_save(struct fp_state *state);
+void fpu_restore(const struct fp_state *state);
+
+/**
+ * Turn the FPU on for a process's first floating-point instruction
+ *
+ * @param tf Trap frame of an illegal instruction trap from user mode
+ * @return 0 if the instruction should be retried, -1 if the process
+ *         already had the FPU on (it is a real illegal instruction) or
+ *         no save area could be allocated
+ */
+int fpu_handle_trap(struct trap_frame *tf);
+
+/**
+ * Save the outgoing process's registers if dirty, load the incoming one's
+ *
+ * Called by context_switch(); NULL is the idle context.
+ */
+void fpu_switch(struct process *old, struct process *new);
+
+/**
+ * Give a forked child a copy of the parent's registers
+ *
+ * The child's trap frame is a copy of the parent's, whose FS bits are
+ * Off exactly when the parent has no FP state, so they need no fixing.
+ *
+ * @param parent Current process
+ * @param child New process
+ * @return 0 on success, -1 if no save area could be allocated
+ */
+int fpu_fork(struct process *parent, struct process *child);
+
+/**
+ * Drop a process's floating-point state and turn the FPU off for it
+ *
+ * Used by exec; tf (may be NULL) is the frame returning to user mode.
+ */
+void fpu_release(struct process *proc, struct trap_frame *tf);
+
+/**
+ * Record the live FS state in a trap frame about to return to user mode
+ *
+ * Keeps a clean save from being undone by the FS value saved at trap
+ * entry, so registers are not saved again until really written.
+ */
+void fpu_sync_frame(struct trap_frame *tf);
+
+#endif // ARCH_FPU_H
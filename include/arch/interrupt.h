@@ -8,6 +8,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "kernel/config.h"
 
 /* Maximum number of interrupt sources (QEMU virt machine supports 96) */
 #define MAX_INTERRUPT_SOURCES 96
@@ -20,19 +21,126 @@
 #define IRQ_PRIORITY_HIGH     5
 #define IRQ_PRIORITY_HIGHEST  7
 
+/* Affinity mask of every CPU, the default */
+#define IRQ_AFFINITY_ALL ((1U << MAX_CPUS) - 1)
+
+/* Longest IRQ name kept, NUL included */
+#define IRQ_NAME_MAX 16
+
 /* Interrupt handler function type */
 typedef void (*interrupt_handler_t)(void);
 
+/*
+ * Hard handler of a threaded IRQ: quiets the device in the trap and
+ * says whether the thread function has work
+ */
+typedef int (*interrupt_hard_handler_t)(void);
+
+/* Hard handler results */
+#define IRQ_HANDLED      0              /* Nothing left for the thread */
+#define IRQ_WAKE_THREAD  1              /* Run the thread function */
+
+/* Scheduling priority of IRQ threads (real-time, below init's) */
+#define IRQ_THREAD_PRIORITY 5
+
+/*
+ * Per-IRQ statistics
+ *
+ * Latency runs from the external interrupt trap to the handler's start,
+ * so it includes waiting for the big kernel lock and for handlers of
+ * interrupts claimed before it in the same trap. Thread latency runs
+ * from the hard handler to the thread function's start.
+ */
+typedef struct {
+    uint64_t count;                     /* Interrupts handled */
+    uint64_t cpu_count[MAX_CPUS];       /* Of those, on each logical CPU */
+    uint64_t total_us;                  /* Time spent in the handler */
+    uint64_t max_us;                    /* Longest handler run */
+    uint64_t max_latency_us;            /* Longest wait for the handler */
+    uint64_t thread_count;              /* Thread function runs */
+    uint64_t thread_total_us;           /* Time spent in the thread function */
+    uint64_t thread_max_us;             /* Longest thread function run */
+    uint64_t thread_max_latency_us;     /* Longest wake-up of the thread */
+} interrupt_stats_t;
+
 /* Public API */
 void interrupt_init(void);
 void interrupt_enable(void);
 void interrupt_disable(void);
 int interrupt_save_disable(void);
 void interrupt_restore(int state);
-bool interrupt_register_handler(uint32_t irq_number, interrupt_handler_t handler);
+bool interrupt_register_handler(uint32_t irq_number, interrupt_handler_t handler,
+                                const char *name);
 void interrupt_unregister_handler(uint32_t irq_number);
+
+/*
+ * Threaded IRQs: the hard handler runs in the trap, with interrupts off,
+ * and only quiets the device; the thread function does the rest in a
+ * kernel thread of its own ("irq/<n>-<name>", IRQ_THREAD_PRIORITY), with
+ * interrupts on, so the timer and other devices get in meanwhile.
+ *
+ * With no hard handler the device is still raising the line, so the
+ * IRQ is masked from the trap until the thread function has run (one
+ * shot); with one, it stays enabled and interrupts meanwhile run the
+ * thread function again once. Until interrupt_start_threads() the
+ * thread function runs in the trap, after the hard handler, as it does
+ * if its thread could not be created.
+ */
+bool interrupt_register_threaded(uint32_t irq_number, interrupt_hard_handler_t handler,
+                                 interrupt_handler_t thread_fn, const char *name);
+
+/*
+ * Create the threads of the threaded IRQs registered so far; later ones
+ * get theirs when registered
+ *
+ * Returns 0 on success, -1 on error (errno set by kthread_create())
+ */
+int interrupt_start_threads(void);
+
+/*
+ * PID of an IRQ's thread, 0 if it has none
+ */
+int interrupt_get_thread_pid(uint32_t irq_number);
 void interrupt_set_priority(uint32_t irq_number, uint32_t priority);
+uint32_t interrupt_get_priority(uint32_t irq_number);
 void interrupt_enable_irq(uint32_t irq_number);
 void interrupt_disable_irq(uint32_t irq_number);
 
+/*
+ * Hart affinity: the mask lists the logical CPUs that may take an IRQ.
+ * One of them, the lowest online, gets it enabled in its PLIC context
+ * (the target); the others never see it. Fails for an unknown IRQ or a
+ * mask with no CPU online.
+ */
+bool interrupt_set_affinity(uint32_t irq_number, uint32_t cpu_mask);
+uint32_t interrupt_get_affinity(uint32_t irq_number);
+int interrupt_get_target(uint32_t irq_number);
+
+/*
+ * Priority threshold of a CPU's PLIC context: IRQs at or below it are
+ * masked on that CPU
+ */
+void interrupt_set_threshold(int cpu_id, uint32_t threshold);
+uint32_t interrupt_get_threshold(int cpu_id);
+
+/*
+ * Statistics and name of an IRQ; false if no handler is registered
+ */
+bool interrupt_get_stats(uint32_t irq_number, interrupt_stats_t *stats);
+const char *interrupt_get_name(uint32_t irq_number);
+
+/*
+ * Set up the calling CPU's PLIC context (each secondary hart, once
+ * online): its threshold, the IRQs targeted at it and SEIE
+ */
+void interrupt_init_cpu(void);
+
+/*
+ * Claim and handle pending external interrupts on the calling CPU
+ * (trap handler)
+ *
+ * @param trap_time_us When the trap was taken, for the latency figures
+ */
+void handle_external_interrupt(unsigned long trap_time_us);
+
 #endif // ARCH_INTERRUPT_H
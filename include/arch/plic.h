@@ -26,12 +26,18 @@
 /* Context for supervisor mode, hart 0 */
 #define PLIC_CONTEXT_SUPERVISOR_HART0 1
 
+/* Supervisor-mode context of a hart: QEMU virt gives each hart an
+ * M-mode context (2 * hart) followed by an S-mode one
+ */
+#define PLIC_CONTEXT_SUPERVISOR(hartid) (2U * (uint32_t)(hartid) + 1U)
+
 /* Priority levels */
 #define PLIC_PRIORITY_MIN 0
 #define PLIC_PRIORITY_MAX 7
 
 /* Public API */
 void plic_init(void);
+void plic_init_context(uint32_t context);
 void plic_set_priority(uint32_t irq_number, uint32_t priority);
 void plic_enable_interrupt(uint32_t irq_number, uint32_t context);
 void plic_disable_interrupt(uint32_t irq_number, uint32_t context);
@@ -16,10 +16,18 @@
 #define SBI_EXT_RFENCE              0x52464E43  /* "RFNC" */
 #define SBI_EXT_HSM                 0x48534D    /* "HSM" - Hart State Management */
 #define SBI_EXT_SRST                0x53525354  /* "SRST" - System Reset */
+#define SBI_EXT_PMU                 0x504D55    /* "PMU" - Performance Monitoring Unit */
 
 /* Legacy SBI Extension IDs (deprecated but widely supported) */
 #define SBI_EXT_LEGACY_SHUTDOWN     0x08
 
+/* SBI Base Extension */
+#define SBI_BASE_GET_SPEC_VERSION   0
+#define SBI_BASE_PROBE_EXTENSION    3
+
+/* SBI Hart State Management Extension */
+#define SBI_HSM_HART_START          0
+
 /* SBI System Reset Extension */
 #define SBI_SRST_RESET_TYPE_SHUTDOWN    0x00000000
 #define SBI_SRST_RESET_TYPE_COLD_REBOOT 0x00000001
@@ -28,6 +36,43 @@
 #define SBI_SRST_RESET_REASON_NONE      0x00000000
 #define SBI_SRST_RESET_REASON_SYSFAIL   0x00000001
 
+/* SBI PMU Extension functions */
+#define SBI_PMU_NUM_COUNTERS        0
+#define SBI_PMU_COUNTER_GET_INFO    1
+#define SBI_PMU_COUNTER_CFG_MATCH   2
+#define SBI_PMU_COUNTER_START       3
+#define SBI_PMU_COUNTER_STOP        4
+
+/* counter_get_info: CSR number in [11:0], width - 1 in [17:12] */
+#define SBI_PMU_INFO_CSR(info)      ((unsigned long)(info) & 0xFFF)
+#define SBI_PMU_INFO_WIDTH(info)    ((((unsigned long)(info) >> 12) & 0x3F) + 1)
+#define SBI_PMU_INFO_FIRMWARE       (1UL << 63)  /* Firmware counter, no CSR */
+
+/* PMU event index: type in [19:16], code in [15:0] */
+#define SBI_PMU_EVENT(type, code)   (((unsigned long)(type) << 16) | (code))
+#define SBI_PMU_EVENT_TYPE(idx)     (((unsigned long)(idx) >> 16) & 0xF)
+#define SBI_PMU_EVENT_CODE(idx)     ((unsigned long)(idx) & 0xFFFF)
+
+#define SBI_PMU_TYPE_HW             0   /* Code: SBI_PMU_HW_* */
+#define SBI_PMU_TYPE_CACHE          1   /* Code: cache << 3 | op << 1 | result */
+#define SBI_PMU_TYPE_RAW            2   /* Code 0; event_data is the mhpmevent value */
+
+#define SBI_PMU_HW_CPU_CYCLES       1
+#define SBI_PMU_HW_INSTRUCTIONS     2
+#define SBI_PMU_HW_CACHE_REFERENCES 3
+#define SBI_PMU_HW_CACHE_MISSES     4
+#define SBI_PMU_HW_BRANCH_INSTRUCTIONS 5
+#define SBI_PMU_HW_BRANCH_MISSES    6
+
+/* counter_config_matching flags */
+#define SBI_PMU_CFG_FLAG_SKIP_MATCH     (1 << 0)
+#define SBI_PMU_CFG_FLAG_CLEAR_VALUE    (1 << 1)
+#define SBI_PMU_CFG_FLAG_AUTO_START     (1 << 2)
+
+/* counter_start and counter_stop flags */
+#define SBI_PMU_START_FLAG_SET_INIT_VALUE (1 << 0)
+#define SBI_PMU_STOP_FLAG_RESET         (1 << 0)
+
 /* QEMU virt machine test device */
 #define QEMU_TEST_DEVICE_ADDR           0x100000
 #define QEMU_TEST_DEVICE_EXIT_SUCCESS   0x5555
@@ -42,6 +87,8 @@
 #define SBI_ERR_DENIED              -4
 #define SBI_ERR_INVALID_ADDRESS     -5
 #define SBI_ERR_ALREADY_AVAILABLE   -6
+#define SBI_ERR_ALREADY_STARTED     -7
+#define SBI_ERR_ALREADY_STOPPED     -8
 
 /**
  * SBI call result
@@ -67,4 +114,75 @@ void sbi_shutdown(void);
  */
 void sbi_reboot(void);
 
+/**
+ * Start a parked hart (HSM hart_start)
+ * 
+ * The hart begins executing start_addr in S-mode with the MMU off,
+ * a0 = hartid and a1 = opaque. With -bios none there is no firmware to
+ * ask, so this hands the request to the hart through the start mailbox
+ * that boot/start.c parks secondary harts on.
+ * 
+ * @param hartid Hart to start
+ * @param start_addr Physical address to start at
+ * @param opaque Value passed in a1
+ * @return SBI_SUCCESS, or SBI_ERR_INVALID_PARAM for a hart with no mailbox
+ */
+long sbi_hart_start(unsigned long hartid, unsigned long start_addr, unsigned long opaque);
+
+/**
+ * Is an SBI extension available? (Base probe_extension)
+ * 
+ * @param ext Extension ID (SBI_EXT_*)
+ * @return Nonzero if the firmware implements it
+ */
+long sbi_probe_extension(long ext);
+
+/**
+ * Number of PMU counters; counter indexes run from 0 to this - 1
+ * 
+ * @return Count, or 0 without the PMU extension
+ */
+long sbi_pmu_num_counters(void);
+
+/**
+ * Describe a PMU counter
+ * 
+ * @param idx Counter index
+ * @param info Output: SBI_PMU_INFO_* fields
+ * @return SBI_SUCCESS, or SBI_ERR_INVALID_PARAM for an index with no counter
+ */
+long sbi_pmu_counter_get_info(unsigned long idx, unsigned long *info);
+
+/**
+ * Find a free counter in a set that can count an event, and configure it
+ * 
+ * @param base First counter index of the set
+ * @param mask Counters of the set, bit N for index base + N
+ * @param flags SBI_PMU_CFG_FLAG_*
+ * @param event_idx SBI_PMU_EVENT(type, code)
+ * @param event_data Raw event selector (SBI_PMU_TYPE_RAW), otherwise 0
+ * @param idx Output: the counter chosen
+ * @return SBI_SUCCESS, or SBI_ERR_NOT_SUPPORTED if no counter is free for it
+ */
+long sbi_pmu_counter_config_matching(unsigned long base, unsigned long mask,
+                                     unsigned long flags, unsigned long event_idx,
+                                     unsigned long event_data, unsigned long *idx);
+
+/**
+ * Start configured counters
+ * 
+ * @param flags SBI_PMU_START_FLAG_*
+ * @param initial Value loaded with SBI_PMU_START_FLAG_SET_INIT_VALUE
+ * @return SBI_SUCCESS or SBI_ERR_*
+ */
+long sbi_pmu_counter_start(unsigned long base, unsigned long mask,
+                           unsigned long flags, unsigned long initial);
+
+/**
+ * Stop counters, and with SBI_PMU_STOP_FLAG_RESET release them
+ * 
+ * @return SBI_SUCCESS or SBI_ERR_*
+ */
+long sbi_pmu_counter_stop(unsigned long base, unsigned long mask, unsigned long flags);
+
 #endif /* ARCH_SBI_H */
@@ -0,0 +1,177 @@
+/**
+ * Block I/O request queue
+ *
+ * Sits between the filesystem and the virtio block driver. Callers
+ * describe each transfer as a blk_io_t (one buffer, a run of sectors)
+ * and hand it to the queue; the queue decides when it goes to the
+ * device and with what:
+ *
+ *   - Merging: queued I/Os on adjacent sectors in the same direction
+ *     leave as one multi-segment device request.
+ *   - Elevator: each direction is kept in sector order and served in
+ *     one upward sweep, wrapping to the lowest sector at the end.
+ *   - Deadlines: every I/O also sits on a FIFO with an expiry time;
+ *     once the oldest has waited too long it is served next, ahead of
+ *     the sweep.
+ *   - Read priority: reads usually block a process while writes are
+ *     background write-back, so reads go first, with a short expiry.
+ *     Writes get a turn after BLK_WRITES_STARVED read requests in a row
+ *     so write-back never stalls indefinitely.
+ *
+ * Only BLK_QUEUE_DEPTH requests are in flight at once; the rest wait in
+ * the queue, where they can still be merged and reordered. A caller
+ * issuing several I/Os at once plugs the queue so it sees all of them
+ * before choosing:
+ *
+ *   blk_batch_t batch;
+ *   blk_plug_t plug;
+ *   blk_batch_init(&batch);
+ *   blk_plug_init(&plug);
+ *   for (...) {
+ *       blk_io_init(&ios[i], sector, buf, len, write, done, arg);
+ *       blk_plug_add(&plug, &ios[i], &batch);
+ *   }
+ *   blk_unplug(&plug);
+ *   if (blk_batch_wait(&batch) != 0) ...   // errno set
+ *
+ * An I/O belongs to the queue from submission until its done callback,
+ * which runs from the device interrupt (or from a poller at boot).
+ */
+
+#ifndef BLK_QUEUE_H
+#define BLK_QUEUE_H
+
+#include <stdint.h>
+#include "kernel/wait_queue.h"
+
+/* Device requests in flight at once; further I/O waits to be scheduled */
+#define BLK_QUEUE_DEPTH         8
+
+/* Expiry after submission, in microseconds */
+#define BLK_READ_EXPIRE_US      500000
+#define BLK_WRITE_EXPIRE_US     5000000
+
+/* Read requests dispatched in a row while writes wait */
+#define BLK_WRITES_STARVED      2
+
+struct blk_io;
+
+/**
+ * Completion callback, run from the device interrupt
+ * @param io The finished I/O
+ * @param ok Nonzero if the device reported success
+ */
+typedef void (*blk_io_done_t)(struct blk_io *io, int ok);
+
+/**
+ * Group of I/Os a caller waits for together
+ */
+typedef struct blk_batch {
+    volatile uint32_t pending;  // Submitted but not finished
+    int error;                  // Set once any of them failed
+    wait_queue_t waiters;       // Woken as each one finishes
+} blk_batch_t;
+
+/**
+ * One transfer between a buffer and consecutive sectors
+ */
+typedef struct blk_io {
+    uint64_t sector;            // First sector
+    void *buf;                  // Buffer (must be DMA-capable)
+    uint32_t len;               // Bytes, a whole number of sectors
+    uint8_t write;              // Nonzero to write buf to the device
+    blk_io_done_t done;         // Completion callback (may be NULL)
+    void *arg;                  // For the callback's use
+    blk_batch_t *batch;         // Batch it counts against (may be NULL)
+
+    // Queue state, owned by the queue while the I/O is submitted
+    uint64_t deadline_us;       // Served ahead of the sweep after this
+    struct blk_io *sort_prev;   // Sector order within the direction
+    struct blk_io *sort_next;
+    struct blk_io *fifo_prev;   // Submission order within the direction
+    struct blk_io *fifo_next;
+    struct blk_io *rq_next;     // Next I/O in the same device request
+} blk_io_t;
+
+/**
+ * I/Os collected by one caller before the queue sees them
+ */
+typedef struct {
+    blk_io_t *head;
+    blk_io_t *tail;
+} blk_plug_t;
+
+/**
+ * Request queue statistics
+ */
+typedef struct {
+    uint32_t ios;               // I/Os submitted
+    uint32_t requests;          // Device requests dispatched
+    uint32_t merged;            // I/Os that joined another's request
+    uint32_t expired;           // Requests dispatched because a deadline passed
+    uint32_t reads_first;       // Read requests dispatched ahead of waiting writes
+    uint32_t peak_queued;       // Most I/Os ever waiting at once
+} blk_stats_t;
+
+/**
+ * Prepare a batch for I/Os to count against
+ * @param batch Batch to initialise
+ */
+void blk_batch_init(blk_batch_t *batch);
+
+/**
+ * Describe a transfer
+ * @param io I/O to fill in
+ * @param sector First sector
+ * @param buf Buffer; must stay valid until done runs
+ * @param len Length in bytes, a multiple of the sector size
+ * @param write Nonzero to write, zero to read
+ * @param done Completion callback (may be NULL)
+ * @param arg Stored in io->arg
+ */
+void blk_io_init(blk_io_t *io, uint64_t sector, void *buf, uint32_t len,
+                 int write, blk_io_done_t done, void *arg);
+
+/**
+ * Queue an I/O and dispatch what the device has room for
+ * @param io Initialised I/O
+ * @param batch Batch it counts against (may be NULL)
+ */
+void blk_submit(blk_io_t *io, blk_batch_t *batch);
+
+/**
+ * Start collecting I/Os
+ * @param plug Plug to initialise
+ */
+void blk_plug_init(blk_plug_t *plug);
+
+/**
+ * Collect an I/O; it counts against its batch from now on
+ * @param plug Plug from blk_plug_init()
+ * @param io Initialised I/O
+ * @param batch Batch it counts against (may be NULL)
+ */
+void blk_plug_add(blk_plug_t *plug, blk_io_t *io, blk_batch_t *batch);
+
+/**
+ * Queue everything collected, then dispatch
+ *
+ * Must come before waiting on a batch that collected I/Os count against.
+ * @param plug Plug to empty
+ */
+void blk_unplug(blk_plug_t *plug);
+
+/**
+ * Wait until every I/O of a batch has finished
+ * @param batch Batch of submitted I/Os
+ * @return 0 if all succeeded, -1 otherwise (errno set)
+ */
+int blk_batch_wait(blk_batch_t *batch);
+
+/**
+ * Get request queue statistics
+ * @param stats Output structure
+ */
+void blk_get_stats(blk_stats_t *stats);
+
+#endif /* BLK_QUEUE_H */
@@ -0,0 +1,57 @@
+/**
+ * Framebuffer Device (/dev/fb0)
+ *
+ * Lets one process draw on the screen directly: it opens /dev/fb0,
+ * asks for the geometry with FBIOGET_INFO, maps the framebuffer with
+ * mmap(MAP_SHARED) and draws into it at memory speed, then says which
+ * part changed with FBIO_DAMAGE, which sends that part to the display.
+ *
+ * Opening the device takes the display over: the virtual terminals stop
+ * drawing (they keep their output) and the framebuffer stays in one
+ * place, rows in screen order, for as long as it is open. A second open
+ * fails with EBUSY. The last close gives the display back to the
+ * terminals, which draw everything again; a mapping left after that
+ * still reaches the framebuffer but no longer owns it.
+ */
+
+#ifndef FBDEV_H
+#define FBDEV_H
+
+#include <stdint.h>
+
+/* ioctl() requests */
+#define FBIOGET_INFO    0x4600          /* Fill an fbdev_info_t */
+#define FBIO_DAMAGE     0x4601          /* Show the fbdev_rect_t given */
+
+/* fbdev_info_t.format */
+#define FBDEV_FORMAT_BGRX8888 1         /* 32-bit pixels: blue, green, red, unused */
+
+/**
+ * Framebuffer geometry (FBIOGET_INFO)
+ */
+typedef struct {
+    uint32_t width;                     /* Pixels per row */
+    uint32_t height;                    /* Rows */
+    uint32_t stride;                    /* Bytes from one row to the next */
+    uint32_t format;                    /* FBDEV_FORMAT_* */
+    uint64_t size;                      /* Bytes mmap() may map */
+} fbdev_info_t;
+
+/**
+ * Rectangle of pixels (FBIO_DAMAGE); clipped to the screen
+ */
+typedef struct {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+} fbdev_rect_t;
+
+/**
+ * Register /dev/fb0 for the VirtIO GPU framebuffer
+ *
+ * @return 0 on success, -1 on error (errno set: ENODEV without a GPU)
+ */
+int fbdev_init(void);
+
+#endif /* FBDEV_H */
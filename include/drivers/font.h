@@ -37,6 +37,23 @@ const uint8_t *font_get_glyph(char c);
  */
 void font_draw_char(uint32_t x, uint32_t y, char c, uint32_t fg, uint32_t bg);
 
+/**
+ * Draw a run of characters on one line
+ * 
+ * Each glyph row is copied from rows pre-expanded for the color pair, and
+ * each pixel row of the run goes to the framebuffer in one write. Control
+ * characters are not interpreted.
+ * 
+ * @param x X coordinate (top-left)
+ * @param y Y coordinate (top-left)
+ * @param chars Characters to draw
+ * @param count Number of characters
+ * @param fg Foreground color (ARGB)
+ * @param bg Background color (ARGB)
+ */
+void font_draw_run(uint32_t x, uint32_t y, const char *chars, uint32_t count,
+                   uint32_t fg, uint32_t bg);
+
 /**
  * Draw a character with transparent background
  * 
@@ -51,6 +51,16 @@ typedef enum {
     FB_BACKEND_LINEAR,          /* Simple linear framebuffer */
 } fb_backend_t;
 
+/**
+ * Rectangle of pixels
+ */
+typedef struct {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+} fb_rect_t;
+
 /**
  * Framebuffer information structure
  */
@@ -116,6 +126,50 @@ void fb_set_pixel(uint32_t x, uint32_t y, uint32_t color);
  */
 uint32_t fb_get_pixel(uint32_t x, uint32_t y);
 
+/**
+ * Convert a color to the framebuffer's own pixel format
+ * 
+ * @param color ARGB color value
+ * @return The pixel fb_write_span() stores for it
+ */
+uint32_t fb_native_color(uint32_t color);
+
+/**
+ * Write a run of pixels to one row
+ * 
+ * Checks the bounds once for the whole run rather than per pixel.
+ * 
+ * @param x X coordinate of the first pixel
+ * @param y Y coordinate
+ * @param pixels Pixels from fb_native_color()
+ * @param count Number of pixels; those past the right edge are dropped
+ */
+void fb_write_span(uint32_t x, uint32_t y, const uint32_t *pixels, uint32_t count);
+
+/**
+ * Copy a rectangle of pixels onto the screen
+ * 
+ * Each row is one copy. Whatever falls past the right or bottom edge is
+ * dropped.
+ * 
+ * @param src Pixels from fb_native_color(), row after row
+ * @param src_stride Pixels from one source row to the next
+ * @param rect Where the pixels go; its size is the size of the source
+ */
+void fb_blit(const uint32_t *src, uint32_t src_stride, const fb_rect_t *rect);
+
+/**
+ * Move a rectangle of the screen to another place on it
+ * 
+ * The two may overlap. Clipped so that both the source and the
+ * destination lie on the screen.
+ * 
+ * @param dst_x X coordinate of the destination
+ * @param dst_y Y coordinate of the destination
+ * @param src The rectangle to move
+ */
+void fb_copy_rect(uint32_t dst_x, uint32_t dst_y, const fb_rect_t *src);
+
 /**
  * Clear the entire framebuffer
  * 
@@ -133,6 +187,9 @@ int fb_flush(void);
 /**
  * Flush a specific region to display
  * 
+ * On a double-buffered backend this is the page flip fb_swap_buffers()
+ * does.
+ * 
  * @param x X coordinate
  * @param y Y coordinate
  * @param width Width of region
@@ -141,6 +198,46 @@ int fb_flush(void);
  */
 int fb_flush_region(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
 
+/**
+ * Show a finished frame
+ * 
+ * With two buffers (the VirtIO GPU, given the memory), drawing always
+ * goes to the one not on the screen; this sends it the rectangle, moves
+ * the scanout to it and copies the rectangle to the other buffer, which
+ * is drawn into next. The screen never shows a frame half drawn, and the
+ * next frame is drawn while the device still reads this one. Everything
+ * drawn since the previous swap must be inside the rectangle. With one
+ * buffer it flushes the rectangle.
+ * 
+ * fb_info_t.pixels names the first buffer only; draw with fb_set_pixel()
+ * and friends.
+ * 
+ * @param x X coordinate
+ * @param y Y coordinate
+ * @param width Width of the changed rectangle
+ * @param height Height of the changed rectangle
+ * @return 0 on success, -1 on error (errno set)
+ */
+int fb_swap_buffers(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+/**
+ * Scroll the top of the screen up
+ * 
+ * Moves rows [0, height) up by lines rows; rows below stay put. On the
+ * VirtIO GPU this only moves the origin of a ring of rows, so it costs
+ * the same whatever the height. The bottom lines rows of the region are
+ * left with stale contents for the caller to draw over. Nothing reaches
+ * the display until the region is flushed.
+ * 
+ * After a scroll, pixels may no longer be in screen order behind
+ * fb_info_t.pixels; draw with fb_set_pixel() and friends.
+ * 
+ * @param height Rows in the scrolled region
+ * @param lines Rows to scroll by
+ * @return 0 on success, -1 on error (errno set)
+ */
+int fb_scroll_up(uint32_t height, uint32_t lines);
+
 /* ============================================================================
  * Graphics Primitives
  * ============================================================================ */
@@ -190,6 +287,8 @@ void fb_draw_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint3
 /**
  * Draw a filled rectangle
  * 
+ * Clipped to the screen; each row is one word-wide fill.
+ * 
  * @param x X coordinate
  * @param y Y coordinate
  * @param width Width
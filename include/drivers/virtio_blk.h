@@ -12,47 +12,13 @@
 
 #include <stdint.h>
 #include <stddef.h>
-
-/* VirtIO MMIO Register Offsets (from base address) */
-#define VIRTIO_MMIO_MAGIC_VALUE         0x000  // Magic value ('virt')
-#define VIRTIO_MMIO_VERSION             0x004  // Device version
-#define VIRTIO_MMIO_DEVICE_ID           0x008  // Device type (2 = block)
-#define VIRTIO_MMIO_VENDOR_ID           0x00c  // Vendor ID
-#define VIRTIO_MMIO_DEVICE_FEATURES     0x010  // Device features
-#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014  // Device features selector
-#define VIRTIO_MMIO_DRIVER_FEATURES     0x020  // Driver features
-#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024  // Driver features selector
-#define VIRTIO_MMIO_QUEUE_SEL           0x030  // Queue selector
-#define VIRTIO_MMIO_QUEUE_NUM_MAX       0x034  // Maximum queue size
-#define VIRTIO_MMIO_QUEUE_NUM           0x038  // Queue size
-#define VIRTIO_MMIO_QUEUE_READY         0x044  // Queue ready
-#define VIRTIO_MMIO_QUEUE_NOTIFY        0x050  // Queue notify
-#define VIRTIO_MMIO_INTERRUPT_STATUS    0x060  // Interrupt status
-#define VIRTIO_MMIO_INTERRUPT_ACK       0x064  // Interrupt acknowledge
-#define VIRTIO_MMIO_STATUS              0x070  // Device status
-#define VIRTIO_MMIO_QUEUE_DESC_LOW      0x080  // Queue descriptor address (low)
-#define VIRTIO_MMIO_QUEUE_DESC_HIGH     0x084  // Queue descriptor address (high)
-#define VIRTIO_MMIO_QUEUE_AVAIL_LOW     0x090  // Available ring address (low)
-#define VIRTIO_MMIO_QUEUE_AVAIL_HIGH    0x094  // Available ring address (high)
-#define VIRTIO_MMIO_QUEUE_USED_LOW      0x0a0  // Used ring address (low)
-#define VIRTIO_MMIO_QUEUE_USED_HIGH     0x0a4  // Used ring address (high)
-#define VIRTIO_MMIO_CONFIG_GENERATION   0x0fc  // Configuration generation
-#define VIRTIO_MMIO_CONFIG              0x100  // Device-specific configuration
-
-/* VirtIO Magic Value */
-#define VIRTIO_MAGIC                    0x74726976  // 'virt' in little-endian
+#include "drivers/virtqueue.h"
+#include "kernel/config.h"
+#include "kernel/wait_queue.h"
 
 /* VirtIO Device IDs */
 #define VIRTIO_DEVICE_ID_BLOCK          2
 
-/* VirtIO Status Bits */
-#define VIRTIO_STATUS_ACKNOWLEDGE       (1 << 0)  // Guest OS has noticed device
-#define VIRTIO_STATUS_DRIVER            (1 << 1)  // Guest OS knows how to drive device
-#define VIRTIO_STATUS_DRIVER_OK         (1 << 2)  // Driver is ready
-#define VIRTIO_STATUS_FEATURES_OK       (1 << 3)  // Features negotiated successfully
-#define VIRTIO_STATUS_DEVICE_NEEDS_RESET (1 << 6) // Device experienced error
-#define VIRTIO_STATUS_FAILED            (1 << 7)  // Fatal error occurred
-
 /* VirtIO Block Device Features */
 #define VIRTIO_BLK_F_SIZE_MAX           (1 << 1)  // Maximum segment size
 #define VIRTIO_BLK_F_SEG_MAX            (1 << 2)  // Maximum number of segments
@@ -62,6 +28,14 @@
 #define VIRTIO_BLK_F_FLUSH              (1 << 9)  // Cache flush command
 #define VIRTIO_BLK_F_TOPOLOGY           (1 << 10) // Topology information
 #define VIRTIO_BLK_F_CONFIG_WCE         (1 << 11) // Write cache enable
+#define VIRTIO_BLK_F_MQ                 (1 << 12) // Multiple request queues
+
+/* Features the driver accepts; anything else offered is declined */
+#define VIRTIO_BLK_DRIVER_FEATURES \
+    (VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_GEOMETRY | \
+     VIRTIO_BLK_F_RO | VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_FLUSH | \
+     VIRTIO_BLK_F_TOPOLOGY | VIRTIO_BLK_F_MQ | VIRTIO_RING_F_INDIRECT_DESC | \
+     VIRTIO_RING_F_EVENT_IDX | VIRTIO_F_VERSION_1)
 
 /* VirtIO Block Request Types */
 #define VIRTIO_BLK_T_IN                 0         // Read
@@ -75,23 +49,21 @@
 #define VIRTIO_BLK_S_IOERR              1         // I/O error
 #define VIRTIO_BLK_S_UNSUPP             2         // Unsupported operation
 
-/* VirtIO Descriptor Flags */
-#define VIRTQ_DESC_F_NEXT               1         // This descriptor continues
-#define VIRTQ_DESC_F_WRITE              2         // Write-only (device writes)
-#define VIRTQ_DESC_F_INDIRECT           4         // Indirect descriptor
-
-/* VirtIO Used Ring Flags */
-#define VIRTQ_USED_F_NO_NOTIFY          1         // Don't notify when buffer added
-
-/* VirtIO Available Ring Flags */
-#define VIRTQ_AVAIL_F_NO_INTERRUPT      1         // Don't interrupt when buffer used
-
 /* Block device sector size */
 #define VIRTIO_BLK_SECTOR_SIZE          512
 
-/* Default queue size (must be power of 2) */
+/* Default queue size (must be power of 2, at most VIRTQ_MAX_SIZE) */
 #define VIRTIO_BLK_QUEUE_SIZE           128
 
+/* Data segments per request, before any lower device limit */
+#define VIRTIO_BLK_MAX_SEGS             32
+
+/* Request queues used with VIRTIO_BLK_F_MQ: at most one per CPU */
+#define VIRTIO_BLK_MAX_QUEUES           MAX_CPUS
+
+/* Empty polls of the used ring before a polled wait gives up */
+#define VIRTIO_BLK_POLL_SPINS           1000000
+
 /**
  * VirtIO Block Device Configuration Space
  * Located at offset 0x100 from MMIO base
@@ -113,7 +85,8 @@ typedef struct {
         uint32_t opt_io_size;        // Optimal I/O size
     } topology;
     uint8_t writeback;          // Write cache enabled
-    uint8_t unused0[3];
+    uint8_t unused0;
+    uint16_t num_queues;        // Request queues (VIRTIO_BLK_F_MQ)
     uint32_t max_discard_sectors;    // Maximum discard sectors
     uint32_t max_discard_seg;        // Maximum discard segments
     uint32_t discard_sector_alignment;  // Discard sector alignment
@@ -123,71 +96,6 @@ typedef struct {
     uint8_t unused1[3];
 } __attribute__((packed)) virtio_blk_config_t;
 
-/**
- * VirtQueue Descriptor
- * Describes a single buffer in the virtqueue
- */
-typedef struct {
-    uint64_t addr;              // Physical address
-    uint32_t len;               // Length
-    uint16_t flags;             // Flags (VIRTQ_DESC_F_*)
-    uint16_t next;              // Next descriptor index (if NEXT flag set)
-} __attribute__((packed)) virtq_desc_t;
-
-/**
- * VirtQueue Available Ring
- * Written by driver, read by device
- */
-typedef struct {
-    uint16_t flags;             // Flags (VIRTQ_AVAIL_F_*)
-    uint16_t idx;               // Index of next available descriptor
-    uint16_t ring[];            // Available descriptor indices (size = queue_size)
-    // Note: 'used_event' follows ring[], at ring[queue_size]
-} __attribute__((packed)) virtq_avail_t;
-
-/**
- * VirtQueue Used Element
- * Single element in the used ring
- */
-typedef struct {
-    uint32_t id;                // Descriptor chain head index
-    uint32_t len;               // Total bytes written to buffer
-} __attribute__((packed)) virtq_used_elem_t;
-
-/**
- * VirtQueue Used Ring
- * Written by device, read by driver
- */
-typedef struct {
-    uint16_t flags;             // Flags (VIRTQ_USED_F_*)
-    uint16_t idx;               // Index of next used descriptor
-    virtq_used_elem_t ring[];   // Used descriptor elements (size = queue_size)
-    // Note: 'avail_event' follows ring[], at ring[queue_size]
-} __attribute__((packed)) virtq_used_t;
-
-/**
- * VirtQueue
- * Complete virtqueue structure with descriptor, available, and used rings
- */
-typedef struct {
-    uint32_t queue_size;        // Number of descriptors
-    uint16_t last_seen_used;    // Last used index we've seen
-    
-    // DMA-allocated rings
-    virtq_desc_t *desc;         // Descriptor ring
-    virtq_avail_t *avail;       // Available ring
-    virtq_used_t *used;         // Used ring
-    
-    // Physical addresses for device
-    uintptr_t desc_phys;
-    uintptr_t avail_phys;
-    uintptr_t used_phys;
-    
-    // Free descriptor tracking
-    uint16_t free_head;         // Head of free descriptor list
-    uint16_t num_free;          // Number of free descriptors
-} virtqueue_t;
-
 /**
  * VirtIO Block Request Header
  * Sent to device for each I/O operation
@@ -198,16 +106,48 @@ typedef struct {
     uint64_t sector;            // First sector to read/write
 } __attribute__((packed)) virtio_blk_req_header_t;
 
+/**
+ * Completion callback, run from the interrupt handler
+ * @param arg Argument given to virtio_blk_submit()
+ * @param ok Nonzero if the device reported success
+ */
+typedef void (*virtio_blk_done_t)(void *arg, int ok);
+
+/**
+ * Group of requests a caller waits for together
+ */
+typedef struct virtio_blk_batch {
+    volatile uint32_t pending;  // Requests started but not finished
+    int error;                  // Set once any of them failed
+    wait_queue_t waiters;       // Woken as each one finishes
+} virtio_blk_batch_t;
+
 /**
  * VirtIO Block Request
  * Complete request structure including header, data buffer, and status
  */
-typedef struct {
+typedef struct virtio_blk_request {
+    // Chain handed to the device through one ring slot with
+    // VIRTIO_RING_F_INDIRECT_DESC; first, so it is 16-byte aligned
+    virtq_desc_t indirect[VIRTIO_BLK_MAX_SEGS + 2];
     virtio_blk_req_header_t header;  // Request header
     uint8_t *data;                   // Data buffer (DMA-allocated)
     uint8_t status;                  // Status byte (written by device)
+    uintptr_t phys;                  // Physical address of this request
+    virtio_blk_batch_t *batch;       // Batch it counts against (may be NULL)
+    virtio_blk_done_t done;          // Completion callback (may be NULL)
+    void *arg;                       // Argument for done
 } virtio_blk_request_t;
 
+/**
+ * Data segment of a request
+ * One buffer, physically contiguous, a whole number of sectors long
+ */
+typedef struct {
+    void *buf;                  // Buffer (must be DMA-capable)
+    uint32_t len;               // Length in bytes
+} virtio_blk_seg_t;
+
 /**
  * VirtIO Block Device
  * Main driver state structure
@@ -226,14 +166,28 @@ typedef struct {
     uint64_t capacity;          // Capacity in sectors
     uint32_t block_size;        // Block size in bytes
     uint8_t read_only;          // Read-only flag
+    uint32_t seg_max;           // Data segments per request
+    
+    // VirtQueues, one per CPU up to what the device offers
+    virtqueue_t queues[VIRTIO_BLK_MAX_QUEUES];
+    uint32_t num_queues;
     
-    // VirtQueue
-    virtqueue_t queue;
+    // Request headers/status bytes, physical addresses precomputed
+    struct dma_pool *req_pool;
+    
+    // Requests in flight on all queues
+    uint32_t in_flight;
+    uint32_t peak_in_flight;    // Most ever in flight at once
+    wait_queue_t desc_waiters;  // Submitters waiting for free descriptors
+    uint8_t irq_ready;          // Completions raise interrupts
     
     // Statistics
     uint64_t read_count;
     uint64_t write_count;
     uint64_t error_count;
+    uint64_t notify_count;      // Doorbell writes (each a VM exit under QEMU)
+    uint64_t notify_skipped;    // Doorbells the device said it did not need
+    uint64_t irq_count;         // Completion interrupts taken
 } virtio_blk_device_t;
 
 /* Function Prototypes */
@@ -264,6 +218,81 @@ int virtio_blk_read(uint64_t sector, void *buffer, uint32_t count);
  */
 int virtio_blk_write(uint64_t sector, const void *buffer, uint32_t count);
 
+/**
+ * Prepare a batch for requests to count against
+ * @param batch Batch to initialise
+ */
+void virtio_blk_batch_init(virtio_blk_batch_t *batch);
+
+/**
+ * Start a read or write of consecutive sectors without waiting for it
+ *
+ * Sleeps only if the queue is full. done (if any) runs when the device
+ * finishes the request, before the batch stops counting it.
+ *
+ * @param batch Batch the request counts against (may be NULL)
+ * @param sector Starting sector number
+ * @param segs Buffers, transferred in order; must stay valid until done
+ * @param nsegs Number of buffers (at most virtio_blk_get_max_segments())
+ * @param write Nonzero to write, zero to read
+ * @param done Completion callback (may be NULL)
+ * @param arg Argument for done
+ * @return 0 once started, negative on error (errno set)
+ */
+int virtio_blk_submit(virtio_blk_batch_t *batch, uint64_t sector,
+                      const virtio_blk_seg_t *segs, uint32_t nsegs, int write,
+                      virtio_blk_done_t done, void *arg);
+
+/**
+ * Wait until every request of a batch has finished
+ * @param batch Batch of submitted requests
+ * @return 0 if all succeeded, negative if any failed (errno set)
+ */
+int virtio_blk_batch_wait(virtio_blk_batch_t *batch);
+
+/**
+ * Read consecutive sectors into several buffers with one request
+ * @param sector Starting sector number
+ * @param segs Buffers, filled in order
+ * @param nsegs Number of buffers (at most virtio_blk_get_max_segments())
+ * @return Number of sectors read, negative on error
+ */
+int virtio_blk_read_segs(uint64_t sector, const virtio_blk_seg_t *segs, uint32_t nsegs);
+
+/**
+ * Write consecutive sectors from several buffers with one request
+ * @param sector Starting sector number
+ * @param segs Buffers, written in order
+ * @param nsegs Number of buffers (at most virtio_blk_get_max_segments())
+ * @return Number of sectors written, negative on error
+ */
+int virtio_blk_write_segs(uint64_t sector, const virtio_blk_seg_t *segs, uint32_t nsegs);
+
+/**
+ * Get the most data segments one request may carry
+ * @return Segment limit, 0 if no device
+ */
+uint32_t virtio_blk_get_max_segments(void);
+
+/**
+ * Check whether a request starts without waiting for descriptors
+ * @param nsegs Data segments the request would carry
+ * @return Nonzero if the queue has room for it now
+ */
+int virtio_blk_has_room(uint32_t nsegs);
+
+/**
+ * Check whether the caller may sleep for a completion
+ * @return Nonzero once completions raise interrupts and a process is running
+ */
+int virtio_blk_can_wait(void);
+
+/**
+ * Finish requests the device has completed, for callers that cannot sleep
+ * @return Number of requests finished
+ */
+int virtio_blk_poll(void);
+
 /**
  * Flush device write cache
  * @return 0 on success, negative on error
@@ -12,6 +12,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "kernel/wait_queue.h"
 
 /* VirtIO Device ID for GPU */
 #define VIRTIO_DEVICE_ID_GPU            16
@@ -288,14 +289,36 @@ typedef struct {
     uint32_t fb_width;              /* Framebuffer width */
     uint32_t fb_height;             /* Framebuffer height */
     uint32_t fb_format;             /* Pixel format */
-    uint32_t *fb_pixels;            /* Framebuffer pixel data */
+    uint32_t *fb_pixels;            /* Framebuffer pixel data (the buffer drawn into) */
     uintptr_t fb_phys;              /* Physical address of framebuffer */
     size_t fb_size;                 /* Framebuffer size in bytes */
     uint32_t resource_id;           /* GPU resource ID for framebuffer */
     
+    /* Double buffering: buffer i is resource i + 1; the one not on the
+       scanout is the one in fb_pixels (the one on it while direct), and
+       a flush flips between them */
+    uint32_t *buffers[2];
+    uintptr_t buffers_phys[2];
+    uint8_t double_buffered;        /* Both buffers are set up */
+    uint8_t front;                  /* Buffer on the scanout */
+    virtio_gpu_rect_t stale;        /* What the back buffer's resource lacks */
+    uint8_t direct;                 /* Drawing straight into the buffer on the
+                                       scanout (see virtio_gpu_set_direct()) */
+    
+    /* Scrolling: rows [0, scroll_height) of the screen are a ring in the
+       backing, screen row 0 stored at backing row scroll_origin */
+    uint32_t scroll_height;
+    uint32_t scroll_origin;
+    
+    /* Completions */
+    uint32_t in_flight;             /* Commands the device has not finished */
+    wait_queue_t idle_waiters;      /* Woken when in_flight drops to 0 */
+    uint8_t irq_ready;              /* Completions raise interrupts */
+    
     /* Statistics */
     uint32_t flush_count;           /* Number of flushes */
     uint32_t error_count;           /* Number of errors */
+    uint32_t irq_count;             /* Completion interrupts taken */
 } virtio_gpu_device_t;
 
 /* ============================================================================
@@ -345,6 +368,16 @@ void virtio_gpu_set_pixel(uint32_t x, uint32_t y, uint32_t color);
  */
 uint32_t virtio_gpu_get_pixel(uint32_t x, uint32_t y);
 
+/**
+ * Write a run of pixels to one row
+ * 
+ * @param x X coordinate of the first pixel
+ * @param y Y coordinate
+ * @param pixels Pixels, already in the framebuffer format (BGRX)
+ * @param count Number of pixels; those past the right edge are dropped
+ */
+void virtio_gpu_write_span(uint32_t x, uint32_t y, const uint32_t *pixels, uint32_t count);
+
 /**
  * Clear the framebuffer with a color
  * 
@@ -352,6 +385,50 @@ uint32_t virtio_gpu_get_pixel(uint32_t x, uint32_t y);
  */
 void virtio_gpu_clear(uint32_t color);
 
+/**
+ * Fill a rectangle with a color
+ * 
+ * Clipped to the screen; each row is one word-wide fill.
+ * 
+ * @param x X coordinate
+ * @param y Y coordinate
+ * @param width Width
+ * @param height Height
+ * @param color ARGB color value
+ */
+void virtio_gpu_fill_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                          uint32_t color);
+
+/**
+ * Copy a rectangle of pixels onto the screen
+ * 
+ * Clipped to the screen at the right and bottom; each row is one copy.
+ * 
+ * @param x X coordinate of the destination
+ * @param y Y coordinate of the destination
+ * @param width Width
+ * @param height Height
+ * @param src Pixels, already in the framebuffer format (BGRX)
+ * @param src_stride Pixels from one source row to the next
+ */
+void virtio_gpu_blit(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                     const uint32_t *src, uint32_t src_stride);
+
+/**
+ * Move a rectangle of the screen to another place on it
+ * 
+ * The two may overlap. Clipped so that both lie on the screen.
+ * 
+ * @param dst_x X coordinate of the destination
+ * @param dst_y Y coordinate of the destination
+ * @param src_x X coordinate of the source
+ * @param src_y Y coordinate of the source
+ * @param width Width
+ * @param height Height
+ */
+void virtio_gpu_copy_rect(uint32_t dst_x, uint32_t dst_y, uint32_t src_x, uint32_t src_y,
+                          uint32_t width, uint32_t height);
+
 /**
  * Flush framebuffer to display
  * 
@@ -362,6 +439,16 @@ int virtio_gpu_flush(void);
 /**
  * Flush a region of the framebuffer
  * 
+ * Once the completion interrupt is wired up this only queues the
+ * transfer and flush commands: it waits (sleeping) for the previous
+ * flush to finish, not for this one. A failure the device reports later
+ * is counted in error_count.
+ * 
+ * Double-buffered, it is a page flip: the region goes to the buffer drawn
+ * into, the scanout moves to that buffer, and the region is copied to the
+ * other one, which is drawn into from then on. Everything drawn since the
+ * previous flush must be inside the region.
+ * 
  * @param x X coordinate
  * @param y Y coordinate
  * @param width Width of region
@@ -370,13 +457,70 @@ int virtio_gpu_flush(void);
  */
 int virtio_gpu_flush_region(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
 
+/**
+ * Check whether flushes are page flips
+ * 
+ * @return 1 if the framebuffer is double-buffered, 0 otherwise
+ */
+int virtio_gpu_double_buffered(void);
+
+/**
+ * Hand the framebuffer to one client that draws in it directly
+ * 
+ * While direct, the framebuffer stays in one place for a user mapping
+ * (/dev/fb0): rows are in screen order, drawing goes into the buffer on
+ * the scanout and a flush only transfers the region, with no page flip.
+ * Waits for flushes in progress. Turning it off blanks the screen and
+ * brings flips back.
+ * 
+ * @param direct 1 to enter direct mode, 0 to leave it
+ * @return 0 on success, -1 on error (errno set)
+ */
+int virtio_gpu_set_direct(int direct);
+
+/**
+ * VirtIO GPU interrupt handler
+ * 
+ * Finishes the commands the device completed and wakes their waiters.
+ * Runs in the IRQ's thread, not in the trap.
+ */
+void virtio_gpu_irq_handler(void);
+
+/**
+ * Scroll the top of the screen up
+ * 
+ * Moves rows [0, height) up by lines rows by advancing where the ring
+ * starts, without copying pixels; the bottom lines rows of the region are
+ * left with stale contents to be drawn over. Rows below the region stay
+ * put. Changing height first puts the rows back in order.
+ * 
+ * @param height Rows in the scrolled region
+ * @param lines Rows to scroll by
+ * @return 0 on success, -1 on error (errno set)
+ */
+int virtio_gpu_scroll(uint32_t height, uint32_t lines);
+
 /**
  * Get framebuffer pointer for direct access
  * 
+ * Row y is at row y of the buffer only while nothing is scrolled; use
+ * virtio_gpu_set_pixel() otherwise. Double-buffered, this is the buffer
+ * being drawn into, and it changes at every flush.
+ * 
  * @return Pointer to framebuffer pixels, or NULL if not available
  */
 uint32_t *virtio_gpu_get_framebuffer(void);
 
+/**
+ * Get the physical address of the framebuffer
+ * 
+ * The buffer virtio_gpu_get_framebuffer() returns: fb_size bytes of
+ * contiguous pages, allocated for good.
+ * 
+ * @return Physical address, or 0 if not available
+ */
+uintptr_t virtio_gpu_get_framebuffer_phys(void);
+
 /**
  * Get framebuffer dimensions
  * 
@@ -0,0 +1,293 @@
+/**
+ * VirtIO Network Device Driver
+ *
+ * Sends and receives Ethernet frames through a VirtIO network device
+ * (QEMU's virtio-net-device, on TAP or user networking). One receive
+ * and one transmit queue; the frames are what a network stack builds
+ * and parses, without the link-layer checksum, and travel in sk_buffs
+ * the device reads and writes in place.
+ *
+ * Reference: VirtIO Specification 1.1, section 5.1
+ */
+
+#ifndef VIRTIO_NET_H
+#define VIRTIO_NET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "drivers/virtqueue.h"
+#include "net/skbuff.h"
+#include "kernel/wait_queue.h"
+
+/* VirtIO Device IDs */
+#define VIRTIO_DEVICE_ID_NET            1
+
+/* VirtIO Network Device Features */
+#define VIRTIO_NET_F_CSUM               (1ULL << 0)  // Device checksums partial packets
+#define VIRTIO_NET_F_GUEST_CSUM         (1ULL << 1)  // Driver checksums partial packets
+#define VIRTIO_NET_F_MTU                (1ULL << 3)  // Maximum MTU in config
+#define VIRTIO_NET_F_MAC                (1ULL << 5)  // MAC address in config
+#define VIRTIO_NET_F_HOST_TSO4          (1ULL << 11) // Device segments TCPv4 packets
+#define VIRTIO_NET_F_MRG_RXBUF          (1ULL << 15) // Frames may span receive buffers
+#define VIRTIO_NET_F_STATUS             (1ULL << 16) // Link status in config
+
+/* Features the driver accepts; anything else offered is declined */
+#define VIRTIO_NET_DRIVER_FEATURES \
+    (VIRTIO_NET_F_CSUM | VIRTIO_NET_F_GUEST_CSUM | VIRTIO_NET_F_MTU | \
+     VIRTIO_NET_F_MAC | VIRTIO_NET_F_HOST_TSO4 | VIRTIO_NET_F_MRG_RXBUF | \
+     VIRTIO_NET_F_STATUS | VIRTIO_RING_F_EVENT_IDX | VIRTIO_F_VERSION_1)
+
+/* virtio_net_hdr_t.flags */
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM     1   // Checksum from csum_start still to do
+#define VIRTIO_NET_HDR_F_DATA_VALID     2   // Receive: checksum already checked
+
+/* virtio_net_hdr_t.gso_type */
+#define VIRTIO_NET_HDR_GSO_NONE         0
+#define VIRTIO_NET_HDR_GSO_TCPV4        1
+
+/* virtio_net_config_t.status */
+#define VIRTIO_NET_S_LINK_UP            1
+
+/* Queue numbers */
+#define VIRTIO_NET_QUEUE_RX             0
+#define VIRTIO_NET_QUEUE_TX             1
+
+/* Ring size for both queues (must be power of 2, at most VIRTQ_MAX_SIZE) */
+#define VIRTIO_NET_QUEUE_SIZE           256
+
+/* Ethernet address and header lengths */
+#define VIRTIO_NET_ETH_ALEN             6
+#define VIRTIO_NET_ETH_HLEN             14
+
+/* Largest frame sent or delivered: 1500-byte MTU plus the Ethernet header */
+#define VIRTIO_NET_MTU                  1500
+#define VIRTIO_NET_FRAME_MAX            (VIRTIO_NET_MTU + VIRTIO_NET_ETH_HLEN)
+
+/* Largest TSO frame: a 64 KiB IP packet plus the Ethernet header */
+#define VIRTIO_NET_GSO_FRAME_MAX        (65535 + VIRTIO_NET_ETH_HLEN)
+
+/* Empty polls of the used ring before a polled wait gives up */
+#define VIRTIO_NET_POLL_SPINS           1000000
+
+/* Frames the interrupt handler takes before leaving the rest to the
+ * poller thread, and frames the poller takes per round */
+#define VIRTIO_NET_RX_IRQ_BUDGET        16
+#define VIRTIO_NET_RX_POLL_BUDGET       64
+
+/**
+ * VirtIO Network Device Configuration Space
+ * Located at offset 0x100 from MMIO base
+ */
+typedef struct {
+    uint8_t mac[VIRTIO_NET_ETH_ALEN];   // MAC address (VIRTIO_NET_F_MAC)
+    uint16_t status;                    // VIRTIO_NET_S_* (VIRTIO_NET_F_STATUS)
+    uint16_t max_virtqueue_pairs;       // Queue pairs (VIRTIO_NET_F_MQ)
+    uint16_t mtu;                       // Maximum MTU (VIRTIO_NET_F_MTU)
+} __attribute__((packed)) virtio_net_config_t;
+
+/**
+ * VirtIO Network Packet Header
+ * Precedes every frame in a buffer; all zero for a plain frame
+ */
+typedef struct {
+    uint8_t flags;              // Checksum offload flags
+    uint8_t gso_type;           // Segmentation offload type
+    uint16_t hdr_len;           // Headers before the payload (GSO)
+    uint16_t gso_size;          // Segment size (GSO)
+    uint16_t csum_start;        // Where checksumming starts
+    uint16_t csum_offset;       // Where the checksum goes, from csum_start
+    uint16_t num_buffers;       // Receive buffers the frame spans (MRG_RXBUF)
+} __attribute__((packed)) virtio_net_hdr_t;
+
+/**
+ * Frame to send
+ */
+typedef struct {
+    const void *data;           // Ethernet frame
+    uint32_t len;               // Length in bytes (at most VIRTIO_NET_FRAME_MAX)
+} virtio_net_frame_t;
+
+/**
+ * Receive callback, run from the interrupt handler or the poller thread
+ * with interrupts off
+ * @param skb Ethernet frame, data at the Ethernet header; the callback
+ *            owns it and frees it with skb_free()
+ */
+typedef void (*virtio_net_rx_t)(sk_buff_t *skb);
+
+/**
+ * End of a receive pass, run after the last frame it handed over, in the
+ * same context
+ */
+typedef void (*virtio_net_rx_done_t)(void);
+
+/**
+ * VirtIO Network Device
+ * Main driver state structure
+ */
+typedef struct {
+    uintptr_t base_addr;        // MMIO base address
+    uint32_t irq;               // Interrupt number
+    uint64_t features;          // Negotiated features
+    
+    // Link properties
+    uint8_t mac[VIRTIO_NET_ETH_ALEN];
+    uint16_t mtu;
+    uint32_t hdr_len;           // Bytes of virtio_net_hdr_t before each frame
+    
+    // Queues; tokens are the sk_buffs posted or sent
+    virtqueue_t rxq;
+    virtqueue_t txq;
+    
+    // Transmit state
+    uint32_t tx_in_flight;      // Frames the device has not sent yet
+    wait_queue_t tx_waiters;    // Senders waiting for ring space
+    
+    // Receive state
+    virtio_net_rx_t rx_handler; // Where received frames go (may be NULL)
+    virtio_net_rx_done_t rx_done; // End of each receive pass (may be NULL)
+    uint8_t irq_ready;          // Completions raise interrupts
+    uint8_t in_rx_handler;      // rx_handler running: sends must not sleep
+    uint8_t rx_polling;         // Ring handed to the poller; interrupts masked
+    struct process *rx_poller;  // Poller thread (NULL: the handler takes all)
+    wait_queue_t rx_poll_wait;  // Poller waiting for a hand-off
+    
+    // Statistics
+    uint64_t rx_packets;
+    uint64_t rx_bytes;
+    uint64_t rx_dropped;        // Frames with no handler or buffer to take them
+    uint64_t rx_errors;         // Malformed or oversized frames
+    uint64_t rx_csum_valid;     // Frames the device vouched for (GUEST_CSUM)
+    uint64_t tx_packets;
+    uint64_t tx_bytes;
+    uint64_t tx_dropped;        // Packets given to xmit but not sent
+    uint64_t tx_reaps;          // Passes that freed sent buffers
+    uint64_t tx_csum_offload;   // Packets the device checksums
+    uint64_t tx_tso;            // Packets the device segments
+    uint64_t notify_count;      // Doorbell writes (each a VM exit under QEMU)
+    uint64_t notify_skipped;    // Doorbells the device said it did not need
+    uint64_t irq_count;         // Interrupts taken
+    uint64_t rx_poll_handoffs;  // Interrupts that left the ring to the poller
+    uint64_t rx_poll_rounds;    // Poller rounds
+} virtio_net_device_t;
+
+/* Function Prototypes */
+
+/**
+ * Initialize VirtIO network device driver
+ *
+ * Fills the receive ring with buffers before the device starts.
+ *
+ * @param base_addr MMIO base address of the device
+ * @param irq Interrupt number
+ * @return 0 on success, negative on error (errno set)
+ */
+int virtio_net_init(uintptr_t base_addr, uint32_t irq);
+
+/**
+ * Check whether a network device was found
+ * @return 1 if available, 0 otherwise
+ */
+int virtio_net_available(void);
+
+/**
+ * Get the device's MAC address
+ * @param mac Output: VIRTIO_NET_ETH_ALEN bytes
+ * @return 0 on success, -1 without a device (errno set)
+ */
+int virtio_net_get_mac(uint8_t *mac);
+
+/**
+ * Check whether a feature was negotiated
+ * @param feature VIRTIO_NET_F_* bit
+ * @return 1 if there is a device and it agreed to the feature, 0 otherwise
+ */
+int virtio_net_has_feature(uint64_t feature);
+
+/**
+ * Check whether the link is up
+ * @return 1 if up (or the device does not report it), 0 if down
+ */
+int virtio_net_link_up(void);
+
+/**
+ * Transmit one packet without copying it
+ *
+ * The virtio header is pushed into the packet's headroom; the linear
+ * part and each fragment go to the device as they are. A packet with
+ * ip_summed SKB_CSUM_PARTIAL is checksummed by the device (needs
+ * VIRTIO_NET_F_CSUM), one with gso_size set is also cut into segments
+ * of that size (needs VIRTIO_NET_F_HOST_TSO4).
+ *
+ * @param skb Ethernet frame; taken over, and freed once sent or on error
+ * @return 0 once queued, -1 on error (errno set)
+ */
+int virtio_net_xmit(sk_buff_t *skb);
+
+/**
+ * Transmit several packets with one doorbell
+ *
+ * Waits for room like virtio_net_send_batch(). Invalid packets are
+ * dropped and the rest still sent; after any other failure the packets
+ * behind it are dropped.
+ *
+ * @param skbs Packets, sent in order; all taken over
+ * @param count Number of packets
+ * @return Number of packets queued; -1 if none was (errno set)
+ */
+int virtio_net_xmit_batch(sk_buff_t **skbs, uint32_t count);
+
+/**
+ * Send one frame
+ *
+ * The frame is copied, so it may be reused as soon as this returns.
+ *
+ * @param frame Ethernet frame
+ * @param len Length in bytes (at most VIRTIO_NET_FRAME_MAX)
+ * @return 0 once queued, -1 on error (errno set)
+ */
+int virtio_net_send(const void *frame, uint32_t len);
+
+/**
+ * Send several frames with one doorbell
+ *
+ * Sleeps while the ring is full if the caller is a process; otherwise
+ * polls for room.
+ *
+ * @param frames Frames, sent in order; copied, so reusable on return
+ * @param count Number of frames
+ * @return Number of frames queued; -1 if none was (errno set)
+ */
+int virtio_net_send_batch(const virtio_net_frame_t *frames, uint32_t count);
+
+/**
+ * Set where received frames go
+ *
+ * Without a handler frames are counted in rx_dropped and their buffers
+ * go straight back to the device. A frame is handed over only when a
+ * fresh buffer can take its place on the ring.
+ *
+ * @param handler Receive callback (NULL to drop)
+ */
+void virtio_net_set_rx_handler(virtio_net_rx_t handler);
+
+/**
+ * Set what runs at the end of each receive pass (receive offload
+ * flushes what it is holding here)
+ *
+ * @param done Callback (NULL for none)
+ */
+void virtio_net_set_rx_done(virtio_net_rx_done_t done);
+
+/**
+ * VirtIO network device interrupt handler
+ */
+void virtio_net_irq_handler(void);
+
+/**
+ * Get the global VirtIO network device
+ * @return Pointer to device structure, or NULL if not initialized
+ */
+virtio_net_device_t *virtio_net_get_device(void);
+
+#endif /* VIRTIO_NET_H */
@@ -0,0 +1,314 @@
+/**
+ * VirtIO MMIO Transport and Split Virtqueues
+ *
+ * Register layout, status and ring definitions shared by every VirtIO
+ * driver, and the split-ring queue the block and network drivers run
+ * their requests through: descriptor allocation, the available and used
+ * rings, doorbells and interrupt suppression.
+ *
+ * A queue does no locking of its own; its driver serializes access,
+ * with interrupts off wherever its interrupt handler touches the queue.
+ *
+ * Reference: VirtIO Specification 1.1, sections 2.6 and 4.2
+ */
+
+#ifndef VIRTQUEUE_H
+#define VIRTQUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* VirtIO MMIO Register Offsets (from base address) */
+#define VIRTIO_MMIO_MAGIC_VALUE         0x000  // Magic value ('virt')
+#define VIRTIO_MMIO_VERSION             0x004  // Device version
+#define VIRTIO_MMIO_DEVICE_ID           0x008  // Device type (2 = block)
+#define VIRTIO_MMIO_VENDOR_ID           0x00c  // Vendor ID
+#define VIRTIO_MMIO_DEVICE_FEATURES     0x010  // Device features
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014  // Device features selector
+#define VIRTIO_MMIO_DRIVER_FEATURES     0x020  // Driver features
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024  // Driver features selector
+#define VIRTIO_MMIO_QUEUE_SEL           0x030  // Queue selector
+#define VIRTIO_MMIO_QUEUE_NUM_MAX       0x034  // Maximum queue size
+#define VIRTIO_MMIO_QUEUE_NUM           0x038  // Queue size
+#define VIRTIO_MMIO_QUEUE_READY         0x044  // Queue ready
+#define VIRTIO_MMIO_QUEUE_NOTIFY        0x050  // Queue notify
+#define VIRTIO_MMIO_INTERRUPT_STATUS    0x060  // Interrupt status
+#define VIRTIO_MMIO_INTERRUPT_ACK       0x064  // Interrupt acknowledge
+#define VIRTIO_MMIO_STATUS              0x070  // Device status
+#define VIRTIO_MMIO_QUEUE_DESC_LOW      0x080  // Queue descriptor address (low)
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH     0x084  // Queue descriptor address (high)
+#define VIRTIO_MMIO_QUEUE_AVAIL_LOW     0x090  // Available ring address (low)
+#define VIRTIO_MMIO_QUEUE_AVAIL_HIGH    0x094  // Available ring address (high)
+#define VIRTIO_MMIO_QUEUE_USED_LOW      0x0a0  // Used ring address (low)
+#define VIRTIO_MMIO_QUEUE_USED_HIGH     0x0a4  // Used ring address (high)
+#define VIRTIO_MMIO_CONFIG_GENERATION   0x0fc  // Configuration generation
+#define VIRTIO_MMIO_CONFIG              0x100  // Device-specific configuration
+
+/* VirtIO Magic Value */
+#define VIRTIO_MAGIC                    0x74726976  // 'virt' in little-endian
+
+/* VirtIO Status Bits */
+#define VIRTIO_STATUS_ACKNOWLEDGE       (1 << 0)  // Guest OS has noticed device
+#define VIRTIO_STATUS_DRIVER            (1 << 1)  // Guest OS knows how to drive device
+#define VIRTIO_STATUS_DRIVER_OK         (1 << 2)  // Driver is ready
+#define VIRTIO_STATUS_FEATURES_OK       (1 << 3)  // Features negotiated successfully
+#define VIRTIO_STATUS_DEVICE_NEEDS_RESET (1 << 6) // Device experienced error
+#define VIRTIO_STATUS_FAILED            (1 << 7)  // Fatal error occurred
+
+/* Device-independent features */
+#define VIRTIO_RING_F_INDIRECT_DESC     (1ULL << 28) // Descriptor tables
+#define VIRTIO_RING_F_EVENT_IDX         (1ULL << 29) // used_event/avail_event
+#define VIRTIO_F_VERSION_1              (1ULL << 32) // Modern (non-legacy) device
+
+/* VirtIO Descriptor Flags */
+#define VIRTQ_DESC_F_NEXT               1         // This descriptor continues
+#define VIRTQ_DESC_F_WRITE              2         // Write-only (device writes)
+#define VIRTQ_DESC_F_INDIRECT           4         // Indirect descriptor
+
+/* VirtIO Used Ring Flags */
+#define VIRTQ_USED_F_NO_NOTIFY          1         // Don't notify when buffer added
+
+/* VirtIO Available Ring Flags */
+#define VIRTQ_AVAIL_F_NO_INTERRUPT      1         // Don't interrupt when buffer used
+
+/* Largest queue a driver sets up (must be power of 2) */
+#define VIRTQ_MAX_SIZE                  256
+
+/* Helper macros for MMIO register access */
+#define VIRTIO_MMIO_READ32(base, offset) \
+    (*((volatile uint32_t *)((base) + (offset))))
+
+#define VIRTIO_MMIO_WRITE32(base, offset, value) \
+    (*((volatile uint32_t *)((base) + (offset))) = (value))
+
+/**
+ * VirtQueue Descriptor
+ * Describes a single buffer in the virtqueue
+ */
+typedef struct {
+    uint64_t addr;              // Physical address
+    uint32_t len;               // Length
+    uint16_t flags;             // Flags (VIRTQ_DESC_F_*)
+    uint16_t next;              // Next descriptor index (if NEXT flag set)
+} __attribute__((packed)) virtq_desc_t;
+
+/**
+ * VirtQueue Available Ring
+ * Written by driver, read by device
+ */
+typedef struct {
+    uint16_t flags;             // Flags (VIRTQ_AVAIL_F_*)
+    uint16_t idx;               // Index of next available descriptor
+    uint16_t ring[];            // Available descriptor indices (size = queue_size)
+    // Note: 'used_event' follows ring[], at ring[queue_size]
+} __attribute__((packed)) virtq_avail_t;
+
+/**
+ * VirtQueue Used Element
+ * Single element in the used ring
+ */
+typedef struct {
+    uint32_t id;                // Descriptor chain head index
+    uint32_t len;               // Total bytes written to buffer
+} __attribute__((packed)) virtq_used_elem_t;
+
+/**
+ * VirtQueue Used Ring
+ * Written by device, read by driver
+ */
+typedef struct {
+    uint16_t flags;             // Flags (VIRTQ_USED_F_*)
+    uint16_t idx;               // Index of next used descriptor
+    virtq_used_elem_t ring[];   // Used descriptor elements (size = queue_size)
+    // Note: 'avail_event' follows ring[], at ring[queue_size]
+} __attribute__((packed)) virtq_used_t;
+
+/**
+ * VirtQueue
+ * Complete virtqueue structure with descriptor, available, and used rings
+ */
+typedef struct {
+    uintptr_t base_addr;        // MMIO base of the device it belongs to
+    uint32_t index;             // Queue number on the device
+    uint32_t queue_size;        // Number of descriptors
+    uint16_t last_seen_used;    // Last used index we've seen
+    uint8_t event_idx;          // VIRTIO_RING_F_EVENT_IDX negotiated
+    
+    // DMA-allocated rings
+    virtq_desc_t *desc;         // Descriptor ring
+    virtq_avail_t *avail;       // Available ring
+    virtq_used_t *used;         // Used ring
+    
+    // Physical addresses for device
+    uintptr_t desc_phys;
+    uintptr_t avail_phys;
+    uintptr_t used_phys;
+    
+    // Free descriptor tracking
+    uint16_t free_head;         // Head of free descriptor list
+    uint16_t num_free;          // Number of free descriptors
+    
+    // Driver's data for each chain in flight, indexed by its head
+    void *token[VIRTQ_MAX_SIZE];
+} virtqueue_t;
+
+/* used_event: the used index after which the device should interrupt */
+#define VRING_USED_EVENT(vq)  (*(volatile uint16_t *)&(vq)->avail->ring[(vq)->queue_size])
+
+/* avail_event: the avail index after which the device wants a doorbell */
+#define VRING_AVAIL_EVENT(vq) (*(volatile uint16_t *)&(vq)->used->ring[(vq)->queue_size])
+
+/* Function Prototypes */
+
+/**
+ * Reset a device and negotiate features with it
+ *
+ * Checks the magic value and device type, resets the device, sets
+ * ACKNOWLEDGE and DRIVER, offers the features both sides know and sets
+ * FEATURES_OK. Queues are set up next, then virtio_mmio_driver_ok().
+ *
+ * @param base_addr MMIO base address of the device
+ * @param device_id Expected device type (VIRTIO_DEVICE_ID_*)
+ * @param driver_features Features the driver implements
+ * @param features Output: features both sides accepted
+ * @return 0 on success, -1 on error (errno set: EVIRTIO_BADDEV if the
+ *         device is missing, of another type or refuses the features)
+ */
+int virtio_mmio_negotiate(uintptr_t base_addr, uint32_t device_id,
+                          uint64_t driver_features, uint64_t *features);
+
+/**
+ * Tell a device its driver is ready
+ *
+ * @param base_addr MMIO base address of the device
+ * @return 0 on success, -1 if the device did not accept it (errno set)
+ */
+int virtio_mmio_driver_ok(uintptr_t base_addr);
+
+/**
+ * Reset a device that could not be set up
+ *
+ * @param base_addr MMIO base address of the device
+ */
+void virtio_mmio_reset(uintptr_t base_addr);
+
+/**
+ * Read and acknowledge a device's pending interrupts
+ *
+ * Acknowledge before scanning the rings, so a completion after the scan
+ * raises a new interrupt.
+ *
+ * @param base_addr MMIO base address of the device
+ * @return Interrupt status bits that were pending
+ */
+uint32_t virtio_mmio_ack_interrupt(uintptr_t base_addr);
+
+/**
+ * Allocate a queue's rings and hand them to the device
+ *
+ * @param vq Queue to set up
+ * @param base_addr MMIO base address of the device
+ * @param index Queue number on the device
+ * @param queue_size Descriptors (power of two, at most VIRTQ_MAX_SIZE)
+ * @param event_idx Nonzero if VIRTIO_RING_F_EVENT_IDX was negotiated
+ * @return 0 on success, -1 on error (errno set: EINVAL if the device's
+ *         queue is smaller, ENOMEM)
+ */
+int virtqueue_init(virtqueue_t *vq, uintptr_t base_addr, uint32_t index,
+                   uint32_t queue_size, int event_idx);
+
+/**
+ * Allocate a chain of descriptors from the free list
+ *
+ * The chain follows the free list's links; the caller fills in each
+ * descriptor and sets VIRTQ_DESC_F_NEXT on all but the last.
+ *
+ * @param vq Queue
+ * @param head Output: first descriptor of the chain
+ * @param count Descriptors in the chain
+ * @return 0 on success, -1 if too few are free (errno set: EBUSY)
+ */
+int virtqueue_alloc_desc_chain(virtqueue_t *vq, uint16_t *head, uint32_t count);
+
+/**
+ * Return a descriptor chain to the free list
+ *
+ * @param vq Queue
+ * @param head First descriptor of the chain
+ */
+void virtqueue_free_desc_chain(virtqueue_t *vq, uint16_t head);
+
+/**
+ * Make a descriptor chain available to the device
+ *
+ * Nothing is notified; batch several and call virtqueue_kick() once.
+ *
+ * @param vq Queue
+ * @param head First descriptor of the chain
+ */
+void virtqueue_add_to_avail(virtqueue_t *vq, uint16_t head);
+
+/**
+ * Take the next chain the device has finished with
+ *
+ * @param vq Queue
+ * @param head Output: first descriptor of the chain
+ * @param len Output: bytes the device wrote into it
+ * @return 0 if a chain was taken, -1 if none is ready
+ */
+int virtqueue_get_used_buf(virtqueue_t *vq, uint16_t *head, uint32_t *len);
+
+/**
+ * Check whether the device has finished chains not yet taken
+ *
+ * @param vq Queue
+ * @return Nonzero if virtqueue_get_used_buf() would find one
+ */
+int virtqueue_has_used(virtqueue_t *vq);
+
+/**
+ * Ring the doorbell for chains added since old_idx, unless the device
+ * said it does not need it
+ *
+ * @param vq Queue
+ * @param old_idx avail->idx before the chains were added
+ * @return 1 if the doorbell was rung, 0 if it was skipped
+ */
+int virtqueue_kick(virtqueue_t *vq, uint16_t old_idx);
+
+/**
+ * Ask the device not to interrupt for this queue
+ *
+ * Only a hint: an interrupt may still come, and the queue's chains are
+ * still reaped by whoever polls it.
+ *
+ * @param vq Queue
+ */
+void virtqueue_disable_cb(virtqueue_t *vq);
+
+/**
+ * Ask for an interrupt at the next chain finished after those taken
+ *
+ * A chain finished while this was being published would not interrupt,
+ * so the caller reaps again whenever this returns nonzero.
+ *
+ * @param vq Queue
+ * @return Nonzero if finished chains are already waiting
+ */
+int virtqueue_enable_cb(virtqueue_t *vq);
+
+/**
+ * Ask for an interrupt only once most of the chains in flight finish
+ *
+ * With VIRTIO_RING_F_EVENT_IDX the interrupt comes after three quarters
+ * of them, so their completions are reaped in one batch; without it this
+ * is virtqueue_enable_cb().
+ *
+ * @param vq Queue
+ * @param in_flight Chains the device has not finished yet
+ * @return Nonzero if that many have finished already, so no interrupt
+ *         will come for them and the caller reaps now
+ */
+int virtqueue_enable_cb_delayed(virtqueue_t *vq, uint16_t in_flight);
+
+#endif /* VIRTQUEUE_H */
@@ -11,6 +11,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <kernel/constants.h>
 
 /* Maximum number of virtual terminals */
 #define VTERM_MAX_TERMINALS     6
@@ -34,6 +35,26 @@ typedef struct {
 #define VTERM_ATTR_BLINK        0x04
 #define VTERM_ATTR_REVERSE      0x08
 
+/*
+ * Lines that scrolled off the top of a terminal, oldest first
+ * 
+ * Each line is encoded in the byte ring data[] as its length in columns
+ * (trailing blanks dropped) followed by runs of cells that share their
+ * attributes: a count, the colors (fg | bg << 4), the attributes and the
+ * characters. Attributes are stored only where they change, so a line of
+ * plain text costs its characters and four bytes. start[] holds where
+ * each line begins. Line numbers and byte positions run freely and are
+ * reduced modulo VTERM_SCROLLBACK_LINES and VTERM_SCROLLBACK_BYTES; the
+ * oldest lines are dropped to make room.
+ */
+typedef struct {
+    uint8_t data[VTERM_SCROLLBACK_BYTES];
+    uint32_t start[VTERM_SCROLLBACK_LINES];
+    uint32_t first;         /* Oldest line kept */
+    uint32_t next;          /* Number of the next line pushed */
+    uint32_t pos;           /* Byte position the next line is written at */
+} vterm_scrollback_t;
+
 /* Virtual terminal state */
 typedef struct {
     /* Screen buffer */
@@ -63,6 +84,15 @@ typedef struct {
     
     /* Foreground process ID for signal delivery (Ctrl+C) */
     int fg_pid;
+    
+    /* Cells changed since last drawn: columns [dirty_start, dirty_end) of
+       each row, none when the two are equal */
+    uint8_t dirty_start[VTERM_MAX_ROWS];
+    uint8_t dirty_end[VTERM_MAX_ROWS];
+    
+    /* Scrollback, and how many lines back the display looks (0: live) */
+    vterm_scrollback_t scrollback;
+    uint32_t view_offset;
 } vterm_t;
 
 /* Keyboard input state for escape sequence processing */
@@ -73,6 +103,19 @@ typedef struct {
     int escape_len;         /* Length of escape sequence */
 } vterm_input_state_t;
 
+/* Line discipline modes (vterm_termios_t.lflag), as in termios */
+#define VTERM_ICANON            0x0002  /* Canonical: edit a line, read it whole */
+#define VTERM_ECHO              0x0008  /* Echo input to its terminal */
+
+/* ioctl() requests on the console */
+#define TCGETS                  0x5401  /* Fill the vterm_termios_t at arg */
+#define TCSETS                  0x5402  /* Take the modes from the vterm_termios_t at arg */
+
+/* Line discipline settings of a terminal (TCGETS, TCSETS) */
+typedef struct {
+    uint32_t lflag;         /* VTERM_ICANON, VTERM_ECHO */
+} vterm_termios_t;
+
 /**
  * Initialize the virtual terminal subsystem
  * 
@@ -174,9 +217,51 @@ void vterm_refresh(void);
 
 /**
  * Flush pending updates to the display
+ * 
+ * Schedules a frame: the worker thread draws the cells of the active
+ * terminal that changed since they were last drawn, then sends the
+ * framebuffer the rectangle around everything drawn since the previous
+ * frame. Frames come at most every VTERM_FRAME_US, so many flushes in a
+ * row cost one frame; none of them waits for the display. Before the
+ * worker runs, the frame is drawn at once. Output between flushes only
+ * updates the terminal buffer.
  */
 void vterm_flush(void);
 
+/**
+ * Move the active terminal's view through its scrollback
+ * 
+ * The display then shows older lines over the live screen, drawn from
+ * the scrollback when a frame is drawn; output keeps going to the
+ * terminal underneath and the view stays on the same lines. Bound to
+ * Shift+PgUp and Shift+PgDn. Does nothing without a framebuffer.
+ * 
+ * @param lines Lines further back (positive) or forward (negative)
+ * @return Lines back the view is now (0: the live screen)
+ */
+uint32_t vterm_scroll_view(int lines);
+
+/**
+ * Get the number of lines in a terminal's scrollback
+ * 
+ * @param index Terminal index (0 to VTERM_MAX_TERMINALS-1)
+ * @return Lines kept, at most VTERM_SCROLLBACK_LINES
+ */
+uint32_t vterm_scrollback_lines(int index);
+
+/**
+ * Stop drawing on the framebuffer
+ * 
+ * For a client that takes over the display (/dev/fb0). Terminals keep
+ * taking output and switching; nothing of it reaches the screen.
+ */
+void vterm_display_suspend(void);
+
+/**
+ * Take the framebuffer back and draw the whole active terminal again
+ */
+void vterm_display_resume(void);
+
 /**
  * Check if virtual terminal system is available
  * 
@@ -209,6 +294,20 @@ void vterm_draw_status_bar(void);
  */
 void vterm_putc_to(int index, char c);
 
+/**
+ * Write a buffer to a virtual terminal
+ * 
+ * Parses the whole buffer into the terminal in one pass, with nothing
+ * drawn or echoed in between, then shows it with a single flush (on the
+ * display, or one write to the UART in UART-only mode) if the terminal
+ * is active. Console writes from processes come through here.
+ * 
+ * @param index Terminal index, or -1 for the active terminal
+ * @param buf Bytes to write
+ * @param len Number of bytes
+ */
+void vterm_write(int index, const char *buf, size_t len);
+
 /**
  * Write a string to a specific virtual terminal
  * 
@@ -264,14 +363,22 @@ int vterm_get_input_terminal(void);
 /**
  * Poll for keyboard input and handle VT switching
  * 
- * This is called from timer interrupt to allow VT switching
- * even when no process is reading input. Regular characters
- * are buffered for later consumption.
+ * Called from the UART receive interrupt (or the timer interrupt where
+ * input does not interrupt) to allow VT switching even when no process
+ * is reading input. Regular characters are buffered for later
+ * consumption and wake the terminal's readers.
  * 
  * @return 1 if input was processed, 0 if no input
  */
 int vterm_poll_input(void);
 
+/**
+ * Check whether the timer has to poll for input
+ * 
+ * @return 1 until vterm_init() has set up the UART receive interrupt
+ */
+int vterm_input_needs_polling(void);
+
 /**
  * Get a character that was buffered during polling for a specific terminal
  * 
@@ -288,6 +395,86 @@ int vterm_get_buffered_input_for(int index);
  */
 int vterm_has_buffered_input_for(int index);
 
+struct poll_table;
+
+/**
+ * Poll method of a terminal's input buffer
+ * 
+ * @param index Terminal index (0 to VTERM_MAX_TERMINALS-1)
+ * @param pt Poll table to register on, or NULL
+ * @return POLLIN if input is buffered, 0 otherwise
+ */
+int vterm_input_poll(int index, struct poll_table *pt);
+
+/**
+ * Sleep until a terminal has buffered input
+ * 
+ * Input is buffered by vterm_poll_input() as it arrives, which wakes the
+ * terminal's waiters. May return early (signals); callers re-check.
+ * 
+ * @param index Terminal index (0 to VTERM_MAX_TERMINALS-1)
+ */
+void vterm_wait_input(int index);
+
+/**
+ * Read a terminal's input
+ * 
+ * In canonical mode a read stops after a newline, so it returns at most
+ * one line, and at a ^D; in raw mode it takes everything buffered.
+ * 
+ * @param index Terminal index (0 to VTERM_MAX_TERMINALS-1)
+ * @param buf Kernel buffer to fill
+ * @param count Bytes wanted (more than 0)
+ * @return Bytes read, 0 at end of file (^D on an empty line), or -1 if
+ *         nothing is buffered
+ */
+int vterm_read_input(int index, char *buf, size_t count);
+
+/**
+ * Feed a character to a terminal's line discipline as if typed
+ * 
+ * @param index Terminal index (0 to VTERM_MAX_TERMINALS-1)
+ * @param c Character
+ */
+void vterm_input_char(int index, char c);
+
+/**
+ * Get a terminal's line discipline settings
+ * 
+ * @param index Terminal index (0 to VTERM_MAX_TERMINALS-1)
+ * @param termios Output structure
+ * @return 0 on success, -1 on error (errno set)
+ * 
+ * @errno THUNDEROS_EINVAL - No such terminal
+ */
+int vterm_get_termios(int index, vterm_termios_t *termios);
+
+/**
+ * Change a terminal's line discipline settings
+ * 
+ * Leaving canonical mode makes the line being edited readable as it is.
+ * 
+ * @param index Terminal index (0 to VTERM_MAX_TERMINALS-1)
+ * @param termios New settings (unknown lflag bits are ignored)
+ * @return 0 on success, -1 on error (errno set)
+ * 
+ * @errno THUNDEROS_EINVAL - No such terminal
+ */
+int vterm_set_termios(int index, const vterm_termios_t *termios);
+
+/**
+ * Console ioctl(): TCGETS and TCSETS
+ * 
+ * @param index Terminal index, or -1 for the active terminal
+ * @param request Request number
+ * @param arg User address of a vterm_termios_t
+ * @return 0 on success, -1 on error (errno set)
+ * 
+ * @errno THUNDEROS_ENOTTY - Unknown request, or no virtual terminals
+ * @errno THUNDEROS_EFAULT - arg is not accessible
+ */
+int vterm_ioctl(int index, uint32_t request, uint64_t arg);
+
 /**
  * Get a character that was buffered during polling
  * 
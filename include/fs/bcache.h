@@ -0,0 +1,175 @@
+/*
+ * bcache.h - Block buffer cache
+ *
+ * Caches filesystem blocks in memory, keyed by (device, block number),
+ * so bitmaps, inode tables and indirect blocks that every operation
+ * touches are read from the device once. All ext2 block I/O goes through
+ * here:
+ *
+ *   buf_t *b = bread(fs->device, block, fs->block_size);
+ *   if (!b) return -1;            // errno set
+ *   ... read or modify b->data ...
+ *   bwrite(b);                    // only if modified
+ *   brelse(b);
+ *
+ * bwrite() only marks the buffer dirty. Dirty buffers reach the device
+ * when evicted, once more than BCACHE_DIRTY_LIMIT are dirty, and on
+ * bcache_sync(), so a block changed several times by one operation is
+ * written once. bcache_sync() hands everything it writes to the block
+ * request queue at once, which sends runs of consecutive blocks as single
+ * device requests; bread_ahead() does the same for reads of a run the
+ * caller is about to bread() block by block. Buffers are evicted least recently used first once
+ * BCACHE_MAX_BUFFERS are cached or memory runs low, and never while
+ * referenced.
+ *
+ * Device I/O sleeps until the device interrupt. Everything else runs
+ * under the big kernel lock without sleeping; a buffer under I/O is
+ * marked busy, and bread()/bget() wait for it, so a buffer is never
+ * handed out half read. Keeping a multi-block update consistent is up
+ * to the filesystem, which serialises its own operations.
+ *
+ * A journaling filesystem bhold()s the buffers a transaction changes
+ * instead of bwrite()ing them: a held buffer is never written to its
+ * home location, however dirty, until bunhold() once the transaction is
+ * safely in the log.
+ */
+
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include "drivers/blk_queue.h"
+
+/* Buffers kept before unreferenced ones are evicted */
+#define BCACHE_MAX_BUFFERS 128
+
+/* Dirty buffers allowed before bwrite() flushes them all */
+#define BCACHE_DIRTY_LIMIT 32
+
+/* Most consecutive blocks one bread_ahead() pass queues together */
+#define BCACHE_MAX_MERGE 16
+
+/* buf_t flags */
+#define BUF_VALID  0x1             /* data holds the block's contents */
+#define BUF_DIRTY  0x2             /* data is newer than the device */
+#define BUF_BUSY   0x4             /* device I/O in flight */
+#define BUF_REDIRTY 0x8            /* modified again during a write */
+#define BUF_HELD   0x10            /* changed by an uncommitted transaction */
+
+/**
+ * Cached block
+ */
+typedef struct buf {
+    void *device;                  /* Block device handle */
+    uint32_t block;                /* Block number */
+    uint32_t size;                 /* Block size in bytes */
+    uint32_t flags;                /* BUF_* */
+    uint32_t refcount;             /* Holders between bread() and brelse() */
+    uint8_t *data;                 /* Block contents */
+    struct buf *hash_next;         /* Hash chain */
+    struct buf *lru_prev;          /* Toward more recently used */
+    struct buf *lru_next;          /* Toward less recently used */
+    blk_io_t io;                   /* Device I/O while BUF_BUSY */
+} buf_t;
+
+/**
+ * Block cache statistics
+ */
+typedef struct {
+    uint32_t buffers;      /* Buffers currently cached */
+    uint32_t dirty;        /* Of those, newer than the device */
+    uint32_t held;         /* Of those, held back by a transaction */
+    uint32_t hits;         /* Requests served from memory */
+    uint32_t misses;       /* Requests that read the device */
+    uint32_t writes;       /* Blocks written to the device */
+    uint32_t evictions;    /* Buffers dropped to stay under the limit or by reclaim */
+} bcache_stats_t;
+
+/**
+ * Get a block, reading it from the device on a miss
+ *
+ * @param device   Block device handle
+ * @param block    Block number
+ * @param size     Block size in bytes (a multiple of SECTOR_SIZE)
+ * @return Buffer with a reference held for the caller (drop it with
+ *         brelse()), or NULL on error (errno set)
+ */
+buf_t *bread(void *device, uint32_t block, uint32_t size);
+
+/**
+ * Get a block the caller will overwrite entirely, without reading it
+ *
+ * The contents are undefined unless BUF_VALID is set; fill all of data,
+ * then bwrite().
+ *
+ * @param device   Block device handle
+ * @param block    Block number
+ * @param size     Block size in bytes
+ * @return Buffer with a reference held for the caller, or NULL on error
+ *         (errno set)
+ */
+buf_t *bget(void *device, uint32_t block, uint32_t size);
+
+/**
+ * Read the uncached blocks of a run into the cache ahead of bread()
+ *
+ * Missing blocks are fetched with as few device requests as their
+ * layout allows; blocks already cached are left alone and no reference
+ * is kept. Best effort: a block that fails here is read again by bread().
+ *
+ * @param device   Block device handle
+ * @param block    First block number
+ * @param count    Number of consecutive blocks
+ * @param size     Block size in bytes
+ * @return 0 on success, -1 if any read failed (errno set)
+ */
+int bread_ahead(void *device, uint32_t block, uint32_t count, uint32_t size);
+
+/**
+ * Mark a buffer modified; it is written back later
+ *
+ * @param b        Buffer from bread() or bget()
+ */
+void bwrite(buf_t *b);
+
+/**
+ * Keep a modified buffer from being written back until bunhold()
+ *
+ * Takes a reference of its own. Holding a held buffer again is a no-op.
+ * Held buffers do not count toward BCACHE_DIRTY_LIMIT, since nothing
+ * can write them.
+ *
+ * @param b        Buffer from bread() or bget(), already modified
+ */
+void bhold(buf_t *b);
+
+/**
+ * Release a bhold(): the buffer is marked dirty and written back later
+ *
+ * @param b        Held buffer
+ */
+void bunhold(buf_t *b);
+
+/**
+ * Drop a reference taken by bread() or bget()
+ *
+ * @param b        Buffer (NULL is a no-op)
+ */
+void brelse(buf_t *b);
+
+/**
+ * Write every dirty buffer that is not held to the device
+ *
+ * @return 0 on success, -1 if any write failed (errno set; those buffers
+ *         stay dirty)
+ */
+int bcache_sync(void);
+
+/**
+ * Get block cache statistics
+ *
+ * @param stats    Output structure
+ */
+void bcache_get_stats(bcache_stats_t *stats);
+
+#endif /* BCACHE_H */
@@ -0,0 +1,79 @@
+/*
+ * dcache.h - Directory entry cache
+ *
+ * Remembers the result of looking up a name in a directory, keyed by
+ * (filesystem, directory inode, name), so resolving a path that was
+ * resolved before walks memory instead of reading directories and inodes
+ * from disk. A positive entry holds a reference to the node it found; a
+ * negative entry records that the name does not exist, so repeated
+ * lookups of missing files (PATH searches, O_CREAT checks) are cheap too.
+ *
+ * The least recently used entry is dropped once DCACHE_MAX_ENTRIES are
+ * cached, and under memory pressure (mm/reclaim.h). Its node lives on
+ * for as long as a descriptor or mapping still references it. Everything that adds or removes a name must invalidate
+ * the entry for it; vfs.c does so around the create, mkdir, unlink and
+ * rmdir operations.
+ */
+
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <stdint.h>
+#include "vfs.h"
+
+/* Entries (positive and negative) kept before the oldest is dropped */
+#define DCACHE_MAX_ENTRIES 256
+
+/**
+ * Dentry cache statistics
+ */
+typedef struct {
+    uint32_t entries;      /* Entries currently cached */
+    uint32_t negative;     /* Of those, names known not to exist */
+    uint32_t hits;         /* Lookups answered from the cache */
+    uint32_t misses;       /* Lookups passed to the filesystem */
+    uint32_t evictions;    /* Entries dropped to stay under the limit or by reclaim */
+} dcache_stats_t;
+
+/**
+ * Look up a name in a directory, asking the filesystem on a miss
+ *
+ * @param dir      Directory node
+ * @param name     Component name
+ * @return Node with a reference held for the caller (drop it with
+ *         vfs_node_put()), or NULL (errno set; THUNDEROS_ENOENT for a
+ *         name that does not exist)
+ */
+vfs_node_t *dcache_lookup(vfs_node_t *dir, const char *name);
+
+/**
+ * Forget what is cached for one name (it was created or removed)
+ *
+ * @param dir      Directory node
+ * @param name     Component name
+ */
+void dcache_invalidate(vfs_node_t *dir, const char *name);
+
+/**
+ * Forget every entry in a directory (it was removed)
+ *
+ * @param fs       Filesystem of the directory
+ * @param inode    Inode number of the directory
+ */
+void dcache_invalidate_dir(vfs_filesystem_t *fs, uint32_t inode);
+
+/**
+ * Forget every entry of a filesystem (it is no longer mounted)
+ *
+ * @param fs       Filesystem
+ */
+void dcache_invalidate_fs(vfs_filesystem_t *fs);
+
+/**
+ * Get dentry cache statistics
+ *
+ * @param stats    Output structure
+ */
+void dcache_get_stats(dcache_stats_t *stats);
+
+#endif /* DCACHE_H */
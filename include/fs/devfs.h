@@ -0,0 +1,51 @@
+/*
+ * devfs.h - Device filesystem
+ *
+ * One flat directory, mounted on /dev, listing the device nodes drivers
+ * registered. A node (VFS_TYPE_DEVICE) carries its driver's operations:
+ * open and close to claim and let go of the device, read and write for
+ * byte streams, map_page for devices whose memory mmap() can map (which
+ * must be MAP_SHARED and within the node's size) and ioctl for anything
+ * else. The device memory belongs to the driver; a mapping only holds
+ * page references.
+ *
+ * There is one devfs, made on first use, so drivers may register before
+ * or after it is mounted. Nodes are never removed. Operations run under
+ * the big kernel lock.
+ */
+
+#ifndef DEVFS_H
+#define DEVFS_H
+
+#include <stdint.h>
+#include "vfs.h"
+
+/* Inode number of the root directory */
+#define DEVFS_ROOT_INO 1
+
+/* Mode of the root directory (rwxr-xr-x) */
+#define DEVFS_ROOT_MODE 0755
+
+/**
+ * Add a device node to /dev
+ *
+ * @param name Node name (no '/')
+ * @param mode Permission bits
+ * @param ops  Driver operations (kept, not copied)
+ * @param size Bytes mmap() may map from offset 0 (0 for none)
+ * @param data Driver data, left in the node's fs_data
+ * @return Node, or NULL on error (errno set: EEXIST if the name is taken)
+ */
+vfs_node_t *devfs_register(const char *name, uint16_t mode, vfs_ops_t *ops,
+                           uint64_t size, void *data);
+
+/**
+ * Get the device filesystem
+ *
+ * Mount it with vfs_mount().
+ *
+ * @return Filesystem, or NULL on error (errno set)
+ */
+vfs_filesystem_t *devfs_mount(void);
+
+#endif /* DEVFS_H */
@@ -10,6 +10,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "kernel/mutex.h"
 
 /* ext2 magic number */
 #define EXT2_SUPER_MAGIC 0xEF53
@@ -27,6 +28,11 @@
 #define EXT2_GOOD_OLD_FIRST_INO 11 /* First non-reserved inode */
 #define EXT2_INODE_SIZE 128       /* Standard inode size */
 
+/* Inodes whose table blocks one ext2_prefetch_inodes() call reads, and
+ * the gap between two it still reads as one run */
+#define EXT2_INODE_PREFETCH_MAX 64
+#define EXT2_INODE_PREFETCH_GAP 2
+
 /* Number of block pointers in inode */
 #define EXT2_NDIR_BLOCKS 12      /* Direct blocks */
 #define EXT2_IND_BLOCK 12        /* Indirect block */
@@ -82,6 +88,45 @@
 /* Maximum filename length */
 #define EXT2_NAME_LEN 255
 
+/* Revision levels: features and s_first_ino onwards exist from EXT2_DYNAMIC_REV */
+#define EXT2_GOOD_OLD_REV 0
+#define EXT2_DYNAMIC_REV  1
+
+/* Regular files may pass 2 GiB: i_size_high holds the top 32 bits of their size */
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE 0x0002  /* s_feature_ro_compat */
+
+/* Largest size without EXT2_FEATURE_RO_COMPAT_LARGE_FILE */
+#define EXT2_SMALL_FILE_MAX 0x7FFFFFFFu
+
+/* Incompatible features this driver understands; others refuse the mount */
+#define EXT2_FEATURE_INCOMPAT_FILETYPE 0x0002  /* Directory entries carry a file type */
+#define EXT4_FEATURE_INCOMPAT_EXTENTS  0x0040  /* Some files are mapped by extents */
+#define EXT3_FEATURE_INCOMPAT_RECOVER  0x0004  /* The journal may hold unreplayed transactions */
+#define EXT4_FEATURE_INCOMPAT_FLEX_BG  0x0200  /* Group metadata may sit in other groups */
+#define EXT2_FEATURE_INCOMPAT_SUPPORTED (EXT2_FEATURE_INCOMPAT_FILETYPE | \
+                                         EXT3_FEATURE_INCOMPAT_RECOVER | \
+                                         EXT4_FEATURE_INCOMPAT_EXTENTS | \
+                                         EXT4_FEATURE_INCOMPAT_FLEX_BG)
+
+/* Metadata journal (from ext3) in the inode s_journal_inum, see ext2_journal.h */
+#define EXT3_FEATURE_COMPAT_HAS_JOURNAL 0x0004  /* s_feature_compat */
+
+/* Extent trees (from ext4): i_block holds the root of a tree of block runs */
+#define EXT4_EXTENTS_FL        0x00080000  /* i_flags: file is mapped by extents */
+#define EXT4_EXT_MAGIC         0xF30A      /* eh_magic */
+#define EXT4_EXT_MAX_DEPTH     5           /* Deepest tree accepted */
+#define EXT4_EXT_INIT_MAX_LEN  32768       /* ee_len past this: uninitialized (reads as zeros) */
+
+/* Hashed directory indexes (htree, from ext3) */
+#define EXT2_FEATURE_COMPAT_DIR_INDEX 0x0020  /* s_feature_compat */
+#define EXT2_INDEX_FL                 0x1000  /* i_flags: directory has a valid htree */
+#define EXT2_FLAGS_SIGNED_HASH        0x0001  /* s_flags: names hashed as signed char */
+#define EXT2_FLAGS_UNSIGNED_HASH      0x0002  /* s_flags: names hashed as unsigned char */
+
+/* Directories whose in-memory index is kept at once, per filesystem */
+#define EXT2_DIR_INDEX_MAX     16
+#define EXT2_DIR_INDEX_BUCKETS 256
+
 /**
  * ext2 superblock structure
  * Located at byte offset 1024 from start of partition
@@ -136,7 +181,23 @@ typedef struct {
     uint32_t s_journal_dev;         /* Device number of journal file */
     uint32_t s_last_orphan;         /* Head of orphan inode list */
     
-    uint32_t s_reserved[197];       /* Padding to 1024 bytes */
+    /* Directory indexing and later ext3/ext4 fields */
+    uint32_t s_hash_seed[4];        /* Seed for htree name hashes */
+    uint8_t  s_def_hash_version;    /* Hash for new indexed directories */
+    uint8_t  s_jnl_backup_type;
+    uint16_t s_desc_size;
+    uint32_t s_default_mount_opts;
+    uint32_t s_first_meta_bg;
+    uint32_t s_mkfs_time;
+    uint32_t s_jnl_blocks[17];
+    uint32_t s_blocks_count_hi;
+    uint32_t s_r_blocks_count_hi;
+    uint32_t s_free_blocks_hi;
+    uint16_t s_min_extra_isize;
+    uint16_t s_want_extra_isize;
+    uint32_t s_flags;               /* EXT2_FLAGS_* */
+    
+    uint32_t s_reserved[167];       /* Padding to 1024 bytes */
 } __attribute__((packed)) ext2_superblock_t;
 
 /**
@@ -161,7 +222,7 @@ typedef struct {
 typedef struct {
     uint16_t i_mode;                /* File mode (type + permissions) */
     uint16_t i_uid;                 /* Owner UID */
-    uint32_t i_size;                /* File size in bytes */
+    uint32_t i_size;                /* File size in bytes (low 32 bits) */
     uint32_t i_atime;               /* Access time */
     uint32_t i_ctime;               /* Creation time */
     uint32_t i_mtime;               /* Modification time */
@@ -174,11 +235,72 @@ typedef struct {
     uint32_t i_block[EXT2_N_BLOCKS]; /* Block pointers */
     uint32_t i_generation;          /* File version (for NFS) */
     uint32_t i_file_acl;            /* File ACL */
-    uint32_t i_dir_acl;             /* Directory ACL */
+    uint32_t i_size_high;           /* Regular files: top 32 bits of the size */
     uint32_t i_faddr;               /* Fragment address */
     uint8_t  i_osd2[12];            /* OS-dependent 2 */
 } __attribute__((packed)) ext2_inode_t;
 
+/**
+ * Extent tree node header
+ * At the start of i_block (the root) and of every tree block
+ */
+typedef struct {
+    uint16_t eh_magic;              /* EXT4_EXT_MAGIC */
+    uint16_t eh_entries;            /* Entries in use */
+    uint16_t eh_max;                /* Entries that fit */
+    uint16_t eh_depth;              /* 0 for a leaf, else levels below */
+    uint32_t eh_generation;
+} __attribute__((packed)) ext4_extent_header_t;
+
+/**
+ * Leaf entry: a run of file blocks stored in consecutive disk blocks
+ */
+typedef struct {
+    uint32_t ee_block;              /* First file block */
+    uint16_t ee_len;                /* Blocks (past EXT4_EXT_INIT_MAX_LEN: uninitialized) */
+    uint16_t ee_start_hi;           /* First disk block, high 16 bits */
+    uint32_t ee_start_lo;           /* First disk block, low 32 bits */
+} __attribute__((packed)) ext4_extent_t;
+
+/**
+ * Index entry: the node covering file blocks from ei_block on
+ */
+typedef struct {
+    uint32_t ei_block;              /* First file block it covers */
+    uint32_t ei_leaf_lo;            /* Child node block, low 32 bits */
+    uint16_t ei_leaf_hi;            /* Child node block, high 16 bits */
+    uint16_t ei_unused;
+} __attribute__((packed)) ext4_extent_idx_t;
+
+/* Indirect blocks an ext2_map_cache_t remembers */
+#define EXT2_MAP_CACHE_INDIRECT 4
+
+/**
+ * Block-map indirect block holding the disk blocks of a stretch of a file
+ */
+typedef struct {
+    uint32_t file_block;            /* First file block it maps */
+    uint32_t block;                 /* The indirect block (0: slot unused) */
+} ext2_map_indirect_t;
+
+/**
+ * What the last lookups of a file's blocks found
+ *
+ * Kept by the caller of ext2_read_file()/ext2_write_file() for each
+ * in-memory inode. Blocks inside the last run looked up (consecutive file
+ * blocks in consecutive disk blocks, or a hole) are mapped without
+ * walking the inode's block map or extent tree again. For block-mapped
+ * inodes the last few indirect blocks that cover data blocks are kept
+ * too, so a lookup past the run reads one block instead of up to three.
+ */
+typedef struct {
+    uint32_t file_block;            /* First file block of the run */
+    uint32_t count;                 /* Blocks in the run (0: nothing cached) */
+    uint32_t disk_block;            /* Disk block of file_block (0: a hole) */
+    ext2_map_indirect_t indirect[EXT2_MAP_CACHE_INDIRECT];
+    uint32_t next_indirect;         /* Slot to replace next */
+} ext2_map_cache_t;
+
 /**
  * ext2 directory entry
  * Variable length structure
@@ -202,7 +324,14 @@ typedef struct {
     uint32_t num_groups;            /* Number of block groups */
     uint32_t inodes_per_block;      /* Inodes that fit in one block */
     uint32_t desc_per_block;        /* Group descriptors per block */
+    uint64_t max_file_size;         /* Largest file the block map can hold */
     void *device;                   /* Block device handle */
+    struct buf **block_bitmaps;     /* Per group, pinned once first used */
+    struct buf **inode_bitmaps;
+    struct ext2_dir_index *dir_indexes; /* In-memory directory indexes, most recent first */
+    mutex_t lock;                   /* Held across each VFS operation */
+    uint32_t lock_depth;            /* Nesting of the holder's operations */
+    struct ext2_journal *journal;   /* Metadata journal (NULL: changes go straight to disk) */
 } ext2_fs_t;
 
 /* Function declarations */
@@ -230,18 +359,136 @@ int ext2_read_inode(ext2_fs_t *fs, uint32_t inode_num, ext2_inode_t *inode);
  */
 int ext2_write_inode(ext2_fs_t *fs, uint32_t inode_num, ext2_inode_t *inode);
 
+/**
+ * Read the inode-table blocks of several inodes into the block cache
+ * ahead of ext2_read_inode(), merging neighbouring blocks into single
+ * device requests (best effort, at most EXT2_INODE_PREFETCH_MAX inodes)
+ */
+void ext2_prefetch_inodes(ext2_fs_t *fs, const uint32_t *inodes, uint32_t count);
+
+/**
+ * Write the in-memory superblock back (through the block cache)
+ * Returns 0 on success, -1 on error
+ */
+int ext2_write_super(ext2_fs_t *fs);
+
+/**
+ * Read the superblock and group descriptors again through the block
+ * cache (after journal replay changed them)
+ * Returns 0 on success, -1 on error
+ */
+int ext2_reload_super(ext2_fs_t *fs);
+
+/**
+ * Write a group's descriptor back (through the block cache, journaled)
+ * Returns 0 on success, -1 on error
+ */
+int ext2_write_group_desc(ext2_fs_t *fs, uint32_t group);
+
+/**
+ * Size of an inode's file in bytes (i_size_high counts for regular files only)
+ */
+uint64_t ext2_inode_size(const ext2_inode_t *inode);
+
+/**
+ * Set the size of an inode's file
+ * A size past EXT2_SMALL_FILE_MAX turns on EXT2_FEATURE_RO_COMPAT_LARGE_FILE.
+ * Returns 0 on success, -1 on error (THUNDEROS_EFBIG past max_file_size)
+ */
+int ext2_inode_set_size(ext2_fs_t *fs, ext2_inode_t *inode, uint64_t size);
+
 /**
  * Read data from a file
+ * map caches the last run of blocks mapped (NULL: none kept between calls)
  * Returns number of bytes read, or -1 on error
  */
-int ext2_read_file(ext2_fs_t *fs, ext2_inode_t *inode, uint32_t offset, 
-                   void *buffer, uint32_t size);
+int ext2_read_file(ext2_fs_t *fs, ext2_inode_t *inode, ext2_map_cache_t *map,
+                   uint64_t offset, void *buffer, uint32_t size);
+
+/**
+ * Find the disk block holding a file block (0 for a hole)
+ * map caches the run found, as for ext2_read_file()
+ * Returns 0 on success, -1 on error
+ */
+int ext2_map_block(ext2_fs_t *fs, ext2_inode_t *inode, ext2_map_cache_t *map,
+                   uint32_t file_block, uint32_t *block_num);
+
+/**
+ * Forget everything a map cache holds (after the inode's blocks change)
+ */
+void ext2_map_cache_reset(ext2_map_cache_t *map);
+
+/**
+ * Find the extent, or the hole, holding a file block of an extent-mapped inode
+ * The run from file_block on is stored in *run. If uninit is NULL an
+ * uninitialized extent is reported as a hole, else *uninit says whether it is one.
+ * Returns 0 on success, -1 on error (THUNDEROS_EFS_CORRUPT for a bad tree)
+ */
+int ext2_extent_map(ext2_fs_t *fs, ext2_inode_t *inode, uint32_t file_block,
+                    ext2_map_cache_t *run, int *uninit);
+
+/**
+ * Map a file block of an extent-mapped inode to a newly allocated disk block
+ * Grows the last extent when the blocks are consecutive; splits tree nodes
+ * (allocating them near disk_block) when one is full.
+ * Returns 0 on success, -1 on error
+ */
+int ext2_extent_insert(ext2_fs_t *fs, ext2_inode_t *inode, uint32_t file_block,
+                       uint32_t disk_block);
+
+/**
+ * Zero the uninitialized extent holding a file block and mark it initialized
+ * Returns 0 on success, -1 on error
+ */
+int ext2_extent_initialize(ext2_fs_t *fs, ext2_inode_t *inode, uint32_t file_block);
+
+/**
+ * Free every block of an extent-mapped inode, tree blocks included
+ * Leaves an empty root. Returns 0 on success, -1 on error
+ */
+int ext2_extent_free(ext2_fs_t *fs, ext2_inode_t *inode);
 
 /**
  * Lookup a file in a directory by name
+ * Uses the directory's in-memory index, building it on first use; an
+ * htree directory not indexed yet is searched through its hash tree.
  * Returns inode number on success, 0 if not found
  */
-uint32_t ext2_lookup(ext2_fs_t *fs, ext2_inode_t *dir_inode, const char *name);
+uint32_t ext2_lookup(ext2_fs_t *fs, uint32_t dir_inode_num, ext2_inode_t *dir_inode,
+                     const char *name);
+
+/**
+ * Directory entry callback for ext2_iterate_dir()
+ * name is null-terminated. Returns 0 to take the entry and go on, non-zero
+ * to stop without taking it.
+ */
+typedef int (*ext2_filldir_t)(void *ctx, const char *name, uint32_t name_len, uint32_t inode);
+
+/**
+ * Pass a directory's entries, starting at byte offset *pos, to fill in
+ * directory order until it stops or the directory ends
+ * *pos is left past the last entry taken, so the next call resumes there.
+ * Returns 0 on success, -1 on error
+ */
+int ext2_iterate_dir(ext2_fs_t *fs, uint32_t dir_inode_num, ext2_inode_t *dir_inode,
+                     uint32_t *pos, ext2_filldir_t fill, void *ctx);
+
+/**
+ * Keep a directory's in-memory index in step with an entry added on disk
+ * at byte offset offset (no-op if the directory is not indexed)
+ */
+void ext2_dir_index_add(ext2_fs_t *fs, uint32_t dir_inode_num, const char *name,
+                        uint32_t offset, uint32_t inode, uint8_t file_type);
+
+/**
+ * Keep a directory's in-memory index in step with an entry removed on disk
+ */
+void ext2_dir_index_remove(ext2_fs_t *fs, uint32_t dir_inode_num, const char *name);
+
+/**
+ * Forget a directory's in-memory index (0 forgets every directory's)
+ */
+void ext2_dir_index_drop(ext2_fs_t *fs, uint32_t dir_inode_num);
 
 /**
  * List directory contents
@@ -254,10 +501,19 @@ int ext2_list_dir(ext2_fs_t *fs, ext2_inode_t *dir_inode, ext2_dir_callback_t ca
 /* Write operations */
 
 /**
- * Allocate a block from block bitmap
+ * Allocate a run of consecutive blocks
+ * Starts at goal if it is free, else at the next free block after it
+ * (wrapping around the filesystem), and extends while blocks stay free.
+ * Sets *allocated to the run length (1 to count).
+ * Returns the first block number, or 0 on failure
+ */
+uint32_t ext2_alloc_blocks(ext2_fs_t *fs, uint32_t goal, uint32_t count, uint32_t *allocated);
+
+/**
+ * Allocate one block, as close after goal as possible (0 for no goal)
  * Returns block number, or 0 on failure
  */
-uint32_t ext2_alloc_block(ext2_fs_t *fs, uint32_t group);
+uint32_t ext2_alloc_block(ext2_fs_t *fs, uint32_t goal);
 
 /**
  * Free a block to block bitmap
@@ -277,12 +533,23 @@ uint32_t ext2_alloc_inode(ext2_fs_t *fs, uint32_t group);
  */
 int ext2_free_inode(ext2_fs_t *fs, uint32_t inode_num);
 
+/**
+ * Set up bitmap pinning at mount
+ * Returns 0 on success, -1 on error
+ */
+int ext2_bitmaps_init(ext2_fs_t *fs);
+
+/**
+ * Drop the references pinning the bitmaps, at unmount
+ */
+void ext2_bitmaps_release(ext2_fs_t *fs);
+
 /**
  * Write data to a file
  * Returns number of bytes written, or -1 on error
  */
-int ext2_write_file(ext2_fs_t *fs, ext2_inode_t *inode, uint32_t offset,
-                    const void *buffer, uint32_t size);
+int ext2_write_file(ext2_fs_t *fs, ext2_inode_t *inode, ext2_map_cache_t *map,
+                    uint64_t offset, const void *buffer, uint32_t size);
 
 /**
  * Create a new file in a directory
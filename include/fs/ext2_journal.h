@@ -0,0 +1,181 @@
+/*
+ * ext2_journal.h - ext3-style metadata journal
+ *
+ * A filesystem with EXT3_FEATURE_COMPAT_HAS_JOURNAL keeps a log in the
+ * inode s_journal_inum, in the format the Linux JBD2 layer uses (all
+ * fields big-endian). Metadata changes (bitmaps, group descriptors, inode
+ * tables, indirect and extent blocks, directory blocks, the superblock)
+ * are collected into a running transaction instead of being written in
+ * place: ext2_journal_dirty() takes over from bwrite() and bhold()s the
+ * buffer. A commit writes, in order:
+ *
+ *   1. every other dirty block, file data included (ordered mode: data
+ *      is on disk before metadata that points at it)
+ *   2. a descriptor block naming the transaction's blocks, copies of
+ *      them and a revoke block, as one sequential batch, then a flush
+ *   3. the commit block, then a flush
+ *
+ * after which the buffers are let go and reach their home locations with
+ * ordinary write-back (lazy checkpointing). Operations join the running
+ * transaction until it fills or a commit interval passes (group commit),
+ * so many creates share one descriptor, one commit block and two
+ * flushes. Once the log runs low everything is written home and the log
+ * starts over from its first block.
+ *
+ * At mount, committed transactions still in the log are copied home
+ * before anything else reads the filesystem. A block freed after being
+ * journaled is revoked, so replay cannot overwrite what it holds now.
+ *
+ * Everything here runs under the filesystem lock. Checksums, 64-bit
+ * block numbers and asynchronous commits are not supported: a journal
+ * using them refuses the mount if it needs replay, and is left unused
+ * otherwise.
+ */
+
+#ifndef EXT2_JOURNAL_H
+#define EXT2_JOURNAL_H
+
+#include <stdint.h>
+#include "ext2.h"
+#include "bcache.h"
+
+/* Block header magic, and the block types it starts */
+#define JBD2_MAGIC_NUMBER        0xC03B3998u
+#define JBD2_DESCRIPTOR_BLOCK    1
+#define JBD2_COMMIT_BLOCK        2
+#define JBD2_SUPERBLOCK_V1       3
+#define JBD2_SUPERBLOCK_V2       4
+#define JBD2_REVOKE_BLOCK        5
+
+/* Descriptor tag flags */
+#define JBD2_FLAG_ESCAPE         0x1   /* Block started with the magic, stored zeroed */
+#define JBD2_FLAG_SAME_UUID      0x2   /* No UUID follows the tag */
+#define JBD2_FLAG_DELETED        0x4
+#define JBD2_FLAG_LAST_TAG       0x8   /* Last tag of the descriptor */
+
+/* Journal superblock incompatible features */
+#define JBD2_FEATURE_INCOMPAT_REVOKE 0x1
+#define JBD2_FEATURE_INCOMPAT_SUPPORTED JBD2_FEATURE_INCOMPAT_REVOKE
+
+/* Most buffers one transaction holds; it commits early once full */
+#define EXT2_JOURNAL_MAX_BUFFERS 64
+
+/* Most revoked blocks one transaction holds (one 1 KiB revoke block) */
+#define EXT2_JOURNAL_MAX_REVOKES 248
+
+/* Log blocks one commit can need: descriptor, copies, revoke, commit */
+#define EXT2_JOURNAL_RESERVE     (EXT2_JOURNAL_MAX_BUFFERS + 3)
+
+/* Home blocks remembered as being in the log, for revoking */
+#define EXT2_JOURNAL_LOGGED      1024
+
+/* Longest a change waits in the running transaction (microseconds) */
+#define EXT2_JOURNAL_COMMIT_INTERVAL_US 5000000
+
+/**
+ * Header starting every journal metadata block
+ */
+typedef struct {
+    uint32_t h_magic;               /* JBD2_MAGIC_NUMBER */
+    uint32_t h_blocktype;           /* JBD2_*_BLOCK */
+    uint32_t h_sequence;            /* Transaction the block belongs to */
+} jbd2_header_t;
+
+/**
+ * Journal superblock (first block of the journal)
+ */
+typedef struct {
+    jbd2_header_t s_header;
+    uint32_t s_blocksize;           /* Journal block size */
+    uint32_t s_maxlen;              /* Blocks in the journal */
+    uint32_t s_first;               /* First log block */
+    uint32_t s_sequence;            /* First transaction expected in the log */
+    uint32_t s_start;               /* Log block of that transaction (0: log empty) */
+    uint32_t s_errno;
+    uint32_t s_feature_compat;
+    uint32_t s_feature_incompat;
+    uint32_t s_feature_ro_compat;
+    uint8_t  s_uuid[16];
+} jbd2_superblock_t;
+
+/**
+ * Descriptor tag: one journaled block (a UUID follows the first)
+ */
+typedef struct {
+    uint32_t t_blocknr;             /* Home location */
+    uint16_t t_checksum;
+    uint16_t t_flags;               /* JBD2_FLAG_* */
+} jbd2_tag_t;
+
+/**
+ * Revoke block header; r_count bytes of it are used, block numbers follow
+ */
+typedef struct {
+    jbd2_header_t r_header;
+    uint32_t r_count;
+} jbd2_revoke_header_t;
+
+/**
+ * Replay the journal if needed and start journaling metadata
+ *
+ * Called by ext2_mount() once the group descriptors are read; when
+ * transactions were replayed the superblock and descriptors are read
+ * again with ext2_reload_super(). A filesystem without a usable journal
+ * is left without one (fs->journal stays NULL) and written in place.
+ *
+ * @param fs       Filesystem being mounted
+ * @return 0 on success, -1 if the journal could not be replayed (errno set)
+ */
+int ext2_journal_load(ext2_fs_t *fs);
+
+/**
+ * Commit, write everything home and mark the journal empty
+ *
+ * @param fs       Filesystem being unmounted
+ */
+void ext2_journal_unload(ext2_fs_t *fs);
+
+/**
+ * Add a modified metadata buffer to the running transaction
+ *
+ * Used in place of bwrite() for metadata. Without a journal it is
+ * bwrite(). The caller keeps its own reference and releases it as usual.
+ *
+ * @param fs       Filesystem
+ * @param b        Buffer from bread() or bget(), already modified
+ */
+void ext2_journal_dirty(ext2_fs_t *fs, buf_t *b);
+
+/**
+ * Note that a block was freed
+ *
+ * If the block is in the log, the running transaction revokes it so
+ * replay leaves its new contents alone.
+ *
+ * @param fs       Filesystem
+ * @param block    Block just freed
+ */
+void ext2_journal_revoke(ext2_fs_t *fs, uint32_t block);
+
+/**
+ * Commit the running transaction, if it holds anything
+ *
+ * @param fs       Filesystem
+ * @return 0 on success, -1 on error (errno set; the transaction stays
+ *         open and its buffers held)
+ */
+int ext2_journal_commit(ext2_fs_t *fs);
+
+/**
+ * End an operation's part of the running transaction
+ *
+ * Commits once the transaction is half full, so an operation never
+ * starts in a transaction it could overflow; otherwise the changes wait
+ * for the next commit.
+ *
+ * @param fs       Filesystem
+ * @return 0 on success, -1 on error (errno set)
+ */
+int ext2_journal_end_op(ext2_fs_t *fs);
+
+#endif /* EXT2_JOURNAL_H */
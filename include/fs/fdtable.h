@@ -0,0 +1,129 @@
+/*
+ * fdtable.h - Per-process file descriptor tables
+ *
+ * A descriptor is a slot in its process's table that points at an open
+ * file (vfs_file_t): the position, flags and whatever the descriptor
+ * refers to. Open files are reference counted. fork() gives the child a
+ * copy of the table whose slots point at the same open files, and dup2()
+ * makes two slots share one, so they share a position and flags. An open
+ * file is released when its last descriptor is closed. The threads of a
+ * process share one table, which is freed with its last user.
+ *
+ * A table starts with FDTABLE_INITIAL_FDS slots and doubles when it runs
+ * out, up to VFS_MAX_OPEN_FILES. A bitmap of the slots in use, searched
+ * a 64-bit word at a time from the lowest slot that may be free, gives
+ * the lowest free descriptor without visiting open ones.
+ *
+ * Processes without a table of their own (the boot process and kernel
+ * threads) share the kernel's. Tables are only changed by their owners,
+ * under the big kernel lock, so they take no lock of their own.
+ */
+
+#ifndef FDTABLE_H
+#define FDTABLE_H
+
+#include <stdint.h>
+#include "vfs.h"
+
+/* Slots in a new table (a multiple of 64) */
+#define FDTABLE_INITIAL_FDS 64
+
+/**
+ * File descriptor table
+ */
+typedef struct fdtable {
+    vfs_file_t **files;                /* Open file per slot (NULL = free) */
+    uint64_t *open_map;                /* Bit per slot, set while in use */
+    uint32_t size;                     /* Slots */
+    uint32_t next_fd;                  /* No free slot below this one */
+    uint32_t users;                    /* Processes using it (threads share one) */
+} fdtable_t;
+
+/**
+ * Create a table with the console on descriptors 0, 1 and 2
+ *
+ * @return New table, or NULL on error (errno set)
+ */
+fdtable_t *fdtable_create(void);
+
+/**
+ * Copy a table for a forked child
+ *
+ * Every slot of the copy points at the same open file as the original.
+ *
+ * @param table    Table to copy
+ * @return New table, or NULL on error (errno set)
+ */
+fdtable_t *fdtable_clone(fdtable_t *table);
+
+/**
+ * Take another reference to a table, for a new thread
+ *
+ * @param table    Table
+ * @return table
+ */
+fdtable_t *fdtable_share(fdtable_t *table);
+
+/**
+ * Drop a reference to a table; the last closes every descriptor and
+ * frees it
+ *
+ * @param table    Table (NULL is a no-op)
+ */
+void fdtable_destroy(fdtable_t *table);
+
+/**
+ * Get the calling process's table (the kernel's if it has none)
+ *
+ * @return Table, or NULL if the kernel's cannot be set up (errno set)
+ */
+fdtable_t *fdtable_current(void);
+
+/**
+ * Put an open file on the lowest free descriptor
+ *
+ * The slot takes over the caller's reference to file.
+ *
+ * @param table    Table
+ * @param file     Open file
+ * @return Descriptor, or -1 on error (errno set, THUNDEROS_EMFILE when
+ *         VFS_MAX_OPEN_FILES are open)
+ */
+int fdtable_alloc(fdtable_t *table, vfs_file_t *file);
+
+/**
+ * Put an open file on a given descriptor
+ *
+ * The slot takes over the caller's reference to file. Whatever was open
+ * on fd is handed back in *replaced (NULL if nothing), still referenced,
+ * for the caller to release.
+ *
+ * @param table    Table
+ * @param fd       Descriptor (below VFS_MAX_OPEN_FILES)
+ * @param file     Open file
+ * @param replaced Receives the previous open file
+ * @return 0 on success, -1 on error (errno set)
+ */
+int fdtable_install(fdtable_t *table, int fd, vfs_file_t *file, vfs_file_t **replaced);
+
+/**
+ * Get the open file on a descriptor
+ *
+ * @param table    Table
+ * @param fd       Descriptor
+ * @return Open file (no reference taken), or NULL if fd is not open
+ *         (errno untouched)
+ */
+vfs_file_t *fdtable_get(fdtable_t *table, int fd);
+
+/**
+ * Free a descriptor
+ *
+ * @param table    Table
+ * @param fd       Descriptor
+ * @return The open file that was on it, with the slot's reference now
+ *         the caller's, or NULL if fd was not open
+ */
+vfs_file_t *fdtable_remove(fdtable_t *table, int fd);
+
+#endif /* FDTABLE_H */
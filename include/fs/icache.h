@@ -0,0 +1,90 @@
+/*
+ * icache.h - In-memory inode cache
+ *
+ * Keeps one vfs_node_t per live inode, keyed by (filesystem, inode
+ * number), so every path, hard link and descriptor that reaches an inode
+ * shares the same size, mode and block list. A filesystem's lookup asks
+ * the cache before reading an inode from disk and adds the node it builds.
+ * Nodes leave the cache with their last reference (vfs_node_put()) or
+ * when the inode is deleted.
+ *
+ * Metadata changes are not written through: operations mark the node
+ * dirty and the cache writes it back with the filesystem's write_inode
+ * operation when the file is closed, when the last reference goes, and
+ * on icache_sync(). A burst of writes through one descriptor costs one
+ * inode write instead of one per write().
+ */
+
+#ifndef ICACHE_H
+#define ICACHE_H
+
+#include <stdint.h>
+#include "vfs.h"
+
+/**
+ * Inode cache statistics
+ */
+typedef struct {
+    uint32_t inodes;       /* Nodes currently cached */
+    uint32_t dirty;        /* Of those, with metadata not yet written */
+    uint32_t hits;         /* Lookups that found a live node */
+    uint32_t misses;       /* Lookups that had to read the inode */
+    uint32_t writebacks;   /* Inode writes issued */
+} icache_stats_t;
+
+/**
+ * Find the live node for an inode
+ *
+ * @param fs       Filesystem
+ * @param inode    Inode number
+ * @return Node with a reference held for the caller, or NULL if the
+ *         inode has no node (errno untouched)
+ */
+vfs_node_t *icache_find(vfs_filesystem_t *fs, uint32_t inode);
+
+/**
+ * Add a newly built node (its fs and inode must be set)
+ *
+ * @param node     Node
+ */
+void icache_insert(vfs_node_t *node);
+
+/**
+ * Take a node out of the cache without writing it (its inode is gone)
+ *
+ * @param node     Node
+ */
+void icache_remove(vfs_node_t *node);
+
+/**
+ * Note that a node's metadata changed and must be written back
+ *
+ * @param node     Node
+ */
+void icache_mark_dirty(vfs_node_t *node);
+
+/**
+ * Write a node's metadata back now if it is dirty
+ *
+ * @param node     Node (NULL is a no-op)
+ * @return 0 on success, -1 on error (errno set by write_inode; the node
+ *         stays dirty)
+ */
+int icache_writeback(vfs_node_t *node);
+
+/**
+ * Write back every dirty node of a filesystem
+ *
+ * @param fs       Filesystem, or NULL for all of them
+ * @return 0 on success, -1 if any write failed
+ */
+int icache_sync(vfs_filesystem_t *fs);
+
+/**
+ * Get inode cache statistics
+ *
+ * @param stats    Output structure
+ */
+void icache_get_stats(icache_stats_t *stats);
+
+#endif /* ICACHE_H */
@@ -0,0 +1,178 @@
+/*
+ * page_cache.h - File page cache
+ *
+ * Caches file contents one page at a time, keyed by (filesystem, inode,
+ * page index), so file-backed mmap() can map file data directly into user
+ * page tables. Every cached page holds one reference for the cache itself;
+ * each mapping takes its own with get_page().
+ *
+ * write() to a regular file only copies into cached pages and marks them
+ * PG_DIRTY, so mappings see it immediately; pages written through a
+ * MAP_SHARED mapping are marked dirty too. Dirty pages reach the
+ * filesystem through page_cache_writeback(): from the flusher thread once
+ * they have waited PAGE_CACHE_DIRTY_EXPIRE_US, from write() itself past
+ * PAGE_CACHE_DIRTY_LIMIT, on msync, munmap and exit, and on
+ * page_cache_sync(). The filesystem allocates blocks only then, for a
+ * whole file at once.
+ *
+ * The cache grows into free memory; under memory pressure reclaim
+ * (mm/reclaim.h) evicts clean pages nobody maps, least recently used
+ * first.
+ *
+ * A memory filesystem (VFS_FS_MEMORY, e.g. tmpfs) keeps its files only
+ * here: its pages are never dirty and stay cached until the file is
+ * truncated or released.
+ */
+
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+#include <stdint.h>
+#include "vfs.h"
+
+/* Largest file the cache can hold: 2^32 pages of 4 KiB (indexes are 32-bit) */
+#define PAGE_CACHE_MAX_FILE_SIZE (1ULL << 44)
+
+/* Readahead window: starts at the minimum, doubles on each sequential
+ * read that nears its end, up to the maximum */
+#define PAGE_CACHE_RA_MIN_PAGES 4
+#define PAGE_CACHE_RA_MAX_PAGES 32
+
+/* Dirty pages before the flusher starts early, and before write() writes
+ * back its own file */
+#define PAGE_CACHE_DIRTY_BACKGROUND 128
+#define PAGE_CACHE_DIRTY_LIMIT 256
+
+/* Flusher period, and how long a page written with write() may stay dirty */
+#define PAGE_CACHE_FLUSH_INTERVAL_US 1000000
+#define PAGE_CACHE_DIRTY_EXPIRE_US   5000000
+
+/**
+ * Page cache statistics
+ */
+typedef struct {
+    uint32_t pages;        /* Pages currently cached */
+    uint32_t dirty;        /* Cached pages newer than the filesystem */
+    uint32_t hits;         /* Lookups served from the cache */
+    uint32_t misses;       /* Lookups that read from the filesystem */
+    uint32_t writebacks;   /* Dirty pages written back */
+    uint32_t evictions;    /* Clean pages dropped by reclaim */
+    uint32_t readahead;    /* Pages read before they were asked for */
+    uint32_t memory;       /* Cached pages of memory filesystems (never evicted) */
+} page_cache_stats_t;
+
+/**
+ * Get a file page, reading it into the cache on a miss
+ *
+ * Bytes past end of file read as zero.
+ *
+ * @param node     File node
+ * @param index    Page index within the file (offset / PAGE_SIZE)
+ * @param major    Output (may be NULL): 1 if the page was read from the
+ *                 filesystem, 0 if it was already cached
+ * @return Physical address of the page with a reference held for the
+ *         caller (drop it with put_page()), or 0 on error (errno set)
+ */
+uintptr_t page_cache_get_page(vfs_node_t *node, uint32_t index, int *major);
+
+/**
+ * Get a file page if it is already cached, without reading anything
+ *
+ * @param node     File node
+ * @param index    Page index within the file (offset / PAGE_SIZE)
+ * @return Physical address of the page with a reference held for the
+ *         caller (drop it with put_page()), or 0 if it is not cached
+ */
+uintptr_t page_cache_find_page(vfs_node_t *node, uint32_t index);
+
+/**
+ * Read file data through the cache, reading ahead on sequential access
+ *
+ * Serves read() for regular files. Cached pages hold what write() and
+ * shared mappings stored, so no write-back is needed first. When this read continues where the last one on the same
+ * descriptor stopped and nears the end of what was read ahead, the next
+ * window of pages is read in too and the window doubles; a seek resets
+ * it to PAGE_CACHE_RA_MIN_PAGES.
+ *
+ * @param node     File node
+ * @param offset   File offset
+ * @param buffer   Destination
+ * @param size     Bytes wanted (clipped at end of file)
+ * @param ra       Readahead state of the descriptor
+ * @return Bytes read (0 at end of file), or -1 on error (errno set)
+ */
+int page_cache_read(vfs_node_t *node, uint64_t offset, void *buffer, uint32_t size,
+                    vfs_readahead_t *ra);
+
+/**
+ * Mark a cached page as modified
+ *
+ * @param page     Physical address returned by page_cache_get_page()
+ */
+void page_cache_set_dirty(uintptr_t page);
+
+/**
+ * Write dirty cached pages of a file range back to the filesystem
+ *
+ * Only the part of each page below end of file is written; mappings
+ * never extend a file.
+ *
+ * @param node     File node
+ * @param offset   Start of range in bytes
+ * @param size     Length of range in bytes
+ * @return 0 on success, -1 on error (errno set)
+ */
+int page_cache_writeback(vfs_node_t *node, uint64_t offset, uint64_t size);
+
+/**
+ * Write file data into the cache; the filesystem sees it on write-back
+ *
+ * Serves write() for regular files. Pages the write covers only partly
+ * are read in first; the file grows as soon as it returns.
+ *
+ * @param node     File node
+ * @param offset   File offset
+ * @param buffer   Data to write
+ * @param size     Number of bytes
+ * @return Bytes written (short only if the cache ran out of memory), or
+ *         -1 on error (errno set)
+ */
+int page_cache_write(vfs_node_t *node, uint64_t offset, const void *buffer, uint32_t size);
+
+/**
+ * Drop every cached page of an inode (e.g. after unlink or truncate)
+ *
+ * Pages still mapped by a process stay alive until unmapped.
+ *
+ * @param fs       Filesystem of the inode
+ * @param inode    Inode number
+ */
+void page_cache_invalidate(vfs_filesystem_t *fs, uint32_t inode);
+
+/**
+ * Write back every dirty page written with write()
+ *
+ * The filesystem's own metadata still has to be synced afterwards
+ * (icache_sync(), bcache_sync()).
+ *
+ * @param fs       Only this filesystem's pages (NULL for all)
+ * @return 0 on success, -1 if any write-back failed (errno set; those
+ *         pages stay dirty)
+ */
+int page_cache_sync(vfs_filesystem_t *fs);
+
+/**
+ * Start the thread that writes back pages left dirty by write()
+ *
+ * @return 0 on success, -1 on error (errno set)
+ */
+int page_cache_start_flusher(void);
+
+/**
+ * Get page cache statistics
+ *
+ * @param stats    Output structure
+ */
+void page_cache_get_stats(page_cache_stats_t *stats);
+
+#endif /* PAGE_CACHE_H */
@@ -0,0 +1,74 @@
+/*
+ * procfs.h - Process and system information filesystem
+ *
+ * Mounted on /proc, it shows kernel state as text generated afresh on
+ * every read through seq_file iterators (fs/seq_file.h), so a monitoring
+ * agent polls it with plain open() and read() instead of a syscall per
+ * metric:
+ *
+ *   /proc/<pid>/stat      "key value" lines: times, context switches,
+ *                         syscalls, block I/O, page faults (kernel/acct.h)
+ *   /proc/<pid>/status    "key value" lines: identity, scheduling, memory
+ *   /proc/<pid>/syscalls  The process's calls and latency per syscall,
+ *                         and a log2 histogram of all its syscalls
+ *   /proc/self            The reader's own directory
+ *
+ * and the system files registered with procfs_create(); procfs mounts
+ * with these (kernel/fs/proc_stats.c):
+ *
+ *   /proc/meminfo         Physical pages, buddy free lists, slab, DMA, caches
+ *   /proc/interrupts      Per-IRQ counts by CPU and handler times
+ *   /proc/blkstat         Block request queue counters
+ *   /proc/cachestat       Page, buffer, dentry and inode cache hit rates
+ *   /proc/sched           Per-CPU run queue lengths
+ *   /proc/syscalls        Calls, latency and a log2 histogram per syscall
+ *   /proc/lockstat        Lock class wait and hold times (kernel/lockstat.h)
+ *   /proc/rgroups         Resource group limits and usage (kernel/rgroup.h)
+ *   /proc/boottime        Boot timeline, one line per init stage
+ *   /proc/bootlog         Console output held back by a quiet boot
+ *
+ * Pid nodes are made by each lookup and freed with their last reference;
+ * the filesystem is VFS_FS_NOCACHE, so the dentry cache never keeps a
+ * name for a process that has gone. A file whose process is gone reads
+ * with ESRCH. Read-only; operations run under the big kernel lock.
+ */
+
+#ifndef PROCFS_H
+#define PROCFS_H
+
+#include "vfs.h"
+#include "seq_file.h"
+
+/* Inode number of the root directory */
+#define PROCFS_ROOT_INO 1
+
+/* Files procfs_create() can add to the root */
+#define PROCFS_MAX_FILES 16
+
+/**
+ * Add a file to /proc
+ *
+ * @param name File name (no '/')
+ * @param ops  Its records (kept, not copied)
+ * @param data Left in seq_file_t::private for them
+ * @return Node, or NULL on error (errno set: EEXIST if the name is taken,
+ *         ENOSPC once PROCFS_MAX_FILES are registered)
+ */
+vfs_node_t *procfs_create(const char *name, const seq_operations_t *ops, void *data);
+
+/**
+ * Register the system files listed above (kernel/fs/proc_stats.c; called
+ * once, when procfs is first set up)
+ */
+void procfs_register_stats(void);
+
+/**
+ * Get the process filesystem
+ *
+ * Mount it with vfs_mount().
+ *
+ * @return Filesystem, or NULL on error (errno set)
+ */
+vfs_filesystem_t *procfs_mount(void);
+
+#endif /* PROCFS_H */
@@ -0,0 +1,125 @@
+/*
+ * rofs.h - Compressed read-only image filesystem
+ *
+ * A rofs image is built once on the host (tools/mkrofs.py) and never
+ * written. File data is cut into blocks of block_size bytes, each
+ * compressed with LZ4 on its own and stored that way only if that makes
+ * it smaller; a block of zeroes takes no space at all. All metadata
+ * sits at the front of the image:
+ *
+ *   rofs_super_t | inodes | directory entries | block table | names | data
+ *
+ * The kernel reads the whole metadata region at mount, in a few large
+ * requests, and never touches the disk for a lookup, stat() or directory
+ * listing after that. A page cache miss reads the one compressed block
+ * holding the page, with one request, and decompresses it; the last block
+ * decompressed is kept, so reading a file in order costs one request per
+ * block rather than per page. The pages themselves live in the page cache
+ * like any other file's, so mmap() and exec work unchanged.
+ *
+ * All fields are little-endian. Offsets in the block table are bytes from
+ * the start of the image, which limits an image to 4 GiB.
+ *
+ * Directories list their entries sorted by name (bytewise), so a lookup
+ * is a binary search. Names are stored null-terminated. Inode numbers
+ * run from ROFS_ROOT_INO to inode_count; hard links share an inode.
+ * Symbolic links, devices and other special files are not supported.
+ */
+
+#ifndef ROFS_H
+#define ROFS_H
+
+#include <stdint.h>
+#include "vfs.h"
+
+/* Superblock magic ("ROFS" read as a little-endian word) */
+#define ROFS_MAGIC          0x53464F52u
+#define ROFS_VERSION        1
+
+/* Block compression (rofs_super_t.compression) */
+#define ROFS_COMP_NONE      0           /* Every block stored as-is */
+#define ROFS_COMP_LZ4       1           /* LZ4 block format */
+
+/* Data block sizes an image may use (powers of two) */
+#define ROFS_MIN_BLOCK_SIZE 4096
+#define ROFS_MAX_BLOCK_SIZE 65536
+
+/* Inode number of the root directory */
+#define ROFS_ROOT_INO       1
+
+/* rofs_block_t.length: the block is stored uncompressed */
+#define ROFS_BLOCK_RAW      0x80000000u
+#define ROFS_BLOCK_LEN_MASK 0x7FFFFFFFu
+
+/**
+ * Superblock, at the start of the image (64 bytes)
+ */
+typedef struct {
+    uint32_t magic;                    /* ROFS_MAGIC */
+    uint16_t version;                  /* ROFS_VERSION */
+    uint16_t compression;              /* ROFS_COMP_* */
+    uint32_t block_size;               /* Bytes of file data per block, uncompressed */
+    uint32_t inode_count;              /* Inodes, numbered from ROFS_ROOT_INO */
+    uint32_t dirent_count;             /* Directory entries */
+    uint32_t block_count;              /* Block table entries */
+    uint32_t names_size;               /* Bytes of names */
+    uint32_t meta_size;                /* Bytes from the image start to the end of the names */
+    uint32_t image_size;               /* Bytes in the image */
+    uint32_t build_time;               /* When the image was made (seconds since 1970) */
+    uint32_t reserved[6];
+} rofs_super_t;
+
+/**
+ * Inode (24 bytes)
+ */
+typedef struct {
+    uint16_t mode;                     /* File type and permissions (EXT2_S_* values) */
+    uint16_t uid;                      /* Owner user ID */
+    uint16_t gid;                      /* Owner group ID */
+    uint16_t reserved;
+    uint32_t parent;                   /* Directories: the one holding it (the root's is itself) */
+    uint32_t start;                    /* First block table entry (files) or directory entry */
+    uint64_t size;                     /* Bytes (files) or directory entries */
+} rofs_inode_t;
+
+/**
+ * Directory entry (12 bytes)
+ */
+typedef struct {
+    uint32_t inode;                    /* Inode it names */
+    uint32_t name;                     /* Offset of the name in the names region */
+    uint16_t name_len;                 /* Its length, without the terminator */
+    uint16_t reserved;
+} rofs_dirent_t;
+
+/**
+ * Block table entry: where one block of a file is (8 bytes)
+ */
+typedef struct {
+    uint32_t offset;                   /* Byte offset in the image */
+    uint32_t length;                   /* Stored bytes, ROFS_BLOCK_RAW if not compressed;
+                                          0 for a block of zeroes */
+} rofs_block_t;
+
+/**
+ * Mount the rofs image on the block device
+ *
+ * Reads and checks the superblock and all metadata; a corrupt image is
+ * refused rather than found out later. Mount it with vfs_mount_root()
+ * or vfs_mount().
+ *
+ * @return Filesystem, or NULL on error (errno set: THUNDEROS_EFS_BADSUPER
+ *         if the device does not hold a rofs image, THUNDEROS_EFS_CORRUPT
+ *         if it holds a damaged one)
+ */
+vfs_filesystem_t *rofs_mount(void);
+
+/**
+ * Bytes a mounted image takes on the device (what follows is free, e.g.
+ * for a swap area)
+ *
+ * @param fs Filesystem returned by rofs_mount()
+ */
+uint64_t rofs_image_size(vfs_filesystem_t *fs);
+
+#endif /* ROFS_H */
@@ -0,0 +1,81 @@
+/*
+ * seq_file.h - Text generated record by record
+ *
+ * A synthetic file (see fs/procfs.h) describes its contents as a
+ * sequence of records: start() returns the record at *pos (NULL past the
+ * end), next() the one after it, and show() prints one. seq_read()
+ * renders from the first record, drops the bytes before the read's
+ * offset and stops asking for records as soon as the caller's buffer is
+ * full, so a read costs what it returns plus what precedes it, and
+ * nothing is allocated.
+ *
+ * Files with a single record leave start and next NULL: show() is called
+ * once with SEQ_START_TOKEN.
+ */
+
+#ifndef SEQ_FILE_H
+#define SEQ_FILE_H
+
+#include <stdint.h>
+
+/* The record of a file without start() */
+#define SEQ_START_TOKEN ((void *)1)
+
+/**
+ * What one read renders into
+ */
+typedef struct seq_file {
+    char *buf;                         /* The caller's buffer */
+    uint32_t size;                     /* Its size */
+    uint32_t len;                      /* Bytes put in it so far */
+    uint64_t skip;                     /* Bytes still to drop before the offset */
+    void *private;                     /* The file's data (see the ops' owner) */
+} seq_file_t;
+
+/**
+ * How a file produces its records
+ */
+typedef struct seq_operations {
+    void *(*start)(seq_file_t *m, uint64_t *pos);
+    void *(*next)(seq_file_t *m, void *v, uint64_t *pos);
+    void (*show)(seq_file_t *m, void *v);
+} seq_operations_t;
+
+/**
+ * Render a file and copy out the part at offset
+ *
+ * @param ops     Records
+ * @param private Left in m->private for them
+ * @param buffer  Checked memory for size bytes
+ * @return Bytes read (0 at the end)
+ */
+int seq_read(const seq_operations_t *ops, void *private, uint64_t offset,
+             void *buffer, uint32_t size);
+
+/* Nonzero once the buffer is full: later output is thrown away */
+static inline int seq_full(const seq_file_t *m) {
+    return m->len >= m->size;
+}
+
+void seq_putc(seq_file_t *m, char c);
+void seq_puts(seq_file_t *m, const char *s);
+
+/* Decimal number, right-aligned in width columns (0: no padding) */
+void seq_put_dec(seq_file_t *m, uint64_t n, uint32_t width);
+
+/* "0x" and a hexadecimal number */
+void seq_put_hex(seq_file_t *m, uint64_t n);
+
+/* String, left-aligned in width columns, with at least one space after it */
+void seq_put_col(seq_file_t *m, const char *s, uint32_t width);
+
+/* "key value\n" */
+void seq_put_field(seq_file_t *m, const char *key, uint64_t value);
+
+/* "label b0 b1 ...\n" up to the last bucket not empty (nothing if all are) */
+void seq_put_hist(seq_file_t *m, const char *label, const uint32_t *hist, uint32_t buckets);
+
+/* Percentage part / (part + rest), one decimal ("-" when both are 0) */
+void seq_put_ratio(seq_file_t *m, uint64_t part, uint64_t rest, uint32_t width);
+
+#endif /* SEQ_FILE_H */
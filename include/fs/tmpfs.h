@@ -0,0 +1,37 @@
+/*
+ * tmpfs.h - Memory filesystem
+ *
+ * A tmpfs keeps its directory tree in kernel memory and its file data
+ * only in the page cache (VFS_FS_MEMORY): a write() stays in cached pages
+ * that are never written back or evicted, so files under it never reach
+ * a block device. Everything is lost when the machine restarts.
+ *
+ * Each name holds one reference to its node, so a file that is unlinked
+ * while open keeps its pages until it is last closed or unmapped. Nodes
+ * are not in the inode cache and inode numbers are never reused.
+ * Operations do not sleep and run under the big kernel lock, so there is
+ * no lock of its own.
+ */
+
+#ifndef TMPFS_H
+#define TMPFS_H
+
+#include <stdint.h>
+#include "vfs.h"
+
+/* Inode number of the root directory */
+#define TMPFS_ROOT_INO 1
+
+/* Mode of the root directory: anyone may create files (sticky, rwx for all) */
+#define TMPFS_ROOT_MODE 01777
+
+/**
+ * Create an empty tmpfs
+ *
+ * Mount it with vfs_mount().
+ *
+ * @return Filesystem, or NULL on error (errno set)
+ */
+vfs_filesystem_t *tmpfs_mount(void);
+
+#endif /* TMPFS_H */
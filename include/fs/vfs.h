@@ -11,12 +11,15 @@
 #include <stdint.h>
 #include <stddef.h>
 
-/* Maximum number of open files per process */
-#define VFS_MAX_OPEN_FILES 16
+/* Maximum number of open files per process (see fs/fdtable.h) */
+#define VFS_MAX_OPEN_FILES 1024
 
 /* Maximum path length */
 #define VFS_MAX_PATH 256
 
+/* Filesystems mounted below the root at once */
+#define VFS_MAX_MOUNTS 8
+
 /* Default file permissions */
 #define VFS_DEFAULT_FILE_MODE 0644  /* rw-r--r-- */
 
@@ -31,18 +34,41 @@
 #define O_WRONLY  0x0001  /* Write-only */
 #define O_RDWR    0x0002  /* Read-write */
 #define O_CREAT   0x0040  /* Create if not exists */
+#define O_EXCL    0x0080  /* With O_CREAT: fail if it exists */
 #define O_TRUNC   0x0200  /* Truncate to zero length */
 #define O_APPEND  0x0400  /* Append mode */
+#define O_NONBLOCK 0x0800 /* Fail with EAGAIN instead of blocking */
+
+/* Flags F_SETFL may change; the rest are fixed at open */
+#define VFS_SETFL_MASK (O_APPEND | O_NONBLOCK)
 
 /* Seek whence values */
 #define SEEK_SET  0  /* Seek from beginning */
 #define SEEK_CUR  1  /* Seek from current position */
 #define SEEK_END  2  /* Seek from end */
 
+/* fcntl commands (Linux numbering) */
+#define F_GETFL       3     /* Get file status flags */
+#define F_SETFL       4     /* Set O_APPEND / O_NONBLOCK */
+#define F_SETPIPE_SZ  1031  /* Set pipe capacity in bytes */
+#define F_GETPIPE_SZ  1032  /* Get pipe capacity in bytes */
+
+/* splice() / tee() flags */
+#define SPLICE_F_NONBLOCK 0x02  /* Don't block on the pipes */
+
 /* File types */
 #define VFS_TYPE_FILE      1
 #define VFS_TYPE_DIRECTORY 2
 #define VFS_TYPE_PIPE      3
+#define VFS_TYPE_EPOLL     4
+#define VFS_TYPE_SHM       5
+#define VFS_TYPE_SIGNALFD  6
+#define VFS_TYPE_CONSOLE   7
+#define VFS_TYPE_DEVICE    8   /* Device node (see fs/devfs.h) */
+#define VFS_TYPE_SOCKET    9   /* Socket (see net/socket.h) */
+#define VFS_TYPE_PERF      10  /* Performance counter (see kernel/perf_event.h) */
+#define VFS_TYPE_PROC      11  /* Generated on each read (see fs/procfs.h) */
+#define VFS_TYPE_AIO       12  /* Asynchronous I/O context (see kernel/aio.h) */
 
 /**
  * Stat structure for vfs_stat_full
@@ -54,23 +80,31 @@ typedef struct {
     uint16_t st_uid;      /* Owner user ID */
     uint16_t st_gid;      /* Owner group ID */
     uint16_t st_pad;      /* Padding for alignment */
-    uint32_t st_size;     /* File size in bytes */
+    uint32_t st_size;     /* File size in bytes (low 32 bits) */
     uint32_t st_type;     /* VFS file type (VFS_TYPE_*) */
+    uint32_t st_size_high; /* File size in bytes (high 32 bits) */
 } vfs_stat_t;
 
 /* Forward declarations */
 struct vfs_node;
 struct vfs_filesystem;
 
+/**
+ * Directory entry callback for the iterate operation
+ * name is null-terminated. Returns 0 to take the entry and go on, non-zero
+ * to stop without taking it (the caller's buffer is full).
+ */
+typedef int (*vfs_filldir_t)(void *ctx, const char *name, uint32_t name_len, uint32_t inode);
+
 /**
  * Filesystem operations - implemented by each FS type (ext2, etc.)
  */
 typedef struct {
     /* Read from file */
-    int (*read)(struct vfs_node *node, uint32_t offset, void *buffer, uint32_t size);
+    int (*read)(struct vfs_node *node, uint64_t offset, void *buffer, uint32_t size);
     
     /* Write to file */
-    int (*write)(struct vfs_node *node, uint32_t offset, const void *buffer, uint32_t size);
+    int (*write)(struct vfs_node *node, uint64_t offset, const void *buffer, uint32_t size);
     
     /* Open file (optional setup) */
     int (*open)(struct vfs_node *node, uint32_t flags);
@@ -81,8 +115,9 @@ typedef struct {
     /* Lookup file in directory by name */
     struct vfs_node *(*lookup)(struct vfs_node *dir, const char *name);
     
-    /* List directory contents */
-    int (*readdir)(struct vfs_node *dir, uint32_t index, char *name, uint32_t *inode);
+    /* List directory contents: pass entries from cursor *pos on to fill,
+     * leaving *pos past the last one taken (0 starts at the beginning) */
+    int (*iterate)(struct vfs_node *dir, uint32_t *pos, vfs_filldir_t fill, void *ctx);
     
     /* Create file */
     int (*create)(struct vfs_node *dir, const char *name, uint32_t mode);
@@ -95,15 +130,36 @@ typedef struct {
     
     /* Remove directory */
     int (*rmdir)(struct vfs_node *dir, const char *name);
+    
+    /* Free a node once its last reference is dropped */
+    void (*release)(struct vfs_node *node);
+    
+    /* Write a dirty node's metadata (size, mode, owner) back to disk */
+    int (*write_inode)(struct vfs_node *node);
+    
+    /* Make everything written to the filesystem durable, device cache
+     * included (optional: nothing to do without a backing store) */
+    int (*sync)(struct vfs_filesystem *fs);
+    
+    /* Devices: page index of the device's memory to map into a process,
+     * with a reference taken for the mapping (0 on error, errno set) */
+    uintptr_t (*map_page)(struct vfs_node *node, uint64_t index);
+    
+    /* Devices: device-specific control request */
+    int (*ioctl)(struct vfs_node *node, uint32_t request, uint64_t arg);
 } vfs_ops_t;
 
+/* vfs_node_t flags (see fs/icache.h) */
+#define VFS_NODE_HASHED  0x1           /* In the inode cache */
+#define VFS_NODE_DIRTY   0x2           /* Metadata not yet written back */
+
 /**
  * VFS node - represents a file or directory
  */
 typedef struct vfs_node {
     char name[256];                    /* File/directory name */
     uint32_t inode;                    /* Inode number */
-    uint32_t size;                     /* File size in bytes */
+    uint64_t size;                     /* File size in bytes */
     uint32_t type;                     /* File type (file/dir) */
     uint32_t flags;                    /* Flags */
     uint16_t mode;                     /* Permission bits (from inode i_mode) */
@@ -112,8 +168,20 @@ typedef struct vfs_node {
     struct vfs_filesystem *fs;         /* Filesystem this node belongs to */
     void *fs_data;                     /* Filesystem-specific data */
     vfs_ops_t *ops;                    /* Operations for this node */
+    uint32_t refcount;                 /* Holders: dentry cache, descriptors, mappings,
+                                          subdirectories, working directories */
+    struct vfs_node *hash_next;        /* Inode cache chain */
+    struct vfs_node *parent;           /* Directory a directory was found in, for ".."
+                                          (reference held; NULL for a filesystem root) */
 } vfs_node_t;
 
+/* vfs_filesystem_t flags */
+#define VFS_FS_MEMORY    0x1           /* No backing store: page cache pages are the data */
+#define VFS_FS_RDONLY    0x2           /* Never written: no writes, creates, removals or
+                                          metadata changes (THUNDEROS_EFS_RDONLY) */
+#define VFS_FS_NOCACHE   0x4           /* Names come and go on their own (procfs): the
+                                          dentry cache must not remember them */
+
 /**
  * Filesystem instance
  */
@@ -122,52 +190,141 @@ typedef struct vfs_filesystem {
     void *fs_data;                     /* Filesystem-specific data (e.g., ext2_fs_t) */
     vfs_node_t *root;                  /* Root directory node */
     vfs_ops_t *ops;                    /* Default operations */
+    uint64_t max_file_size;            /* Largest file it can hold (0: no limit) */
+    uint32_t flags;                    /* VFS_FS_* */
 } vfs_filesystem_t;
 
 /**
- * File descriptor - tracks open file state
+ * Readahead state of an open file (see page_cache_read())
  */
 typedef struct {
+    uint32_t prev_index;               /* Last page read, VFS_RA_NONE before the first */
+    uint32_t window;                   /* Pages to read ahead next time */
+    uint32_t end;                      /* First page past the last readahead */
+} vfs_readahead_t;
+
+#define VFS_RA_NONE 0xFFFFFFFFu
+
+/* Vectored I/O limits */
+#define VFS_IOV_MAX 1024           /* Buffers per call */
+#define VFS_IO_MAX  0x7FFFFFFFu    /* Bytes per call (fits the int result) */
+
+/**
+ * One buffer of a vectored read or write (the layout of struct iovec)
+ */
+typedef struct vfs_iovec {
+    void *base;                        /* Start of the buffer */
+    uint64_t len;                      /* Its length in bytes */
+} vfs_iovec_t;
+
+/**
+ * Open file - what descriptors point at (see fs/fdtable.h)
+ *
+ * Shared by every descriptor dup2() or fork() made from the one open()
+ * returned, and released when the last of them closes.
+ */
+typedef struct vfs_file {
     vfs_node_t *node;                  /* File node (NULL for pipes) */
     void *pipe;                        /* Pipe pointer (if VFS_TYPE_PIPE) */
     uint32_t flags;                    /* Open flags */
-    uint32_t pos;                      /* Current file position */
-    int in_use;                        /* 1 if FD is allocated */
+    uint64_t pos;                      /* Current file position (directory cursor for directories) */
+    uint32_t refcount;                 /* Descriptors pointing here */
     uint32_t type;                     /* File type (VFS_TYPE_FILE, VFS_TYPE_PIPE, etc.) */
+    void *epoll;                       /* Epoll instance (if VFS_TYPE_EPOLL) */
+    void *epitems;                     /* Epoll registrations watching this file */
+    void *shm;                         /* Shared memory object (if VFS_TYPE_SHM) */
+    void *signalfd;                    /* Signal set (if VFS_TYPE_SIGNALFD) */
+    void *socket;                      /* Socket (if VFS_TYPE_SOCKET) */
+    void *perf;                        /* Counter (if VFS_TYPE_PERF) */
+    void *aio;                         /* Context (if VFS_TYPE_AIO) */
+    vfs_readahead_t ra;                /* Sequential read detection */
 } vfs_file_t;
 
 /* VFS initialization */
 int vfs_init(void);
 
-/* Mount a filesystem at root */
+/* Mount a filesystem at root (replacing one waits until no lookup still uses it) */
 int vfs_mount_root(vfs_filesystem_t *fs);
 
+/**
+ * Mount a filesystem on a directory
+ * 
+ * Paths at or below the directory resolve in fs from then on; what the
+ * directory held is hidden until the machine restarts (there is no
+ * unmount). A mount point cannot be removed.
+ * 
+ * @param path Existing directory, not "/" or already a mount point
+ * @param fs   Filesystem, with its root node set up
+ * @return 0 on success, -1 on error (THUNDEROS_EBUSY if path is mounted
+ *         on, THUNDEROS_ENOMEM once VFS_MAX_MOUNTS are in use)
+ */
+int vfs_mount(const char *path, vfs_filesystem_t *fs);
+
 /* File operations */
 int vfs_open(const char *path, uint32_t flags);
 int vfs_close(int fd);
 int vfs_read(int fd, void *buffer, uint32_t size);
 int vfs_write(int fd, const void *buffer, uint32_t size);
-int vfs_seek(int fd, int offset, int whence);
+int64_t vfs_seek(int fd, int64_t offset, int whence);
 int vfs_dup2(int oldfd, int newfd);
 
+/**
+ * Read into several buffers in one call
+ * 
+ * Buffers are filled in order; a short read into one ends the call. A
+ * pipe or signalfd waits only for the first buffer's data.
+ * 
+ * @param fd     Descriptor
+ * @param iov    Buffers (at most VFS_IOV_MAX, VFS_IO_MAX bytes in all)
+ * @param iovcnt Number of buffers
+ * @param offset File offset, updated (NULL: use and move the file position;
+ *               THUNDEROS_ESPIPE on a pipe)
+ * @return Bytes read, 0 at end of file, -1 on error
+ */
+int vfs_readv(int fd, const vfs_iovec_t *iov, int iovcnt, int64_t *offset);
+
+/**
+ * Write from several buffers in one call
+ * 
+ * @param fd     Descriptor (regular file or pipe)
+ * @param iov    Buffers, as vfs_readv()
+ * @param iovcnt Number of buffers
+ * @param offset File offset, as vfs_readv()
+ * @return Bytes written, -1 on error
+ */
+int vfs_writev(int fd, const vfs_iovec_t *iov, int iovcnt, int64_t *offset);
+
 /* Directory operations */
 int vfs_mkdir(const char *path, uint32_t mode);
 int vfs_rmdir(const char *path);
 int vfs_unlink(const char *path);
 
-/* Path resolution */
+/* Path resolution: walks from the root, or for a relative path from the
+ * process's working directory; the node comes back with a reference
+ * (drop it with vfs_node_put) */
 vfs_node_t *vfs_resolve_path(const char *path);
 
+/* Node references */
+void vfs_node_get(vfs_node_t *node);
+void vfs_node_put(vfs_node_t *node);
+
 /* Path normalization - converts relative paths to absolute, resolves . and .. */
 int vfs_normalize_path(const char *path, char *normalized, size_t size);
 
-/* File descriptor management */
+/* File descriptor management (the calling process's table) */
 int vfs_alloc_fd(void);
 void vfs_free_fd(int fd);
+int vfs_install_file(vfs_file_t *file);     /* Takes over the caller's reference */
 vfs_file_t *vfs_get_file(int fd);
+int vfs_is_console(int fd);
+
+/* Open files: vfs_file_alloc() returns one reference, released by vfs_file_put() */
+vfs_file_t *vfs_file_alloc(void);
+void vfs_file_get(vfs_file_t *file);
+void vfs_file_put(vfs_file_t *file);
 
 /* Helper functions */
-int vfs_stat(const char *path, uint32_t *size, uint32_t *type);
+int vfs_stat(const char *path, uint64_t *size, uint32_t *type);
 int vfs_stat_full(const char *path, vfs_stat_t *statbuf);
 int vfs_exists(const char *path);
 
@@ -182,7 +339,8 @@ int vfs_exists(const char *path);
  * 
  * @param node     VFS node to check
  * @param mode     Access mode (VFS_ACCESS_READ, VFS_ACCESS_WRITE, VFS_ACCESS_EXEC)
- * @return 0 if access allowed, -1 if denied (errno set to THUNDEROS_EACCES)
+ * @return 0 if access allowed, -1 if denied (errno set to THUNDEROS_EACCES,
+ *         or THUNDEROS_EFS_RDONLY for a write on a VFS_FS_RDONLY filesystem)
  */
 int vfs_check_permission(vfs_node_t *node, int mode);
 
@@ -206,6 +364,268 @@ int vfs_chmod(const char *path, uint32_t mode);
 int vfs_chown(const char *path, uint16_t uid, uint16_t gid);
 
 /* Pipe support */
-int vfs_create_pipe(int pipefd[2]);
+
+/**
+ * Create a pipe and descriptors for both ends
+ * 
+ * @param pipefd Receives the read end (0) and write end (1)
+ * @param flags  O_NONBLOCK or 0, set on both ends
+ * @return 0 on success, -1 on error
+ */
+int vfs_create_pipe(int pipefd[2], uint32_t flags);
+
+/**
+ * Check whether a descriptor is in non-blocking mode
+ * 
+ * Only pipes and the terminal (fd 0) ever block; regular files are
+ * read through the page cache and accept O_NONBLOCK without effect.
+ * 
+ * @param fd Descriptor
+ * @return Nonzero if O_NONBLOCK is set, 0 otherwise or if fd is not open
+ */
+int vfs_is_nonblock(int fd);
+
+struct poll_table;
+struct eventpoll;
+
+/**
+ * Get the readiness of an open file (see kernel/poll.h)
+ * 
+ * Pipes report their end's state; regular files and directories are
+ * always ready; an epoll descriptor is readable while it has events.
+ * The console is polled by poll_file(), not here.
+ * 
+ * @param file Open file
+ * @param pt   Poll table to register on, or NULL
+ * @return POLL* mask
+ */
+int vfs_poll_file(vfs_file_t *file, struct poll_table *pt);
+
+/**
+ * Create an epoll instance and a descriptor for it
+ * 
+ * @return Descriptor, -1 on error
+ */
+int vfs_create_epoll(void);
+
+/**
+ * Get the epoll instance behind a descriptor
+ * 
+ * @param fd Descriptor
+ * @return Instance, or NULL (EBADF, or EINVAL if not an epoll descriptor)
+ */
+struct eventpoll *vfs_get_epoll(int fd);
+
+struct shm_object;
+
+/**
+ * Get a descriptor for a shared memory object (see kernel/shm.h)
+ * 
+ * The descriptor takes over one reference to the object.
+ * 
+ * @param shm   Object
+ * @param flags O_RDONLY or O_RDWR, optionally O_NONBLOCK
+ * @return Descriptor, -1 on error
+ */
+int vfs_open_shm(struct shm_object *shm, uint32_t flags);
+
+/**
+ * Get the shared memory object behind a descriptor
+ * 
+ * @param fd Descriptor
+ * @return Object, or NULL (EBADF, or EINVAL if not a shared memory descriptor)
+ */
+struct shm_object *vfs_get_shm(int fd);
+
+/**
+ * Change the size of an open file
+ * 
+ * Only shared memory objects can be resized; regular files are refused.
+ * 
+ * @param fd     Descriptor, open for writing
+ * @param length New size in bytes
+ * @return 0 on success, -1 on error
+ */
+int vfs_ftruncate(int fd, uint64_t length);
+
+/**
+ * Make an open file's data and metadata durable
+ * 
+ * Writes back the file's dirty pages, then its inode, then everything the
+ * filesystem holds in memory, and flushes the device's write cache. The
+ * node only carries metadata needed to read the data back (size and block
+ * list; chmod() and chown() write theirs through), so datasync changes
+ * nothing today and is there for fdatasync().
+ * 
+ * @param fd       Descriptor of a regular file or directory
+ * @param datasync Only what reading the data back needs (fdatasync())
+ * @return 0 on success, -1 on error (EBADF, EINVAL for pipes, the console
+ *         and other descriptors without a file, EIO)
+ */
+int vfs_fsync(int fd, int datasync);
+
+/**
+ * Make everything written to every mounted filesystem durable
+ * 
+ * @return 0 on success, -1 if any write-back or flush failed (errno set)
+ */
+int vfs_sync(void);
+
+struct signalfd;
+
+/**
+ * Create a signalfd and a descriptor for it (see kernel/signalfd.h)
+ * 
+ * @param mask  Signals to read
+ * @param flags Optionally O_NONBLOCK
+ * @return Descriptor, -1 on error
+ */
+int vfs_create_signalfd(uint64_t mask, uint32_t flags);
+
+/**
+ * Get the signalfd behind a descriptor
+ * 
+ * @param fd Descriptor
+ * @return Context, or NULL (EBADF, or EINVAL if not a signalfd)
+ */
+struct signalfd *vfs_get_signalfd(int fd);
+
+struct socket;
+
+/**
+ * Make a descriptor for a socket (see net/socket.h)
+ * 
+ * @param sock  Socket; its reference passes to the descriptor on success
+ * @param flags Optionally O_NONBLOCK
+ * @return Descriptor, -1 on error
+ */
+int vfs_create_socket(struct socket *sock, uint32_t flags);
+
+/**
+ * Get the socket behind a descriptor
+ * 
+ * @param fd Descriptor
+ * @return Socket, or NULL (EBADF, or ENOTSOCK if not a socket)
+ */
+struct socket *vfs_get_socket(int fd);
+
+struct perf_event;
+
+/**
+ * Make a descriptor for a performance counter (closing the last one
+ * releases it)
+ * 
+ * @param event Counter from perf_event_open()
+ * @return Descriptor, -1 on error
+ */
+int vfs_create_perf_event(struct perf_event *event);
+
+struct aio_ctx;
+
+/**
+ * Create an asynchronous I/O context and a descriptor for it (see
+ * kernel/aio.h)
+ * 
+ * @param flags 0 or O_NONBLOCK
+ * @return Descriptor, -1 on error
+ */
+int vfs_create_aio(uint32_t flags);
+
+/**
+ * Get the asynchronous I/O context behind a descriptor
+ * 
+ * @param fd Descriptor
+ * @return Context, or NULL (EBADF, or EINVAL if not a context)
+ */
+struct aio_ctx *vfs_get_aio(int fd);
+
+/**
+ * Check that an open file is a regular file open for a transfer
+ * 
+ * @param file Open file
+ * @param write Nonzero for writing, zero for reading
+ * @return 0 if it is, -1 otherwise (EINVAL if not a regular file,
+ *         EACCES if not open for it)
+ */
+int vfs_file_check_io(vfs_file_t *file, int write);
+
+/**
+ * Read or write an open regular file at a given position, for callers
+ * holding the file rather than a descriptor (the AIO workers)
+ * 
+ * Does not move the file position.
+ * 
+ * @return Bytes transferred, -1 on error (errno set)
+ */
+int vfs_file_pread(vfs_file_t *file, uint64_t pos, void *buffer, uint32_t size);
+int vfs_file_pwrite(vfs_file_t *file, uint64_t pos, const void *buffer, uint32_t size);
+
+/**
+ * Control an open file
+ * 
+ * F_GETFL and F_SETFL read and change the status flags of any
+ * descriptor, including 0-2; F_SETFL only changes the flags in
+ * VFS_SETFL_MASK. The pipe capacity commands (F_GETPIPE_SZ,
+ * F_SETPIPE_SZ) round the size up to whole pages.
+ * 
+ * @param fd   File descriptor
+ * @param cmd  F_* command
+ * @param arg  Command argument (flags for F_SETFL, size for F_SETPIPE_SZ)
+ * @return Command result (flags, pipe capacity in bytes, or 0), -1 on error
+ */
+int vfs_fcntl(int fd, int cmd, uint64_t arg);
+
+/**
+ * Send a device-specific request to an open device
+ * 
+ * @param fd      File descriptor
+ * @param request Request number, defined by the device's driver
+ * @param arg     Request argument (often a user pointer)
+ * @return Request result, -1 on error (ENOTTY if the file takes no requests)
+ */
+int vfs_ioctl(int fd, uint32_t request, uint64_t arg);
+
+/**
+ * Move data between a pipe and a regular file without a user copy
+ * 
+ * One of the two descriptors must be a pipe. File data goes into the
+ * pipe as references to page cache pages; pipe data is written to the
+ * file straight from the pipe's pages. Later writes to the file can
+ * still show up in pages that are queued in a pipe. The other end may
+ * also be an AF_UNIX stream socket: its data moves from pipe to pipe
+ * by page reference.
+ * 
+ * @param fd_in   Source descriptor
+ * @param off_in  Source file offset, updated (NULL: use and move the file position)
+ * @param fd_out  Destination descriptor
+ * @param off_out Destination file offset, as off_in
+ * @param len     Maximum bytes to move
+ * @param flags   SPLICE_F_NONBLOCK: don't block on the pipe (as does O_NONBLOCK on it)
+ * @return Bytes moved, 0 at end of input, -1 on error
+ */
+int vfs_splice(int fd_in, int64_t *off_in, int fd_out, int64_t *off_out, uint32_t len,
+               unsigned int flags);
+
+/**
+ * Duplicate data from one pipe into another without consuming it
+ * 
+ * @param fd_in  Read end of the source pipe
+ * @param fd_out Write end of the destination pipe
+ * @param len    Maximum bytes to duplicate
+ * @param flags  SPLICE_F_NONBLOCK: don't block (as does O_NONBLOCK on either pipe)
+ * @return Bytes duplicated, 0 at end of input, -1 on error
+ */
+int vfs_tee(int fd_in, int fd_out, uint32_t len, unsigned int flags);
+
+/**
+ * Copy from a regular file to a pipe or file through the page cache
+ * 
+ * @param out_fd Destination descriptor (pipe or regular file)
+ * @param in_fd  Source regular file
+ * @param offset Source offset, updated (NULL: use and move the file position)
+ * @param count  Maximum bytes to copy
+ * @return Bytes copied, 0 at end of file, -1 on error
+ */
+int vfs_sendfile(int out_fd, int in_fd, int64_t *offset, uint32_t count);
 
 #endif /* VFS_H */
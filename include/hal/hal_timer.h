@@ -7,7 +7,9 @@
  * 
  * Implementation notes:
  * - Each architecture must implement these functions
- * - Timer interrupts should increment an internal tick counter
+ * - The tick count advances once per timer interval; interrupts are
+ *   one-shot, programmed by the kernel for its next event, so several
+ *   ticks may be accounted by one interrupt after an idle period
  * - Timer interval is specified in microseconds
  */
 
@@ -35,17 +37,43 @@
  */
 void hal_timer_init(unsigned long interval_us);
 
+/**
+ * Start timer interrupts on a secondary CPU
+ * 
+ * hal_timer_init() must already have run on the boot CPU; this arms the
+ * calling hart's own timer for the next tick.
+ */
+void hal_timer_init_cpu(void);
+
 /**
  * Get the current tick count
  * 
- * Returns the number of timer interrupts that have occurred since
- * initialization. This counter is incremented by the timer interrupt
- * handler.
+ * Returns the number of timer intervals that have elapsed since
+ * initialization, as of the last timer interrupt. While the CPU idles
+ * with the tick stopped the count is caught up by the next interrupt.
  * 
  * @return Current tick count
  */
 unsigned long hal_timer_get_ticks(void);
 
+/**
+ * Get monotonic time in microseconds
+ * 
+ * Reads the hardware time counter directly, so unlike the tick count it
+ * has sub-tick resolution.
+ * 
+ * @return Microseconds since boot
+ */
+unsigned long hal_timer_get_time_us(void);
+
+/**
+ * Get the time at which a tick begins
+ * 
+ * @param tick Tick number
+ * @return Microseconds since boot (same clock as hal_timer_get_time_us())
+ */
+unsigned long hal_timer_tick_time_us(unsigned long tick);
+
 /**
  * Set the next timer interrupt
  * 
@@ -56,14 +84,24 @@ unsigned long hal_timer_get_ticks(void);
  */
 void hal_timer_set_next(unsigned long interval_us);
 
+/**
+ * Program the next timer interrupt for an absolute time
+ * 
+ * @param time_us Deadline in microseconds since boot; a deadline already
+ *                past fires at once, HAL_TIMER_NO_DEADLINE stops the timer
+ */
+void hal_timer_set_deadline(unsigned long time_us);
+
+#define HAL_TIMER_NO_DEADLINE (~0UL)
+
 /**
  * Handle timer interrupt
  * 
  * This function is called by the interrupt handler when a timer
  * interrupt occurs. It should:
- * 1. Increment the tick counter
- * 2. Perform any timer-related bookkeeping
- * 3. Schedule the next timer interrupt
+ * 1. Bring the tick counter up to date
+ * 2. Run expired kernel timers and account the tick to the scheduler
+ * 3. Program the next timer interrupt (hrtimer_reprogram())
  * 
  * Note: This function is typically called from the trap handler
  */
@@ -23,7 +23,9 @@ void hal_uart_init(void);
 /**
  * Write a single character to UART
  * 
- * Blocks until the character is transmitted.
+ * Blocks until the character is transmitted, or only until it is queued
+ * once hal_uart_enable_interrupts() has been called. Never sleeps, so it
+ * can be used from any context.
  * 
  * @param c Character to transmit
  */
@@ -41,7 +43,10 @@ void hal_uart_puts(const char *s);
 /**
  * Write a buffer of bytes to UART
  * 
- * Writes multiple bytes efficiently without newline conversion.
+ * Writes multiple bytes efficiently without newline conversion. With
+ * interrupts on, the bytes are queued and sent in the background; the
+ * call waits only for as much as does not fit in the queue, sleeping if
+ * called from a process with interrupts enabled.
  * 
  * @param buffer Buffer to transmit
  * @param count Number of bytes to write
@@ -52,7 +57,8 @@ int hal_uart_write(const char *buffer, unsigned int count);
 /**
  * Read a single character from UART
  * 
- * Blocks until a character is available.
+ * Blocks until a character is available: with interrupts on, a process
+ * sleeps until one arrives; other callers poll.
  * 
  * @return Character received from UART
  */
@@ -74,6 +80,53 @@ int hal_uart_data_available(void);
  */
 int hal_uart_getc_nonblock(void);
 
+/**
+ * Handler for received data, called in interrupt context
+ */
+typedef void (*hal_uart_rx_handler_t)(void);
+
+/**
+ * Interrupt on received data instead of being polled
+ * 
+ * The handler runs from the UART's interrupt whenever data arrives and
+ * must drain it with hal_uart_getc_nonblock(). Can only be set once.
+ * Turns interrupts on with hal_uart_enable_interrupts() if need be.
+ * 
+ * @param handler Called with data waiting
+ * @return 0 on success, -1 if the interrupt could not be set up
+ */
+int hal_uart_enable_rx_interrupt(hal_uart_rx_handler_t handler);
+
+/**
+ * Move data through interrupt-driven rings instead of polling
+ * 
+ * From then on the receive interrupt queues input (UART_RX_RING_SIZE
+ * bytes) for hal_uart_getc() and its readers, and writers queue output
+ * (UART_TX_RING_SIZE bytes) that the transmitter-empty interrupt feeds
+ * to the UART's FIFO. Output stays in order; callers running with
+ * interrupts disabled still send synchronously.
+ * 
+ * @return 0 on success, -1 if the interrupt could not be set up
+ */
+int hal_uart_enable_interrupts(void);
+
+/**
+ * Where diverted console output goes, one byte at a time
+ */
+typedef void (*hal_uart_sink_t)(char c);
+
+/**
+ * Divert output from the line
+ * 
+ * While a sink is set, hal_uart_putc(), hal_uart_puts() and
+ * hal_uart_write() hand every byte to it instead of the UART (quiet
+ * boot, see kernel/bootstage.h). The sink may be called from any CPU
+ * and any context. Input is unaffected.
+ * 
+ * @param sink Sink, or NULL to send output to the line again
+ */
+void hal_uart_set_sink(hal_uart_sink_t sink);
+
 /**
  * Write a 32-bit unsigned integer as decimal to UART
  * 
@@ -0,0 +1,125 @@
+/**
+ * @file acct.h
+ * @brief Per-process and per-syscall time and I/O accounting
+ *
+ * Run time is split at trap boundaries: a trap from user mode charges the
+ * time since the process last entered user mode to utime, and the return
+ * to user mode charges the time since the trap (or since the process was
+ * switched in) to stime. context_switch() charges the outgoing process's
+ * kernel time and counts the switch as voluntary if the process stopped
+ * being runnable (it blocked, slept or exited) and involuntary if it was
+ * preempted or yielded, as Linux counts nvcsw and nivcsw.
+ *
+ * Every syscall is timed from dispatch to return, blocking included, into
+ * both the caller's counts and a system-wide table. Latencies go into
+ * log2 buckets: bucket 0 counts calls under 1us, bucket b those from
+ * 2^(b-1) up to 2^b us, and the last bucket everything longer.
+ *
+ * Block I/O is charged to the process that submits it: bytes when it is
+ * queued and wait time while the process waits for it to finish.
+ *
+ * /proc (fs/procfs.h) shows all of it. Counts are updated under the big
+ * kernel lock or, for the trap-boundary times, by the CPU running the
+ * process; readers may see a value a few microseconds stale.
+ */
+
+#ifndef KERNEL_ACCT_H
+#define KERNEL_ACCT_H
+
+#include <stdint.h>
+#include "kernel/bitops.h"
+
+struct process;
+struct trap_frame;
+
+// Latency histogram buckets (the last one is open-ended: >= 2^18 us)
+#define ACCT_HIST_BUCKETS   20
+
+/**
+ * One syscall's counts for one process
+ */
+typedef struct acct_syscall {
+    uint64_t count;                     // Calls that returned
+    uint64_t total_us;                  // Their summed latency
+} acct_syscall_t;
+
+/**
+ * One syscall's counts for the whole system
+ */
+typedef struct acct_syscall_stats {
+    uint64_t count;                     // Calls that returned
+    uint64_t total_us;                  // Their summed latency
+    uint64_t max_us;                    // The slowest
+    uint32_t hist[ACCT_HIST_BUCKETS];   // Calls by log2 latency bucket
+} acct_syscall_stats_t;
+
+/**
+ * Accounting of one process (struct process::acct)
+ */
+typedef struct proc_acct {
+    uint64_t utime_us;                  // Time in user mode
+    uint64_t stime_us;                  // Time in the kernel on its behalf
+    uint64_t mark_us;                   // When the running process last crossed a boundary
+    uint64_t nvcsw;                     // Switches away because it blocked
+    uint64_t nivcsw;                    // Switches away while still runnable
+    uint64_t syscalls;                  // Syscalls that returned
+    uint64_t syscall_us;                // Their summed latency
+    uint64_t syscall_hist[ACCT_HIST_BUCKETS]; // Them by log2 latency bucket
+    uint64_t io_read_bytes;             // Block device bytes it read
+    uint64_t io_write_bytes;            // Block device bytes it wrote
+    uint64_t io_wait_us;                // Time spent waiting for block I/O
+    acct_syscall_t *sys;                // Per-syscall counts, SYSCALL_COUNT of them
+                                        // (NULL until its first syscall)
+} proc_acct_t;
+
+/**
+ * Log2 latency bucket of a duration
+ */
+static inline uint32_t acct_hist_bucket(uint64_t us) {
+    return log2_bucket(us, ACCT_HIST_BUCKETS);
+}
+
+/**
+ * Trap entry: charge user time if the trap came from user mode
+ */
+void acct_trap_enter(struct trap_frame *tf);
+
+/**
+ * Trap exit: charge system time if returning to user mode
+ */
+void acct_trap_exit(struct trap_frame *tf);
+
+/**
+ * Charge the outgoing process and start the clock of the incoming one
+ * (context_switch(), interrupts off; either may be NULL for idle)
+ */
+void acct_switch(struct process *old, struct process *new);
+
+/**
+ * Record a syscall of the running process that took us microseconds
+ */
+void acct_syscall(uint64_t syscall_number, uint64_t us);
+
+/**
+ * Charge block I/O the running process submitted
+ */
+void acct_blk_io(uint64_t bytes, int write);
+
+/**
+ * Charge time the running process spent waiting for block I/O
+ */
+void acct_blk_wait(uint64_t us);
+
+/**
+ * Free a process's accounting (process_free())
+ */
+void acct_release(struct process *proc);
+
+/**
+ * System-wide counts of a syscall
+ *
+ * @return Counts, or NULL if the number is out of range
+ */
+const acct_syscall_stats_t *acct_syscall_stats(uint64_t syscall_number);
+
+#endif // KERNEL_ACCT_H
@@ -0,0 +1,146 @@
+/**
+ * @file aio.h
+ * @brief Asynchronous file I/O with completions read from a descriptor
+ *
+ * An AIO context is a descriptor that file reads and writes are
+ * submitted to, each at a given offset, and whose read() returns their
+ * completions as aio_event records, in the order they finished. poll()
+ * and epoll report it readable while a completion is waiting, so one
+ * process can keep many reads in flight and wait for all of them (and
+ * for its other descriptors) in one place.
+ *
+ * Requests are run by a pool of AIO_WORKERS kernel threads, started by
+ * the first context. Each takes the next request and does the ordinary
+ * blocking read or write through the page cache; while one waits for
+ * the disk the others go on, so up to AIO_WORKERS misses reach the block
+ * queue at once, where they are merged and sorted like anyone else's.
+ *
+ * The workers cannot touch the submitter's memory, so data goes through
+ * a kernel buffer: a write's data is copied in at submission, and a
+ * read's data is copied out to its buffer when reading the context
+ * returns its completion. Read buffers must therefore stay mapped until
+ * then, and are filled in the address space of the process reading the
+ * completion.
+ */
+
+#ifndef AIO_H
+#define AIO_H
+
+#include <stdint.h>
+#include "kernel/poll.h"
+
+/* Request kinds (aio_iocb.opcode) */
+#define AIO_OP_READ         0
+#define AIO_OP_WRITE        1
+
+/* Worker threads, as many as the block queue keeps in flight */
+#define AIO_WORKERS         8
+
+/* Largest transfer of one request, in bytes */
+#define AIO_MAX_IO          (64 * 1024)
+
+/* Requests a context may have submitted and not yet read back */
+#define AIO_MAX_REQUESTS    64
+
+/**
+ * One request, as submitted
+ */
+typedef struct aio_iocb {
+    uint64_t user_data;     /**< Copied to the completion */
+    uint32_t opcode;        /**< AIO_OP_READ or AIO_OP_WRITE */
+    int32_t fd;             /**< Regular file to read or write */
+    uint64_t buf;           /**< User buffer */
+    uint64_t offset;        /**< File offset */
+    uint32_t len;           /**< Bytes, at most AIO_MAX_IO */
+    uint32_t flags;         /**< Must be 0 */
+} aio_iocb_t;
+
+/**
+ * One finished request, as read from the context
+ */
+typedef struct aio_event {
+    uint64_t user_data;     /**< From the request */
+    int64_t result;         /**< Bytes transferred, or -1 */
+    int32_t error;          /**< errno if result is -1, else 0 */
+    uint32_t reserved;
+} aio_event_t;
+
+typedef struct aio_ctx aio_ctx_t;
+
+/**
+ * Create a context, starting the workers if they are not running yet
+ *
+ * @return Context holding one reference, or NULL (errno set)
+ *
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ * @errno THUNDEROS_EAGAIN - No process slot for a worker
+ */
+aio_ctx_t *aio_create(void);
+
+/**
+ * Take another reference to a context (dup2 of its descriptor)
+ *
+ * @param ctx Context
+ */
+void aio_get(aio_ctx_t *ctx);
+
+/**
+ * Drop a reference; the last one frees the context
+ *
+ * Requests still running hold references of their own, so closing the
+ * descriptor lets them finish, and their completions are thrown away.
+ *
+ * @param ctx Context
+ */
+void aio_put(aio_ctx_t *ctx);
+
+/**
+ * Queue one request
+ *
+ * Checks the request and the descriptor now, in the caller's context,
+ * and copies a write's data; errors found later, while the request
+ * runs, come back in its completion.
+ *
+ * @param ctx Context
+ * @param iocb Request (in kernel memory)
+ * @return 0 on success, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_EINVAL - Unknown opcode, flags set, len too large,
+ *        or fd is not a regular file
+ * @errno THUNDEROS_EBADF - fd is not open
+ * @errno THUNDEROS_EACCES - fd is not open for the transfer asked for
+ * @errno THUNDEROS_EAGAIN - AIO_MAX_REQUESTS already outstanding
+ * @errno THUNDEROS_EFAULT - A write's buffer is not readable
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ */
+int aio_submit(aio_ctx_t *ctx, const aio_iocb_t *iocb);
+
+/**
+ * Read completions
+ *
+ * Waits for at least one, unless nonblock is set. Copies each finished
+ * read's data to its buffer on the way; if that fails, the completion
+ * reports EFAULT.
+ *
+ * @param ctx Context
+ * @param buffer Destination for aio_event records
+ * @param size Its size in bytes
+ * @param nonblock Nonzero to fail with EAGAIN instead of waiting
+ * @return Bytes stored (a multiple of sizeof(aio_event_t)), or -1
+ *
+ * @errno THUNDEROS_EINVAL - size is below one record
+ * @errno THUNDEROS_EAGAIN - Nothing finished and nonblock set
+ * @errno THUNDEROS_EINTR - A signal arrived while waiting
+ */
+int aio_read(aio_ctx_t *ctx, void *buffer, uint32_t size, int nonblock);
+
+/**
+ * Get the readiness of a context
+ *
+ * @param ctx Context
+ * @param pt Poll table (may be NULL)
+ * @return POLLIN while a completion is waiting, else 0
+ */
+int aio_poll(aio_ctx_t *ctx, poll_table_t *pt);
+
+#endif // AIO_H
@@ -0,0 +1,63 @@
+/**
+ * @file bitops.h
+ * @brief Bit scanning helpers
+ *
+ * The kernel is built for the base RV64GC ISA, which has no count
+ * trailing zeros instruction (that is Zbb), and is linked without libgcc,
+ * so __builtin_ctzll() is not available either. ctz64() multiplies the
+ * lowest set bit by a De Bruijn constant instead: the top six bits of the
+ * product are different for each of the 64 possible bits, and a table
+ * turns them back into the bit index. It needs no branch and no loop.
+ *
+ * log2_bucket() is the histogram bucket the accounting code and the lock
+ * and latency statistics share, and atomic_max64() how they keep a
+ * maximum that several CPUs update.
+ */
+
+#ifndef KERNEL_BITOPS_H
+#define KERNEL_BITOPS_H
+
+#include <stdint.h>
+
+/**
+ * Index of the lowest set bit of x (x must be non-zero)
+ */
+static inline uint32_t ctz64(uint64_t x) {
+    static const uint8_t debruijn_index[64] = {
+        0, 1, 48, 2, 57, 49, 28, 3, 61, 58, 50, 42, 38, 29, 17, 4,
+        62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12, 5,
+        63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+        46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19, 9, 13, 8, 7, 6
+    };
+    return debruijn_index[((x & -x) * 0x03F79D71B4CB0A89ULL) >> 58];
+}
+
+/**
+ * Log2 histogram bucket of x: 0 for 0, b for 2^(b-1) up to 2^b, the last
+ * of buckets open-ended
+ */
+static inline uint32_t log2_bucket(uint64_t x, uint32_t buckets) {
+    uint32_t b = 0;
+    while (x && b < buckets - 1) {
+        x >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/**
+ * Raise *max to value if it is larger (1 if it was), with a CAS loop so
+ * no update is lost to another CPU
+ */
+static inline int atomic_max64(uint64_t *max, uint64_t value) {
+    uint64_t old = *max;
+    while (value > old) {
+        if (__sync_bool_compare_and_swap(max, old, value)) {
+            return 1;
+        }
+        old = *max;
+    }
+    return 0;
+}
+
+#endif // KERNEL_BITOPS_H
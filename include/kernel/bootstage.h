@@ -0,0 +1,101 @@
+/**
+ * @file bootstage.h
+ * @brief Boot timeline and quiet boot
+ *
+ * kernel_main() marks the end of each init stage; a stage run off the
+ * main path (device probes on the workqueue) records its own start and
+ * end. Times are hal_timer_get_time_us(), the rdtime clock, which counts
+ * from reset, so the first stage ("firmware") is everything before
+ * kernel_main(). bootstage_done() prints the timeline once on the UART,
+ * and /proc/boottime shows it afterwards.
+ *
+ * Quiet boot ("quiet" on the kernel command line: make run QUIET_BOOT=1)
+ * diverts console output into a buffer from bootstage_init() until
+ * bootstage_done(), which prints one summary line instead; /proc/bootlog
+ * shows what was held back. A panic sends output to the line again and
+ * prints the held-back output first.
+ */
+
+#ifndef KERNEL_BOOTSTAGE_H
+#define KERNEL_BOOTSTAGE_H
+
+#include <stdint.h>
+
+// Stages kept; later ones are dropped
+#define BOOTSTAGE_MAX           32
+
+// Console output kept during a quiet boot; the rest is dropped
+#define BOOTSTAGE_LOG_SIZE      16384
+
+/**
+ * One stage of the timeline
+ */
+typedef struct bootstage {
+    const char *name;                   // Stage name (kept, not copied)
+    uint64_t start_us;                  // When it began, since reset
+    uint64_t end_us;                    // When it ended
+    int cpu;                            // CPU that ran it
+} bootstage_t;
+
+/**
+ * Start the timeline
+ *
+ * First thing in kernel_main(), while the device tree is intact: records
+ * the firmware stage and reads "quiet" from the command line.
+ */
+void bootstage_init(void);
+
+/**
+ * Check whether this is a quiet boot
+ */
+int bootstage_quiet(void);
+
+/**
+ * End a stage of the main boot path
+ *
+ * The stage runs from the previous mark (or bootstage_record() made on
+ * the main path) to now.
+ *
+ * @param name Stage name
+ */
+void bootstage_mark(const char *name);
+
+/**
+ * Record a stage that ran off the main path, ending now
+ *
+ * @param name     Stage name
+ * @param start_us When it began (hal_timer_get_time_us())
+ */
+void bootstage_record(const char *name, uint64_t start_us);
+
+/**
+ * Finish the timeline
+ *
+ * Marks the last stage, ends a quiet boot's diversion and prints the
+ * timeline, or on a quiet boot a single summary line.
+ *
+ * @param name Last stage's name
+ */
+void bootstage_done(const char *name);
+
+/**
+ * Get a stage by index
+ *
+ * @return Stage, or NULL past the last one
+ */
+const bootstage_t *bootstage_get(uint32_t index);
+
+/**
+ * Get the output held back by a quiet boot
+ *
+ * @param len Output: its length in bytes
+ * @return The bytes (not NUL-terminated)
+ */
+const char *bootstage_log(uint32_t *len);
+
+/**
+ * Send output to the line again and print what was held back (panics)
+ */
+void bootstage_flush_log(void);
+
+#endif // KERNEL_BOOTSTAGE_H
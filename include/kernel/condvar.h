@@ -14,6 +14,8 @@
 #include "kernel/wait_queue.h"
 #include "kernel/mutex.h"
 
+struct lockstat_class;
+
 /**
  * @brief Condition variable structure
  *
@@ -31,6 +33,9 @@
  */
 typedef struct condvar {
     wait_queue_t waiters;         /**< Processes waiting on this condition */
+#ifdef LOCKSTAT
+    struct lockstat_class *lockstat; /**< Class (see kernel/lockstat.h) */
+#endif
 } condvar_t;
 
 /**
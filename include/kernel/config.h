@@ -17,7 +17,10 @@
 // Hardware and memory layout constants (QEMU virt machine)
 #define KERNEL_LOAD_ADDRESS 0x80000000  // From linker script (M-mode entry)
 #define RAM_START_ADDRESS 0x80000000    // Physical RAM base
-#define RAM_END_ADDRESS 0x88000000      // 128MB RAM end
+#define RAM_END_ADDRESS 0x88000000      // Default RAM end (128MB) if the device tree has no memory node
 #define RAM_SIZE_MB 128                 // Total RAM size
 
+// Most harts the kernel brings up (QEMU virt allows up to 8 per socket)
+#define MAX_CPUS 8
+
 #endif // KERNEL_CONFIG_H
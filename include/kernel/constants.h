@@ -49,9 +49,6 @@
 #define MILLISECONDS_PER_SECOND         1000
 #define MICROSECONDS_PER_MILLISECOND    1000
 
-/* Initial stack size (in pages) */
-#define INITIAL_STACK_PAGES             8    /* 32KB initial stack */
-
 /* Signal exit code base */
 #define SIGNAL_EXIT_BASE                128
 
@@ -82,7 +79,12 @@
 #define VTERM_TAB_WIDTH                 8
 #define VTERM_MAX_ESCAPE_LEN            7
 #define VTERM_CURSOR_HEIGHT             2
-#define VTERM_INPUT_BUFFER_SIZE         64
+#define VTERM_INPUT_BUFFER_SIZE         1024  /* Input ready to be read, per terminal */
+#define VTERM_LINE_MAX                  256   /* Canonical line being edited, newline included */
+#define VTERM_ECHO_BATCH                64    /* Echo gathered before it is drawn */
+#define VTERM_FRAME_US                  16667 /* At most 60 frames a second */
+#define VTERM_SCROLLBACK_LINES          512   /* Lines of history per terminal */
+#define VTERM_SCROLLBACK_BYTES          16384 /* Encoded history per terminal (power of two) */
 
 /* Font rendering */
 #define FONT_TAB_WIDTH                  4    /* 4-space tabs */
@@ -138,17 +140,29 @@
 #define QEMU_VIRTIO_STRIDE              0x1000UL
 #define QEMU_VIRTIO_END                 0x10008000UL
 #define QEMU_CLINT_BASE                 0x2000000UL
+#define QEMU_RTC_BASE                   0x101000UL     /* Goldfish RTC */
 #define QEMU_RAM_START                  0x80000000UL
 #define QEMU_RAM_END                    0x88000000UL
 
+/* UART rings (powers of two) */
+#define UART_TX_RING_SIZE               4096
+#define UART_RX_RING_SIZE               256
+
 /* PLIC constants */
 #define PLIC_BITS_PER_WORD              32
 
 /* Timer/interrupt bit positions */
+#define SSIE_BIT                        1
+#define SIE_SSIE                        (1 << SSIE_BIT)
+#define SIP_SSIP                        (1 << SSIE_BIT)
 #define STIE_BIT                        5
 #define SIE_STIE                        (1 << STIE_BIT)
+#define SEIE_BIT                        9
+#define SIE_SEIE                        (1 << SEIE_BIT)
+#define SCOUNTEREN_TM                   (1 << 1)   /* User mode may read time */
 
 /* SSTATUS bits */
+#define SSTATUS_SPIE_BIT                5
 #define SSTATUS_SPP_BIT                 8
 
 /* Interrupt state for interrupt_restore() */
@@ -193,9 +207,22 @@
 #define PROT_EXEC                       0x4
 
 /* Mapping flags for mmap */
+#define MAP_SHARED                      0x01
 #define MAP_PRIVATE                     0x02
 #define MAP_ANONYMOUS                   0x20
 
+/* Flags for msync */
+#define MS_ASYNC                        0x1
+#define MS_INVALIDATE                   0x2
+#define MS_SYNC                         0x4
+
+/* Advice for madvise */
+#define MADV_NORMAL                     0
+#define MADV_WILLNEED                   3
+#define MADV_DONTNEED                   4
+#define MADV_MERGEABLE                  12
+#define MADV_UNMERGEABLE                13
+
 /*
  * ============================================================================
  * UTILITY CONSTANTS
@@ -2,8 +2,9 @@
 
 #include <stdint.h>
 
-/* Forward declaration */
+/* Forward declarations */
 struct trap_frame;
+struct vfs_filesystem;
 
 /* ELF machine types */
 #define EM_RISCV 0xF3  /* RISC-V architecture */
@@ -13,3 +14,14 @@ struct trap_frame;
 
 int elf_load_exec(const char *path, const char *argv[], int argc);
 int elf_exec_replace(const char *path, const char *argv[], int argc, struct trap_frame *tf);
+
+/**
+ * Forget the cached headers of an executable
+ *
+ * Called by the VFS whenever a file is written, truncated or unlinked,
+ * so the next exec of it reads its headers again.
+ *
+ * @param fs Filesystem of the inode
+ * @param inode Inode number
+ */
+void elf_cache_invalidate(struct vfs_filesystem *fs, uint32_t inode);
@@ -17,6 +17,7 @@
  * 70-89   : VirtIO/driver errors
  * 90-109  : Process/scheduler errors
  * 110-129 : Memory management errors
+ * 130-149 : Network errors
  */
 
 /* ========== Success ========== */
@@ -114,6 +115,27 @@
 #define THUNDEROS_EMEM_BADPTE  117 /* Invalid page table entry */
 #define THUNDEROS_EMEM_DMA     118 /* DMA allocation failed */
 
+/* ========== Network Errors (130-149) ========== */
+#define THUNDEROS_ENOTSOCK      130 /* Not a socket */
+#define THUNDEROS_EDESTADDRREQ  131 /* Destination address required */
+#define THUNDEROS_EMSGSIZE      132 /* Message too long */
+#define THUNDEROS_EPROTONOSUPPORT 133 /* Protocol not supported */
+#define THUNDEROS_EAFNOSUPPORT  134 /* Address family not supported */
+#define THUNDEROS_EADDRINUSE    135 /* Address already in use */
+#define THUNDEROS_EADDRNOTAVAIL 136 /* Cannot assign requested address */
+#define THUNDEROS_ENETDOWN      137 /* Network is down */
+#define THUNDEROS_EHOSTUNREACH  138 /* No route to host */
+#define THUNDEROS_ENOBUFS       139 /* No buffer space available */
+#define THUNDEROS_ECONNREFUSED  140 /* Connection refused */
+#define THUNDEROS_ECONNRESET    141 /* Connection reset by peer */
+#define THUNDEROS_ETIMEDOUT     142 /* Connection timed out */
+#define THUNDEROS_ENOTCONN      143 /* Socket is not connected */
+#define THUNDEROS_EISCONN       144 /* Socket is already connected */
+#define THUNDEROS_EINPROGRESS   145 /* Connection in progress */
+#define THUNDEROS_EALREADY      146 /* Connection already in progress */
+#define THUNDEROS_ENOPROTOOPT   147 /* Protocol not available */
+#define THUNDEROS_EOPNOTSUPP    148 /* Operation not supported on socket */
+
 /* ========== Error Handling Functions ========== */
 
 /**
@@ -0,0 +1,114 @@
+/**
+ * @file eventpoll.h
+ * @brief epoll: registered interest in descriptor readiness
+ *
+ * An epoll instance keeps, for each watched descriptor, a callback entry
+ * on the wait queue its poll method names. When that queue is woken the
+ * descriptor goes on the instance's ready list, so epoll_wait() only
+ * looks at descriptors that had something happen: its cost follows the
+ * number of ready descriptors, not the number watched.
+ *
+ * Level-triggered by default: a descriptor still ready after being
+ * reported stays on the ready list. EPOLLET reports it once per wakeup.
+ */
+
+#ifndef EVENTPOLL_H
+#define EVENTPOLL_H
+
+#include <stdint.h>
+#include "kernel/poll.h"
+#include "fs/vfs.h"
+
+/* epoll_ctl() operations */
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+/* Event bits: the POLL* values plus flags */
+#define EPOLLIN     POLLIN
+#define EPOLLPRI    POLLPRI
+#define EPOLLOUT    POLLOUT
+#define EPOLLERR    POLLERR
+#define EPOLLHUP    POLLHUP
+#define EPOLLET     (1u << 31)  /* Edge-triggered */
+
+/**
+ * User-space epoll event (Linux layout on 64-bit RISC-V)
+ */
+struct epoll_event {
+    uint32_t events;    /**< EPOLL* bits */
+    uint64_t data;      /**< Returned as given to epoll_ctl() */
+};
+
+typedef struct eventpoll eventpoll_t;
+
+/**
+ * Create an empty epoll instance
+ *
+ * @return Instance holding one reference, or NULL (errno set)
+ */
+eventpoll_t *eventpoll_create(void);
+
+/**
+ * Take another reference to an epoll instance (dup2 of its descriptor)
+ *
+ * @param ep Instance
+ */
+void eventpoll_get(eventpoll_t *ep);
+
+/**
+ * Drop a reference; the last one frees the instance and all its
+ * registrations
+ *
+ * @param ep Instance
+ */
+void eventpoll_put(eventpoll_t *ep);
+
+/**
+ * Add, change or remove interest in a descriptor
+ *
+ * @param ep Instance
+ * @param op EPOLL_CTL_*
+ * @param fd Descriptor to watch
+ * @param event Events and user data (ignored for EPOLL_CTL_DEL)
+ * @return 0 on success, -1 on error
+ *
+ * @errno THUNDEROS_EBADF - fd is not open
+ * @errno THUNDEROS_EINVAL - Unknown op, or fd is an epoll instance
+ * @errno THUNDEROS_EEXIST - fd already watched (ADD)
+ * @errno THUNDEROS_ENOENT - fd not watched (MOD, DEL)
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ */
+int eventpoll_ctl(eventpoll_t *ep, int op, int fd, const struct epoll_event *event);
+
+/**
+ * Wait for watched descriptors to become ready
+ *
+ * @param ep Instance
+ * @param events Kernel buffer for the results
+ * @param maxevents Size of events
+ * @param timeout_ms Milliseconds to wait; 0 = don't wait, negative = forever
+ * @return Number of events, 0 on timeout, -1 on error
+ *
+ * @errno THUNDEROS_EINVAL - maxevents not positive
+ * @errno THUNDEROS_EINTR - A signal arrived first
+ */
+int eventpoll_wait(eventpoll_t *ep, struct epoll_event *events, int maxevents, int timeout_ms);
+
+/**
+ * Poll method of an epoll descriptor: readable while anything is ready
+ *
+ * @param ep Instance
+ * @param pt Poll table, or NULL
+ * @return POLLIN or 0
+ */
+int eventpoll_poll(eventpoll_t *ep, poll_table_t *pt);
+
+/**
+ * Drop every registration on a descriptor that is being closed
+ *
+ * @param file Descriptor's file entry (file->epitems lists them)
+ */
+void eventpoll_file_release(vfs_file_t *file);
+
+#endif /* EVENTPOLL_H */
@@ -0,0 +1,59 @@
+/*
+ * Flattened Device Tree (FDT) Parsing
+ * 
+ * Minimal read-only walker for the device tree blob QEMU hands the
+ * kernel at boot. Only what early boot needs is implemented.
+ */
+
+#ifndef FDT_H
+#define FDT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// FDT header magic (big-endian 0xd00dfeed)
+#define FDT_MAGIC 0xd00dfeed
+
+/**
+ * Device tree address saved by boot/entry.S (0 if none was passed)
+ */
+extern uintptr_t boot_fdt_addr;
+
+/**
+ * Find the first RAM region described by the device tree
+ * 
+ * Reads the "reg" property of the first /memory node, honouring the
+ * root node's #address-cells and #size-cells.
+ * 
+ * @param fdt Address of the device tree blob
+ * @param base Output: physical base address of RAM
+ * @param size Output: size of RAM in bytes
+ * @return 0 on success, -1 if fdt is invalid or has no memory node (errno set)
+ */
+int fdt_get_memory(uintptr_t fdt, uintptr_t *base, size_t *size);
+
+/**
+ * List the harts described by the device tree
+ * 
+ * Reads the "reg" property (the hart ID) of every cpu@N node under
+ * /cpus, honouring /cpus' #address-cells.
+ * 
+ * @param fdt Address of the device tree blob
+ * @param hartids Output: hart IDs, in device tree order
+ * @param max Capacity of hartids; further harts are not listed
+ * @return Number of harts stored, or -1 if fdt is invalid (errno set)
+ */
+int fdt_get_cpus(uintptr_t fdt, unsigned long *hartids, int max);
+
+/**
+ * Get the kernel command line
+ * 
+ * Reads the "bootargs" property of /chosen (QEMU's -append).
+ * 
+ * @param fdt Address of the device tree blob
+ * @return The NUL-terminated string inside the blob, or NULL if fdt is
+ *         invalid or has none (errno set)
+ */
+const char *fdt_get_bootargs(uintptr_t fdt);
+
+#endif // FDT_H
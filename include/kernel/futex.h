@@ -0,0 +1,71 @@
+/**
+ * @file futex.h
+ * @brief Fast user-space locking support for ThunderOS
+ *
+ * A futex is a 32-bit word in user memory. User-space locks change it
+ * with atomic instructions and only enter the kernel to sleep when they
+ * find it contended (FUTEX_WAIT) or to wake sleepers (FUTEX_WAKE). The
+ * kernel keeps no object per futex: sleepers are hashed on the word's
+ * address.
+ *
+ * Futexes in private memory are keyed by (page table, virtual address)
+ * and so only match within one process. Futexes in a MAP_SHARED mapping
+ * are keyed by physical address and match in every process mapping it.
+ */
+
+#ifndef _KERNEL_FUTEX_H
+#define _KERNEL_FUTEX_H
+
+#include <stdint.h>
+
+/**
+ * @brief Futex operations (numbered as on Linux)
+ */
+#define FUTEX_WAIT      0   /**< Sleep if *uaddr == val */
+#define FUTEX_WAKE      1   /**< Wake up to val sleepers */
+#define FUTEX_REQUEUE   3   /**< Wake up to val, move up to val2 to uaddr2 */
+
+/**
+ * @brief Number of hash buckets for sleeping waiters
+ */
+#define FUTEX_HASH_BUCKETS  64
+
+/**
+ * @brief Sleep on a futex word if it still holds the expected value
+ *
+ * The comparison and going to sleep are atomic with respect to
+ * futex_wake(), so a wakeup sent after the word changed cannot be lost.
+ *
+ * @param uaddr User address of the futex word (4-byte aligned)
+ * @param val Value the caller last saw in the word
+ * @return 0 when woken by futex_wake(), -1 on error
+ * @errno THUNDEROS_EAGAIN - *uaddr != val
+ * @errno THUNDEROS_EINTR - Woken by something else (e.g. a signal)
+ * @errno THUNDEROS_EFAULT - uaddr is not a mapped, aligned user address
+ */
+int futex_wait(uint32_t *uaddr, uint32_t val);
+
+/**
+ * @brief Wake processes sleeping on a futex word
+ *
+ * @param uaddr User address of the futex word
+ * @param nr_wake Maximum number of processes to wake (oldest first)
+ * @return Number woken, or -1 on error
+ */
+int futex_wake(uint32_t *uaddr, int nr_wake);
+
+/**
+ * @brief Wake some sleepers and move the rest to another futex
+ *
+ * Lets a condition variable broadcast wake one waiter and hand the
+ * others to the mutex word, instead of waking them all to fight over it.
+ *
+ * @param uaddr User address of the futex word
+ * @param nr_wake Maximum number of processes to wake
+ * @param uaddr2 Futex word the remaining sleepers are moved to
+ * @param nr_requeue Maximum number of processes to move
+ * @return Number woken, or -1 on error
+ */
+int futex_requeue(uint32_t *uaddr, int nr_wake, uint32_t *uaddr2, int nr_requeue);
+
+#endif /* _KERNEL_FUTEX_H */
@@ -0,0 +1,88 @@
+/*
+ * High-Resolution Timers for ThunderOS
+ *
+ * One-shot timers with microsecond deadlines on the hal_timer_get_time_us()
+ * clock, independent of the scheduler tick. Each timer interrupt is
+ * programmed for the earliest of the pending hrtimers, the next tick
+ * (only while a process is running) and the running slice's end; an idle
+ * CPU with nothing due sleeps in wfi with the timer stopped.
+ */
+
+#ifndef HRTIMER_H
+#define HRTIMER_H
+
+#include <stdint.h>
+
+typedef void (*hrtimer_fn_t)(void *data);
+
+/**
+ * High-resolution timer
+ *
+ * Embedded in its owner and initialised once with hrtimer_setup(). The
+ * owner must cancel a pending timer before freeing it.
+ */
+typedef struct hrtimer {
+    struct hrtimer *next;               // Next timer by deadline
+    struct hrtimer **pprev;             // Link pointing at us (NULL = not pending)
+    uint64_t expires_us;                // Deadline (hal_timer_get_time_us())
+    hrtimer_fn_t fn;                    // Callback
+    void *data;                         // Callback argument
+} hrtimer_t;
+
+/**
+ * Initialise a timer
+ *
+ * @param timer Timer to initialise
+ * @param fn Callback, run from the timer interrupt with interrupts disabled
+ * @param data Argument passed to fn
+ */
+void hrtimer_setup(hrtimer_t *timer, hrtimer_fn_t fn, void *data);
+
+/**
+ * Arm a timer, or re-arm it if already pending
+ *
+ * Reprograms the timer interrupt if this is now the earliest deadline.
+ *
+ * @param timer Timer to arm
+ * @param expires_us Absolute deadline; one already past fires at once
+ */
+void hrtimer_start(hrtimer_t *timer, uint64_t expires_us);
+
+/**
+ * Disarm a timer
+ *
+ * @param timer Timer to disarm
+ * @return 1 if the timer was pending, 0 if it had fired or was never armed
+ */
+int hrtimer_cancel(hrtimer_t *timer);
+
+/**
+ * Check whether a timer is armed
+ *
+ * @param timer Timer to check
+ * @return Nonzero if pending
+ */
+static inline int hrtimer_pending(const hrtimer_t *timer) {
+    return timer->pprev != 0;
+}
+
+/**
+ * Run every timer due at or before now
+ *
+ * Called from the timer interrupt.
+ *
+ * @param now_us Current time
+ */
+void hrtimer_run(uint64_t now_us);
+
+/**
+ * Program the timer interrupt for the next event
+ *
+ * Picks the earliest of: the first pending hrtimer, and either the next
+ * tick and slice end (a process is running) or the next timer wheel
+ * expiry (idle). Called from every timer interrupt and whenever the
+ * scheduler starts a slice or goes idle.
+ */
+void hrtimer_reprogram(void);
+
+#endif // HRTIMER_H
@@ -61,6 +61,18 @@ size_t kstrlen(const char *str);
  */
 void *kmemset(void *s, int c, size_t n);
 
+/**
+ * Set memory to a repeated 32-bit value
+ * 
+ * Fills a row of pixels with whole-word stores.
+ * 
+ * @param s Memory area, 4-byte aligned
+ * @param value Value to store
+ * @param count Number of 32-bit values
+ * @return Memory area
+ */
+void *kmemset32(void *s, uint32_t value, size_t count);
+
 /**
  * Copy memory
  * 
@@ -0,0 +1,115 @@
+/**
+ * @file lockstat.h
+ * @brief Lock contention statistics per lock class
+ *
+ * Built with LOCK_STATS=1 (-DLOCKSTAT), spinlocks, mutexes, rwlocks and
+ * condition variables report every acquisition to the class of their
+ * lock: how many there were, how many had to wait, how long they waited
+ * and how long the lock was then held, with log2 histograms of both
+ * times (bucket 0 under 1us, bucket b from 2^(b-1) up to 2^b us, the
+ * last open-ended) and the call site of the longest wait.
+ *
+ * A class is all the locks set up in the same place, as with Linux's
+ * lockdep: named spinlocks by their name, other locks by the code that
+ * called mutex_init(), rwlock_init() or cond_init(). Locks set up with a
+ * static initializer join the class of the site that first takes them.
+ * Readers and writers of an rwlock count as two classes. For a condition
+ * variable, the wait is the time asleep in cond_wait() until signalled;
+ * it has no hold time.
+ *
+ * /proc/lockstat shows the classes. Without LOCKSTAT the locks report
+ * nothing, but the table and the file stay, so the interface is the same
+ * in every build. Counters are updated atomically: spinlocks report from
+ * every CPU, outside the big kernel lock.
+ */
+
+#ifndef KERNEL_LOCKSTAT_H
+#define KERNEL_LOCKSTAT_H
+
+#include <stdint.h>
+#include "kernel/bitops.h"
+
+// Lock class kinds
+#define LOCKSTAT_SPIN           0
+#define LOCKSTAT_MUTEX          1
+#define LOCKSTAT_RWLOCK_READ    2
+#define LOCKSTAT_RWLOCK_WRITE   3
+#define LOCKSTAT_CONDVAR        4
+
+// Classes kept; the last one collects the locks of any after that
+#define LOCKSTAT_MAX_CLASSES    64
+
+// Wait and hold time histogram buckets (the last one is >= 2^14 us)
+#define LOCKSTAT_HIST_BUCKETS   16
+
+/**
+ * Statistics of one lock class
+ */
+typedef struct lockstat_class {
+    const void *volatile key;           // Name or set-up site (NULL: slot free)
+    const char *name;                   // NULL: shown as kind@key
+    uint32_t kind;                      // LOCKSTAT_*
+    uint64_t acquisitions;              // Times taken
+    uint64_t contended;                 // Of those, after waiting
+    uint64_t wait_us;                   // Time those waited
+    uint64_t max_wait_us;               // Longest wait
+    uintptr_t max_wait_site;            // Caller that waited longest
+    uint64_t hold_us;                   // Time held
+    uint64_t max_hold_us;               // Longest hold
+    uint32_t wait_hist[LOCKSTAT_HIST_BUCKETS];
+    uint32_t hold_hist[LOCKSTAT_HIST_BUCKETS];
+} lockstat_class_t;
+
+/**
+ * Find or add the class of a kind of lock
+ *
+ * @param kind LOCKSTAT_*
+ * @param key  Name string (for named locks) or set-up site
+ * @param name Name shown, or NULL to show kind@key
+ * @return Class; never NULL (the last slot takes overflow)
+ */
+lockstat_class_t *lockstat_class(uint32_t kind, const void *key, const char *name);
+
+/**
+ * Count an acquisition
+ */
+void lockstat_acquired(lockstat_class_t *cls);
+
+/**
+ * Count an acquisition's wait
+ *
+ * @param wait_us How long it waited
+ * @param site    Return address of the caller that waited
+ */
+void lockstat_waited(lockstat_class_t *cls, uint64_t wait_us, uintptr_t site);
+
+/**
+ * Count a hold ending
+ */
+void lockstat_held(lockstat_class_t *cls, uint64_t hold_us);
+
+/**
+ * Log2 histogram bucket of a time in microseconds
+ */
+static inline uint32_t lockstat_bucket(uint64_t us) {
+    return log2_bucket(us, LOCKSTAT_HIST_BUCKETS);
+}
+
+/**
+ * Get a class by index, for listing
+ *
+ * @return Class, or NULL if that slot is unused
+ */
+const lockstat_class_t *lockstat_get(uint32_t index);
+
+/**
+ * Name of a class kind ("spin", "mutex", "rwlock_r", "rwlock_w", "condvar")
+ */
+const char *lockstat_kind_name(uint32_t kind);
+
+#ifdef LOCKSTAT
+// Caller of the lock function taking it (the site reported for waits)
+#define LOCKSTAT_SITE() ((uintptr_t)__builtin_return_address(0))
+#endif
+
+#endif // KERNEL_LOCKSTAT_H
@@ -0,0 +1,30 @@
+/*
+ * lz4.h - LZ4 block decompression
+ *
+ * Decodes the LZ4 block format (not the frame format): a run of
+ * sequences, each a token, literals and a back-reference into the output
+ * already produced, the last one literals only. Blocks written by any LZ4
+ * compressor decode here; there is no compressor in the kernel.
+ */
+
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stdint.h>
+
+/**
+ * Decompress one LZ4 block
+ *
+ * Every read and write is bounds-checked, so a corrupt block fails
+ * instead of running past either buffer.
+ *
+ * @param src      Compressed block
+ * @param src_len  Its length in bytes
+ * @param dst      Output buffer
+ * @param dst_len  Its size in bytes
+ * @return Bytes written to dst, or -1 if the block is malformed or does
+ *         not fit (errno set to THUNDEROS_EINVAL)
+ */
+int lz4_decompress(const void *src, uint32_t src_len, void *dst, uint32_t dst_len);
+
+#endif /* LZ4_H */
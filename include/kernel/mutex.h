@@ -12,6 +12,8 @@
 #include <stdint.h>
 #include "kernel/wait_queue.h"
 
+struct lockstat_class;
+
 /**
  * @brief Mutex state values
  */
@@ -22,19 +24,40 @@
  * @brief Mutex structure for mutual exclusion
  *
  * A mutex provides mutual exclusion - only one process can hold the lock
- * at a time. Other processes attempting to lock will block until the mutex
- * is unlocked.
+ * at a time. A process that finds it held spins for up to MUTEX_SPIN_US
+ * while the owner is running on another CPU, then blocks. Unlocking with
+ * waiters queued hands the mutex straight to the oldest one, so waiters
+ * get it in FIFO order and never race each other for it.
+ *
+ * Mutexes use priority inheritance: while a process sleeps on one, its
+ * owner runs at no worse than the sleeper's priority.
  */
 typedef struct mutex {
     volatile int locked;          /**< Lock state: MUTEX_UNLOCKED or MUTEX_LOCKED */
     volatile int owner_pid;       /**< PID of process holding the lock (-1 if none) */
+    struct process *volatile owner; /**< Process holding the lock (NULL if none) */
+    struct mutex *pi_next;        /**< Next mutex held by the same owner */
     wait_queue_t waiters;         /**< Processes waiting to acquire the mutex */
+#ifdef LOCKSTAT
+    struct lockstat_class *lockstat; /**< Class (see kernel/lockstat.h) */
+    uint64_t locked_at_us;        /**< When the owner got it */
+#endif
 } mutex_t;
 
+/**
+ * @brief Longest chain of blocked owners a priority boost follows
+ */
+#define MUTEX_PI_MAX_DEPTH  8
+
+/**
+ * @brief Longest time mutex_lock() spins on a running owner before sleeping
+ */
+#define MUTEX_SPIN_US   20
+
 /**
  * @brief Static initializer for mutex
  */
-#define MUTEX_INIT { .locked = MUTEX_UNLOCKED, .owner_pid = -1, .waiters = WAIT_QUEUE_INIT }
+#define MUTEX_INIT { .locked = MUTEX_UNLOCKED, .owner_pid = -1, .owner = NULL, .pi_next = NULL, .waiters = WAIT_QUEUE_INIT }
 
 /**
  * @brief Semaphore structure for counting synchronization
@@ -63,7 +86,8 @@ void mutex_init(mutex_t *mutex);
 /**
  * @brief Acquire a mutex (blocking)
  *
- * Blocks if the mutex is already held by another process.
+ * Blocks if the mutex is already held by another process, after spinning
+ * briefly if that process is running on another CPU.
  * Recursive locking by the same process is NOT allowed and will deadlock.
  *
  * @param mutex Pointer to mutex to acquire
@@ -83,7 +107,8 @@ int mutex_trylock(mutex_t *mutex);
 /**
  * @brief Release a mutex
  *
- * Releases the mutex and wakes one waiting process if any.
+ * If processes are waiting, ownership passes directly to the oldest one
+ * and it is woken; otherwise the mutex becomes unlocked.
  * Must be called by the process that holds the lock.
  *
  * @param mutex Pointer to mutex to release
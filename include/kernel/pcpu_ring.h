@@ -0,0 +1,123 @@
+/**
+ * @file pcpu_ring.h
+ * @brief Per-CPU single-producer record rings
+ *
+ * A set of rings, one per CPU, of fixed-size binary records that the
+ * kernel writes and user space drains through a device (/dev/trace,
+ * /dev/prof). Each ring is single-producer: only its CPU writes, with
+ * interrupts off so a record made from an interrupt handler cannot land
+ * in the middle of another. The writer fills the slot at tail and then
+ * moves tail; a reader copies the slots from head up to tail and then
+ * moves head, and the writer drops records while tail is a whole ring
+ * ahead of head. Readers must be serialised with each other (the devices
+ * run under the big kernel lock), never with the writers.
+ *
+ * Usage (interrupts off):
+ *   rec = pcpu_ring_reserve(&rings, cpu);
+ *   if (rec) { fill rec; pcpu_ring_commit(&rings, cpu); }
+ */
+
+#ifndef KERNEL_PCPU_RING_H
+#define KERNEL_PCPU_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "kernel/config.h"
+#include "arch/barrier.h"
+
+/**
+ * @brief One CPU's ring
+ */
+typedef struct pcpu_ring {
+    uint8_t *slots;             // entries records (NULL: no ring)
+    volatile uint32_t head;     // Next record to read; moved by readers
+    volatile uint32_t tail;     // Next slot to fill; moved by the writer
+    uint64_t written;           // Records written (writer)
+    uint64_t lost;              // Records dropped on a full ring (writer)
+    uint64_t written_base;      // Counts at the last reset (readers)
+    uint64_t lost_base;
+} pcpu_ring_t;
+
+/**
+ * @brief The rings of every CPU, for one record type
+ */
+typedef struct pcpu_rings {
+    pcpu_ring_t cpu[MAX_CPUS];
+    uint32_t entries;           // Records per ring (a power of two)
+    uint32_t record_size;       // Bytes per record
+} pcpu_rings_t;
+
+#define PCPU_RINGS_INIT(entries_, type) { .entries = (entries_), .record_size = sizeof(type) }
+
+/**
+ * @brief Counts over every CPU's ring since the last reset
+ */
+typedef struct pcpu_ring_counts {
+    uint64_t written;
+    uint64_t lost;
+    uint64_t buffered;          // Records waiting to be read
+} pcpu_ring_counts_t;
+
+/**
+ * @brief Take the next slot of a CPU's ring (interrupts off, on that CPU)
+ *
+ * @return Slot to fill, or NULL (counted as lost) if the ring is full or
+ *         was never allocated
+ */
+static inline void *pcpu_ring_reserve(pcpu_rings_t *rings, int cpu) {
+    pcpu_ring_t *ring = &rings->cpu[cpu];
+    uint32_t tail = ring->tail;
+
+    if (!ring->slots || tail - ring->head >= rings->entries) {
+        ring->lost++;
+        return NULL;
+    }
+    return ring->slots + (tail & (rings->entries - 1)) * rings->record_size;
+}
+
+/**
+ * @brief Publish the slot pcpu_ring_reserve() returned
+ */
+static inline void pcpu_ring_commit(pcpu_rings_t *rings, int cpu) {
+    pcpu_ring_t *ring = &rings->cpu[cpu];
+
+    // The record is complete before a reader can see it
+    write_barrier();
+    ring->tail = ring->tail + 1;
+    ring->written++;
+}
+
+/**
+ * @brief Allocate a ring for each CPU that is up and has none yet
+ *
+ * @return 0 on success, -1 on error (errno set)
+ */
+int pcpu_rings_alloc(pcpu_rings_t *rings);
+
+/**
+ * @brief Take records out of the rings, oldest first within each CPU
+ *
+ * @param buf Where to put them (kernel or checked user memory)
+ * @param max Most records to take
+ * @return Records taken
+ */
+uint32_t pcpu_rings_drain(pcpu_rings_t *rings, void *buf, uint32_t max);
+
+/**
+ * @brief Device read(): whole records only, the offset means nothing
+ *
+ * @return Bytes read, or -1 if size is below one record (errno set)
+ */
+int pcpu_rings_read(pcpu_rings_t *rings, void *buffer, uint32_t size);
+
+/**
+ * @brief Drop every buffered record and zero the counts
+ */
+void pcpu_rings_reset(pcpu_rings_t *rings);
+
+/**
+ * @brief Get the counts of every CPU's ring
+ */
+void pcpu_rings_get_counts(const pcpu_rings_t *rings, pcpu_ring_counts_t *counts);
+
+#endif // KERNEL_PCPU_RING_H
@@ -0,0 +1,147 @@
+/**
+ * @file perf_event.h
+ * @brief Hardware performance counters for processes
+ *
+ * perf_event_open() (SYS_PERF_EVENT_OPEN) returns a descriptor that
+ * counts one hardware event (cycles, instructions, cache or TLB misses,
+ * or a raw selector) while one process runs, kernel time on its behalf
+ * included. read() returns a perf_count_t.
+ *
+ * Counters are the hart's: cycle, instret and the hpmcounters, found and
+ * programmed through the SBI PMU extension (arch/sbi.h). An event holds a
+ * counter only while its process is on a CPU: perf_switch() takes one
+ * for each of the incoming process's events and gives those of the
+ * outgoing process back, banking what they counted. Processes that
+ * have no events cost two pointer tests per switch. When every counter
+ * that can count an event is taken, the event misses that slice:
+ * time_running then falls behind time_enabled, as on Linux.
+ *
+ * Events are not inherited by children. A parent can open one on a child
+ * before letting it exec, and read the total after it exits.
+ */
+
+#ifndef KERNEL_PERF_EVENT_H
+#define KERNEL_PERF_EVENT_H
+
+#include <stdint.h>
+
+struct process;
+
+// perf_event_attr_t types
+#define PERF_TYPE_HARDWARE      0   // config: PERF_COUNT_HW_*
+#define PERF_TYPE_HW_CACHE      3   // config: cache | op << 8 | result << 16
+#define PERF_TYPE_RAW           4   // config: the hart's mhpmevent selector
+
+// PERF_TYPE_HARDWARE events
+#define PERF_COUNT_HW_CPU_CYCLES            0
+#define PERF_COUNT_HW_INSTRUCTIONS          1
+#define PERF_COUNT_HW_CACHE_REFERENCES      2
+#define PERF_COUNT_HW_CACHE_MISSES          3
+#define PERF_COUNT_HW_BRANCH_INSTRUCTIONS   4
+#define PERF_COUNT_HW_BRANCH_MISSES         5
+#define PERF_COUNT_HW_MAX                   6
+
+// PERF_TYPE_HW_CACHE caches, operations and results
+#define PERF_COUNT_HW_CACHE_L1D             0
+#define PERF_COUNT_HW_CACHE_L1I             1
+#define PERF_COUNT_HW_CACHE_LL              2
+#define PERF_COUNT_HW_CACHE_DTLB            3
+#define PERF_COUNT_HW_CACHE_ITLB            4
+#define PERF_COUNT_HW_CACHE_BPU             5
+#define PERF_COUNT_HW_CACHE_NODE            6
+#define PERF_COUNT_HW_CACHE_MAX             7
+
+#define PERF_COUNT_HW_CACHE_OP_READ         0
+#define PERF_COUNT_HW_CACHE_OP_WRITE        1
+#define PERF_COUNT_HW_CACHE_OP_PREFETCH     2
+#define PERF_COUNT_HW_CACHE_OP_MAX          3
+
+#define PERF_COUNT_HW_CACHE_RESULT_ACCESS   0
+#define PERF_COUNT_HW_CACHE_RESULT_MISS     1
+#define PERF_COUNT_HW_CACHE_RESULT_MAX      2
+
+#define PERF_HW_CACHE_CONFIG(cache, op, result) \
+    ((uint64_t)(cache) | ((uint64_t)(op) << 8) | ((uint64_t)(result) << 16))
+
+// perf_event_attr_t flags
+#define PERF_ATTR_DISABLED      0x1 // Open stopped; start with PERF_EVENT_IOC_ENABLE
+
+// ioctl() requests on an event descriptor
+#define PERF_EVENT_IOC_ENABLE   0x2400  // Start counting
+#define PERF_EVENT_IOC_DISABLE  0x2401  // Stop counting; the count is kept
+#define PERF_EVENT_IOC_RESET    0x2403  // Zero the count and times
+
+/**
+ * What to count (perf_event_open())
+ */
+typedef struct perf_event_attr {
+    uint32_t type;          /**< PERF_TYPE_* */
+    uint32_t flags;         /**< PERF_ATTR_* */
+    uint64_t config;        /**< Event within the type */
+} perf_event_attr_t;
+
+/**
+ * What read() returns
+ */
+typedef struct perf_count {
+    uint64_t value;             /**< Events counted */
+    uint64_t time_enabled_us;   /**< Time the process ran with the event enabled */
+    uint64_t time_running_us;   /**< The part of it a counter was counting */
+} perf_count_t;
+
+typedef struct perf_event perf_event_t;
+
+/**
+ * Find the hart's counters (SBI PMU extension)
+ *
+ * @return 0 on success, -1 if there is no PMU (errno set)
+ */
+int perf_init(void);
+
+/**
+ * Open an event counting a process
+ *
+ * @param attr What to count
+ * @param target The calling process or one of its children
+ * @return Descriptor, or -1 (errno set)
+ *
+ * @errno THUNDEROS_ENODEV - No PMU
+ * @errno THUNDEROS_EINVAL - Unknown type, config or flags
+ * @errno THUNDEROS_ENOENT - No counter of this hart can count the event
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ */
+int perf_event_open(const perf_event_attr_t *attr, struct process *target);
+
+/**
+ * Read an event (read() on its descriptor)
+ *
+ * @param buffer Checked user memory, at least sizeof(perf_count_t)
+ * @return Bytes read, or -1 (errno set)
+ */
+int perf_event_read(perf_event_t *event, void *buffer, uint32_t size);
+
+/**
+ * PERF_EVENT_IOC_* on an event
+ *
+ * @return 0, or -1 (errno set)
+ */
+int perf_event_ioctl(perf_event_t *event, uint32_t request, uint64_t arg);
+
+/**
+ * Release an event (last close of its descriptor)
+ */
+void perf_event_release(perf_event_t *event);
+
+/**
+ * Hand the CPU's counters from old's events to new's (context_switch(),
+ * interrupts off; either may be NULL for the idle context)
+ */
+void perf_switch(struct process *old, struct process *new);
+
+/**
+ * Called by process_exit(): bank the exiting process's counts and
+ * detach its events, which stay readable until closed
+ */
+void perf_process_exit(struct process *proc);
+
+#endif // KERNEL_PERF_EVENT_H
@@ -10,7 +10,13 @@
  * - Read end (fd[0]): Blocks if no data available, returns EOF when write end closed
  * - Write end (fd[1]): Blocks if buffer full, returns error if read end closed
  * 
- * Maximum pipe buffer size is 4KB (one page).
+ * Every call that may block takes a nonblock argument; with it set (an
+ * O_NONBLOCK descriptor) the call fails with EAGAIN instead of sleeping.
+ * 
+ * Data is kept in a ring of pages, allocated as data arrives and freed
+ * as it is read, so an idle pipe holds no buffer memory. Capacity is
+ * PIPE_DEF_SIZE and can be changed per pipe with F_SETPIPE_SZ, up to
+ * PIPE_MAX_SIZE; bulk streams then block and switch less often.
  */
 
 #ifndef PIPE_H
@@ -19,11 +25,20 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "kernel/wait_queue.h"
+#include "mm/pmm.h"
+
+/**
+ * Capacity of a new pipe, in pages (64KB)
+ */
+#define PIPE_DEF_PAGES 16
 
 /**
- * Maximum size of pipe buffer (4KB - one page)
+ * Largest capacity F_SETPIPE_SZ accepts, in pages (256KB)
  */
-#define PIPE_BUF_SIZE 4096
+#define PIPE_MAX_PAGES 64
+
+#define PIPE_DEF_SIZE (PIPE_DEF_PAGES * PAGE_SIZE)
+#define PIPE_MAX_SIZE (PIPE_MAX_PAGES * PAGE_SIZE)
 
 /**
  * Pipe states
@@ -33,17 +48,48 @@
 #define PIPE_WRITE_CLOSED 2  /**< Write end has been closed */
 #define PIPE_CLOSED     3  /**< Both ends closed, can be freed */
 
+/**
+ * Pipe buffer flags
+ */
+#define PIPE_BUF_CAN_MERGE (1 << 0)  /**< Private page; writes may append to it */
+
+/**
+ * One page of pipe data
+ * 
+ * The pipe holds one reference to the page. Pages written by
+ * pipe_write() belong to the pipe alone; pages spliced in from the page
+ * cache or duplicated by pipe_tee() are shared and read-only.
+ */
+typedef struct pipe_buf {
+    uintptr_t page;              /**< Page holding the data */
+    uint32_t offset;             /**< Start of unread data in the page */
+    uint32_t len;                /**< Bytes of unread data */
+    uint32_t flags;              /**< PIPE_BUF_* flags */
+} pipe_buf_t;
+
+/**
+ * Consumer for pipe_splice_out()
+ * 
+ * @param ctx  Caller's context
+ * @param data Pipe data, in place in its page
+ * @param len  Bytes available at data
+ * @return Bytes consumed (may be fewer than len), -1 on error (errno set)
+ */
+typedef int (*pipe_actor_t)(void *ctx, const void *data, uint32_t len);
+
 /**
  * Pipe structure
  * 
- * Contains circular buffer for data, read/write positions, reference counts
- * for tracking when both ends are closed, and wait queues for blocking I/O.
+ * Contains a ring of data pages, reference counts for tracking when
+ * both ends are closed, and wait queues for blocking I/O.
  */
 typedef struct pipe {
-    char buffer[PIPE_BUF_SIZE];  /**< Circular buffer for pipe data */
-    uint32_t read_pos;           /**< Current read position in buffer */
-    uint32_t write_pos;          /**< Current write position in buffer */
-    uint32_t data_size;          /**< Number of bytes currently in buffer */
+    pipe_buf_t bufs[PIPE_MAX_PAGES]; /**< Ring of data pages */
+    uint32_t head;               /**< Slot of the oldest data */
+    uint32_t nr_bufs;            /**< Slots in use, from head */
+    uint32_t max_bufs;           /**< Capacity in pages */
+    uint32_t data_size;          /**< Number of bytes currently in the pipe */
+    uint64_t consumed;           /**< Bytes read out since the pipe was created */
     uint32_t state;              /**< Current pipe state (PIPE_*) */
     uint32_t read_ref_count;     /**< Number of open read ends */
     uint32_t write_ref_count;    /**< Number of open write ends */
@@ -80,13 +126,15 @@ pipe_t* pipe_create(void);
  * @param pipe Pointer to pipe structure
  * @param buffer Destination buffer for read data
  * @param count Maximum number of bytes to read
+ * @param nonblock Nonzero to fail with EAGAIN instead of sleeping
  * 
  * @return Number of bytes read on success, 0 on EOF, -1 on error
  * 
  * @errno THUNDEROS_EINVAL - Invalid pipe or buffer pointer
  * @errno THUNDEROS_EPIPE - Pipe read end already closed
+ * @errno THUNDEROS_EAGAIN - Empty and nonblock set
  */
-int pipe_read(pipe_t* pipe, void* buffer, size_t count);
+int pipe_read(pipe_t* pipe, void* buffer, size_t count, int nonblock);
 
 /**
  * Write data to pipe (blocking)
@@ -99,13 +147,136 @@ int pipe_read(pipe_t* pipe, void* buffer, size_t count);
  * @param pipe Pointer to pipe structure
  * @param buffer Source buffer containing data to write
  * @param count Number of bytes to write
+ * @param nonblock Nonzero to fail with EAGAIN instead of sleeping
  * 
  * @return Number of bytes written on success, -1 on error
  * 
  * @errno THUNDEROS_EINVAL - Invalid pipe or buffer pointer
  * @errno THUNDEROS_EPIPE - Read end closed, cannot write (broken pipe)
+ * @errno THUNDEROS_ENOMEM - No page free for the data
+ * @errno THUNDEROS_EAGAIN - Full and nonblock set
+ */
+int pipe_write(pipe_t* pipe, const void* buffer, size_t count, int nonblock);
+
+/**
+ * Queue a page in a pipe by reference (splice into a pipe)
+ * 
+ * Blocks until the pipe has a free slot. On success the caller's
+ * reference to the page passes to the pipe; on error it stays with the
+ * caller. The page is never written through the pipe.
+ * 
+ * @param pipe Pointer to pipe structure
+ * @param page Physical page with data
+ * @param offset Start of the data in the page
+ * @param len Bytes of data
+ * @param nonblock Nonzero to fail with EAGAIN instead of sleeping
+ * @return len on success, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Invalid pipe, page or range
+ * @errno THUNDEROS_EPIPE - Read end closed
+ * @errno THUNDEROS_EAGAIN - No free slot and nonblock set
+ */
+int pipe_splice_page(pipe_t* pipe, uintptr_t page, uint32_t offset, uint32_t len, int nonblock);
+
+/**
+ * Pass pipe data to a consumer without copying it out first (splice out)
+ * 
+ * Blocks like pipe_read() while the pipe is empty. Data is handed to the
+ * actor a page at a time and dropped from the pipe as it is consumed;
+ * stops early when the actor takes less than it was offered.
+ * 
+ * @param pipe Pointer to pipe structure
+ * @param actor Consumer
+ * @param ctx Passed to the actor
+ * @param count Maximum bytes to consume
+ * @param nonblock Nonzero to fail with EAGAIN instead of sleeping
+ * @return Bytes consumed, 0 on EOF, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Invalid pipe or actor
+ * @errno THUNDEROS_EPIPE - Read end already closed
+ * @errno THUNDEROS_EAGAIN - Empty and nonblock set
+ */
+int pipe_splice_out(pipe_t* pipe, pipe_actor_t actor, void *ctx, size_t count, int nonblock);
+
+/**
+ * Copy data from one pipe to another by reference (tee)
+ * 
+ * The data stays in src. Blocks while src is empty or dst has no free
+ * slot. Both pipes share the pages afterwards.
+ * 
+ * @param src Pipe to duplicate from
+ * @param dst Pipe to duplicate into
+ * @param count Maximum bytes to duplicate
+ * @param nonblock Nonzero to fail with EAGAIN instead of sleeping
+ * @return Bytes duplicated, 0 on EOF of src, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Invalid pipes, or src == dst
+ * @errno THUNDEROS_EPIPE - src's read end or dst's read end closed
+ * @errno THUNDEROS_EAGAIN - src empty or dst full, and nonblock set
+ */
+int pipe_tee(pipe_t* src, pipe_t* dst, size_t count, int nonblock);
+
+/**
+ * Move data from one pipe to another by reference
+ * 
+ * Whole pages change hands; the pipes share a page split by count, and
+ * neither appends to it afterwards. Blocks like pipe_tee(); the data
+ * leaves src.
+ * 
+ * @param src Pipe to move from
+ * @param dst Pipe to move into
+ * @param count Maximum bytes to move
+ * @param nonblock Nonzero to fail with EAGAIN instead of sleeping
+ * @return Bytes moved, 0 on EOF of src, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Invalid pipes, or src == dst
+ * @errno THUNDEROS_EPIPE - src's read end or dst's read end closed
+ * @errno THUNDEROS_EAGAIN - src empty or dst full, and nonblock set
+ */
+int pipe_move(pipe_t* src, pipe_t* dst, size_t count, int nonblock);
+
+struct poll_table;
+
+/**
+ * Poll method of a pipe end
+ * 
+ * The read end is readable (POLLIN) while data is queued and reports
+ * POLLHUP once no writer is left; the write end is writable (POLLOUT)
+ * while a write would not block and reports POLLERR once no reader is
+ * left.
+ * 
+ * @param pipe Pointer to pipe structure
+ * @param write_end Nonzero for the write end
+ * @param pt Poll table to register on, or NULL
+ * @return POLL* mask
+ */
+int pipe_poll(pipe_t* pipe, int write_end, struct poll_table *pt);
+
+/**
+ * Get the capacity of a pipe
+ * 
+ * @param pipe Pointer to pipe structure
+ * @return Capacity in bytes, or -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Invalid pipe pointer
+ */
+int pipe_get_size(pipe_t* pipe);
+
+/**
+ * Set the capacity of a pipe (F_SETPIPE_SZ)
+ * 
+ * The size is rounded up to whole pages. Nothing is allocated here;
+ * the capacity only bounds how many pages writes may add.
+ * 
+ * @param pipe Pointer to pipe structure
+ * @param size Requested capacity in bytes
+ * @return New capacity in bytes, or -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Invalid pipe pointer or size 0
+ * @errno THUNDEROS_EPERM - Size above PIPE_MAX_SIZE
+ * @errno THUNDEROS_EBUSY - The pipe holds more data than the new size
  */
-int pipe_write(pipe_t* pipe, const void* buffer, size_t count);
+int pipe_set_size(pipe_t* pipe, size_t size);
 
 /**
  * Close read end of pipe
@@ -149,7 +320,8 @@ int pipe_can_free(pipe_t* pipe);
 /**
  * Free pipe resources
  * 
- * Deallocates pipe structure. Should only be called when both ends are closed.
+ * Deallocates pipe structure and any unread data. Should only be called
+ * when both ends are closed.
  * 
  * @param pipe Pointer to pipe structure to free
  */
@@ -0,0 +1,163 @@
+/**
+ * @file poll.h
+ * @brief Readiness polling for file descriptors
+ *
+ * Everything that can be waited on (pipes, terminals, sockets, and
+ * signalfd, AIO and epoll descriptors) reports readiness through a poll
+ * method of the form
+ *
+ *   int x_poll(x_t *obj, poll_table_t *pt) {
+ *       poll_wait(pt, &obj->wait_queue);   // where wakeups come from
+ *       return ready ? POLLIN : 0;         // what is ready right now
+ *   }
+ *
+ * The poll table, when not NULL, registers a callback entry on each wait
+ * queue passed to poll_wait(); poll() uses this to sleep until one of
+ * many objects changes and epoll to keep interest registered between
+ * calls. Registering before testing means no wakeup is missed.
+ */
+
+#ifndef POLL_H
+#define POLL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "kernel/wait_queue.h"
+
+struct vfs_file;
+
+/* Event bits (Linux values) */
+#define POLLIN      0x0001  /* Data to read */
+#define POLLPRI     0x0002  /* Urgent data */
+#define POLLOUT     0x0004  /* Writing will not block */
+#define POLLERR     0x0008  /* Error (e.g. no reader left) */
+#define POLLHUP     0x0010  /* Hang up (no writer left) */
+#define POLLNVAL    0x0020  /* Not an open descriptor */
+
+/* Always reported, whether asked for or not */
+#define POLL_ALWAYS (POLLERR | POLLHUP | POLLNVAL)
+
+/* Most entries one poll() call takes */
+#define POLL_MAX_FDS 64
+
+/**
+ * User-space poll() entry (struct pollfd)
+ */
+struct pollfd {
+    int fd;             /**< Descriptor (negative: ignored) */
+    short events;       /**< Requested events */
+    short revents;      /**< Returned events */
+};
+
+struct poll_table;
+
+/**
+ * Callback for each wait queue a poll method may be woken from
+ */
+typedef void (*poll_queue_fn_t)(struct poll_table *pt, wait_queue_t *wq);
+
+/**
+ * Poll table passed to poll methods
+ *
+ * Embedded as the first member of the structure that owns it, so the
+ * callback can find its owner by casting.
+ */
+typedef struct poll_table {
+    poll_queue_fn_t queue;
+} poll_table_t;
+
+/**
+ * Tell the poller that wakeups of wq signal a change
+ *
+ * @param pt Poll table (NULL: only testing, nothing is registered)
+ * @param wq Wait queue woken when readiness changes
+ */
+static inline void poll_wait(poll_table_t *pt, wait_queue_t *wq) {
+    if (pt && pt->queue) {
+        pt->queue(pt, wq);
+    }
+}
+
+/**
+ * A process waiting on several wait queues at once
+ *
+ * Used by poll() and epoll_wait(): each queue gets one of the entries,
+ * whose callback marks the waiter triggered and wakes its process.
+ */
+typedef struct poll_waiter {
+    poll_table_t pt;                /**< Must be first */
+    struct process *proc;           /**< Process to wake */
+    volatile int triggered;         /**< Set by a wakeup since the last sleep */
+    wait_queue_entry_t *entries;    /**< Caller-provided entries */
+    int nr_entries;                 /**< Entries in use */
+    int max_entries;                /**< Size of entries */
+    int overflow;                   /**< More queues than entries: rescan on a timer */
+} poll_waiter_t;
+
+/**
+ * Set up a waiter for the current process
+ *
+ * @param pw Waiter
+ * @param entries Storage for one entry per wait queue
+ * @param max_entries Number of entries
+ */
+void poll_waiter_init(poll_waiter_t *pw, wait_queue_entry_t *entries, int max_entries);
+
+/**
+ * Sleep until one of the registered queues is woken
+ *
+ * Returns at once if a wakeup already happened since the last call.
+ * Signals and the deadline also end the sleep.
+ *
+ * @param pw Waiter
+ * @param deadline_us Absolute time to give up (0: no deadline)
+ */
+void poll_waiter_sleep(poll_waiter_t *pw, uint64_t deadline_us);
+
+/**
+ * Unregister every entry of a waiter
+ *
+ * @param pw Waiter
+ */
+void poll_waiter_release(poll_waiter_t *pw);
+
+/**
+ * Get the readiness of an open file
+ *
+ * Covers the console as well as VFS files.
+ *
+ * @param file Open file
+ * @param pt   Poll table to register on, or NULL
+ * @return POLL* mask
+ */
+int poll_file(struct vfs_file *file, poll_table_t *pt);
+
+/**
+ * Get the readiness of a descriptor of the calling process
+ *
+ * @param fd Descriptor
+ * @param pt Poll table to register on, or NULL
+ * @return POLL* mask (POLLNVAL for a bad descriptor)
+ */
+int poll_fd(int fd, poll_table_t *pt);
+
+/**
+ * Wait for events on a set of descriptors (poll())
+ *
+ * @param fds Kernel copy of the pollfd array; revents is filled in
+ * @param nfds Number of entries
+ * @param timeout_ms Milliseconds to wait; 0 = don't wait, negative = forever
+ * @return Number of entries with revents set, 0 on timeout, -1 on error
+ *
+ * @errno THUNDEROS_EINVAL - More than POLL_MAX_FDS entries
+ * @errno THUNDEROS_ENOMEM - No memory for wait entries
+ * @errno THUNDEROS_EINTR - A signal arrived first
+ */
+int do_poll(struct pollfd *fds, uint32_t nfds, int timeout_ms);
+
+/**
+ * Check whether the current process has an unblocked signal pending
+ */
+int poll_signal_pending(void);
+
+#endif /* POLL_H */
@@ -12,12 +12,17 @@
 #include <stddef.h>
 #include "trap.h"
 #include "mm/paging.h"
+#include "kernel/timer_wheel.h"
+#include "kernel/hrtimer.h"
+#include "kernel/seqlock.h"
+#include "kernel/acct.h"
+#include "kernel/wait_queue.h"
 
 // Forward declaration
 typedef uint64_t sigset_t;
 typedef void (*sighandler_t)(int);
 
-#define NSIG 32
+#define NSIG 64
 
 // Process states
 typedef enum {
@@ -34,7 +39,10 @@ typedef enum {
 typedef int32_t pid_t;
 
 // Maximum number of processes
-#define MAX_PROCS 64
+#define MAX_PROCS 256
+
+// Buckets in the PID and process group hashes
+#define PID_HASH_BUCKETS 64
 
 // Process name length
 #define PROC_NAME_LEN 32
@@ -42,7 +50,13 @@ typedef int32_t pid_t;
 // User stack size (1MB)
 #define USER_STACK_SIZE (1024 * 1024)
 
-// Kernel stack size (16KB)
+// Level-0 page tables the reaper frees before letting others run
+#define PROCESS_TEARDOWN_BATCH 8
+
+// Reaper thread priority (nice 19, kernel/scheduler.h)
+#define PROCESS_REAPER_PRIORITY 29
+
+// Kernel stack size (16KB, half a kstack slot: mm/kstack.h)
 #define KERNEL_STACK_SIZE (16 * 1024)
 
 // RISC-V ABI requires 16-byte stack alignment
@@ -64,15 +78,37 @@ typedef int32_t pid_t;
 #define VM_USER     0x08  // User accessible
 #define VM_SHARED   0x10  // Shared mapping
 #define VM_GROWSDOWN 0x20 // Stack segment (grows downward)
+#define VM_MERGEABLE 0x40 // Scanned for identical pages (madvise, mm/ksm.h)
 
-// Virtual memory area - tracks mapped memory regions
+// Virtual memory area - tracks mapped memory regions. VMAs are linked in
+// address order and indexed by an AVL tree (see kernel/vma.h).
 typedef struct vm_area {
     uint64_t start;           // Start virtual address (inclusive)
     uint64_t end;             // End virtual address (exclusive)
     uint32_t flags;           // Protection flags (VM_READ, VM_WRITE, etc.)
-    struct vm_area *next;     // Next VMA in list
+    int height;               // AVL subtree height
+    struct vm_area *next;     // Next VMA in address order
+    struct vm_area *prev;     // Previous VMA in address order
+    struct vm_area *left;     // Tree: lower addresses
+    struct vm_area *right;    // Tree: higher addresses
+    uint64_t max_gap;         // Largest gap below any VMA in this subtree
+    struct vfs_node *file;    // Backing file (NULL = anonymous)
+    uint64_t file_offset;     // File (or shm object) offset of start (page-aligned)
+    struct shm_object *shm;   // Shared memory object (NULL = none)
 } vm_area_t;
 
+// Link on one of the process lists (PID hash, process group, siblings).
+// pprev points at whatever points at us, so unlinking needs no search.
+typedef struct proc_link {
+    struct process *next;     // Next process on the list
+    struct process **pprev;   // Pointer to us in the previous entry (NULL = unlinked)
+} proc_link_t;
+
+struct fp_state;
+struct perf_event;
+struct fdtable;
+struct vfs_node;
+
 // Process context - saved during context switch
 struct context {
     unsigned long ra;   // Return address
@@ -96,25 +132,72 @@ struct process {
     pid_t pid;                          // Process ID
     proc_state_t state;                 // Process state
     char name[PROC_NAME_LEN];           // Process name
+    seqcount_t seq;                     // Guards pid, name and slot reuse for lock-free readers
+    proc_link_t pid_link;               // PID hash chain
     
     // Memory management - ISOLATION CRITICAL
     page_table_t *page_table;           // Virtual memory page table (isolated per-process)
-    uintptr_t kernel_stack;             // Kernel stack base
+    uint64_t asid;                      // ASID + generation (0 = none yet), see switch_page_table_asid()
+    int last_cpu;                       // CPU it last ran on (-1 = none yet), soft affinity
+    uintptr_t kernel_stack;             // Kernel stack base (kstack_alloc())
     uintptr_t user_stack;               // User stack base (virtual)
-    vm_area_t *vm_areas;                // List of mapped virtual memory areas
+    vm_area_t *vm_areas;                // Mapped virtual memory areas, sorted by address
+    vm_area_t *vma_root;                // AVL tree over vm_areas
     uint64_t heap_start;                // Heap start address
     uint64_t heap_end;                  // Current heap end (brk)
     
+    // Memory accounting (see process_update_mm_stats())
+    uint64_t rss_pages;                 // Resident user pages (shared zero page excluded)
+    uint64_t peak_rss_pages;            // High-water mark of rss_pages
+    uint64_t pt_pages;                  // Page-table pages, as of the last update
+    uint64_t minor_faults;              // Faults resolved without I/O
+    uint64_t major_faults;              // Faults that read from a filesystem
+    struct rgroup *rgroup;              // Resource group, charged for CPU and memory (see kernel/rgroup.h)
+    
+    // Time, context switch, syscall and block I/O accounting (see kernel/acct.h)
+    proc_acct_t acct;
+    
     // Saved context (for context switching)
     struct context context;             // Kernel context
     struct trap_frame *trap_frame;      // User context (trap frame)
+    struct fp_state *fp_state;          // Saved FP registers (NULL until first FP use)
+    struct perf_event *perf_events;     // Counters on this process (see kernel/perf_event.h)
+    void (*kthread_fn)(void *);         // Kernel thread body (see kthread_create())
+    void *kthread_arg;                  // Its argument
     
     // Scheduling
     uint64_t cpu_time;                  // Total CPU time used (in ticks)
     uint64_t priority;                  // Scheduling priority (lower = higher priority)
+    uint64_t base_priority;             // Priority without mutex inheritance boosts
+    uint64_t vruntime;                  // Weighted run time in us (fair class)
+    uint64_t exec_start_us;             // When run time was last charged
+    uint64_t slice_used_us;             // Run time since last picked
+    struct process *run_next;           // Next process on the same run list (RT, deadline)
+    struct process *run_prev;           // Previous process on the same run list (RT, deadline)
+    uint32_t run_level;                 // Run list (RT) or heap slot (fair) while queued
+    int run_queued;                     // Nonzero while on a run queue
+    int rq_cpu;                         // Whose run queue, while queued
+    uint64_t wake_us;                   // When made runnable, until it runs (0 = not stamped)
+    uintptr_t wake_site;                // Caller of scheduler_enqueue() that did it
+    ktimer_t sleep_timer;               // Wakeup for process_sleep()
+    hrtimer_t sleep_hrtimer;            // Wakeup for process_sleep_us()
+    struct wait_queue_entry *wait_entry; // Entry on the wait queue it sleeps on (NULL = none)
+    struct mutex *pi_held;              // Mutexes it holds (boost sources), via mutex->pi_next
+    struct mutex *pi_blocked_on;        // Mutex it sleeps waiting for (NULL = none)
+    uint32_t sched_policy;              // SCHED_NORMAL, _FIFO, _RR or _DEADLINE (kernel/scheduler.h)
+    uint64_t dl_runtime_us;             // SCHED_DEADLINE: this much run time...
+    uint64_t dl_deadline_us;            // ...within this long of each period's start...
+    uint64_t dl_period_us;              // ...every period
+    uint64_t dl_abs_deadline_us;        // Current job's absolute deadline (EDF key)
+    int64_t dl_budget_us;               // Run time left to the current job
+    int dl_throttled;                   // Budget spent: off the run queue until dl_timer
+    hrtimer_t dl_timer;                 // Refills the budget at the next period
     
     // Process tree
     struct process *parent;             // Parent process
+    struct process *children;           // First child, via sibling_link
+    proc_link_t sibling_link;           // Parent's other children
+    wait_queue_t child_wait;            // waitpid() sleeps here until a child exits or stops
     
     // Exit status
     int exit_code;                      // Exit code if state is ZOMBIE
@@ -131,19 +214,62 @@ struct process {
     // Process groups and sessions
     pid_t pgid;                         // Process group ID
     pid_t sid;                          // Session ID
+    proc_link_t pgrp_link;              // Process group hash chain (by pgid)
     
     // Signal handling
     sigset_t pending_signals;           // Pending signals (bitmask)
     sigset_t blocked_signals;           // Blocked signals (bitmask)
     sighandler_t signal_handlers[NSIG]; // Signal handler functions
+    struct sigqueue *sigqueue;          // Queued real-time signals (NULL = none yet)
+    
+    // Open files (see fs/fdtable.h)
+    struct fdtable *files;              // Descriptor table (NULL = the kernel's)
     
     // Current working directory
     char cwd[256];                      // Current working directory path
+    struct vfs_node *cwd_node;          // Its directory, where relative paths start
+                                        // (reference held; NULL = the root)
     
     // Console multiplexing
     int controlling_tty;                // Controlling terminal index (-1 = none)
+    
+    // Batched syscalls (see kernel/ring.h)
+    struct ring_header *ring;           // Registered submission ring (NULL = none)
+    uint32_t ring_entries;              // Its entries per queue, as validated
+    
+    // vfork (see process_vfork())
+    struct process *vfork_parent;       // Parent whose address space we borrow (NULL = none)
+    struct process *vfork_child;        // Child borrowing ours; we sleep until it is NULL
+    
+    // Threads (see process_clone()). The leader's VMAs, heap, ASID and
+    // memory accounting are the group's; the other threads' are unused.
+    struct process *group_leader;       // First thread; its pid is the group's (self if alone)
+    struct process *threads;            // Leader: the other threads, via thread_link
+    proc_link_t thread_link;            // Leader's other threads
+    int nr_threads;                     // Leader: threads not yet reaped, itself included
+    int group_exiting;                  // Leader: exit_group(), a fatal signal or execve()
+                                        // is ending the other threads
+    int group_exit_code;                // Leader: exit code once the group exits
+    uint32_t *clear_child_tid;          // Zeroed and woken as a futex when we exit (NULL = none)
 };
 
+// clone() flags (numbered as on Linux). A thread needs the first four.
+#define CLONE_VM                0x00000100  // Share the address space
+#define CLONE_FILES             0x00000400  // Share the descriptor table
+#define CLONE_SIGHAND           0x00000800  // Share signal dispositions
+#define CLONE_THREAD            0x00010000  // Same thread group (pid, signals, exit)
+#define CLONE_SETTLS            0x00080000  // Set tp to tls
+#define CLONE_CHILD_CLEARTID    0x00200000  // Clear *ctid and wake it as a futex at exit
+
+#define CLONE_THREAD_FLAGS      (CLONE_VM | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD)
+
+/**
+ * Get a process's thread group ID (its pid for a single-threaded process)
+ */
+static inline pid_t process_tgid(const struct process *proc) {
+    return proc->group_leader->pid;
+}
+
 /**
  * Initialize the process management subsystem
  * 
@@ -162,7 +288,29 @@ void process_init(void);
 struct process *process_create(const char *name, void (*entry_point)(void *), void *arg);
 
 /**
- * Exit the current process
+ * Create a kernel thread
+ * 
+ * Lighter than process_create(): the thread runs on its kernel stack in
+ * the kernel page table, with no user stack and no trap frame. It is
+ * nobody's child and blocks all signals, and is meant to run until
+ * shutdown; if fn returns, the thread exits and its slot stays a zombie.
+ * 
+ * @param name Thread name
+ * @param fn Thread body, entered with interrupts enabled
+ * @param arg Argument to pass to fn
+ * @return New (runnable) thread, or NULL on failure (errno set)
+ * @errno THUNDEROS_EAGAIN - Process table full
+ * @errno THUNDEROS_ENOMEM - No memory for the kernel stack
+ */
+struct process *kthread_create(const char *name, void (*fn)(void *), void *arg);
+
+/**
+ * Exit the current thread
+ * 
+ * For a single-threaded process this is the process's exit. A thread
+ * other than the leader clears its clear_child_tid word and is reaped at
+ * once; the leader stays a zombie its parent cannot reap until the
+ * other threads have exited.
  * 
  * @param exit_code Exit status code
  */
@@ -175,9 +323,23 @@ void process_exit(int exit_code) __attribute__((noreturn));
  */
 struct process *process_current(void);
 
+/**
+ * Switch to a process's page table on this CPU
+ * 
+ * Also drops any translations a previous stay on this CPU left under the
+ * process's ASID, if it last ran somewhere else.
+ * 
+ * @param proc Process whose page table to use
+ */
+void process_switch_page_table(struct process *proc);
+
 /**
  * Get process by PID
  * 
+ * Takes no lock. The slot may be reused once the process is reaped, so
+ * a caller that can sleep before using the result should check its pid
+ * again afterwards.
+ * 
  * @param pid Process ID
  * @return Pointer to process, or NULL if not found
  */
@@ -211,7 +373,8 @@ int process_has_children(struct process *parent, int target_pid);
 /**
  * Get process by index in process table
  * 
- * Used for iterating through all processes.
+ * Used for iterating through all processes. Takes no lock: read the
+ * fields that must agree (pid, name) under the slot's seq.
  * 
  * @param index Index in process table (0 to MAX_PROCS-1)
  * @return Process pointer, or NULL if index invalid or slot unused
@@ -228,10 +391,23 @@ int process_get_max_count(void);
 /**
  * Sleep for a number of ticks
  * 
+ * Parks the current process off the run queue until the timer wheel wakes
+ * it, or until process_wakeup() (e.g. a signal) ends the sleep early.
+ * 
  * @param ticks Number of timer ticks to sleep
  */
 void process_sleep(uint64_t ticks);
 
+/**
+ * Sleep for a number of microseconds
+ * 
+ * Same as process_sleep(), but woken by a high-resolution timer instead
+ * of at a tick boundary.
+ * 
+ * @param us Microseconds to sleep
+ */
+void process_sleep_us(uint64_t us);
+
 /**
  * Wake up a process
  * 
@@ -268,6 +444,72 @@ void process_dump(void);
 struct trap_frame;
 pid_t process_fork(struct trap_frame *current_tf);
 
+/**
+ * Fork the current process, lending the child its address space
+ * 
+ * The child runs on the parent's page table, VMAs and stack, so nothing
+ * is copied. The parent sleeps until the child calls execve() or exits;
+ * until then the child must do nothing else that the parent would notice
+ * (return from the calling function, write its variables).
+ * 
+ * @return Child PID in parent, 0 in child, -1 on error
+ */
+pid_t process_vfork(struct trap_frame *current_tf);
+
+/**
+ * Start a new thread in the current process
+ * 
+ * The thread shares the caller's page table, VMAs, descriptor table and
+ * signal dispositions, and gets its own kernel stack and trap frame: it
+ * returns 0 from the same syscall, on stack with tp = tls. Threads are
+ * nobody's children: they are reaped as soon as they exit, and the group
+ * leader only becomes a zombie its parent can reap once they all have.
+ * 
+ * @param current_tf Current trap frame with register state to copy to the thread
+ * @param flags CLONE_THREAD_FLAGS, plus CLONE_SETTLS and CLONE_CHILD_CLEARTID
+ * @param stack Initial user stack pointer (16-byte aligned)
+ * @param tls Thread pointer, with CLONE_SETTLS
+ * @param ctid Word to clear at exit, with CLONE_CHILD_CLEARTID
+ * @return New thread's ID, or -1 on error (errno set)
+ * @errno THUNDEROS_EINVAL - Bad flags or stack
+ * @errno THUNDEROS_EFAULT - ctid is not a writable user word
+ * @errno THUNDEROS_EAGAIN - Process table full
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ */
+pid_t process_clone(struct trap_frame *current_tf, uint64_t flags, uintptr_t stack,
+                    uintptr_t tls, uint32_t *ctid);
+
+/**
+ * Exit every thread of the current process
+ * 
+ * The other threads get SIGKILL; the group leader's parent sees
+ * exit_code once they are all gone. Fatal signals end processes this way.
+ * 
+ * @param exit_code Exit status code
+ */
+void process_exit_group(int exit_code) __attribute__((noreturn));
+
+/**
+ * Make the current thread the only one in its process, for execve()
+ * 
+ * Kills the other threads and sleeps until they are reaped.
+ * 
+ * @return 0 on success, -1 on error (errno set)
+ * @errno THUNDEROS_EBUSY - Called from a thread other than the leader
+ */
+int process_kill_other_threads(void);
+
+/**
+ * Give a borrowed address space back to the vfork parent and wake it
+ * 
+ * Called on exec and exit. Does nothing if proc is not a vfork child.
+ * proc is left with no page table: the caller must install one, or be
+ * exiting, before it next switches page tables.
+ * 
+ * @param proc vfork child
+ */
+void process_vfork_release(struct process *proc);
+
 /**
  * Execute a new program in the current process
  * 
@@ -292,21 +534,24 @@ int process_exec(void (*entry_point)(void *), void *arg);
 struct process *process_create_user(const char *name, void *user_code, size_t code_size);
 
 /**
- * Create a new user process from loaded ELF segments
+ * Create a new user process for an ELF program
  * 
- * This function is similar to process_create_user but allows specifying
- * custom virtual address base and entry point for loaded ELF programs.
+ * The process gets a page table, a stack and a trap frame that starts at
+ * entry_point, but no program: the caller maps the ELF segments, then
+ * makes it runnable with process_start() (or drops it with process_free()).
  * 
  * @param name Process name
- * @param code_base Virtual address base where code should be mapped
- * @param code_mem Physical address of loaded code (page-aligned)
- * @param code_size Size of code in bytes
  * @param entry_point Entry point virtual address
  * @return Pointer to new process, or NULL on failure
  */
-struct process *process_create_elf(const char *name, uint64_t code_base, 
-                                   void *code_mem, size_t code_size, 
-                                   uint64_t entry_point);
+struct process *process_create_elf(const char *name, uint64_t entry_point);
+
+/**
+ * Make a process from process_create_elf() runnable
+ * 
+ * @param proc Process whose program is mapped
+ */
+void process_start(struct process *proc);
 
 /**
  * Return to user mode (assembly function)
@@ -358,6 +603,8 @@ int process_setup_memory_isolation(struct process *proc);
  * Map a memory region in process address space
  * 
  * @param proc Process to map in
+ * Reserves the range with a VMA; pages are populated on first touch.
+ * 
  * @param vaddr Virtual address to map
  * @param size Size in bytes
  * @param flags Protection flags (VM_READ, VM_WRITE, VM_EXEC, VM_USER)
@@ -365,6 +612,58 @@ int process_setup_memory_isolation(struct process *proc);
  */
 int process_map_region(struct process *proc, uint64_t vaddr, uint64_t size, uint32_t flags);
 
+/**
+ * Recount a process's resident and page-table pages from its page table
+ * 
+ * Used after operations that rebuild many mappings (fork, exec, process
+ * creation) and before reporting stats; faults and unmaps keep rss_pages
+ * up to date incrementally in between.
+ * 
+ * @param proc Process to update
+ */
+void process_update_mm_stats(struct process *proc);
+
+/**
+ * Adjust a process's resident page count
+ * 
+ * @param proc Process whose mappings changed
+ * @param delta Pages mapped (positive) or unmapped (negative)
+ */
+void process_account_rss(struct process *proc, int64_t delta);
+
+/**
+ * Handle a page fault on a user address
+ * 
+ * Faults in zeroed pages for reserved VMAs (page cache pages for
+ * file-backed ones) and resolves copy-on-write faults. Called from the trap handler for user and kernel (SUM) faults.
+ * 
+ * @param proc Faulting process
+ * @param addr Faulting virtual address
+ * @param cause CAUSE_LOAD_PAGE_FAULT, CAUSE_STORE_PAGE_FAULT or
+ *              CAUSE_FETCH_PAGE_FAULT
+ * @return 0 if handled, -1 if the access is invalid (errno set)
+ */
+int process_handle_page_fault(struct process *proc, uint64_t addr, unsigned long cause);
+
+/**
+ * Find a free range of user address space (first fit)
+ * 
+ * @param proc Process to search
+ * @param floor Lowest acceptable address
+ * @param length Length in bytes (page-aligned)
+ * @return Start address, or 0 if no gap below USER_VIRT_END fits
+ */
+uint64_t process_find_free_area(struct process *proc, uint64_t floor, uint64_t length);
+
+/**
+ * Move the end of a VMA (keeps the VMA tree consistent)
+ * 
+ * @param proc Process owning the VMA
+ * @param vma VMA to resize
+ * @param end New end address (exclusive, must be > vma->start)
+ */
+void process_resize_vma(struct process *proc, vm_area_t *vma, uint64_t end);
+
 /**
  * Find VMA containing an address
  * 
@@ -385,6 +684,54 @@ vm_area_t *process_find_vma(struct process *proc, uint64_t addr);
  */
 int process_add_vma(struct process *proc, uint64_t start, uint64_t end, uint32_t flags);
 
+/**
+ * Add a file-backed VMA to process address space
+ * 
+ * Pages are faulted in from the page cache. With VM_SHARED, writes go to
+ * the cached page and are written back to the file; otherwise the
+ * mapping is private and written pages are copied.
+ * 
+ * @param proc Process to add VMA to
+ * @param start Start address (inclusive, page-aligned)
+ * @param end End address (exclusive, page-aligned)
+ * @param flags Protection flags, plus VM_SHARED for shared mappings
+ * @param file Backing file node (NULL for anonymous memory)
+ * @param offset File offset mapped at start (page-aligned)
+ * @return 0 on success, -1 on failure
+ */
+int process_add_file_vma(struct process *proc, uint64_t start, uint64_t end, uint32_t flags,
+                         struct vfs_node *file, uint64_t offset);
+
+/**
+ * Add a VMA mapping a shared memory object (see kernel/shm.h)
+ * 
+ * Pages are faulted in from the object, so every process mapping it sees
+ * the same memory. The VMA holds a reference to the object until it is
+ * removed.
+ * 
+ * @param proc Process to add VMA to
+ * @param start Start address (inclusive, page-aligned)
+ * @param end End address (exclusive, page-aligned)
+ * @param flags Protection flags, plus VM_SHARED
+ * @param shm Object to map
+ * @param offset Object offset mapped at start (page-aligned)
+ * @return 0 on success, -1 on failure
+ */
+int process_add_shm_vma(struct process *proc, uint64_t start, uint64_t end, uint32_t flags,
+                        struct shm_object *shm, uint64_t offset);
+
+/**
+ * Write back dirty pages of a shared file VMA
+ * 
+ * Does nothing for anonymous or private VMAs.
+ * 
+ * @param vma VMA to sync
+ * @param start Start of range to sync (clamped to the VMA)
+ * @param end End of range to sync (exclusive, clamped to the VMA)
+ * @return 0 on success, -1 on I/O error
+ */
+int process_sync_vma(vm_area_t *vma, uint64_t start, uint64_t end);
+
 /**
  * Remove a VMA from process address space
  * 
@@ -400,6 +747,34 @@ void process_remove_vma(struct process *proc, vm_area_t *vma);
  */
 void process_cleanup_vmas(struct process *proc);
 
+/**
+ * Deferred teardown statistics
+ */
+typedef struct {
+    uint64_t pending;                   // Address spaces waiting for the reaper
+    uint64_t deferred;                  // Handed to the reaper
+    uint64_t direct;                    // Freed by process_free() itself
+    uint64_t batches;                   // Reaper passes of PROCESS_TEARDOWN_BATCH tables
+} process_teardown_stats_t;
+
+/**
+ * Start the reaper thread
+ * 
+ * process_free() then leaves freeing a process's page table and VMAs to
+ * it (unless memory is below the low watermark), so exit and wait()
+ * return without walking the address space.
+ * 
+ * @return 0 on success, -1 on error (errno set)
+ */
+int process_start_reaper(void);
+
+/**
+ * Get deferred teardown statistics
+ * 
+ * @param stats Output structure
+ */
+void process_get_teardown_stats(process_teardown_stats_t *stats);
+
 /**
  * Validate user pointer against process VMAs
  * 
@@ -0,0 +1,148 @@
+/**
+ * @file prof.h
+ * @brief Sampling CPU profiler driven by the timer interrupt
+ *
+ * While the profiler runs, every CPU takes a sample each sampling period:
+ * the interrupted PC, the pid that was running and, for kernel code, the
+ * return addresses of up to PROF_MAX_DEPTH callers found by walking the
+ * frame pointer chain (the kernel is built with -O0, which keeps s0 as
+ * the frame pointer). Samples go into a ring belonging to the CPU and are
+ * drained through /dev/prof; tools/prof_report.py symbolizes them against
+ * build/thunderos.elf.
+ *
+ * The period is independent of the scheduler tick: hrtimer_reprogram()
+ * brings the timer interrupt forward to each CPU's next sample time, and
+ * prof_tick() samples only once that time has passed, so extra timer
+ * interrupts for other reasons do not bias the profile.
+ *
+ * /dev/prof:
+ *   read()  - Whole samples, every CPU's ring in turn; 0 once all are empty
+ *   ioctl() - PROFIO_* below
+ */
+
+#ifndef KERNEL_PROF_H
+#define KERNEL_PROF_H
+
+#include <stdint.h>
+
+struct trap_frame;
+
+// Return addresses kept per sample, innermost caller first
+#define PROF_MAX_DEPTH          6
+
+// Samples per CPU ring (a power of two)
+#define PROF_RING_SAMPLES       4096
+
+// Sampling period limits and default, in microseconds
+#define PROF_MIN_PERIOD_US      100
+#define PROF_MAX_PERIOD_US      1000000
+#define PROF_DEFAULT_PERIOD_US  1000
+
+// prof_sample_t flags
+#define PROF_SAMPLE_USER        0x01    // Interrupted in user mode (no callchain)
+
+// pid of a sample taken in the idle loop
+#define PROF_PID_IDLE           0xFFFFFFFFu
+
+// ioctl() requests on /dev/prof
+#define PROFIO_START            0x5500  // Drop buffered samples, sample every arg us (0: default)
+#define PROFIO_STOP             0x5501  // Stop sampling; buffered samples stay readable
+#define PROFIO_GET_STATS        0x5502  // Fill the prof_stats_t at arg
+#define PROFIO_RESET            0x5503  // Drop everything buffered, zero the counts
+
+/**
+ * Profile sample (64 bytes, as read from /dev/prof)
+ */
+typedef struct prof_sample {
+    uint64_t pc;                            /**< Interrupted PC (sepc) */
+    uint32_t pid;                           /**< Process running then, or PROF_PID_IDLE */
+    uint16_t cpu;                           /**< Logical CPU that took it */
+    uint8_t flags;                          /**< PROF_SAMPLE_* */
+    uint8_t depth;                          /**< Entries used in callchain */
+    uint64_t callchain[PROF_MAX_DEPTH];     /**< Return addresses, innermost first */
+} prof_sample_t;
+
+/**
+ * Profiler counts (PROFIO_GET_STATS), totals over every CPU
+ */
+typedef struct prof_stats {
+    uint64_t samples;       /**< Samples taken since the last start or reset */
+    uint64_t dropped;       /**< Samples lost to a full ring */
+    uint64_t buffered;      /**< Samples waiting to be read */
+    uint32_t period_us;     /**< Sampling period, 0 if stopped */
+    uint32_t ring_samples;  /**< PROF_RING_SAMPLES */
+} prof_stats_t;
+
+// Sampling period while running, 0 when stopped; written only by prof_start()/prof_stop()
+extern volatile uint32_t prof_period_us;
+
+/**
+ * Is the profiler sampling? (trap_fast_handler() sends timer interrupts
+ * down the full path while it is, as sampling needs the caller's s0)
+ */
+static inline int prof_running(void) {
+    return __builtin_expect(prof_period_us != 0, 0);
+}
+
+/**
+ * Start sampling every CPU, dropping anything buffered
+ *
+ * Each CPU allocates its ring the first time; CPUs other than the caller
+ * begin at their next timer interrupt.
+ *
+ * @param period_us Sampling period (0 for PROF_DEFAULT_PERIOD_US)
+ * @return 0 on success, -1 on error (errno set)
+ */
+int prof_start(uint32_t period_us);
+
+/**
+ * Stop sampling; buffered samples stay readable
+ */
+void prof_stop(void);
+
+/**
+ * Timer interrupt hook: take a sample if this CPU's sample time has come
+ *
+ * @param tf Full frame of the interrupted context
+ */
+void prof_tick(struct trap_frame *tf);
+
+/**
+ * Take a sample of tf on this CPU now (prof_tick() when it is due)
+ */
+void prof_sample(struct trap_frame *tf);
+
+/**
+ * Time this CPU next wants a timer interrupt, for hrtimer_reprogram()
+ *
+ * @return Microseconds, or UINT64_MAX when the profiler is stopped
+ */
+uint64_t prof_next_sample_us(void);
+
+/**
+ * Get the counts of every CPU's ring
+ */
+void prof_get_stats(prof_stats_t *stats);
+
+/**
+ * Take samples out of the rings, oldest first within each CPU
+ *
+ * @param buf Where to put them (kernel or checked user memory)
+ * @param max Most samples to take
+ * @return Samples taken
+ */
+uint32_t prof_drain(prof_sample_t *buf, uint32_t max);
+
+/**
+ * Drop every buffered sample and zero the counts
+ */
+void prof_reset(void);
+
+/**
+ * Register /dev/prof
+ *
+ * @return 0 on success, -1 on error (errno set)
+ */
+int prof_init(void);
+
+#endif // KERNEL_PROF_H
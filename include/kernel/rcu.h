@@ -0,0 +1,106 @@
+/**
+ * @file rcu.h
+ * @brief Read-copy-update for read-mostly kernel data
+ *
+ * RCU lets readers follow shared pointers without locks or atomic
+ * instructions. A writer publishes a new version with
+ * rcu_assign_pointer() and may only free or reuse the old one after a
+ * grace period, once every reader that could still see it has finished.
+ *
+ * This is quiescent-state-based RCU. Kernel code is never preempted, so
+ * a read section lasts until the CPU next switches processes or leaves
+ * the kernel (drops the big kernel lock); either ends every section it
+ * was in. Each CPU counts those events in cpu->rcu_qs_seq, which is odd
+ * while the CPU is in the kernel, and a grace period is over once every
+ * CPU that was in the kernel when it began has passed one.
+ *
+ * Read sections must not sleep, yield or call bkl_relax().
+ */
+
+#ifndef KERNEL_RCU_H
+#define KERNEL_RCU_H
+
+#include <stdint.h>
+#include "arch/barrier.h"
+
+/**
+ * @brief Callback queued by call_rcu()
+ *
+ * Embed it in the object to be reclaimed.
+ */
+struct rcu_head {
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+};
+
+/**
+ * @brief Start a read section
+ *
+ * Free: no process switch can happen inside one. Marks the section for
+ * the reader and stops the compiler moving loads out of it.
+ */
+static inline void rcu_read_lock(void) {
+    compiler_barrier();
+}
+
+/**
+ * @brief End a read section
+ */
+static inline void rcu_read_unlock(void) {
+    compiler_barrier();
+}
+
+/**
+ * @brief Load an RCU-protected pointer inside a read section
+ *
+ * RISC-V keeps loads through the pointer after the load of the pointer,
+ * so only the compiler needs to be told to read it exactly once.
+ */
+#define rcu_dereference(p)  (*(__typeof__(p) volatile *)&(p))
+
+/**
+ * @brief Publish a pointer to readers
+ *
+ * Orders the initialization of the pointed-to object before the store,
+ * so a reader that sees the new pointer sees the object's contents.
+ */
+#define rcu_assign_pointer(p, v)                        \
+    do {                                                \
+        write_barrier();                                \
+        *(__typeof__(p) volatile *)&(p) = (v);          \
+    } while (0)
+
+/**
+ * @brief Wait for a grace period
+ *
+ * Returns once every read section running on another CPU when it was
+ * called has finished. Yields, so it must be called from process
+ * context and outside any read section.
+ */
+void synchronize_rcu(void);
+
+/**
+ * @brief Run a callback after a grace period, without waiting
+ *
+ * For writers that cannot sleep. The callback runs from the RCU softirq
+ * of some CPU, with interrupts off, and must not sleep either.
+ *
+ * @param head Callback head embedded in the retired object
+ * @param func Function to call with head
+ */
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head));
+
+/**
+ * @brief Advance grace periods and run callbacks whose period ended
+ *
+ * Run by SOFTIRQ_RCU, which every CPU's timer tick raises while
+ * rcu_pending().
+ */
+void rcu_poll(void);
+
+/**
+ * @brief Check whether callbacks are waiting for a grace period
+ */
+int rcu_pending(void);
+
+#endif // KERNEL_RCU_H
@@ -0,0 +1,198 @@
+/**
+ * @file rgroup.h
+ * @brief Resource groups: CPU bandwidth and memory limits for processes
+ *
+ * Every process belongs to one resource group, inherited across fork()
+ * and clone(); rgroup_root, which is never limited, holds kernel threads
+ * and everything nobody moved. A group bounds its members together:
+ *
+ *   CPU     At most cpu_quota_us of run time in each cpu_period_us,
+ *           summed over the members and every CPU. The scheduler charges
+ *           run time to the group as it charges it to the process; once
+ *           the quota is spent the group is throttled, its members leave
+ *           the CPU at the next tick or slice end (slices are cut to the
+ *           quota left) and stay off the run queues until the period
+ *           ends. A period starts with the first run time charged after
+ *           the last one ended.
+ *
+ *   Memory  At most mem_limit_pages resident user pages, counted as each
+ *           member's rss_pages (a copy-on-write page shared after fork()
+ *           counts in both processes, as in their RSS). A page fault that
+ *           would take a new page past the limit fails, which kills the
+ *           faulting process as any bad fault does, and fork() fails
+ *           with ENOMEM when the child's copy would not fit.
+ *
+ * Groups are created, configured and joined with SYS_RGROUP_* (root
+ * only) and shown in /proc/rgroups. State changes under the big kernel
+ * lock; the CPU counters also under the group's lock, as the timer
+ * interrupt charges them.
+ */
+
+#ifndef KERNEL_RGROUP_H
+#define KERNEL_RGROUP_H
+
+#include <stdint.h>
+#include "kernel/hrtimer.h"
+#include "kernel/spinlock.h"
+
+struct process;
+
+#define RGROUP_MAX              16      // Groups, rgroup_root included
+#define RGROUP_NAME_LEN         16      // Name, NUL included
+
+// cpu_period_us range; 0 quota = unlimited
+#define RGROUP_PERIOD_DEFAULT_US    100000
+#define RGROUP_PERIOD_MIN_US        1000
+#define RGROUP_PERIOD_MAX_US        1000000
+#define RGROUP_QUOTA_MIN_US         1000
+
+/**
+ * Limits, as SYS_RGROUP_SETLIMIT takes them (0 = unlimited)
+ */
+typedef struct rgroup_limits {
+    uint64_t cpu_quota_us;              // Run time per period
+    uint64_t cpu_period_us;             // 0 = RGROUP_PERIOD_DEFAULT_US
+    uint64_t mem_limit_bytes;           // Resident memory, rounded down to pages
+} rgroup_limits_t;
+
+/**
+ * One group
+ */
+typedef struct rgroup {
+    int id;                             // Index in the table (0 = root)
+    int in_use;
+    char name[RGROUP_NAME_LEN];
+    uint32_t nr_procs;                  // Member processes and threads
+
+    // CPU bandwidth
+    spinlock_t lock;
+    uint64_t cpu_quota_us;              // 0 = unlimited
+    uint64_t cpu_period_us;
+    uint64_t cpu_runtime_us;            // Charged in the current period
+    int cpu_throttled;                  // Quota spent: members stay off the CPU
+    hrtimer_t period_timer;             // End of the current period
+    uint64_t throttled_at_us;           // When the current throttle began
+    uint64_t cpu_usage_us;              // Total run time
+    uint64_t nr_periods;                // Periods that charged run time
+    uint64_t nr_throttled;              // Periods that ran out of quota
+    uint64_t throttled_us;              // Total time spent throttled
+
+    // Memory
+    uint64_t mem_limit_pages;           // 0 = unlimited
+    uint64_t mem_pages;                 // Resident pages of the members
+    uint64_t mem_peak_pages;            // High-water mark of mem_pages
+    uint64_t mem_failcnt;               // Allocations refused by the limit
+} rgroup_t;
+
+extern rgroup_t rgroup_root;
+
+/**
+ * Set up the root group (once, before the first process)
+ */
+void rgroup_init(void);
+
+/**
+ * Get a group by ID
+ *
+ * @return Group, or NULL if there is none with that ID
+ */
+rgroup_t *rgroup_get(int id);
+
+/**
+ * Create an empty, unlimited group
+ *
+ * @param name Its name, 1 to RGROUP_NAME_LEN - 1 characters
+ * @return Group ID, or -1 on error (errno set)
+ *
+ * @errno THUNDEROS_EINVAL - Bad name
+ * @errno THUNDEROS_EEXIST - Name taken
+ * @errno THUNDEROS_ENOSPC - RGROUP_MAX groups exist
+ */
+int rgroup_create(const char *name);
+
+/**
+ * Remove an empty group
+ *
+ * @return 0 on success, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_EINVAL - The root group
+ * @errno THUNDEROS_ENOENT - No such group
+ * @errno THUNDEROS_EBUSY - It has members
+ */
+int rgroup_destroy(int id);
+
+/**
+ * Change a group's limits
+ *
+ * A new period starts, unthrottling the group.
+ *
+ * @return 0 on success, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_EINVAL - The root group, or a quota or period out of range
+ * @errno THUNDEROS_ENOENT - No such group
+ * @errno THUNDEROS_EBUSY - The memory limit is below what the group holds
+ */
+int rgroup_set_limits(int id, const rgroup_limits_t *limits);
+
+/**
+ * Read a group's limits
+ */
+void rgroup_get_limits(const rgroup_t *group, rgroup_limits_t *limits);
+
+/**
+ * Move a process, with all its threads and its resident pages, to a group
+ *
+ * @return 0 on success, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_ENOENT - No such group
+ * @errno THUNDEROS_EINVAL - A kernel thread, which stays in the root group
+ */
+int rgroup_attach(struct process *proc, int id);
+
+/**
+ * Join a new process to its creator's group (fork(), clone()), or with
+ * no creator to the root group, leaving the one it was in
+ */
+void rgroup_fork(struct process *child, struct process *parent);
+
+/**
+ * Leave the group (process_free())
+ */
+void rgroup_exit(struct process *proc);
+
+/**
+ * Charge run time to a group (scheduler, run queue lock held)
+ *
+ * @param now Current time (hal_timer_get_time_us())
+ * @return Nonzero if the group is now throttled
+ */
+int rgroup_charge_cpu(rgroup_t *group, uint64_t delta_us, uint64_t now);
+
+/**
+ * Run time a member may still have this period (UINT64_MAX = unlimited)
+ */
+uint64_t rgroup_cpu_remaining(rgroup_t *group);
+
+/**
+ * Must a member stay off the CPU?
+ */
+static inline int rgroup_cpu_throttled(const rgroup_t *group) {
+    return group && group->cpu_throttled;
+}
+
+/**
+ * Adjust a group's resident page count
+ */
+void rgroup_charge_mem(rgroup_t *group, int64_t delta);
+
+/**
+ * May a group take more resident pages?
+ *
+ * @return 0 if pages more fit under the limit, -1 if not (errno set;
+ *         counted in mem_failcnt)
+ *
+ * @errno THUNDEROS_ENOMEM - Over the limit
+ */
+int rgroup_mem_allow(rgroup_t *group, uint64_t pages);
+
+#endif // KERNEL_RGROUP_H
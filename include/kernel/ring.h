@@ -0,0 +1,102 @@
+/**
+ * @file ring.h
+ * @brief Batched syscall submission rings for ThunderOS
+ *
+ * A process that issues many small syscalls can queue them in a ring in
+ * its own memory and have the kernel run a whole batch in one trap. The
+ * ring holds a submission queue (SQ), which user space fills and the
+ * kernel drains, and a completion queue (CQ) going the other way. Each
+ * queue has a head, advanced by its consumer, and a tail, advanced by its
+ * producer; both run freely and are reduced modulo the ring size.
+ *
+ * A submission entry names any syscall from the dispatch table and
+ * carries its six arguments. The kernel runs entries in order, as if
+ * the process had made the calls itself, and posts one completion per
+ * entry with the return value and errno.
+ *
+ * Layout in user memory (ring_size_bytes(entries) bytes, 8-byte aligned):
+ *
+ *     ring_header_t | ring_sqe_t sq[entries] | ring_cqe_t cq[entries]
+ */
+
+#ifndef _KERNEL_RING_H
+#define _KERNEL_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Largest ring (entries per queue, a power of two)
+ */
+#define RING_MAX_ENTRIES    256
+
+/**
+ * @brief Shared ring header
+ */
+typedef struct ring_header {
+    volatile uint32_t sq_head;      /**< Next SQ entry the kernel takes */
+    volatile uint32_t sq_tail;      /**< Next SQ slot user space fills */
+    volatile uint32_t cq_head;      /**< Next CQ entry user space reads */
+    volatile uint32_t cq_tail;      /**< Next CQ slot the kernel fills */
+    uint32_t entries;               /**< Entries per queue (set by ring_setup()) */
+    uint32_t reserved;
+} ring_header_t;
+
+/**
+ * @brief Submission queue entry: one syscall
+ */
+typedef struct ring_sqe {
+    uint64_t user_data;             /**< Copied to the completion */
+    uint32_t opcode;                /**< Syscall number */
+    uint32_t flags;                 /**< Must be 0 */
+    uint64_t args[6];               /**< Arguments a0-a5 */
+} ring_sqe_t;
+
+/**
+ * @brief Completion queue entry: one finished syscall
+ */
+typedef struct ring_cqe {
+    uint64_t user_data;             /**< From the submission */
+    int64_t result;                 /**< Return value */
+    int32_t error;                  /**< errno if result is -1, else 0 */
+    uint32_t reserved;
+} ring_cqe_t;
+
+/**
+ * @brief Size in bytes of a ring with the given number of entries
+ */
+static inline size_t ring_size_bytes(uint32_t entries) {
+    return sizeof(ring_header_t) + entries * (sizeof(ring_sqe_t) + sizeof(ring_cqe_t));
+}
+
+/**
+ * @brief Register a ring for the calling process
+ *
+ * Replaces any ring registered before. The header's heads and tails are
+ * reset and entries is filled in. Rings are inherited across fork() (at
+ * the same address in the child's copy) and dropped by execve().
+ *
+ * @param ring User address of the ring, 8-byte aligned
+ * @param entries Entries per queue: a power of two, at most RING_MAX_ENTRIES
+ * @return 0 on success, -1 on error
+ * @errno THUNDEROS_EINVAL - Bad entries or misaligned ring
+ * @errno THUNDEROS_EFAULT - Ring not in writable user memory
+ */
+int ring_setup(ring_header_t *ring, uint32_t entries);
+
+/**
+ * @brief Run queued submissions
+ *
+ * Takes up to to_submit entries from the SQ, stopping early when it is
+ * empty or the CQ is full, and runs each to completion before the next.
+ * Entries may block. Syscalls that need the caller's trap frame (fork,
+ * execve) and ring syscalls themselves complete with EINVAL.
+ *
+ * @param to_submit Maximum number of entries to run
+ * @return Number of entries run, or -1 on error
+ * @errno THUNDEROS_EINVAL - No ring registered, or its heads are corrupt
+ * @errno THUNDEROS_EFAULT - The ring is no longer mapped
+ */
+int ring_enter(uint32_t to_submit);
+
+#endif /* _KERNEL_RING_H */
@@ -3,7 +3,8 @@
  * @brief Reader-writer lock synchronization primitive for ThunderOS
  *
  * Provides a reader-writer lock that allows multiple concurrent readers
- * or a single exclusive writer. Writers have priority to prevent starvation.
+ * or a single exclusive writer, with a policy chosen at initialisation
+ * deciding who goes first when both are waiting.
  */
 
 #ifndef _KERNEL_RWLOCK_H
@@ -12,32 +13,62 @@
 #include <stdint.h>
 #include "kernel/wait_queue.h"
 
+struct lockstat_class;
+
+/**
+ * @brief rwlock policies (also the flags of sys_rwlock_create)
+ *
+ * - RWLOCK_PREFER_WRITER: a waiting writer blocks new readers and goes
+ *   before queued readers. Readers can starve under steady writes.
+ * - RWLOCK_PREFER_READER: readers enter whenever no writer holds the
+ *   lock. Writers can starve under steady reads.
+ * - RWLOCK_PHASE_FAIR: a waiting writer blocks new readers, but each
+ *   write unlock first admits every reader queued so far, then the next
+ *   writer once they leave; read and write phases alternate, so neither
+ *   side starves.
+ */
+#define RWLOCK_PREFER_WRITER    0
+#define RWLOCK_PREFER_READER    1
+#define RWLOCK_PHASE_FAIR       2
+
 /**
  * @brief Reader-writer lock structure
  *
  * A reader-writer lock allows:
  * - Multiple readers to hold the lock simultaneously (shared access)
  * - Only one writer at a time (exclusive access)
- * - Writers block new readers to prevent writer starvation
  *
  * The lock uses two wait queues: one for readers and one for writers.
- * Writers have priority - when a writer is waiting, new readers block.
+ * Unlocking hands the lock straight to the waiters it admits: all queued
+ * readers in one batch, or the oldest writer.
  */
 typedef struct rwlock {
     volatile int readers;         /**< Number of active readers (0 when writer holds) */
     volatile int writer;          /**< 1 if a writer holds the lock, 0 otherwise */
-    volatile int writers_waiting; /**< Number of writers waiting (for priority) */
+    volatile int writers_waiting; /**< Number of writers waiting (not yet handed the lock) */
+    volatile int reader_grants;   /**< Woken readers already counted in readers */
+    struct process *writer_owner; /**< Writer holding the lock (NULL if none) */
+    int policy;                   /**< RWLOCK_PREFER_WRITER, _PREFER_READER or _PHASE_FAIR */
     wait_queue_t reader_queue;    /**< Readers waiting to acquire */
     wait_queue_t writer_queue;    /**< Writers waiting to acquire */
+#ifdef LOCKSTAT
+    struct lockstat_class *lockstat_read;  /**< Reader class (kernel/lockstat.h) */
+    struct lockstat_class *lockstat_write; /**< Writer class */
+    uint64_t read_at_us;          /**< When the current read phase began */
+    uint64_t write_at_us;         /**< When the writer got it */
+#endif
 } rwlock_t;
 
 /**
- * @brief Static initializer for rwlock
+ * @brief Static initializer for rwlock (writer-preferring)
  */
 #define RWLOCK_INIT { \
     .readers = 0, \
     .writer = 0, \
     .writers_waiting = 0, \
+    .reader_grants = 0, \
+    .writer_owner = NULL, \
+    .policy = RWLOCK_PREFER_WRITER, \
     .reader_queue = WAIT_QUEUE_INIT, \
     .writer_queue = WAIT_QUEUE_INIT \
 }
@@ -46,14 +77,16 @@ typedef struct rwlock {
  * @brief Initialize a reader-writer lock
  *
  * @param rw Pointer to rwlock to initialize
+ * @param policy RWLOCK_PREFER_WRITER, RWLOCK_PREFER_READER or RWLOCK_PHASE_FAIR
+ * @return 0 on success, -1 if the policy is unknown
  */
-void rwlock_init(rwlock_t *rw);
+int rwlock_init(rwlock_t *rw, int policy);
 
 /**
  * @brief Acquire read lock (blocking)
  *
- * Blocks if a writer holds the lock or if writers are waiting.
- * Multiple readers can hold the lock simultaneously.
+ * Blocks if a writer holds the lock, or (unless reader-preferring) if
+ * writers are waiting. Multiple readers can hold the lock simultaneously.
  *
  * @param rw Pointer to rwlock to acquire for reading
  */
@@ -98,8 +131,8 @@ int rwlock_write_trylock(rwlock_t *rw);
 /**
  * @brief Release write lock
  *
- * Releases the write lock and wakes waiting readers or a writer.
- * Prefers waking all waiting readers, then one writer if no readers.
+ * Hands the lock to the next waiting writer or to every queued reader at
+ * once, as the policy decides, and wakes them.
  *
  * @param rw Pointer to rwlock to release
  */
@@ -0,0 +1,156 @@
+/**
+ * @file schedlat.h
+ * @brief Wakeup-to-run latency per priority, and what delayed the worst
+ *
+ * scheduler_enqueue() stamps a process with the time it became runnable
+ * and the code that made it so (process_wakeup(), a wait queue, a sleep
+ * timer, a new process starting); context_switch() charges the time
+ * until it got the CPU to its class: one per real-time priority, the
+ * fair class and SCHED_DEADLINE. A process preempted while running is
+ * not stamped, so only waits after a wakeup are counted, as cyclictest
+ * measures them. Histograms are log2, like lockstat's (bucket 0 under
+ * 1us, bucket b from 2^(b-1) up to 2^b us, the last open-ended).
+ *
+ * The SCHEDLAT_WORST longest waits are kept with the process that had
+ * the CPU until then and, in IRQOFF_TRACE=1 builds (-DSCHEDLAT_IRQOFF),
+ * the longest section with interrupts off on that CPU that ended while
+ * the process waited (or was still open when it got the CPU), and where
+ * it started. Those builds time every interrupt_save_disable() that
+ * turned interrupts off, up to the interrupt_restore() that turned them
+ * back on, into a histogram of their own.
+ *
+ * /proc/schedlat shows all of it. Other builds count wakeups but no
+ * sections, and the file says so. Counters are updated atomically, the
+ * worst list under a spinlock: every CPU reports from context_switch(),
+ * interrupts off.
+ */
+
+#ifndef KERNEL_SCHEDLAT_H
+#define KERNEL_SCHEDLAT_H
+
+#include <stdint.h>
+#include "kernel/process.h"
+#include "kernel/scheduler.h"
+
+// Latency classes: a real-time priority level each, then fair, deadline
+#define SCHEDLAT_FAIR           SCHED_RT_LEVELS
+#define SCHEDLAT_DEADLINE       (SCHED_RT_LEVELS + 1)
+#define SCHEDLAT_CLASSES        (SCHED_RT_LEVELS + 2)
+
+// Histogram buckets (the last one is >= 2^14 us)
+#define SCHEDLAT_HIST_BUCKETS   16
+
+// Longest waits kept
+#define SCHEDLAT_WORST          8
+
+/**
+ * Wakeups of one latency class
+ */
+typedef struct schedlat_class {
+    uint64_t count;                     // Wakeups that got the CPU
+    uint64_t total_us;                  // Their summed wait
+    uint64_t max_us;                    // The longest
+    uint32_t hist[SCHEDLAT_HIST_BUCKETS];
+} schedlat_class_t;
+
+/**
+ * Sections with interrupts off (IRQOFF_TRACE=1 builds)
+ */
+typedef struct schedlat_irqoff {
+    uint64_t count;                     // Sections timed
+    uint64_t total_us;                  // Their summed length
+    uint64_t max_us;                    // The longest
+    uintptr_t max_site;                 // Where it started
+    uint32_t max_cpu;                   // On which CPU
+    uint32_t hist[SCHEDLAT_HIST_BUCKETS];
+} schedlat_irqoff_t;
+
+/**
+ * One of the longest waits
+ */
+typedef struct schedlat_record {
+    uint64_t latency_us;                // Runnable to running
+    uint64_t run_us;                    // When it got the CPU
+    pid_t pid;
+    char name[PROC_NAME_LEN];
+    uint32_t lat_class;                 // SCHEDLAT_* class
+    uint32_t cpu;                       // CPU it got
+    uintptr_t wake_site;                // Caller of scheduler_enqueue()
+    pid_t prev_pid;                     // Had the CPU until then (0: idle)
+    char prev_name[PROC_NAME_LEN];
+    uint64_t irqoff_us;                 // Longest section with interrupts off meanwhile
+    uintptr_t irqoff_site;              // Where it started (0: none seen)
+} schedlat_record_t;
+
+/**
+ * Start timing sections with interrupts off, once cpu_this() works
+ * (a no-op without SCHEDLAT_IRQOFF)
+ */
+void schedlat_init(void);
+
+/**
+ * Stamp a process made runnable (scheduler_enqueue())
+ *
+ * @param site Return address of scheduler_enqueue()'s caller
+ */
+void schedlat_wake(struct process *proc, uintptr_t site);
+
+/**
+ * Charge the wait of a process getting the CPU (context_switch(),
+ * interrupts off; either may be NULL for idle)
+ */
+void schedlat_switch(struct process *prev, struct process *next);
+
+/**
+ * A process that was stamped ran without a switch (picked again while
+ * still current): forget the stamp
+ */
+static inline void schedlat_ran(struct process *proc) {
+    proc->wake_us = 0;
+}
+
+#ifdef SCHEDLAT_IRQOFF
+/**
+ * Interrupts just went off at site (interrupt_save_disable() found them on)
+ */
+void schedlat_irqs_off(uintptr_t site);
+
+/**
+ * Interrupts are about to go back on: time the open section, if any
+ */
+void schedlat_irqs_on(void);
+
+/**
+ * A trap came from code running with interrupts on: whatever section
+ * this CPU thought open ended without interrupt_restore() (sret, a new
+ * process's first return), so drop it untimed
+ */
+void schedlat_irqs_were_on(void);
+#endif
+
+/**
+ * Get a latency class by index, for listing
+ *
+ * @return Class, or NULL past SCHEDLAT_CLASSES
+ */
+const schedlat_class_t *schedlat_get_class(uint32_t index);
+
+/**
+ * Name of a latency class ("rt10" ... "rt1" by sched_priority, "fair",
+ * "deadline")
+ */
+const char *schedlat_class_name(uint32_t index);
+
+/**
+ * Get the interrupts-off section statistics
+ */
+void schedlat_get_irqoff(schedlat_irqoff_t *stats);
+
+/**
+ * Copy one of the longest waits, longest first
+ *
+ * @return 0 on success, -1 if there are not that many
+ */
+int schedlat_get_worst(uint32_t index, schedlat_record_t *record);
+
+#endif // KERNEL_SCHEDLAT_H
@@ -1,13 +1,100 @@
 /*
  * Process Scheduler for ThunderOS
  * 
- * Implements a round-robin scheduler with priority support.
+ * An earliest-deadline-first class above real-time priority run lists,
+ * above a proportional-share (fair) class.
  */
 
 #ifndef SCHEDULER_H
 #define SCHEDULER_H
 
 #include "kernel/process.h"
+#include "kernel/config.h"
+
+/**
+ * Scheduling classes
+ * 
+ * Priorities below SCHED_RT_LEVELS are real-time: one FIFO run list per
+ * level, the highest level always runs first, round-robin within a level.
+ * Priorities from SCHED_RT_LEVELS up are in the fair class, which shares
+ * the CPU in proportion to weight (SCHED_RT_LEVELS = nice 0, each step
+ * above it about 20% less CPU, clamped at nice 19).
+ */
+#define SCHED_RT_LEVELS 10
+
+// Fair class: every runnable process runs once per latency period...
+#define SCHED_LATENCY_US 200000
+// ...but never for less than this (slice ends are timed, not ticked)
+#define SCHED_MIN_GRANULARITY_US (SCHED_LATENCY_US / 8)
+// A process must trail the running one by this much to preempt it
+#define SCHED_WAKEUP_GRANULARITY_US (TIMER_INTERVAL_US / 2)
+
+// Weight of a nice-0 fair process; vruntime advances 1us per us at it
+#define SCHED_WEIGHT_NICE0 1024
+
+// Slice of a SCHED_RR process (SCHED_FIFO runs until it blocks or yields)
+#define SCHED_RR_SLICE_US 100000
+
+/**
+ * Scheduling policies (sched_attr_t::sched_policy)
+ * 
+ * SCHED_NORMAL and SCHED_RR/SCHED_FIFO pick the class through the
+ * priority, as above. SCHED_DEADLINE runs ahead of both: each process is
+ * promised sched_runtime of CPU within sched_deadline of the start of
+ * every sched_period, and the one with the earliest deadline runs. A
+ * process that uses up its runtime is throttled until its next period
+ * (constant bandwidth server), so an overrun cannot eat into the others'
+ * guarantees.
+ */
+#define SCHED_NORMAL    0
+#define SCHED_FIFO      1
+#define SCHED_RR        2
+#define SCHED_DEADLINE  6
+
+// Deadline admission: the runtime/period sum stays under 95% of the CPUs
+#define SCHED_DL_BW_SHIFT       20
+#define SCHED_DL_BW_LIMIT_PCT   95
+// Shortest runtime accepted: below this the timer cannot police it
+#define SCHED_DL_MIN_RUNTIME_US 100
+// Longest period accepted (keeps the budget arithmetic in 64 bits)
+#define SCHED_DL_MAX_PERIOD_US  10000000
+
+/**
+ * Scheduling attributes (sched_setattr()/sched_getattr())
+ * 
+ * Laid out as Linux's struct sched_attr; the deadline parameters are in
+ * nanoseconds, kept to the microsecond.
+ */
+typedef struct sched_attr {
+    uint32_t size;                      // sizeof(sched_attr_t)
+    uint32_t sched_policy;              // SCHED_*
+    uint64_t sched_flags;               // Must be 0
+    int32_t sched_nice;                 // SCHED_NORMAL: 0 to 19
+    uint32_t sched_priority;            // SCHED_FIFO/RR: 1 to SCHED_RT_LEVELS (most urgent)
+    uint64_t sched_runtime;             // SCHED_DEADLINE, in ns
+    uint64_t sched_deadline;
+    uint64_t sched_period;              // 0 = sched_deadline
+} sched_attr_t;
+
+/**
+ * Account the running process and reschedule
+ * 
+ * Called from every timer interrupt, whether a tick, a slice end or an
+ * hrtimer. Charges run time (cpu_time and vruntime) and preempts the
+ * process when its slice is used up or a fair process with less vruntime
+ * is waiting.
+ * 
+ * @param ticks Ticks that elapsed since the previous call (may be 0)
+ */
+void scheduler_tick(unsigned long ticks);
+
+/**
+ * Get the time the running process's slice ends
+ * 
+ * @return Microseconds since boot, or UINT64_MAX when the last pick found
+ *         nothing to run (the CPU is idle and needs no tick)
+ */
+uint64_t scheduler_next_event_us(void);
 
 /**
  * Initialize the scheduler
@@ -31,9 +118,29 @@ void schedule(void);
  */
 void scheduler_yield(void);
 
+/**
+ * Handle a reschedule IPI
+ * 
+ * Another CPU queued work for this one: reschedule now.
+ */
+void scheduler_ipi(void);
+
+/**
+ * Run this CPU's idle loop
+ * 
+ * Entered through the CPU's idle context when nothing is runnable (and
+ * by secondary harts once they are up), holding the big kernel lock with
+ * interrupts disabled. Pre-zeroes pages, runs whatever becomes runnable,
+ * and otherwise waits for interrupts without the lock.
+ */
+void scheduler_idle_loop(void) __attribute__((noreturn));
+
 /**
  * Add a process to the ready queue
  * 
+ * Appends to the run list of the process's priority. Does nothing if the
+ * process is already queued.
+ * 
  * @param proc Process to add
  */
 void scheduler_enqueue(struct process *proc);
@@ -41,23 +148,99 @@ void scheduler_enqueue(struct process *proc);
 /**
  * Remove a process from the ready queue
  * 
+ * Does nothing if the process is not queued.
+ * 
  * @param proc Process to remove
  */
 void scheduler_dequeue(struct process *proc);
 
+/**
+ * Change a process's effective priority
+ * 
+ * Moves a queued process to the run list or class of its new priority.
+ * Used by mutex priority inheritance; proc->base_priority is unchanged.
+ * 
+ * @param proc Process to change
+ * @param priority New priority (lower = higher priority)
+ */
+void scheduler_set_priority(struct process *proc, uint64_t priority);
+
+/**
+ * Give a new process slot its scheduling state
+ * 
+ * SCHED_NORMAL with no deadline parameters; the caller sets the priority.
+ * 
+ * @param proc Process being allocated
+ */
+void scheduler_init_process(struct process *proc);
+
+/**
+ * Change a process's scheduling policy and parameters
+ * 
+ * A queued process moves to its new class at once. A mutex priority
+ * boost outranking the new priority is kept until the mutex is released.
+ * 
+ * @param proc Process to change
+ * @param attr New policy and parameters
+ * @return 0 on success, -1 on error (errno set)
+ * 
+ * @errno THUNDEROS_EINVAL - Unknown policy or flags, or parameters out of range
+ * @errno THUNDEROS_EBUSY - SCHED_DEADLINE bandwidth would pass the admission limit
+ */
+int scheduler_setattr(struct process *proc, const sched_attr_t *attr);
+
+/**
+ * Get a process's scheduling policy and parameters
+ * 
+ * @param proc Process to read
+ * @param attr Output (priority without mutex boosts)
+ */
+void scheduler_getattr(struct process *proc, sched_attr_t *attr);
+
+/**
+ * Release an exiting process's deadline bandwidth
+ * 
+ * @param proc Exiting process
+ */
+void scheduler_exit(struct process *proc);
+
 /**
  * Perform a context switch from old process to new process
  * 
- * @param old Old process (can be NULL)
- * @param new New process
+ * @param old Old process (NULL = this CPU's idle context)
+ * @param new New process (NULL = this CPU's idle context)
  */
 void context_switch(struct process *old, struct process *new);
 
 /**
  * Get the next process to run
  * 
+ * Takes the deadline process with the earliest deadline, else the first
+ * process of the highest-priority non-empty run list, else the fair
+ * process with the least vruntime.
+ * 
  * @return Next process, or NULL if none available
  */
 struct process *scheduler_pick_next(void);
 
+/**
+ * Run queue of one CPU, as of now (see scheduler_get_rq_stats())
+ */
+typedef struct {
+    uint32_t dl_queued;                 // Deadline processes waiting to run
+    uint32_t rt_queued;                 // Real-time processes waiting to run
+    uint32_t fair_queued;               // Fair processes waiting to run
+    uint64_t fair_weight;               // Sum of the waiting fair weights
+    uint64_t min_vruntime;              // Fair class vruntime floor
+} sched_rq_stats_t;
+
+/**
+ * Get a CPU's run queue lengths
+ * 
+ * @param cpu Logical CPU number
+ * @param stats Output structure
+ * @return 0 on success, -1 if cpu is not a CPU (errno set)
+ */
+int scheduler_get_rq_stats(int cpu, sched_rq_stats_t *stats);
+
 #endif // SCHEDULER_H
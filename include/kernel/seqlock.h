@@ -0,0 +1,144 @@
+/**
+ * @file seqlock.h
+ * @brief Sequence counters and sequence locks for ThunderOS
+ *
+ * A sequence counter lets readers of a small, rarely written record run
+ * without taking any lock. Writers make the count odd while they change
+ * the record and even again when done; a reader notes the count, copies
+ * what it needs, and retries if the count was odd or has moved since.
+ * Readers therefore never delay writers, and only pay for a retry when a
+ * write actually overlapped them.
+ *
+ * A seqcount_t does not serialize writers: they must already exclude
+ * each other. seqlock_t pairs one with a spinlock for when they do not.
+ *
+ * Readers may see a half-written record before the retry check, so they
+ * must only copy fields out inside the loop and never follow pointers
+ * read there into memory that a writer may free.
+ */
+
+#ifndef KERNEL_SEQLOCK_H
+#define KERNEL_SEQLOCK_H
+
+#include <stdint.h>
+#include "kernel/spinlock.h"
+#include "arch/barrier.h"
+
+/**
+ * @brief Sequence counter (odd while a write is in progress)
+ */
+typedef struct seqcount {
+    volatile uint32_t sequence;
+} seqcount_t;
+
+/**
+ * @brief Sequence counter with a spinlock serializing its writers
+ */
+typedef struct seqlock {
+    seqcount_t seqcount;
+    spinlock_t lock;
+} seqlock_t;
+
+#define SEQCOUNT_INIT   { .sequence = 0 }
+#define SEQLOCK_INIT    { .seqcount = SEQCOUNT_INIT, .lock = SPINLOCK_INIT }
+
+/**
+ * @brief Initialize a sequence counter
+ */
+static inline void seqcount_init(seqcount_t *s) {
+    s->sequence = 0;
+}
+
+/**
+ * @brief Start a read section
+ *
+ * Waits out a write in progress, so the count returned is always even.
+ *
+ * @param s Sequence counter
+ * @return Count to pass to read_seqcount_retry()
+ */
+static inline uint32_t read_seqcount_begin(const seqcount_t *s) {
+    uint32_t seq;
+
+    while ((seq = s->sequence) & 1) {
+        // Writer active
+    }
+    read_barrier();
+    return seq;
+}
+
+/**
+ * @brief End a read section
+ *
+ * @param s Sequence counter
+ * @param start Count returned by read_seqcount_begin()
+ * @return Nonzero if a write overlapped the section and it must be redone
+ */
+static inline int read_seqcount_retry(const seqcount_t *s, uint32_t start) {
+    read_barrier();
+    return s->sequence != start;
+}
+
+/**
+ * @brief Start a write (writers already serialized)
+ */
+static inline void write_seqcount_begin(seqcount_t *s) {
+    s->sequence++;
+    write_barrier();
+}
+
+/**
+ * @brief End a write started with write_seqcount_begin()
+ */
+static inline void write_seqcount_end(seqcount_t *s) {
+    write_barrier();
+    s->sequence++;
+}
+
+/**
+ * @brief Initialize a sequence lock
+ */
+static inline void seqlock_init(seqlock_t *sl, const char *name) {
+    seqcount_init(&sl->seqcount);
+    spin_lock_init(&sl->lock, name);
+}
+
+/**
+ * @brief Start a read section on a sequence lock
+ */
+static inline uint32_t read_seqbegin(const seqlock_t *sl) {
+    return read_seqcount_begin(&sl->seqcount);
+}
+
+/**
+ * @brief End a read section on a sequence lock
+ *
+ * @return Nonzero if the section must be redone
+ */
+static inline int read_seqretry(const seqlock_t *sl, uint32_t start) {
+    return read_seqcount_retry(&sl->seqcount, start);
+}
+
+/**
+ * @brief Take a sequence lock for writing
+ *
+ * Interrupts stay masked until write_sequnlock(): a reader interrupting
+ * the writer on its own hart would spin forever on the odd count.
+ *
+ * @return Interrupt state for write_sequnlock()
+ */
+static inline int write_seqlock(seqlock_t *sl) {
+    int irq_state = spin_lock_irqsave(&sl->lock);
+    write_seqcount_begin(&sl->seqcount);
+    return irq_state;
+}
+
+/**
+ * @brief Release a sequence lock taken with write_seqlock()
+ */
+static inline void write_sequnlock(seqlock_t *sl, int irq_state) {
+    write_seqcount_end(&sl->seqcount);
+    spin_unlock_irqrestore(&sl->lock, irq_state);
+}
+
+#endif // KERNEL_SEQLOCK_H
@@ -0,0 +1,107 @@
+/**
+ * @file shm.h
+ * @brief Named shared memory objects (shm_open)
+ *
+ * A shared memory object is a named, resizable array of physical pages
+ * that lives until it is unlinked and the last user is gone. Processes
+ * open it by name with shm_open(), size it with ftruncate() and map it
+ * with mmap(MAP_SHARED): every mapping faults in the object's own pages,
+ * so data written by one process is seen by all others without copying.
+ *
+ * The object holds one reference to each of its pages, and each mapping
+ * takes another, so a page stays valid while mapped even if the object
+ * is shrunk. Pages are allocated zeroed on first touch. Objects are not
+ * backed by a filesystem and do not survive a reboot.
+ */
+
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Longest object name, including the leading '/' */
+#define SHM_NAME_MAX 64
+
+/* Largest object ftruncate() accepts (64MB) */
+#define SHM_MAX_SIZE (64ULL * 1024 * 1024)
+
+typedef struct shm_object shm_object_t;
+
+/**
+ * Open or create a named object and get a descriptor for it
+ *
+ * @param name Object name: '/' followed by up to SHM_NAME_MAX - 2
+ *             characters, none of them '/'
+ * @param flags O_RDONLY or O_RDWR, optionally O_CREAT, O_EXCL, O_TRUNC
+ * @return Descriptor, -1 on error
+ *
+ * @errno THUNDEROS_EINVAL - Bad name or access mode
+ * @errno THUNDEROS_ENOENT - No such object and no O_CREAT
+ * @errno THUNDEROS_EEXIST - Object exists and O_CREAT|O_EXCL given
+ * @errno THUNDEROS_EMFILE - Too many open files
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ */
+int shm_open(const char *name, uint32_t flags);
+
+/**
+ * Remove an object's name
+ *
+ * The object itself goes once no descriptor or mapping refers to it.
+ *
+ * @param name Object name
+ * @return 0 on success, -1 on error
+ *
+ * @errno THUNDEROS_EINVAL - Bad name
+ * @errno THUNDEROS_ENOENT - No such object
+ */
+int shm_unlink(const char *name);
+
+/**
+ * Change the size of an object
+ *
+ * Growing adds zero-filled space; shrinking drops the object's pages
+ * past the new end (mappings keep the pages they already have).
+ *
+ * @param shm Object
+ * @param size New size in bytes
+ * @return 0 on success, -1 on error
+ *
+ * @errno THUNDEROS_EFBIG - Larger than SHM_MAX_SIZE
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ */
+int shm_truncate(shm_object_t *shm, uint64_t size);
+
+/**
+ * Get the size of an object in bytes
+ */
+uint64_t shm_size(shm_object_t *shm);
+
+/**
+ * Get a page of an object for mapping, allocating it on first use
+ *
+ * @param shm Object
+ * @param index Page index
+ * @return Physical address with a reference taken for the caller,
+ *         0 on error
+ *
+ * @errno THUNDEROS_EFAULT - Page is past the end of the object
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ */
+uintptr_t shm_get_page(shm_object_t *shm, uint64_t index);
+
+/**
+ * Take a reference to an object (a descriptor or mapping)
+ *
+ * @param shm Object
+ */
+void shm_get(shm_object_t *shm);
+
+/**
+ * Drop a reference; an unlinked object is freed with the last one
+ *
+ * @param shm Object
+ */
+void shm_put(shm_object_t *shm);
+
+#endif /* SHM_H */
@@ -36,7 +36,14 @@ struct trap_frame;
 #define SIGTTIN     21  // Background read from terminal
 #define SIGTTOU     22  // Background write to terminal
 
-#define NSIG        32  // Total number of signals
+// Real-time signals: queued, not coalesced, and delivered with a value
+#define SIGRTMIN    32
+#define SIGRTMAX    63
+
+#define NSIG        64  // Total number of signals
+
+// Most real-time signals queued on one process at a time
+#define SIGQUEUE_MAX 32
 
 // Signal handler types
 #define SIG_DFL     ((void (*)(int))0)  // Default handler
@@ -56,6 +63,40 @@ struct sigaction {
     int sa_flags;               // Special flags
 };
 
+// sigprocmask() operations
+#define SIG_BLOCK       0       // Add set to the blocked signals
+#define SIG_UNBLOCK     1       // Remove set from the blocked signals
+#define SIG_SETMASK     2       // Block exactly set
+
+// Signals that can never be blocked, caught or ignored
+#define SIG_UNBLOCKABLE ((1UL << SIGKILL) | (1UL << SIGSTOP))
+
+// si_code values
+#define SI_USER         0       // kill()
+#define SI_KERNEL       0x80    // Sent by the kernel
+#define SI_QUEUE        (-1)    // sigqueue()
+
+/**
+ * What is known about one signal occurrence
+ */
+typedef struct ksiginfo {
+    int si_signo;               // Signal number
+    int si_code;                // SI_* origin
+    int si_pid;                 // Sending process (0 = kernel)
+    int si_uid;                 // Its real user ID
+    int64_t si_value;           // sigqueue() value
+} ksiginfo_t;
+
+/**
+ * Real-time signals queued on a process, oldest first
+ * 
+ * Allocated the first time one is queued.
+ */
+typedef struct sigqueue {
+    int count;
+    ksiginfo_t info[SIGQUEUE_MAX];
+} sigqueue_t;
+
 // sigaction flags
 #define SA_NOCLDSTOP    1       // Don't notify on child stop
 #define SA_NOCLDWAIT    2       // Don't create zombie on child death
@@ -78,6 +119,60 @@ void signal_init_process(struct process *proc);
  */
 int signal_send(struct process *proc, int signum);
 
+/**
+ * Send a signal with its details
+ * 
+ * Real-time signals are queued, so each one sent is delivered once,
+ * with info. Standard signals coalesce as before and info is dropped.
+ * Queueing allocates, so real-time signals must not be sent from an
+ * interrupt handler.
+ * 
+ * @param proc Target process
+ * @param info Signal number and details
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Bad signal number
+ * @errno THUNDEROS_ESRCH - Process is gone
+ * @errno THUNDEROS_EAGAIN - SIGQUEUE_MAX real-time signals already queued
+ * @errno THUNDEROS_ENOMEM - No memory for the queue
+ */
+int signal_send_info(struct process *proc, const ksiginfo_t *info);
+
+/**
+ * Take the lowest pending signal in mask off a process
+ * 
+ * For a real-time signal this is its oldest queued occurrence; the
+ * signal stays pending while more are queued.
+ * 
+ * @param proc Process
+ * @param mask Signals to consider
+ * @param info Filled in with the signal's details
+ * @return Signal number, or 0 if none in mask is pending
+ */
+int signal_dequeue(struct process *proc, sigset_t mask, ksiginfo_t *info);
+
+/**
+ * Change the blocked signals of a process
+ * 
+ * SIGKILL and SIGSTOP stay unblocked whatever set says.
+ * 
+ * @param proc Process
+ * @param how SIG_BLOCK, SIG_UNBLOCK or SIG_SETMASK
+ * @param set Signals to apply
+ * @param oldset Filled in with the previous mask (may be NULL)
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Unknown how
+ */
+int signal_procmask(struct process *proc, int how, sigset_t set, sigset_t *oldset);
+
+/**
+ * Free what a dying process still has queued
+ * 
+ * @param proc Process being freed
+ */
+void signal_release_process(struct process *proc);
+
 /**
  * Check and deliver pending signals
  * 
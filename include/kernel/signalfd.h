@@ -0,0 +1,113 @@
+/**
+ * @file signalfd.h
+ * @brief Receiving signals through a file descriptor
+ *
+ * A signalfd names a set of signals. Reading it takes pending signals in
+ * that set off the reading process, lowest first, as signalfd_siginfo
+ * records, instead of having them delivered to a handler; the signals
+ * should be blocked so normal delivery does not take them first. Several
+ * records come back from one read(), so a supervisor can collect a burst
+ * of real-time signals (each queued with its own value) in one system
+ * call, and poll() and epoll report the descriptor readable while any of
+ * its signals is pending.
+ *
+ * As on Linux, a signalfd always reads the signals of the process using
+ * it, not of the one that created it. All signalfds share one wait
+ * queue, woken whenever any signal is sent; readers recheck their own
+ * pending set.
+ */
+
+#ifndef SIGNALFD_H
+#define SIGNALFD_H
+
+#include <stdint.h>
+#include "kernel/poll.h"
+#include "kernel/process.h"
+
+/**
+ * One signal as read from a signalfd (Linux layout, 128 bytes)
+ */
+struct signalfd_siginfo {
+    uint32_t ssi_signo;     /**< Signal number */
+    int32_t  ssi_errno;     /**< Unused (0) */
+    int32_t  ssi_code;      /**< SI_* origin */
+    uint32_t ssi_pid;       /**< Sending process */
+    uint32_t ssi_uid;       /**< Its real user ID */
+    int32_t  ssi_fd;        /**< Unused (0) */
+    uint32_t ssi_tid;       /**< Unused (0) */
+    uint32_t ssi_band;      /**< Unused (0) */
+    uint32_t ssi_overrun;   /**< Unused (0) */
+    uint32_t ssi_trapno;    /**< Unused (0) */
+    int32_t  ssi_status;    /**< Unused (0) */
+    int32_t  ssi_int;       /**< sigqueue() value, as an int */
+    uint64_t ssi_ptr;       /**< sigqueue() value, as a pointer */
+    uint8_t  pad[72];
+};
+
+typedef struct signalfd signalfd_t;
+
+/**
+ * Create a signalfd context
+ *
+ * @param mask Signals to read (SIGKILL and SIGSTOP are dropped)
+ * @return Context holding one reference, or NULL (errno set)
+ *
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ */
+signalfd_t *signalfd_create(sigset_t mask);
+
+/**
+ * Replace the signals a signalfd reads
+ *
+ * @param sfd Context
+ * @param mask New set (SIGKILL and SIGSTOP are dropped)
+ */
+void signalfd_set_mask(signalfd_t *sfd, sigset_t mask);
+
+/**
+ * Take another reference to a context (dup2 of its descriptor)
+ *
+ * @param sfd Context
+ */
+void signalfd_get(signalfd_t *sfd);
+
+/**
+ * Drop a reference; the last one frees the context
+ *
+ * @param sfd Context
+ */
+void signalfd_put(signalfd_t *sfd);
+
+/**
+ * Read pending signals of the current process
+ *
+ * Returns as many whole records as fit in size and are pending, waiting
+ * for the first one unless nonblock is set.
+ *
+ * @param sfd Context
+ * @param buffer Kernel buffer for struct signalfd_siginfo records
+ * @param size Size of buffer in bytes
+ * @param nonblock Nonzero to fail with EAGAIN instead of sleeping
+ * @return Bytes read, -1 on error
+ *
+ * @errno THUNDEROS_EINVAL - size is smaller than one record
+ * @errno THUNDEROS_EAGAIN - Nothing pending and nonblock set
+ * @errno THUNDEROS_EINTR - A signal outside the set arrived first
+ */
+int signalfd_read(signalfd_t *sfd, void *buffer, uint32_t size, int nonblock);
+
+/**
+ * Poll method: POLLIN while a signal in the set is pending on the caller
+ *
+ * @param sfd Context
+ * @param pt Poll table to register on, or NULL
+ * @return POLL* mask
+ */
+int signalfd_poll(signalfd_t *sfd, poll_table_t *pt);
+
+/**
+ * Wake everything waiting on a signalfd (called when a signal is sent)
+ */
+void signalfd_notify(void);
+
+#endif /* SIGNALFD_H */
@@ -0,0 +1,174 @@
+/*
+ * SMP Support for ThunderOS
+ *
+ * Per-CPU state and secondary hart bring-up. While a hart is in the
+ * kernel its tp register points at its struct cpu; in user mode the
+ * pointer is parked in sscratch and trap entry swaps it back.
+ *
+ * Kernel code is serialised by one big kernel lock (BKL): a hart takes it
+ * on entry from user mode or idle and drops it on the way back out, so
+ * the rest of the kernel can keep treating disabled interrupts as
+ * exclusive access. The scheduler runs on every hart, each switching
+ * between the processes it picks and its own idle context.
+ */
+
+#ifndef KERNEL_SMP_H
+#define KERNEL_SMP_H
+
+#include "kernel/config.h"
+
+// struct cpu offsets used by boot.S and trap_entry.S
+#define CPU_KERNEL_SP   0
+#define CPU_USER_SP     8
+#define CPU_IDLE_SP     16
+#define CPU_OVERFLOW_SP 24
+#define CPU_TRAP_SCRATCH 32
+
+// Idle loop stack per CPU (also the secondary harts' boot stack)
+#define CPU_IDLE_STACK_SIZE (8 * 1024)
+
+// Stack a trap moves to when the kernel stack has run into its guard
+#define CPU_OVERFLOW_STACK_SIZE (4 * 1024)
+
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+#include "kernel/process.h"
+
+/**
+ * Per-CPU state
+ *
+ * The first five fields are reached from assembly; keep them in step
+ * with the CPU_* offsets above.
+ */
+struct cpu {
+    uint64_t kernel_sp;                 // Kernel stack top for the next trap from user mode
+    uint64_t user_sp;                   // User sp, stashed by trap entry
+    uint64_t idle_sp;                   // Top of this CPU's idle stack
+    uint64_t overflow_sp;               // Top of this CPU's overflow stack (mm/kstack.h)
+    uint64_t trap_scratch;              // t0 while trap entry checks for overflow
+
+    unsigned long hartid;               // Hardware hart ID
+    int id;                             // Logical CPU number (boot CPU = 0)
+    volatile int online;                // Set once the hart is running kernel code
+
+    // Scheduler
+    struct process *current;            // Running process (NULL = idle)
+    struct context idle_context;        // Idle loop, run when nothing is runnable
+    uint64_t slice_us;                  // Slice granted to the running process
+    uint64_t slice_end_us;              // When it runs out (UINT64_MAX while idle)
+    volatile int need_resched;          // Running process must give up the CPU
+    unsigned long ticks_seen;           // Last tick charged by scheduler_tick()
+
+    uint64_t asid_generation;           // ASID generation this hart's TLB holds
+
+    // Deferred interrupt work (kernel/softirq.h)
+    volatile uint32_t softirq_pending;  // Raised softirqs, a bit per SOFTIRQ_*
+    int softirq_running;                // In do_softirq(): no nesting, no switch
+
+    // Bumped at every RCU quiescent state: switching processes (by 2) and
+    // taking or dropping the BKL (by 1), so odd while in the kernel
+    volatile unsigned long rcu_qs_seq;
+
+    // TLB shootdown (smp_flush_tlb_others())
+    volatile int tlb_flush_pending;     // Flush the whole TLB on taking the BKL
+    volatile int bkl_waiting;           // Spinning in bkl_acquire()
+};
+
+/**
+ * Get the CPU we are running on
+ *
+ * Only stable while the caller cannot be switched out: a process may
+ * resume on another CPU after schedule().
+ */
+static inline struct cpu *cpu_this(void) {
+    struct cpu *cpu;
+    asm volatile("mv %0, tp" : "=r"(cpu));
+    return cpu;
+}
+
+/**
+ * Get a CPU by logical number
+ *
+ * @param id Logical CPU number
+ * @return CPU, or NULL if id is not a CPU the device tree described
+ */
+struct cpu *cpu_get(int id);
+
+/**
+ * Get the number of CPUs running kernel code
+ */
+int cpu_online_count(void);
+
+/**
+ * Set up per-CPU state on the boot hart
+ *
+ * Must run first in kernel_main(), while the device tree is intact:
+ * lists the harts it describes, points tp at CPU 0 and takes the BKL
+ * for the rest of boot.
+ */
+void smp_init(void);
+
+/**
+ * Start every other hart described by the device tree
+ *
+ * Each one enables paging and its timer, then enters the scheduler's
+ * idle loop. Waits briefly for them to report in.
+ */
+void smp_boot_secondaries(void);
+
+/**
+ * C entry point of a secondary hart (from _start_secondary in boot.S)
+ *
+ * @param cpu This hart's CPU, already in tp
+ */
+void smp_secondary_main(struct cpu *cpu) __attribute__((noreturn));
+
+/**
+ * Ask a CPU to reschedule
+ * 
+ * Sends it an IPI, which it handles with scheduler_ipi(); for the calling
+ * CPU itself this just sets need_resched.
+ * 
+ * @param cpu Target CPU
+ */
+void smp_send_reschedule(struct cpu *cpu);
+
+/**
+ * Flush every other CPU's TLB (threads share a page table)
+ *
+ * Local flushes only reach this hart, while another may be running a
+ * thread of the same process on stale translations. Each other CPU is
+ * marked and sent an IPI, and flushes when it next takes the BKL; we
+ * wait until each has at least left user mode, as it cannot get back
+ * there without the lock. Call with the BKL held, after changing the
+ * PTEs and before freeing any page they pointed at.
+ */
+void smp_flush_tlb_others(void);
+
+/**
+ * Take the big kernel lock (spins; interrupts are kept off meanwhile)
+ */
+void bkl_acquire(void);
+
+/**
+ * Release the big kernel lock
+ */
+void bkl_release(void);
+
+/**
+ * Check whether this CPU holds the big kernel lock
+ */
+int bkl_held(void);
+
+/**
+ * Let a waiting CPU have the big kernel lock for a moment
+ *
+ * Called at voluntary yield points, where the caller holds no state
+ * another CPU could trip over. Does nothing if no one is waiting.
+ */
+void bkl_relax(void);
+
+#endif // __ASSEMBLER__
+
+#endif // KERNEL_SMP_H
@@ -0,0 +1,142 @@
+/**
+ * @file softirq.h
+ * @brief Per-CPU deferred interrupt work
+ *
+ * A hard interrupt handler does only what cannot wait (acknowledging
+ * the device) and raises a softirq; its action runs on the same CPU on
+ * the way out of the trap, once every interrupt it claimed is complete,
+ * or from the idle loop. Actions run with interrupts on, so a timer or
+ * device interrupt that arrives meanwhile is taken at once, but are
+ * never switched out: a reschedule that comes due waits until they are
+ * done. An action must not sleep, and disables interrupts around state
+ * it shares with hard handlers, as before.
+ *
+ * Each CPU has a bitmap of raised softirqs (cpu->softirq_pending).
+ * Raising one that is already raised is a no-op, so a burst of
+ * interrupts costs one run of the action. Work that keeps raising
+ * itself is cut off after SOFTIRQ_RESTART_MAX rounds and waits for the
+ * next interrupt or the idle loop, so it cannot starve processes.
+ *
+ * Usage:
+ *   static void mydev_softirq(void) { ... reap completions ... }
+ *
+ *   open_softirq(SOFTIRQ_BLOCK, mydev_softirq);     // At init
+ *
+ *   // In the interrupt handler:
+ *   mydev_ack();
+ *   raise_softirq(SOFTIRQ_BLOCK);
+ *
+ * Tasklets are one-off items run from SOFTIRQ_TASKLET: a tasklet is on
+ * the list of the CPU that scheduled it at most once, so scheduling it
+ * again before it ran is a no-op.
+ */
+
+#ifndef KERNEL_SOFTIRQ_H
+#define KERNEL_SOFTIRQ_H
+
+#include <stdint.h>
+
+// Softirq numbers, run in this order
+#define SOFTIRQ_TIMER       0   // Timer wheel
+#define SOFTIRQ_NET_RX      1   // Network receive
+#define SOFTIRQ_NET_TX      2   // Network transmit completions
+#define SOFTIRQ_BLOCK       3   // Block I/O completions
+#define SOFTIRQ_TASKLET     4   // Tasklets
+#define SOFTIRQ_RCU         5   // RCU callbacks
+#define SOFTIRQ_COUNT       6
+
+// Passes over the bitmap per run before leaving the rest for later
+#define SOFTIRQ_RESTART_MAX 10
+
+/**
+ * Softirq action
+ */
+typedef void (*softirq_fn_t)(void);
+
+struct tasklet;
+
+/**
+ * Tasklet callback; the tasklet may be scheduled again from inside it
+ */
+typedef void (*tasklet_fn_t)(struct tasklet *tasklet);
+
+/**
+ * Tasklet
+ */
+typedef struct tasklet {
+    tasklet_fn_t fn;                /**< Function to run */
+    struct tasklet *next;           /**< Next tasklet on the CPU's list */
+    int pending;                    /**< Nonzero while scheduled */
+} tasklet_t;
+
+/**
+ * Static initializer for a tasklet
+ */
+#define TASKLET_INIT(f) { .fn = (f), .next = NULL, .pending = 0 }
+
+/**
+ * Set up the softirqs of the core kernel (tasklets, RCU)
+ */
+void softirq_init(void);
+
+/**
+ * Set the action of a softirq
+ *
+ * @param nr SOFTIRQ_* number
+ * @param fn Action, run each time nr was raised
+ */
+void open_softirq(int nr, softirq_fn_t fn);
+
+/**
+ * Raise a softirq on the calling CPU
+ *
+ * Safe from interrupt handlers. The action runs at the end of the trap,
+ * or at the next one if the caller is not in a trap.
+ *
+ * @param nr SOFTIRQ_* number
+ */
+void raise_softirq(int nr);
+
+/**
+ * Run the softirqs raised on the calling CPU
+ *
+ * Called on the way out of interrupt traps and from the idle loop, with
+ * the big kernel lock held. Does nothing if they are running already
+ * (in the trap this one interrupted).
+ */
+void do_softirq(void);
+
+/**
+ * Check whether the calling CPU is running softirqs
+ *
+ * Code that can sleep or poll for a completion polls when this is set,
+ * as it does in an interrupt handler.
+ */
+int in_softirq(void);
+
+/**
+ * Get the number of times a softirq's action has run, on every CPU
+ *
+ * @param nr SOFTIRQ_* number
+ */
+uint64_t softirq_count(int nr);
+
+/**
+ * Initialize a tasklet
+ *
+ * @param tasklet Tasklet
+ * @param fn Function to run
+ */
+void tasklet_init(tasklet_t *tasklet, tasklet_fn_t fn);
+
+/**
+ * Schedule a tasklet to run on the calling CPU
+ *
+ * Safe from interrupt handlers. Never sleeps.
+ *
+ * @param tasklet Tasklet
+ * @return 1 if scheduled, 0 if it was already pending
+ */
+int tasklet_schedule(tasklet_t *tasklet);
+
+#endif // KERNEL_SOFTIRQ_H
@@ -0,0 +1,134 @@
+/**
+ * @file spinlock.h
+ * @brief Ticket spinlocks for ThunderOS
+ *
+ * A ticket lock hands out numbers in arrival order and serves them in the
+ * same order, so waiting harts get the lock first come, first served and
+ * none can be starved by one that keeps re-taking it. Each waiter only
+ * reads now_serving while it spins.
+ *
+ * Spinlocks never sleep. Take them with interrupts masked
+ * (spin_lock_irqsave()) whenever an interrupt handler on the same hart
+ * could want the same lock, or the handler would spin on its own hart
+ * forever.
+ *
+ * Build with LOCK_STATS=1 (-DSPINLOCK_STATS) to count acquisitions,
+ * contended acquisitions, spin iterations and the longest hold time per
+ * lock; spinlock_stats_dump() prints them. LOCK_STATS=1 also defines
+ * LOCKSTAT, which adds wait and hold times per lock class (lockstat.h).
+ */
+
+#ifndef KERNEL_SPINLOCK_H
+#define KERNEL_SPINLOCK_H
+
+#include <stdint.h>
+
+// Lock classes need the hold times kept for SPINLOCK_STATS
+#if defined(LOCKSTAT) && !defined(SPINLOCK_STATS)
+#define SPINLOCK_STATS
+#endif
+
+struct lockstat_class;
+
+/**
+ * @brief Ticket spinlock
+ */
+typedef struct spinlock {
+    volatile uint32_t next_ticket;  /**< Ticket the next arrival takes */
+    volatile uint32_t now_serving;  /**< Ticket allowed to hold the lock */
+#ifdef SPINLOCK_STATS
+    const char *name;               /**< Name for spinlock_stats_dump() */
+    uint64_t acquisitions;          /**< Times taken */
+    uint64_t contended;             /**< Times taken after waiting */
+    uint64_t spins;                 /**< Total spin iterations */
+    uint64_t max_hold_us;           /**< Longest hold time */
+    uint64_t locked_at_us;          /**< When the holder took it */
+    struct spinlock *stats_next;    /**< Next lock known to the stats */
+#endif
+#ifdef LOCKSTAT
+    struct lockstat_class *lockstat; /**< Class (NULL until first known) */
+#endif
+} spinlock_t;
+
+/**
+ * @brief Static initializer for an unlocked spinlock
+ *
+ * Locks initialised this way are only listed by spinlock_stats_dump()
+ * once spin_lock_init() has named them.
+ */
+#define SPINLOCK_INIT { .next_ticket = 0, .now_serving = 0 }
+
+/**
+ * @brief Initialize a spinlock
+ *
+ * @param lock Lock to initialize
+ * @param name Name reported by the lock statistics (may be NULL)
+ */
+void spin_lock_init(spinlock_t *lock, const char *name);
+
+/**
+ * @brief Acquire a spinlock, spinning until it is ours
+ *
+ * @param lock Lock to acquire
+ */
+void spin_lock(spinlock_t *lock);
+
+/**
+ * @brief Try to acquire a spinlock without spinning
+ *
+ * @param lock Lock to acquire
+ * @return 1 if acquired, 0 if it was held
+ */
+int spin_trylock(spinlock_t *lock);
+
+/**
+ * @brief Release a spinlock
+ *
+ * @param lock Lock to release (must be held by the caller)
+ */
+void spin_unlock(spinlock_t *lock);
+
+/**
+ * @brief Disable interrupts and acquire a spinlock
+ *
+ * @param lock Lock to acquire
+ * @return Previous interrupt state, for spin_unlock_irqrestore()
+ */
+int spin_lock_irqsave(spinlock_t *lock);
+
+/**
+ * @brief Release a spinlock and restore the interrupt state
+ *
+ * @param lock Lock to release
+ * @param irq_state Value returned by spin_lock_irqsave()
+ */
+void spin_unlock_irqrestore(spinlock_t *lock, int irq_state);
+
+/**
+ * @brief Check whether a spinlock is held
+ *
+ * @param lock Lock to check
+ * @return Nonzero if some hart holds it
+ */
+static inline int spin_is_locked(const spinlock_t *lock) {
+    return lock->next_ticket != lock->now_serving;
+}
+
+/**
+ * @brief Check whether anyone is waiting for a held spinlock
+ *
+ * @param lock Lock to check
+ * @return Nonzero if a hart other than the holder has taken a ticket
+ */
+static inline int spin_is_contended(const spinlock_t *lock) {
+    return (uint32_t)(lock->next_ticket - lock->now_serving) > 1;
+}
+
+/**
+ * @brief Print the statistics of every named lock
+ *
+ * Does nothing unless built with SPINLOCK_STATS.
+ */
+void spinlock_stats_dump(void);
+
+#endif // KERNEL_SPINLOCK_H
@@ -72,10 +72,67 @@
 #define SYS_RWLOCK_WRITE_LOCK  59  // Acquire write lock (blocking)
 #define SYS_RWLOCK_WRITE_UNLOCK 60 // Release write lock
 #define SYS_RWLOCK_DESTROY     61  // Destroy a reader-writer lock
+#define SYS_MSYNC              62  // Write back a shared file mapping
+#define SYS_FUTEX              63  // Wait on / wake a user-space lock word
+#define SYS_RING_SETUP         64  // Register a batched syscall ring
+#define SYS_RING_ENTER         65  // Run queued ring submissions
+#define SYS_VFORK              66  // Fork without copying the address space
+#define SYS_FCNTL              67  // Control an open file (pipe size)
+#define SYS_SPLICE             68  // Move data between a pipe and a file
+#define SYS_TEE                69  // Duplicate pipe data into another pipe
+#define SYS_SENDFILE           70  // Copy file data to a pipe or file
+#define SYS_POLL               71  // Wait for events on descriptors
+#define SYS_EPOLL_CREATE       72  // Create an epoll instance
+#define SYS_EPOLL_CTL          73  // Change an epoll interest list
+#define SYS_EPOLL_WAIT         74  // Wait on an epoll instance
+#define SYS_PIPE2              75  // Create a pipe with O_NONBLOCK
+#define SYS_SHM_OPEN           76  // Open a named shared memory object
+#define SYS_SHM_UNLINK         77  // Remove a shared memory object's name
+#define SYS_FTRUNCATE          78  // Resize an open file (shared memory)
+#define SYS_SIGQUEUE           79  // Send a signal with a value
+#define SYS_SIGPROCMASK        80  // Change the blocked signals
+#define SYS_SIGNALFD           81  // Create or change a signalfd
+#define SYS_PREAD64            82  // Read at a file offset
+#define SYS_PWRITE64           83  // Write at a file offset
+#define SYS_READV              84  // Read into several buffers
+#define SYS_WRITEV             85  // Write from several buffers
+#define SYS_PREADV             86  // Read into several buffers at a file offset
+#define SYS_PWRITEV            87  // Write from several buffers at a file offset
+#define SYS_FSYNC              88  // Make a file durable
+#define SYS_FDATASYNC          89  // Make a file's data durable
+#define SYS_SYNC               90  // Make every filesystem durable
+#define SYS_IOCTL              91  // Device-specific request (/dev/fb0)
 #define SYS_SOCKET        100  // Create a socket
 #define SYS_BIND          101  // Bind socket to address
 #define SYS_SENDTO        102  // Send data on socket
 #define SYS_RECVFROM      103  // Receive data from socket
+#define SYS_SENDMMSG      104  // Send several datagrams
+#define SYS_RECVMMSG      105  // Receive several datagrams
+#define SYS_CONNECT       106  // Connect a stream socket
+#define SYS_LISTEN        107  // Accept connections on a socket
+#define SYS_ACCEPT        108  // Take a connection off a listener
+#define SYS_SETSOCKOPT    109  // Set a socket option
+#define SYS_GETSOCKOPT    110  // Get a socket option
+#define SYS_SHUTDOWN      111  // Shut down part of a connection
+#define SYS_SOCKETPAIR    112  // Create a pair of connected sockets
+#define SYS_SENDMSG       113  // Send a message, with descriptors
+#define SYS_RECVMSG       114  // Receive a message, with descriptors
+#define SYS_GETIRQS       115  // Get interrupt statistics
+#define SYS_IRQCTL        116  // Set an interrupt's affinity or priority
+#define SYS_PERF_EVENT_OPEN 117  // Count a hardware event for a process
+#define SYS_CLOCK_GETTIME 118  // Read CLOCK_REALTIME or CLOCK_MONOTONIC
+#define SYS_CLONE         119  // Create a thread sharing our address space
+#define SYS_GETTID        120  // Get the calling thread's ID
+#define SYS_EXIT_GROUP    121  // Exit every thread of the process
+#define SYS_SCHED_SETATTR 122  // Set a scheduling policy and parameters
+#define SYS_SCHED_GETATTR 123  // Get a scheduling policy and parameters
+#define SYS_RGROUP_CREATE 124  // Create a resource group
+#define SYS_RGROUP_DESTROY 125  // Remove an empty resource group
+#define SYS_RGROUP_SETLIMIT 126  // Set a resource group's CPU and memory limits
+#define SYS_RGROUP_ATTACH 127  // Move a process to a resource group
+#define SYS_MADVISE       128  // Drop or advise on pages of a mapping
+#define SYS_AIO_SETUP     129  // Create an asynchronous I/O context
+#define SYS_AIO_SUBMIT    130  // Queue file reads and writes on one
 #define SYS_POWEROFF      200  // Power off the system
 #define SYS_REBOOT        201  // Reboot the system
 
@@ -87,9 +144,43 @@
 // - Return value in a0 (x10)
 // - Uses ECALL instruction from user mode
 
+struct trap_frame;
+struct pollfd;
+struct epoll_event;
+struct vfs_iovec;
+struct msghdr;
+struct mmsghdr;
+struct timespec;
+struct aio_iocb;
+
+// Syscall table entry flags
+#define SYSCALL_NEEDS_FRAME 0x01    // Works on the caller's trap frame (fork, execve)
+#define SYSCALL_MAY_BLOCK   0x02    // May sleep before returning
+
+// Arguments of one syscall, as handed to its table entry
+typedef struct syscall_args {
+    struct trap_frame *tf;          // Caller's trap frame (NULL without one)
+    uint64_t arg[6];                // a0-a5
+} syscall_args_t;
+
+// Syscall table entry
+typedef struct syscall_entry {
+    uint64_t (*handler)(const syscall_args_t *args);
+    uint32_t flags;                 // SYSCALL_NEEDS_FRAME, SYSCALL_MAY_BLOCK
+    const char *name;               // For /proc (its handler's name)
+} syscall_entry_t;
+
 /**
- * Main syscall handler
- * Called from trap handler when ECALL is executed from user mode
+ * Look up a syscall's table entry
+ * 
+ * @param syscall_number Syscall number
+ * @return Entry, or NULL if the number is not a syscall
+ */
+const syscall_entry_t *syscall_lookup(uint64_t syscall_number);
+
+/**
+ * Dispatch a syscall without a trap frame
+ * Syscalls flagged SYSCALL_NEEDS_FRAME fail with ENOSYS
  * 
  * @param syscall_num Syscall number (from a7)
  * @param arg0-arg5 Syscall arguments (from a0-a5)
@@ -99,8 +190,7 @@ uint64_t syscall_handler(uint64_t syscall_number,
                         uint64_t argument0, uint64_t argument1, uint64_t argument2,
                         uint64_t argument3, uint64_t argument4, uint64_t argument5);
 
-// Syscall handler with trap frame (for syscalls like fork that need full register state)
-struct trap_frame;
+// Main syscall handler, called from the trap handler on ECALL from user mode
 uint64_t syscall_handler_with_frame(struct trap_frame *tf,
                                     uint64_t syscall_number, 
                                     uint64_t argument0, uint64_t argument1, uint64_t argument2,
@@ -117,8 +207,43 @@ typedef struct {
     int tty;                    /* Controlling terminal (-1 = none) */
     unsigned long cpu_time;     /* CPU time in ticks */
     char name[PROC_NAME_MAX];   /* Process name */
+    unsigned long rss_pages;    /* Resident user pages */
+    unsigned long peak_rss_pages; /* Peak resident user pages */
+    unsigned long pt_pages;     /* Page-table pages */
+    unsigned long minor_faults; /* Page faults resolved without I/O */
+    unsigned long major_faults; /* Page faults that read from disk */
+    unsigned long utime_us;     /* Time in user mode */
+    unsigned long stime_us;     /* Time in the kernel on its behalf */
+    unsigned long nvcsw;        /* Voluntary context switches (blocked) */
+    unsigned long nivcsw;       /* Involuntary context switches (preempted) */
+    unsigned long io_wait_us;   /* Time waiting for block I/O */
 } procinfo_t;
 
+/* Interrupt info structure for SYS_GETIRQS */
+#define IRQ_INFO_NAME_MAX 16
+#define IRQ_INFO_CPUS 8             /* MAX_CPUS */
+typedef struct {
+    unsigned int irq;           /* PLIC source number */
+    unsigned int priority;      /* 1-7 */
+    unsigned int affinity;      /* CPUs allowed to take it, a bit per logical CPU */
+    int target;                 /* CPU that takes it */
+    char name[IRQ_INFO_NAME_MAX]; /* Driver's name for it */
+    unsigned long count;        /* Interrupts handled */
+    unsigned long cpu_count[IRQ_INFO_CPUS]; /* Of those, on each CPU */
+    unsigned long total_us;     /* Time spent in the handler */
+    unsigned long max_us;       /* Longest handler run */
+    unsigned long max_latency_us; /* Longest wait from the trap to the handler */
+    int thread_pid;             /* Its IRQ thread, 0 if none */
+    unsigned long thread_count; /* Thread function runs */
+    unsigned long thread_total_us; /* Time spent in the thread function */
+    unsigned long thread_max_us; /* Longest thread function run */
+    unsigned long thread_max_latency_us; /* Longest wait from the hard handler to it */
+} irqinfo_t;
+
+/* SYS_IRQCTL commands */
+#define IRQCTL_SET_AFFINITY 1       /* arg: CPU mask */
+#define IRQCTL_SET_PRIORITY 2       /* arg: 1-7 */
+
 /* System info structure for SYS_UNAME */
 typedef struct {
     char sysname[64];           /* OS name */
@@ -130,14 +255,18 @@ typedef struct {
 
 // Individual syscall implementations
 uint64_t sys_exit(int status);
+uint64_t sys_exit_group(int status);
 uint64_t sys_waitpid(int pid, int *wstatus, int options);
 uint64_t sys_write(int file_descriptor, const char *buffer, size_t byte_count);
 uint64_t sys_read(int file_descriptor, char *buffer, size_t byte_count);
 uint64_t sys_getpid(void);
+uint64_t sys_gettid(void);
 uint64_t sys_sbrk(int increment);
 uint64_t sys_sleep(uint64_t milliseconds);
 uint64_t sys_yield(void);
 uint64_t sys_fork(struct trap_frame *tf);
+uint64_t sys_vfork(struct trap_frame *tf);
+uint64_t sys_clone(struct trap_frame *tf, uint64_t flags, uintptr_t stack, uintptr_t tls, uint32_t *ctid);
 uint64_t sys_getppid(void);
 uint64_t sys_kill(int pid, int signal);
 uint64_t sys_gettime(void);
@@ -154,7 +283,57 @@ uint64_t sys_sigaction(int signum, const void *act, void *oldact);
 uint64_t sys_sigreturn(void);
 uint64_t sys_mmap(void *addr, size_t length, int prot, int flags, int fd, uint64_t offset);
 uint64_t sys_munmap(void *addr, size_t length);
+uint64_t sys_msync(void *addr, size_t length, int flags);
+uint64_t sys_madvise(void *addr, size_t length, int advice);
+uint64_t sys_futex(uint32_t *uaddr, int op, uint32_t val, uint64_t val2, uint32_t *uaddr2);
+uint64_t sys_ring_setup(void *ring, uint32_t entries);
+uint64_t sys_ring_enter(uint32_t to_submit);
+uint64_t sys_aio_setup(int flags);
+uint64_t sys_aio_submit(int fd, const struct aio_iocb *iocbs, uint32_t nr);
 uint64_t sys_pipe(int pipefd[2]);
+uint64_t sys_pipe2(int pipefd[2], int flags);
+uint64_t sys_fcntl(int fd, int cmd, uint64_t arg);
+uint64_t sys_splice(int fd_in, int64_t *off_in, int fd_out, int64_t *off_out, size_t len, unsigned int flags);
+uint64_t sys_tee(int fd_in, int fd_out, size_t len, unsigned int flags);
+uint64_t sys_sendfile(int out_fd, int in_fd, int64_t *offset, size_t count);
+uint64_t sys_poll(struct pollfd *fds, uint32_t nfds, int timeout_ms);
+uint64_t sys_epoll_create(int size);
+uint64_t sys_epoll_ctl(int epfd, int op, int fd, const struct epoll_event *event);
+uint64_t sys_epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout_ms);
+uint64_t sys_shm_open(const char *name, int flags, int mode);
+uint64_t sys_shm_unlink(const char *name);
+uint64_t sys_ftruncate(int fd, int64_t length);
+uint64_t sys_sigqueue(int pid, int signum, int64_t value);
+uint64_t sys_sigprocmask(int how, const uint64_t *set, uint64_t *oldset);
+uint64_t sys_signalfd(int fd, const uint64_t *mask, int flags);
+uint64_t sys_pread64(int fd, void *buffer, size_t count, int64_t offset);
+uint64_t sys_pwrite64(int fd, const void *buffer, size_t count, int64_t offset);
+uint64_t sys_readv(int fd, const struct vfs_iovec *iov, int iovcnt);
+uint64_t sys_writev(int fd, const struct vfs_iovec *iov, int iovcnt);
+uint64_t sys_preadv(int fd, const struct vfs_iovec *iov, int iovcnt, int64_t offset);
+uint64_t sys_pwritev(int fd, const struct vfs_iovec *iov, int iovcnt, int64_t offset);
+uint64_t sys_fsync(int fd);
+uint64_t sys_fdatasync(int fd);
+uint64_t sys_sync(void);
+uint64_t sys_ioctl(int fd, uint32_t request, uint64_t arg);
+uint64_t sys_socket(int domain, int type, int protocol);
+uint64_t sys_bind(int fd, const void *addr, uint32_t addrlen);
+uint64_t sys_sendto(int fd, const void *buffer, size_t len, int flags,
+                    const void *dest, uint32_t addrlen);
+uint64_t sys_recvfrom(int fd, void *buffer, size_t len, int flags,
+                      void *src, uint32_t *addrlen);
+uint64_t sys_sendmmsg(int fd, struct mmsghdr *msgvec, uint32_t vlen, int flags);
+uint64_t sys_recvmmsg(int fd, struct mmsghdr *msgvec, uint32_t vlen, int flags,
+                      const struct timespec *timeout);
+uint64_t sys_connect(int fd, const void *addr, uint32_t addrlen);
+uint64_t sys_listen(int fd, int backlog);
+uint64_t sys_accept(int fd, void *addr, uint32_t *addrlen);
+uint64_t sys_setsockopt(int fd, int level, int name, const void *value, uint32_t len);
+uint64_t sys_getsockopt(int fd, int level, int name, void *value, uint32_t *len);
+uint64_t sys_shutdown(int fd, int how);
+uint64_t sys_socketpair(int domain, int type, int protocol, int *sv);
+uint64_t sys_sendmsg(int fd, const struct msghdr *msg, int flags);
+uint64_t sys_recvmsg(int fd, struct msghdr *msg, int flags);
 uint64_t sys_getdents(int fd, void *dirp, size_t count);
 uint64_t sys_chdir(const char *path);
 uint64_t sys_getcwd(char *buf, size_t size);
@@ -163,6 +342,16 @@ uint64_t sys_gettty(void);
 uint64_t sys_settty(int tty);
 uint64_t sys_getprocs(procinfo_t *buf, size_t max_procs);
 uint64_t sys_uname(utsname_t *buf);
+uint64_t sys_getirqs(irqinfo_t *buf, size_t max_irqs);
+uint64_t sys_irqctl(uint32_t irq, int cmd, uint64_t arg);
+uint64_t sys_perf_event_open(const void *attr, int pid, int flags);
+uint64_t sys_clock_gettime(int clock, struct timespec *ts);
+uint64_t sys_sched_setattr(int pid, const void *attr, unsigned int flags);
+uint64_t sys_sched_getattr(int pid, void *attr, unsigned int size, unsigned int flags);
+uint64_t sys_rgroup_create(const char *name);
+uint64_t sys_rgroup_destroy(int id);
+uint64_t sys_rgroup_setlimit(int id, const void *limits);
+uint64_t sys_rgroup_attach(int id, int pid);
 uint64_t sys_setpgid(int pid, int pgid);
 uint64_t sys_getpgid(int pid);
 uint64_t sys_getsid(int pid);
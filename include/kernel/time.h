@@ -9,6 +9,18 @@
 
 #include <stdint.h>
 
+// Clocks of clock_gettime() (Linux numbering)
+#define CLOCK_REALTIME          0       // Wall clock, from the RTC at boot
+#define CLOCK_MONOTONIC         1       // Since reset, never steps
+
+/**
+ * A time in seconds and nanoseconds (clock_gettime(), recvmmsg() timeouts)
+ */
+struct timespec {
+    int64_t tv_sec;
+    int64_t tv_nsec;
+};
+
 /**
  * Read the current time value
  * 
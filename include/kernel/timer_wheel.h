@@ -0,0 +1,94 @@
+/*
+ * Timer Wheel for ThunderOS
+ *
+ * Tick-granularity kernel timers on a hierarchical timing wheel. Adding
+ * and cancelling a timer is O(1); each tick runs the timers of one slot,
+ * and a far-off timer is moved down a level every time its slot comes
+ * round (at most TIMER_WHEEL_LEVELS - 1 times over its life).
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+// Slots per level (64) and number of levels
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SIZE (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+// Longest delay the wheel holds directly (2^24 ticks, ~19 days at 100ms);
+// later timers park in the top level and are re-filed as time passes
+#define TIMER_WHEEL_MAX_DELTA ((1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+typedef void (*ktimer_fn_t)(void *data);
+
+/**
+ * Kernel timer
+ *
+ * Embedded in its owner and initialised once with ktimer_setup(). The
+ * owner must cancel a pending timer before freeing it.
+ */
+typedef struct ktimer {
+    struct ktimer *next;                // Next timer in the same slot
+    struct ktimer **pprev;              // Link pointing at us (NULL = not pending)
+    uint64_t expires;                   // Tick (hal_timer_get_ticks()) to fire at
+    ktimer_fn_t fn;                     // Callback
+    void *data;                         // Callback argument
+} ktimer_t;
+
+/**
+ * Initialise a timer
+ *
+ * @param timer Timer to initialise
+ * @param fn Callback, run from the timer interrupt with interrupts disabled
+ * @param data Argument passed to fn
+ */
+void ktimer_setup(ktimer_t *timer, ktimer_fn_t fn, void *data);
+
+/**
+ * Arm a timer, or re-arm it if already pending
+ *
+ * @param timer Timer to arm
+ * @param expires Absolute tick; a tick already past fires on the next tick
+ */
+void ktimer_add(ktimer_t *timer, uint64_t expires);
+
+/**
+ * Disarm a timer
+ *
+ * @param timer Timer to disarm
+ * @return 1 if the timer was pending, 0 if it had fired or was never armed
+ */
+int ktimer_cancel(ktimer_t *timer);
+
+/**
+ * Check whether a timer is armed
+ *
+ * @param timer Timer to check
+ * @return Nonzero if pending
+ */
+static inline int ktimer_pending(const ktimer_t *timer) {
+    return timer->pprev != 0;
+}
+
+/**
+ * Get the first tick at which the wheel has work to do
+ *
+ * Exact for timers due within the next 64 ticks; for later ones it is the
+ * tick they are cascaded, which is never after they are due.
+ *
+ * @return Tick number, or UINT64_MAX if no timer is pending
+ */
+uint64_t timer_wheel_next_expiry(void);
+
+/**
+ * Run every timer due at or before now
+ *
+ * Called from the timer interrupt with the current tick count.
+ *
+ * @param now Current tick
+ */
+void timer_wheel_run(uint64_t now);
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,138 @@
+/**
+ * @file trace.h
+ * @brief Static tracepoints and per-CPU trace rings
+ *
+ * Tracepoints sit at fixed places in the kernel (scheduler switches,
+ * syscall entry and exit, page faults, block requests, interrupts) and
+ * write a fixed-size binary record into a ring of the CPU they run on.
+ * Nothing is printed: the rings are drained through /dev/trace and the
+ * records decoded offline (tools/trace_decode.py), so tracing costs a
+ * timer read and a 32-byte store per event instead of a serial write.
+ *
+ * Each event has a bit in a read-mostly enable mask. A disabled
+ * tracepoint is one load and a branch the compiler lays out as not
+ * taken; the record is written out of line. Nothing is enabled at boot.
+ *
+ * A ring has one writer, its CPU, which fills it with interrupts off,
+ * and readers that only ever move its head; neither takes a lock. When
+ * a ring is full new records are dropped and counted, so a slow reader
+ * loses the end of a trace rather than the start.
+ *
+ * Usage:
+ *   trace_event(TRACE_BLK_SUBMIT, sector, bytes);
+ *
+ * /dev/trace:
+ *   read()  - Whole records, every CPU's ring in turn; 0 once all are empty
+ *   ioctl() - TRACEIO_* below
+ */
+
+#ifndef KERNEL_TRACE_H
+#define KERNEL_TRACE_H
+
+#include <stdint.h>
+
+// Events (bit numbers in the enable mask). arg0 and arg1 of each:
+#define TRACE_SCHED_SWITCH      0   // Outgoing pid, incoming pid
+#define TRACE_SYSCALL_ENTER     1   // Syscall number, a0
+#define TRACE_SYSCALL_EXIT      2   // Syscall number, return value
+#define TRACE_PAGE_FAULT_ENTER  3   // Faulting address, scause
+#define TRACE_PAGE_FAULT_EXIT   4   // Faulting address, 0 if handled, else -1
+#define TRACE_BLK_SUBMIT        5   // First sector, bytes (| TRACE_BLK_WRITE)
+#define TRACE_BLK_COMPLETE      6   // First sector, 1 if it succeeded, else 0
+#define TRACE_IRQ_ENTER         7   // scause without the interrupt bit, PLIC source (0 if none)
+#define TRACE_IRQ_EXIT          8   // Same as TRACE_IRQ_ENTER
+#define TRACE_EVENT_COUNT       9
+
+#define TRACE_EVENTS_ALL        ((1u << TRACE_EVENT_COUNT) - 1)
+
+// TRACE_BLK_SUBMIT arg1: the request writes
+#define TRACE_BLK_WRITE         (1UL << 63)
+
+// pid of a record made, or a switch to or from, the idle loop
+#define TRACE_PID_IDLE          0xFFFFFFFFu
+
+// Records per CPU ring (a power of two)
+#define TRACE_RING_RECORDS      2048
+
+// ioctl() requests on /dev/trace
+#define TRACEIO_SET_EVENTS      0x5400  // Enable the events in mask arg (0: stop tracing)
+#define TRACEIO_GET_EVENTS      0x5401  // Store the enabled mask (uint32_t) at arg
+#define TRACEIO_GET_STATS       0x5402  // Fill the trace_stats_t at arg
+#define TRACEIO_RESET           0x5403  // Drop everything buffered, zero the counts
+
+/**
+ * Trace record (32 bytes, as read from /dev/trace)
+ */
+typedef struct trace_record {
+    uint64_t timestamp;     /**< rdtime ticks (TIMER_FREQ_HZ per second) */
+    uint16_t event;         /**< TRACE_* */
+    uint16_t cpu;           /**< Logical CPU that recorded it */
+    uint32_t pid;           /**< Process running then, or TRACE_PID_IDLE */
+    uint64_t arg0;
+    uint64_t arg1;
+} trace_record_t;
+
+/**
+ * Trace counts (TRACEIO_GET_STATS), totals over every CPU
+ */
+typedef struct trace_stats {
+    uint64_t recorded;      /**< Records written since the last reset */
+    uint64_t lost;          /**< Records dropped on a full ring */
+    uint64_t buffered;      /**< Records waiting to be read */
+    uint32_t events;        /**< Enabled mask */
+    uint32_t ring_records;  /**< TRACE_RING_RECORDS */
+} trace_stats_t;
+
+// Enabled events; written only by trace_set_events()
+extern volatile uint32_t trace_events_enabled;
+
+/**
+ * Write a record for an enabled event (use trace_event())
+ */
+void trace_record(uint32_t event, uint64_t arg0, uint64_t arg1);
+
+/**
+ * Tracepoint: record event on this CPU if it is enabled
+ *
+ * May be called from any context, interrupt handlers included.
+ */
+static inline void trace_event(uint32_t event, uint64_t arg0, uint64_t arg1) {
+    if (__builtin_expect((trace_events_enabled >> event) & 1, 0)) {
+        trace_record(event, arg0, arg1);
+    }
+}
+
+/**
+ * Set the enabled events
+ *
+ * @param mask Bits (1 << TRACE_*); bits past TRACE_EVENT_COUNT are ignored
+ */
+void trace_set_events(uint32_t mask);
+
+/**
+ * Get the counts of every CPU's ring
+ */
+void trace_get_stats(trace_stats_t *stats);
+
+/**
+ * Take records out of the rings, oldest first within each CPU
+ *
+ * @param buf Where to put them (kernel or checked user memory)
+ * @param max Most records to take
+ * @return Records taken
+ */
+uint32_t trace_drain(trace_record_t *buf, uint32_t max);
+
+/**
+ * Drop every buffered record and zero the counts
+ */
+void trace_reset(void);
+
+/**
+ * Allocate a ring for each CPU and register /dev/trace
+ *
+ * @return 0 on success, -1 on error (errno set)
+ */
+int trace_init(void);
+
+#endif // KERNEL_TRACE_H
@@ -0,0 +1,72 @@
+/**
+ * @file uaccess.h
+ * @brief Copying data between the kernel and user memory
+ *
+ * These replace validating a user range against the VMAs and then
+ * touching it directly. Only the address range is checked up front; the
+ * copy loop (kernel/arch/riscv64/uaccess.S) then runs at full width, and
+ * a fault it cannot resolve (unmapped address, write to a read-only
+ * page) ends it through the exception table with EFAULT instead of a
+ * kernel halt. Pages that are merely not present yet are faulted in as
+ * usual, so a copy may sleep.
+ */
+
+#ifndef _KERNEL_UACCESS_H
+#define _KERNEL_UACCESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Exception table entry: where to resume after a faulting access
+ */
+struct exception_table_entry {
+    uintptr_t insn;                 /**< Address of the faulting instruction */
+    uintptr_t fixup;                /**< Where to continue instead */
+};
+
+/**
+ * @brief Copy from user memory into the kernel
+ *
+ * @param dst Kernel destination
+ * @param src User source
+ * @param n Number of bytes
+ * @return 0 on success, -1 on error
+ * @errno THUNDEROS_EFAULT - Part of the source is not readable user memory
+ */
+int copy_from_user(void *dst, const void *src, size_t n);
+
+/**
+ * @brief Copy from the kernel into user memory
+ *
+ * On failure some of the destination may already have been written.
+ *
+ * @param dst User destination
+ * @param src Kernel source
+ * @param n Number of bytes
+ * @return 0 on success, -1 on error
+ * @errno THUNDEROS_EFAULT - Part of the destination is not writable user memory
+ */
+int copy_to_user(void *dst, const void *src, size_t n);
+
+/**
+ * @brief Copy a NUL-terminated string from user memory
+ *
+ * @param dst Kernel buffer of n bytes; always NUL-terminated on success
+ * @param src User string
+ * @param n Size of dst
+ * @return Length of the string (excluding the NUL), or -1 on error
+ * @errno THUNDEROS_EFAULT - The string runs into memory that is not readable
+ * @errno THUNDEROS_ERANGE - The string does not fit in n bytes
+ */
+long strncpy_from_user(char *dst, const char *src, size_t n);
+
+/**
+ * @brief Find the fixup for a faulting kernel instruction
+ *
+ * @param pc Address of the instruction that faulted
+ * @return Address to resume at, or 0 if pc is not a user access
+ */
+uintptr_t uaccess_fixup(uintptr_t pc);
+
+#endif /* _KERNEL_UACCESS_H */
@@ -0,0 +1,95 @@
+/**
+ * @file vdso.h
+ * @brief vDSO: clock_gettime() in user space
+ *
+ * Every user page table maps two kernel pages just below USER_CODE_BASE:
+ * the vDSO data page (read-only) and the vDSO code page (read and
+ * execute). The data page holds a timebase and the code page a
+ * clock_gettime() that reads rdtime and the timebase, so reading a clock
+ * costs no trap:
+ *
+ *   monotonic ns = mono_base_ns + ((rdtime - cycle_last) * mult >> shift)
+ *   realtime ns  = monotonic ns + realtime_offset_ns
+ *
+ * The kernel rebases the timebase on the timer interrupt, inside a
+ * sequence count (kernel/seqlock.h) that the user code rereads to retry.
+ * User space calls the function through the address in the data page
+ * (userland/lib/vdso.h); SYS_CLOCK_GETTIME reads the same clocks with a
+ * trap.
+ *
+ * CLOCK_REALTIME is the Goldfish RTC read at boot, carried forward by
+ * the monotonic clock. The rebase compares it with the RTC once a second
+ * and steps it back if they are over 100ms apart, which happens when the
+ * VM was paused, or resumed from a snapshot (make resume).
+ */
+
+#ifndef KERNEL_VDSO_H
+#define KERNEL_VDSO_H
+
+#include <stdint.h>
+#include "kernel/seqlock.h"
+#include "kernel/time.h"
+#include "mm/paging.h"
+
+// Where every process sees the pages (under USER_CODE_BASE)
+#define VDSO_DATA_ADDR          0xE000UL
+#define VDSO_TEXT_ADDR          0xF000UL
+
+#define VDSO_MAGIC              0x4F534476  // "vDSO"
+#define VDSO_VERSION            1
+
+/**
+ * The data page, as user space sees it
+ *
+ * kernel/arch/riscv64/vdso.S reads it at fixed offsets, checked against
+ * these fields in kernel/core/vdso.c.
+ */
+typedef struct vdso_data {
+    uint32_t magic;                     // VDSO_MAGIC once set up
+    uint32_t version;                   // VDSO_VERSION
+    seqcount_t seq;                     // Odd while the kernel rebases
+    uint32_t shift;                     // Cycles to ns: * mult >> shift
+    uint64_t mult;
+    uint64_t cycle_last;                // rdtime at the last rebase
+    uint64_t mono_base_ns;              // CLOCK_MONOTONIC then
+    uint64_t realtime_offset_ns;        // CLOCK_REALTIME - CLOCK_MONOTONIC
+    uint64_t clock_gettime;             // User address of the vDSO function
+} vdso_data_t;
+
+/**
+ * Set up the vDSO pages and the timebase
+ *
+ * Once, after paging_init(); page tables made before it have no vDSO.
+ *
+ * @return 0 on success, -1 on error (errno set)
+ */
+int vdso_init(void);
+
+/**
+ * Map the vDSO pages into a user page table
+ *
+ * Each mapping holds a reference to the pages, dropped with the others
+ * when the table is freed. Before vdso_init() (or if it failed) only the
+ * zero page is mapped, at VDSO_DATA_ADDR, so user space finds no magic.
+ *
+ * @return 0 on success, -1 on error (errno set by map_page())
+ */
+int vdso_map(page_table_t *page_table);
+
+/**
+ * Rebase the timebase to now (timer interrupt)
+ */
+void vdso_update(void);
+
+/**
+ * Read a clock, as the vDSO does
+ *
+ * @param clock CLOCK_REALTIME or CLOCK_MONOTONIC
+ * @param ts    Output
+ * @return 0 on success, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_EINVAL - Unknown clock
+ */
+int vdso_clock_gettime(int clock, struct timespec *ts);
+
+#endif // KERNEL_VDSO_H
@@ -0,0 +1,65 @@
+/*
+ * VMA Tree
+ *
+ * Each process keeps its VMAs in two views: proc->vm_areas is a list
+ * sorted by start address (for walking all regions), and proc->vma_root
+ * is an AVL tree over the same nodes for O(log n) lookup. Every node also
+ * tracks the largest unmapped gap below any VMA in its subtree, so a
+ * first-fit search for free address space can skip whole subtrees.
+ *
+ * These are the low-level operations used by the process_*_vma()
+ * functions in process.c; other code should go through those.
+ */
+
+#ifndef VMA_H
+#define VMA_H
+
+#include "kernel/process.h"
+
+/**
+ * Link a VMA into a process's list and tree
+ *
+ * @param proc Owning process
+ * @param vma VMA with start/end/flags set
+ */
+void vma_tree_insert(struct process *proc, vm_area_t *vma);
+
+/**
+ * Unlink a VMA from a process's list and tree (does not free it)
+ *
+ * @param proc Owning process
+ * @param vma VMA to unlink
+ */
+void vma_tree_remove(struct process *proc, vm_area_t *vma);
+
+/**
+ * Find the VMA containing an address
+ *
+ * @param proc Process to search
+ * @param addr Virtual address
+ * @return VMA, or NULL if addr is not in any VMA
+ */
+vm_area_t *vma_tree_find(struct process *proc, uint64_t addr);
+
+/**
+ * Move the end of a VMA (e.g. when the heap shrinks)
+ *
+ * @param proc Owning process
+ * @param vma VMA to resize
+ * @param end New end address (exclusive, > vma->start)
+ */
+void vma_tree_set_end(struct process *proc, vm_area_t *vma, uint64_t end);
+
+/**
+ * Find the lowest free range of a given length
+ *
+ * @param proc Process to search
+ * @param floor Lowest acceptable start address
+ * @param limit End of the searchable address space (exclusive)
+ * @param length Length of the range in bytes
+ * @return Start of the free range, or 0 if none fits
+ */
+uint64_t vma_tree_find_gap(struct process *proc, uint64_t floor,
+                           uint64_t limit, uint64_t length);
+
+#endif // VMA_H
@@ -17,6 +17,11 @@
  *   // In writer:
  *   add_data();
  *   wait_queue_wake(&wq);  // Wake all waiters
+ *
+ * Besides sleepers, a queue can carry callback entries added with
+ * wait_queue_add(): they stay queued across wakeups and have their
+ * function called instead of a process being woken. poll() and epoll
+ * watch many queues at once this way.
  */
 
 #ifndef WAIT_QUEUE_H
@@ -24,26 +29,44 @@
 
 #include <stdint.h>
 #include <stddef.h>
-#include "kernel/process.h"
+
+// process.h embeds wait queues, so only the name here
+struct process;
+
+struct wait_queue;
+struct wait_queue_entry;
 
 /**
- * Maximum number of processes that can wait on a single queue
+ * Wakeup callback of a callback entry
+ *
+ * Runs with interrupts disabled, possibly from an interrupt handler, so
+ * it must not sleep or touch the queue it is called from.
+ *
+ * @return Number of processes it woke
  */
-#define WAIT_QUEUE_MAX_WAITERS 16
+typedef int (*wait_func_t)(struct wait_queue_entry *entry);
 
 /**
  * Wait queue entry - represents one waiting process
+ *
+ * Lives on the sleeper's kernel stack for as long as it is in
+ * wait_queue_sleep(), so blocking never allocates. Callback entries
+ * (func set, proc NULL) are owned by whoever added them.
  */
 typedef struct wait_queue_entry {
     struct process *proc;           /**< Process waiting on this queue */
+    struct wait_queue *wq;          /**< Queue it is linked on (NULL once woken) */
+    struct wait_queue_entry *prev;  /**< Previous entry in the queue */
     struct wait_queue_entry *next;  /**< Next entry in the queue */
+    wait_func_t func;               /**< Callback instead of waking proc (NULL = sleeper) */
+    void *private;                  /**< Owner's data for func */
 } wait_queue_entry_t;
 
 /**
  * Wait queue structure
  *
- * A simple linked list of processes waiting for an event.
- * Processes are added when they sleep and removed when woken.
+ * An intrusive doubly linked list of processes waiting for an event.
+ * Processes are added when they sleep and removed in O(1) when woken.
  */
 typedef struct wait_queue {
     wait_queue_entry_t *head;  /**< First waiting process */
@@ -71,12 +94,48 @@ void wait_queue_init(wait_queue_t *wq);
  * or wait_queue_wake_one().
  *
  * IMPORTANT: Caller should check the condition again after this
- * function returns, as spurious wakeups can occur.
+ * function returns, as spurious wakeups can occur (process_wakeup(),
+ * e.g. for a signal, also ends the sleep).
  *
  * @param wq Pointer to wait queue
  */
 void wait_queue_sleep(wait_queue_t *wq);
 
+/**
+ * Sleep on a wait queue, returning with the caller's interrupt state
+ *
+ * wait_queue_sleep() returns with interrupts on. A caller that checks
+ * its condition with interrupts off, so a wakeup cannot slip in between
+ * the check and the sleep, uses this to have them off again for the
+ * next check.
+ *
+ * @param wq Pointer to wait queue
+ */
+void wait_queue_sleep_irqoff(wait_queue_t *wq);
+
+/**
+ * Link a callback entry onto a wait queue
+ *
+ * Every wakeup of the queue then calls func(entry), until the entry is
+ * removed with wait_queue_del(). Callback entries do not count as
+ * sleepers for wait_queue_wake_one() and wait_queue_peek().
+ *
+ * @param wq Pointer to wait queue
+ * @param entry Entry to link (owned by the caller)
+ * @param func Callback
+ * @param private Stored in entry->private
+ */
+void wait_queue_add(wait_queue_t *wq, wait_queue_entry_t *entry, wait_func_t func, void *private);
+
+/**
+ * Unlink a callback entry added with wait_queue_add()
+ *
+ * Does nothing if the entry is not linked.
+ *
+ * @param entry Entry to unlink
+ */
+void wait_queue_del(wait_queue_entry_t *entry);
+
 /**
  * Wake all processes sleeping on a wait queue
  *
@@ -92,13 +151,25 @@ int wait_queue_wake(wait_queue_t *wq);
  * Wake one process sleeping on a wait queue
  *
  * Wakes the first (oldest) waiting process. Useful when only
- * one process can proceed (e.g., single consumer).
+ * one process can proceed (e.g., single consumer). Callback entries are
+ * all notified as well.
  *
  * @param wq Pointer to wait queue
  * @return 1 if a process was woken, 0 if queue was empty
  */
 int wait_queue_wake_one(wait_queue_t *wq);
 
+/**
+ * Get the process that wait_queue_wake_one() would wake next
+ *
+ * Lets a caller hand something (e.g. a mutex) to that process before
+ * waking it. Call with interrupts disabled so the answer stays true.
+ *
+ * @param wq Pointer to wait queue
+ * @return Oldest waiting process, or NULL if queue is empty
+ */
+struct process *wait_queue_peek(wait_queue_t *wq);
+
 /**
  * Check if wait queue is empty
  *
@@ -0,0 +1,90 @@
+/**
+ * @file workqueue.h
+ * @brief Deferred work run by a kernel thread
+ *
+ * Interrupt handlers and syscalls queue work items here instead of doing
+ * slow, non-urgent work (screen redraws, flushes) inline; the "kworker"
+ * kernel thread runs them later, in order, in process context where it
+ * may sleep and is preempted like anything else.
+ *
+ * Usage:
+ *   static void redraw(work_t *work) { ... }
+ *   static work_t redraw_work = WORK_INIT(redraw);
+ *
+ *   // In an interrupt handler:
+ *   queue_work(&redraw_work);
+ *
+ * A work item is owned by its user (usually static, or embedded in the
+ * object it works on) and is on the queue at most once: queueing it
+ * again before it ran is a no-op, so bursts of events coalesce.
+ */
+
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <stdint.h>
+
+struct work;
+
+/**
+ * Work callback; the item may be queued again from inside it
+ */
+typedef void (*work_fn_t)(struct work *work);
+
+/**
+ * Work item
+ */
+typedef struct work {
+    work_fn_t fn;                   /**< Function to run */
+    struct work *next;              /**< Next item on the queue */
+    int pending;                    /**< Nonzero while queued */
+} work_t;
+
+/**
+ * Static initializer for a work item
+ */
+#define WORK_INIT(f) { .fn = (f), .next = NULL, .pending = 0 }
+
+/**
+ * Initialize a work item
+ *
+ * @param work Work item
+ * @param fn Function to run
+ */
+void work_init(work_t *work, work_fn_t fn);
+
+/**
+ * Start the worker thread
+ *
+ * Until this has run, queue_work() runs items immediately instead.
+ *
+ * @return 0 on success, -1 on error (errno set by kthread_create())
+ */
+int workqueue_init(void);
+
+/**
+ * Check whether work is deferred yet
+ *
+ * @return Nonzero once the worker thread runs queued items, 0 while
+ *         queue_work() still runs them inline
+ */
+int workqueue_running(void);
+
+/**
+ * Queue a work item to run on the worker thread
+ *
+ * Safe from interrupt handlers. Never sleeps.
+ *
+ * @param work Work item
+ * @return 1 if queued, 0 if it was already pending
+ */
+int queue_work(work_t *work);
+
+/**
+ * Wait until all work queued so far has run
+ *
+ * Sleeps, so not for interrupt handlers nor for work items themselves.
+ */
+void flush_workqueue(void);
+
+#endif // WORKQUEUE_H
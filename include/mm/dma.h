@@ -96,4 +96,62 @@ static inline size_t dma_size(dma_region_t *region) {
  */
 void dma_get_stats(size_t *allocated_regions, size_t *allocated_bytes);
 
+/**
+ * DMA pool
+ * 
+ * Hands out small fixed-size buffers (virtio request headers, status
+ * bytes, command structs) carved from whole DMA pages. Each free buffer
+ * records its own physical address, so allocation is a free-list pop
+ * with no page walk; pages are only allocated when the pool runs dry.
+ */
+typedef struct dma_pool dma_pool_t;
+
+/**
+ * Create a DMA pool
+ * 
+ * Preallocates one page of buffers. Buffers never cross a page boundary.
+ * 
+ * @param name Pool name (for debugging, must outlive the pool)
+ * @param size Buffer size in bytes (at most PAGE_SIZE)
+ * @param align Buffer alignment (power of two, 0 for default)
+ * @return New pool, or NULL on failure
+ */
+dma_pool_t *dma_pool_create(const char *name, size_t size, size_t align);
+
+/**
+ * Allocate a buffer from a DMA pool
+ * 
+ * @param pool Pool to allocate from
+ * @param flags DMA_ZERO to clear the buffer
+ * @param phys Output: physical address of the buffer for the device
+ * @return Virtual address of the buffer, or NULL on failure
+ */
+void *dma_pool_alloc(dma_pool_t *pool, uint32_t flags, uintptr_t *phys);
+
+/**
+ * Return a buffer to its DMA pool
+ * 
+ * @param pool Pool the buffer came from
+ * @param vaddr Virtual address returned by dma_pool_alloc()
+ * @param phys Physical address returned by dma_pool_alloc()
+ */
+void dma_pool_free(dma_pool_t *pool, void *vaddr, uintptr_t phys);
+
+/**
+ * Destroy a DMA pool and free its pages
+ * 
+ * @param pool Pool to destroy
+ * @return 0 on success, -1 if buffers are still allocated
+ */
+int dma_pool_destroy(dma_pool_t *pool);
+
+/**
+ * Get DMA pool statistics
+ * 
+ * @param pool Pool to query
+ * @param in_use Output: buffers currently allocated
+ * @param capacity Output: buffers the pool's pages can hold
+ */
+void dma_pool_get_stats(dma_pool_t *pool, size_t *in_use, size_t *capacity);
+
 #endif // DMA_H
@@ -2,13 +2,35 @@
  * Kernel Memory Allocator (kmalloc/kfree)
  * 
  * Provides dynamic memory allocation for the kernel.
- * Simple implementation using the PMM as a backend.
+ * Small requests are served from per-size-class slabs; larger ones
+ * take whole pages from the PMM.
  */
 
 #ifndef KMALLOC_H
 #define KMALLOC_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+// Number of slab size classes (16, 32, ... 1024, KMALLOC_MAX_SLAB_SIZE)
+#define KMALLOC_NUM_SIZE_CLASSES 8
+
+// Largest request served from a slab; two fit in a page after the header
+#define KMALLOC_MAX_SLAB_SIZE 2016
+
+// Minimum alignment of kmalloc() pointers up to KMALLOC_MAX_SLAB_SIZE
+// (larger ones follow a 24-byte page header: use kmalloc_aligned())
+#define KMALLOC_MIN_ALIGN 16
+
+/**
+ * Allocator statistics
+ */
+typedef struct {
+    size_t slab_pages;                              // Pages backing slabs
+    size_t slab_objects;                            // Live slab objects
+    size_t class_objects[KMALLOC_NUM_SIZE_CLASSES]; // Live objects per class
+    size_t large_pages;                             // Pages in large allocations
+} kmalloc_stats_t;
 
 /**
  * Allocate kernel memory
@@ -21,17 +43,29 @@ void *kmalloc(size_t size);
 /**
  * Free previously allocated kernel memory
  * 
- * @param ptr Pointer to memory to free (from kmalloc)
+ * @param ptr Pointer to memory to free (from kmalloc or kmem_cache_alloc)
  */
 void kfree(void *ptr);
 
 /**
  * Allocate aligned kernel memory
  * 
+ * Slab-sized requests up to KMALLOC_MIN_ALIGN are plain kmalloc();
+ * anything else takes whole pages, like large allocations. Free with
+ * kfree().
+ * 
  * @param size Number of bytes to allocate
- * @param align Alignment requirement (must be power of 2)
- * @return Pointer to aligned allocated memory, or NULL if out of memory
+ * @param align Alignment requirement (power of 2, at most PAGE_SIZE)
+ * @return Pointer to aligned allocated memory, or NULL with errno set
+ *         (EINVAL for a bad alignment, ENOSYS above PAGE_SIZE, ENOMEM)
  */
 void *kmalloc_aligned(size_t size, size_t align);
 
+/**
+ * Get allocator statistics
+ * 
+ * @param stats Output structure filled with current usage
+ */
+void kmalloc_get_stats(kmalloc_stats_t *stats);
+
 #endif // KMALLOC_H
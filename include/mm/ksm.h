@@ -0,0 +1,85 @@
+/*
+ * Same-page merging
+ *
+ * Processes started from one image, or forked and then left to fill
+ * their heaps the same way, hold many anonymous pages with the same
+ * contents. madvise(MADV_MERGEABLE) lets the "ksmd" kernel thread look
+ * for them and keep one copy, shared copy-on-write like a page fork()
+ * left behind:
+ *
+ *   Scan        ksmd wakes every KSM_SCAN_INTERVAL_US and walks
+ *               KSM_PAGES_PER_SCAN resident pages of VM_MERGEABLE
+ *               private mappings from a clock hand, like the swap sweep.
+ *               Pages a file, shm object or the swap cache owns are
+ *               skipped. Each page is hashed.
+ *   Stable      Pages already merged (PG_KSM), by hash. The table holds a
+ *               reference to each, and every mapping of one is read-only,
+ *               so their contents never change. A page hashing like one
+ *               is mapped to it instead, and its own copy is dropped.
+ *   Unstable    Pages seen once this pass and not merged, by hash. A page
+ *               matching one makes that one stable and is merged into it.
+ *               Hashes there may be stale, so the table is emptied after
+ *               every full pass; the contents are always compared before
+ *               merging.
+ *   Zero pages  A page of zeroes is mapped to the shared zero page and
+ *               freed, as if it had never been written.
+ *
+ * A page is write-protected before it is compared, and the TLBs of every
+ * CPU flushed once per batch of KSM_BATCH, so no store can slip in
+ * between the comparison and the merge. Writing a merged page afterwards
+ * is an ordinary copy-on-write fault. The table's reference is dropped at
+ * the end of each pass for pages nobody maps any more.
+ *
+ * The flag is kept per VMA: madvise() marks every mapping the range
+ * touches, as a whole. fork() copies it, exec() starts without.
+ * MADV_UNMERGEABLE only stops the scanning; pages merged already stay
+ * shared until written.
+ */
+
+#ifndef KSM_H
+#define KSM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Pages looked at per wakeup, and the time between wakeups
+#define KSM_PAGES_PER_SCAN      256
+#define KSM_SCAN_INTERVAL_US    100000
+
+// Pages write-protected before one TLB flush and their comparison
+#define KSM_BATCH               16
+
+// Hash buckets of each table (a power of two)
+#define KSM_BUCKETS             256
+
+// Pages the unstable table holds at most
+#define KSM_UNSTABLE_MAX        4096
+
+/**
+ * Same-page merging statistics
+ */
+typedef struct {
+    uint64_t pages_shared;          // Merged pages in the stable table
+    uint64_t pages_sharing;         // Mappings of them beyond the first
+    uint64_t pages_unshared;        // Pages in the unstable table
+    uint64_t pages_scanned;         // Resident pages hashed
+    uint64_t merged;                // Pages mapped to a merged page
+    uint64_t zero_merged;           // Pages of zeroes mapped to the zero page
+    uint64_t full_scans;            // Passes over every mergeable mapping
+} ksm_stats_t;
+
+/**
+ * Start ksmd if it is not running (first MADV_MERGEABLE)
+ *
+ * @return 0 on success, -1 on error (errno set by kthread_create())
+ */
+int ksm_start(void);
+
+/**
+ * Get same-page merging statistics
+ *
+ * @param stats Output structure
+ */
+void ksm_get_stats(ksm_stats_t *stats);
+
+#endif // KSM_H
@@ -0,0 +1,114 @@
+/*
+ * Kernel Stacks
+ *
+ * Every process's kernel stack lives in a virtual area of its own rather
+ * than in the kmalloc heap:
+ *
+ *   Area        Root page table entry KSTACK_AREA_VPN2 (upper half, which
+ *               the identity-mapped kernel leaves unused), cut into
+ *               KSTACK_SLOTS slots of twice KERNEL_STACK_SIZE. The upper
+ *               half of a slot holds the stack, the lower half is never
+ *               mapped: a stack that overflows faults on it instead of
+ *               writing over its neighbour. The area's page tables are
+ *               built at boot, before the first user page table copies
+ *               the kernel's root entries, so stacks mapped later are
+ *               visible in every address space.
+ *   Pages       A stack is KERNEL_STACK_SIZE / PAGE_SIZE single pages,
+ *               so creating a process needs no contiguous run.
+ *   Cache       Up to KSTACK_CACHE freed stacks stay mapped for the next
+ *               fork(); past that, and when reclaim asks (the "kstack"
+ *               shrinker), a stack is unmapped and its pages freed.
+ *
+ * Trap entry moves a trap whose frame would land on a guard (the stack
+ * is full) to the CPU's overflow stack, so the fault is reported rather
+ * than taken again. Stack memory is contiguous only virtually: buffers
+ * a device reads or writes must not live on the stack.
+ */
+
+#ifndef KSTACK_H
+#define KSTACK_H
+
+// Root page table entry of the area (KSTACK_AREA_BASE)
+#define KSTACK_AREA_VPN2        256
+
+// A slot is a guard and a stack of 1 << KSTACK_GUARD_SHIFT bytes each;
+// bit KSTACK_GUARD_SHIFT of an address in the area is clear on a guard
+#define KSTACK_GUARD_SHIFT      14
+#define KSTACK_SLOT_SHIFT       (KSTACK_GUARD_SHIFT + 1)
+
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define KSTACK_AREA_BASE        0xFFFFFFC000000000UL
+#define KSTACK_SLOT_SIZE        (1UL << KSTACK_SLOT_SHIFT)
+
+// Slots in the area (its page tables are built for all of them at boot)
+#define KSTACK_SLOTS            256
+#define KSTACK_AREA_END         (KSTACK_AREA_BASE + KSTACK_SLOTS * KSTACK_SLOT_SIZE)
+
+// Freed stacks kept mapped
+#define KSTACK_CACHE            16
+
+/**
+ * Kernel stack statistics
+ */
+typedef struct {
+    size_t in_use;                  // Stacks handed out
+    size_t cached;                  // Freed stacks still mapped
+    uint64_t allocs;                // kstack_alloc() calls that succeeded
+    uint64_t cache_hits;            // Of those, served from the cache
+    uint64_t unmapped;              // Stacks unmapped and their pages freed
+    uint64_t failures;              // kstack_alloc() calls that failed
+} kstack_stats_t;
+
+/**
+ * Build the area's page tables and register the shrinker
+ *
+ * Must run after paging_init() and before the first user page table.
+ *
+ * @return 0 on success, -1 on error (errno set)
+ */
+int kstack_init(void);
+
+/**
+ * Allocate a kernel stack
+ *
+ * @return Lowest address of a KERNEL_STACK_SIZE stack, or 0 on error
+ *         (errno set)
+ *
+ * @errno THUNDEROS_ENOMEM - No free slot, or no pages to map one
+ */
+uintptr_t kstack_alloc(void);
+
+/**
+ * Free a kernel stack (nobody may be running on it)
+ *
+ * @param stack Address kstack_alloc() returned (0 is ignored)
+ */
+void kstack_free(uintptr_t stack);
+
+/**
+ * Get the top of the kernel stack holding an address
+ *
+ * @return One past the stack's highest byte, or 0 if addr is not in a
+ *         stack of the area
+ */
+uintptr_t kstack_top(uintptr_t addr);
+
+/**
+ * Check whether an address lies on a guard of the area
+ */
+int kstack_is_guard(uintptr_t addr);
+
+/**
+ * Get kernel stack statistics
+ *
+ * @param stats Output structure
+ */
+void kstack_get_stats(kstack_stats_t *stats);
+
+#endif // __ASSEMBLER__
+
+#endif // KSTACK_H
@@ -0,0 +1,85 @@
+/*
+ * Per-Page Metadata (struct page)
+ * 
+ * Every page managed by the PMM has a struct page, indexed by page frame
+ * number. The reference count lets several owners (page tables, caches,
+ * pipes) share one physical page; the page goes back to the PMM when the
+ * last reference is dropped with put_page().
+ * 
+ * Pages start with a reference count of 1 when allocated by the PMM.
+ * Addresses outside the PMM-managed region (kernel image, MMIO) have no
+ * struct page; get_page()/put_page() ignore them.
+ * 
+ * Pages a cache can give back under memory pressure sit on the LRU
+ * lists of mm/reclaim.h, linked through lru_prev/lru_next.
+ */
+
+#ifndef PAGE_H
+#define PAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Page flags
+ */
+#define PG_SLAB       (1 << 0)  // Page backs a slab (mm/slab.c)
+#define PG_DIRTY      (1 << 1)  // Page cache page newer than the file (fs/page_cache.c)
+#define PG_LRU        (1 << 2)  // On an LRU list (mm/reclaim.h)
+#define PG_ACTIVE     (1 << 3)  // On the active list, not the inactive one
+#define PG_REFERENCED (1 << 4)  // Used since the LRU last looked at it
+#define PG_SWAPCACHE  (1 << 5)  // In the swap cache, mapping = its entry (mm/swap.h)
+#define PG_KSM        (1 << 6)  // Merged page shared read-only (mm/ksm.h)
+
+/**
+ * Physical page descriptor
+ */
+struct page {
+    uint32_t refcount;   // Number of owners (0 = free)
+    uint32_t flags;      // PG_* flags
+    void *mapping;       // Owner-defined back pointer (cache, file, ...)
+    struct page *lru_prev;  // Toward more recently used (PG_LRU)
+    struct page *lru_next;  // Toward less recently used
+};
+
+/**
+ * Look up the struct page for a physical address
+ * 
+ * @param paddr Physical address (any offset within the page)
+ * @return Page descriptor, or NULL if paddr is not PMM-managed
+ */
+struct page *phys_to_page(uintptr_t paddr);
+
+/**
+ * Get the physical address described by a struct page
+ * 
+ * @param page Page descriptor from phys_to_page()
+ * @return Physical address of the start of the page
+ */
+uintptr_t page_to_phys(struct page *page);
+
+/**
+ * Take an extra reference to a page
+ * 
+ * @param paddr Physical address of the page
+ */
+void get_page(uintptr_t paddr);
+
+/**
+ * Drop a reference to a page
+ * 
+ * Frees the page back to the PMM when the count reaches zero.
+ * 
+ * @param paddr Physical address of the page
+ */
+void put_page(uintptr_t paddr);
+
+/**
+ * Get the reference count of a page
+ * 
+ * @param paddr Physical address of the page
+ * @return Reference count, or 0 if free or not PMM-managed
+ */
+uint32_t page_refcount(uintptr_t paddr);
+
+#endif // PAGE_H
@@ -28,6 +28,14 @@
 #define VPN_1(va) (((va) >> 21) & VPN_MASK)  // Level 1
 #define VPN_2(va) (((va) >> 30) & VPN_MASK)  // Level 2
 
+// Index into the page table at a given level (0-2)
+#define PTE_INDEX(va, level) (((va) >> (PAGE_SHIFT + 9 * (level))) & VPN_MASK)
+
+// Superpage sizes: a leaf at level 1 maps 2MB, at level 2 1GB
+#define MEGAPAGE_SIZE (1UL << 21)
+#define GIGAPAGE_SIZE (1UL << 30)
+#define PTE_LEVEL_SIZE(level) (1UL << (PAGE_SHIFT + 9 * (level)))
+
 // Page table entry flags (bits 0-7)
 #define PTE_V    (1 << 0)  // Valid
 #define PTE_R    (1 << 1)  // Readable
@@ -38,6 +46,10 @@
 #define PTE_A    (1 << 6)  // Accessed
 #define PTE_D    (1 << 7)  // Dirty
 
+// Software-defined PTE bits (RSW, bits 8-9, ignored by hardware)
+#define PTE_COW  (1 << 8)  // Copy-on-write: read-only share of a writable page
+#define PTE_SWAP (1 << 9)  // Not valid: the PPN field holds a swap slot (mm/swap.h)
+
 // Common permission combinations
 #define PTE_KERNEL_TEXT  (PTE_V | PTE_R | PTE_X)           // Kernel code
 #define PTE_KERNEL_DATA  (PTE_V | PTE_R | PTE_W)           // Kernel data
@@ -49,6 +61,10 @@
 // SATP register mode (bits 60-63)
 #define SATP_MODE_SV39  (8UL << 60)
 
+// SATP ASID field (bits 44-59); ASID 0 is reserved for the kernel page table
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK  (0xFFFFUL << SATP_ASID_SHIFT)
+
 // Page table entry structure
 typedef uint64_t pte_t;
 
@@ -68,6 +84,12 @@ typedef struct {
 // Check if PTE is a leaf (points to physical page)
 #define PTE_IS_LEAF(pte) ((pte) & (PTE_R | PTE_W | PTE_X))
 
+// Swap entries: a page written out to swap slot n leaves the PTE not
+// valid, with n where the PPN would be
+#define SWAP_TO_PTE(slot)   (((uint64_t)(slot) << 10) | PTE_SWAP)
+#define PTE_IS_SWAP(pte)    (((pte) & (PTE_V | PTE_SWAP)) == PTE_SWAP)
+#define PTE_TO_SWAP(pte)    PTE_TO_PPN(pte)
+
 // Virtual memory layout
 #define KERNEL_VIRT_BASE  0xFFFFFFFF80000000UL  // -2GB (higher half)
 #define USER_VIRT_BASE    0x0000000000000000UL  // 0GB (lower half)
@@ -80,8 +102,9 @@ typedef struct {
  * 
  * @param kernel_start Physical address of kernel start
  * @param kernel_end Physical address of kernel end
+ * @param ram_end Physical address one past the end of RAM
  */
-void paging_init(uintptr_t kernel_start, uintptr_t kernel_end);
+void paging_init(uintptr_t kernel_start, uintptr_t kernel_end, uintptr_t ram_end);
 
 /**
  * Map a virtual address to a physical address
@@ -103,6 +126,152 @@ int map_page(page_table_t *page_table, uintptr_t vaddr, uintptr_t paddr, uint64_
  */
 int unmap_page(page_table_t *page_table, uintptr_t vaddr);
 
+/**
+ * Build the kernel page tables covering a virtual range, mapping nothing
+ * 
+ * User page tables share the kernel's tables below root entries 2-511
+ * from the moment they are created, so a kernel area whose tables exist
+ * before the first one is visible in all of them, whatever is mapped
+ * there later.
+ * 
+ * @param start First address (2MB-aligned)
+ * @param end One past the last address (2MB-aligned)
+ * @return 0 on success, -1 on failure (errno set)
+ */
+int paging_prepare_kernel_range(uintptr_t start, uintptr_t end);
+
+/**
+ * Unmap a user page and drop the mapping's page reference
+ * 
+ * Unlike unmap_page(), an address that is not mapped is not an error.
+ * 
+ * @param page_table Root page table (level 2)
+ * @param vaddr Virtual address (must be page-aligned)
+ * @return 0 on success
+ */
+int unmap_user_page(page_table_t *page_table, uintptr_t vaddr);
+
+// Pages an mmu_gather holds before it flushes the TLB and frees them
+#define MMU_GATHER_BATCH 64
+
+// Ranges longer than this (in pages) are flushed with one global sfence.vma
+#define TLB_FLUSH_RANGE_MAX 32
+
+/**
+ * Batched unmap state ("mmu_gather")
+ * 
+ * Collects the range of unmapped user pages and the physical pages whose
+ * references they held. The TLB is flushed once per batch, and only then
+ * are the pages released, so no stale translation can reach a reused page.
+ */
+typedef struct {
+    page_table_t *page_table;
+    uintptr_t start;                   // Lowest unmapped address
+    uintptr_t end;                     // One past the highest unmapped address
+    size_t nr_pages;                   // Entries used in pages[]
+    size_t unmapped;                   // Resident pages unmapped (zero page excluded)
+    uintptr_t pages[MMU_GATHER_BATCH]; // Pages to release after the flush
+} mmu_gather_t;
+
+/**
+ * Start a batched unmap
+ * 
+ * @param tlb Gather state (usually on the stack)
+ * @param page_table Page table to unmap from
+ */
+void tlb_gather_init(mmu_gather_t *tlb, page_table_t *page_table);
+
+/**
+ * Unmap user pages in [start, end) as part of a batch
+ * 
+ * Unmapped holes are skipped a whole page table at a time.
+ * 
+ * @param tlb Gather state
+ * @param start Start address (page-aligned)
+ * @param end End address (exclusive, page-aligned)
+ */
+void tlb_gather_unmap_range(mmu_gather_t *tlb, uintptr_t start, uintptr_t end);
+
+/**
+ * Finish a batched unmap: flush the TLB once and release the pages
+ * 
+ * @param tlb Gather state
+ */
+void tlb_gather_finish(mmu_gather_t *tlb);
+
+/**
+ * Flush TLB entries for a range of virtual addresses
+ * 
+ * Falls back to a global flush for ranges above TLB_FLUSH_RANGE_MAX pages.
+ * 
+ * @param start Start address
+ * @param end End address (exclusive)
+ */
+void tlb_flush_range(uintptr_t start, uintptr_t end);
+
+/**
+ * Share a user page copy-on-write with another page table
+ * 
+ * Maps the page at vaddr in src into dst at the same address and takes a
+ * reference for the new mapping. Writable pages lose PTE_W and gain
+ * PTE_COW in both tables, so the first write to either copy faults into
+ * handle_cow_fault(). A swap entry is copied, taking a reference to its
+ * slot. The caller must flush src's TLB entries afterwards.
+ * 
+ * @param src Page table that owns the mapping
+ * @param dst Page table to share it with
+ * @param vaddr Virtual address (must be page-aligned)
+ * @return 0 on success (including when nothing is mapped), -1 on failure
+ */
+int share_user_page_cow(page_table_t *src, page_table_t *dst, uintptr_t vaddr);
+
+/**
+ * Resolve a write fault on a copy-on-write page
+ * 
+ * The last owner of a page simply gets write access back; otherwise the
+ * page is copied and the faulting mapping switched to the private copy.
+ * 
+ * @param page_table Page table of the faulting process
+ * @param vaddr Faulting virtual address (any offset within the page)
+ * @return 0 if the fault was handled, -1 if vaddr is not a COW mapping
+ *         or no memory was available (errno set)
+ */
+int handle_cow_fault(page_table_t *page_table, uintptr_t vaddr);
+
+/**
+ * Give a present user page write access
+ * 
+ * Used for writes to shared file mappings, which are mapped read-only
+ * until first written so the page cache can track dirty pages.
+ * 
+ * @param page_table Page table of the faulting process
+ * @param vaddr Virtual address (any offset within the page)
+ * @return 0 on success, -1 if no user page is mapped at vaddr (errno set)
+ */
+int make_user_page_writable(page_table_t *page_table, uintptr_t vaddr);
+
+/**
+ * Check whether a present user page allows an access
+ * 
+ * @param page_table Page table
+ * @param vaddr Virtual address
+ * @param perm PTE permission bits needed (PTE_R, PTE_W, PTE_X)
+ * @return 1 if the page is mapped for user mode with all of them, 0 if not
+ */
+int user_page_permits(page_table_t *page_table, uintptr_t vaddr, uint64_t perm);
+
+/**
+ * Find the 4KB leaf entry for a user address
+ * 
+ * Creates no tables. For code that inspects or rewrites entries itself
+ * (swap); everything else should use the functions above.
+ * 
+ * @param page_table Root page table (level 2)
+ * @param vaddr Virtual address
+ * @return The PTE, or NULL if no level-0 table covers vaddr
+ */
+pte_t *get_user_pte(page_table_t *page_table, uintptr_t vaddr);
+
 /**
  * Translate virtual address to physical address
  * 
@@ -120,6 +289,15 @@ int virt_to_phys(page_table_t *page_table, uintptr_t vaddr, uintptr_t *paddr);
  */
 void tlb_flush(uintptr_t vaddr);
 
+/**
+ * Flush this CPU's TLB entries for one address space
+ * 
+ * Does nothing without hardware ASIDs (switches flush everything).
+ * 
+ * @param asid ASID context as kept by switch_page_table_asid()
+ */
+void tlb_flush_asid(uint64_t asid);
+
 /**
  * Get the kernel's root page table
  * 
@@ -139,7 +317,10 @@ void switch_to_kernel_page_table(void);
  * Create a new page table for a user process
  * 
  * Creates a new page table with kernel mappings but no user mappings.
- * The user space (low memory) is left empty for user code/data.
+ * The kernel half and the UART/VirtIO/CLINT MMIO tables are shared with
+ * the kernel page table by reference; only the root and one level-1
+ * table are allocated. The 2MB windows holding that MMIO cannot be
+ * used for user mappings.
  * 
  * @return Pointer to new page table, or NULL on failure
  */
@@ -173,6 +354,20 @@ int map_user_code(page_table_t *page_table, uintptr_t user_vaddr,
 int map_user_memory(page_table_t *page_table, uintptr_t user_vaddr, 
                     uintptr_t phys_addr, size_t size, int writable);
 
+/**
+ * Switch to a process page table, tagged with its ASID
+ * 
+ * Allocates an ASID on first use, or when *asid is from an older
+ * generation. ASIDs are never reused within a generation, so the switch
+ * needs no TLB flush; running out starts a new generation with one
+ * global flush. Without hardware ASIDs this flushes like
+ * switch_page_table().
+ * 
+ * @param page_table New page table to switch to
+ * @param asid Per-address-space ASID context (0 = not yet allocated)
+ */
+void switch_page_table_asid(page_table_t *page_table, uint64_t *asid);
+
 /**
  * Switch to a different page table
  * 
@@ -186,8 +381,8 @@ void switch_page_table(page_table_t *page_table);
  * Free a page table and all its child page tables
  * 
  * This function walks the entire page table hierarchy and frees all
- * allocated page table pages. It does NOT free the actual data pages
- * mapped by the page table - those should be freed separately.
+ * allocated page table pages. User data pages (PTE_U leaves) have their
+ * reference dropped, so they are freed once no other table maps them.
  * 
  * WARNING: Do not call this on the kernel page table!
  * 
@@ -195,6 +390,32 @@ void switch_page_table(page_table_t *page_table);
  */
 void free_page_table(page_table_t *page_table);
 
+/**
+ * Free part of a page table nobody runs on any more
+ * 
+ * Frees up to nr level-0 tables with the user mappings below them, as
+ * free_page_table() does, so a large address space can be torn down a
+ * piece at a time. Once none is left, frees the rest of the table.
+ * 
+ * @param page_table Root page table (not the kernel's)
+ * @param nr Level-0 tables to free in this call
+ * @return 1 if the whole table is freed, 0 if some remains
+ */
+int free_page_table_partial(page_table_t *page_table, size_t nr);
+
+/**
+ * Count the memory a user page table maps and occupies
+ * 
+ * The shared zero page is not counted as resident, and neither are the
+ * kernel's shared tables. Pass NULL for user_pages to only count tables,
+ * which skips the leaf tables' entries.
+ * 
+ * @param page_table Root page table
+ * @param user_pages Output: mapped PTE_U leaves (may be NULL)
+ * @param table_pages Output: page-table pages including the root (may be NULL)
+ */
+void page_table_usage(page_table_t *page_table, size_t *user_pages, size_t *table_pages);
+
 /**
  * Convert kernel virtual address to physical address
  * (Assumes higher-half kernel mapping)
@@ -2,7 +2,9 @@
  * Physical Memory Manager (PMM)
  * 
  * Manages physical memory allocation at page granularity.
- * Uses a bitmap to track which 4KB pages are free or allocated.
+ * Uses a binary buddy allocator with per-order free lists; a bitmap
+ * tracks which 4KB pages are allocated. Single pages go through a small
+ * per-CPU cache in front of it.
  */
 
 #ifndef PMM_H
@@ -21,6 +23,23 @@
 // Align address up to page boundary
 #define PAGE_ALIGN_UP(addr) (((addr) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
 
+// Largest buddy block is 2^PMM_MAX_ORDER pages (4MB)
+#define PMM_MAX_ORDER 10
+
+// Pre-zeroed pages kept for pmm_alloc_zeroed_page()
+#define PMM_ZERO_POOL_SIZE 64
+
+// Pool refills stop once free memory drops to this many pages
+#define PMM_ZERO_POOL_RESERVE 256
+
+// Pages zeroed per idle pass of the scheduler
+#define PMM_ZERO_POOL_IDLE_BATCH 4
+
+// Per-CPU page caches: pages a CPU keeps at most, and moved to or from
+// the buddy allocator at once
+#define PMM_PCP_HIGH 96
+#define PMM_PCP_BATCH 32
+
 // Convert between physical addresses and page numbers
 #define ADDR_TO_PAGE(addr) ((addr) >> PAGE_SHIFT)
 #define PAGE_TO_ADDR(page) ((page) << PAGE_SHIFT)
@@ -36,13 +55,89 @@ void pmm_init(uintptr_t mem_start, size_t mem_size);
 /**
  * Allocate a single physical page
  * 
+ * Comes from this CPU's page cache, most recently freed first, which
+ * refills from the buddy allocator PMM_PCP_BATCH pages at a time.
+ * 
  * @return Physical address of allocated page, or 0 if out of memory
  */
 uintptr_t pmm_alloc_page(void);
 
+/**
+ * Allocate a single zero-filled physical page
+ * 
+ * Takes a page from the pre-zeroed pool when one is available, so the
+ * caller does not pay for clearing it; otherwise zeroes a fresh page.
+ * 
+ * @return Physical address of allocated page, or 0 if out of memory
+ */
+uintptr_t pmm_alloc_zeroed_page(void);
+
+/**
+ * Zero free pages into the pre-zeroed pool
+ * 
+ * Called when the CPU is idle. Stops when the pool is full or free
+ * memory falls to PMM_ZERO_POOL_RESERVE pages.
+ * 
+ * @param max_pages Maximum number of pages to zero in this call
+ * @return Number of pages added to the pool
+ */
+size_t pmm_zero_pool_refill(size_t max_pages);
+
+/**
+ * Get the number of pages in the pre-zeroed pool
+ * 
+ * Pool pages are allocated from the buddy allocator's point of view, but
+ * pmm_get_stats() counts them as free since pmm_alloc_page() falls back
+ * to them when the buddy allocator runs dry.
+ * 
+ * @return Pages currently pooled
+ */
+size_t pmm_zero_pool_count(void);
+
+/**
+ * Per-CPU page cache statistics (all CPUs together)
+ */
+typedef struct {
+    size_t pages;                   // Pages on the lists (counted as free)
+    uint64_t hits;                  // Single-page allocations served from a list
+    uint64_t refills;               // Batches taken from the buddy allocator
+    uint64_t drains;                // Batches given back to it
+} pmm_pcp_stats_t;
+
+/**
+ * Return every CPU's cached pages to the buddy allocator
+ * 
+ * Lets them merge into larger blocks, for a contiguous allocation that
+ * failed or to look at fragmentation. Done by pmm_alloc_pages() itself
+ * before it gives up.
+ */
+void pmm_drain_pcp(void);
+
+/**
+ * Get per-CPU page cache statistics
+ * 
+ * @param stats Output structure
+ */
+void pmm_get_pcp_stats(pmm_pcp_stats_t *stats);
+
+/**
+ * Get the shared zero page
+ * 
+ * A single page of zeros, allocated at boot and never freed. Untouched
+ * anonymous memory is mapped to it read-only until first written.
+ * Mappings take and drop references with get_page()/put_page() like
+ * any other page.
+ * 
+ * @return Physical address of the zero page
+ */
+uintptr_t pmm_zero_page(void);
+
 /**
  * Allocate multiple contiguous physical pages
  * 
+ * The run starts on a boundary of the next power of two at or above
+ * num_pages (in physical address terms). At most 2^PMM_MAX_ORDER pages.
+ * 
  * @param num_pages Number of contiguous pages to allocate
  * @return Physical address of first allocated page, or 0 if unable to allocate
  */
@@ -51,6 +146,9 @@ uintptr_t pmm_alloc_pages(size_t num_pages);
 /**
  * Free a previously allocated physical page
  * 
+ * The page goes to this CPU's page cache; past PMM_PCP_HIGH pages the
+ * oldest PMM_PCP_BATCH go back to the buddy allocator.
+ * 
  * @param page_addr Physical address of page to free (must be page-aligned)
  */
 void pmm_free_page(uintptr_t page_addr);
@@ -71,4 +169,11 @@ void pmm_free_pages(uintptr_t page_addr, size_t num_pages);
  */
 void pmm_get_stats(size_t *total_pages, size_t *free_pages);
 
+/**
+ * Get buddy allocator free-list statistics
+ * 
+ * @param counts Output: number of free blocks of each order 0..PMM_MAX_ORDER
+ */
+void pmm_get_order_stats(size_t counts[PMM_MAX_ORDER + 1]);
+
 #endif // PMM_H
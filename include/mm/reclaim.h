@@ -0,0 +1,211 @@
+/*
+ * Memory Reclaim
+ *
+ * Caches may use every free page; this gives their memory back when the
+ * free page count runs low:
+ *
+ *   LRU lists   Pages a cache can drop (clean page cache pages) sit on an
+ *               inactive and an active list. They start inactive; a page
+ *               used again while inactive is promoted. Reclaim takes
+ *               from the tail of the inactive list, giving a page used
+ *               since it last looked one more pass on the active list,
+ *               and deactivates active pages to keep the two lists of
+ *               one size.
+ *   Shrinkers   Each cache registers one: count() reports how much it
+ *               could free, scan() frees up to that many objects, least
+ *               recently used first. Reclaim asks each in turn for a
+ *               share of its count that grows with every pass that does
+ *               not free enough.
+ *   Watermarks  pmm.c wakes the kswapd thread when an allocation leaves
+ *               fewer free pages than the low watermark, and kswapd
+ *               reclaims until the high one is reached. An allocation
+ *               that finds no free page at all reclaims directly and
+ *               tries again. A page fault that still gets none waits for
+ *               a kswapd pass with reclaim_wait(), which may swap
+ *               (mm/swap.h), and tries again.
+ *
+ * Direct reclaim runs in whatever context the allocation came from, so
+ * it runs only when the caller had interrupts enabled, with them
+ * disabled for its duration, and shrinkers are told they must not sleep.
+ * kswapd may sleep, which lets shrinkers write back or release nodes; a
+ * shrinker sleeps only with its cache consistent, as direct reclaim may
+ * run meanwhile.
+ */
+
+#ifndef RECLAIM_H
+#define RECLAIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct page;
+
+// Low watermark: 1/N of total pages, at least the floor; high is twice it
+#define RECLAIM_WMARK_LOW_DIV   128
+#define RECLAIM_WMARK_LOW_FLOOR 64
+
+// Pages a direct reclaim tries to free for a failed allocation
+#define RECLAIM_DIRECT_BATCH    32
+
+// Passes over the shrinkers, scanning count >> priority objects each,
+// from RECLAIM_PRIORITY_MAX down to 0 (everything)
+#define RECLAIM_PRIORITY_MAX    6
+
+// kswapd checks the watermarks this often even when nobody woke it
+#define RECLAIM_KSWAPD_INTERVAL_US 1000000
+
+// Shrinker scan() flags
+#define SHRINK_MAY_SLEEP        (1 << 0)  // Writing back or releasing nodes is allowed
+
+/**
+ * Cache callbacks for reclaim
+ */
+typedef struct shrinker {
+    const char *name;
+
+    /**
+     * Objects the cache could free (a cheap estimate)
+     */
+    size_t (*count)(struct shrinker *shrinker);
+
+    /**
+     * Free up to nr objects, least recently used first
+     *
+     * @param flags SHRINK_* flags
+     * @return Objects freed
+     */
+    size_t (*scan)(struct shrinker *shrinker, size_t nr, uint32_t flags);
+
+    // Filled in by reclaim
+    uint64_t scanned;               // Objects asked for
+    uint64_t freed;                 // Objects scan() reported freed
+    struct shrinker *next;
+} shrinker_t;
+
+/**
+ * Reclaim statistics
+ */
+typedef struct {
+    size_t lru_active;              // Pages on the active list
+    size_t lru_inactive;            // Pages on the inactive list
+    size_t wmark_low;               // Watermarks, in pages
+    size_t wmark_high;
+    uint64_t kswapd_wakeups;        // Times kswapd ran below the low watermark
+    uint64_t kswapd_reclaimed;      // Pages kswapd freed
+    uint64_t direct_reclaims;       // Direct reclaims run by allocations
+    uint64_t direct_reclaimed;      // Pages they freed
+    uint64_t kswapd_waits;          // reclaim_wait() calls answered by kswapd
+    uint64_t lru_scanned;           // Inactive pages looked at
+    uint64_t lru_activated;         // Promoted to the active list
+    uint64_t lru_deactivated;       // Demoted to the inactive list
+} reclaim_stats_t;
+
+/**
+ * Compute the watermarks (pmm_init(), once the page count is known)
+ *
+ * @param total_pages Pages the PMM manages
+ */
+void reclaim_init(size_t total_pages);
+
+/**
+ * Register a cache's shrinker
+ *
+ * Reclaim asks the most recently registered shrinkers first.
+ *
+ * @param shrinker Callbacks (must stay valid until unregistered)
+ */
+void register_shrinker(shrinker_t *shrinker);
+
+/**
+ * Unregister a shrinker
+ */
+void unregister_shrinker(shrinker_t *shrinker);
+
+/**
+ * Put a page at the head of the inactive list
+ */
+void lru_add(struct page *page);
+
+/**
+ * Take a page off its LRU list (before its owner drops it)
+ */
+void lru_del(struct page *page);
+
+/**
+ * Note a use of a page on an LRU list
+ *
+ * A second use while it is inactive moves it to the active list.
+ */
+void lru_mark_accessed(struct page *page);
+
+/**
+ * Reclaim from the inactive list
+ *
+ * Looks at up to nr pages from the tail. evict() drops a page if it can
+ * (calling lru_del() and releasing it) and returns nonzero; a page it
+ * keeps moves to the head of the inactive list.
+ *
+ * @param nr    Pages to look at
+ * @param evict Owner callback, run with interrupts disabled
+ * @return Pages evicted
+ */
+size_t lru_shrink(size_t nr, int (*evict)(struct page *page));
+
+/**
+ * Free memory through the shrinkers
+ *
+ * @param nr_pages Pages wanted
+ * @param flags    SHRINK_* flags for the shrinkers
+ * @return Pages freed, as seen by the PMM
+ */
+size_t reclaim_pages(size_t nr_pages, uint32_t flags);
+
+/**
+ * Reclaim on behalf of an allocation (pmm.c)
+ *
+ * Does nothing when called with interrupts disabled or from inside
+ * reclaim.
+ *
+ * @param nr_pages Pages wanted
+ * @return Pages freed
+ */
+size_t reclaim_direct(size_t nr_pages);
+
+/**
+ * Wait for kswapd to free memory (process context, when an allocation
+ * failed even after direct reclaim)
+ *
+ * Wakes kswapd, past any backoff, and sleeps until it finishes a pass.
+ *
+ * @return 0 if the pass freed pages, -1 if not (errno set)
+ *
+ * @errno THUNDEROS_ENOMEM - Nothing was freed, or kswapd is not running
+ *                           (or is the caller)
+ */
+int reclaim_wait(void);
+
+/**
+ * Wake kswapd (free pages fell below the low watermark)
+ */
+void reclaim_wake_kswapd(void);
+
+/**
+ * Start the kswapd thread
+ *
+ * @return 0 on success, -1 on error (errno set)
+ */
+int reclaim_start_kswapd(void);
+
+/**
+ * Get the low watermark (kswapd is woken below it)
+ */
+size_t reclaim_wmark_low(void);
+
+/**
+ * Get reclaim statistics
+ *
+ * @param stats Output structure
+ */
+void reclaim_get_stats(reclaim_stats_t *stats);
+
+#endif // RECLAIM_H
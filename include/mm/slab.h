@@ -0,0 +1,120 @@
+/*
+ * Slab Allocator (kmem_cache)
+ *
+ * Named caches of fixed-size objects carved out of PMM pages. Each
+ * cache keeps a list of partially used slabs so alloc/free are O(1),
+ * and an optional constructor runs once per object when its slab is
+ * created, so freed objects come back already initialized.
+ *
+ * kmalloc() is built on a set of generic caches (kmalloc-16 ...).
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Maximum number of caches (kmalloc size classes plus named caches)
+#define KMEM_MAX_CACHES 32
+
+// Bytes reserved at the start of each slab for its header
+#define SLAB_HEADER_SIZE 48
+
+// Default (and minimum) object alignment
+#define SLAB_MIN_ALIGN 16
+
+typedef struct kmem_cache kmem_cache_t;
+
+/**
+ * Object constructor
+ *
+ * Called once for each object when its slab is created. Objects must be
+ * back in their constructed state when handed to kmem_cache_free().
+ */
+typedef void (*kmem_ctor_t)(void *obj);
+
+/**
+ * Cache statistics
+ */
+typedef struct {
+    size_t object_size;      // Requested object size
+    size_t objects_in_use;   // Live objects
+    size_t objects_per_slab; // Objects per slab
+    size_t slabs;            // Slabs owned by the cache
+    size_t slab_pages;       // Pages per slab
+} kmem_cache_stats_t;
+
+/**
+ * Create an object cache
+ *
+ * @param name Cache name (must stay valid for the cache's lifetime)
+ * @param size Object size in bytes
+ * @param align Object alignment (power of 2, 0 for SLAB_MIN_ALIGN)
+ * @param ctor Optional constructor, or NULL
+ * @return New cache, or NULL on failure (errno set)
+ */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                kmem_ctor_t ctor);
+
+/**
+ * Destroy an object cache
+ *
+ * @param cache Cache to destroy (must have no live objects)
+ * @return 0 on success, -1 on error (errno set)
+ */
+int kmem_cache_destroy(kmem_cache_t *cache);
+
+/**
+ * Allocate an object from a cache
+ *
+ * @param cache Cache to allocate from
+ * @return Pointer to object, or NULL if out of memory (errno set)
+ */
+void *kmem_cache_alloc(kmem_cache_t *cache);
+
+/**
+ * Return an object to its cache
+ *
+ * @param cache Cache the object was allocated from
+ * @param obj Object to free
+ */
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+/**
+ * Return a cache's empty slabs to the PMM
+ *
+ * A cache keeps its last empty slab so one that bounces between zero
+ * and one object does not thrash the PMM; reclaim calls this for every
+ * cache.
+ *
+ * @param cache Cache to shrink
+ * @return Slabs released
+ */
+size_t kmem_cache_shrink(kmem_cache_t *cache);
+
+/**
+ * Find the cache that owns a pointer
+ *
+ * @param ptr Pointer returned by kmem_cache_alloc() or kmalloc()
+ * @return Owning cache, or NULL if ptr does not point into a slab
+ */
+kmem_cache_t *kmem_cache_of(const void *ptr);
+
+/**
+ * Get cache statistics
+ *
+ * @param cache Cache to query
+ * @param stats Output structure
+ */
+void kmem_cache_get_stats(kmem_cache_t *cache, kmem_cache_stats_t *stats);
+
+/**
+ * Get cache name
+ *
+ * @param cache Cache to query
+ * @return Name passed to kmem_cache_create()
+ */
+const char *kmem_cache_name(kmem_cache_t *cache);
+
+#endif // SLAB_H
@@ -0,0 +1,139 @@
+/*
+ * Swap
+ *
+ * Anonymous memory (pages no file or shared object backs) can be written
+ * to a swap area on the block device and read back when touched, so
+ * processes together may use more memory than the machine has:
+ *
+ *   Area        A region of the disk starting with a header page in the
+ *               Linux (mkswap) layout: "SWAPSPACE2" in the page's last
+ *               bytes, the index of the last page, and bad pages to skip.
+ *               The rest is cut into page-sized slots. main.c looks for
+ *               one at the first 1MB boundary past the root filesystem;
+ *               `make fs` appends it (SWAP_SIZE, tools/mkswap.py).
+ *   Entries     A swapped-out page leaves a PTE that is not valid but has
+ *               PTE_SWAP set and its slot in the PPN field (mm/paging.h).
+ *               fork() copies such an entry, unmapping drops it; each
+ *               slot counts the entries naming it.
+ *   Swap cache  Pages on their way to or from a slot stay findable by
+ *               slot until reclaim frees them. A fault on an entry maps the
+ *               cached page if there is one, so processes that shared a
+ *               page before it was swapped out share it again. Cached
+ *               pages sit on the reclaim LRU with PG_SWAPCACHE set.
+ *   Swap-out    The "swap" shrinker, when allowed to sleep (kswapd),
+ *               sweeps process page tables like a clock: a page accessed
+ *               since the last sweep loses PTE_A and stays, any other is
+ *               unmapped into the swap cache. The batch is then written,
+ *               and pages nobody else maps are freed.
+ *   Swap-in     The page fault handler reads the faulting slot together
+ *               with the other used slots of its aligned cluster of
+ *               SWAP_CLUSTER, which are likely neighbours in the address
+ *               space as they were written out together.
+ *
+ * A cached page whose slot is still named by an entry is mapped read-only
+ * (copy-on-write if the VMA is writable), so it always matches the slot.
+ * The last entry for a slot hands the page over to its process and frees
+ * the slot.
+ */
+
+#ifndef SWAP_H
+#define SWAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Header page (Linux layout)
+#define SWAP_MAGIC              "SWAPSPACE2"   // Last 10 bytes of the page
+#define SWAP_MAGIC_LEN          10
+#define SWAP_VERSION            1
+#define SWAP_HDR_VERSION        1024           // Offsets of the header fields
+#define SWAP_HDR_LAST_PAGE      1028
+#define SWAP_HDR_NR_BADPAGES    1032
+#define SWAP_HDR_BADPAGES       1536
+
+// Areas start on a 1MB boundary (in 512-byte sectors)
+#define SWAP_ALIGN_SECTORS      2048
+
+// Slots read in together around a faulting one (a power of two)
+#define SWAP_CLUSTER            8
+
+// Pages unmapped by one sweep before they are written
+#define SWAP_WRITE_BATCH        32
+
+// Entries one slot may be named by
+#define SWAP_MAP_MAX            0x7FFF
+
+/**
+ * Swap statistics
+ */
+typedef struct {
+    uint64_t total_slots;           // Usable slots in the area (0 = no swap)
+    uint64_t free_slots;            // Slots neither named nor cached
+    uint64_t cache_pages;           // Pages in the swap cache
+    uint64_t swap_outs;             // Pages written to their slot
+    uint64_t swap_ins;              // Faults that read their slot
+    uint64_t readahead;             // Slots read in along with a faulting one
+    uint64_t readahead_hits;        // Of those, faulted on while cached
+    uint64_t io_errors;             // Reads and writes that failed
+} swap_stats_t;
+
+/**
+ * Start swapping to the area at a sector of the block device
+ *
+ * @param start_sector First sector of the header page
+ * @return 0 on success, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_EBUSY - A swap area is already in use
+ * @errno THUNDEROS_EINVAL - No swap header there, or an area with no slots
+ * @errno THUNDEROS_EIO - The header could not be read
+ * @errno THUNDEROS_ENOMEM - No memory for the slot map
+ */
+int swap_on(uint64_t start_sector);
+
+/**
+ * Get the page with a slot's contents for a fault on one of its entries
+ *
+ * Maps nothing and keeps the slot's entry count; the caller maps the
+ * page in place of the entry and then calls swap_entry_free(). May sleep.
+ *
+ * @param slot  Slot named by the entry
+ * @param major Output: 1 if the slot had to be read from the device
+ * @return Page holding an extra reference for the caller, or 0 on error
+ *         (errno set)
+ *
+ * @errno THUNDEROS_EFAULT - No entry names the slot
+ * @errno THUNDEROS_ENOMEM - No page to read it into
+ * @errno THUNDEROS_EIO - The read failed
+ */
+uintptr_t swap_in(uint64_t slot, int *major);
+
+/**
+ * Count one more entry naming a slot (fork() copying one)
+ *
+ * @return 0 on success, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_EINVAL - No entry names the slot
+ * @errno THUNDEROS_ENOMEM - SWAP_MAP_MAX entries name it already
+ */
+int swap_entry_dup(uint64_t slot);
+
+/**
+ * Drop an entry naming a slot (unmapped, or swapped in)
+ *
+ * The last one frees the slot and drops the slot's cached page.
+ */
+void swap_entry_free(uint64_t slot);
+
+/**
+ * Number of entries naming a slot
+ */
+uint32_t swap_entry_count(uint64_t slot);
+
+/**
+ * Get swap statistics
+ *
+ * @param stats Output structure
+ */
+void swap_get_stats(swap_stats_t *stats);
+
+#endif // SWAP_H
@@ -0,0 +1,68 @@
+/**
+ * ARP (RFC 826)
+ *
+ * Maps next-hop IPv4 addresses to Ethernet addresses through a small
+ * cache. A packet for an address not resolved yet waits on its cache
+ * entry while a request goes out, and is sent when the reply arrives.
+ * There is no timer: an unanswered request is repeated when more
+ * packets are sent to the address, and the entry fails after
+ * ARP_MAX_RETRIES.
+ */
+
+#ifndef ARP_H
+#define ARP_H
+
+#include <stdint.h>
+#include "net/net.h"
+
+#define ARP_CACHE_SIZE      16
+#define ARP_MAX_PENDING     8           // Packets waiting per entry
+#define ARP_MAX_RETRIES     3
+#define ARP_RETRY_US        1000000     // Between requests for one address
+#define ARP_TIMEOUT_US      300000000   // A resolved entry is re-requested after this
+
+#define ARP_HRD_ETHER       1
+#define ARP_OP_REQUEST      1
+#define ARP_OP_REPLY        2
+
+typedef struct __attribute__((packed)) {
+    uint16_t htype;             // ARP_HRD_ETHER
+    uint16_t ptype;             // ETH_P_IP
+    uint8_t hlen;
+    uint8_t plen;
+    uint16_t op;
+    uint8_t sha[ETH_ALEN];      // Sender
+    uint32_t spa;
+    uint8_t tha[ETH_ALEN];      // Target
+    uint32_t tpa;
+} arp_packet_t;
+
+/**
+ * Handle a received ARP packet (interrupts off)
+ *
+ * Answers requests for our address and learns the sender's mapping,
+ * sending what was waiting for it.
+ *
+ * @param skb Packet, ARP header first; consumed
+ */
+void arp_rx(sk_buff_t *skb);
+
+/**
+ * Send an IPv4 packet to a next hop on the local network
+ *
+ * @param skb Packet, IP header first; taken over, sent or not
+ * @param next_hop Next-hop address (INADDR_BROADCAST for all hosts)
+ * @param batch Transmit batch, or NULL
+ * @return 0 if sent or waiting for resolution, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_EHOSTUNREACH - The next hop did not answer
+ * @errno THUNDEROS_ENOBUFS - Too many packets already waiting for it
+ */
+int arp_output(sk_buff_t *skb, uint32_t next_hop, net_tx_batch_t *batch);
+
+/**
+ * Forget every cache entry, dropping waiting packets
+ */
+void arp_flush(void);
+
+#endif /* ARP_H */
@@ -0,0 +1,45 @@
+/**
+ * Generic Receive Offload
+ *
+ * Consecutive TCP segments of a flow that arrive in one receive pass
+ * are merged into one packet before IPv4 sees them: the first keeps its
+ * headers, the payload of the rest is chained on its frag_list. The
+ * stack then does its per-packet work (lookup, ACK processing, a wakeup)
+ * once for up to GRO_MAX_SEGS segments, and the reader copies them with
+ * one pass over the chain.
+ *
+ * Only plain data segments merge: ACK with or without PSH, no IP
+ * options, in sequence, the same ACK and TCP options. Anything else of a
+ * held flow flushes it first, so the order within a flow is kept.
+ */
+
+#ifndef GRO_H
+#define GRO_H
+
+#include "net/net.h"
+
+/* Flows held at once; a new one beyond this flushes the oldest */
+#define GRO_MAX_FLOWS       8
+
+/* Segments merged into one packet */
+#define GRO_MAX_SEGS        44
+
+/* Largest merged packet, IP header included */
+#define GRO_MAX_SIZE        65535
+
+/**
+ * Take a received IPv4 packet, merging or holding it if it is TCP data
+ * (interrupts off)
+ *
+ * Packets that cannot be merged go on to ip_rx() at once.
+ *
+ * @param skb Packet, IP header first; consumed
+ */
+void net_gro_receive(sk_buff_t *skb);
+
+/**
+ * Hand every held packet to ip_rx() (end of a receive pass, interrupts off)
+ */
+void net_gro_flush(void);
+
+#endif /* GRO_H */
@@ -0,0 +1,90 @@
+/**
+ * IPv4 (RFC 791) and ICMP echo (RFC 792)
+ *
+ * No options are sent, fragments are dropped on receipt, and packets
+ * are never fragmented on the way out (DF is set; senders keep within
+ * the MTU). Packets for a local address go through loopback without
+ * touching the device.
+ */
+
+#ifndef IP_H
+#define IP_H
+
+#include <stdint.h>
+#include "net/net.h"
+
+#define IP_HLEN             20
+#define IP_DEFAULT_TTL      64
+
+#define IP_FLAG_DF          0x4000
+#define IP_FLAG_MF          0x2000
+#define IP_OFFSET_MASK      0x1FFF
+
+#define IPPROTO_ICMP        1
+#define IPPROTO_TCP         6
+#define IPPROTO_UDP         17
+
+#define ICMP_ECHO_REPLY     0
+#define ICMP_ECHO_REQUEST   8
+
+typedef struct __attribute__((packed)) {
+    uint8_t version_ihl;        // Version 4, header length in words
+    uint8_t tos;
+    uint16_t tot_len;
+    uint16_t id;
+    uint16_t frag_off;          // Flags and fragment offset
+    uint8_t ttl;
+    uint8_t protocol;
+    uint16_t check;
+    uint32_t saddr;
+    uint32_t daddr;
+} ip_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint8_t code;
+    uint16_t check;
+    uint16_t id;
+    uint16_t seq;
+} icmp_header_t;
+
+/**
+ * Handle a received IPv4 packet (interrupts off)
+ *
+ * @param skb Packet, IP header first; consumed
+ */
+void ip_rx(sk_buff_t *skb);
+
+/**
+ * Send a transport packet over IPv4
+ *
+ * Pushes the IP header in front of skb->data and routes the packet:
+ * local addresses through loopback, the local network directly, the
+ * rest through the gateway. An SKB_CSUM_PARTIAL packet is checksummed
+ * here when the device cannot do it.
+ *
+ * @param skb Packet, transport header first; taken over, sent or not
+ * @param saddr Source address
+ * @param daddr Destination address
+ * @param protocol IPPROTO_*
+ * @param batch Transmit batch, or NULL
+ * @return 0 on success, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_ENETDOWN - No device for a non-local address
+ * @errno THUNDEROS_EHOSTUNREACH - ARP failed for the next hop
+ * @errno THUNDEROS_EMSGSIZE - A TSO packet, and the device cannot segment
+ */
+int ip_output(sk_buff_t *skb, uint32_t saddr, uint32_t daddr, uint8_t protocol,
+              net_tx_batch_t *batch);
+
+/**
+ * Source address for packets to a destination
+ */
+uint32_t ip_select_source(uint32_t daddr);
+
+static inline ip_header_t *ip_hdr(const sk_buff_t *skb)
+{
+    return (ip_header_t *)skb_network_header(skb);
+}
+
+#endif /* IP_H */
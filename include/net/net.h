@@ -0,0 +1,233 @@
+/**
+ * Network Stack Core
+ *
+ * One interface, configured statically: the VirtIO network device when
+ * there is one, plus loopback. Frames from the driver arrive through
+ * net_rx() in interrupt context and are handed to ARP or IPv4 by
+ * EtherType; packets going out pass down through IPv4 and ARP to
+ * net_dev_xmit().
+ *
+ * Addresses and ports are kept in network byte order everywhere, as
+ * they appear on the wire and in struct sockaddr_in.
+ */
+
+#ifndef NET_H
+#define NET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "net/skbuff.h"
+
+/* Byte order (the kernel runs little-endian) */
+static inline uint16_t htons(uint16_t x)
+{
+    return __builtin_bswap16(x);
+}
+
+static inline uint32_t htonl(uint32_t x)
+{
+    return __builtin_bswap32(x);
+}
+
+#define ntohs(x)    htons(x)
+#define ntohl(x)    htonl(x)
+
+/* An IPv4 address a.b.c.d in network byte order */
+#define NET_IPV4(a, b, c, d) \
+    ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+#define INADDR_ANY          0
+#define INADDR_BROADCAST    0xFFFFFFFFu
+#define INADDR_LOOPBACK     NET_IPV4(127, 0, 0, 1)
+
+/* Static configuration, matching the host side of `make qemu-net` */
+#define NET_DEFAULT_ADDR    NET_IPV4(10, 0, 3, 15)
+#define NET_DEFAULT_NETMASK NET_IPV4(255, 255, 255, 0)
+#define NET_DEFAULT_GATEWAY NET_IPV4(10, 0, 3, 1)
+
+/* Ethernet */
+#define ETH_ALEN            6
+#define ETH_HLEN            14
+#define ETH_P_IP            0x0800
+#define ETH_P_ARP           0x0806
+#define ETH_MTU             1500
+
+typedef struct __attribute__((packed)) {
+    uint8_t dst[ETH_ALEN];
+    uint8_t src[ETH_ALEN];
+    uint16_t type;              // EtherType, network order
+} eth_header_t;
+
+/* Packets net_tx_batch_t collects before it flushes */
+#define NET_TX_BATCH        64
+
+/**
+ * Transmit batch
+ *
+ * Senders of many packets pass one down the stack; frames for the
+ * device collect in it and go out with one doorbell per flush instead
+ * of one per packet. A NULL batch means send at once.
+ */
+typedef struct {
+    sk_buff_t *skbs[NET_TX_BATCH];
+    uint32_t count;
+} net_tx_batch_t;
+
+/* net_config_t.offloads: work the device takes off the stack */
+#define NET_OFFLOAD_TX_CSUM 0x1     // Checksums of SKB_CSUM_PARTIAL packets
+#define NET_OFFLOAD_TSO     0x2     // Cutting TCP packets with gso_size set
+
+/**
+ * Interface configuration
+ */
+typedef struct {
+    int up;                     // Device present and configured
+    uint32_t offloads;          // NET_OFFLOAD_*
+    uint8_t mac[ETH_ALEN];
+    uint32_t addr;
+    uint32_t netmask;
+    uint32_t gateway;
+} net_config_t;
+
+/**
+ * Stack statistics
+ */
+typedef struct {
+    uint64_t rx_frames;         // Frames from the device
+    uint64_t rx_unknown;        // Frames of an EtherType nobody handles
+    uint64_t ip_rx;             // IPv4 packets received (device and loopback)
+    uint64_t ip_rx_errors;      // Bad IPv4 headers or checksums
+    uint64_t ip_rx_fragments;   // Fragments, dropped
+    uint64_t ip_rx_not_local;   // Not addressed to us
+    uint64_t ip_tx;             // IPv4 packets sent
+    uint64_t ip_loopback;       // Of those, delivered locally
+    uint64_t icmp_echo;         // Echo requests answered
+    uint64_t arp_requests;      // ARP requests sent
+    uint64_t arp_replies;       // ARP replies sent
+    uint64_t arp_queue_drops;   // Packets dropped waiting for ARP
+    uint64_t udp_rx;            // Datagrams queued to a socket
+    uint64_t udp_rx_errors;     // Bad UDP lengths or checksums
+    uint64_t udp_no_port;       // Datagrams for ports nobody has bound
+    uint64_t udp_rcvbuf_drops;  // Datagrams dropped on a full socket
+    uint64_t udp_tx;            // Datagrams sent
+    uint64_t tcp_rx;            // Segments received
+    uint64_t tcp_rx_errors;     // Bad TCP lengths or checksums
+    uint64_t tcp_tx;            // Segments sent, retransmissions included
+    uint64_t tcp_retransmits;   // Segments sent again
+    uint64_t tcp_fast_retransmits; // Of those, on duplicate ACKs or SACKs
+    uint64_t tcp_timeouts;      // Retransmission timer expiries
+    uint64_t tcp_resets_sent;   // RSTs sent
+    uint64_t tcp_ooo;           // Segments queued out of order
+    uint64_t tcp_delayed_acks;  // ACKs sent by the delayed-ACK timer
+    uint64_t tcp_tso;           // TSO packets sent, several segments each
+    uint64_t gro_merged;        // Received segments merged into another
+    uint64_t gro_flows_flushed; // Merged packets handed up
+    uint64_t csum_soft;         // Partial checksums finished by the stack
+} net_stats_t;
+
+extern net_config_t g_net_config;
+extern net_stats_t g_net_stats;
+
+/**
+ * Initialize the network stack
+ *
+ * Always brings loopback up; takes the VirtIO network device, if it was
+ * found, with the static address configuration.
+ *
+ * @return 0 if the device is configured, -1 for loopback only
+ */
+int net_init(void);
+
+/**
+ * Receive a frame from the device (driver callback, interrupts off)
+ *
+ * @param skb Frame, Ethernet header first; the stack owns it
+ */
+void net_rx(sk_buff_t *skb);
+
+/**
+ * Send a complete frame, or add it to a batch
+ *
+ * @param skb Frame, Ethernet header first; taken over, sent or not
+ * @param batch Batch to add to, or NULL to send at once
+ * @return 0 on success, -1 on error (errno set)
+ */
+int net_dev_xmit(sk_buff_t *skb, net_tx_batch_t *batch);
+
+/**
+ * Send whatever a batch holds, with one doorbell
+ *
+ * @param batch Batch (left empty)
+ */
+void net_tx_flush(net_tx_batch_t *batch);
+
+/**
+ * Deliver a packet addressed to this host, as the device would
+ *
+ * The packet is handed to ip_rx() with interrupts off. A packet sent
+ * while one is being delivered (an ACK, an echo reply) waits in a queue
+ * until that delivery returns, so loopback replies never recurse.
+ *
+ * @param skb IPv4 packet, IP header first; consumed
+ */
+void net_loopback_xmit(sk_buff_t *skb);
+
+/**
+ * Whether an address belongs to this host (loopback included)
+ */
+int net_is_local_addr(uint32_t addr);
+
+/**
+ * Whether an address is on the loopback network 127.0.0.0/8
+ */
+static inline int net_is_loopback(uint32_t addr)
+{
+    return (addr & 0xFF) == 127;
+}
+
+/**
+ * Add data to a ones' complement checksum (RFC 1071)
+ *
+ * @param data Bytes to add
+ * @param len Number of bytes
+ * @param sum Running sum (0 to start)
+ * @return New running sum, unfolded
+ */
+uint32_t net_csum_partial(const void *data, uint32_t len, uint32_t sum);
+
+/**
+ * Add bytes of a packet to a ones' complement checksum
+ *
+ * Like net_csum_partial(), across the linear part and the fragments.
+ *
+ * @param skb Packet
+ * @param offset First byte, from skb->data
+ * @param len Number of bytes (offset + len at most skb->len)
+ * @param sum Running sum (0 to start)
+ * @return New running sum, unfolded
+ */
+uint32_t net_csum_skb(const sk_buff_t *skb, uint32_t offset, uint32_t len, uint32_t sum);
+
+/**
+ * Finish the checksum of an SKB_CSUM_PARTIAL packet in software
+ *
+ * Sums from csum_start to the end of the packet, over the pseudo-header
+ * sum already in the checksum field, and stores the result there; the
+ * packet is SKB_CSUM_NONE afterwards.
+ *
+ * @param skb Packet whose headers are private (not shared with a clone)
+ */
+void net_csum_finish(sk_buff_t *skb);
+
+/**
+ * Fold a running sum into the final 16-bit checksum
+ */
+static inline uint16_t net_csum_fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+#endif /* NET_H */
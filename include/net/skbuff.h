@@ -0,0 +1,397 @@
+/**
+ * Packet Buffers (sk_buff)
+ *
+ * A packet is a descriptor (sk_buff_t, from a kmem_cache) over a head
+ * buffer (from a DMA pool, so a device can read or write it directly)
+ * plus up to SKB_MAX_FRAGS page fragments. The head buffer is laid out
+ * as
+ *
+ *   head      data           tail         end
+ *    | headroom | linear data | tailroom   | shared info |
+ *
+ * so protocol layers prepend their headers in place with skb_push() and
+ * a receiver strips them with skb_pull(), without copying the payload.
+ *
+ * The shared info at the end of the head buffer holds the fragment list
+ * and a count of the descriptors using the buffer: skb_clone() makes a
+ * second descriptor over the same data, and the buffer and the page
+ * references of its fragments go back when the last one is freed.
+ * Cloned data is read-only; skb_cow_head() gives a descriptor its own
+ * copy of the linear part before headers are written into it.
+ *
+ * A received packet may also carry whole packets chained behind it on
+ * the shared info's frag_list: receive offload (GRO) merges consecutive
+ * TCP segments that way, each segment staying in its own head buffer,
+ * and their payload counts in the first one's len and data_len.
+ *
+ * Everything here may be called with interrupts off (from a driver's
+ * interrupt handler) as well as from process context.
+ */
+
+#ifndef SKBUFF_H
+#define SKBUFF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Head buffer size, including the shared info; two per page */
+#define SKB_HEAD_SIZE           2048
+
+/* Page fragments per packet */
+#define SKB_MAX_FRAGS           16
+
+/* Headroom skb_alloc() callers reserve for link, network and transport headers */
+#define SKB_DEFAULT_HEADROOM    128
+
+/*
+ * Extra headroom for received frames, so the IP header after the 14-byte
+ * Ethernet header lands on a 4-byte boundary
+ */
+#define NET_IP_ALIGN            2
+
+/**
+ * Page fragment
+ *
+ * The packet holds one reference to the page for each fragment.
+ */
+typedef struct {
+    uintptr_t page;             // Physical address of the page
+    uint32_t offset;            // Start of the data within the page
+    uint32_t size;              // Bytes of data
+} skb_frag_t;
+
+struct sk_buff;
+
+/**
+ * Shared info, at the end of every head buffer
+ */
+typedef struct {
+    uint32_t dataref;           // Descriptors using this head buffer
+    uint32_t nr_frags;          // Fragments in use
+    skb_frag_t frags[SKB_MAX_FRAGS];
+    struct sk_buff *frag_list;  // Packets chained behind the fragments (linked by next)
+} skb_shared_info_t;
+
+/* Largest linear area: what the head buffer leaves after the shared info */
+#define SKB_MAX_LINEAR          (SKB_HEAD_SIZE - sizeof(skb_shared_info_t))
+
+/* sk_buff_t.ip_summed: the state of the transport checksum */
+#define SKB_CSUM_NONE           0   // Not checked (receive), complete (send)
+#define SKB_CSUM_UNNECESSARY    1   // Checked by the device, or never left memory
+#define SKB_CSUM_PARTIAL        2   // Send: pseudo-header sum at csum_start + csum_offset
+
+/**
+ * Packet buffer descriptor
+ */
+typedef struct sk_buff {
+    struct sk_buff *next;       // Queue links (sk_buff_head_t)
+    struct sk_buff *prev;
+
+    uint8_t *head;              // Start of the head buffer
+    uint8_t *data;              // Start of the packet
+    uint8_t *tail;              // End of the linear data
+    uint8_t *end;               // End of the linear area (shared info follows)
+    uintptr_t head_phys;        // Physical address of head, for devices
+
+    uint32_t len;               // Bytes in the packet, linear and fragments
+    uint32_t data_len;          // Bytes in fragments
+
+    uint16_t protocol;          // EtherType, host order (set by the receiver)
+    uint16_t network_header;    // Offset of the network header from head
+    uint16_t transport_header;  // Offset of the transport header from head
+    uint8_t cloned;             // Head buffer may be shared with a clone
+    uint8_t ip_summed;          // SKB_CSUM_*
+    uint16_t csum_start;        // PARTIAL: offset of the checksummed part from head
+    uint16_t csum_offset;       // PARTIAL: offset of the checksum from csum_start
+    uint16_t gso_size;          // Payload per segment of a TSO or GRO packet (0: one segment)
+
+    uint64_t cb[4];             // Private to the layer holding the packet
+} sk_buff_t;
+
+/**
+ * Queue of packet buffers
+ */
+typedef struct {
+    sk_buff_t *next;
+    sk_buff_t *prev;
+    uint32_t qlen;
+} sk_buff_head_t;
+
+/**
+ * Packet buffer statistics
+ */
+typedef struct {
+    uint64_t allocs;            // Descriptors with a new head buffer
+    uint64_t clones;            // Descriptors sharing a head buffer
+    uint64_t copies;            // Head buffers copied by skb_cow_head()
+    uint32_t skbs_in_use;       // Live descriptors
+    uint32_t heads_in_use;      // Live head buffers
+} skb_stats_t;
+
+/**
+ * Initialize the packet buffer subsystem
+ *
+ * Creates the descriptor cache and the head buffer pool; panics if
+ * either cannot be created.
+ */
+void skb_init(void);
+
+/**
+ * Allocate a packet buffer
+ *
+ * The packet starts empty with data at the start of the head buffer;
+ * skb_reserve() makes room for headers to come.
+ *
+ * @param size Linear bytes needed, headroom included (at most SKB_MAX_LINEAR)
+ * @return New packet buffer, or NULL on failure (errno set)
+ */
+sk_buff_t *skb_alloc(uint32_t size);
+
+/**
+ * Free a packet buffer
+ *
+ * The head buffer and fragment pages are released with the last
+ * descriptor using them.
+ *
+ * @param skb Packet buffer (NULL is ignored)
+ */
+void skb_free(sk_buff_t *skb);
+
+/**
+ * Make a second descriptor over the same data
+ *
+ * Neither descriptor may write the shared data afterwards without
+ * skb_cow_head().
+ *
+ * @param skb Packet buffer to clone
+ * @return New descriptor, or NULL on failure (errno set)
+ */
+sk_buff_t *skb_clone(sk_buff_t *skb);
+
+/**
+ * Give a packet buffer a private linear area with some headroom
+ *
+ * Copies the linear data into a new head buffer if the current one is
+ * shared or has less than headroom bytes in front of data; fragments
+ * are shared, not copied. A packet with a frag_list cannot be copied.
+ *
+ * @param skb Packet buffer
+ * @param headroom Headroom needed
+ * @return 0 on success, -1 on error (errno set)
+ */
+int skb_cow_head(sk_buff_t *skb, uint32_t headroom);
+
+/**
+ * Split a packet buffer in two
+ *
+ * The bytes from offset len to the end move to a new packet buffer:
+ * fragments move (a fragment cut in two is shared, with a page
+ * reference for each side) and linear data past len is copied.
+ *
+ * @param skb Packet buffer without a frag_list; keeps its first len bytes
+ * @param len Bytes to keep (less than skb->len)
+ * @return Packet buffer holding the rest, or NULL on failure (errno set)
+ */
+sk_buff_t *skb_split(sk_buff_t *skb, uint32_t len);
+
+/**
+ * Attach a page fragment at the end of the packet
+ *
+ * The packet takes over the caller's reference to the page.
+ *
+ * @param skb Packet buffer (must not be cloned)
+ * @param page Physical address of the page
+ * @param offset Start of the data within the page
+ * @param size Bytes of data
+ * @return 0 on success, -1 if the fragment list is full (errno set)
+ */
+int skb_add_frag(sk_buff_t *skb, uintptr_t page, uint32_t offset, uint32_t size);
+
+/**
+ * Chain a packet behind another, on its frag_list
+ *
+ * The chained packet's data (usually payload, its headers pulled off)
+ * becomes the end of skb's. Neither may be cloned.
+ *
+ * @param skb Packet to extend
+ * @param last Packet chained last, or skb if none is yet
+ * @param piece Packet to chain; skb takes it over
+ */
+void skb_append_chained(sk_buff_t *skb, sk_buff_t *last, sk_buff_t *piece);
+
+/**
+ * Copy bytes out of a packet, across the linear part, fragments and
+ * chained packets
+ *
+ * @param skb Packet buffer
+ * @param offset Offset from data
+ * @param to Destination
+ * @param len Bytes to copy
+ * @return 0 on success, -1 if the range is outside the packet (errno set)
+ */
+int skb_copy_bits(const sk_buff_t *skb, uint32_t offset, void *to, uint32_t len);
+
+/**
+ * Get packet buffer statistics
+ *
+ * @param stats Output structure
+ */
+void skb_get_stats(skb_stats_t *stats);
+
+/* Queues; callers serialize access with interrupts off */
+void skb_queue_init(sk_buff_head_t *list);
+void skb_queue_tail(sk_buff_head_t *list, sk_buff_t *skb);
+void skb_queue_head(sk_buff_head_t *list, sk_buff_t *skb);
+sk_buff_t *skb_dequeue(sk_buff_head_t *list);
+void skb_insert_after(sk_buff_head_t *list, sk_buff_t *prev, sk_buff_t *skb);
+void skb_unlink(sk_buff_head_t *list, sk_buff_t *skb);
+void skb_queue_purge(sk_buff_head_t *list);
+
+/**
+ * Shared info of a packet buffer
+ */
+static inline skb_shared_info_t *skb_shinfo(const sk_buff_t *skb)
+{
+    return (skb_shared_info_t *)skb->end;
+}
+
+/**
+ * Bytes in the linear part
+ */
+static inline uint32_t skb_headlen(const sk_buff_t *skb)
+{
+    return skb->len - skb->data_len;
+}
+
+/**
+ * Bytes free in front of data
+ */
+static inline uint32_t skb_headroom(const sk_buff_t *skb)
+{
+    return (uint32_t)(skb->data - skb->head);
+}
+
+/**
+ * Bytes free after the linear data (zero once there are fragments)
+ */
+static inline uint32_t skb_tailroom(const sk_buff_t *skb)
+{
+    return skb->data_len ? 0 : (uint32_t)(skb->end - skb->tail);
+}
+
+/**
+ * Whether the head buffer is shared with another descriptor
+ */
+static inline int skb_cloned(const sk_buff_t *skb)
+{
+    return skb->cloned && skb_shinfo(skb)->dataref != 1;
+}
+
+/**
+ * Physical address of data, for a device
+ */
+static inline uintptr_t skb_data_phys(const sk_buff_t *skb)
+{
+    return skb->head_phys + (uintptr_t)(skb->data - skb->head);
+}
+
+/**
+ * Address of a fragment's data
+ */
+static inline void *skb_frag_address(const skb_frag_t *frag)
+{
+    return (uint8_t *)frag->page + frag->offset;
+}
+
+/**
+ * Move an empty packet's data and tail forward, making headroom
+ */
+static inline void skb_reserve(sk_buff_t *skb, uint32_t len)
+{
+    skb->data += len;
+    skb->tail += len;
+}
+
+/**
+ * Extend the linear data at the end
+ *
+ * @return Start of the added bytes (caller checks skb_tailroom() first)
+ */
+static inline uint8_t *skb_put(sk_buff_t *skb, uint32_t len)
+{
+    uint8_t *start = skb->tail;
+    skb->tail += len;
+    skb->len += len;
+    return start;
+}
+
+/**
+ * Extend the packet at the front, into the headroom
+ *
+ * @return New start of the packet (caller checks skb_headroom() first)
+ */
+static inline uint8_t *skb_push(sk_buff_t *skb, uint32_t len)
+{
+    skb->data -= len;
+    skb->len += len;
+    return skb->data;
+}
+
+/**
+ * Remove bytes from the front of the linear data
+ *
+ * @return New start of the packet, or NULL if the linear part is shorter
+ */
+static inline uint8_t *skb_pull(sk_buff_t *skb, uint32_t len)
+{
+    if (len > skb_headlen(skb)) {
+        return NULL;
+    }
+    skb->len -= len;
+    skb->data += len;
+    return skb->data;
+}
+
+/**
+ * Cut the linear data of a packet without fragments to len bytes
+ */
+static inline void skb_trim(sk_buff_t *skb, uint32_t len)
+{
+    if (!skb->data_len && len < skb->len) {
+        skb->len = len;
+        skb->tail = skb->data + len;
+    }
+}
+
+/**
+ * Mark where the network and transport headers start
+ */
+static inline void skb_set_network_header(sk_buff_t *skb, uint32_t offset)
+{
+    skb->network_header = (uint16_t)(skb->data - skb->head + offset);
+}
+
+static inline void skb_set_transport_header(sk_buff_t *skb, uint32_t offset)
+{
+    skb->transport_header = (uint16_t)(skb->data - skb->head + offset);
+}
+
+static inline uint8_t *skb_network_header(const sk_buff_t *skb)
+{
+    return skb->head + skb->network_header;
+}
+
+static inline uint8_t *skb_transport_header(const sk_buff_t *skb)
+{
+    return skb->head + skb->transport_header;
+}
+
+/**
+ * Number of packets in a queue
+ */
+static inline uint32_t skb_queue_len(const sk_buff_head_t *list)
+{
+    return list->qlen;
+}
+
+#endif /* SKBUFF_H */
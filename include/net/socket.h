@@ -0,0 +1,410 @@
+/**
+ * Sockets
+ *
+ * A socket is an open file of type VFS_TYPE_SOCKET, so it lives in the
+ * per-process descriptor table and works with read(), close(), dup2(),
+ * fork(), poll() and epoll like any other descriptor. AF_INET sockets
+ * are datagram (UDP) or stream (TCP, see net/tcp.h); AF_UNIX sockets
+ * connect processes on this machine (see net/unix.h).
+ *
+ * Received datagrams wait on the socket's queue as the packet buffers
+ * they arrived in, up to the receive buffer limit; a receiver copies
+ * the payload out and the source address from the headers still in
+ * front of it. Sending builds the datagram straight in a packet buffer
+ * from the caller's memory. sendmmsg() and recvmmsg() move many
+ * datagrams per call; the frames one sendmmsg() produces leave the
+ * device with one doorbell per NET_TX_BATCH.
+ *
+ * A stream socket's state is its TCP connection (sock->tcp), which
+ * outlives the last close() until the connection has been shut down.
+ */
+
+#ifndef SOCKET_H
+#define SOCKET_H
+
+#include <stdint.h>
+#include "net/skbuff.h"
+#include "net/net.h"
+#include "kernel/wait_queue.h"
+#include "kernel/poll.h"
+#include "kernel/time.h"
+#include "fs/vfs.h"
+
+/* Address families, types and protocols (Linux values) */
+#define AF_UNIX             1
+#define AF_INET             2
+#define SOCK_STREAM         1
+#define SOCK_DGRAM          2
+#define SOCK_TYPE_MASK      0xF
+#define SOCK_NONBLOCK       O_NONBLOCK
+
+/* send/recv flags */
+#define MSG_CTRUNC          0x8         // Descriptors passed were dropped
+#define MSG_TRUNC           0x20        // Datagram was longer than the buffers
+#define MSG_DONTWAIT        0x40        // Don't block for this call
+#define MSG_WAITFORONE      0x10000     // recvmmsg(): block for the first only
+
+/* setsockopt() levels and options (Linux values) */
+#define SOL_SOCKET          1
+#define SO_REUSEADDR        2
+#define SO_TYPE             3
+#define SO_ERROR            4
+#define SO_SNDBUF           7
+#define SO_RCVBUF           8
+#define TCP_NODELAY         1           // Level IPPROTO_TCP
+#define TCP_MAXSEG          2
+
+/* Ancillary data: level SOL_SOCKET, descriptors passed (AF_UNIX) */
+#define SCM_RIGHTS          1
+
+/* shutdown() */
+#define SHUT_RD             0
+#define SHUT_WR             1
+#define SHUT_RDWR           2
+
+/* Receive buffer: packet buffer bytes a socket may hold (about 128 datagrams) */
+#define SOCKET_RCVBUF       (128 * SKB_HEAD_SIZE)
+
+/* Limits for SO_SNDBUF and SO_RCVBUF */
+#define SOCKET_BUF_MIN      (4 * 1024)
+#define SOCKET_BUF_MAX      (4 * 1024 * 1024)
+
+/* Most messages one sendmmsg()/recvmmsg() call takes */
+#define SOCKET_MMSG_MAX     1024
+
+/* Most descriptors one message passes */
+#define SOCKET_SCM_MAX      16
+
+/* Longest AF_UNIX name, terminating NUL included if it fits */
+#define UNIX_PATH_MAX       108
+
+/**
+ * IPv4 socket address (Linux layout)
+ */
+struct sockaddr_in {
+    uint16_t sin_family;        // AF_INET
+    uint16_t sin_port;          // Network order
+    uint32_t sin_addr;          // Network order
+    uint8_t sin_zero[8];
+};
+
+/**
+ * AF_UNIX socket address (Linux layout)
+ */
+struct sockaddr_un {
+    uint16_t sun_family;        // AF_UNIX
+    char sun_path[UNIX_PATH_MAX];
+};
+
+/**
+ * A socket address of either family, as the socket calls take it
+ */
+typedef union {
+    uint16_t family;
+    struct sockaddr_in in;
+    struct sockaddr_un un;
+} socket_addr_t;
+
+/**
+ * Message header for sendmsg()/recvmsg() and the mmsg calls (Linux layout)
+ */
+struct msghdr {
+    void *msg_name;             // struct sockaddr_in or sockaddr_un, or NULL
+    uint32_t msg_namelen;
+    vfs_iovec_t *msg_iov;
+    uint64_t msg_iovlen;
+    void *msg_control;          // Ancillary data (sendmsg()/recvmsg() only)
+    uint64_t msg_controllen;
+    int32_t msg_flags;          // MSG_TRUNC, MSG_CTRUNC on return
+};
+
+/**
+ * Ancillary data header (Linux layout); the data follows, and each
+ * header starts at a multiple of 8 bytes
+ */
+struct cmsghdr {
+    uint64_t cmsg_len;          // Header and data
+    int32_t cmsg_level;         // SOL_SOCKET
+    int32_t cmsg_type;          // SCM_RIGHTS: the data is an int array
+};
+
+#define CMSG_ALIGN(len)     (((len) + 7) & ~(uint64_t)7)
+#define CMSG_LEN(len)       (sizeof(struct cmsghdr) + (len))
+#define CMSG_SPACE(len)     (sizeof(struct cmsghdr) + CMSG_ALIGN(len))
+
+struct mmsghdr {
+    struct msghdr msg_hdr;
+    uint32_t msg_len;           // Bytes sent or received
+};
+
+/**
+ * Descriptors passed with a message, as the open files behind them
+ *
+ * Each slot holds a reference to its file.
+ */
+typedef struct {
+    uint32_t nfds;
+    vfs_file_t *files[SOCKET_SCM_MAX];
+} socket_scm_t;
+
+struct tcp_sock;
+struct unix_sock;
+
+/**
+ * Socket
+ */
+typedef struct socket {
+    uint32_t refcount;          // Open files, plus callers using it
+    uint16_t family;            // AF_INET or AF_UNIX
+    uint16_t type;              // SOCK_DGRAM or SOCK_STREAM
+    uint16_t protocol;          // IPPROTO_UDP or IPPROTO_TCP (AF_UNIX: 0)
+    uint32_t local_addr;        // Bound address (INADDR_ANY: any local one)
+    uint16_t local_port;        // Bound port, 0 until bound
+    struct socket *hash_next;   // Port table chain
+
+    sk_buff_head_t rx_queue;    // Received datagrams (interrupts off)
+    uint32_t rx_queued;         // Packet buffer bytes in rx_queue
+    uint32_t rcvbuf;            // Limit on rx_queued (stream: unread bytes)
+    uint64_t rx_drops;          // Datagrams dropped on a full queue
+    uint32_t sndbuf;            // Stream: bytes queued and not acknowledged
+    uint8_t reuseaddr;          // SO_REUSEADDR
+
+    wait_queue_t wait_queue;    // Woken when data, space or a state change comes
+    struct tcp_sock *tcp;       // AF_INET stream: the connection
+    struct unix_sock *un;       // AF_UNIX: names, peer and pipes
+} socket_t;
+
+/**
+ * What a queued datagram counts against the receive buffer
+ */
+static inline uint32_t socket_truesize(const sk_buff_t *skb)
+{
+    return SKB_HEAD_SIZE + skb->data_len;
+}
+
+/**
+ * Create a socket
+ *
+ * @param domain AF_INET or AF_UNIX
+ * @param type SOCK_DGRAM or SOCK_STREAM, optionally with SOCK_NONBLOCK
+ *             (left to the caller)
+ * @param protocol 0, or (AF_INET) IPPROTO_UDP or IPPROTO_TCP to match the type
+ * @return Socket with one reference, or NULL on error (errno set)
+ *
+ * @errno THUNDEROS_EAFNOSUPPORT - Not AF_INET or AF_UNIX
+ * @errno THUNDEROS_EPROTONOSUPPORT - Not a UDP or TCP socket, or an
+ *        AF_UNIX protocol other than 0
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ */
+socket_t *socket_create(int domain, int type, int protocol);
+
+/**
+ * Create a pair of connected sockets (AF_UNIX only, see unix_pair())
+ *
+ * @param pair Filled with both sockets, one reference each
+ * @return 0 on success, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_EOPNOTSUPP - AF_INET
+ * @errno Otherwise as socket_create()
+ */
+int socket_create_pair(int domain, int type, int protocol, socket_t *pair[2]);
+
+void socket_get(socket_t *sock);
+
+/**
+ * Drop a reference; the last one unbinds the socket and frees its queue
+ * (an AF_INET stream socket closes its connection, see tcp_close())
+ */
+void socket_put(socket_t *sock);
+
+/**
+ * Put back the files a message carried (scm->nfds is cleared)
+ */
+void socket_scm_release(socket_scm_t *scm);
+
+/**
+ * Bind a socket to a local address and port, or (AF_UNIX) a name
+ *
+ * @param sock Socket (not bound yet)
+ * @param addr Address of the socket's family; port 0 picks a free
+ *             ephemeral port
+ * @return 0 on success, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_EINVAL - Already bound
+ * @errno THUNDEROS_EAFNOSUPPORT - Not the socket's family
+ * @errno THUNDEROS_EADDRNOTAVAIL - Not a local address
+ * @errno THUNDEROS_EADDRINUSE - Port or name taken
+ */
+int socket_bind(socket_t *sock, const socket_addr_t *addr);
+
+/**
+ * Send one datagram, or data on a stream
+ *
+ * Binds an unbound UDP socket to an ephemeral port first.
+ *
+ * @param sock Socket
+ * @param dest Destination (UDP: NULL fails, sockets are not connected;
+ *             AF_UNIX datagram: NULL for the connected peer; stream:
+ *             ignored)
+ * @param iov Payload, in user memory
+ * @param iovcnt Number of buffers
+ * @param batch Transmit batch, or NULL to send at once (UDP only)
+ * @param nonblock Fail instead of waiting for buffer space
+ * @param scm Descriptors to pass (AF_UNIX), or NULL; the references
+ *            pass with the message when it is sent, else stay with the
+ *            caller
+ * @return Bytes sent, or -1 on error (errno set)
+ *
+ * @errno THUNDEROS_EDESTADDRREQ - No destination
+ * @errno THUNDEROS_EMSGSIZE - Payload larger than UDP_MAX_PAYLOAD
+ * @errno THUNDEROS_EFAULT - Bad buffer
+ * @errno THUNDEROS_EINVAL - Descriptors on an AF_INET socket
+ * @errno THUNDEROS_ENETDOWN, THUNDEROS_EHOSTUNREACH - See ip_output()
+ * @errno Stream: see tcp_sendmsg(); AF_UNIX: see unix_sendmsg()
+ */
+int socket_sendmsg(socket_t *sock, const socket_addr_t *dest,
+                   const vfs_iovec_t *iov, int iovcnt, net_tx_batch_t *batch,
+                   int nonblock, socket_scm_t *scm);
+
+/**
+ * Receive one datagram, or data on a stream
+ *
+ * A datagram longer than the buffers is cut short and the rest of it
+ * discarded, with MSG_TRUNC in *msg_flags. A stream returns what has
+ * arrived, 0 at its end, and its peer as the source.
+ *
+ * @param sock Socket
+ * @param iov Buffers, in user memory
+ * @param iovcnt Number of buffers
+ * @param from Filled with the source address (NULL: not wanted)
+ * @param nonblock Fail instead of waiting for a datagram
+ * @param deadline_us Absolute time to stop waiting (0: none)
+ * @param msg_flags Set to MSG_TRUNC, MSG_CTRUNC or 0 (NULL: not wanted)
+ * @param scm Filled with the descriptors passed with the data, the
+ *            references now the caller's (AF_UNIX); NULL drops them
+ *            with MSG_CTRUNC
+ * @return Bytes received, or -1 on error (errno set)
+ *
+ * @errno THUNDEROS_EAGAIN - Nothing queued (nonblock, or the deadline passed)
+ * @errno THUNDEROS_EINTR - A signal arrived first
+ * @errno THUNDEROS_EFAULT - Bad buffer (the datagram is lost)
+ */
+int socket_recvmsg(socket_t *sock, const vfs_iovec_t *iov, int iovcnt,
+                   socket_addr_t *from, int nonblock, uint64_t deadline_us,
+                   int *msg_flags, socket_scm_t *scm);
+
+/**
+ * Copy a datagram's payload out to user buffers
+ *
+ * @return Bytes copied (at most skb->len), or -1 on a bad buffer (errno set)
+ */
+int socket_copy_to_iov(const sk_buff_t *skb, const vfs_iovec_t *iov, int iovcnt);
+
+/**
+ * Take the oldest datagram off the receive queue, waiting for one if
+ * allowed (as socket_recvmsg())
+ *
+ * @return The datagram, or NULL (errno set)
+ */
+sk_buff_t *socket_dequeue(socket_t *sock, int nonblock, uint64_t deadline_us);
+
+/**
+ * Copy bytes of a packet out to user memory
+ *
+ * @return 0, or -1 on a bad buffer (errno set)
+ */
+int socket_copy_to_user(const sk_buff_t *skb, uint32_t offset, void *to, uint32_t len);
+
+/**
+ * Connect a stream socket (see tcp_connect(), unix_connect()), or set
+ * the peer of an AF_UNIX datagram socket
+ *
+ * @errno THUNDEROS_EOPNOTSUPP - UDP socket
+ * @errno THUNDEROS_EAFNOSUPPORT - Not the socket's family
+ */
+int socket_connect(socket_t *sock, const socket_addr_t *addr, int nonblock);
+
+/**
+ * Listen on a bound (or, if not, an ephemeral) port (see tcp_listen(),
+ * unix_listen())
+ *
+ * @errno THUNDEROS_EOPNOTSUPP - Datagram socket
+ */
+int socket_listen(socket_t *sock, int backlog);
+
+/**
+ * Accept a connection (see tcp_accept(), unix_accept())
+ *
+ * @param peer Filled with the peer's address (NULL: not wanted)
+ * @return New socket with one reference, or NULL (errno set)
+ *
+ * @errno THUNDEROS_EOPNOTSUPP - Datagram socket
+ */
+socket_t *socket_accept(socket_t *sock, socket_addr_t *peer, int nonblock);
+
+/**
+ * Shut down a stream socket (see tcp_shutdown(), unix_shutdown())
+ *
+ * @errno THUNDEROS_EINVAL - how is not SHUT_RD, SHUT_WR or SHUT_RDWR
+ * @errno THUNDEROS_ENOTCONN - Datagram socket, or not connected
+ */
+int socket_shutdown(socket_t *sock, int how);
+
+/**
+ * Set an int option
+ *
+ * SO_SNDBUF and SO_RCVBUF are clamped to SOCKET_BUF_MIN..SOCKET_BUF_MAX.
+ *
+ * @param level SOL_SOCKET, or IPPROTO_TCP for a stream socket
+ * @return 0 on success, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_ENOPROTOOPT - Unknown level or option
+ * @errno THUNDEROS_EINVAL - Bad value
+ */
+int socket_setsockopt(socket_t *sock, int level, int name, int value);
+
+/**
+ * Get an int option (SO_ERROR takes the pending error)
+ *
+ * @errno THUNDEROS_ENOPROTOOPT - Unknown level or option
+ */
+int socket_getsockopt(socket_t *sock, int level, int name, int *value);
+
+/**
+ * Queue a received datagram (interrupts off)
+ *
+ * @param sock Socket
+ * @param skb Datagram, payload first with the IP and UDP headers marked;
+ *            consumed, queued or dropped
+ * @return 0 if queued, -1 if the receive buffer is full
+ */
+int socket_deliver(socket_t *sock, sk_buff_t *skb);
+
+/**
+ * Readiness of a socket (see kernel/poll.h)
+ */
+int socket_poll(socket_t *sock, poll_table_t *pt);
+
+struct pipe;
+
+/**
+ * Move data from a pipe onto a stream by page reference (splice())
+ *
+ * @return Bytes moved, or -1 on error (errno set)
+ *
+ * @errno THUNDEROS_EINVAL - Not an AF_UNIX stream socket
+ * @errno Otherwise see unix_splice_write()
+ */
+int socket_splice_write(socket_t *sock, struct pipe *pipe, uint32_t len, int nonblock);
+
+/**
+ * Move received stream data into a pipe by page reference (splice())
+ *
+ * @return Bytes moved, 0 at the end of the stream, or -1 on error (errno set)
+ *
+ * @errno THUNDEROS_EINVAL - Not an AF_UNIX stream socket
+ * @errno Otherwise see unix_splice_read()
+ */
+int socket_splice_read(socket_t *sock, struct pipe *pipe, uint32_t len, int nonblock);
+
+#endif /* SOCKET_H */
@@ -0,0 +1,461 @@
+/**
+ * TCP (RFC 9293)
+ *
+ * Connections live in a table hashed on the local port, next to the
+ * listeners they were accepted from. Each has:
+ *
+ *   - A write queue of segments from snd_una on, MSS-sized, with the
+ *     payload in page fragments that a transmission shares with the
+ *     queue (skb_clone()), so data is copied once from the caller and
+ *     retransmitted without copying. Small writes are appended to the
+ *     last unsent segment (coalescing) and sent under Nagle's algorithm
+ *     unless TCP_NODELAY is set.
+ *   - A receive queue of in-order segments and an out-of-order queue
+ *     that the SACK option reports to the sender (RFC 2018).
+ *   - NewReno congestion control (RFC 5681, RFC 6582) counted in bytes,
+ *     with SACK-based loss recovery, window scaling (RFC 7323), RTT and
+ *     RTO estimation (RFC 6298) and delayed ACKs (every second full
+ *     segment is acknowledged at once).
+ *   - Checksums left to the device (SKB_CSUM_PARTIAL) and, when it can
+ *     segment (TSO), runs of full queued segments sent to it as one
+ *     packet that shares their pages; the queue keeps its MSS segments,
+ *     so ACK, SACK and retransmission work as without TSO.
+ *   - A retransmission timer and a delayed-ACK timer on the timer wheel.
+ *     They fire in the timer interrupt and hand their work to the
+ *     workqueue, as sending may sleep for ring space.
+ *
+ * Locking: connection state is changed with interrupts off. A process
+ * working on a connection (sending, receiving, the timer work) owns it
+ * through tp->lock and tp->owned; segments arriving meanwhile wait on
+ * tp->backlog and are processed when the owner lets go, so a process can
+ * copy from and to user memory with interrupts on. Lists shared between
+ * a listener and its children are only changed with interrupts off.
+ */
+
+#ifndef TCP_H
+#define TCP_H
+
+#include <stdint.h>
+#include "net/net.h"
+#include "net/ip.h"
+#include "net/socket.h"
+#include "kernel/timer_wheel.h"
+#include "kernel/workqueue.h"
+#include "kernel/mutex.h"
+
+#define TCP_HLEN            20
+#define TCP_MAX_HLEN        60
+
+/* Header flags */
+#define TCP_FIN             0x01
+#define TCP_SYN             0x02
+#define TCP_RST             0x04
+#define TCP_PSH             0x08
+#define TCP_ACK             0x10
+
+/* Options */
+#define TCPOPT_EOL          0
+#define TCPOPT_NOP          1
+#define TCPOPT_MSS          2
+#define TCPOPT_WSCALE       3
+#define TCPOPT_SACK_PERM    4
+#define TCPOPT_SACK         5
+
+/* States */
+#define TCP_CLOSED          0
+#define TCP_LISTEN          1
+#define TCP_SYN_SENT        2
+#define TCP_SYN_RECV        3
+#define TCP_ESTABLISHED     4
+#define TCP_FIN_WAIT1       5
+#define TCP_FIN_WAIT2       6
+#define TCP_CLOSING         7
+#define TCP_TIME_WAIT       8
+#define TCP_CLOSE_WAIT      9
+#define TCP_LAST_ACK        10
+
+/* Segment sizes: what fits an Ethernet frame, and the RFC 9293 default */
+#define TCP_MSS_ETH         (ETH_MTU - IP_HLEN - TCP_HLEN)
+#define TCP_MSS_DEFAULT     536
+
+/* Largest payload of one TSO packet: an IP packet of at most 64 KiB */
+#define TCP_TSO_MAX_PAYLOAD (65535 - IP_HLEN - TCP_MAX_HLEN)
+
+/* Window scale we offer: 65535 << 7 covers SOCKET_BUF_MAX */
+#define TCP_WSCALE          7
+
+/* Initial congestion window, in segments (RFC 6928) */
+#define TCP_INIT_CWND       10
+
+/* Duplicate ACKs (or SACKed segments) that start fast retransmit */
+#define TCP_DUPACK_THRESH   3
+
+/* SACK blocks sent in an ACK (4 fit without timestamps) */
+#define TCP_MAX_SACKS       4
+
+/* Timing, in microseconds */
+#define TCP_RTO_INIT_US     1000000
+#define TCP_RTO_MIN_US      200000
+#define TCP_RTO_MAX_US      60000000
+#define TCP_DELACK_US       40000       // At least one timer tick
+#define TCP_TIMEWAIT_US     60000000    // 2 * MSL
+#define TCP_FIN_TIMEOUT_US  60000000    // Closed socket waiting in FIN_WAIT2
+
+/* Transmissions of one segment before the connection is given up */
+#define TCP_SYN_RETRIES     5
+#define TCP_RETRIES         10
+
+/* Default and largest listen() backlog */
+#define TCP_BACKLOG_DEFAULT 16
+#define TCP_BACKLOG_MAX     128
+
+/* Ports handed to sockets that connect before binding */
+#define TCP_EPHEMERAL_FIRST 49152
+#define TCP_EPHEMERAL_LAST  65535
+
+/* Connection table buckets (power of two) */
+#define TCP_HASH_SIZE       64
+
+/* Default socket buffers */
+#define TCP_SNDBUF_DEFAULT  (256 * 1024)
+#define TCP_RCVBUF_DEFAULT  (256 * 1024)
+
+/* Congestion control state */
+#define TCP_CA_OPEN         0
+#define TCP_CA_RECOVERY     1           // Fast recovery after duplicate ACKs
+#define TCP_CA_LOSS         2           // After a retransmission timeout
+
+/* Directions shut down (tcp_sock_t.shutdown) */
+#define TCP_RCV_SHUTDOWN    0x01
+#define TCP_SEND_SHUTDOWN   0x02
+
+/* Segments held for a connection while a process owns it */
+#define TCP_BACKLOG_SEGS    1024
+
+/* Timer events, handled by the connection's work item */
+#define TCP_EV_RETRANSMIT   0x01
+#define TCP_EV_DELACK       0x02
+
+typedef struct __attribute__((packed)) {
+    uint16_t source;
+    uint16_t dest;
+    uint32_t seq;
+    uint32_t ack_seq;
+    uint8_t doff;               // Header length in words, in the high nibble
+    uint8_t flags;
+    uint16_t window;
+    uint16_t check;
+    uint16_t urg_ptr;
+} tcp_header_t;
+
+/**
+ * What TCP keeps in skb->cb for a segment
+ */
+typedef struct {
+    uint32_t seq;               // First sequence number (of the SYN, or payload)
+    uint32_t end_seq;           // seq + payload + SYN + FIN
+    uint64_t sent_us;           // Last transmission, 0 if not sent yet
+    uint8_t flags;              // TCP flags the segment carries
+    uint8_t sacked;             // TCPCB_* below
+} tcp_skb_cb_t;
+
+#define TCP_SKB_CB(skb)     ((tcp_skb_cb_t *)(skb)->cb)
+
+#define TCPCB_SACKED        0x01        // Peer has it (SACK, or a Reno duplicate ACK)
+#define TCPCB_LOST          0x02        // Considered lost, to be sent again
+#define TCPCB_RETRANS       0x04        // Sent again; no RTT sample from it
+
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+} tcp_sack_block_t;
+
+/**
+ * Connection
+ */
+typedef struct tcp_sock {
+    socket_t *sock;             // Socket (local address and port, wait queue)
+    uint32_t refs;              // Socket, table entry, queued work, callers
+    struct tcp_sock *hash_next; // Table chain
+
+    uint8_t state;
+    uint8_t owned;              // A process is working on it (see above)
+    uint8_t orphan;             // Socket closed; finishing the close alone
+    uint8_t hashed;             // In the connection table
+    uint8_t nodelay;            // TCP_NODELAY: no Nagle
+    uint8_t sack_ok;            // Both ends do SACK
+    uint8_t snd_wscale;         // Shift for windows the peer sends
+    uint8_t rcv_wscale;         // Shift for windows we send
+    uint8_t shutdown;           // TCP_*_SHUTDOWN bits
+    int error;                  // Error for the next call (ECONNRESET, ...)
+
+    uint32_t remote_addr;
+    uint16_t remote_port;
+    uint16_t mss;               // Largest payload we send
+    uint16_t rcv_mss;           // Largest payload seen, for delayed ACKs
+    uint16_t user_mss;          // TCP_MAXSEG, 0 if not set
+
+    /* Send side */
+    uint32_t iss;
+    uint32_t snd_una;           // Oldest unacknowledged
+    uint32_t snd_nxt;           // Next new sequence number to send
+    uint32_t write_seq;         // Next sequence number to queue
+    uint32_t snd_wnd;           // Peer's window, in bytes
+    uint32_t snd_wl1;           // Segment seq and ack of the last window update
+    uint32_t snd_wl2;
+    sk_buff_head_t write_queue; // Segments from snd_una on, sent and not
+    sk_buff_t *send_head;       // First segment not sent yet, or NULL
+    uintptr_t tx_page;          // Page write() copies into
+    uint32_t tx_page_off;
+
+    /* Congestion control, in bytes */
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t bytes_acked;       // Toward the next increase in avoidance
+    uint32_t recover;           // snd_nxt when recovery began
+    uint32_t sacked_out;        // Bytes marked TCPCB_SACKED
+    uint32_t lost_out;          // Bytes marked TCPCB_LOST
+    uint32_t retrans_out;       // Lost bytes sent again
+    uint32_t high_sacked;       // Highest end of a SACKed segment
+    uint32_t dupacks;           // Duplicate ACKs in a row
+    uint8_t ca_state;
+    uint8_t cwnd_limited;       // The last send stopped at cwnd
+
+    /* Round-trip time and retransmission */
+    uint32_t srtt_us;           // 0 until the first sample
+    uint32_t rttvar_us;
+    uint32_t rto_us;
+    uint8_t retransmits;        // Timeouts since the last progress
+    ktimer_t rtx_timer;         // Retransmit, window probe, SYN, TIME_WAIT
+    ktimer_t delack_timer;
+    work_t work;                // Runs the timer events
+    uint32_t events;            // TCP_EV_* pending (interrupts off)
+
+    /* Receive side */
+    uint32_t irs;
+    uint32_t rcv_nxt;           // Next sequence number expected
+    uint32_t copied_seq;        // Next byte the reader gets
+    uint32_t rcv_wnd;           // Window last advertised, from rcv_wup
+    uint32_t rcv_wup;           // rcv_nxt when it was advertised
+    sk_buff_head_t rcv_queue;   // In-order segments, headers pulled
+    sk_buff_head_t ooo_queue;   // Out-of-order segments, by sequence
+    tcp_sack_block_t sacks[TCP_MAX_SACKS]; // Most recent first
+    uint8_t num_sacks;
+    uint8_t ack_pending;        // An ACK is owed (delayed)
+    uint8_t fin_rcvd;           // Peer's FIN is in sequence
+    uint32_t unacked_bytes;     // Received since our last ACK
+
+    /* Listening */
+    struct tcp_sock *parent;    // Listener a connection came from
+    struct tcp_sock *child_next;
+    struct tcp_sock *children;  // Connections not accepted yet, oldest first
+    uint32_t child_count;
+    uint32_t backlog_max;       // listen() backlog
+
+    mutex_t lock;               // Held by the owning process
+    sk_buff_head_t backlog;     // Segments arriving while owned
+} tcp_sock_t;
+
+/**
+ * Initialize TCP
+ */
+void tcp_init(void);
+
+/**
+ * Handle a received TCP segment (interrupts off)
+ *
+ * @param skb Segment, TCP header first, IP header marked; consumed
+ */
+void tcp_rx(sk_buff_t *skb);
+
+/**
+ * Give a stream socket its connection state
+ *
+ * @param sock New SOCK_STREAM socket
+ * @return 0 on success, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ */
+int tcp_sock_create(socket_t *sock);
+
+/**
+ * Close a stream socket whose last reference went
+ *
+ * Sends a FIN (a RST if unread data is left) and lets the connection
+ * finish on its own; it is freed when it reaches CLOSED.
+ */
+void tcp_close(socket_t *sock);
+
+/**
+ * Bind to a local address and port
+ *
+ * @param sock Stream socket
+ * @param addr Local address, network order
+ * @param port Local port, network order; 0 picks an ephemeral port
+ * @return 0 on success, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_EADDRINUSE - Port taken (SO_REUSEADDR only shares
+ *        a port with connections, not with a listener)
+ */
+int tcp_bind(socket_t *sock, uint32_t addr, uint16_t port);
+
+/**
+ * Open a connection
+ *
+ * @param sock Stream socket, not connected
+ * @param dest Peer
+ * @param nonblock Return EINPROGRESS instead of waiting
+ * @return 0 once connected, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_EISCONN - Already connected
+ * @errno THUNDEROS_EALREADY - A connect is in progress
+ * @errno THUNDEROS_EINPROGRESS - Started, not finished (nonblock)
+ * @errno THUNDEROS_ECONNREFUSED - Peer answered with a RST
+ * @errno THUNDEROS_ETIMEDOUT - No answer to the SYNs
+ * @errno THUNDEROS_EINTR - A signal arrived first (the connect goes on)
+ * @errno THUNDEROS_ENETDOWN, THUNDEROS_EHOSTUNREACH - See ip_output()
+ */
+int tcp_connect(socket_t *sock, const struct sockaddr_in *dest, int nonblock);
+
+/**
+ * Accept connections
+ *
+ * @param sock Bound stream socket, not connected
+ * @param backlog Connections that may wait for accept() (clamped)
+ * @return 0 on success, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_EINVAL - Connected or connecting
+ */
+int tcp_listen(socket_t *sock, int backlog);
+
+/**
+ * Take a connection off a listener
+ *
+ * @param sock Listening socket
+ * @param nonblock Fail instead of waiting for one
+ * @return Socket of the connection, with one reference, or NULL (errno set)
+ *
+ * @errno THUNDEROS_EINVAL - Not listening
+ * @errno THUNDEROS_EAGAIN - None waiting (nonblock)
+ * @errno THUNDEROS_EINTR - A signal arrived first
+ */
+socket_t *tcp_accept(socket_t *sock, int nonblock);
+
+/**
+ * Queue data for sending
+ *
+ * Waits for send buffer space unless nonblock.
+ *
+ * @return Bytes queued (short only when interrupted after some), or -1
+ *         on error (errno set)
+ *
+ * @errno THUNDEROS_ENOTCONN - Not connected
+ * @errno THUNDEROS_EPIPE - Shut down for writing, or the peer reset
+ * @errno THUNDEROS_EAGAIN - Send buffer full (nonblock)
+ * @errno THUNDEROS_EFAULT - Bad buffer
+ */
+int tcp_sendmsg(socket_t *sock, const vfs_iovec_t *iov, int iovcnt, int nonblock);
+
+/**
+ * Receive data
+ *
+ * Returns what is there once anything is, like a pipe.
+ *
+ * @return Bytes received, 0 at end of stream, or -1 on error (errno set)
+ *
+ * @errno THUNDEROS_ENOTCONN - Not connected
+ * @errno THUNDEROS_ECONNRESET - Peer reset the connection
+ * @errno THUNDEROS_EAGAIN - Nothing to read (nonblock, or deadline passed)
+ * @errno THUNDEROS_EINTR - A signal arrived first
+ * @errno THUNDEROS_EFAULT - Bad buffer
+ */
+int tcp_recvmsg(socket_t *sock, const vfs_iovec_t *iov, int iovcnt, int nonblock,
+                uint64_t deadline_us);
+
+/**
+ * Shut down one or both directions
+ *
+ * @param how SHUT_RD, SHUT_WR or SHUT_RDWR
+ * @return 0 on success, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_ENOTCONN - Not connected
+ */
+int tcp_shutdown(socket_t *sock, int how);
+
+/**
+ * TCP-level options (IPPROTO_TCP)
+ *
+ * @errno THUNDEROS_ENOPROTOOPT - Unknown option
+ */
+int tcp_setsockopt(socket_t *sock, int name, int value);
+int tcp_getsockopt(socket_t *sock, int name, int *value);
+
+/**
+ * Take the pending error (SO_ERROR)
+ */
+int tcp_take_error(socket_t *sock);
+
+/**
+ * Fill in the peer's address
+ *
+ * @return 0, or -1 if not connected (errno set to ENOTCONN)
+ */
+int tcp_getpeer(socket_t *sock, struct sockaddr_in *addr);
+
+/**
+ * Readiness of a stream socket (see kernel/poll.h)
+ */
+int tcp_poll(socket_t *sock, poll_table_t *pt);
+
+static inline tcp_header_t *tcp_hdr(const sk_buff_t *skb)
+{
+    return (tcp_header_t *)skb_transport_header(skb);
+}
+
+/* Sequence number comparisons, modulo 2^32 */
+static inline int tcp_before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+static inline int tcp_after(uint32_t a, uint32_t b)
+{
+    return (int32_t)(b - a) < 0;
+}
+
+/*
+ * Between the files of the TCP implementation
+ */
+
+/* tcp.c */
+void tcp_sock_hold(tcp_sock_t *tp);
+void tcp_sock_put(tcp_sock_t *tp);
+void tcp_set_state(tcp_sock_t *tp, uint8_t state);
+void tcp_done(tcp_sock_t *tp);
+void tcp_wake(tcp_sock_t *tp);
+void tcp_reset_timer(tcp_sock_t *tp, uint32_t delay_us);
+tcp_sock_t *tcp_create_child(tcp_sock_t *listener, uint32_t local_addr, uint32_t remote_addr,
+                             uint16_t remote_port);
+void tcp_child_ready(tcp_sock_t *child);
+uint32_t tcp_pseudo_sum(uint32_t saddr, uint32_t daddr, uint32_t len);
+
+/* tcp_input.c */
+void tcp_rcv(tcp_sock_t *tp, sk_buff_t *skb);
+uint32_t tcp_in_flight(const tcp_sock_t *tp);
+void tcp_rtx_timeout(tcp_sock_t *tp);
+
+/* tcp_output.c */
+int tcp_write_xmit(tcp_sock_t *tp, int push);
+void tcp_xmit_retransmit_queue(tcp_sock_t *tp);
+int tcp_retransmit_skb(tcp_sock_t *tp, sk_buff_t *skb);
+int tcp_send_syn(tcp_sock_t *tp);
+void tcp_send_ack(tcp_sock_t *tp);
+void tcp_send_delayed_ack(tcp_sock_t *tp);
+void tcp_send_probe(tcp_sock_t *tp);
+void tcp_send_fin(tcp_sock_t *tp);
+void tcp_send_active_reset(tcp_sock_t *tp);
+void tcp_send_reset(const sk_buff_t *skb);
+void tcp_window_update(tcp_sock_t *tp);
+uint32_t tcp_receive_space(const tcp_sock_t *tp);
+
+#endif /* TCP_H */
@@ -0,0 +1,80 @@
+/**
+ * UDP (RFC 768)
+ *
+ * Bound sockets sit in a port table hashed on the local port. Received
+ * datagrams are checked (length, checksum when the sender set one) and
+ * queued to the socket bound to their port and address; sent datagrams
+ * always carry a checksum.
+ */
+
+#ifndef UDP_H
+#define UDP_H
+
+#include <stdint.h>
+#include "net/net.h"
+#include "net/ip.h"
+#include "net/socket.h"
+
+#define UDP_HLEN            8
+
+/* Largest payload that fits one Ethernet frame */
+#define UDP_MAX_PAYLOAD     (ETH_MTU - IP_HLEN - UDP_HLEN)
+
+/* Ports handed to sockets that send before binding */
+#define UDP_EPHEMERAL_FIRST 49152
+#define UDP_EPHEMERAL_LAST  65535
+
+/* Port table buckets (power of two) */
+#define UDP_HASH_SIZE       64
+
+typedef struct __attribute__((packed)) {
+    uint16_t source;
+    uint16_t dest;
+    uint16_t len;               // Header and payload
+    uint16_t check;             // 0: none (receive only)
+} udp_header_t;
+
+/**
+ * Handle a received UDP datagram (interrupts off)
+ *
+ * @param skb Datagram, UDP header first, IP header marked; consumed
+ */
+void udp_rx(sk_buff_t *skb);
+
+/**
+ * Put a socket in the port table
+ *
+ * @param sock Socket, not bound yet
+ * @param addr Local address, network order (INADDR_ANY for all)
+ * @param port Port, network order (0 picks an ephemeral one)
+ * @return 0 on success, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_EADDRINUSE - Port taken, or no ephemeral port left
+ */
+int udp_bind(socket_t *sock, uint32_t addr, uint16_t port);
+
+/**
+ * Take a socket out of the port table
+ */
+void udp_unbind(socket_t *sock);
+
+/**
+ * Build and send one datagram from user memory
+ *
+ * @param sock Bound socket
+ * @param daddr Destination address, network order
+ * @param dport Destination port, network order
+ * @param iov Payload buffers, in user memory
+ * @param iovcnt Number of buffers
+ * @param batch Transmit batch, or NULL
+ * @return Payload bytes sent, or -1 on error (errno set)
+ */
+int udp_sendmsg(socket_t *sock, uint32_t daddr, uint16_t dport,
+                const vfs_iovec_t *iov, int iovcnt, net_tx_batch_t *batch);
+
+static inline udp_header_t *udp_hdr(const sk_buff_t *skb)
+{
+    return (udp_header_t *)skb_transport_header(skb);
+}
+
+#endif /* UDP_H */
@@ -0,0 +1,237 @@
+/**
+ * AF_UNIX sockets
+ *
+ * Local sockets never touch the IP stack. A stream connection is two
+ * pipes (kernel/pipe.h), one per direction: each socket owns the read
+ * end of the pipe its peer writes to, so data moves the way it does
+ * between processes joined by pipe(), a page at a time, and splice()
+ * moves it between a pipe and a socket by page reference. A datagram is
+ * copied once into a packet buffer and queued on the receiver as it is.
+ *
+ * Names live in a table in the kernel, not in the file system: a name
+ * is taken while its socket is open and free again after the last
+ * close(), as Linux's abstract names are.
+ *
+ * Descriptors (SCM_RIGHTS) travel as references to the open files. On
+ * a stream they are tied to the byte they were sent with, and a read
+ * stops short of the next such byte, so each set arrives with its own
+ * data, as on Linux. AF_UNIX sockets themselves cannot be passed: there
+ * is no collector for sockets in flight to each other.
+ */
+
+#ifndef UNIX_H
+#define UNIX_H
+
+#include "net/socket.h"
+#include "kernel/pipe.h"
+
+/* unix_sock_t states */
+#define UNIX_UNCONNECTED    0
+#define UNIX_LISTEN         1
+#define UNIX_CONNECTED      2
+
+/* Name table buckets */
+#define UNIX_HASH_SIZE      64
+
+/* Connections waiting for accept() when listen() asks for 0 or less */
+#define UNIX_BACKLOG_DEF    16
+#define UNIX_BACKLOG_MAX    128
+
+/* Largest datagram */
+#define UNIX_DGRAM_MAX      (64 * 1024)
+
+/**
+ * Descriptors in flight to a socket
+ */
+typedef struct unix_scm {
+    struct unix_scm *next;
+    uint64_t seq;               // Stream: byte of rx they were sent with
+    socket_scm_t scm;
+} unix_scm_t;
+
+/**
+ * AF_UNIX state of a socket (sock->un)
+ */
+typedef struct unix_sock {
+    socket_t *sock;
+    uint8_t state;              // UNIX_*
+    uint8_t shut_rd;            // shutdown() taken (stream)
+    uint8_t shut_wr;
+    char path[UNIX_PATH_MAX + 1];   // Bound name, "" if none
+    char peer_path[UNIX_PATH_MAX + 1];  // Datagram: connect()ed destination
+    struct unix_sock *hash_next;    // Name table chain
+
+    socket_t *peer;             // Stream, socketpair(): the other end (cleared
+                                // when it goes)
+    pipe_t *rx;                 // Stream: data to us; we hold the read end
+    pipe_t *tx;                 // Stream: the peer's rx; we hold the write end
+    unix_scm_t *scm_head;       // Stream: descriptors in flight to us, in order
+    unix_scm_t *scm_tail;
+
+    socket_t *accept_head;      // Listener: connections not accepted yet
+    socket_t *accept_tail;
+    socket_t *accept_next;      // Chain in the listener's queue
+    uint32_t accept_len;
+    uint32_t backlog;
+} unix_sock_t;
+
+/**
+ * Set up the AF_UNIX state of a new socket
+ *
+ * @return 0 on success, -1 on error (errno set)
+ *
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ */
+int unix_sock_create(socket_t *sock);
+
+/**
+ * Tear down a socket on its last reference: the name is freed, the
+ * peer sees the end of the stream and queued data and descriptors are
+ * put back. Frees sock->un, not sock.
+ */
+void unix_release(socket_t *sock);
+
+/**
+ * Connect two new sockets of the same type to each other (socketpair())
+ *
+ * @errno THUNDEROS_ENOMEM - No memory for the pipes
+ */
+int unix_pair(socket_t *a, socket_t *b);
+
+/**
+ * Give a socket a name
+ *
+ * @errno THUNDEROS_EINVAL - Already bound, or an empty name
+ * @errno THUNDEROS_EADDRINUSE - Name taken
+ */
+int unix_bind(socket_t *sock, const struct sockaddr_un *addr);
+
+/**
+ * Connect to a listening stream socket, or set a datagram socket's peer
+ *
+ * A stream connection is complete once the listener has queued it; the
+ * data written meanwhile waits for whoever accepts it. Waits for backlog
+ * room unless nonblock.
+ *
+ * @errno THUNDEROS_EISCONN - Already connected
+ * @errno THUNDEROS_EINVAL - Listening
+ * @errno THUNDEROS_ENOENT - No socket has the name
+ * @errno THUNDEROS_ECONNREFUSED - It does not listen, or is of the other type
+ * @errno THUNDEROS_EAGAIN - Backlog full (nonblock)
+ * @errno THUNDEROS_EINTR - A signal arrived first
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ */
+int unix_connect(socket_t *sock, const struct sockaddr_un *addr, int nonblock);
+
+/**
+ * Listen on a bound stream socket
+ *
+ * @param backlog Connections waiting for accept() (0 or less: UNIX_BACKLOG_DEF)
+ *
+ * @errno THUNDEROS_EINVAL - Not bound, or connected
+ */
+int unix_listen(socket_t *sock, int backlog);
+
+/**
+ * Take a connection off a listening socket
+ *
+ * @return Connected socket with one reference, or NULL (errno set)
+ *
+ * @errno THUNDEROS_EINVAL - Not listening
+ * @errno THUNDEROS_EAGAIN - None waiting (nonblock)
+ * @errno THUNDEROS_EINTR - A signal arrived first
+ */
+socket_t *unix_accept(socket_t *sock, int nonblock);
+
+/**
+ * Send data on a stream, or one datagram
+ *
+ * A stream write waits until it all went unless nonblock (which returns
+ * what fitted); a datagram waits for room in the receiver's buffer.
+ *
+ * @param dest Datagram destination (NULL: the connected peer; a stream
+ *             ignores it)
+ * @param scm Descriptors to pass, or NULL; the references go with the
+ *            message if it is sent
+ * @return Bytes sent, or -1 on error (errno set)
+ *
+ * @errno THUNDEROS_ENOTCONN - Stream not connected
+ * @errno THUNDEROS_EPIPE - Stream shut down for writing, or the peer is gone
+ * @errno THUNDEROS_EDESTADDRREQ - Datagram with no destination or peer
+ * @errno THUNDEROS_ENOENT - No socket has the destination name
+ * @errno THUNDEROS_ECONNREFUSED - The destination is a stream socket, or
+ *        the socketpair() peer is gone
+ * @errno THUNDEROS_EMSGSIZE - Datagram larger than UNIX_DGRAM_MAX, or than
+ *        the receiver's buffer
+ * @errno THUNDEROS_EINVAL - An AF_UNIX socket among the descriptors
+ * @errno THUNDEROS_EAGAIN - No room (nonblock)
+ * @errno THUNDEROS_EINTR - A signal arrived first
+ * @errno THUNDEROS_EFAULT - Bad buffer
+ */
+int unix_sendmsg(socket_t *sock, const struct sockaddr_un *dest,
+                 const vfs_iovec_t *iov, int iovcnt, int nonblock, socket_scm_t *scm);
+
+/**
+ * Receive data on a stream, or one datagram
+ *
+ * A stream read returns what is there, never more than reaches the next
+ * byte sent with descriptors, and 0 at the end of the stream.
+ *
+ * @param from Filled with the sender's name (NULL: not wanted)
+ * @param msg_flags Set to MSG_TRUNC, MSG_CTRUNC or 0 (NULL: not wanted)
+ * @param scm Filled with the descriptors that came with the data (NULL:
+ *            they are put back, and MSG_CTRUNC set)
+ * @return Bytes received, or -1 on error (errno set)
+ *
+ * @errno THUNDEROS_ENOTCONN - Stream not connected
+ * @errno THUNDEROS_EAGAIN - Nothing to read (nonblock, or the deadline passed)
+ * @errno THUNDEROS_EINTR - A signal arrived first
+ * @errno THUNDEROS_EFAULT - Bad buffer
+ */
+int unix_recvmsg(socket_t *sock, const vfs_iovec_t *iov, int iovcnt,
+                 struct sockaddr_un *from, int nonblock, uint64_t deadline_us,
+                 int *msg_flags, socket_scm_t *scm);
+
+/**
+ * The name of a socket, or of its stream peer
+ *
+ * An unnamed socket has just the family.
+ */
+void unix_getname(socket_t *sock, int peer, struct sockaddr_un *addr);
+
+/**
+ * Shut down one or both directions of a stream
+ *
+ * @errno THUNDEROS_ENOTCONN - Not connected
+ */
+int unix_shutdown(socket_t *sock, int how);
+
+/**
+ * Readiness of a socket (see kernel/poll.h)
+ */
+int unix_poll(socket_t *sock, poll_table_t *pt);
+
+/**
+ * Apply SO_RCVBUF to a stream's receive pipe (as far as PIPE_MAX_SIZE)
+ */
+void unix_set_rcvbuf(socket_t *sock);
+
+/**
+ * Move data from a pipe to the peer of a stream by page reference
+ *
+ * @errno THUNDEROS_ENOTCONN, THUNDEROS_EPIPE - As unix_sendmsg()
+ * @errno Otherwise see pipe_move()
+ */
+int unix_splice_write(socket_t *sock, pipe_t *pipe, uint32_t len, int nonblock);
+
+/**
+ * Move received stream data into a pipe by page reference
+ *
+ * Descriptors sent with the data moved are put back.
+ *
+ * @errno THUNDEROS_ENOTCONN - Not connected
+ * @errno Otherwise see pipe_move()
+ */
+int unix_splice_read(socket_t *sock, pipe_t *pipe, uint32_t len, int nonblock);
+
+#endif /* UNIX_H */
@@ -29,7 +29,11 @@
 #define IRQ_S_TIMER   5
 #define IRQ_S_EXTERNAL 9
 
+#ifndef __ASSEMBLER__
+
 // Trap frame structure - saved by trap handler
+// Frames of the syscall/timer fast path leave s0-s11 unset; only
+// trap_handler() (and so SYSCALL_NEEDS_FRAME syscalls) sees all of them.
 struct trap_frame {
     unsigned long ra;   // x1: return address
     unsigned long sp;   // x2: stack pointer
@@ -69,5 +73,8 @@ struct trap_frame {
 // Function prototypes
 void trap_init(void);
 void trap_handler(struct trap_frame *tf);
+int trap_fast_handler(struct trap_frame *tf);
+
+#endif // __ASSEMBLER__
 
 #endif // TRAP_H
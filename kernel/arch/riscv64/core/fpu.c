@@ -0,0 +1,126 @@
+/*
+ * Lazy floating-point context switching for RISC-V
+ *
+ * See include/arch/fpu.h. A process owns a save area (proc->fp_state)
+ * only once it has executed a floating-point instruction. Registers are
+ * not left behind on a hart for later: a process switched out with
+ * FS = Dirty is saved right there, so it can be resumed on any CPU from
+ * its save area. What the FS bits buy is skipping the save when nothing
+ * changed, and both save and restore for processes without FP state.
+ */
+
+#include "arch/fpu.h"
+#include "trap.h"
+#include "kernel/process.h"
+#include "kernel/kstring.h"
+#include "mm/slab.h"
+
+static kmem_cache_t *fp_state_cache = NULL;
+
+static inline unsigned long fs_read(void) {
+    unsigned long x;
+    asm volatile("csrr %0, sstatus" : "=r"(x));
+    return x & SSTATUS_FS_MASK;
+}
+
+static inline void fs_write(unsigned long fs) {
+    asm volatile("csrc sstatus, %0" :: "r"(SSTATUS_FS_MASK));
+    if (fs) {
+        asm volatile("csrs sstatus, %0" :: "r"(fs));
+    }
+}
+
+static inline void frame_set_fs(struct trap_frame *tf, unsigned long fs) {
+    tf->sstatus = (tf->sstatus & ~SSTATUS_FS_MASK) | fs;
+}
+
+static struct fp_state *fp_state_alloc(void) {
+    if (!fp_state_cache) {
+        fp_state_cache = kmem_cache_create("fp_state", sizeof(struct fp_state), 0, NULL);
+        if (!fp_state_cache) {
+            return NULL;
+        }
+    }
+    struct fp_state *state = kmem_cache_alloc(fp_state_cache);
+    if (state) {
+        kmemset(state, 0, sizeof(*state));
+    }
+    return state;
+}
+
+/* Bring a dirty save area up to date with the live registers */
+static void fpu_flush(struct process *proc) {
+    if (proc->fp_state && fs_read() == SSTATUS_FS_DIRTY) {
+        fpu_save(proc->fp_state);
+        fs_write(SSTATUS_FS_CLEAN);
+    }
+}
+
+int fpu_handle_trap(struct trap_frame *tf) {
+    struct process *proc = process_current();
+    if (!proc || (tf->sstatus & SSTATUS_FS_MASK) != SSTATUS_FS_OFF) {
+        // FPU already on: not an FP instruction we can help with
+        return -1;
+    }
+
+    if (!proc->fp_state) {
+        proc->fp_state = fp_state_alloc();
+        if (!proc->fp_state) {
+            return -1;
+        }
+    }
+
+    // Start from zeroed registers and fcsr, not whatever the last
+    // FP user on this hart left behind
+    fs_write(SSTATUS_FS_INITIAL);
+    fpu_restore(proc->fp_state);
+    fs_write(SSTATUS_FS_CLEAN);
+    frame_set_fs(tf, SSTATUS_FS_CLEAN);
+    return 0;
+}
+
+void fpu_switch(struct process *old, struct process *new) {
+    if (old) {
+        fpu_flush(old);
+    }
+
+    if (new && new->fp_state) {
+        fs_write(SSTATUS_FS_INITIAL);
+        fpu_restore(new->fp_state);
+        fs_write(SSTATUS_FS_CLEAN);
+    } else {
+        fs_write(SSTATUS_FS_OFF);
+    }
+}
+
+int fpu_fork(struct process *parent, struct process *child) {
+    child->fp_state = NULL;
+    if (!parent->fp_state) {
+        return 0;
+    }
+
+    child->fp_state = fp_state_alloc();
+    if (!child->fp_state) {
+        return -1;
+    }
+    fpu_flush(parent);
+    kmemcpy(child->fp_state, parent->fp_state, sizeof(struct fp_state));
+    return 0;
+}
+
+void fpu_release(struct process *proc, struct trap_frame *tf) {
+    if (proc->fp_state) {
+        kmem_cache_free(fp_state_cache, proc->fp_state);
+        proc->fp_state = NULL;
+    }
+    if (tf) {
+        frame_set_fs(tf, SSTATUS_FS_OFF);
+    }
+    if (proc == process_current()) {
+        fs_write(SSTATUS_FS_OFF);
+    }
+}
+
+void fpu_sync_frame(struct trap_frame *tf) {
+    frame_set_fs(tf, fs_read());
+}
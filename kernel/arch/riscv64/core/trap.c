@@ -10,9 +10,18 @@
 #include "kernel/signal.h"
 #include "kernel/kstring.h"
 #include "kernel/constants.h"
-
-/* Forward declaration for external interrupt handler */
-void handle_external_interrupt(void);
+#include "kernel/smp.h"
+#include "kernel/scheduler.h"
+#include "kernel/softirq.h"
+#include "kernel/prof.h"
+#include "kernel/trace.h"
+#include "kernel/schedlat.h"
+#include "kernel/acct.h"
+#include "kernel/uaccess.h"
+#include "mm/paging.h"
+#include "mm/kstack.h"
+#include "arch/fpu.h"
+#include "arch/interrupt.h"
 
 // CSR read helpers
 static inline unsigned long read_scause(void) {
@@ -76,29 +85,66 @@ static void print_hex(unsigned long val) {
     hal_uart_puts(buf);
 }
 
+// Handle an ECALL from user mode (syscall)
+static void handle_syscall(struct trap_frame *tf) {
+    // Call syscall handler with trap frame, for syscalls that need full
+    // register state (fork)
+    uint64_t syscall_num = tf->a7;
+    
+    trace_event(TRACE_SYSCALL_ENTER, syscall_num, tf->a0);
+    uint64_t ret = syscall_handler_with_frame(tf, syscall_num, tf->a0, tf->a1, tf->a2, tf->a3, tf->a4, tf->a5);
+    trace_event(TRACE_SYSCALL_EXIT, syscall_num, ret);
+    
+    // Special case: execve success - trap frame already configured for new program
+    // Don't modify a0 or sepc
+    if (syscall_num == SYS_EXECVE && ret == 0) {
+        return;
+    }
+    
+    // Store return value in a0
+    tf->a0 = ret;
+    
+    // Advance sepc past the ECALL instruction (4 bytes)
+    tf->sepc += 4;
+}
+
 // Handle exceptions (synchronous traps)
 static void handle_exception(struct trap_frame *tf, unsigned long cause) {
     // Check if this is an ECALL from user mode (syscall)
     if (cause == CAUSE_USER_ECALL) {
-        // System call - pass trap frame for syscalls that need full register state (fork)
-        
-        // Call syscall handler with trap frame
-        uint64_t syscall_num = tf->a7;
-        
-        uint64_t ret = syscall_handler_with_frame(tf, syscall_num, tf->a0, tf->a1, tf->a2, tf->a3, tf->a4, tf->a5);
-        
-        // Special case: execve success - trap frame already configured for new program
-        // Don't modify a0 or sepc
-        if (syscall_num == SYS_EXECVE && ret == 0) {
+        handle_syscall(tf);
+        return;
+    }
+    
+    // Demand paging and copy-on-write. These also fault in kernel mode
+    // when a syscall touches a user buffer (SUM is set).
+    if (cause == CAUSE_LOAD_PAGE_FAULT || cause == CAUSE_STORE_PAGE_FAULT ||
+        cause == CAUSE_FETCH_PAGE_FAULT) {
+        struct process *proc = process_current();
+        uintptr_t addr = read_stval();
+        if (proc && addr < USER_VIRT_END) {
+            trace_event(TRACE_PAGE_FAULT_ENTER, addr, cause);
+            int result = process_handle_page_fault(proc, addr, cause);
+            trace_event(TRACE_PAGE_FAULT_EXIT, addr, (uint64_t)(int64_t)result);
+            if (result == 0) {
+                return;
+            }
+        }
+    }
+    
+    // A user copy that hit an address it may not touch: resume at its
+    // fixup, which fails the copy with EFAULT
+    if (!trap_from_user_mode()) {
+        uintptr_t fixup = uaccess_fixup(tf->sepc);
+        if (fixup) {
+            tf->sepc = fixup;
             return;
         }
-        
-        // Store return value in a0
-        tf->a0 = ret;
-        
-        // Advance sepc past the ECALL instruction (4 bytes)
-        tf->sepc += 4;
-        
+    }
+    
+    // First FP instruction of a process: turn the FPU on and retry it
+    if (cause == CAUSE_ILLEGAL_INSTRUCTION && trap_from_user_mode() &&
+        fpu_handle_trap(tf) == 0) {
         return;
     }
     
@@ -149,9 +195,9 @@ static void handle_exception(struct trap_frame *tf, unsigned long cause) {
         print_hex(tf->a2);
         hal_uart_puts("\n");
         
-        // Terminate the user process
-        extern void process_exit(int) __attribute__((noreturn));
-        process_exit(-1);  // Exit with error code
+        // Terminate the user process, all its threads
+        extern void process_exit_group(int) __attribute__((noreturn));
+        process_exit_group(-1);  // Exit with error code
         
         return;  // Should not reach here
     }
@@ -174,6 +220,14 @@ static void handle_exception(struct trap_frame *tf, unsigned long cause) {
     print_hex(cause);
     hal_uart_puts("\n");
     
+    // A fault on a guard below a process's kernel stack
+    if ((cause == CAUSE_LOAD_PAGE_FAULT || cause == CAUSE_STORE_PAGE_FAULT) &&
+        kstack_is_guard(read_stval())) {
+        hal_uart_puts("Kernel stack overflow (sp ");
+        print_hex(tf->sp);
+        hal_uart_puts(")\n");
+    }
+    
     // Halt system
     hal_uart_puts("System halted.\n");
     while (1) {
@@ -182,20 +236,28 @@ static void handle_exception(struct trap_frame *tf, unsigned long cause) {
 }
 
 // Handle interrupts (asynchronous traps)
-static void handle_interrupt(struct trap_frame *tf __attribute__((unused)), unsigned long cause) {
+static void handle_interrupt(struct trap_frame *tf, unsigned long cause,
+                             unsigned long trap_time_us) {
     cause &= ~INTERRUPT_BIT; // Remove interrupt bit
     
     switch (cause) {
         case IRQ_S_TIMER:
             // Handle timer interrupt (scheduler is called inside)
+            trace_event(TRACE_IRQ_ENTER, IRQ_S_TIMER, 0);
+            prof_tick(tf);
             hal_timer_handle_interrupt();
+            trace_event(TRACE_IRQ_EXIT, IRQ_S_TIMER, 0);
             break;
         case IRQ_S_SOFT:
-            hal_uart_puts("Software interrupt\n");
+            // Reschedule IPI from another CPU
+            trace_event(TRACE_IRQ_ENTER, IRQ_S_SOFT, 0);
+            asm volatile("csrc sip, %0" :: "r"(SIP_SSIP));
+            scheduler_ipi();
+            trace_event(TRACE_IRQ_EXIT, IRQ_S_SOFT, 0);
             break;
         case IRQ_S_EXTERNAL:
-            // Handle external interrupt via PLIC
-            handle_external_interrupt();
+            // Handle external interrupt via PLIC (traced per source there)
+            handle_external_interrupt(trap_time_us);
             break;
         default:
             hal_uart_puts("Unknown interrupt: ");
@@ -205,33 +267,122 @@ static void handle_interrupt(struct trap_frame *tf __attribute__((unused)), unsi
     }
 }
 
+// Work before returning from a trap: signals, stops, FP state
+static void trap_exit_work(struct trap_frame *tf) {
+    // Deliver pending signals before returning to user mode. A trap taken
+    // in the kernel (a softirq, a kernel thread) returns to kernel code,
+    // which the signal frame must not replace.
+    struct process *current = process_current();
+    if (current) {
+        if (!(tf->sstatus & (1UL << SSTATUS_SPP_BIT))) {
+            // Deliver any pending signals, passing the trap frame so signal
+            // handler can modify it to redirect execution. Only ra, sepc and
+            // a0 are touched, which fast path frames have too.
+            signal_deliver_with_frame(current, tf);
+            
+            // If signal caused process to stop (SIGTSTP/SIGSTOP), we need to
+            // reschedule so we don't return to user mode for a stopped process
+            if (current->state == PROC_STOPPED) {
+                extern void schedule(void);
+                schedule();
+                // When we return here, this process was resumed via SIGCONT/fg
+            }
+        }
+        
+        // sret restores sstatus from the frame: keep the FS state current
+        fpu_sync_frame(tf);
+    }
+}
+
 // Main trap handler called from trap.S
 void trap_handler(struct trap_frame *tf) {
     unsigned long cause = read_scause();
     
+    // Device interrupt latency counts the wait for the BKL as well
+    unsigned long trap_time_us = 0;
+    if (cause == (INTERRUPT_BIT | IRQ_S_EXTERNAL)) {
+        trap_time_us = hal_timer_get_time_us();
+    }
+    
+#ifdef SCHEDLAT_IRQOFF
+    // Interrupts were on where the trap came from: no section is open
+    if (tf->sstatus & (1UL << SSTATUS_SPIE_BIT)) {
+        schedlat_irqs_were_on();
+    }
+#endif
+    
+    // User time ends here; waiting for the BKL is system time
+    acct_trap_enter(tf);
+    
+    // Entering the kernel from user mode or the idle loop: serialise with
+    // the other CPUs. A trap in kernel code already holding it nests.
+    int bkl_taken = !bkl_held();
+    if (bkl_taken) {
+        bkl_acquire();
+    }
+    
     if (cause & INTERRUPT_BIT) {
-        // Asynchronous trap (interrupt)
-        handle_interrupt(tf, cause);
+        // Asynchronous trap (interrupt), then the work its handlers deferred
+        handle_interrupt(tf, cause, trap_time_us);
+        do_softirq();
     } else {
         // Synchronous trap (exception)
         handle_exception(tf, cause);
     }
     
-    // Deliver pending signals before returning to user mode
-    struct process *current = process_current();
-    if (current) {
-        // Deliver any pending signals, passing the trap frame so signal
-        // handler can modify it to redirect execution
-        signal_deliver_with_frame(current, tf);
-        
-        // If signal caused process to stop (SIGTSTP/SIGSTOP), we need to
-        // reschedule so we don't return to user mode for a stopped process
-        if (current->state == PROC_STOPPED) {
-            extern void schedule(void);
-            schedule();
-            // When we return here, this process was resumed via SIGCONT/fg
+    trap_exit_work(tf);
+    acct_trap_exit(tf);
+    
+    if (bkl_taken) {
+        bkl_release();
+    }
+}
+
+// Fast path for syscalls and timer ticks, called from trap_entry.S with a
+// frame missing s0-s11. Returns nonzero, having done nothing, if the trap
+// needs them; trap_entry.S then completes the frame and calls trap_handler().
+int trap_fast_handler(struct trap_frame *tf) {
+    unsigned long cause = read_scause();
+    
+    if (cause == CAUSE_USER_ECALL) {
+        const syscall_entry_t *entry = syscall_lookup(tf->a7);
+        if (entry && (entry->flags & SYSCALL_NEEDS_FRAME)) {
+            return 1;
         }
+    } else if (prof_running()) {
+        // A sample of kernel code walks the frame pointer, which is in s0
+        return 1;
+    }
+    
+#ifdef SCHEDLAT_IRQOFF
+    if (tf->sstatus & (1UL << SSTATUS_SPIE_BIT)) {
+        schedlat_irqs_were_on();
+    }
+#endif
+    
+    acct_trap_enter(tf);
+    
+    int bkl_taken = !bkl_held();
+    if (bkl_taken) {
+        bkl_acquire();
+    }
+    
+    if (cause == CAUSE_USER_ECALL) {
+        handle_syscall(tf);
+    } else {
+        // Handle timer interrupt (scheduler is called inside)
+        trace_event(TRACE_IRQ_ENTER, IRQ_S_TIMER, 0);
+        hal_timer_handle_interrupt();
+        trace_event(TRACE_IRQ_EXIT, IRQ_S_TIMER, 0);
+    }
+    
+    trap_exit_work(tf);
+    acct_trap_exit(tf);
+    
+    if (bkl_taken) {
+        bkl_release();
     }
+    return 0;
 }
 
 // Initialize trap handling
@@ -7,10 +7,46 @@
 #include "arch/plic.h"
 #include "arch/clint.h"
 #include "trap.h"
+#include "hal/hal_timer.h"
+#include "kernel/smp.h"
+#include "kernel/constants.h"
+#include "kernel/kstring.h"
+#include "kernel/process.h"
+#include "kernel/scheduler.h"
+#include "kernel/schedlat.h"
+#include "kernel/trace.h"
+#include "kernel/wait_queue.h"
 #include <stddef.h>
 
-/* Interrupt handler table */
-static interrupt_handler_t interrupt_handlers[MAX_INTERRUPT_SOURCES] = {NULL};
+/* Interrupts claimed in one trap before letting the trap return */
+#define IRQ_CLAIM_MAX 16
+
+/* Per-IRQ state */
+typedef struct {
+    interrupt_handler_t handler;
+    interrupt_hard_handler_t hard_handler;  /* Threaded: quiets the device */
+    interrupt_handler_t thread_fn;      /* Threaded: the rest of the work */
+    struct process *thread;             /* Runs thread_fn; NULL: the trap does */
+    wait_queue_t thread_wait;
+    bool thread_pending;                /* thread_fn has work */
+    unsigned long thread_woken_us;      /* When it was given the work */
+    char name[IRQ_NAME_MAX];
+    uint32_t priority;
+    uint32_t affinity;                  /* CPUs allowed to take it */
+    int target;                         /* CPU whose context has it enabled */
+    bool enabled;
+    bool masked;                        /* One shot: off until thread_fn ran */
+    interrupt_stats_t stats;
+} irq_desc_t;
+
+/* Interrupt descriptor table */
+static irq_desc_t irq_descs[MAX_INTERRUPT_SOURCES];
+
+/* Set by interrupt_start_threads(); until then thread functions run inline */
+static bool irq_threads_started = false;
+
+/* Priority threshold of each CPU's context */
+static uint32_t cpu_thresholds[MAX_CPUS];
 
 /* CSR definitions for interrupt enable/disable */
 #define CSR_SSTATUS 0x100
@@ -47,8 +83,36 @@ static void configure_default_priorities(void)
     /* Set all interrupts to normal priority by default */
     for (irq_number = 1; irq_number < MAX_INTERRUPT_SOURCES; irq_number++)
     {
-        plic_set_priority(irq_number, IRQ_PRIORITY_NORMAL);
+        interrupt_set_priority(irq_number, IRQ_PRIORITY_NORMAL);
+    }
+}
+
+/*
+ * PLIC context of a logical CPU
+ */
+static uint32_t cpu_context(int cpu_id)
+{
+    struct cpu *cpu = cpu_get(cpu_id);
+    
+    return PLIC_CONTEXT_SUPERVISOR(cpu ? cpu->hartid : 0);
+}
+
+/*
+ * The CPU of a mask that takes its IRQs: the lowest one online, or -1
+ */
+static int pick_target(uint32_t cpu_mask)
+{
+    int cpu_id = 0;
+    
+    for (cpu_id = 0; cpu_id < MAX_CPUS; cpu_id++)
+    {
+        struct cpu *cpu = cpu_get(cpu_id);
+        if ((cpu_mask & (1U << cpu_id)) && cpu != NULL && cpu->online)
+        {
+            return cpu_id;
+        }
     }
+    return -1;
 }
 
 /*
@@ -58,14 +122,25 @@ void interrupt_init(void)
 {
     uint32_t handler_index = 0;
     
-    /* Clear all registered handlers */
+    /* Clear all registered handlers; every IRQ goes to the boot CPU */
+    kmemset(irq_descs, 0, sizeof(irq_descs));
     for (handler_index = 0; handler_index < MAX_INTERRUPT_SOURCES; handler_index++)
     {
-        interrupt_handlers[handler_index] = NULL;
+        irq_descs[handler_index].affinity = IRQ_AFFINITY_ALL;
+        irq_descs[handler_index].target = 0;
+        wait_queue_init(&irq_descs[handler_index].thread_wait);
     }
+    kmemset(cpu_thresholds, 0, sizeof(cpu_thresholds));
     
-    /* Initialize PLIC (Platform-Level Interrupt Controller) */
+    /* Initialize PLIC (Platform-Level Interrupt Controller); the boot
+     * hart's context here, the others' as they come online */
     plic_init();
+    plic_init_context(cpu_context(0));
+    
+    /* External interrupts reach the supervisor only with SEIE set; the
+     * PLIC context has every source disabled until a driver enables one,
+     * and sstatus.SIE stays off until interrupt_enable() */
+    __asm__ volatile("csrs sie, %0" :: "r"(SIE_SEIE));
     
     /* Initialize CLINT (Core-Local Interruptor) */
     // NOTE: CLINT init disabled for QEMU 10.1.2 with ACLINT - different memory layout
@@ -83,6 +158,9 @@ void interrupt_init(void)
  */
 void interrupt_enable(void)
 {
+#ifdef SCHEDLAT_IRQOFF
+    schedlat_irqs_on();
+#endif
     enable_supervisor_interrupts();
 }
 
@@ -105,6 +183,13 @@ int interrupt_save_disable(void)
     
     disable_supervisor_interrupts();
     
+#ifdef SCHEDLAT_IRQOFF
+    /* Only the outermost call opens a section */
+    if (sstatus & SSTATUS_SIE) {
+        schedlat_irqs_off((uintptr_t)__builtin_return_address(0));
+    }
+#endif
+    
     /* Return 1 if interrupts were enabled, 0 otherwise */
     return (sstatus & SSTATUS_SIE) ? 1 : 0;
 }
@@ -115,34 +200,237 @@ int interrupt_save_disable(void)
 void interrupt_restore(int state)
 {
     if (state) {
+#ifdef SCHEDLAT_IRQOFF
+        schedlat_irqs_on();
+#endif
         enable_supervisor_interrupts();
     }
 }
 
 /*
- * Register an interrupt handler for a specific IRQ
+ * Check whether an IRQ has a handler of either kind
  */
-bool interrupt_register_handler(uint32_t irq_number, interrupt_handler_t handler)
+static bool irq_in_use(const irq_desc_t *desc)
 {
+    return desc->handler != NULL || desc->thread_fn != NULL;
+}
+
+/*
+ * Take a free IRQ for a new handler: name it and clear its statistics
+ *
+ * The name (cut to IRQ_NAME_MAX - 1 characters) labels the IRQ's
+ * statistics.
+ */
+static bool irq_desc_claim(uint32_t irq_number, const char *name)
+{
+    irq_desc_t *desc = NULL;
+    
     if (irq_number == 0 || irq_number >= MAX_INTERRUPT_SOURCES)
     {
         return false;  /* Invalid IRQ number */
     }
     
+    desc = &irq_descs[irq_number];
+    if (irq_in_use(desc))
+    {
+        return false;  /* Handler already registered */
+    }
+    
+    kstrncpy(desc->name, name ? name : "", IRQ_NAME_MAX - 1);
+    desc->name[IRQ_NAME_MAX - 1] = '\0';
+    kmemset(&desc->stats, 0, sizeof(interrupt_stats_t));
+    return true;
+}
+
+/*
+ * Register an interrupt handler for a specific IRQ
+ */
+bool interrupt_register_handler(uint32_t irq_number, interrupt_handler_t handler,
+                                const char *name)
+{
     if (handler == NULL)
     {
         return false;  /* Invalid handler */
     }
     
-    if (interrupt_handlers[irq_number] != NULL)
+    if (!irq_desc_claim(irq_number, name))
     {
-        return false;  /* Handler already registered */
+        return false;
     }
     
-    interrupt_handlers[irq_number] = handler;
+    irq_descs[irq_number].handler = handler;
     return true;
 }
 
+/*
+ * Run an IRQ's thread function and account for it
+ */
+static void irq_run_thread_fn(irq_desc_t *desc, unsigned long woken_us)
+{
+    unsigned long start_us = hal_timer_get_time_us();
+    unsigned long run_us = 0;
+    
+    desc->thread_fn();
+    run_us = hal_timer_get_time_us() - start_us;
+    
+    desc->stats.thread_count++;
+    desc->stats.thread_total_us += run_us;
+    if (run_us > desc->stats.thread_max_us)
+    {
+        desc->stats.thread_max_us = run_us;
+    }
+    if (start_us > woken_us && start_us - woken_us > desc->stats.thread_max_latency_us)
+    {
+        desc->stats.thread_max_latency_us = start_us - woken_us;
+    }
+}
+
+/*
+ * Body of an IRQ thread: run the thread function each time the hard
+ * handler hands it work, then unmask a one-shot IRQ
+ */
+static void irq_thread_main(void *arg)
+{
+    irq_desc_t *desc = (irq_desc_t *)arg;
+    uint32_t irq_number = (uint32_t)(desc - irq_descs);
+    
+    for (;;)
+    {
+        int irq_state = interrupt_save_disable();
+        unsigned long woken_us = 0;
+        
+        /* Interrupts stay off from the check until we are on the wait
+         * queue, so a wake-up in between cannot be missed */
+        while (!desc->thread_pending)
+        {
+            wait_queue_sleep_irqoff(&desc->thread_wait);
+        }
+        desc->thread_pending = false;
+        woken_us = desc->thread_woken_us;
+        interrupt_restore(irq_state);
+        
+        if (desc->thread_fn != NULL)
+        {
+            irq_run_thread_fn(desc, woken_us);
+        }
+        
+        if (desc->masked)
+        {
+            irq_state = interrupt_save_disable();
+            desc->masked = false;
+            if (desc->enabled)
+            {
+                plic_enable_interrupt(irq_number, cpu_context(desc->target));
+            }
+            interrupt_restore(irq_state);
+        }
+        
+        /* Let other CPUs into the kernel between runs */
+        bkl_relax();
+    }
+}
+
+/*
+ * Create the thread of a threaded IRQ, "irq/<n>-<name>"
+ */
+static bool irq_thread_create(uint32_t irq_number)
+{
+    irq_desc_t *desc = &irq_descs[irq_number];
+    char name[PROC_NAME_LEN];
+    char digits[4];
+    size_t len = 0;
+    int ndigits = 0;
+    uint32_t n = irq_number;
+    struct process *proc = NULL;
+    
+    kstrcpy(name, "irq/");
+    len = kstrlen(name);
+    do
+    {
+        digits[ndigits++] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n > 0);
+    while (ndigits > 0)
+    {
+        name[len++] = digits[--ndigits];
+    }
+    name[len++] = '-';
+    kstrncpy(name + len, desc->name, PROC_NAME_LEN - 1 - len);
+    name[PROC_NAME_LEN - 1] = '\0';
+    
+    proc = kthread_create(name, irq_thread_main, desc);
+    if (proc == NULL)
+    {
+        return false;  /* errno already set by kthread_create */
+    }
+    
+    proc->base_priority = IRQ_THREAD_PRIORITY;
+    proc->sched_policy = SCHED_RR;
+    scheduler_set_priority(proc, IRQ_THREAD_PRIORITY);
+    desc->thread = proc;
+    return true;
+}
+
+/*
+ * Register a threaded interrupt handler for a specific IRQ
+ */
+bool interrupt_register_threaded(uint32_t irq_number, interrupt_hard_handler_t handler,
+                                 interrupt_handler_t thread_fn, const char *name)
+{
+    if (thread_fn == NULL)
+    {
+        return false;  /* Invalid handler */
+    }
+    
+    if (!irq_desc_claim(irq_number, name))
+    {
+        return false;
+    }
+    
+    irq_descs[irq_number].hard_handler = handler;
+    irq_descs[irq_number].thread_fn = thread_fn;
+    if (irq_threads_started && irq_descs[irq_number].thread == NULL)
+    {
+        /* Without a thread the work stays in the trap */
+        irq_thread_create(irq_number);
+    }
+    return true;
+}
+
+/*
+ * Create the threads of the threaded IRQs registered so far
+ */
+int interrupt_start_threads(void)
+{
+    uint32_t irq_number = 0;
+    int result = 0;
+    
+    for (irq_number = 1; irq_number < MAX_INTERRUPT_SOURCES; irq_number++)
+    {
+        irq_desc_t *desc = &irq_descs[irq_number];
+        if (desc->thread_fn != NULL && desc->thread == NULL && !irq_thread_create(irq_number))
+        {
+            result = -1;  /* errno already set by kthread_create */
+        }
+    }
+    
+    irq_threads_started = true;
+    return result;
+}
+
+/*
+ * PID of an IRQ's thread, 0 if it has none
+ */
+int interrupt_get_thread_pid(uint32_t irq_number)
+{
+    if (irq_number == 0 || irq_number >= MAX_INTERRUPT_SOURCES)
+    {
+        return 0;
+    }
+    
+    return irq_descs[irq_number].thread ? irq_descs[irq_number].thread->pid : 0;
+}
+
 /*
  * Unregister an interrupt handler
  */
@@ -153,7 +441,10 @@ void interrupt_unregister_handler(uint32_t irq_number)
         return;  /* Invalid IRQ number */
     }
     
-    interrupt_handlers[irq_number] = NULL;
+    /* A thread stays parked on its wait queue */
+    irq_descs[irq_number].handler = NULL;
+    irq_descs[irq_number].hard_handler = NULL;
+    irq_descs[irq_number].thread_fn = NULL;
 }
 
 /*
@@ -171,22 +462,38 @@ void interrupt_set_priority(uint32_t irq_number, uint32_t priority)
         priority = IRQ_PRIORITY_HIGHEST;
     }
     
+    irq_descs[irq_number].priority = priority;
     plic_set_priority(irq_number, priority);
 }
 
+/*
+ * Get the priority of a specific interrupt
+ */
+uint32_t interrupt_get_priority(uint32_t irq_number)
+{
+    if (irq_number == 0 || irq_number >= MAX_INTERRUPT_SOURCES)
+    {
+        return IRQ_PRIORITY_DISABLED;
+    }
+    
+    return irq_descs[irq_number].priority;
+}
+
 /*
  * Enable a specific IRQ
  */
 void interrupt_enable_irq(uint32_t irq_number)
 {
-    uint32_t context = PLIC_CONTEXT_SUPERVISOR_HART0;
-    
     if (irq_number == 0 || irq_number >= MAX_INTERRUPT_SOURCES)
     {
         return;  /* Invalid IRQ number */
     }
     
-    plic_enable_interrupt(irq_number, context);
+    irq_descs[irq_number].enabled = true;
+    if (!irq_descs[irq_number].masked)
+    {
+        plic_enable_interrupt(irq_number, cpu_context(irq_descs[irq_number].target));
+    }
 }
 
 /*
@@ -194,43 +501,271 @@ void interrupt_enable_irq(uint32_t irq_number)
  */
 void interrupt_disable_irq(uint32_t irq_number)
 {
-    uint32_t context = PLIC_CONTEXT_SUPERVISOR_HART0;
-    
     if (irq_number == 0 || irq_number >= MAX_INTERRUPT_SOURCES)
     {
         return;  /* Invalid IRQ number */
     }
     
-    plic_disable_interrupt(irq_number, context);
+    irq_descs[irq_number].enabled = false;
+    plic_disable_interrupt(irq_number, cpu_context(irq_descs[irq_number].target));
 }
 
 /*
- * Handle external interrupts from PLIC
- * Called by the trap handler when an external interrupt occurs
+ * Set which CPUs may take a specific IRQ
+ *
+ * Runs under the big kernel lock, as the external interrupt handler
+ * does, so the IRQ is never moved between its claim and its completion
+ * (the PLIC ignores a completion from a context it is not enabled in).
+ */
+bool interrupt_set_affinity(uint32_t irq_number, uint32_t cpu_mask)
+{
+    irq_desc_t *desc = NULL;
+    int target = 0;
+    
+    if (irq_number == 0 || irq_number >= MAX_INTERRUPT_SOURCES)
+    {
+        return false;  /* Invalid IRQ number */
+    }
+    
+    target = pick_target(cpu_mask);
+    if (target < 0)
+    {
+        return false;  /* No CPU of the mask is online */
+    }
+    
+    desc = &irq_descs[irq_number];
+    if (desc->enabled && !desc->masked && target != desc->target)
+    {
+        plic_disable_interrupt(irq_number, cpu_context(desc->target));
+        plic_enable_interrupt(irq_number, cpu_context(target));
+    }
+    desc->affinity = cpu_mask & IRQ_AFFINITY_ALL;
+    desc->target = target;
+    return true;
+}
+
+/*
+ * Get the affinity mask of a specific IRQ
+ */
+uint32_t interrupt_get_affinity(uint32_t irq_number)
+{
+    if (irq_number == 0 || irq_number >= MAX_INTERRUPT_SOURCES)
+    {
+        return 0;
+    }
+    
+    return irq_descs[irq_number].affinity;
+}
+
+/*
+ * Get the CPU that takes a specific IRQ, or -1 for an invalid IRQ
+ */
+int interrupt_get_target(uint32_t irq_number)
+{
+    if (irq_number == 0 || irq_number >= MAX_INTERRUPT_SOURCES)
+    {
+        return -1;
+    }
+    
+    return irq_descs[irq_number].target;
+}
+
+/*
+ * Set the priority threshold of a CPU
  */
-void handle_external_interrupt(void)
+void interrupt_set_threshold(int cpu_id, uint32_t threshold)
 {
-    uint32_t context = PLIC_CONTEXT_SUPERVISOR_HART0;
+    struct cpu *cpu = cpu_get(cpu_id);
+    
+    if (cpu == NULL)
+    {
+        return;  /* Invalid CPU */
+    }
+    
+    if (threshold > IRQ_PRIORITY_HIGHEST)
+    {
+        threshold = IRQ_PRIORITY_HIGHEST;
+    }
+    
+    cpu_thresholds[cpu_id] = threshold;
+    plic_set_threshold(threshold, PLIC_CONTEXT_SUPERVISOR(cpu->hartid));
+}
+
+/*
+ * Get the priority threshold of a CPU
+ */
+uint32_t interrupt_get_threshold(int cpu_id)
+{
+    if (cpu_get(cpu_id) == NULL)
+    {
+        return 0;
+    }
+    
+    return cpu_thresholds[cpu_id];
+}
+
+/*
+ * Get the statistics of a specific IRQ
+ */
+bool interrupt_get_stats(uint32_t irq_number, interrupt_stats_t *stats)
+{
+    if (irq_number == 0 || irq_number >= MAX_INTERRUPT_SOURCES)
+    {
+        return false;  /* Invalid IRQ number */
+    }
+    
+    if (!irq_in_use(&irq_descs[irq_number]))
+    {
+        return false;  /* Nothing registered */
+    }
+    
+    *stats = irq_descs[irq_number].stats;
+    return true;
+}
+
+/*
+ * Get the name a specific IRQ was registered with
+ */
+const char *interrupt_get_name(uint32_t irq_number)
+{
+    if (irq_number == 0 || irq_number >= MAX_INTERRUPT_SOURCES)
+    {
+        return "";
+    }
+    
+    return irq_descs[irq_number].name;
+}
+
+/*
+ * Set up the calling CPU's PLIC context
+ */
+void interrupt_init_cpu(void)
+{
+    struct cpu *cpu = cpu_this();
+    uint32_t context = PLIC_CONTEXT_SUPERVISOR(cpu->hartid);
     uint32_t irq_number = 0;
-    interrupt_handler_t handler = NULL;
     
-    /* Claim the interrupt */
-    irq_number = plic_claim_interrupt(context);
+    plic_init_context(context);
+    plic_set_threshold(cpu_thresholds[cpu->id], context);
     
-    if (irq_number == 0)
+    for (irq_number = 1; irq_number < MAX_INTERRUPT_SOURCES; irq_number++)
     {
-        return;  /* No interrupt pending */
+        if (irq_descs[irq_number].enabled && !irq_descs[irq_number].masked &&
+            irq_descs[irq_number].target == cpu->id)
+        {
+            plic_enable_interrupt(irq_number, context);
+        }
     }
     
-    /* Get the registered handler */
-    handler = interrupt_handlers[irq_number];
+    __asm__ volatile("csrs sie, %0" :: "r"(SIE_SEIE));
+}
+
+/*
+ * Hand a threaded IRQ's work to its thread, after the claim is complete
+ *
+ * A one-shot IRQ is masked in the claiming context until the thread has
+ * run; masking it before the completion would lose that (the PLIC
+ * ignores a completion for a source not enabled in the context).
+ */
+static void irq_wake_thread(uint32_t irq_number, irq_desc_t *desc, uint32_t context)
+{
+    unsigned long now_us = hal_timer_get_time_us();
     
-    /* Call the handler if registered */
-    if (handler != NULL)
+    if (desc->thread == NULL)
     {
-        handler();
+        irq_run_thread_fn(desc, now_us);
+        return;
     }
     
-    /* Complete the interrupt */
-    plic_complete_interrupt(irq_number, context);
+    if (desc->hard_handler == NULL)
+    {
+        desc->masked = true;
+        plic_disable_interrupt(irq_number, context);
+    }
+    if (!desc->thread_pending)
+    {
+        desc->thread_pending = true;
+        desc->thread_woken_us = now_us;
+    }
+    wait_queue_wake_one(&desc->thread_wait);
+}
+
+/*
+ * Handle external interrupts from PLIC
+ * Called by the trap handler when an external interrupt occurs
+ *
+ * Claims until nothing is pending (at most IRQ_CLAIM_MAX), so a burst
+ * from several devices costs one trap. A source is claimed by one
+ * context at a time and this runs under the big kernel lock, so nothing
+ * else writes an IRQ's statistics meanwhile; an IRQ thread only writes
+ * the thread figures, with this one masked or not looking at them.
+ */
+void handle_external_interrupt(unsigned long trap_time_us)
+{
+    struct cpu *cpu = cpu_this();
+    uint32_t context = PLIC_CONTEXT_SUPERVISOR(cpu->hartid);
+    uint32_t irq_number = 0;
+    int claims = 0;
+    
+    for (claims = 0; claims < IRQ_CLAIM_MAX; claims++)
+    {
+        irq_desc_t *desc = NULL;
+        unsigned long start_us = 0;
+        unsigned long run_us = 0;
+        bool wake_thread = false;
+        
+        /* Claim the interrupt */
+        irq_number = plic_claim_interrupt(context);
+        
+        if (irq_number == 0)
+        {
+            return;  /* No interrupt pending */
+        }
+        
+        if (irq_number >= MAX_INTERRUPT_SOURCES)
+        {
+            plic_complete_interrupt(irq_number, context);
+            continue;
+        }
+        
+        desc = &irq_descs[irq_number];
+        
+        /* Call the handler if registered */
+        if (irq_in_use(desc))
+        {
+            trace_event(TRACE_IRQ_ENTER, IRQ_S_EXTERNAL, irq_number);
+            start_us = hal_timer_get_time_us();
+            if (desc->handler != NULL)
+            {
+                desc->handler();
+            }
+            else
+            {
+                wake_thread = desc->hard_handler == NULL ||
+                              desc->hard_handler() == IRQ_WAKE_THREAD;
+            }
+            run_us = hal_timer_get_time_us() - start_us;
+            trace_event(TRACE_IRQ_EXIT, IRQ_S_EXTERNAL, irq_number);
+            
+            desc->stats.count++;
+            desc->stats.cpu_count[cpu->id]++;
+            desc->stats.total_us += run_us;
+            if (run_us > desc->stats.max_us)
+            {
+                desc->stats.max_us = run_us;
+            }
+            if (start_us > trap_time_us && start_us - trap_time_us > desc->stats.max_latency_us)
+            {
+                desc->stats.max_latency_us = start_us - trap_time_us;
+            }
+        }
+        
+        /* Complete the interrupt */
+        plic_complete_interrupt(irq_number, context);
+        
+        if (wake_thread)
+        {
+            irq_wake_thread(irq_number, desc, context);
+        }
+    }
 }
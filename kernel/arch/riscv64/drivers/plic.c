@@ -20,24 +20,31 @@
 
 /*
  * Initialize the PLIC
+ * Each hart's context is set up with plic_init_context()
  */
 void plic_init(void)
 {
     uint32_t irq_number = 0;
-    uint32_t word_index = 0;
-    uint32_t context = PLIC_CONTEXT_SUPERVISOR_HART0;
-
-    /* Disable all interrupts for supervisor context */
-    for (word_index = 0; word_index < PLIC_ENABLE_WORDS; word_index++)
-    {
-        *PLIC_ENABLE_REG(context, word_index) = 0;
-    }
 
     /* Set all interrupt priorities to 0 (disabled) */
     for (irq_number = 1; irq_number < PLIC_MAX_IRQ; irq_number++)
     {
         *PLIC_PRIORITY_REG(irq_number) = PLIC_PRIORITY_MIN;
     }
+}
+
+/*
+ * Reset a context: every interrupt disabled, threshold 0
+ */
+void plic_init_context(uint32_t context)
+{
+    uint32_t word_index = 0;
+
+    /* Disable all interrupts for the context */
+    for (word_index = 0; word_index < PLIC_ENABLE_WORDS; word_index++)
+    {
+        *PLIC_ENABLE_REG(context, word_index) = 0;
+    }
 
     /* Set priority threshold to 0 (accept all priorities) */
     plic_set_threshold(PLIC_PRIORITY_MIN, context);
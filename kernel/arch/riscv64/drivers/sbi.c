@@ -2,11 +2,21 @@
  * RISC-V Supervisor Binary Interface (SBI)
  * 
  * Provides interface to machine-mode firmware.
+ * 
+ * With -bios none the firmware is our own M-mode code: boot/mtrap.c
+ * answers Base and PMU calls, and the start mailbox stands in for HSM.
  */
 
 #include "arch/sbi.h"
+#include "arch/clint.h"
+#include "arch/barrier.h"
 #include "hal/hal_uart.h"
 #include "mm/paging.h"
+#include "kernel/config.h"
+
+/* Start mailbox, one slot per hart (boot/entry.S) */
+extern volatile unsigned long hart_start_addr[MAX_CPUS];
+extern volatile unsigned long hart_start_opaque[MAX_CPUS];
 
 /**
  * Perform SBI ecall (inline assembly)
@@ -112,3 +122,92 @@ void sbi_reboot(void)
         asm volatile("wfi");
     }
 }
+
+/**
+ * Start a parked hart
+ * 
+ * The parked hart sleeps in M-mode with only its software interrupt
+ * enabled; it wakes, finds its start address and drops to S-mode there.
+ */
+long sbi_hart_start(unsigned long hartid, unsigned long start_addr, unsigned long opaque)
+{
+    if (hartid >= MAX_CPUS || start_addr == 0) {
+        return SBI_ERR_INVALID_PARAM;
+    }
+    if (hart_start_addr[hartid] != 0) {
+        return SBI_ERR_ALREADY_AVAILABLE;
+    }
+    
+    /* The address is the go signal: publish the argument first */
+    hart_start_opaque[hartid] = opaque;
+    memory_barrier();
+    hart_start_addr[hartid] = start_addr;
+    memory_barrier();
+    
+    clint_trigger_software_interrupt((uint32_t)hartid);
+    return SBI_SUCCESS;
+}
+
+/**
+ * Probe for an SBI extension
+ */
+long sbi_probe_extension(long ext)
+{
+    sbi_ret_t ret = sbi_ecall(SBI_EXT_BASE, SBI_BASE_PROBE_EXTENSION, ext, 0, 0, 0, 0, 0);
+    return ret.error == SBI_SUCCESS ? ret.value : 0;
+}
+
+/**
+ * Get the number of PMU counters
+ */
+long sbi_pmu_num_counters(void)
+{
+    sbi_ret_t ret = sbi_ecall(SBI_EXT_PMU, SBI_PMU_NUM_COUNTERS, 0, 0, 0, 0, 0, 0);
+    return ret.error == SBI_SUCCESS ? ret.value : 0;
+}
+
+/**
+ * Get a PMU counter's CSR and width
+ */
+long sbi_pmu_counter_get_info(unsigned long idx, unsigned long *info)
+{
+    sbi_ret_t ret = sbi_ecall(SBI_EXT_PMU, SBI_PMU_COUNTER_GET_INFO, (long)idx, 0, 0, 0, 0, 0);
+    if (ret.error == SBI_SUCCESS) {
+        *info = (unsigned long)ret.value;
+    }
+    return ret.error;
+}
+
+/**
+ * Configure a counter for an event
+ */
+long sbi_pmu_counter_config_matching(unsigned long base, unsigned long mask,
+                                     unsigned long flags, unsigned long event_idx,
+                                     unsigned long event_data, unsigned long *idx)
+{
+    sbi_ret_t ret = sbi_ecall(SBI_EXT_PMU, SBI_PMU_COUNTER_CFG_MATCH, (long)base, (long)mask,
+                              (long)flags, (long)event_idx, (long)event_data, 0);
+    if (ret.error == SBI_SUCCESS) {
+        *idx = (unsigned long)ret.value;
+    }
+    return ret.error;
+}
+
+/**
+ * Start counters
+ */
+long sbi_pmu_counter_start(unsigned long base, unsigned long mask,
+                           unsigned long flags, unsigned long initial)
+{
+    return sbi_ecall(SBI_EXT_PMU, SBI_PMU_COUNTER_START, (long)base, (long)mask,
+                     (long)flags, (long)initial, 0, 0).error;
+}
+
+/**
+ * Stop counters
+ */
+long sbi_pmu_counter_stop(unsigned long base, unsigned long mask, unsigned long flags)
+{
+    return sbi_ecall(SBI_EXT_PMU, SBI_PMU_COUNTER_STOP, (long)base, (long)mask,
+                     (long)flags, 0, 0, 0).error;
+}
@@ -1,19 +1,31 @@
 /*
  * RISC-V Timer Driver - Fresh Implementation
  * 
- * Simple timer interrupt implementation using SSTC extension.
- * Goal: Get continuous 100ms timer interrupts working.
+ * One-shot timer interrupts using the SSTC extension (stimecmp). The
+ * kernel programs each deadline; the tick count is derived from time.
+ * 
+ * Every hart has its own stimecmp. The tick count is global, caught up by
+ * whichever hart takes an interrupt first; each hart charges its running
+ * process for the ticks it has not yet seen.
  */
 
 #include "hal/hal_timer.h"
 #include "hal/hal_uart.h"
 #include "drivers/vterm.h"
 #include "kernel/constants.h"
+#include "kernel/timer_wheel.h"
+#include "kernel/hrtimer.h"
+#include "kernel/rcu.h"
+#include "kernel/scheduler.h"
+#include "kernel/smp.h"
+#include "kernel/softirq.h"
+#include "kernel/vdso.h"
 
 /* Timer frequency TIMER_FREQ_HZ and MICROSECONDS_PER_SECOND from constants.h */
 
 static volatile unsigned long ticks = 0;
 static unsigned long timer_interval_us = 0;
+static unsigned long tick_base_us = 0;     /* Time at which tick 0 began */
 
 static inline unsigned long read_time(void) {
     unsigned long time;
@@ -25,44 +37,112 @@ static inline void write_stimecmp(unsigned long value) {
     asm volatile("csrw 0x14D, %0" :: "r"(value));
 }
 
+// SOFTIRQ_TIMER: run the kernel timers due by the latest tick
+static void timer_softirq(void) {
+    timer_wheel_run(ticks);
+}
+
 void hal_timer_init(unsigned long interval_us) {
     timer_interval_us = interval_us;
-    unsigned long interval_ticks = (TIMER_FREQ_HZ * interval_us) / MICROSECONDS_PER_SECOND;
-    unsigned long next_time = read_time() + interval_ticks;
+    tick_base_us = hal_timer_get_time_us();
+    open_softirq(SOFTIRQ_TIMER, timer_softirq);
     
     // Set first timer deadline
-    write_stimecmp(next_time);
+    hal_timer_set_deadline(hal_timer_tick_time_us(1));
     
     // Enable timer interrupts in sie
     unsigned long sie;
     asm volatile("csrr %0, sie" : "=r"(sie));
     sie |= SIE_STIE;  // Supervisor Timer Interrupt Enable
     asm volatile("csrw sie, %0" :: "r"(sie));
+    
+    // User mode may read time too, for the vDSO clock
+    asm volatile("csrs scounteren, %0" :: "r"(SCOUNTEREN_TM));
+}
+
+void hal_timer_init_cpu(void) {
+    struct cpu *cpu = cpu_this();
+    cpu->ticks_seen = ticks;
+    
+    hal_timer_set_deadline(hal_timer_tick_time_us(ticks + 1));
+    
+    unsigned long sie;
+    asm volatile("csrr %0, sie" : "=r"(sie));
+    sie |= SIE_STIE;
+    asm volatile("csrw sie, %0" :: "r"(sie));
+    asm volatile("csrs scounteren, %0" :: "r"(SCOUNTEREN_TM));
 }
 
 unsigned long hal_timer_get_ticks(void) {
     return ticks;
 }
 
+unsigned long hal_timer_get_time_us(void) {
+    return read_time() / (TIMER_FREQ_HZ / MICROSECONDS_PER_SECOND);
+}
+
+unsigned long hal_timer_tick_time_us(unsigned long tick) {
+    return tick_base_us + tick * timer_interval_us;
+}
+
 void hal_timer_set_next(unsigned long interval_us) {
     unsigned long interval_ticks = (TIMER_FREQ_HZ * interval_us) / MICROSECONDS_PER_SECOND;
     unsigned long next_time = read_time() + interval_ticks;
     write_stimecmp(next_time);
 }
 
+void hal_timer_set_deadline(unsigned long time_us) {
+    if (time_us > HAL_TIMER_NO_DEADLINE / (TIMER_FREQ_HZ / MICROSECONDS_PER_SECOND)) {
+        // Never: stimecmp only fires once time reaches it
+        write_stimecmp(~0UL);
+        return;
+    }
+    write_stimecmp(time_us * (TIMER_FREQ_HZ / MICROSECONDS_PER_SECOND));
+}
+
 void hal_timer_handle_interrupt(void) {
-    ticks++;
+    unsigned long now_us = hal_timer_get_time_us();
     
-    // Schedule next interrupt BEFORE calling scheduler
-    hal_timer_set_next(timer_interval_us);
+    // Catch up on every interval that ended, including ones skipped while
+    // the tick was stopped; early interrupts (hrtimers) advance nothing
+    unsigned long elapsed = timer_interval_us ? (now_us - tick_base_us) / timer_interval_us : 0;
+    unsigned long new_ticks = elapsed > ticks ? elapsed - ticks : 0;
+    ticks += new_ticks;
     
-    // Poll for keyboard input (VT switching, etc.)
-    // This allows switching terminals even when processes don't read input
-    if (vterm_available()) {
+    // Keep the vDSO timebase's delta small
+    if (new_ticks) {
+        vdso_update();
+    }
+    
+    // Poll for keyboard input (VT switching, etc.) unless the UART
+    // interrupts on it; this allows switching terminals even when
+    // processes don't read input
+    if (vterm_available() && vterm_input_needs_polling()) {
         vterm_poll_input();
     }
     
-    // Preemptive multitasking
-    extern void schedule(void);
-    schedule();
+    // Wake sleepers and run other expired kernel timers, and advance RCU,
+    // as softirqs below; hrtimers are due now
+    if (new_ticks) {
+        raise_softirq(SOFTIRQ_TIMER);
+    }
+    if (rcu_pending()) {
+        raise_softirq(SOFTIRQ_RCU);
+    }
+    hrtimer_run(now_us);
+    
+    // Arm the interrupt for whatever comes next (tick, slice end or timer)
+    // BEFORE calling the scheduler, which may switch away; a new slice
+    // reprograms it again
+    hrtimer_reprogram();
+    
+    // Deferred work runs before the scheduler may switch away, so what it
+    // wakes competes for the CPU now
+    do_softirq();
+    
+    // Charge the running process and preempt it if its slice is used up
+    struct cpu *cpu = cpu_this();
+    unsigned long cpu_ticks = ticks - cpu->ticks_seen;
+    cpu->ticks_seen = ticks;
+    scheduler_tick(cpu_ticks);
 }
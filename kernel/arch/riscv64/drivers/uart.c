@@ -6,18 +6,46 @@
  */
 
 #include "hal/hal_uart.h"
+#include "arch/interrupt.h"
+#include "arch/barrier.h"
+#include "kernel/constants.h"
+#include "kernel/spinlock.h"
+#include "kernel/process.h"
+#include "kernel/softirq.h"
+#include "kernel/wait_queue.h"
+#include <stddef.h>
 
-// UART0 base address on QEMU virt machine
+// UART0 base address and PLIC source on QEMU virt machine
 #define UART0_BASE 0x10000000
+#define UART0_IRQ  10
 
 // UART registers (NS16550A)
 #define UART_RBR (UART0_BASE + 0)  // Receiver Buffer Register (read)
 #define UART_THR (UART0_BASE + 0)  // Transmitter Holding Register (write)
+#define UART_IER (UART0_BASE + 1)  // Interrupt Enable Register
+#define UART_IIR (UART0_BASE + 2)  // Interrupt Identification Register (read)
+#define UART_FCR (UART0_BASE + 2)  // FIFO Control Register (write)
 #define UART_LSR (UART0_BASE + 5)  // Line Status Register
 
+// Interrupt Enable Register bits
+#define IER_RX_AVAILABLE (1 << 0)  // Received data available
+#define IER_TX_EMPTY     (1 << 1)  // Transmitter holding register empty
+
+// FIFO Control Register bits
+#define FCR_FIFO_ENABLE  (1 << 0)  // Enable both FIFOs
+#define FCR_RX_CLEAR     (1 << 1)  // Empty the receive FIFO
+#define FCR_RX_TRIGGER_8 (2 << 6)  // Interrupt at 8 received bytes (or on timeout)
+
+// Interrupt Identification Register bits
+#define IIR_FIFO_ENABLED (3 << 6)  // FIFOs present and on
+
 // Line Status Register bits
 #define LSR_DATA_READY (1 << 0)    // Data available to read
 #define LSR_TX_IDLE    (1 << 5)    // Transmitter idle (can write)
+#define LSR_TX_EMPTY   (1 << 6)    // Transmitter and its FIFO empty
+
+// Bytes the transmit FIFO takes once it has emptied
+#define UART_FIFO_SIZE 16
 
 // Helper to write to UART register
 static inline void uart_write_reg(unsigned long addr, unsigned char val) {
@@ -29,6 +57,151 @@ static inline unsigned char uart_read_reg(unsigned long addr) {
     return *(volatile unsigned char *)addr;
 }
 
+// Bytes per fill of an empty THR: the FIFO's depth, or 1 without one
+static unsigned int uart_tx_depth = 1;
+
+// Set once the UART interrupts in both directions and the rings are used
+static int uart_irq_on = 0;
+
+// Diverted output (hal_uart_set_sink()), or NULL
+static volatile hal_uart_sink_t uart_sink = NULL;
+
+/*
+ * Transmit ring
+ *
+ * Output is queued here and moved into the transmit FIFO by the interrupt
+ * as the UART takes it, so a writer returns without waiting for the line.
+ * The THR-empty interrupt is armed only while bytes are waiting. A writer
+ * that finds the ring full sleeps until the interrupt makes room, or sends
+ * the oldest bytes itself when it may not sleep; one running with
+ * interrupts off (panics, traps, interrupt handlers) sends all of it before
+ * returning. Either way output leaves in the order written. Writers come
+ * from anywhere, so the ring is under a spinlock. Head and tail run freely
+ * and are reduced modulo the ring size.
+ */
+
+static char uart_tx_ring[UART_TX_RING_SIZE];
+static uint32_t uart_tx_head = 0;          // Next byte to send
+static uint32_t uart_tx_tail = 0;          // Next free slot
+static int uart_tx_armed = 0;              // IER_TX_EMPTY set
+static spinlock_t uart_tx_lock = SPINLOCK_INIT;
+static wait_queue_t uart_tx_waiters = WAIT_QUEUE_INIT;
+
+/*
+ * Receive ring
+ *
+ * The interrupt moves received bytes from the FIFO into the ring and wakes
+ * readers sleeping in hal_uart_getc(). It has one reader at a time (under
+ * the big kernel lock, or the rx handler in the interrupt) which takes no
+ * lock: the writer publishes a byte by advancing the tail after storing
+ * it, and the reader frees a slot by advancing the head after loading it.
+ * The lock only keeps a polling reader that fills the ring itself (with
+ * interrupts off) from writing at the same time as the interrupt on
+ * another hart. Bytes arriving with the ring full are dropped.
+ */
+
+static char uart_rx_ring[UART_RX_RING_SIZE];
+static volatile uint32_t uart_rx_head = 0; // Next byte to read (reader only)
+static volatile uint32_t uart_rx_tail = 0; // Next free slot (writer only)
+static spinlock_t uart_rx_lock = SPINLOCK_INIT;
+static wait_queue_t uart_rx_waiters = WAIT_QUEUE_INIT;
+
+// Move queued bytes into the THR while it takes them (lock held)
+static void uart_tx_fill(void) {
+    if (uart_tx_head != uart_tx_tail && (uart_read_reg(UART_LSR) & LSR_TX_IDLE)) {
+        // An empty THR with the FIFO on takes a whole FIFO's worth at once
+        for (unsigned int i = 0; i < uart_tx_depth && uart_tx_head != uart_tx_tail; i++) {
+            uart_write_reg(UART_THR, uart_tx_ring[uart_tx_head & (UART_TX_RING_SIZE - 1)]);
+            uart_tx_head++;
+        }
+    }
+    
+    // Interrupt on an empty THR only while there is more for it
+    int armed = uart_tx_head != uart_tx_tail;
+    if (armed != uart_tx_armed) {
+        unsigned char ier = uart_read_reg(UART_IER);
+        uart_write_reg(UART_IER, armed ? (ier | IER_TX_EMPTY) : (ier & ~IER_TX_EMPTY));
+        uart_tx_armed = armed;
+    }
+}
+
+// Wait for the THR, then fill it (lock held)
+static void uart_tx_poll(void) {
+    while ((uart_read_reg(UART_LSR) & LSR_TX_IDLE) == 0)
+        ;
+    uart_tx_fill();
+}
+
+/*
+ * Make room for a byte (lock held, interrupts off). May drop the lock to
+ * sleep when the caller had interrupts on and can, and returns the lock's
+ * interrupt state to restore with, which sleeping leaves on.
+ */
+static int uart_tx_wait_room(int irq_state, int may_sleep) {
+    while (uart_tx_tail - uart_tx_head == UART_TX_RING_SIZE) {
+        if (may_sleep && irq_state && process_current() != NULL && !in_softirq()) {
+            uart_tx_fill();            // Keep the interrupt armed
+            spin_unlock(&uart_tx_lock);
+            wait_queue_sleep(&uart_tx_waiters);
+            irq_state = spin_lock_irqsave(&uart_tx_lock);
+        } else {
+            uart_tx_poll();
+        }
+    }
+    return irq_state;
+}
+
+// Queue a byte with room made for it (lock held)
+static void uart_tx_put(char c) {
+    uart_tx_ring[uart_tx_tail & (UART_TX_RING_SIZE - 1)] = c;
+    uart_tx_tail++;
+}
+
+// Start on what was queued; with interrupts off nothing would, so send it all
+static void uart_tx_start(int irq_state) {
+    if (irq_state) {
+        uart_tx_fill();
+        return;
+    }
+    while (uart_tx_head != uart_tx_tail) {
+        uart_tx_poll();
+    }
+}
+
+// Move received bytes from the FIFO into the ring (interrupts off)
+static int uart_rx_receive(void) {
+    int received = 0;
+    
+    spin_lock(&uart_rx_lock);
+    while (uart_read_reg(UART_LSR) & LSR_DATA_READY) {
+        char c = uart_read_reg(UART_RBR);
+        uint32_t tail = uart_rx_tail;
+        if (tail - uart_rx_head == UART_RX_RING_SIZE) {
+            continue;                  // Full: the byte is lost
+        }
+        uart_rx_ring[tail & (UART_RX_RING_SIZE - 1)] = c;
+        write_barrier();               // The byte is stored before the tail shows it
+        uart_rx_tail = tail + 1;
+        received++;
+    }
+    spin_unlock(&uart_rx_lock);
+    
+    return received;
+}
+
+// Take the oldest received byte, or -1 if there is none
+static int uart_rx_take(void) {
+    uint32_t head = uart_rx_head;
+    if (head == uart_rx_tail) {
+        return -1;
+    }
+    read_barrier();                    // The byte is loaded after the tail that showed it
+    unsigned char c = (unsigned char)uart_rx_ring[head & (UART_RX_RING_SIZE - 1)];
+    memory_barrier();                  // ...and before the slot is handed back
+    uart_rx_head = head + 1;
+    return c;
+}
+
 /*
  * HAL Implementation
  */
@@ -42,9 +215,38 @@ void hal_uart_init(void) {
     // - Data bits (8)
     // - Stop bits (1)
     // - Parity (none)
+    
+    // Turn the FIFOs on once the firmware's last bytes are out (changing
+    // the enable bit empties them); keep to one byte at a time without
+    while ((uart_read_reg(UART_LSR) & LSR_TX_EMPTY) == 0)
+        ;
+    uart_write_reg(UART_FCR, FCR_FIFO_ENABLE | FCR_RX_CLEAR | FCR_RX_TRIGGER_8);
+    if ((uart_read_reg(UART_IIR) & IIR_FIFO_ENABLED) == IIR_FIFO_ENABLED) {
+        uart_tx_depth = UART_FIFO_SIZE;
+    }
+}
+
+void hal_uart_set_sink(hal_uart_sink_t sink) {
+    uart_sink = sink;
 }
 
 void hal_uart_putc(char c) {
+    hal_uart_sink_t sink = uart_sink;
+    if (sink) {
+        sink(c);
+        return;
+    }
+    
+    if (uart_irq_on) {
+        // Never sleeps: this is the kernel's print path from any context
+        int irq_state = spin_lock_irqsave(&uart_tx_lock);
+        irq_state = uart_tx_wait_room(irq_state, 0);
+        uart_tx_put(c);
+        uart_tx_start(irq_state);
+        spin_unlock_irqrestore(&uart_tx_lock, irq_state);
+        return;
+    }
+    
     // Wait until transmitter holding register is empty
     while ((uart_read_reg(UART_LSR) & LSR_TX_IDLE) == 0)
         ;
@@ -66,11 +268,30 @@ void hal_uart_puts(const char *s) {
 int hal_uart_write(const char *buffer, unsigned int count) {
     unsigned int bytes_written = 0;
     
+    hal_uart_sink_t sink = uart_sink;
+    if (sink) {
+        for (unsigned int i = 0; i < count; i++) {
+            sink(buffer[i]);
+        }
+        return count;
+    }
+    
+    if (uart_irq_on) {
+        int irq_state = spin_lock_irqsave(&uart_tx_lock);
+        for (unsigned int i = 0; i < count; i++) {
+            irq_state = uart_tx_wait_room(irq_state, 1);
+            uart_tx_put(buffer[i]);
+        }
+        uart_tx_start(irq_state);
+        spin_unlock_irqrestore(&uart_tx_lock, irq_state);
+        return count;
+    }
+    
     for (unsigned int i = 0; i < count; i++) {
         // Wait until transmitter holding register is empty
         while ((uart_read_reg(UART_LSR) & LSR_TX_IDLE) == 0)
             ;
-        
+    
         // Write character to transmitter
         uart_write_reg(UART_THR, buffer[i]);
         bytes_written++;
@@ -80,6 +301,21 @@ int hal_uart_write(const char *buffer, unsigned int count) {
 }
 
 char hal_uart_getc(void) {
+    if (uart_irq_on) {
+        int c;
+        int irq_state = interrupt_save_disable();
+        while ((c = uart_rx_take()) < 0) {
+            if (irq_state && process_current() != NULL && !in_softirq()) {
+                wait_queue_sleep_irqoff(&uart_rx_waiters);
+            } else {
+                // Nothing else will fill the ring for us
+                uart_rx_receive();
+            }
+        }
+        interrupt_restore(irq_state);
+        return (char)c;
+    }
+    
     // Wait for data to be available
     while ((uart_read_reg(UART_LSR) & LSR_DATA_READY) == 0)
         ;
@@ -89,16 +325,83 @@ char hal_uart_getc(void) {
 }
 
 int hal_uart_data_available(void) {
+    if (uart_irq_on) {
+        return uart_rx_head != uart_rx_tail;
+    }
     return (uart_read_reg(UART_LSR) & LSR_DATA_READY) != 0;
 }
 
 int hal_uart_getc_nonblock(void) {
+    if (uart_irq_on) {
+        return uart_rx_take();
+    }
     if ((uart_read_reg(UART_LSR) & LSR_DATA_READY) == 0) {
         return -1;  // No data available
     }
     return (unsigned char)uart_read_reg(UART_RBR);
 }
 
+static hal_uart_rx_handler_t uart_rx_handler = NULL;
+
+// Hard half, in the trap: empty the receive FIFO into the ring before it
+// overflows and keep the transmitter busy
+static int uart_irq_handler(void) {
+    // Reading the data clears the receive interrupt
+    if (uart_rx_receive() > 0) {
+        wait_queue_wake(&uart_rx_waiters);
+    }
+    
+    // Refilling the THR (or disarming it) clears the transmit interrupt
+    spin_lock(&uart_tx_lock);
+    uart_tx_fill();
+    int room = uart_tx_tail - uart_tx_head < UART_TX_RING_SIZE;
+    spin_unlock(&uart_tx_lock);
+    if (room) {
+        wait_queue_wake(&uart_tx_waiters);
+    }
+    
+    return uart_rx_handler && uart_rx_head != uart_rx_tail ? IRQ_WAKE_THREAD : IRQ_HANDLED;
+}
+
+// Threaded half: the handler drains what arrived (escape sequences,
+// terminal switches and their redraws), preemptible by the timer
+static void uart_irq_thread(void) {
+    if (uart_rx_handler) {
+        uart_rx_handler();
+    }
+}
+
+int hal_uart_enable_interrupts(void) {
+    if (uart_irq_on) {
+        return 0;
+    }
+    if (!interrupt_register_threaded(UART0_IRQ, uart_irq_handler, uart_irq_thread, "uart0")) {
+        return -1;
+    }
+    
+    interrupt_set_priority(UART0_IRQ, IRQ_PRIORITY_HIGH);
+    interrupt_enable_irq(UART0_IRQ);
+    
+    // Bytes that came in while polling go first
+    int irq_state = spin_lock_irqsave(&uart_tx_lock);
+    uart_rx_receive();
+    uart_irq_on = 1;
+    uart_write_reg(UART_IER, uart_read_reg(UART_IER) | IER_RX_AVAILABLE);
+    spin_unlock_irqrestore(&uart_tx_lock, irq_state);
+    return 0;
+}
+
+int hal_uart_enable_rx_interrupt(hal_uart_rx_handler_t handler) {
+    if (!handler || uart_rx_handler) {
+        return -1;
+    }
+    if (hal_uart_enable_interrupts() != 0) {
+        return -1;
+    }
+    uart_rx_handler = handler;
+    return 0;
+}
+
 void hal_uart_put_uint32(uint32_t value) {
     // Convert to decimal string
     char buffer[11];  // Max 10 digits + null terminator
@@ -0,0 +1,156 @@
+/**
+ * @file acct.c
+ * @brief Per-process and per-syscall time and I/O accounting
+ *
+ * A running process's mark_us is the last time it crossed a boundary
+ * that changes which of utime and stime it is charging: switch-in, trap
+ * from user mode, return to user mode. Each crossing charges the time
+ * since the mark and moves it.
+ */
+
+#include "kernel/acct.h"
+#include "kernel/process.h"
+#include "kernel/syscall.h"
+#include "kernel/constants.h"
+#include "kernel/kstring.h"
+#include "hal/hal_timer.h"
+#include "mm/kmalloc.h"
+#include "trap.h"
+#include <stddef.h>
+
+// System-wide counts, by syscall number
+static acct_syscall_stats_t acct_syscalls[SYSCALL_COUNT];
+
+static int acct_from_user(struct trap_frame *tf) {
+    return !(tf->sstatus & (1UL << SSTATUS_SPP_BIT));
+}
+
+/**
+ * Trap entry: charge user time if the trap came from user mode
+ */
+void acct_trap_enter(struct trap_frame *tf) {
+    struct process *proc = process_current();
+    if (!proc || !acct_from_user(tf)) {
+        return;
+    }
+    uint64_t now = hal_timer_get_time_us();
+    proc->acct.utime_us += now - proc->acct.mark_us;
+    proc->acct.mark_us = now;
+}
+
+/**
+ * Trap exit: charge system time if returning to user mode
+ */
+void acct_trap_exit(struct trap_frame *tf) {
+    struct process *proc = process_current();
+    if (!proc || !acct_from_user(tf)) {
+        return;
+    }
+    uint64_t now = hal_timer_get_time_us();
+    proc->acct.stime_us += now - proc->acct.mark_us;
+    proc->acct.mark_us = now;
+}
+
+/**
+ * Charge the outgoing process and start the clock of the incoming one
+ */
+void acct_switch(struct process *old, struct process *new) {
+    uint64_t now = hal_timer_get_time_us();
+
+    if (old) {
+        // Switches happen in the kernel, so the time since the mark is stime
+        old->acct.stime_us += now - old->acct.mark_us;
+        if (old->state == PROC_RUNNING || old->state == PROC_READY) {
+            old->acct.nivcsw++;
+        } else {
+            old->acct.nvcsw++;
+        }
+    }
+    if (new) {
+        new->acct.mark_us = now;
+    }
+}
+
+/**
+ * Record a syscall of the running process
+ */
+void acct_syscall(uint64_t syscall_number, uint64_t us) {
+    if (syscall_number >= SYSCALL_COUNT) {
+        return;
+    }
+    uint32_t bucket = acct_hist_bucket(us);
+
+    acct_syscall_stats_t *stats = &acct_syscalls[syscall_number];
+    stats->count++;
+    stats->total_us += us;
+    if (us > stats->max_us) {
+        stats->max_us = us;
+    }
+    stats->hist[bucket]++;
+
+    struct process *proc = process_current();
+    if (!proc) {
+        return;
+    }
+    proc->acct.syscalls++;
+    proc->acct.syscall_us += us;
+    proc->acct.syscall_hist[bucket]++;
+
+    // Per-syscall counts are allocated on first use; without memory the
+    // process just goes without them
+    if (!proc->acct.sys) {
+        size_t size = SYSCALL_COUNT * sizeof(acct_syscall_t);
+        proc->acct.sys = (acct_syscall_t *)kmalloc(size);
+        if (!proc->acct.sys) {
+            return;
+        }
+        kmemset(proc->acct.sys, 0, size);
+    }
+    proc->acct.sys[syscall_number].count++;
+    proc->acct.sys[syscall_number].total_us += us;
+}
+
+/**
+ * Charge block I/O the running process submitted
+ */
+void acct_blk_io(uint64_t bytes, int write) {
+    struct process *proc = process_current();
+    if (!proc) {
+        return;
+    }
+    if (write) {
+        proc->acct.io_write_bytes += bytes;
+    } else {
+        proc->acct.io_read_bytes += bytes;
+    }
+}
+
+/**
+ * Charge time the running process spent waiting for block I/O
+ */
+void acct_blk_wait(uint64_t us) {
+    struct process *proc = process_current();
+    if (proc) {
+        proc->acct.io_wait_us += us;
+    }
+}
+
+/**
+ * Free a process's accounting
+ */
+void acct_release(struct process *proc) {
+    if (proc->acct.sys) {
+        kfree(proc->acct.sys);
+    }
+    kmemset(&proc->acct, 0, sizeof(proc->acct));
+}
+
+/**
+ * System-wide counts of a syscall
+ */
+const acct_syscall_stats_t *acct_syscall_stats(uint64_t syscall_number) {
+    if (syscall_number >= SYSCALL_COUNT) {
+        return NULL;
+    }
+    return &acct_syscalls[syscall_number];
+}
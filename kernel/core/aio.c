@@ -0,0 +1,331 @@
+/**
+ * @file aio.c
+ * @brief Asynchronous file I/O contexts and their worker threads
+ *
+ * Submitted requests from every context wait on one FIFO, taken by the
+ * first idle worker. A finished request moves to its context's list of
+ * completions, where read() picks it up. Both lists are touched only in
+ * process context under the big kernel lock; interrupts are disabled
+ * around them as for the work queue, so a sleeper cannot miss a wakeup.
+ *
+ * A context's reference count covers its descriptors and the requests
+ * not yet finished, so a request never outlives its context and the
+ * context is freed, finished requests and all, once both are gone.
+ */
+
+#include "kernel/aio.h"
+#include "kernel/process.h"
+#include "kernel/wait_queue.h"
+#include "kernel/smp.h"
+#include "kernel/uaccess.h"
+#include "kernel/errno.h"
+#include "fs/vfs.h"
+#include "mm/kmalloc.h"
+#include "arch/interrupt.h"
+#include <stddef.h>
+
+typedef struct aio_request {
+    struct aio_request *next;       /* Worker FIFO, then completion list */
+    aio_ctx_t *ctx;                 /* Context it was submitted to */
+    vfs_file_t *file;               /* Holds a reference until it ran */
+    void *data;                     /* Kernel copy of the transfer */
+    aio_iocb_t iocb;                /* The request as submitted */
+    int64_t result;
+    int error;
+} aio_request_t;
+
+struct aio_ctx {
+    int refs;                       /* Descriptors and unfinished requests */
+    uint32_t outstanding;           /* Submitted and not yet read back */
+    aio_request_t *done_head;       /* Finished, oldest first */
+    aio_request_t *done_tail;
+    wait_queue_t wq;                /* Woken as each request finishes */
+};
+
+static aio_request_t *g_queue_head = NULL;
+static aio_request_t *g_queue_tail = NULL;
+static wait_queue_t g_worker_wait = WAIT_QUEUE_INIT;
+static int g_workers = 0;
+
+static void aio_worker_main(void *arg);
+
+/**
+ * Start workers until there are AIO_WORKERS of them
+ *
+ * @return 0 if at least one is running, -1 otherwise (errno set)
+ */
+static int aio_start_workers(void) {
+    while (g_workers < AIO_WORKERS) {
+        if (!kthread_create("kaio", aio_worker_main, NULL)) {
+            if (g_workers > 0) {
+                break;
+            }
+            /* errno already set by kthread_create */
+            return -1;
+        }
+        g_workers++;
+    }
+    clear_errno();
+    return 0;
+}
+
+aio_ctx_t *aio_create(void) {
+    if (aio_start_workers() != 0) {
+        /* errno already set by aio_start_workers */
+        return NULL;
+    }
+
+    aio_ctx_t *ctx = kmalloc(sizeof(aio_ctx_t));
+    if (!ctx) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+    ctx->refs = 1;
+    ctx->outstanding = 0;
+    ctx->done_head = NULL;
+    ctx->done_tail = NULL;
+    wait_queue_init(&ctx->wq);
+    clear_errno();
+    return ctx;
+}
+
+void aio_get(aio_ctx_t *ctx) {
+    ctx->refs++;
+}
+
+/**
+ * Free a request and what it still holds
+ */
+static void aio_request_free(aio_request_t *req) {
+    if (req->file) {
+        vfs_file_put(req->file);
+    }
+    kfree(req->data);
+    kfree(req);
+}
+
+void aio_put(aio_ctx_t *ctx) {
+    if (--ctx->refs > 0) {
+        return;
+    }
+    while (ctx->done_head) {
+        aio_request_t *req = ctx->done_head;
+        ctx->done_head = req->next;
+        aio_request_free(req);
+    }
+    kfree(ctx);
+}
+
+int aio_submit(aio_ctx_t *ctx, const aio_iocb_t *iocb) {
+    if ((iocb->opcode != AIO_OP_READ && iocb->opcode != AIO_OP_WRITE) ||
+        iocb->flags != 0 || iocb->len > AIO_MAX_IO) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (ctx->outstanding >= AIO_MAX_REQUESTS) {
+        RETURN_ERRNO(THUNDEROS_EAGAIN);
+    }
+
+    vfs_file_t *file = vfs_get_file(iocb->fd);
+    if (!file) {
+        /* errno already set by vfs_get_file */
+        return -1;
+    }
+    if (vfs_file_check_io(file, iocb->opcode == AIO_OP_WRITE) != 0) {
+        /* errno already set by vfs_file_check_io */
+        return -1;
+    }
+
+    aio_request_t *req = kmalloc(sizeof(aio_request_t));
+    if (!req) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    req->next = NULL;
+    req->ctx = ctx;
+    req->file = NULL;
+    req->data = NULL;
+    req->iocb = *iocb;
+    req->result = 0;
+    req->error = 0;
+
+    if (iocb->len > 0) {
+        req->data = kmalloc(iocb->len);
+        if (!req->data) {
+            kfree(req);
+            RETURN_ERRNO(THUNDEROS_ENOMEM);
+        }
+        if (iocb->opcode == AIO_OP_WRITE &&
+            copy_from_user(req->data, (const void *)iocb->buf, iocb->len) != 0) {
+            aio_request_free(req);
+            /* errno already set by copy_from_user */
+            return -1;
+        }
+    }
+
+    vfs_file_get(file);
+    req->file = file;
+    aio_get(ctx);
+    ctx->outstanding++;
+
+    int irq_state = interrupt_save_disable();
+    if (g_queue_tail) {
+        g_queue_tail->next = req;
+    } else {
+        g_queue_head = req;
+    }
+    g_queue_tail = req;
+    wait_queue_wake_one(&g_worker_wait);
+    interrupt_restore(irq_state);
+
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Take the oldest request off the queue, sleeping while there is none
+ */
+static aio_request_t *aio_next(void) {
+    int irq_state = interrupt_save_disable();
+
+    while (!g_queue_head) {
+        wait_queue_sleep(&g_worker_wait);
+        interrupt_disable();
+    }
+
+    aio_request_t *req = g_queue_head;
+    g_queue_head = req->next;
+    if (!g_queue_head) {
+        g_queue_tail = NULL;
+    }
+    req->next = NULL;
+
+    interrupt_restore(irq_state);
+    return req;
+}
+
+/**
+ * Do the transfer and post the completion
+ */
+static void aio_run(aio_request_t *req) {
+    const aio_iocb_t *iocb = &req->iocb;
+    int n;
+    if (iocb->opcode == AIO_OP_READ) {
+        n = vfs_file_pread(req->file, iocb->offset, req->data, iocb->len);
+    } else {
+        n = vfs_file_pwrite(req->file, iocb->offset, req->data, iocb->len);
+    }
+    req->result = n;
+    req->error = n < 0 ? get_errno() : 0;
+
+    // The transfer is done: the file may close now
+    vfs_file_put(req->file);
+    req->file = NULL;
+
+    aio_ctx_t *ctx = req->ctx;
+    int irq_state = interrupt_save_disable();
+    if (ctx->done_tail) {
+        ctx->done_tail->next = req;
+    } else {
+        ctx->done_head = req;
+    }
+    ctx->done_tail = req;
+    wait_queue_wake(&ctx->wq);
+    interrupt_restore(irq_state);
+
+    aio_put(ctx);
+}
+
+/**
+ * Worker thread body
+ */
+static void aio_worker_main(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        aio_run(aio_next());
+
+        // Let other CPUs into the kernel between requests
+        bkl_relax();
+    }
+}
+
+/**
+ * Move finished requests into records, copying out the data read
+ *
+ * @return Records filled in
+ */
+static int aio_harvest(aio_ctx_t *ctx, aio_event_t *out, int max) {
+    int n = 0;
+
+    while (n < max) {
+        int irq_state = interrupt_save_disable();
+        aio_request_t *req = ctx->done_head;
+        if (req) {
+            ctx->done_head = req->next;
+            if (!ctx->done_head) {
+                ctx->done_tail = NULL;
+            }
+        }
+        interrupt_restore(irq_state);
+        if (!req) {
+            break;
+        }
+
+        if (req->iocb.opcode == AIO_OP_READ && req->result > 0 &&
+            copy_to_user((void *)req->iocb.buf, req->data, (size_t)req->result) != 0) {
+            req->result = -1;
+            req->error = THUNDEROS_EFAULT;
+        }
+
+        aio_event_t *ev = &out[n++];
+        ev->user_data = req->iocb.user_data;
+        ev->result = req->result;
+        ev->error = req->error;
+        ev->reserved = 0;
+
+        ctx->outstanding--;
+        aio_request_free(req);
+    }
+    return n;
+}
+
+int aio_read(aio_ctx_t *ctx, void *buffer, uint32_t size, int nonblock) {
+    int max = (int)(size / sizeof(aio_event_t));
+    if (max == 0) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    wait_queue_entry_t entry;
+    poll_waiter_t pw;
+    poll_waiter_init(&pw, &entry, 1);
+    poll_wait(&pw.pt, &ctx->wq);
+
+    int n;
+    int error = 0;
+    for (;;) {
+        n = aio_harvest(ctx, (aio_event_t *)buffer, max);
+        if (n > 0) {
+            break;
+        }
+        if (nonblock) {
+            error = THUNDEROS_EAGAIN;
+            break;
+        }
+        if (poll_signal_pending()) {
+            error = THUNDEROS_EINTR;
+            break;
+        }
+        poll_waiter_sleep(&pw, 0);
+    }
+
+    poll_waiter_release(&pw);
+
+    if (error) {
+        RETURN_ERRNO(error);
+    }
+    clear_errno();
+    return n * (int)sizeof(aio_event_t);
+}
+
+int aio_poll(aio_ctx_t *ctx, poll_table_t *pt) {
+    poll_wait(pt, &ctx->wq);
+    return ctx->done_head ? POLLIN : 0;
+}
@@ -0,0 +1,182 @@
+/**
+ * @file bootstage.c
+ * @brief Boot timeline and quiet boot
+ *
+ * Stages are claimed with an atomic add, so the main path and work on
+ * other CPUs can record at the same time; a slot's fields are written
+ * before bootstage_done() reads them, which waits for the probes first.
+ */
+
+#include "kernel/bootstage.h"
+#include "kernel/fdt.h"
+#include "kernel/kstring.h"
+#include "kernel/smp.h"
+#include "hal/hal_uart.h"
+#include "hal/hal_timer.h"
+#include <stddef.h>
+
+static bootstage_t bootstages[BOOTSTAGE_MAX];
+static volatile uint32_t bootstage_count = 0;
+
+// End of the last stage on the main path
+static uint64_t bootstage_last_us = 0;
+
+static int boot_quiet = 0;
+static volatile int bootstage_diverting = 0;
+static char bootstage_log_buf[BOOTSTAGE_LOG_SIZE];
+static volatile uint32_t bootstage_log_len = 0;
+
+/**
+ * Check a command line for a word
+ */
+static int bootargs_has(const char *args, const char *word) {
+    while (*args) {
+        while (*args == ' ') {
+            args++;
+        }
+        const char *w = word;
+        while (*w && *args == *w) {
+            args++;
+            w++;
+        }
+        if (*w == '\0' && (*args == ' ' || *args == '\0')) {
+            return 1;
+        }
+        while (*args && *args != ' ') {
+            args++;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Keep a byte of diverted output (hal_uart_sink_t)
+ */
+static void bootstage_log_putc(char c) {
+    if (c == '\r') {
+        return;                        // hal_uart_puts() line endings
+    }
+    uint32_t at = __sync_fetch_and_add(&bootstage_log_len, 1);
+    if (at < BOOTSTAGE_LOG_SIZE) {
+        bootstage_log_buf[at] = c;
+    }
+}
+
+/**
+ * Logical CPU, or 0 before smp_init()
+ */
+static int bootstage_cpu(void) {
+    return cpu_online_count() ? cpu_this()->id : 0;
+}
+
+static void bootstage_add(const char *name, uint64_t start_us, uint64_t end_us) {
+    uint32_t at = __sync_fetch_and_add(&bootstage_count, 1);
+    if (at >= BOOTSTAGE_MAX) {
+        bootstage_count = BOOTSTAGE_MAX;
+        return;
+    }
+    bootstages[at].name = name;
+    bootstages[at].start_us = start_us;
+    bootstages[at].end_us = end_us;
+    bootstages[at].cpu = bootstage_cpu();
+}
+
+void bootstage_init(void) {
+    const char *args = fdt_get_bootargs(boot_fdt_addr);
+    boot_quiet = args && bootargs_has(args, "quiet");
+    if (boot_quiet) {
+        bootstage_diverting = 1;
+        hal_uart_set_sink(bootstage_log_putc);
+    }
+
+    bootstage_last_us = hal_timer_get_time_us();
+    bootstage_add("firmware", 0, bootstage_last_us);
+}
+
+int bootstage_quiet(void) {
+    return boot_quiet;
+}
+
+void bootstage_mark(const char *name) {
+    uint64_t now = hal_timer_get_time_us();
+    bootstage_add(name, bootstage_last_us, now);
+    bootstage_last_us = now;
+}
+
+void bootstage_record(const char *name, uint64_t start_us) {
+    bootstage_add(name, start_us, hal_timer_get_time_us());
+}
+
+/**
+ * Print "<n>.<3 digits>" ms for a time in microseconds
+ */
+static void bootstage_print_ms(uint64_t us) {
+    kprint_dec(us / 1000);
+    hal_uart_putc('.');
+    hal_uart_putc((char)('0' + us / 100 % 10));
+    hal_uart_putc((char)('0' + us / 10 % 10));
+    hal_uart_putc((char)('0' + us % 10));
+}
+
+void bootstage_done(const char *name) {
+    bootstage_mark(name);
+    hal_uart_set_sink(NULL);
+    bootstage_diverting = 0;
+
+    if (boot_quiet) {
+        hal_uart_puts("[OK] ThunderOS booted in ");
+        bootstage_print_ms(bootstage_last_us);
+        hal_uart_puts(" ms (/proc/boottime, /proc/bootlog)\n");
+        return;
+    }
+
+    hal_uart_puts("\nBoot timeline (ms since reset):\n");
+    const bootstage_t *stage;
+    for (uint32_t i = 0; (stage = bootstage_get(i)) != NULL; i++) {
+        hal_uart_puts("  ");
+        bootstage_print_ms(stage->start_us);
+        hal_uart_puts(" - ");
+        bootstage_print_ms(stage->end_us);
+        hal_uart_puts("  cpu");
+        kprint_dec((uint64_t)stage->cpu);
+        hal_uart_puts("  ");
+        hal_uart_puts(stage->name);
+        hal_uart_puts(" (");
+        bootstage_print_ms(stage->end_us - stage->start_us);
+        hal_uart_puts(")\n");
+    }
+}
+
+const bootstage_t *bootstage_get(uint32_t index) {
+    // The count may run past the table for a moment while a late add backs off
+    if (index >= bootstage_count || index >= BOOTSTAGE_MAX) {
+        return NULL;
+    }
+    return &bootstages[index];
+}
+
+const char *bootstage_log(uint32_t *len) {
+    uint32_t n = bootstage_log_len;
+    *len = n < BOOTSTAGE_LOG_SIZE ? n : BOOTSTAGE_LOG_SIZE;
+    return bootstage_log_buf;
+}
+
+void bootstage_flush_log(void) {
+    if (!bootstage_diverting) {
+        return;
+    }
+    hal_uart_set_sink(NULL);
+    bootstage_diverting = 0;
+
+    uint32_t len;
+    const char *log = bootstage_log(&len);
+    if (len > 0) {
+        hal_uart_puts("\n--- held back by quiet boot ---\n");
+        for (uint32_t i = 0; i < len; i++) {
+            if (log[i] == '\n') {
+                hal_uart_putc('\r');
+            }
+            hal_uart_putc(log[i]);
+        }
+    }
+}
@@ -12,6 +12,8 @@
 #include "kernel/process.h"
 #include "kernel/scheduler.h"
 #include "kernel/errno.h"
+#include "kernel/lockstat.h"
+#include "hal/hal_timer.h"
 #include "arch/interrupt.h"
 
 /**
@@ -27,6 +29,9 @@ void cond_init(condvar_t *cv) {
     }
     
     wait_queue_init(&cv->waiters);
+#ifdef LOCKSTAT
+    cv->lockstat = lockstat_class(LOCKSTAT_CONDVAR, (const void *)LOCKSTAT_SITE(), NULL);
+#endif
 }
 
 /**
@@ -51,17 +56,23 @@ void cond_wait(condvar_t *cv, mutex_t *mutex) {
     
     uint64_t flags = interrupt_save_disable();
     
+#ifdef LOCKSTAT
+    // A wait is the time asleep; CONDVAR_INIT ones join the first waiter's class
+    uintptr_t site = LOCKSTAT_SITE();
+    if (!cv->lockstat) {
+        cv->lockstat = lockstat_class(LOCKSTAT_CONDVAR, (const void *)site, NULL);
+    }
+    lockstat_acquired(cv->lockstat);
+    uint64_t wait_start = hal_timer_get_time_us();
+#endif
+    
     /* 
      * Atomically unlock the mutex and add ourselves to the wait queue.
      * This is the critical section that prevents lost wakeups.
      */
     
-    /* Unlock the mutex - this allows other processes to proceed */
-    mutex->locked = MUTEX_UNLOCKED;
-    mutex->owner_pid = -1;
-    
-    /* Wake one process waiting on the mutex (if any) */
-    wait_queue_wake(&mutex->waiters);
+    /* Unlock the mutex, handing it to the oldest waiter (if any) */
+    mutex_unlock(mutex);
     
     /* 
      * Now sleep on the condition variable.
@@ -71,6 +82,10 @@ void cond_wait(condvar_t *cv, mutex_t *mutex) {
     interrupt_restore(flags);
     wait_queue_sleep(&cv->waiters);
     
+#ifdef LOCKSTAT
+    lockstat_waited(cv->lockstat, hal_timer_get_time_us() - wait_start, site);
+#endif
+    
     /* 
      * We've been awakened! Now we need to re-acquire the mutex.
      * This blocks if another process has taken it.
@@ -1,3 +1,21 @@
+/**
+ * @file elf_loader.c
+ * @brief Loading ELF executables into user processes
+ *
+ * Parsed headers of recently run executables are kept in a small cache
+ * keyed by inode, so running the same program again opens the file but
+ * reads nothing through it. Segments are demand loaded: their VMAs are
+ * backed by the file, and pages are faulted in from the page cache on
+ * first touch - shared between every process running the program until
+ * written - with pure bss pages served by the zero page. Read-only pages
+ * another process already brought into the cache are mapped at exec
+ * rather than faulted in one by one. Only the few pages that mix file
+ * data with bss or with another segment are copied into private memory
+ * at exec time.
+ *
+ * Callers hold the BKL, which serialises every use of the cache.
+ */
+
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
@@ -7,15 +25,33 @@
 #include "kernel/elf_loader.h"
 #include "trap.h"
 #include "fs/vfs.h"
+#include "fs/page_cache.h"
 #include "kernel/process.h"
+#include "kernel/rgroup.h"
 #include "mm/kmalloc.h"
 #include "mm/pmm.h"
+#include "mm/page.h"
 #include "mm/paging.h"
 #include "hal/hal_uart.h"
+#include "arch/fpu.h"
 
 #define ELF_MAGIC 0x464C457F
 #define PT_LOAD   1
 
+/* Segment permissions (p_flags) */
+#define PF_X      0x1
+#define PF_W      0x2
+#define PF_R      0x4
+
+/* Most program headers accepted in one file */
+#define ELF_MAX_PHDRS   16
+
+/* Executables whose parsed headers are kept */
+#define ELF_CACHE_SLOTS 8
+
+/* Cached read-only pages mapped at exec time, at most */
+#define ELF_PREMAP_MAX  64
+
 typedef struct {
     uint32_t magic;
     uint8_t  class;
@@ -50,53 +86,74 @@ typedef struct {
     uint64_t align;
 } elf64_phdr_t;
 
+/* A PT_LOAD segment, reduced to what mapping it needs */
+typedef struct {
+    uint64_t vaddr;
+    uint64_t memsz;
+    uint64_t offset;
+    uint64_t filesz;
+    uint32_t flags;                 /* PF_* */
+} elf_segment_t;
+
+/* What exec needs from an executable's headers */
+typedef struct {
+    vfs_node_t *node;               /* File the segments are read from */
+    uint64_t entry;
+    int nr_segments;
+    elf_segment_t segments[ELF_MAX_PHDRS];
+} elf_image_t;
+
+/* Where a page of an image comes from */
+#define ELF_PAGE_HOLE   0           /* No segment: left unmapped */
+#define ELF_PAGE_FILE   1           /* Mapped from the page cache on first touch */
+#define ELF_PAGE_ZERO   2           /* All bss: the zero page until written */
+#define ELF_PAGE_COPY   3           /* Filled at exec time */
+
+/* An image's copied pages, filled before exec commits */
+typedef struct {
+    uint64_t start;                 /* Page-aligned bounds of the image */
+    uint64_t end;
+    uintptr_t *pages;               /* Copied page per page; 0 = none */
+} elf_layout_t;
+
+typedef struct {
+    vfs_filesystem_t *fs;           /* NULL = free slot */
+    uint32_t inode;
+    uint64_t size;                  /* File size when the headers were read */
+    uint32_t last_used;             /* g_elf_cache_clock at the last exec */
+    elf_image_t image;              /* node is not kept; taken from each open */
+} elf_cache_entry_t;
+
+static elf_cache_entry_t g_elf_cache[ELF_CACHE_SLOTS];
+static uint32_t g_elf_cache_clock = 0;
+
 /**
- * Load ELF binary from filesystem and create process
- * 
- * @param path Path to ELF binary
- * @param argv Argument array (unused)
- * @param argc Argument count (unused)
- * @return PID of new process, or -1 on error (errno set)
+ * Read and check the headers of an open executable
  */
-int elf_load_exec(const char *path, const char *argv[], int argc) {
-    (void)argv;
-    (void)argc;
-    
-    /* Open file */
-    int fd = vfs_open(path, O_RDONLY);
-    if (fd < 0) {
-        /* errno already set by vfs_open */
-        return -1;
-    }
-    
+static int elf_read_image(int fd, vfs_node_t *node, elf_image_t *img) {
     /* Read ELF header */
     elf64_ehdr_t ehdr;
     if (vfs_read(fd, &ehdr, sizeof(ehdr)) != sizeof(ehdr)) {
-        vfs_close(fd);
         RETURN_ERRNO(THUNDEROS_EIO);
     }
     
     /* Verify ELF magic */
     if (ehdr.magic != ELF_MAGIC) {
-        vfs_close(fd);
         RETURN_ERRNO(THUNDEROS_EELF_MAGIC);
     }
     
     /* Verify it's a RISC-V executable */
     if (ehdr.machine != EM_RISCV) {
-        vfs_close(fd);
         RETURN_ERRNO(THUNDEROS_EELF_ARCH);
     }
     
     /* Verify it's an executable */
     if (ehdr.type != ET_EXEC) {
-        vfs_close(fd);
         RETURN_ERRNO(THUNDEROS_EELF_TYPE);
     }
     
     /* Read program headers */
-    if (ehdr.phnum == 0 || ehdr.phnum > 16) {
-        vfs_close(fd);
+    if (ehdr.phnum == 0 || ehdr.phnum > ELF_MAX_PHDRS) {
         RETURN_ERRNO(THUNDEROS_EELF_NOPHDR);
     }
     
@@ -104,14 +161,12 @@ int elf_load_exec(const char *path, const char *argv[], int argc) {
     size_t phdrs_size = ehdr.phnum * sizeof(elf64_phdr_t);
     elf64_phdr_t *phdrs = kmalloc(phdrs_size);
     if (!phdrs) {
-        vfs_close(fd);
         RETURN_ERRNO(THUNDEROS_ENOMEM);
     }
     
     /* Seek to program headers */
     if (vfs_seek(fd, ehdr.phoff, SEEK_SET) < 0) {
         kfree(phdrs);
-        vfs_close(fd);
         /* errno already set by vfs_seek */
         return -1;
     }
@@ -119,88 +174,415 @@ int elf_load_exec(const char *path, const char *argv[], int argc) {
     /* Read all program headers */
     if (vfs_read(fd, phdrs, phdrs_size) != (int)phdrs_size) {
         kfree(phdrs);
-        vfs_close(fd);
         RETURN_ERRNO(THUNDEROS_EIO);
     }
     
-    // Find the total memory needed and lowest/highest addresses
-    uint64_t min_addr = (uint64_t)-1;
-    uint64_t max_addr = 0;
-    
+    /* Keep the PT_LOAD segments; their data is read later, page by page,
+     * so check now that it is all inside the file and below the stack */
+    img->node = node;
+    img->entry = ehdr.entry;
+    img->nr_segments = 0;
     for (int i = 0; i < ehdr.phnum; i++) {
-        if (phdrs[i].type == PT_LOAD) {
-            if (phdrs[i].vaddr < min_addr) {
-                min_addr = phdrs[i].vaddr;
-            }
-            uint64_t seg_end = phdrs[i].vaddr + phdrs[i].memsz;
-            if (seg_end > max_addr) {
-                max_addr = seg_end;
-            }
+        const elf64_phdr_t *ph = &phdrs[i];
+        if (ph->type != PT_LOAD || ph->memsz == 0) {
+            continue;
+        }
+        if (ph->filesz > ph->memsz || ph->offset + ph->filesz > node->size ||
+            ph->offset + ph->filesz < ph->offset ||
+            ph->vaddr + ph->memsz < ph->vaddr ||
+            ph->vaddr + ph->memsz > USER_STACK_TOP - USER_STACK_SIZE) {
+            kfree(phdrs);
+            RETURN_ERRNO(THUNDEROS_EELF_PHDR);
         }
+        
+        elf_segment_t *seg = &img->segments[img->nr_segments++];
+        seg->vaddr = ph->vaddr;
+        seg->memsz = ph->memsz;
+        seg->offset = ph->offset;
+        seg->filesz = ph->filesz;
+        seg->flags = ph->flags;
     }
+    kfree(phdrs);
     
-    if (min_addr == (uint64_t)-1) {
-        kfree(phdrs);
-        vfs_close(fd);
+    if (img->nr_segments == 0) {
         RETURN_ERRNO(THUNDEROS_EELF_NOPHDR);
     }
+    return 0;
+}
+
+/**
+ * Open an executable and get its headers, from the cache if they are there
+ */
+static int elf_get_image(const char *path, elf_image_t *img) {
+    /* Open file */
+    int fd = vfs_open(path, O_RDONLY);
+    if (fd < 0) {
+        /* errno already set by vfs_open */
+        return -1;
+    }
     
-    /* Allocate memory for the entire program (page-aligned) */
-    size_t total_size = max_addr - min_addr;
-    size_t num_pages = (total_size + PAGE_SIZE - 1) / PAGE_SIZE;
-    uintptr_t program_phys = pmm_alloc_pages(num_pages);
-    if (!program_phys) {
-        kfree(phdrs);
+    vfs_file_t *file = vfs_get_file(fd);
+    vfs_node_t *node = file ? file->node : NULL;
+    if (!node || node->type != VFS_TYPE_FILE) {
         vfs_close(fd);
-        RETURN_ERRNO(THUNDEROS_ENOMEM);
+        RETURN_ERRNO(THUNDEROS_EIO);
     }
     
-    /* Convert to virtual address for kernel access when loading segments */
-    void *program_mem_virt = (void *)translate_phys_to_virt(program_phys);
-    void *program_mem_phys = (void *)program_phys;
+    /* Hit: a matching entry, otherwise the least recently used slot is
+     * refilled. Writes drop entries (elf_cache_invalidate), and the size
+     * check catches anything that got past that. */
+    g_elf_cache_clock++;
+    elf_cache_entry_t *victim = &g_elf_cache[0];
+    for (int i = 0; i < ELF_CACHE_SLOTS; i++) {
+        elf_cache_entry_t *entry = &g_elf_cache[i];
+        if (entry->fs == node->fs && entry->inode == node->inode && entry->fs) {
+            if (entry->size == node->size) {
+                entry->last_used = g_elf_cache_clock;
+                *img = entry->image;
+                img->node = node;
+                vfs_close(fd);
+                clear_errno();
+                return 0;
+            }
+            victim = entry;
+            break;
+        }
+        if (victim->fs && (!entry->fs || entry->last_used < victim->last_used)) {
+            victim = entry;
+        }
+    }
+    
+    /* Miss: parse the headers and remember them */
+    victim->fs = NULL;
+    if (elf_read_image(fd, node, img) != 0) {
+        vfs_close(fd);
+        /* errno already set by elf_read_image */
+        return -1;
+    }
+    vfs_close(fd);
     
-    /* Zero out the memory */
-    kmemset(program_mem_virt, 0, total_size);
+    victim->fs = node->fs;
+    victim->inode = node->inode;
+    victim->size = node->size;
+    victim->last_used = g_elf_cache_clock;
+    victim->image = *img;
     
-    /* Load each PT_LOAD segment */
-    for (int i = 0; i < ehdr.phnum; i++) {
-        if (phdrs[i].type != PT_LOAD) {
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Forget the cached headers of a file that changed or went away
+ */
+void elf_cache_invalidate(vfs_filesystem_t *fs, uint32_t inode) {
+    for (int i = 0; i < ELF_CACHE_SLOTS; i++) {
+        if (g_elf_cache[i].fs == fs && g_elf_cache[i].inode == inode) {
+            g_elf_cache[i].fs = NULL;
+        }
+    }
+}
+
+/**
+ * VMA flags for a segment's p_flags (RISC-V has no write-only pages)
+ */
+static uint32_t elf_vm_flags(uint32_t pf) {
+    uint32_t flags = VM_READ | VM_USER;
+    if (pf & PF_W) flags |= VM_WRITE;
+    if (pf & PF_X) flags |= VM_EXEC;
+    return flags;
+}
+
+/**
+ * Combined VMA flags of every segment touching a page, or 0 if none does
+ */
+static uint32_t elf_page_flags(const elf_image_t *img, uint64_t addr) {
+    uint32_t flags = 0;
+    for (int i = 0; i < img->nr_segments; i++) {
+        const elf_segment_t *seg = &img->segments[i];
+        if (addr + PAGE_SIZE > seg->vaddr && addr < seg->vaddr + seg->memsz) {
+            flags |= elf_vm_flags(seg->flags);
+        }
+    }
+    return flags;
+}
+
+/**
+ * Work out where a page of an image comes from
+ *
+ * A page only one segment touches is mapped from the page cache if it
+ * holds nothing but file bytes, or left to the zero page if it is all
+ * bss. Anything else - the page where data turns into bss, or one two
+ * segments share - has to be put together by copying (ELF_PAGE_COPY).
+ *
+ * @param segment Output: the segment, for ELF_PAGE_FILE and ELF_PAGE_ZERO
+ */
+static int elf_page_kind(const elf_image_t *img, uint64_t addr, int *segment) {
+    int found = -1;
+    for (int i = 0; i < img->nr_segments; i++) {
+        const elf_segment_t *seg = &img->segments[i];
+        if (addr + PAGE_SIZE > seg->vaddr && addr < seg->vaddr + seg->memsz) {
+            if (found >= 0) {
+                return ELF_PAGE_COPY;
+            }
+            found = i;
+        }
+    }
+    if (found < 0) {
+        return ELF_PAGE_HOLE;
+    }
+    *segment = found;
+    
+    const elf_segment_t *seg = &img->segments[found];
+    uint64_t file_end = seg->vaddr + seg->filesz;
+    if (seg->filesz == 0 || file_end <= addr) {
+        return ELF_PAGE_ZERO;
+    }
+    
+    /* File bytes past the end of the segment are harmless; past the end
+     * of the data, where bss starts, they are not */
+    if ((seg->vaddr & (PAGE_SIZE - 1)) == (seg->offset & (PAGE_SIZE - 1)) &&
+        (addr + PAGE_SIZE <= file_end || seg->filesz == seg->memsz)) {
+        return ELF_PAGE_FILE;
+    }
+    return ELF_PAGE_COPY;
+}
+
+/**
+ * Copy file bytes out of the page cache
+ */
+static int elf_copy_from_file(vfs_node_t *node, uint64_t offset, void *dst, size_t len) {
+    uint8_t *out = (uint8_t *)dst;
+    while (len > 0) {
+        size_t in_page = offset & (PAGE_SIZE - 1);
+        size_t chunk = PAGE_SIZE - in_page;
+        if (chunk > len) {
+            chunk = len;
+        }
+        
+        uintptr_t page = page_cache_get_page(node, (uint32_t)(offset / PAGE_SIZE), NULL);
+        if (!page) {
+            /* errno already set by page_cache_get_page */
+            return -1;
+        }
+        kmemcpy(out, (uint8_t *)translate_phys_to_virt(page) + in_page, chunk);
+        put_page(page);
+        
+        out += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+/**
+ * Drop the private pages elf_install() did not map, and the layout
+ */
+static void elf_release(elf_layout_t *layout) {
+    size_t nr_pages = (layout->end - layout->start) / PAGE_SIZE;
+    for (size_t i = 0; i < nr_pages; i++) {
+        if (layout->pages[i]) {
+            put_page(layout->pages[i]);
+        }
+    }
+    kfree(layout->pages);
+    layout->pages = NULL;
+}
+
+/**
+ * Lay out an image and fill its copied pages
+ *
+ * Done before exec has touched the old image, so failing here still
+ * fails the exec. Errors reading the demand-loaded pages later on end
+ * the process in the page fault handler instead.
+ */
+static int elf_prepare(const elf_image_t *img, elf_layout_t *layout) {
+    layout->start = (uint64_t)-1;
+    layout->end = 0;
+    for (int i = 0; i < img->nr_segments; i++) {
+        const elf_segment_t *seg = &img->segments[i];
+        if (PAGE_ALIGN_DOWN(seg->vaddr) < layout->start) {
+            layout->start = PAGE_ALIGN_DOWN(seg->vaddr);
+        }
+        if (PAGE_ALIGN_UP(seg->vaddr + seg->memsz) > layout->end) {
+            layout->end = PAGE_ALIGN_UP(seg->vaddr + seg->memsz);
+        }
+    }
+    
+    size_t nr_pages = (layout->end - layout->start) / PAGE_SIZE;
+    layout->pages = kmalloc(nr_pages * sizeof(uintptr_t));
+    if (!layout->pages) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    kmemset(layout->pages, 0, nr_pages * sizeof(uintptr_t));
+    
+    for (size_t n = 0; n < nr_pages; n++) {
+        uint64_t addr = layout->start + n * PAGE_SIZE;
+        int segment;
+        if (elf_page_kind(img, addr, &segment) != ELF_PAGE_COPY) {
             continue;
         }
         
-        /* Calculate offset into allocated memory (use virtual address for access) */
-        void *dest = (uint8_t*)program_mem_virt + (phdrs[i].vaddr - min_addr);
+        /* Zeroed, so bss and any gap between segments read as zero */
+        uintptr_t page = pmm_alloc_zeroed_page();
+        if (!page) {
+            elf_release(layout);
+            RETURN_ERRNO(THUNDEROS_ENOMEM);
+        }
+        layout->pages[n] = page;
         
-        /* Seek to segment data in file */
-        if (vfs_seek(fd, phdrs[i].offset, SEEK_SET) < 0) {
-            pmm_free_pages(program_phys, num_pages);
-            kfree(phdrs);
-            vfs_close(fd);
-            /* errno already set by vfs_seek */
-            return -1;
+        for (int i = 0; i < img->nr_segments; i++) {
+            const elf_segment_t *seg = &img->segments[i];
+            uint64_t from = seg->vaddr > addr ? seg->vaddr : addr;
+            uint64_t to = seg->vaddr + seg->filesz;
+            if (to > addr + PAGE_SIZE) {
+                to = addr + PAGE_SIZE;
+            }
+            if (from >= to) {
+                continue;
+            }
+            void *dst = (uint8_t *)translate_phys_to_virt(page) + (from - addr);
+            if (elf_copy_from_file(img->node, seg->offset + (from - seg->vaddr), dst, to - from) != 0) {
+                elf_release(layout);
+                /* errno already set by elf_copy_from_file */
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Map the already cached pages of a read-only file run
+ *
+ * Another process running the program has usually faulted its text in,
+ * so the new one maps the same page cache pages straight away instead of
+ * taking a minor fault on each. Pages not in the cache are left to the
+ * fault handler: nothing is read here. Stops quietly when the resource
+ * group is at its limit.
+ *
+ * @param proc Process being loaded
+ * @param node Executable
+ * @param start First page of the run
+ * @param end End of the run
+ * @param offset File offset of start
+ * @param flags VMA flags of the run (without VM_WRITE)
+ * @param budget Pages that may still be premapped
+ * @return What is left of the budget
+ */
+static size_t elf_premap_run(struct process *proc, vfs_node_t *node, uint64_t start,
+                             uint64_t end, uint64_t offset, uint32_t flags, size_t budget) {
+    uint64_t pte_flags = PTE_V | PTE_R | PTE_U;
+    if (flags & VM_EXEC) pte_flags |= PTE_X;
+    
+    for (uint64_t addr = start; addr < end && budget > 0; addr += PAGE_SIZE, offset += PAGE_SIZE) {
+        uintptr_t page = page_cache_find_page(node, (uint32_t)(offset / PAGE_SIZE));
+        if (!page) {
+            continue;
+        }
+        if (rgroup_mem_allow(proc->rgroup, 1) != 0 ||
+            map_page(proc->page_table, addr, page, pte_flags) != 0) {
+            put_page(page);
+            break;
+        }
+        process_account_rss(proc, 1);
+        budget--;
+    }
+    clear_errno();
+    return budget;
+}
+
+/**
+ * Map a prepared image into a process
+ *
+ * Each run of pages of one kind and permission gets its own VMA. File
+ * and zero pages are only faulted in when first touched (file VMAs are
+ * private, so written pages are copied out of the page cache), except
+ * that read-only file pages already in the page cache are mapped now;
+ * copied pages are mapped now and taken out of the layout, so
+ * elf_release() afterwards only drops what is left over.
+ */
+static int elf_install(struct process *proc, const elf_image_t *img, elf_layout_t *layout) {
+    size_t premap_budget = ELF_PREMAP_MAX;
+    uint64_t addr = layout->start;
+    while (addr < layout->end) {
+        int segment = -1;
+        int kind = elf_page_kind(img, addr, &segment);
+        if (kind == ELF_PAGE_HOLE) {
+            addr += PAGE_SIZE;
+            continue;
         }
         
-        /* Read segment data */
-        if (phdrs[i].filesz > 0) {
-            int nread = vfs_read(fd, dest, phdrs[i].filesz);
-            if (nread != (int)phdrs[i].filesz) {
-                pmm_free_pages(program_phys, num_pages);
-                kfree(phdrs);
-                vfs_close(fd);
-                RETURN_ERRNO(THUNDEROS_EIO);
+        uint32_t flags = elf_page_flags(img, addr);
+        uint64_t run_end = addr + PAGE_SIZE;
+        int next_segment = -1;
+        while (run_end < layout->end && elf_page_kind(img, run_end, &next_segment) == kind &&
+               next_segment == segment && elf_page_flags(img, run_end) == flags) {
+            run_end += PAGE_SIZE;
+        }
+        
+        if (kind == ELF_PAGE_FILE) {
+            const elf_segment_t *seg = &img->segments[segment];
+            uint64_t offset = PAGE_ALIGN_DOWN(seg->offset) + (addr - PAGE_ALIGN_DOWN(seg->vaddr));
+            if (process_add_file_vma(proc, addr, run_end, flags, img->node, offset) != 0) {
+                /* errno already set by process_add_file_vma */
+                return -1;
             }
+            if (!(flags & VM_WRITE)) {
+                premap_budget = elf_premap_run(proc, img->node, addr, run_end, offset, flags,
+                                               premap_budget);
+            }
+            addr = run_end;
+            continue;
         }
         
-        // Zero out BSS (memsz > filesz)
-        if (phdrs[i].memsz > phdrs[i].filesz) {
-            size_t bss_size = phdrs[i].memsz - phdrs[i].filesz;
-            kmemset((uint8_t*)dest + phdrs[i].filesz, 0, bss_size);
+        if (process_add_vma(proc, addr, run_end, flags) != 0) {
+            /* errno already set by process_add_vma */
+            return -1;
+        }
+        if (kind == ELF_PAGE_ZERO) {
+            addr = run_end;
+            continue;
         }
+        
+        uint64_t pte_flags = PTE_V | PTE_R | PTE_U;
+        if (flags & VM_WRITE) pte_flags |= PTE_W;
+        if (flags & VM_EXEC) pte_flags |= PTE_X;
+        
+        for (; addr < run_end; addr += PAGE_SIZE) {
+            size_t n = (addr - layout->start) / PAGE_SIZE;
+            if (map_page(proc->page_table, addr, layout->pages[n], pte_flags) != 0) {
+                /* errno already set by map_page */
+                return -1;
+            }
+            layout->pages[n] = 0;   /* The page table owns it now */
+        }
+    }
+    return 0;
+}
+
+/**
+ * Load ELF binary from filesystem and create process
+ * 
+ * @param path Path to ELF binary
+ * @param argv Argument array (unused)
+ * @param argc Argument count (unused)
+ * @return PID of new process, or -1 on error (errno set)
+ */
+int elf_load_exec(const char *path, const char *argv[], int argc) {
+    (void)argv;
+    (void)argc;
+    
+    elf_image_t img;
+    if (elf_get_image(path, &img) != 0) {
+        /* errno already set by elf_get_image */
+        return -1;
     }
     
-    /* Done with file and program headers */
-    vfs_close(fd);
-    kfree(phdrs);
+    elf_layout_t layout;
+    if (elf_prepare(&img, &layout) != 0) {
+        /* errno already set by elf_prepare */
+        return -1;
+    }
     
     /* Extract program name from path for process name */
     const char *program_name = path;
@@ -210,14 +592,22 @@ int elf_load_exec(const char *path, const char *argv[], int argc) {
         }
     }
     
-    /* Create user process with loaded code and custom entry point */
-    struct process *proc = process_create_elf(program_name, min_addr, program_mem_phys, total_size, ehdr.entry);
-    
+    /* Create user process, then give it the program */
+    struct process *proc = process_create_elf(program_name, img.entry);
     if (!proc) {
-        pmm_free_pages(program_phys, num_pages);
+        elf_release(&layout);
         RETURN_ERRNO(THUNDEROS_EPROC_INIT);
     }
     
+    if (elf_install(proc, &img, &layout) != 0) {
+        elf_release(&layout);
+        process_free(proc);
+        RETURN_ERRNO(THUNDEROS_EPROC_INIT);
+    }
+    elf_release(&layout);
+    
+    process_start(proc);
+    
     clear_errno();
     /* Return process ID */
     return proc->pid;
@@ -280,141 +670,53 @@ int elf_exec_replace(const char *path, const char *argv[], int argc, struct trap
     /* Use kernel buffer from now on */
     const char *kpath = path_buf;
 
-    /* Open file */
-    int fd = vfs_open(kpath, O_RDONLY);
-    if (fd < 0) {
+    elf_image_t img;
+    if (elf_get_image(kpath, &img) != 0) {
+        /* errno already set by elf_get_image */
         return -1;
     }
     
-    /* Read ELF header */
-    elf64_ehdr_t ehdr;
-    if (vfs_read(fd, &ehdr, sizeof(ehdr)) != sizeof(ehdr)) {
-        vfs_close(fd);
-        RETURN_ERRNO(THUNDEROS_EIO);
-    }
-    
-    /* Verify ELF magic */
-    if (ehdr.magic != ELF_MAGIC) {
-        vfs_close(fd);
-        RETURN_ERRNO(THUNDEROS_EELF_MAGIC);
-    }
-    
-    /* Verify it's a RISC-V executable */
-    if (ehdr.machine != EM_RISCV) {
-        vfs_close(fd);
-        RETURN_ERRNO(THUNDEROS_EELF_ARCH);
-    }
-    
-    /* Verify it's an executable */
-    if (ehdr.type != ET_EXEC) {
-        vfs_close(fd);
-        RETURN_ERRNO(THUNDEROS_EELF_TYPE);
-    }
-    
-    /* Read program headers */
-    if (ehdr.phnum == 0 || ehdr.phnum > 16) {
-        vfs_close(fd);
-        RETURN_ERRNO(THUNDEROS_EELF_NOPHDR);
-    }
-    
-    /* Allocate space for program headers */
-    size_t phdrs_size = ehdr.phnum * sizeof(elf64_phdr_t);
-    elf64_phdr_t *phdrs = kmalloc(phdrs_size);
-    if (!phdrs) {
-        vfs_close(fd);
-        RETURN_ERRNO(THUNDEROS_ENOMEM);
-    }
-    
-    /* Seek to program headers */
-    if (vfs_seek(fd, ehdr.phoff, SEEK_SET) < 0) {
-        kfree(phdrs);
-        vfs_close(fd);
+    /* Read everything the new image needs while failing is still possible */
+    elf_layout_t layout;
+    if (elf_prepare(&img, &layout) != 0) {
+        /* errno already set by elf_prepare */
         return -1;
     }
     
-    /* Read all program headers */
-    if (vfs_read(fd, phdrs, phdrs_size) != (int)phdrs_size) {
-        kfree(phdrs);
-        vfs_close(fd);
-        RETURN_ERRNO(THUNDEROS_EIO);
-    }
-    
-    /* Find memory range needed */
-    uint64_t min_addr = (uint64_t)-1;
-    uint64_t max_addr = 0;
-    
-    for (int i = 0; i < ehdr.phnum; i++) {
-        if (phdrs[i].type == PT_LOAD) {
-            if (phdrs[i].vaddr < min_addr) {
-                min_addr = phdrs[i].vaddr;
-            }
-            uint64_t seg_end = phdrs[i].vaddr + phdrs[i].memsz;
-            if (seg_end > max_addr) {
-                max_addr = seg_end;
-            }
-        }
-    }
-    
-    if (min_addr == (uint64_t)-1) {
-        kfree(phdrs);
-        vfs_close(fd);
-        RETURN_ERRNO(THUNDEROS_EELF_NOPHDR);
-    }
-    
-    /* Allocate memory for the new program */
-    size_t total_size = max_addr - min_addr;
-    size_t num_pages = (total_size + PAGE_SIZE - 1) / PAGE_SIZE;
-    uintptr_t program_phys = pmm_alloc_pages(num_pages);
-    if (!program_phys) {
-        kfree(phdrs);
-        vfs_close(fd);
-        RETURN_ERRNO(THUNDEROS_ENOMEM);
-    }
-    
-    /* Zero out the memory */
-    void *program_mem = (void *)program_phys;
-    kmemset(program_mem, 0, total_size);
-    
-    /* Load each PT_LOAD segment */
-    for (int i = 0; i < ehdr.phnum; i++) {
-        if (phdrs[i].type != PT_LOAD) {
-            continue;
+    /* A vfork child hands the parent's memory back and starts from an
+     * empty address space of its own (path and argv are copied already) */
+    if (proc->vfork_parent) {
+        page_table_t *page_table = create_user_page_table();
+        if (!page_table) {
+            elf_release(&layout);
+            RETURN_ERRNO(THUNDEROS_ENOMEM);
         }
         
-        void *dest = (uint8_t*)program_mem + (phdrs[i].vaddr - min_addr);
+        process_vfork_release(proc);
+        proc->page_table = page_table;
+        proc->last_cpu = -1;
+        process_setup_memory_isolation(proc);
         
-        if (vfs_seek(fd, phdrs[i].offset, SEEK_SET) < 0) {
-            pmm_free_pages(program_phys, num_pages);
-            kfree(phdrs);
-            vfs_close(fd);
-            return -1;
-        }
-        
-        if (phdrs[i].filesz > 0) {
-            int nread = vfs_read(fd, dest, phdrs[i].filesz);
-            if (nread != (int)phdrs[i].filesz) {
-                pmm_free_pages(program_phys, num_pages);
-                kfree(phdrs);
-                vfs_close(fd);
-                RETURN_ERRNO(THUNDEROS_EIO);
-            }
+        /* Stack pages are faulted in as argv is copied below */
+        proc->user_stack = USER_STACK_TOP - USER_STACK_SIZE;
+        if (process_add_vma(proc, proc->user_stack, USER_STACK_TOP,
+                            VM_READ | VM_WRITE | VM_USER | VM_GROWSDOWN) != 0) {
+            hal_uart_puts("FATAL: exec failed to add stack VMA\n");
+            elf_release(&layout);
+            process_exit(-1);
         }
         
-        /* Zero out BSS */
-        if (phdrs[i].memsz > phdrs[i].filesz) {
-            size_t bss_size = phdrs[i].memsz - phdrs[i].filesz;
-            kmemset((uint8_t*)dest + phdrs[i].filesz, 0, bss_size);
-        }
+        /* argv goes onto the new stack, not the parent's */
+        process_switch_page_table(proc);
     }
     
-    vfs_close(fd);
-    kfree(phdrs);
-    
     /* Now replace the current process's memory */
     
     /* 1. Free old CODE VMAs and their pages (but keep the stack!) */
+    mmu_gather_t tlb;
+    tlb_gather_init(&tlb, proc->page_table);
+    
     vm_area_t *vma = proc->vm_areas;
-    vm_area_t *prev = NULL;
     
     while (vma) {
         vm_area_t *next = vma->next;
@@ -424,52 +726,28 @@ int elf_exec_replace(const char *path, const char *argv[], int argc, struct trap
         
         if (!is_stack) {
             /* Free physical pages for code/data VMAs */
-            for (uint64_t addr = vma->start; addr < vma->end; addr += PAGE_SIZE) {
-                uintptr_t paddr;
-                if (virt_to_phys(proc->page_table, addr, &paddr) == 0) {
-                    unmap_page(proc->page_table, addr);
-                    pmm_free_page(paddr);
-                }
-            }
+            tlb_gather_unmap_range(&tlb, vma->start, vma->end);
             
             /* Remove this VMA from the list */
-            if (prev) {
-                prev->next = next;
-            } else {
-                proc->vm_areas = next;
-            }
-            kfree(vma);
-        } else {
-            /* Keep stack VMA, just move prev pointer */
-            prev = vma;
+            process_remove_vma(proc, vma);
         }
         
         vma = next;
     }
     
-    /* 2. Map new program into process's page table */
-    for (size_t i = 0; i < num_pages; i++) {
-        uintptr_t vaddr = min_addr + (i * PAGE_SIZE);
-        uintptr_t paddr = program_phys + (i * PAGE_SIZE);
-        
-        uint64_t flags = PTE_V | PTE_R | PTE_W | PTE_X | PTE_U;
-        
-        if (map_page(proc->page_table, vaddr, paddr, flags) != 0) {
-            /* Critical error - can't recover */
-            hal_uart_puts("FATAL: exec failed to map page at vaddr=0x");
-            hal_uart_put_hex(vaddr);
-            hal_uart_puts("\n");
-            process_exit(-1);
-        }
-    }
+    /* Flush the old mappings once, then release their pages */
+    tlb_gather_finish(&tlb);
     
-    /* 3. Add VMA for the new program */
-    if (process_add_vma(proc, min_addr, max_addr, VM_READ | VM_WRITE | VM_EXEC | VM_USER) != 0) {
-        hal_uart_puts("FATAL: exec failed to add VMA\n");
+    /* 2. Map new program into process's page table */
+    if (elf_install(proc, &img, &layout) != 0) {
+        /* Critical error - can't recover */
+        hal_uart_puts("FATAL: exec failed to map the new program\n");
+        elf_release(&layout);
         process_exit(-1);
     }
+    elf_release(&layout);
     
-    /* 4. Setup new user stack and copy argv to it */
+    /* 3. Setup new user stack and copy argv to it */
     /* Stack layout (growing down from USER_STACK_TOP):
      *   [argv strings]     - actual string data
      *   [padding for alignment]
@@ -510,13 +788,13 @@ int elf_exec_replace(const char *path, const char *argv[], int argc, struct trap
         argv_ptr[i] = user_argv[i];
     }
     
-    /* 5. Update trap frame to start at new entry point */
+    /* 4. Update trap frame to start at new entry point */
     /* CRITICAL: We modify the trap frame passed from syscall handler (on stack),
      * NOT proc->trap_frame. The trap handler will return using this tf. */
-    tf->sepc = ehdr.entry;
+    tf->sepc = img.entry;
     tf->sp = sp;  /* Stack pointer below argv */
     
-    /* 6. Clear registers except sp */
+    /* 5. Clear registers except sp */
     tf->ra = 0;
     tf->gp = 0;
     tf->tp = 0;
@@ -548,6 +826,9 @@ int elf_exec_replace(const char *path, const char *argv[], int argc, struct trap
     tf->t5 = 0;
     tf->t6 = 0;
     
+    /* The new image starts with the FPU off, like a fresh process */
+    fpu_release(proc, tf);
+    
     /* Extract program name from path (use kernel copy, not user pointer!) */
     const char *program_name = kpath;
     for (const char *p = kpath; *p; p++) {
@@ -555,12 +836,25 @@ int elf_exec_replace(const char *path, const char *argv[], int argc, struct trap
             program_name = p + 1;
         }
     }
+    write_seqcount_begin(&proc->seq);
     kstrcpy(proc->name, program_name);
+    write_seqcount_end(&proc->seq);
+    
+    /* A ring registered by the old image is gone with it */
+    proc->ring = NULL;
+    proc->ring_entries = 0;
+    
+    /* The old image is gone: restart the high-water mark from the new one */
+    proc->peak_rss_pages = 0;
+    process_update_mm_stats(proc);
     
     /* CRITICAL: Switch to the new page table BEFORE returning to user mode!
      * We just replaced the memory mappings, but the CPU is still using the old
      * page table. Without this switch, we'd execute the old code. */
-    switch_page_table(proc->page_table);
+    process_switch_page_table(proc);
+    
+    /* Same ASID as before exec: drop any stale translations for it */
+    tlb_flush(0);
     
     clear_errno();
     
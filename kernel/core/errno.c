@@ -141,6 +141,27 @@ const char *thunderos_strerror(int error_code) {
         case THUNDEROS_EMEM_BADPTE:  return "Invalid page table entry";
         case THUNDEROS_EMEM_DMA:     return "DMA allocation failed";
         
+        /* Network errors */
+        case THUNDEROS_ENOTSOCK:        return "Not a socket";
+        case THUNDEROS_EDESTADDRREQ:    return "Destination address required";
+        case THUNDEROS_EMSGSIZE:        return "Message too long";
+        case THUNDEROS_EPROTONOSUPPORT: return "Protocol not supported";
+        case THUNDEROS_EAFNOSUPPORT:    return "Address family not supported";
+        case THUNDEROS_EADDRINUSE:      return "Address already in use";
+        case THUNDEROS_EADDRNOTAVAIL:   return "Address not available";
+        case THUNDEROS_ENETDOWN:        return "Network is down";
+        case THUNDEROS_EHOSTUNREACH:    return "No route to host";
+        case THUNDEROS_ENOBUFS:         return "No buffer space available";
+        case THUNDEROS_ECONNREFUSED:    return "Connection refused";
+        case THUNDEROS_ECONNRESET:      return "Connection reset by peer";
+        case THUNDEROS_ETIMEDOUT:       return "Connection timed out";
+        case THUNDEROS_ENOTCONN:        return "Socket is not connected";
+        case THUNDEROS_EISCONN:         return "Socket is already connected";
+        case THUNDEROS_EINPROGRESS:     return "Connection in progress";
+        case THUNDEROS_EALREADY:        return "Connection already in progress";
+        case THUNDEROS_ENOPROTOOPT:     return "Protocol not available";
+        case THUNDEROS_EOPNOTSUPP:      return "Operation not supported on socket";
+        
         default:
             return "Unknown error";
     }
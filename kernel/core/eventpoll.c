@@ -0,0 +1,372 @@
+/**
+ * @file eventpoll.c
+ * @brief epoll instances, registrations and the ready list
+ *
+ * Each registration (epitem) owns one wait queue entry, hung on the
+ * queue that the watched descriptor's poll method names. Its callback
+ * puts the item on the instance's ready list and wakes epoll_wait()ers.
+ * The callbacks run with interrupts disabled and possibly from an
+ * interrupt handler, so the ready list is only touched with interrupts
+ * disabled; everything else runs under the big kernel lock.
+ */
+
+#include "kernel/eventpoll.h"
+#include "kernel/poll.h"
+#include "kernel/process.h"
+#include "kernel/constants.h"
+#include "kernel/errno.h"
+#include "hal/hal_timer.h"
+#include "arch/interrupt.h"
+#include "mm/kmalloc.h"
+#include "mm/slab.h"
+
+/**
+ * One watched descriptor of one instance
+ */
+typedef struct epitem {
+    poll_table_t pt;                /* Must be first: registers wait */
+    struct eventpoll *ep;           /* Owning instance */
+    int fd;                         /* Watched descriptor */
+    vfs_file_t *file;               /* Its open file */
+    uint32_t events;                /* EPOLL* interest */
+    uint64_t data;                  /* User data */
+    wait_queue_entry_t wait;        /* On the descriptor's wait queue */
+    int ready;                      /* On the ready list */
+    struct epitem *next;            /* Instance's item list */
+    struct epitem *ready_next;      /* Ready list */
+    struct epitem *file_next;       /* File's item list */
+} epitem_t;
+
+struct eventpoll {
+    epitem_t *items;                /* Every registration */
+    epitem_t *ready_head;           /* Registrations woken since last looked at */
+    epitem_t *ready_tail;
+    wait_queue_t wq;                /* epoll_wait() sleepers */
+    wait_queue_t poll_wq;           /* Pollers of the epoll descriptor itself */
+    int refs;                       /* Descriptors referring to it */
+};
+
+static kmem_cache_t *epitem_cache = NULL;
+
+/**
+ * Append an item to the ready list (interrupts disabled)
+ */
+static void ep_ready_add(eventpoll_t *ep, epitem_t *item) {
+    if (item->ready) {
+        return;
+    }
+    item->ready = 1;
+    item->ready_next = NULL;
+    if (ep->ready_tail) {
+        ep->ready_tail->ready_next = item;
+    } else {
+        ep->ready_head = item;
+    }
+    ep->ready_tail = item;
+}
+
+/**
+ * Take an item off the ready list wherever it is (interrupts disabled)
+ */
+static void ep_ready_del(eventpoll_t *ep, epitem_t *item) {
+    if (!item->ready) {
+        return;
+    }
+    epitem_t **link = &ep->ready_head;
+    epitem_t *prev = NULL;
+    while (*link && *link != item) {
+        prev = *link;
+        link = &(*link)->ready_next;
+    }
+    if (*link) {
+        *link = item->ready_next;
+        if (ep->ready_tail == item) {
+            ep->ready_tail = prev;
+        }
+    }
+    item->ready = 0;
+}
+
+/**
+ * Wait queue callback: the watched descriptor may have changed
+ */
+static int ep_item_wake(wait_queue_entry_t *entry) {
+    epitem_t *item = (epitem_t *)entry->private;
+    eventpoll_t *ep = item->ep;
+
+    ep_ready_add(ep, item);
+    return wait_queue_wake(&ep->wq) + wait_queue_wake(&ep->poll_wq);
+}
+
+/**
+ * poll_wait() callback of an item: register on the descriptor's queue
+ */
+static void ep_item_queue(poll_table_t *pt, wait_queue_t *wq) {
+    epitem_t *item = (epitem_t *)pt;
+
+    // One queue per descriptor is all our poll methods name
+    if (!item->wait.wq) {
+        wait_queue_add(wq, &item->wait, ep_item_wake, item);
+    }
+}
+
+/**
+ * Find the item for a descriptor and the open file on it
+ *
+ * Descriptor numbers are per process, so the open file is part of the key.
+ */
+static epitem_t *ep_find(eventpoll_t *ep, int fd, vfs_file_t *file) {
+    for (epitem_t *item = ep->items; item; item = item->next) {
+        if (item->fd == fd && item->file == file) {
+            return item;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Unregister an item and free it
+ */
+static void ep_remove(eventpoll_t *ep, epitem_t *item) {
+    wait_queue_del(&item->wait);
+
+    int irq_state = interrupt_save_disable();
+    ep_ready_del(ep, item);
+    interrupt_restore(irq_state);
+
+    for (epitem_t **link = &ep->items; *link; link = &(*link)->next) {
+        if (*link == item) {
+            *link = item->next;
+            break;
+        }
+    }
+    epitem_t *prev = NULL;
+    for (epitem_t *cur = (epitem_t *)item->file->epitems; cur; prev = cur, cur = cur->file_next) {
+        if (cur == item) {
+            if (prev) {
+                prev->file_next = item->file_next;
+            } else {
+                item->file->epitems = item->file_next;
+            }
+            break;
+        }
+    }
+
+    kmem_cache_free(epitem_cache, item);
+}
+
+eventpoll_t *eventpoll_create(void) {
+    if (!epitem_cache) {
+        epitem_cache = kmem_cache_create("epitem", sizeof(epitem_t), 0, NULL);
+        if (!epitem_cache) {
+            RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+        }
+    }
+
+    eventpoll_t *ep = kmalloc(sizeof(eventpoll_t));
+    if (!ep) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+    ep->items = NULL;
+    ep->ready_head = NULL;
+    ep->ready_tail = NULL;
+    wait_queue_init(&ep->wq);
+    wait_queue_init(&ep->poll_wq);
+    ep->refs = 1;
+
+    clear_errno();
+    return ep;
+}
+
+void eventpoll_get(eventpoll_t *ep) {
+    ep->refs++;
+}
+
+void eventpoll_put(eventpoll_t *ep) {
+    if (--ep->refs > 0) {
+        return;
+    }
+    while (ep->items) {
+        ep_remove(ep, ep->items);
+    }
+    kfree(ep);
+}
+
+int eventpoll_ctl(eventpoll_t *ep, int op, int fd, const struct epoll_event *event) {
+    vfs_file_t *file = vfs_get_file(fd);
+    if (!file) {
+        /* errno already set by vfs_get_file */
+        return -1;
+    }
+    if (file->type == VFS_TYPE_EPOLL) {
+        // Nesting would let instances wake each other in a loop
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    epitem_t *item = ep_find(ep, fd, file);
+    int irq_state;
+
+    switch (op) {
+        case EPOLL_CTL_ADD:
+            if (item) {
+                RETURN_ERRNO(THUNDEROS_EEXIST);
+            }
+            item = kmem_cache_alloc(epitem_cache);
+            if (!item) {
+                RETURN_ERRNO(THUNDEROS_ENOMEM);
+            }
+            item->pt.queue = ep_item_queue;
+            item->ep = ep;
+            item->fd = fd;
+            item->file = file;
+            item->events = event->events;
+            item->data = event->data;
+            item->wait.wq = NULL;
+            item->ready = 0;
+            item->next = ep->items;
+            ep->items = item;
+            item->file_next = (epitem_t *)file->epitems;
+            file->epitems = item;
+
+            // Register, then look: anything from here on is a wakeup
+            if (poll_file(file, &item->pt) & (item->events | POLL_ALWAYS)) {
+                irq_state = interrupt_save_disable();
+                ep_ready_add(ep, item);
+                interrupt_restore(irq_state);
+                wait_queue_wake(&ep->wq);
+                wait_queue_wake(&ep->poll_wq);
+            }
+            break;
+
+        case EPOLL_CTL_MOD:
+            if (!item) {
+                RETURN_ERRNO(THUNDEROS_ENOENT);
+            }
+            item->events = event->events;
+            item->data = event->data;
+            if (poll_file(file, NULL) & (item->events | POLL_ALWAYS)) {
+                irq_state = interrupt_save_disable();
+                ep_ready_add(ep, item);
+                interrupt_restore(irq_state);
+                wait_queue_wake(&ep->wq);
+                wait_queue_wake(&ep->poll_wq);
+            }
+            break;
+
+        case EPOLL_CTL_DEL:
+            if (!item) {
+                RETURN_ERRNO(THUNDEROS_ENOENT);
+            }
+            ep_remove(ep, item);
+            break;
+
+        default:
+            RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Report ready items into events
+ *
+ * Only items on the ready list are looked at. Each is polled again,
+ * since a wakeup does not say what changed; level-triggered items that
+ * are still ready go back on the list for next time.
+ */
+static int ep_harvest(eventpoll_t *ep, struct epoll_event *events, int maxevents) {
+    int irq_state = interrupt_save_disable();
+    epitem_t *list = ep->ready_head;
+    ep->ready_head = NULL;
+    ep->ready_tail = NULL;
+    for (epitem_t *item = list; item; item = item->ready_next) {
+        item->ready = 0;
+    }
+    interrupt_restore(irq_state);
+
+    int n = 0;
+    epitem_t *item = list;
+    while (item) {
+        epitem_t *next = item->ready_next;
+        int requeue;
+
+        if (n < maxevents) {
+            uint32_t mask = (uint32_t)poll_file(item->file, NULL) & (item->events | POLL_ALWAYS);
+            if (mask) {
+                events[n].events = mask;
+                events[n].data = item->data;
+                n++;
+            }
+            // Level-triggered and still ready: report it again next time
+            requeue = mask && !(item->events & EPOLLET);
+        } else {
+            // No room left: look at it next time
+            requeue = 1;
+        }
+
+        if (requeue) {
+            irq_state = interrupt_save_disable();
+            ep_ready_add(ep, item);
+            interrupt_restore(irq_state);
+        }
+        item = next;
+    }
+    return n;
+}
+
+int eventpoll_wait(eventpoll_t *ep, struct epoll_event *events, int maxevents, int timeout_ms) {
+    if (maxevents <= 0) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    wait_queue_entry_t entry;
+    poll_waiter_t pw;
+    poll_waiter_init(&pw, &entry, 1);
+    poll_wait(&pw.pt, &ep->wq);
+
+    uint64_t deadline_us = 0;
+    if (timeout_ms > 0) {
+        deadline_us = hal_timer_get_time_us() + (uint64_t)timeout_ms * MICROSECONDS_PER_MILLISECOND;
+    }
+
+    int n;
+    int error = 0;
+    for (;;) {
+        n = ep_harvest(ep, events, maxevents);
+        if (n > 0 || timeout_ms == 0) {
+            break;
+        }
+        if (poll_signal_pending()) {
+            error = THUNDEROS_EINTR;
+            break;
+        }
+        if (deadline_us && hal_timer_get_time_us() >= deadline_us) {
+            break;
+        }
+        poll_waiter_sleep(&pw, deadline_us);
+    }
+
+    poll_waiter_release(&pw);
+
+    if (error) {
+        RETURN_ERRNO(error);
+    }
+    clear_errno();
+    return n;
+}
+
+int eventpoll_poll(eventpoll_t *ep, poll_table_t *pt) {
+    if (!ep) {
+        return POLLNVAL;
+    }
+    poll_wait(pt, &ep->poll_wq);
+    return ep->ready_head ? POLLIN : 0;
+}
+
+void eventpoll_file_release(vfs_file_t *file) {
+    while (file->epitems) {
+        epitem_t *item = (epitem_t *)file->epitems;
+        ep_remove(item->ep, item);
+    }
+}
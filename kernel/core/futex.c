@@ -0,0 +1,292 @@
+/**
+ * @file futex.c
+ * @brief Futex wait/wake implementation for ThunderOS
+ *
+ * Sleepers are kept in a hash table of FIFO lists keyed by futex word.
+ * Each waiter lives on its sleeper's kernel stack, like a wait queue
+ * entry, and records the bucket it is linked on: wakers clear that to
+ * say it was woken, and FUTEX_REQUEUE moves it to another bucket. A
+ * sleeper woken some other way unlinks itself before returning.
+ */
+
+#include "kernel/futex.h"
+#include "kernel/process.h"
+#include "kernel/scheduler.h"
+#include "kernel/spinlock.h"
+#include "kernel/errno.h"
+#include "mm/paging.h"
+#include "arch/interrupt.h"
+#include <stddef.h>
+
+/**
+ * @brief Identity of a futex word
+ *
+ * space is the owning page table for a private futex and 0 for a shared
+ * one, whose addr is then physical.
+ */
+typedef struct futex_key {
+    uintptr_t space;
+    uintptr_t addr;
+} futex_key_t;
+
+struct futex_bucket;
+
+/**
+ * @brief One process sleeping in futex_wait()
+ */
+typedef struct futex_waiter {
+    futex_key_t key;                        /**< Futex it waits on */
+    struct process *proc;                   /**< Sleeping process */
+    struct futex_bucket *volatile bucket;   /**< Bucket it is on (NULL once woken) */
+    struct futex_waiter *prev;              /**< Previous waiter in the bucket */
+    struct futex_waiter *next;              /**< Next waiter in the bucket */
+} futex_waiter_t;
+
+/**
+ * @brief Hash bucket: waiters of every futex hashing here, oldest first
+ */
+typedef struct futex_bucket {
+    spinlock_t lock;
+    futex_waiter_t *head;
+    futex_waiter_t *tail;
+} futex_bucket_t;
+
+// Zeroed buckets are empty with their locks free (SPINLOCK_INIT)
+static futex_bucket_t futex_buckets[FUTEX_HASH_BUCKETS];
+
+static inline futex_bucket_t *futex_hash(const futex_key_t *key) {
+    uint64_t hash = ((key->addr >> 2) ^ (key->space >> 12)) * 0x9E3779B97F4A7C15ULL;
+    return &futex_buckets[(hash >> 32) % FUTEX_HASH_BUCKETS];
+}
+
+static inline int futex_key_equal(const futex_key_t *a, const futex_key_t *b) {
+    return a->space == b->space && a->addr == b->addr;
+}
+
+/**
+ * @brief Work out the key of a user futex word
+ */
+static int futex_get_key(struct process *proc, uint32_t *uaddr, futex_key_t *key) {
+    uintptr_t addr = (uintptr_t)uaddr;
+
+    if (!proc || (addr & (sizeof(uint32_t) - 1)) != 0) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (!process_validate_user_ptr(proc, uaddr, sizeof(uint32_t), VM_USER | VM_READ)) {
+        RETURN_ERRNO(THUNDEROS_EFAULT);
+    }
+
+    vm_area_t *vma = process_find_vma(proc, addr);
+    if (vma && (vma->flags & VM_SHARED)) {
+        // Fault the page in so it has a physical address to key on
+        (void)*(volatile uint32_t *)uaddr;
+
+        uintptr_t phys;
+        if (virt_to_phys(proc->page_table, addr, &phys) != 0) {
+            RETURN_ERRNO(THUNDEROS_EFAULT);
+        }
+        key->space = 0;
+        key->addr = phys;
+    } else {
+        key->space = (uintptr_t)proc->page_table;
+        key->addr = addr;
+    }
+    return 0;
+}
+
+/**
+ * @brief Append a waiter to a bucket (bucket locked)
+ */
+static void futex_link(futex_bucket_t *bucket, futex_waiter_t *waiter) {
+    waiter->bucket = bucket;
+    waiter->prev = bucket->tail;
+    waiter->next = NULL;
+
+    if (bucket->tail) {
+        bucket->tail->next = waiter;
+    } else {
+        bucket->head = waiter;
+    }
+    bucket->tail = waiter;
+}
+
+/**
+ * @brief Remove a waiter from its bucket (bucket locked)
+ */
+static void futex_unlink(futex_bucket_t *bucket, futex_waiter_t *waiter) {
+    if (waiter->prev) {
+        waiter->prev->next = waiter->next;
+    } else {
+        bucket->head = waiter->next;
+    }
+
+    if (waiter->next) {
+        waiter->next->prev = waiter->prev;
+    } else {
+        bucket->tail = waiter->prev;
+    }
+
+    waiter->bucket = NULL;
+}
+
+/**
+ * @brief Unlink a waiter and make its process runnable (bucket locked)
+ */
+static void futex_wake_waiter(futex_bucket_t *bucket, futex_waiter_t *waiter) {
+    struct process *proc = waiter->proc;
+
+    // Once unlinked the waiter may vanish with its stack frame
+    futex_unlink(bucket, waiter);
+
+    if (proc->state == PROC_SLEEPING) {
+        proc->state = PROC_READY;
+        scheduler_enqueue(proc);
+    }
+}
+
+/**
+ * @brief Sleep on a futex word if it still holds the expected value
+ */
+int futex_wait(uint32_t *uaddr, uint32_t val) {
+    struct process *current = process_current();
+    futex_key_t key;
+
+    if (futex_get_key(current, uaddr, &key) != 0) {
+        return -1;  /* errno already set */
+    }
+
+    futex_bucket_t *bucket = futex_hash(&key);
+    futex_waiter_t waiter;
+    waiter.key = key;
+    waiter.proc = current;
+
+    int irq_state = spin_lock_irqsave(&bucket->lock);
+
+    // Wakers take this lock after changing the word, so either we see the
+    // change here or they see us queued
+    if (*(volatile uint32_t *)uaddr != val) {
+        spin_unlock_irqrestore(&bucket->lock, irq_state);
+        RETURN_ERRNO(THUNDEROS_EAGAIN);
+    }
+
+    futex_link(bucket, &waiter);
+    current->state = PROC_SLEEPING;
+    scheduler_dequeue(current);
+
+    spin_unlock_irqrestore(&bucket->lock, irq_state);
+
+    schedule();
+
+    // Still queued means something other than a futex wake ended the sleep;
+    // a requeue may move us between our read of the bucket and locking it
+    for (;;) {
+        futex_bucket_t *queued_on = waiter.bucket;
+        if (!queued_on) {
+            break;
+        }
+
+        irq_state = spin_lock_irqsave(&queued_on->lock);
+        if (waiter.bucket == queued_on) {
+            futex_unlink(queued_on, &waiter);
+            spin_unlock_irqrestore(&queued_on->lock, irq_state);
+            RETURN_ERRNO(THUNDEROS_EINTR);
+        }
+        spin_unlock_irqrestore(&queued_on->lock, irq_state);
+    }
+
+    clear_errno();
+    return 0;
+}
+
+/**
+ * @brief Wake processes sleeping on a futex word
+ */
+int futex_wake(uint32_t *uaddr, int nr_wake) {
+    futex_key_t key;
+
+    if (futex_get_key(process_current(), uaddr, &key) != 0) {
+        return -1;  /* errno already set */
+    }
+
+    futex_bucket_t *bucket = futex_hash(&key);
+    int woken = 0;
+
+    int irq_state = spin_lock_irqsave(&bucket->lock);
+
+    futex_waiter_t *waiter = bucket->head;
+    while (waiter && woken < nr_wake) {
+        futex_waiter_t *next = waiter->next;
+        if (futex_key_equal(&waiter->key, &key)) {
+            futex_wake_waiter(bucket, waiter);
+            woken++;
+        }
+        waiter = next;
+    }
+
+    spin_unlock_irqrestore(&bucket->lock, irq_state);
+
+    clear_errno();
+    return woken;
+}
+
+/**
+ * @brief Wake some sleepers and move the rest to another futex
+ */
+int futex_requeue(uint32_t *uaddr, int nr_wake, uint32_t *uaddr2, int nr_requeue) {
+    struct process *current = process_current();
+    futex_key_t key, key2;
+
+    if (futex_get_key(current, uaddr, &key) != 0 ||
+        futex_get_key(current, uaddr2, &key2) != 0) {
+        return -1;  /* errno already set */
+    }
+
+    futex_bucket_t *bucket = futex_hash(&key);
+    futex_bucket_t *bucket2 = futex_hash(&key2);
+    int woken = 0;
+    int moved = 0;
+
+    // Two buckets are always locked in address order
+    int irq_state = interrupt_save_disable();
+    if (bucket < bucket2) {
+        spin_lock(&bucket->lock);
+        spin_lock(&bucket2->lock);
+    } else if (bucket2 < bucket) {
+        spin_lock(&bucket2->lock);
+        spin_lock(&bucket->lock);
+    } else {
+        spin_lock(&bucket->lock);
+    }
+
+    // Stop at the old tail: waiters requeued onto this bucket go after it
+    futex_waiter_t *last = bucket->tail;
+    futex_waiter_t *waiter = bucket->head;
+    while (waiter && (woken < nr_wake || moved < nr_requeue)) {
+        futex_waiter_t *next = waiter->next;
+        int at_last = waiter == last;
+        if (futex_key_equal(&waiter->key, &key)) {
+            if (woken < nr_wake) {
+                futex_wake_waiter(bucket, waiter);
+                woken++;
+            } else {
+                futex_unlink(bucket, waiter);
+                waiter->key = key2;
+                futex_link(bucket2, waiter);
+                moved++;
+            }
+        }
+        if (at_last) {
+            break;
+        }
+        waiter = next;
+    }
+
+    if (bucket != bucket2) {
+        spin_unlock(&bucket2->lock);
+    }
+    spin_unlock(&bucket->lock);
+    interrupt_restore(irq_state);
+
+    clear_errno();
+    return woken;
+}
@@ -0,0 +1,142 @@
+/*
+ * High-Resolution Timer Implementation
+ *
+ * Pending timers are kept on one list sorted by deadline: there are few
+ * of them (about one per sleeping process), the interrupt only ever needs
+ * the first, and removal is O(1) through pprev. Inserting is a walk of
+ * the list.
+ */
+
+#include "kernel/hrtimer.h"
+#include "kernel/timer_wheel.h"
+#include "kernel/scheduler.h"
+#include "kernel/prof.h"
+#include "hal/hal_timer.h"
+#include "drivers/vterm.h"
+#include "arch/interrupt.h"
+#include <stddef.h>
+
+static hrtimer_t *hrtimer_head = NULL;
+
+/**
+ * Take a timer off the list (interrupts must be disabled)
+ */
+static void hrtimer_unlink(hrtimer_t *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/**
+ * Initialise a timer
+ */
+void hrtimer_setup(hrtimer_t *timer, hrtimer_fn_t fn, void *data) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires_us = 0;
+    timer->fn = fn;
+    timer->data = data;
+}
+
+/**
+ * Arm or re-arm a timer
+ */
+void hrtimer_start(hrtimer_t *timer, uint64_t expires_us) {
+    int irq_state = interrupt_save_disable();
+
+    if (timer->pprev) {
+        hrtimer_unlink(timer);
+    }
+    timer->expires_us = expires_us;
+
+    // Behind every timer due no later, so equal deadlines fire in order
+    hrtimer_t **link = &hrtimer_head;
+    while (*link && (*link)->expires_us <= expires_us) {
+        link = &(*link)->next;
+    }
+    timer->next = *link;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = link;
+    *link = timer;
+
+    // A new earliest deadline may be before the programmed interrupt
+    if (hrtimer_head == timer) {
+        hrtimer_reprogram();
+    }
+
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Disarm a timer
+ */
+int hrtimer_cancel(hrtimer_t *timer) {
+    int irq_state = interrupt_save_disable();
+
+    int was_pending = timer->pprev != NULL;
+    if (was_pending) {
+        hrtimer_unlink(timer);
+    }
+
+    interrupt_restore(irq_state);
+    return was_pending;
+}
+
+/**
+ * Run every timer due at or before now
+ */
+void hrtimer_run(uint64_t now_us) {
+    int irq_state = interrupt_save_disable();
+
+    while (hrtimer_head && hrtimer_head->expires_us <= now_us) {
+        hrtimer_t *timer = hrtimer_head;
+        hrtimer_unlink(timer);
+        timer->fn(timer->data);
+    }
+
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Program the timer interrupt for the next event
+ */
+void hrtimer_reprogram(void) {
+    int irq_state = interrupt_save_disable();
+
+    uint64_t next_tick = hal_timer_tick_time_us(hal_timer_get_ticks() + 1);
+    uint64_t slice_end = scheduler_next_event_us();
+    uint64_t deadline;
+
+    if (slice_end != UINT64_MAX) {
+        // Busy: keep the tick for accounting and wakeup preemption, and
+        // end the slice on time if it runs out first
+        deadline = slice_end < next_tick ? slice_end : next_tick;
+    } else if (vterm_available()) {
+        // Idle, but the console has no receive interrupt and is polled
+        deadline = next_tick;
+    } else {
+        // Idle: sleep until the wheel has something to run
+        uint64_t tick = timer_wheel_next_expiry();
+        deadline = tick == UINT64_MAX ? UINT64_MAX : hal_timer_tick_time_us(tick);
+    }
+
+    if (hrtimer_head && hrtimer_head->expires_us < deadline) {
+        deadline = hrtimer_head->expires_us;
+    }
+
+    // The profiler samples on its own period, busy or idle
+    uint64_t sample = prof_next_sample_us();
+    if (sample < deadline) {
+        deadline = sample;
+    }
+
+    hal_timer_set_deadline(deadline == UINT64_MAX ? HAL_TIMER_NO_DEADLINE
+                                                  : (unsigned long)deadline);
+
+    interrupt_restore(irq_state);
+}
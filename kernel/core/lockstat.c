@@ -0,0 +1,75 @@
+/**
+ * @file lockstat.c
+ * @brief Lock contention statistics per lock class
+ *
+ * Slots are claimed in order with a compare-and-swap on the key and never
+ * given back, so a lock can keep a pointer to its class for good and a
+ * lookup never needs a lock of its own (spinlocks report from inside
+ * spin_lock()).
+ */
+
+#include "kernel/lockstat.h"
+#include <stddef.h>
+
+static lockstat_class_t lockstat_classes[LOCKSTAT_MAX_CLASSES];
+
+static const char *lockstat_kind_names[] = {
+    "spin", "mutex", "rwlock_r", "rwlock_w", "condvar",
+};
+
+/**
+ * Find or add a class
+ */
+lockstat_class_t *lockstat_class(uint32_t kind, const void *key, const char *name) {
+    for (int i = 0; i < LOCKSTAT_MAX_CLASSES - 1; i++) {
+        lockstat_class_t *cls = &lockstat_classes[i];
+        if (!cls->key && __sync_bool_compare_and_swap(&cls->key, NULL, key)) {
+            cls->kind = kind;
+            cls->name = name;
+            return cls;
+        }
+        // A CPU adding the same class at the same moment may add a twin
+        // (its kind is set just after the key); both are listed
+        if (cls->key == key && cls->kind == kind) {
+            return cls;
+        }
+    }
+
+    lockstat_class_t *other = &lockstat_classes[LOCKSTAT_MAX_CLASSES - 1];
+    if (!other->key) {
+        other->name = "(other)";
+        other->key = other;
+    }
+    return other;
+}
+
+void lockstat_acquired(lockstat_class_t *cls) {
+    __sync_fetch_and_add(&cls->acquisitions, 1);
+}
+
+void lockstat_waited(lockstat_class_t *cls, uint64_t wait_us, uintptr_t site) {
+    __sync_fetch_and_add(&cls->contended, 1);
+    __sync_fetch_and_add(&cls->wait_us, wait_us);
+    __sync_fetch_and_add(&cls->wait_hist[lockstat_bucket(wait_us)], 1);
+    // Racing waits may pair a maximum with the other's site; rare and harmless
+    if (atomic_max64(&cls->max_wait_us, wait_us)) {
+        cls->max_wait_site = site;
+    }
+}
+
+void lockstat_held(lockstat_class_t *cls, uint64_t hold_us) {
+    __sync_fetch_and_add(&cls->hold_us, hold_us);
+    __sync_fetch_and_add(&cls->hold_hist[lockstat_bucket(hold_us)], 1);
+    atomic_max64(&cls->max_hold_us, hold_us);
+}
+
+const lockstat_class_t *lockstat_get(uint32_t index) {
+    if (index >= LOCKSTAT_MAX_CLASSES || !lockstat_classes[index].key) {
+        return NULL;
+    }
+    return &lockstat_classes[index];
+}
+
+const char *lockstat_kind_name(uint32_t kind) {
+    return kind <= LOCKSTAT_CONDVAR ? lockstat_kind_names[kind] : "?";
+}
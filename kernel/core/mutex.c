@@ -11,6 +11,9 @@
 #include "kernel/scheduler.h"
 #include "kernel/errno.h"
 #include "kernel/constants.h"
+#include "kernel/smp.h"
+#include "kernel/lockstat.h"
+#include "hal/hal_timer.h"
 #include "arch/interrupt.h"
 
 /* Forward declaration to avoid circular includes */
@@ -30,15 +33,130 @@ void mutex_init(mutex_t *mutex) {
     
     mutex->locked = MUTEX_UNLOCKED;
     mutex->owner_pid = -1;
+    mutex->owner = NULL;
+    mutex->pi_next = NULL;
     wait_queue_init(&mutex->waiters);
+#ifdef LOCKSTAT
+    // Mutexes set up by the same code are one class
+    mutex->lockstat = lockstat_class(LOCKSTAT_MUTEX, (const void *)LOCKSTAT_SITE(), NULL);
+#endif
+}
+
+/* ========================================================================
+ * Priority Inheritance
+ *
+ * A process sleeping on a mutex lends its priority to the owner, and on
+ * down the chain if that owner is itself blocked on a mutex. An owner's
+ * effective priority is always the best of its base priority and those
+ * of the waiters on every mutex it holds, recomputed when it releases
+ * one. All of this runs with interrupts disabled.
+ * ======================================================================== */
+
+/**
+ * @brief Recompute a process's priority from the mutexes it holds
+ */
+static void mutex_pi_update(struct process *proc) {
+    uint64_t priority = proc->base_priority;
+    
+    for (mutex_t *held = proc->pi_held; held; held = held->pi_next) {
+        for (wait_queue_entry_t *entry = held->waiters.head; entry; entry = entry->next) {
+            if (entry->proc->priority < priority) {
+                priority = entry->proc->priority;
+            }
+        }
+    }
+    
+    scheduler_set_priority(proc, priority);
+}
+
+/**
+ * @brief Lend a blocking process's priority down the chain of owners
+ */
+static void mutex_pi_boost(mutex_t *mutex, struct process *waiter) {
+    uint64_t priority = waiter->priority;
+    
+    for (int depth = 0; mutex && depth < MUTEX_PI_MAX_DEPTH; depth++) {
+        struct process *owner = mutex->owner;
+        if (!owner || owner == waiter || owner->priority <= priority) {
+            break;
+        }
+        scheduler_set_priority(owner, priority);
+        mutex = owner->pi_blocked_on;
+    }
+}
+
+/**
+ * @brief Make a process the owner of a free mutex
+ */
+static void mutex_set_owner(mutex_t *mutex, struct process *proc) {
+    mutex->locked = MUTEX_LOCKED;
+    mutex->owner = proc;
+    mutex->owner_pid = proc ? proc->pid : -1;
+    
+    if (proc) {
+        mutex->pi_next = proc->pi_held;
+        proc->pi_held = mutex;
+    }
+    
+#ifdef LOCKSTAT
+    if (mutex->lockstat) {
+        lockstat_acquired(mutex->lockstat);
+        mutex->locked_at_us = hal_timer_get_time_us();
+    }
+#endif
+}
+
+/**
+ * @brief Take a mutex away from its owner, dropping any boost it lent
+ */
+static void mutex_clear_owner(mutex_t *mutex) {
+    struct process *owner = mutex->owner;
+    
+#ifdef LOCKSTAT
+    if (mutex->lockstat) {
+        lockstat_held(mutex->lockstat, hal_timer_get_time_us() - mutex->locked_at_us);
+    }
+#endif
+    
+    mutex->locked = MUTEX_UNLOCKED;
+    mutex->owner = NULL;
+    mutex->owner_pid = -1;
+    
+    if (owner) {
+        mutex_t **link = &owner->pi_held;
+        while (*link && *link != mutex) {
+            link = &(*link)->pi_next;
+        }
+        if (*link) {
+            *link = mutex->pi_next;
+        }
+        mutex->pi_next = NULL;
+        mutex_pi_update(owner);
+    }
+}
+
+/**
+ * @brief Check whether spinning on a held mutex can pay off
+ *
+ * Only while its owner is on another CPU and so may release it soon, and
+ * only while nobody sleeps on it: they are owed the mutex first.
+ */
+static int mutex_should_spin(mutex_t *mutex, struct process *current) {
+    struct process *owner = mutex->owner;
+    
+    return mutex->locked == MUTEX_LOCKED &&
+           owner && owner != current && owner->state == PROC_RUNNING &&
+           wait_queue_empty(&mutex->waiters);
 }
 
 /**
  * @brief Acquire a mutex (blocking)
  *
- * Atomically checks if the mutex is unlocked and acquires it.
- * If the mutex is already held, the calling process is added to the
- * wait queue and put to sleep until the mutex becomes available.
+ * Takes the mutex if it is unlocked. Otherwise spins for up to
+ * MUTEX_SPIN_US while the owner is running elsewhere, letting other CPUs
+ * into the kernel meanwhile so the owner can get to mutex_unlock(). If
+ * the mutex is still held, the calling process sleeps on the wait queue
+ * until mutex_unlock() hands the mutex to it.
  *
  * @param mutex Pointer to mutex to acquire
  */
@@ -47,25 +165,53 @@ void mutex_lock(mutex_t *mutex) {
         return;
     }
     
+    struct process *current = process_current();
     uint64_t flags = interrupt_save_disable();
     
-    /* Spin until we can acquire the lock */
-    while (mutex->locked == MUTEX_LOCKED) {
-        /* Add ourselves to the wait queue and sleep */
+#ifdef LOCKSTAT
+    // MUTEX_INIT mutexes join the class of the first code to take them
+    uintptr_t site = LOCKSTAT_SITE();
+    if (!mutex->lockstat) {
+        mutex->lockstat = lockstat_class(LOCKSTAT_MUTEX, (const void *)site, NULL);
+    }
+#endif
+    
+    if (mutex->locked == MUTEX_UNLOCKED) {
+        mutex_set_owner(mutex, current);
         interrupt_restore(flags);
-        wait_queue_sleep(&mutex->waiters);
-        flags = interrupt_save_disable();
+        return;
     }
+    interrupt_restore(flags);
     
-    /* We got the lock */
-    mutex->locked = MUTEX_LOCKED;
+    /* Spin phase: short hold times are cheaper to wait out than to sleep */
+    uint64_t wait_start = hal_timer_get_time_us();
+    uint64_t deadline = wait_start + MUTEX_SPIN_US;
+    while (mutex_should_spin(mutex, current) &&
+           hal_timer_get_time_us() < deadline) {
+        bkl_relax();
+    }
     
-    /* Record owner (get current process PID) */
-    struct process *current = process_current();
-    if (current) {
-        mutex->owner_pid = current->pid;
+    flags = interrupt_save_disable();
+    
+    /* Sleep phase: the unlocker makes us the owner before waking us */
+    while (mutex->owner != current || mutex->locked == MUTEX_UNLOCKED) {
+        if (mutex->locked == MUTEX_UNLOCKED) {
+            mutex_set_owner(mutex, current);
+            break;
+        }
+        
+        /* Add ourselves to the wait queue and sleep, boosting the owner */
+        current->pi_blocked_on = mutex;
+        mutex_pi_boost(mutex, current);
+        interrupt_restore(flags);
+        wait_queue_sleep(&mutex->waiters);
+        flags = interrupt_save_disable();
+        current->pi_blocked_on = NULL;
     }
     
+#ifdef LOCKSTAT
+    lockstat_waited(mutex->lockstat, hal_timer_get_time_us() - wait_start, site);
+#endif
     interrupt_restore(flags);
 }
 
@@ -91,12 +237,7 @@ int mutex_trylock(mutex_t *mutex) {
     }
     
     /* Acquire the lock */
-    mutex->locked = MUTEX_LOCKED;
-    
-    struct process *current = process_current();
-    if (current) {
-        mutex->owner_pid = current->pid;
-    }
+    mutex_set_owner(mutex, process_current());
     
     interrupt_restore(flags);
     clear_errno();
@@ -106,7 +247,9 @@ int mutex_trylock(mutex_t *mutex) {
 /**
  * @brief Release a mutex
  *
- * Releases the mutex and wakes one waiting process if any.
+ * Hands the mutex to the oldest waiting process and wakes it, or
+ * unlocks it if nobody is waiting. The mutex never becomes free while a
+ * waiter is queued, so a newcomer cannot take it ahead of the waiters.
  * Should only be called by the process that holds the lock.
  *
  * @param mutex Pointer to mutex to release
@@ -118,14 +261,22 @@ void mutex_unlock(mutex_t *mutex) {
     
     uint64_t flags = interrupt_save_disable();
     
-    /* Release the lock */
-    mutex->locked = MUTEX_UNLOCKED;
-    mutex->owner_pid = -1;
+    struct process *next = wait_queue_peek(&mutex->waiters);
     
-    interrupt_restore(flags);
+    /* Our boost from this mutex's waiters ends here */
+    mutex_clear_owner(mutex);
     
-    /* Wake one waiting process */
-    wait_queue_wake_one(&mutex->waiters);
+    if (next) {
+        /* Direct hand-off: stays locked, now on behalf of the waiter */
+        mutex_set_owner(mutex, next);
+        wait_queue_wake_one(&mutex->waiters);
+        next->pi_blocked_on = NULL;
+        
+        /* It inherits from whoever still waits */
+        mutex_pi_update(next);
+    }
+    
+    interrupt_restore(flags);
 }
 
 /**
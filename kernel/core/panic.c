@@ -6,6 +6,7 @@
 
 #include "kernel/panic.h"
 #include "kernel/kstring.h"
+#include "kernel/bootstage.h"
 #include "hal/hal_uart.h"
 #include "arch/interrupt.h"
 
@@ -19,6 +20,9 @@ void kernel_panic(const char *message) {
     // Disable all interrupts immediately
     interrupt_disable();
     
+    // A quiet boot holds output back; show it, then the panic
+    bootstage_flush_log();
+    
     // Print panic banner
     hal_uart_puts("\n");
     hal_uart_puts("================================================================================\n");
@@ -0,0 +1,80 @@
+/**
+ * @file pcpu_ring.c
+ * @brief Per-CPU single-producer record rings (readers' side)
+ */
+
+#include "kernel/pcpu_ring.h"
+#include "kernel/smp.h"
+#include "kernel/errno.h"
+#include "kernel/kstring.h"
+#include "mm/kmalloc.h"
+#include <stddef.h>
+
+int pcpu_rings_alloc(pcpu_rings_t *rings) {
+    for (int i = 0; i < MAX_CPUS; i++) {
+        if (!cpu_get(i) || rings->cpu[i].slots) {
+            continue;
+        }
+        rings->cpu[i].slots = kmalloc((size_t)rings->entries * rings->record_size);
+        if (!rings->cpu[i].slots) {
+            RETURN_ERRNO(THUNDEROS_ENOMEM);
+        }
+    }
+    clear_errno();
+    return 0;
+}
+
+uint32_t pcpu_rings_drain(pcpu_rings_t *rings, void *buf, uint32_t max) {
+    uint8_t *out = (uint8_t *)buf;
+    uint32_t taken = 0;
+
+    for (int i = 0; i < MAX_CPUS && taken < max; i++) {
+        pcpu_ring_t *ring = &rings->cpu[i];
+        uint32_t head = ring->head;
+        uint32_t tail = ring->tail;
+
+        // Records are read only after the tail that published them
+        read_barrier();
+        while (head != tail && taken < max) {
+            kmemcpy(out + (size_t)taken * rings->record_size,
+                    ring->slots + (head & (rings->entries - 1)) * rings->record_size,
+                    rings->record_size);
+            taken++;
+            head++;
+        }
+
+        // Done with the slots before the writer may reuse them
+        memory_barrier();
+        ring->head = head;
+    }
+    return taken;
+}
+
+int pcpu_rings_read(pcpu_rings_t *rings, void *buffer, uint32_t size) {
+    if (size < rings->record_size) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    uint32_t taken = pcpu_rings_drain(rings, buffer, size / rings->record_size);
+    clear_errno();
+    return (int)(taken * rings->record_size);
+}
+
+void pcpu_rings_reset(pcpu_rings_t *rings) {
+    for (int i = 0; i < MAX_CPUS; i++) {
+        pcpu_ring_t *ring = &rings->cpu[i];
+        ring->written_base = ring->written;
+        ring->lost_base = ring->lost;
+        memory_barrier();
+        ring->head = ring->tail;
+    }
+}
+
+void pcpu_rings_get_counts(const pcpu_rings_t *rings, pcpu_ring_counts_t *counts) {
+    kmemset(counts, 0, sizeof(*counts));
+    for (int i = 0; i < MAX_CPUS; i++) {
+        const pcpu_ring_t *ring = &rings->cpu[i];
+        counts->written += ring->written - ring->written_base;
+        counts->lost += ring->lost - ring->lost_base;
+        counts->buffered += ring->tail - ring->head;
+    }
+}
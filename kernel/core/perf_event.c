@@ -0,0 +1,373 @@
+/**
+ * @file perf_event.c
+ * @brief Per-process hardware event counting on the SBI PMU
+ *
+ * An event is "on" a CPU from the switch to its process to the switch
+ * away: time_enabled grows meanwhile. If counter_config_matching found
+ * it a counter at switch-in it also holds that counter, whose value then
+ * was start_value; time_running grows and at switch-out the difference
+ * (modulo the counter's width) is banked into count and the counter is
+ * stopped and released for the next process.
+ *
+ * The big kernel lock serialises everything here, but the counters are
+ * the hart's own: an event on another CPU can be read only as of its
+ * last switch-out, and changing or closing it takes effect when that CPU
+ * switches its process out. A closed event that is still on a CPU is
+ * freed by that switch.
+ */
+
+#include "kernel/perf_event.h"
+#include "kernel/process.h"
+#include "kernel/smp.h"
+#include "kernel/errno.h"
+#include "kernel/kstring.h"
+#include "hal/hal_timer.h"
+#include "fs/vfs.h"
+#include "mm/kmalloc.h"
+#include "arch/sbi.h"
+#include <stddef.h>
+
+#define PERF_MAX_COUNTERS   32
+
+struct perf_event {
+    struct perf_event *next;    // Next event of the process
+    struct process *proc;       // Process counted (NULL once it exited)
+    unsigned long event_idx;    // SBI_PMU_EVENT()
+    unsigned long event_data;   // Raw selector, or 0
+    uint64_t count;             // Banked events
+    uint64_t time_enabled_us;   // Banked times
+    uint64_t time_running_us;
+    uint64_t since_us;          // When it went on its CPU
+    uint64_t start_value;       // Counter value then
+    int cpu;                    // CPU it is on, -1 if none
+    int counter;                // Counter held there, -1 if none
+    uint8_t enabled;            // Counts from its next switch-in
+    uint8_t slice_enabled;      // Was enabled at the last switch-in
+    uint8_t closed;             // Released while on another CPU
+};
+
+// Counters found by perf_init() (bit N: SBI counter index N)
+static unsigned long perf_counters;
+static uint16_t perf_counter_csr[PERF_MAX_COUNTERS];
+static uint64_t perf_counter_mask[PERF_MAX_COUNTERS];
+
+// User-mode counter CSRs, cycle (0xC00) to hpmcounter31 (0xC1F)
+#define PERF_CSRS(X) \
+    X(0xC00) X(0xC01) X(0xC02) X(0xC03) X(0xC04) X(0xC05) X(0xC06) X(0xC07) \
+    X(0xC08) X(0xC09) X(0xC0A) X(0xC0B) X(0xC0C) X(0xC0D) X(0xC0E) X(0xC0F) \
+    X(0xC10) X(0xC11) X(0xC12) X(0xC13) X(0xC14) X(0xC15) X(0xC16) X(0xC17) \
+    X(0xC18) X(0xC19) X(0xC1A) X(0xC1B) X(0xC1C) X(0xC1D) X(0xC1E) X(0xC1F)
+
+static uint64_t perf_read_csr(uint16_t csr) {
+    uint64_t value;
+    switch (csr) {
+#define X(n) case n: __asm__ volatile("csrr %0, %1" : "=r"(value) : "i"(n)); return value;
+        PERF_CSRS(X)
+#undef X
+        default:
+            return 0;
+    }
+}
+
+static uint64_t perf_counter_read(int counter) {
+    return perf_read_csr(perf_counter_csr[counter]) & perf_counter_mask[counter];
+}
+
+int perf_init(void) {
+    if (!sbi_probe_extension(SBI_EXT_PMU)) {
+        RETURN_ERRNO(THUNDEROS_ENODEV);
+    }
+
+    long num = sbi_pmu_num_counters();
+    for (long idx = 0; idx < num && idx < PERF_MAX_COUNTERS; idx++) {
+        unsigned long info;
+        if (sbi_pmu_counter_get_info((unsigned long)idx, &info) != SBI_SUCCESS ||
+            (info & SBI_PMU_INFO_FIRMWARE)) {
+            continue;
+        }
+        unsigned long width = SBI_PMU_INFO_WIDTH(info);
+        perf_counters |= 1UL << idx;
+        perf_counter_csr[idx] = (uint16_t)SBI_PMU_INFO_CSR(info);
+        perf_counter_mask[idx] = width >= 64 ? UINT64_MAX : (1ULL << width) - 1;
+    }
+    if (perf_counters == 0) {
+        RETURN_ERRNO(THUNDEROS_ENODEV);
+    }
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Put an event on this CPU, taking a counter if it is enabled and one is free
+ */
+static void perf_event_sched_in(perf_event_t *event, int cpu, uint64_t now) {
+    event->cpu = cpu;
+    event->since_us = now;
+    event->slice_enabled = event->enabled;
+    event->counter = -1;
+    if (!event->enabled) {
+        return;
+    }
+
+    unsigned long idx;
+    if (sbi_pmu_counter_config_matching(0, perf_counters,
+                                        SBI_PMU_CFG_FLAG_CLEAR_VALUE | SBI_PMU_CFG_FLAG_AUTO_START,
+                                        event->event_idx, event->event_data,
+                                        &idx) != SBI_SUCCESS) {
+        // Every counter that could count it is taken: it misses this slice
+        return;
+    }
+    event->counter = (int)idx;
+    event->start_value = perf_counter_read(event->counter);
+}
+
+/**
+ * Take an event off this CPU, banking what it counted
+ */
+static void perf_event_sched_out(perf_event_t *event, uint64_t now) {
+    if (event->slice_enabled) {
+        event->time_enabled_us += now - event->since_us;
+    }
+    if (event->counter >= 0) {
+        uint64_t value = perf_counter_read(event->counter);
+        event->count += (value - event->start_value) & perf_counter_mask[event->counter];
+        event->time_running_us += now - event->since_us;
+        sbi_pmu_counter_stop((unsigned long)event->counter, 1, SBI_PMU_STOP_FLAG_RESET);
+        event->counter = -1;
+    }
+    event->cpu = -1;
+}
+
+static void perf_event_unlink(perf_event_t *event) {
+    if (!event->proc) {
+        return;
+    }
+    perf_event_t **link = &event->proc->perf_events;
+    while (*link && *link != event) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = event->next;
+    }
+    event->proc = NULL;
+    event->next = NULL;
+}
+
+void perf_switch(struct process *old, struct process *new) {
+    int switching_out = old && old->perf_events;
+    int switching_in = new && new->perf_events;
+    if (!switching_out && !switching_in) {
+        return;
+    }
+
+    uint64_t now = hal_timer_get_time_us();
+
+    if (switching_out) {
+        perf_event_t **link = &old->perf_events;
+        while (*link) {
+            perf_event_t *event = *link;
+            perf_event_sched_out(event, now);
+            if (event->closed) {
+                *link = event->next;
+                kfree(event);
+            } else {
+                link = &event->next;
+            }
+        }
+    }
+
+    if (switching_in) {
+        int cpu = cpu_this()->id;
+        for (perf_event_t *event = new->perf_events; event; event = event->next) {
+            perf_event_sched_in(event, cpu, now);
+        }
+    }
+}
+
+void perf_process_exit(struct process *proc) {
+    uint64_t now = hal_timer_get_time_us();
+
+    while (proc->perf_events) {
+        perf_event_t *event = proc->perf_events;
+        proc->perf_events = event->next;
+        if (event->cpu >= 0) {
+            perf_event_sched_out(event, now);
+        }
+        event->proc = NULL;
+        event->next = NULL;
+        if (event->closed) {
+            kfree(event);
+        }
+    }
+}
+
+/**
+ * Map perf_event_attr_t to an SBI event
+ */
+static int perf_event_encode(const perf_event_attr_t *attr, unsigned long *event_idx,
+                             unsigned long *event_data) {
+    *event_data = 0;
+
+    switch (attr->type) {
+        case PERF_TYPE_HARDWARE:
+            if (attr->config >= PERF_COUNT_HW_MAX) {
+                return -1;
+            }
+            *event_idx = SBI_PMU_EVENT(SBI_PMU_TYPE_HW, attr->config + 1);
+            return 0;
+
+        case PERF_TYPE_HW_CACHE: {
+            uint64_t cache = attr->config & 0xFF;
+            uint64_t op = (attr->config >> 8) & 0xFF;
+            uint64_t result = (attr->config >> 16) & 0xFF;
+            if ((attr->config >> 24) || cache >= PERF_COUNT_HW_CACHE_MAX ||
+                op >= PERF_COUNT_HW_CACHE_OP_MAX || result >= PERF_COUNT_HW_CACHE_RESULT_MAX) {
+                return -1;
+            }
+            *event_idx = SBI_PMU_EVENT(SBI_PMU_TYPE_CACHE, cache << 3 | op << 1 | result);
+            return 0;
+        }
+
+        case PERF_TYPE_RAW:
+            if (attr->config == 0) {
+                return -1;
+            }
+            *event_idx = SBI_PMU_EVENT(SBI_PMU_TYPE_RAW, 0);
+            *event_data = attr->config;
+            return 0;
+
+        default:
+            return -1;
+    }
+}
+
+int perf_event_open(const perf_event_attr_t *attr, struct process *target) {
+    if (perf_counters == 0) {
+        RETURN_ERRNO(THUNDEROS_ENODEV);
+    }
+
+    unsigned long event_idx, event_data;
+    if ((attr->flags & ~PERF_ATTR_DISABLED) ||
+        perf_event_encode(attr, &event_idx, &event_data) != 0) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    // cycle and instret count only themselves; the rest need an hpmcounter
+    int fixed = event_idx == SBI_PMU_EVENT(SBI_PMU_TYPE_HW, SBI_PMU_HW_CPU_CYCLES) ||
+                event_idx == SBI_PMU_EVENT(SBI_PMU_TYPE_HW, SBI_PMU_HW_INSTRUCTIONS);
+    if (!fixed && !(perf_counters & ~0x7UL)) {
+        RETURN_ERRNO(THUNDEROS_ENOENT);
+    }
+
+    perf_event_t *event = kmalloc(sizeof(*event));
+    if (!event) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    kmemset(event, 0, sizeof(*event));
+    event->event_idx = event_idx;
+    event->event_data = event_data;
+    event->cpu = -1;
+    event->counter = -1;
+    event->enabled = !(attr->flags & PERF_ATTR_DISABLED);
+
+    int fd = vfs_create_perf_event(event);
+    if (fd < 0) {
+        kfree(event);
+        // errno already set by vfs_create_perf_event
+        return -1;
+    }
+
+    event->proc = target;
+    event->next = target->perf_events;
+    target->perf_events = event;
+
+    // Counting ourselves starts now, not at our next switch-in
+    if (target == process_current()) {
+        perf_event_sched_in(event, cpu_this()->id, hal_timer_get_time_us());
+    }
+    clear_errno();
+    return fd;
+}
+
+/**
+ * Is the event on this CPU? Then its counter and times can be settled here.
+ */
+static int perf_event_local(perf_event_t *event) {
+    return event->cpu >= 0 && event->cpu == cpu_this()->id;
+}
+
+int perf_event_read(perf_event_t *event, void *buffer, uint32_t size) {
+    if (size < sizeof(perf_count_t)) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    perf_count_t count = {
+        .value = event->count,
+        .time_enabled_us = event->time_enabled_us,
+        .time_running_us = event->time_running_us,
+    };
+    if (perf_event_local(event)) {
+        uint64_t elapsed = hal_timer_get_time_us() - event->since_us;
+        if (event->slice_enabled) {
+            count.time_enabled_us += elapsed;
+        }
+        if (event->counter >= 0) {
+            count.value += (perf_counter_read(event->counter) - event->start_value) &
+                           perf_counter_mask[event->counter];
+            count.time_running_us += elapsed;
+        }
+    }
+
+    kmemcpy(buffer, &count, sizeof(count));
+    clear_errno();
+    return (int)sizeof(count);
+}
+
+int perf_event_ioctl(perf_event_t *event, uint32_t request, uint64_t arg) {
+    (void)arg;
+
+    if (request != PERF_EVENT_IOC_ENABLE && request != PERF_EVENT_IOC_DISABLE &&
+        request != PERF_EVENT_IOC_RESET) {
+        RETURN_ERRNO(THUNDEROS_ENOTTY);
+    }
+
+    // Settle an event on this CPU first, so the change applies from now
+    int local = perf_event_local(event);
+    uint64_t now = hal_timer_get_time_us();
+    if (local) {
+        perf_event_sched_out(event, now);
+    }
+
+    switch (request) {
+        case PERF_EVENT_IOC_ENABLE:
+            event->enabled = 1;
+            break;
+        case PERF_EVENT_IOC_DISABLE:
+            event->enabled = 0;
+            break;
+        case PERF_EVENT_IOC_RESET:
+            event->count = 0;
+            event->time_enabled_us = 0;
+            event->time_running_us = 0;
+            break;
+    }
+
+    if (local) {
+        perf_event_sched_in(event, cpu_this()->id, now);
+    }
+    clear_errno();
+    return 0;
+}
+
+void perf_event_release(perf_event_t *event) {
+    if (event->cpu >= 0 && !perf_event_local(event)) {
+        // Only that CPU can give its counter back: its next switch frees us
+        event->closed = 1;
+        return;
+    }
+    if (event->cpu >= 0) {
+        perf_event_sched_out(event, hal_timer_get_time_us());
+    }
+    perf_event_unlink(event);
+    kfree(event);
+}
@@ -3,78 +3,110 @@
  * @brief Pipe (FIFO) inter-process communication implementation
  * 
  * Implements anonymous pipes for unidirectional communication between processes.
- * Uses a circular buffer for efficient data transfer without copying.
- * Supports blocking I/O via wait queues - readers sleep when pipe is empty,
- * writers sleep when pipe is full.
+ * Data lives in a ring of pages: a write fills the last page and adds new
+ * ones up to the pipe's capacity, a read drains the first and frees each
+ * page once it is empty. Supports blocking I/O via wait queues - readers
+ * sleep when pipe is empty, writers sleep when pipe is full.
  */
 
 #include "kernel/pipe.h"
 #include "kernel/errno.h"
 #include "kernel/process.h"
 #include "kernel/wait_queue.h"
-#include "mm/kmalloc.h"
+#include "mm/slab.h"
+#include "mm/pmm.h"
+#include "mm/page.h"
+#include "kernel/poll.h"
+#include "kernel/panic.h"
 #include "kernel/kstring.h"
 
+// Cache of constructed pipe structures
+static kmem_cache_t *pipe_cache = NULL;
+
+/**
+ * Construct a pipe object
+ * 
+ * Runs once per object when its slab is created. Pipes always return to
+ * the cache with empty wait queues and no pages, so only the per-use
+ * fields need to be reset in pipe_create().
+ * 
+ * @param obj Pipe object to construct
+ */
+static void pipe_ctor(void *obj) {
+    pipe_t* pipe = (pipe_t*)obj;
+    
+    wait_queue_init(&pipe->readers);
+    wait_queue_init(&pipe->writers);
+}
+
 /**
  * Initialize pipe subsystem
  * 
- * Currently no global initialization needed. Reserved for future use
- * (e.g., pipe cache, statistics).
+ * Creates the pipe object cache.
  */
 void pipe_init(void) {
-    // No global initialization needed yet
+    pipe_cache = kmem_cache_create("pipe", sizeof(pipe_t), 0, pipe_ctor);
+    if (!pipe_cache) {
+        kernel_panic("pipe_init: Failed to create pipe cache");
+    }
 }
 
 /**
  * Create a new pipe
  * 
- * Allocates and initializes a pipe structure with empty circular buffer.
- * Both read and write ends start with reference count of 1.
- * Wait queues are initialized for blocking I/O support.
+ * Takes a constructed pipe from the pipe cache and resets it to an empty
+ * circular buffer. Both read and write ends start with reference count of 1.
  * 
  * @return Pointer to newly created pipe, or NULL on allocation failure
  */
 pipe_t* pipe_create(void) {
-    pipe_t* pipe = (pipe_t*)kmalloc(sizeof(pipe_t));
+    pipe_t* pipe = (pipe_t*)kmem_cache_alloc(pipe_cache);
     if (!pipe) {
         set_errno(THUNDEROS_ENOMEM);
         return NULL;
     }
 
-    // Initialize pipe to empty state
-    kmemset(pipe->buffer, 0, PIPE_BUF_SIZE);
-    pipe->read_pos = 0;
-    pipe->write_pos = 0;
+    // Reset to empty state. No pages until data arrives, and the wait
+    // queues were set up by pipe_ctor() and are empty whenever a pipe is
+    // freed.
+    pipe->head = 0;
+    pipe->nr_bufs = 0;
+    pipe->max_bufs = PIPE_DEF_PAGES;
     pipe->data_size = 0;
+    pipe->consumed = 0;
     pipe->state = PIPE_OPEN;
     pipe->read_ref_count = 1;
     pipe->write_ref_count = 1;
-    
-    // Initialize wait queues for blocking I/O
-    wait_queue_init(&pipe->readers);
-    wait_queue_init(&pipe->writers);
 
     clear_errno();
     return pipe;
 }
 
 /**
- * Read data from pipe (blocking)
- * 
- * Reads up to 'count' bytes from pipe's circular buffer. If the pipe is empty,
- * the calling process will sleep until data is available or the write end is
- * closed. Handles wraparound automatically.
- * 
- * @param pipe Pointer to pipe structure
- * @param buffer Destination buffer
- * @param count Maximum bytes to read
- * @return Bytes read, 0 on EOF, -1 on error
+ * Slot i places after the head of the ring
  */
-int pipe_read(pipe_t* pipe, void* buffer, size_t count) {
-    if (!pipe || !buffer) {
-        RETURN_ERRNO(THUNDEROS_EINVAL);
+static pipe_buf_t *pipe_slot(pipe_t *pipe, uint32_t i) {
+    return &pipe->bufs[(pipe->head + i) % PIPE_MAX_PAGES];
+}
+
+/**
+ * Check whether a write could store at least one byte now
+ */
+static int pipe_has_room(pipe_t *pipe) {
+    if (pipe->nr_bufs < pipe->max_bufs) {
+        return 1;
     }
+    pipe_buf_t *last = pipe_slot(pipe, pipe->nr_bufs - 1);
+    return (last->flags & PIPE_BUF_CAN_MERGE) && last->offset + last->len < PAGE_SIZE;
+}
 
+/**
+ * Sleep until the pipe has data
+ * 
+ * @param nonblock Nonzero to fail with EAGAIN instead of sleeping
+ * @return 1 if there is data, 0 on EOF, -1 on error (errno set)
+ */
+static int pipe_wait_data(pipe_t *pipe, int nonblock) {
     // Check if read end is already closed
     if (pipe->state == PIPE_READ_CLOSED || pipe->state == PIPE_CLOSED) {
         RETURN_ERRNO(THUNDEROS_EPIPE);
@@ -88,6 +120,10 @@ int pipe_read(pipe_t* pipe, void* buffer, size_t count) {
             return 0;  // EOF
         }
         
+        if (nonblock) {
+            RETURN_ERRNO(THUNDEROS_EAGAIN);
+        }
+        
         // Sleep until writer wakes us
         wait_queue_sleep(&pipe->readers);
         
@@ -96,6 +132,110 @@ int pipe_read(pipe_t* pipe, void* buffer, size_t count) {
             RETURN_ERRNO(THUNDEROS_EPIPE);
         }
     }
+    return 1;
+}
+
+/**
+ * Sleep until a write can go ahead
+ * 
+ * @param need_slot Nonzero to wait for a free slot, not just tail room
+ * @param nonblock Nonzero to fail with EAGAIN instead of sleeping
+ * @return 0 when there is room, -1 on error (errno set)
+ */
+static int pipe_wait_room(pipe_t *pipe, int need_slot, int nonblock) {
+    for (;;) {
+        // Check if write end is already closed
+        if (pipe->state == PIPE_WRITE_CLOSED || pipe->state == PIPE_CLOSED) {
+            RETURN_ERRNO(THUNDEROS_EPIPE);
+        }
+
+        // Check if read end is closed (broken pipe)
+        if (pipe->state == PIPE_READ_CLOSED || pipe->read_ref_count == 0) {
+            RETURN_ERRNO(THUNDEROS_EPIPE);
+        }
+
+        if (need_slot ? pipe->nr_bufs < pipe->max_bufs : pipe_has_room(pipe)) {
+            return 0;
+        }
+
+        if (nonblock) {
+            RETURN_ERRNO(THUNDEROS_EAGAIN);
+        }
+
+        // Sleep until reader makes space
+        wait_queue_sleep(&pipe->writers);
+    }
+}
+
+/**
+ * Drop bytes from the head of the pipe once they have been consumed
+ * 
+ * Frees (or releases the pipe's reference to) pages that become empty
+ * and wakes writers.
+ */
+static void pipe_advance(pipe_t *pipe, size_t count) {
+    size_t left = count;
+
+    while (left > 0) {
+        pipe_buf_t *buf = pipe_slot(pipe, 0);
+        size_t chunk_size = left < buf->len ? left : buf->len;
+        buf->offset += chunk_size;
+        buf->len -= chunk_size;
+        left -= chunk_size;
+
+        if (buf->len == 0) {
+            put_page(buf->page);
+            buf->page = 0;
+            pipe->head = (pipe->head + 1) % PIPE_MAX_PAGES;
+            pipe->nr_bufs--;
+        }
+    }
+
+    pipe->data_size -= count;
+    pipe->consumed += count;
+
+    // Wake any writers waiting for space
+    if (count > 0) {
+        wait_queue_wake(&pipe->writers);
+    }
+}
+
+/**
+ * Append a slot to the ring; the caller has checked there is one free
+ */
+static void pipe_push(pipe_t *pipe, uintptr_t page, uint32_t offset, uint32_t len, uint32_t flags) {
+    pipe_buf_t *buf = pipe_slot(pipe, pipe->nr_bufs);
+    buf->page = page;
+    buf->offset = offset;
+    buf->len = len;
+    buf->flags = flags;
+    pipe->nr_bufs++;
+    pipe->data_size += len;
+}
+
+/**
+ * Read data from pipe (blocking)
+ * 
+ * Reads up to 'count' bytes from the pipe's pages. If the pipe is empty,
+ * the calling process will sleep until data is available or the write end is
+ * closed. Pages that have been read completely are freed.
+ * 
+ * @param pipe Pointer to pipe structure
+ * @param buffer Destination buffer
+ * @param count Maximum bytes to read
+ * @param nonblock Nonzero to fail with EAGAIN instead of sleeping
+ * @return Bytes read, 0 on EOF, -1 on error
+ */
+int pipe_read(pipe_t* pipe, void* buffer, size_t count, int nonblock) {
+    if (!pipe || !buffer) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    int ready = pipe_wait_data(pipe, nonblock);
+    if (ready <= 0) {
+        /* errno already set by pipe_wait_data */
+        return ready;
+    }
 
     // Read available data (limited by count and available data)
     size_t to_read = count;
@@ -106,26 +246,19 @@ int pipe_read(pipe_t* pipe, void* buffer, size_t count) {
     char* dest = (char*)buffer;
     size_t bytes_read = 0;
 
-    // Handle circular buffer wraparound
-    while (bytes_read < to_read) {
+    // Copy from the pages at the head of the ring
+    for (uint32_t i = 0; bytes_read < to_read; i++) {
+        pipe_buf_t *buf = pipe_slot(pipe, i);
         size_t chunk_size = to_read - bytes_read;
-        size_t remaining_in_buffer = PIPE_BUF_SIZE - pipe->read_pos;
-        
-        if (chunk_size > remaining_in_buffer) {
-            chunk_size = remaining_in_buffer;
+        if (chunk_size > buf->len) {
+            chunk_size = buf->len;
         }
 
-        kmemcpy(dest + bytes_read, pipe->buffer + pipe->read_pos, chunk_size);
+        kmemcpy(dest + bytes_read, (char *)buf->page + buf->offset, chunk_size);
         bytes_read += chunk_size;
-        pipe->read_pos = (pipe->read_pos + chunk_size) % PIPE_BUF_SIZE;
     }
 
-    pipe->data_size -= bytes_read;
-
-    // Wake any writers waiting for space
-    if (bytes_read > 0) {
-        wait_queue_wake(&pipe->writers);
-    }
+    pipe_advance(pipe, bytes_read);
 
     clear_errno();
     return (int)bytes_read;
@@ -134,82 +267,303 @@ int pipe_read(pipe_t* pipe, void* buffer, size_t count) {
 /**
  * Write data to pipe
  * 
- * Writes up to 'count' bytes into pipe's circular buffer. Returns immediately
- * if space is available, or -EAGAIN if pipe is full, or -EPIPE if read end
- * is closed.
+ * Writes up to 'count' bytes into the pipe, filling its last page and
+ * adding pages up to the capacity. Blocks while the pipe is full, and
+ * fails with EPIPE if the read end is closed.
  * 
  * @param pipe Pointer to pipe structure
  * @param buffer Source buffer
  * @param count Bytes to write
+ * @param nonblock Nonzero to fail with EAGAIN instead of sleeping
  * @return Bytes written, -1 on error
  */
-int pipe_write(pipe_t* pipe, const void* buffer, size_t count) {
+int pipe_write(pipe_t* pipe, const void* buffer, size_t count, int nonblock) {
     if (!pipe || !buffer) {
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
 
-    // Check if write end is already closed
-    if (pipe->state == PIPE_WRITE_CLOSED || pipe->state == PIPE_CLOSED) {
-        RETURN_ERRNO(THUNDEROS_EPIPE);
+    if (pipe_wait_room(pipe, 0, nonblock) != 0) {
+        /* errno already set by pipe_wait_room */
+        return -1;
     }
 
-    // Check if read end is closed (broken pipe)
-    if (pipe->state == PIPE_READ_CLOSED || pipe->read_ref_count == 0) {
-        RETURN_ERRNO(THUNDEROS_EPIPE);
+    const char* src = (const char*)buffer;
+    size_t bytes_written = 0;
+
+    // Fill the last page, then add new ones while the capacity allows.
+    // Pages spliced in may be shared with the page cache or another pipe
+    // and are never appended to.
+    while (bytes_written < count) {
+        pipe_buf_t *buf = pipe->nr_bufs ? pipe_slot(pipe, pipe->nr_bufs - 1) : NULL;
+        if (!buf || !(buf->flags & PIPE_BUF_CAN_MERGE) || buf->offset + buf->len == PAGE_SIZE) {
+            if (pipe->nr_bufs == pipe->max_bufs) {
+                break;
+            }
+            uintptr_t page = pmm_alloc_page();
+            if (!page) {
+                break;
+            }
+            pipe_push(pipe, page, 0, 0, PIPE_BUF_CAN_MERGE);
+            buf = pipe_slot(pipe, pipe->nr_bufs - 1);
+        }
+
+        size_t chunk_size = count - bytes_written;
+        size_t room = PAGE_SIZE - (buf->offset + buf->len);
+        if (chunk_size > room) {
+            chunk_size = room;
+        }
+
+        kmemcpy((char *)buf->page + buf->offset + buf->len, src + bytes_written, chunk_size);
+        bytes_written += chunk_size;
+        buf->len += chunk_size;
     }
 
-    // Block until there's space to write
-    while (pipe->data_size >= PIPE_BUF_SIZE) {
-        // Check for broken pipe
-        if (pipe->state == PIPE_READ_CLOSED || pipe->read_ref_count == 0) {
-            RETURN_ERRNO(THUNDEROS_EPIPE);
+    if (bytes_written == 0 && count > 0) {
+        // Room in the ring but no page to put it in
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+
+    pipe->data_size += bytes_written;
+
+    // Wake any readers waiting for data
+    if (bytes_written > 0) {
+        wait_queue_wake(&pipe->readers);
+    }
+
+    clear_errno();
+    return (int)bytes_written;
+}
+
+/**
+ * Queue a page reference in a pipe without copying (splice into a pipe)
+ */
+int pipe_splice_page(pipe_t* pipe, uintptr_t page, uint32_t offset, uint32_t len, int nonblock) {
+    if (!pipe || !page || len == 0 || offset + len > PAGE_SIZE) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    if (pipe_wait_room(pipe, 1, nonblock) != 0) {
+        /* errno already set by pipe_wait_room */
+        return -1;
+    }
+
+    pipe_push(pipe, page, offset, len, 0);
+    wait_queue_wake(&pipe->readers);
+
+    clear_errno();
+    return (int)len;
+}
+
+/**
+ * Hand pipe data to a consumer straight from its pages (splice out)
+ */
+int pipe_splice_out(pipe_t* pipe, pipe_actor_t actor, void *ctx, size_t count, int nonblock) {
+    if (!pipe || !actor) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    int ready = pipe_wait_data(pipe, nonblock);
+    if (ready <= 0) {
+        /* errno already set by pipe_wait_data */
+        return ready;
+    }
+
+    size_t done = 0;
+    while (done < count && pipe->data_size > 0) {
+        pipe_buf_t *buf = pipe_slot(pipe, 0);
+        size_t chunk_size = count - done;
+        if (chunk_size > buf->len) {
+            chunk_size = buf->len;
         }
-        
-        // Sleep until reader makes space
-        wait_queue_sleep(&pipe->writers);
-        
-        // After waking, re-check conditions
-        if (pipe->state == PIPE_WRITE_CLOSED || pipe->state == PIPE_CLOSED) {
-            RETURN_ERRNO(THUNDEROS_EPIPE);
+
+        int used = actor(ctx, (char *)buf->page + buf->offset, (uint32_t)chunk_size);
+        if (used < 0) {
+            if (done == 0) {
+                /* errno already set by the actor */
+                return -1;
+            }
+            break;
         }
-        if (pipe->state == PIPE_READ_CLOSED || pipe->read_ref_count == 0) {
+
+        pipe_advance(pipe, (size_t)used);
+        done += (size_t)used;
+        if ((size_t)used < chunk_size) {
+            break;
+        }
+    }
+
+    clear_errno();
+    return (int)done;
+}
+
+/**
+ * Sleep until src has data and dst a free slot, at the same time
+ * 
+ * @return 1 when both hold, 0 on EOF of src, -1 on error (errno set)
+ */
+static int pipe_wait_pair(pipe_t *src, pipe_t *dst, int nonblock) {
+    for (;;) {
+        int ready = pipe_wait_data(src, nonblock);
+        if (ready <= 0) {
+            /* errno already set by pipe_wait_data */
+            return ready;
+        }
+        if (dst->state == PIPE_WRITE_CLOSED || dst->state == PIPE_CLOSED ||
+            dst->state == PIPE_READ_CLOSED || dst->read_ref_count == 0) {
             RETURN_ERRNO(THUNDEROS_EPIPE);
         }
+        if (dst->nr_bufs < dst->max_bufs) {
+            return 1;
+        }
+        if (nonblock) {
+            RETURN_ERRNO(THUNDEROS_EAGAIN);
+        }
+        wait_queue_sleep(&dst->writers);
     }
+}
 
-    // Write available space (limited by count and free space)
-    size_t free_space = PIPE_BUF_SIZE - pipe->data_size;
-    size_t to_write = count;
-    if (to_write > free_space) {
-        to_write = free_space;
+/**
+ * Duplicate data from one pipe into another without consuming it
+ */
+int pipe_tee(pipe_t* src, pipe_t* dst, size_t count, int nonblock) {
+    if (!src || !dst || src == dst) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
     }
 
-    const char* src = (const char*)buffer;
-    size_t bytes_written = 0;
+    int ready = pipe_wait_pair(src, dst, nonblock);
+    if (ready <= 0) {
+        /* errno already set by pipe_wait_pair */
+        return ready;
+    }
 
-    // Handle circular buffer wraparound
-    while (bytes_written < to_write) {
-        size_t chunk_size = to_write - bytes_written;
-        size_t remaining_in_buffer = PIPE_BUF_SIZE - pipe->write_pos;
-        
-        if (chunk_size > remaining_in_buffer) {
-            chunk_size = remaining_in_buffer;
+    size_t done = 0;
+    for (uint32_t i = 0; i < src->nr_bufs && done < count && dst->nr_bufs < dst->max_bufs; i++) {
+        pipe_buf_t *buf = pipe_slot(src, i);
+        size_t chunk_size = count - done;
+        if (chunk_size > buf->len) {
+            chunk_size = buf->len;
         }
 
-        kmemcpy(pipe->buffer + pipe->write_pos, src + bytes_written, chunk_size);
-        bytes_written += chunk_size;
-        pipe->write_pos = (pipe->write_pos + chunk_size) % PIPE_BUF_SIZE;
+        // Both pipes now share the page: neither may append to it
+        get_page(buf->page);
+        buf->flags &= ~PIPE_BUF_CAN_MERGE;
+        pipe_push(dst, buf->page, buf->offset, (uint32_t)chunk_size, 0);
+        done += chunk_size;
     }
 
-    pipe->data_size += bytes_written;
+    wait_queue_wake(&dst->readers);
 
-    // Wake any readers waiting for data
-    if (bytes_written > 0) {
-        wait_queue_wake(&pipe->readers);
+    clear_errno();
+    return (int)done;
+}
+
+/**
+ * Move data from one pipe into another without copying it
+ */
+int pipe_move(pipe_t* src, pipe_t* dst, size_t count, int nonblock) {
+    if (!src || !dst || src == dst) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    int ready = pipe_wait_pair(src, dst, nonblock);
+    if (ready <= 0) {
+        /* errno already set by pipe_wait_pair */
+        return ready;
+    }
+
+    size_t done = 0;
+    while (done < count && src->nr_bufs > 0 && dst->nr_bufs < dst->max_bufs) {
+        pipe_buf_t *buf = pipe_slot(src, 0);
+        size_t chunk_size = count - done;
+        uint32_t flags = buf->flags;
+        if (chunk_size < buf->len) {
+            // Split: both pipes keep part of the page
+            buf->flags &= ~PIPE_BUF_CAN_MERGE;
+            flags = 0;
+        } else {
+            chunk_size = buf->len;
+        }
+
+        // dst's reference; src drops its own once the page is empty
+        get_page(buf->page);
+        pipe_push(dst, buf->page, buf->offset, (uint32_t)chunk_size, flags);
+        pipe_advance(src, chunk_size);
+        done += chunk_size;
     }
 
+    wait_queue_wake(&dst->readers);
+
     clear_errno();
-    return (int)bytes_written;
+    return (int)done;
+}
+
+/**
+ * Poll method of a pipe end
+ */
+int pipe_poll(pipe_t* pipe, int write_end, poll_table_t *pt) {
+    if (!pipe) {
+        return POLLNVAL;
+    }
+
+    int mask = 0;
+    if (write_end) {
+        // Readers drain and close through the writers' queue
+        poll_wait(pt, &pipe->writers);
+        if (pipe->state == PIPE_READ_CLOSED || pipe->read_ref_count == 0) {
+            mask |= POLLERR;
+        } else if (pipe_has_room(pipe)) {
+            mask |= POLLOUT;
+        }
+    } else {
+        // Writers fill and close through the readers' queue
+        poll_wait(pt, &pipe->readers);
+        if (pipe->data_size > 0) {
+            mask |= POLLIN;
+        }
+        if (pipe->state == PIPE_WRITE_CLOSED || pipe->write_ref_count == 0) {
+            mask |= POLLHUP;
+        }
+    }
+    return mask;
+}
+
+/**
+ * Get the capacity of a pipe
+ */
+int pipe_get_size(pipe_t* pipe) {
+    if (!pipe) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    clear_errno();
+    return (int)(pipe->max_bufs * PAGE_SIZE);
+}
+
+/**
+ * Set the capacity of a pipe (F_SETPIPE_SZ)
+ */
+int pipe_set_size(pipe_t* pipe, size_t size) {
+    if (!pipe || size == 0) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (size > PIPE_MAX_SIZE) {
+        RETURN_ERRNO(THUNDEROS_EPERM);
+    }
+
+    uint32_t pages = (uint32_t)((size + PAGE_SIZE - 1) / PAGE_SIZE);
+    if (pages < pipe->nr_bufs) {
+        // Would strand data already queued
+        RETURN_ERRNO(THUNDEROS_EBUSY);
+    }
+
+    uint32_t old = pipe->max_bufs;
+    pipe->max_bufs = pages;
+    if (pages > old) {
+        // Writers blocked on a full pipe may have room now
+        wait_queue_wake(&pipe->writers);
+    }
+
+    clear_errno();
+    return (int)(pages * PAGE_SIZE);
 }
 
 /**
@@ -293,12 +647,20 @@ int pipe_can_free(pipe_t* pipe) {
 /**
  * Free pipe resources
  * 
- * Deallocates pipe structure. Caller should verify both ends are closed first.
+ * Deallocates pipe structure and unread data. Caller should verify both
+ * ends are closed first.
  * 
  * @param pipe Pointer to pipe structure
  */
 void pipe_free(pipe_t* pipe) {
     if (pipe) {
-        kfree(pipe);
+        while (pipe->nr_bufs) {
+            pipe_buf_t *buf = pipe_slot(pipe, 0);
+            put_page(buf->page);
+            buf->page = 0;
+            pipe->head = (pipe->head + 1) % PIPE_MAX_PAGES;
+            pipe->nr_bufs--;
+        }
+        kmem_cache_free(pipe_cache, pipe);
     }
 }
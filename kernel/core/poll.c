@@ -0,0 +1,218 @@
+/**
+ * @file poll.c
+ * @brief poll() and the waiting machinery shared with epoll
+ *
+ * A poll_waiter hangs one callback entry on every wait queue the polled
+ * objects name; any wakeup of those queues marks it triggered and makes
+ * the sleeping process runnable, after which it rescans. Interrupts are
+ * disabled from checking the flag to going to sleep, so a wakeup from an
+ * interrupt handler (terminal input) cannot slip in between.
+ */
+
+#include "kernel/poll.h"
+#include "kernel/process.h"
+#include "kernel/scheduler.h"
+#include "kernel/hrtimer.h"
+#include "kernel/constants.h"
+#include "kernel/errno.h"
+#include "drivers/vterm.h"
+#include "hal/hal_uart.h"
+#include "hal/hal_timer.h"
+#include "arch/interrupt.h"
+#include "fs/vfs.h"
+#include "mm/kmalloc.h"
+
+/* Rescan period when a poll has more queues than wait entries */
+#define POLL_RESCAN_US 10000
+
+/**
+ * Wait entry callback: wake the polling process
+ */
+static int poll_wake(wait_queue_entry_t *entry) {
+    poll_waiter_t *pw = (poll_waiter_t *)entry->private;
+    struct process *proc = pw->proc;
+
+    pw->triggered = 1;
+
+    // No process_lock: we may be in an interrupt handler that interrupted
+    // code holding it (as for the sleep timers)
+    if (proc->state == PROC_SLEEPING) {
+        proc->state = PROC_READY;
+        scheduler_enqueue(proc);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * poll_wait() callback of a waiter: hang an entry on the queue
+ */
+static void poll_queue(poll_table_t *pt, wait_queue_t *wq) {
+    poll_waiter_t *pw = (poll_waiter_t *)pt;
+
+    if (pw->nr_entries >= pw->max_entries) {
+        pw->overflow = 1;
+        return;
+    }
+    wait_queue_add(wq, &pw->entries[pw->nr_entries++], poll_wake, pw);
+}
+
+void poll_waiter_init(poll_waiter_t *pw, wait_queue_entry_t *entries, int max_entries) {
+    pw->pt.queue = poll_queue;
+    pw->proc = process_current();
+    pw->triggered = 0;
+    pw->entries = entries;
+    pw->nr_entries = 0;
+    pw->max_entries = max_entries;
+    pw->overflow = 0;
+}
+
+void poll_waiter_sleep(poll_waiter_t *pw, uint64_t deadline_us) {
+    struct process *proc = pw->proc;
+
+    // Some queues were not registered: come back to look at them
+    if (pw->overflow) {
+        uint64_t rescan = hal_timer_get_time_us() + POLL_RESCAN_US;
+        if (!deadline_us || rescan < deadline_us) {
+            deadline_us = rescan;
+        }
+    }
+
+    int irq_state = interrupt_save_disable();
+    if (!pw->triggered) {
+        proc->state = PROC_SLEEPING;
+        scheduler_dequeue(proc);
+        if (deadline_us) {
+            hrtimer_start(&proc->sleep_hrtimer, deadline_us);
+        }
+        interrupt_restore(irq_state);
+
+        schedule();
+
+        irq_state = interrupt_save_disable();
+    }
+    pw->triggered = 0;
+    interrupt_restore(irq_state);
+
+    if (deadline_us) {
+        hrtimer_cancel(&proc->sleep_hrtimer);
+    }
+}
+
+void poll_waiter_release(poll_waiter_t *pw) {
+    for (int i = 0; i < pw->nr_entries; i++) {
+        wait_queue_del(&pw->entries[i]);
+    }
+    pw->nr_entries = 0;
+}
+
+int poll_signal_pending(void) {
+    struct process *proc = process_current();
+    return proc && (proc->pending_signals & ~proc->blocked_signals) != 0;
+}
+
+/**
+ * Readiness of the calling process's terminal input
+ */
+static int console_poll(poll_table_t *pt) {
+    if (!vterm_available()) {
+        // Plain UART: nothing wakes us, so this is only ever a snapshot
+        return hal_uart_data_available() ? POLLIN : 0;
+    }
+
+    int tty = process_get_tty(process_current());
+    if (tty < 0) {
+        tty = vterm_get_active_index();
+    }
+    return vterm_input_poll(tty, pt);
+}
+
+int poll_file(struct vfs_file *file, poll_table_t *pt) {
+    if (file->type == VFS_TYPE_CONSOLE) {
+        // Only the input side ever waits
+        if (file->flags & (O_WRONLY | O_RDWR)) {
+            return POLLOUT;
+        }
+        return console_poll(pt);
+    }
+    return vfs_poll_file(file, pt);
+}
+
+int poll_fd(int fd, poll_table_t *pt) {
+    vfs_file_t *file = vfs_get_file(fd);
+    if (!file) {
+        // Reported in revents, not as an error
+        clear_errno();
+        return POLLNVAL;
+    }
+    return poll_file(file, pt);
+}
+
+int do_poll(struct pollfd *fds, uint32_t nfds, int timeout_ms) {
+    if (nfds > POLL_MAX_FDS) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    // One queue per descriptor covers everything we can poll today
+    wait_queue_entry_t *entries = NULL;
+    if (nfds > 0 && timeout_ms != 0) {
+        entries = kmalloc(nfds * sizeof(wait_queue_entry_t));
+        if (!entries) {
+            RETURN_ERRNO(THUNDEROS_ENOMEM);
+        }
+    }
+
+    poll_waiter_t pw;
+    poll_waiter_init(&pw, entries, entries ? (int)nfds : 0);
+
+    uint64_t deadline_us = 0;
+    if (timeout_ms > 0) {
+        deadline_us = hal_timer_get_time_us() + (uint64_t)timeout_ms * MICROSECONDS_PER_MILLISECOND;
+    }
+
+    // Register on the first pass only; the entries stay until we return
+    poll_table_t *pt = entries ? &pw.pt : NULL;
+    int ready;
+    int error = 0;
+
+    for (;;) {
+        ready = 0;
+        for (uint32_t i = 0; i < nfds; i++) {
+            fds[i].revents = 0;
+            if (fds[i].fd < 0) {
+                continue;
+            }
+            int mask = poll_fd(fds[i].fd, pt);
+            mask &= fds[i].events | POLL_ALWAYS;
+            if (mask) {
+                fds[i].revents = (short)mask;
+                ready++;
+            }
+        }
+        pt = NULL;
+
+        if (ready || timeout_ms == 0) {
+            break;
+        }
+        if (poll_signal_pending()) {
+            error = THUNDEROS_EINTR;
+            break;
+        }
+        if (deadline_us && hal_timer_get_time_us() >= deadline_us) {
+            break;
+        }
+
+        poll_waiter_sleep(&pw, deadline_us);
+    }
+
+    poll_waiter_release(&pw);
+    if (entries) {
+        kfree(entries);
+    }
+
+    if (error) {
+        RETURN_ERRNO(error);
+    }
+    clear_errno();
+    return ready;
+}
@@ -4,53 +4,108 @@
 
 #include "kernel/process.h"
 #include "kernel/scheduler.h"
+#include "kernel/rgroup.h"
 #include "kernel/kstring.h"
 #include "kernel/panic.h"
 #include "kernel/signal.h"
 #include "kernel/errno.h"
 #include "kernel/constants.h"
+#include "kernel/smp.h"
+#include "kernel/spinlock.h"
 #include "drivers/vterm.h"
 #include "mm/pmm.h"
+#include "mm/page.h"
 #include "mm/kmalloc.h"
+#include "mm/slab.h"
 #include "mm/paging.h"
+#include "mm/reclaim.h"
+#include "mm/swap.h"
+#include "mm/kstack.h"
 #include "hal/hal_uart.h"
+#include "hal/hal_timer.h"
+#include "arch/interrupt.h"
+#include "arch/fpu.h"
 #include "kernel/elf_loader.h"
+#include "kernel/vma.h"
+#include "fs/page_cache.h"
+#include "fs/fdtable.h"
+#include "kernel/shm.h"
+#include "kernel/perf_event.h"
+#include "kernel/futex.h"
+#include "kernel/workqueue.h"
+#include "kernel/uaccess.h"
 #include <stddef.h>
 
+_Static_assert(PROCESS_REAPER_PRIORITY == SCHED_RT_LEVELS + 19, "reaper should run at nice 19");
+
 // Process table
 static struct process process_table[MAX_PROCS];
 
-// Current running process
-static struct process *current_process = NULL;
+// Current running process, per CPU
+#define current_process (cpu_this()->current)
 
 // Next PID to allocate
 static pid_t next_pid = 1;
 
-// Lock for process table (simple spinlock)
-static volatile int process_lock = 0;
+// Lock for process table
+static spinlock_t process_lock = SPINLOCK_INIT;
 
-// Simple spinlock functions
-static inline void lock_acquire(volatile int *lock) {
-    while (__sync_lock_test_and_set(lock, 1)) {
-        // Spin
-    }
-}
+// Processes by PID and by process group, chained through pid_link and
+// pgrp_link. Changed under process_lock; pid_hash_seq lets process_get()
+// walk the PID chains without it.
+static struct process *pid_hash[PID_HASH_BUCKETS];
+static struct process *pgrp_hash[PID_HASH_BUCKETS];
+static seqcount_t pid_hash_seq = SEQCOUNT_INIT;
 
-static inline void lock_release(volatile int *lock) {
-    __sync_lock_release(lock);
-}
+// The proc_link_t at byte offset member of a process
+#define PROC_LINK(proc, member) ((proc_link_t *)((char *)(proc) + (member)))
+
+// Object caches for per-process structures allocated on every fork/exec
+static kmem_cache_t *vma_cache = NULL;
+static kmem_cache_t *trap_frame_cache = NULL;
+static kmem_cache_t *teardown_cache = NULL;
+
+// Address spaces process_free() left to the reaper, oldest first
+typedef struct mm_teardown {
+    page_table_t *page_table;           // Detached user page table (NULL = none)
+    vm_area_t *vm_areas;                // Its VMAs
+    struct mm_teardown *next;
+} mm_teardown_t;
+
+static mm_teardown_t *teardown_head = NULL;
+static mm_teardown_t *teardown_tail = NULL;
+static struct process *reaper = NULL;
+static wait_queue_t reaper_wait = WAIT_QUEUE_INIT;
+static process_teardown_stats_t teardown_stats;
 
 // Forward declarations
 static void forked_child_entry(void);
+static void process_hash_pid(struct process *proc);
+static void process_set_pgid(struct process *proc, pid_t pgid);
+static void process_set_rss(struct process *proc, uint64_t pages);
+static void vma_list_free(vm_area_t *vma);
+static int process_defer_teardown(page_table_t *page_table, vm_area_t *vm_areas);
 
 /**
  * Initialize the process management subsystem
  */
 void process_init(void) {
+    spin_lock_init(&process_lock, "process_table");
+    rgroup_init();
+    
     // Initialize process table
     for (int i = 0; i < MAX_PROCS; i++) {
         process_table[i].state = PROC_UNUSED;
         process_table[i].pid = -1;
+        process_table[i].run_queued = 0;
+        seqcount_init(&process_table[i].seq);
+    }
+    
+    vma_cache = kmem_cache_create("vm_area", sizeof(vm_area_t), 0, NULL);
+    trap_frame_cache = kmem_cache_create("trap_frame", sizeof(struct trap_frame), 0, NULL);
+    teardown_cache = kmem_cache_create("mm_teardown", sizeof(mm_teardown_t), 0, NULL);
+    if (!vma_cache || !trap_frame_cache || !teardown_cache) {
+        kernel_panic("process_init: Failed to create object caches");
     }
     
     // Create the initial kernel process (process 0)
@@ -63,6 +118,9 @@ void process_init(void) {
     init_proc->user_stack = 0;
     init_proc->cpu_time = 0;
     init_proc->priority = 0;
+    init_proc->base_priority = 0;
+    scheduler_init_process(init_proc);
+    init_proc->sched_policy = SCHED_RR;
     init_proc->parent = NULL;
     init_proc->exit_code = 0;
     init_proc->errno_value = 0;
@@ -74,8 +132,14 @@ void process_init(void) {
     init_proc->gid = 0;              /* root group */
     init_proc->euid = 0;             /* effective root */
     init_proc->egid = 0;             /* effective root group */
-    init_proc->pgid = 0;             /* Process group leader (its own pgid) */
     init_proc->sid = 0;              /* Session leader (its own session) */
+    init_proc->last_cpu = cpu_this()->id;
+    init_proc->group_leader = init_proc;
+    init_proc->nr_threads = 1;
+    init_proc->rgroup = NULL;
+    rgroup_fork(init_proc, NULL);
+    process_hash_pid(init_proc);
+    process_set_pgid(init_proc, 0);  /* Process group leader (its own pgid) */
     
     current_process = init_proc;
     
@@ -96,17 +160,128 @@ void process_set_current(struct process *proc) {
     current_process = proc;
 }
 
+/**
+ * Switch to a process's page table on this CPU
+ */
+void process_switch_page_table(struct process *proc) {
+    // Threads share their leader's ASID along with its page table
+    struct process *mm = proc->group_leader;
+    switch_page_table_asid(proc->page_table, &mm->asid);
+    
+    // Another CPU may have left translations under this ASID in our TLB
+    // from before the process last ran here
+    int cpu_id = cpu_this()->id;
+    if (proc->last_cpu != cpu_id) {
+        tlb_flush_asid(mm->asid);
+        proc->last_cpu = cpu_id;
+    }
+}
+
 /**
  * Allocate a new PID
  * Uses atomic increment to ensure no PID conflicts in multi-threaded context
  */
 pid_t alloc_pid(void) {
-    lock_acquire(&process_lock);
+    int irq_state = spin_lock_irqsave(&process_lock);
     pid_t pid = next_pid++;
-    lock_release(&process_lock);
+    spin_unlock_irqrestore(&process_lock, irq_state);
     return pid;
 }
 
+/**
+ * Hash bucket of a PID or process group ID
+ */
+static inline uint32_t pid_hashfn(pid_t pid) {
+    // PIDs are handed out in sequence, so consecutive ones spread evenly
+    return (uint32_t)pid % PID_HASH_BUCKETS;
+}
+
+/**
+ * Push a process onto a list (process_lock held)
+ * 
+ * @param head List head
+ * @param proc Process to add
+ * @param member Offset of the proc_link_t the list uses
+ */
+static void proc_list_add(struct process **head, struct process *proc, size_t member) {
+    proc_link_t *link = PROC_LINK(proc, member);
+    
+    link->next = *head;
+    if (*head) {
+        PROC_LINK(*head, member)->pprev = &link->next;
+    }
+    link->pprev = head;
+    *head = proc;
+}
+
+/**
+ * Take a process off a list, if it is on it (process_lock held)
+ * 
+ * Leaves its next pointer alone, so a lock-free reader standing on the
+ * process can still walk on.
+ */
+static void proc_list_del(struct process *proc, size_t member) {
+    proc_link_t *link = PROC_LINK(proc, member);
+    
+    if (!link->pprev) {
+        return;
+    }
+    
+    *link->pprev = link->next;
+    if (link->next) {
+        PROC_LINK(link->next, member)->pprev = link->pprev;
+    }
+    link->pprev = NULL;
+}
+
+/**
+ * Make a newly numbered process findable by process_get()
+ */
+static void process_hash_pid(struct process *proc) {
+    int irq_state = spin_lock_irqsave(&process_lock);
+    write_seqcount_begin(&pid_hash_seq);
+    proc_list_add(&pid_hash[pid_hashfn(proc->pid)], proc,
+                  offsetof(struct process, pid_link));
+    write_seqcount_end(&pid_hash_seq);
+    spin_unlock_irqrestore(&process_lock, irq_state);
+}
+
+/**
+ * Give a new process its parent, on whose children list it goes
+ */
+static void process_set_parent(struct process *proc, struct process *parent) {
+    int irq_state = spin_lock_irqsave(&process_lock);
+    proc->parent = parent;
+    if (parent) {
+        proc_list_add(&parent->children, proc, offsetof(struct process, sibling_link));
+    }
+    spin_unlock_irqrestore(&process_lock, irq_state);
+}
+
+/**
+ * Move a process into a process group
+ */
+static void process_set_pgid(struct process *proc, pid_t pgid) {
+    int irq_state = spin_lock_irqsave(&process_lock);
+    proc_list_del(proc, offsetof(struct process, pgrp_link));
+    proc->pgid = pgid;
+    proc_list_add(&pgrp_hash[pid_hashfn(pgid)], proc, offsetof(struct process, pgrp_link));
+    spin_unlock_irqrestore(&process_lock, irq_state);
+}
+
+/**
+ * Sleep timer callback (wheel or hrtimer): make the sleeper runnable
+ */
+static void process_sleep_timeout(void *data) {
+    struct process *proc = (struct process *)data;
+    
+    // No process_lock: the interrupted code may hold it
+    if (proc->state == PROC_SLEEPING) {
+        proc->state = PROC_READY;
+        scheduler_enqueue(proc);
+    }
+}
+
 /**
  * Find a free process slot in the process table
  * 
@@ -116,31 +291,92 @@ pid_t alloc_pid(void) {
  * @return Pointer to unused process structure, or NULL if table full
  */
 static struct process *alloc_process(void) {
-    lock_acquire(&process_lock);
+    int irq_state = spin_lock_irqsave(&process_lock);
     
     for (int i = 0; i < MAX_PROCS; i++) {
         if (process_table[i].state == PROC_UNUSED) {
             // Mark slot as being allocated to prevent race conditions
+            write_seqcount_begin(&process_table[i].seq);
             process_table[i].state = PROC_EMBRYO;
-            lock_release(&process_lock);
+            write_seqcount_end(&process_table[i].seq);
+            process_table[i].asid = 0;
+            process_table[i].last_cpu = -1;
+            process_table[i].rss_pages = 0;
+            process_table[i].peak_rss_pages = 0;
+            process_table[i].pt_pages = 0;
+            process_table[i].minor_faults = 0;
+            process_table[i].major_faults = 0;
+            kmemset(&process_table[i].acct, 0, sizeof(process_table[i].acct));
+            process_table[i].vruntime = 0;
+            process_table[i].slice_used_us = 0;
+            process_table[i].wake_us = 0;
+            process_table[i].wait_entry = NULL;
+            process_table[i].pi_held = NULL;
+            process_table[i].pi_blocked_on = NULL;
+            process_table[i].children = NULL;
+            wait_queue_init(&process_table[i].child_wait);
+            process_table[i].pid_link.pprev = NULL;
+            process_table[i].sibling_link.pprev = NULL;
+            process_table[i].pgrp_link.pprev = NULL;
+            process_table[i].ring = NULL;
+            process_table[i].ring_entries = 0;
+            process_table[i].vfork_parent = NULL;
+            process_table[i].vfork_child = NULL;
+            process_table[i].fp_state = NULL;
+            process_table[i].perf_events = NULL;
+            process_table[i].sigqueue = NULL;
+            process_table[i].files = NULL;
+            process_table[i].cwd_node = NULL;
+            process_table[i].group_leader = &process_table[i];
+            process_table[i].threads = NULL;
+            process_table[i].thread_link.pprev = NULL;
+            process_table[i].nr_threads = 1;
+            process_table[i].group_exiting = 0;
+            process_table[i].group_exit_code = 0;
+            process_table[i].clear_child_tid = NULL;
+            process_table[i].rgroup = NULL;
+            rgroup_fork(&process_table[i], NULL);
+            scheduler_init_process(&process_table[i]);
+            ktimer_setup(&process_table[i].sleep_timer, process_sleep_timeout,
+                         &process_table[i]);
+            hrtimer_setup(&process_table[i].sleep_hrtimer, process_sleep_timeout,
+                          &process_table[i]);
+            spin_unlock_irqrestore(&process_lock, irq_state);
             return &process_table[i];
         }
     }
     
-    lock_release(&process_lock);
+    spin_unlock_irqrestore(&process_lock, irq_state);
     return NULL;
 }
 
 /**
  * Get process by PID
+ * 
+ * Lock-free: slots are never freed, only reused, so a chain stays safe
+ * to walk while it changes, and pid_hash_seq makes us walk it again if
+ * it did. A walk knocked onto another chain by a reused slot may loop,
+ * hence the bound.
  */
 struct process *process_get(pid_t pid) {
-    for (int i = 0; i < MAX_PROCS; i++) {
-        if (process_table[i].pid == pid && process_table[i].state != PROC_UNUSED) {
-            return &process_table[i];
+    struct process *found;
+    uint32_t seq;
+    
+    do {
+        seq = read_seqcount_begin(&pid_hash_seq);
+        found = NULL;
+        
+        struct process *p = pid_hash[pid_hashfn(pid)];
+        for (int steps = 0; p && steps < MAX_PROCS; steps++) {
+            if (p->pid == pid) {
+                found = p;
+                break;
+            }
+            p = p->pid_link.next;
         }
-    }
-    return NULL;
+    } while (read_seqcount_retry(&pid_hash_seq, seq));
+    
+    return found;
 }
 
 /**
@@ -155,37 +391,200 @@ struct process *process_get(pid_t pid) {
 void process_free(struct process *proc) {
     if (!proc) return;
     
-    lock_acquire(&process_lock);
+    // Closing files can wake other processes, so not under the lock
+    fdtable_destroy(proc->files);
+    proc->files = NULL;
+    vfs_node_put(proc->cwd_node);
+    proc->cwd_node = NULL;
     
-    // Clean up VMAs first
-    process_cleanup_vmas(proc);
+    int irq_state = spin_lock_irqsave(&process_lock);
     
-    // Free kernel stack (this WAS allocated with kmalloc)
+    // Free kernel stack (back to the stack cache, mm/kstack.h)
     if (proc->kernel_stack) {
-        kfree((void *)proc->kernel_stack);
+        kstack_free(proc->kernel_stack);
+        proc->kernel_stack = 0;
     }
     
     // NOTE: Do NOT kfree user_stack! It's a USER SPACE virtual address,
-    // not a kernel allocation. The user stack pages are freed when we
-    // free the page table (which unmaps and frees all user pages).
+    // not a kernel allocation. The user stack pages are released when we
+    // free the page table, which drops each user page's reference.
     // if (proc->user_stack) {
     //     kfree((void *)proc->user_stack);  // WRONG!
     // }
     
     if (proc->trap_frame) {
-        kfree(proc->trap_frame);
+        kmem_cache_free(trap_frame_cache, proc->trap_frame);
+        proc->trap_frame = NULL;
     }
     
-    // Free user page table (but NOT the shared kernel page table)
-    if (proc->page_table && proc->page_table != get_kernel_page_table()) {
-        free_page_table(proc->page_table);
+    fpu_release(proc, NULL);
+    signal_release_process(proc);
+    acct_release(proc);
+    
+    // Detach the user page table (but NOT the shared kernel page table)
+    // and the VMAs, freed once the lock is dropped. A thread's table is
+    // its leader's, which is freed last.
+    struct process *leader = proc->group_leader;
+    page_table_t *page_table = NULL;
+    if (proc->page_table && proc->page_table != get_kernel_page_table() && leader == proc) {
+        page_table = proc->page_table;
+    }
+    proc->page_table = NULL;
+    vm_area_t *vm_areas = proc->vm_areas;
+    proc->vm_areas = NULL;
+    proc->vma_root = NULL;
+    if (leader == proc) {
+        process_set_rss(proc, 0);
+    }
+    rgroup_exit(proc);
+    
+    // Off every list before the slot can be reused
+    write_seqcount_begin(&pid_hash_seq);
+    proc_list_del(proc, offsetof(struct process, pid_link));
+    write_seqcount_end(&pid_hash_seq);
+    proc_list_del(proc, offsetof(struct process, pgrp_link));
+    proc_list_del(proc, offsetof(struct process, sibling_link));
+    if (leader && leader != proc) {
+        proc_list_del(proc, offsetof(struct process, thread_link));
+        leader->nr_threads--;
+    }
+    
+    // Children outliving us have no one left to signal or reap them
+    while (proc->children) {
+        struct process *child = proc->children;
+        proc_list_del(child, offsetof(struct process, sibling_link));
+        child->parent = NULL;
     }
     
     // Mark process slot as unused
+    write_seqcount_begin(&proc->seq);
     proc->state = PROC_UNUSED;
     proc->pid = -1;
+    write_seqcount_end(&proc->seq);
+    
+    spin_unlock_irqrestore(&process_lock, irq_state);
     
-    lock_release(&process_lock);
+    // Freeing the page table drops the references its user mappings hold
+    // on data pages. VMAs go once their pages are unmapped, so shared
+    // file pages written back then can be marked clean.
+    if ((page_table || vm_areas) && process_defer_teardown(page_table, vm_areas) != 0) {
+        if (page_table) {
+            free_page_table(page_table);
+        }
+        vma_list_free(vm_areas);
+    }
+}
+
+/**
+ * Queue a detached address space for the reaper
+ * 
+ * Unless memory is short: the reaper runs at the lowest priority, and
+ * an allocation waiting for memory should not wait for it too.
+ * 
+ * @return 0 if queued, -1 if the caller must free it now
+ */
+static int process_defer_teardown(page_table_t *page_table, vm_area_t *vm_areas) {
+    size_t free_pages;
+    pmm_get_stats(NULL, &free_pages);
+    if (!reaper || free_pages < reclaim_wmark_low()) {
+        teardown_stats.direct++;
+        return -1;
+    }
+    
+    mm_teardown_t *td = kmem_cache_alloc(teardown_cache);
+    if (!td) {
+        teardown_stats.direct++;
+        return -1;
+    }
+    td->page_table = page_table;
+    td->vm_areas = vm_areas;
+    td->next = NULL;
+    
+    int irq_state = interrupt_save_disable();
+    if (teardown_tail) {
+        teardown_tail->next = td;
+    } else {
+        teardown_head = td;
+    }
+    teardown_tail = td;
+    teardown_stats.pending++;
+    teardown_stats.deferred++;
+    wait_queue_wake(&reaper_wait);
+    interrupt_restore(irq_state);
+    return 0;
+}
+
+/**
+ * Reaper thread body
+ * 
+ * Frees queued address spaces PROCESS_TEARDOWN_BATCH level-0 tables at
+ * a time, letting other CPUs into the kernel in between.
+ */
+static void reaper_main(void *arg) {
+    (void)arg;
+    
+    for (;;) {
+        int irq_state = interrupt_save_disable();
+        while (!teardown_head) {
+            wait_queue_sleep_irqoff(&reaper_wait);
+        }
+        mm_teardown_t *td = teardown_head;
+        interrupt_restore(irq_state);
+        
+        // Only the reaper takes entries off: td stays at the head
+        if (td->page_table) {
+            if (!free_page_table_partial(td->page_table, PROCESS_TEARDOWN_BATCH)) {
+                teardown_stats.batches++;
+                bkl_relax();
+                continue;
+            }
+            td->page_table = NULL;
+            teardown_stats.batches++;
+        }
+        vma_list_free(td->vm_areas);
+        
+        irq_state = interrupt_save_disable();
+        teardown_head = td->next;
+        if (!teardown_head) {
+            teardown_tail = NULL;
+        }
+        teardown_stats.pending--;
+        interrupt_restore(irq_state);
+        kmem_cache_free(teardown_cache, td);
+        
+        bkl_relax();
+    }
+}
+
+/**
+ * Start the reaper thread
+ */
+int process_start_reaper(void) {
+    struct process *proc = kthread_create("reaper", reaper_main, NULL);
+    if (!proc) {
+        // errno already set by kthread_create
+        return -1;
+    }
+    
+    // Cleanup only gets the CPU nobody else wants
+    proc->base_priority = PROCESS_REAPER_PRIORITY;
+    scheduler_set_priority(proc, PROCESS_REAPER_PRIORITY);
+    reaper = proc;
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Get deferred teardown statistics
+ */
+void process_get_teardown_stats(process_teardown_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+    
+    int irq_state = interrupt_save_disable();
+    *stats = teardown_stats;
+    interrupt_restore(irq_state);
 }
 
 /**
@@ -200,7 +599,7 @@ void process_free(struct process *proc) {
  */
 static void setup_trap_frame(struct process *proc, void (*entry_point)(void *), void *arg) {
     // Allocate trap frame separately (stack allocation would cause corruption)
-    proc->trap_frame = (struct trap_frame *)kmalloc(sizeof(struct trap_frame));
+    proc->trap_frame = (struct trap_frame *)kmem_cache_alloc(trap_frame_cache);
     if (!proc->trap_frame) {
         kernel_panic("setup_trap_frame: failed to allocate trap frame");
     }
@@ -265,14 +664,17 @@ struct process *process_create(const char *name, void (*entry_point)(void *), vo
     }
     
     // Assign unique PID
+    write_seqcount_begin(&proc->seq);
     proc->pid = alloc_pid();
     
     // Copy process name (with null terminator)
     kstrncpy(proc->name, name, PROC_NAME_LEN - 1);
     proc->name[PROC_NAME_LEN - 1] = '\0';
+    write_seqcount_end(&proc->seq);
+    process_hash_pid(proc);
     
     // Allocate kernel stack for trap handling and context switching
-    proc->kernel_stack = (uintptr_t)kmalloc((size_t)KERNEL_STACK_SIZE);
+    proc->kernel_stack = kstack_alloc();
     if (!proc->kernel_stack) {
         kernel_panic("process_create: Failed to allocate kernel stack");
     }
@@ -302,7 +704,8 @@ struct process *process_create(const char *name, void (*entry_point)(void *), vo
     // Initialize other process fields
     proc->cpu_time = 0;
     proc->priority = 10;  // Default priority
-    proc->parent = current_process;
+    proc->base_priority = 10;
+    process_set_parent(proc, current_process);
     proc->exit_code = 0;
     proc->errno_value = 0;
     proc->cwd[0] = '/';
@@ -316,7 +719,7 @@ struct process *process_create(const char *name, void (*entry_point)(void *), vo
         proc->euid = current_process->euid;
         proc->egid = current_process->egid;
         // Inherit process group and session from parent
-        proc->pgid = current_process->pgid;
+        process_set_pgid(proc, current_process->pgid);
         proc->sid = current_process->sid;
     } else {
         proc->uid = 0;   /* root */
@@ -324,7 +727,7 @@ struct process *process_create(const char *name, void (*entry_point)(void *), vo
         proc->euid = 0;
         proc->egid = 0;
         // New process becomes its own group and session leader
-        proc->pgid = proc->pid;
+        process_set_pgid(proc, proc->pid);
         proc->sid = proc->pid;
     }
     
@@ -340,12 +743,134 @@ struct process *process_create(const char *name, void (*entry_point)(void *), vo
 }
 
 /**
- * Exit the current process
+ * First code a kernel thread runs, from its initial context
+ */
+static void kthread_entry(void) {
+    struct process *proc = process_current();
+    
+    // context_switch() left interrupts off and skipped the page table
+    // switch, as for any process entered through a fresh context
+    process_switch_page_table(proc);
+    interrupt_enable();
+    
+    proc->kthread_fn(proc->kthread_arg);
+    process_exit(0);
+}
+
+/**
+ * Create a kernel thread
+ */
+struct process *kthread_create(const char *name, void (*fn)(void *), void *arg) {
+    struct process *proc = alloc_process();
+    if (!proc) {
+        RETURN_ERRNO_NULL(THUNDEROS_EAGAIN);
+    }
+    
+    write_seqcount_begin(&proc->seq);
+    proc->pid = alloc_pid();
+    kstrncpy(proc->name, name, PROC_NAME_LEN - 1);
+    proc->name[PROC_NAME_LEN - 1] = '\0';
+    write_seqcount_end(&proc->seq);
+    process_hash_pid(proc);
+    
+    proc->kernel_stack = kstack_alloc();
+    if (!proc->kernel_stack) {
+        process_free(proc);
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+    proc->page_table = get_kernel_page_table();
+    proc->user_stack = 0;
+    proc->trap_frame = NULL;
+    proc->kthread_fn = fn;
+    proc->kthread_arg = arg;
+    
+    kmemset(&proc->context, 0, sizeof(struct context));
+    proc->context.ra = (unsigned long)kthread_entry;
+    proc->context.sp = proc->kernel_stack + (size_t)KERNEL_STACK_SIZE - STACK_ALIGNMENT;
+    proc->context.s0 = proc->context.sp;
+    
+    proc->cpu_time = 0;
+    proc->priority = 10;
+    proc->base_priority = 10;
+    proc->exit_code = 0;
+    proc->errno_value = 0;
+    proc->cwd[0] = '/';
+    proc->cwd[1] = '\0';
+    proc->controlling_tty = -1;
+    proc->uid = 0;
+    proc->gid = 0;
+    proc->euid = 0;
+    proc->egid = 0;
+    process_set_pgid(proc, proc->pid);
+    proc->sid = proc->pid;
+    
+    extern void signal_init_process(struct process *proc);
+    signal_init_process(proc);
+    proc->blocked_signals = ~(sigset_t)0;
+    
+    proc->state = PROC_READY;
+    scheduler_enqueue(proc);
+    
+    clear_errno();
+    return proc;
+}
+
+/**
+ * Reap threads that have exited (work item)
+ * 
+ * A zombie is off its CPU by the time anyone else holds the BKL, so its
+ * kernel stack is free to go, as when a parent reaps a child.
+ */
+static void process_reap_threads(work_t *work) {
+    (void)work;
+    
+    for (int i = 0; i < MAX_PROCS; i++) {
+        struct process *proc = &process_table[i];
+        struct process *leader = proc->group_leader;
+        if (proc->state != PROC_ZOMBIE || !leader || leader == proc) {
+            continue;
+        }
+        
+        process_free(proc);
+        
+        // Wake an execve() waiting to be alone, and once the last thread
+        // is gone, the parent of a leader that already exited
+        wait_queue_wake(&leader->child_wait);
+        if (leader->state == PROC_ZOMBIE && leader->nr_threads == 1 && leader->parent) {
+            signal_send(leader->parent, SIGCHLD);
+            wait_queue_wake(&leader->parent->child_wait);
+        }
+    }
+}
+
+static work_t thread_reap_work = WORK_INIT(process_reap_threads);
+
+/**
+ * Clear the clear_child_tid word and wake whoever joins on it
+ */
+static void process_clear_child_tid(struct process *proc) {
+    uint32_t *ctid = proc->clear_child_tid;
+    if (!ctid) {
+        return;
+    }
+    proc->clear_child_tid = NULL;
+    
+    uint32_t zero = 0;
+    if (copy_to_user(ctid, &zero, sizeof(zero)) == 0) {
+        futex_wake(ctid, 1);
+    }
+}
+
+/**
+ * Exit the current thread
  * 
- * Marks process as zombie, removes from scheduler, and yields to another process.
- * Cannot be called on PID 0 (init process).
+ * Marks it as zombie, removes it from the scheduler, and yields to
+ * another process. A thread other than the group leader is reaped by
+ * the worker thread; the leader waits for its parent, which cannot reap
+ * it while other threads remain. Cannot be called on PID 0 (init
+ * process).
  * 
- * @param exit_code Exit status code (currently unused)
+ * @param exit_code Exit status code
  */
 void process_exit(int exit_code) {
     struct process *proc = current_process;
@@ -357,10 +882,35 @@ void process_exit(int exit_code) {
         }
     }
     
-    // Save parent pointer before acquiring lock
+    struct process *leader = proc->group_leader;
+    if (leader == proc && leader->group_exiting) {
+        exit_code = leader->group_exit_code;
+    }
+    
+    // A vfork parent gets its address space back before we are a zombie
+    process_vfork_release(proc);
+    
+    // Still in our address space: tell a joiner we are done
+    process_clear_child_tid(proc);
+    
+    // Bank our counters before the descriptors holding them close
+    perf_process_exit(proc);
+    
+    // Close our descriptors, so a pipe's reader sees EOF now rather than
+    // when we are reaped
+    fdtable_destroy(proc->files);
+    proc->files = NULL;
+    vfs_node_put(proc->cwd_node);
+    proc->cwd_node = NULL;
+    
+    // Save parent pointer before acquiring lock. Nobody hears of a leader
+    // until its other threads are gone too (process_reap_threads()).
     struct process *parent = proc->parent;
+    if (leader != proc || leader->nr_threads > 1) {
+        parent = NULL;
+    }
     
-    lock_acquire(&process_lock);
+    int irq_state = spin_lock_irqsave(&process_lock);
     
     // Mark as zombie and record exit code
     proc->state = PROC_ZOMBIE;
@@ -369,14 +919,24 @@ void process_exit(int exit_code) {
     // Remove from scheduler to prevent re-execution
     extern void scheduler_dequeue(struct process *proc);
     scheduler_dequeue(proc);
+    ktimer_cancel(&proc->sleep_timer);
+    hrtimer_cancel(&proc->sleep_hrtimer);
     
-    lock_release(&process_lock);
+    spin_unlock_irqrestore(&process_lock, irq_state);
+    
+    // Its deadline bandwidth is free for others
+    scheduler_exit(proc);
+    
+    if (leader != proc) {
+        queue_work(&thread_reap_work);
+    }
     
     // Send SIGCHLD to parent AFTER releasing lock to avoid deadlock
     // (signal_send -> process_wakeup also acquires process_lock)
     if (parent) {
         extern int signal_send(struct process *proc, int signum);
         signal_send(parent, SIGCHLD);
+        wait_queue_wake(&parent->child_wait);
     }
     
     // Keep yielding until scheduler finds another process
@@ -395,6 +955,9 @@ void process_exit(int exit_code) {
 void process_yield(void) {
     extern void schedule(void);
     schedule();
+    
+    // Let other CPUs into the kernel too
+    bkl_relax();
 }
 
 /**
@@ -407,22 +970,21 @@ void process_yield(void) {
 struct process *process_find_zombie_child(struct process *parent, int target_pid) {
     if (!parent) return NULL;
     
-    lock_acquire(&process_lock);
+    int irq_state = spin_lock_irqsave(&process_lock);
     
-    // Search through process table for zombie children
-    for (int i = 0; i < MAX_PROCS; i++) {
-        struct process *proc = &process_table[i];
-        
-        if (proc->state == PROC_ZOMBIE && proc->parent == parent) {
+    // Search through the parent's children for a zombie whose other
+    // threads have been reaped
+    for (struct process *proc = parent->children; proc; proc = proc->sibling_link.next) {
+        if (proc->state == PROC_ZOMBIE && proc->nr_threads == 1) {
             // Found a zombie child
             if (target_pid == -1 || proc->pid == target_pid) {
-                lock_release(&process_lock);
+                spin_unlock_irqrestore(&process_lock, irq_state);
                 return proc;
             }
         }
     }
     
-    lock_release(&process_lock);
+    spin_unlock_irqrestore(&process_lock, irq_state);
     return NULL;
 }
 
@@ -436,22 +998,20 @@ struct process *process_find_zombie_child(struct process *parent, int target_pid
 int process_has_children(struct process *parent, int target_pid) {
     if (!parent) return 0;
     
-    lock_acquire(&process_lock);
+    int irq_state = spin_lock_irqsave(&process_lock);
     
-    // Search through process table for children
-    for (int i = 0; i < MAX_PROCS; i++) {
-        struct process *proc = &process_table[i];
-        
-        if (proc->state != PROC_UNUSED && proc->parent == parent) {
+    // Search through the parent's children
+    for (struct process *proc = parent->children; proc; proc = proc->sibling_link.next) {
+        if (proc->state != PROC_UNUSED) {
             // Found a child
             if (target_pid == -1 || proc->pid == target_pid) {
-                lock_release(&process_lock);
+                spin_unlock_irqrestore(&process_lock, irq_state);
                 return 1;
             }
         }
     }
     
-    lock_release(&process_lock);
+    spin_unlock_irqrestore(&process_lock, irq_state);
     return 0;
 }
 
@@ -467,22 +1027,20 @@ int process_has_children(struct process *parent, int target_pid) {
 struct process *process_find_stopped_child(struct process *parent, int target_pid) {
     if (!parent) return NULL;
     
-    lock_acquire(&process_lock);
+    int irq_state = spin_lock_irqsave(&process_lock);
     
-    // Search through process table for stopped children
-    for (int i = 0; i < MAX_PROCS; i++) {
-        struct process *proc = &process_table[i];
-        
-        if (proc->state == PROC_STOPPED && proc->parent == parent) {
+    // Search through the parent's children for a stopped one
+    for (struct process *proc = parent->children; proc; proc = proc->sibling_link.next) {
+        if (proc->state == PROC_STOPPED) {
             // Found a stopped child
             if (target_pid == -1 || proc->pid == target_pid) {
-                lock_release(&process_lock);
+                spin_unlock_irqrestore(&process_lock, irq_state);
                 return proc;
             }
         }
     }
     
-    lock_release(&process_lock);
+    spin_unlock_irqrestore(&process_lock, irq_state);
     return NULL;
 }
 
@@ -516,25 +1074,62 @@ int process_get_max_count(void) {
     return MAX_PROCS;
 }
 
+/**
+ * Block until the sleeping current process is woken
+ * 
+ * schedule() switches to another process, or to this CPU's idle context
+ * if nothing else is runnable, and returns once the process has been
+ * woken and picked again. Called with interrupts disabled and the
+ * process already PROC_SLEEPING with a timer armed.
+ */
+static void process_sleep_wait(struct process *proc) {
+    while (proc->state == PROC_SLEEPING) {
+        process_yield();
+        interrupt_disable();
+    }
+}
+
 /**
  * User process sleep
  * 
- * Marks process as sleeping and yields to scheduler.
- * TODO: Implement timer-based wakeup queue for actual sleep functionality.
+ * Arms the process's sleep timer and blocks until it fires or something
+ * else wakes the process.
  * 
- * @param ticks Number of ticks to sleep (currently unused)
+ * @param ticks Number of ticks to sleep
  */
 void process_sleep(uint64_t ticks) {
     struct process *proc = current_process;
-    if (!proc) return;
+    if (!proc || ticks == 0) return;
     
-    lock_acquire(&process_lock);
+    int irq_state = interrupt_save_disable();
     proc->state = PROC_SLEEPING;
-    // TODO: Add to sleep queue with wakeup time
-    (void)ticks;  // Mark unused parameter
-    lock_release(&process_lock);
+    ktimer_add(&proc->sleep_timer, hal_timer_get_ticks() + ticks);
+    process_sleep_wait(proc);
+    interrupt_restore(irq_state);
     
-    process_yield();
+    // Woken early (signal): the timer is still armed
+    ktimer_cancel(&proc->sleep_timer);
+}
+
+/**
+ * User process sleep with microsecond resolution
+ * 
+ * Like process_sleep(), but on a high-resolution timer, so the wakeup is
+ * not rounded to a tick.
+ * 
+ * @param us Microseconds to sleep
+ */
+void process_sleep_us(uint64_t us) {
+    struct process *proc = current_process;
+    if (!proc || us == 0) return;
+    
+    int irq_state = interrupt_save_disable();
+    proc->state = PROC_SLEEPING;
+    hrtimer_start(&proc->sleep_hrtimer, hal_timer_get_time_us() + us);
+    process_sleep_wait(proc);
+    interrupt_restore(irq_state);
+    
+    hrtimer_cancel(&proc->sleep_hrtimer);
 }
 
 /**
@@ -547,12 +1142,12 @@ void process_sleep(uint64_t ticks) {
 void process_wakeup(struct process *proc) {
     if (!proc) return;
     
-    lock_acquire(&process_lock);
+    int irq_state = spin_lock_irqsave(&process_lock);
     if (proc->state == PROC_SLEEPING || proc->state == PROC_STOPPED) {
         proc->state = PROC_READY;
         scheduler_enqueue(proc);
     }
-    lock_release(&process_lock);
+    spin_unlock_irqrestore(&process_lock, irq_state);
 }
 
 /**
@@ -593,15 +1188,103 @@ void process_dump(void) {
 }
 
 /**
- * Fork the current process
+ * Give a forked child a copy-on-write copy of the parent's address space
  * 
- * Creates a copy of the current process with complete memory isolation.
- * Copies page table, VMAs, and process state.
+ * @return 0 on success, -1 on error (errno set; the caller frees the child)
+ */
+static int fork_copy_mm(struct process *parent, struct process *child) {
+    // A thread's address space is its leader's
+    parent = parent->group_leader;
+    
+    // The copy-on-write copy counts in the child's RSS, and the group's
+    if (rgroup_mem_allow(child->rgroup, parent->rss_pages) != 0) {
+        /* errno already set by rgroup_mem_allow */
+        return -1;
+    }
+    
+    // Set up memory isolation for child
+    if (process_setup_memory_isolation(child) != 0) {
+        hal_uart_puts("process_fork: failed to setup memory isolation\n");
+        /* errno already set by process_setup_memory_isolation */
+        return -1;
+    }
+    
+    // Create new page table for child
+    child->page_table = create_user_page_table();
+    if (!child->page_table) {
+        hal_uart_puts("process_fork: failed to create page table\n");
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    
+    // Copy VMAs from parent to child
+    vm_area_t *parent_vma = parent->vm_areas;
+    while (parent_vma) {
+        // Add VMA to child
+        int added;
+        if (parent_vma->shm) {
+            added = process_add_shm_vma(child, parent_vma->start, parent_vma->end, parent_vma->flags,
+                                        parent_vma->shm, parent_vma->file_offset);
+        } else {
+            added = process_add_file_vma(child, parent_vma->start, parent_vma->end, parent_vma->flags,
+                                         parent_vma->file, parent_vma->file_offset);
+        }
+        if (added != 0) {
+            hal_uart_puts("process_fork: failed to copy VMA\n");
+            /* errno already set by process_add_*_vma */
+            return -1;
+        }
+        
+        // Shared file pages stay in the page cache, and shared memory
+        // pages in their object: the child faults in the same pages
+        // instead of sharing them copy-on-write
+        if (parent_vma->shm || (parent_vma->file && (parent_vma->flags & VM_SHARED))) {
+            parent_vma = parent_vma->next;
+            continue;
+        }
+        
+        // Share this VMA's pages copy-on-write; the first write from
+        // either side copies the page in handle_cow_fault()
+        for (uint64_t addr = parent_vma->start; addr < parent_vma->end; addr += PAGE_SIZE) {
+            if (share_user_page_cow(parent->page_table, child->page_table, addr) != 0) {
+                hal_uart_puts("process_fork: failed to share page\n");
+                tlb_flush(0);
+                /* errno already set by share_user_page_cow */
+                return -1;
+            }
+        }
+        
+        parent_vma = parent_vma->next;
+    }
+    
+    // Parent pages that turned read-only must not stay writable in the
+    // TLB, ours or those of CPUs running the parent's other threads
+    tlb_flush(0);
+    if (parent->nr_threads > 1) {
+        smp_flush_tlb_others();
+    }
+    process_update_mm_stats(child);
+    
+    return 0;
+}
+
+// What a new process gets of its creator's address space (fork_process())
+#define FORK_COPY_MM    0       // A copy-on-write copy (fork())
+#define FORK_BORROW_MM  1       // A loan until exec or exit (vfork())
+#define FORK_THREAD     2       // The same one, for good (clone())
+
+/**
+ * Create a child of the current process
+ * 
+ * With FORK_BORROW_MM the child runs on the parent's page table and VMAs
+ * instead of a copy-on-write copy of them (see process_vfork()). With
+ * FORK_THREAD it is a new thread: in the parent's thread group, sharing
+ * its address space and descriptor table, and nobody's child.
  * 
  * @param current_tf Current trap frame with register state to copy to child
- * @return Child PID in parent, 0 in child, -1 on error
+ * @param mode FORK_COPY_MM, FORK_BORROW_MM or FORK_THREAD
+ * @return Child PID, or -1 on error
  */
-pid_t process_fork(struct trap_frame *current_tf) {
+static pid_t fork_process(struct trap_frame *current_tf, int mode) {
     struct process *parent = process_current();
     if (!parent) {
         hal_uart_puts("process_fork: no current process\n");
@@ -621,17 +1304,36 @@ pid_t process_fork(struct trap_frame *current_tf) {
     }
     
     // Assign new PID
+    write_seqcount_begin(&child->seq);
     child->pid = alloc_pid();
     
     // Copy basic process info
     kstrcpy(child->name, parent->name);
+    write_seqcount_end(&child->seq);
+    process_hash_pid(child);
     child->state = PROC_READY;
-    child->parent = parent;
+    if (mode != FORK_THREAD) {
+        process_set_parent(child, parent);
+    }
     child->cpu_time = 0;
-    child->priority = parent->priority;
+    child->priority = parent->base_priority;  // Boosts are not inherited
+    child->base_priority = parent->base_priority;
+    child->sched_policy = parent->sched_policy;
+    if (parent->sched_policy == SCHED_DEADLINE) {
+        // Bandwidth was admitted for the parent alone
+        child->sched_policy = SCHED_NORMAL;
+        child->priority = 10;
+        child->base_priority = 10;
+    }
+    child->vruntime = parent->vruntime;
+    rgroup_fork(child, parent);
     child->exit_code = 0;
     child->errno_value = 0;
     child->controlling_tty = parent->controlling_tty;  /* Inherit parent's TTY */
+    if (mode == FORK_COPY_MM) {
+        child->ring = parent->ring;  /* Same address in the copied address space */
+        child->ring_entries = parent->ring_entries;
+    }
     
     /* Inherit uid/gid from parent */
     child->uid = parent->uid;
@@ -640,100 +1342,93 @@ pid_t process_fork(struct trap_frame *current_tf) {
     child->egid = parent->egid;
     
     /* Inherit process group and session from parent */
-    child->pgid = parent->pgid;
+    process_set_pgid(child, parent->pgid);
     child->sid = parent->sid;
     
+    /* Inherit signal dispositions and mask; nothing is pending yet */
+    child->pending_signals = 0;
+    child->blocked_signals = parent->blocked_signals;
+    for (int sig = 0; sig < NSIG; sig++) {
+        child->signal_handlers[sig] = parent->signal_handlers[sig];
+    }
+    
     /* Copy parent's current working directory with proper null termination */
     int cwd_index = 0;
     for (cwd_index = 0; cwd_index < MAX_CWD_LEN && parent->cwd[cwd_index]; cwd_index++) {
         child->cwd[cwd_index] = parent->cwd[cwd_index];
     }
     child->cwd[cwd_index] = '\0';
+    child->cwd_node = parent->cwd_node;
+    vfs_node_get(child->cwd_node);
+    
+    /* Same open files on the same descriptors (the same table, for a thread) */
+    fdtable_t *files = fdtable_current();
+    if (mode == FORK_THREAD) {
+        child->files = files ? fdtable_share(files) : NULL;
+    } else {
+        child->files = files ? fdtable_clone(files) : NULL;
+    }
+    if (!child->files) {
+        hal_uart_puts("process_fork: failed to copy descriptor table\n");
+        process_free(child);
+        /* errno already set by fdtable_current or fdtable_clone */
+        return -1;
+    }
     
     /* Allocate kernel stack for child */
-    child->kernel_stack = (uintptr_t)kmalloc((size_t)KERNEL_STACK_SIZE);
+    child->kernel_stack = kstack_alloc();
     if (!child->kernel_stack) {
         hal_uart_puts("process_fork: failed to allocate kernel stack\n");
         process_free(child);
         RETURN_ERRNO(THUNDEROS_ENOMEM);
     }
     
-    // Set up memory isolation for child
-    if (process_setup_memory_isolation(child) != 0) {
-        hal_uart_puts("process_fork: failed to setup memory isolation\n");
+    // Allocate trap frame (before a borrowed address space would make
+    // process_free() unsafe)
+    child->trap_frame = (struct trap_frame *)kmem_cache_alloc(trap_frame_cache);
+    if (!child->trap_frame) {
+        hal_uart_puts("process_fork: failed to allocate trap frame\n");
         process_free(child);
-        /* errno already set by process_setup_memory_isolation */
-        return -1;
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
     }
     
-    // Create new page table for child
-    child->page_table = create_user_page_table();
-    if (!child->page_table) {
-        hal_uart_puts("process_fork: failed to create page table\n");
+    // FP registers; the FS bits in the copied trap frame already match
+    if (fpu_fork(parent, child) != 0) {
+        hal_uart_puts("process_fork: failed to allocate FP state\n");
         process_free(child);
         RETURN_ERRNO(THUNDEROS_ENOMEM);
     }
     
-    // Copy VMAs from parent to child
-    vm_area_t *parent_vma = parent->vm_areas;
-    while (parent_vma) {
-        // Add VMA to child
-        if (process_add_vma(child, parent_vma->start, parent_vma->end, parent_vma->flags) != 0) {
-            hal_uart_puts("process_fork: failed to copy VMA\n");
-            process_free(child);
-            /* errno already set by process_add_vma */
-            return -1;
-        }
-        
-        // Copy physical pages for this VMA
-        for (uint64_t addr = parent_vma->start; addr < parent_vma->end; addr += PAGE_SIZE) {
-            uintptr_t parent_paddr;
-            if (virt_to_phys(parent->page_table, addr, &parent_paddr) == 0) {
-                // Allocate new physical page for child
-                uintptr_t child_paddr = pmm_alloc_page();
-                if (!child_paddr) {
-                    hal_uart_puts("process_fork: failed to allocate page\n");
-                    process_free(child);
-                    RETURN_ERRNO(THUNDEROS_ENOMEM);
-                }
-                
-                // Copy page contents using physical addresses (identity-mapped in kernel)
-                kmemcpy((void *)child_paddr, (void *)parent_paddr, PAGE_SIZE);
-                
-                // Convert VM flags to PTE flags
-                uint64_t pte_flags = PTE_V;
-                if (parent_vma->flags & VM_READ) pte_flags |= PTE_R;
-                if (parent_vma->flags & VM_WRITE) pte_flags |= PTE_W;
-                if (parent_vma->flags & VM_EXEC) pte_flags |= PTE_X;
-                if (parent_vma->flags & VM_USER) pte_flags |= PTE_U;
-                
-                // Map page in child's page table
-                if (map_page(child->page_table, addr, child_paddr, pte_flags) != 0) {
-                    hal_uart_puts("process_fork: failed to map page\n");
-                    pmm_free_page(child_paddr);
-                    process_free(child);
-                    /* errno already set by map_page */
-                    return -1;
-                }
-            }
-        }
-        
-        parent_vma = parent_vma->next;
+    if (mode == FORK_THREAD) {
+        // The leader's page table, VMAs and ASID, for the thread's life
+        struct process *leader = parent->group_leader;
+        int irq_state = spin_lock_irqsave(&process_lock);
+        child->group_leader = leader;
+        proc_list_add(&leader->threads, child, offsetof(struct process, thread_link));
+        leader->nr_threads++;
+        spin_unlock_irqrestore(&process_lock, irq_state);
+        child->page_table = parent->page_table;
+    } else if (mode == FORK_BORROW_MM) {
+        // Same page table, ASID and VMAs: nothing to copy or flush. They
+        // go back to the parent in process_vfork_release().
+        child->page_table = parent->page_table;
+        child->asid = parent->asid;
+        child->last_cpu = parent->last_cpu;
+        child->vm_areas = parent->vm_areas;
+        child->vma_root = parent->vma_root;
+        child->vfork_parent = parent;
+        parent->vfork_child = child;
+    } else if (fork_copy_mm(parent, child) != 0) {
+        process_free(child);
+        /* errno already set by fork_copy_mm */
+        return -1;
     }
     
     // Copy heap information
-    child->heap_start = parent->heap_start;
-    child->heap_end = parent->heap_end;
+    child->heap_start = parent->group_leader->heap_start;
+    child->heap_end = parent->group_leader->heap_end;
     child->user_stack = parent->user_stack;
     
-    // Allocate and copy trap frame
-    child->trap_frame = (struct trap_frame *)kmalloc(sizeof(struct trap_frame));
-    if (!child->trap_frame) {
-        hal_uart_puts("process_fork: failed to allocate trap frame\n");
-        process_free(child);
-        RETURN_ERRNO(THUNDEROS_ENOMEM);
-    }
-    
     // Copy from CURRENT trap frame (on kernel stack), not old parent->trap_frame
     kmemcpy(child->trap_frame, current_tf, sizeof(struct trap_frame));
     
@@ -756,25 +1451,212 @@ pid_t process_fork(struct trap_frame *current_tf) {
     // Set up child's kernel stack pointer
     child->context.sp = child->kernel_stack  + (size_t)KERNEL_STACK_SIZE- STACK_ALIGNMENT;
     
-    // CRITICAL: Initialize s0 (frame pointer) to point to kernel stack!
-    // forked_child_entry is a C function and with -O0 it uses frame pointers.
-    // It needs s0 to point to a valid KERNEL stack location, not user space.
-    // Set s0 = sp (both point to top of kernel stack).
-    child->context.s0 = child->context.sp;
+    // CRITICAL: Initialize s0 (frame pointer) to point to kernel stack!
+    // forked_child_entry is a C function and with -O0 it uses frame pointers.
+    // It needs s0 to point to a valid KERNEL stack location, not user space.
+    // Set s0 = sp (both point to top of kernel stack).
+    child->context.s0 = child->context.sp;
+    
+    // Other callee-saved registers (s1-s11) can stay at 0 - they're not used
+    // by forked_child_entry before user_return restores them from trap_frame.
+    
+    // Set up child to return to user mode on first schedule
+    // Use forked_child_entry which restores all registers from trap frame
+    child->context.ra = (unsigned long)forked_child_entry;
+    
+    // Add child to scheduler
+    child->state = PROC_READY;
+    scheduler_enqueue(child);
+    
+    // Return child PID to parent
+    return child->pid;
+}
+
+/**
+ * Fork the current process
+ * 
+ * Creates a copy of the current process with complete memory isolation.
+ * Copies VMAs and process state; user pages are shared copy-on-write
+ * and only copied when one side first writes to them.
+ * 
+ * @param current_tf Current trap frame with register state to copy to child
+ * @return Child PID in parent, 0 in child, -1 on error
+ */
+pid_t process_fork(struct trap_frame *current_tf) {
+    return fork_process(current_tf, FORK_COPY_MM);
+}
+
+/**
+ * Fork the current process without copying its address space
+ * 
+ * The child runs on the parent's memory and the parent sleeps until the
+ * child hands it back, by exec or exit.
+ */
+pid_t process_vfork(struct trap_frame *current_tf) {
+    struct process *parent = process_current();
+    
+    // Our other threads keep changing the address space a child would
+    // borrow: copy it instead
+    if (parent->group_leader->nr_threads > 1) {
+        return fork_process(current_tf, FORK_COPY_MM);
+    }
+    
+    pid_t child_pid = fork_process(current_tf, FORK_BORROW_MM);
+    if (child_pid < 0) {
+        /* errno already set by fork_process */
+        return -1;
+    }
+    
+    // Our stack is in use by the child: stay off it until it is released.
+    // Other wakeups (signals, SIGCHLD) just send us around again.
+    while (parent->vfork_child) {
+        parent->state = PROC_SLEEPING;
+        scheduler_yield();
+        parent->state = PROC_RUNNING;
+    }
+    
+    return child_pid;
+}
+
+/**
+ * Hand a borrowed address space back to the vfork parent
+ */
+void process_vfork_release(struct process *proc) {
+    struct process *parent = proc->vfork_parent;
+    if (!parent) {
+        return;
+    }
+    
+    // Whatever the child mapped or unmapped is now the parent's; so are
+    // the translations it left under the shared ASID
+    parent->vm_areas = proc->vm_areas;
+    parent->vma_root = proc->vma_root;
+    parent->heap_end = proc->heap_end;
+    parent->asid = proc->asid;
+    parent->last_cpu = proc->last_cpu;
+    
+    // So are the pages it faulted in
+    uint64_t pages = proc->rss_pages;
+    process_set_rss(proc, 0);
+    process_set_rss(parent, parent->rss_pages + pages);
+    proc->page_table = NULL;
+    proc->vm_areas = NULL;
+    proc->vma_root = NULL;
+    proc->asid = 0;
+    proc->vfork_parent = NULL;
+    parent->vfork_child = NULL;
+    
+    process_wakeup(parent);
+}
+
+/**
+ * Start a new thread in the current process
+ */
+pid_t process_clone(struct trap_frame *current_tf, uint64_t flags, uintptr_t stack,
+                    uintptr_t tls, uint32_t *ctid) {
+    const uint64_t known = CLONE_THREAD_FLAGS | CLONE_SETTLS | CLONE_CHILD_CLEARTID;
+    struct process *parent = process_current();
+    
+    if (!parent || !current_tf || (flags & ~known) ||
+        (flags & CLONE_THREAD_FLAGS) != CLONE_THREAD_FLAGS) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (stack == 0 || (stack & (STACK_ALIGNMENT - 1))) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (flags & CLONE_CHILD_CLEARTID) {
+        if (((uintptr_t)ctid & (sizeof(uint32_t) - 1)) ||
+            !process_validate_user_ptr(parent, ctid, sizeof(uint32_t), VM_USER | VM_WRITE)) {
+            RETURN_ERRNO(THUNDEROS_EFAULT);
+        }
+    }
+    
+    // The thread starts from our registers, on its own stack and TLS
+    struct trap_frame tf;
+    kmemcpy(&tf, current_tf, sizeof(tf));
+    tf.sp = stack;
+    if (flags & CLONE_SETTLS) {
+        tf.tp = tls;
+    }
+    
+    pid_t tid = fork_process(&tf, FORK_THREAD);
+    if (tid < 0) {
+        /* errno already set by fork_process */
+        return -1;
+    }
+    
+    // Not run yet: it cannot be before we leave the kernel
+    if (flags & CLONE_CHILD_CLEARTID) {
+        process_get(tid)->clear_child_tid = ctid;
+    }
+    
+    clear_errno();
+    return tid;
+}
+
+/**
+ * Send SIGKILL to every thread of proc's group but proc
+ */
+static void process_signal_other_threads(struct process *proc) {
+    struct process *leader = proc->group_leader;
+    struct process *next;
+    
+    for (struct process *thread = leader; thread; thread = next) {
+        next = thread == leader ? leader->threads : thread->thread_link.next;
+        if (thread == proc || thread->state == PROC_ZOMBIE) {
+            continue;
+        }
+        signal_send(thread, SIGKILL);
+        if (thread->state == PROC_STOPPED) {
+            process_wakeup(thread);
+        }
+    }
+}
+
+/**
+ * Exit every thread of the current process
+ */
+void process_exit_group(int exit_code) {
+    struct process *proc = current_process;
+    struct process *leader = proc->group_leader;
+    
+    // The first to end the group sets its exit code; the threads it kills
+    // come back here from the signal and just exit
+    if (!leader->group_exiting) {
+        leader->group_exiting = 1;
+        leader->group_exit_code = exit_code;
+        process_signal_other_threads(proc);
+    }
+    process_exit(exit_code);
+}
+
+/**
+ * Make the current thread the only one in its process
+ */
+int process_kill_other_threads(void) {
+    struct process *proc = current_process;
     
-    // Other callee-saved registers (s1-s11) can stay at 0 - they're not used
-    // by forked_child_entry before user_return restores them from trap_frame.
+    if (proc->group_leader != proc) {
+        RETURN_ERRNO(THUNDEROS_EBUSY);
+    }
+    if (proc->nr_threads == 1) {
+        clear_errno();
+        return 0;
+    }
     
-    // Set up child to return to user mode on first schedule
-    // Use forked_child_entry which restores all registers from trap frame
-    child->context.ra = (unsigned long)forked_child_entry;
+    // Killed ourselves meanwhile, we exit as the group would have
+    proc->group_exiting = 1;
+    proc->group_exit_code = SIGNAL_EXIT_BASE;
+    process_signal_other_threads(proc);
     
-    // Add child to scheduler
-    child->state = PROC_READY;
-    scheduler_enqueue(child);
+    // process_reap_threads() wakes us as each one goes
+    while (proc->nr_threads > 1) {
+        wait_queue_sleep(&proc->child_wait);
+    }
+    proc->group_exiting = 0;
     
-    // Return child PID to parent
-    return child->pid;
+    clear_errno();
+    return 0;
 }
 
 /**
@@ -809,11 +1691,21 @@ struct process *process_create_user(const char *name, void *user_code, size_t co
     }
     
     // Assign unique PID
+    write_seqcount_begin(&proc->seq);
     proc->pid = alloc_pid();
     
     // Copy process name with null termination
     kstrncpy(proc->name, name, PROC_NAME_LEN - 1);
     proc->name[PROC_NAME_LEN - 1] = '\0';
+    write_seqcount_end(&proc->seq);
+    process_hash_pid(proc);
+    
+    // Console on descriptors 0, 1 and 2
+    proc->files = fdtable_create();
+    if (!proc->files) {
+        process_free(proc);
+        return NULL;
+    }
     
     // Create isolated user page table with kernel memory mappings
     proc->page_table = create_user_page_table();
@@ -842,12 +1734,9 @@ struct process *process_create_user(const char *name, void *user_code, size_t co
         return NULL;
     }
     
-    // Map user stack at standard location with read-write permissions
+    // Reserve user stack at standard location; pages are faulted in on
+    // first touch
     uintptr_t user_stack_base = USER_STACK_TOP - USER_STACK_SIZE;
-    if (map_user_memory(proc->page_table, user_stack_base, 0, (size_t)USER_STACK_SIZE, 1) != 0) {
-        process_free(proc);
-        return NULL;
-    }
     
     // Add VMA for stack segment
     if (process_add_vma(proc, user_stack_base, USER_STACK_TOP, VM_READ | VM_WRITE | VM_USER | VM_GROWSDOWN) != 0) {
@@ -856,17 +1745,17 @@ struct process *process_create_user(const char *name, void *user_code, size_t co
     }
     
     // Allocate kernel stack for trap handling (separate from user stack)
-    proc->kernel_stack = (uintptr_t)kmalloc((size_t)KERNEL_STACK_SIZE);
+    proc->kernel_stack = kstack_alloc();
     if (!proc->kernel_stack) {
         process_free(proc);
         return NULL;
     }
     
-    // User stack is in user address space (already mapped above)
+    // User stack is in user address space (reserved above)
     proc->user_stack = user_stack_base;
     
     // Allocate trap frame to save user state on traps
-    proc->trap_frame = (struct trap_frame *)kmalloc(sizeof(struct trap_frame));
+    proc->trap_frame = (struct trap_frame *)kmem_cache_alloc(trap_frame_cache);
     if (!proc->trap_frame) {
         process_free(proc);
         return NULL;
@@ -893,6 +1782,7 @@ struct process *process_create_user(const char *name, void *user_code, size_t co
     sstatus &= ~(1 << 1);   // Clear SIE (bit 1) = disable interrupts during user_return
     sstatus |= (1 << 5);    // Set SPIE (bit 5) = enable interrupts after sret
     sstatus |= (1UL << 18); // Set SUM (bit 18) = allow supervisor access to user memory
+    sstatus &= ~SSTATUS_FS_MASK; // FPU off until first use (see arch/fpu.h)
     proc->trap_frame->sstatus = sstatus;
     
     // Setup kernel context for initial context switch
@@ -908,7 +1798,8 @@ struct process *process_create_user(const char *name, void *user_code, size_t co
     // Initialize process metadata
     proc->cpu_time = 0;
     proc->priority = 10;  // Default priority (lower number = higher priority)
-    proc->parent = current_process;
+    proc->base_priority = 10;
+    process_set_parent(proc, current_process);
     proc->exit_code = 0;
     proc->errno_value = 0;
     proc->cwd[0] = '/';
@@ -922,7 +1813,7 @@ struct process *process_create_user(const char *name, void *user_code, size_t co
         proc->euid = current_process->euid;
         proc->egid = current_process->egid;
         // Inherit process group and session from parent
-        proc->pgid = current_process->pgid;
+        process_set_pgid(proc, current_process->pgid);
         proc->sid = current_process->sid;
     } else {
         proc->uid = 0;
@@ -930,11 +1821,13 @@ struct process *process_create_user(const char *name, void *user_code, size_t co
         proc->euid = 0;
         proc->egid = 0;
         // New process becomes its own group and session leader
-        proc->pgid = proc->pid;
+        process_set_pgid(proc, proc->pid);
         proc->sid = proc->pid;
     }
     
     // Mark as ready and enqueue for scheduling
+    process_update_mm_stats(proc);
+    
     proc->state = PROC_READY;
     scheduler_enqueue(proc);
     
@@ -942,16 +1835,14 @@ struct process *process_create_user(const char *name, void *user_code, size_t co
 }
 
 /**
- * Create a new user process from loaded ELF segments
+ * Create a new user process for an ELF program
  * 
  * Unlike process_create_user which maps code at a fixed address (USER_CODE_BASE),
- * this function maps code at the virtual address specified by the ELF file,
- * and sets the entry point to the ELF entry address.
+ * this leaves the program to the ELF loader, which maps its segments where
+ * the ELF file asks, and sets the entry point to the ELF entry address.
  */
-struct process *process_create_elf(const char *name, uint64_t code_base, 
-                                   void *code_mem, size_t code_size, 
-                                   uint64_t entry_point) {
-    if (!name || !code_mem || code_size == 0) {
+struct process *process_create_elf(const char *name, uint64_t entry_point) {
+    if (!name) {
         return NULL;
     }
     
@@ -962,14 +1853,24 @@ struct process *process_create_elf(const char *name, uint64_t code_base,
     }
     
     // Assign unique PID
+    write_seqcount_begin(&proc->seq);
     proc->pid = alloc_pid();
     
     // Set process name
     kstrncpy(proc->name, name, PROC_NAME_LEN - 1);
     proc->name[PROC_NAME_LEN - 1] = '\0';
+    write_seqcount_end(&proc->seq);
+    process_hash_pid(proc);
+    
+    // Console on descriptors 0, 1 and 2
+    proc->files = fdtable_create();
+    if (!proc->files) {
+        process_free(proc);
+        return NULL;
+    }
     
     // Allocate kernel stack
-    proc->kernel_stack = (uintptr_t)kmalloc((size_t)KERNEL_STACK_SIZE);
+    proc->kernel_stack = kstack_alloc();
     if (!proc->kernel_stack) {
         process_free(proc);
         return NULL;
@@ -978,63 +1879,18 @@ struct process *process_create_elf(const char *name, uint64_t code_base,
     // Create isolated page table for this process
     proc->page_table = create_user_page_table();
     if (!proc->page_table) {
-        kfree((void *)proc->kernel_stack);
         process_free(proc);
         return NULL;
     }
     
-    // Map user code at the specified virtual address base
-    // Round size up to page boundary
-    size_t code_pages = (code_size + PAGE_SIZE - 1) / PAGE_SIZE;
-    for (size_t i = 0; i < code_pages; i++) {
-        uintptr_t vaddr = code_base + ((size_t)i * PAGE_SIZE);
-        uintptr_t paddr = (uintptr_t)code_mem + ((size_t)i * PAGE_SIZE);
-        
-        // Map as user-readable, writable, and executable
-        // TODO: Use proper segment permissions from ELF (R/W/X per segment)
-        if (map_page(proc->page_table, vaddr, paddr, 
-                           PTE_V | PTE_R | PTE_W | PTE_X | PTE_U) != 0) {
-            free_page_table(proc->page_table);
-            kfree((void *)proc->kernel_stack);
-            process_free(proc);
-            return NULL;
-        }
-    }
-    
-    // Allocate user stack (multiple pages for stack growth)
-    #define INITIAL_STACK_PAGES 8  // 32KB initial stack
-    uintptr_t stack_base_vaddr = USER_STACK_TOP - (INITIAL_STACK_PAGES * PAGE_SIZE);
-    
-    for (int i = 0; i < INITIAL_STACK_PAGES; i++) {
-        uintptr_t stack_phys = pmm_alloc_page();
-        if (!stack_phys) {
-            free_page_table(proc->page_table);
-            kfree((void *)proc->kernel_stack);
-            process_free(proc);
-            return NULL;
-        }
-        
-        // Zero out stack via virtual address
-        kmemset((void *)translate_phys_to_virt(stack_phys), 0, PAGE_SIZE);
-        
-        // Map stack page
-        uintptr_t stack_vaddr = stack_base_vaddr + ((size_t)i * PAGE_SIZE);
-        if (map_page(proc->page_table, stack_vaddr, stack_phys,
-                           PTE_V | PTE_R | PTE_W | PTE_U) != 0) {
-            free_page_table(proc->page_table);
-            kfree((void *)proc->kernel_stack);
-            process_free(proc);
-            return NULL;
-        }
-    }
+    // Reserve the user stack; pages are faulted in on first touch
+    uintptr_t stack_base_vaddr = USER_STACK_TOP - USER_STACK_SIZE;
     
     proc->user_stack = stack_base_vaddr;
     
     // Allocate trap frame to save user state on traps
-    proc->trap_frame = (struct trap_frame *)kmalloc(sizeof(struct trap_frame));
+    proc->trap_frame = (struct trap_frame *)kmem_cache_alloc(trap_frame_cache);
     if (!proc->trap_frame) {
-        free_page_table(proc->page_table);
-        kfree((void *)proc->kernel_stack);
         process_free(proc);
         return NULL;
     }
@@ -1064,6 +1920,7 @@ struct process *process_create_elf(const char *name, uint64_t code_base,
     sstatus &= ~(1 << 1);   // Clear SIE (bit 1) = disable interrupts during user_return
     sstatus |= (1 << 5);    // Set SPIE (bit 5) = enable interrupts after sret
     sstatus |= (1UL << 18); // Set SUM (bit 18) = allow supervisor access to user memory
+    sstatus &= ~SSTATUS_FS_MASK; // FPU off until first use (see arch/fpu.h)
     proc->trap_frame->sstatus = sstatus;
     
     // Setup kernel context for initial context switch
@@ -1079,7 +1936,8 @@ struct process *process_create_elf(const char *name, uint64_t code_base,
     // Initialize process metadata
     proc->cpu_time = 0;
     proc->priority = 10;  // Default priority
-    proc->parent = current_process;
+    proc->base_priority = 10;
+    process_set_parent(proc, current_process);
     proc->exit_code = 0;
     proc->errno_value = 0;
     proc->cwd[0] = '/';
@@ -1093,7 +1951,7 @@ struct process *process_create_elf(const char *name, uint64_t code_base,
         proc->euid = current_process->euid;
         proc->egid = current_process->egid;
         // Inherit process group and session from parent
-        proc->pgid = current_process->pgid;
+        process_set_pgid(proc, current_process->pgid);
         proc->sid = current_process->sid;
     } else {
         proc->uid = 0;
@@ -1101,47 +1959,36 @@ struct process *process_create_elf(const char *name, uint64_t code_base,
         proc->euid = 0;
         proc->egid = 0;
         // New process becomes its own group and session leader
-        proc->pgid = proc->pid;
+        process_set_pgid(proc, proc->pid);
         proc->sid = proc->pid;
     }
     
     // Setup memory isolation (VMAs for validation)
     if (process_setup_memory_isolation(proc) != 0) {
-        free_page_table(proc->page_table);
-        kfree((void *)proc->kernel_stack);
-        kfree(proc->trap_frame);
         process_free(proc);
         /* errno already set by process_setup_memory_isolation */
         return NULL;
     }
     
-    // Add VMAs for code segment
-    if (process_add_vma(proc, code_base, code_base + code_size, 
-                       VM_READ | VM_WRITE | VM_EXEC | VM_USER) != 0) {
-        process_cleanup_vmas(proc);
-        free_page_table(proc->page_table);
-        kfree((void *)proc->kernel_stack);
-        kfree(proc->trap_frame);
-        process_free(proc);
-        return NULL;
-    }
-    
     // Add VMA for stack segment
     if (process_add_vma(proc, stack_base_vaddr, USER_STACK_TOP,
                        VM_READ | VM_WRITE | VM_USER | VM_GROWSDOWN) != 0) {
-        process_cleanup_vmas(proc);
-        free_page_table(proc->page_table);
-        kfree((void *)proc->kernel_stack);
-        kfree(proc->trap_frame);
         process_free(proc);
         return NULL;
     }
     
+    return proc;
+}
+
+/**
+ * Make a process from process_create_elf() runnable
+ */
+void process_start(struct process *proc) {
     // Mark as ready and enqueue for scheduling
+    process_update_mm_stats(proc);
+    
     proc->state = PROC_READY;
     scheduler_enqueue(proc);
-    
-    return proc;
 }
 
 /**
@@ -1173,11 +2020,16 @@ void forked_child_entry(void) {
     // parent's page table, the child would read/write parent's memory instead
     // of its own copy. The trap_frame is in kernel memory (kmalloc) so it's
     // accessible regardless of which user page table is active.
-    switch_page_table(proc->page_table);
+    process_switch_page_table(proc);
     
-    // Setup sscratch with kernel stack pointer for trap entry
-    uintptr_t kernel_sp = proc->kernel_stack  + (size_t)KERNEL_STACK_SIZE;
-    __asm__ volatile("csrw sscratch, %0" :: "r"(kernel_sp));
+    // Setup sscratch for trap entry: the struct cpu holding the kernel
+    // stack top, swapped into tp when a trap comes from user mode
+    struct cpu *cpu = cpu_this();
+    cpu->kernel_sp = proc->kernel_stack + (size_t)KERNEL_STACK_SIZE;
+    __asm__ volatile("csrw sscratch, %0" :: "r"(cpu));
+    
+    // Leaving the kernel
+    bkl_release();
     
     // Return to user mode using user_return which restores all registers
     extern void user_return(struct trap_frame *trap_frame);
@@ -1193,12 +2045,16 @@ void user_mode_entry_wrapper(void) {
     }
     
     // Switch to user process page table for memory isolation
-    switch_page_table(proc->page_table);
+    process_switch_page_table(proc);
+    
+    // Setup sscratch for trap entry
+    // When trap occurs in user mode, sscratch will swap with tp
+    struct cpu *cpu = cpu_this();
+    cpu->kernel_sp = proc->kernel_stack + (size_t)KERNEL_STACK_SIZE;
+    __asm__ volatile("csrw sscratch, %0" :: "r"(cpu));
     
-    // Setup sscratch with kernel stack pointer for trap entry
-    // When trap occurs in user mode, sscratch will swap with sp
-    uintptr_t kernel_sp = proc->kernel_stack  + (size_t)KERNEL_STACK_SIZE;
-    __asm__ volatile("csrw sscratch, %0" :: "r"(kernel_sp));
+    // Leaving the kernel
+    bkl_release();
     
     // Enter user mode using specialized entry function
     // This avoids the problem of loading sp before sret in user_return()
@@ -1226,8 +2082,9 @@ int process_setup_memory_isolation(struct process *proc) {
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
     
-    // Initialize VMA list as empty
+    // Initialize VMA list and tree as empty
     proc->vm_areas = NULL;
+    proc->vma_root = NULL;
     
     // Initialize heap boundaries (heap starts above code and data)
     proc->heap_start = USER_HEAP_BASE;
@@ -1239,7 +2096,7 @@ int process_setup_memory_isolation(struct process *proc) {
 /**
  * Find VMA containing an address
  * 
- * Searches the process's VMA list for a region containing the given address.
+ * Searches the process's VMA tree for a region containing the given address.
  * 
  * @param proc Process to search
  * @param addr Virtual address to find
@@ -1250,15 +2107,7 @@ vm_area_t *process_find_vma(struct process *proc, uint64_t addr) {
         return NULL;
     }
     
-    vm_area_t *vma = proc->vm_areas;
-    while (vma) {
-        if (addr >= vma->start && addr < vma->end) {
-            return vma;
-        }
-        vma = vma->next;
-    }
-    
-    return NULL;
+    return vma_tree_find(proc->group_leader, addr);
 }
 
 /**
@@ -1273,12 +2122,28 @@ vm_area_t *process_find_vma(struct process *proc, uint64_t addr) {
  * @return 0 on success, -1 on failure
  */
 int process_add_vma(struct process *proc, uint64_t start, uint64_t end, uint32_t flags) {
+    return process_add_file_vma(proc, start, end, flags, NULL, 0);
+}
+
+/**
+ * Add a file-backed VMA to process address space
+ * 
+ * @param proc Process to add VMA to
+ * @param start Start address (inclusive)
+ * @param end End address (exclusive)
+ * @param flags Protection flags, plus VM_SHARED for shared mappings
+ * @param file Backing file node (NULL for anonymous memory)
+ * @param offset File offset mapped at start
+ * @return 0 on success, -1 on failure
+ */
+int process_add_file_vma(struct process *proc, uint64_t start, uint64_t end, uint32_t flags,
+                         struct vfs_node *file, uint64_t offset) {
     if (!proc || start >= end) {
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
     
     // Allocate new VMA structure
-    vm_area_t *vma = (vm_area_t *)kmalloc(sizeof(vm_area_t));
+    vm_area_t *vma = (vm_area_t *)kmem_cache_alloc(vma_cache);
     if (!vma) {
         RETURN_ERRNO(THUNDEROS_ENOMEM);
     }
@@ -1287,10 +2152,48 @@ int process_add_vma(struct process *proc, uint64_t start, uint64_t end, uint32_t
     vma->start = start;
     vma->end = end;
     vma->flags = flags;
+    vma->file = file;
+    vma->file_offset = offset;
+    vma->shm = NULL;
+    vfs_node_get(file);
+    
+    // Link in address order (a thread's VMAs are its leader's)
+    vma_tree_insert(proc->group_leader, vma);
+    
+    return 0;
+}
+
+/**
+ * Add a VMA mapping a shared memory object
+ * 
+ * @param proc Process to add VMA to
+ * @param start Start address (inclusive)
+ * @param end End address (exclusive)
+ * @param flags Protection flags, plus VM_SHARED
+ * @param shm Object to map (referenced by the VMA)
+ * @param offset Object offset mapped at start
+ * @return 0 on success, -1 on failure
+ */
+int process_add_shm_vma(struct process *proc, uint64_t start, uint64_t end, uint32_t flags,
+                        struct shm_object *shm, uint64_t offset) {
+    if (!proc || !shm || start >= end) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    vm_area_t *vma = (vm_area_t *)kmem_cache_alloc(vma_cache);
+    if (!vma) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    
+    vma->start = start;
+    vma->end = end;
+    vma->flags = flags;
+    vma->file = NULL;
+    vma->file_offset = offset;
+    vma->shm = shm;
+    shm_get(shm);
     
-    // Add to front of list
-    vma->next = proc->vm_areas;
-    proc->vm_areas = vma;
+    vma_tree_insert(proc->group_leader, vma);
     
     return 0;
 }
@@ -1308,16 +2211,51 @@ void process_remove_vma(struct process *proc, vm_area_t *vma) {
         return;
     }
     
-    // Find and unlink from list
-    vm_area_t **prev = &proc->vm_areas;
-    while (*prev) {
-        if (*prev == vma) {
-            *prev = vma->next;
-            kfree(vma);
-            return;
-        }
-        prev = &(*prev)->next;
+    process_sync_vma(vma, vma->start, vma->end);
+    vma_tree_remove(proc->group_leader, vma);
+    if (vma->shm) {
+        shm_put(vma->shm);
+    }
+    vfs_node_put(vma->file);
+    kmem_cache_free(vma_cache, vma);
+}
+
+/**
+ * Write back dirty pages of a shared file VMA
+ */
+int process_sync_vma(vm_area_t *vma, uint64_t start, uint64_t end) {
+    if (!vma || !vma->file || !(vma->flags & VM_SHARED) || vma->file->type == VFS_TYPE_DEVICE) {
+        return 0;
+    }
+    
+    if (start < vma->start) start = vma->start;
+    if (end > vma->end) end = vma->end;
+    if (start >= end) {
+        return 0;
+    }
+    
+    uint64_t offset = vma->file_offset + (start - vma->start);
+    return page_cache_writeback(vma->file, offset, end - start);
+}
+
+/**
+ * Move the end of a VMA
+ */
+void process_resize_vma(struct process *proc, vm_area_t *vma, uint64_t end) {
+    if (!proc || !vma || end <= vma->start) {
+        return;
+    }
+    vma_tree_set_end(proc->group_leader, vma, end);
+}
+
+/**
+ * Find a free range of user address space
+ */
+uint64_t process_find_free_area(struct process *proc, uint64_t floor, uint64_t length) {
+    if (!proc) {
+        return 0;
     }
+    return vma_tree_find_gap(proc->group_leader, floor, USER_VIRT_END, length);
 }
 
 /**
@@ -1333,21 +2271,32 @@ void process_cleanup_vmas(struct process *proc) {
         return;
     }
     
-    vm_area_t *vma = proc->vm_areas;
+    vma_list_free(proc->vm_areas);
+    proc->vm_areas = NULL;
+    proc->vma_root = NULL;
+}
+
+/**
+ * Free a list of VMAs, writing back shared file pages first
+ */
+static void vma_list_free(vm_area_t *vma) {
     while (vma) {
         vm_area_t *next = vma->next;
-        kfree(vma);
+        process_sync_vma(vma, vma->start, vma->end);
+        if (vma->shm) {
+            shm_put(vma->shm);
+        }
+        vfs_node_put(vma->file);
+        kmem_cache_free(vma_cache, vma);
         vma = next;
     }
-    
-    proc->vm_areas = NULL;
 }
 
 /**
  * Map a memory region in process address space
  * 
- * Allocates physical pages and maps them into the process's virtual address space.
- * Also creates a VMA to track the mapping.
+ * Reserves the region with a VMA only. Pages are allocated and zeroed on
+ * first touch by process_handle_page_fault().
  * 
  * @param proc Process to map in
  * @param vaddr Virtual address to start mapping (must be page-aligned)
@@ -1364,40 +2313,309 @@ int process_map_region(struct process *proc, uint64_t vaddr, uint64_t size, uint
     uint64_t start = vaddr & ~(PAGE_SIZE - 1);
     uint64_t end = (vaddr + size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
     
+    // Add VMA to track this region
+    if (process_add_vma(proc, start, end, flags) != 0) {
+        /* errno already set by process_add_vma */
+        return -1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Recount resident and page-table pages from the page table
+ */
+void process_update_mm_stats(struct process *proc) {
+    if (!proc || !proc->page_table) {
+        return;
+    }
+    proc = proc->group_leader;
+    
+    size_t user_pages, table_pages;
+    page_table_usage(proc->page_table, &user_pages, &table_pages);
+    
+    process_set_rss(proc, user_pages);
+    proc->pt_pages = table_pages;
+}
+
+/**
+ * Set the resident page count, charging the change to the resource group
+ */
+static void process_set_rss(struct process *proc, uint64_t pages) {
+    rgroup_charge_mem(proc->rgroup, (int64_t)pages - (int64_t)proc->rss_pages);
+    proc->rss_pages = pages;
+    if (proc->rss_pages > proc->peak_rss_pages) {
+        proc->peak_rss_pages = proc->rss_pages;
+    }
+}
+
+/**
+ * Adjust the resident page count and its high-water mark
+ */
+void process_account_rss(struct process *proc, int64_t delta) {
+    if (!proc) {
+        return;
+    }
+    proc = proc->group_leader;
+    
+    if (delta < 0 && (uint64_t)(-delta) > proc->rss_pages) {
+        process_set_rss(proc, 0);
+    } else {
+        process_set_rss(proc, proc->rss_pages + delta);
+    }
+}
+
+/**
+ * Wait for memory after a fault ran out of it
+ * 
+ * kswapd may swap, which direct reclaim cannot. Nothing is mapped
+ * meanwhile: the access faults again and the handler starts over, as the
+ * page tables may have changed while we slept.
+ * 
+ * @return 0 to retry the access, -1 if the fault fails (errno set)
+ */
+static int fault_wait_for_memory(void) {
+    if (get_errno() != THUNDEROS_ENOMEM || reclaim_wait() != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Resolve a fault on a swapped-out page
+ * 
+ * Maps the swap cache's page in place of the entry. While other entries
+ * name its slot or others map it, the page is mapped copy-on-write, so it
+ * keeps matching the slot.
+ * 
+ * @param proc Faulting process (group leader)
+ * @param page_addr Page-aligned faulting address
+ * @param slot Slot named by the entry
+ * @param pte_flags Flags the VMA gives the page
+ * @param cause Exception cause (CAUSE_*_PAGE_FAULT)
+ * @return 0 if the fault was handled, -1 on error (errno set)
+ */
+static int process_swap_fault(struct process *proc, uint64_t page_addr, uint64_t slot,
+                              uint64_t pte_flags, unsigned long cause) {
+    if (rgroup_mem_allow(proc->rgroup, 1) != 0) {
+        /* errno already set by rgroup_mem_allow */
+        return -1;
+    }
+    
+    int major;
+    uintptr_t page = swap_in(slot, &major);
+    if (!page) {
+        return fault_wait_for_memory();
+    }
+    
+    // Reading may sleep: another thread may have swapped it in already
+    pte_t *pte = get_user_pte(proc->page_table, page_addr);
+    if (pte == NULL || *pte != SWAP_TO_PTE(slot)) {
+        put_page(page);
+        tlb_flush(page_addr);
+        return 0;
+    }
+    
+    // The cache and we hold a reference each; any other is a mapping
+    if ((pte_flags & PTE_W) && (swap_entry_count(slot) > 1 || page_refcount(page) > 2)) {
+        pte_flags = (pte_flags & ~PTE_W) | PTE_COW;
+    }
+    
+    // The entry is not valid, so map_page() replaces it
+    if (map_page(proc->page_table, page_addr, page, pte_flags) != 0) {
+        put_page(page);
+        /* errno already set by map_page */
+        return -1;
+    }
+    swap_entry_free(slot);
+    tlb_flush(page_addr);
+    
+    if (major) {
+        proc->major_faults++;
+    } else {
+        proc->minor_faults++;
+    }
+    process_account_rss(proc, 1);
+    
+    if ((pte_flags & PTE_COW) && cause == CAUSE_STORE_PAGE_FAULT &&
+        handle_cow_fault(proc->page_table, page_addr) != 0) {
+        return fault_wait_for_memory();
+    }
+    
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Handle a page fault on a user address
+ * 
+ * Populates pages of reserved VMAs on first touch (zeroed memory, or the
+ * page cache for file-backed VMAs), swaps pages back in and resolves
+ * copy-on-write faults. The access must be allowed by the VMA. Out of
+ * memory, it waits for kswapd and has the access retried.
+ * 
+ * @param proc Faulting process
+ * @param addr Faulting virtual address (stval)
+ * @param cause Exception cause (CAUSE_*_PAGE_FAULT)
+ * @return 0 if the fault was handled, -1 if it is a real access violation
+ */
+int process_handle_page_fault(struct process *proc, uint64_t addr, unsigned long cause) {
+    if (!proc || !proc->page_table) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    proc = proc->group_leader;  // Faults are counted for the whole process
+    
+    vm_area_t *vma = process_find_vma(proc, addr);
+    if (!vma) {
+        RETURN_ERRNO(THUNDEROS_EFAULT);
+    }
+    
+    uint32_t required = VM_READ;
+    uint64_t pte_required = PTE_R;
+    if (cause == CAUSE_STORE_PAGE_FAULT) {
+        required = VM_WRITE;
+        pte_required = PTE_W;
+    } else if (cause == CAUSE_FETCH_PAGE_FAULT) {
+        required = VM_EXEC;
+        pte_required = PTE_X;
+    }
+    if ((vma->flags & required) != required) {
+        RETURN_ERRNO(THUNDEROS_EFAULT);
+    }
+    
+    uint64_t page_addr = addr & ~(PAGE_SIZE - 1);
+    int device = vma->file && vma->file->type == VFS_TYPE_DEVICE;
+    int shared_file = vma->file && (vma->flags & VM_SHARED) && !device;
+    uintptr_t paddr;
+    if (virt_to_phys(proc->page_table, page_addr, &paddr) == 0) {
+        // Another thread got here first, while we held a stale (or
+        // cached invalid) translation: try again with a fresh one
+        if (user_page_permits(proc->page_table, page_addr, pte_required)) {
+            tlb_flush(page_addr);
+            return 0;
+        }
+        
+        // Already present: only a write to a COW or clean shared file
+        // page is ours
+        if (cause != CAUSE_STORE_PAGE_FAULT) {
+            RETURN_ERRNO(THUNDEROS_EFAULT);
+        }
+        proc->minor_faults++;
+        if (shared_file) {
+            // First write to a shared file page: it now needs writeback
+            page_cache_set_dirty(paddr);
+            return make_user_page_writable(proc->page_table, page_addr);
+        }
+        if (paddr == pmm_zero_page() && rgroup_mem_allow(proc->rgroup, 1) != 0) {
+            /* errno already set by rgroup_mem_allow */
+            return -1;
+        }
+        if (handle_cow_fault(proc->page_table, page_addr) != 0) {
+            return fault_wait_for_memory();
+        }
+        // Breaking away from the zero page makes the page resident
+        if (paddr == pmm_zero_page()) {
+            process_account_rss(proc, 1);
+        }
+        return 0;
+    }
+    
     // Convert VM flags to PTE flags
     uint64_t pte_flags = PTE_V;
-    if (flags & VM_READ) pte_flags |= PTE_R;
-    if (flags & VM_WRITE) pte_flags |= PTE_W;
-    if (flags & VM_EXEC) pte_flags |= PTE_X;
-    if (flags & VM_USER) pte_flags |= PTE_U;
-    
-    // Allocate and map each page
-    for (uint64_t addr = start; addr < end; addr += PAGE_SIZE) {
-        uintptr_t phys_page = pmm_alloc_page();
+    if (vma->flags & VM_READ) pte_flags |= PTE_R;
+    if (vma->flags & VM_WRITE) pte_flags |= PTE_W;
+    if (vma->flags & VM_EXEC) pte_flags |= PTE_X;
+    if (vma->flags & VM_USER) pte_flags |= PTE_U;
+    
+    pte_t *pte = get_user_pte(proc->page_table, page_addr);
+    if (pte != NULL && PTE_IS_SWAP(*pte)) {
+        return process_swap_fault(proc, page_addr, PTE_TO_SWAP(*pte), pte_flags, cause);
+    }
+    
+    // Everything but a read of untouched anonymous memory (the zero page)
+    // makes a page resident
+    int anon_read = !vma->shm && !vma->file && cause != CAUSE_STORE_PAGE_FAULT;
+    if (!anon_read && rgroup_mem_allow(proc->rgroup, 1) != 0) {
+        /* errno already set by rgroup_mem_allow */
+        return -1;
+    }
+    
+    uintptr_t phys_page;
+    int major = 0;
+    if (vma->shm) {
+        // Shared memory: map the object's page, writable from the start
+        uint64_t offset = vma->file_offset + (page_addr - vma->start);
+        phys_page = shm_get_page(vma->shm, offset / PAGE_SIZE);
         if (!phys_page) {
-            // TODO: Cleanup already mapped pages
-            RETURN_ERRNO(THUNDEROS_ENOMEM);
+            /* errno already set by shm_get_page */
+            return -1;
         }
-        
-        // Zero the page
-        kmemset((void *)phys_page, 0, PAGE_SIZE);
-        
-        // Map the page
-        if (map_page(proc->page_table, addr, phys_page, pte_flags) != 0) {
-            pmm_free_page(phys_page);
-            // TODO: Cleanup already mapped pages
+    } else if (device) {
+        // Device memory: map the device's page, writable from the start
+        uint64_t offset = vma->file_offset + (page_addr - vma->start);
+        phys_page = vma->file->ops->map_page(vma->file, offset / PAGE_SIZE);
+        if (!phys_page) {
             /* errno already set by map_page */
             return -1;
         }
+    } else if (vma->file) {
+        // File page: map the page cache's copy
+        uint64_t offset = vma->file_offset + (page_addr - vma->start);
+        phys_page = page_cache_get_page(vma->file, (uint32_t)(offset / PAGE_SIZE), &major);
+        if (!phys_page) {
+            /* errno already set by page_cache_get_page */
+            return -1;
+        }
+        
+        if (shared_file) {
+            // Stay read-only until written so clean pages are not synced
+            if (cause == CAUSE_STORE_PAGE_FAULT) {
+                page_cache_set_dirty(phys_page);
+            } else {
+                pte_flags &= ~PTE_W;
+            }
+        } else if (pte_flags & PTE_W) {
+            // Private: written pages are copied out of the cache
+            pte_flags = (pte_flags & ~PTE_W) | PTE_COW;
+        }
+    } else if (cause != CAUSE_STORE_PAGE_FAULT) {
+        // Reading untouched memory: share the zero page until written
+        phys_page = pmm_zero_page();
+        get_page(phys_page);
+        if (pte_flags & PTE_W) {
+            pte_flags = (pte_flags & ~PTE_W) | PTE_COW;
+        }
+    } else {
+        // First write: back the page with zeroed memory
+        phys_page = pmm_alloc_zeroed_page();
+        if (!phys_page) {
+            set_errno(THUNDEROS_ENOMEM);
+            return fault_wait_for_memory();
+        }
     }
     
-    // Add VMA to track this region
-    if (process_add_vma(proc, start, end, flags) != 0) {
-        // TODO: Cleanup mapped pages
-        /* errno already set by process_add_vma */
+    if (map_page(proc->page_table, page_addr, phys_page, pte_flags) != 0) {
+        put_page(phys_page);
+        /* errno already set by map_page */
         return -1;
     }
+    tlb_flush(page_addr);
+    
+    if (major) {
+        proc->major_faults++;
+    } else {
+        proc->minor_faults++;
+    }
+    if (phys_page != pmm_zero_page()) {
+        process_account_rss(proc, 1);
+    }
+    
+    if ((pte_flags & PTE_COW) && cause == CAUSE_STORE_PAGE_FAULT &&
+        handle_cow_fault(proc->page_table, page_addr) != 0) {
+        return fault_wait_for_memory();
+    }
     
+    clear_errno();
     return 0;
 }
 
@@ -1526,21 +2744,21 @@ int process_setpgid(pid_t pid, pid_t pgid) {
     if (new_pgid != target_pid) {
         // Check if there's a process with pgid == new_pgid in the same session
         int found_group = 0;
-        for (int i = 0; i < MAX_PROCS; i++) {
-            if (process_table[i].state != PROC_UNUSED &&
-                process_table[i].pgid == new_pgid &&
-                process_table[i].sid == target->sid) {
+        int irq_state = spin_lock_irqsave(&process_lock);
+        for (struct process *p = pgrp_hash[pid_hashfn(new_pgid)]; p; p = p->pgrp_link.next) {
+            if (p->pgid == new_pgid && p->sid == target->sid) {
                 found_group = 1;
                 break;
             }
         }
+        spin_unlock_irqrestore(&process_lock, irq_state);
         if (!found_group) {
             RETURN_ERRNO(THUNDEROS_EPERM);  // No such process group in session
         }
     }
     
     // Set the new process group ID
-    target->pgid = new_pgid;
+    process_set_pgid(target, new_pgid);
     
     clear_errno();
     return 0;
@@ -1593,7 +2811,7 @@ pid_t process_setsid(void) {
     
     // Create new session and process group
     current->sid = current->pid;   // Become session leader
-    current->pgid = current->pid;  // Become process group leader
+    process_set_pgid(current, current->pid);  // Become process group leader
     current->controlling_tty = -1; // Detach from controlling terminal
     
     clear_errno();
@@ -1635,12 +2853,9 @@ pid_t process_getsid(pid_t pid) {
  * @return Process pointer, or NULL if not found
  */
 struct process *process_get_group_leader(pid_t pgid) {
-    for (int i = 0; i < MAX_PROCS; i++) {
-        if (process_table[i].state != PROC_UNUSED &&
-            process_table[i].pid == pgid &&
-            process_table[i].pgid == pgid) {
-            return &process_table[i];
-        }
+    struct process *leader = process_get(pgid);
+    if (leader && leader->pgid == pgid) {
+        return leader;
     }
     return NULL;
 }
@@ -1661,13 +2876,14 @@ int process_killpg(pid_t pgid, int sig) {
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
     
+    // Walk the group's hash chain only. No process_lock: signal_send()
+    // takes it to wake sleepers, and an unlinked member still points on.
     int found = 0;
-    for (int i = 0; i < MAX_PROCS; i++) {
-        if (process_table[i].state != PROC_UNUSED &&
-            process_table[i].pgid == pgid) {
+    for (struct process *p = pgrp_hash[pid_hashfn(pgid)]; p; p = p->pgrp_link.next) {
+        if (p->pgid == pgid) {
             // Send signal to this process
             extern int signal_send(struct process *proc, int sig);
-            signal_send(&process_table[i], sig);
+            signal_send(p, sig);
             found = 1;
         }
     }
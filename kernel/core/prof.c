@@ -0,0 +1,261 @@
+/**
+ * @file prof.c
+ * @brief Sampling CPU profiler driven by the timer interrupt
+ *
+ * The rings are pcpu_ring.h's, as trace.c's are: the CPU is the only
+ * writer of its ring and fills slots from the timer interrupt, readers
+ * (/dev/prof, under the big kernel lock) only move their heads, and a
+ * full ring drops new samples.
+ *
+ * Each CPU keeps its own next sample time. prof_tick() runs on every
+ * timer interrupt and samples once that time has passed, then moves it on
+ * by whole periods so a CPU that slept through several keeps the same
+ * phase instead of sampling in a burst.
+ */
+
+#include "kernel/prof.h"
+#include "kernel/pcpu_ring.h"
+#include "kernel/smp.h"
+#include "kernel/config.h"
+#include "kernel/errno.h"
+#include "kernel/kstring.h"
+#include "kernel/process.h"
+#include "kernel/constants.h"
+#include "kernel/hrtimer.h"
+#include "kernel/uaccess.h"
+#include "hal/hal_timer.h"
+#include "fs/devfs.h"
+#include "mm/kstack.h"
+#include "arch/barrier.h"
+#include "arch/interrupt.h"
+#include "trap.h"
+#include <stddef.h>
+
+// Kernel text bounds (linker script)
+extern char _text_start[];
+extern char _text_end[];
+
+volatile uint32_t prof_period_us = 0;
+
+static pcpu_rings_t prof_rings = PCPU_RINGS_INIT(PROF_RING_SAMPLES, prof_sample_t);
+
+// When each CPU takes its next sample (0: at its next timer interrupt)
+static uint64_t prof_next_us[MAX_CPUS];
+
+static int is_kernel_text(uint64_t addr) {
+    return addr >= (uint64_t)_text_start && addr < (uint64_t)_text_end;
+}
+
+/**
+ * Walk the frame pointer chain of a kernel context
+ *
+ * A frame's return address is at fp - 8 and the caller's fp at fp - 16.
+ * Leaf functions save no ra, so their fp - 8 holds the caller's fp: then
+ * the return address is still in ra. Frames must lie on the interrupted
+ * stack and move up it, which stops the walk at the first frame that is
+ * not (an entry point, or s0 used as a plain register).
+ */
+static uint8_t prof_callchain(struct trap_frame *tf, uint64_t *chain) {
+    uint64_t low = tf->sp;
+    uint64_t high = tf->sp + KERNEL_STACK_SIZE;
+    if (kstack_top(tf->sp)) {
+        // Nothing is mapped past a process stack's top
+        high = kstack_top(tf->sp);
+    }
+    uint64_t fp = tf->s0;
+    uint8_t depth = 0;
+
+    while (depth < PROF_MAX_DEPTH) {
+        if ((fp & 7) || fp < low + 16 || fp > high) {
+            break;
+        }
+        uint64_t ra = ((uint64_t *)fp)[-1];
+        uint64_t next = ((uint64_t *)fp)[-2];
+
+        if (depth == 0 && !is_kernel_text(ra) && ra > fp && ra <= high &&
+            is_kernel_text(tf->ra)) {
+            // Interrupted in a leaf: fp - 8 is the caller's saved fp
+            chain[depth++] = tf->ra;
+            fp = ra;
+            continue;
+        }
+        if (!is_kernel_text(ra)) {
+            break;
+        }
+        chain[depth++] = ra;
+        if (next <= fp) {
+            break;
+        }
+        fp = next;
+    }
+    return depth;
+}
+
+void prof_sample(struct trap_frame *tf) {
+    int irq_state = interrupt_save_disable();
+    struct cpu *cpu = cpu_this();
+    prof_sample_t *sample = pcpu_ring_reserve(&prof_rings, cpu->id);
+
+    if (sample) {
+        sample->pc = tf->sepc;
+        sample->pid = cpu->current ? (uint32_t)cpu->current->pid : PROF_PID_IDLE;
+        sample->cpu = (uint16_t)cpu->id;
+        if (tf->sstatus & (1UL << SSTATUS_SPP_BIT)) {
+            sample->flags = 0;
+            sample->depth = prof_callchain(tf, sample->callchain);
+        } else {
+            // User stacks are not walked: their frames may not be mapped
+            sample->flags = PROF_SAMPLE_USER;
+            sample->depth = 0;
+        }
+        pcpu_ring_commit(&prof_rings, cpu->id);
+    }
+    interrupt_restore(irq_state);
+}
+
+void prof_tick(struct trap_frame *tf) {
+    uint32_t period = prof_period_us;
+    if (period == 0) {
+        return;
+    }
+
+    uint64_t *next_us = &prof_next_us[cpu_this()->id];
+    uint64_t now = hal_timer_get_time_us();
+
+    if (*next_us == 0) {
+        // First interrupt on this CPU since the start
+        *next_us = now + period;
+        return;
+    }
+    if (now < *next_us) {
+        return;
+    }
+
+    prof_sample(tf);
+    *next_us += ((now - *next_us) / period + 1) * period;
+}
+
+uint64_t prof_next_sample_us(void) {
+    if (!prof_running()) {
+        return UINT64_MAX;
+    }
+    uint64_t next = prof_next_us[cpu_this()->id];
+    return next ? next : UINT64_MAX;
+}
+
+int prof_start(uint32_t period_us) {
+    if (period_us == 0) {
+        period_us = PROF_DEFAULT_PERIOD_US;
+    }
+    if (period_us < PROF_MIN_PERIOD_US || period_us > PROF_MAX_PERIOD_US) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    if (pcpu_rings_alloc(&prof_rings) != 0) {
+        // errno already set by pcpu_rings_alloc
+        return -1;
+    }
+
+    prof_period_us = 0;
+    prof_reset();
+    uint64_t first = hal_timer_get_time_us() + period_us;
+    for (int i = 0; i < MAX_CPUS; i++) {
+        // Other CPUs pick a start time at their next timer interrupt
+        prof_next_us[i] = i == cpu_this()->id ? first : 0;
+    }
+    memory_barrier();
+    prof_period_us = period_us;
+
+    hrtimer_reprogram();
+    clear_errno();
+    return 0;
+}
+
+void prof_stop(void) {
+    prof_period_us = 0;
+}
+
+void prof_get_stats(prof_stats_t *stats) {
+    pcpu_ring_counts_t counts;
+    pcpu_rings_get_counts(&prof_rings, &counts);
+    kmemset(stats, 0, sizeof(*stats));
+    stats->samples = counts.written;
+    stats->dropped = counts.lost;
+    stats->buffered = counts.buffered;
+    stats->period_us = prof_period_us;
+    stats->ring_samples = PROF_RING_SAMPLES;
+}
+
+uint32_t prof_drain(prof_sample_t *buf, uint32_t max) {
+    return pcpu_rings_drain(&prof_rings, buf, max);
+}
+
+void prof_reset(void) {
+    pcpu_rings_reset(&prof_rings);
+}
+
+// ========================================
+// /dev/prof
+// ========================================
+
+static int prof_dev_read(vfs_node_t *node, uint64_t offset, void *buffer, uint32_t size);
+static int prof_dev_ioctl(vfs_node_t *node, uint32_t request, uint64_t arg);
+
+static vfs_ops_t prof_dev_ops = {
+    .read = prof_dev_read,
+    .write = NULL,
+    .ioctl = prof_dev_ioctl,
+};
+
+static int prof_dev_read(vfs_node_t *node, uint64_t offset, void *buffer, uint32_t size) {
+    (void)node;
+    (void)offset;
+    // errno set by pcpu_rings_read
+    return pcpu_rings_read(&prof_rings, buffer, size);
+}
+
+static int prof_dev_ioctl(vfs_node_t *node, uint32_t request, uint64_t arg) {
+    (void)node;
+
+    switch (request) {
+        case PROFIO_START:
+            if (arg > PROF_MAX_PERIOD_US) {
+                RETURN_ERRNO(THUNDEROS_EINVAL);
+            }
+            // errno set by prof_start
+            return prof_start((uint32_t)arg);
+
+        case PROFIO_STOP:
+            prof_stop();
+            clear_errno();
+            return 0;
+
+        case PROFIO_GET_STATS: {
+            prof_stats_t stats;
+            prof_get_stats(&stats);
+            if (copy_to_user((void *)arg, &stats, sizeof(stats)) != 0) {
+                // errno already set by copy_to_user
+                return -1;
+            }
+            clear_errno();
+            return 0;
+        }
+
+        case PROFIO_RESET:
+            prof_reset();
+            clear_errno();
+            return 0;
+
+        default:
+            RETURN_ERRNO(THUNDEROS_ENOTTY);
+    }
+}
+
+int prof_init(void) {
+    if (!devfs_register("prof", 0600, &prof_dev_ops, 0, NULL)) {
+        // errno already set by devfs_register
+        return -1;
+    }
+    clear_errno();
+    return 0;
+}
@@ -0,0 +1,120 @@
+/**
+ * @file rcu.c
+ * @brief Quiescent-state-based RCU for ThunderOS
+ *
+ * A grace period starts with a snapshot of every CPU's rcu_qs_seq. An
+ * even count means that CPU was outside the kernel and cannot be in a
+ * read section; an odd one has to move before the period can end.
+ *
+ * call_rcu() callbacks go through two batches: new ones queue on the
+ * next batch, which becomes the waiting batch (and takes a snapshot)
+ * once the previous waiting batch has run.
+ */
+
+#include "kernel/rcu.h"
+#include "kernel/smp.h"
+#include "kernel/scheduler.h"
+#include "kernel/spinlock.h"
+#include "kernel/config.h"
+#include <stddef.h>
+
+static spinlock_t rcu_lock = SPINLOCK_INIT;
+static struct rcu_head *rcu_next_batch;         // Queued since the waiting batch began
+static struct rcu_head *rcu_wait_batch;         // Waiting for its grace period
+static unsigned long rcu_wait_snap[MAX_CPUS];   // Counts when that period began
+
+/**
+ * Record every CPU's quiescent-state count
+ *
+ * skip (the caller's CPU, if it is known not to be in a read section)
+ * is recorded as quiescent already.
+ */
+static void rcu_snapshot(unsigned long *snap, const struct cpu *skip) {
+    // Updates being retired come before the counts they are judged by
+    memory_barrier();
+
+    for (int i = 0; i < MAX_CPUS; i++) {
+        struct cpu *cpu = cpu_get(i);
+        snap[i] = (cpu && cpu != skip) ? cpu->rcu_qs_seq : 0;
+    }
+}
+
+/**
+ * Check whether every CPU has passed a quiescent state since a snapshot
+ */
+static int rcu_snapshot_expired(const unsigned long *snap) {
+    for (int i = 0; i < MAX_CPUS; i++) {
+        struct cpu *cpu = cpu_get(i);
+        if (cpu && (snap[i] & 1) && cpu->rcu_qs_seq == snap[i]) {
+            return 0;
+        }
+    }
+
+    // And reclaim after everything those CPUs did before
+    memory_barrier();
+    return 1;
+}
+
+/**
+ * Wait for a grace period
+ */
+void synchronize_rcu(void) {
+    unsigned long snap[MAX_CPUS];
+
+    // Our own CPU is not in a read section: we were called outside one
+    rcu_snapshot(snap, cpu_this());
+
+    while (!rcu_snapshot_expired(snap)) {
+        // Lets the CPUs we wait for into the kernel and back out
+        scheduler_yield();
+    }
+}
+
+/**
+ * Run a callback after a grace period, without waiting
+ */
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head)) {
+    head->func = func;
+
+    int irq_state = spin_lock_irqsave(&rcu_lock);
+    head->next = rcu_next_batch;
+    rcu_next_batch = head;
+    spin_unlock_irqrestore(&rcu_lock, irq_state);
+}
+
+/**
+ * Check whether callbacks are waiting for a grace period
+ */
+int rcu_pending(void) {
+    return rcu_wait_batch != NULL || rcu_next_batch != NULL;
+}
+
+/**
+ * Advance grace periods and run callbacks whose period ended
+ */
+void rcu_poll(void) {
+    if (!rcu_wait_batch && !rcu_next_batch) {
+        return;
+    }
+
+    struct rcu_head *done = NULL;
+
+    int irq_state = spin_lock_irqsave(&rcu_lock);
+    if (rcu_wait_batch && rcu_snapshot_expired(rcu_wait_snap)) {
+        done = rcu_wait_batch;
+        rcu_wait_batch = NULL;
+    }
+    if (!rcu_wait_batch && rcu_next_batch) {
+        // This CPU may be inside a read section right now: wait for it too
+        rcu_wait_batch = rcu_next_batch;
+        rcu_next_batch = NULL;
+        rcu_snapshot(rcu_wait_snap, NULL);
+    }
+    spin_unlock_irqrestore(&rcu_lock, irq_state);
+
+    while (done) {
+        struct rcu_head *next = done->next;
+        done->func(done);
+        done = next;
+    }
+}
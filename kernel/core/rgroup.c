@@ -0,0 +1,307 @@
+/**
+ * @file rgroup.c
+ * @brief Resource groups: CPU bandwidth and memory limits
+ *
+ * Groups live in a fixed table; ID 0 is rgroup_root, kept outside it
+ * and never removed. A throttled
+ * group's members are not on any run queue: the scheduler drops them
+ * when it would queue or pick them, and the period timer puts the
+ * runnable ones back, found by a walk of the process table. That walk is
+ * once per throttled period, and the big kernel lock keeps any CPU from
+ * being half way through switching one out meanwhile.
+ */
+
+#include "kernel/rgroup.h"
+#include "kernel/process.h"
+#include "kernel/scheduler.h"
+#include "kernel/errno.h"
+#include "kernel/kstring.h"
+#include "mm/paging.h"
+#include "hal/hal_timer.h"
+#include "arch/interrupt.h"
+#include <stddef.h>
+
+static rgroup_t rgroup_table[RGROUP_MAX];
+rgroup_t rgroup_root;
+
+static void rgroup_period_end(void *data);
+
+static int rgroup_name_eq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static void rgroup_setup(rgroup_t *group, int id, const char *name) {
+    kmemset(group, 0, sizeof(*group));
+    group->id = id;
+    group->in_use = 1;
+    kstrncpy(group->name, name, RGROUP_NAME_LEN - 1);
+    group->name[RGROUP_NAME_LEN - 1] = '\0';
+    spin_lock_init(&group->lock, "rgroup");
+    group->cpu_period_us = RGROUP_PERIOD_DEFAULT_US;
+    hrtimer_setup(&group->period_timer, rgroup_period_end, group);
+}
+
+void rgroup_init(void) {
+    for (int i = 0; i < RGROUP_MAX; i++) {
+        rgroup_table[i].in_use = 0;
+    }
+    rgroup_setup(&rgroup_root, 0, "root");
+}
+
+rgroup_t *rgroup_get(int id) {
+    if (id == 0) {
+        return &rgroup_root;
+    }
+    if (id < 0 || id >= RGROUP_MAX || !rgroup_table[id].in_use) {
+        return NULL;
+    }
+    return &rgroup_table[id];
+}
+
+int rgroup_create(const char *name) {
+    size_t len = name ? kstrlen(name) : 0;
+    if (len == 0 || len >= RGROUP_NAME_LEN) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    int free_id = -1;
+    for (int id = 0; id < RGROUP_MAX; id++) {
+        rgroup_t *group = rgroup_get(id);
+        if (group && rgroup_name_eq(group->name, name)) {
+            RETURN_ERRNO(THUNDEROS_EEXIST);
+        }
+        if (!group && free_id < 0) {
+            free_id = id;
+        }
+    }
+    if (free_id < 0) {
+        RETURN_ERRNO(THUNDEROS_ENOSPC);
+    }
+
+    rgroup_setup(&rgroup_table[free_id], free_id, name);
+    clear_errno();
+    return free_id;
+}
+
+int rgroup_destroy(int id) {
+    if (id == 0) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    rgroup_t *group = rgroup_get(id);
+    if (!group) {
+        RETURN_ERRNO(THUNDEROS_ENOENT);
+    }
+    if (group->nr_procs > 0) {
+        RETURN_ERRNO(THUNDEROS_EBUSY);
+    }
+
+    int irq_state = interrupt_save_disable();
+    hrtimer_cancel(&group->period_timer);
+    interrupt_restore(irq_state);
+    group->in_use = 0;
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Put a group's runnable members back on the run queues
+ */
+static void rgroup_unthrottle(rgroup_t *group) {
+    for (int i = 0; i < process_get_max_count(); i++) {
+        struct process *proc = process_get_by_index(i);
+        if (proc && proc->rgroup == group && proc->state == PROC_READY && !proc->run_queued) {
+            scheduler_enqueue(proc);
+        }
+    }
+}
+
+/**
+ * Start a new period (lock held); returns whether the group was throttled
+ */
+static int rgroup_new_period(rgroup_t *group, uint64_t now) {
+    int was_throttled = group->cpu_throttled;
+    if (was_throttled) {
+        group->throttled_us += now - group->throttled_at_us;
+        group->cpu_throttled = 0;
+    }
+    group->cpu_runtime_us = 0;
+    return was_throttled;
+}
+
+/**
+ * A period ended (hrtimer, interrupts off)
+ */
+static void rgroup_period_end(void *data) {
+    rgroup_t *group = (rgroup_t *)data;
+
+    spin_lock(&group->lock);
+    int was_throttled = rgroup_new_period(group, hal_timer_get_time_us());
+    spin_unlock(&group->lock);
+
+    if (was_throttled) {
+        rgroup_unthrottle(group);
+    }
+}
+
+int rgroup_set_limits(int id, const rgroup_limits_t *limits) {
+    if (id == 0 || !limits) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    rgroup_t *group = rgroup_get(id);
+    if (!group) {
+        RETURN_ERRNO(THUNDEROS_ENOENT);
+    }
+
+    uint64_t period = limits->cpu_period_us ? limits->cpu_period_us : RGROUP_PERIOD_DEFAULT_US;
+    if (period < RGROUP_PERIOD_MIN_US || period > RGROUP_PERIOD_MAX_US) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (limits->cpu_quota_us != 0 && limits->cpu_quota_us < RGROUP_QUOTA_MIN_US) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    uint64_t mem_limit = limits->mem_limit_bytes / PAGE_SIZE;
+    if (limits->mem_limit_bytes != 0 && (mem_limit == 0 || mem_limit < group->mem_pages)) {
+        RETURN_ERRNO(THUNDEROS_EBUSY);
+    }
+
+    int irq_state = interrupt_save_disable();
+    hrtimer_cancel(&group->period_timer);
+    spin_lock(&group->lock);
+    group->cpu_quota_us = limits->cpu_quota_us;
+    group->cpu_period_us = period;
+    int was_throttled = rgroup_new_period(group, hal_timer_get_time_us());
+    spin_unlock(&group->lock);
+    group->mem_limit_pages = mem_limit;
+    if (was_throttled) {
+        rgroup_unthrottle(group);
+    }
+    interrupt_restore(irq_state);
+
+    clear_errno();
+    return 0;
+}
+
+void rgroup_get_limits(const rgroup_t *group, rgroup_limits_t *limits) {
+    limits->cpu_quota_us = group->cpu_quota_us;
+    limits->cpu_period_us = group->cpu_period_us;
+    limits->mem_limit_bytes = group->mem_limit_pages * PAGE_SIZE;
+}
+
+int rgroup_attach(struct process *proc, int id) {
+    rgroup_t *group = rgroup_get(id);
+    if (!group) {
+        RETURN_ERRNO(THUNDEROS_ENOENT);
+    }
+    struct process *leader = proc->group_leader;
+    if (leader->kthread_fn) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    rgroup_t *old = leader->rgroup;
+    if (old == group) {
+        clear_errno();
+        return 0;
+    }
+
+    // Resident pages are the leader's, for the whole thread group
+    rgroup_charge_mem(old, -(int64_t)leader->rss_pages);
+    rgroup_charge_mem(group, (int64_t)leader->rss_pages);
+
+    // Throttled where it was, it may run again: the new group decides
+    // at the next pick
+    for (int i = 0; i < process_get_max_count(); i++) {
+        struct process *p = process_get_by_index(i);
+        if (p && p->group_leader == leader && p->rgroup == old) {
+            p->rgroup = group;
+            old->nr_procs--;
+            group->nr_procs++;
+            if (p->state == PROC_READY && !p->run_queued) {
+                scheduler_enqueue(p);
+            }
+        }
+    }
+
+    clear_errno();
+    return 0;
+}
+
+void rgroup_fork(struct process *child, struct process *parent) {
+    rgroup_t *group = parent && parent->rgroup ? parent->rgroup : &rgroup_root;
+    if (child->rgroup) {
+        child->rgroup->nr_procs--;
+    }
+    child->rgroup = group;
+    group->nr_procs++;
+}
+
+void rgroup_exit(struct process *proc) {
+    if (proc->rgroup) {
+        proc->rgroup->nr_procs--;
+        proc->rgroup = NULL;
+    }
+}
+
+int rgroup_charge_cpu(rgroup_t *group, uint64_t delta_us, uint64_t now) {
+    if (!group) {
+        return 0;
+    }
+
+    spin_lock(&group->lock);
+    group->cpu_usage_us += delta_us;
+    if (group->cpu_quota_us == 0) {
+        spin_unlock(&group->lock);
+        return 0;
+    }
+
+    // The first run time since the last period ended starts the next
+    if (!hrtimer_pending(&group->period_timer)) {
+        rgroup_new_period(group, now);
+        group->nr_periods++;
+        hrtimer_start(&group->period_timer, now + group->cpu_period_us);
+    }
+    group->cpu_runtime_us += delta_us;
+    if (!group->cpu_throttled && group->cpu_runtime_us >= group->cpu_quota_us) {
+        group->cpu_throttled = 1;
+        group->throttled_at_us = now;
+        group->nr_throttled++;
+    }
+    int throttled = group->cpu_throttled;
+    spin_unlock(&group->lock);
+    return throttled;
+}
+
+uint64_t rgroup_cpu_remaining(rgroup_t *group) {
+    if (!group || group->cpu_quota_us == 0) {
+        return UINT64_MAX;
+    }
+    if (group->cpu_runtime_us >= group->cpu_quota_us) {
+        return 0;
+    }
+    return group->cpu_quota_us - group->cpu_runtime_us;
+}
+
+void rgroup_charge_mem(rgroup_t *group, int64_t delta) {
+    if (!group) {
+        return;
+    }
+    if (delta < 0 && (uint64_t)(-delta) > group->mem_pages) {
+        group->mem_pages = 0;
+    } else {
+        group->mem_pages += delta;
+    }
+    if (group->mem_pages > group->mem_peak_pages) {
+        group->mem_peak_pages = group->mem_pages;
+    }
+}
+
+int rgroup_mem_allow(rgroup_t *group, uint64_t pages) {
+    if (!group || group->mem_limit_pages == 0 ||
+        group->mem_pages + pages <= group->mem_limit_pages) {
+        return 0;
+    }
+    group->mem_failcnt++;
+    RETURN_ERRNO(THUNDEROS_ENOMEM);
+}
@@ -0,0 +1,162 @@
+/**
+ * @file ring.c
+ * @brief Batched syscall submission rings for ThunderOS
+ *
+ * ring_enter() drains the calling process's submission queue through the
+ * syscall dispatch table, in the caller's own context, so every entry
+ * behaves exactly like the syscall it names. The ring is user memory the
+ * process can rewrite at any time: each entry is copied out before it
+ * runs, indices are masked before use, and the ring is checked to still
+ * be mapped before every entry, since the entry before it may have
+ * unmapped it.
+ */
+
+#include "kernel/ring.h"
+#include "kernel/syscall.h"
+#include "kernel/process.h"
+#include "kernel/errno.h"
+#include "kernel/smp.h"
+#include "arch/barrier.h"
+#include <stddef.h>
+
+/**
+ * @brief Check that a ring is still mapped read-write in the process
+ */
+static int ring_mapped(struct process *proc, ring_header_t *ring, uint32_t entries) {
+    return process_validate_user_ptr(proc, ring, ring_size_bytes(entries),
+                                     VM_USER | VM_READ | VM_WRITE);
+}
+
+/**
+ * @brief Run one submission and fill in its completion
+ */
+static void ring_run(const ring_sqe_t *sqe, ring_cqe_t *cqe) {
+    cqe->user_data = sqe->user_data;
+    cqe->reserved = 0;
+
+    const syscall_entry_t *entry = syscall_lookup(sqe->opcode);
+    if (!entry) {
+        cqe->result = -1;
+        cqe->error = THUNDEROS_ENOSYS;
+        return;
+    }
+
+    // No trap frame to hand out, and no rings inside rings
+    if (sqe->flags != 0 || (entry->flags & SYSCALL_NEEDS_FRAME) ||
+        sqe->opcode == SYS_RING_SETUP || sqe->opcode == SYS_RING_ENTER) {
+        cqe->result = -1;
+        cqe->error = THUNDEROS_EINVAL;
+        return;
+    }
+
+    syscall_args_t args = { .tf = NULL };
+    for (int i = 0; i < 6; i++) {
+        args.arg[i] = sqe->args[i];
+    }
+
+    clear_errno();
+    uint64_t ret = entry->handler(&args);
+    cqe->result = (int64_t)ret;
+    cqe->error = (ret == (uint64_t)-1) ? get_errno() : 0;
+}
+
+/**
+ * @brief Register a ring for the calling process
+ */
+int ring_setup(ring_header_t *ring, uint32_t entries) {
+    struct process *proc = process_current();
+    if (!proc) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    if (entries == 0 || entries > RING_MAX_ENTRIES || (entries & (entries - 1)) != 0 ||
+        ((uintptr_t)ring & 7) != 0) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (!ring || !ring_mapped(proc, ring, entries)) {
+        RETURN_ERRNO(THUNDEROS_EFAULT);
+    }
+
+    ring->sq_head = 0;
+    ring->sq_tail = 0;
+    ring->cq_head = 0;
+    ring->cq_tail = 0;
+    ring->entries = entries;
+    ring->reserved = 0;
+
+    // Our own copy of entries: the header's is user-writable
+    proc->ring = ring;
+    proc->ring_entries = entries;
+
+    clear_errno();
+    return 0;
+}
+
+/**
+ * @brief Run queued submissions
+ */
+int ring_enter(uint32_t to_submit) {
+    struct process *proc = process_current();
+    if (!proc || !proc->ring) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    ring_header_t *ring = proc->ring;
+    uint32_t entries = proc->ring_entries;
+    uint32_t mask = entries - 1;
+    ring_sqe_t *sq = (ring_sqe_t *)(ring + 1);
+    ring_cqe_t *cq = (ring_cqe_t *)(sq + entries);
+    uint32_t done = 0;
+
+    while (done < to_submit) {
+        if (!ring_mapped(proc, ring, entries)) {
+            if (done == 0) {
+                RETURN_ERRNO(THUNDEROS_EFAULT);
+            }
+            break;
+        }
+
+        uint32_t sq_head = ring->sq_head;
+        uint32_t sq_tail = ring->sq_tail;
+        if (sq_head == sq_tail) {
+            break;
+        }
+        if (sq_tail - sq_head > entries) {
+            if (done == 0) {
+                RETURN_ERRNO(THUNDEROS_EINVAL);
+            }
+            break;
+        }
+
+        // Stop while user space has not made room for the completion
+        uint32_t cq_tail = ring->cq_tail;
+        if (cq_tail - ring->cq_head >= entries) {
+            break;
+        }
+
+        // See the entry user space wrote before moving sq_tail
+        read_barrier();
+        ring_sqe_t sqe = sq[sq_head & mask];
+        ring->sq_head = sq_head + 1;
+
+        ring_cqe_t cqe;
+        ring_run(&sqe, &cqe);
+        done++;
+
+        // The entry may have unmapped the ring (its completion is lost)
+        if (!ring_mapped(proc, ring, entries)) {
+            break;
+        }
+
+        // The completion is in place before its tail moves
+        cq[cq_tail & mask] = cqe;
+        write_barrier();
+        ring->cq_tail = cq_tail + 1;
+
+        // A long batch should not keep other CPUs out of the kernel
+        bkl_relax();
+    }
+
+    clear_errno();
+    return (int)done;
+}
@@ -3,36 +3,171 @@
  * @brief Reader-writer lock implementation for ThunderOS
  *
  * Implements a reader-writer lock that allows multiple concurrent readers
- * or a single exclusive writer. Writers have priority to prevent starvation.
+ * or a single exclusive writer, under one of three policies (rwlock.h).
+ *
+ * Unlocking hands the lock over instead of waking waiters to race for it:
+ * a batch of readers is counted into readers (and reader_grants) before
+ * being woken, a writer is made writer_owner. A woken waiter that finds no
+ * grant for it was woken by something else and tries again.
  */
 
 #include "kernel/rwlock.h"
+#include "kernel/process.h"
 #include "kernel/errno.h"
 #include "kernel/constants.h"
+#include "kernel/lockstat.h"
+#include "hal/hal_timer.h"
 #include "arch/interrupt.h"
 
 /**
  * @brief Initialize a reader-writer lock
  *
  * @param rw Pointer to rwlock to initialize
+ * @param policy RWLOCK_PREFER_WRITER, RWLOCK_PREFER_READER or RWLOCK_PHASE_FAIR
+ * @return 0 on success, -1 if the policy is unknown
  */
-void rwlock_init(rwlock_t *rw) {
-    if (!rw) {
-        return;
+int rwlock_init(rwlock_t *rw, int policy) {
+    if (!rw || policy < RWLOCK_PREFER_WRITER || policy > RWLOCK_PHASE_FAIR) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
     }
     
     rw->readers = 0;
     rw->writer = 0;
     rw->writers_waiting = 0;
+    rw->reader_grants = 0;
+    rw->writer_owner = NULL;
+    rw->policy = policy;
     wait_queue_init(&rw->reader_queue);
     wait_queue_init(&rw->writer_queue);
+#ifdef LOCKSTAT
+    // rwlocks set up by the same code are one pair of classes
+    const void *site = (const void *)LOCKSTAT_SITE();
+    rw->lockstat_read = lockstat_class(LOCKSTAT_RWLOCK_READ, site, NULL);
+    rw->lockstat_write = lockstat_class(LOCKSTAT_RWLOCK_WRITE, site, NULL);
+#endif
+    clear_errno();
+    return 0;
+}
+
+/* ========================================================================
+ * Lock statistics (kernel/lockstat.h)
+ *
+ * A read hold is a read phase: from the first reader getting in to the
+ * last one leaving. Called with interrupts disabled.
+ * ======================================================================== */
+
+#ifdef LOCKSTAT
+/**
+ * @brief Give an RWLOCK_INIT lock the classes of the first site to take it
+ */
+static void rwlock_stat_init(rwlock_t *rw, uintptr_t site) {
+    if (!rw->lockstat_read) {
+        rw->lockstat_read = lockstat_class(LOCKSTAT_RWLOCK_READ, (const void *)site, NULL);
+        rw->lockstat_write = lockstat_class(LOCKSTAT_RWLOCK_WRITE, (const void *)site, NULL);
+    }
+}
+
+/**
+ * @brief Count readers just added to readers
+ */
+static void rwlock_stat_read(rwlock_t *rw, int admitted) {
+    if (admitted > 0 && rw->readers == admitted) {
+        rw->read_at_us = hal_timer_get_time_us();
+    }
+    for (int i = 0; i < admitted && rw->lockstat_read; i++) {
+        lockstat_acquired(rw->lockstat_read);
+    }
+}
+
+static void rwlock_stat_read_end(rwlock_t *rw) {
+    if (rw->lockstat_read) {
+        lockstat_held(rw->lockstat_read, hal_timer_get_time_us() - rw->read_at_us);
+    }
+}
+
+static void rwlock_stat_write(rwlock_t *rw) {
+    rw->write_at_us = hal_timer_get_time_us();
+    if (rw->lockstat_write) {
+        lockstat_acquired(rw->lockstat_write);
+    }
+}
+
+static void rwlock_stat_write_end(rwlock_t *rw) {
+    if (rw->lockstat_write) {
+        lockstat_held(rw->lockstat_write, hal_timer_get_time_us() - rw->write_at_us);
+    }
+}
+
+static void rwlock_stat_waited(rwlock_t *rw, int write, uint64_t wait_start, uintptr_t site) {
+    struct lockstat_class *cls = write ? rw->lockstat_write : rw->lockstat_read;
+    if (cls) {
+        lockstat_waited(cls, hal_timer_get_time_us() - wait_start, site);
+    }
+}
+
+#define RWLOCK_STAT_SITE() LOCKSTAT_SITE()
+#define RWLOCK_STAT_NOW() hal_timer_get_time_us()
+#else
+static inline void rwlock_stat_init(rwlock_t *rw, uintptr_t site) { (void)rw; (void)site; }
+static inline void rwlock_stat_read(rwlock_t *rw, int admitted) { (void)rw; (void)admitted; }
+static inline void rwlock_stat_read_end(rwlock_t *rw) { (void)rw; }
+static inline void rwlock_stat_write(rwlock_t *rw) { (void)rw; }
+static inline void rwlock_stat_write_end(rwlock_t *rw) { (void)rw; }
+static inline void rwlock_stat_waited(rwlock_t *rw, int write, uint64_t wait_start, uintptr_t site) {
+    (void)rw; (void)write; (void)wait_start; (void)site;
+}
+
+#define RWLOCK_STAT_SITE() ((uintptr_t)0)
+#define RWLOCK_STAT_NOW() ((uint64_t)0)
+#endif
+
+/**
+ * @brief Can a newly arriving reader enter? (interrupts disabled)
+ */
+static int rwlock_reader_may_enter(rwlock_t *rw) {
+    if (rw->writer) {
+        return 0;
+    }
+    return rw->policy == RWLOCK_PREFER_READER || rw->writers_waiting == 0;
+}
+
+/**
+ * @brief Admit every queued reader in one batch (interrupts disabled)
+ *
+ * @return Number of readers admitted
+ */
+static int rwlock_grant_readers(rwlock_t *rw) {
+    int admitted = wait_queue_wake(&rw->reader_queue);
+    rw->readers += admitted;
+    rw->reader_grants += admitted;
+    rwlock_stat_read(rw, admitted);
+    return admitted;
+}
+
+/**
+ * @brief Hand the lock to the oldest queued writer (interrupts disabled)
+ *
+ * @return 1 if a writer was queued, 0 otherwise
+ */
+static int rwlock_grant_writer(rwlock_t *rw) {
+    struct process *next = wait_queue_peek(&rw->writer_queue);
+    if (!next) {
+        return 0;
+    }
+    
+    rw->writer = 1;
+    rw->writer_owner = next;
+    rw->writers_waiting--;
+    rwlock_stat_write(rw);
+    wait_queue_wake_one(&rw->writer_queue);
+    return 1;
 }
 
 /**
  * @brief Acquire read lock (blocking)
  *
- * Blocks if a writer holds the lock or if writers are waiting.
- * This gives priority to writers to prevent writer starvation.
+ * Blocks while a writer holds the lock or, unless reader-preferring,
+ * while writers are waiting; then waits to be admitted by an unlock.
  *
  * @param rw Pointer to rwlock to acquire for reading
  */
@@ -41,17 +176,33 @@ void rwlock_read_lock(rwlock_t *rw) {
         return;
     }
     
+    uintptr_t site = RWLOCK_STAT_SITE();
+    uint64_t wait_start = RWLOCK_STAT_NOW();
+    int waited = 0;
     uint64_t flags = interrupt_save_disable();
+    rwlock_stat_init(rw, site);
     
-    /* Wait while a writer holds the lock or writers are waiting */
-    while (rw->writer || rw->writers_waiting > 0) {
+    while (!rwlock_reader_may_enter(rw)) {
         interrupt_restore(flags);
         wait_queue_sleep(&rw->reader_queue);
         flags = interrupt_save_disable();
+        waited = 1;
+        
+        /* Admitted by an unlock: already counted in readers */
+        if (rw->reader_grants > 0) {
+            rw->reader_grants--;
+            rwlock_stat_waited(rw, 0, wait_start, site);
+            interrupt_restore(flags);
+            return;
+        }
     }
     
     /* Acquired read lock */
     rw->readers++;
+    rwlock_stat_read(rw, 1);
+    if (waited) {
+        rwlock_stat_waited(rw, 0, wait_start, site);
+    }
     
     interrupt_restore(flags);
 }
@@ -68,15 +219,16 @@ int rwlock_read_trylock(rwlock_t *rw) {
     }
     
     uint64_t flags = interrupt_save_disable();
+    rwlock_stat_init(rw, RWLOCK_STAT_SITE());
     
-    /* Cannot acquire if writer holds or writers waiting */
-    if (rw->writer || rw->writers_waiting > 0) {
+    if (!rwlock_reader_may_enter(rw)) {
         interrupt_restore(flags);
         RETURN_ERRNO(THUNDEROS_EBUSY);
     }
     
     /* Acquired read lock */
     rw->readers++;
+    rwlock_stat_read(rw, 1);
     
     interrupt_restore(flags);
     clear_errno();
@@ -86,8 +238,8 @@ int rwlock_read_trylock(rwlock_t *rw) {
 /**
  * @brief Release read lock
  *
- * Decrements reader count. If this was the last reader and writers
- * are waiting, wakes one writer.
+ * Decrements reader count. If this was the last reader, hands the lock
+ * to the oldest waiting writer.
  *
  * @param rw Pointer to rwlock to release
  */
@@ -100,13 +252,14 @@ void rwlock_read_unlock(rwlock_t *rw) {
     
     if (rw->readers > 0) {
         rw->readers--;
+        if (rw->readers == 0) {
+            rwlock_stat_read_end(rw);
+        }
     }
     
-    /* If no more readers and writers waiting, wake a writer */
-    if (rw->readers == 0 && rw->writers_waiting > 0) {
-        interrupt_restore(flags);
-        wait_queue_wake_one(&rw->writer_queue);
-        return;
+    /* End of the read phase: readers only queue behind a writer */
+    if (rw->readers == 0 && !rw->writer) {
+        rwlock_grant_writer(rw);
     }
     
     interrupt_restore(flags);
@@ -115,8 +268,9 @@ void rwlock_read_unlock(rwlock_t *rw) {
 /**
  * @brief Acquire write lock (blocking)
  *
- * Blocks until all readers release and no other writer holds the lock.
- * Increments writers_waiting to give priority over new readers.
+ * Blocks until all readers release and no other writer holds the lock,
+ * counting itself in writers_waiting meanwhile so that (unless
+ * reader-preferring) new readers wait behind it.
  *
  * @param rw Pointer to rwlock to acquire for writing
  */
@@ -125,22 +279,43 @@ void rwlock_write_lock(rwlock_t *rw) {
         return;
     }
     
+    struct process *current = process_current();
+    uintptr_t site = RWLOCK_STAT_SITE();
+    uint64_t wait_start = RWLOCK_STAT_NOW();
     uint64_t flags = interrupt_save_disable();
+    rwlock_stat_init(rw, site);
+    
+    if (rw->readers == 0 && !rw->writer) {
+        rw->writer = 1;
+        rw->writer_owner = current;
+        rwlock_stat_write(rw);
+        interrupt_restore(flags);
+        return;
+    }
     
     /* Indicate we're waiting - this blocks new readers */
     rw->writers_waiting++;
     
-    /* Wait while readers hold the lock or another writer holds it */
-    while (rw->readers > 0 || rw->writer) {
+    for (;;) {
         interrupt_restore(flags);
         wait_queue_sleep(&rw->writer_queue);
         flags = interrupt_save_disable();
+        
+        /* Handed the lock by an unlock (which stopped counting us) */
+        if (rw->writer && rw->writer_owner == current) {
+            break;
+        }
+        
+        if (rw->readers == 0 && !rw->writer) {
+            rw->writers_waiting--;
+            rw->writer = 1;
+            rw->writer_owner = current;
+            rwlock_stat_write(rw);
+            break;
+        }
     }
     
-    /* Acquired write lock */
-    rw->writers_waiting--;
-    rw->writer = 1;
-    
+    rwlock_stat_waited(rw, 1, wait_start, site);
     interrupt_restore(flags);
 }
 
@@ -156,6 +331,7 @@ int rwlock_write_trylock(rwlock_t *rw) {
     }
     
     uint64_t flags = interrupt_save_disable();
+    rwlock_stat_init(rw, RWLOCK_STAT_SITE());
     
     /* Cannot acquire if readers hold or writer holds */
     if (rw->readers > 0 || rw->writer) {
@@ -165,6 +341,8 @@ int rwlock_write_trylock(rwlock_t *rw) {
     
     /* Acquired write lock */
     rw->writer = 1;
+    rw->writer_owner = process_current();
+    rwlock_stat_write(rw);
     
     interrupt_restore(flags);
     clear_errno();
@@ -174,8 +352,10 @@ int rwlock_write_trylock(rwlock_t *rw) {
 /**
  * @brief Release write lock
  *
- * Releases the write lock. Wakes all waiting readers first (if any),
- * otherwise wakes one waiting writer.
+ * Writer-preferring: the next writer, else all queued readers.
+ * Reader-preferring and phase-fair: all queued readers, else the next
+ * writer. For phase-fair that bounds each read phase to the readers that
+ * queued during the write, since writers_waiting keeps new ones out.
  *
  * @param rw Pointer to rwlock to release
  */
@@ -186,19 +366,20 @@ void rwlock_write_unlock(rwlock_t *rw) {
     
     uint64_t flags = interrupt_save_disable();
     
+    if (rw->writer) {
+        rwlock_stat_write_end(rw);
+    }
     rw->writer = 0;
+    rw->writer_owner = NULL;
     
-    /* Prefer waking readers over writers for fairness */
-    /* Wake all waiting readers */
-    interrupt_restore(flags);
-    wait_queue_wake(&rw->reader_queue);
-    
-    /* If no readers were waiting but writers are, wake one writer */
-    flags = interrupt_save_disable();
-    if (rw->readers == 0 && rw->writers_waiting > 0) {
-        interrupt_restore(flags);
-        wait_queue_wake_one(&rw->writer_queue);
-        return;
+    if (rw->policy == RWLOCK_PREFER_WRITER) {
+        if (!rwlock_grant_writer(rw)) {
+            rwlock_grant_readers(rw);
+        }
+    } else {
+        if (!rwlock_grant_readers(rw)) {
+            rwlock_grant_writer(rw);
+        }
     }
     
     interrupt_restore(flags);
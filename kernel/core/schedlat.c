@@ -0,0 +1,230 @@
+/**
+ * @file schedlat.c
+ * @brief Wakeup-to-run latency per priority, and what delayed the worst
+ *
+ * The worst list is kept sorted, longest first, under its own spinlock.
+ * Once it is full, a wait no longer than the shortest kept is turned
+ * away before taking the lock, so most switches only add to counters.
+ *
+ * Sections with interrupts off are tracked per CPU: the one open, and the
+ * longest that ended since the CPU last switched processes, which is what
+ * the process switched to can have waited behind there.
+ */
+
+#include "kernel/schedlat.h"
+#include "kernel/smp.h"
+#include "kernel/spinlock.h"
+#include "kernel/kstring.h"
+#include "kernel/bitops.h"
+#include "kernel/config.h"
+#include "hal/hal_timer.h"
+#include <stddef.h>
+
+_Static_assert(SCHED_RT_LEVELS == 10, "schedlat_class_names out of date");
+
+static schedlat_class_t schedlat_classes[SCHEDLAT_CLASSES];
+
+static const char *schedlat_class_names[SCHEDLAT_CLASSES] = {
+    "rt10", "rt9", "rt8", "rt7", "rt6", "rt5", "rt4", "rt3", "rt2", "rt1",
+    "fair", "deadline",
+};
+
+static schedlat_record_t schedlat_worst[SCHEDLAT_WORST];
+static uint32_t schedlat_worst_count;
+static volatile uint64_t schedlat_worst_min;    // Shortest kept, once full
+static spinlock_t schedlat_worst_lock = SPINLOCK_INIT;
+
+static schedlat_irqoff_t schedlat_irqoff;
+
+#ifdef SCHEDLAT_IRQOFF
+/**
+ * Interrupts-off state of one CPU
+ */
+typedef struct {
+    uint64_t start_us;                  // Open section's start (0: none)
+    uintptr_t start_site;               // Where it started
+    uint64_t max_us;                    // Longest ended since the last switch
+    uintptr_t max_site;
+    uint64_t max_end_us;                // When that one ended
+} schedlat_cpu_t;
+
+static schedlat_cpu_t schedlat_cpus[MAX_CPUS];
+
+// cpu_this() is garbage until smp_init()
+static volatile int schedlat_ready;
+#endif
+
+/**
+ * Latency class of a process, by its effective priority
+ */
+static uint32_t schedlat_class_of(const struct process *proc) {
+    if (proc->sched_policy == SCHED_DEADLINE) {
+        return SCHEDLAT_DEADLINE;
+    }
+    if (proc->priority < SCHED_RT_LEVELS) {
+        return (uint32_t)proc->priority;
+    }
+    return SCHEDLAT_FAIR;
+}
+
+void schedlat_init(void) {
+#ifdef SCHEDLAT_IRQOFF
+    schedlat_ready = 1;
+#endif
+}
+
+void schedlat_wake(struct process *proc, uintptr_t site) {
+    proc->wake_us = hal_timer_get_time_us();
+    proc->wake_site = site;
+}
+
+/**
+ * Keep a wait in the worst list if it is long enough (interrupts off)
+ */
+static void schedlat_add_worst(const schedlat_record_t *record) {
+    spin_lock(&schedlat_worst_lock);
+
+    uint32_t i = schedlat_worst_count;
+    while (i > 0 && schedlat_worst[i - 1].latency_us < record->latency_us) {
+        i--;
+    }
+    if (i < SCHEDLAT_WORST) {
+        uint32_t last = schedlat_worst_count < SCHEDLAT_WORST ? schedlat_worst_count : SCHEDLAT_WORST - 1;
+        for (uint32_t j = last; j > i; j--) {
+            schedlat_worst[j] = schedlat_worst[j - 1];
+        }
+        schedlat_worst[i] = *record;
+        if (schedlat_worst_count < SCHEDLAT_WORST) {
+            schedlat_worst_count++;
+        }
+        if (schedlat_worst_count == SCHEDLAT_WORST) {
+            schedlat_worst_min = schedlat_worst[SCHEDLAT_WORST - 1].latency_us;
+        }
+    }
+
+    spin_unlock(&schedlat_worst_lock);
+}
+
+void schedlat_switch(struct process *prev, struct process *next) {
+#ifdef SCHEDLAT_IRQOFF
+    schedlat_cpu_t *pc = &schedlat_cpus[cpu_this()->id];
+#endif
+
+    if (next && next->wake_us) {
+        uint64_t now = hal_timer_get_time_us();
+        uint64_t wake_us = next->wake_us;
+        next->wake_us = 0;
+
+        // Every CPU reads the same mtime, so a wakeup from another CPU
+        // compares fine
+        uint64_t latency = now > wake_us ? now - wake_us : 0;
+        uint32_t c = schedlat_class_of(next);
+        schedlat_class_t *cls = &schedlat_classes[c];
+        __sync_fetch_and_add(&cls->count, 1);
+        __sync_fetch_and_add(&cls->total_us, latency);
+        __sync_fetch_and_add(&cls->hist[log2_bucket(latency, SCHEDLAT_HIST_BUCKETS)], 1);
+        atomic_max64(&cls->max_us, latency);
+
+        if (latency > schedlat_worst_min) {
+            schedlat_record_t record;
+            kmemset(&record, 0, sizeof(record));
+            record.latency_us = latency;
+            record.run_us = now;
+            record.pid = next->pid;
+            kstrncpy(record.name, next->name, PROC_NAME_LEN - 1);
+            record.lat_class = c;
+            record.cpu = (uint32_t)cpu_this()->id;
+            record.wake_site = next->wake_site;
+            if (prev) {
+                record.prev_pid = prev->pid;
+                kstrncpy(record.prev_name, prev->name, PROC_NAME_LEN - 1);
+            }
+#ifdef SCHEDLAT_IRQOFF
+            // The section schedule() is in counts too: it may have been
+            // opened long before by whatever called it
+            if (pc->max_end_us >= wake_us) {
+                record.irqoff_us = pc->max_us;
+                record.irqoff_site = pc->max_site;
+            }
+            if (pc->start_us && now - pc->start_us > record.irqoff_us) {
+                record.irqoff_us = now - pc->start_us;
+                record.irqoff_site = pc->start_site;
+            }
+#endif
+            schedlat_add_worst(&record);
+        }
+    }
+
+#ifdef SCHEDLAT_IRQOFF
+    pc->max_us = 0;
+    pc->max_site = 0;
+    pc->max_end_us = 0;
+#endif
+}
+
+#ifdef SCHEDLAT_IRQOFF
+void schedlat_irqs_off(uintptr_t site) {
+    if (!schedlat_ready) {
+        return;
+    }
+    schedlat_cpu_t *pc = &schedlat_cpus[cpu_this()->id];
+    pc->start_us = hal_timer_get_time_us();
+    pc->start_site = site;
+}
+
+void schedlat_irqs_on(void) {
+    if (!schedlat_ready) {
+        return;
+    }
+    int id = cpu_this()->id;
+    schedlat_cpu_t *pc = &schedlat_cpus[id];
+    if (!pc->start_us) {
+        return;
+    }
+    uint64_t now = hal_timer_get_time_us();
+    uint64_t us = now - pc->start_us;
+    pc->start_us = 0;
+
+    if (us >= pc->max_us) {
+        pc->max_us = us;
+        pc->max_site = pc->start_site;
+        pc->max_end_us = now;
+    }
+    __sync_fetch_and_add(&schedlat_irqoff.count, 1);
+    __sync_fetch_and_add(&schedlat_irqoff.total_us, us);
+    __sync_fetch_and_add(&schedlat_irqoff.hist[log2_bucket(us, SCHEDLAT_HIST_BUCKETS)], 1);
+    // Two CPUs racing here may pair one's maximum with the other's site
+    if (atomic_max64(&schedlat_irqoff.max_us, us)) {
+        schedlat_irqoff.max_site = pc->start_site;
+        schedlat_irqoff.max_cpu = (uint32_t)id;
+    }
+}
+
+void schedlat_irqs_were_on(void) {
+    if (schedlat_ready) {
+        schedlat_cpus[cpu_this()->id].start_us = 0;
+    }
+}
+#endif
+
+const schedlat_class_t *schedlat_get_class(uint32_t index) {
+    return index < SCHEDLAT_CLASSES ? &schedlat_classes[index] : NULL;
+}
+
+const char *schedlat_class_name(uint32_t index) {
+    return index < SCHEDLAT_CLASSES ? schedlat_class_names[index] : "?";
+}
+
+void schedlat_get_irqoff(schedlat_irqoff_t *stats) {
+    *stats = schedlat_irqoff;
+}
+
+int schedlat_get_worst(uint32_t index, schedlat_record_t *record) {
+    int irq_state = spin_lock_irqsave(&schedlat_worst_lock);
+    int found = index < schedlat_worst_count;
+    if (found) {
+        *record = schedlat_worst[index];
+    }
+    spin_unlock_irqrestore(&schedlat_worst_lock, irq_state);
+    return found ? 0 : -1;
+}
@@ -1,53 +1,567 @@
 /*
  * Process Scheduler Implementation
  * 
- * Round-robin scheduler with priority support.
+ * Each CPU has its own run queue, with its own lock, holding three
+ * classes. SCHED_DEADLINE processes come first, on a list kept in order
+ * of absolute deadline (admission control keeps it short), each with a
+ * budget of run time per period that it is throttled without.
+ * Real-time processes (priority below SCHED_RT_LEVELS) sit on intrusive
+ * per-priority run lists, with a bitmap of non-empty levels for O(1)
+ * pick. Everything else is in the fair class: a min-heap keyed on
+ * vruntime, the run time a process has had scaled by its weight. The
+ * process with the least vruntime runs next, for a slice that is its
+ * weighted share of SCHED_LATENCY_US, so every runnable process gets the
+ * CPU within a bounded time however many are busy.
+ * 
+ * A resource group (kernel/rgroup.h) that has used up its CPU quota is
+ * throttled the same way for all its members: none is queued, or picked
+ * if it was queued before, until the group's period timer puts them
+ * back.
+ * 
+ * The running process is never queued; schedule() puts it back on its
+ * CPU's queue before picking, so it competes with everything else.
+ * 
+ * A woken or new process goes to the CPU it last ran on, whose cache and
+ * TLB may still hold its working set, unless that CPU is busy and another
+ * is idle. A CPU that queues work for an idle or less urgent CPU kicks it
+ * with an IPI. A CPU whose own queue is empty steals from the busiest
+ * one before going idle. Slice state is per CPU, in struct cpu; with
+ * nothing to run a CPU switches to its idle context, which drops the big
+ * kernel lock and waits for an interrupt.
  */
 
 #include "kernel/scheduler.h"
 #include "kernel/process.h"
 #include "kernel/config.h"
 #include "kernel/constants.h"
+#include "kernel/errno.h"
+#include "kernel/kstring.h"
+#include "kernel/bitops.h"
 #include "kernel/panic.h"
+#include "kernel/hrtimer.h"
+#include "kernel/smp.h"
+#include "kernel/spinlock.h"
+#include "kernel/rcu.h"
+#include "kernel/softirq.h"
+#include "kernel/trace.h"
+#include "kernel/perf_event.h"
+#include "kernel/acct.h"
+#include "kernel/schedlat.h"
+#include "kernel/rgroup.h"
 #include "hal/hal_uart.h"
+#include "hal/hal_timer.h"
 #include "arch/interrupt.h"
+#include "arch/barrier.h"
+#include "arch/fpu.h"
+#include "mm/pmm.h"
+
+// One CPU's runnable processes
+struct run_queue {
+    spinlock_t lock;
+    
+    // Deadline class: earliest absolute deadline first
+    struct process *dl_head;
+    uint32_t dl_nr;
+    
+    // Real-time class: per-priority run lists (FIFO within a level)
+    struct process *run_head[SCHED_RT_LEVELS];
+    struct process *run_tail[SCHED_RT_LEVELS];
+    
+    // Bit n set = run_head[n] is non-empty
+    uint32_t run_bitmap;
+    
+    // Fair class: min-heap ordered by vruntime
+    struct process *fair_heap[MAX_PROCS];
+    uint32_t fair_nr;
+    uint64_t fair_weight;               // Sum of queued weights
+    
+    // Monotonic floor for vruntime, used to place woken processes
+    uint64_t min_vruntime;
+    
+    uint32_t nr_queued;                 // Processes on either class
+};
+
+static struct run_queue run_queues[MAX_CPUS];
+
+// Admitted SCHED_DEADLINE bandwidth, runtime/period << SCHED_DL_BW_SHIFT
+// summed (changed under the BKL)
+static uint64_t dl_total_bw = 0;
+
+// Weight per fair priority (nice 0 to 19): each step is ~1.25x
+static const uint32_t sched_prio_to_weight[20] = {
+    1024, 820, 655, 526, 423, 335, 272, 215, 172, 137,
+     110,  87,  70,  56,  45,  36,  29,  23,  18,  15
+};
+
+// run_queued values: which queue a process is on
+#define QUEUED_RT   1
+#define QUEUED_FAIR 2
+#define QUEUED_DL   3
+
+static inline struct run_queue *this_rq(void) {
+    return &run_queues[cpu_this()->id];
+}
+
+static inline int sched_is_dl(struct process *proc) {
+    return proc->sched_policy == SCHED_DEADLINE;
+}
+
+static inline int sched_is_fair(struct process *proc) {
+    return !sched_is_dl(proc) && proc->priority >= SCHED_RT_LEVELS;
+}
+
+// A mutex boost into the real-time levels runs round-robin
+static inline int sched_is_fifo(struct process *proc) {
+    return proc->sched_policy == SCHED_FIFO && !sched_is_fair(proc);
+}
+
+/**
+ * Must a process stay off the CPU? (its deadline budget or its group's
+ * quota is spent)
+ */
+static inline int sched_throttled(struct process *proc) {
+    return proc->dl_throttled || rgroup_cpu_throttled(proc->rgroup);
+}
+
+static inline uint64_t dl_bw(uint64_t runtime_us, uint64_t period_us) {
+    return (runtime_us << SCHED_DL_BW_SHIFT) / period_us;
+}
+
+static inline uint32_t sched_weight(struct process *proc) {
+    uint64_t nice = proc->priority - SCHED_RT_LEVELS;
+    if (nice >= 20) {
+        nice = 19;
+    }
+    return sched_prio_to_weight[nice];
+}
+
+/**
+ * Unlink a queued process from its run list (lock must be held)
+ */
+static void run_list_remove(struct run_queue *rq, struct process *proc) {
+    uint32_t level = proc->run_level;
+    
+    if (proc->run_prev) {
+        proc->run_prev->run_next = proc->run_next;
+    } else {
+        rq->run_head[level] = proc->run_next;
+    }
+    if (proc->run_next) {
+        proc->run_next->run_prev = proc->run_prev;
+    } else {
+        rq->run_tail[level] = proc->run_prev;
+    }
+    
+    if (!rq->run_head[level]) {
+        rq->run_bitmap &= ~(1U << level);
+    }
+    
+    proc->run_next = NULL;
+    proc->run_prev = NULL;
+    proc->run_queued = 0;
+    rq->nr_queued--;
+}
 
-// Simple circular queue for ready processes
-#define READY_QUEUE_SIZE MAX_PROCS
-static struct process *ready_queue[READY_QUEUE_SIZE];
-static int queue_head = 0;
-static int queue_tail = 0;
-static int queue_count = 0;
+/**
+ * Queue a deadline process in deadline order (lock must be held)
+ * 
+ * Behind those with the same deadline, so equals take turns.
+ */
+static void dl_insert(struct run_queue *rq, struct process *proc) {
+    struct process *prev = NULL;
+    struct process *next = rq->dl_head;
+    while (next && next->dl_abs_deadline_us <= proc->dl_abs_deadline_us) {
+        prev = next;
+        next = next->run_next;
+    }
+    
+    proc->run_prev = prev;
+    proc->run_next = next;
+    if (prev) {
+        prev->run_next = proc;
+    } else {
+        rq->dl_head = proc;
+    }
+    if (next) {
+        next->run_prev = proc;
+    }
+    rq->dl_nr++;
+}
 
-// Scheduler lock
-static volatile int sched_lock = 0;
+/**
+ * Unlink a queued deadline process (lock must be held)
+ */
+static void dl_remove(struct run_queue *rq, struct process *proc) {
+    if (proc->run_prev) {
+        proc->run_prev->run_next = proc->run_next;
+    } else {
+        rq->dl_head = proc->run_next;
+    }
+    if (proc->run_next) {
+        proc->run_next->run_prev = proc->run_prev;
+    }
+    
+    proc->run_next = NULL;
+    proc->run_prev = NULL;
+    proc->run_queued = 0;
+    rq->dl_nr--;
+    rq->nr_queued--;
+}
 
-// Time slice for round-robin scheduling
-// Calculated based on TIMER_INTERVAL_US from config.h
-// Desired time slice: 1 second = MICROSECONDS_PER_SECOND microseconds
-// TIME_SLICE = MICROSECONDS_PER_SECOND / TIMER_INTERVAL_US ticks
-#define TIME_SLICE (MICROSECONDS_PER_SECOND / TIMER_INTERVAL_US)
-static uint64_t current_time_slice = 0;
+/**
+ * Refill a deadline process's budget for its next job
+ * 
+ * An overrun is paid back from the following periods; a process that
+ * fell behind real time starts a fresh job now.
+ */
+static void dl_replenish(struct process *proc, uint64_t now) {
+    while (proc->dl_budget_us <= 0) {
+        proc->dl_abs_deadline_us += proc->dl_period_us;
+        proc->dl_budget_us += (int64_t)proc->dl_runtime_us;
+    }
+    if (proc->dl_abs_deadline_us < now) {
+        proc->dl_abs_deadline_us = now + proc->dl_deadline_us;
+        proc->dl_budget_us = (int64_t)proc->dl_runtime_us;
+    }
+}
+
+/**
+ * Start a new job for a waking deadline process if it needs one
+ * 
+ * The constant bandwidth server rule: keep the current deadline only if
+ * the budget left can run before it without going over runtime/period.
+ */
+static void dl_wakeup(struct process *proc, uint64_t now) {
+    if (now >= proc->dl_abs_deadline_us ||
+        (uint64_t)proc->dl_budget_us * proc->dl_period_us >
+            (proc->dl_abs_deadline_us - now) * proc->dl_runtime_us) {
+        proc->dl_abs_deadline_us = now + proc->dl_deadline_us;
+        proc->dl_budget_us = (int64_t)proc->dl_runtime_us;
+    }
+}
+
+/**
+ * Take a deadline process whose budget ran out off the CPU until its
+ * next period
+ */
+static void dl_throttle(struct process *proc, uint64_t now) {
+    uint64_t next_period = proc->dl_abs_deadline_us - proc->dl_deadline_us + proc->dl_period_us;
+    if (next_period <= now) {
+        // That period has begun already
+        dl_replenish(proc, now);
+        return;
+    }
+    proc->dl_throttled = 1;
+    hrtimer_start(&proc->dl_timer, next_period);
+}
 
-// Simple spinlock functions
-static inline void lock_acquire(volatile int *lock) {
-    while (__sync_lock_test_and_set(lock, 1)) {
-        // Spin
+/**
+ * A throttled process's next period began (hrtimer, interrupts off)
+ */
+static void dl_timer_fn(void *data) {
+    struct process *proc = (struct process *)data;
+    
+    proc->dl_throttled = 0;
+    dl_replenish(proc, hal_timer_get_time_us());
+    
+    // Still runnable: back on a queue. A sleeper goes when woken.
+    if (proc->state == PROC_READY && !proc->run_queued) {
+        scheduler_enqueue(proc);
     }
 }
 
-static inline void lock_release(volatile int *lock) {
-    __sync_lock_release(lock);
+/**
+ * vruntime order, safe across wraparound
+ */
+static inline int vruntime_before(uint64_t a, uint64_t b) {
+    return (int64_t)(a - b) < 0;
+}
+
+static inline void fair_heap_set(struct run_queue *rq, uint32_t index, struct process *proc) {
+    rq->fair_heap[index] = proc;
+    proc->run_level = index;
+}
+
+static void fair_sift_up(struct run_queue *rq, uint32_t index) {
+    struct process *proc = rq->fair_heap[index];
+    while (index > 0) {
+        uint32_t parent = (index - 1) / 2;
+        if (!vruntime_before(proc->vruntime, rq->fair_heap[parent]->vruntime)) {
+            break;
+        }
+        fair_heap_set(rq, index, rq->fair_heap[parent]);
+        index = parent;
+    }
+    fair_heap_set(rq, index, proc);
+}
+
+static void fair_sift_down(struct run_queue *rq, uint32_t index) {
+    struct process *proc = rq->fair_heap[index];
+    for (;;) {
+        uint32_t child = 2 * index + 1;
+        if (child >= rq->fair_nr) {
+            break;
+        }
+        if (child + 1 < rq->fair_nr &&
+            vruntime_before(rq->fair_heap[child + 1]->vruntime,
+                            rq->fair_heap[child]->vruntime)) {
+            child++;
+        }
+        if (!vruntime_before(rq->fair_heap[child]->vruntime, proc->vruntime)) {
+            break;
+        }
+        fair_heap_set(rq, index, rq->fair_heap[child]);
+        index = child;
+    }
+    fair_heap_set(rq, index, proc);
+}
+
+/**
+ * Remove a queued fair process from the heap (lock must be held)
+ */
+static void fair_remove(struct run_queue *rq, struct process *proc) {
+    uint32_t index = proc->run_level;
+    struct process *last = rq->fair_heap[--rq->fair_nr];
+    
+    if (last != proc) {
+        fair_heap_set(rq, index, last);
+        fair_sift_down(rq, index);
+        fair_sift_up(rq, last->run_level);
+    }
+    
+    rq->fair_weight -= sched_weight(proc);
+    proc->run_queued = 0;
+    rq->nr_queued--;
+}
+
+/**
+ * Advance min_vruntime to the least vruntime still in play
+ */
+static void update_min_vruntime(struct run_queue *rq, struct process *curr) {
+    int have = 0;
+    uint64_t vruntime = 0;
+    
+    if (curr && curr->state == PROC_RUNNING && sched_is_fair(curr)) {
+        vruntime = curr->vruntime;
+        have = 1;
+    }
+    if (rq->fair_nr > 0 && (!have || vruntime_before(rq->fair_heap[0]->vruntime, vruntime))) {
+        vruntime = rq->fair_heap[0]->vruntime;
+        have = 1;
+    }
+    
+    if (have && vruntime_before(rq->min_vruntime, vruntime)) {
+        rq->min_vruntime = vruntime;
+    }
+}
+
+/**
+ * Charge run time since the last update to a process (lock must be held)
+ */
+static void update_curr(struct run_queue *rq, struct process *curr, uint64_t now) {
+    uint64_t delta = now - curr->exec_start_us;
+    curr->exec_start_us = now;
+    curr->slice_used_us += delta;
+    rgroup_charge_cpu(curr->rgroup, delta, now);
+    
+    if (sched_is_dl(curr)) {
+        curr->dl_budget_us -= (int64_t)delta;
+    } else if (sched_is_fair(curr)) {
+        curr->vruntime += delta * SCHED_WEIGHT_NICE0 / sched_weight(curr);
+        update_min_vruntime(rq, curr);
+    }
+}
+
+/**
+ * Slice for a fair process about to run: its weighted share of the
+ * latency period, stretched when too many processes are runnable
+ */
+static uint64_t fair_slice(struct run_queue *rq, struct process *proc) {
+    uint64_t nr = rq->fair_nr + 1;
+    uint64_t period = SCHED_LATENCY_US;
+    if (nr * SCHED_MIN_GRANULARITY_US > period) {
+        period = nr * SCHED_MIN_GRANULARITY_US;
+    }
+    
+    uint64_t weight = sched_weight(proc);
+    uint64_t slice = period * weight / (rq->fair_weight + weight);
+    return slice < SCHED_MIN_GRANULARITY_US ? SCHED_MIN_GRANULARITY_US : slice;
+}
+
+/**
+ * Queue a runnable process on a run queue (lock must be held)
+ */
+static void rq_enqueue(struct run_queue *rq, struct process *proc) {
+    if (sched_is_dl(proc)) {
+        dl_insert(rq, proc);
+        proc->run_queued = QUEUED_DL;
+    } else if (sched_is_fair(proc)) {
+        // Sleepers get at most half a period of credit, so a process
+        // that slept for long cannot monopolise the CPU when it wakes
+        uint64_t floor = rq->min_vruntime - SCHED_LATENCY_US / 2;
+        if (rq->min_vruntime < SCHED_LATENCY_US / 2) {
+            floor = 0;
+        }
+        if (vruntime_before(proc->vruntime, floor)) {
+            proc->vruntime = floor;
+        }
+        
+        rq->fair_heap[rq->fair_nr] = proc;
+        proc->run_level = rq->fair_nr;
+        rq->fair_nr++;
+        fair_sift_up(rq, proc->run_level);
+        rq->fair_weight += sched_weight(proc);
+        proc->run_queued = QUEUED_FAIR;
+    } else {
+        uint32_t level = (uint32_t)proc->priority;
+        proc->run_level = level;
+        proc->run_next = NULL;
+        proc->run_prev = rq->run_tail[level];
+        if (rq->run_tail[level]) {
+            rq->run_tail[level]->run_next = proc;
+        } else {
+            rq->run_head[level] = proc;
+        }
+        rq->run_tail[level] = proc;
+        rq->run_bitmap |= 1U << level;
+        proc->run_queued = QUEUED_RT;
+    }
+    
+    proc->rq_cpu = (int)(rq - run_queues);
+    rq->nr_queued++;
+}
+
+/**
+ * Take the next process off a run queue (lock must be held)
+ * 
+ * The earliest deadline first, then real-time processes (highest level,
+ * round-robin within it), then the fair process with the least vruntime.
+ */
+static struct process *rq_dequeue_next(struct run_queue *rq) {
+    struct process *proc;
+    do {
+        proc = NULL;
+        if (rq->dl_head) {
+            proc = rq->dl_head;
+            dl_remove(rq, proc);
+        } else if (rq->run_bitmap != 0) {
+            proc = rq->run_head[ctz64(rq->run_bitmap)];
+            run_list_remove(rq, proc);
+        } else if (rq->fair_nr > 0) {
+            proc = rq->fair_heap[0];
+            fair_remove(rq, proc);
+        }
+        // Queued before its group ran out of quota: it waits off the
+        // queue for the group's next period
+    } while (proc && rgroup_cpu_throttled(proc->rgroup));
+    return proc;
+}
+
+/**
+ * Would a newly queued process preempt what a CPU is running?
+ */
+static int rq_should_preempt(struct cpu *cpu, struct process *proc) {
+    struct process *curr = cpu->current;
+    if (!curr) {
+        return 1;                       // Idle
+    }
+    if (sched_is_dl(proc)) {
+        return !sched_is_dl(curr) || proc->dl_abs_deadline_us < curr->dl_abs_deadline_us;
+    }
+    if (sched_is_dl(curr) || sched_is_fair(proc)) {
+        return 0;                       // Left to that CPU's tick
+    }
+    return sched_is_fair(curr) || proc->priority < curr->priority;
+}
+
+/**
+ * Choose the CPU a runnable process should queue on
+ * 
+ * The CPU it last ran on if that one is idle or there is no idle CPU
+ * to use instead, otherwise any idle CPU. On first run (or after its
+ * CPU went away) the waking CPU stands in for the last one.
+ */
+static struct cpu *sched_select_cpu(struct process *proc) {
+    struct cpu *cpu = cpu_get(proc->last_cpu);
+    if (!cpu || !cpu->online) {
+        cpu = cpu_this();
+    }
+    if (!cpu->current) {
+        return cpu;
+    }
+    
+    for (int i = 0; i < MAX_CPUS; i++) {
+        struct cpu *idle = cpu_get(i);
+        if (!idle) {
+            break;
+        }
+        if (idle->online && !idle->current) {
+            return idle;
+        }
+    }
+    return cpu;
+}
+
+/**
+ * Take a process from the busiest other run queue
+ * 
+ * Its vruntime is carried over relative to the two queues' floors, so it
+ * neither jumps the queue nor loses its place.
+ */
+static struct process *sched_steal(struct run_queue *dst) {
+    struct run_queue *busiest = NULL;
+    for (int i = 0; i < MAX_CPUS; i++) {
+        struct run_queue *rq = &run_queues[i];
+        if (rq != dst && rq->nr_queued > 0 &&
+            (!busiest || rq->nr_queued > busiest->nr_queued)) {
+            busiest = rq;
+        }
+    }
+    if (!busiest) {
+        return NULL;
+    }
+    
+    spin_lock(&busiest->lock);
+    struct process *proc = rq_dequeue_next(busiest);
+    uint64_t src_min = busiest->min_vruntime;
+    spin_unlock(&busiest->lock);
+    
+    if (proc && sched_is_fair(proc)) {
+        proc->vruntime = proc->vruntime - src_min + dst->min_vruntime;
+    }
+    return proc;
 }
 
 /**
  * Initialize the scheduler
  */
 void scheduler_init(void) {
-    queue_head = 0;
-    queue_tail = 0;
-    queue_count = 0;
-    current_time_slice = TIME_SLICE;
+    for (int cpu_id = 0; cpu_id < MAX_CPUS; cpu_id++) {
+        struct run_queue *rq = &run_queues[cpu_id];
+        spin_lock_init(&rq->lock, "run_queue");
+        rq->dl_head = NULL;
+        rq->dl_nr = 0;
+        for (int i = 0; i < SCHED_RT_LEVELS; i++) {
+            rq->run_head[i] = NULL;
+            rq->run_tail[i] = NULL;
+        }
+        rq->run_bitmap = 0;
+        rq->fair_nr = 0;
+        rq->fair_weight = 0;
+        rq->min_vruntime = 0;
+        rq->nr_queued = 0;
+    }
+    
+    struct cpu *cpu = cpu_this();
+    cpu->need_resched = 0;
+    cpu->slice_us = SCHED_RR_SLICE_US;
+    
+    // The boot process is already running: start charging it now
+    struct process *current = process_current();
+    if (current) {
+        current->exec_start_us = hal_timer_get_time_us();
+        current->slice_used_us = 0;
+    }
     
     hal_uart_puts("[OK] Scheduler initialized\n");
 }
@@ -58,22 +572,34 @@ void scheduler_init(void) {
 void scheduler_enqueue(struct process *proc) {
     if (!proc) return;
     
-    lock_acquire(&sched_lock);
+    // The timer tick takes the lock too: keep it out while we hold it
+    int irq_state = interrupt_save_disable();
     
-    if (queue_count >= READY_QUEUE_SIZE) {
-        hal_uart_puts("Warning: Ready queue full!\n");
-        lock_release(&sched_lock);
+    // Queues are intrusive: a process can only be on one once. A
+    // throttled process waits for its (or its group's) timer instead.
+    if (proc->run_queued || sched_throttled(proc)) {
+        interrupt_restore(irq_state);
         return;
     }
+    if (sched_is_dl(proc)) {
+        dl_wakeup(proc, hal_timer_get_time_us());
+    }
+    // The wait for the CPU starts now; the waker shows where from
+    schedlat_wake(proc, (uintptr_t)__builtin_return_address(0));
     
-    (void)queue_count;  // Suppress unused warning - used for debugging
-    (void)queue_tail;   // Suppress unused warning - used for debugging
+    struct cpu *cpu = sched_select_cpu(proc);
+    struct run_queue *rq = &run_queues[cpu->id];
     
-    ready_queue[queue_tail] = proc;
-    queue_tail = (queue_tail + 1) % READY_QUEUE_SIZE;
-    queue_count++;
+    spin_lock(&rq->lock);
+    rq_enqueue(rq, proc);
+    int kick = rq_should_preempt(cpu, proc);
+    spin_unlock(&rq->lock);
     
-    lock_release(&sched_lock);
+    if (kick) {
+        smp_send_reschedule(cpu);
+    }
+    
+    interrupt_restore(irq_state);
 }
 
 /**
@@ -82,97 +608,394 @@ void scheduler_enqueue(struct process *proc) {
 void scheduler_dequeue(struct process *proc) {
     if (!proc) return;
     
-    lock_acquire(&sched_lock);
-    
-    // Simple linear search and removal
-    for (int i = 0; i < queue_count; i++) {
-        int idx = (queue_head + i) % READY_QUEUE_SIZE;
-        if (ready_queue[idx] == proc) {
-            // Shift remaining elements
-            for (int j = i; j < queue_count - 1; j++) {
-                int curr = (queue_head + j) % READY_QUEUE_SIZE;
-                int next = (queue_head + j + 1) % READY_QUEUE_SIZE;
-                ready_queue[curr] = ready_queue[next];
+    int irq_state = interrupt_save_disable();
+    
+    if (proc->run_queued) {
+        struct run_queue *rq = &run_queues[proc->rq_cpu];
+        spin_lock(&rq->lock);
+        if (proc->run_queued == QUEUED_FAIR) {
+            fair_remove(rq, proc);
+        } else if (proc->run_queued == QUEUED_RT) {
+            run_list_remove(rq, proc);
+        } else if (proc->run_queued == QUEUED_DL) {
+            dl_remove(rq, proc);
+        }
+        spin_unlock(&rq->lock);
+    }
+    
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Change a process's effective priority
+ */
+void scheduler_set_priority(struct process *proc, uint64_t priority) {
+    if (!proc || proc->priority == priority) return;
+    
+    int irq_state = interrupt_save_disable();
+    
+    if (proc->run_queued == QUEUED_DL) {
+        // Ordered by deadline: the priority only matters to mutexes
+        proc->priority = priority;
+    } else if (proc->run_queued) {
+        // Its place and weight depend on the priority: requeue it
+        struct run_queue *rq = &run_queues[proc->rq_cpu];
+        struct cpu *cpu = cpu_get(proc->rq_cpu);
+        
+        spin_lock(&rq->lock);
+        if (proc->run_queued == QUEUED_FAIR) {
+            fair_remove(rq, proc);
+        } else {
+            run_list_remove(rq, proc);
+        }
+        proc->priority = priority;
+        rq_enqueue(rq, proc);
+        int kick = cpu && rq_should_preempt(cpu, proc);
+        spin_unlock(&rq->lock);
+        
+        if (kick) {
+            smp_send_reschedule(cpu);
+        }
+    } else {
+        // Running or asleep: takes effect when next queued. A running
+        // process that lost priority rechecks at the next tick.
+        if (priority > proc->priority && proc == cpu_this()->current) {
+            cpu_this()->need_resched = 1;
+        }
+        proc->priority = priority;
+    }
+    
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Give a new process slot its scheduling state
+ */
+void scheduler_init_process(struct process *proc) {
+    proc->sched_policy = SCHED_NORMAL;
+    proc->dl_runtime_us = 0;
+    proc->dl_deadline_us = 0;
+    proc->dl_period_us = 0;
+    proc->dl_abs_deadline_us = 0;
+    proc->dl_budget_us = 0;
+    proc->dl_throttled = 0;
+    hrtimer_setup(&proc->dl_timer, dl_timer_fn, proc);
+}
+
+/**
+ * Change a process's scheduling policy and parameters
+ */
+int scheduler_setattr(struct process *proc, const sched_attr_t *attr) {
+    if (!proc || !attr || attr->sched_flags != 0) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    uint64_t base_priority = 0;
+    uint64_t runtime = 0, deadline = 0, period = 0;
+    uint64_t new_bw = 0;
+    switch (attr->sched_policy) {
+        case SCHED_NORMAL:
+            if (attr->sched_nice < 0 || attr->sched_nice > 19) {
+                RETURN_ERRNO(THUNDEROS_EINVAL);
+            }
+            base_priority = SCHED_RT_LEVELS + (uint64_t)attr->sched_nice;
+            break;
+        case SCHED_FIFO:
+        case SCHED_RR:
+            if (attr->sched_priority < 1 || attr->sched_priority > SCHED_RT_LEVELS) {
+                RETURN_ERRNO(THUNDEROS_EINVAL);
+            }
+            base_priority = SCHED_RT_LEVELS - attr->sched_priority;
+            break;
+        case SCHED_DEADLINE:
+            runtime = attr->sched_runtime / 1000;
+            deadline = attr->sched_deadline / 1000;
+            period = attr->sched_period ? attr->sched_period / 1000 : deadline;
+            if (runtime < SCHED_DL_MIN_RUNTIME_US || runtime > deadline ||
+                deadline > period || period > SCHED_DL_MAX_PERIOD_US) {
+                RETURN_ERRNO(THUNDEROS_EINVAL);
             }
-            queue_tail = (queue_tail - 1 + READY_QUEUE_SIZE) % READY_QUEUE_SIZE;
-            queue_count--;
+            new_bw = dl_bw(runtime, period);
             break;
+        default:
+            RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    // Admission control: the admitted deadline work must fit the CPUs
+    uint64_t old_bw = sched_is_dl(proc) ? dl_bw(proc->dl_runtime_us, proc->dl_period_us) : 0;
+    uint64_t limit = (uint64_t)cpu_online_count() *
+                     (((uint64_t)SCHED_DL_BW_LIMIT_PCT << SCHED_DL_BW_SHIFT) / 100);
+    if (dl_total_bw - old_bw + new_bw > limit) {
+        RETURN_ERRNO(THUNDEROS_EBUSY);
+    }
+    dl_total_bw = dl_total_bw - old_bw + new_bw;
+    
+    int irq_state = interrupt_save_disable();
+    
+    // Off its queue while its class changes
+    int queued_on = proc->run_queued ? proc->rq_cpu : -1;
+    if (queued_on >= 0) {
+        struct run_queue *rq = &run_queues[queued_on];
+        spin_lock(&rq->lock);
+        if (proc->run_queued == QUEUED_FAIR) {
+            fair_remove(rq, proc);
+        } else if (proc->run_queued == QUEUED_RT) {
+            run_list_remove(rq, proc);
+        } else {
+            dl_remove(rq, proc);
+        }
+        spin_unlock(&rq->lock);
+    }
+    hrtimer_cancel(&proc->dl_timer);
+    int was_throttled = proc->dl_throttled;
+    proc->dl_throttled = 0;
+    
+    proc->sched_policy = attr->sched_policy;
+    proc->dl_runtime_us = runtime;
+    proc->dl_deadline_us = deadline;
+    proc->dl_period_us = period;
+    if (proc->sched_policy == SCHED_DEADLINE) {
+        proc->dl_abs_deadline_us = hal_timer_get_time_us() + deadline;
+        proc->dl_budget_us = (int64_t)runtime;
+    }
+    
+    // Keep a mutex boost that still outranks the new priority
+    proc->base_priority = base_priority;
+    if (!proc->pi_held || proc->priority > base_priority) {
+        proc->priority = base_priority;
+    }
+    
+    if (queued_on >= 0) {
+        struct run_queue *rq = &run_queues[queued_on];
+        struct cpu *cpu = cpu_get(queued_on);
+        spin_lock(&rq->lock);
+        rq_enqueue(rq, proc);
+        int kick = cpu && rq_should_preempt(cpu, proc);
+        spin_unlock(&rq->lock);
+        if (kick) {
+            smp_send_reschedule(cpu);
+        }
+    } else if (was_throttled && proc->state == PROC_READY) {
+        // Was waiting for a budget it no longer needs
+        scheduler_enqueue(proc);
+    } else {
+        // Running: its CPU picks again with the new class
+        struct cpu *cpu = cpu_get(proc->last_cpu);
+        if (cpu && cpu->current == proc) {
+            smp_send_reschedule(cpu);
         }
     }
     
-    lock_release(&sched_lock);
+    interrupt_restore(irq_state);
+    clear_errno();
+    return 0;
 }
 
 /**
- * Get the next process to run (round-robin)
+ * Get a process's scheduling policy and parameters
  */
-struct process *scheduler_pick_next(void) {
-    lock_acquire(&sched_lock);
+void scheduler_getattr(struct process *proc, sched_attr_t *attr) {
+    kmemset(attr, 0, sizeof(*attr));
+    attr->size = sizeof(*attr);
+    attr->sched_policy = proc->sched_policy;
     
-    if (queue_count == 0) {
-        lock_release(&sched_lock);
-        return NULL;
+    if (proc->sched_policy == SCHED_DEADLINE) {
+        attr->sched_runtime = proc->dl_runtime_us * 1000;
+        attr->sched_deadline = proc->dl_deadline_us * 1000;
+        attr->sched_period = proc->dl_period_us * 1000;
+    } else if (proc->base_priority < SCHED_RT_LEVELS) {
+        attr->sched_priority = (uint32_t)(SCHED_RT_LEVELS - proc->base_priority);
+    } else {
+        uint64_t nice = proc->base_priority - SCHED_RT_LEVELS;
+        attr->sched_nice = (int32_t)(nice > 19 ? 19 : nice);
     }
+}
+
+/**
+ * Release an exiting process's deadline bandwidth
+ */
+void scheduler_exit(struct process *proc) {
+    if (!sched_is_dl(proc)) {
+        return;
+    }
+    
+    int irq_state = interrupt_save_disable();
+    hrtimer_cancel(&proc->dl_timer);
+    proc->dl_throttled = 0;
+    interrupt_restore(irq_state);
+    
+    dl_total_bw -= dl_bw(proc->dl_runtime_us, proc->dl_period_us);
+    proc->sched_policy = SCHED_NORMAL;
+}
+
+/**
+ * Get the next process to run
+ * 
+ * From this CPU's queue, or failing that stolen from the busiest other
+ * queue.
+ */
+struct process *scheduler_pick_next(void) {
+    struct cpu *cpu = cpu_this();
+    struct run_queue *rq = &run_queues[cpu->id];
     
-    struct process *proc = ready_queue[queue_head];
-    queue_head = (queue_head + 1) % READY_QUEUE_SIZE;
-    queue_count--;
+    spin_lock(&rq->lock);
+    struct process *proc = rq_dequeue_next(rq);
+    spin_unlock(&rq->lock);
     
-    lock_release(&sched_lock);
+    if (!proc) {
+        proc = sched_steal(rq);
+    }
+    
+    if (proc) {
+        spin_lock(&rq->lock);
+        if (sched_is_dl(proc)) {
+            cpu->slice_us = proc->dl_budget_us > 0 ? (uint64_t)proc->dl_budget_us : 1;
+        } else if (sched_is_fair(proc)) {
+            cpu->slice_us = fair_slice(rq, proc);
+        } else {
+            cpu->slice_us = SCHED_RR_SLICE_US;
+        }
+        
+        // No further than the group's quota goes
+        uint64_t quota_left = rgroup_cpu_remaining(proc->rgroup);
+        if (quota_left < cpu->slice_us) {
+            cpu->slice_us = quota_left > 0 ? quota_left : 1;
+        }
+        spin_unlock(&rq->lock);
+        
+        proc->exec_start_us = hal_timer_get_time_us();
+        proc->slice_used_us = 0;
+        cpu->slice_end_us = proc->exec_start_us + cpu->slice_us;
+    } else {
+        cpu->slice_end_us = UINT64_MAX;
+    }
     
     return proc;
 }
 
 /**
- * External assembly function for context switching
+ * Account elapsed time and preempt if needed
  */
-extern void context_switch_asm(struct context *old, struct context *new);
+void scheduler_tick(unsigned long ticks) {
+    struct cpu *cpu = cpu_this();
+    struct process *current = cpu->current;
+    
+    if (current && current->state == PROC_RUNNING) {
+        current->cpu_time += ticks;
+        
+        struct run_queue *rq = &run_queues[cpu->id];
+        uint64_t now = hal_timer_get_time_us();
+        spin_lock(&rq->lock);
+        update_curr(rq, current, now);
+        
+        if (rgroup_cpu_throttled(current->rgroup)) {
+            // The group's quota is spent, on this CPU or another
+            cpu->need_resched = 1;
+        } else if (sched_is_dl(current) && current->dl_budget_us <= 0) {
+            // Budget spent (the slice was the budget): wait for the next period
+            dl_throttle(current, now);
+            cpu->need_resched = 1;
+        } else if (current->slice_used_us >= cpu->slice_us) {
+            if (sched_is_fifo(current)) {
+                // No slice to run out of: keep going, and keep time
+                current->slice_used_us = 0;
+                cpu->slice_end_us = now + cpu->slice_us;
+            } else {
+                cpu->need_resched = 1;
+            }
+        } else if (sched_is_dl(current)) {
+            if (rq->dl_head && rq->dl_head->dl_abs_deadline_us < current->dl_abs_deadline_us) {
+                cpu->need_resched = 1;
+            }
+        } else if (sched_is_fair(current)) {
+            // Deadline or real-time work, or a fair process far enough
+            // behind, waits no longer than one tick
+            if (rq->dl_nr != 0 || rq->run_bitmap != 0 ||
+                (rq->fair_nr > 0 &&
+                 vruntime_before(rq->fair_heap[0]->vruntime + SCHED_WAKEUP_GRANULARITY_US,
+                                 current->vruntime))) {
+                cpu->need_resched = 1;
+            }
+        } else if (rq->dl_nr != 0 ||
+                   (rq->run_bitmap != 0 && ctz64(rq->run_bitmap) < current->priority)) {
+            cpu->need_resched = 1;
+        }
+        spin_unlock(&rq->lock);
+    }
+    
+    schedule();
+}
 
 /**
- * External function to set current process
+ * Get the time the running process's slice ends
+ */
+uint64_t scheduler_next_event_us(void) {
+    return cpu_this()->slice_end_us;
+}
+
+/**
+ * External assembly function for context switching
  */
-extern void process_set_current(struct process *proc);
+extern void context_switch_asm(struct context *old, struct context *new);
 
 /**
  * Perform a context switch from old process to new process
  * 
+ * A NULL old or new is this CPU's idle context.
+ * 
  * NOTE: This function MUST be called with interrupts disabled
  * to ensure atomic state updates and prevent race conditions.
  */
 void context_switch(struct process *old, struct process *new) {
-    if (!new) {
-        kernel_panic("context_switch: Attempting to switch to NULL process");
-    }
+    struct cpu *cpu = cpu_this();
+    
+    trace_event(TRACE_SCHED_SWITCH, old ? (uint32_t)old->pid : TRACE_PID_IDLE,
+                new ? (uint32_t)new->pid : TRACE_PID_IDLE);
+    
+    // Charge old's kernel time; old's state still says why it is leaving
+    acct_switch(old, new);
+    
+    // A woken process's wait ends here
+    schedlat_switch(old, new);
     
     // Update states (interrupts must be disabled by caller)
     if (old && old->state == PROC_RUNNING) {
         old->state = PROC_READY;
     }
-    new->state = PROC_RUNNING;
+    if (new) {
+        new->state = PROC_RUNNING;
+    }
     
     // Set current process BEFORE context switch
-    process_set_current(new);
+    cpu->current = new;
+    
+    // A process switch ends every RCU read section on this CPU
+    memory_barrier();
+    cpu->rcu_qs_seq += 2;
     
     // NOTE: Page table switch is done by the destination function
     // (forked_child_entry or after returning from context_switch_asm)
     // We can't switch page tables here because the return from switch_page_table
     // fails for forked children - the stack addresses get corrupted.
     
+    // FP registers are not callee-saved: save them if dirty, load new's
+    fpu_switch(old, new);
+    
+    // Hardware counters follow the processes counted
+    perf_switch(old, new);
+    
     // Perform low-level context switch
-    if (old) {
-        context_switch_asm(&old->context, &new->context);
-    } else {
-        context_switch_asm(NULL, &new->context);
-    }
+    context_switch_asm(old ? &old->context : &cpu->idle_context,
+                       new ? &new->context : &cpu->idle_context);
     
     // CRITICAL: After context_switch_asm returns, we're on the new stack
     // but may be using the old page table. We need to switch to the
     // current process's page table.
-    // NOTE: process_set_current(new) was called before the switch, so
-    // process_current() returns the correct (new) process.
+    // NOTE: the process may have been switched out on another CPU, so
+    // look the CPU up again rather than trusting our stack frame.
     struct process *current_after = process_current();
-    if (current_after && current_after->page_table) {
-        switch_page_table(current_after->page_table);
+    if (current_after) {
+        process_switch_page_table(current_after);
     }
 }
 
@@ -183,68 +1006,84 @@ void context_switch(struct process *old, struct process *new) {
  * 1. Timer interrupt (preemptive)
  * 2. process_yield() (voluntary)
  * 3. process_exit() (termination)
+ * 4. The idle loop, to leave it when something is runnable
  */
 void schedule(void) {
     // Disable interrupts during scheduling
     int old_state = interrupt_save_disable();
     
-    struct process *current = process_current();
+    struct cpu *cpu = cpu_this();
+    struct process *current = cpu->current;
     struct process *next = NULL;
     
-    // Decrement time slice
-    if (current_time_slice > 0) {
-        current_time_slice--;
+    // Softirqs are never switched out (they must not sleep either): a
+    // reschedule raised meanwhile waits for the next call after them
+    if (cpu->softirq_running) {
+        interrupt_restore(old_state);
+        return;
     }
     
     // Check if we should preempt current process
     int should_preempt = 0;
     
     if (!current || current->state != PROC_RUNNING) {
-        // No current process or not running (sleeping, zombie, etc.)
+        // Idle, or not running any more (sleeping, zombie, etc.)
         should_preempt = 1;
-    } else if (current_time_slice == 0) {
-        // Time slice expired
+    } else if (cpu->need_resched) {
+        // Slice used up, yielded, or a more deserving process is waiting
         should_preempt = 1;
-        current_time_slice = TIME_SLICE;
     }
     
     if (should_preempt) {
-        // Pick next process
-        next = scheduler_pick_next();
+        cpu->need_resched = 0;
         
-        if (!next) {
-            // No process to run, use current if available
-            if (current && current->state == PROC_RUNNING) {
-                next = current;
-            } else {
-                // Idle - no process to run
-                // If current process is not running (zombie, etc.), switch back to kernel page table
-                if (current && current->state != PROC_RUNNING) {
-                    extern void switch_to_kernel_page_table(void);
-                    switch_to_kernel_page_table();
-                    process_set_current(NULL);
-                }
-                // Re-enable interrupts and halt
-                interrupt_restore(old_state);
-                return;
+        // Charge the outgoing process, then let it compete with the rest
+        // of this CPU's queue
+        if (current) {
+            struct run_queue *rq = this_rq();
+            uint64_t now = hal_timer_get_time_us();
+            spin_lock(&rq->lock);
+            update_curr(rq, current, now);
+            if (sched_is_dl(current) && current->dl_budget_us <= 0 && !current->dl_throttled) {
+                dl_throttle(current, now);
+            }
+            if (current->state == PROC_RUNNING && !current->run_queued && !sched_throttled(current)) {
+                rq_enqueue(rq, current);
             }
+            spin_unlock(&rq->lock);
         }
         
-        // Add current process back to ready queue if still ready
-        if (current && current->state == PROC_RUNNING && current != next) {
-            scheduler_enqueue(current);
-        }
+        // Pick next process (may be current again)
+        next = scheduler_pick_next();
         
-        // Switch to next process
-        if (next != current) {
-            context_switch(current, next);
-            // After context_switch returns, we're on the resumed process's stack.
-            // Local variable 'old_state' now points to the new process's stack frame
-            // which contains garbage or the wrong value.
-            // We must enable interrupts and return WITHOUT using old_state.
-            interrupt_restore(INTERRUPTS_ENABLED);  // Always enable interrupts after context switch
+        // Time the new slice (or stop the tick if going idle)
+        hrtimer_reprogram();
+        
+        if (next == current) {
+            // Still idle, or picked again (possibly woken before it got
+            // switched out)
+            if (current) {
+                current->state = PROC_RUNNING;
+                schedlat_ran(current);
+            }
+            interrupt_restore(old_state);
             return;
         }
+        
+        if (!next) {
+            // Idle - leave the process's page table, which may be freed
+            // by its parent on another CPU once this one is a zombie
+            switch_to_kernel_page_table();
+        }
+        
+        // Switch to next process (or the idle context)
+        context_switch(current, next);
+        // After context_switch returns, we're on the resumed process's stack.
+        // Local variable 'old_state' now points to the new process's stack frame
+        // which contains garbage or the wrong value.
+        // We must enable interrupts and return WITHOUT using old_state.
+        interrupt_restore(INTERRUPTS_ENABLED);  // Always enable interrupts after context switch
+        return;
     }
     
     // Restore interrupt state (only reached if no context switch happened)
@@ -259,11 +1098,54 @@ void schedule(void) {
  * and when waiting for child processes.
  */
 void scheduler_yield(void) {
-    // Reset time slice to force scheduling
-    current_time_slice = 0;
+    // Give up the rest of the slice
+    cpu_this()->need_resched = 1;
     
     // Call scheduler
     schedule();
+    
+    // Let other CPUs into the kernel too
+    bkl_relax();
+}
+
+/**
+ * Handle a reschedule IPI from another CPU
+ */
+void scheduler_ipi(void) {
+    // Work was queued for us: look at it now rather than at the next tick
+    cpu_this()->need_resched = 1;
+    schedule();
+}
+
+/**
+ * Idle loop
+ * 
+ * Entered with the big kernel lock held and interrupts disabled. Each
+ * pass runs leftover softirqs, pre-zeroes some pages and runs anything
+ * runnable; with nothing
+ * left it drops the lock and sleeps until an interrupt (the timer),
+ * whose handler may schedule a woken process in.
+ */
+void scheduler_idle_loop(void) {
+    for (;;) {
+        // Deferred interrupt work left over from the last trap
+        do_softirq();
+        
+        // Spend idle time pre-zeroing pages for later faults
+        pmm_zero_pool_refill(PMM_ZERO_POOL_IDLE_BATCH);
+        
+        // Returns once we are back on the idle context with nothing to run
+        schedule();
+        
+        interrupt_disable();
+        bkl_release();
+        __asm__ volatile("wfi");
+        
+        // Take the interrupt that woke us; its handler locks for itself
+        interrupt_enable();
+        interrupt_disable();
+        bkl_acquire();
+    }
 }
 
 /**
@@ -273,3 +1155,24 @@ struct trap_frame *process_get_current_trap_frame(void) {
     struct process *proc = process_current();
     return proc ? proc->trap_frame : NULL;
 }
+
+/**
+ * Get a CPU's run queue lengths
+ */
+int scheduler_get_rq_stats(int cpu, sched_rq_stats_t *stats) {
+    if (!stats || !cpu_get(cpu)) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    struct run_queue *rq = &run_queues[cpu];
+    int irq_state = spin_lock_irqsave(&rq->lock);
+    stats->dl_queued = rq->dl_nr;
+    stats->fair_queued = rq->fair_nr;
+    stats->rt_queued = rq->nr_queued - rq->fair_nr - rq->dl_nr;
+    stats->fair_weight = rq->fair_weight;
+    stats->min_vruntime = rq->min_vruntime;
+    spin_unlock_irqrestore(&rq->lock, irq_state);
+    
+    clear_errno();
+    return 0;
+}
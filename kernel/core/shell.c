@@ -91,6 +91,18 @@ static void shell_echo(int argument_count, char **argument_vector) {
     hal_uart_puts("\n");
 }
 
+/**
+ * Print one directory entry for ls
+ */
+static int shell_ls_entry(void *ctx, const char *name, uint32_t name_len, uint32_t inode) {
+    (void)ctx;
+    (void)name_len;
+    (void)inode;
+    hal_uart_puts(name);
+    hal_uart_puts("\n");
+    return 0;
+}
+
 /**
  * List directory contents
  * 
@@ -113,19 +125,16 @@ static void shell_ls(int argument_count, char **argument_vector) {
         hal_uart_puts("ls: '");
         hal_uart_puts(directory_path);
         hal_uart_puts("': Not a directory\n");
+        vfs_node_put(directory_node);
         return;
     }
     
-    /* List directory entries */
-    char entry_name[MAX_NAME_LEN];
-    uint32_t entry_inode = 0;
-    uint32_t entry_index = 0;
-    
-    while (directory_node->ops->readdir(directory_node, entry_index, entry_name, &entry_inode) == 0) {
-        hal_uart_puts(entry_name);
-        hal_uart_puts("\n");
-        entry_index++;
+    /* List directory entries in one pass */
+    uint32_t position = 0;
+    if (directory_node->ops->iterate) {
+        directory_node->ops->iterate(directory_node, &position, shell_ls_entry, NULL);
     }
+    vfs_node_put(directory_node);
 }
 
 /**
@@ -0,0 +1,259 @@
+/**
+ * @file shm.c
+ * @brief Named shared memory objects
+ *
+ * Objects sit on one list, looked up by name under the big kernel lock.
+ * The page array is also read from the page fault handler, so pages are
+ * installed in it with interrupts disabled, as in the page cache; the
+ * zeroed page is allocated beforehand and dropped if another fault got
+ * there first.
+ */
+
+#include "kernel/shm.h"
+#include "kernel/kstring.h"
+#include "kernel/errno.h"
+#include "fs/vfs.h"
+#include "arch/interrupt.h"
+#include "mm/pmm.h"
+#include "mm/page.h"
+#include "mm/kmalloc.h"
+
+struct shm_object {
+    char name[SHM_NAME_MAX];        /* Name, while linked */
+    uintptr_t *pages;               /* One slot per page of size (0: not touched) */
+    uint64_t nr_pages;              /* Slots in pages */
+    uint64_t size;                  /* Size in bytes */
+    int refs;                       /* Descriptors and mappings */
+    int linked;                     /* Still on the name list */
+    struct shm_object *next;        /* Name list */
+};
+
+static shm_object_t *g_shm_objects = NULL;
+
+/**
+ * Check a name: '/' then at least one character, no more slashes
+ */
+static int shm_name_valid(const char *name) {
+    if (!name || name[0] != '/' || name[1] == '\0') {
+        return 0;
+    }
+    size_t len = 1;
+    while (name[len]) {
+        if (name[len] == '/' || len >= SHM_NAME_MAX - 1) {
+            return 0;
+        }
+        len++;
+    }
+    return 1;
+}
+
+static int shm_name_equal(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static shm_object_t *shm_lookup(const char *name) {
+    for (shm_object_t *shm = g_shm_objects; shm; shm = shm->next) {
+        if (shm_name_equal(shm->name, name)) {
+            return shm;
+        }
+    }
+    return NULL;
+}
+
+static void shm_unlink_object(shm_object_t *shm) {
+    for (shm_object_t **link = &g_shm_objects; *link; link = &(*link)->next) {
+        if (*link == shm) {
+            *link = shm->next;
+            break;
+        }
+    }
+    shm->linked = 0;
+}
+
+static void shm_free(shm_object_t *shm) {
+    for (uint64_t i = 0; i < shm->nr_pages; i++) {
+        if (shm->pages[i]) {
+            put_page(shm->pages[i]);
+        }
+    }
+    if (shm->pages) {
+        kfree(shm->pages);
+    }
+    kfree(shm);
+}
+
+int shm_open(const char *name, uint32_t flags) {
+    if (!shm_name_valid(name) || (flags & O_WRONLY)) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    shm_object_t *shm = shm_lookup(name);
+    if (shm) {
+        if ((flags & O_CREAT) && (flags & O_EXCL)) {
+            RETURN_ERRNO(THUNDEROS_EEXIST);
+        }
+        shm_get(shm);
+    } else {
+        if (!(flags & O_CREAT)) {
+            RETURN_ERRNO(THUNDEROS_ENOENT);
+        }
+        shm = kmalloc(sizeof(shm_object_t));
+        if (!shm) {
+            RETURN_ERRNO(THUNDEROS_ENOMEM);
+        }
+        kstrcpy(shm->name, name);
+        shm->pages = NULL;
+        shm->nr_pages = 0;
+        shm->size = 0;
+        shm->refs = 1;
+        shm->linked = 1;
+        shm->next = g_shm_objects;
+        g_shm_objects = shm;
+    }
+
+    if ((flags & O_TRUNC) && (flags & O_RDWR)) {
+        shm_truncate(shm, 0);
+    }
+
+    // The descriptor takes over our reference
+    int fd = vfs_open_shm(shm, flags & (O_RDWR | O_NONBLOCK));
+    if (fd < 0) {
+        shm_put(shm);
+        /* errno already set by vfs_open_shm */
+        return -1;
+    }
+
+    clear_errno();
+    return fd;
+}
+
+int shm_unlink(const char *name) {
+    if (!shm_name_valid(name)) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    shm_object_t *shm = shm_lookup(name);
+    if (!shm) {
+        RETURN_ERRNO(THUNDEROS_ENOENT);
+    }
+
+    shm_unlink_object(shm);
+    if (shm->refs == 0) {
+        shm_free(shm);
+    }
+
+    clear_errno();
+    return 0;
+}
+
+int shm_truncate(shm_object_t *shm, uint64_t size) {
+    if (size > SHM_MAX_SIZE) {
+        RETURN_ERRNO(THUNDEROS_EFBIG);
+    }
+
+    uint64_t nr_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uintptr_t *pages = NULL;
+    if (nr_pages > 0) {
+        pages = kmalloc(nr_pages * sizeof(uintptr_t));
+        if (!pages) {
+            RETURN_ERRNO(THUNDEROS_ENOMEM);
+        }
+    }
+
+    int irq_state = interrupt_save_disable();
+    uintptr_t *old_pages = shm->pages;
+    uint64_t old_nr = shm->nr_pages;
+    for (uint64_t i = 0; i < nr_pages; i++) {
+        pages[i] = i < old_nr ? old_pages[i] : 0;
+    }
+    shm->pages = pages;
+    shm->nr_pages = nr_pages;
+    shm->size = size;
+    interrupt_restore(irq_state);
+
+    // Pages cut off now belong only to whoever still maps them
+    for (uint64_t i = nr_pages; i < old_nr; i++) {
+        if (old_pages[i]) {
+            put_page(old_pages[i]);
+        }
+    }
+
+    // A shrink may leave stale data behind the new end of the last page
+    if (nr_pages > 0 && (size & (PAGE_SIZE - 1)) && pages[nr_pages - 1]) {
+        uint64_t tail = size & (PAGE_SIZE - 1);
+        kmemset((void *)(pages[nr_pages - 1] + tail), 0, PAGE_SIZE - tail);
+    }
+
+    if (old_pages) {
+        kfree(old_pages);
+    }
+
+    clear_errno();
+    return 0;
+}
+
+uint64_t shm_size(shm_object_t *shm) {
+    return shm->size;
+}
+
+uintptr_t shm_get_page(shm_object_t *shm, uint64_t index) {
+    int irq_state = interrupt_save_disable();
+    if (index >= shm->nr_pages) {
+        interrupt_restore(irq_state);
+        set_errno(THUNDEROS_EFAULT);
+        return 0;
+    }
+    uintptr_t page = shm->pages[index];
+    if (page) {
+        get_page(page);
+        interrupt_restore(irq_state);
+        clear_errno();
+        return page;
+    }
+    interrupt_restore(irq_state);
+
+    uintptr_t fresh = pmm_alloc_zeroed_page();
+    if (!fresh) {
+        set_errno(THUNDEROS_ENOMEM);
+        return 0;
+    }
+
+    irq_state = interrupt_save_disable();
+    if (index >= shm->nr_pages) {
+        // Truncated while we were allocating
+        interrupt_restore(irq_state);
+        put_page(fresh);
+        set_errno(THUNDEROS_EFAULT);
+        return 0;
+    }
+    page = shm->pages[index];
+    if (!page) {
+        // The object keeps the allocation's reference
+        shm->pages[index] = fresh;
+        page = fresh;
+        fresh = 0;
+    }
+    get_page(page);
+    interrupt_restore(irq_state);
+
+    if (fresh) {
+        put_page(fresh);
+    }
+    clear_errno();
+    return page;
+}
+
+void shm_get(shm_object_t *shm) {
+    shm->refs++;
+}
+
+void shm_put(shm_object_t *shm) {
+    if (--shm->refs > 0 || shm->linked) {
+        return;
+    }
+    shm_free(shm);
+}
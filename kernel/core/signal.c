@@ -7,11 +7,15 @@
 #include "kernel/errno.h"
 #include "kernel/constants.h"
 #include "kernel/kstring.h"
+#include "kernel/signalfd.h"
 #include "hal/hal_uart.h"
+#include "arch/interrupt.h"
+#include "mm/kmalloc.h"
 
 // External process functions
 extern struct process *process_current(void);
 extern void process_exit(int exit_code);
+extern void process_exit_group(int exit_code);
 
 /**
  * Initialize signal subsystem for a process
@@ -89,10 +93,55 @@ sighandler_t signal_default_action(int signum) {
  * @return 0 on success, -1 on error (sets errno)
  */
 int signal_send(struct process *proc, int signum) {
+    struct process *sender = process_current();
+    ksiginfo_t info;
+    
+    info.si_signo = signum;
+    info.si_code = SI_USER;
+    info.si_pid = sender ? sender->pid : 0;
+    info.si_uid = sender ? sender->uid : 0;
+    info.si_value = 0;
+    return signal_send_info(proc, &info);
+}
+
+/**
+ * Queue a real-time signal occurrence (interrupts disabled)
+ */
+static int signal_enqueue(struct process *proc, const ksiginfo_t *info) {
+    if (!proc->sigqueue) {
+        proc->sigqueue = kmalloc(sizeof(sigqueue_t));
+        if (!proc->sigqueue) {
+            RETURN_ERRNO(THUNDEROS_ENOMEM);
+        }
+        proc->sigqueue->count = 0;
+    }
+    
+    sigqueue_t *queue = proc->sigqueue;
+    if (queue->count >= SIGQUEUE_MAX) {
+        RETURN_ERRNO(THUNDEROS_EAGAIN);
+    }
+    queue->info[queue->count++] = *info;
+    return 0;
+}
+
+/**
+ * Send a signal with its details
+ * 
+ * @param proc Target process (must not be NULL)
+ * @param info Signal number and details
+ * @return 0 on success, -1 on error (sets errno)
+ */
+int signal_send_info(struct process *proc, const ksiginfo_t *info) {
+    int signum = info ? info->si_signo : 0;
     if (!proc || signum <= 0 || signum >= NSIG) {
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
     
+    // A process whose first thread exited is signalled through another
+    if (proc->state == PROC_ZOMBIE && proc->group_leader == proc && proc->threads) {
+        proc = proc->threads;
+    }
+    
     // Can't send signals to UNUSED or ZOMBIE processes
     if (proc->state == PROC_UNUSED || proc->state == PROC_ZOMBIE) {
         RETURN_ERRNO(THUNDEROS_ESRCH);
@@ -107,8 +156,17 @@ int signal_send(struct process *proc, int signum) {
         return 0;
     }
     
+    // Real-time signals keep every occurrence; standard ones coalesce
+    int irq_state = interrupt_save_disable();
+    if (signum >= SIGRTMIN && signal_enqueue(proc, info) != 0) {
+        interrupt_restore(irq_state);
+        /* errno already set by signal_enqueue */
+        return -1;
+    }
+    
     // Add signal to pending set
     proc->pending_signals |= (1UL << signum);
+    interrupt_restore(irq_state);
     
     // Wake up the process if it's sleeping (for most signals)
     if (proc->state == PROC_SLEEPING && signum != SIGCONT) {
@@ -116,10 +174,115 @@ int signal_send(struct process *proc, int signum) {
         process_wakeup(proc);
     }
     
+    // And anyone waiting on a signalfd
+    signalfd_notify();
+    
     clear_errno();
     return 0;
 }
 
+/**
+ * Take the lowest pending signal in mask off a process
+ */
+int signal_dequeue(struct process *proc, sigset_t mask, ksiginfo_t *info) {
+    if (!proc) {
+        return 0;
+    }
+    
+    int irq_state = interrupt_save_disable();
+    sigset_t ready = proc->pending_signals & mask;
+    if (!ready) {
+        interrupt_restore(irq_state);
+        return 0;
+    }
+    
+    int signum = 1;
+    while (!(ready & (1UL << signum))) {
+        signum++;
+    }
+    
+    // Standard signals carry nothing beyond their number
+    info->si_signo = signum;
+    info->si_code = SI_USER;
+    info->si_pid = 0;
+    info->si_uid = 0;
+    info->si_value = 0;
+    
+    int more = 0;
+    sigqueue_t *queue = proc->sigqueue;
+    if (signum >= SIGRTMIN && queue) {
+        // Oldest occurrence first; the signal stays pending while others wait
+        int found = -1;
+        for (int i = 0; i < queue->count; i++) {
+            if (queue->info[i].si_signo != signum) {
+                continue;
+            }
+            if (found < 0) {
+                found = i;
+            } else {
+                more = 1;
+                break;
+            }
+        }
+        if (found >= 0) {
+            *info = queue->info[found];
+            for (int i = found; i < queue->count - 1; i++) {
+                queue->info[i] = queue->info[i + 1];
+            }
+            queue->count--;
+        }
+    }
+    if (!more) {
+        proc->pending_signals &= ~(1UL << signum);
+    }
+    interrupt_restore(irq_state);
+    
+    return signum;
+}
+
+/**
+ * Change the blocked signals of a process
+ */
+int signal_procmask(struct process *proc, int how, sigset_t set, sigset_t *oldset) {
+    if (!proc) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    sigset_t blocked = proc->blocked_signals;
+    switch (how) {
+        case SIG_BLOCK:
+            blocked |= set;
+            break;
+        case SIG_UNBLOCK:
+            blocked &= ~set;
+            break;
+        case SIG_SETMASK:
+            blocked = set;
+            break;
+        default:
+            RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    if (oldset) {
+        *oldset = proc->blocked_signals;
+    }
+    proc->blocked_signals = blocked & ~SIG_UNBLOCKABLE;
+    
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Free what a dying process still has queued
+ */
+void signal_release_process(struct process *proc) {
+    if (!proc || !proc->sigqueue) {
+        return;
+    }
+    kfree(proc->sigqueue);
+    proc->sigqueue = NULL;
+}
+
 /**
  * Check if signal is pending
  */
@@ -147,7 +310,13 @@ sighandler_t signal_set_handler(struct process *proc, int signum, sighandler_t h
     }
     
     sighandler_t old_handler = proc->signal_handlers[signum];
-    proc->signal_handlers[signum] = handler;
+    
+    // Threads share their handlers (CLONE_SIGHAND): keep every copy in step
+    struct process *leader = proc->group_leader;
+    leader->signal_handlers[signum] = handler;
+    for (struct process *thread = leader->threads; thread; thread = thread->thread_link.next) {
+        thread->signal_handlers[signum] = handler;
+    }
     
     clear_errno();
     return old_handler;
@@ -156,12 +325,14 @@ sighandler_t signal_set_handler(struct process *proc, int signum, sighandler_t h
 /**
  * Default signal handler: terminate process
  * 
+ * Takes every thread of the process with it.
+ * 
  * @param proc Process to terminate (unused, uses current process)
  */
 void signal_default_term(struct process *proc) {
-    (void)proc;  // Unused - process_exit operates on current process
+    (void)proc;  // Unused - process_exit_group operates on current process
     // Terminate the process with signal exit code
-    process_exit(SIGNAL_EXIT_BASE);  // Exit with signal indicator
+    process_exit_group(SIGNAL_EXIT_BASE);  // Exit with signal indicator
 }
 
 /**
@@ -196,10 +367,7 @@ void signal_default_stop(struct process *proc) {
     if (proc->parent) {
         signal_send(proc->parent, SIGCHLD);
         // Wake parent if it's waiting
-        if (proc->parent->state == PROC_SLEEPING) {
-            extern void process_wakeup(struct process *p);
-            process_wakeup(proc->parent);
-        }
+        wait_queue_wake(&proc->parent->child_wait);
     }
 }
 
@@ -269,9 +437,17 @@ void signal_handle(struct process *proc, int signum) {
                 break;
                 
             case SIGCHLD:
-            default:
                 signal_default_ignore(proc);
                 break;
+                
+            default:
+                // Real-time signals terminate, like the standard ones
+                if (signum >= SIGRTMIN) {
+                    signal_default_term(proc);
+                } else {
+                    signal_default_ignore(proc);
+                }
+                break;
         }
     } else if (handler == SIG_IGN) {
         // Ignore the signal
@@ -333,9 +509,17 @@ void signal_handle_with_frame(struct process *proc, int signum, struct trap_fram
                 break;
                 
             case SIGCHLD:
-            default:
                 signal_default_ignore(proc);
                 break;
+                
+            default:
+                // Real-time signals terminate, like the standard ones
+                if (signum >= SIGRTMIN) {
+                    signal_default_term(proc);
+                } else {
+                    signal_default_ignore(proc);
+                }
+                break;
         }
     } else if (handler == SIG_IGN) {
         // Ignore the signal
@@ -358,6 +542,31 @@ void signal_handle_with_frame(struct process *proc, int signum, struct trap_fram
 }
 
 
+/**
+ * Deliver the lowest unblocked pending signal, if any
+ * 
+ * Only one signal is delivered at a time (the handler might have changed
+ * the process state).
+ * 
+ * @param proc Process to check for signals
+ * @param trap_frame Trap frame to modify for handler execution (can be NULL)
+ */
+static void signal_deliver_one(struct process *proc, struct trap_frame *trap_frame) {
+    ksiginfo_t info;
+    int signum = signal_dequeue(proc, ~proc->blocked_signals, &info);
+    if (!signum) {
+        return;  // No signals to deliver
+    }
+    
+    signal_handle_with_frame(proc, signum, trap_frame);
+    
+    // User handlers get the sigqueue() value as their second argument
+    sighandler_t handler = proc->signal_handlers[signum];
+    if (trap_frame && handler != SIG_DFL && handler != SIG_IGN) {
+        trap_frame->a1 = (unsigned long)info.si_value;
+    }
+}
+
 /**
  * Deliver pending signals to a process with trap frame
  * 
@@ -373,27 +582,7 @@ void signal_deliver_with_frame(struct process *proc, struct trap_frame *trap_fra
         return;
     }
     
-    // Get unblocked pending signals
-    sigset_t deliverable = proc->pending_signals & ~proc->blocked_signals;
-    
-    if (!deliverable) {
-        return;  // No signals to deliver
-    }
-    
-    // Deliver signals in order (lowest number first)
-    for (int signum = 1; signum < NSIG; signum++) {
-        if (deliverable & (1UL << signum)) {
-            // Clear the pending bit
-            proc->pending_signals &= ~(1UL << signum);
-            
-            // Handle the signal with the trap frame
-            signal_handle_with_frame(proc, signum, trap_frame);
-            
-            // Only deliver one signal at a time
-            // (the handler might have changed the process state)
-            break;
-        }
-    }
+    signal_deliver_one(proc, trap_frame);
 }
 
 /**
@@ -409,25 +598,5 @@ void signal_deliver(struct process *proc) {
         return;
     }
     
-    // Get unblocked pending signals
-    sigset_t deliverable = proc->pending_signals & ~proc->blocked_signals;
-    
-    if (!deliverable) {
-        return;  // No signals to deliver
-    }
-    
-    // Deliver signals in order (lowest number first)
-    for (int signum = 1; signum < NSIG; signum++) {
-        if (deliverable & (1UL << signum)) {
-            // Clear the pending bit
-            proc->pending_signals &= ~(1UL << signum);
-            
-            // Handle the signal (without trap frame - will use proc->trap_frame)
-            signal_handle_with_frame(proc, signum, proc->trap_frame);
-            
-            // Only deliver one signal at a time
-            // (the handler might have changed the process state)
-            break;
-        }
-    }
+    signal_deliver_one(proc, proc->trap_frame);
 }
@@ -0,0 +1,129 @@
+/**
+ * @file signalfd.c
+ * @brief signalfd contexts
+ *
+ * A context only holds the signal set; the signals themselves stay in
+ * the reading process's pending mask and real-time queue, and are taken
+ * off with signal_dequeue(), exactly as delivery would take them.
+ */
+
+#include "kernel/signalfd.h"
+#include "kernel/signal.h"
+#include "kernel/kstring.h"
+#include "kernel/errno.h"
+#include "mm/kmalloc.h"
+
+struct signalfd {
+    sigset_t mask;                  /* Signals this descriptor reads */
+    int refs;                       /* Descriptors */
+};
+
+/* Woken on every signal sent; see signalfd.h */
+static wait_queue_t g_signalfd_wq = WAIT_QUEUE_INIT;
+
+signalfd_t *signalfd_create(sigset_t mask) {
+    signalfd_t *sfd = kmalloc(sizeof(signalfd_t));
+    if (!sfd) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+    sfd->mask = mask & ~SIG_UNBLOCKABLE;
+    sfd->refs = 1;
+    clear_errno();
+    return sfd;
+}
+
+void signalfd_set_mask(signalfd_t *sfd, sigset_t mask) {
+    sfd->mask = mask & ~SIG_UNBLOCKABLE;
+    // A reader asleep on the old set may have something to read now
+    signalfd_notify();
+}
+
+void signalfd_get(signalfd_t *sfd) {
+    sfd->refs++;
+}
+
+void signalfd_put(signalfd_t *sfd) {
+    if (--sfd->refs > 0) {
+        return;
+    }
+    kfree(sfd);
+}
+
+/**
+ * Move pending signals of the current process into records
+ *
+ * @return Records filled in
+ */
+static int signalfd_harvest(signalfd_t *sfd, struct signalfd_siginfo *out, int max) {
+    struct process *proc = process_current();
+    int n = 0;
+
+    while (n < max) {
+        ksiginfo_t info;
+        if (!signal_dequeue(proc, sfd->mask, &info)) {
+            break;
+        }
+
+        struct signalfd_siginfo *rec = &out[n++];
+        kmemset(rec, 0, sizeof(*rec));
+        rec->ssi_signo = (uint32_t)info.si_signo;
+        rec->ssi_code = info.si_code;
+        rec->ssi_pid = (uint32_t)info.si_pid;
+        rec->ssi_uid = (uint32_t)info.si_uid;
+        rec->ssi_int = (int32_t)info.si_value;
+        rec->ssi_ptr = (uint64_t)info.si_value;
+    }
+    return n;
+}
+
+int signalfd_read(signalfd_t *sfd, void *buffer, uint32_t size, int nonblock) {
+    int max = (int)(size / sizeof(struct signalfd_siginfo));
+    if (max == 0) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    wait_queue_entry_t entry;
+    poll_waiter_t pw;
+    poll_waiter_init(&pw, &entry, 1);
+    poll_wait(&pw.pt, &g_signalfd_wq);
+
+    int n;
+    int error = 0;
+    for (;;) {
+        n = signalfd_harvest(sfd, (struct signalfd_siginfo *)buffer, max);
+        if (n > 0) {
+            break;
+        }
+        if (nonblock) {
+            error = THUNDEROS_EAGAIN;
+            break;
+        }
+        if (poll_signal_pending()) {
+            error = THUNDEROS_EINTR;
+            break;
+        }
+        poll_waiter_sleep(&pw, 0);
+    }
+
+    poll_waiter_release(&pw);
+
+    if (error) {
+        RETURN_ERRNO(error);
+    }
+    clear_errno();
+    return n * (int)sizeof(struct signalfd_siginfo);
+}
+
+int signalfd_poll(signalfd_t *sfd, poll_table_t *pt) {
+    poll_wait(pt, &g_signalfd_wq);
+
+    struct process *proc = process_current();
+    if (proc && (proc->pending_signals & sfd->mask)) {
+        return POLLIN;
+    }
+    return 0;
+}
+
+void signalfd_notify(void) {
+    wait_queue_wake(&g_signalfd_wq);
+}
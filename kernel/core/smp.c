@@ -0,0 +1,282 @@
+/*
+ * SMP Implementation
+ *
+ * CPU 0 is the boot hart; the other harts listed in the device tree are
+ * numbered after it. Each is started through sbi_hart_start() once the
+ * kernel is initialised, enables paging and its own timer, and then sits
+ * in the scheduler's idle loop on its own stack like CPU 0 does whenever
+ * it has nothing to run.
+ *
+ * Reschedule IPIs go through the CLINT: only M-mode can take its software
+ * interrupt, so mtrap_vector in boot/entry.S forwards it to S-mode as a
+ * supervisor software interrupt.
+ *
+ * The big kernel lock is a ticket spinlock, so a CPU waiting to enter
+ * the kernel is served in order and cannot be starved by one that keeps
+ * re-entering.
+ */
+
+#include "kernel/smp.h"
+#include "kernel/scheduler.h"
+#include "kernel/fdt.h"
+#include "kernel/kstring.h"
+#include "kernel/spinlock.h"
+#include "kernel/constants.h"
+#include "mm/paging.h"
+#include "hal/hal_uart.h"
+#include "hal/hal_timer.h"
+#include "arch/sbi.h"
+#include "arch/clint.h"
+#include "arch/interrupt.h"
+#include "arch/barrier.h"
+#include <stddef.h>
+
+_Static_assert(offsetof(struct cpu, kernel_sp) == CPU_KERNEL_SP, "CPU_KERNEL_SP out of date");
+_Static_assert(offsetof(struct cpu, user_sp) == CPU_USER_SP, "CPU_USER_SP out of date");
+_Static_assert(offsetof(struct cpu, idle_sp) == CPU_IDLE_SP, "CPU_IDLE_SP out of date");
+_Static_assert(offsetof(struct cpu, overflow_sp) == CPU_OVERFLOW_SP, "CPU_OVERFLOW_SP out of date");
+_Static_assert(offsetof(struct cpu, trap_scratch) == CPU_TRAP_SCRATCH, "CPU_TRAP_SCRATCH out of date");
+
+// How long the boot CPU waits for a started hart to report in
+#define SMP_BOOT_TIMEOUT_US 100000
+
+static struct cpu cpus[MAX_CPUS];
+static int cpu_count = 1;               // CPUs described (the boot hart at least)
+
+static uint8_t idle_stacks[MAX_CPUS][CPU_IDLE_STACK_SIZE] __attribute__((aligned(16)));
+static uint8_t overflow_stacks[MAX_CPUS][CPU_OVERFLOW_STACK_SIZE] __attribute__((aligned(16)));
+
+// Big kernel lock
+static spinlock_t bkl = SPINLOCK_INIT;
+static volatile int bkl_owner = -1;     // CPU holding it (-1 = free)
+
+// S-mode entry point of secondary harts (boot/boot.S)
+extern void _start_secondary(void);
+
+/**
+ * Initialise one CPU's state
+ */
+static void cpu_setup(struct cpu *cpu, int id, unsigned long hartid) {
+    kmemset(cpu, 0, sizeof(*cpu));
+    cpu->id = id;
+    cpu->hartid = hartid;
+    cpu->idle_sp = (uint64_t)(uintptr_t)(idle_stacks[id] + CPU_IDLE_STACK_SIZE);
+    cpu->overflow_sp = (uint64_t)(uintptr_t)(overflow_stacks[id] + CPU_OVERFLOW_STACK_SIZE);
+    cpu->slice_end_us = UINT64_MAX;
+
+    // The first switch to the idle context starts the idle loop afresh
+    // (a secondary hart is already in it by then and saves over this)
+    cpu->idle_context.ra = (unsigned long)scheduler_idle_loop;
+    cpu->idle_context.sp = cpu->idle_sp;
+}
+
+/**
+ * Get a CPU by logical number
+ */
+struct cpu *cpu_get(int id) {
+    if (id < 0 || id >= cpu_count) {
+        return NULL;
+    }
+    return &cpus[id];
+}
+
+/**
+ * Get the number of CPUs running kernel code
+ */
+int cpu_online_count(void) {
+    int online = 0;
+    for (int i = 0; i < cpu_count; i++) {
+        if (cpus[i].online) {
+            online++;
+        }
+    }
+    return online;
+}
+
+/**
+ * Set up per-CPU state on the boot hart
+ */
+void smp_init(void) {
+    // start.c left the hart ID in tp
+    unsigned long boot_hartid;
+    asm volatile("mv %0, tp" : "=r"(boot_hartid));
+
+    cpu_setup(&cpus[0], 0, boot_hartid);
+    cpu_count = 1;
+
+    // Harts past MAX_CPUS have no start mailbox and stay parked
+    unsigned long hartids[MAX_CPUS];
+    int nr_harts = fdt_get_cpus(boot_fdt_addr, hartids, MAX_CPUS);
+    for (int i = 0; i < nr_harts; i++) {
+        if (hartids[i] == boot_hartid || hartids[i] >= MAX_CPUS) {
+            continue;
+        }
+        cpu_setup(&cpus[cpu_count], cpu_count, hartids[i]);
+        cpu_count++;
+    }
+
+    cpus[0].online = 1;
+    asm volatile("mv tp, %0" :: "r"(&cpus[0]));
+
+    spin_lock_init(&bkl, "bkl");
+
+    // Boot runs as one kernel entry, until init first sleeps
+    bkl_acquire();
+
+    hal_uart_puts("[OK] SMP: ");
+    kprint_dec(cpu_count);
+    hal_uart_puts(cpu_count == 1 ? " CPU\n" : " CPUs\n");
+}
+
+/**
+ * Start every other hart described by the device tree
+ */
+void smp_boot_secondaries(void) {
+    for (int i = 1; i < cpu_count; i++) {
+        struct cpu *cpu = &cpus[i];
+
+        long err = sbi_hart_start(cpu->hartid, (unsigned long)_start_secondary,
+                                  (unsigned long)cpu);
+        if (err != SBI_SUCCESS) {
+            hal_uart_puts("[WARN] SMP: cannot start hart ");
+            kprint_dec(cpu->hartid);
+            hal_uart_puts("\n");
+            continue;
+        }
+
+        // It reports in before taking the BKL, which we hold
+        uint64_t deadline = hal_timer_get_time_us() + SMP_BOOT_TIMEOUT_US;
+        while (!cpu->online && hal_timer_get_time_us() < deadline) {
+            // Spin
+        }
+        if (!cpu->online) {
+            hal_uart_puts("[WARN] SMP: hart ");
+            kprint_dec(cpu->hartid);
+            hal_uart_puts(" did not come up\n");
+        }
+    }
+
+    hal_uart_puts("[OK] SMP: ");
+    kprint_dec(cpu_online_count());
+    hal_uart_puts(" CPUs online\n");
+}
+
+/**
+ * C entry point of a secondary hart
+ */
+void smp_secondary_main(struct cpu *cpu) {
+    // Same kernel page table as the boot hart, on our own TLB
+    switch_to_kernel_page_table();
+
+    cpu->online = 1;
+    memory_barrier();
+
+    bkl_acquire();
+
+    hal_timer_init_cpu();
+
+    // Reschedule IPIs (forwarded by M-mode as supervisor software interrupts)
+    asm volatile("csrs sie, %0" :: "r"(SIE_SSIE));
+
+    // Its PLIC context, for device interrupts steered here
+    interrupt_init_cpu();
+
+    hal_uart_puts("[OK] CPU ");
+    kprint_dec(cpu->id);
+    hal_uart_puts(" online (hart ");
+    kprint_dec(cpu->hartid);
+    hal_uart_puts(")\n");
+
+    // Nothing of its own to run: wait for work like an idle CPU 0
+    scheduler_idle_loop();
+}
+
+/**
+ * Ask a CPU to reschedule
+ */
+void smp_send_reschedule(struct cpu *cpu) {
+    if (cpu == cpu_this()) {
+        cpu->need_resched = 1;
+        return;
+    }
+
+    // Machine software interrupt; entry.S passes it on as SSIP
+    clint_trigger_software_interrupt((uint32_t)cpu->hartid);
+}
+
+/**
+ * Flush every other CPU's TLB
+ */
+void smp_flush_tlb_others(void) {
+    struct cpu *self = cpu_this();
+    for (int i = 0; i < cpu_count; i++) {
+        struct cpu *cpu = &cpus[i];
+        if (cpu == self || !cpu->online) {
+            continue;
+        }
+        cpu->tlb_flush_pending = 1;
+        memory_barrier();
+        clint_trigger_software_interrupt((uint32_t)cpu->hartid);
+    }
+
+    // A CPU waiting for the lock is out of user mode until it flushes
+    for (int i = 0; i < cpu_count; i++) {
+        struct cpu *cpu = &cpus[i];
+        while (cpu != self && cpu->tlb_flush_pending && !cpu->bkl_waiting) {
+            memory_barrier();
+        }
+    }
+}
+
+/**
+ * Take the big kernel lock
+ */
+void bkl_acquire(void) {
+    struct cpu *cpu = cpu_this();
+
+    // An interrupt taken while spinning would queue behind our own ticket
+    cpu->bkl_waiting = 1;
+    int irq_state = spin_lock_irqsave(&bkl);
+    cpu->bkl_waiting = 0;
+    bkl_owner = cpu->id;
+
+    // Another CPU changed a page table we may have cached
+    if (cpu->tlb_flush_pending) {
+        __asm__ volatile("sfence.vma zero, zero" ::: "memory");
+        cpu->tlb_flush_pending = 0;
+    }
+
+    // Into the kernel: synchronize_rcu() must wait for us from here on
+    cpu_this()->rcu_qs_seq++;
+    memory_barrier();
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Release the big kernel lock
+ */
+void bkl_release(void) {
+    // Leaving the kernel ends any RCU read section
+    memory_barrier();
+    cpu_this()->rcu_qs_seq++;
+
+    bkl_owner = -1;
+    spin_unlock(&bkl);
+}
+
+/**
+ * Check whether this CPU holds the big kernel lock
+ */
+int bkl_held(void) {
+    return bkl_owner == cpu_this()->id;
+}
+
+/**
+ * Let a waiting CPU have the big kernel lock for a moment
+ */
+void bkl_relax(void) {
+    if (spin_is_contended(&bkl)) {
+        bkl_release();
+        bkl_acquire();
+    }
+}
@@ -0,0 +1,144 @@
+/**
+ * @file softirq.c
+ * @brief Per-CPU deferred interrupt work
+ *
+ * The pending bitmap and tasklet list of a CPU are only touched by that
+ * CPU, with interrupts off, so they need no lock; the big kernel lock
+ * keeps the other CPUs out of the actions, as for interrupt handlers.
+ */
+
+#include "kernel/softirq.h"
+#include "kernel/smp.h"
+#include "kernel/rcu.h"
+#include "kernel/config.h"
+#include "arch/interrupt.h"
+#include <stddef.h>
+
+static softirq_fn_t softirq_actions[SOFTIRQ_COUNT];
+static uint64_t softirq_runs[SOFTIRQ_COUNT];
+
+// Tasklets scheduled on each CPU, oldest first
+static tasklet_t *tasklet_head[MAX_CPUS];
+static tasklet_t *tasklet_tail[MAX_CPUS];
+
+/**
+ * SOFTIRQ_TASKLET: run the tasklets scheduled on this CPU so far
+ */
+static void tasklet_action(void) {
+    int cpu_id = cpu_this()->id;
+
+    // Take the whole list: tasklets scheduled from here on are the next run's
+    int irq_state = interrupt_save_disable();
+    tasklet_t *list = tasklet_head[cpu_id];
+    tasklet_head[cpu_id] = NULL;
+    tasklet_tail[cpu_id] = NULL;
+    interrupt_restore(irq_state);
+
+    while (list) {
+        tasklet_t *tasklet = list;
+        list = tasklet->next;
+        tasklet->next = NULL;
+        tasklet->pending = 0;   // May be scheduled again from here on, even by fn
+        tasklet->fn(tasklet);
+    }
+}
+
+/**
+ * SOFTIRQ_RCU: callbacks ran in the timer tick before, with interrupts off
+ */
+static void rcu_action(void) {
+    int irq_state = interrupt_save_disable();
+    rcu_poll();
+    interrupt_restore(irq_state);
+}
+
+void softirq_init(void) {
+    open_softirq(SOFTIRQ_TASKLET, tasklet_action);
+    open_softirq(SOFTIRQ_RCU, rcu_action);
+}
+
+void open_softirq(int nr, softirq_fn_t fn) {
+    if (nr < 0 || nr >= SOFTIRQ_COUNT) {
+        return;
+    }
+    softirq_actions[nr] = fn;
+}
+
+void raise_softirq(int nr) {
+    if (nr < 0 || nr >= SOFTIRQ_COUNT) {
+        return;
+    }
+
+    int irq_state = interrupt_save_disable();
+    cpu_this()->softirq_pending |= 1U << nr;
+    interrupt_restore(irq_state);
+}
+
+void do_softirq(void) {
+    int irq_state = interrupt_save_disable();
+    struct cpu *cpu = cpu_this();
+
+    if (cpu->softirq_running || !cpu->softirq_pending) {
+        interrupt_restore(irq_state);
+        return;
+    }
+
+    // Keeps nested traps out of here and the scheduler from switching away
+    cpu->softirq_running = 1;
+
+    for (int round = 0; round < SOFTIRQ_RESTART_MAX && cpu->softirq_pending; round++) {
+        uint32_t pending = cpu->softirq_pending;
+        cpu->softirq_pending = 0;
+
+        interrupt_enable();
+        for (int nr = 0; nr < SOFTIRQ_COUNT; nr++) {
+            if ((pending & (1U << nr)) && softirq_actions[nr]) {
+                softirq_actions[nr]();
+                softirq_runs[nr]++;
+            }
+        }
+        interrupt_disable();
+    }
+
+    cpu->softirq_running = 0;
+    interrupt_restore(irq_state);
+}
+
+int in_softirq(void) {
+    return cpu_this()->softirq_running;
+}
+
+uint64_t softirq_count(int nr) {
+    if (nr < 0 || nr >= SOFTIRQ_COUNT) {
+        return 0;
+    }
+    return softirq_runs[nr];
+}
+
+void tasklet_init(tasklet_t *tasklet, tasklet_fn_t fn) {
+    tasklet->fn = fn;
+    tasklet->next = NULL;
+    tasklet->pending = 0;
+}
+
+int tasklet_schedule(tasklet_t *tasklet) {
+    int irq_state = interrupt_save_disable();
+    if (tasklet->pending) {
+        interrupt_restore(irq_state);
+        return 0;
+    }
+
+    int cpu_id = cpu_this()->id;
+    tasklet->pending = 1;
+    tasklet->next = NULL;
+    if (tasklet_tail[cpu_id]) {
+        tasklet_tail[cpu_id]->next = tasklet;
+    } else {
+        tasklet_head[cpu_id] = tasklet;
+    }
+    tasklet_tail[cpu_id] = tasklet;
+
+    raise_softirq(SOFTIRQ_TASKLET);
+    interrupt_restore(irq_state);
+    return 1;
+}
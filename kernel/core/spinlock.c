@@ -0,0 +1,213 @@
+/**
+ * @file spinlock.c
+ * @brief Ticket spinlock implementation for ThunderOS
+ *
+ * spin_lock() takes a ticket with one atomic add and waits for
+ * now_serving to reach it; only the holder ever writes now_serving, so
+ * spin_unlock() is a fence and a plain store.
+ */
+
+#include "kernel/spinlock.h"
+#include "kernel/kstring.h"
+#include "kernel/lockstat.h"
+#include "kernel/schedlat.h"
+#include "hal/hal_uart.h"
+#include "hal/hal_timer.h"
+#include "arch/interrupt.h"
+#include "arch/barrier.h"
+#include <stddef.h>
+
+#ifdef SPINLOCK_STATS
+/* Named locks, newest first (pushed lock-free: no lock to count) */
+static spinlock_t *stats_head = NULL;
+#endif
+
+#ifdef LOCKSTAT
+/**
+ * @brief Class of a lock, joining the first site's for SPINLOCK_INIT ones
+ */
+static struct lockstat_class *spin_lockstat_class(spinlock_t *lock, uintptr_t site) {
+    if (!lock->lockstat) {
+        lock->lockstat = lockstat_class(LOCKSTAT_SPIN, (const void *)site, NULL);
+    }
+    return lock->lockstat;
+}
+#endif
+
+/**
+ * @brief Initialize a spinlock
+ */
+void spin_lock_init(spinlock_t *lock, const char *name) {
+    lock->next_ticket = 0;
+    lock->now_serving = 0;
+#ifdef SPINLOCK_STATS
+    lock->name = name;
+    lock->acquisitions = 0;
+    lock->contended = 0;
+    lock->spins = 0;
+    lock->max_hold_us = 0;
+    lock->locked_at_us = 0;
+#ifdef LOCKSTAT
+    lock->lockstat = name ? lockstat_class(LOCKSTAT_SPIN, name, name) : NULL;
+#endif
+
+    /* Only named locks are listed; a lock inside freed memory must stay
+     * anonymous or the list would point into it */
+    if (name) {
+        spinlock_t *head;
+        do {
+            head = stats_head;
+            lock->stats_next = head;
+        } while (!__sync_bool_compare_and_swap(&stats_head, head, lock));
+    }
+#else
+    (void)name;
+#endif
+}
+
+/**
+ * @brief Acquire a spinlock on behalf of the caller at site
+ */
+static inline void spin_lock_at(spinlock_t *lock, uintptr_t site) {
+    uint32_t ticket = __sync_fetch_and_add(&lock->next_ticket, 1);
+
+#ifdef SPINLOCK_STATS
+    uint64_t spins = 0;
+#ifdef LOCKSTAT
+    uint64_t wait_start = lock->now_serving != ticket ? hal_timer_get_time_us() : 0;
+#endif
+    while (lock->now_serving != ticket) {
+        spins++;
+    }
+#else
+    while (lock->now_serving != ticket) {
+        /* Spin */
+    }
+#endif
+
+    /* Nothing in the critical section may be read before we own it */
+    memory_barrier();
+
+#ifdef SPINLOCK_STATS
+    lock->acquisitions++;
+    if (spins) {
+        lock->contended++;
+        lock->spins += spins;
+    }
+    lock->locked_at_us = hal_timer_get_time_us();
+#endif
+#ifdef LOCKSTAT
+    struct lockstat_class *cls = spin_lockstat_class(lock, site);
+    lockstat_acquired(cls);
+    if (spins) {
+        lockstat_waited(cls, lock->locked_at_us - wait_start, site);
+    }
+#else
+    (void)site;
+#endif
+}
+
+/**
+ * @brief Acquire a spinlock
+ */
+void spin_lock(spinlock_t *lock) {
+#ifdef LOCKSTAT
+    spin_lock_at(lock, LOCKSTAT_SITE());
+#else
+    spin_lock_at(lock, 0);
+#endif
+}
+
+/**
+ * @brief Try to acquire a spinlock
+ */
+int spin_trylock(spinlock_t *lock) {
+    uint32_t ticket = lock->now_serving;
+
+    /* Free only if no ticket is outstanding; take the next one atomically */
+    if (lock->next_ticket != ticket ||
+        !__sync_bool_compare_and_swap(&lock->next_ticket, ticket, ticket + 1)) {
+        return 0;
+    }
+
+    memory_barrier();
+
+#ifdef SPINLOCK_STATS
+    lock->acquisitions++;
+    lock->locked_at_us = hal_timer_get_time_us();
+#endif
+#ifdef LOCKSTAT
+    lockstat_acquired(spin_lockstat_class(lock, LOCKSTAT_SITE()));
+#endif
+    return 1;
+}
+
+/**
+ * @brief Release a spinlock
+ */
+void spin_unlock(spinlock_t *lock) {
+#ifdef SPINLOCK_STATS
+    uint64_t held = hal_timer_get_time_us() - lock->locked_at_us;
+    if (held > lock->max_hold_us) {
+        lock->max_hold_us = held;
+    }
+#endif
+#ifdef LOCKSTAT
+    if (lock->lockstat) {
+        lockstat_held(lock->lockstat, held);
+    }
+#endif
+
+    /* Everything written under the lock is visible before the next owner */
+    memory_barrier();
+    lock->now_serving = lock->now_serving + 1;
+}
+
+/**
+ * @brief Disable interrupts and acquire a spinlock
+ */
+int spin_lock_irqsave(spinlock_t *lock) {
+    int irq_state = interrupt_save_disable();
+#ifdef SCHEDLAT_IRQOFF
+    /* Put the section down to our caller rather than to us */
+    if (irq_state) {
+        schedlat_irqs_off((uintptr_t)__builtin_return_address(0));
+    }
+#endif
+#ifdef LOCKSTAT
+    spin_lock_at(lock, LOCKSTAT_SITE());
+#else
+    spin_lock_at(lock, 0);
+#endif
+    return irq_state;
+}
+
+/**
+ * @brief Release a spinlock and restore the interrupt state
+ */
+void spin_unlock_irqrestore(spinlock_t *lock, int irq_state) {
+    spin_unlock(lock);
+    interrupt_restore(irq_state);
+}
+
+/**
+ * @brief Print the statistics of every named lock
+ */
+void spinlock_stats_dump(void) {
+#ifdef SPINLOCK_STATS
+    hal_uart_puts("Lock statistics (acquired / contended / spins / max hold us):\n");
+    for (spinlock_t *lock = stats_head; lock; lock = lock->stats_next) {
+        hal_uart_puts("  ");
+        hal_uart_puts(lock->name);
+        hal_uart_puts(": ");
+        kprint_dec(lock->acquisitions);
+        hal_uart_puts(" / ");
+        kprint_dec(lock->contended);
+        hal_uart_puts(" / ");
+        kprint_dec(lock->spins);
+        hal_uart_puts(" / ");
+        kprint_dec(lock->max_hold_us);
+        hal_uart_puts("\n");
+    }
+#endif
+}
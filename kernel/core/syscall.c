@@ -9,6 +9,11 @@
 #include "kernel/mutex.h"
 #include "kernel/condvar.h"
 #include "kernel/rwlock.h"
+#include "kernel/futex.h"
+#include "kernel/ring.h"
+#include "kernel/aio.h"
+#include "kernel/uaccess.h"
+#include "kernel/kstring.h"
 #include "kernel/constants.h"
 #include "hal/hal_timer.h"
 #include "mm/paging.h"
@@ -19,13 +24,26 @@
 #include "kernel/elf_loader.h"
 #include "drivers/vterm.h"
 #include "fs/vfs.h"
+#include "fs/page_cache.h"
+#include "kernel/poll.h"
+#include "kernel/eventpoll.h"
+#include "kernel/shm.h"
+#include "kernel/signal.h"
+#include "kernel/signalfd.h"
+#include "kernel/perf_event.h"
+#include "kernel/vdso.h"
+#include "kernel/acct.h"
+#include "kernel/rgroup.h"
+#include "net/socket.h"
+#include "arch/interrupt.h"
+#include "mm/kmalloc.h"
+#include "mm/ksm.h"
 #include <stdint.h>
 #include <stddef.h>
 
 // External SBI functions for system shutdown/reboot
 extern void sbi_shutdown(void);
 extern void sbi_reboot(void);
-#define STDERR_FD 2
 #define SYSCALL_ERROR ((uint64_t)-1)
 #define SYSCALL_SUCCESS 0
 
@@ -68,7 +86,9 @@ static int is_valid_user_pointer(const void *pointer, size_t length) {
 }
 
 /**
- * sys_exit - Terminate the current process
+ * sys_exit - Terminate the calling thread
+ * 
+ * The process ends with its last thread; sys_exit_group() ends them all.
  * 
  * @param status Exit status code
  * @return Never returns
@@ -79,6 +99,18 @@ uint64_t sys_exit(int status) {
     return 0;
 }
 
+/**
+ * sys_exit_group - Terminate every thread of the current process
+ * 
+ * @param status Exit status code (the process's, for waitpid())
+ * @return Never returns
+ */
+uint64_t sys_exit_group(int status) {
+    process_exit_group(status);
+    // Never reaches here
+    return 0;
+}
+
 /**
  * sys_waitpid - Wait for a child process to change state
  * 
@@ -88,6 +120,8 @@ uint64_t sys_exit(int status) {
  * @param wstatus Pointer to store exit status (can be NULL)
  * @param options Options (0 for blocking wait)
  * @return PID of terminated child, or -1 on error
+ *
+ * Sleeps on the caller's child_wait queue until a child exits or stops.
  */
 uint64_t sys_waitpid(int pid, int *wstatus, int options) {
     (void)options;  // Options not implemented yet
@@ -151,16 +185,18 @@ uint64_t sys_waitpid(int pid, int *wstatus, int options) {
             return SYSCALL_ERROR;
         }
         
-        // Child exists but hasn't exited/stopped yet - sleep and try again
-        current->state = PROC_SLEEPING;
-        scheduler_yield();
-        current->state = PROC_RUNNING;
+        // Child exists but hasn't exited/stopped yet: sleep until one of
+        // our children does (process_exit(), signal_default_stop()), then
+        // look again, as other wakeups end the sleep too
+        wait_queue_sleep(&current->child_wait);
     }
 }
 
 /**
  * sys_getpid - Get current process ID
  * 
+ * Every thread of a process sees the same one: its first thread's.
+ * 
  * @return Current process ID, or -1 on error
  */
 uint64_t sys_getpid(void) {
@@ -170,6 +206,21 @@ uint64_t sys_getpid(void) {
         return SYSCALL_ERROR;
     }
     
+    return process_tgid(current_process);
+}
+
+/**
+ * sys_gettid - Get the calling thread's ID
+ * 
+ * @return Thread ID (the process ID for its first thread), or -1 on error
+ */
+uint64_t sys_gettid(void) {
+    struct process *current_process = process_current();
+    
+    if (current_process == NULL) {
+        return SYSCALL_ERROR;
+    }
+    
     return current_process->pid;
 }
 
@@ -177,8 +228,8 @@ uint64_t sys_getpid(void) {
  * sys_sbrk - Adjust heap size with memory isolation
  * 
  * Implements heap expansion/contraction with complete memory isolation.
- * Allocates physical pages, maps them into process address space, and
- * updates VMA tracking.
+ * Growing only extends the heap VMA; pages are zero-filled on first
+ * touch. Shrinking unmaps and frees the pages past the new break.
  * 
  * @param heap_increment Bytes to add to heap (can be negative)
  * @return Previous heap end on success, or -1 on error
@@ -188,6 +239,7 @@ uint64_t sys_sbrk(int heap_increment) {
     if (!proc) {
         return SYSCALL_ERROR;
     }
+    proc = proc->group_leader;  // Threads share one heap
     
     uint64_t old_brk = proc->heap_end;
     
@@ -215,10 +267,15 @@ uint64_t sys_sbrk(int heap_increment) {
         uint64_t old_page = (old_brk + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
         uint64_t new_page = (new_brk + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
         
-        // Map new pages if crossing page boundary
+        // Reserve new pages if crossing page boundary: grow the heap VMA
+        // when it ends here, so repeated sbrk()s keep one VMA
         if (new_page > old_page) {
-            if (process_map_region(proc, old_page, new_page - old_page, 
-                                 VM_READ | VM_WRITE | VM_USER) != 0) {
+            vm_area_t *heap_vma = old_page > proc->heap_start ?
+                                  process_find_vma(proc, old_page - 1) : NULL;
+            if (heap_vma && heap_vma->start == proc->heap_start && heap_vma->end == old_page) {
+                process_resize_vma(proc, heap_vma, new_page);
+            } else if (process_map_region(proc, old_page, new_page - old_page, 
+                                          VM_READ | VM_WRITE | VM_USER) != 0) {
                 return SYSCALL_ERROR;
             }
         }
@@ -230,14 +287,22 @@ uint64_t sys_sbrk(int heap_increment) {
         uint64_t old_page = (old_brk + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
         
         // Unmap pages if crossing page boundary
-        for (uint64_t addr = new_page; addr < old_page; addr += PAGE_SIZE) {
-            unmap_page(proc->page_table, addr);
+        if (new_page < old_page) {
+            mmu_gather_t tlb;
+            tlb_gather_init(&tlb, proc->page_table);
+            tlb_gather_unmap_range(&tlb, new_page, old_page);
+            tlb_gather_finish(&tlb);
+            process_account_rss(proc, -(int64_t)tlb.unmapped);
         }
         
-        // Update VMA for heap
+        // Update VMA for heap (gone once the heap is empty)
         vm_area_t *heap_vma = process_find_vma(proc, proc->heap_start);
         if (heap_vma && heap_vma->start == proc->heap_start) {
-            heap_vma->end = new_page;
+            if (new_page > proc->heap_start) {
+                process_resize_vma(proc, heap_vma, new_page);
+            } else {
+                process_remove_vma(proc, heap_vma);
+            }
         }
     }
     
@@ -250,7 +315,9 @@ uint64_t sys_sbrk(int heap_increment) {
 /**
  * sys_sleep - Sleep for specified milliseconds
  * 
- * Timer ticks are every 100ms (TIMER_INTERVAL_US = 100000).
+ * Uses a high-resolution timer, so the sleep is not rounded to the
+ * 100ms tick. Other processes run in the meantime; a signal ends the
+ * sleep early.
  * 
  * @param milliseconds Milliseconds to sleep
  * @return 0 on success
@@ -260,51 +327,7 @@ uint64_t sys_sleep(uint64_t milliseconds) {
         return SYSCALL_SUCCESS;
     }
     
-    /* Get current time */
-    extern uint64_t hal_timer_get_ticks(void);
-    uint64_t start_ticks = hal_timer_get_ticks();
-    
-    /* Each tick is TIMER_TICK_MS milliseconds
-     * So to sleep N ms, we need N/TIMER_TICK_MS ticks
-     * But to avoid losing precision, round up: (N + TIMER_TICK_MS-1) / TIMER_TICK_MS
-     */
-    uint64_t ticks_to_wait = (milliseconds + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
-    if (ticks_to_wait == 0) ticks_to_wait = 1;
-    
-    uint64_t target_ticks = start_ticks + ticks_to_wait;
-    
-    /* Enable interrupts so timer interrupts can fire during sleep.
-     * 
-     * When we enter a syscall via trap, interrupts are disabled by hardware.
-     * We need to re-enable them so the timer can update the tick count.
-     * 
-     * CRITICAL: Before enabling interrupts, we must clear sscratch.
-     * The trap entry uses sscratch to detect user vs kernel mode:
-     * - sscratch == 0 means we were in kernel mode
-     * - sscratch != 0 means we were in user mode (contains kernel stack)
-     * If we don't clear it, the trap handler will think we came from user
-     * mode and corrupt the stack.
-     * 
-     * Save sscratch first, then clear it, enable interrupts.
-     */
-    uint64_t saved_sscratch;
-    __asm__ volatile("csrrw %0, sscratch, zero" : "=r"(saved_sscratch));
-    
-    /* Enable SIE (Supervisor Interrupt Enable) bit in sstatus. */
-    __asm__ volatile("csrs sstatus, %0" :: "r"(1UL << 1));
-    
-    /* Wait until enough ticks have passed.
-     * Use WFI to wait for next interrupt instead of spinning.
-     */
-    while (hal_timer_get_ticks() < target_ticks) {
-        __asm__ volatile("wfi");
-    }
-    
-    /* Disable interrupts before restoring sscratch */
-    __asm__ volatile("csrc sstatus, %0" :: "r"(1UL << 1));
-    
-    /* Restore sscratch for proper return to user mode */
-    __asm__ volatile("csrw sscratch, %0" :: "r"(saved_sscratch));
+    process_sleep_us(milliseconds * MICROSECONDS_PER_MILLISECOND);
     
     return SYSCALL_SUCCESS;
 }
@@ -366,17 +389,13 @@ uint64_t sys_kill(int pid, int signal) {
 /**
  * sys_gettime - Get system time
  * 
- * Timer ticks are every 100ms (TIMER_INTERVAL_US = 100000).
+ * Read from the hardware clock rather than the tick count, which stands
+ * still while the CPU idles with the tick stopped.
  * 
  * @return Milliseconds since boot
  */
 uint64_t sys_gettime(void) {
-    // Get time from hardware timer (each tick is 100ms)
-    extern uint64_t hal_timer_get_ticks(void);
-    uint64_t ticks = hal_timer_get_ticks();
-    
-    // Convert ticks to milliseconds (each tick = 100ms)
-    return ticks * TIMER_TICK_MS;
+    return hal_timer_get_time_us() / MICROSECONDS_PER_MILLISECOND;
 }
 
 /**
@@ -441,20 +460,33 @@ uint64_t sys_open(const char *path, int flags, int mode) {
  * @return 0 on success, -1 on error
  */
 uint64_t sys_close(int fd) {
-    // Don't allow closing stdin/stdout/stderr
-    if (fd <= STDERR_FD) {
-        return SYSCALL_ERROR;
-    }
-    
     int result = vfs_close(fd);
     return (result == 0) ? SYSCALL_SUCCESS : SYSCALL_ERROR;
 }
 
+/* Console reads are copied out to user space this many bytes at a time */
+#define READ_CHUNK_SIZE 256
+
+/**
+ * read_store_char - Hand one character read from stdin to the user
+ * 
+ * @return 1, or -1 if buffer is not writable (errno set)
+ */
+static uint64_t read_store_char(char *buffer, char c) {
+    if (copy_to_user(buffer, &c, 1) != 0) {
+        return SYSCALL_ERROR;
+    }
+    return 1;
+}
+
 /**
  * sys_read - Read data from a file descriptor
  * 
  * Enhanced version with memory isolation validation.
- * Validates buffer is in mapped memory with write permissions.
+ * Console input comes through the terminal's line discipline, a line
+ * or all that is buffered per read, and is stored through
+ * copy_to_user(); files are read straight into the buffer, which is
+ * validated as mapped and writable first.
  * 
  * @param file_descriptor File descriptor
  * @param buffer Buffer to read into
@@ -464,87 +496,73 @@ uint64_t sys_close(int fd) {
 uint64_t sys_read(int file_descriptor, char *buffer, size_t byte_count) {
     struct process *proc = process_current();
     
-    // Validate user buffer with write permission (we're writing to it)
-    if (!process_validate_user_ptr(proc, buffer, byte_count, VM_WRITE | VM_USER)) {
-        return SYSCALL_ERROR;
-    }
-    
-    // Handle stdin separately
-    if (file_descriptor == STDIN_FD) {
+    // Handle the console separately
+    if (vfs_is_console(file_descriptor)) {
+        // Only its input side reads
+        if (vfs_get_file(file_descriptor)->flags & O_WRONLY) {
+            set_errno(THUNDEROS_EBADF);
+            return SYSCALL_ERROR;
+        }
+        
         // Read from input buffer or UART
         if (byte_count == 0) {
             return 0;
         }
         
-        // Get this process's controlling terminal
-        int tty = process_get_tty(proc);
-        
-        // If vterm is available, use per-terminal input buffers
-        if (vterm_available() && tty >= 0) {
-            // Loop until we get input
+        // Read what the terminal's line discipline has ready: a line in
+        // canonical mode, everything buffered in raw mode
+        if (vterm_available()) {
+            // Processes without a controlling terminal read the active one
+            int tty = process_get_tty(proc);
+            char chunk[READ_CHUNK_SIZE];
+            if (byte_count > sizeof(chunk)) {
+                byte_count = sizeof(chunk);
+            }
+            
             while (1) {
-                // First check buffer (filled by timer interrupt)
-                if (vterm_has_buffered_input_for(tty)) {
-                    int buffered = vterm_get_buffered_input_for(tty);
-                    if (buffered >= 0) {
-                        buffer[0] = (char)buffered;
-                        return 1;
+                int index = tty >= 0 ? tty : vterm_get_active_index();
+                int n = vterm_read_input(index, chunk, byte_count);
+                if (n >= 0) {
+                    if (n > 0 && copy_to_user(buffer, chunk, (size_t)n) != 0) {
+                        return SYSCALL_ERROR;
                     }
+                    return (uint64_t)n;
                 }
                 
-                // If we're the active terminal, also check UART directly
-                // This provides immediate response without waiting for timer
-                // Disable interrupts briefly to avoid race with timer polling
-                if (tty == vterm_get_active_index() && hal_uart_data_available()) {
-                    // Forward declarations for interrupt control
-                    extern int interrupt_save_disable(void);
-                    extern void interrupt_restore(int state);
-                    
-                    // Disable interrupts to prevent timer from also reading UART
+                // If we're the active terminal, also take input the UART
+                // has not interrupted for yet (or the timer polled, where
+                // the UART does not interrupt); interrupts stay off so the
+                // timer cannot take it at the same time
+                if (index == vterm_get_active_index() && hal_uart_data_available()) {
                     int old_state = interrupt_save_disable();
-                    
-                    // Double-check UART still has data after disabling interrupts
-                    if (hal_uart_data_available()) {
-                        int c = hal_uart_getc_nonblock();
-                        if (c >= 0) {
-                            // Process through VT system for escape sequences
-                            char result = vterm_process_input((char)c);
-                            interrupt_restore(old_state);
-                            if (result != 0) {
-                                buffer[0] = result;
-                                return 1;
-                            }
-                            // Character consumed (VT switch), continue loop
-                            continue;
-                        }
-                    }
+                    vterm_poll_input();
                     interrupt_restore(old_state);
+                    continue;
                 }
                 
-                // Nothing available, yield and try again
-                process_yield();
-            }
-        } else if (vterm_available()) {
-            // Fallback for processes without controlling terminal
-            while (!vterm_has_buffered_input()) {
-                process_yield();
-            }
-            int buffered = vterm_get_buffered_input();
-            if (buffered >= 0) {
-                buffer[0] = (char)buffered;
-                return 1;
+                // Nothing available: sleep until input is buffered
+                if (vfs_is_nonblock(file_descriptor)) {
+                    set_errno(THUNDEROS_EAGAIN);
+                    return SYSCALL_ERROR;
+                }
+                vterm_wait_input(index);
             }
-            return 0;
         } else {
             // No vterm - read directly from UART (fallback)
-            char c = hal_uart_getc();
-            buffer[0] = c;
-            return 1;
+            if (vfs_is_nonblock(file_descriptor)) {
+                int c = hal_uart_getc_nonblock();
+                if (c < 0) {
+                    set_errno(THUNDEROS_EAGAIN);
+                    return SYSCALL_ERROR;
+                }
+                return read_store_char(buffer, (char)c);
+            }
+            return read_store_char(buffer, hal_uart_getc());
         }
     }
     
-    // Handle regular file descriptors
-    if (file_descriptor <= STDERR_FD) {
+    // Validate user buffer with write permission (we're writing to it)
+    if (!process_validate_user_ptr(proc, buffer, byte_count, VM_WRITE | VM_USER)) {
         return SYSCALL_ERROR;
     }
     
@@ -557,11 +575,35 @@ uint64_t sys_read(int file_descriptor, char *buffer, size_t byte_count) {
     return bytes_read;
 }
 
+/* Console writes are copied in from user space this many bytes at a time */
+#define WRITE_CHUNK_SIZE 256
+
+/**
+ * console_write - Write kernel bytes to the process's console
+ * 
+ * @return 0 on success, -1 if the UART did not take everything
+ */
+static int console_write(struct process *proc, const char *buffer, size_t byte_count) {
+    // If virtual terminals are available, write to process's controlling terminal
+    if (vterm_available()) {
+        /* No controlling terminal (-1) means the active one */
+        vterm_write(process_get_tty(proc), buffer, byte_count);
+    } else {
+        // Fallback to UART only
+        int bytes_written = hal_uart_write(buffer, byte_count);
+        if (bytes_written != (int)byte_count) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
 /**
  * sys_write - Write data to a file descriptor
  * 
  * Enhanced version with memory isolation validation.
- * Validates buffer is in mapped memory with read permissions.
+ * Console output is copied in with copy_from_user(); file writes
+ * validate the buffer as mapped and readable first.
  * 
  * @param file_descriptor File descriptor
  * @param buffer Buffer to write from
@@ -571,44 +613,36 @@ uint64_t sys_read(int file_descriptor, char *buffer, size_t byte_count) {
 uint64_t sys_write(int file_descriptor, const char *buffer, size_t byte_count) {
     struct process *proc = process_current();
     
-    // Validate user buffer with read permission (we're reading from it)
-    if (!process_validate_user_ptr(proc, buffer, byte_count, VM_READ | VM_USER)) {
-        return SYSCALL_ERROR;
-    }
-    
-    // Handle stdout/stderr with UART (and optional vterm)
-    if (file_descriptor == STDOUT_FD || file_descriptor == STDERR_FD) {
-        // If virtual terminals are available, write to process's controlling terminal
-        if (vterm_available()) {
-            int tty = process_get_tty(proc);
-            if (tty >= 0) {
-                /* Route output to process's controlling terminal */
-                for (size_t i = 0; i < byte_count; i++) {
-                    vterm_putc_to(tty, buffer[i]);
-                }
-                /* Only flush if writing to active terminal */
-                if (tty == vterm_get_active_index()) {
-                    vterm_flush();
-                }
-            } else {
-                /* No controlling terminal, write to active terminal */
-                for (size_t i = 0; i < byte_count; i++) {
-                    vterm_putc(buffer[i]);
-                }
-                vterm_flush();
+    // Handle the console with UART (and optional vterm), copying the
+    // user buffer in through a bounce buffer a chunk at a time
+    if (vfs_is_console(file_descriptor)) {
+        // Only its output side writes
+        if (!(vfs_get_file(file_descriptor)->flags & (O_WRONLY | O_RDWR))) {
+            set_errno(THUNDEROS_EBADF);
+            return SYSCALL_ERROR;
+        }
+        
+        char chunk[WRITE_CHUNK_SIZE];
+        size_t done = 0;
+        while (done < byte_count) {
+            size_t len = byte_count - done;
+            if (len > sizeof(chunk)) {
+                len = sizeof(chunk);
             }
-        } else {
-            // Fallback to UART only
-            int bytes_written = hal_uart_write(buffer, byte_count);
-            if (bytes_written != (int)byte_count) {
+            if (copy_from_user(chunk, buffer + done, len) != 0) {
+                // Report what made it out before the bad address
+                return done ? done : SYSCALL_ERROR;
+            }
+            if (console_write(proc, chunk, len) != 0) {
                 return SYSCALL_ERROR;
             }
+            done += len;
         }
         return byte_count;
     }
     
-    // Handle stdin (cannot write)
-    if (file_descriptor == STDIN_FD) {
+    // Validate user buffer with read permission (the filesystem reads it)
+    if (!process_validate_user_ptr(proc, buffer, byte_count, VM_READ | VM_USER)) {
         return SYSCALL_ERROR;
     }
     
@@ -621,6 +655,223 @@ uint64_t sys_write(int file_descriptor, const char *buffer, size_t byte_count) {
     return bytes_written;
 }
 
+/* iovec arrays up to this long are copied onto the stack */
+#define IOV_FAST_COUNT 8
+
+/**
+ * iov_import - Copy a user iovec array in and check its buffers
+ * 
+ * @param uiov User array
+ * @param iovcnt Its length
+ * @param fast Stack array of IOV_FAST_COUNT, used when it is big enough
+ * @param access VM_WRITE to read into the buffers, VM_READ to write from them
+ * @return Kernel copy (fast or allocated, free with iov_release()), or
+ *         NULL on error (errno set)
+ */
+static vfs_iovec_t *iov_import(const vfs_iovec_t *uiov, int iovcnt, vfs_iovec_t *fast,
+                               uint32_t access) {
+    if (iovcnt < 0 || iovcnt > VFS_IOV_MAX) {
+        RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+    }
+    
+    vfs_iovec_t *iov = fast;
+    if (iovcnt > IOV_FAST_COUNT) {
+        iov = (vfs_iovec_t *)kmalloc((size_t)iovcnt * sizeof(vfs_iovec_t));
+        if (!iov) {
+            RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+        }
+    }
+    
+    struct process *proc = process_current();
+    int ok = copy_from_user(iov, uiov, (size_t)iovcnt * sizeof(vfs_iovec_t)) == 0;
+    for (int i = 0; ok && i < iovcnt; i++) {
+        ok = iov[i].len == 0 ||
+             process_validate_user_ptr(proc, iov[i].base, iov[i].len, access | VM_USER);
+    }
+    if (!ok) {
+        if (iov != fast) {
+            kfree(iov);
+        }
+        RETURN_ERRNO_NULL(THUNDEROS_EFAULT);
+    }
+    return iov;
+}
+
+static void iov_release(vfs_iovec_t *iov, vfs_iovec_t *fast) {
+    if (iov != fast) {
+        kfree(iov);
+    }
+}
+
+/**
+ * rw_vectored - Shared body of readv/writev/preadv/pwritev
+ * 
+ * The console is read a character at a time, so a console readv fills
+ * only its first non-empty buffer; a writev writes each in turn.
+ * 
+ * @param offset File offset (NULL: the file position)
+ * @param write Write from the buffers rather than read into them
+ * @return Bytes transferred, or -1 on error
+ */
+static uint64_t rw_vectored(int fd, const vfs_iovec_t *uiov, int iovcnt, int64_t *offset,
+                            int write) {
+    if (vfs_is_console(fd) && offset) {
+        set_errno(THUNDEROS_ESPIPE);
+        return SYSCALL_ERROR;
+    }
+    
+    vfs_iovec_t fast[IOV_FAST_COUNT];
+    vfs_iovec_t *iov = iov_import(uiov, iovcnt, fast, write ? VM_READ : VM_WRITE);
+    if (!iov) {
+        /* errno already set by iov_import */
+        return SYSCALL_ERROR;
+    }
+    
+    uint64_t result;
+    if (vfs_is_console(fd)) {
+        result = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            if (iov[i].len == 0) {
+                continue;
+            }
+            uint64_t n = write ? sys_write(fd, iov[i].base, iov[i].len)
+                               : sys_read(fd, iov[i].base, iov[i].len);
+            if (n == SYSCALL_ERROR) {
+                result = result ? result : SYSCALL_ERROR;
+                break;
+            }
+            result += n;
+            if (!write) {
+                break;
+            }
+        }
+    } else {
+        int n = write ? vfs_writev(fd, iov, iovcnt, offset) : vfs_readv(fd, iov, iovcnt, offset);
+        result = n < 0 ? SYSCALL_ERROR : (uint64_t)n;
+    }
+    
+    iov_release(iov, fast);
+    return result;
+}
+
+/**
+ * sys_pread64 - Read from a file offset without moving the file position
+ * 
+ * @param fd File descriptor (regular file)
+ * @param buffer Buffer to read into
+ * @param count Maximum number of bytes to read
+ * @param offset File offset to read from
+ * @return Number of bytes read, 0 at end of file, or -1 on error
+ * 
+ * @errno THUNDEROS_ESPIPE - fd is a pipe or the console
+ * @errno THUNDEROS_EINVAL - Negative offset
+ */
+uint64_t sys_pread64(int fd, void *buffer, size_t count, int64_t offset) {
+    vfs_iovec_t iov = { buffer, count > VFS_IO_MAX ? VFS_IO_MAX : count };
+    return rw_vectored(fd, &iov, 1, &offset, 0);
+}
+
+/**
+ * sys_pwrite64 - Write at a file offset without moving the file position
+ * 
+ * @param fd File descriptor (regular file)
+ * @param buffer Buffer to write from
+ * @param count Number of bytes to write
+ * @param offset File offset to write at
+ * @return Number of bytes written, or -1 on error
+ */
+uint64_t sys_pwrite64(int fd, const void *buffer, size_t count, int64_t offset) {
+    vfs_iovec_t iov = { (void *)buffer, count > VFS_IO_MAX ? VFS_IO_MAX : count };
+    return rw_vectored(fd, &iov, 1, &offset, 1);
+}
+
+/**
+ * sys_readv - Read into several buffers
+ * 
+ * @param fd File descriptor
+ * @param iov Buffers (struct iovec layout), at most VFS_IOV_MAX
+ * @param iovcnt Number of buffers
+ * @return Number of bytes read, 0 at end of file, or -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Bad count, or more than VFS_IO_MAX bytes in all
+ * @errno THUNDEROS_EFAULT - Bad array or buffer
+ */
+uint64_t sys_readv(int fd, const vfs_iovec_t *iov, int iovcnt) {
+    return rw_vectored(fd, iov, iovcnt, NULL, 0);
+}
+
+/**
+ * sys_writev - Write from several buffers
+ * 
+ * @return Number of bytes written, or -1 on error (errors as sys_readv)
+ */
+uint64_t sys_writev(int fd, const vfs_iovec_t *iov, int iovcnt) {
+    return rw_vectored(fd, iov, iovcnt, NULL, 1);
+}
+
+/**
+ * sys_preadv - Read into several buffers from a file offset
+ * 
+ * @return Number of bytes read, 0 at end of file, or -1 on error
+ */
+uint64_t sys_preadv(int fd, const vfs_iovec_t *iov, int iovcnt, int64_t offset) {
+    return rw_vectored(fd, iov, iovcnt, &offset, 0);
+}
+
+/**
+ * sys_pwritev - Write from several buffers at a file offset
+ * 
+ * @return Number of bytes written, or -1 on error
+ */
+uint64_t sys_pwritev(int fd, const vfs_iovec_t *iov, int iovcnt, int64_t offset) {
+    return rw_vectored(fd, iov, iovcnt, &offset, 1);
+}
+
+/**
+ * sys_fsync - Make a file's data and metadata durable
+ * 
+ * Returns once the file's dirty pages, its inode and the filesystem's
+ * pending metadata are on the device and its write cache is flushed.
+ * 
+ * @param fd Descriptor of a regular file or directory
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_EBADF - Not open
+ * @errno THUNDEROS_EINVAL - A pipe, the console or another non-file
+ * @errno THUNDEROS_EIO - Write-back or the flush failed
+ */
+uint64_t sys_fsync(int fd) {
+    if (vfs_fsync(fd, 0) != 0) {
+        return SYSCALL_ERROR;
+    }
+    return SYSCALL_SUCCESS;
+}
+
+/**
+ * sys_fdatasync - Make a file's data durable
+ * 
+ * As sys_fsync(): everything the inode may still owe (size, block
+ * list) is needed to read the data back.
+ */
+uint64_t sys_fdatasync(int fd) {
+    if (vfs_fsync(fd, 1) != 0) {
+        return SYSCALL_ERROR;
+    }
+    return SYSCALL_SUCCESS;
+}
+
+/**
+ * sys_sync - Make every mounted filesystem durable
+ * 
+ * @return 0 on success, -1 if some write-back or flush failed (EIO)
+ */
+uint64_t sys_sync(void) {
+    if (vfs_sync() != 0) {
+        return SYSCALL_ERROR;
+    }
+    return SYSCALL_SUCCESS;
+}
+
 /**
  * sys_lseek - Seek file position
  * 
@@ -630,8 +881,9 @@ uint64_t sys_write(int file_descriptor, const char *buffer, size_t byte_count) {
  * @return New file position, or -1 on error
  */
 uint64_t sys_lseek(int fd, int64_t offset, int whence) {
-    // Don't allow seeking on stdin/stdout/stderr
-    if (fd <= STDERR_FD) {
+    // The console has no position
+    if (vfs_is_console(fd)) {
+        set_errno(THUNDEROS_ESPIPE);
         return SYSCALL_ERROR;
     }
     
@@ -773,41 +1025,96 @@ uint64_t sys_rmdir(const char *path) {
 /**
  * sys_mmap - Map memory into process address space
  * 
- * Simplified mmap implementation for memory isolation.
+ * Anonymous mappings are zero-filled on demand. File mappings fault their
+ * pages in from the page cache: MAP_PRIVATE copies a page on first write,
+ * MAP_SHARED writes to the cached page, which msync(), munmap() and exit
+ * write back to the file. A shared memory descriptor (shm_open) maps the
+ * object's own pages and must be mapped MAP_SHARED, within its size; so
+ * must a device node (such as /dev/fb0), which maps the device's memory.
+ * Shared anonymous memory is not supported.
  * 
  * @param addr Hint address (0 = kernel chooses)
  * @param length Length of mapping in bytes
  * @param prot Protection flags (PROT_READ, PROT_WRITE, PROT_EXEC)
- * @param flags Mapping flags (MAP_PRIVATE, MAP_ANONYMOUS, etc.)
+ * @param flags Mapping flags (MAP_SHARED or MAP_PRIVATE, MAP_ANONYMOUS)
  * @param fd File descriptor (ignored if MAP_ANONYMOUS)
- * @param offset File offset (ignored if MAP_ANONYMOUS)
+ * @param offset File offset, page-aligned (ignored if MAP_ANONYMOUS)
  * @return Mapped address on success, -1 on error
  */
 uint64_t sys_mmap(void *addr, size_t length, int prot, int flags, int fd, uint64_t offset) {
     struct process *proc = process_current();
     if (!proc || length == 0) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    int shared = (flags & MAP_SHARED) != 0;
+    if (shared && (flags & MAP_PRIVATE)) {
+        set_errno(THUNDEROS_EINVAL);
         return SYSCALL_ERROR;
     }
     
-    (void)fd;      // TODO: Implement file-backed mappings
-    (void)offset;  // TODO: Implement file offset
-    (void)flags;   // TODO: Handle MAP_SHARED vs MAP_PRIVATE
+    uint64_t pages_len = (length + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    
+    // Resolve the backing file
+    vfs_node_t *file = NULL;
+    shm_object_t *shm = NULL;
+    if (!(flags & MAP_ANONYMOUS)) {
+        vfs_file_t *vfile = vfs_get_file(fd);
+        if (vfile && vfile->type == VFS_TYPE_SHM) {
+            // Shared memory: no private copies, and no pages past the end
+            shm = (shm_object_t *)vfile->shm;
+            if (!shared || offset + length > shm_size(shm)) {
+                set_errno(THUNDEROS_EINVAL);
+                return SYSCALL_ERROR;
+            }
+        } else if (vfile && vfile->node && vfile->node->type == VFS_TYPE_DEVICE) {
+            // Device memory: shared, and only what the device has
+            if (!vfile->node->ops || !vfile->node->ops->map_page) {
+                set_errno(THUNDEROS_ENODEV);
+                return SYSCALL_ERROR;
+            }
+            if (!shared || offset > vfile->node->size || length > vfile->node->size - offset) {
+                set_errno(THUNDEROS_EINVAL);
+                return SYSCALL_ERROR;
+            }
+        } else if (!vfile || vfile->type != VFS_TYPE_FILE || !vfile->node ||
+            vfile->node->type != VFS_TYPE_FILE) {
+            set_errno(THUNDEROS_EBADF);
+            return SYSCALL_ERROR;
+        }
+        
+        // The page cache indexes files by 32-bit page number
+        if ((offset & (PAGE_SIZE - 1)) != 0 || offset > PAGE_CACHE_MAX_FILE_SIZE ||
+            pages_len > PAGE_CACHE_MAX_FILE_SIZE - offset) {
+            set_errno(THUNDEROS_EINVAL);
+            return SYSCALL_ERROR;
+        }
+        
+        // The file must be readable, and writable for shared writes
+        int readable = (vfile->flags & O_RDWR) || !(vfile->flags & O_WRONLY);
+        int writable = (vfile->flags & (O_WRONLY | O_RDWR)) != 0;
+        if (!readable || (shared && (prot & PROT_WRITE) && !writable)) {
+            set_errno(THUNDEROS_EACCES);
+            return SYSCALL_ERROR;
+        }
+        
+        file = shm ? NULL : vfile->node;
+    } else if (shared) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
     
     // Determine mapping address
     uint64_t map_addr;
     if (addr) {
-        map_addr = (uint64_t)addr;
+        map_addr = (uint64_t)addr & ~(PAGE_SIZE - 1);
     } else {
-        // Find free space in user address space (simple allocator)
-        map_addr = USER_MMAP_START;
-        
-        // Search for free region
-        vm_area_t *vma = proc->vm_areas;
-        while (vma) {
-            if (map_addr >= vma->start && map_addr < vma->end) {
-                map_addr = vma->end;
-            }
-            vma = vma->next;
+        // First free range above USER_MMAP_START large enough to fit
+        map_addr = process_find_free_area(proc, USER_MMAP_START, pages_len);
+        if (map_addr == 0) {
+            set_errno(THUNDEROS_ENOMEM);
+            return SYSCALL_ERROR;
         }
     }
     
@@ -816,9 +1123,16 @@ uint64_t sys_mmap(void *addr, size_t length, int prot, int flags, int fd, uint64
     if (prot & PROT_READ) vm_flags |= VM_READ;
     if (prot & PROT_WRITE) vm_flags |= VM_WRITE;
     if (prot & PROT_EXEC) vm_flags |= VM_EXEC;
+    if (shared) vm_flags |= VM_SHARED;
     
-    // Map the region
-    if (process_map_region(proc, map_addr, length, vm_flags) != 0) {
+    // Reserve the region; pages are faulted in on first touch
+    int result;
+    if (shm) {
+        result = process_add_shm_vma(proc, map_addr, map_addr + pages_len, vm_flags, shm, offset);
+    } else {
+        result = process_add_file_vma(proc, map_addr, map_addr + pages_len, vm_flags, file, offset);
+    }
+    if (result != 0) {
         return SYSCALL_ERROR;
     }
     
@@ -847,10 +1161,12 @@ uint64_t sys_munmap(void *addr, size_t length) {
         return SYSCALL_ERROR;  // Address not start of mapping
     }
     
-    // Unmap all pages in the region
-    for (uint64_t page = start; page < end; page += PAGE_SIZE) {
-        unmap_page(proc->page_table, page);
-    }
+    // Unmap all pages in the region with a single TLB flush
+    mmu_gather_t tlb;
+    tlb_gather_init(&tlb, proc->page_table);
+    tlb_gather_unmap_range(&tlb, start, end);
+    tlb_gather_finish(&tlb);
+    process_account_rss(proc, -(int64_t)tlb.unmapped);
     
     // Remove VMA
     process_remove_vma(proc, vma);
@@ -859,973 +1175,4022 @@ uint64_t sys_munmap(void *addr, size_t length) {
 }
 
 /**
- * sys_pipe - Create a pipe
+ * sys_msync - Write back a shared file mapping
  * 
- * Creates an anonymous pipe for inter-process communication.
- * Returns two file descriptors in pipefd array:
- * - pipefd[0] is the read end
- * - pipefd[1] is the write end
- * 
- * Typical usage with fork():
- *   int pipefd[2];
- *   pipe(pipefd);
- *   if (fork() == 0) {
- *     // Child: close read end, write to pipe
- *     close(pipefd[0]);
- *     write(pipefd[1], "hello", 5);
- *   } else {
- *     // Parent: close write end, read from pipe
- *     close(pipefd[1]);
- *     read(pipefd[0], buf, sizeof(buf));
- *   }
+ * Writes dirty pages of every MAP_SHARED file mapping in the range back
+ * to the file. Writeback is always synchronous, so MS_ASYNC behaves like
+ * MS_SYNC; MS_INVALIDATE is accepted and has nothing to do, since all
+ * mappings of a file share the page cache.
  * 
- * @param pipefd Array of 2 integers to receive file descriptors
+ * @param addr Start of range (must be page-aligned)
+ * @param length Length of range in bytes
+ * @param flags MS_ASYNC or MS_SYNC, optionally MS_INVALIDATE
  * @return 0 on success, -1 on error
- * 
- * @errno THUNDEROS_EINVAL - Invalid pipefd pointer
- * @errno THUNDEROS_EMFILE - Too many open files
- * @errno THUNDEROS_ENOMEM - Failed to allocate pipe buffer
  */
-uint64_t sys_pipe(int pipefd[2]) {
+uint64_t sys_msync(void *addr, size_t length, int flags) {
     struct process *proc = process_current();
-    if (!proc) {
+    uint64_t start = (uint64_t)addr;
+    
+    if (!proc || (start & (PAGE_SIZE - 1)) != 0 ||
+        (flags & ~(MS_ASYNC | MS_INVALIDATE | MS_SYNC)) != 0 ||
+        ((flags & MS_ASYNC) && (flags & MS_SYNC))) {
+        set_errno(THUNDEROS_EINVAL);
         return SYSCALL_ERROR;
     }
     
-    // Validate user pointer
-    if (!pipefd || !process_validate_user_ptr(proc, pipefd, sizeof(int) * 2, VM_WRITE)) {
+    uint64_t end = (start + length + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (end < start || end > USER_VIRT_END) {
+        set_errno(THUNDEROS_ENOMEM);
         return SYSCALL_ERROR;
     }
     
-    // Create the pipe through VFS
-    if (vfs_create_pipe(pipefd) != 0) {
-        // errno already set by vfs_create_pipe
-        return SYSCALL_ERROR;
+    // Every page of the range must be mapped
+    uint64_t addr_cursor = start;
+    while (addr_cursor < end) {
+        vm_area_t *vma = process_find_vma(proc, addr_cursor);
+        if (!vma) {
+            set_errno(THUNDEROS_ENOMEM);
+            return SYSCALL_ERROR;
+        }
+        if (process_sync_vma(vma, addr_cursor, end) != 0) {
+            /* errno already set by process_sync_vma */
+            return SYSCALL_ERROR;
+        }
+        addr_cursor = vma->end;
     }
     
+    clear_errno();
     return SYSCALL_SUCCESS;
 }
 
 /**
- * sys_dup2 - Duplicate a file descriptor
+ * sys_madvise - Advise the kernel about a range of a mapping
  * 
- * Makes newfd be the copy of oldfd, closing newfd first if necessary.
- * Used for I/O redirection in shells (e.g., redirecting stdin/stdout to pipes).
+ * MADV_DONTNEED unmaps the range's pages and frees those nobody else
+ * shares, keeping the mapping: the next touch faults in a zeroed page
+ * (anonymous memory) or the file's page again (private file mappings).
+ * This is how an allocator hands back freed memory without giving up
+ * the address range. Shared mappings are refused, since dropping their
+ * pages would not free anything. MADV_MERGEABLE and MADV_UNMERGEABLE
+ * start and stop ksmd merging identical pages of the private mappings
+ * the range touches, whole mappings at a time (mm/ksm.h). MADV_NORMAL
+ * and MADV_WILLNEED are accepted and change nothing.
  * 
- * @param oldfd The file descriptor to duplicate
- * @param newfd The target file descriptor number
- * @return newfd on success, -1 on error
+ * @param addr Start of range (must be page-aligned)
+ * @param length Length of range in bytes
+ * @param advice MADV_NORMAL, MADV_WILLNEED, MADV_DONTNEED,
+ *               MADV_MERGEABLE or MADV_UNMERGEABLE
+ * @return 0 on success, -1 on error
  * 
- * @errno THUNDEROS_EBADF - oldfd is not a valid file descriptor
- * @errno THUNDEROS_EINVAL - newfd is out of range
+ * @errno THUNDEROS_EINVAL - addr not aligned, unknown advice, or
+ *                           MADV_DONTNEED or MADV_MERGEABLE on a shared
+ *                           mapping
+ * @errno THUNDEROS_ENOMEM - Part of the range is not mapped
+ * @errno THUNDEROS_EAGAIN - No process slot to start ksmd in
  */
-uint64_t sys_dup2(int oldfd, int newfd) {
-    int result = vfs_dup2(oldfd, newfd);
-    if (result < 0) {
+uint64_t sys_madvise(void *addr, size_t length, int advice) {
+    struct process *proc = process_current();
+    uint64_t start = (uint64_t)addr;
+    int ksm = advice == MADV_MERGEABLE || advice == MADV_UNMERGEABLE;
+    
+    if (!proc || (start & (PAGE_SIZE - 1)) != 0 ||
+        (advice != MADV_NORMAL && advice != MADV_WILLNEED && advice != MADV_DONTNEED && !ksm)) {
+        set_errno(THUNDEROS_EINVAL);
         return SYSCALL_ERROR;
     }
-    return result;
+    
+    uint64_t end = (start + length + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (end < start || end > USER_VIRT_END) {
+        set_errno(THUNDEROS_ENOMEM);
+        return SYSCALL_ERROR;
+    }
+    
+    // Every page of the range must be mapped, and privately to drop it
+    uint64_t addr_cursor = start;
+    while (addr_cursor < end) {
+        vm_area_t *vma = process_find_vma(proc, addr_cursor);
+        if (!vma) {
+            set_errno(THUNDEROS_ENOMEM);
+            return SYSCALL_ERROR;
+        }
+        if ((advice == MADV_DONTNEED || advice == MADV_MERGEABLE) && (vma->flags & VM_SHARED)) {
+            set_errno(THUNDEROS_EINVAL);
+            return SYSCALL_ERROR;
+        }
+        addr_cursor = vma->end;
+    }
+    
+    if (advice == MADV_MERGEABLE && start < end && ksm_start() != 0) {
+        /* errno already set by ksm_start */
+        return SYSCALL_ERROR;
+    }
+    
+    for (addr_cursor = start; ksm && addr_cursor < end; ) {
+        vm_area_t *vma = process_find_vma(proc, addr_cursor);
+        if (advice == MADV_MERGEABLE) {
+            vma->flags |= VM_MERGEABLE;
+        } else {
+            vma->flags &= ~VM_MERGEABLE;
+        }
+        addr_cursor = vma->end;
+    }
+    
+    if (advice == MADV_DONTNEED && start < end) {
+        // One TLB flush for the whole range
+        mmu_gather_t tlb;
+        tlb_gather_init(&tlb, proc->page_table);
+        tlb_gather_unmap_range(&tlb, start, end);
+        tlb_gather_finish(&tlb);
+        process_account_rss(proc, -(int64_t)tlb.unmapped);
+    }
+    
+    clear_errno();
+    return SYSCALL_SUCCESS;
 }
 
 /**
- * sys_getuid - Get real user ID
+ * sys_pipe - Create a pipe
  * 
- * @return Real user ID of current process
+ * Creates an anonymous pipe for inter-process communication.
+ * Returns two file descriptors in pipefd array:
+ * - pipefd[0] is the read end
+ * - pipefd[1] is the write end
+ * 
+ * Typical usage with fork():
+ *   int pipefd[2];
+ *   pipe(pipefd);
+ *   if (fork() == 0) {
+ *     // Child: close read end, write to pipe
+ *     close(pipefd[0]);
+ *     write(pipefd[1], "hello", 5);
+ *   } else {
+ *     // Parent: close write end, read from pipe
+ *     close(pipefd[1]);
+ *     read(pipefd[0], buf, sizeof(buf));
+ *   }
+ * 
+ * @param pipefd Array of 2 integers to receive file descriptors
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Invalid pipefd pointer
+ * @errno THUNDEROS_EFAULT - pipefd not writable
+ * @errno THUNDEROS_EMFILE - Too many open files
+ * @errno THUNDEROS_ENOMEM - Failed to allocate pipe buffer
  */
-uint64_t sys_getuid(void) {
-    struct process *proc = process_current();
-    if (!proc) {
-        return 0;  /* Default to root */
-    }
-    return proc->uid;
+uint64_t sys_pipe(int pipefd[2]) {
+    return sys_pipe2(pipefd, 0);
 }
 
 /**
- * sys_getgid - Get real group ID
+ * sys_pipe2 - Create a pipe with flags
  * 
- * @return Real group ID of current process
+ * As sys_pipe, with O_NONBLOCK allowed in flags: both ends then fail
+ * with EAGAIN instead of blocking.
+ * 
+ * @param pipefd Array of 2 integers to receive file descriptors
+ * @param flags O_NONBLOCK or 0
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Invalid pipefd pointer or unknown flags
+ * @errno THUNDEROS_EFAULT - pipefd not writable
+ * @errno THUNDEROS_EMFILE - Too many open files
+ * @errno THUNDEROS_ENOMEM - Failed to allocate pipe buffer
  */
-uint64_t sys_getgid(void) {
+uint64_t sys_pipe2(int pipefd[2], int flags) {
     struct process *proc = process_current();
     if (!proc) {
-        return 0;  /* Default to root */
+        return SYSCALL_ERROR;
     }
-    return proc->gid;
+    
+    if (!pipefd) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    // Create the pipe through VFS
+    int fds[2];
+    if (vfs_create_pipe(fds, (uint32_t)flags) != 0) {
+        // errno already set by vfs_create_pipe
+        return SYSCALL_ERROR;
+    }
+    
+    if (copy_to_user(pipefd, fds, sizeof(fds)) != 0) {
+        // Nobody would ever learn the descriptors
+        vfs_close(fds[0]);
+        vfs_close(fds[1]);
+        set_errno(THUNDEROS_EFAULT);
+        return SYSCALL_ERROR;
+    }
+    
+    return SYSCALL_SUCCESS;
 }
 
 /**
- * sys_geteuid - Get effective user ID
+ * sys_fcntl - Control an open file
  * 
- * @return Effective user ID of current process
+ * F_GETFL and F_SETFL read and change the status flags of any
+ * descriptor; F_SETFL toggles O_NONBLOCK and O_APPEND. F_GETPIPE_SZ and
+ * F_SETPIPE_SZ read or change how much a pipe buffers before writers
+ * block (64KB by default, 256KB at most, rounded up to whole pages).
+ * 
+ * @param fd File descriptor
+ * @param cmd F_* command
+ * @param arg New flags for F_SETFL, new size in bytes for F_SETPIPE_SZ
+ * @return Flags (F_GETFL), pipe capacity in bytes, or 0; -1 on error
+ * 
+ * @errno THUNDEROS_EBADF - Invalid file descriptor
+ * @errno THUNDEROS_EINVAL - Not a pipe, unknown command or zero size
+ * @errno THUNDEROS_EPERM - Size above the maximum
+ * @errno THUNDEROS_EBUSY - Pipe holds more data than the new size
  */
-uint64_t sys_geteuid(void) {
-    struct process *proc = process_current();
-    if (!proc) {
-        return 0;  /* Default to root */
+uint64_t sys_fcntl(int fd, int cmd, uint64_t arg) {
+    int result = vfs_fcntl(fd, cmd, arg);
+    if (result < 0) {
+        return SYSCALL_ERROR;
     }
-    return proc->euid;
+    return result;
 }
 
 /**
- * sys_getegid - Get effective group ID
+ * sys_ioctl - Send a device-specific request to an open device
  * 
- * @return Effective group ID of current process
+ * What the request does, and what arg points at, is up to the device's
+ * driver (see drivers/fbdev.h for /dev/fb0).
+ * 
+ * @param fd File descriptor
+ * @param request Request number
+ * @param arg Request argument, often a user pointer
+ * @return Request result (0 for most); -1 on error
+ * 
+ * @errno THUNDEROS_EBADF - Invalid file descriptor
+ * @errno THUNDEROS_ENOTTY - Not a device, or not a request it knows
+ * @errno THUNDEROS_EFAULT - arg points outside the caller's memory
  */
-uint64_t sys_getegid(void) {
-    struct process *proc = process_current();
-    if (!proc) {
-        return 0;  /* Default to root */
+uint64_t sys_ioctl(int fd, uint32_t request, uint64_t arg) {
+    int result = vfs_ioctl(fd, request, arg);
+    if (result < 0) {
+        return SYSCALL_ERROR;
     }
-    return proc->egid;
+    return result;
 }
 
 /**
- * sys_chmod - Change file permissions
+ * sys_socket - Create a socket
  * 
- * @param path Path to file
- * @param mode New permission bits (e.g., 0755)
- * @return 0 on success, -1 on error
+ * @param domain AF_INET or AF_UNIX
+ * @param type SOCK_DGRAM or SOCK_STREAM, optionally with SOCK_NONBLOCK
+ * @param protocol 0, or IPPROTO_UDP or IPPROTO_TCP for AF_INET
+ * @return New file descriptor, or -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Unknown type flags
+ * @errno THUNDEROS_EAFNOSUPPORT - Neither AF_INET nor AF_UNIX
+ * @errno THUNDEROS_EPROTONOSUPPORT - Not a UDP or TCP socket, or a protocol
+ *        with AF_UNIX
+ * @errno THUNDEROS_EMFILE - Too many open files
  */
-uint64_t sys_chmod(const char *path, uint32_t mode) {
-    if (!path) {
+uint64_t sys_socket(int domain, int type, int protocol) {
+    if (type & ~(SOCK_TYPE_MASK | SOCK_NONBLOCK)) {
         set_errno(THUNDEROS_EINVAL);
         return SYSCALL_ERROR;
     }
     
-    int result = vfs_chmod(path, mode);
-    if (result < 0) {
+    socket_t *sock = socket_create(domain, type, protocol);
+    if (!sock) {
         return SYSCALL_ERROR;
     }
-    return 0;
+    
+    int fd = vfs_create_socket(sock, (uint32_t)(type & SOCK_NONBLOCK));
+    if (fd < 0) {
+        socket_put(sock);
+        return SYSCALL_ERROR;
+    }
+    return fd;
 }
 
 /**
- * sys_chown - Change file owner and group
+ * sys_socketpair - Create two connected AF_UNIX sockets
  * 
- * @param path Path to file
- * @param uid New owner user ID
- * @param gid New owner group ID
+ * @param domain AF_UNIX
+ * @param type SOCK_DGRAM or SOCK_STREAM, optionally with SOCK_NONBLOCK
+ * @param protocol 0
+ * @param sv Filled with the two descriptors
  * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Unknown type flags
+ * @errno THUNDEROS_EOPNOTSUPP - AF_INET
+ * @errno THUNDEROS_EAFNOSUPPORT, THUNDEROS_EPROTONOSUPPORT - As sys_socket
+ * @errno THUNDEROS_EMFILE - Too many open files
+ * @errno THUNDEROS_EFAULT - sv points outside the caller's memory
  */
-uint64_t sys_chown(const char *path, uint16_t uid, uint16_t gid) {
-    if (!path) {
+uint64_t sys_socketpair(int domain, int type, int protocol, int *sv) {
+    if (type & ~(SOCK_TYPE_MASK | SOCK_NONBLOCK)) {
         set_errno(THUNDEROS_EINVAL);
         return SYSCALL_ERROR;
     }
     
-    int result = vfs_chown(path, uid, gid);
-    if (result < 0) {
+    socket_t *pair[2];
+    if (socket_create_pair(domain, type, protocol, pair) != 0) {
+        return SYSCALL_ERROR;
+    }
+    
+    int fds[2];
+    fds[0] = vfs_create_socket(pair[0], (uint32_t)(type & SOCK_NONBLOCK));
+    if (fds[0] < 0) {
+        socket_put(pair[0]);
+        socket_put(pair[1]);
+        return SYSCALL_ERROR;
+    }
+    fds[1] = vfs_create_socket(pair[1], (uint32_t)(type & SOCK_NONBLOCK));
+    if (fds[1] < 0) {
+        vfs_close(fds[0]);
+        socket_put(pair[1]);
+        set_errno(THUNDEROS_EMFILE);
+        return SYSCALL_ERROR;
+    }
+    
+    if (copy_to_user(sv, fds, sizeof(fds)) != 0) {
+        vfs_close(fds[0]);
+        vfs_close(fds[1]);
+        set_errno(THUNDEROS_EFAULT);
         return SYSCALL_ERROR;
     }
     return 0;
 }
 
 /**
- * Directory entry structure for getdents
- * Similar to Linux struct linux_dirent
+ * Copy a socket address in from user space
+ * 
+ * An AF_UNIX name may be shorter than sun_path, and need not end in a
+ * NUL when it fills it.
  */
-struct thunderos_dirent {
-    uint32_t d_ino;       /* Inode number */
-    uint16_t d_reclen;    /* Record length */
-    uint8_t  d_type;      /* File type */
-    char     d_name[MAX_NAME_LEN]; /* File name (null-terminated) */
-};
+static int sockaddr_import(socket_addr_t *kaddr, const void *uaddr, uint32_t addrlen) {
+    if (addrlen < sizeof(kaddr->family)) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    uint32_t n = addrlen < sizeof(*kaddr) ? addrlen : (uint32_t)sizeof(*kaddr);
+    kmemset(kaddr, 0, sizeof(*kaddr));
+    if (copy_from_user(kaddr, uaddr, n) != 0) {
+        return -1;
+    }
+    if (kaddr->family == AF_INET && addrlen < sizeof(kaddr->in)) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    return 0;
+}
 
 /**
- * sys_getdents - Get directory entries
+ * Size of a socket address as user space sees it
  * 
- * Reads directory entries from an open directory file descriptor.
+ * As on Linux, an AF_UNIX name counts with its NUL (none when it fills
+ * sun_path), and an unnamed socket is just the family.
+ */
+static uint32_t sockaddr_size(const socket_addr_t *kaddr) {
+    if (kaddr->family != AF_UNIX) {
+        return sizeof(kaddr->in);
+    }
+    uint32_t len = 0;
+    while (len < UNIX_PATH_MAX && kaddr->un.sun_path[len]) {
+        len++;
+    }
+    if (len == 0) {
+        return sizeof(kaddr->family);
+    }
+    return (uint32_t)offsetof(struct sockaddr_un, sun_path) + len + (len < UNIX_PATH_MAX);
+}
+
+/**
+ * Copy a socket address out to a user buffer of *len bytes
  * 
- * @param fd File descriptor of open directory
- * @param dirp Buffer to store directory entries
- * @param count Size of buffer in bytes
- * @return Number of bytes read on success, 0 on end of directory, -1 on error
+ * As on Linux, the address is cut to fit and *len set to its full size.
+ */
+static int sockaddr_export(void *uaddr, uint32_t *len, const socket_addr_t *kaddr) {
+    uint32_t size = sockaddr_size(kaddr);
+    uint32_t n = *len < size ? *len : size;
+    if (n && copy_to_user(uaddr, kaddr, n) != 0) {
+        return -1;
+    }
+    *len = size;
+    return 0;
+}
+
+/**
+ * sys_bind - Give a socket its local address and port
  * 
- * @errno THUNDEROS_EINVAL - Invalid buffer or count
- * @errno THUNDEROS_EBADF - Invalid file descriptor
- * @errno THUNDEROS_ENOTDIR - fd does not refer to a directory
+ * @param fd Socket descriptor
+ * @param addr struct sockaddr_in (INADDR_ANY: every local address; port 0:
+ *             any free one), or struct sockaddr_un with a name
+ * @param addrlen Size of addr
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_ENOTSOCK - fd is not a socket
+ * @errno THUNDEROS_EINVAL - Already bound, addrlen too small, or an empty name
+ * @errno THUNDEROS_EAFNOSUPPORT - addr is of the other family
+ * @errno THUNDEROS_EADDRNOTAVAIL - Not a local address
+ * @errno THUNDEROS_EADDRINUSE - Port or name taken
  */
-uint64_t sys_getdents(int fd, void *dirp, size_t count) {
-    struct process *proc = process_current();
-    if (!proc) {
-        set_errno(THUNDEROS_EINVAL);
+uint64_t sys_bind(int fd, const void *addr, uint32_t addrlen) {
+    socket_t *sock = vfs_get_socket(fd);
+    if (!sock) {
         return SYSCALL_ERROR;
     }
     
-    if (!dirp || count < sizeof(struct thunderos_dirent)) {
-        set_errno(THUNDEROS_EINVAL);
+    socket_addr_t kaddr;
+    if (sockaddr_import(&kaddr, addr, addrlen) != 0 || socket_bind(sock, &kaddr) != 0) {
         return SYSCALL_ERROR;
     }
-    
-    // Validate user pointer
-    if (!process_validate_user_ptr(proc, dirp, count, VM_WRITE)) {
+    return 0;
+}
+
+/**
+ * sys_sendto - Send a datagram, or data on a connected stream
+ * 
+ * An unbound datagram socket is bound to an ephemeral port first. A
+ * stream socket ignores dest and waits for buffer space unless the
+ * descriptor is non-blocking or flags has MSG_DONTWAIT.
+ * 
+ * @param fd Socket descriptor
+ * @param buffer Payload
+ * @param len Payload size, at most 1472 bytes for an AF_INET datagram (one
+ *            Ethernet frame), 64 KiB for an AF_UNIX one
+ * @param flags MSG_DONTWAIT or 0 (a datagram never waits for the socket)
+ * @param dest Destination (datagram; NULL: the connect()ed peer)
+ * @param addrlen Size of dest
+ * @return Bytes sent, or -1 on error
+ * 
+ * @errno THUNDEROS_ENOTSOCK - fd is not a socket
+ * @errno THUNDEROS_EDESTADDRREQ - No destination
+ * @errno THUNDEROS_EMSGSIZE - Payload too large
+ * @errno THUNDEROS_ENETDOWN - No network device for a non-local address
+ * @errno THUNDEROS_EHOSTUNREACH - The next hop does not answer ARP
+ * @errno THUNDEROS_EPIPE, THUNDEROS_ENOTCONN, THUNDEROS_EAGAIN - Stream, see tcp_sendmsg()
+ * @errno Otherwise see unix_sendmsg() for AF_UNIX
+ */
+uint64_t sys_sendto(int fd, const void *buffer, size_t len, int flags,
+                    const void *dest, uint32_t addrlen) {
+    if (flags & ~MSG_DONTWAIT) {
         set_errno(THUNDEROS_EINVAL);
         return SYSCALL_ERROR;
     }
-    
-    // Get the file from fd
-    vfs_file_t *file = vfs_get_file(fd);
-    if (!file || !file->node) {
-        set_errno(THUNDEROS_EBADF);
+    socket_t *sock = vfs_get_socket(fd);
+    if (!sock) {
         return SYSCALL_ERROR;
     }
     
-    vfs_node_t *node = file->node;
-    
-    // Must be a directory
-    if (node->type != VFS_TYPE_DIRECTORY) {
-        set_errno(THUNDEROS_ENOTDIR);
+    socket_addr_t kdest;
+    if (dest && sockaddr_import(&kdest, dest, addrlen) != 0) {
         return SYSCALL_ERROR;
     }
     
-    // Check for readdir operation
-    if (!node->ops || !node->ops->readdir) {
-        set_errno(THUNDEROS_EIO);
+    int nonblock = (flags & MSG_DONTWAIT) || vfs_is_nonblock(fd);
+    vfs_iovec_t iov = { (void *)buffer, len };
+    socket_get(sock);
+    int sent = socket_sendmsg(sock, dest ? &kdest : NULL, &iov, 1, NULL, nonblock, NULL);
+    socket_put(sock);
+    if (sent < 0) {
         return SYSCALL_ERROR;
     }
-    
-    // Read directory entries starting from current position
-    uint8_t *buf = (uint8_t *)dirp;
-    size_t bytes_written = 0;
-    uint32_t index = file->pos;
-    
-    char name[MAX_NAME_LEN];
-    uint32_t inode_num;
-    
-    while (bytes_written + sizeof(struct thunderos_dirent) <= count) {
-        int ret = node->ops->readdir(node, index, name, &inode_num);
-        if (ret != 0) {
-            // No more entries
-            break;
-        }
-        
-        // Create dirent entry
-        struct thunderos_dirent *entry = (struct thunderos_dirent *)(buf + bytes_written);
-        entry->d_ino = inode_num;
-        entry->d_reclen = sizeof(struct thunderos_dirent);
-        entry->d_type = 0;  // DT_UNKNOWN for now
-        
-        // Copy name
-        uint32_t name_len = 0;
-        while (name[name_len] && name_len < (MAX_NAME_LEN - 1)) {
-            entry->d_name[name_len] = name[name_len];
-            name_len++;
-        }
-        entry->d_name[name_len] = '\0';
-        
-        bytes_written += sizeof(struct thunderos_dirent);
-        index++;
-    }
-    
-    // Update file position
-    file->pos = index;
-    
-    clear_errno();
-    return bytes_written;
+    return sent;
 }
 
 /**
- * sys_chdir - Change current working directory
+ * sys_recvfrom - Receive a datagram, or data on a stream
  * 
- * Supports both absolute and relative paths. The path is normalized
- * before storing in the process control block.
+ * Waits for one unless the descriptor is non-blocking or flags has
+ * MSG_DONTWAIT. A datagram longer than len is cut short; the rest of
+ * it is discarded. A stream returns what has arrived (0 at its end) and
+ * the peer as src.
  * 
- * @param path Path to new working directory (absolute or relative)
- * @return 0 on success, -1 on error
+ * @param fd Socket descriptor
+ * @param buffer Where the payload goes
+ * @param len Size of buffer
+ * @param flags MSG_DONTWAIT or 0
+ * @param src Filled with the sender's address (NULL: not wanted)
+ * @param addrlen Size of src, set to the address size (needed with src)
+ * @return Bytes received, or -1 on error
  * 
- * @errno THUNDEROS_EINVAL - Invalid path
- * @errno THUNDEROS_ENOENT - Path does not exist
- * @errno THUNDEROS_ENOTDIR - Path is not a directory
+ * @errno THUNDEROS_ENOTSOCK - fd is not a socket
+ * @errno THUNDEROS_EAGAIN - Nothing to receive without waiting
+ * @errno THUNDEROS_EINTR - A signal arrived first
+ * @errno THUNDEROS_EFAULT - Bad buffer or address
  */
-uint64_t sys_chdir(const char *path) {
-    struct process *proc = process_current();
-    if (!proc) {
+uint64_t sys_recvfrom(int fd, void *buffer, size_t len, int flags,
+                      void *src, uint32_t *addrlen) {
+    if (flags & ~MSG_DONTWAIT) {
         set_errno(THUNDEROS_EINVAL);
         return SYSCALL_ERROR;
     }
-    
-    if (!is_valid_user_pointer(path, 1)) {
-        set_errno(THUNDEROS_EINVAL);
+    socket_t *sock = vfs_get_socket(fd);
+    if (!sock) {
         return SYSCALL_ERROR;
     }
     
-    /* Normalize the path (handles relative paths, ., ..) */
-    char normalized_path[VFS_MAX_PATH];
-    if (vfs_normalize_path(path, normalized_path, VFS_MAX_PATH) < 0) {
-        /* errno already set by vfs_normalize_path */
+    /* Check the length first, so no datagram is lost to a bad pointer */
+    uint32_t klen = 0;
+    if (src && copy_from_user(&klen, addrlen, sizeof(klen)) != 0) {
         return SYSCALL_ERROR;
     }
     
-    /* Resolve the normalized path to verify it exists and is a directory */
-    vfs_node_t *node = vfs_resolve_path(normalized_path);
-    if (!node) {
-        /* errno already set by vfs_resolve_path */
+    int nonblock = (flags & MSG_DONTWAIT) || vfs_is_nonblock(fd);
+    vfs_iovec_t iov = { buffer, len };
+    socket_addr_t from;
+    
+    socket_get(sock);
+    int received = socket_recvmsg(sock, &iov, 1, src ? &from : NULL, nonblock, 0, NULL, NULL);
+    socket_put(sock);
+    if (received < 0) {
         return SYSCALL_ERROR;
     }
     
-    if (node->type != VFS_TYPE_DIRECTORY) {
-        set_errno(THUNDEROS_ENOTDIR);
+    if (src && (sockaddr_export(src, &klen, &from) != 0 ||
+                copy_to_user(addrlen, &klen, sizeof(klen)) != 0)) {
+        return SYSCALL_ERROR;
+    }
+    return received;
+}
+
+/**
+ * sys_sendmmsg - Send several datagrams in one call
+ * 
+ * Each message is a sendto() (destination in msg_name, payload in
+ * msg_iov); the frames they make leave the device in batches, with one
+ * doorbell for each. msg_len is set for every message sent.
+ * 
+ * @param fd Socket descriptor
+ * @param msgvec Messages
+ * @param vlen Number of messages (at most SOCKET_MMSG_MAX are taken)
+ * @param flags MSG_DONTWAIT or 0
+ * @return Messages sent; -1 on error if none was
+ * 
+ * @errno As sys_sendto, for the first message
+ */
+uint64_t sys_sendmmsg(int fd, struct mmsghdr *msgvec, uint32_t vlen, int flags) {
+    if (flags & ~MSG_DONTWAIT) {
+        set_errno(THUNDEROS_EINVAL);
         return SYSCALL_ERROR;
     }
+    socket_t *sock = vfs_get_socket(fd);
+    if (!sock) {
+        return SYSCALL_ERROR;
+    }
+    if (vlen > SOCKET_MMSG_MAX) {
+        vlen = SOCKET_MMSG_MAX;
+    }
     
-    /* Store the normalized absolute path in process cwd */
-    size_t path_index = 0;
-    while (normalized_path[path_index] && path_index < VFS_MAX_PATH - 1) {
-        proc->cwd[path_index] = normalized_path[path_index];
-        path_index++;
+    int nonblock = (flags & MSG_DONTWAIT) || vfs_is_nonblock(fd);
+    net_tx_batch_t batch;
+    batch.count = 0;
+    socket_get(sock);
+    
+    uint32_t sent = 0;
+    int error = 0;
+    for (; sent < vlen; sent++) {
+        struct mmsghdr m;
+        if (copy_from_user(&m, &msgvec[sent], sizeof(m)) != 0) {
+            error = THUNDEROS_EFAULT;
+            break;
+        }
+        
+        socket_addr_t dest;
+        if (m.msg_hdr.msg_name &&
+            sockaddr_import(&dest, m.msg_hdr.msg_name, m.msg_hdr.msg_namelen) != 0) {
+            error = get_errno();
+            break;
+        }
+        if (m.msg_hdr.msg_iovlen > VFS_IOV_MAX) {
+            error = THUNDEROS_EMSGSIZE;
+            break;
+        }
+        
+        vfs_iovec_t fast[IOV_FAST_COUNT];
+        int iovcnt = (int)m.msg_hdr.msg_iovlen;
+        vfs_iovec_t *iov = iov_import(m.msg_hdr.msg_iov, iovcnt, fast, VM_READ);
+        if (!iov) {
+            error = get_errno();
+            break;
+        }
+        int n = socket_sendmsg(sock, m.msg_hdr.msg_name ? &dest : NULL, iov, iovcnt, &batch,
+                               nonblock, NULL);
+        iov_release(iov, fast);
+        if (n < 0) {
+            error = get_errno();
+            break;
+        }
+        
+        uint32_t msg_len = (uint32_t)n;
+        if (copy_to_user(&msgvec[sent].msg_len, &msg_len, sizeof(msg_len)) != 0) {
+            error = THUNDEROS_EFAULT;
+            break;
+        }
     }
-    proc->cwd[path_index] = '\0';
     
+    net_tx_flush(&batch);
+    socket_put(sock);
+    
+    if (sent == 0 && error) {
+        set_errno(error);
+        return SYSCALL_ERROR;
+    }
     clear_errno();
-    return SYSCALL_SUCCESS;
+    return sent;
 }
 
 /**
- * sys_getcwd - Get current working directory
+ * sys_recvmmsg - Receive several datagrams in one call
  * 
- * @param buf Buffer to store path
- * @param size Size of buffer
- * @return Pointer to buf on success, NULL on error
+ * Fills the messages in turn, as recvfrom() would (sender in msg_name,
+ * MSG_TRUNC in msg_flags for a datagram cut short, byte count in
+ * msg_len). Waits for each message unless the descriptor is
+ * non-blocking or flags has MSG_DONTWAIT; with MSG_WAITFORONE only the
+ * first is waited for. The timeout bounds the whole call.
  * 
- * @errno THUNDEROS_EINVAL - Invalid buffer or size
- * @errno THUNDEROS_ERANGE - Buffer too small for path
+ * @param fd Socket descriptor
+ * @param msgvec Messages
+ * @param vlen Number of messages (at most SOCKET_MMSG_MAX are taken)
+ * @param flags MSG_DONTWAIT, MSG_WAITFORONE
+ * @param timeout Longest wait (NULL: no limit)
+ * @return Messages received; -1 on error if none was
+ * 
+ * @errno THUNDEROS_EINVAL - Unknown flags or bad timeout
+ * @errno THUNDEROS_EAGAIN - Nothing received without waiting, or in time
+ * @errno Otherwise as sys_recvfrom, for the first message
  */
-uint64_t sys_getcwd(char *buf, size_t size) {
-    struct process *proc = process_current();
-    if (!proc) {
+uint64_t sys_recvmmsg(int fd, struct mmsghdr *msgvec, uint32_t vlen, int flags,
+                      const struct timespec *timeout) {
+    if (flags & ~(MSG_DONTWAIT | MSG_WAITFORONE)) {
         set_errno(THUNDEROS_EINVAL);
-        return (uint64_t)NULL;
+        return SYSCALL_ERROR;
+    }
+    socket_t *sock = vfs_get_socket(fd);
+    if (!sock) {
+        return SYSCALL_ERROR;
+    }
+    if (vlen > SOCKET_MMSG_MAX) {
+        vlen = SOCKET_MMSG_MAX;
     }
     
-    if (!buf || size == 0) {
-        set_errno(THUNDEROS_EINVAL);
-        return (uint64_t)NULL;
+    uint64_t deadline_us = 0;
+    if (timeout) {
+        struct timespec ts;
+        if (copy_from_user(&ts, timeout, sizeof(ts)) != 0) {
+            return SYSCALL_ERROR;
+        }
+        if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+            set_errno(THUNDEROS_EINVAL);
+            return SYSCALL_ERROR;
+        }
+        deadline_us = hal_timer_get_time_us() + (uint64_t)ts.tv_sec * 1000000 +
+                      (uint64_t)ts.tv_nsec / 1000;
     }
     
-    if (!process_validate_user_ptr(proc, buf, size, VM_WRITE)) {
-        set_errno(THUNDEROS_EINVAL);
-        return (uint64_t)NULL;
+    int nonblock = (flags & MSG_DONTWAIT) || vfs_is_nonblock(fd);
+    socket_get(sock);
+    
+    uint32_t received = 0;
+    int error = 0;
+    for (; received < vlen; received++) {
+        struct mmsghdr m;
+        if (copy_from_user(&m, &msgvec[received], sizeof(m)) != 0) {
+            error = THUNDEROS_EFAULT;
+            break;
+        }
+        if (m.msg_hdr.msg_iovlen > VFS_IOV_MAX) {
+            error = THUNDEROS_EINVAL;
+            break;
+        }
+        
+        vfs_iovec_t fast[IOV_FAST_COUNT];
+        int iovcnt = (int)m.msg_hdr.msg_iovlen;
+        vfs_iovec_t *iov = iov_import(m.msg_hdr.msg_iov, iovcnt, fast, VM_WRITE);
+        if (!iov) {
+            error = get_errno();
+            break;
+        }
+        socket_addr_t from;
+        int msg_flags;
+        int n = socket_recvmsg(sock, iov, iovcnt, m.msg_hdr.msg_name ? &from : NULL,
+                               nonblock, deadline_us, &msg_flags, NULL);
+        iov_release(iov, fast);
+        if (n < 0) {
+            error = get_errno();
+            break;
+        }
+        
+        if (m.msg_hdr.msg_name &&
+            sockaddr_export(m.msg_hdr.msg_name, &m.msg_hdr.msg_namelen, &from) != 0) {
+            error = THUNDEROS_EFAULT;
+            break;
+        }
+        m.msg_hdr.msg_flags = msg_flags;
+        m.msg_len = (uint32_t)n;
+        if (copy_to_user(&msgvec[received], &m, sizeof(m)) != 0) {
+            error = THUNDEROS_EFAULT;
+            break;
+        }
+        
+        if (flags & MSG_WAITFORONE) {
+            nonblock = 1;
+        }
     }
     
-    // Check if buffer is large enough
-    size_t cwd_len = 0;
-    while (proc->cwd[cwd_len]) cwd_len++;
+    socket_put(sock);
     
-    if (cwd_len >= size) {
-        set_errno(THUNDEROS_ERANGE);
-        return (uint64_t)NULL;
+    if (received == 0 && error) {
+        set_errno(error);
+        return SYSCALL_ERROR;
+    }
+    clear_errno();
+    return received;
+}
+
+/* Control data sendmsg() takes, as Linux's default optmem_max */
+#define SCM_CONTROL_MAX 20480
+
+/**
+ * Take the descriptors named by SCM_RIGHTS headers in user control data
+ * 
+ * Each open file gets a reference in scm; on error none is kept.
+ */
+static int scm_import(socket_scm_t *scm, const void *control, uint64_t controllen) {
+    scm->nfds = 0;
+    if (controllen > SCM_CONTROL_MAX) {
+        RETURN_ERRNO(THUNDEROS_ENOBUFS);
     }
     
-    // Copy cwd to buffer
-    size_t i = 0;
-    while (proc->cwd[i] && i < size - 1) {
-        buf[i] = proc->cwd[i];
-        i++;
+    uint64_t off = 0;
+    while (off + sizeof(struct cmsghdr) <= controllen) {
+        struct cmsghdr cmsg;
+        if (copy_from_user(&cmsg, (const uint8_t *)control + off, sizeof(cmsg)) != 0) {
+            goto fail;
+        }
+        if (cmsg.cmsg_len < sizeof(cmsg) || cmsg.cmsg_len > controllen - off ||
+            cmsg.cmsg_level != SOL_SOCKET || cmsg.cmsg_type != SCM_RIGHTS) {
+            set_errno(THUNDEROS_EINVAL);
+            goto fail;
+        }
+        uint64_t count = (cmsg.cmsg_len - sizeof(cmsg)) / sizeof(int);
+        if (count > SOCKET_SCM_MAX - scm->nfds) {
+            set_errno(THUNDEROS_EINVAL);
+            goto fail;
+        }
+        
+        int fds[SOCKET_SCM_MAX];
+        if (count && copy_from_user(fds, (const uint8_t *)control + off + sizeof(cmsg),
+                                    count * sizeof(int)) != 0) {
+            goto fail;
+        }
+        for (uint64_t i = 0; i < count; i++) {
+            vfs_file_t *file = vfs_get_file(fds[i]);
+            if (!file) {
+                /* errno already set by vfs_get_file */
+                goto fail;
+            }
+            vfs_file_get(file);
+            scm->files[scm->nfds++] = file;
+        }
+        off += CMSG_ALIGN(cmsg.cmsg_len);
     }
-    buf[i] = '\0';
+    return 0;
     
-    clear_errno();
-    return (uint64_t)buf;
+fail:
+    socket_scm_release(scm);
+    return -1;
 }
 
 /**
- * sys_setsid - Create a new session
+ * sys_sendmsg - Send a message, with descriptors on an AF_UNIX socket
  * 
- * Creates a new session with the calling process as the session leader.
- * The process becomes the controlling process of a new terminal.
+ * As sys_sendto, with the destination in msg_name and the payload in
+ * msg_iov. SCM_RIGHTS headers (struct cmsghdr) in msg_control name open
+ * descriptors to pass: the files go with the message, and the receiver
+ * gets descriptors of its own for them.
  * 
- * @return New session ID (process PID) on success, -1 on error
+ * @param fd Socket descriptor
+ * @param msg Message
+ * @param flags MSG_DONTWAIT or 0
+ * @return Bytes sent, or -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Unknown flags, a malformed control header, more
+ *        than SOCKET_SCM_MAX descriptors, an AF_UNIX socket among them, or
+ *        descriptors on an AF_INET socket
+ * @errno THUNDEROS_EBADF - A descriptor passed is not open
+ * @errno THUNDEROS_ENOBUFS - More than 20 KiB of control data
+ * @errno THUNDEROS_EMSGSIZE - More than VFS_IOV_MAX buffers
+ * @errno THUNDEROS_EFAULT - Bad message, buffer or control data
+ * @errno Otherwise as sys_sendto
  */
-uint64_t sys_setsid(void) {
-    /* Use the proper process group implementation */
-    return (uint64_t)process_setsid();
+uint64_t sys_sendmsg(int fd, const struct msghdr *msg, int flags) {
+    if (flags & ~MSG_DONTWAIT) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    socket_t *sock = vfs_get_socket(fd);
+    if (!sock) {
+        return SYSCALL_ERROR;
+    }
+    
+    struct msghdr m;
+    if (copy_from_user(&m, msg, sizeof(m)) != 0) {
+        return SYSCALL_ERROR;
+    }
+    socket_addr_t dest;
+    if (m.msg_name && sockaddr_import(&dest, m.msg_name, m.msg_namelen) != 0) {
+        return SYSCALL_ERROR;
+    }
+    if (m.msg_iovlen > VFS_IOV_MAX) {
+        set_errno(THUNDEROS_EMSGSIZE);
+        return SYSCALL_ERROR;
+    }
+    
+    socket_scm_t scm;
+    if (scm_import(&scm, m.msg_control, m.msg_controllen) != 0) {
+        return SYSCALL_ERROR;
+    }
+    
+    vfs_iovec_t fast[IOV_FAST_COUNT];
+    int iovcnt = (int)m.msg_iovlen;
+    vfs_iovec_t *iov = iov_import(m.msg_iov, iovcnt, fast, VM_READ);
+    if (!iov) {
+        socket_scm_release(&scm);
+        return SYSCALL_ERROR;
+    }
+    
+    int nonblock = (flags & MSG_DONTWAIT) || vfs_is_nonblock(fd);
+    socket_get(sock);
+    int sent = socket_sendmsg(sock, m.msg_name ? &dest : NULL, iov, iovcnt, NULL, nonblock,
+                              scm.nfds ? &scm : NULL);
+    socket_put(sock);
+    iov_release(iov, fast);
+    
+    /* Whatever did not go with the message */
+    int error = get_errno();
+    socket_scm_release(&scm);
+    if (sent < 0) {
+        set_errno(error);
+        return SYSCALL_ERROR;
+    }
+    return sent;
 }
 
 /**
- * sys_setpgid - Set process group ID
+ * sys_recvmsg - Receive a message, with the descriptors passed with it
  * 
- * Sets the process group ID of the specified process.
+ * As sys_recvfrom, with the sender in msg_name and the buffers in
+ * msg_iov. Descriptors that came with the data are installed and listed
+ * in one SCM_RIGHTS header in msg_control; msg_controllen is set to the
+ * control data written (0 if none). Those that do not fit are closed and
+ * MSG_CTRUNC set in msg_flags.
  * 
- * @param pid Process ID (0 for current process)
- * @param pgid New process group ID (0 to use pid as pgid)
- * @return 0 on success, -1 on error
+ * @param fd Socket descriptor
+ * @param msg Message, updated on return
+ * @param flags MSG_DONTWAIT or 0
+ * @return Bytes received, or -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Unknown flags
+ * @errno THUNDEROS_EMSGSIZE - More than VFS_IOV_MAX buffers
+ * @errno THUNDEROS_EFAULT - Bad message, buffer or control data (the
+ *        descriptors received are closed)
+ * @errno Otherwise as sys_recvfrom
  */
-uint64_t sys_setpgid(int pid, int pgid) {
-    return (uint64_t)process_setpgid((pid_t)pid, (pid_t)pgid);
+uint64_t sys_recvmsg(int fd, struct msghdr *msg, int flags) {
+    if (flags & ~MSG_DONTWAIT) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    socket_t *sock = vfs_get_socket(fd);
+    if (!sock) {
+        return SYSCALL_ERROR;
+    }
+    
+    struct msghdr m;
+    if (copy_from_user(&m, msg, sizeof(m)) != 0) {
+        return SYSCALL_ERROR;
+    }
+    if (m.msg_iovlen > VFS_IOV_MAX) {
+        set_errno(THUNDEROS_EMSGSIZE);
+        return SYSCALL_ERROR;
+    }
+    
+    vfs_iovec_t fast[IOV_FAST_COUNT];
+    int iovcnt = (int)m.msg_iovlen;
+    vfs_iovec_t *iov = iov_import(m.msg_iov, iovcnt, fast, VM_WRITE);
+    if (!iov) {
+        return SYSCALL_ERROR;
+    }
+    
+    int nonblock = (flags & MSG_DONTWAIT) || vfs_is_nonblock(fd);
+    socket_addr_t from;
+    int msg_flags = 0;
+    socket_scm_t scm;
+    scm.nfds = 0;
+    
+    socket_get(sock);
+    int received = socket_recvmsg(sock, iov, iovcnt, m.msg_name ? &from : NULL, nonblock, 0,
+                                  &msg_flags, m.msg_control ? &scm : NULL);
+    socket_put(sock);
+    iov_release(iov, fast);
+    if (received < 0) {
+        return SYSCALL_ERROR;
+    }
+    
+    /* Descriptors of our own for the files, as many as the buffer lists */
+    uint64_t room = 0;
+    if (m.msg_controllen >= sizeof(struct cmsghdr)) {
+        room = (m.msg_controllen - sizeof(struct cmsghdr)) / sizeof(int);
+    }
+    int fds[SOCKET_SCM_MAX];
+    uint32_t installed = 0;
+    for (uint32_t i = 0; i < scm.nfds; i++) {
+        int newfd = installed < room ? vfs_install_file(scm.files[i]) : -1;
+        if (newfd < 0) {
+            vfs_file_put(scm.files[i]);
+            msg_flags |= MSG_CTRUNC;
+            continue;
+        }
+        fds[installed++] = newfd;
+    }
+    scm.nfds = 0;
+    
+    int fault = 0;
+    uint64_t controllen = 0;
+    if (installed) {
+        struct cmsghdr cmsg;
+        cmsg.cmsg_len = CMSG_LEN(installed * sizeof(int));
+        cmsg.cmsg_level = SOL_SOCKET;
+        cmsg.cmsg_type = SCM_RIGHTS;
+        if (copy_to_user(m.msg_control, &cmsg, sizeof(cmsg)) != 0 ||
+            copy_to_user((uint8_t *)m.msg_control + sizeof(cmsg), fds,
+                         installed * sizeof(int)) != 0) {
+            fault = 1;
+        }
+        controllen = CMSG_SPACE(installed * sizeof(int));
+        if (controllen > m.msg_controllen) {
+            controllen = m.msg_controllen;
+        }
+    }
+    m.msg_controllen = controllen;
+    m.msg_flags = msg_flags;
+    
+    if (!fault && m.msg_name &&
+        sockaddr_export(m.msg_name, &m.msg_namelen, &from) != 0) {
+        fault = 1;
+    }
+    if (fault || copy_to_user(msg, &m, sizeof(m)) != 0) {
+        for (uint32_t i = 0; i < installed; i++) {
+            vfs_close(fds[i]);
+        }
+        set_errno(THUNDEROS_EFAULT);
+        return SYSCALL_ERROR;
+    }
+    clear_errno();
+    return received;
 }
 
 /**
- * sys_getpgid - Get process group ID
+ * sys_connect - Connect a stream socket
  * 
- * Returns the process group ID of the specified process.
+ * Binds an unbound socket to an ephemeral port first. Waits for the
+ * handshake unless the descriptor is non-blocking: then it fails with
+ * EINPROGRESS, poll() reports POLLOUT when the attempt is over and
+ * SO_ERROR says how it went. An AF_UNIX stream connects as soon as the
+ * listener has backlog room; an AF_UNIX datagram socket just takes addr
+ * as its default destination.
  * 
- * @param pid Process ID (0 for current process)
- * @return Process group ID, or -1 on error
+ * @param fd Socket descriptor
+ * @param addr Peer
+ * @param addrlen Size of addr
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_ENOTSOCK - fd is not a socket
+ * @errno THUNDEROS_EOPNOTSUPP - AF_INET datagram socket
+ * @errno THUNDEROS_EISCONN, THUNDEROS_EALREADY - Connected, or connecting
+ * @errno THUNDEROS_EINPROGRESS - Non-blocking, started
+ * @errno THUNDEROS_ECONNREFUSED - Nothing listens on the port
+ * @errno THUNDEROS_ETIMEDOUT - No answer
+ * @errno THUNDEROS_EINTR - A signal arrived first
+ * @errno Otherwise see unix_connect() for AF_UNIX
  */
-uint64_t sys_getpgid(int pid) {
-    return (uint64_t)process_getpgid((pid_t)pid);
+uint64_t sys_connect(int fd, const void *addr, uint32_t addrlen) {
+    socket_t *sock = vfs_get_socket(fd);
+    if (!sock) {
+        return SYSCALL_ERROR;
+    }
+    
+    socket_addr_t kaddr;
+    if (sockaddr_import(&kaddr, addr, addrlen) != 0) {
+        return SYSCALL_ERROR;
+    }
+    
+    socket_get(sock);
+    int ret = socket_connect(sock, &kaddr, vfs_is_nonblock(fd));
+    socket_put(sock);
+    if (ret != 0) {
+        return SYSCALL_ERROR;
+    }
+    return 0;
 }
 
 /**
- * sys_getsid - Get session ID
+ * sys_listen - Accept connections on a stream socket
  * 
- * Returns the session ID of the specified process.
+ * @param fd Socket descriptor (bound; an unbound one gets an ephemeral port)
+ * @param backlog Connections waiting for accept() (1-128; 0 or less: 16)
+ * @return 0 on success, -1 on error
  * 
- * @param pid Process ID (0 for current process)
- * @return Session ID, or -1 on error
+ * @errno THUNDEROS_ENOTSOCK - fd is not a socket
+ * @errno THUNDEROS_EOPNOTSUPP - Datagram socket
+ * @errno THUNDEROS_EINVAL - Connected or connecting
+ * @errno THUNDEROS_EADDRINUSE - Another socket listens on the port
  */
-uint64_t sys_getsid(int pid) {
-    return (uint64_t)process_getsid((pid_t)pid);
+uint64_t sys_listen(int fd, int backlog) {
+    socket_t *sock = vfs_get_socket(fd);
+    if (!sock) {
+        return SYSCALL_ERROR;
+    }
+    if (socket_listen(sock, backlog) != 0) {
+        return SYSCALL_ERROR;
+    }
+    return 0;
 }
 
 /**
- * sys_gettty - Get controlling terminal
+ * sys_accept - Take a connection off a listening socket
  * 
- * Returns the index of the process's controlling terminal.
+ * Waits for one unless the descriptor is non-blocking. The new
+ * descriptor is blocking.
  * 
- * @return Terminal index (0-5), or -1 if no controlling terminal
+ * @param fd Listening socket
+ * @param addr Filled with the peer's address (NULL: not wanted)
+ * @param addrlen Size of addr, set to the address size (needed with addr)
+ * @return New socket descriptor, or -1 on error
+ * 
+ * @errno THUNDEROS_ENOTSOCK - fd is not a socket
+ * @errno THUNDEROS_EOPNOTSUPP - Datagram socket
+ * @errno THUNDEROS_EINVAL - Not listening
+ * @errno THUNDEROS_EAGAIN - None waiting (non-blocking)
+ * @errno THUNDEROS_EINTR - A signal arrived first
+ * @errno THUNDEROS_EMFILE - Too many open files (the connection is closed)
  */
-uint64_t sys_gettty(void) {
-    struct process *proc = process_current();
-    if (!proc) {
+uint64_t sys_accept(int fd, void *addr, uint32_t *addrlen) {
+    socket_t *sock = vfs_get_socket(fd);
+    if (!sock) {
         return SYSCALL_ERROR;
     }
     
-    return (uint64_t)proc->controlling_tty;
+    uint32_t klen = 0;
+    if (addr && copy_from_user(&klen, addrlen, sizeof(klen)) != 0) {
+        return SYSCALL_ERROR;
+    }
+    
+    socket_addr_t peer;
+    socket_get(sock);
+    socket_t *conn = socket_accept(sock, addr ? &peer : NULL, vfs_is_nonblock(fd));
+    socket_put(sock);
+    if (!conn) {
+        return SYSCALL_ERROR;
+    }
+    
+    int newfd = vfs_create_socket(conn, 0);
+    if (newfd < 0) {
+        socket_put(conn);
+        return SYSCALL_ERROR;
+    }
+    if (addr && (sockaddr_export(addr, &klen, &peer) != 0 ||
+                 copy_to_user(addrlen, &klen, sizeof(klen)) != 0)) {
+        vfs_close(newfd);
+        set_errno(THUNDEROS_EFAULT);
+        return SYSCALL_ERROR;
+    }
+    return newfd;
 }
 
 /**
- * sys_settty - Set controlling terminal
+ * sys_setsockopt - Set a socket option
  * 
- * Sets the controlling terminal for the current process.
- * The terminal must be a valid virtual terminal index (0-5).
+ * Every option takes an int: SOL_SOCKET with SO_REUSEADDR, SO_SNDBUF or
+ * SO_RCVBUF (clamped to 4 KiB - 4 MiB), IPPROTO_TCP with TCP_NODELAY or
+ * TCP_MAXSEG.
  * 
- * @param tty Terminal index to set, or -1 to detach
+ * @param fd Socket descriptor
+ * @param level SOL_SOCKET or IPPROTO_TCP
+ * @param name Option
+ * @param value Pointer to the int
+ * @param len Size of value (at least sizeof(int))
  * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_ENOTSOCK - fd is not a socket
+ * @errno THUNDEROS_ENOPROTOOPT - Unknown level or option
+ * @errno THUNDEROS_EINVAL - len too small, or a bad value
  */
-uint64_t sys_settty(int tty) {
-    struct process *proc = process_current();
-    if (!proc) {
+uint64_t sys_setsockopt(int fd, int level, int name, const void *value, uint32_t len) {
+    socket_t *sock = vfs_get_socket(fd);
+    if (!sock) {
+        return SYSCALL_ERROR;
+    }
+    if (len < sizeof(int)) {
+        set_errno(THUNDEROS_EINVAL);
         return SYSCALL_ERROR;
     }
     
-    /* Validate terminal index */
-    if (tty < -1 || tty >= VTERM_MAX_TERMINALS) {
+    int kvalue;
+    if (copy_from_user(&kvalue, value, sizeof(kvalue)) != 0) {
         return SYSCALL_ERROR;
     }
     
-    proc->controlling_tty = tty;
+    socket_get(sock);
+    int ret = socket_setsockopt(sock, level, name, kvalue);
+    socket_put(sock);
+    if (ret != 0) {
+        return SYSCALL_ERROR;
+    }
     return 0;
 }
 
 /**
- * sys_getprocs - Get information about running processes
+ * sys_getsockopt - Get a socket option
  * 
- * Fills a user-provided buffer with information about all active processes.
- * This is used by the 'ps' utility to display process status.
+ * As sys_setsockopt, plus SO_TYPE and SO_ERROR (which clears the error).
  * 
- * @param buf User buffer to store procinfo_t structures
- * @param max_procs Maximum number of processes to return
- * @return Number of processes returned, or -1 on error
+ * @param fd Socket descriptor
+ * @param level SOL_SOCKET or IPPROTO_TCP
+ * @param name Option
+ * @param value Filled with the int
+ * @param len Size of value, set to sizeof(int)
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_ENOTSOCK - fd is not a socket
+ * @errno THUNDEROS_ENOPROTOOPT - Unknown level or option
+ * @errno THUNDEROS_EINVAL - *len too small
  */
-uint64_t sys_getprocs(procinfo_t *buf, size_t max_procs) {
-    if (!buf || max_procs == 0) {
+uint64_t sys_getsockopt(int fd, int level, int name, void *value, uint32_t *len) {
+    socket_t *sock = vfs_get_socket(fd);
+    if (!sock) {
+        return SYSCALL_ERROR;
+    }
+    
+    uint32_t klen;
+    if (copy_from_user(&klen, len, sizeof(klen)) != 0) {
+        return SYSCALL_ERROR;
+    }
+    if (klen < sizeof(int)) {
         set_errno(THUNDEROS_EINVAL);
         return SYSCALL_ERROR;
     }
     
-    /* Validate user buffer */
-    if (!is_valid_user_pointer(buf, max_procs * sizeof(procinfo_t))) {
-        set_errno(THUNDEROS_EFAULT);
+    int kvalue;
+    socket_get(sock);
+    int ret = socket_getsockopt(sock, level, name, &kvalue);
+    socket_put(sock);
+    if (ret != 0) {
         return SYSCALL_ERROR;
     }
     
-    int max_count = process_get_max_count();
-    size_t count = 0;
-    
-    for (int i = 0; i < max_count && count < max_procs; i++) {
-        struct process *p = process_get_by_index(i);
-        if (p != NULL) {
-            buf[count].pid = p->pid;
-            buf[count].ppid = p->parent ? p->parent->pid : 0;
-            buf[count].pgid = p->pgid;
-            buf[count].sid = p->sid;
-            buf[count].state = p->state;
-            buf[count].tty = p->controlling_tty;
-            buf[count].cpu_time = p->cpu_time;
-            
-            /* Copy name safely */
-            for (int j = 0; j < PROC_NAME_MAX - 1 && p->name[j]; j++) {
-                buf[count].name[j] = p->name[j];
-            }
-            buf[count].name[PROC_NAME_MAX - 1] = '\0';
-            
-            count++;
-        }
+    klen = sizeof(int);
+    if (copy_to_user(value, &kvalue, sizeof(kvalue)) != 0 ||
+        copy_to_user(len, &klen, sizeof(klen)) != 0) {
+        return SYSCALL_ERROR;
     }
-    
-    clear_errno();
-    return count;
+    return 0;
 }
 
 /**
- * sys_uname - Get system information
+ * sys_shutdown - Shut down one or both directions of a stream
  * 
- * Returns information about the operating system.
+ * SHUT_WR sends a FIN once the data queued before it is sent; the peer
+ * reads end of stream. SHUT_RD makes reads return 0.
  * 
- * @param buf User buffer to store utsname_t structure
+ * @param fd Socket descriptor
+ * @param how SHUT_RD, SHUT_WR or SHUT_RDWR
  * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_ENOTSOCK - fd is not a socket
+ * @errno THUNDEROS_EINVAL - Bad how
+ * @errno THUNDEROS_ENOTCONN - Not connected
  */
-uint64_t sys_uname(utsname_t *buf) {
-    if (!buf) {
-        set_errno(THUNDEROS_EINVAL);
+uint64_t sys_shutdown(int fd, int how) {
+    socket_t *sock = vfs_get_socket(fd);
+    if (!sock) {
         return SYSCALL_ERROR;
     }
     
-    /* Validate user buffer */
-    if (!is_valid_user_pointer(buf, sizeof(utsname_t))) {
-        set_errno(THUNDEROS_EFAULT);
+    socket_get(sock);
+    int ret = socket_shutdown(sock, how);
+    socket_put(sock);
+    if (ret != 0) {
         return SYSCALL_ERROR;
     }
-    
-    /* Helper to copy string safely */
-    #define COPY_STR(dst, src) do { \
-        int i; \
-        for (i = 0; i < 63 && (src)[i]; i++) (dst)[i] = (src)[i]; \
-        (dst)[i] = '\0'; \
-    } while(0)
-    
-    COPY_STR(buf->sysname, "ThunderOS");
-    COPY_STR(buf->nodename, "thunderos");
-    COPY_STR(buf->release, "0.7.0");
-    COPY_STR(buf->version, "v0.7.0 Virtual Terminals");
-    COPY_STR(buf->machine, "riscv64");
-    
-    #undef COPY_STR
-    
-    clear_errno();
     return 0;
 }
 
-/* ========================================================================
- * Mutex Syscalls
- * ======================================================================== */
-
-#define MAX_USER_MUTEXES 64
-
-static mutex_t user_mutexes[MAX_USER_MUTEXES];
-static int mutex_in_use[MAX_USER_MUTEXES] = {0};
-
-/* ========================================================================
- * Condition Variable Syscalls
- * ======================================================================== */
-
-#define MAX_USER_CONDVARS 64
-
-static condvar_t user_condvars[MAX_USER_CONDVARS];
-static int condvar_in_use[MAX_USER_CONDVARS] = {0};
+/**
+ * Clamp a byte count for the 32-bit VFS interfaces
+ */
+static uint32_t splice_len(size_t len) {
+    return len > 0x7fffffff ? 0x7fffffff : (uint32_t)len;
+}
 
 /**
- * sys_mutex_create - Create a new mutex
+ * sys_splice - Move data between a pipe and a file
  * 
- * @return Mutex ID (>= 0) on success, -1 on error
+ * One of fd_in and fd_out must be a pipe. Moving file data into a pipe
+ * queues references to page cache pages instead of copying; moving pipe
+ * data into a file writes straight from the pipe's pages. Either way
+ * the data never passes through user memory.
+ * 
+ * @param fd_in Source descriptor
+ * @param off_in Source file offset, read and updated (NULL: file position)
+ * @param fd_out Destination descriptor
+ * @param off_out Destination file offset, as off_in
+ * @param len Maximum bytes to move
+ * @param flags SPLICE_F_NONBLOCK, or 0
+ * @return Bytes moved, 0 at end of input, -1 on error
+ * 
+ * @errno THUNDEROS_EBADF - Invalid file descriptor
+ * @errno THUNDEROS_EINVAL - Neither or both descriptors are pipes
+ * @errno THUNDEROS_ESPIPE - Offset given for the pipe end
+ * @errno THUNDEROS_EFAULT - Bad offset pointer
+ * @errno THUNDEROS_EPIPE - Pipe closed
+ * @errno THUNDEROS_EAGAIN - Pipe empty or full, and non-blocking
  */
-uint64_t sys_mutex_create(void) {
-    /* Find a free mutex slot */
-    for (int i = 0; i < MAX_USER_MUTEXES; i++) {
-        if (!mutex_in_use[i]) {
-            mutex_init(&user_mutexes[i]);
-            mutex_in_use[i] = 1;
-            clear_errno();
-            return (uint64_t)i;
-        }
+uint64_t sys_splice(int fd_in, int64_t *off_in, int fd_out, int64_t *off_out, size_t len, unsigned int flags) {
+    int64_t in_pos = 0, out_pos = 0;
+    if ((off_in && copy_from_user(&in_pos, off_in, sizeof(in_pos)) != 0) ||
+        (off_out && copy_from_user(&out_pos, off_out, sizeof(out_pos)) != 0)) {
+        set_errno(THUNDEROS_EFAULT);
+        return SYSCALL_ERROR;
     }
     
-    set_errno(THUNDEROS_ENOMEM);
-    return SYSCALL_ERROR;
+    int result = vfs_splice(fd_in, off_in ? &in_pos : NULL,
+                            fd_out, off_out ? &out_pos : NULL, splice_len(len), flags);
+    if (result < 0) {
+        return SYSCALL_ERROR;
+    }
+    
+    if ((off_in && copy_to_user(off_in, &in_pos, sizeof(in_pos)) != 0) ||
+        (off_out && copy_to_user(off_out, &out_pos, sizeof(out_pos)) != 0)) {
+        set_errno(THUNDEROS_EFAULT);
+        return SYSCALL_ERROR;
+    }
+    return result;
 }
 
 /**
- * sys_mutex_lock - Lock a mutex (blocking)
+ * sys_tee - Duplicate pipe data into another pipe
  * 
- * @param mutex_id Mutex ID from sys_mutex_create
- * @return 0 on success, -1 on error
+ * The data stays readable from fd_in; both pipes share its pages.
+ * 
+ * @param fd_in Read end of the source pipe
+ * @param fd_out Write end of the destination pipe
+ * @param len Maximum bytes to duplicate
+ * @param flags SPLICE_F_NONBLOCK, or 0
+ * @return Bytes duplicated, 0 at end of input, -1 on error
+ * 
+ * @errno THUNDEROS_EBADF - Invalid file descriptor
+ * @errno THUNDEROS_EINVAL - Not two different pipes
+ * @errno THUNDEROS_EPIPE - Pipe closed
+ * @errno THUNDEROS_EAGAIN - Source empty or destination full, and non-blocking
  */
-uint64_t sys_mutex_lock(int mutex_id) {
-    if (mutex_id < 0 || mutex_id >= MAX_USER_MUTEXES || !mutex_in_use[mutex_id]) {
-        set_errno(THUNDEROS_EINVAL);
+uint64_t sys_tee(int fd_in, int fd_out, size_t len, unsigned int flags) {
+    int result = vfs_tee(fd_in, fd_out, splice_len(len), flags);
+    if (result < 0) {
         return SYSCALL_ERROR;
     }
-    
-    mutex_lock(&user_mutexes[mutex_id]);
-    clear_errno();
-    return 0;
+    return result;
 }
 
 /**
- * sys_mutex_trylock - Try to lock a mutex (non-blocking)
+ * sys_sendfile - Copy file data to a pipe or file inside the kernel
  * 
- * @param mutex_id Mutex ID from sys_mutex_create
- * @return 0 if locked, -1 if already locked or error
+ * Reads in_fd through the page cache. Into a pipe the pages are queued
+ * by reference; into a file they are copied once, directly.
+ * 
+ * @param out_fd Destination (pipe or regular file)
+ * @param in_fd Source regular file
+ * @param offset Source offset, read and updated (NULL: file position)
+ * @param count Maximum bytes to copy
+ * @return Bytes copied, 0 at end of file, -1 on error
+ * 
+ * @errno THUNDEROS_EBADF - Invalid file descriptor
+ * @errno THUNDEROS_EINVAL - Unsupported descriptor types
+ * @errno THUNDEROS_EFAULT - Bad offset pointer
  */
-uint64_t sys_mutex_trylock(int mutex_id) {
-    if (mutex_id < 0 || mutex_id >= MAX_USER_MUTEXES || !mutex_in_use[mutex_id]) {
-        set_errno(THUNDEROS_EINVAL);
+uint64_t sys_sendfile(int out_fd, int in_fd, int64_t *offset, size_t count) {
+    int64_t pos = 0;
+    if (offset && copy_from_user(&pos, offset, sizeof(pos)) != 0) {
+        set_errno(THUNDEROS_EFAULT);
         return SYSCALL_ERROR;
     }
     
-    return mutex_trylock(&user_mutexes[mutex_id]);
+    int result = vfs_sendfile(out_fd, in_fd, offset ? &pos : NULL, splice_len(count));
+    if (result < 0) {
+        return SYSCALL_ERROR;
+    }
+    
+    if (offset && copy_to_user(offset, &pos, sizeof(pos)) != 0) {
+        set_errno(THUNDEROS_EFAULT);
+        return SYSCALL_ERROR;
+    }
+    return result;
 }
 
 /**
- * sys_mutex_unlock - Unlock a mutex
+ * sys_poll - Wait for events on a set of descriptors
  * 
- * @param mutex_id Mutex ID from sys_mutex_create
- * @return 0 on success, -1 on error
+ * Pipes and the terminal wake the caller when they change; it never
+ * spins. Descriptors 1 and 2 are always writable.
+ * 
+ * @param fds User array of struct pollfd; revents is filled in
+ * @param nfds Number of entries (at most POLL_MAX_FDS)
+ * @param timeout_ms Milliseconds to wait; 0 = don't wait, negative = forever
+ * @return Number of entries with events, 0 on timeout, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Too many entries
+ * @errno THUNDEROS_EFAULT - Bad fds pointer
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ * @errno THUNDEROS_EINTR - A signal arrived first
  */
-uint64_t sys_mutex_unlock(int mutex_id) {
-    if (mutex_id < 0 || mutex_id >= MAX_USER_MUTEXES || !mutex_in_use[mutex_id]) {
+uint64_t sys_poll(struct pollfd *fds, uint32_t nfds, int timeout_ms) {
+    if (nfds > POLL_MAX_FDS) {
         set_errno(THUNDEROS_EINVAL);
         return SYSCALL_ERROR;
     }
     
-    mutex_unlock(&user_mutexes[mutex_id]);
-    clear_errno();
-    return 0;
+    struct pollfd kfds[POLL_MAX_FDS];
+    size_t bytes = nfds * sizeof(struct pollfd);
+    if (nfds > 0 && copy_from_user(kfds, fds, bytes) != 0) {
+        set_errno(THUNDEROS_EFAULT);
+        return SYSCALL_ERROR;
+    }
+    
+    int result = do_poll(kfds, nfds, timeout_ms);
+    if (result < 0) {
+        return SYSCALL_ERROR;
+    }
+    
+    if (nfds > 0 && copy_to_user(fds, kfds, bytes) != 0) {
+        set_errno(THUNDEROS_EFAULT);
+        return SYSCALL_ERROR;
+    }
+    return result;
 }
 
 /**
- * sys_mutex_destroy - Destroy a mutex
+ * sys_epoll_create - Create an epoll instance
  * 
- * @param mutex_id Mutex ID from sys_mutex_create
- * @return 0 on success, -1 on error
+ * @param size Ignored, as on Linux (must be positive)
+ * @return New descriptor, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - size not positive
+ * @errno THUNDEROS_EMFILE - Too many open files
+ * @errno THUNDEROS_ENOMEM - Out of memory
  */
-uint64_t sys_mutex_destroy(int mutex_id) {
-    if (mutex_id < 0 || mutex_id >= MAX_USER_MUTEXES || !mutex_in_use[mutex_id]) {
+uint64_t sys_epoll_create(int size) {
+    if (size <= 0) {
         set_errno(THUNDEROS_EINVAL);
         return SYSCALL_ERROR;
     }
     
-    mutex_in_use[mutex_id] = 0;
-    clear_errno();
-    return 0;
+    int fd = vfs_create_epoll();
+    if (fd < 0) {
+        return SYSCALL_ERROR;
+    }
+    return fd;
 }
 
 /**
- * sys_cond_create - Create a new condition variable
+ * sys_epoll_ctl - Add, change or remove a descriptor of an epoll instance
  * 
- * @return Condition variable ID (>= 0) on success, -1 on error
+ * @param epfd Epoll descriptor
+ * @param op EPOLL_CTL_ADD, EPOLL_CTL_MOD or EPOLL_CTL_DEL
+ * @param fd Descriptor to watch
+ * @param event Events and user data (may be NULL for EPOLL_CTL_DEL)
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_EBADF - Invalid descriptor
+ * @errno THUNDEROS_EINVAL - epfd not an epoll instance, or bad op
+ * @errno THUNDEROS_EEXIST - Already watched
+ * @errno THUNDEROS_ENOENT - Not watched
+ * @errno THUNDEROS_EFAULT - Bad event pointer
  */
-uint64_t sys_cond_create(void) {
-    /* Find a free condvar slot */
-    for (int i = 0; i < MAX_USER_CONDVARS; i++) {
-        if (!condvar_in_use[i]) {
-            cond_init(&user_condvars[i]);
-            condvar_in_use[i] = 1;
-            clear_errno();
-            return (uint64_t)i;
+uint64_t sys_epoll_ctl(int epfd, int op, int fd, const struct epoll_event *event) {
+    eventpoll_t *ep = vfs_get_epoll(epfd);
+    if (!ep) {
+        return SYSCALL_ERROR;
+    }
+    
+    struct epoll_event kevent = { 0, 0 };
+    if (op != EPOLL_CTL_DEL) {
+        if (!event || copy_from_user(&kevent, event, sizeof(kevent)) != 0) {
+            set_errno(THUNDEROS_EFAULT);
+            return SYSCALL_ERROR;
         }
     }
     
-    set_errno(THUNDEROS_ENOMEM);
-    return SYSCALL_ERROR;
+    if (eventpoll_ctl(ep, op, fd, &kevent) < 0) {
+        return SYSCALL_ERROR;
+    }
+    return SYSCALL_SUCCESS;
 }
 
 /**
- * sys_cond_wait - Wait on a condition variable (blocking)
+ * sys_epoll_wait - Wait for events on an epoll instance
  * 
- * Atomically unlocks the mutex and sleeps on the condition variable.
- * When awakened, re-acquires the mutex before returning.
+ * Only descriptors woken since the last call are looked at, so the
+ * cost follows the number of ready descriptors.
  * 
- * @param cond_id Condition variable ID from sys_cond_create
- * @param mutex_id Mutex ID (must be locked by caller)
- * @return 0 on success, -1 on error
+ * @param epfd Epoll descriptor
+ * @param events User buffer for the results
+ * @param maxevents Size of events (more than POLL_MAX_FDS is clamped)
+ * @param timeout_ms Milliseconds to wait; 0 = don't wait, negative = forever
+ * @return Number of events, 0 on timeout, -1 on error
+ * 
+ * @errno THUNDEROS_EBADF - Invalid descriptor
+ * @errno THUNDEROS_EINVAL - Not an epoll instance, or maxevents not positive
+ * @errno THUNDEROS_EFAULT - Bad events pointer
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ * @errno THUNDEROS_EINTR - A signal arrived first
  */
-uint64_t sys_cond_wait(int cond_id, int mutex_id) {
-    if (cond_id < 0 || cond_id >= MAX_USER_CONDVARS || !condvar_in_use[cond_id]) {
-        set_errno(THUNDEROS_EINVAL);
+uint64_t sys_epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout_ms) {
+    eventpoll_t *ep = vfs_get_epoll(epfd);
+    if (!ep) {
+        return SYSCALL_ERROR;
+    }
+    if (maxevents <= 0 || !events) {
+        set_errno(maxevents <= 0 ? THUNDEROS_EINVAL : THUNDEROS_EFAULT);
         return SYSCALL_ERROR;
     }
+    if (maxevents > POLL_MAX_FDS) {
+        maxevents = POLL_MAX_FDS;
+    }
     
-    if (mutex_id < 0 || mutex_id >= MAX_USER_MUTEXES || !mutex_in_use[mutex_id]) {
-        set_errno(THUNDEROS_EINVAL);
+    struct epoll_event *kevents = kmalloc((size_t)maxevents * sizeof(struct epoll_event));
+    if (!kevents) {
+        set_errno(THUNDEROS_ENOMEM);
         return SYSCALL_ERROR;
     }
     
-    cond_wait(&user_condvars[cond_id], &user_mutexes[mutex_id]);
-    clear_errno();
-    return 0;
+    int result = eventpoll_wait(ep, kevents, maxevents, timeout_ms);
+    if (result > 0 &&
+        copy_to_user(events, kevents, (size_t)result * sizeof(struct epoll_event)) != 0) {
+        set_errno(THUNDEROS_EFAULT);
+        result = -1;
+    }
+    kfree(kevents);
+    
+    if (result < 0) {
+        return SYSCALL_ERROR;
+    }
+    return result;
 }
 
 /**
- * sys_cond_signal - Signal one waiter on a condition variable
+ * sys_shm_open - Open or create a named shared memory object
  * 
- * Wakes up one process waiting on the condition variable (if any).
+ * A new object is empty: size it with ftruncate(), then mmap() the
+ * descriptor MAP_SHARED. Every process mapping the object sees the
+ * same pages.
  * 
- * @param cond_id Condition variable ID from sys_cond_create
- * @return 0 on success, -1 on error
+ * @param name Object name ("/name", no further slashes)
+ * @param flags O_RDONLY or O_RDWR, optionally O_CREAT, O_EXCL, O_TRUNC
+ * @param mode Ignored (objects are not access-checked)
+ * @return New descriptor, -1 on error
+ * 
+ * @errno THUNDEROS_EFAULT - Bad name pointer
+ * @errno THUNDEROS_EINVAL - Bad name or access mode
+ * @errno THUNDEROS_ENOENT - No such object and no O_CREAT
+ * @errno THUNDEROS_EEXIST - Object exists and O_CREAT|O_EXCL given
+ * @errno THUNDEROS_EMFILE - Too many open files
+ * @errno THUNDEROS_ENOMEM - Out of memory
  */
-uint64_t sys_cond_signal(int cond_id) {
-    if (cond_id < 0 || cond_id >= MAX_USER_CONDVARS || !condvar_in_use[cond_id]) {
-        set_errno(THUNDEROS_EINVAL);
+uint64_t sys_shm_open(const char *name, int flags, int mode) {
+    (void)mode;
+    
+    char kname[SHM_NAME_MAX];
+    if (strncpy_from_user(kname, name, sizeof(kname)) < 0) {
+        // A name too long for the buffer is just a bad name
+        if (get_errno() == THUNDEROS_ERANGE) {
+            set_errno(THUNDEROS_EINVAL);
+        }
         return SYSCALL_ERROR;
     }
     
-    cond_signal(&user_condvars[cond_id]);
-    clear_errno();
-    return 0;
+    int fd = shm_open(kname, (uint32_t)flags);
+    if (fd < 0) {
+        return SYSCALL_ERROR;
+    }
+    return fd;
 }
 
 /**
- * sys_cond_broadcast - Wake all waiters on a condition variable
+ * sys_shm_unlink - Remove the name of a shared memory object
  * 
- * Wakes up all processes waiting on the condition variable.
+ * Open descriptors and mappings keep the object alive until they go.
  * 
- * @param cond_id Condition variable ID from sys_cond_create
+ * @param name Object name
  * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_EFAULT - Bad name pointer
+ * @errno THUNDEROS_EINVAL - Bad name
+ * @errno THUNDEROS_ENOENT - No such object
  */
-uint64_t sys_cond_broadcast(int cond_id) {
-    if (cond_id < 0 || cond_id >= MAX_USER_CONDVARS || !condvar_in_use[cond_id]) {
-        set_errno(THUNDEROS_EINVAL);
+uint64_t sys_shm_unlink(const char *name) {
+    char kname[SHM_NAME_MAX];
+    if (strncpy_from_user(kname, name, sizeof(kname)) < 0) {
+        if (get_errno() == THUNDEROS_ERANGE) {
+            set_errno(THUNDEROS_EINVAL);
+        }
         return SYSCALL_ERROR;
     }
     
-    cond_broadcast(&user_condvars[cond_id]);
-    clear_errno();
-    return 0;
+    if (shm_unlink(kname) != 0) {
+        return SYSCALL_ERROR;
+    }
+    return SYSCALL_SUCCESS;
 }
 
 /**
- * sys_cond_destroy - Destroy a condition variable
+ * sys_ftruncate - Change the size of an open file
  * 
- * @param cond_id Condition variable ID from sys_cond_create
+ * Only shared memory objects can be resized for now.
+ * 
+ * @param fd Descriptor, open O_RDWR
+ * @param length New size in bytes
  * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_EBADF - Not open, or not open for writing
+ * @errno THUNDEROS_EINVAL - Not a shared memory object, or negative length
+ * @errno THUNDEROS_EFBIG - Larger than SHM_MAX_SIZE
+ * @errno THUNDEROS_ENOMEM - Out of memory
  */
-uint64_t sys_cond_destroy(int cond_id) {
-    if (cond_id < 0 || cond_id >= MAX_USER_CONDVARS || !condvar_in_use[cond_id]) {
+uint64_t sys_ftruncate(int fd, int64_t length) {
+    if (length < 0) {
         set_errno(THUNDEROS_EINVAL);
         return SYSCALL_ERROR;
     }
     
-    cond_destroy(&user_condvars[cond_id]);
-    condvar_in_use[cond_id] = 0;
-    clear_errno();
-    return 0;
+    if (vfs_ftruncate(fd, (uint64_t)length) != 0) {
+        return SYSCALL_ERROR;
+    }
+    return SYSCALL_SUCCESS;
 }
 
-/* ========================================================================
- * Reader-Writer Lock Syscalls
- * ======================================================================== */
-
-#define MAX_USER_RWLOCKS 64
-
-static rwlock_t user_rwlocks[MAX_USER_RWLOCKS];
-static int rwlock_in_use[MAX_USER_RWLOCKS] = {0};
+/**
+ * sys_sigqueue - Send a signal with a value
+ * 
+ * A real-time signal (SIGRTMIN..SIGRTMAX) is queued, so each call is
+ * delivered once, with value in si_value: read from a signalfd as
+ * ssi_int/ssi_ptr, or passed to a handler as its second argument. A
+ * standard signal coalesces as with kill() and the value is dropped.
+ * 
+ * @param pid Target process ID
+ * @param signum Signal number
+ * @param value Value delivered with the signal
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_ESRCH - No such process
+ * @errno THUNDEROS_EINVAL - Bad signal number
+ * @errno THUNDEROS_EAGAIN - Target already has SIGQUEUE_MAX signals queued
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ */
+uint64_t sys_sigqueue(int pid, int signum, int64_t value) {
+    struct process *target = pid > 0 ? process_get(pid) : NULL;
+    if (!target) {
+        set_errno(THUNDEROS_ESRCH);
+        return SYSCALL_ERROR;
+    }
+    
+    struct process *sender = process_current();
+    ksiginfo_t info;
+    info.si_signo = signum;
+    info.si_code = SI_QUEUE;
+    info.si_pid = sender->pid;
+    info.si_uid = sender->uid;
+    info.si_value = value;
+    
+    if (signal_send_info(target, &info) != 0) {
+        return SYSCALL_ERROR;
+    }
+    return SYSCALL_SUCCESS;
+}
 
 /**
- * sys_rwlock_create - Create a new reader-writer lock
+ * sys_sigprocmask - Examine and change the blocked signals
  * 
- * @return RWLock ID (>= 0) on success, -1 on error
+ * Blocked signals stay pending instead of being delivered; that is how
+ * signals meant for a signalfd are kept away from their default action.
+ * SIGKILL and SIGSTOP cannot be blocked.
+ * 
+ * @param how SIG_BLOCK, SIG_UNBLOCK or SIG_SETMASK
+ * @param set Signals to apply (NULL: only read the mask)
+ * @param oldset Where to store the previous mask (may be NULL)
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Unknown how
+ * @errno THUNDEROS_EFAULT - Bad set or oldset pointer
  */
-uint64_t sys_rwlock_create(void) {
-    /* Find a free rwlock slot */
-    for (int i = 0; i < MAX_USER_RWLOCKS; i++) {
-        if (!rwlock_in_use[i]) {
-            rwlock_init(&user_rwlocks[i]);
-            rwlock_in_use[i] = 1;
-            clear_errno();
-            return (uint64_t)i;
+uint64_t sys_sigprocmask(int how, const uint64_t *set, uint64_t *oldset) {
+    struct process *proc = process_current();
+    sigset_t old = proc->blocked_signals;
+    
+    if (set) {
+        sigset_t kset;
+        if (copy_from_user(&kset, set, sizeof(kset)) != 0) {
+            return SYSCALL_ERROR;
+        }
+        if (signal_procmask(proc, how, kset, &old) != 0) {
+            return SYSCALL_ERROR;
         }
     }
     
-    set_errno(THUNDEROS_ENOMEM);
-    return SYSCALL_ERROR;
+    if (oldset && copy_to_user(oldset, &old, sizeof(old)) != 0) {
+        return SYSCALL_ERROR;
+    }
+    return SYSCALL_SUCCESS;
 }
 
 /**
- * sys_rwlock_read_lock - Acquire read lock (blocking)
+ * sys_signalfd - Create a signalfd, or change the signals one reads
  * 
- * @param rwlock_id RWLock ID from sys_rwlock_create
- * @return 0 on success, -1 on error
+ * @param fd -1 to create a new descriptor, or an existing signalfd
+ * @param mask Signals to read (pointer to a 64-bit set)
+ * @param flags 0 or O_NONBLOCK (new descriptors only)
+ * @return The descriptor, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Unknown flags, or fd is not a signalfd
+ * @errno THUNDEROS_EBADF - fd is not open
+ * @errno THUNDEROS_EFAULT - Bad mask pointer
+ * @errno THUNDEROS_EMFILE - Too many open files
+ * @errno THUNDEROS_ENOMEM - Out of memory
  */
-uint64_t sys_rwlock_read_lock(int rwlock_id) {
-    if (rwlock_id < 0 || rwlock_id >= MAX_USER_RWLOCKS || !rwlock_in_use[rwlock_id]) {
+uint64_t sys_signalfd(int fd, const uint64_t *mask, int flags) {
+    if (flags & ~O_NONBLOCK) {
         set_errno(THUNDEROS_EINVAL);
         return SYSCALL_ERROR;
     }
     
-    rwlock_read_lock(&user_rwlocks[rwlock_id]);
-    clear_errno();
-    return 0;
+    sigset_t kmask;
+    if (copy_from_user(&kmask, mask, sizeof(kmask)) != 0) {
+        return SYSCALL_ERROR;
+    }
+    
+    if (fd == -1) {
+        int new_fd = vfs_create_signalfd(kmask, (uint32_t)flags);
+        if (new_fd < 0) {
+            return SYSCALL_ERROR;
+        }
+        return new_fd;
+    }
+    
+    signalfd_t *sfd = vfs_get_signalfd(fd);
+    if (!sfd) {
+        return SYSCALL_ERROR;
+    }
+    signalfd_set_mask(sfd, kmask);
+    return fd;
 }
 
 /**
- * sys_rwlock_read_unlock - Release read lock
+ * sys_dup2 - Duplicate a file descriptor
  * 
- * @param rwlock_id RWLock ID from sys_rwlock_create
- * @return 0 on success, -1 on error
+ * Makes newfd be the copy of oldfd, closing newfd first if necessary.
+ * Used for I/O redirection in shells (e.g., redirecting stdin/stdout to pipes).
+ * 
+ * @param oldfd The file descriptor to duplicate
+ * @param newfd The target file descriptor number
+ * @return newfd on success, -1 on error
+ * 
+ * @errno THUNDEROS_EBADF - oldfd is not a valid file descriptor
+ * @errno THUNDEROS_EINVAL - newfd is out of range
  */
-uint64_t sys_rwlock_read_unlock(int rwlock_id) {
-    if (rwlock_id < 0 || rwlock_id >= MAX_USER_RWLOCKS || !rwlock_in_use[rwlock_id]) {
-        set_errno(THUNDEROS_EINVAL);
+uint64_t sys_dup2(int oldfd, int newfd) {
+    int result = vfs_dup2(oldfd, newfd);
+    if (result < 0) {
         return SYSCALL_ERROR;
     }
-    
-    rwlock_read_unlock(&user_rwlocks[rwlock_id]);
-    clear_errno();
-    return 0;
+    return result;
 }
 
 /**
- * sys_rwlock_write_lock - Acquire write lock (blocking)
+ * sys_getuid - Get real user ID
  * 
- * @param rwlock_id RWLock ID from sys_rwlock_create
+ * @return Real user ID of current process
+ */
+uint64_t sys_getuid(void) {
+    struct process *proc = process_current();
+    if (!proc) {
+        return 0;  /* Default to root */
+    }
+    return proc->uid;
+}
+
+/**
+ * sys_getgid - Get real group ID
+ * 
+ * @return Real group ID of current process
+ */
+uint64_t sys_getgid(void) {
+    struct process *proc = process_current();
+    if (!proc) {
+        return 0;  /* Default to root */
+    }
+    return proc->gid;
+}
+
+/**
+ * sys_geteuid - Get effective user ID
+ * 
+ * @return Effective user ID of current process
+ */
+uint64_t sys_geteuid(void) {
+    struct process *proc = process_current();
+    if (!proc) {
+        return 0;  /* Default to root */
+    }
+    return proc->euid;
+}
+
+/**
+ * sys_getegid - Get effective group ID
+ * 
+ * @return Effective group ID of current process
+ */
+uint64_t sys_getegid(void) {
+    struct process *proc = process_current();
+    if (!proc) {
+        return 0;  /* Default to root */
+    }
+    return proc->egid;
+}
+
+/**
+ * sys_chmod - Change file permissions
+ * 
+ * @param path Path to file
+ * @param mode New permission bits (e.g., 0755)
  * @return 0 on success, -1 on error
  */
-uint64_t sys_rwlock_write_lock(int rwlock_id) {
-    if (rwlock_id < 0 || rwlock_id >= MAX_USER_RWLOCKS || !rwlock_in_use[rwlock_id]) {
+uint64_t sys_chmod(const char *path, uint32_t mode) {
+    if (!path) {
         set_errno(THUNDEROS_EINVAL);
         return SYSCALL_ERROR;
     }
     
-    rwlock_write_lock(&user_rwlocks[rwlock_id]);
-    clear_errno();
+    int result = vfs_chmod(path, mode);
+    if (result < 0) {
+        return SYSCALL_ERROR;
+    }
     return 0;
 }
 
 /**
- * sys_rwlock_write_unlock - Release write lock
+ * sys_chown - Change file owner and group
  * 
- * @param rwlock_id RWLock ID from sys_rwlock_create
+ * @param path Path to file
+ * @param uid New owner user ID
+ * @param gid New owner group ID
  * @return 0 on success, -1 on error
  */
-uint64_t sys_rwlock_write_unlock(int rwlock_id) {
-    if (rwlock_id < 0 || rwlock_id >= MAX_USER_RWLOCKS || !rwlock_in_use[rwlock_id]) {
+uint64_t sys_chown(const char *path, uint16_t uid, uint16_t gid) {
+    if (!path) {
         set_errno(THUNDEROS_EINVAL);
         return SYSCALL_ERROR;
     }
     
-    rwlock_write_unlock(&user_rwlocks[rwlock_id]);
-    clear_errno();
+    int result = vfs_chown(path, uid, gid);
+    if (result < 0) {
+        return SYSCALL_ERROR;
+    }
     return 0;
 }
 
 /**
- * sys_rwlock_destroy - Destroy a reader-writer lock
- * 
- * @param rwlock_id RWLock ID from sys_rwlock_create
- * @return 0 on success, -1 on error
+ * Directory entry structure for getdents
+ * Similar to Linux struct linux_dirent
  */
-uint64_t sys_rwlock_destroy(int rwlock_id) {
-    if (rwlock_id < 0 || rwlock_id >= MAX_USER_RWLOCKS || !rwlock_in_use[rwlock_id]) {
-        set_errno(THUNDEROS_EINVAL);
-        return SYSCALL_ERROR;
+struct thunderos_dirent {
+    uint32_t d_ino;       /* Inode number */
+    uint16_t d_reclen;    /* Record length */
+    uint8_t  d_type;      /* File type */
+    char     d_name[MAX_NAME_LEN]; /* File name (null-terminated) */
+};
+
+/* Entries gathered in kernel memory before each copy to the user buffer */
+#define GETDENTS_BATCH 16
+
+/**
+ * Entries gathered by getdents_fill
+ */
+typedef struct {
+    struct thunderos_dirent *entries;
+    uint32_t count;                    /* Entries filled */
+    uint32_t room;                     /* Entries that fit */
+} getdents_batch_t;
+
+/**
+ * Add one directory entry to a getdents batch; non-zero once it is full
+ */
+static int getdents_fill(void *ctx, const char *name, uint32_t name_len, uint32_t inode) {
+    getdents_batch_t *batch = (getdents_batch_t *)ctx;
+    if (batch->count == batch->room) {
+        return 1;
     }
     
-    rwlock_in_use[rwlock_id] = 0;
-    clear_errno();
+    // Zeroed, so padding and the end of d_name leak nothing
+    struct thunderos_dirent *entry = &batch->entries[batch->count++];
+    kmemset(entry, 0, sizeof(*entry));
+    entry->d_ino = inode;
+    entry->d_reclen = sizeof(struct thunderos_dirent);
+    entry->d_type = 0;  // DT_UNKNOWN for now
+    if (name_len > MAX_NAME_LEN - 1) {
+        name_len = MAX_NAME_LEN - 1;
+    }
+    kmemcpy(entry->d_name, name, name_len);
     return 0;
 }
 
 /**
- * sys_fork - Create a child process
- * 
- * Creates a complete copy of the current process with its own address space.
- * Both processes continue execution after fork() returns, with different return values:
- * - Parent receives child PID
- * - Child receives 0
- * 
- * The child process gets:
- * - Copy of all memory pages (code, data, stack, heap)
- * - Copy of all VMAs (virtual memory areas)
- * - Copy of all open file descriptors
- * - Separate page table (memory isolation)
- * - Same instruction pointer (continues from fork() call)
+ * sys_getdents - Get directory entries
  * 
- * @return Child PID in parent process, 0 in child process, -1 on error
+ * Reads directory entries from an open directory file descriptor. The
+ * descriptor's position is the filesystem's directory cursor: each call
+ * carries on where the last one stopped, with one pass over the
+ * directory per batch of entries rather than one per entry.
  * 
- * @errno THUNDEROS_EINVAL - No current process
- * @errno THUNDEROS_EAGAIN - Process table full
- * @errno THUNDEROS_ENOMEM - Out of memory
+ * @param fd File descriptor of open directory
+ * @param dirp Buffer to store directory entries
+ * @param count Size of buffer in bytes
+ * @return Number of bytes read on success, 0 on end of directory, -1 on error
  * 
- * Example:
- *   pid_t pid = fork();
- *   if (pid < 0) {
- *     // Error
- *   } else if (pid == 0) {
- *     // Child process
- *   } else {
- *     // Parent process (pid = child's PID)
- *   }
+ * @errno THUNDEROS_EINVAL - Invalid buffer or count
+ * @errno THUNDEROS_EFAULT - Buffer not writable
+ * @errno THUNDEROS_EBADF - Invalid file descriptor
+ * @errno THUNDEROS_ENOTDIR - fd does not refer to a directory
+ * @errno THUNDEROS_ENOMEM - No memory for the batch buffer
  */
-uint64_t sys_fork(struct trap_frame *tf) {
-    struct process *current = process_current();
-    if (!current) {
-        RETURN_ERRNO(THUNDEROS_EINVAL);
+uint64_t sys_getdents(int fd, void *dirp, size_t count) {
+    struct process *proc = process_current();
+    if (!proc) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
     }
     
-    if (!tf) {
-        RETURN_ERRNO(THUNDEROS_EINVAL);
+    if (!dirp || count < sizeof(struct thunderos_dirent)) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
     }
     
-    // Call kernel fork implementation with current trap frame
-    // The child will get a copy of this trap frame
-    pid_t child_pid = process_fork(tf);
+    // Get the file from fd
+    vfs_file_t *file = vfs_get_file(fd);
+    if (!file || !file->node) {
+        set_errno(THUNDEROS_EBADF);
+        return SYSCALL_ERROR;
+    }
     
-    // Return child PID to parent, or -1 on error (errno already set)
-    return child_pid;
-}
+    vfs_node_t *node = file->node;
+    
+    // Must be a directory
+    if (node->type != VFS_TYPE_DIRECTORY) {
+        set_errno(THUNDEROS_ENOTDIR);
+        return SYSCALL_ERROR;
+    }
+    
+    // Check for iterate operation
+    if (!node->ops || !node->ops->iterate) {
+        set_errno(THUNDEROS_EIO);
+        return SYSCALL_ERROR;
+    }
+    
+    getdents_batch_t batch;
+    batch.entries = kmalloc(GETDENTS_BATCH * sizeof(struct thunderos_dirent));
+    if (!batch.entries) {
+        set_errno(THUNDEROS_ENOMEM);
+        return SYSCALL_ERROR;
+    }
+    
+    // Fill a batch in kernel memory (the filesystem is locked meanwhile,
+    // so user memory is not touched), then copy it out; repeat while the
+    // user buffer has room and the directory has entries
+    uint8_t *buf = (uint8_t *)dirp;
+    size_t capacity = count / sizeof(struct thunderos_dirent);
+    size_t copied = 0;
+    
+    while (copied < capacity) {
+        uint32_t pos = (uint32_t)file->pos;
+        batch.count = 0;
+        batch.room = capacity - copied < GETDENTS_BATCH ? (uint32_t)(capacity - copied) : GETDENTS_BATCH;
+        if (node->ops->iterate(node, &pos, getdents_fill, &batch) != 0) {
+            if (copied == 0) {
+                kfree(batch.entries);
+                /* errno already set by iterate */
+                return SYSCALL_ERROR;
+            }
+            break;  // Report what was read; the error comes back next call
+        }
+        if (batch.count == 0) {
+            break;  // End of directory
+        }
+        
+        if (copy_to_user(buf + copied * sizeof(struct thunderos_dirent), batch.entries,
+                         batch.count * sizeof(struct thunderos_dirent)) != 0) {
+            // Entries already copied stand; this batch is read again next time
+            kfree(batch.entries);
+            if (copied == 0) {
+                return SYSCALL_ERROR;
+            }
+            clear_errno();
+            return copied * sizeof(struct thunderos_dirent);
+        }
+        
+        copied += batch.count;
+        file->pos = pos;
+        if (batch.count < batch.room) {
+            break;  // The directory ran out before the batch filled
+        }
+    }
+    
+    kfree(batch.entries);
+    clear_errno();
+    return copied * sizeof(struct thunderos_dirent);
+}
+
+/**
+ * sys_chdir - Change current working directory
+ * 
+ * Supports both absolute and relative paths. The path is normalized
+ * before storing in the process control block.
+ * 
+ * @param path Path to new working directory (absolute or relative)
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Invalid path
+ * @errno THUNDEROS_ENOENT - Path does not exist
+ * @errno THUNDEROS_ENOTDIR - Path is not a directory
+ */
+uint64_t sys_chdir(const char *path) {
+    struct process *proc = process_current();
+    if (!proc) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    if (!is_valid_user_pointer(path, 1)) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    /* Normalize the path (handles relative paths, ., ..) */
+    char normalized_path[VFS_MAX_PATH];
+    if (vfs_normalize_path(path, normalized_path, VFS_MAX_PATH) < 0) {
+        /* errno already set by vfs_normalize_path */
+        return SYSCALL_ERROR;
+    }
+    
+    /* Resolve the path to verify it exists and is a directory */
+    vfs_node_t *node = vfs_resolve_path(path);
+    if (!node) {
+        /* errno already set by vfs_resolve_path */
+        return SYSCALL_ERROR;
+    }
+    
+    if (node->type != VFS_TYPE_DIRECTORY) {
+        vfs_node_put(node);
+        set_errno(THUNDEROS_ENOTDIR);
+        return SYSCALL_ERROR;
+    }
+    
+    /* Relative paths now start from the node; getcwd() reports the text */
+    vfs_node_put(proc->cwd_node);
+    proc->cwd_node = node;
+    
+    /* Store the normalized absolute path in process cwd */
+    size_t path_index = 0;
+    while (normalized_path[path_index] && path_index < VFS_MAX_PATH - 1) {
+        proc->cwd[path_index] = normalized_path[path_index];
+        path_index++;
+    }
+    proc->cwd[path_index] = '\0';
+    
+    clear_errno();
+    return SYSCALL_SUCCESS;
+}
+
+/**
+ * sys_getcwd - Get current working directory
+ * 
+ * @param buf Buffer to store path
+ * @param size Size of buffer
+ * @return Pointer to buf on success, NULL on error
+ * 
+ * @errno THUNDEROS_EINVAL - Invalid buffer or size
+ * @errno THUNDEROS_ERANGE - Buffer too small for path
+ * @errno THUNDEROS_EFAULT - Buffer not writable
+ */
+uint64_t sys_getcwd(char *buf, size_t size) {
+    struct process *proc = process_current();
+    if (!proc) {
+        set_errno(THUNDEROS_EINVAL);
+        return (uint64_t)NULL;
+    }
+    
+    if (!buf || size == 0) {
+        set_errno(THUNDEROS_EINVAL);
+        return (uint64_t)NULL;
+    }
+    
+    // Check if buffer is large enough
+    size_t cwd_len = 0;
+    while (proc->cwd[cwd_len]) cwd_len++;
+    
+    if (cwd_len >= size) {
+        set_errno(THUNDEROS_ERANGE);
+        return (uint64_t)NULL;
+    }
+    
+    // Copy cwd to buffer, terminator included
+    if (copy_to_user(buf, proc->cwd, cwd_len + 1) != 0) {
+        return (uint64_t)NULL;
+    }
+    
+    clear_errno();
+    return (uint64_t)buf;
+}
+
+/**
+ * sys_setsid - Create a new session
+ * 
+ * Creates a new session with the calling process as the session leader.
+ * The process becomes the controlling process of a new terminal.
+ * 
+ * @return New session ID (process PID) on success, -1 on error
+ */
+uint64_t sys_setsid(void) {
+    /* Use the proper process group implementation */
+    return (uint64_t)process_setsid();
+}
+
+/**
+ * sys_setpgid - Set process group ID
+ * 
+ * Sets the process group ID of the specified process.
+ * 
+ * @param pid Process ID (0 for current process)
+ * @param pgid New process group ID (0 to use pid as pgid)
+ * @return 0 on success, -1 on error
+ */
+uint64_t sys_setpgid(int pid, int pgid) {
+    return (uint64_t)process_setpgid((pid_t)pid, (pid_t)pgid);
+}
+
+/**
+ * sys_getpgid - Get process group ID
+ * 
+ * Returns the process group ID of the specified process.
+ * 
+ * @param pid Process ID (0 for current process)
+ * @return Process group ID, or -1 on error
+ */
+uint64_t sys_getpgid(int pid) {
+    return (uint64_t)process_getpgid((pid_t)pid);
+}
+
+/**
+ * sys_getsid - Get session ID
+ * 
+ * Returns the session ID of the specified process.
+ * 
+ * @param pid Process ID (0 for current process)
+ * @return Session ID, or -1 on error
+ */
+uint64_t sys_getsid(int pid) {
+    return (uint64_t)process_getsid((pid_t)pid);
+}
+
+/**
+ * sys_gettty - Get controlling terminal
+ * 
+ * Returns the index of the process's controlling terminal.
+ * 
+ * @return Terminal index (0-5), or -1 if no controlling terminal
+ */
+uint64_t sys_gettty(void) {
+    struct process *proc = process_current();
+    if (!proc) {
+        return SYSCALL_ERROR;
+    }
+    
+    return (uint64_t)proc->controlling_tty;
+}
+
+/**
+ * sys_settty - Set controlling terminal
+ * 
+ * Sets the controlling terminal for the current process.
+ * The terminal must be a valid virtual terminal index (0-5).
+ * 
+ * @param tty Terminal index to set, or -1 to detach
+ * @return 0 on success, -1 on error
+ */
+uint64_t sys_settty(int tty) {
+    struct process *proc = process_current();
+    if (!proc) {
+        return SYSCALL_ERROR;
+    }
+    
+    /* Validate terminal index */
+    if (tty < -1 || tty >= VTERM_MAX_TERMINALS) {
+        return SYSCALL_ERROR;
+    }
+    
+    proc->controlling_tty = tty;
+    return 0;
+}
+
+/**
+ * sys_getprocs - Get information about running processes
+ * 
+ * Fills a user-provided buffer with information about all active processes.
+ * This is used by the 'ps' utility to display process status.
+ * 
+ * @param buf User buffer to store procinfo_t structures
+ * @param max_procs Maximum number of processes to return
+ * @return Number of processes returned, or -1 on error
+ */
+uint64_t sys_getprocs(procinfo_t *buf, size_t max_procs) {
+    if (!buf || max_procs == 0) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    /* Validate user buffer */
+    if (!is_valid_user_pointer(buf, max_procs * sizeof(procinfo_t))) {
+        set_errno(THUNDEROS_EFAULT);
+        return SYSCALL_ERROR;
+    }
+    
+    int max_count = process_get_max_count();
+    size_t count = 0;
+    
+    for (int i = 0; i < max_count && count < max_procs; i++) {
+        struct process *p = process_get_by_index(i);
+        if (p != NULL) {
+            /* No lock: retry if the slot was reused or renamed meanwhile */
+            uint32_t seq;
+            do {
+                seq = read_seqcount_begin(&p->seq);
+                buf[count].pid = p->pid;
+                buf[count].state = p->state;
+                for (int j = 0; j < PROC_NAME_MAX - 1; j++) {
+                    buf[count].name[j] = p->name[j];
+                    if (!p->name[j]) {
+                        break;
+                    }
+                }
+                buf[count].name[PROC_NAME_MAX - 1] = '\0';
+            } while (read_seqcount_retry(&p->seq, seq));
+            
+            if (buf[count].state == PROC_UNUSED) {
+                continue;
+            }
+            
+            buf[count].ppid = p->parent ? p->parent->pid : 0;
+            buf[count].pgid = p->pgid;
+            buf[count].sid = p->sid;
+            buf[count].tty = p->controlling_tty;
+            buf[count].cpu_time = p->cpu_time;
+            
+            /* Table pages are only counted on demand */
+            size_t table_pages = 0;
+            if (p->page_table) {
+                page_table_usage(p->page_table, NULL, &table_pages);
+            }
+            p->pt_pages = table_pages;
+            buf[count].rss_pages = p->rss_pages;
+            buf[count].peak_rss_pages = p->peak_rss_pages;
+            buf[count].pt_pages = p->pt_pages;
+            buf[count].minor_faults = p->minor_faults;
+            buf[count].major_faults = p->major_faults;
+            buf[count].utime_us = p->acct.utime_us;
+            buf[count].stime_us = p->acct.stime_us;
+            buf[count].nvcsw = p->acct.nvcsw;
+            buf[count].nivcsw = p->acct.nivcsw;
+            buf[count].io_wait_us = p->acct.io_wait_us;
+            
+            count++;
+        }
+    }
+    
+    clear_errno();
+    return count;
+}
+
+/**
+ * sys_uname - Get system information
+ * 
+ * Returns information about the operating system.
+ * 
+ * @param buf User buffer to store utsname_t structure
+ * @return 0 on success, -1 on error
+ */
+uint64_t sys_uname(utsname_t *buf) {
+    if (!buf) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    /* Helper to copy string safely */
+    #define COPY_STR(dst, src) do { \
+        int i; \
+        for (i = 0; i < 63 && (src)[i]; i++) (dst)[i] = (src)[i]; \
+        (dst)[i] = '\0'; \
+    } while(0)
+    
+    /* Filled in here and copied out whole */
+    utsname_t uts;
+    kmemset(&uts, 0, sizeof(uts));
+    COPY_STR(uts.sysname, "ThunderOS");
+    COPY_STR(uts.nodename, "thunderos");
+    COPY_STR(uts.release, "0.7.0");
+    COPY_STR(uts.version, "v0.7.0 Virtual Terminals");
+    COPY_STR(uts.machine, "riscv64");
+    
+    #undef COPY_STR
+    
+    if (copy_to_user(buf, &uts, sizeof(uts)) != 0) {
+        return SYSCALL_ERROR;
+    }
+    
+    clear_errno();
+    return 0;
+}
+
+/**
+ * sys_getirqs - Get statistics of the interrupts in use
+ * 
+ * Fills a user buffer with one entry per IRQ that has a handler, in IRQ
+ * order. Used by the 'irqstat' utility.
+ * 
+ * @param buf User buffer of irqinfo_t
+ * @param max_irqs Entries it holds
+ * @return Entries filled, or -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - No buffer
+ * @errno THUNDEROS_EFAULT - buf points outside the caller's memory
+ */
+uint64_t sys_getirqs(irqinfo_t *buf, size_t max_irqs) {
+    if (!buf || max_irqs == 0) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    size_t count = 0;
+    for (uint32_t irq = 1; irq < MAX_INTERRUPT_SOURCES && count < max_irqs; irq++) {
+        interrupt_stats_t stats;
+        if (!interrupt_get_stats(irq, &stats)) {
+            continue;
+        }
+        
+        irqinfo_t info;
+        kmemset(&info, 0, sizeof(info));
+        info.irq = irq;
+        info.priority = interrupt_get_priority(irq);
+        info.affinity = interrupt_get_affinity(irq);
+        info.target = interrupt_get_target(irq);
+        kstrncpy(info.name, interrupt_get_name(irq), IRQ_INFO_NAME_MAX - 1);
+        info.count = stats.count;
+        for (int cpu = 0; cpu < IRQ_INFO_CPUS && cpu < MAX_CPUS; cpu++) {
+            info.cpu_count[cpu] = stats.cpu_count[cpu];
+        }
+        info.total_us = stats.total_us;
+        info.max_us = stats.max_us;
+        info.max_latency_us = stats.max_latency_us;
+        info.thread_pid = interrupt_get_thread_pid(irq);
+        info.thread_count = stats.thread_count;
+        info.thread_total_us = stats.thread_total_us;
+        info.thread_max_us = stats.thread_max_us;
+        info.thread_max_latency_us = stats.thread_max_latency_us;
+        
+        if (copy_to_user(&buf[count], &info, sizeof(info)) != 0) {
+            return SYSCALL_ERROR;
+        }
+        count++;
+    }
+    
+    clear_errno();
+    return count;
+}
+
+/**
+ * sys_irqctl - Steer an interrupt or change its priority
+ * 
+ * IRQCTL_SET_AFFINITY moves the IRQ to the lowest online CPU of the mask
+ * (a bit per logical CPU); IRQCTL_SET_PRIORITY sets its PLIC priority.
+ * Only root may do either.
+ * 
+ * @param irq IRQ with a handler
+ * @param cmd IRQCTL_SET_AFFINITY or IRQCTL_SET_PRIORITY
+ * @param arg CPU mask, or priority 1-7
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_EPERM - Not root
+ * @errno THUNDEROS_EINVAL - No such IRQ in use, unknown cmd, a priority
+ *        out of range or a mask with no CPU online
+ */
+uint64_t sys_irqctl(uint32_t irq, int cmd, uint64_t arg) {
+    struct process *proc = process_current();
+    if (proc && proc->euid != 0) {
+        set_errno(THUNDEROS_EPERM);
+        return SYSCALL_ERROR;
+    }
+    
+    interrupt_stats_t stats;
+    if (!interrupt_get_stats(irq, &stats)) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    switch (cmd) {
+        case IRQCTL_SET_AFFINITY:
+            if (arg > 0xFFFFFFFFUL || !interrupt_set_affinity(irq, (uint32_t)arg)) {
+                set_errno(THUNDEROS_EINVAL);
+                return SYSCALL_ERROR;
+            }
+            break;
+        case IRQCTL_SET_PRIORITY:
+            if (arg < IRQ_PRIORITY_LOWEST || arg > IRQ_PRIORITY_HIGHEST) {
+                set_errno(THUNDEROS_EINVAL);
+                return SYSCALL_ERROR;
+            }
+            interrupt_set_priority(irq, (uint32_t)arg);
+            break;
+        default:
+            set_errno(THUNDEROS_EINVAL);
+            return SYSCALL_ERROR;
+    }
+    
+    clear_errno();
+    return 0;
+}
+
+/**
+ * sys_perf_event_open - Count a hardware event while a process runs
+ * 
+ * Counting starts at once unless attr has PERF_ATTR_DISABLED. read() on
+ * the descriptor returns a perf_count_t; ioctl() takes the
+ * PERF_EVENT_IOC_* requests (see kernel/perf_event.h).
+ * 
+ * @param attr What to count (perf_event_attr_t)
+ * @param pid 0 or our own pid, or a child that has not exited
+ * @param flags Must be 0
+ * @return Descriptor on success, -1 on error
+ * 
+ * @errno THUNDEROS_EFAULT - Bad attr pointer
+ * @errno THUNDEROS_EINVAL - Unknown type, config or flags
+ * @errno THUNDEROS_ESRCH - No such process, or it has exited
+ * @errno THUNDEROS_EPERM - pid is not us or a child of ours
+ * @errno THUNDEROS_ENODEV - No performance counters
+ * @errno THUNDEROS_ENOENT - No counter of this machine counts the event
+ * @errno THUNDEROS_EMFILE - Too many open files
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ */
+uint64_t sys_perf_event_open(const void *attr, int pid, int flags) {
+    if (flags != 0) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    perf_event_attr_t kattr;
+    if (copy_from_user(&kattr, attr, sizeof(kattr)) != 0) {
+        return SYSCALL_ERROR;
+    }
+    
+    struct process *proc = process_current();
+    struct process *target = pid == 0 ? proc : process_get(pid);
+    if (!target || target->state == PROC_ZOMBIE || target->state == PROC_UNUSED) {
+        set_errno(THUNDEROS_ESRCH);
+        return SYSCALL_ERROR;
+    }
+    if (target != proc && target->parent != proc) {
+        set_errno(THUNDEROS_EPERM);
+        return SYSCALL_ERROR;
+    }
+    
+    int fd = perf_event_open(&kattr, target);
+    if (fd < 0) {
+        return SYSCALL_ERROR;
+    }
+    return fd;
+}
+
+/**
+ * Find the target of sched_setattr()/sched_getattr()
+ * 
+ * pid 0 is the caller; others must be the caller's own threads or
+ * children, unless the caller is root.
+ */
+static struct process *sched_attr_target(int pid) {
+    struct process *proc = process_current();
+    struct process *target = pid == 0 ? proc : process_get(pid);
+    if (!target || target->state == PROC_ZOMBIE || target->state == PROC_UNUSED) {
+        set_errno(THUNDEROS_ESRCH);
+        return NULL;
+    }
+    if (target != proc && proc->euid != 0 && target->parent != proc &&
+        target->group_leader != proc->group_leader) {
+        set_errno(THUNDEROS_EPERM);
+        return NULL;
+    }
+    return target;
+}
+
+/**
+ * sys_sched_setattr - Set a scheduling policy and parameters
+ * 
+ * @param pid 0 for the calling thread, or a thread ID
+ * @param attr New policy and parameters (sched_attr_t)
+ * @param flags Must be 0
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_EFAULT - Bad attr pointer
+ * @errno THUNDEROS_EINVAL - Bad size or flags, unknown policy, or
+ *                           parameters out of range
+ * @errno THUNDEROS_ESRCH - No such process, or it has exited
+ * @errno THUNDEROS_EPERM - Not ours, or a real-time or deadline policy
+ *                          (or a lower nice) without root
+ * @errno THUNDEROS_EBUSY - Deadline admission control refused it
+ */
+uint64_t sys_sched_setattr(int pid, const void *attr, unsigned int flags) {
+    sched_attr_t kattr;
+    if (copy_from_user(&kattr, attr, sizeof(kattr)) != 0) {
+        return SYSCALL_ERROR;
+    }
+    if (flags != 0 || (kattr.size != 0 && kattr.size != sizeof(kattr))) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    struct process *target = sched_attr_target(pid);
+    if (!target) {
+        return SYSCALL_ERROR;
+    }
+    
+    // Only root may take CPU time from everyone else
+    int more_urgent = kattr.sched_policy != SCHED_NORMAL ||
+                      SCHED_RT_LEVELS + (uint64_t)kattr.sched_nice < target->base_priority;
+    if (more_urgent && process_current()->euid != 0) {
+        set_errno(THUNDEROS_EPERM);
+        return SYSCALL_ERROR;
+    }
+    
+    if (scheduler_setattr(target, &kattr) != 0) {
+        return SYSCALL_ERROR;
+    }
+    return 0;
+}
+
+/**
+ * sys_sched_getattr - Get a scheduling policy and parameters
+ * 
+ * @param pid 0 for the calling thread, or a thread ID
+ * @param attr Output (sched_attr_t)
+ * @param size Size of attr, at least sizeof(sched_attr_t)
+ * @param flags Must be 0
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_EFAULT - Bad attr pointer
+ * @errno THUNDEROS_EINVAL - size too small, or flags
+ * @errno THUNDEROS_ESRCH - No such process, or it has exited
+ * @errno THUNDEROS_EPERM - Not ours
+ */
+uint64_t sys_sched_getattr(int pid, void *attr, unsigned int size, unsigned int flags) {
+    if (flags != 0 || size < sizeof(sched_attr_t)) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    struct process *target = sched_attr_target(pid);
+    if (!target) {
+        return SYSCALL_ERROR;
+    }
+    
+    sched_attr_t kattr;
+    scheduler_getattr(target, &kattr);
+    if (copy_to_user(attr, &kattr, sizeof(kattr)) != 0) {
+        return SYSCALL_ERROR;
+    }
+    return 0;
+}
+
+/**
+ * sys_rgroup_create - Create a resource group
+ * 
+ * @param name Its name, under RGROUP_NAME_LEN characters
+ * @return Group ID, or -1 on error
+ * 
+ * @errno THUNDEROS_EPERM - Not root
+ * @errno THUNDEROS_EFAULT - Bad name pointer
+ * @errno THUNDEROS_EINVAL - Empty or too long a name
+ * @errno THUNDEROS_EEXIST - Name taken
+ * @errno THUNDEROS_ENOSPC - No free group
+ */
+uint64_t sys_rgroup_create(const char *name) {
+    if (process_current()->euid != 0) {
+        set_errno(THUNDEROS_EPERM);
+        return SYSCALL_ERROR;
+    }
+    
+    char kname[RGROUP_NAME_LEN];
+    if (strncpy_from_user(kname, name, sizeof(kname)) < 0) {
+        // A name too long for the buffer is just a bad name
+        if (get_errno() == THUNDEROS_ERANGE) {
+            set_errno(THUNDEROS_EINVAL);
+        }
+        return SYSCALL_ERROR;
+    }
+    
+    int id = rgroup_create(kname);
+    if (id < 0) {
+        return SYSCALL_ERROR;
+    }
+    return id;
+}
+
+/**
+ * sys_rgroup_destroy - Remove an empty resource group
+ * 
+ * @param id Group ID
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_EPERM - Not root
+ * @errno THUNDEROS_EINVAL - The root group
+ * @errno THUNDEROS_ENOENT - No such group
+ * @errno THUNDEROS_EBUSY - It still has members
+ */
+uint64_t sys_rgroup_destroy(int id) {
+    if (process_current()->euid != 0) {
+        set_errno(THUNDEROS_EPERM);
+        return SYSCALL_ERROR;
+    }
+    if (rgroup_destroy(id) != 0) {
+        return SYSCALL_ERROR;
+    }
+    return 0;
+}
+
+/**
+ * sys_rgroup_setlimit - Set a resource group's limits
+ * 
+ * @param id Group ID
+ * @param limits CPU quota and period, memory limit (rgroup_limits_t;
+ *               0 = unlimited)
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_EPERM - Not root
+ * @errno THUNDEROS_EFAULT - Bad limits pointer
+ * @errno THUNDEROS_EINVAL - The root group, or a quota or period out of range
+ * @errno THUNDEROS_ENOENT - No such group
+ * @errno THUNDEROS_EBUSY - Memory limit below the group's resident pages
+ */
+uint64_t sys_rgroup_setlimit(int id, const void *limits) {
+    if (process_current()->euid != 0) {
+        set_errno(THUNDEROS_EPERM);
+        return SYSCALL_ERROR;
+    }
+    
+    rgroup_limits_t klimits;
+    if (copy_from_user(&klimits, limits, sizeof(klimits)) != 0) {
+        return SYSCALL_ERROR;
+    }
+    if (rgroup_set_limits(id, &klimits) != 0) {
+        return SYSCALL_ERROR;
+    }
+    return 0;
+}
+
+/**
+ * sys_rgroup_attach - Move a process to a resource group
+ * 
+ * All its threads move with it, and its resident pages are charged to
+ * the new group from then on.
+ * 
+ * @param id Group ID (0 = the root group)
+ * @param pid 0 for the caller, or a process ID
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_EPERM - Not root
+ * @errno THUNDEROS_ESRCH - No such process, or it has exited
+ * @errno THUNDEROS_ENOENT - No such group
+ * @errno THUNDEROS_EINVAL - A kernel thread
+ */
+uint64_t sys_rgroup_attach(int id, int pid) {
+    struct process *proc = process_current();
+    if (proc->euid != 0) {
+        set_errno(THUNDEROS_EPERM);
+        return SYSCALL_ERROR;
+    }
+    
+    struct process *target = pid == 0 ? proc : process_get(pid);
+    if (!target || target->state == PROC_ZOMBIE || target->state == PROC_UNUSED) {
+        set_errno(THUNDEROS_ESRCH);
+        return SYSCALL_ERROR;
+    }
+    if (rgroup_attach(target, id) != 0) {
+        return SYSCALL_ERROR;
+    }
+    return 0;
+}
+
+/**
+ * sys_clock_gettime - Read a clock
+ * 
+ * The vDSO (kernel/vdso.h) reads the same clocks without a trap; this is
+ * for callers without it.
+ * 
+ * @param clock CLOCK_REALTIME or CLOCK_MONOTONIC
+ * @param ts Output: the time, to the nanosecond
+ * @return 0 on success, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Unknown clock
+ * @errno THUNDEROS_EFAULT - Bad ts pointer
+ */
+uint64_t sys_clock_gettime(int clock, struct timespec *ts) {
+    struct timespec kts;
+    if (vdso_clock_gettime(clock, &kts) != 0) {
+        return SYSCALL_ERROR;
+    }
+    if (copy_to_user(ts, &kts, sizeof(kts)) != 0) {
+        return SYSCALL_ERROR;
+    }
+    return 0;
+}
+
+/* ========================================================================
+ * Futex Syscall
+ * ======================================================================== */
+
+/**
+ * sys_futex - Wait on or wake a user-space lock word
+ * 
+ * Lets user-space locks stay entirely in user space until they are
+ * contended (see kernel/futex.h and userland/lib/futex.h).
+ * 
+ * @param uaddr Futex word (4-byte aligned)
+ * @param op FUTEX_WAIT, FUTEX_WAKE or FUTEX_REQUEUE
+ * @param val WAIT: expected value; WAKE/REQUEUE: how many to wake
+ * @param val2 REQUEUE: how many to move to uaddr2 (otherwise ignored)
+ * @param uaddr2 REQUEUE: futex word to move sleepers to
+ * @return WAIT: 0 when woken; WAKE/REQUEUE: number woken; -1 on error
+ */
+uint64_t sys_futex(uint32_t *uaddr, int op, uint32_t val, uint64_t val2, uint32_t *uaddr2) {
+    int result;
+    
+    switch (op) {
+        case FUTEX_WAIT:
+            result = futex_wait(uaddr, val);
+            break;
+        case FUTEX_WAKE:
+            result = futex_wake(uaddr, (int)val);
+            break;
+        case FUTEX_REQUEUE:
+            result = futex_requeue(uaddr, (int)val, uaddr2, (int)val2);
+            break;
+        default:
+            set_errno(THUNDEROS_ENOSYS);
+            return SYSCALL_ERROR;
+    }
+    
+    /* errno already set by the futex call */
+    return result < 0 ? SYSCALL_ERROR : (uint64_t)result;
+}
+
+/* ========================================================================
+ * Submission Ring Syscalls
+ * ======================================================================== */
+
+/**
+ * sys_ring_setup - Register a batched syscall ring
+ * 
+ * @param ring User address of the ring (see kernel/ring.h for its layout)
+ * @param entries Entries per queue (power of two, at most RING_MAX_ENTRIES)
+ * @return 0 on success, -1 on error
+ */
+uint64_t sys_ring_setup(void *ring, uint32_t entries) {
+    if (ring_setup((ring_header_t *)ring, entries) != 0) {
+        return SYSCALL_ERROR;  /* errno already set */
+    }
+    return 0;
+}
+
+/**
+ * sys_ring_enter - Run queued ring submissions
+ * 
+ * @param to_submit Maximum number of submissions to run
+ * @return Number run, or -1 on error
+ */
+uint64_t sys_ring_enter(uint32_t to_submit) {
+    int done = ring_enter(to_submit);
+    if (done < 0) {
+        return SYSCALL_ERROR;  /* errno already set */
+    }
+    return (uint64_t)done;
+}
+
+/**
+ * sys_aio_setup - Create an asynchronous I/O context
+ * 
+ * Reading the descriptor returns aio_event_t completions; see
+ * kernel/aio.h.
+ * 
+ * @param flags 0 or O_NONBLOCK
+ * @return The descriptor, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Unknown flags
+ * @errno THUNDEROS_EMFILE - Too many open files
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ * @errno THUNDEROS_EAGAIN - No process slot for the worker threads
+ */
+uint64_t sys_aio_setup(int flags) {
+    if (flags & ~O_NONBLOCK) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    int fd = vfs_create_aio((uint32_t)flags);
+    if (fd < 0) {
+        return SYSCALL_ERROR;  /* errno already set */
+    }
+    return (uint64_t)fd;
+}
+
+/**
+ * sys_aio_submit - Queue file reads and writes on a context
+ * 
+ * Requests are taken in order until one is refused; the rest are left
+ * for the caller to submit again.
+ * 
+ * @param fd Context from sys_aio_setup()
+ * @param iocbs Array of requests
+ * @param nr Number of requests
+ * @return Number of requests queued (0 only if nr is 0), -1 if the first
+ *         one was refused
+ * 
+ * @errno THUNDEROS_EINVAL - fd is not a context, or a bad request
+ * @errno THUNDEROS_EBADF - fd, or a request's fd, is not open
+ * @errno THUNDEROS_EFAULT - Bad iocbs pointer or write buffer
+ * @errno THUNDEROS_EAGAIN - Too many requests outstanding
+ */
+uint64_t sys_aio_submit(int fd, const aio_iocb_t *iocbs, uint32_t nr) {
+    aio_ctx_t *ctx = vfs_get_aio(fd);
+    if (!ctx) {
+        return SYSCALL_ERROR;  /* errno already set */
+    }
+    
+    uint32_t done = 0;
+    for (; done < nr; done++) {
+        aio_iocb_t iocb;
+        if (copy_from_user(&iocb, &iocbs[done], sizeof(iocb)) != 0 ||
+            aio_submit(ctx, &iocb) != 0) {
+            break;
+        }
+    }
+    if (done == 0 && nr > 0) {
+        return SYSCALL_ERROR;  /* errno already set */
+    }
+    clear_errno();
+    return done;
+}
+
+/* ========================================================================
+ * Mutex Syscalls
+ * ======================================================================== */
+
+#define MAX_USER_MUTEXES 64
+
+static mutex_t user_mutexes[MAX_USER_MUTEXES];
+static int mutex_in_use[MAX_USER_MUTEXES] = {0};
+
+/* ========================================================================
+ * Condition Variable Syscalls
+ * ======================================================================== */
+
+#define MAX_USER_CONDVARS 64
+
+static condvar_t user_condvars[MAX_USER_CONDVARS];
+static int condvar_in_use[MAX_USER_CONDVARS] = {0};
+
+/**
+ * sys_mutex_create - Create a new mutex
+ * 
+ * @return Mutex ID (>= 0) on success, -1 on error
+ */
+uint64_t sys_mutex_create(void) {
+    /* Find a free mutex slot */
+    for (int i = 0; i < MAX_USER_MUTEXES; i++) {
+        if (!mutex_in_use[i]) {
+            mutex_init(&user_mutexes[i]);
+            mutex_in_use[i] = 1;
+            clear_errno();
+            return (uint64_t)i;
+        }
+    }
+    
+    set_errno(THUNDEROS_ENOMEM);
+    return SYSCALL_ERROR;
+}
+
+/**
+ * sys_mutex_lock - Lock a mutex (blocking)
+ * 
+ * @param mutex_id Mutex ID from sys_mutex_create
+ * @return 0 on success, -1 on error
+ */
+uint64_t sys_mutex_lock(int mutex_id) {
+    if (mutex_id < 0 || mutex_id >= MAX_USER_MUTEXES || !mutex_in_use[mutex_id]) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    mutex_lock(&user_mutexes[mutex_id]);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * sys_mutex_trylock - Try to lock a mutex (non-blocking)
+ * 
+ * @param mutex_id Mutex ID from sys_mutex_create
+ * @return 0 if locked, -1 if already locked or error
+ */
+uint64_t sys_mutex_trylock(int mutex_id) {
+    if (mutex_id < 0 || mutex_id >= MAX_USER_MUTEXES || !mutex_in_use[mutex_id]) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    return mutex_trylock(&user_mutexes[mutex_id]);
+}
+
+/**
+ * sys_mutex_unlock - Unlock a mutex
+ * 
+ * @param mutex_id Mutex ID from sys_mutex_create
+ * @return 0 on success, -1 on error
+ */
+uint64_t sys_mutex_unlock(int mutex_id) {
+    if (mutex_id < 0 || mutex_id >= MAX_USER_MUTEXES || !mutex_in_use[mutex_id]) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    mutex_unlock(&user_mutexes[mutex_id]);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * sys_mutex_destroy - Destroy a mutex
+ * 
+ * A held mutex cannot be destroyed: its owner still lists it as a source
+ * of priority inheritance.
+ * 
+ * @param mutex_id Mutex ID from sys_mutex_create
+ * @return 0 on success, -1 on error (EBUSY if locked)
+ */
+uint64_t sys_mutex_destroy(int mutex_id) {
+    if (mutex_id < 0 || mutex_id >= MAX_USER_MUTEXES || !mutex_in_use[mutex_id]) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    if (mutex_is_locked(&user_mutexes[mutex_id])) {
+        set_errno(THUNDEROS_EBUSY);
+        return SYSCALL_ERROR;
+    }
+    
+    mutex_in_use[mutex_id] = 0;
+    clear_errno();
+    return 0;
+}
+
+/**
+ * sys_cond_create - Create a new condition variable
+ * 
+ * @return Condition variable ID (>= 0) on success, -1 on error
+ */
+uint64_t sys_cond_create(void) {
+    /* Find a free condvar slot */
+    for (int i = 0; i < MAX_USER_CONDVARS; i++) {
+        if (!condvar_in_use[i]) {
+            cond_init(&user_condvars[i]);
+            condvar_in_use[i] = 1;
+            clear_errno();
+            return (uint64_t)i;
+        }
+    }
+    
+    set_errno(THUNDEROS_ENOMEM);
+    return SYSCALL_ERROR;
+}
+
+/**
+ * sys_cond_wait - Wait on a condition variable (blocking)
+ * 
+ * Atomically unlocks the mutex and sleeps on the condition variable.
+ * When awakened, re-acquires the mutex before returning.
+ * 
+ * @param cond_id Condition variable ID from sys_cond_create
+ * @param mutex_id Mutex ID (must be locked by caller)
+ * @return 0 on success, -1 on error
+ */
+uint64_t sys_cond_wait(int cond_id, int mutex_id) {
+    if (cond_id < 0 || cond_id >= MAX_USER_CONDVARS || !condvar_in_use[cond_id]) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    if (mutex_id < 0 || mutex_id >= MAX_USER_MUTEXES || !mutex_in_use[mutex_id]) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    cond_wait(&user_condvars[cond_id], &user_mutexes[mutex_id]);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * sys_cond_signal - Signal one waiter on a condition variable
+ * 
+ * Wakes up one process waiting on the condition variable (if any).
+ * 
+ * @param cond_id Condition variable ID from sys_cond_create
+ * @return 0 on success, -1 on error
+ */
+uint64_t sys_cond_signal(int cond_id) {
+    if (cond_id < 0 || cond_id >= MAX_USER_CONDVARS || !condvar_in_use[cond_id]) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    cond_signal(&user_condvars[cond_id]);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * sys_cond_broadcast - Wake all waiters on a condition variable
+ * 
+ * Wakes up all processes waiting on the condition variable.
+ * 
+ * @param cond_id Condition variable ID from sys_cond_create
+ * @return 0 on success, -1 on error
+ */
+uint64_t sys_cond_broadcast(int cond_id) {
+    if (cond_id < 0 || cond_id >= MAX_USER_CONDVARS || !condvar_in_use[cond_id]) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    cond_broadcast(&user_condvars[cond_id]);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * sys_cond_destroy - Destroy a condition variable
+ * 
+ * @param cond_id Condition variable ID from sys_cond_create
+ * @return 0 on success, -1 on error
+ */
+uint64_t sys_cond_destroy(int cond_id) {
+    if (cond_id < 0 || cond_id >= MAX_USER_CONDVARS || !condvar_in_use[cond_id]) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    cond_destroy(&user_condvars[cond_id]);
+    condvar_in_use[cond_id] = 0;
+    clear_errno();
+    return 0;
+}
+
+/* ========================================================================
+ * Reader-Writer Lock Syscalls
+ * ======================================================================== */
+
+#define MAX_USER_RWLOCKS 64
+
+static rwlock_t user_rwlocks[MAX_USER_RWLOCKS];
+static int rwlock_in_use[MAX_USER_RWLOCKS] = {0};
+
+/**
+ * sys_rwlock_create - Create a new reader-writer lock
+ * 
+ * @param flags Policy: RWLOCK_PREFER_WRITER (0), RWLOCK_PREFER_READER (1)
+ *              or RWLOCK_PHASE_FAIR (2)
+ * @return RWLock ID (>= 0) on success, -1 on error
+ */
+uint64_t sys_rwlock_create(int flags) {
+    if (flags < RWLOCK_PREFER_WRITER || flags > RWLOCK_PHASE_FAIR) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    /* Find a free rwlock slot */
+    for (int i = 0; i < MAX_USER_RWLOCKS; i++) {
+        if (!rwlock_in_use[i]) {
+            rwlock_init(&user_rwlocks[i], flags);
+            rwlock_in_use[i] = 1;
+            clear_errno();
+            return (uint64_t)i;
+        }
+    }
+    
+    set_errno(THUNDEROS_ENOMEM);
+    return SYSCALL_ERROR;
+}
+
+/**
+ * sys_rwlock_read_lock - Acquire read lock (blocking)
+ * 
+ * @param rwlock_id RWLock ID from sys_rwlock_create
+ * @return 0 on success, -1 on error
+ */
+uint64_t sys_rwlock_read_lock(int rwlock_id) {
+    if (rwlock_id < 0 || rwlock_id >= MAX_USER_RWLOCKS || !rwlock_in_use[rwlock_id]) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    rwlock_read_lock(&user_rwlocks[rwlock_id]);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * sys_rwlock_read_unlock - Release read lock
+ * 
+ * @param rwlock_id RWLock ID from sys_rwlock_create
+ * @return 0 on success, -1 on error
+ */
+uint64_t sys_rwlock_read_unlock(int rwlock_id) {
+    if (rwlock_id < 0 || rwlock_id >= MAX_USER_RWLOCKS || !rwlock_in_use[rwlock_id]) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    rwlock_read_unlock(&user_rwlocks[rwlock_id]);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * sys_rwlock_write_lock - Acquire write lock (blocking)
+ * 
+ * @param rwlock_id RWLock ID from sys_rwlock_create
+ * @return 0 on success, -1 on error
+ */
+uint64_t sys_rwlock_write_lock(int rwlock_id) {
+    if (rwlock_id < 0 || rwlock_id >= MAX_USER_RWLOCKS || !rwlock_in_use[rwlock_id]) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    rwlock_write_lock(&user_rwlocks[rwlock_id]);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * sys_rwlock_write_unlock - Release write lock
+ * 
+ * @param rwlock_id RWLock ID from sys_rwlock_create
+ * @return 0 on success, -1 on error
+ */
+uint64_t sys_rwlock_write_unlock(int rwlock_id) {
+    if (rwlock_id < 0 || rwlock_id >= MAX_USER_RWLOCKS || !rwlock_in_use[rwlock_id]) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    rwlock_write_unlock(&user_rwlocks[rwlock_id]);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * sys_rwlock_destroy - Destroy a reader-writer lock
+ * 
+ * @param rwlock_id RWLock ID from sys_rwlock_create
+ * @return 0 on success, -1 on error
+ */
+uint64_t sys_rwlock_destroy(int rwlock_id) {
+    if (rwlock_id < 0 || rwlock_id >= MAX_USER_RWLOCKS || !rwlock_in_use[rwlock_id]) {
+        set_errno(THUNDEROS_EINVAL);
+        return SYSCALL_ERROR;
+    }
+    
+    rwlock_in_use[rwlock_id] = 0;
+    clear_errno();
+    return 0;
+}
+
+/**
+ * sys_fork - Create a child process
+ * 
+ * Creates a complete copy of the current process with its own address space.
+ * Both processes continue execution after fork() returns, with different return values:
+ * - Parent receives child PID
+ * - Child receives 0
+ * 
+ * The child process gets:
+ * - Copy of all memory pages (code, data, stack, heap)
+ * - Copy of all VMAs (virtual memory areas)
+ * - Copy of all open file descriptors
+ * - Separate page table (memory isolation)
+ * - Same instruction pointer (continues from fork() call)
+ * 
+ * @return Child PID in parent process, 0 in child process, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - No current process
+ * @errno THUNDEROS_EAGAIN - Process table full
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ * 
+ * Example:
+ *   pid_t pid = fork();
+ *   if (pid < 0) {
+ *     // Error
+ *   } else if (pid == 0) {
+ *     // Child process
+ *   } else {
+ *     // Parent process (pid = child's PID)
+ *   }
+ */
+uint64_t sys_fork(struct trap_frame *tf) {
+    struct process *current = process_current();
+    if (!current) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    if (!tf) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    // Call kernel fork implementation with current trap frame
+    // The child will get a copy of this trap frame
+    pid_t child_pid = process_fork(tf);
+    
+    // Return child PID to parent, or -1 on error (errno already set)
+    return child_pid;
+}
+
+/**
+ * sys_vfork - Create a child process that borrows our address space
+ * 
+ * Like sys_fork(), but the child runs on the parent's memory instead of
+ * a copy-on-write copy, and the parent is suspended until the child calls
+ * execve() or exits. Nothing is copied, so a fork-then-exec costs no page
+ * table walk. The child must not return from the function that called
+ * vfork() or change memory the parent relies on.
+ * 
+ * @param tf Trap frame pointer (copied to the child)
+ * @return Child PID to parent, 0 to child, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - No current process
+ * @errno THUNDEROS_EAGAIN - Process table full
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ */
+uint64_t sys_vfork(struct trap_frame *tf) {
+    if (!process_current() || !tf) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    // Returns once the child has released our memory (errno set on error)
+    return process_vfork(tf);
+}
+
+/**
+ * sys_clone - Create a thread sharing our address space
+ * 
+ * The new thread shares memory, descriptors and signal handlers with
+ * the caller, and starts out returning 0 from the call on its own stack.
+ * 
+ * @param tf Trap frame pointer (copied to the thread)
+ * @param flags CLONE_THREAD_FLAGS, optionally CLONE_SETTLS and
+ *              CLONE_CHILD_CLEARTID
+ * @param stack Top of the thread's stack (16-byte aligned)
+ * @param tls Thread pointer (tp) for CLONE_SETTLS
+ * @param ctid Word zeroed and woken as a futex when the thread exits,
+ *             for CLONE_CHILD_CLEARTID
+ * @return Thread ID to the caller, 0 to the thread, -1 on error
+ * 
+ * @errno THUNDEROS_EINVAL - Unsupported flags or misaligned stack
+ * @errno THUNDEROS_EFAULT - ctid is not a writable user word
+ * @errno THUNDEROS_EAGAIN - Process table full
+ * @errno THUNDEROS_ENOMEM - Out of memory
+ */
+uint64_t sys_clone(struct trap_frame *tf, uint64_t flags, uintptr_t stack, uintptr_t tls, uint32_t *ctid) {
+    if (!process_current() || !tf) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    // errno already set on error
+    return process_clone(tf, flags, stack, tls, ctid);
+}
+
+/**
+ * sys_execve_with_frame - Execute program from filesystem (with trap frame)
+ * 
+ * @param tf Trap frame pointer (for updating entry point)
+ * @param path Path to executable
+ * @param argv Argument array
+ * @param envp Environment array (ignored)
+ * @return Does not return on success, -1 on error
+ *
+ * @errno THUNDEROS_EBUSY - Called by a thread other than the first
+ */
+uint64_t sys_execve_with_frame(struct trap_frame *tf, const char *path, const char *argv[], const char *envp[]) {
+    (void)envp;
+    
+    if (!is_valid_user_pointer(path, 1)) {
+        return SYSCALL_ERROR;
+    }
+    
+    // The new program starts with one thread (errno set on error)
+    if (process_kill_other_threads() != 0) {
+        return SYSCALL_ERROR;
+    }
+    
+    // Count arguments
+    int argc = 0;
+    if (argv) {
+        while (argv[argc] && argc < SYSCALL_MAX_ARGC) {
+            if (!is_valid_user_pointer(argv[argc], 1)) {
+                return SYSCALL_ERROR;
+            }
+            argc++;
+        }
+    }
+    
+    // Replace current process with new ELF binary
+    // On success, this modifies trap_frame to jump to new entry point
+    // and returns 0. On error, returns -1.
+    int result = elf_exec_replace(path, argv, argc, tf);
+    
+    if (result == 0) {
+        // SUCCESS: exec replaced the process
+        // The trap frame has been modified to jump to the new program
+        // We must NOT modify trap_frame->a0 - just return 
+        // The syscall handler should detect exec success and not modify a0
+        return 0;  // Special: tells syscall_handler not to modify a0
+    }
+    
+    // FAILURE: exec failed
+    return SYSCALL_ERROR;
+}
+
+/* ========================================================================
+ * Dispatch Table
+ * ======================================================================== */
+
+/*
+ * One adapter per syscall unpacks the argument registers into the
+ * implementation's own parameter types, so every table entry has the
+ * same signature.
+ */
+
+static uint64_t do_exit(const syscall_args_t *args) {
+    return sys_exit((int)args->arg[0]);
+}
+
+static uint64_t do_write(const syscall_args_t *args) {
+    return sys_write((int)args->arg[0], (const char *)args->arg[1], (size_t)args->arg[2]);
+}
+
+static uint64_t do_read(const syscall_args_t *args) {
+    return sys_read((int)args->arg[0], (char *)args->arg[1], (size_t)args->arg[2]);
+}
+
+static uint64_t do_getpid(const syscall_args_t *args) {
+    (void)args;
+    return sys_getpid();
+}
+
+static uint64_t do_sbrk(const syscall_args_t *args) {
+    return sys_sbrk((int)args->arg[0]);
+}
+
+static uint64_t do_sleep(const syscall_args_t *args) {
+    return sys_sleep(args->arg[0]);
+}
+
+static uint64_t do_yield(const syscall_args_t *args) {
+    (void)args;
+    return sys_yield();
+}
+
+static uint64_t do_fork(const syscall_args_t *args) {
+    return sys_fork(args->tf);
+}
+
+static uint64_t do_vfork(const syscall_args_t *args) {
+    return sys_vfork(args->tf);
+}
+
+static uint64_t do_waitpid(const syscall_args_t *args) {
+    return sys_waitpid((int)args->arg[0], (int *)args->arg[1], (int)args->arg[2]);
+}
+
+static uint64_t do_getppid(const syscall_args_t *args) {
+    (void)args;
+    return sys_getppid();
+}
+
+static uint64_t do_kill(const syscall_args_t *args) {
+    return sys_kill((int)args->arg[0], (int)args->arg[1]);
+}
+
+static uint64_t do_gettime(const syscall_args_t *args) {
+    (void)args;
+    return sys_gettime();
+}
+
+static uint64_t do_open(const syscall_args_t *args) {
+    return sys_open((const char *)args->arg[0], (int)args->arg[1], (int)args->arg[2]);
+}
+
+static uint64_t do_close(const syscall_args_t *args) {
+    return sys_close((int)args->arg[0]);
+}
+
+static uint64_t do_lseek(const syscall_args_t *args) {
+    return sys_lseek((int)args->arg[0], (int64_t)args->arg[1], (int)args->arg[2]);
+}
+
+static uint64_t do_stat(const syscall_args_t *args) {
+    return sys_stat((const char *)args->arg[0], (void *)args->arg[1]);
+}
+
+static uint64_t do_mkdir(const syscall_args_t *args) {
+    return sys_mkdir((const char *)args->arg[0], (int)args->arg[1]);
+}
+
+static uint64_t do_unlink(const syscall_args_t *args) {
+    return sys_unlink((const char *)args->arg[0]);
+}
+
+static uint64_t do_rmdir(const syscall_args_t *args) {
+    return sys_rmdir((const char *)args->arg[0]);
+}
+
+static uint64_t do_execve(const syscall_args_t *args) {
+    return sys_execve_with_frame(args->tf, (const char *)args->arg[0], (const char **)args->arg[1], (const char **)args->arg[2]);
+}
+
+static uint64_t do_mmap(const syscall_args_t *args) {
+    return sys_mmap((void *)args->arg[0], (size_t)args->arg[1], (int)args->arg[2], (int)args->arg[3], (int)args->arg[4], args->arg[5]);
+}
+
+static uint64_t do_munmap(const syscall_args_t *args) {
+    return sys_munmap((void *)args->arg[0], (size_t)args->arg[1]);
+}
+
+static uint64_t do_pipe(const syscall_args_t *args) {
+    return sys_pipe((int *)args->arg[0]);
+}
+
+static uint64_t do_pipe2(const syscall_args_t *args) {
+    return sys_pipe2((int *)args->arg[0], (int)args->arg[1]);
+}
+
+static uint64_t do_fcntl(const syscall_args_t *args) {
+    return sys_fcntl((int)args->arg[0], (int)args->arg[1], args->arg[2]);
+}
+
+static uint64_t do_splice(const syscall_args_t *args) {
+    return sys_splice((int)args->arg[0], (int64_t *)args->arg[1], (int)args->arg[2],
+                      (int64_t *)args->arg[3], (size_t)args->arg[4], (unsigned int)args->arg[5]);
+}
+
+static uint64_t do_tee(const syscall_args_t *args) {
+    return sys_tee((int)args->arg[0], (int)args->arg[1], (size_t)args->arg[2],
+                   (unsigned int)args->arg[3]);
+}
+
+static uint64_t do_sendfile(const syscall_args_t *args) {
+    return sys_sendfile((int)args->arg[0], (int)args->arg[1], (int64_t *)args->arg[2],
+                        (size_t)args->arg[3]);
+}
+
+static uint64_t do_pread64(const syscall_args_t *args) {
+    return sys_pread64((int)args->arg[0], (void *)args->arg[1], (size_t)args->arg[2],
+                       (int64_t)args->arg[3]);
+}
+
+static uint64_t do_pwrite64(const syscall_args_t *args) {
+    return sys_pwrite64((int)args->arg[0], (const void *)args->arg[1], (size_t)args->arg[2],
+                        (int64_t)args->arg[3]);
+}
+
+static uint64_t do_readv(const syscall_args_t *args) {
+    return sys_readv((int)args->arg[0], (const vfs_iovec_t *)args->arg[1], (int)args->arg[2]);
+}
+
+static uint64_t do_writev(const syscall_args_t *args) {
+    return sys_writev((int)args->arg[0], (const vfs_iovec_t *)args->arg[1], (int)args->arg[2]);
+}
+
+static uint64_t do_preadv(const syscall_args_t *args) {
+    return sys_preadv((int)args->arg[0], (const vfs_iovec_t *)args->arg[1], (int)args->arg[2],
+                      (int64_t)args->arg[3]);
+}
+
+static uint64_t do_pwritev(const syscall_args_t *args) {
+    return sys_pwritev((int)args->arg[0], (const vfs_iovec_t *)args->arg[1], (int)args->arg[2],
+                       (int64_t)args->arg[3]);
+}
+
+static uint64_t do_fsync(const syscall_args_t *args) {
+    return sys_fsync((int)args->arg[0]);
+}
+
+static uint64_t do_fdatasync(const syscall_args_t *args) {
+    return sys_fdatasync((int)args->arg[0]);
+}
+
+static uint64_t do_sync(const syscall_args_t *args) {
+    (void)args;
+    return sys_sync();
+}
+
+static uint64_t do_ioctl(const syscall_args_t *args) {
+    return sys_ioctl((int)args->arg[0], (uint32_t)args->arg[1], args->arg[2]);
+}
+
+static uint64_t do_socket(const syscall_args_t *args) {
+    return sys_socket((int)args->arg[0], (int)args->arg[1], (int)args->arg[2]);
+}
+
+static uint64_t do_bind(const syscall_args_t *args) {
+    return sys_bind((int)args->arg[0], (const void *)args->arg[1],
+                    (uint32_t)args->arg[2]);
+}
+
+static uint64_t do_sendto(const syscall_args_t *args) {
+    return sys_sendto((int)args->arg[0], (const void *)args->arg[1], (size_t)args->arg[2],
+                      (int)args->arg[3], (const void *)args->arg[4],
+                      (uint32_t)args->arg[5]);
+}
+
+static uint64_t do_recvfrom(const syscall_args_t *args) {
+    return sys_recvfrom((int)args->arg[0], (void *)args->arg[1], (size_t)args->arg[2],
+                        (int)args->arg[3], (void *)args->arg[4],
+                        (uint32_t *)args->arg[5]);
+}
+
+static uint64_t do_sendmmsg(const syscall_args_t *args) {
+    return sys_sendmmsg((int)args->arg[0], (struct mmsghdr *)args->arg[1],
+                        (uint32_t)args->arg[2], (int)args->arg[3]);
+}
+
+static uint64_t do_recvmmsg(const syscall_args_t *args) {
+    return sys_recvmmsg((int)args->arg[0], (struct mmsghdr *)args->arg[1],
+                        (uint32_t)args->arg[2], (int)args->arg[3],
+                        (const struct timespec *)args->arg[4]);
+}
+
+static uint64_t do_connect(const syscall_args_t *args) {
+    return sys_connect((int)args->arg[0], (const void *)args->arg[1],
+                       (uint32_t)args->arg[2]);
+}
+
+static uint64_t do_listen(const syscall_args_t *args) {
+    return sys_listen((int)args->arg[0], (int)args->arg[1]);
+}
+
+static uint64_t do_accept(const syscall_args_t *args) {
+    return sys_accept((int)args->arg[0], (void *)args->arg[1],
+                      (uint32_t *)args->arg[2]);
+}
+
+static uint64_t do_setsockopt(const syscall_args_t *args) {
+    return sys_setsockopt((int)args->arg[0], (int)args->arg[1], (int)args->arg[2],
+                          (const void *)args->arg[3], (uint32_t)args->arg[4]);
+}
+
+static uint64_t do_getsockopt(const syscall_args_t *args) {
+    return sys_getsockopt((int)args->arg[0], (int)args->arg[1], (int)args->arg[2],
+                          (void *)args->arg[3], (uint32_t *)args->arg[4]);
+}
+
+static uint64_t do_shutdown(const syscall_args_t *args) {
+    return sys_shutdown((int)args->arg[0], (int)args->arg[1]);
+}
+
+static uint64_t do_socketpair(const syscall_args_t *args) {
+    return sys_socketpair((int)args->arg[0], (int)args->arg[1], (int)args->arg[2],
+                          (int *)args->arg[3]);
+}
+
+static uint64_t do_sendmsg(const syscall_args_t *args) {
+    return sys_sendmsg((int)args->arg[0], (const struct msghdr *)args->arg[1],
+                       (int)args->arg[2]);
+}
+
+static uint64_t do_recvmsg(const syscall_args_t *args) {
+    return sys_recvmsg((int)args->arg[0], (struct msghdr *)args->arg[1], (int)args->arg[2]);
+}
+
+static uint64_t do_poll_fds(const syscall_args_t *args) {
+    return sys_poll((struct pollfd *)args->arg[0], (uint32_t)args->arg[1], (int)args->arg[2]);
+}
+
+static uint64_t do_shm_open(const syscall_args_t *args) {
+    return sys_shm_open((const char *)args->arg[0], (int)args->arg[1], (int)args->arg[2]);
+}
+
+static uint64_t do_shm_unlink(const syscall_args_t *args) {
+    return sys_shm_unlink((const char *)args->arg[0]);
+}
+
+static uint64_t do_ftruncate(const syscall_args_t *args) {
+    return sys_ftruncate((int)args->arg[0], (int64_t)args->arg[1]);
+}
+
+static uint64_t do_sigqueue(const syscall_args_t *args) {
+    return sys_sigqueue((int)args->arg[0], (int)args->arg[1], (int64_t)args->arg[2]);
+}
+
+static uint64_t do_sigprocmask(const syscall_args_t *args) {
+    return sys_sigprocmask((int)args->arg[0], (const uint64_t *)args->arg[1],
+                           (uint64_t *)args->arg[2]);
+}
+
+static uint64_t do_signalfd(const syscall_args_t *args) {
+    return sys_signalfd((int)args->arg[0], (const uint64_t *)args->arg[1], (int)args->arg[2]);
+}
+
+static uint64_t do_epoll_create(const syscall_args_t *args) {
+    return sys_epoll_create((int)args->arg[0]);
+}
+
+static uint64_t do_epoll_ctl(const syscall_args_t *args) {
+    return sys_epoll_ctl((int)args->arg[0], (int)args->arg[1], (int)args->arg[2],
+                         (const struct epoll_event *)args->arg[3]);
+}
+
+static uint64_t do_epoll_wait(const syscall_args_t *args) {
+    return sys_epoll_wait((int)args->arg[0], (struct epoll_event *)args->arg[1],
+                          (int)args->arg[2], (int)args->arg[3]);
+}
+
+static uint64_t do_getdents(const syscall_args_t *args) {
+    return sys_getdents((int)args->arg[0], (void *)args->arg[1], (size_t)args->arg[2]);
+}
+
+static uint64_t do_chdir(const syscall_args_t *args) {
+    return sys_chdir((const char *)args->arg[0]);
+}
+
+static uint64_t do_getcwd(const syscall_args_t *args) {
+    return sys_getcwd((char *)args->arg[0], (size_t)args->arg[1]);
+}
+
+static uint64_t do_setsid(const syscall_args_t *args) {
+    (void)args;
+    return sys_setsid();
+}
+
+static uint64_t do_gettty(const syscall_args_t *args) {
+    (void)args;
+    return sys_gettty();
+}
+
+static uint64_t do_settty(const syscall_args_t *args) {
+    return sys_settty((int)args->arg[0]);
+}
+
+static uint64_t do_getprocs(const syscall_args_t *args) {
+    return sys_getprocs((procinfo_t *)args->arg[0], (size_t)args->arg[1]);
+}
+
+static uint64_t do_getirqs(const syscall_args_t *args) {
+    return sys_getirqs((irqinfo_t *)args->arg[0], (size_t)args->arg[1]);
+}
+
+static uint64_t do_irqctl(const syscall_args_t *args) {
+    return sys_irqctl((uint32_t)args->arg[0], (int)args->arg[1], args->arg[2]);
+}
+
+static uint64_t do_perf_event_open(const syscall_args_t *args) {
+    return sys_perf_event_open((const void *)args->arg[0], (int)args->arg[1], (int)args->arg[2]);
+}
+
+static uint64_t do_clock_gettime(const syscall_args_t *args) {
+    return sys_clock_gettime((int)args->arg[0], (struct timespec *)args->arg[1]);
+}
+
+static uint64_t do_sched_setattr(const syscall_args_t *args) {
+    return sys_sched_setattr((int)args->arg[0], (const void *)args->arg[1], (unsigned int)args->arg[2]);
+}
+
+static uint64_t do_sched_getattr(const syscall_args_t *args) {
+    return sys_sched_getattr((int)args->arg[0], (void *)args->arg[1], (unsigned int)args->arg[2],
+                             (unsigned int)args->arg[3]);
+}
+
+static uint64_t do_rgroup_create(const syscall_args_t *args) {
+    return sys_rgroup_create((const char *)args->arg[0]);
+}
+
+static uint64_t do_rgroup_destroy(const syscall_args_t *args) {
+    return sys_rgroup_destroy((int)args->arg[0]);
+}
+
+static uint64_t do_rgroup_setlimit(const syscall_args_t *args) {
+    return sys_rgroup_setlimit((int)args->arg[0], (const void *)args->arg[1]);
+}
+
+static uint64_t do_rgroup_attach(const syscall_args_t *args) {
+    return sys_rgroup_attach((int)args->arg[0], (int)args->arg[1]);
+}
+
+static uint64_t do_clone(const syscall_args_t *args) {
+    return sys_clone(args->tf, args->arg[0], (uintptr_t)args->arg[1], (uintptr_t)args->arg[2],
+                     (uint32_t *)args->arg[3]);
+}
+
+static uint64_t do_gettid(const syscall_args_t *args) {
+    (void)args;
+    return sys_gettid();
+}
+
+static uint64_t do_exit_group(const syscall_args_t *args) {
+    return sys_exit_group((int)args->arg[0]);
+}
+
+static uint64_t do_uname(const syscall_args_t *args) {
+    return sys_uname((utsname_t *)args->arg[0]);
+}
+
+static uint64_t do_dup2(const syscall_args_t *args) {
+    return sys_dup2((int)args->arg[0], (int)args->arg[1]);
+}
+
+static uint64_t do_setfgpid(const syscall_args_t *args) {
+    /* Set foreground process for current terminal */
+    extern void vterm_set_active_fg_pid(int pid);
+    vterm_set_active_fg_pid((int)args->arg[0]);
+    return 0;
+}
+
+static uint64_t do_getuid(const syscall_args_t *args) {
+    (void)args;
+    return sys_getuid();
+}
+
+static uint64_t do_getgid(const syscall_args_t *args) {
+    (void)args;
+    return sys_getgid();
+}
+
+static uint64_t do_geteuid(const syscall_args_t *args) {
+    (void)args;
+    return sys_geteuid();
+}
+
+static uint64_t do_getegid(const syscall_args_t *args) {
+    (void)args;
+    return sys_getegid();
+}
+
+static uint64_t do_chmod(const syscall_args_t *args) {
+    return sys_chmod((const char *)args->arg[0], (uint32_t)args->arg[1]);
+}
+
+static uint64_t do_chown(const syscall_args_t *args) {
+    return sys_chown((const char *)args->arg[0], (uint16_t)args->arg[1], (uint16_t)args->arg[2]);
+}
+
+static uint64_t do_setpgid(const syscall_args_t *args) {
+    return sys_setpgid((int)args->arg[0], (int)args->arg[1]);
+}
+
+static uint64_t do_getpgid(const syscall_args_t *args) {
+    return sys_getpgid((int)args->arg[0]);
+}
+
+static uint64_t do_getsid(const syscall_args_t *args) {
+    return sys_getsid((int)args->arg[0]);
+}
+
+static uint64_t do_mutex_create(const syscall_args_t *args) {
+    (void)args;
+    return sys_mutex_create();
+}
+
+static uint64_t do_mutex_lock(const syscall_args_t *args) {
+    return sys_mutex_lock((int)args->arg[0]);
+}
+
+static uint64_t do_mutex_trylock(const syscall_args_t *args) {
+    return sys_mutex_trylock((int)args->arg[0]);
+}
+
+static uint64_t do_mutex_unlock(const syscall_args_t *args) {
+    return sys_mutex_unlock((int)args->arg[0]);
+}
+
+static uint64_t do_mutex_destroy(const syscall_args_t *args) {
+    return sys_mutex_destroy((int)args->arg[0]);
+}
+
+static uint64_t do_cond_create(const syscall_args_t *args) {
+    (void)args;
+    return sys_cond_create();
+}
+
+static uint64_t do_cond_wait(const syscall_args_t *args) {
+    return sys_cond_wait((int)args->arg[0], (int)args->arg[1]);
+}
+
+static uint64_t do_cond_signal(const syscall_args_t *args) {
+    return sys_cond_signal((int)args->arg[0]);
+}
+
+static uint64_t do_cond_broadcast(const syscall_args_t *args) {
+    return sys_cond_broadcast((int)args->arg[0]);
+}
+
+static uint64_t do_cond_destroy(const syscall_args_t *args) {
+    return sys_cond_destroy((int)args->arg[0]);
+}
+
+static uint64_t do_rwlock_create(const syscall_args_t *args) {
+    return sys_rwlock_create((int)args->arg[0]);
+}
+
+static uint64_t do_rwlock_read_lock(const syscall_args_t *args) {
+    return sys_rwlock_read_lock((int)args->arg[0]);
+}
+
+static uint64_t do_rwlock_read_unlock(const syscall_args_t *args) {
+    return sys_rwlock_read_unlock((int)args->arg[0]);
+}
+
+static uint64_t do_rwlock_write_lock(const syscall_args_t *args) {
+    return sys_rwlock_write_lock((int)args->arg[0]);
+}
+
+static uint64_t do_rwlock_write_unlock(const syscall_args_t *args) {
+    return sys_rwlock_write_unlock((int)args->arg[0]);
+}
+
+static uint64_t do_rwlock_destroy(const syscall_args_t *args) {
+    return sys_rwlock_destroy((int)args->arg[0]);
+}
+
+static uint64_t do_msync(const syscall_args_t *args) {
+    return sys_msync((void *)args->arg[0], (size_t)args->arg[1], (int)args->arg[2]);
+}
+
+static uint64_t do_madvise(const syscall_args_t *args) {
+    return sys_madvise((void *)args->arg[0], (size_t)args->arg[1], (int)args->arg[2]);
+}
+
+static uint64_t do_futex(const syscall_args_t *args) {
+    return sys_futex((uint32_t *)args->arg[0], (int)args->arg[1], (uint32_t)args->arg[2], args->arg[3], (uint32_t *)args->arg[4]);
+}
+
+static uint64_t do_ring_setup(const syscall_args_t *args) {
+    return sys_ring_setup((void *)args->arg[0], (uint32_t)args->arg[1]);
+}
+
+static uint64_t do_ring_enter(const syscall_args_t *args) {
+    return sys_ring_enter((uint32_t)args->arg[0]);
+}
+
+static uint64_t do_aio_setup(const syscall_args_t *args) {
+    return sys_aio_setup((int)args->arg[0]);
+}
+
+static uint64_t do_aio_submit(const syscall_args_t *args) {
+    return sys_aio_submit((int)args->arg[0], (const aio_iocb_t *)args->arg[1], (uint32_t)args->arg[2]);
+}
+
+static uint64_t do_poweroff(const syscall_args_t *args) {
+    (void)args;
+    
+    /* Power off the system */
+    hal_uart_puts("\n=====================================\n");
+    hal_uart_puts("  System Poweroff Requested\n");
+    hal_uart_puts("=====================================\n");
+    
+    /* File data, inode metadata and blocks still only in memory */
+    vfs_sync();
+    
+    clear_errno();  // Clear errno before non-returning operation
+    sbi_shutdown();
+    
+    /* Should not reach here */
+    return 0;
+}
+
+static uint64_t do_reboot(const syscall_args_t *args) {
+    (void)args;
+    
+    /* Reboot the system */
+    hal_uart_puts("\n=====================================\n");
+    hal_uart_puts("  System Reboot Requested\n");
+    hal_uart_puts("=====================================\n");
+    
+    /* File data, inode metadata and blocks still only in memory */
+    vfs_sync();
+    
+    clear_errno();  // Clear errno before non-returning operation
+    sbi_reboot();
+    
+    /* Should not reach here */
+    return 0;
+}
 
 /**
- * sys_execve_with_frame - Execute program from filesystem (with trap frame)
+ * Syscall table, indexed by syscall number
  * 
- * @param tf Trap frame pointer (for updating entry point)
- * @param path Path to executable
- * @param argv Argument array
- * @param envp Environment array (ignored)
- * @return Does not return on success, -1 on error
+ * Numbers without an entry fail with ENOSYS.
  */
-uint64_t sys_execve_with_frame(struct trap_frame *tf, const char *path, const char *argv[], const char *envp[]) {
-    (void)envp;
-    
-    if (!is_valid_user_pointer(path, 1)) {
+static const syscall_entry_t syscall_table[SYSCALL_COUNT] = {
+    [SYS_EXIT]                = { do_exit, 0, "exit" },
+    [SYS_WRITE]               = { do_write, SYSCALL_MAY_BLOCK, "write" },
+    [SYS_READ]                = { do_read, SYSCALL_MAY_BLOCK, "read" },
+    [SYS_GETPID]              = { do_getpid, 0, "getpid" },
+    [SYS_SBRK]                = { do_sbrk, 0, "sbrk" },
+    [SYS_SLEEP]               = { do_sleep, SYSCALL_MAY_BLOCK, "sleep" },
+    [SYS_YIELD]               = { do_yield, SYSCALL_MAY_BLOCK, "yield" },
+    [SYS_FORK]                = { do_fork, SYSCALL_NEEDS_FRAME, "fork" },
+    [SYS_WAIT]                = { do_waitpid, SYSCALL_MAY_BLOCK, "waitpid" },
+    [SYS_GETPPID]             = { do_getppid, 0, "getppid" },
+    [SYS_KILL]                = { do_kill, 0, "kill" },
+    [SYS_GETTIME]             = { do_gettime, 0, "gettime" },
+    [SYS_OPEN]                = { do_open, SYSCALL_MAY_BLOCK, "open" },
+    [SYS_CLOSE]               = { do_close, 0, "close" },
+    [SYS_LSEEK]               = { do_lseek, 0, "lseek" },
+    [SYS_STAT]                = { do_stat, SYSCALL_MAY_BLOCK, "stat" },
+    [SYS_MKDIR]               = { do_mkdir, SYSCALL_MAY_BLOCK, "mkdir" },
+    [SYS_UNLINK]              = { do_unlink, SYSCALL_MAY_BLOCK, "unlink" },
+    [SYS_RMDIR]               = { do_rmdir, SYSCALL_MAY_BLOCK, "rmdir" },
+    [SYS_EXECVE]              = { do_execve, SYSCALL_NEEDS_FRAME | SYSCALL_MAY_BLOCK, "execve" },
+    [SYS_MMAP]                = { do_mmap, SYSCALL_MAY_BLOCK, "mmap" },
+    [SYS_MUNMAP]              = { do_munmap, SYSCALL_MAY_BLOCK, "munmap" },
+    [SYS_PIPE]                = { do_pipe, 0, "pipe" },
+    [SYS_GETDENTS]            = { do_getdents, SYSCALL_MAY_BLOCK, "getdents" },
+    [SYS_CHDIR]               = { do_chdir, SYSCALL_MAY_BLOCK, "chdir" },
+    [SYS_GETCWD]              = { do_getcwd, 0, "getcwd" },
+    [SYS_SETSID]              = { do_setsid, 0, "setsid" },
+    [SYS_GETTTY]              = { do_gettty, 0, "gettty" },
+    [SYS_SETTTY]              = { do_settty, 0, "settty" },
+    [SYS_GETPROCS]            = { do_getprocs, 0, "getprocs" },
+    [SYS_UNAME]               = { do_uname, 0, "uname" },
+    [SYS_DUP2]                = { do_dup2, 0, "dup2" },
+    [SYS_SETFGPID]            = { do_setfgpid, 0, "setfgpid" },
+    [SYS_GETUID]              = { do_getuid, 0, "getuid" },
+    [SYS_GETGID]              = { do_getgid, 0, "getgid" },
+    [SYS_GETEUID]             = { do_geteuid, 0, "geteuid" },
+    [SYS_GETEGID]             = { do_getegid, 0, "getegid" },
+    [SYS_CHMOD]               = { do_chmod, SYSCALL_MAY_BLOCK, "chmod" },
+    [SYS_CHOWN]               = { do_chown, SYSCALL_MAY_BLOCK, "chown" },
+    [SYS_SETPGID]             = { do_setpgid, 0, "setpgid" },
+    [SYS_GETPGID]             = { do_getpgid, 0, "getpgid" },
+    [SYS_GETSID]              = { do_getsid, 0, "getsid" },
+    [SYS_MUTEX_CREATE]        = { do_mutex_create, 0, "mutex_create" },
+    [SYS_MUTEX_LOCK]          = { do_mutex_lock, SYSCALL_MAY_BLOCK, "mutex_lock" },
+    [SYS_MUTEX_TRYLOCK]       = { do_mutex_trylock, 0, "mutex_trylock" },
+    [SYS_MUTEX_UNLOCK]        = { do_mutex_unlock, 0, "mutex_unlock" },
+    [SYS_MUTEX_DESTROY]       = { do_mutex_destroy, 0, "mutex_destroy" },
+    [SYS_COND_CREATE]         = { do_cond_create, 0, "cond_create" },
+    [SYS_COND_WAIT]           = { do_cond_wait, SYSCALL_MAY_BLOCK, "cond_wait" },
+    [SYS_COND_SIGNAL]         = { do_cond_signal, 0, "cond_signal" },
+    [SYS_COND_BROADCAST]      = { do_cond_broadcast, 0, "cond_broadcast" },
+    [SYS_COND_DESTROY]        = { do_cond_destroy, 0, "cond_destroy" },
+    [SYS_RWLOCK_CREATE]       = { do_rwlock_create, 0, "rwlock_create" },
+    [SYS_RWLOCK_READ_LOCK]    = { do_rwlock_read_lock, SYSCALL_MAY_BLOCK, "rwlock_read_lock" },
+    [SYS_RWLOCK_READ_UNLOCK]  = { do_rwlock_read_unlock, 0, "rwlock_read_unlock" },
+    [SYS_RWLOCK_WRITE_LOCK]   = { do_rwlock_write_lock, SYSCALL_MAY_BLOCK, "rwlock_write_lock" },
+    [SYS_RWLOCK_WRITE_UNLOCK] = { do_rwlock_write_unlock, 0, "rwlock_write_unlock" },
+    [SYS_RWLOCK_DESTROY]      = { do_rwlock_destroy, 0, "rwlock_destroy" },
+    [SYS_MSYNC]               = { do_msync, SYSCALL_MAY_BLOCK, "msync" },
+    [SYS_FUTEX]               = { do_futex, SYSCALL_MAY_BLOCK, "futex" },
+    [SYS_RING_SETUP]          = { do_ring_setup, 0, "ring_setup" },
+    [SYS_RING_ENTER]          = { do_ring_enter, SYSCALL_MAY_BLOCK, "ring_enter" },
+    [SYS_VFORK]               = { do_vfork, SYSCALL_NEEDS_FRAME | SYSCALL_MAY_BLOCK, "vfork" },
+    [SYS_FCNTL]               = { do_fcntl, 0, "fcntl" },
+    [SYS_SPLICE]              = { do_splice, SYSCALL_MAY_BLOCK, "splice" },
+    [SYS_TEE]                 = { do_tee, SYSCALL_MAY_BLOCK, "tee" },
+    [SYS_SENDFILE]            = { do_sendfile, SYSCALL_MAY_BLOCK, "sendfile" },
+    [SYS_POLL]                = { do_poll_fds, SYSCALL_MAY_BLOCK, "poll_fds" },
+    [SYS_EPOLL_CREATE]        = { do_epoll_create, 0, "epoll_create" },
+    [SYS_EPOLL_CTL]           = { do_epoll_ctl, 0, "epoll_ctl" },
+    [SYS_EPOLL_WAIT]          = { do_epoll_wait, SYSCALL_MAY_BLOCK, "epoll_wait" },
+    [SYS_PIPE2]               = { do_pipe2, 0, "pipe2" },
+    [SYS_SHM_OPEN]            = { do_shm_open, 0, "shm_open" },
+    [SYS_SHM_UNLINK]          = { do_shm_unlink, 0, "shm_unlink" },
+    [SYS_FTRUNCATE]           = { do_ftruncate, 0, "ftruncate" },
+    [SYS_SIGQUEUE]            = { do_sigqueue, 0, "sigqueue" },
+    [SYS_SIGPROCMASK]         = { do_sigprocmask, 0, "sigprocmask" },
+    [SYS_SIGNALFD]            = { do_signalfd, 0, "signalfd" },
+    [SYS_PREAD64]             = { do_pread64, SYSCALL_MAY_BLOCK, "pread64" },
+    [SYS_PWRITE64]            = { do_pwrite64, SYSCALL_MAY_BLOCK, "pwrite64" },
+    [SYS_READV]               = { do_readv, SYSCALL_MAY_BLOCK, "readv" },
+    [SYS_WRITEV]              = { do_writev, SYSCALL_MAY_BLOCK, "writev" },
+    [SYS_PREADV]              = { do_preadv, SYSCALL_MAY_BLOCK, "preadv" },
+    [SYS_PWRITEV]             = { do_pwritev, SYSCALL_MAY_BLOCK, "pwritev" },
+    [SYS_FSYNC]               = { do_fsync, SYSCALL_MAY_BLOCK, "fsync" },
+    [SYS_FDATASYNC]           = { do_fdatasync, SYSCALL_MAY_BLOCK, "fdatasync" },
+    [SYS_SYNC]                = { do_sync, SYSCALL_MAY_BLOCK, "sync" },
+    [SYS_IOCTL]               = { do_ioctl, SYSCALL_MAY_BLOCK, "ioctl" },
+    [SYS_SOCKET]              = { do_socket, 0, "socket" },
+    [SYS_BIND]                = { do_bind, 0, "bind" },
+    [SYS_SENDTO]              = { do_sendto, SYSCALL_MAY_BLOCK, "sendto" },
+    [SYS_RECVFROM]            = { do_recvfrom, SYSCALL_MAY_BLOCK, "recvfrom" },
+    [SYS_SENDMMSG]            = { do_sendmmsg, SYSCALL_MAY_BLOCK, "sendmmsg" },
+    [SYS_RECVMMSG]            = { do_recvmmsg, SYSCALL_MAY_BLOCK, "recvmmsg" },
+    [SYS_CONNECT]             = { do_connect, SYSCALL_MAY_BLOCK, "connect" },
+    [SYS_LISTEN]              = { do_listen, 0, "listen" },
+    [SYS_ACCEPT]              = { do_accept, SYSCALL_MAY_BLOCK, "accept" },
+    [SYS_SETSOCKOPT]          = { do_setsockopt, 0, "setsockopt" },
+    [SYS_GETSOCKOPT]          = { do_getsockopt, 0, "getsockopt" },
+    [SYS_SHUTDOWN]            = { do_shutdown, SYSCALL_MAY_BLOCK, "shutdown" },
+    [SYS_SOCKETPAIR]          = { do_socketpair, 0, "socketpair" },
+    [SYS_SENDMSG]             = { do_sendmsg, SYSCALL_MAY_BLOCK, "sendmsg" },
+    [SYS_RECVMSG]             = { do_recvmsg, SYSCALL_MAY_BLOCK, "recvmsg" },
+    [SYS_GETIRQS]             = { do_getirqs, 0, "getirqs" },
+    [SYS_IRQCTL]              = { do_irqctl, 0, "irqctl" },
+    [SYS_PERF_EVENT_OPEN]     = { do_perf_event_open, 0, "perf_event_open" },
+    [SYS_CLOCK_GETTIME]       = { do_clock_gettime, 0, "clock_gettime" },
+    [SYS_CLONE]               = { do_clone, SYSCALL_NEEDS_FRAME, "clone" },
+    [SYS_GETTID]              = { do_gettid, 0, "gettid" },
+    [SYS_EXIT_GROUP]          = { do_exit_group, 0, "exit_group" },
+    [SYS_SCHED_SETATTR]       = { do_sched_setattr, 0, "sched_setattr" },
+    [SYS_SCHED_GETATTR]       = { do_sched_getattr, 0, "sched_getattr" },
+    [SYS_RGROUP_CREATE]       = { do_rgroup_create, 0, "rgroup_create" },
+    [SYS_RGROUP_DESTROY]      = { do_rgroup_destroy, 0, "rgroup_destroy" },
+    [SYS_RGROUP_SETLIMIT]     = { do_rgroup_setlimit, 0, "rgroup_setlimit" },
+    [SYS_RGROUP_ATTACH]       = { do_rgroup_attach, 0, "rgroup_attach" },
+    [SYS_MADVISE]             = { do_madvise, SYSCALL_MAY_BLOCK, "madvise" },
+    [SYS_AIO_SETUP]           = { do_aio_setup, 0, "aio_setup" },
+    [SYS_AIO_SUBMIT]          = { do_aio_submit, SYSCALL_MAY_BLOCK, "aio_submit" },
+    [SYS_POWEROFF]            = { do_poweroff, 0, "poweroff" },
+    [SYS_REBOOT]              = { do_reboot, 0, "reboot" },
+};
+
+/**
+ * Look up a syscall's table entry
+ */
+const syscall_entry_t *syscall_lookup(uint64_t syscall_number) {
+    if (syscall_number >= SYSCALL_COUNT || !syscall_table[syscall_number].handler) {
+        return NULL;
+    }
+    return &syscall_table[syscall_number];
+}
+
+/**
+ * Dispatch one syscall through the table
+ * 
+ * @param tf Caller's trap frame, or NULL if there is none
+ */
+static uint64_t syscall_dispatch(struct trap_frame *tf, uint64_t syscall_number,
+                                 uint64_t argument0, uint64_t argument1, uint64_t argument2,
+                                 uint64_t argument3, uint64_t argument4, uint64_t argument5) {
+    const syscall_entry_t *entry = syscall_lookup(syscall_number);
+    if (!entry) {
+        hal_uart_puts("[SYSCALL] Invalid syscall number\n");
+        set_errno(THUNDEROS_ENOSYS);
         return SYSCALL_ERROR;
     }
     
-    // Count arguments
-    int argc = 0;
-    if (argv) {
-        while (argv[argc] && argc < SYSCALL_MAX_ARGC) {
-            if (!is_valid_user_pointer(argv[argc], 1)) {
-                return SYSCALL_ERROR;
-            }
-            argc++;
-        }
+    // fork and execve work on the caller's registers: no frame, no call
+    if ((entry->flags & SYSCALL_NEEDS_FRAME) && !tf) {
+        set_errno(THUNDEROS_ENOSYS);
+        return SYSCALL_ERROR;
     }
     
-    // Replace current process with new ELF binary
-    // On success, this modifies trap_frame to jump to new entry point
-    // and returns 0. On error, returns -1.
-    int result = elf_exec_replace(path, argv, argc, tf);
-    
-    if (result == 0) {
-        // SUCCESS: exec replaced the process
-        // The trap frame has been modified to jump to the new program
-        // We must NOT modify trap_frame->a0 - just return 
-        // The syscall handler should detect exec success and not modify a0
-        return 0;  // Special: tells syscall_handler not to modify a0
-    }
+    syscall_args_t args = {
+        .tf = tf,
+        .arg = { argument0, argument1, argument2, argument3, argument4, argument5 },
+    };
     
-    // FAILURE: exec failed
-    return SYSCALL_ERROR;
+    // Latency counts blocking too: that is where most of it comes from
+    uint64_t start_us = hal_timer_get_time_us();
+    uint64_t ret = entry->handler(&args);
+    acct_syscall(syscall_number, hal_timer_get_time_us() - start_us);
+    return ret;
 }
 
 /**
- * syscall_handler - Main system call dispatcher
+ * syscall_handler_with_frame - Main system call dispatcher
  * 
  * Called from trap handler when ECALL is executed from user mode.
- * Dispatches to appropriate syscall implementation based on syscall number.
+ * Dispatches through syscall_table, handing the trap frame on to the
+ * syscalls that need it.
  * 
+ * @param tf Trap frame of the calling process
  * @param syscall_number Syscall number (from a7 register)
  * @param argument0 First argument (from a0 register)
  * @param argument1 Second argument (from a1 register)
@@ -1835,319 +5200,22 @@ uint64_t sys_execve_with_frame(struct trap_frame *tf, const char *path, const ch
  * @param argument5 Sixth argument (from a5 register)
  * @return Return value (placed in a0 register)
  */
-/**
- * Syscall handler with trap frame for syscalls that need full register state
- */
 uint64_t syscall_handler_with_frame(struct trap_frame *tf,
                                     uint64_t syscall_number, 
                                     uint64_t argument0, uint64_t argument1, uint64_t argument2,
                                     uint64_t argument3, uint64_t argument4, uint64_t argument5) {
-    // For fork, we need to pass the current trap frame
-    if (syscall_number == SYS_FORK) {
-        return sys_fork(tf);
-    }
-    
-    // For execve, we need to pass the trap frame to update sepc
-    if (syscall_number == SYS_EXECVE) {
-        return sys_execve_with_frame(tf, (const char *)argument0, (const char **)argument1, (const char **)argument2);
-    }
-    
-    // For all other syscalls, use the normal handler
-    return syscall_handler(syscall_number, argument0, argument1, argument2, 
-                          argument3, argument4, argument5);
+    return syscall_dispatch(tf, syscall_number, argument0, argument1, argument2,
+                            argument3, argument4, argument5);
 }
 
+/**
+ * syscall_handler - Dispatch a syscall without a trap frame
+ * 
+ * Syscalls flagged SYSCALL_NEEDS_FRAME fail with ENOSYS here.
+ */
 uint64_t syscall_handler(uint64_t syscall_number, 
                         uint64_t argument0, uint64_t argument1, uint64_t argument2,
                         uint64_t argument3, uint64_t argument4, uint64_t argument5) {
-    uint64_t return_value = SYSCALL_ERROR;
-    
-    (void)argument3;  // Suppress unused parameter warnings
-    (void)argument4;
-    (void)argument5;
-    
-    switch (syscall_number) {
-        case SYS_EXIT:
-            return_value = sys_exit((int)argument0);
-            break;
-        
-        case SYS_WAIT:  // waitpid
-            return_value = sys_waitpid((int)argument0, (int *)argument1, (int)argument2);
-            break;
-            
-        case SYS_WRITE:
-            return_value = sys_write((int)argument0, (const char *)argument1, (size_t)argument2);
-            break;
-            
-        case SYS_READ:
-            return_value = sys_read((int)argument0, (char *)argument1, (size_t)argument2);
-            break;
-            
-        case SYS_GETPID:
-            return_value = sys_getpid();
-            break;
-            
-        case SYS_SBRK:
-            return_value = sys_sbrk((int)argument0);
-            break;
-            
-        case SYS_SLEEP:
-            return_value = sys_sleep(argument0);
-            break;
-            
-        case SYS_YIELD:
-            return_value = sys_yield();
-            break;
-            
-        case SYS_GETPPID:
-            return_value = sys_getppid();
-            break;
-            
-        case SYS_KILL:
-            return_value = sys_kill((int)argument0, (int)argument1);
-            break;
-            
-        case SYS_GETTIME:
-            return_value = sys_gettime();
-            break;
-            
-        case SYS_OPEN:
-            return_value = sys_open((const char *)argument0, (int)argument1, (int)argument2);
-            break;
-            
-        case SYS_CLOSE:
-            return_value = sys_close((int)argument0);
-            break;
-            
-        case SYS_LSEEK:
-            return_value = sys_lseek((int)argument0, (int64_t)argument1, (int)argument2);
-            break;
-            
-        case SYS_STAT:
-            return_value = sys_stat((const char *)argument0, (void *)argument1);
-            break;
-            
-        case SYS_MKDIR:
-            return_value = sys_mkdir((const char *)argument0, (int)argument1);
-            break;
-            
-        case SYS_UNLINK:
-            return_value = sys_unlink((const char *)argument0);
-            break;
-            
-        case SYS_RMDIR:
-            return_value = sys_rmdir((const char *)argument0);
-            break;
-            
-        case SYS_EXECVE:
-            // Execve is handled in syscall_handler_with_frame
-            return_value = SYSCALL_ERROR;
-            break;
-            
-        case SYS_MMAP:
-            return_value = sys_mmap((void *)argument0, (size_t)argument1, (int)argument2, 
-                                   (int)argument3, (int)argument4, (uint64_t)argument5);
-            break;
-            
-        case SYS_MUNMAP:
-            return_value = sys_munmap((void *)argument0, (size_t)argument1);
-            break;
-            
-        case SYS_PIPE:
-            return_value = sys_pipe((int *)argument0);
-            break;
-            
-        case SYS_GETDENTS:
-            return_value = sys_getdents((int)argument0, (void *)argument1, (size_t)argument2);
-            break;
-            
-        case SYS_CHDIR:
-            return_value = sys_chdir((const char *)argument0);
-            break;
-            
-        case SYS_GETCWD:
-            return_value = sys_getcwd((char *)argument0, (size_t)argument1);
-            break;
-            
-        case SYS_SETSID:
-            return_value = sys_setsid();
-            break;
-            
-        case SYS_GETTTY:
-            return_value = sys_gettty();
-            break;
-            
-        case SYS_SETTTY:
-            return_value = sys_settty((int)argument0);
-            break;
-            
-        case SYS_GETPROCS:
-            return_value = sys_getprocs((procinfo_t *)argument0, (size_t)argument1);
-            break;
-            
-        case SYS_UNAME:
-            return_value = sys_uname((utsname_t *)argument0);
-            break;
-            
-        case SYS_DUP2:
-            return_value = sys_dup2((int)argument0, (int)argument1);
-            break;
-            
-        case SYS_SETFGPID: {
-            /* Set foreground process for current terminal */
-            extern void vterm_set_active_fg_pid(int pid);
-            int pid = (int)argument0;
-            vterm_set_active_fg_pid(pid);
-            return_value = 0;
-            break;
-        }
-        
-        case SYS_GETUID:
-            return_value = sys_getuid();
-            break;
-            
-        case SYS_GETGID:
-            return_value = sys_getgid();
-            break;
-            
-        case SYS_GETEUID:
-            return_value = sys_geteuid();
-            break;
-            
-        case SYS_GETEGID:
-            return_value = sys_getegid();
-            break;
-            
-        case SYS_CHMOD:
-            return_value = sys_chmod((const char *)argument0, (uint32_t)argument1);
-            break;
-            
-        case SYS_CHOWN:
-            return_value = sys_chown((const char *)argument0, (uint16_t)argument1, (uint16_t)argument2);
-            break;
-            
-        case SYS_SETPGID:
-            return_value = sys_setpgid((int)argument0, (int)argument1);
-            break;
-            
-        case SYS_GETPGID:
-            return_value = sys_getpgid((int)argument0);
-            break;
-            
-        case SYS_GETSID:
-            return_value = sys_getsid((int)argument0);
-            break;
-            
-        case SYS_MUTEX_CREATE:
-            return_value = sys_mutex_create();
-            break;
-            
-        case SYS_MUTEX_LOCK:
-            return_value = sys_mutex_lock((int)argument0);
-            break;
-            
-        case SYS_MUTEX_TRYLOCK:
-            return_value = sys_mutex_trylock((int)argument0);
-            break;
-            
-        case SYS_MUTEX_UNLOCK:
-            return_value = sys_mutex_unlock((int)argument0);
-            break;
-            
-        case SYS_MUTEX_DESTROY:
-            return_value = sys_mutex_destroy((int)argument0);
-            break;
-            
-        case SYS_COND_CREATE:
-            return_value = sys_cond_create();
-            break;
-            
-        case SYS_COND_WAIT:
-            return_value = sys_cond_wait((int)argument0, (int)argument1);
-            break;
-            
-        case SYS_COND_SIGNAL:
-            return_value = sys_cond_signal((int)argument0);
-            break;
-            
-        case SYS_COND_BROADCAST:
-            return_value = sys_cond_broadcast((int)argument0);
-            break;
-            
-        case SYS_COND_DESTROY:
-            return_value = sys_cond_destroy((int)argument0);
-            break;
-            
-        case SYS_RWLOCK_CREATE:
-            return_value = sys_rwlock_create();
-            break;
-            
-        case SYS_RWLOCK_READ_LOCK:
-            return_value = sys_rwlock_read_lock((int)argument0);
-            break;
-            
-        case SYS_RWLOCK_READ_UNLOCK:
-            return_value = sys_rwlock_read_unlock((int)argument0);
-            break;
-            
-        case SYS_RWLOCK_WRITE_LOCK:
-            return_value = sys_rwlock_write_lock((int)argument0);
-            break;
-            
-        case SYS_RWLOCK_WRITE_UNLOCK:
-            return_value = sys_rwlock_write_unlock((int)argument0);
-            break;
-            
-        case SYS_RWLOCK_DESTROY:
-            return_value = sys_rwlock_destroy((int)argument0);
-            break;
-            
-        case SYS_FORK:
-            // Fork is handled in syscall_handler_with_frame
-            // This should not be reached
-            hal_uart_puts("[WARN] SYS_FORK called from old syscall_handler\n");
-            return_value = SYSCALL_ERROR;
-            break;
-            break;
-            
-        case SYS_EXEC:
-            return_value = SYSCALL_ERROR;
-            break;
-            
-        case SYS_POWEROFF: {
-            /* Power off the system */
-            hal_uart_puts("\n=====================================\n");
-            hal_uart_puts("  System Poweroff Requested\n");
-            hal_uart_puts("=====================================\n");
-            
-            clear_errno();  // Clear errno before non-returning operation
-            sbi_shutdown();
-            
-            /* Should not reach here */
-            return_value = 0;
-            break;
-        }
-        
-        case SYS_REBOOT: {
-            /* Reboot the system */
-            hal_uart_puts("\n=====================================\n");
-            hal_uart_puts("  System Reboot Requested\n");
-            hal_uart_puts("=====================================\n");
-            
-            clear_errno();  // Clear errno before non-returning operation
-            sbi_reboot();
-            
-            /* Should not reach here */
-            return_value = 0;
-            break;
-        }
-            
-        default:
-            hal_uart_puts("[SYSCALL] Invalid syscall number\n");
-            set_errno(THUNDEROS_ENOSYS);
-            return_value = SYSCALL_ERROR;
-            break;
-    }
-    
-    return return_value;
+    return syscall_dispatch(NULL, syscall_number, argument0, argument1, argument2,
+                            argument3, argument4, argument5);
 }
@@ -21,10 +21,9 @@ void udelay(uint64_t us) {
     uint64_t start = ktime_read();
     uint64_t target = start + ticks;
     
-    // Wait until we reach the target time
+    // Wait until we reach the target time. Spin rather than wfi: with
+    // the tick stopped there may be no interrupt to end the wait.
     while (ktime_read() < target) {
-        // Use WFI to reduce power consumption while waiting
-        __asm__ volatile("wfi");
     }
 }
 
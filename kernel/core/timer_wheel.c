@@ -0,0 +1,202 @@
+/*
+ * Timer Wheel Implementation
+ *
+ * Level 0 has one slot per tick for the next 64 ticks; each level above
+ * covers 64 times the span of the one below. A timer is filed in the
+ * lowest level whose span contains its delay. Whenever level 0 wraps,
+ * the next slot of level 1 is moved down and re-filed (and level 2 when
+ * level 1 wraps, and so on), so every timer reaches level 0 by the tick
+ * it is due.
+ */
+
+#include "kernel/timer_wheel.h"
+#include "arch/interrupt.h"
+#include <stddef.h>
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SIZE - 1)
+
+static ktimer_t *wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+
+// Next tick to process; every slot before it has been run
+static uint64_t wheel_clock = 0;
+
+/**
+ * Push a timer onto a list (interrupts must be disabled)
+ */
+static void wheel_link(ktimer_t **head, ktimer_t *timer) {
+    timer->next = *head;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    *head = timer;
+}
+
+/**
+ * Take a timer off whatever list it is on (interrupts must be disabled)
+ */
+static void wheel_unlink(ktimer_t *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/**
+ * File a timer in the slot matching its delay (interrupts must be disabled)
+ */
+static void wheel_insert(ktimer_t *timer) {
+    uint64_t expires = timer->expires;
+    if (expires < wheel_clock) {
+        expires = wheel_clock;
+    }
+
+    uint64_t delta = expires - wheel_clock;
+    if (delta > TIMER_WHEEL_MAX_DELTA) {
+        // Park it as far out as the wheel reaches; re-filed on cascade
+        expires = wheel_clock + TIMER_WHEEL_MAX_DELTA;
+        delta = TIMER_WHEEL_MAX_DELTA;
+    }
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+
+    uint32_t slot = (expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    wheel_link(&wheel[level][slot], timer);
+}
+
+/**
+ * Move the current slot of each wrapped level down (interrupts disabled)
+ */
+static void wheel_cascade(void) {
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        uint32_t slot = (wheel_clock >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+
+        ktimer_t *timer = wheel[level][slot];
+        wheel[level][slot] = NULL;
+        while (timer) {
+            ktimer_t *next = timer->next;
+            wheel_insert(timer);
+            timer = next;
+        }
+
+        // Only a level that wrapped as well pulls from the one above it
+        if (slot != 0) {
+            break;
+        }
+    }
+}
+
+/**
+ * Initialise a timer
+ */
+void ktimer_setup(ktimer_t *timer, ktimer_fn_t fn, void *data) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->fn = fn;
+    timer->data = data;
+}
+
+/**
+ * Arm or re-arm a timer
+ */
+void ktimer_add(ktimer_t *timer, uint64_t expires) {
+    int irq_state = interrupt_save_disable();
+
+    if (timer->pprev) {
+        wheel_unlink(timer);
+    }
+    timer->expires = expires;
+    wheel_insert(timer);
+
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Disarm a timer
+ */
+int ktimer_cancel(ktimer_t *timer) {
+    int irq_state = interrupt_save_disable();
+
+    int was_pending = timer->pprev != NULL;
+    if (was_pending) {
+        wheel_unlink(timer);
+    }
+
+    interrupt_restore(irq_state);
+    return was_pending;
+}
+
+/**
+ * Get the first tick at which the wheel has work to do
+ */
+uint64_t timer_wheel_next_expiry(void) {
+    int irq_state = interrupt_save_disable();
+    uint64_t next = UINT64_MAX;
+
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        int shift = TIMER_WHEEL_BITS * level;
+        uint32_t pos = (wheel_clock >> shift) & TIMER_WHEEL_MASK;
+
+        for (uint32_t k = 0; k < TIMER_WHEEL_SIZE; k++) {
+            uint32_t slot = (pos + k) & TIMER_WHEEL_MASK;
+            if (!wheel[level][slot]) {
+                continue;
+            }
+
+            // Slots are visited on their boundary; an upper slot at pos was
+            // already cascaded unless the clock sits exactly on it
+            uint64_t when;
+            if ((wheel_clock & ((1ULL << shift) - 1)) == 0) {
+                when = wheel_clock + ((uint64_t)k << shift);
+            } else {
+                uint64_t turns = k ? k : TIMER_WHEEL_SIZE;
+                when = ((wheel_clock >> shift) + turns) << shift;
+            }
+            if (when < next) {
+                next = when;
+            }
+            break;
+        }
+    }
+
+    interrupt_restore(irq_state);
+    return next;
+}
+
+/**
+ * Run every timer due at or before now
+ */
+void timer_wheel_run(uint64_t now) {
+    int irq_state = interrupt_save_disable();
+
+    while (wheel_clock <= now) {
+        uint32_t slot = wheel_clock & TIMER_WHEEL_MASK;
+        if (slot == 0) {
+            wheel_cascade();
+        }
+
+        // Detach the slot first: callbacks may re-arm into the next tick
+        // or cancel timers still waiting on this list
+        ktimer_t *expired = wheel[0][slot];
+        wheel[0][slot] = NULL;
+        if (expired) {
+            expired->pprev = &expired;
+        }
+        wheel_clock++;
+
+        while (expired) {
+            ktimer_t *timer = expired;
+            wheel_unlink(timer);
+            timer->fn(timer->data);
+        }
+    }
+
+    interrupt_restore(irq_state);
+}
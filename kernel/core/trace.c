@@ -0,0 +1,138 @@
+/**
+ * @file trace.c
+ * @brief Static tracepoints and per-CPU trace rings
+ *
+ * The rings are pcpu_ring.h's: each CPU writes its own with interrupts
+ * off, and readers (/dev/trace, under the big kernel lock) only move
+ * their heads.
+ */
+
+#include "kernel/trace.h"
+#include "kernel/pcpu_ring.h"
+#include "kernel/smp.h"
+#include "kernel/config.h"
+#include "kernel/errno.h"
+#include "kernel/kstring.h"
+#include "kernel/time.h"
+#include "kernel/uaccess.h"
+#include "fs/devfs.h"
+#include "arch/interrupt.h"
+#include <stddef.h>
+
+volatile uint32_t trace_events_enabled = 0;
+
+static pcpu_rings_t trace_rings = PCPU_RINGS_INIT(TRACE_RING_RECORDS, trace_record_t);
+
+void trace_record(uint32_t event, uint64_t arg0, uint64_t arg1) {
+    int irq_state = interrupt_save_disable();
+    struct cpu *cpu = cpu_this();
+    trace_record_t *rec = pcpu_ring_reserve(&trace_rings, cpu->id);
+
+    if (rec) {
+        rec->timestamp = ktime_read();
+        rec->event = (uint16_t)event;
+        rec->cpu = (uint16_t)cpu->id;
+        rec->pid = cpu->current ? (uint32_t)cpu->current->pid : TRACE_PID_IDLE;
+        rec->arg0 = arg0;
+        rec->arg1 = arg1;
+        pcpu_ring_commit(&trace_rings, cpu->id);
+    }
+    interrupt_restore(irq_state);
+}
+
+void trace_set_events(uint32_t mask) {
+    trace_events_enabled = mask & TRACE_EVENTS_ALL;
+}
+
+void trace_get_stats(trace_stats_t *stats) {
+    pcpu_ring_counts_t counts;
+    pcpu_rings_get_counts(&trace_rings, &counts);
+    kmemset(stats, 0, sizeof(*stats));
+    stats->recorded = counts.written;
+    stats->lost = counts.lost;
+    stats->buffered = counts.buffered;
+    stats->events = trace_events_enabled;
+    stats->ring_records = TRACE_RING_RECORDS;
+}
+
+uint32_t trace_drain(trace_record_t *buf, uint32_t max) {
+    return pcpu_rings_drain(&trace_rings, buf, max);
+}
+
+void trace_reset(void) {
+    pcpu_rings_reset(&trace_rings);
+}
+
+// ========================================
+// /dev/trace
+// ========================================
+
+static int trace_dev_read(vfs_node_t *node, uint64_t offset, void *buffer, uint32_t size);
+static int trace_dev_ioctl(vfs_node_t *node, uint32_t request, uint64_t arg);
+
+static vfs_ops_t trace_dev_ops = {
+    .read = trace_dev_read,
+    .write = NULL,
+    .ioctl = trace_dev_ioctl,
+};
+
+static int trace_dev_read(vfs_node_t *node, uint64_t offset, void *buffer, uint32_t size) {
+    (void)node;
+    (void)offset;
+    // errno set by pcpu_rings_read
+    return pcpu_rings_read(&trace_rings, buffer, size);
+}
+
+static int trace_dev_ioctl(vfs_node_t *node, uint32_t request, uint64_t arg) {
+    (void)node;
+
+    switch (request) {
+        case TRACEIO_SET_EVENTS:
+            trace_set_events((uint32_t)arg);
+            clear_errno();
+            return 0;
+
+        case TRACEIO_GET_EVENTS: {
+            uint32_t mask = trace_events_enabled;
+            if (copy_to_user((void *)arg, &mask, sizeof(mask)) != 0) {
+                // errno already set by copy_to_user
+                return -1;
+            }
+            clear_errno();
+            return 0;
+        }
+
+        case TRACEIO_GET_STATS: {
+            trace_stats_t stats;
+            trace_get_stats(&stats);
+            if (copy_to_user((void *)arg, &stats, sizeof(stats)) != 0) {
+                // errno already set by copy_to_user
+                return -1;
+            }
+            clear_errno();
+            return 0;
+        }
+
+        case TRACEIO_RESET:
+            trace_reset();
+            clear_errno();
+            return 0;
+
+        default:
+            RETURN_ERRNO(THUNDEROS_ENOTTY);
+    }
+}
+
+int trace_init(void) {
+    if (pcpu_rings_alloc(&trace_rings) != 0) {
+        // errno already set by pcpu_rings_alloc
+        return -1;
+    }
+
+    if (!devfs_register("trace", 0600, &trace_dev_ops, 0, NULL)) {
+        // errno already set by devfs_register
+        return -1;
+    }
+    clear_errno();
+    return 0;
+}
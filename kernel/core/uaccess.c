@@ -0,0 +1,92 @@
+/**
+ * @file uaccess.c
+ * @brief Copying data between the kernel and user memory
+ *
+ * The range checks here are all that runs before a copy; the VMAs are
+ * consulted only if the copy faults, by the page fault handler, and an
+ * unresolvable fault resumes at the fixup recorded in __ex_table.
+ */
+
+#include "kernel/uaccess.h"
+#include "kernel/errno.h"
+#include "mm/paging.h"
+
+/* Copy loops (kernel/arch/riscv64/uaccess.S) */
+extern size_t __copy_user(void *dst, const void *src, size_t n);
+extern long __strncpy_user(char *dst, const char *src, size_t n);
+
+/* Bounds of __ex_table, from the linker script */
+extern const struct exception_table_entry __start___ex_table[];
+extern const struct exception_table_entry __stop___ex_table[];
+
+/**
+ * @brief Check that a range lies entirely in user space
+ */
+static int user_range_ok(const void *ptr, size_t n) {
+    uintptr_t start = (uintptr_t)ptr;
+    return start + n >= start && start + n <= USER_VIRT_END;
+}
+
+/**
+ * @brief Copy from user memory into the kernel
+ */
+int copy_from_user(void *dst, const void *src, size_t n) {
+    if (!user_range_ok(src, n) || __copy_user(dst, src, n) != 0) {
+        RETURN_ERRNO(THUNDEROS_EFAULT);
+    }
+    return 0;
+}
+
+/**
+ * @brief Copy from the kernel into user memory
+ */
+int copy_to_user(void *dst, const void *src, size_t n) {
+    if (!user_range_ok(dst, n) || __copy_user(dst, src, n) != 0) {
+        RETURN_ERRNO(THUNDEROS_EFAULT);
+    }
+    return 0;
+}
+
+/**
+ * @brief Copy a NUL-terminated string from user memory
+ */
+long strncpy_from_user(char *dst, const char *src, size_t n) {
+    if (n == 0) {
+        RETURN_ERRNO(THUNDEROS_ERANGE);
+    }
+
+    // Never read past the end of user space, even before a NUL
+    uintptr_t start = (uintptr_t)src;
+    if (start >= USER_VIRT_END) {
+        RETURN_ERRNO(THUNDEROS_EFAULT);
+    }
+    size_t limit = n;
+    if (limit > USER_VIRT_END - start) {
+        limit = USER_VIRT_END - start;
+    }
+
+    long len = __strncpy_user(dst, src, limit);
+    if (len < 0) {
+        RETURN_ERRNO(THUNDEROS_EFAULT);
+    }
+    if ((size_t)len == limit) {
+        // No NUL: either it does not fit, or it ran to the end of user space
+        RETURN_ERRNO(limit == n ? THUNDEROS_ERANGE : THUNDEROS_EFAULT);
+    }
+    return len;
+}
+
+/**
+ * @brief Find the fixup for a faulting kernel instruction
+ *
+ * The table is short (one entry per access instruction in uaccess.S),
+ * so a linear scan is enough.
+ */
+uintptr_t uaccess_fixup(uintptr_t pc) {
+    for (const struct exception_table_entry *e = __start___ex_table; e < __stop___ex_table; e++) {
+        if (e->insn == pc) {
+            return e->fixup;
+        }
+    }
+    return 0;
+}
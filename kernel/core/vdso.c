@@ -0,0 +1,203 @@
+/**
+ * @file vdso.c
+ * @brief vDSO pages and the timebase they export
+ *
+ * Both pages come from the PMM, so user mappings can hold references to
+ * them like any other user page; vdso_init() keeps one of its own, which
+ * pins them for good, as with pmm_zero_page(). The code is copied in
+ * from kernel/arch/riscv64/vdso.S.
+ */
+
+#include "kernel/vdso.h"
+#include "kernel/errno.h"
+#include "kernel/kstring.h"
+#include "kernel/constants.h"
+#include "kernel/spinlock.h"
+#include "mm/pmm.h"
+#include "mm/page.h"
+#include <stddef.h>
+
+// The user-space code, position independent (kernel/arch/riscv64/vdso.S)
+extern const char __vdso_start[];
+extern const char __vdso_clock_gettime[];
+extern const char __vdso_end[];
+
+// Goldfish RTC: nanoseconds since the epoch; reading the low word latches the high
+#define RTC_TIME_LOW            0x00
+#define RTC_TIME_HIGH           0x04
+
+#define NSEC_PER_SEC            1000000000UL
+
+// Multipliers are kept under 2^24, so a delta of up to 2^40 cycles
+// (about 30 hours at 10 MHz) fits in 64 bits between rebases
+#define VDSO_MULT_LIMIT         (1UL << 24)
+
+// CLOCK_REALTIME is checked against the RTC once a second, and stepped
+// onto it if they are further apart than this
+#define VDSO_RTC_CHECK_NS       NSEC_PER_SEC
+#define VDSO_RTC_STEP_NS        (NSEC_PER_SEC / 10)
+
+// vdso.S reads these by offset
+_Static_assert(offsetof(vdso_data_t, seq) == 8, "vdso.S VD_SEQ");
+_Static_assert(offsetof(vdso_data_t, shift) == 12, "vdso.S VD_SHIFT");
+_Static_assert(offsetof(vdso_data_t, mult) == 16, "vdso.S VD_MULT");
+_Static_assert(offsetof(vdso_data_t, cycle_last) == 24, "vdso.S VD_CYCLE_LAST");
+_Static_assert(offsetof(vdso_data_t, mono_base_ns) == 32, "vdso.S VD_MONO_BASE");
+_Static_assert(offsetof(vdso_data_t, realtime_offset_ns) == 40, "vdso.S VD_REALTIME");
+
+static vdso_data_t *vdso_data = NULL;
+static uintptr_t vdso_text_page = 0;
+static spinlock_t vdso_lock = SPINLOCK_INIT;   // Rebasing harts
+static uint64_t rtc_checked_ns = 0;             // CLOCK_MONOTONIC at the last check
+
+/**
+ * Monotonic nanoseconds at a cycle count, from a timebase
+ */
+static uint64_t vdso_cycles_to_ns(const vdso_data_t *vd, uint64_t cycles) {
+    uint64_t delta = cycles > vd->cycle_last ? cycles - vd->cycle_last : 0;
+    return vd->mono_base_ns + ((delta * vd->mult) >> vd->shift);
+}
+
+static uint64_t vdso_read_rtc_ns(void) {
+    volatile uint32_t *rtc = (volatile uint32_t *)QEMU_RTC_BASE;
+    uint64_t low = rtc[RTC_TIME_LOW / 4];
+    uint64_t high = rtc[RTC_TIME_HIGH / 4];
+    return (high << 32) | low;
+}
+
+/**
+ * Realtime offset that puts CLOCK_REALTIME back on the RTC, if it left it
+ *
+ * The clocks only part when time passed that rdtime did not count: the
+ * VM was stopped, or resumed from a snapshot taken earlier (make resume),
+ * and QEMU brought the RTC up to the host's time.
+ */
+static uint64_t vdso_rtc_offset(uint64_t now_ns, uint64_t offset) {
+    uint64_t rtc_ns = vdso_read_rtc_ns();
+    uint64_t real_ns = now_ns + offset;
+    uint64_t apart = rtc_ns > real_ns ? rtc_ns - real_ns : real_ns - rtc_ns;
+    if (apart <= VDSO_RTC_STEP_NS) {
+        return offset;
+    }
+    return rtc_ns > now_ns ? rtc_ns - now_ns : 0;
+}
+
+int vdso_init(void) {
+    size_t text_size = (size_t)(__vdso_end - __vdso_start);
+    if (text_size > PAGE_SIZE) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    uintptr_t data_page = pmm_alloc_zeroed_page();
+    uintptr_t text_page = pmm_alloc_zeroed_page();
+    if (!data_page || !text_page) {
+        if (data_page) {
+            pmm_free_page(data_page);
+        }
+        if (text_page) {
+            pmm_free_page(text_page);
+        }
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+
+    kmemcpy((void *)text_page, __vdso_start, text_size);
+    __asm__ volatile("fence.i" ::: "memory");
+
+    // Largest shift whose multiplier stays under the limit
+    vdso_data_t *vd = (vdso_data_t *)data_page;
+    uint32_t shift = 32;
+    while (shift > 0 && (NSEC_PER_SEC << shift) / TIMER_FREQ_HZ >= VDSO_MULT_LIMIT) {
+        shift--;
+    }
+    vd->shift = shift;
+    vd->mult = (NSEC_PER_SEC << shift) / TIMER_FREQ_HZ;
+    vd->cycle_last = 0;
+    vd->mono_base_ns = 0;
+    vd->clock_gettime = VDSO_TEXT_ADDR + (uint64_t)(__vdso_clock_gettime - __vdso_start);
+
+    uint64_t now_ns = vdso_cycles_to_ns(vd, ktime_read());
+    uint64_t rtc_ns = vdso_read_rtc_ns();
+    vd->realtime_offset_ns = rtc_ns > now_ns ? rtc_ns - now_ns : 0;
+    rtc_checked_ns = now_ns;
+
+    seqcount_init(&vd->seq);
+    vd->version = VDSO_VERSION;
+    vd->magic = VDSO_MAGIC;
+
+    vdso_text_page = text_page;
+    vdso_data = vd;
+    clear_errno();
+    return 0;
+}
+
+int vdso_map(page_table_t *page_table) {
+    // Without a vDSO the data page reads as zeros, so user space sees no
+    // magic and falls back to SYS_CLOCK_GETTIME
+    uintptr_t data_page = vdso_data ? (uintptr_t)vdso_data : pmm_zero_page();
+    if (!data_page) {
+        return 0;
+    }
+    if (map_page(page_table, VDSO_DATA_ADDR, data_page, PTE_USER_RO) != 0) {
+        /* errno already set by map_page */
+        return -1;
+    }
+    get_page(data_page);
+    if (!vdso_data) {
+        return 0;
+    }
+
+    if (map_page(page_table, VDSO_TEXT_ADDR, vdso_text_page, PTE_V | PTE_R | PTE_X | PTE_U) != 0) {
+        /* errno already set by map_page; freeing the table drops the data page */
+        return -1;
+    }
+    get_page(vdso_text_page);
+    return 0;
+}
+
+void vdso_update(void) {
+    vdso_data_t *vd = vdso_data;
+    if (!vd) {
+        return;
+    }
+
+    int irq_state = spin_lock_irqsave(&vdso_lock);
+    uint64_t now = ktime_read();
+    uint64_t now_ns = vdso_cycles_to_ns(vd, now);
+    uint64_t offset = vd->realtime_offset_ns;
+    if (now_ns - rtc_checked_ns >= VDSO_RTC_CHECK_NS) {
+        rtc_checked_ns = now_ns;
+        offset = vdso_rtc_offset(now_ns, offset);
+    }
+    write_seqcount_begin(&vd->seq);
+    vd->mono_base_ns = now_ns;
+    vd->cycle_last = now;
+    vd->realtime_offset_ns = offset;
+    write_seqcount_end(&vd->seq);
+    spin_unlock_irqrestore(&vdso_lock, irq_state);
+}
+
+int vdso_clock_gettime(int clock, struct timespec *ts) {
+    if (clock != CLOCK_REALTIME && clock != CLOCK_MONOTONIC) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    uint64_t ns;
+    const vdso_data_t *vd = vdso_data;
+    if (vd) {
+        uint32_t seq;
+        do {
+            seq = read_seqcount_begin(&vd->seq);
+            ns = vdso_cycles_to_ns(vd, ktime_read());
+            if (clock == CLOCK_REALTIME) {
+                ns += vd->realtime_offset_ns;
+            }
+        } while (read_seqcount_retry(&vd->seq, seq));
+    } else {
+        ns = ktime_read() * (NSEC_PER_SEC / TIMER_FREQ_HZ);
+    }
+
+    ts->tv_sec = (int64_t)(ns / NSEC_PER_SEC);
+    ts->tv_nsec = (int64_t)(ns % NSEC_PER_SEC);
+    clear_errno();
+    return 0;
+}
@@ -0,0 +1,312 @@
+/*
+ * VMA Tree Implementation
+ *
+ * AVL tree ordered by (start, node address), augmented with max_gap: the
+ * largest gap between a VMA and its list predecessor anywhere in the
+ * subtree. A node's gap depends on its predecessor, so the sorted list is
+ * always updated before the tree; the only node whose gap changes on an
+ * insert or remove is the successor, which lies on the rebalanced path.
+ */
+
+#include "kernel/vma.h"
+
+static inline int vma_height(vm_area_t *node) {
+    return node ? node->height : 0;
+}
+
+static inline uint64_t vma_max_gap(vm_area_t *node) {
+    return node ? node->max_gap : 0;
+}
+
+/**
+ * Unmapped space between a VMA and the one before it
+ */
+static uint64_t vma_gap_before(vm_area_t *node) {
+    uint64_t prev_end = node->prev ? node->prev->end : 0;
+    return node->start > prev_end ? node->start - prev_end : 0;
+}
+
+/**
+ * Total order on VMAs: by start address, ties broken by node address
+ */
+static int vma_less(vm_area_t *a, vm_area_t *b) {
+    if (a->start != b->start) {
+        return a->start < b->start;
+    }
+    return (uintptr_t)a < (uintptr_t)b;
+}
+
+/**
+ * Recompute a node's height and gap from its children
+ */
+static void vma_update(vm_area_t *node) {
+    int hl = vma_height(node->left);
+    int hr = vma_height(node->right);
+    node->height = (hl > hr ? hl : hr) + 1;
+
+    uint64_t gap = vma_gap_before(node);
+    if (vma_max_gap(node->left) > gap) {
+        gap = vma_max_gap(node->left);
+    }
+    if (vma_max_gap(node->right) > gap) {
+        gap = vma_max_gap(node->right);
+    }
+    node->max_gap = gap;
+}
+
+static vm_area_t *vma_rotate_right(vm_area_t *node) {
+    vm_area_t *pivot = node->left;
+    node->left = pivot->right;
+    pivot->right = node;
+    vma_update(node);
+    vma_update(pivot);
+    return pivot;
+}
+
+static vm_area_t *vma_rotate_left(vm_area_t *node) {
+    vm_area_t *pivot = node->right;
+    node->right = pivot->left;
+    pivot->left = node;
+    vma_update(node);
+    vma_update(pivot);
+    return pivot;
+}
+
+/**
+ * Restore the AVL invariant at node after one of its subtrees changed
+ */
+static vm_area_t *vma_balance(vm_area_t *node) {
+    vma_update(node);
+
+    int balance = vma_height(node->left) - vma_height(node->right);
+    if (balance > 1) {
+        if (vma_height(node->left->left) < vma_height(node->left->right)) {
+            node->left = vma_rotate_left(node->left);
+        }
+        return vma_rotate_right(node);
+    }
+    if (balance < -1) {
+        if (vma_height(node->right->right) < vma_height(node->right->left)) {
+            node->right = vma_rotate_right(node->right);
+        }
+        return vma_rotate_left(node);
+    }
+    return node;
+}
+
+static vm_area_t *vma_insert_node(vm_area_t *root, vm_area_t *vma) {
+    if (!root) {
+        return vma;
+    }
+    if (vma_less(vma, root)) {
+        root->left = vma_insert_node(root->left, vma);
+    } else {
+        root->right = vma_insert_node(root->right, vma);
+    }
+    return vma_balance(root);
+}
+
+/**
+ * Detach the leftmost node of a subtree
+ *
+ * @param min Output: the detached node
+ * @return New subtree root
+ */
+static vm_area_t *vma_remove_min(vm_area_t *root, vm_area_t **min) {
+    if (!root->left) {
+        *min = root;
+        return root->right;
+    }
+    root->left = vma_remove_min(root->left, min);
+    return vma_balance(root);
+}
+
+static vm_area_t *vma_remove_node(vm_area_t *root, vm_area_t *vma) {
+    if (!root) {
+        return NULL;
+    }
+
+    if (root == vma) {
+        if (!root->right) {
+            return root->left;
+        }
+
+        // Replace with the in-order successor, even when there is no left
+        // child: its gap changed, so its path must be rebalanced anyway
+        vm_area_t *succ;
+        vm_area_t *right = vma_remove_min(root->right, &succ);
+        succ->left = root->left;
+        succ->right = right;
+        return vma_balance(succ);
+    }
+
+    if (vma_less(vma, root)) {
+        root->left = vma_remove_node(root->left, vma);
+    } else {
+        root->right = vma_remove_node(root->right, vma);
+    }
+    return vma_balance(root);
+}
+
+/**
+ * Recompute the augmented data on the path from root to target
+ */
+static void vma_refresh_path(vm_area_t *root, vm_area_t *target) {
+    if (!root) {
+        return;
+    }
+    if (root != target) {
+        vma_refresh_path(vma_less(target, root) ? root->left : root->right, target);
+    }
+    vma_update(root);
+}
+
+/**
+ * Last VMA ordered before vma in the tree, or NULL
+ */
+static vm_area_t *vma_predecessor(vm_area_t *root, vm_area_t *vma) {
+    vm_area_t *pred = NULL;
+    while (root) {
+        if (vma_less(root, vma)) {
+            pred = root;
+            root = root->right;
+        } else {
+            root = root->left;
+        }
+    }
+    return pred;
+}
+
+/**
+ * Link a VMA into list and tree
+ */
+void vma_tree_insert(struct process *proc, vm_area_t *vma) {
+    vm_area_t *pred = vma_predecessor(proc->vma_root, vma);
+
+    // Sorted list first: gaps are computed from list neighbours
+    vma->prev = pred;
+    vma->next = pred ? pred->next : proc->vm_areas;
+    if (vma->next) {
+        vma->next->prev = vma;
+    }
+    if (pred) {
+        pred->next = vma;
+    } else {
+        proc->vm_areas = vma;
+    }
+
+    vma->left = NULL;
+    vma->right = NULL;
+    vma->height = 1;
+    vma->max_gap = vma_gap_before(vma);
+    proc->vma_root = vma_insert_node(proc->vma_root, vma);
+}
+
+/**
+ * Unlink a VMA from list and tree
+ */
+void vma_tree_remove(struct process *proc, vm_area_t *vma) {
+    if (vma->prev) {
+        vma->prev->next = vma->next;
+    } else {
+        proc->vm_areas = vma->next;
+    }
+    if (vma->next) {
+        vma->next->prev = vma->prev;
+    }
+
+    proc->vma_root = vma_remove_node(proc->vma_root, vma);
+
+    vma->next = NULL;
+    vma->prev = NULL;
+    vma->left = NULL;
+    vma->right = NULL;
+}
+
+/**
+ * Find the VMA containing addr
+ */
+vm_area_t *vma_tree_find(struct process *proc, uint64_t addr) {
+    vm_area_t *node = proc->vma_root;
+    vm_area_t *best = NULL;
+
+    // Last VMA starting at or below addr
+    while (node) {
+        if (node->start <= addr) {
+            best = node;
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+
+    if (best && addr < best->end) {
+        return best;
+    }
+    return NULL;
+}
+
+/**
+ * Resize a VMA
+ */
+void vma_tree_set_end(struct process *proc, vm_area_t *vma, uint64_t end) {
+    vma->end = end;
+
+    // Only the successor's gap changed
+    if (vma->next) {
+        vma_refresh_path(proc->vma_root, vma->next);
+    }
+}
+
+/**
+ * First-fit search for a gap ending above floor
+ */
+static int vma_gap_search(vm_area_t *node, uint64_t floor, uint64_t length,
+                          uint64_t *result) {
+    if (!node || node->max_gap < length) {
+        return 0;
+    }
+
+    // Gaps in the left subtree all end below node->start
+    if (node->start > floor && vma_gap_search(node->left, floor, length, result)) {
+        return 1;
+    }
+
+    uint64_t lo = node->prev ? node->prev->end : 0;
+    if (lo < floor) {
+        lo = floor;
+    }
+    if (node->start > lo && node->start - lo >= length) {
+        *result = lo;
+        return 1;
+    }
+
+    return vma_gap_search(node->right, floor, length, result);
+}
+
+/**
+ * Find the lowest free range of a given length
+ */
+uint64_t vma_tree_find_gap(struct process *proc, uint64_t floor,
+                           uint64_t limit, uint64_t length) {
+    if (length == 0 || floor >= limit) {
+        return 0;
+    }
+
+    uint64_t result;
+    if (vma_gap_search(proc->vma_root, floor, length, &result)) {
+        return result + length <= limit ? result : 0;
+    }
+
+    // Space above the highest VMA
+    vm_area_t *last = proc->vma_root;
+    while (last && last->right) {
+        last = last->right;
+    }
+
+    uint64_t lo = last && last->end > floor ? last->end : floor;
+    if (lo + length <= limit && lo + length > lo) {
+        return lo;
+    }
+    return 0;
+}
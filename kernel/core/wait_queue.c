@@ -4,16 +4,78 @@
  *
  * Implements sleep/wakeup mechanism for processes waiting on events.
  * This is the foundation for blocking pipes, sockets, and other I/O.
+ *
+ * Each sleeper links an entry from its own kernel stack into the queue
+ * and points proc->wait_entry at it, so blocking never allocates and
+ * every removal is O(1). Wakers unlink the entry; a sleeper woken some
+ * other way (process_wakeup()) unlinks it itself before returning.
+ * Callback entries stay linked until their owner removes them.
  */
 
 #include "kernel/wait_queue.h"
 #include "kernel/process.h"
 #include "kernel/scheduler.h"
 #include "kernel/errno.h"
-#include "mm/kmalloc.h"
 #include "arch/interrupt.h"
 #include "hal/hal_uart.h"
 
+/**
+ * Unlink an entry from its queue (interrupts disabled)
+ */
+static void wait_queue_unlink(wait_queue_t *wq, wait_queue_entry_t *entry) {
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        wq->head = entry->next;
+    }
+    
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        wq->tail = entry->prev;
+    }
+    
+    wq->count--;
+    entry->wq = NULL;
+    if (entry->proc && entry->proc->wait_entry == entry) {
+        entry->proc->wait_entry = NULL;
+    }
+}
+
+/**
+ * Link an entry at the tail of a queue (interrupts disabled)
+ */
+static void wait_queue_link(wait_queue_t *wq, wait_queue_entry_t *entry) {
+    entry->wq = wq;
+    entry->prev = wq->tail;
+    entry->next = NULL;
+    
+    if (wq->tail) {
+        wq->tail->next = entry;
+    } else {
+        // Empty queue
+        wq->head = entry;
+    }
+    wq->tail = entry;
+    wq->count++;
+}
+
+/**
+ * Unlink an entry and make its process runnable (interrupts disabled)
+ */
+static int wait_queue_wake_entry(wait_queue_t *wq, wait_queue_entry_t *entry) {
+    struct process *proc = entry->proc;
+    
+    wait_queue_unlink(wq, entry);
+    
+    if (proc->state == PROC_SLEEPING) {
+        proc->state = PROC_READY;
+        scheduler_enqueue(proc);
+        return 1;
+    }
+    return 0;
+}
+
 /**
  * Initialize a wait queue
  */
@@ -40,30 +102,19 @@ void wait_queue_sleep(wait_queue_t *wq) {
         return;
     }
     
+    // Stays valid while we sleep: this frame is not left until unlinked
+    wait_queue_entry_t entry;
+    
     // Disable interrupts to ensure atomic operation
     int old_state = interrupt_save_disable();
     
-    // Allocate wait queue entry
-    wait_queue_entry_t *entry = (wait_queue_entry_t *)kmalloc(sizeof(wait_queue_entry_t));
-    if (!entry) {
-        // Failed to allocate - can't sleep, return immediately
-        interrupt_restore(old_state);
-        return;
-    }
-    
-    entry->proc = current;
-    entry->next = NULL;
+    entry.proc = current;
+    entry.func = NULL;
+    entry.private = NULL;
     
     // Add to tail of wait queue
-    if (wq->tail) {
-        wq->tail->next = entry;
-        wq->tail = entry;
-    } else {
-        // Empty queue
-        wq->head = entry;
-        wq->tail = entry;
-    }
-    wq->count++;
+    wait_queue_link(wq, &entry);
+    current->wait_entry = &entry;
     
     // Mark process as sleeping
     current->state = PROC_SLEEPING;
@@ -78,7 +129,50 @@ void wait_queue_sleep(wait_queue_t *wq) {
     // When we're woken up, schedule() will return here
     schedule();
     
-    // We've been woken up - the entry was freed by wake function
+    // Woken by a waker (entry already unlinked) or by process_wakeup()
+    old_state = interrupt_save_disable();
+    if (entry.wq) {
+        wait_queue_unlink(entry.wq, &entry);
+    }
+    interrupt_restore(old_state);
+}
+
+/**
+ * Sleep on a wait queue, coming back with interrupts as they were
+ */
+void wait_queue_sleep_irqoff(wait_queue_t *wq) {
+    int irq_state = interrupt_save_disable();
+    wait_queue_sleep(wq);
+    // Woken with interrupts on
+    interrupt_disable();
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Link a callback entry onto a wait queue
+ */
+void wait_queue_add(wait_queue_t *wq, wait_queue_entry_t *entry, wait_func_t func, void *private) {
+    if (!wq || !entry || !func) return;
+    
+    int old_state = interrupt_save_disable();
+    entry->proc = NULL;
+    entry->func = func;
+    entry->private = private;
+    wait_queue_link(wq, entry);
+    interrupt_restore(old_state);
+}
+
+/**
+ * Unlink a callback entry
+ */
+void wait_queue_del(wait_queue_entry_t *entry) {
+    if (!entry) return;
+    
+    int old_state = interrupt_save_disable();
+    if (entry->wq) {
+        wait_queue_unlink(entry->wq, entry);
+    }
+    interrupt_restore(old_state);
 }
 
 /**
@@ -94,26 +188,16 @@ int wait_queue_wake(wait_queue_t *wq) {
     
     wait_queue_entry_t *entry = wq->head;
     while (entry) {
+        // Sleepers are unlinked by the wakeup, so step first
         wait_queue_entry_t *next = entry->next;
-        
-        struct process *proc = entry->proc;
-        if (proc && proc->state == PROC_SLEEPING) {
-            // Wake the process
-            proc->state = PROC_READY;
-            scheduler_enqueue(proc);
-            woken++;
+        if (entry->func) {
+            woken += entry->func(entry);
+        } else {
+            woken += wait_queue_wake_entry(wq, entry);
         }
-        
-        // Free the entry
-        kfree(entry);
         entry = next;
     }
     
-    // Clear the queue
-    wq->head = NULL;
-    wq->tail = NULL;
-    wq->count = 0;
-    
     interrupt_restore(old_state);
     
     return woken;
@@ -128,33 +212,36 @@ int wait_queue_wake_one(wait_queue_t *wq) {
     // Disable interrupts for atomic operation
     int old_state = interrupt_save_disable();
     
-    // Get first entry
+    // Notify callbacks up to and including the first sleeper
+    int woke = 0;
     wait_queue_entry_t *entry = wq->head;
-    if (!entry) {
-        interrupt_restore(old_state);
-        return 0;
-    }
-    
-    // Remove from queue
-    wq->head = entry->next;
-    if (!wq->head) {
-        wq->tail = NULL;
-    }
-    wq->count--;
-    
-    // Wake the process
-    struct process *proc = entry->proc;
-    if (proc && proc->state == PROC_SLEEPING) {
-        proc->state = PROC_READY;
-        scheduler_enqueue(proc);
+    while (entry) {
+        wait_queue_entry_t *next = entry->next;
+        if (entry->func) {
+            entry->func(entry);
+        } else if (!woke) {
+            wait_queue_wake_entry(wq, entry);
+            woke = 1;
+        }
+        entry = next;
     }
     
-    // Free the entry
-    kfree(entry);
-    
     interrupt_restore(old_state);
     
-    return 1;
+    return woke;
+}
+
+/**
+ * Get the process that wait_queue_wake_one() would wake next
+ */
+struct process *wait_queue_peek(wait_queue_t *wq) {
+    if (!wq) return NULL;
+    for (wait_queue_entry_t *entry = wq->head; entry; entry = entry->next) {
+        if (!entry->func) {
+            return entry->proc;
+        }
+    }
+    return NULL;
 }
 
 /**
@@ -181,32 +268,14 @@ int wait_queue_remove(wait_queue_t *wq, struct process *proc) {
     
     int old_state = interrupt_save_disable();
     
-    wait_queue_entry_t *prev = NULL;
-    wait_queue_entry_t *entry = wq->head;
-    
-    while (entry) {
-        if (entry->proc == proc) {
-            // Found it - remove from queue
-            if (prev) {
-                prev->next = entry->next;
-            } else {
-                wq->head = entry->next;
-            }
-            
-            if (entry == wq->tail) {
-                wq->tail = prev;
-            }
-            
-            wq->count--;
-            kfree(entry);
-            
-            interrupt_restore(old_state);
-            return 1;
-        }
-        prev = entry;
-        entry = entry->next;
+    wait_queue_entry_t *entry = proc->wait_entry;
+    if (!entry || entry->wq != wq) {
+        interrupt_restore(old_state);
+        return 0;
     }
     
+    wait_queue_unlink(wq, entry);
+    
     interrupt_restore(old_state);
-    return 0;
+    return 1;
 }
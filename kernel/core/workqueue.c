@@ -0,0 +1,133 @@
+/**
+ * @file workqueue.c
+ * @brief Deferred work run by a kernel thread
+ *
+ * One FIFO of work items and one worker thread. The queue is touched
+ * from interrupt handlers, so it is guarded by disabling interrupts; the
+ * big kernel lock keeps other CPUs out, as for the wait queues.
+ */
+
+#include "kernel/workqueue.h"
+#include "kernel/process.h"
+#include "kernel/wait_queue.h"
+#include "kernel/smp.h"
+#include "kernel/errno.h"
+#include "arch/interrupt.h"
+#include <stddef.h>
+
+static work_t *queue_head = NULL;
+static work_t *queue_tail = NULL;
+
+// Items queued and items finished; flush_workqueue() waits for one to
+// catch up with the other
+static uint64_t queued_count = 0;
+static uint64_t done_count = 0;
+
+static struct process *worker = NULL;
+static wait_queue_t worker_wait = WAIT_QUEUE_INIT;
+static wait_queue_t flush_wait = WAIT_QUEUE_INIT;
+
+void work_init(work_t *work, work_fn_t fn) {
+    work->fn = fn;
+    work->next = NULL;
+    work->pending = 0;
+}
+
+/**
+ * Take the oldest item off the queue, sleeping while there is none
+ */
+static work_t *worker_next(void) {
+    int irq_state = interrupt_save_disable();
+
+    // Interrupts stay off from the check until we are on the wait queue,
+    // so a queue_work() in between cannot be missed
+    while (!queue_head) {
+        wait_queue_sleep(&worker_wait);
+        interrupt_disable();
+    }
+
+    work_t *work = queue_head;
+    queue_head = work->next;
+    if (!queue_head) {
+        queue_tail = NULL;
+    }
+    work->next = NULL;
+    work->pending = 0;  // May be queued again from here on, even by fn
+
+    interrupt_restore(irq_state);
+    return work;
+}
+
+/**
+ * Worker thread body
+ */
+static void worker_main(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        work_t *work = worker_next();
+        work->fn(work);
+
+        done_count++;
+        if (!wait_queue_empty(&flush_wait)) {
+            wait_queue_wake(&flush_wait);
+        }
+
+        // Let other CPUs into the kernel between items
+        bkl_relax();
+    }
+}
+
+int workqueue_init(void) {
+    struct process *proc = kthread_create("kworker", worker_main, NULL);
+    if (!proc) {
+        /* errno already set by kthread_create */
+        return -1;
+    }
+    worker = proc;
+    clear_errno();
+    return 0;
+}
+
+int workqueue_running(void) {
+    return worker != NULL;
+}
+
+int queue_work(work_t *work) {
+    if (!worker) {
+        // Too early for deferring: the caller gets the old, inline behaviour
+        work->fn(work);
+        return 1;
+    }
+
+    int irq_state = interrupt_save_disable();
+    if (work->pending) {
+        interrupt_restore(irq_state);
+        return 0;
+    }
+
+    work->pending = 1;
+    work->next = NULL;
+    if (queue_tail) {
+        queue_tail->next = work;
+    } else {
+        queue_head = work;
+    }
+    queue_tail = work;
+    queued_count++;
+
+    wait_queue_wake_one(&worker_wait);
+    interrupt_restore(irq_state);
+    return 1;
+}
+
+void flush_workqueue(void) {
+    if (!worker) {
+        return;
+    }
+
+    uint64_t target = queued_count;
+    while ((int64_t)(done_count - target) < 0) {
+        wait_queue_sleep(&flush_wait);
+    }
+}
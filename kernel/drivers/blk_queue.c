@@ -0,0 +1,469 @@
+/*
+ * Block I/O request queue
+ *
+ * Each direction keeps its queued I/Os on two doubly linked lists, one
+ * in sector order for the elevator and one in submission order for
+ * deadlines, so an I/O taken by either is unlinked from both in constant
+ * time. Dispatching picks a direction, a first I/O in it, then grows the
+ * run over queued neighbours on adjacent sectors; the run becomes one
+ * virtio request whose callback completes every I/O in it and dispatches
+ * again. Everything runs with interrupts disabled, as the device
+ * interrupt completes requests and dispatches from there too.
+ */
+
+#include <drivers/blk_queue.h>
+#include <drivers/virtio_blk.h>
+#include <arch/interrupt.h>
+#include <hal/hal_timer.h>
+#include <kernel/acct.h>
+#include <kernel/errno.h>
+#include <kernel/trace.h>
+#include <kernel/wait_queue.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLK_READ  0
+#define BLK_WRITE 1
+
+/* Queued I/Os of one direction */
+typedef struct {
+    blk_io_t *sort_head;        // Lowest sector
+    blk_io_t *fifo_head;        // Oldest, the first to expire
+    blk_io_t *fifo_tail;
+    uint64_t next_sector;       // Where the sweep continues
+} blk_dir_t;
+
+/* Device request in flight: the I/Os it carries, linked by rq_next */
+typedef struct {
+    blk_io_t *ios;
+    uint8_t in_use;
+} blk_request_t;
+
+static blk_dir_t g_dirs[2];
+static blk_request_t g_requests[BLK_QUEUE_DEPTH];
+static uint32_t g_in_flight = 0;
+static uint32_t g_queued = 0;
+static uint32_t g_starved = 0;  /* Read requests in a row while writes waited */
+static blk_stats_t g_stats;
+
+static void blk_dispatch(void);
+
+static uint64_t blk_end(const blk_io_t *io)
+{
+    return io->sector + io->len / VIRTIO_BLK_SECTOR_SIZE;
+}
+
+/**
+ * Put an I/O on its direction's lists
+ */
+static void blk_enqueue(blk_io_t *io)
+{
+    blk_dir_t *dir = &g_dirs[io->write ? BLK_WRITE : BLK_READ];
+    io->deadline_us = hal_timer_get_time_us() +
+                      (io->write ? BLK_WRITE_EXPIRE_US : BLK_READ_EXPIRE_US);
+    io->rq_next = NULL;
+
+    /* Sector order; equal sectors keep submission order */
+    blk_io_t *prev = NULL;
+    blk_io_t *next = dir->sort_head;
+    while (next && next->sector <= io->sector) {
+        prev = next;
+        next = next->sort_next;
+    }
+    io->sort_prev = prev;
+    io->sort_next = next;
+    if (prev) {
+        prev->sort_next = io;
+    } else {
+        dir->sort_head = io;
+    }
+    if (next) {
+        next->sort_prev = io;
+    }
+
+    /* Same expiry for the whole direction, so the FIFO is deadline order */
+    io->fifo_prev = dir->fifo_tail;
+    io->fifo_next = NULL;
+    if (dir->fifo_tail) {
+        dir->fifo_tail->fifo_next = io;
+    } else {
+        dir->fifo_head = io;
+    }
+    dir->fifo_tail = io;
+
+    g_stats.ios++;
+    if (++g_queued > g_stats.peak_queued) {
+        g_stats.peak_queued = g_queued;
+    }
+}
+
+/**
+ * Take an I/O off its direction's lists
+ */
+static void blk_dequeue(blk_dir_t *dir, blk_io_t *io)
+{
+    if (io->sort_prev) {
+        io->sort_prev->sort_next = io->sort_next;
+    } else {
+        dir->sort_head = io->sort_next;
+    }
+    if (io->sort_next) {
+        io->sort_next->sort_prev = io->sort_prev;
+    }
+
+    if (io->fifo_prev) {
+        io->fifo_prev->fifo_next = io->fifo_next;
+    } else {
+        dir->fifo_head = io->fifo_next;
+    }
+    if (io->fifo_next) {
+        io->fifo_next->fifo_prev = io->fifo_prev;
+    } else {
+        dir->fifo_tail = io->fifo_prev;
+    }
+
+    io->sort_prev = io->sort_next = NULL;
+    io->fifo_prev = io->fifo_next = NULL;
+    g_queued--;
+}
+
+/**
+ * Pick the direction to serve next, or -1 if nothing is queued
+ *
+ * Reads win unless writes have already waited BLK_WRITES_STARVED read
+ * requests.
+ */
+static int blk_choose(void)
+{
+    int reads = g_dirs[BLK_READ].fifo_head != NULL;
+    int writes = g_dirs[BLK_WRITE].fifo_head != NULL;
+
+    if (reads && (!writes || g_starved < BLK_WRITES_STARVED)) {
+        return BLK_READ;
+    }
+    if (writes) {
+        return BLK_WRITE;
+    }
+    return -1;
+}
+
+/**
+ * Pick the I/O a direction's next request starts from
+ *
+ * The oldest if it has expired, otherwise the next one up the sweep,
+ * wrapping to the lowest sector.
+ */
+static blk_io_t *blk_first(blk_dir_t *dir, int *expired)
+{
+    if (dir->fifo_head->deadline_us <= hal_timer_get_time_us()) {
+        *expired = 1;
+        return dir->fifo_head;
+    }
+
+    *expired = 0;
+    blk_io_t *io = dir->sort_head;
+    while (io && io->sector < dir->next_sector) {
+        io = io->sort_next;
+    }
+    return io ? io : dir->sort_head;
+}
+
+/**
+ * Complete one I/O
+ */
+static void blk_complete(blk_io_t *io, int ok)
+{
+    /* The callback may hand the I/O back to its owner: read batch first */
+    blk_batch_t *batch = io->batch;
+    io->rq_next = NULL;
+
+    if (io->done) {
+        io->done(io, ok);
+    }
+    if (batch) {
+        if (!ok) {
+            batch->error = 1;
+        }
+        batch->pending--;
+        wait_queue_wake(&batch->waiters);
+    }
+}
+
+/**
+ * Complete every I/O of a request and free its slot
+ */
+static void blk_request_finish(blk_request_t *rq, int ok)
+{
+    blk_io_t *io = rq->ios;
+    while (io) {
+        blk_io_t *next = io->rq_next;
+        blk_complete(io, ok);
+        io = next;
+    }
+    rq->ios = NULL;
+    rq->in_use = 0;
+    g_in_flight--;
+}
+
+/* Device completion: finish the request, then refill the device */
+static void blk_request_done(void *arg, int ok)
+{
+    blk_request_t *rq = (blk_request_t *)arg;
+    trace_event(TRACE_BLK_COMPLETE, rq->ios ? rq->ios->sector : 0, ok ? 1 : 0);
+    blk_request_finish(rq, ok);
+    blk_dispatch();
+}
+
+/**
+ * Send queued I/O to the device until the queue depth or the device's
+ * descriptors run out
+ *
+ * Never waits: whatever stays queued goes out as requests finish.
+ */
+static void blk_dispatch(void)
+{
+    uint32_t max_segs = virtio_blk_get_max_segments();
+    int have_device = max_segs > 0;
+    if (max_segs > VIRTIO_BLK_MAX_SEGS) {
+        max_segs = VIRTIO_BLK_MAX_SEGS;
+    }
+    if (max_segs == 0) {
+        max_segs = 1;  // No device: each request fails on its own
+    }
+
+    while (g_in_flight < BLK_QUEUE_DEPTH) {
+        int d = blk_choose();
+        if (d < 0) {
+            return;
+        }
+        blk_dir_t *dir = &g_dirs[d];
+
+        /* Grow the run over queued neighbours, downward first */
+        int expired;
+        blk_io_t *first = blk_first(dir, &expired);
+        blk_io_t *last = first;
+        uint32_t n = 1;
+        while (n < max_segs && first->sort_prev &&
+               blk_end(first->sort_prev) == first->sector) {
+            first = first->sort_prev;
+            n++;
+        }
+        while (n < max_segs && last->sort_next &&
+               last->sort_next->sector == blk_end(last)) {
+            last = last->sort_next;
+            n++;
+        }
+
+        if (have_device && !virtio_blk_has_room(n)) {
+            return;
+        }
+
+        if (d == BLK_READ && g_dirs[BLK_WRITE].fifo_head) {
+            g_starved++;
+            g_stats.reads_first++;
+        } else {
+            g_starved = 0;
+        }
+
+        blk_request_t *rq = NULL;
+        for (uint32_t i = 0; i < BLK_QUEUE_DEPTH; i++) {
+            if (!g_requests[i].in_use) {
+                rq = &g_requests[i];
+                break;
+            }
+        }
+        rq->in_use = 1;
+        g_in_flight++;
+
+        virtio_blk_seg_t segs[VIRTIO_BLK_MAX_SEGS];
+        uint64_t sector = first->sector;
+        uint64_t bytes = 0;
+        blk_io_t **link = &rq->ios;
+        blk_io_t *io = first;
+        for (uint32_t i = 0; i < n; i++) {
+            blk_io_t *next = io->sort_next;
+            blk_dequeue(dir, io);
+            segs[i].buf = io->buf;
+            segs[i].len = io->len;
+            bytes += io->len;
+            *link = io;
+            link = &io->rq_next;
+            io = next;
+        }
+        *link = NULL;
+        dir->next_sector = blk_end(last);
+
+        g_stats.requests++;
+        g_stats.merged += n - 1;
+        if (expired) {
+            g_stats.expired++;
+        }
+
+        trace_event(TRACE_BLK_SUBMIT, sector,
+                    bytes | (d == BLK_WRITE ? TRACE_BLK_WRITE : 0));
+        if (virtio_blk_submit(NULL, sector, segs, n, d == BLK_WRITE,
+                              blk_request_done, rq) != 0) {
+            blk_request_finish(rq, 0);
+        }
+    }
+}
+
+/**
+ * Prepare a batch for I/Os to count against
+ */
+void blk_batch_init(blk_batch_t *batch)
+{
+    batch->pending = 0;
+    batch->error = 0;
+    wait_queue_init(&batch->waiters);
+}
+
+/**
+ * Describe a transfer
+ */
+void blk_io_init(blk_io_t *io, uint64_t sector, void *buf, uint32_t len,
+                 int write, blk_io_done_t done, void *arg)
+{
+    io->sector = sector;
+    io->buf = buf;
+    io->len = len;
+    io->write = write ? 1 : 0;
+    io->done = done;
+    io->arg = arg;
+    io->batch = NULL;
+    io->deadline_us = 0;
+    io->sort_prev = io->sort_next = NULL;
+    io->fifo_prev = io->fifo_next = NULL;
+    io->rq_next = NULL;
+}
+
+/**
+ * Queue an I/O and dispatch what the device has room for
+ */
+void blk_submit(blk_io_t *io, blk_batch_t *batch)
+{
+    int irq_state = interrupt_save_disable();
+    acct_blk_io(io->len, io->write);
+    io->batch = batch;
+    if (batch) {
+        batch->pending++;
+    }
+    blk_enqueue(io);
+    blk_dispatch();
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Start collecting I/Os
+ */
+void blk_plug_init(blk_plug_t *plug)
+{
+    plug->head = NULL;
+    plug->tail = NULL;
+}
+
+/**
+ * Collect an I/O, chained through fifo_next until unplugged
+ */
+void blk_plug_add(blk_plug_t *plug, blk_io_t *io, blk_batch_t *batch)
+{
+    acct_blk_io(io->len, io->write);
+    io->batch = batch;
+    if (batch) {
+        batch->pending++;
+    }
+    io->fifo_next = NULL;
+    if (plug->tail) {
+        plug->tail->fifo_next = io;
+    } else {
+        plug->head = io;
+    }
+    plug->tail = io;
+}
+
+/**
+ * Queue everything collected, then dispatch
+ */
+void blk_unplug(blk_plug_t *plug)
+{
+    int irq_state = interrupt_save_disable();
+    blk_io_t *io = plug->head;
+    while (io) {
+        blk_io_t *next = io->fifo_next;
+        blk_enqueue(io);
+        io = next;
+    }
+    plug->head = NULL;
+    plug->tail = NULL;
+    blk_dispatch();
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Wait until every I/O of a batch has finished
+ *
+ * Sleeps while requests of ours are in flight to wake it; otherwise (no
+ * interrupts yet, or the device full with someone else's requests) polls
+ * the device and dispatches by hand.
+ */
+int blk_batch_wait(blk_batch_t *batch)
+{
+    /* Interrupts stay off from the check until we are on the queue */
+    int irq_state = interrupt_save_disable();
+    uint64_t start_us = hal_timer_get_time_us();
+    uint32_t spins = 0;
+    while (batch->pending > 0) {
+        blk_dispatch();
+        if (batch->pending == 0) {
+            break;
+        }
+        if (g_in_flight > 0 && virtio_blk_can_wait()) {
+            wait_queue_sleep_irqoff(&batch->waiters);
+        } else if (virtio_blk_poll() == 0 && ++spins > VIRTIO_BLK_POLL_SPINS) {
+            break;
+        }
+    }
+    acct_blk_wait(hal_timer_get_time_us() - start_us);
+
+    if (batch->pending > 0) {
+        /* Timed out: the I/Os stay queued or in flight, but no longer
+         * report to the caller's batch */
+        for (int d = BLK_READ; d <= BLK_WRITE; d++) {
+            for (blk_io_t *io = g_dirs[d].fifo_head; io; io = io->fifo_next) {
+                if (io->batch == batch) {
+                    io->batch = NULL;
+                }
+            }
+        }
+        for (uint32_t i = 0; i < BLK_QUEUE_DEPTH; i++) {
+            for (blk_io_t *io = g_requests[i].ios; io; io = io->rq_next) {
+                if (io->batch == batch) {
+                    io->batch = NULL;
+                }
+            }
+        }
+        batch->pending = 0;
+        interrupt_restore(irq_state);
+        RETURN_ERRNO(THUNDEROS_EVIRTIO_TIMEOUT);
+    }
+    interrupt_restore(irq_state);
+
+    if (batch->error) {
+        RETURN_ERRNO(THUNDEROS_EIO);
+    }
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Get request queue statistics
+ */
+void blk_get_stats(blk_stats_t *stats)
+{
+    if (!stats) {
+        return;
+    }
+    int irq_state = interrupt_save_disable();
+    *stats = g_stats;
+    interrupt_restore(irq_state);
+}
@@ -55,11 +55,7 @@ static void draw_cursor(int show)
     
     /* Draw cursor as an underscore on the last two rows of the character cell */
     uint32_t color = show ? g_fbcon.fg_color : g_fbcon.bg_color;
-    for (uint32_t row = FONT_HEIGHT - 2; row < FONT_HEIGHT; row++) {
-        for (uint32_t col = 0; col < FONT_WIDTH; col++) {
-            fb_set_pixel(x + col, y + row, color);
-        }
-    }
+    fb_fill_rect(x, y + FONT_HEIGHT - 2, FONT_WIDTH, 2, color);
 }
 
 /**
@@ -142,24 +138,11 @@ void fbcon_scroll_up(void)
     fb_info_t info;
     if (fb_get_info(&info) < 0) return;
     
-    uint32_t *pixels = info.pixels;
-    if (!pixels) return;
-    
-    uint32_t row_pixels = info.width * FONT_HEIGHT;
     uint32_t console_height = g_fbcon.rows * FONT_HEIGHT;
     
-    /* Copy each row up */
-    for (uint32_t y = 0; y < console_height - FONT_HEIGHT; y++) {
-        for (uint32_t x = 0; x < info.width; x++) {
-            pixels[y * info.width + x] = pixels[(y + FONT_HEIGHT) * info.width + x];
-        }
-    }
-    
-    /* Clear the last row */
-    uint32_t last_row_start = (console_height - FONT_HEIGHT) * info.width;
-    for (uint32_t i = 0; i < row_pixels; i++) {
-        pixels[last_row_start + i] = g_fbcon.bg_color;
-    }
+    /* Move every row up, then clear the last one */
+    if (fb_scroll_up(console_height, FONT_HEIGHT) < 0) return;
+    fb_fill_rect(0, console_height - FONT_HEIGHT, info.width, FONT_HEIGHT, g_fbcon.bg_color);
     
     g_fbcon.dirty = 1;
 }
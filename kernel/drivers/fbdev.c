@@ -0,0 +1,156 @@
+/*
+ * Framebuffer Device (/dev/fb0)
+ *
+ * The node's operations hand the VirtIO GPU framebuffer to the process
+ * that opened it. Everything runs under the big kernel lock, which also
+ * covers the owner flag.
+ */
+
+#include <drivers/fbdev.h>
+#include <drivers/virtio_gpu.h>
+#include <drivers/vterm.h>
+#include <fs/devfs.h>
+#include <mm/page.h>
+#include <mm/pmm.h>
+#include <kernel/errno.h>
+#include <kernel/uaccess.h>
+#include <stddef.h>
+
+static int fbdev_open(vfs_node_t *node, uint32_t flags);
+static void fbdev_close(vfs_node_t *node);
+static uintptr_t fbdev_map_page(vfs_node_t *node, uint64_t index);
+static int fbdev_ioctl(vfs_node_t *node, uint32_t request, uint64_t arg);
+
+static vfs_ops_t fbdev_ops = {
+    .read = NULL,                      /* Pixels are reached through mmap() */
+    .write = NULL,
+    .open = fbdev_open,
+    .close = fbdev_close,
+    .map_page = fbdev_map_page,
+    .ioctl = fbdev_ioctl,
+};
+
+/* The display belongs to an open /dev/fb0 */
+static int g_fbdev_open = 0;
+
+/**
+ * Take the display over for the opener
+ */
+static int fbdev_open(vfs_node_t *node, uint32_t flags) {
+    (void)node;
+    (void)flags;
+    if (!virtio_gpu_available()) {
+        RETURN_ERRNO(THUNDEROS_ENODEV);
+    }
+    if (g_fbdev_open) {
+        RETURN_ERRNO(THUNDEROS_EBUSY);
+    }
+    
+    /* The terminals stop drawing before the framebuffer stops moving */
+    vterm_display_suspend();
+    if (virtio_gpu_set_direct(1) != 0) {
+        vterm_display_resume();
+        /* errno already set by virtio_gpu_set_direct */
+        return -1;
+    }
+    g_fbdev_open = 1;
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Give the display back to the terminals (last close)
+ */
+static void fbdev_close(vfs_node_t *node) {
+    (void)node;
+    if (!g_fbdev_open) {
+        return;
+    }
+    g_fbdev_open = 0;
+    virtio_gpu_set_direct(0);
+    vterm_display_resume();
+}
+
+/**
+ * Page of the framebuffer for a mapping, with a reference for it
+ */
+static uintptr_t fbdev_map_page(vfs_node_t *node, uint64_t index) {
+    uintptr_t phys = virtio_gpu_get_framebuffer_phys();
+    if (!phys) {
+        set_errno(THUNDEROS_ENODEV);
+        return 0;
+    }
+    if (index >= (node->size + PAGE_SIZE - 1) / PAGE_SIZE) {
+        set_errno(THUNDEROS_EFAULT);
+        return 0;
+    }
+    
+    uintptr_t page = phys + index * PAGE_SIZE;
+    get_page(page);
+    clear_errno();
+    return page;
+}
+
+/**
+ * FBIOGET_INFO and FBIO_DAMAGE
+ */
+static int fbdev_ioctl(vfs_node_t *node, uint32_t request, uint64_t arg) {
+    switch (request) {
+        case FBIOGET_INFO: {
+            fbdev_info_t info;
+            virtio_gpu_get_dimensions(&info.width, &info.height);
+            info.stride = info.width * 4;
+            info.format = FBDEV_FORMAT_BGRX8888;
+            info.size = node->size;
+            if (copy_to_user((void *)arg, &info, sizeof(info)) != 0) {
+                /* errno already set by copy_to_user */
+                return -1;
+            }
+            clear_errno();
+            return 0;
+        }
+        
+        case FBIO_DAMAGE: {
+            fbdev_rect_t rect;
+            if (copy_from_user(&rect, (const void *)arg, sizeof(rect)) != 0) {
+                /* errno already set by copy_from_user */
+                return -1;
+            }
+            
+            /* Clipped here, where x + width cannot wrap */
+            uint32_t width, height;
+            virtio_gpu_get_dimensions(&width, &height);
+            if (rect.x >= width || rect.y >= height || rect.width == 0 || rect.height == 0) {
+                clear_errno();
+                return 0;
+            }
+            if (rect.width > width - rect.x) rect.width = width - rect.x;
+            if (rect.height > height - rect.y) rect.height = height - rect.y;
+            /* errno set by virtio_gpu_flush_region */
+            return virtio_gpu_flush_region(rect.x, rect.y, rect.width, rect.height);
+        }
+        
+        default:
+            RETURN_ERRNO(THUNDEROS_ENOTTY);
+    }
+}
+
+/**
+ * Register /dev/fb0 for the VirtIO GPU framebuffer
+ */
+int fbdev_init(void) {
+    if (!virtio_gpu_available()) {
+        RETURN_ERRNO(THUNDEROS_ENODEV);
+    }
+    
+    uint32_t width, height;
+    virtio_gpu_get_dimensions(&width, &height);
+    uint64_t size = (uint64_t)width * height * 4;
+    
+    if (!devfs_register("fb0", 0666, &fbdev_ops, size, NULL)) {
+        /* errno already set by devfs_register */
+        return -1;
+    }
+    clear_errno();
+    return 0;
+}
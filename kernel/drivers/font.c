@@ -314,28 +314,116 @@ const uint8_t *font_get_glyph(char c)
     return font_data[c - FONT_FIRST_CHAR];
 }
 
+/* Color pairs kept expanded, replaced round-robin */
+#define FONT_COLOR_CACHE    4
+
+/* Characters put together per framebuffer row write */
+#define FONT_RUN_CHARS      32
+
+/*
+ * A color pair expanded: the FONT_WIDTH pixels of every possible glyph
+ * row byte, in the framebuffer's own format, so a glyph row is one copy
+ */
+typedef struct {
+    int valid;
+    uint32_t fg;                        /* Native colors it was built for */
+    uint32_t bg;
+    uint32_t rows[256][FONT_WIDTH];
+} font_colors_t;
+
+static font_colors_t g_font_colors[FONT_COLOR_CACHE];
+static uint32_t g_font_colors_next = 0;
+
 /**
- * Draw a character to the framebuffer
+ * Find or build the expanded rows for a color pair
  */
-void font_draw_char(uint32_t x, uint32_t y, char c, uint32_t fg, uint32_t bg)
+static const font_colors_t *font_get_colors(uint32_t fg, uint32_t bg)
 {
-    const uint8_t *glyph = font_get_glyph(c);
+    uint32_t nfg = fb_native_color(fg);
+    uint32_t nbg = fb_native_color(bg);
     
-    /* Draw unknown characters as a filled rectangle */
-    if (!glyph) {
-        fb_fill_rect(x, y, FONT_WIDTH, FONT_HEIGHT, fg);
-        return;
+    for (uint32_t i = 0; i < FONT_COLOR_CACHE; i++) {
+        font_colors_t *colors = &g_font_colors[i];
+        if (colors->valid && colors->fg == nfg && colors->bg == nbg) {
+            return colors;
+        }
     }
     
-    for (int row = 0; row < FONT_HEIGHT; row++) {
-        uint8_t bits = glyph[row];
+    font_colors_t *colors = &g_font_colors[g_font_colors_next];
+    g_font_colors_next = (g_font_colors_next + 1) % FONT_COLOR_CACHE;
+    
+    for (uint32_t bits = 0; bits < 256; bits++) {
         for (int col = 0; col < FONT_WIDTH; col++) {
-            uint32_t color = (bits & (0x80 >> col)) ? fg : bg;
-            fb_set_pixel(x + col, y + row, color);
+            colors->rows[bits][col] = (bits & (0x80 >> col)) ? nfg : nbg;
+        }
+    }
+    colors->fg = nfg;
+    colors->bg = nbg;
+    colors->valid = 1;
+    return colors;
+}
+
+/**
+ * Draw a run of characters on one line
+ */
+void font_draw_run(uint32_t x, uint32_t y, const char *chars, uint32_t count,
+                   uint32_t fg, uint32_t bg)
+{
+    static const uint8_t solid[FONT_HEIGHT] = {
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    };
+    uint32_t line[FONT_RUN_CHARS * FONT_WIDTH];
+    const uint8_t *glyphs[FONT_RUN_CHARS];
+    
+    if (!chars || count == 0) return;
+    
+    /* Blank runs (cleared lines, the end of most rows) are plain fills */
+    uint32_t blank = 0;
+    while (blank < count && chars[blank] == ' ') blank++;
+    if (blank == count) {
+        fb_fill_rect(x, y, count * FONT_WIDTH, FONT_HEIGHT, bg);
+        return;
+    }
+    
+    const font_colors_t *colors = font_get_colors(fg, bg);
+    
+    while (count > 0) {
+        uint32_t n = (count < FONT_RUN_CHARS) ? count : FONT_RUN_CHARS;
+        
+        /* Unknown characters are drawn as a filled rectangle */
+        for (uint32_t i = 0; i < n; i++) {
+            const uint8_t *glyph = font_get_glyph(chars[i]);
+            glyphs[i] = glyph ? glyph : solid;
+        }
+        
+        /* One row across every glyph, then one write */
+        for (int row = 0; row < FONT_HEIGHT; row++) {
+            uint32_t *dst = line;
+            for (uint32_t i = 0; i < n; i++) {
+                const uint32_t *src = colors->rows[glyphs[i][row]];
+                for (int col = 0; col < FONT_WIDTH; col++) {
+                    dst[col] = src[col];
+                }
+                dst += FONT_WIDTH;
+            }
+            fb_write_span(x, y + row, line, n * FONT_WIDTH);
         }
+        
+        chars += n;
+        count -= n;
+        x += n * FONT_WIDTH;
     }
 }
 
+/**
+ * Draw a character to the framebuffer
+ */
+void font_draw_char(uint32_t x, uint32_t y, char c, uint32_t fg, uint32_t bg)
+{
+    font_draw_run(x, y, &c, 1, fg, bg);
+}
+
 /**
  * Draw a character with transparent background
  */
@@ -370,13 +458,18 @@ void font_draw_string(uint32_t x, uint32_t y, const char *str, uint32_t fg, uint
         if (*str == '\n') {
             cx = x;
             y += FONT_HEIGHT;
+            str++;
         } else if (*str == '\t') {
             cx += FONT_WIDTH * FONT_TAB_WIDTH;  /* FONT_TAB_WIDTH-space tabs */
+            str++;
         } else {
-            font_draw_char(cx, y, *str, fg, bg);
-            cx += FONT_WIDTH;
+            /* Everything up to the next line break or tab in one go */
+            uint32_t n = 0;
+            while (str[n] && str[n] != '\n' && str[n] != '\t') n++;
+            font_draw_run(cx, y, str, n, fg, bg);
+            cx += n * FONT_WIDTH;
+            str += n;
         }
-        str++;
     }
 }
 
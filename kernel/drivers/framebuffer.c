@@ -8,6 +8,7 @@
 #include <drivers/framebuffer.h>
 #include <drivers/virtio_gpu.h>
 #include <kernel/errno.h>
+#include <kernel/kstring.h>
 #include <stddef.h>
 
 /* Global framebuffer state */
@@ -141,6 +142,122 @@ uint32_t fb_get_pixel(uint32_t x, uint32_t y)
     return 0;
 }
 
+/**
+ * Convert a color to the framebuffer's own pixel format
+ */
+uint32_t fb_native_color(uint32_t color)
+{
+    switch (g_fb_info.backend) {
+    case FB_BACKEND_VIRTIO_GPU:
+        return color & 0x00FFFFFF;      /* BGRX, as virtio_gpu_set_pixel() stores it */
+    default:
+        return color;
+    }
+}
+
+/**
+ * Write a run of pixels to one row
+ */
+void fb_write_span(uint32_t x, uint32_t y, const uint32_t *pixels, uint32_t count)
+{
+    if (!g_fb_initialized) return;
+    
+    switch (g_fb_info.backend) {
+    case FB_BACKEND_VIRTIO_GPU:
+        virtio_gpu_write_span(x, y, pixels, count);
+        break;
+    case FB_BACKEND_LINEAR:
+        if (x < g_fb_info.width && y < g_fb_info.height && g_fb_info.pixels) {
+            if (count > g_fb_info.width - x) count = g_fb_info.width - x;
+            uint32_t *dst = &g_fb_info.pixels[y * g_fb_info.width + x];
+            for (uint32_t i = 0; i < count; i++) {
+                dst[i] = pixels[i];
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * Clip a rectangle to the screen
+ * 
+ * @return 0 if nothing of it is on the screen
+ */
+static int fb_clip(uint32_t x, uint32_t y, uint32_t *width, uint32_t *height)
+{
+    if (x >= g_fb_info.width || y >= g_fb_info.height) return 0;
+    if (*width > g_fb_info.width - x) *width = g_fb_info.width - x;
+    if (*height > g_fb_info.height - y) *height = g_fb_info.height - y;
+    return *width > 0 && *height > 0;
+}
+
+/**
+ * Copy a rectangle of pixels onto the screen
+ */
+void fb_blit(const uint32_t *src, uint32_t src_stride, const fb_rect_t *rect)
+{
+    if (!g_fb_initialized || !src || !rect) return;
+    
+    switch (g_fb_info.backend) {
+    case FB_BACKEND_VIRTIO_GPU:
+        virtio_gpu_blit(rect->x, rect->y, rect->width, rect->height, src, src_stride);
+        break;
+    case FB_BACKEND_LINEAR: {
+        uint32_t width = rect->width;
+        uint32_t height = rect->height;
+        if (!g_fb_info.pixels || !fb_clip(rect->x, rect->y, &width, &height)) break;
+        for (uint32_t row = 0; row < height; row++) {
+            kmemcpy(&g_fb_info.pixels[(size_t)(rect->y + row) * g_fb_info.width + rect->x],
+                    src + (size_t)row * src_stride, (size_t)width * sizeof(uint32_t));
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/**
+ * Move a rectangle of the screen to another place on it
+ */
+void fb_copy_rect(uint32_t dst_x, uint32_t dst_y, const fb_rect_t *src)
+{
+    if (!g_fb_initialized || !src) return;
+    
+    switch (g_fb_info.backend) {
+    case FB_BACKEND_VIRTIO_GPU:
+        virtio_gpu_copy_rect(dst_x, dst_y, src->x, src->y, src->width, src->height);
+        break;
+    case FB_BACKEND_LINEAR: {
+        uint32_t width = src->width;
+        uint32_t height = src->height;
+        if (!g_fb_info.pixels) break;
+        if (!fb_clip(src->x, src->y, &width, &height)) break;
+        if (!fb_clip(dst_x, dst_y, &width, &height)) break;
+        
+        /* One run of memory: move it in the order that reads before it writes */
+        size_t stride = g_fb_info.width;
+        uint32_t *base = g_fb_info.pixels;
+        int down = dst_y > src->y || (dst_y == src->y && dst_x > src->x);
+        for (uint32_t i = 0; i < height; i++) {
+            uint32_t row = down ? height - 1 - i : i;
+            uint32_t *d = base + (size_t)(dst_y + row) * stride + dst_x;
+            const uint32_t *s = base + (size_t)(src->y + row) * stride + src->x;
+            if (down) {
+                for (uint32_t col = width; col-- > 0; ) d[col] = s[col];
+            } else {
+                for (uint32_t col = 0; col < width; col++) d[col] = s[col];
+            }
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
 /**
  * Clear the framebuffer
  */
@@ -154,10 +271,7 @@ void fb_clear(uint32_t color)
         break;
     case FB_BACKEND_LINEAR:
         if (g_fb_info.pixels) {
-            uint32_t num_pixels = g_fb_info.width * g_fb_info.height;
-            for (uint32_t i = 0; i < num_pixels; i++) {
-                g_fb_info.pixels[i] = color;
-            }
+            kmemset32(g_fb_info.pixels, color, (size_t)g_fb_info.width * g_fb_info.height);
         }
         break;
     default:
@@ -206,6 +320,60 @@ int fb_flush_region(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
     }
 }
 
+/**
+ * Show a finished frame
+ */
+int fb_swap_buffers(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    if (!g_fb_initialized) {
+        RETURN_ERRNO(THUNDEROS_ENODEV);
+    }
+    
+    switch (g_fb_info.backend) {
+    case FB_BACKEND_VIRTIO_GPU:
+        /* A flush is a flip whenever the driver has both buffers */
+        return virtio_gpu_flush_region(x, y, width, height);
+    case FB_BACKEND_LINEAR:
+        /* One buffer, read by the display as it is written */
+        clear_errno();
+        return 0;
+    default:
+        RETURN_ERRNO(THUNDEROS_ENODEV);
+    }
+}
+
+/**
+ * Scroll the top of the screen up
+ */
+int fb_scroll_up(uint32_t height, uint32_t lines)
+{
+    if (!g_fb_initialized) {
+        RETURN_ERRNO(THUNDEROS_ENODEV);
+    }
+    if (height > g_fb_info.height) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    switch (g_fb_info.backend) {
+    case FB_BACKEND_VIRTIO_GPU:
+        return virtio_gpu_scroll(height, lines);
+    case FB_BACKEND_LINEAR:
+        /* The display reads memory in order: move the rows, as one run */
+        if (g_fb_info.pixels && lines < height) {
+            uint32_t *dst = g_fb_info.pixels;
+            const uint32_t *src = g_fb_info.pixels + (size_t)lines * g_fb_info.width;
+            size_t count = (size_t)(height - lines) * g_fb_info.width;
+            for (size_t i = 0; i < count; i++) {
+                dst[i] = src[i];
+            }
+        }
+        clear_errno();
+        return 0;
+    default:
+        RETURN_ERRNO(THUNDEROS_ENODEV);
+    }
+}
+
 /* ============================================================================
  * Graphics Primitives
  * ============================================================================ */
@@ -226,11 +394,10 @@ void fb_draw_hline(uint32_t x1, uint32_t x2, uint32_t y, uint32_t color)
     }
     
     /* Clamp to screen */
+    if (x1 >= g_fb_info.width) return;
     if (x2 >= g_fb_info.width) x2 = g_fb_info.width - 1;
     
-    for (uint32_t x = x1; x <= x2; x++) {
-        fb_set_pixel(x, y, color);
-    }
+    fb_fill_rect(x1, y, x2 - x1 + 1, 1, color);
 }
 
 /**
@@ -249,11 +416,10 @@ void fb_draw_vline(uint32_t x, uint32_t y1, uint32_t y2, uint32_t color)
     }
     
     /* Clamp to screen */
+    if (y1 >= g_fb_info.height) return;
     if (y2 >= g_fb_info.height) y2 = g_fb_info.height - 1;
     
-    for (uint32_t y = y1; y <= y2; y++) {
-        fb_set_pixel(x, y, color);
-    }
+    fb_fill_rect(x, y1, 1, y2 - y1 + 1, color);
 }
 
 /**
@@ -365,21 +531,19 @@ void fb_draw_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint3
 void fb_fill_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t color)
 {
     if (!g_fb_initialized) return;
-    if (width == 0 || height == 0) return;
-    
-    /* Clamp to screen bounds */
-    if (x >= g_fb_info.width || y >= g_fb_info.height) return;
-    
-    if (x + width > g_fb_info.width) {
-        width = g_fb_info.width - x;
-    }
-    if (y + height > g_fb_info.height) {
-        height = g_fb_info.height - y;
-    }
     
-    for (uint32_t row = y; row < y + height; row++) {
-        for (uint32_t col = x; col < x + width; col++) {
-            fb_set_pixel(col, row, color);
+    switch (g_fb_info.backend) {
+    case FB_BACKEND_VIRTIO_GPU:
+        virtio_gpu_fill_rect(x, y, width, height, color);
+        break;
+    case FB_BACKEND_LINEAR:
+        /* Clamped here, where x + width cannot wrap */
+        if (!g_fb_info.pixels || !fb_clip(x, y, &width, &height)) break;
+        for (uint32_t row = y; row < y + height; row++) {
+            kmemset32(&g_fb_info.pixels[(size_t)row * g_fb_info.width + x], color, width);
         }
+        break;
+    default:
+        break;
     }
 }
@@ -2,7 +2,22 @@
  * VirtIO Block Device Driver
  * 
  * Implementation of VirtIO 1.0+ block device driver using MMIO interface.
- * Provides synchronous block I/O with DMA-allocated buffers.
+ * Requests are started without waiting and finished by the device
+ * interrupt, so the whole queue can be in flight at once: the handler
+ * acknowledges it and the block softirq reaps the completions. Callers either
+ * wait for a batch of requests (sleeping, so other processes run) or
+ * have a callback run as each one completes. Until the interrupt is
+ * wired up, and for callers that are not a process, the used ring is
+ * polled instead.
+ *
+ * To keep exits to the hypervisor down, a request takes one ring slot
+ * through an indirect descriptor table (VIRTIO_RING_F_INDIRECT_DESC),
+ * and with VIRTIO_RING_F_EVENT_IDX the driver rings the doorbell only
+ * when the device asked for it and is interrupted once per batch of
+ * completions rather than per request. A device offering several queues
+ * (VIRTIO_BLK_F_MQ) gets one per CPU; each CPU submits to its own. The
+ * rings, doorbells and the feature handshake are the shared virtqueue
+ * code (virtqueue.c).
  */
 
 #include <drivers/virtio_blk.h>
@@ -10,284 +25,278 @@
 #include <mm/paging.h>
 #include <mm/kmalloc.h>
 #include <arch/barrier.h>
+#include <arch/interrupt.h>
+#include <hal/hal_timer.h>
 #include <hal/hal_uart.h>
+#include <kernel/acct.h>
+#include <kernel/constants.h>
 #include <kernel/errno.h>
+#include <kernel/process.h>
+#include <kernel/smp.h>
+#include <kernel/softirq.h>
+#include <kernel/wait_queue.h>
 #include <stddef.h>
 #include <stdint.h>
 
-/* Helper macros for MMIO register access */
-#define VIRTIO_READ32(dev, offset) \
-    (*((volatile uint32_t *)((dev)->base_addr + (offset))))
-
-#define VIRTIO_WRITE32(dev, offset, value) \
-    (*((volatile uint32_t *)((dev)->base_addr + (offset))) = (value))
-
 /* Global device state */
 static virtio_blk_device_t *g_blk_device = NULL;
 
-/* Forward declarations */
-static int virtqueue_init(virtio_blk_device_t *dev, uint32_t queue_size);
-static int virtqueue_alloc_desc_chain(virtqueue_t *vq, uint16_t *desc_idx, uint32_t count);
-static void virtqueue_free_desc_chain(virtqueue_t *vq, uint16_t desc_idx);
-static void virtqueue_add_to_avail(virtqueue_t *vq, uint16_t desc_idx);
-static int virtqueue_get_used_buf(virtqueue_t *vq, uint16_t *desc_idx, uint32_t *len);
-static void virtqueue_notify(virtio_blk_device_t *dev, uint32_t queue_idx);
-
 /**
- * Initialize virtqueue with descriptor, available, and used rings
+ * Get the queue the calling CPU submits to
  */
-static int virtqueue_init(virtio_blk_device_t *dev, uint32_t queue_size)
+static virtqueue_t *virtio_blk_this_queue(virtio_blk_device_t *dev)
 {
-    virtqueue_t *vq = &dev->queue;
-    vq->queue_size = queue_size;
-    vq->last_seen_used = 0;
-    vq->num_free = queue_size;
-    
-    /* Calculate sizes for each ring */
-    size_t desc_size = sizeof(virtq_desc_t) * queue_size;
-    size_t avail_size = sizeof(uint16_t) * (3 + queue_size);
-    size_t used_size = sizeof(uint16_t) * 3 + sizeof(virtq_used_elem_t) * queue_size;
-    
-    /* Allocate descriptor ring using DMA allocator */
-    dma_region_t *desc_region = dma_alloc(desc_size, DMA_ZERO);
-    if (!desc_region) {
-        RETURN_ERRNO(THUNDEROS_ENOMEM);
-    }
-    vq->desc = (virtq_desc_t *)desc_region->virt_addr;
-    vq->desc_phys = desc_region->phys_addr;
-    
-    /* Allocate available ring */
-    dma_region_t *avail_region = dma_alloc(avail_size, DMA_ZERO);
-    if (!avail_region) {
-        dma_free(desc_region);
-        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    if (dev->num_queues <= 1) {
+        return &dev->queues[0];
     }
-    vq->avail = (virtq_avail_t *)avail_region->virt_addr;
-    vq->avail_phys = avail_region->phys_addr;
-    
-    /* Allocate used ring */
-    dma_region_t *used_region = dma_alloc(used_size, DMA_ZERO);
-    if (!used_region) {
-        dma_free(desc_region);
-        dma_free(avail_region);
-        RETURN_ERRNO(THUNDEROS_ENOMEM);
-    }
-    vq->used = (virtq_used_t *)used_region->virt_addr;
-    vq->used_phys = used_region->phys_addr;
-    
-    /* Initialize free descriptor list (link all descriptors together) */
-    for (uint32_t i = 0; i < queue_size - 1; i++) {
-        vq->desc[i].next = (uint16_t)(i + 1);
-    }
-    vq->desc[queue_size - 1].next = 0;
-    vq->free_head = 0;
-    
-    /* Configure queue in device */
-    VIRTIO_WRITE32(dev, VIRTIO_MMIO_QUEUE_SEL, 0);
-    VIRTIO_WRITE32(dev, VIRTIO_MMIO_QUEUE_NUM, queue_size);
-    
-    /* Write descriptor ring address (split 64-bit address into low/high) */
-    VIRTIO_WRITE32(dev, VIRTIO_MMIO_QUEUE_DESC_LOW, (uint32_t)(vq->desc_phys & 0xFFFFFFFF));
-    VIRTIO_WRITE32(dev, VIRTIO_MMIO_QUEUE_DESC_HIGH, (uint32_t)(vq->desc_phys >> 32));
-    
-    /* Write available ring address */
-    VIRTIO_WRITE32(dev, VIRTIO_MMIO_QUEUE_AVAIL_LOW, (uint32_t)(vq->avail_phys & 0xFFFFFFFF));
-    VIRTIO_WRITE32(dev, VIRTIO_MMIO_QUEUE_AVAIL_HIGH, (uint32_t)(vq->avail_phys >> 32));
-    
-    /* Write used ring address */
-    VIRTIO_WRITE32(dev, VIRTIO_MMIO_QUEUE_USED_LOW, (uint32_t)(vq->used_phys & 0xFFFFFFFF));
-    VIRTIO_WRITE32(dev, VIRTIO_MMIO_QUEUE_USED_HIGH, (uint32_t)(vq->used_phys >> 32));
-    
-    /* Mark queue as ready */
-    VIRTIO_WRITE32(dev, VIRTIO_MMIO_QUEUE_READY, 1);
-    
-    clear_errno();
-    return 0;
+    return &dev->queues[(uint32_t)cpu_this()->id % dev->num_queues];
 }
 
 /**
- * Allocate a chain of descriptors from the free list
+ * Get the ring slots a request with nsegs data segments takes
  */
-static int virtqueue_alloc_desc_chain(virtqueue_t *vq, uint16_t *desc_idx, uint32_t count)
+static uint32_t virtio_blk_descs(virtio_blk_device_t *dev, uint32_t nsegs)
 {
-    if (vq->num_free < count) {
-        RETURN_ERRNO(THUNDEROS_EBUSY);
-    }
-    
-    *desc_idx = vq->free_head;
-    uint16_t current = vq->free_head;
-    
-    /* Advance free_head by 'count' descriptors */
-    for (uint32_t i = 0; i < count; i++) {
-        current = vq->desc[current].next;
-    }
-    vq->free_head = current;
-    vq->num_free -= count;
-    
-    clear_errno();
-    return 0;
+    return (dev->features & VIRTIO_RING_F_INDIRECT_DESC) ? 1 : nsegs + 2;
 }
 
 /**
- * Free a descriptor chain back to the free list
+ * Whether the caller may sleep for a completion rather than poll for it
+ *
+ * Only a process can sleep, not a softirq (which reaps completions
+ * itself), and only once completions raise interrupts; before that
+ * (mounting the root filesystem at boot) the used ring is polled.
  */
-static void virtqueue_free_desc_chain(virtqueue_t *vq, uint16_t desc_idx)
+static int virtio_blk_can_sleep(virtio_blk_device_t *dev)
 {
-    /* Count descriptors in chain */
-    uint16_t count = 1;
-    uint16_t current = desc_idx;
-    while (vq->desc[current].flags & VIRTQ_DESC_F_NEXT) {
-        current = vq->desc[current].next;
-        count++;
-    }
-    
-    /* Add chain back to free list */
-    vq->desc[current].next = vq->free_head;
-    vq->free_head = desc_idx;
-    vq->num_free += count;
+    return dev->irq_ready && process_current() != NULL && !in_softirq();
 }
 
 /**
- * Add descriptor to available ring
+ * Finish one request the device has completed
+ *
+ * Runs its callback, counts it against its batch and returns it to the
+ * pool.
  */
-static void virtqueue_add_to_avail(virtqueue_t *vq, uint16_t desc_idx)
+static void virtio_blk_finish(virtio_blk_device_t *dev, virtqueue_t *vq, uint16_t head)
 {
-    uint16_t avail_idx = vq->avail->idx % vq->queue_size;
-    vq->avail->ring[avail_idx] = desc_idx;
+    virtio_blk_request_t *req = vq->token[head];
+    vq->token[head] = NULL;
+    virtqueue_free_desc_chain(vq, head);
+    dev->in_flight--;
+    if (!req) {
+        return;
+    }
     
-    /* Memory barrier to ensure descriptor writes complete before index update */
-    write_barrier();
+    int ok = (req->status == VIRTIO_BLK_S_OK);
+    if (!ok) {
+        dev->error_count++;
+    } else if (req->header.type == VIRTIO_BLK_T_IN) {
+        dev->read_count++;
+    } else if (req->header.type == VIRTIO_BLK_T_OUT) {
+        dev->write_count++;
+    }
     
-    vq->avail->idx++;
+    if (req->done) {
+        req->done(req->arg, ok);
+    }
+    if (req->batch) {
+        if (!ok) {
+            req->batch->error = 1;
+        }
+        req->batch->pending--;
+        wait_queue_wake(&req->batch->waiters);
+    }
+    dma_pool_free(dev->req_pool, req, req->phys);
 }
 
 /**
- * Get buffer from used ring
+ * Finish every request the device has completed, on every queue
+ *
+ * Runs from the interrupt handler, or from a poller that cannot sleep;
+ * anyone waiting for descriptors is then woken. With
+ * VIRTIO_RING_F_EVENT_IDX each queue's used_event is moved up to what was
+ * seen, so the next interrupt comes with the next completion and none
+ * for the ones just handled.
+ *
+ * @return Number of requests finished
  */
-static int virtqueue_get_used_buf(virtqueue_t *vq, uint16_t *desc_idx, uint32_t *len)
+static int virtio_blk_reap(virtio_blk_device_t *dev)
 {
-    /* Memory barrier to ensure we read latest used ring index */
-    read_barrier();
+    int reaped = 0;
+    
+    int irq_state = interrupt_save_disable();
+    
+    /* Acknowledge first so a completion after the scan raises a new interrupt */
+    virtio_mmio_ack_interrupt(dev->base_addr);
     
-    if (vq->last_seen_used == vq->used->idx) {
-        return -1;  // No new completions
+    for (uint32_t q = 0; q < dev->num_queues; q++) {
+        virtqueue_t *vq = &dev->queues[q];
+        uint16_t head;
+        uint32_t len;
+        do {
+            while (virtqueue_get_used_buf(vq, &head, &len) == 0) {
+                virtio_blk_finish(dev, vq, head);
+                reaped++;
+            }
+            /* A completion between the scan and re-arming would not
+             * interrupt: enable_cb looks once more */
+        } while (virtqueue_enable_cb(vq));
     }
     
-    uint16_t used_idx = vq->last_seen_used % vq->queue_size;
-    *desc_idx = vq->used->ring[used_idx].id;
-    *len = vq->used->ring[used_idx].len;
+    if (reaped > 0) {
+        wait_queue_wake(&dev->desc_waiters);
+    }
     
-    vq->last_seen_used++;
-    return 0;
+    interrupt_restore(irq_state);
+    return reaped;
 }
 
 /**
- * Notify device of new available buffers
+ * SOFTIRQ_BLOCK: finish what completed and wake the waiters
  */
-static void virtqueue_notify(virtio_blk_device_t *dev, uint32_t queue_idx)
+static void virtio_blk_softirq(void)
 {
-    /* Memory barrier to ensure all writes complete before notify */
-    write_barrier();
-    
-    /* Write queue index to QUEUE_NOTIFY register */
-    VIRTIO_WRITE32(dev, VIRTIO_MMIO_QUEUE_NOTIFY, queue_idx);
-    
-    /* Memory barrier after notify */
-    write_barrier();
+    if (g_blk_device) {
+        virtio_blk_reap(g_blk_device);
+    }
 }
 
 /**
- * Perform a synchronous block I/O request
+ * Start a block I/O request without waiting for it
+ *
+ * The chain is a header descriptor, one descriptor per data segment and
+ * a status descriptor, so a request covering several buffers or a
+ * multi-sector buffer is one trip to the device. With indirect
+ * descriptors the chain lives in the request's own table and takes a
+ * single ring slot. When the queue has no room the caller sleeps (or
+ * polls) until earlier requests finish.
  */
-static int virtio_blk_do_request(virtio_blk_device_t *dev, virtio_blk_request_t *req,
-                                  uint64_t sector, void *buffer, uint32_t sectors,
-                                  uint32_t type)
+static int virtio_blk_start(virtio_blk_device_t *dev, virtio_blk_batch_t *batch,
+                            uint64_t sector, const virtio_blk_seg_t *segs,
+                            uint32_t nsegs, uint32_t type,
+                            virtio_blk_done_t done, void *arg)
 {
-    virtqueue_t *vq = &dev->queue;
+    /* Header and status live in the pooled request; only data needs a walk */
+    uintptr_t data_phys[VIRTIO_BLK_MAX_SEGS];
+    if (nsegs > VIRTIO_BLK_MAX_SEGS) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    for (uint32_t i = 0; i < nsegs; i++) {
+        data_phys[i] = translate_virt_to_phys((uintptr_t)segs[i].buf);
+        if (data_phys[i] == 0) {
+            RETURN_ERRNO(THUNDEROS_EIO);
+        }
+    }
     
-    /* Allocate 3 descriptors: header, data buffer, status */
-    uint16_t desc_idx = 0;
-    if (virtqueue_alloc_desc_chain(vq, &desc_idx, 3) < 0) {
-        return -1;
+    /* Request structure from the DMA pool (device needs to write status) */
+    uintptr_t req_phys;
+    virtio_blk_request_t *req = dma_pool_alloc(dev->req_pool, 0, &req_phys);
+    if (!req) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
     }
     
+    /* Wait for room: one slot if indirect, else header + segments + status.
+     * A process that slept may wake on another CPU, with another queue */
+    uint32_t ndesc = virtio_blk_descs(dev, nsegs);
+    int indirect = (dev->features & VIRTIO_RING_F_INDIRECT_DESC) != 0;
+    int irq_state = interrupt_save_disable();
+    virtqueue_t *vq = virtio_blk_this_queue(dev);
+    uint32_t spins = 0;
+    while (vq->num_free < ndesc) {
+        if (virtio_blk_can_sleep(dev)) {
+            wait_queue_sleep_irqoff(&dev->desc_waiters);
+        } else if (virtio_blk_reap(dev) == 0 && ++spins > VIRTIO_BLK_POLL_SPINS) {
+            interrupt_restore(irq_state);
+            dma_pool_free(dev->req_pool, req, req_phys);
+            RETURN_ERRNO(THUNDEROS_EVIRTIO_TIMEOUT);
+        }
+        vq = virtio_blk_this_queue(dev);
+    }
+    
+    uint16_t desc_idx = 0;
+    virtqueue_alloc_desc_chain(vq, &desc_idx, ndesc);
+    
     /* Setup request header */
     req->header.type = type;
     req->header.reserved = 0;
     req->header.sector = sector;
-    req->data = buffer;
+    req->data = nsegs > 0 ? (uint8_t *)segs[0].buf : NULL;
     req->status = 0xFF;
+    req->phys = req_phys;
+    req->batch = batch;
+    req->done = done;
+    req->arg = arg;
     
-    /* Get physical addresses for all buffers */
-    uintptr_t header_phys = translate_virt_to_phys((uintptr_t)&req->header);
-    uintptr_t data_phys = translate_virt_to_phys((uintptr_t)buffer);
-    uintptr_t status_phys = translate_virt_to_phys((uintptr_t)&req->status);
+    uintptr_t header_phys = req_phys + offsetof(virtio_blk_request_t, header);
+    uintptr_t status_phys = req_phys + offsetof(virtio_blk_request_t, status);
     
-    if (header_phys == 0 || data_phys == 0 || status_phys == 0) {
-        virtqueue_free_desc_chain(vq, desc_idx);
-        RETURN_ERRNO(THUNDEROS_EIO);
-    }
+    /* In a table the chain simply runs in order; in the ring it follows
+     * the links left by allocation */
+    virtq_desc_t *table = indirect ? req->indirect : vq->desc;
+    uint16_t idx = indirect ? 0 : desc_idx;
     
     /* Descriptor 0: Request header (device reads) */
-    uint16_t idx0 = desc_idx;
-    uint16_t idx1 = vq->desc[idx0].next;  // Get pre-allocated next descriptor
-    uint16_t idx2 = vq->desc[idx1].next;  // Get third descriptor
-    
-    vq->desc[idx0].addr = header_phys;
-    vq->desc[idx0].len = sizeof(virtio_blk_req_header_t);
-    vq->desc[idx0].flags = VIRTQ_DESC_F_NEXT;
-    // idx0.next is already set to idx1 from allocation
-    
-    /* Descriptor 1: Data buffer (device reads for write, writes for read) */
-    vq->desc[idx1].addr = data_phys;
-    vq->desc[idx1].len = sectors * VIRTIO_BLK_SECTOR_SIZE;
-    vq->desc[idx1].flags = VIRTQ_DESC_F_NEXT;
-    if (type == VIRTIO_BLK_T_IN) {
-        vq->desc[idx1].flags |= VIRTQ_DESC_F_WRITE;
-    }
-    // idx1.next is already set to idx2 from allocation
-    
-    /* Descriptor 2: Status byte (device writes) */
-    vq->desc[idx2].addr = status_phys;
-    vq->desc[idx2].len = 1;
-    vq->desc[idx2].flags = VIRTQ_DESC_F_WRITE;  // Last descriptor, no NEXT flag
-    vq->desc[idx2].next = 0;
+    table[idx].addr = header_phys;
+    table[idx].len = sizeof(virtio_blk_req_header_t);
+    table[idx].flags = VIRTQ_DESC_F_NEXT;
+    if (indirect) {
+        table[idx].next = idx + 1;
+    }
+    
+    /* Data descriptors (device reads for write, writes for read) */
+    for (uint32_t i = 0; i < nsegs; i++) {
+        idx = table[idx].next;
+        table[idx].addr = data_phys[i];
+        table[idx].len = segs[i].len;
+        table[idx].flags = VIRTQ_DESC_F_NEXT;
+        if (type == VIRTIO_BLK_T_IN) {
+            table[idx].flags |= VIRTQ_DESC_F_WRITE;
+        }
+        if (indirect) {
+            table[idx].next = idx + 1;
+        }
+    }
+    
+    /* Last descriptor: Status byte (device writes) */
+    idx = table[idx].next;
+    table[idx].addr = status_phys;
+    table[idx].len = 1;
+    table[idx].flags = VIRTQ_DESC_F_WRITE;  // Last descriptor, no NEXT flag
+    table[idx].next = 0;
+    
+    /* The ring slot points at the table; its link stays the free list's */
+    if (indirect) {
+        vq->desc[desc_idx].addr = req_phys + offsetof(virtio_blk_request_t, indirect);
+        vq->desc[desc_idx].len = (nsegs + 2) * sizeof(virtq_desc_t);
+        vq->desc[desc_idx].flags = VIRTQ_DESC_F_INDIRECT;
+    }
+    
+    /* Counted before the device can possibly finish it */
+    vq->token[desc_idx] = req;
+    dev->in_flight++;
+    if (dev->in_flight > dev->peak_in_flight) {
+        dev->peak_in_flight = dev->in_flight;
+    }
+    if (batch) {
+        batch->pending++;
+    }
     
     /* Memory barrier - ensure descriptor writes complete */
     write_barrier();
     
-    /* Add to available ring and notify device */
+    /* Add to available ring and notify device if it is listening */
+    uint16_t old_idx = vq->avail->idx;
     virtqueue_add_to_avail(vq, desc_idx);
-    virtqueue_notify(dev, 0);
-    
-    /* Poll for completion (synchronous for now) */
-    uint32_t timeout = 1000000;
-    
-    while (timeout > 0) {
-        /* Check and acknowledge interrupt status even in polling mode */
-        uint32_t int_status = VIRTIO_READ32(dev, VIRTIO_MMIO_INTERRUPT_STATUS);
-        if (int_status) {
-            VIRTIO_WRITE32(dev, VIRTIO_MMIO_INTERRUPT_ACK, int_status);
-        }
-        
-        uint16_t used_idx;
-        uint32_t len;
-        if (virtqueue_get_used_buf(vq, &used_idx, &len) == 0) {
-            virtqueue_free_desc_chain(vq, used_idx);
-            
-            if (req->status != VIRTIO_BLK_S_OK) {
-                RETURN_ERRNO(THUNDEROS_EIO);
-            }
-            
-            clear_errno();
-            return sectors;
-        }
-        timeout--;
+    if (virtqueue_kick(vq, old_idx)) {
+        dev->notify_count++;
+    } else {
+        dev->notify_skipped++;
     }
     
-    /* Request timed out */
-    virtqueue_free_desc_chain(vq, desc_idx);
-    RETURN_ERRNO(THUNDEROS_EVIRTIO_TIMEOUT);
+    interrupt_restore(irq_state);
+    clear_errno();
+    return 0;
 }
 
 /**
@@ -306,89 +315,99 @@ int virtio_blk_init(uintptr_t base_addr, uint32_t irq)
     g_blk_device->read_count = 0;
     g_blk_device->write_count = 0;
     g_blk_device->error_count = 0;
+    g_blk_device->notify_count = 0;
+    g_blk_device->notify_skipped = 0;
+    g_blk_device->irq_count = 0;
     
-    /* Check magic value */
-    uint32_t magic = VIRTIO_READ32(g_blk_device, VIRTIO_MMIO_MAGIC_VALUE);
-    if (magic != VIRTIO_MAGIC) {
+    /* Reset, check it is a block device and agree on features */
+    if (virtio_mmio_negotiate(base_addr, VIRTIO_DEVICE_ID_BLOCK, VIRTIO_BLK_DRIVER_FEATURES,
+                              &g_blk_device->features) != 0) {
         kfree(g_blk_device);
         g_blk_device = NULL;
-        RETURN_ERRNO(THUNDEROS_EVIRTIO_BADDEV);
-    }
-    
-    /* Check device version and ID */
-    g_blk_device->version = VIRTIO_READ32(g_blk_device, VIRTIO_MMIO_VERSION);
-    g_blk_device->device_id = VIRTIO_READ32(g_blk_device, VIRTIO_MMIO_DEVICE_ID);
-    g_blk_device->vendor_id = VIRTIO_READ32(g_blk_device, VIRTIO_MMIO_VENDOR_ID);
-    
-    if (g_blk_device->device_id != VIRTIO_DEVICE_ID_BLOCK) {
-        kfree(g_blk_device);
-        g_blk_device = NULL;
-        RETURN_ERRNO(THUNDEROS_EVIRTIO_BADDEV);
-    }
-    
-    /* Reset device */
-    VIRTIO_WRITE32(g_blk_device, VIRTIO_MMIO_STATUS, 0);
-    
-    /* Device initialization sequence per VirtIO spec */
-    uint32_t status = VIRTIO_STATUS_ACKNOWLEDGE;
-    VIRTIO_WRITE32(g_blk_device, VIRTIO_MMIO_STATUS, status);
-    
-    status |= VIRTIO_STATUS_DRIVER;
-    VIRTIO_WRITE32(g_blk_device, VIRTIO_MMIO_STATUS, status);
-    
-    /* Read device features */
-    VIRTIO_WRITE32(g_blk_device, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 0);
-    uint32_t features_low = VIRTIO_READ32(g_blk_device, VIRTIO_MMIO_DEVICE_FEATURES);
-    VIRTIO_WRITE32(g_blk_device, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 1);
-    uint32_t features_high = VIRTIO_READ32(g_blk_device, VIRTIO_MMIO_DEVICE_FEATURES);
-    g_blk_device->features = ((uint64_t)features_high << 32) | features_low;
-    
-    /* Negotiate features (accept all for now) */
-    VIRTIO_WRITE32(g_blk_device, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 0);
-    VIRTIO_WRITE32(g_blk_device, VIRTIO_MMIO_DRIVER_FEATURES, features_low);
-    VIRTIO_WRITE32(g_blk_device, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 1);
-    VIRTIO_WRITE32(g_blk_device, VIRTIO_MMIO_DRIVER_FEATURES, features_high);
-    
-    status |= VIRTIO_STATUS_FEATURES_OK;
-    VIRTIO_WRITE32(g_blk_device, VIRTIO_MMIO_STATUS, status);
-    
-    /* Verify features accepted */
-    status = VIRTIO_READ32(g_blk_device, VIRTIO_MMIO_STATUS);
-    if (!(status & VIRTIO_STATUS_FEATURES_OK)) {
-        kfree(g_blk_device);
-        g_blk_device = NULL;
-        RETURN_ERRNO(THUNDEROS_EVIRTIO_BADDEV);
+        /* errno already set by virtio_mmio_negotiate */
+        return -1;
     }
+    g_blk_device->version = VIRTIO_MMIO_READ32(base_addr, VIRTIO_MMIO_VERSION);
+    g_blk_device->device_id = VIRTIO_DEVICE_ID_BLOCK;
+    g_blk_device->vendor_id = VIRTIO_MMIO_READ32(base_addr, VIRTIO_MMIO_VENDOR_ID);
     
     /* Read device configuration */
     virtio_blk_config_t *config = (virtio_blk_config_t *)(g_blk_device->base_addr + VIRTIO_MMIO_CONFIG);
     g_blk_device->capacity = config->capacity;
     g_blk_device->block_size = (config->blk_size > 0) ? config->blk_size : VIRTIO_BLK_SECTOR_SIZE;
     g_blk_device->read_only = (g_blk_device->features & VIRTIO_BLK_F_RO) ? 1 : 0;
+    g_blk_device->seg_max = VIRTIO_BLK_MAX_SEGS;
+    if ((g_blk_device->features & VIRTIO_BLK_F_SEG_MAX) && config->seg_max > 0 &&
+        config->seg_max < g_blk_device->seg_max) {
+        g_blk_device->seg_max = config->seg_max;
+    }
+    
+    /* One queue per CPU, if the device has several */
+    uint32_t num_queues = 1;
+    if ((g_blk_device->features & VIRTIO_BLK_F_MQ) && config->num_queues > 1) {
+        num_queues = config->num_queues;
+    }
+    if (num_queues > VIRTIO_BLK_MAX_QUEUES) {
+        num_queues = VIRTIO_BLK_MAX_QUEUES;
+    }
     
     /* Get maximum queue size */
-    VIRTIO_WRITE32(g_blk_device, VIRTIO_MMIO_QUEUE_SEL, 0);
-    uint32_t queue_max = VIRTIO_READ32(g_blk_device, VIRTIO_MMIO_QUEUE_NUM_MAX);
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_QUEUE_SEL, 0);
+    uint32_t queue_max = VIRTIO_MMIO_READ32(base_addr, VIRTIO_MMIO_QUEUE_NUM_MAX);
     uint32_t queue_size = (queue_max < VIRTIO_BLK_QUEUE_SIZE) ? queue_max : VIRTIO_BLK_QUEUE_SIZE;
     
-    /* Initialize virtqueue */
-    if (virtqueue_init(g_blk_device, queue_size) < 0) {
+    /* A request needs its data descriptors plus header and status, in the
+     * ring or in a table no longer than the ring */
+    if (g_blk_device->seg_max + 2 > queue_size) {
+        g_blk_device->seg_max = queue_size - 2;
+    }
+    
+    /* Initialize virtqueues; queue 0 is required, any later one that
+     * fails just leaves fewer queues */
+    int event_idx = (g_blk_device->features & VIRTIO_RING_F_EVENT_IDX) != 0;
+    if (virtqueue_init(&g_blk_device->queues[0], base_addr, 0, queue_size, event_idx) < 0) {
+        virtio_mmio_reset(base_addr);
         kfree(g_blk_device);
         g_blk_device = NULL;
         /* errno already set by virtqueue_init */
         return -1;
     }
+    g_blk_device->num_queues = 1;
+    while (g_blk_device->num_queues < num_queues &&
+           virtqueue_init(&g_blk_device->queues[g_blk_device->num_queues], base_addr,
+                          g_blk_device->num_queues, queue_size, event_idx) == 0) {
+        g_blk_device->num_queues++;
+    }
     
-    /* Set DRIVER_OK status bit */
-    status |= VIRTIO_STATUS_DRIVER_OK;
-    VIRTIO_WRITE32(g_blk_device, VIRTIO_MMIO_STATUS, status);
+    /* Pool of request structures so each I/O skips dma_alloc() */
+    g_blk_device->req_pool = dma_pool_create("virtio_blk_req", sizeof(virtio_blk_request_t), 16);
+    if (!g_blk_device->req_pool) {
+        kfree(g_blk_device);
+        g_blk_device = NULL;
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    
+    wait_queue_init(&g_blk_device->desc_waiters);
+    g_blk_device->in_flight = 0;
+    g_blk_device->peak_in_flight = 0;
+    g_blk_device->irq_ready = 0;
     
-    /* Verify device accepted DRIVER_OK */
-    uint32_t final_status = VIRTIO_READ32(g_blk_device, VIRTIO_MMIO_STATUS);
-    if (!(final_status & VIRTIO_STATUS_DRIVER_OK)) {
+    /* Set DRIVER_OK status bit */
+    if (virtio_mmio_driver_ok(base_addr) != 0) {
+        dma_pool_destroy(g_blk_device->req_pool);
         kfree(g_blk_device);
         g_blk_device = NULL;
-        RETURN_ERRNO(THUNDEROS_EVIRTIO_BADDEV);
+        /* errno already set by virtio_mmio_driver_ok */
+        return -1;
+    }
+    
+    /* From here on completions arrive by interrupt and waiters sleep;
+     * without the interrupt the driver keeps polling */
+    open_softirq(SOFTIRQ_BLOCK, virtio_blk_softirq);
+    if (irq != 0 && interrupt_register_handler(irq, virtio_blk_irq_handler, "virtio-blk")) {
+        interrupt_set_priority(irq, IRQ_PRIORITY_NORMAL);
+        interrupt_enable_irq(irq);
+        g_blk_device->irq_ready = 1;
     }
     
     clear_errno();
@@ -396,77 +415,198 @@ int virtio_blk_init(uintptr_t base_addr, uint32_t irq)
 }
 
 /**
- * Read sectors from block device
+ * Prepare a batch for requests to count against
  */
-int virtio_blk_read(uint64_t sector, void *buffer, uint32_t count)
+void virtio_blk_batch_init(virtio_blk_batch_t *batch)
+{
+    batch->pending = 0;
+    batch->error = 0;
+    wait_queue_init(&batch->waiters);
+}
+
+/**
+ * Start a read or write of consecutive sectors without waiting for it
+ */
+int virtio_blk_submit(virtio_blk_batch_t *batch, uint64_t sector,
+                      const virtio_blk_seg_t *segs, uint32_t nsegs, int write,
+                      virtio_blk_done_t done, void *arg)
 {
     if (!g_blk_device) {
         RETURN_ERRNO(THUNDEROS_EVIRTIO_NODEV);
     }
     
-    if (sector + count > g_blk_device->capacity) {
-        RETURN_ERRNO(THUNDEROS_EINVAL);
+    if (write && g_blk_device->read_only) {
+        RETURN_ERRNO(THUNDEROS_EFS_RDONLY);
     }
     
-    /* Allocate request structure from DMA memory (device needs to write status) */
-    dma_region_t *req_region = dma_alloc(sizeof(virtio_blk_request_t), DMA_ZERO);
-    if (!req_region) {
-        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    if (!segs || nsegs == 0 || nsegs > g_blk_device->seg_max) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
     }
     
-    virtio_blk_request_t *req = (virtio_blk_request_t *)req_region->virt_addr;
-    int result = virtio_blk_do_request(g_blk_device, req, sector, buffer, count, VIRTIO_BLK_T_IN);
-    
-    dma_free(req_region);
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < nsegs; i++) {
+        if (!segs[i].buf || segs[i].len == 0 || segs[i].len % VIRTIO_BLK_SECTOR_SIZE != 0) {
+            RETURN_ERRNO(THUNDEROS_EINVAL);
+        }
+        count += segs[i].len / VIRTIO_BLK_SECTOR_SIZE;
+    }
     
-    if (result > 0) {
-        g_blk_device->read_count++;
-        clear_errno();
-    } else {
-        g_blk_device->error_count++;
-        /* errno already set by virtio_blk_do_request */
+    if (sector + count > g_blk_device->capacity) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
     }
     
-    return result;
+    return virtio_blk_start(g_blk_device, batch, sector, segs, nsegs,
+                            write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN, done, arg);
 }
 
 /**
- * Write sectors to block device
+ * Wait until every request of a batch has finished
  */
-int virtio_blk_write(uint64_t sector, const void *buffer, uint32_t count)
+int virtio_blk_batch_wait(virtio_blk_batch_t *batch)
 {
-    if (!g_blk_device) {
+    virtio_blk_device_t *dev = g_blk_device;
+    if (!dev) {
         RETURN_ERRNO(THUNDEROS_EVIRTIO_NODEV);
     }
     
-    if (g_blk_device->read_only) {
-        RETURN_ERRNO(THUNDEROS_EFS_RDONLY);
+    /* Interrupts stay off from the check until we are on the queue, so a
+     * completion in between cannot be missed */
+    int irq_state = interrupt_save_disable();
+    uint64_t start_us = hal_timer_get_time_us();
+    uint32_t spins = 0;
+    while (batch->pending > 0) {
+        if (virtio_blk_can_sleep(dev)) {
+            wait_queue_sleep_irqoff(&batch->waiters);
+        } else if (virtio_blk_reap(dev) == 0 && ++spins > VIRTIO_BLK_POLL_SPINS) {
+            break;
+        }
     }
-    
-    if (sector + count > g_blk_device->capacity) {
-        RETURN_ERRNO(THUNDEROS_EINVAL);
+    acct_blk_wait(hal_timer_get_time_us() - start_us);
+    
+    if (batch->pending > 0) {
+        /* Timed out: the requests stay the driver's and free themselves if
+         * the device ever finishes them, but no longer report here */
+        for (uint32_t q = 0; q < dev->num_queues; q++) {
+            virtqueue_t *vq = &dev->queues[q];
+            for (uint32_t i = 0; i < vq->queue_size; i++) {
+                virtio_blk_request_t *req = vq->token[i];
+                if (req && req->batch == batch) {
+                    req->batch = NULL;
+                    req->done = NULL;
+                }
+            }
+        }
+        batch->pending = 0;
+        interrupt_restore(irq_state);
+        RETURN_ERRNO(THUNDEROS_EVIRTIO_TIMEOUT);
     }
+    interrupt_restore(irq_state);
     
-    /* Allocate request structure from DMA memory */
-    dma_region_t *req_region = dma_alloc(sizeof(virtio_blk_request_t), DMA_ZERO);
-    if (!req_region) {
-        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    if (batch->error) {
+        RETURN_ERRNO(THUNDEROS_EIO);
     }
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Issue one request and wait for it
+ */
+static int virtio_blk_rw(uint64_t sector, const virtio_blk_seg_t *segs, uint32_t nsegs,
+                         int write)
+{
+    virtio_blk_batch_t batch;
+    virtio_blk_batch_init(&batch);
     
-    virtio_blk_request_t *req = (virtio_blk_request_t *)req_region->virt_addr;
-    int result = virtio_blk_do_request(g_blk_device, req, sector, (void *)buffer, count, VIRTIO_BLK_T_OUT);
-    
-    dma_free(req_region);
+    if (virtio_blk_submit(&batch, sector, segs, nsegs, write, NULL, NULL) != 0) {
+        /* errno already set by virtio_blk_submit */
+        return -1;
+    }
     
-    if (result > 0) {
-        g_blk_device->write_count++;
-        clear_errno();
-    } else {
-        g_blk_device->error_count++;
-        /* errno already set by virtio_blk_do_request */
+    uint32_t sectors = 0;
+    for (uint32_t i = 0; i < nsegs; i++) {
+        sectors += segs[i].len / VIRTIO_BLK_SECTOR_SIZE;
     }
+    acct_blk_io((uint64_t)sectors * VIRTIO_BLK_SECTOR_SIZE, write);
     
-    return result;
+    if (virtio_blk_batch_wait(&batch) != 0) {
+        /* errno already set by virtio_blk_batch_wait */
+        return -1;
+    }
+    return sectors;
+}
+
+/**
+ * Read sectors from block device
+ */
+int virtio_blk_read(uint64_t sector, void *buffer, uint32_t count)
+{
+    virtio_blk_seg_t seg = { buffer, count * VIRTIO_BLK_SECTOR_SIZE };
+    return virtio_blk_rw(sector, &seg, 1, 0);
+}
+
+/**
+ * Write sectors to block device
+ */
+int virtio_blk_write(uint64_t sector, const void *buffer, uint32_t count)
+{
+    virtio_blk_seg_t seg = { (void *)buffer, count * VIRTIO_BLK_SECTOR_SIZE };
+    return virtio_blk_rw(sector, &seg, 1, 1);
+}
+
+/**
+ * Read consecutive sectors into a list of buffers with one request
+ */
+int virtio_blk_read_segs(uint64_t sector, const virtio_blk_seg_t *segs, uint32_t nsegs)
+{
+    return virtio_blk_rw(sector, segs, nsegs, 0);
+}
+
+/**
+ * Write consecutive sectors from a list of buffers with one request
+ */
+int virtio_blk_write_segs(uint64_t sector, const virtio_blk_seg_t *segs, uint32_t nsegs)
+{
+    return virtio_blk_rw(sector, segs, nsegs, 1);
+}
+
+/**
+ * Get the most data segments one request may carry
+ */
+uint32_t virtio_blk_get_max_segments(void)
+{
+    return g_blk_device ? g_blk_device->seg_max : 0;
+}
+
+/**
+ * Check whether a request starts without waiting for descriptors
+ */
+int virtio_blk_has_room(uint32_t nsegs)
+{
+    if (!g_blk_device) {
+        return 0;
+    }
+    int irq_state = interrupt_save_disable();
+    int room = virtio_blk_this_queue(g_blk_device)->num_free >=
+               virtio_blk_descs(g_blk_device, nsegs);
+    interrupt_restore(irq_state);
+    return room;
+}
+
+/**
+ * Check whether the caller may sleep for a completion
+ */
+int virtio_blk_can_wait(void)
+{
+    return g_blk_device && virtio_blk_can_sleep(g_blk_device);
+}
+
+/**
+ * Finish requests the device has completed
+ */
+int virtio_blk_poll(void)
+{
+    return g_blk_device ? virtio_blk_reap(g_blk_device) : 0;
 }
 
 /**
@@ -483,10 +623,14 @@ int virtio_blk_flush(void)
         return 0;
     }
     
-    virtio_blk_request_t req;
-    int result = virtio_blk_do_request(g_blk_device, &req, 0, NULL, 0, VIRTIO_BLK_T_FLUSH);
-    /* errno already set by virtio_blk_do_request if failed */
-    return result;
+    virtio_blk_batch_t batch;
+    virtio_blk_batch_init(&batch);
+    if (virtio_blk_start(g_blk_device, &batch, 0, NULL, 0, VIRTIO_BLK_T_FLUSH, NULL, NULL) != 0) {
+        /* errno already set by virtio_blk_start */
+        return -1;
+    }
+    /* errno already set by virtio_blk_batch_wait if failed */
+    return virtio_blk_batch_wait(&batch);
 }
 
 /**
@@ -522,11 +666,10 @@ void virtio_blk_irq_handler(void)
         return;
     }
     
-    /* Read and acknowledge interrupt */
-    uint32_t int_status = VIRTIO_READ32(g_blk_device, VIRTIO_MMIO_INTERRUPT_STATUS);
-    VIRTIO_WRITE32(g_blk_device, VIRTIO_MMIO_INTERRUPT_ACK, int_status);
-    
-    /* TODO: Process used buffers asynchronously */
+    /* Acknowledge now; the completions are reaped on the way out of the trap */
+    g_blk_device->irq_count++;
+    virtio_mmio_ack_interrupt(g_blk_device->base_addr);
+    raise_softirq(SOFTIRQ_BLOCK);
 }
 
 /**
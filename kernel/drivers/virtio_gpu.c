@@ -6,14 +6,21 @@
  */
 
 #include <drivers/virtio_gpu.h>
-#include <drivers/virtio_blk.h>  /* For MMIO register offsets */
+#include <drivers/virtqueue.h>   /* For MMIO register offsets */
 #include <mm/dma.h>
 #include <mm/paging.h>
 #include <mm/kmalloc.h>
 #include <arch/barrier.h>
+#include <arch/interrupt.h>
 #include <hal/hal_uart.h>
 #include <kernel/errno.h>
 #include <kernel/constants.h>
+#include <kernel/kstring.h>
+#include <kernel/mutex.h>
+#include <kernel/process.h>
+#include <kernel/softirq.h>
+#include <kernel/spinlock.h>
+#include <kernel/wait_queue.h>
 #include <stddef.h>
 
 /* Helper macros for MMIO register access */
@@ -30,6 +37,21 @@ static virtio_gpu_device_t *g_gpu_device = NULL;
 static dma_region_t *g_cmd_region = NULL;
 static dma_region_t *g_resp_region = NULL;
 
+/* The command regions are cut into slots, one per command of a flush;
+   the synchronous setup commands use slot 0 */
+#define GPU_SLOT_SIZE       128
+#define GPU_FLUSH_SLOTS     5       /* Up to three transfers, a flip and the flush */
+#define GPU_POLL_SPINS      1000000 /* Polls for a completion before giving up */
+
+#define gpu_cmd_slot(i)     ((uint8_t *)g_cmd_region->virt_addr + (i) * GPU_SLOT_SIZE)
+#define gpu_resp_slot(i)    ((uint8_t *)g_resp_region->virt_addr + (i) * GPU_SLOT_SIZE)
+
+/* Guards the control queue against the interrupt handler */
+static spinlock_t g_gpu_lock = SPINLOCK_INIT;
+
+/* One flush builds its commands at a time */
+static mutex_t g_flush_lock = MUTEX_INIT;
+
 /* Forward declarations */
 static int gpu_queue_init(virtio_gpu_device_t *dev, virtio_gpu_queue_t *vq, 
                           uint32_t queue_idx, uint32_t queue_size);
@@ -40,9 +62,11 @@ static int gpu_create_resource(uint32_t resource_id, uint32_t format,
 static int gpu_attach_backing(uint32_t resource_id, uintptr_t phys_addr, size_t size);
 static int gpu_set_scanout(uint32_t scanout_id, uint32_t resource_id,
                            uint32_t width, uint32_t height);
-static int gpu_transfer_to_host(uint32_t resource_id, uint32_t x, uint32_t y,
-                                uint32_t width, uint32_t height);
-static int gpu_resource_flush(uint32_t resource_id, uint32_t x, uint32_t y,
+static int gpu_queue_scanout(uint32_t slot, uint32_t scanout_id, uint32_t resource_id,
+                             uint32_t width, uint32_t height);
+static int gpu_transfer_to_host(uint32_t slot, uint32_t x, uint32_t y,
+                                uint32_t width, uint32_t height, uint64_t offset);
+static int gpu_resource_flush(uint32_t slot, uint32_t x, uint32_t y,
                               uint32_t width, uint32_t height);
 
 /**
@@ -118,29 +142,40 @@ static int gpu_queue_init(virtio_gpu_device_t *dev, virtio_gpu_queue_t *vq,
 }
 
 /**
- * Send a command to the GPU and wait for response
+ * Physical address of a buffer inside a DMA region, without a page walk
  */
-static int gpu_send_command(void *cmd, size_t cmd_size, void *resp, size_t resp_size)
+static uintptr_t gpu_dma_phys(dma_region_t *region, void *ptr)
 {
-    if (!g_gpu_device) {
-        RETURN_ERRNO(THUNDEROS_ENODEV);
+    uintptr_t offset = (uintptr_t)ptr - (uintptr_t)region->virt_addr;
+    if (offset < region->size) {
+        return region->phys_addr + offset;
     }
-    
+    return translate_virt_to_phys((uintptr_t)ptr);
+}
+
+/**
+ * Queue a command without notifying the device or waiting for it
+ */
+static int gpu_submit(void *cmd, size_t cmd_size, void *resp, size_t resp_size)
+{
     virtio_gpu_queue_t *vq = &g_gpu_device->controlq;
     
-    /* Check we have enough free descriptors */
-    if (vq->num_free < 2) {
-        RETURN_ERRNO(THUNDEROS_EBUSY);
-    }
-    
-    /* Get physical addresses */
-    uintptr_t cmd_phys = translate_virt_to_phys((uintptr_t)cmd);
-    uintptr_t resp_phys = translate_virt_to_phys((uintptr_t)resp);
+    /* Commands and responses live in the preallocated DMA regions */
+    uintptr_t cmd_phys = gpu_dma_phys(g_cmd_region, cmd);
+    uintptr_t resp_phys = gpu_dma_phys(g_resp_region, resp);
     
     if (cmd_phys == 0 || resp_phys == 0) {
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
     
+    int irq_state = spin_lock_irqsave(&g_gpu_lock);
+    
+    /* Check we have enough free descriptors */
+    if (vq->num_free < 2) {
+        spin_unlock_irqrestore(&g_gpu_lock, irq_state);
+        RETURN_ERRNO(THUNDEROS_EBUSY);
+    }
+    
     /* Allocate two descriptors */
     uint16_t desc0 = vq->free_head;
     uint16_t desc1 = vq->desc[desc0].next;
@@ -167,52 +202,132 @@ static int gpu_send_command(void *cmd, size_t cmd_size, void *resp, size_t resp_
     vq->avail->ring[avail_idx] = desc0;
     write_barrier();
     vq->avail->idx++;
+    g_gpu_device->in_flight++;
     
-    /* Notify device */
+    spin_unlock_irqrestore(&g_gpu_lock, irq_state);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Tell the device about the commands queued so far
+ */
+static void gpu_kick(void)
+{
     write_barrier();
     GPU_WRITE32(g_gpu_device, VIRTIO_MMIO_QUEUE_NOTIFY, VIRTIO_GPU_QUEUE_CONTROL);
     write_barrier();
+}
+
+/**
+ * Finish every command the device has completed
+ * 
+ * Runs from the interrupt handler, or from a waiter that polls. A
+ * command the device failed is counted in error_count; whoever waits
+ * for it reads its response too.
+ * 
+ * @return Number of commands finished
+ */
+static int gpu_reap(void)
+{
+    virtio_gpu_queue_t *vq = &g_gpu_device->controlq;
+    int reaped = 0;
+    
+    int irq_state = spin_lock_irqsave(&g_gpu_lock);
+    
+    /* Acknowledge first so a completion after the scan raises a new interrupt */
+    uint32_t int_status = GPU_READ32(g_gpu_device, VIRTIO_MMIO_INTERRUPT_STATUS);
+    if (int_status) {
+        GPU_WRITE32(g_gpu_device, VIRTIO_MMIO_INTERRUPT_ACK, int_status);
+    }
     
-    /* Poll for completion */
-    uint32_t timeout = 1000000;
-    while (timeout > 0) {
-        /* Check interrupt status */
-        uint32_t int_status = GPU_READ32(g_gpu_device, VIRTIO_MMIO_INTERRUPT_STATUS);
-        if (int_status) {
-            GPU_WRITE32(g_gpu_device, VIRTIO_MMIO_INTERRUPT_ACK, int_status);
+    read_barrier();
+    while (vq->last_seen_used != *(volatile uint16_t *)&vq->used->idx) {
+        read_barrier();
+        uint16_t desc0 = (uint16_t)vq->used->ring[vq->last_seen_used % vq->queue_size].id;
+        uint16_t desc1 = vq->desc[desc0].next;
+        vq->last_seen_used++;
+        
+        /* Check response type */
+        uintptr_t resp_offset = vq->desc[desc1].addr - g_resp_region->phys_addr;
+        virtio_gpu_ctrl_hdr_t *hdr =
+            (virtio_gpu_ctrl_hdr_t *)((uint8_t *)g_resp_region->virt_addr + resp_offset);
+        if (hdr->type >= VIRTIO_GPU_RESP_ERR_UNSPEC) {
+            g_gpu_device->error_count++;
         }
         
-        read_barrier();
-        if (vq->last_seen_used != vq->used->idx) {
-            /* Got completion */
-            vq->last_seen_used++;
-            
-            /* Return descriptors to free list */
-            vq->desc[desc1].next = vq->free_head;
-            vq->desc[desc0].next = desc1;
-            vq->free_head = desc0;
-            vq->num_free += 2;
-            
-            /* Check response type */
-            virtio_gpu_ctrl_hdr_t *hdr = (virtio_gpu_ctrl_hdr_t *)resp;
-            if (hdr->type >= VIRTIO_GPU_RESP_ERR_UNSPEC) {
-                g_gpu_device->error_count++;
-                RETURN_ERRNO(THUNDEROS_EIO);
-            }
-            
-            clear_errno();
-            return 0;
+        /* Return descriptors to free list */
+        vq->desc[desc1].next = vq->free_head;
+        vq->free_head = desc0;
+        vq->num_free += 2;
+        g_gpu_device->in_flight--;
+        reaped++;
+    }
+    
+    spin_unlock_irqrestore(&g_gpu_lock, irq_state);
+    
+    if (reaped > 0 && g_gpu_device->in_flight == 0) {
+        wait_queue_wake(&g_gpu_device->idle_waiters);
+    }
+    return reaped;
+}
+
+/**
+ * Wait until the device has finished every queued command
+ * 
+ * Sleeps when the completion interrupt is wired up and the caller is a
+ * process; polls otherwise.
+ */
+static int gpu_wait_idle(void)
+{
+    uint32_t spins = 0;
+    int irq_state = interrupt_save_disable();
+    
+    while (g_gpu_device->in_flight > 0) {
+        if (g_gpu_device->irq_ready && process_current() != NULL && !in_softirq()) {
+            wait_queue_sleep_irqoff(&g_gpu_device->idle_waiters);
+        } else if (gpu_reap() == 0 && ++spins > GPU_POLL_SPINS) {
+            interrupt_restore(irq_state);
+            RETURN_ERRNO(THUNDEROS_EVIRTIO_TIMEOUT);
         }
-        timeout--;
     }
     
-    /* Return descriptors on timeout */
-    vq->desc[desc1].next = vq->free_head;
-    vq->desc[desc0].next = desc1;
-    vq->free_head = desc0;
-    vq->num_free += 2;
+    interrupt_restore(irq_state);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Check the response of a finished command
+ */
+static int gpu_check_response(void *resp)
+{
+    virtio_gpu_ctrl_hdr_t *hdr = (virtio_gpu_ctrl_hdr_t *)resp;
+    if (hdr->type >= VIRTIO_GPU_RESP_ERR_UNSPEC) {
+        RETURN_ERRNO(THUNDEROS_EIO);
+    }
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Send a command to the GPU and wait for response
+ */
+static int gpu_send_command(void *cmd, size_t cmd_size, void *resp, size_t resp_size)
+{
+    if (!g_gpu_device) {
+        RETURN_ERRNO(THUNDEROS_ENODEV);
+    }
     
-    RETURN_ERRNO(THUNDEROS_EVIRTIO_TIMEOUT);
+    /* The command buffers are shared: let earlier commands finish first */
+    if (gpu_wait_idle() < 0 || gpu_submit(cmd, cmd_size, resp, resp_size) < 0) {
+        return -1;  /* errno already set */
+    }
+    gpu_kick();
+    if (gpu_wait_idle() < 0) {
+        return -1;  /* errno already set by gpu_wait_idle */
+    }
+    return gpu_check_response(resp);
 }
 
 /**
@@ -309,13 +424,15 @@ static int gpu_attach_backing(uint32_t resource_id, uintptr_t phys_addr, size_t
 }
 
 /**
- * Set scanout (connect resource to display)
+ * Queue a set scanout (connect resource to display)
+ * 
+ * @param slot Command buffer slot to build it in (below GPU_FLUSH_SLOTS)
  */
-static int gpu_set_scanout(uint32_t scanout_id, uint32_t resource_id,
-                           uint32_t width, uint32_t height)
+static int gpu_queue_scanout(uint32_t slot, uint32_t scanout_id, uint32_t resource_id,
+                             uint32_t width, uint32_t height)
 {
     virtio_gpu_set_scanout_t *cmd = 
-        (virtio_gpu_set_scanout_t *)g_cmd_region->virt_addr;
+        (virtio_gpu_set_scanout_t *)gpu_cmd_slot(slot);
     
     cmd->hdr.type = VIRTIO_GPU_CMD_SET_SCANOUT;
     cmd->hdr.flags = 0;
@@ -329,19 +446,39 @@ static int gpu_set_scanout(uint32_t scanout_id, uint32_t resource_id,
     cmd->scanout_id = scanout_id;
     cmd->resource_id = resource_id;
     
-    virtio_gpu_ctrl_hdr_t *resp = (virtio_gpu_ctrl_hdr_t *)g_resp_region->virt_addr;
-    
-    return gpu_send_command(cmd, sizeof(*cmd), resp, sizeof(*resp));
+    return gpu_submit(cmd, sizeof(*cmd), gpu_resp_slot(slot), sizeof(virtio_gpu_ctrl_hdr_t));
+}
+
+/**
+ * Set scanout and wait for it
+ */
+static int gpu_set_scanout(uint32_t scanout_id, uint32_t resource_id,
+                           uint32_t width, uint32_t height)
+{
+    if (gpu_wait_idle() < 0 ||
+        gpu_queue_scanout(0, scanout_id, resource_id, width, height) < 0) {
+        return -1;  /* errno already set */
+    }
+    gpu_kick();
+    if (gpu_wait_idle() < 0) {
+        return -1;  /* errno already set by gpu_wait_idle */
+    }
+    return gpu_check_response(gpu_resp_slot(0));
 }
 
 /**
- * Transfer framebuffer data to host
+ * Queue a transfer of framebuffer data to host
+ * 
+ * offset is where the rectangle's first pixel is in the backing; the
+ * host takes the rows after it at the resource's stride.
+ * 
+ * @param slot Command buffer slot to build it in (below GPU_FLUSH_SLOTS)
  */
-static int gpu_transfer_to_host(uint32_t resource_id, uint32_t x, uint32_t y,
-                                uint32_t width, uint32_t height)
+static int gpu_transfer_to_host(uint32_t slot, uint32_t x, uint32_t y,
+                                uint32_t width, uint32_t height, uint64_t offset)
 {
     virtio_gpu_transfer_to_host_2d_t *cmd = 
-        (virtio_gpu_transfer_to_host_2d_t *)g_cmd_region->virt_addr;
+        (virtio_gpu_transfer_to_host_2d_t *)gpu_cmd_slot(slot);
     
     cmd->hdr.type = VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D;
     cmd->hdr.flags = 0;
@@ -352,23 +489,23 @@ static int gpu_transfer_to_host(uint32_t resource_id, uint32_t x, uint32_t y,
     cmd->r.y = y;
     cmd->r.width = width;
     cmd->r.height = height;
-    cmd->offset = 0;
-    cmd->resource_id = resource_id;
+    cmd->offset = offset;
+    cmd->resource_id = g_gpu_device->resource_id;
     cmd->padding = 0;
     
-    virtio_gpu_ctrl_hdr_t *resp = (virtio_gpu_ctrl_hdr_t *)g_resp_region->virt_addr;
-    
-    return gpu_send_command(cmd, sizeof(*cmd), resp, sizeof(*resp));
+    return gpu_submit(cmd, sizeof(*cmd), gpu_resp_slot(slot), sizeof(virtio_gpu_ctrl_hdr_t));
 }
 
 /**
- * Flush resource to display
+ * Queue a flush of the resource to the display
+ * 
+ * @param slot Command buffer slot to build it in (below GPU_FLUSH_SLOTS)
  */
-static int gpu_resource_flush(uint32_t resource_id, uint32_t x, uint32_t y,
+static int gpu_resource_flush(uint32_t slot, uint32_t x, uint32_t y,
                               uint32_t width, uint32_t height)
 {
     virtio_gpu_resource_flush_t *cmd = 
-        (virtio_gpu_resource_flush_t *)g_cmd_region->virt_addr;
+        (virtio_gpu_resource_flush_t *)gpu_cmd_slot(slot);
     
     cmd->hdr.type = VIRTIO_GPU_CMD_RESOURCE_FLUSH;
     cmd->hdr.flags = 0;
@@ -379,18 +516,27 @@ static int gpu_resource_flush(uint32_t resource_id, uint32_t x, uint32_t y,
     cmd->r.y = y;
     cmd->r.width = width;
     cmd->r.height = height;
-    cmd->resource_id = resource_id;
+    cmd->resource_id = g_gpu_device->resource_id;
     cmd->padding = 0;
     
-    virtio_gpu_ctrl_hdr_t *resp = (virtio_gpu_ctrl_hdr_t *)g_resp_region->virt_addr;
-    
-    return gpu_send_command(cmd, sizeof(*cmd), resp, sizeof(*resp));
+    return gpu_submit(cmd, sizeof(*cmd), gpu_resp_slot(slot), sizeof(virtio_gpu_ctrl_hdr_t));
 }
 
 /* ============================================================================
  * Public API Implementation
  * ============================================================================ */
 
+/**
+ * Make buffer back the one drawn into, the other the one on the scanout
+ */
+static void gpu_set_back(uint32_t back)
+{
+    g_gpu_device->front = (uint8_t)(back ^ 1);
+    g_gpu_device->fb_pixels = g_gpu_device->buffers[back];
+    g_gpu_device->fb_phys = g_gpu_device->buffers_phys[back];
+    g_gpu_device->resource_id = back + 1;
+}
+
 /**
  * Initialize VirtIO GPU device
  */
@@ -410,6 +556,7 @@ int virtio_gpu_init(uintptr_t base_addr, uint32_t irq)
     
     g_gpu_device->base_addr = base_addr;
     g_gpu_device->irq = irq;
+    wait_queue_init(&g_gpu_device->idle_waiters);
     
     /* Check magic value */
     uint32_t magic = GPU_READ32(g_gpu_device, VIRTIO_MMIO_MAGIC_VALUE);
@@ -525,9 +672,19 @@ int virtio_gpu_init(uintptr_t base_addr, uint32_t irq)
         RETURN_ERRNO(THUNDEROS_ENOMEM);
     }
     
-    g_gpu_device->fb_pixels = (uint32_t *)fb_region->virt_addr;
-    g_gpu_device->fb_phys = fb_region->phys_addr;
+    /* A second buffer to draw into while the first is shown; without the
+       memory for it, drawing goes to the one on the screen */
+    dma_region_t *back_region = dma_alloc(g_gpu_device->fb_size, DMA_ZERO);
+    
+    g_gpu_device->buffers[0] = (uint32_t *)fb_region->virt_addr;
+    g_gpu_device->buffers_phys[0] = fb_region->phys_addr;
+    g_gpu_device->fb_pixels = g_gpu_device->buffers[0];
+    g_gpu_device->fb_phys = g_gpu_device->buffers_phys[0];
     g_gpu_device->resource_id = 1;
+    g_gpu_device->front = 0;
+    g_gpu_device->double_buffered = 0;
+    g_gpu_device->scroll_height = 0;
+    g_gpu_device->scroll_origin = 0;
     
     /* Create GPU resource */
     if (gpu_create_resource(g_gpu_device->resource_id, g_gpu_device->fb_format,
@@ -550,6 +707,20 @@ int virtio_gpu_init(uintptr_t base_addr, uint32_t irq)
         goto fail;
     }
     
+    /* The second buffer gets resource 2 and is drawn into first */
+    if (back_region &&
+        gpu_create_resource(2, g_gpu_device->fb_format,
+                            g_gpu_device->fb_width, g_gpu_device->fb_height) == 0 &&
+        gpu_attach_backing(2, back_region->phys_addr, g_gpu_device->fb_size) == 0) {
+        g_gpu_device->buffers[1] = (uint32_t *)back_region->virt_addr;
+        g_gpu_device->buffers_phys[1] = back_region->phys_addr;
+        g_gpu_device->double_buffered = 1;
+        gpu_set_back(1);
+    } else if (back_region) {
+        hal_uart_puts("[GPU] Warning: no second buffer, drawing on screen\n");
+        dma_free(back_region);
+    }
+    
     hal_uart_puts("[GPU] VirtIO GPU initialized: ");
     /* Print dimensions - simple decimal printing */
     char buf[16];
@@ -577,10 +748,21 @@ int virtio_gpu_init(uintptr_t base_addr, uint32_t irq)
     }
     hal_uart_puts("\n");
     
+    /* From here on flushes finish by interrupt and do not wait; without
+     * the interrupt they poll as before. Reaping runs in the IRQ's
+     * thread, so a large batch of completions does not hold up the
+     * timer. */
+    if (irq != 0 && interrupt_register_threaded(irq, NULL, virtio_gpu_irq_handler, "virtio-gpu")) {
+        interrupt_set_priority(irq, IRQ_PRIORITY_NORMAL);
+        interrupt_enable_irq(irq);
+        g_gpu_device->irq_ready = 1;
+    }
+    
     clear_errno();
     return 0;
     
 fail:
+    if (back_region) dma_free(back_region);
     dma_free(fb_region);
     dma_free(g_cmd_region);
     dma_free(g_resp_region);
@@ -616,6 +798,112 @@ int virtio_gpu_get_display_info(uint32_t *width, uint32_t *height)
     return 0;
 }
 
+/**
+ * Backing row holding screen row y
+ */
+static inline uint32_t gpu_backing_row(uint32_t y)
+{
+    if (y >= g_gpu_device->scroll_height) return y;
+    y += g_gpu_device->scroll_origin;
+    if (y >= g_gpu_device->scroll_height) y -= g_gpu_device->scroll_height;
+    return y;
+}
+
+/**
+ * Queue transfers of screen rows [y, y + height) to the host resource
+ * 
+ * The host copies each row from where the transfer's offset says it is in
+ * the backing, so a run of ring rows that wraps takes two transfers, and
+ * rows below the ring a third. They use slots from 0 up.
+ * 
+ * @return Number of transfers queued, or -1 on error (errno set)
+ */
+static int gpu_transfer_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    uint64_t stride = (uint64_t)g_gpu_device->fb_width * 4;
+    uint32_t slot = 0;
+    
+    while (height > 0) {
+        uint32_t row = gpu_backing_row(y);
+        uint32_t run = height;
+        if (y < g_gpu_device->scroll_height) {
+            /* Up to the end of the region or of the backing ring */
+            uint32_t to_wrap = g_gpu_device->scroll_height - row;
+            uint32_t to_end = g_gpu_device->scroll_height - y;
+            if (to_wrap < to_end) to_end = to_wrap;
+            if (run > to_end) run = to_end;
+        }
+        if (gpu_transfer_to_host(slot++, x, y, width, run,
+                                 row * stride + (uint64_t)x * 4) < 0) {
+            return -1;
+        }
+        y += run;
+        height -= run;
+    }
+    return (int)slot;
+}
+
+/**
+ * Swap two backing rows, in both buffers (they share one ring layout)
+ */
+static void gpu_swap_rows(uint32_t a, uint32_t b)
+{
+    uint32_t count = g_gpu_device->double_buffered ? 2 : 1;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t *pixels = g_gpu_device->buffers[i];
+        uint32_t *ra = &pixels[a * g_gpu_device->fb_width];
+        uint32_t *rb = &pixels[b * g_gpu_device->fb_width];
+        for (uint32_t x = 0; x < g_gpu_device->fb_width; x++) {
+            uint32_t tmp = ra[x];
+            ra[x] = rb[x];
+            rb[x] = tmp;
+        }
+    }
+}
+
+/**
+ * Reverse the backing rows [first, last)
+ */
+static void gpu_reverse_rows(uint32_t first, uint32_t last)
+{
+    while (first + 1 < last) {
+        gpu_swap_rows(first++, --last);
+    }
+}
+
+/**
+ * Scroll the top of the screen up
+ */
+int virtio_gpu_scroll(uint32_t height, uint32_t lines)
+{
+    if (!g_gpu_device || !g_gpu_device->fb_pixels) {
+        RETURN_ERRNO(THUNDEROS_ENODEV);
+    }
+    if (height > g_gpu_device->fb_height) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    if (height != g_gpu_device->scroll_height) {
+        /* Rotate the old ring back into screen order (three reversals) */
+        uint32_t old = g_gpu_device->scroll_height;
+        uint32_t origin = g_gpu_device->scroll_origin;
+        if (origin != 0) {
+            gpu_reverse_rows(0, origin);
+            gpu_reverse_rows(origin, old);
+            gpu_reverse_rows(0, old);
+        }
+        g_gpu_device->scroll_height = height;
+        g_gpu_device->scroll_origin = 0;
+    }
+    
+    if (height > 0) {
+        g_gpu_device->scroll_origin = (g_gpu_device->scroll_origin + lines) % height;
+    }
+    
+    clear_errno();
+    return 0;
+}
+
 /**
  * Set a pixel in the framebuffer
  */
@@ -630,7 +918,7 @@ void virtio_gpu_set_pixel(uint32_t x, uint32_t y, uint32_t color)
     uint8_t b = color & 0xFF;
     uint32_t bgrx = (r << 16) | (g << 8) | b;
     
-    g_gpu_device->fb_pixels[y * g_gpu_device->fb_width + x] = bgrx;
+    g_gpu_device->fb_pixels[gpu_backing_row(y) * g_gpu_device->fb_width + x] = bgrx;
 }
 
 /**
@@ -641,7 +929,7 @@ uint32_t virtio_gpu_get_pixel(uint32_t x, uint32_t y)
     if (!g_gpu_device || !g_gpu_device->fb_pixels) return 0;
     if (x >= g_gpu_device->fb_width || y >= g_gpu_device->fb_height) return 0;
     
-    uint32_t bgrx = g_gpu_device->fb_pixels[y * g_gpu_device->fb_width + x];
+    uint32_t bgrx = g_gpu_device->fb_pixels[gpu_backing_row(y) * g_gpu_device->fb_width + x];
     /* Convert BGRX back to ARGB */
     uint8_t r = (bgrx >> 16) & 0xFF;
     uint8_t g = (bgrx >> 8) & 0xFF;
@@ -650,24 +938,117 @@ uint32_t virtio_gpu_get_pixel(uint32_t x, uint32_t y)
 }
 
 /**
- * Clear the framebuffer
+ * Write a run of pixels to one row
  */
-void virtio_gpu_clear(uint32_t color)
+void virtio_gpu_write_span(uint32_t x, uint32_t y, const uint32_t *pixels, uint32_t count)
 {
     if (!g_gpu_device || !g_gpu_device->fb_pixels) return;
+    if (x >= g_gpu_device->fb_width || y >= g_gpu_device->fb_height) return;
+    if (count > g_gpu_device->fb_width - x) count = g_gpu_device->fb_width - x;
     
-    /* Convert ARGB to BGRX */
-    uint8_t r = (color >> 16) & 0xFF;
-    uint8_t g = (color >> 8) & 0xFF;
-    uint8_t b = color & 0xFF;
-    uint32_t bgrx = (r << 16) | (g << 8) | b;
+    uint32_t *dst = &g_gpu_device->fb_pixels[gpu_backing_row(y) * g_gpu_device->fb_width + x];
+    for (uint32_t i = 0; i < count; i++) {
+        dst[i] = pixels[i];
+    }
+}
+
+/**
+ * Clip a rectangle to the screen
+ * 
+ * @return 0 if nothing of it is on the screen
+ */
+static int gpu_clip(uint32_t x, uint32_t y, uint32_t *width, uint32_t *height)
+{
+    if (x >= g_gpu_device->fb_width || y >= g_gpu_device->fb_height) return 0;
+    if (*width > g_gpu_device->fb_width - x) *width = g_gpu_device->fb_width - x;
+    if (*height > g_gpu_device->fb_height - y) *height = g_gpu_device->fb_height - y;
+    return *width > 0 && *height > 0;
+}
+
+/**
+ * Start of screen row y in the framebuffer
+ */
+static inline uint32_t *gpu_row(uint32_t y)
+{
+    return &g_gpu_device->fb_pixels[gpu_backing_row(y) * g_gpu_device->fb_width];
+}
+
+/**
+ * Fill a rectangle with a color
+ */
+void virtio_gpu_fill_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                          uint32_t color)
+{
+    if (!g_gpu_device || !g_gpu_device->fb_pixels) return;
+    if (!gpu_clip(x, y, &width, &height)) return;
     
-    uint32_t num_pixels = g_gpu_device->fb_width * g_gpu_device->fb_height;
-    for (uint32_t i = 0; i < num_pixels; i++) {
-        g_gpu_device->fb_pixels[i] = bgrx;
+    /* ARGB to BGRX */
+    uint32_t bgrx = color & 0x00FFFFFF;
+    for (uint32_t row = y; row < y + height; row++) {
+        kmemset32(gpu_row(row) + x, bgrx, width);
     }
 }
 
+/**
+ * Copy a rectangle of pixels onto the screen
+ */
+void virtio_gpu_blit(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                     const uint32_t *src, uint32_t src_stride)
+{
+    if (!g_gpu_device || !g_gpu_device->fb_pixels || !src) return;
+    if (!gpu_clip(x, y, &width, &height)) return;
+    
+    for (uint32_t row = 0; row < height; row++) {
+        kmemcpy(gpu_row(y + row) + x, src + (size_t)row * src_stride,
+                (size_t)width * sizeof(uint32_t));
+    }
+}
+
+/**
+ * Move a rectangle of the screen
+ */
+void virtio_gpu_copy_rect(uint32_t dst_x, uint32_t dst_y, uint32_t src_x, uint32_t src_y,
+                          uint32_t width, uint32_t height)
+{
+    if (!g_gpu_device || !g_gpu_device->fb_pixels) return;
+    if (!gpu_clip(src_x, src_y, &width, &height)) return;
+    if (!gpu_clip(dst_x, dst_y, &width, &height)) return;
+    
+    /* Rows are taken before they are written over: moving down, go from
+       the bottom; within a row, moving right, go from the right */
+    int down = dst_y > src_y;
+    for (uint32_t i = 0; i < height; i++) {
+        uint32_t row = down ? height - 1 - i : i;
+        uint32_t *dst = gpu_row(dst_y + row) + dst_x;
+        const uint32_t *src = gpu_row(src_y + row) + src_x;
+        
+        if (dst == src) continue;
+        if (dst > src && dst < src + width) {
+            for (uint32_t col = width; col-- > 0; ) {
+                dst[col] = src[col];
+            }
+        } else if (src > dst && src < dst + width) {
+            for (uint32_t col = 0; col < width; col++) {
+                dst[col] = src[col];
+            }
+        } else {
+            kmemcpy(dst, src, (size_t)width * sizeof(uint32_t));
+        }
+    }
+}
+
+/**
+ * Clear the framebuffer
+ */
+void virtio_gpu_clear(uint32_t color)
+{
+    if (!g_gpu_device || !g_gpu_device->fb_pixels) return;
+    
+    /* Every row is cleared, so where the ring put each does not matter */
+    kmemset32(g_gpu_device->fb_pixels, color & 0x00FFFFFF,
+              (size_t)g_gpu_device->fb_width * g_gpu_device->fb_height);
+}
+
 /**
  * Flush framebuffer to display
  */
@@ -677,21 +1058,75 @@ int virtio_gpu_flush(void)
         RETURN_ERRNO(THUNDEROS_ENODEV);
     }
     
-    /* Transfer to host */
-    if (gpu_transfer_to_host(g_gpu_device->resource_id, 0, 0,
-                             g_gpu_device->fb_width, g_gpu_device->fb_height) < 0) {
-        return -1;
+    return virtio_gpu_flush_region(0, 0, g_gpu_device->fb_width, g_gpu_device->fb_height);
+}
+
+/**
+ * Copy screen rectangle from one buffer to the other
+ */
+static void gpu_copy_rect(uint32_t *dst, const uint32_t *src, uint32_t x, uint32_t y,
+                          uint32_t width, uint32_t height)
+{
+    for (uint32_t row = y; row < y + height; row++) {
+        size_t start = (size_t)gpu_backing_row(row) * g_gpu_device->fb_width + x;
+        for (uint32_t i = 0; i < width; i++) {
+            dst[start + i] = src[start + i];
+        }
+    }
+}
+
+/**
+ * Queue the transfer of a rectangle and its flush to the display
+ * 
+ * @return Number of commands queued, or -1 on error (errno set)
+ */
+static int gpu_queue_flush(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    int count = gpu_transfer_rect(x, y, width, height);
+    if (count < 0 || gpu_resource_flush((uint32_t)count, x, y, width, height) < 0) {
+        return -1;  /* errno already set */
+    }
+    return count + 1;
+}
+
+/**
+ * Queue a page flip to the buffer drawn into
+ * 
+ * Its resource was last brought up to date two frames ago, so it is sent
+ * the previous frame's rectangle as well as this one's before the scanout
+ * moves to it. Drawing carries on in the other buffer at once, once the
+ * rectangle is copied there, while the device still reads this one.
+ * 
+ * @return Number of commands queued, or -1 on error (errno set)
+ */
+static int gpu_queue_flip(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    virtio_gpu_rect_t *stale = &g_gpu_device->stale;
+    uint32_t x0 = x, y0 = y, x1 = x + width, y1 = y + height;
+    if (stale->width > 0 && stale->height > 0) {
+        if (stale->x < x0) x0 = stale->x;
+        if (stale->y < y0) y0 = stale->y;
+        if (stale->x + stale->width > x1) x1 = stale->x + stale->width;
+        if (stale->y + stale->height > y1) y1 = stale->y + stale->height;
     }
     
-    /* Flush to display */
-    if (gpu_resource_flush(g_gpu_device->resource_id, 0, 0,
+    int count = gpu_transfer_rect(x0, y0, x1 - x0, y1 - y0);
+    if (count < 0 ||
+        gpu_queue_scanout((uint32_t)count, 0, g_gpu_device->resource_id,
+                          g_gpu_device->fb_width, g_gpu_device->fb_height) < 0 ||
+        gpu_resource_flush((uint32_t)count + 1, 0, 0,
                            g_gpu_device->fb_width, g_gpu_device->fb_height) < 0) {
-        return -1;
+        return -1;  /* errno already set */
     }
     
-    g_gpu_device->flush_count++;
-    clear_errno();
-    return 0;
+    uint32_t back = g_gpu_device->front;
+    gpu_copy_rect(g_gpu_device->buffers[back], g_gpu_device->fb_pixels, x, y, width, height);
+    gpu_set_back(back);
+    stale->x = x;
+    stale->y = y;
+    stale->width = width;
+    stale->height = height;
+    return count + 2;
 }
 
 /**
@@ -715,19 +1150,126 @@ int virtio_gpu_flush_region(uint32_t x, uint32_t y, uint32_t width, uint32_t hei
         height = g_gpu_device->fb_height - y;
     }
     
-    /* Transfer to host */
-    if (gpu_transfer_to_host(g_gpu_device->resource_id, x, y, width, height) < 0) {
-        return -1;
+    /* One flush at a time: the commands are built in shared slots, and the
+       previous flush is normally long done */
+    mutex_lock(&g_flush_lock);
+    if (gpu_wait_idle() < 0) {
+        mutex_unlock(&g_flush_lock);
+        return -1;  /* errno already set by gpu_wait_idle */
     }
     
-    /* Flush to display */
-    if (gpu_resource_flush(g_gpu_device->resource_id, x, y, width, height) < 0) {
-        return -1;
+    /* All of it goes to the device in one notification */
+    int flip = g_gpu_device->double_buffered && !g_gpu_device->direct;
+    int queued = flip ? gpu_queue_flip(x, y, width, height)
+                      : gpu_queue_flush(x, y, width, height);
+    gpu_kick();
+    if (queued < 0) {
+        /* What was queued still runs; nothing waits for it */
+        mutex_unlock(&g_flush_lock);
+        return -1;  /* errno already set */
     }
-    
     g_gpu_device->flush_count++;
-    clear_errno();
-    return 0;
+    
+    /* The interrupt finishes it; without one, wait here */
+    int ret = 0;
+    if (!g_gpu_device->irq_ready || process_current() == NULL || in_softirq()) {
+        ret = gpu_wait_idle();
+        for (int i = 0; ret == 0 && i < queued; i++) {
+            ret = gpu_check_response(gpu_resp_slot((uint32_t)i));
+        }
+    }
+    
+    mutex_unlock(&g_flush_lock);
+    if (ret == 0) {
+        clear_errno();
+    }
+    return ret;
+}
+
+/**
+ * Check whether flushes are page flips
+ */
+int virtio_gpu_double_buffered(void)
+{
+    return g_gpu_device != NULL && g_gpu_device->double_buffered;
+}
+
+/**
+ * Hand the framebuffer to one client that draws in it directly
+ */
+int virtio_gpu_set_direct(int direct)
+{
+    if (!g_gpu_device || !g_gpu_device->fb_pixels) {
+        RETURN_ERRNO(THUNDEROS_ENODEV);
+    }
+    direct = direct != 0;
+    
+    mutex_lock(&g_flush_lock);
+    if (gpu_wait_idle() < 0) {
+        mutex_unlock(&g_flush_lock);
+        return -1;  /* errno already set by gpu_wait_idle */
+    }
+    
+    int ret = 0;
+    if (direct != g_gpu_device->direct) {
+        if (direct) {
+            /* Rows back in screen order, for a plain mapping */
+            virtio_gpu_scroll(0, 0);
+        } else {
+            /* Blank what the client left, on the host too, so none of it
+               shows where the console does not draw */
+            size_t count = (size_t)g_gpu_device->fb_width * g_gpu_device->fb_height;
+            for (size_t i = 0; i < count; i++) {
+                g_gpu_device->fb_pixels[i] = 0;
+            }
+            int queued = gpu_queue_flush(0, 0, g_gpu_device->fb_width, g_gpu_device->fb_height);
+            gpu_kick();
+            ret = queued < 0 ? -1 : gpu_wait_idle();
+            for (int i = 0; ret == 0 && i < queued; i++) {
+                ret = gpu_check_response(gpu_resp_slot((uint32_t)i));
+            }
+            
+            /* The buffer now behind has not been drawn like the screen */
+            g_gpu_device->stale.x = 0;
+            g_gpu_device->stale.y = 0;
+            g_gpu_device->stale.width = g_gpu_device->fb_width;
+            g_gpu_device->stale.height = g_gpu_device->fb_height;
+        }
+        
+        /* Entering, draw into the buffer on the scanout; leaving, into
+           the other one again (the scanout never moved meanwhile) */
+        if (g_gpu_device->double_buffered) {
+            uint32_t front = g_gpu_device->front;
+            if (direct) {
+                g_gpu_device->fb_pixels = g_gpu_device->buffers[front];
+                g_gpu_device->fb_phys = g_gpu_device->buffers_phys[front];
+                g_gpu_device->resource_id = front + 1;
+            } else {
+                gpu_set_back(front ^ 1);
+            }
+        }
+        g_gpu_device->direct = (uint8_t)direct;
+    }
+    
+    mutex_unlock(&g_flush_lock);
+    if (ret == 0) {
+        clear_errno();
+    }
+    return ret;
+}
+
+/**
+ * VirtIO GPU interrupt handler (the IRQ's thread function; the IRQ is
+ * masked until it returns)
+ */
+void virtio_gpu_irq_handler(void)
+{
+    if (!g_gpu_device) {
+        return;
+    }
+    
+    g_gpu_device->irq_count++;
+    gpu_reap();
 }
 
 /**
@@ -739,6 +1281,15 @@ uint32_t *virtio_gpu_get_framebuffer(void)
     return g_gpu_device->fb_pixels;
 }
 
+/**
+ * Get the physical address of the framebuffer
+ */
+uintptr_t virtio_gpu_get_framebuffer_phys(void)
+{
+    if (!g_gpu_device) return 0;
+    return g_gpu_device->fb_phys;
+}
+
 /**
  * Get framebuffer dimensions
  */
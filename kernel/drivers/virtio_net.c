@@ -0,0 +1,810 @@
+/*
+ * VirtIO Network Device Driver
+ *
+ * Queue 0 receives, queue 1 transmits, both through the shared
+ * virtqueue code, and every frame travels in an sk_buff whose head
+ * buffer the device reads or writes directly.
+ *
+ * Each receive descriptor holds one empty packet buffer. A received
+ * frame is handed up in that buffer, its virtio header pulled off, and
+ * a fresh buffer takes its descriptor; when none can be had, or nobody
+ * takes frames, the frame is dropped and the same buffer goes straight
+ * back. The ring is refilled with one doorbell per pass. With
+ * VIRTIO_NET_F_MRG_RXBUF a frame may take several buffers; the pieces
+ * after the first are copied onto it, which with a 1500-byte MTU and
+ * 2KB buffers does not happen in practice.
+ *
+ * Transmit pushes the virtio header into the packet's headroom and
+ * points one descriptor at the linear part and one at each page
+ * fragment, so nothing is copied; a head buffer shared with a clone is
+ * copied first, its fragments still shared. With the offloads the stack
+ * leaves TCP checksums (VIRTIO_NET_F_CSUM) and segmentation
+ * (VIRTIO_NET_F_HOST_TSO4) to the device through the header, and the
+ * device marks frames whose checksum it checked (GUEST_CSUM).
+ *
+ * Interrupts are mitigated on both queues. The handler only acknowledges
+ * the device; the receive softirq masks receive interrupts while it
+ * drains the ring and re-arms them once it is empty, so a burst of
+ * frames costs one interrupt. Under load it stops
+ * after VIRTIO_NET_RX_IRQ_BUDGET frames and leaves the ring, still
+ * masked, to the "netrx" thread, which takes VIRTIO_NET_RX_POLL_BUDGET
+ * frames a round and yields between rounds until the ring is empty, so
+ * a flood of frames cannot keep the hart in the handler. Transmit completions
+ * raise none: each send reaps whatever the device has finished since the
+ * last, in one batch, and only a sender that finds the ring full asks
+ * for an interrupt, after three quarters of the frames in flight have
+ * gone (VIRTIO_RING_F_EVENT_IDX). The same feature lets the device say
+ * when it needs a doorbell at all.
+ */
+
+#include <drivers/virtio_net.h>
+#include <net/skbuff.h>
+#include <mm/kmalloc.h>
+#include <arch/interrupt.h>
+#include <kernel/constants.h>
+#include <kernel/errno.h>
+#include <kernel/kstring.h>
+#include <kernel/process.h>
+#include <kernel/softirq.h>
+#include <kernel/wait_queue.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Global device state */
+static virtio_net_device_t *g_net_device = NULL;
+
+/* Address used when the device has none of its own (QEMU's prefix) */
+static const uint8_t g_default_mac[VIRTIO_NET_ETH_ALEN] = {
+    0x52, 0x54, 0x00, 0x12, 0x34, 0x56
+};
+
+/**
+ * Whether the caller may sleep for a completion rather than poll for it
+ *
+ * Not from the receive handler, which may answer with a packet of its own
+ * but runs in a softirq, nor from another softirq (a timer).
+ */
+static int virtio_net_can_sleep(virtio_net_device_t *dev)
+{
+    return dev->irq_ready && !dev->in_rx_handler && process_current() != NULL &&
+           !in_softirq();
+}
+
+/**
+ * Ring a queue's doorbell for what was added since old_idx
+ */
+static void virtio_net_kick(virtio_net_device_t *dev, virtqueue_t *vq, uint16_t old_idx)
+{
+    if (vq->avail->idx == old_idx) {
+        return;
+    }
+    if (virtqueue_kick(vq, old_idx)) {
+        dev->notify_count++;
+    } else {
+        dev->notify_skipped++;
+    }
+}
+
+/**
+ * Put a packet buffer in a receive descriptor and post it
+ */
+static void virtio_net_post_rx(virtio_net_device_t *dev, uint16_t head, sk_buff_t *skb)
+{
+    virtqueue_t *vq = &dev->rxq;
+    vq->desc[head].addr = skb_data_phys(skb);
+    vq->desc[head].len = skb_tailroom(skb);
+    vq->desc[head].flags = VIRTQ_DESC_F_WRITE;
+    vq->token[head] = skb;
+    virtqueue_add_to_avail(vq, head);
+}
+
+/**
+ * Post a receive descriptor again with its buffer emptied
+ */
+static void virtio_net_recycle_rx(virtio_net_device_t *dev, uint16_t head)
+{
+    skb_trim(dev->rxq.token[head], 0);
+    virtqueue_add_to_avail(&dev->rxq, head);
+}
+
+/**
+ * Allocate an empty receive buffer
+ *
+ * NET_IP_ALIGN in front of the 12-byte virtio header puts the IP header
+ * on a 4-byte boundary.
+ */
+static sk_buff_t *virtio_net_alloc_rx(void)
+{
+    sk_buff_t *skb = skb_alloc(SKB_MAX_LINEAR);
+    if (skb) {
+        skb_reserve(skb, NET_IP_ALIGN);
+    }
+    return skb;
+}
+
+/**
+ * Take one received frame, starting at buffer head, and post a buffer
+ * in its place
+ *
+ * A frame spanning buffers (num_buffers > 1) continues in the next used
+ * entries, which carry no header of their own.
+ */
+static void virtio_net_rx_frame(virtio_net_device_t *dev, uint16_t head, uint32_t len)
+{
+    virtqueue_t *vq = &dev->rxq;
+    sk_buff_t *skb = vq->token[head];
+    virtio_net_hdr_t *hdr = (virtio_net_hdr_t *)skb->data;
+    
+    if (len <= dev->hdr_len || len > vq->desc[head].len) {
+        dev->rx_errors++;
+        virtio_net_recycle_rx(dev, head);
+        return;
+    }
+    skb_put(skb, len);
+    
+    /* Pieces after the first are copied on and their buffers reposted */
+    uint32_t nbufs = (dev->features & VIRTIO_NET_F_MRG_RXBUF) ? hdr->num_buffers : 1;
+    int ok = 1;
+    for (uint32_t i = 1; i < nbufs; i++) {
+        uint16_t next;
+        uint32_t next_len;
+        if (virtqueue_get_used_buf(vq, &next, &next_len) != 0) {
+            /* The device publishes a frame's buffers together */
+            ok = 0;
+            break;
+        }
+        sk_buff_t *piece = vq->token[next];
+        if (ok && next_len <= skb_tailroom(skb)) {
+            kmemcpy(skb_put(skb, next_len), piece->data, next_len);
+        } else {
+            ok = 0;
+        }
+        virtio_net_recycle_rx(dev, next);
+    }
+    
+    if (!ok || skb->len - dev->hdr_len > VIRTIO_NET_FRAME_MAX) {
+        dev->rx_errors++;
+        virtio_net_recycle_rx(dev, head);
+        return;
+    }
+    
+    /* The frame leaves in its buffer only if another can take its place */
+    sk_buff_t *fresh = dev->rx_handler ? virtio_net_alloc_rx() : NULL;
+    if (!fresh) {
+        dev->rx_dropped++;
+        virtio_net_recycle_rx(dev, head);
+        return;
+    }
+    virtio_net_post_rx(dev, head, fresh);
+    
+    /* A partial checksum comes from a sender on the host, which is trusted */
+    if ((dev->features & VIRTIO_NET_F_GUEST_CSUM) &&
+        (hdr->flags & (VIRTIO_NET_HDR_F_DATA_VALID | VIRTIO_NET_HDR_F_NEEDS_CSUM))) {
+        skb->ip_summed = SKB_CSUM_UNNECESSARY;
+        dev->rx_csum_valid++;
+    }
+    
+    skb_pull(skb, dev->hdr_len);
+    dev->rx_packets++;
+    dev->rx_bytes += skb->len;
+    dev->in_rx_handler = 1;
+    dev->rx_handler(skb);
+    dev->in_rx_handler = 0;
+}
+
+/**
+ * Take up to budget frames received, then refill the ring with one
+ * doorbell
+ *
+ * Receive interrupts stay masked while the ring is drained; re-arming
+ * them looks once more, as a frame may land in between. When the budget
+ * runs out first they stay masked and *more is set: the ring is the
+ * poller's until a round finds it empty.
+ */
+static int virtio_net_rx(virtio_net_device_t *dev, int budget, int *more)
+{
+    virtqueue_t *vq = &dev->rxq;
+    uint16_t old_idx = vq->avail->idx;
+    int received = 0;
+    uint16_t head;
+    uint32_t len;
+    
+    *more = 0;
+    virtqueue_disable_cb(vq);
+    for (;;) {
+        while (received < budget && virtqueue_get_used_buf(vq, &head, &len) == 0) {
+            virtio_net_rx_frame(dev, head, len);
+            received++;
+        }
+        if (received >= budget) {
+            *more = 1;
+            break;
+        }
+        if (!virtqueue_enable_cb(vq)) {
+            break;
+        }
+        virtqueue_disable_cb(vq);
+    }
+    
+    virtio_net_kick(dev, vq, old_idx);
+    if (received > 0 && dev->rx_done) {
+        dev->in_rx_handler = 1;
+        dev->rx_done();
+        dev->in_rx_handler = 0;
+    }
+    return received;
+}
+
+/**
+ * Free every packet the device has sent, in one pass
+ */
+static int virtio_net_reap_tx(virtio_net_device_t *dev)
+{
+    virtqueue_t *vq = &dev->txq;
+    int freed = 0;
+    uint16_t head;
+    uint32_t len;
+    
+    while (virtqueue_get_used_buf(vq, &head, &len) == 0) {
+        skb_free(vq->token[head]);
+        vq->token[head] = NULL;
+        virtqueue_free_desc_chain(vq, head);
+        dev->tx_in_flight--;
+        freed++;
+    }
+    
+    if (freed > 0) {
+        dev->tx_reaps++;
+        wait_queue_wake(&dev->tx_waiters);
+    }
+    return freed;
+}
+
+/**
+ * Take received frames, up to budget (interrupts off)
+ *
+ * A ring the interrupt budget does not empty goes to the poller thread;
+ * while it has the ring, this takes nothing.
+ */
+static int virtio_net_reap_rx(virtio_net_device_t *dev, int budget)
+{
+    int done = 0;
+    if (!dev->rx_polling) {
+        int more;
+        done = virtio_net_rx(dev, dev->rx_poller ? budget : INT32_MAX, &more);
+        if (more) {
+            dev->rx_polling = 1;
+            dev->rx_poll_handoffs++;
+            wait_queue_wake(&dev->rx_poll_wait);
+        }
+    }
+    return done;
+}
+
+/**
+ * SOFTIRQ_NET_RX: take the frames received, with the interrupt budget
+ */
+static void virtio_net_rx_softirq(void)
+{
+    virtio_net_device_t *dev = g_net_device;
+    if (!dev) {
+        return;
+    }
+    
+    int irq_state = interrupt_save_disable();
+    virtio_net_reap_rx(dev, VIRTIO_NET_RX_IRQ_BUDGET);
+    interrupt_restore(irq_state);
+}
+
+/**
+ * SOFTIRQ_NET_TX: free what was sent
+ */
+static void virtio_net_tx_softirq(void)
+{
+    virtio_net_device_t *dev = g_net_device;
+    if (!dev) {
+        return;
+    }
+    
+    int irq_state = interrupt_save_disable();
+    virtio_net_reap_tx(dev);
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Receive poller: drain the ring a budget at a time, letting others run
+ * between rounds, and hand it back to the interrupt once it is empty
+ */
+static void virtio_net_rx_poller_main(void *arg)
+{
+    virtio_net_device_t *dev = (virtio_net_device_t *)arg;
+    
+    for (;;) {
+        int irq_state = interrupt_save_disable();
+        
+        /* Interrupts stay off from the check until we are on the wait
+         * queue, so a hand-off in between cannot be missed */
+        while (!dev->rx_polling) {
+            wait_queue_sleep_irqoff(&dev->rx_poll_wait);
+        }
+        
+        int more;
+        virtio_net_rx(dev, VIRTIO_NET_RX_POLL_BUDGET, &more);
+        dev->rx_poll_rounds++;
+        if (!more) {
+            /* Receive interrupts are armed again */
+            dev->rx_polling = 0;
+        }
+        
+        interrupt_restore(irq_state);
+        if (more) {
+            process_yield();
+        }
+    }
+}
+
+/**
+ * Free the receive buffers of a device being given up
+ */
+static void virtio_net_free_rx(virtio_net_device_t *dev)
+{
+    virtqueue_t *vq = &dev->rxq;
+    for (uint32_t i = 0; i < vq->queue_size; i++) {
+        skb_free(vq->token[i]);
+        vq->token[i] = NULL;
+    }
+}
+
+/**
+ * Post a buffer for every receive descriptor
+ *
+ * @return Buffers posted
+ */
+static uint32_t virtio_net_fill_rx(virtio_net_device_t *dev)
+{
+    virtqueue_t *vq = &dev->rxq;
+    uint32_t posted = 0;
+    
+    while (vq->num_free > 0) {
+        sk_buff_t *skb = virtio_net_alloc_rx();
+        if (!skb) {
+            break;
+        }
+        
+        uint16_t head;
+        virtqueue_alloc_desc_chain(vq, &head, 1);
+        virtio_net_post_rx(dev, head, skb);
+        posted++;
+    }
+    return posted;
+}
+
+/**
+ * Put one packet on the transmit ring, waiting for room if it is full
+ *
+ * Called with interrupts off; takes the packet over whether or not it
+ * is queued. old_idx is where the caller's next doorbell starts from.
+ *
+ * @return 0 once queued, otherwise the error to report
+ */
+static int virtio_net_queue_tx(virtio_net_device_t *dev, sk_buff_t *skb, uint16_t *old_idx)
+{
+    virtqueue_t *vq = &dev->txq;
+    uint32_t ndesc = 1 + skb_shinfo(skb)->nr_frags;
+    
+    uint32_t max = skb->gso_size ? VIRTIO_NET_GSO_FRAME_MAX : VIRTIO_NET_FRAME_MAX;
+    if (skb->len == 0 || skb->len > max || ndesc > vq->queue_size || skb_shinfo(skb)->frag_list ||
+        (skb->ip_summed == SKB_CSUM_PARTIAL && !(dev->features & VIRTIO_NET_F_CSUM)) ||
+        (skb->gso_size && !(dev->features & VIRTIO_NET_F_HOST_TSO4))) {
+        dev->tx_dropped++;
+        skb_free(skb);
+        return THUNDEROS_EINVAL;
+    }
+    
+    /* The header goes in the headroom, which must be the packet's own */
+    if (skb_cow_head(skb, dev->hdr_len) != 0) {
+        dev->tx_dropped++;
+        skb_free(skb);
+        return THUNDEROS_ENOMEM;
+    }
+    
+    uint32_t spins = 0;
+    while (vq->num_free < ndesc) {
+        /* Start what is queued, then wait for most of it to go */
+        virtio_net_kick(dev, vq, *old_idx);
+        *old_idx = vq->avail->idx;
+        if (virtio_net_can_sleep(dev)) {
+            if (!virtqueue_enable_cb_delayed(vq, (uint16_t)dev->tx_in_flight)) {
+                wait_queue_sleep_irqoff(&dev->tx_waiters);
+            }
+            virtqueue_disable_cb(vq);
+        } else if (!virtqueue_has_used(vq) && ++spins > VIRTIO_NET_POLL_SPINS) {
+            dev->tx_dropped++;
+            skb_free(skb);
+            return THUNDEROS_EVIRTIO_TIMEOUT;
+        }
+        virtio_net_reap_tx(dev);
+    }
+    
+    /* The header says what is left to the device; all zero for a plain frame */
+    uint32_t frame_len = skb->len;
+    uint32_t frame_start = (uint32_t)(skb->data - skb->head);
+    uint32_t frame_headlen = skb_headlen(skb);
+    virtio_net_hdr_t *hdr = (virtio_net_hdr_t *)skb_push(skb, dev->hdr_len);
+    kmemset(hdr, 0, dev->hdr_len);
+    if (skb->ip_summed == SKB_CSUM_PARTIAL) {
+        hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr->csum_start = (uint16_t)(skb->csum_start - frame_start);
+        hdr->csum_offset = skb->csum_offset;
+        dev->tx_csum_offload++;
+    }
+    if (skb->gso_size) {
+        hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+        hdr->gso_size = skb->gso_size;
+        hdr->hdr_len = (uint16_t)frame_headlen;  // The headers, which are all linear
+        dev->tx_tso++;
+    }
+    
+    /* One descriptor for the linear part, one per page fragment */
+    uint16_t head;
+    virtqueue_alloc_desc_chain(vq, &head, ndesc);
+    skb_shared_info_t *shinfo = skb_shinfo(skb);
+    uint16_t idx = head;
+    for (uint32_t i = 0; i < ndesc; i++) {
+        virtq_desc_t *desc = &vq->desc[idx];
+        if (i == 0) {
+            desc->addr = skb_data_phys(skb);
+            desc->len = skb_headlen(skb);
+        } else {
+            desc->addr = shinfo->frags[i - 1].page + shinfo->frags[i - 1].offset;
+            desc->len = shinfo->frags[i - 1].size;
+        }
+        desc->flags = (i + 1 < ndesc) ? VIRTQ_DESC_F_NEXT : 0;
+        idx = desc->next;
+    }
+    vq->token[head] = skb;
+    virtqueue_add_to_avail(vq, head);
+    
+    dev->tx_in_flight++;
+    dev->tx_packets++;
+    dev->tx_bytes += frame_len;
+    return 0;
+}
+
+/**
+ * Initialize VirtIO network device
+ */
+int virtio_net_init(uintptr_t base_addr, uint32_t irq)
+{
+    if (g_net_device) {
+        RETURN_ERRNO(THUNDEROS_EBUSY);
+    }
+    
+    /* Allocate device structure */
+    virtio_net_device_t *dev = (virtio_net_device_t *)kmalloc(sizeof(virtio_net_device_t));
+    if (!dev) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    kmemset(dev, 0, sizeof(*dev));
+    dev->base_addr = base_addr;
+    dev->irq = irq;
+    
+    /* Reset, check it is a network device and agree on features */
+    if (virtio_mmio_negotiate(base_addr, VIRTIO_DEVICE_ID_NET, VIRTIO_NET_DRIVER_FEATURES,
+                              &dev->features) != 0) {
+        kfree(dev);
+        /* errno already set by virtio_mmio_negotiate */
+        return -1;
+    }
+    /* Segmentation needs the device to checksum the segments it makes */
+    if (!(dev->features & VIRTIO_NET_F_CSUM)) {
+        dev->features &= ~VIRTIO_NET_F_HOST_TSO4;
+    }
+    
+    /* num_buffers is only there with merged buffers or on a modern device */
+    dev->hdr_len = (dev->features & (VIRTIO_NET_F_MRG_RXBUF | VIRTIO_F_VERSION_1)) ?
+                   sizeof(virtio_net_hdr_t) : offsetof(virtio_net_hdr_t, num_buffers);
+    
+    /* Read device configuration */
+    virtio_net_config_t *config = (virtio_net_config_t *)(base_addr + VIRTIO_MMIO_CONFIG);
+    for (int i = 0; i < VIRTIO_NET_ETH_ALEN; i++) {
+        dev->mac[i] = (dev->features & VIRTIO_NET_F_MAC) ? config->mac[i] : g_default_mac[i];
+    }
+    dev->mtu = VIRTIO_NET_MTU;
+    if ((dev->features & VIRTIO_NET_F_MTU) && config->mtu > 0 && config->mtu < dev->mtu) {
+        dev->mtu = config->mtu;
+    }
+    
+    /* Both queues get the same size, what the smaller one allows */
+    uint32_t queue_size = VIRTIO_NET_QUEUE_SIZE;
+    for (uint32_t q = VIRTIO_NET_QUEUE_RX; q <= VIRTIO_NET_QUEUE_TX; q++) {
+        VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_QUEUE_SEL, q);
+        uint32_t queue_max = VIRTIO_MMIO_READ32(base_addr, VIRTIO_MMIO_QUEUE_NUM_MAX);
+        if (queue_max < queue_size) {
+            queue_size = queue_max;
+        }
+    }
+    
+    int event_idx = (dev->features & VIRTIO_RING_F_EVENT_IDX) != 0;
+    if (virtqueue_init(&dev->rxq, base_addr, VIRTIO_NET_QUEUE_RX, queue_size, event_idx) < 0 ||
+        virtqueue_init(&dev->txq, base_addr, VIRTIO_NET_QUEUE_TX, queue_size, event_idx) < 0) {
+        virtio_mmio_reset(base_addr);
+        kfree(dev);
+        /* errno already set by virtqueue_init */
+        return -1;
+    }
+    
+    /* The device may only start with somewhere to put frames */
+    if (virtio_net_fill_rx(dev) == 0) {
+        virtio_mmio_reset(base_addr);
+        kfree(dev);
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    
+    wait_queue_init(&dev->tx_waiters);
+    wait_queue_init(&dev->rx_poll_wait);
+    
+    /* Sent frames are reaped by the next send, not by interrupt */
+    virtqueue_disable_cb(&dev->txq);
+    
+    /* Set DRIVER_OK status bit */
+    if (virtio_mmio_driver_ok(base_addr) != 0) {
+        virtio_mmio_reset(base_addr);
+        virtio_net_free_rx(dev);
+        kfree(dev);
+        /* errno already set by virtio_mmio_driver_ok */
+        return -1;
+    }
+    g_net_device = dev;
+    
+    /* Tell the device about the receive buffers */
+    virtio_net_kick(dev, &dev->rxq, 0);
+    
+    /* From here on completions arrive by interrupt and senders sleep;
+     * without the interrupt the driver is polled */
+    open_softirq(SOFTIRQ_NET_RX, virtio_net_rx_softirq);
+    open_softirq(SOFTIRQ_NET_TX, virtio_net_tx_softirq);
+    if (irq != 0 && interrupt_register_handler(irq, virtio_net_irq_handler, "virtio-net")) {
+        interrupt_set_priority(irq, IRQ_PRIORITY_NORMAL);
+        interrupt_enable_irq(irq);
+        dev->irq_ready = 1;
+        
+        /* Without the poller the handler takes every frame, as before */
+        dev->rx_poller = kthread_create("netrx", virtio_net_rx_poller_main, dev);
+    }
+    
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Check whether a network device was found
+ */
+int virtio_net_available(void)
+{
+    return g_net_device != NULL;
+}
+
+/**
+ * Get the device's MAC address
+ */
+int virtio_net_get_mac(uint8_t *mac)
+{
+    if (!g_net_device) {
+        RETURN_ERRNO(THUNDEROS_EVIRTIO_NODEV);
+    }
+    if (!mac) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    kmemcpy(mac, g_net_device->mac, VIRTIO_NET_ETH_ALEN);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Check whether a feature was negotiated
+ */
+int virtio_net_has_feature(uint64_t feature)
+{
+    return g_net_device && (g_net_device->features & feature) == feature;
+}
+
+/**
+ * Check whether the link is up
+ */
+int virtio_net_link_up(void)
+{
+    if (!g_net_device) {
+        return 0;
+    }
+    if (!(g_net_device->features & VIRTIO_NET_F_STATUS)) {
+        return 1;
+    }
+    virtio_net_config_t *config =
+        (virtio_net_config_t *)(g_net_device->base_addr + VIRTIO_MMIO_CONFIG);
+    return (*(volatile uint16_t *)&config->status & VIRTIO_NET_S_LINK_UP) != 0;
+}
+
+/**
+ * Transmit several packets with one doorbell
+ */
+int virtio_net_xmit_batch(sk_buff_t **skbs, uint32_t count)
+{
+    virtio_net_device_t *dev = g_net_device;
+    if (!skbs || count == 0) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (!dev) {
+        for (uint32_t i = 0; i < count; i++) {
+            skb_free(skbs[i]);
+        }
+        RETURN_ERRNO(THUNDEROS_EVIRTIO_NODEV);
+    }
+    
+    virtqueue_t *vq = &dev->txq;
+    int irq_state = interrupt_save_disable();
+    
+    /* Whatever went out since the last send is freed here, as one batch */
+    virtio_net_reap_tx(dev);
+    
+    uint16_t old_idx = vq->avail->idx;
+    uint32_t queued = 0;
+    int error = 0;
+    uint32_t i;
+    for (i = 0; i < count; i++) {
+        int err = virtio_net_queue_tx(dev, skbs[i], &old_idx);
+        if (err == 0) {
+            queued++;
+        } else {
+            error = err;
+            if (err != THUNDEROS_EINVAL) {
+                i++;
+                break;
+            }
+        }
+    }
+    
+    /* Packets behind a failure are not sent */
+    for (; i < count; i++) {
+        dev->tx_dropped++;
+        skb_free(skbs[i]);
+    }
+    
+    virtio_net_kick(dev, vq, old_idx);
+    interrupt_restore(irq_state);
+    
+    if (queued == 0) {
+        RETURN_ERRNO(error);
+    }
+    clear_errno();
+    return (int)queued;
+}
+
+/**
+ * Transmit one packet
+ */
+int virtio_net_xmit(sk_buff_t *skb)
+{
+    if (virtio_net_xmit_batch(&skb, 1) < 0) {
+        /* errno already set by virtio_net_xmit_batch */
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Send several frames with one doorbell
+ */
+int virtio_net_send_batch(const virtio_net_frame_t *frames, uint32_t count)
+{
+    virtio_net_device_t *dev = g_net_device;
+    if (!dev) {
+        RETURN_ERRNO(THUNDEROS_EVIRTIO_NODEV);
+    }
+    if (!frames || count == 0) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (!frames[i].data || frames[i].len == 0 || frames[i].len > VIRTIO_NET_FRAME_MAX) {
+            RETURN_ERRNO(THUNDEROS_EINVAL);
+        }
+    }
+    
+    virtqueue_t *vq = &dev->txq;
+    int irq_state = interrupt_save_disable();
+    virtio_net_reap_tx(dev);
+    
+    uint16_t old_idx = vq->avail->idx;
+    uint32_t sent = 0;
+    int error = 0;
+    while (sent < count) {
+        /* Copied into a packet buffer, with headroom for the header */
+        uint32_t len = frames[sent].len;
+        sk_buff_t *skb = skb_alloc(dev->hdr_len + len);
+        if (!skb) {
+            error = THUNDEROS_ENOMEM;
+            break;
+        }
+        skb_reserve(skb, dev->hdr_len);
+        kmemcpy(skb_put(skb, len), frames[sent].data, len);
+        
+        error = virtio_net_queue_tx(dev, skb, &old_idx);
+        if (error != 0) {
+            break;
+        }
+        sent++;
+    }
+    
+    virtio_net_kick(dev, vq, old_idx);
+    interrupt_restore(irq_state);
+    
+    if (sent == 0) {
+        RETURN_ERRNO(error);
+    }
+    clear_errno();
+    return (int)sent;
+}
+
+/**
+ * Send one frame
+ */
+int virtio_net_send(const void *frame, uint32_t len)
+{
+    virtio_net_frame_t one = { frame, len };
+    if (virtio_net_send_batch(&one, 1) < 0) {
+        /* errno already set by virtio_net_send_batch */
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Set where received frames go
+ */
+void virtio_net_set_rx_handler(virtio_net_rx_t handler)
+{
+    if (!g_net_device) {
+        return;
+    }
+    int irq_state = interrupt_save_disable();
+    g_net_device->rx_handler = handler;
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Set what runs at the end of each receive pass
+ */
+void virtio_net_set_rx_done(virtio_net_rx_done_t done)
+{
+    if (!g_net_device) {
+        return;
+    }
+    int irq_state = interrupt_save_disable();
+    g_net_device->rx_done = done;
+    interrupt_restore(irq_state);
+}
+
+/**
+ * VirtIO network device interrupt handler
+ */
+void virtio_net_irq_handler(void)
+{
+    if (!g_net_device) {
+        return;
+    }
+    
+    /* Acknowledge now; frames are taken and sent buffers freed on the
+     * way out of the trap */
+    g_net_device->irq_count++;
+    virtio_mmio_ack_interrupt(g_net_device->base_addr);
+    raise_softirq(SOFTIRQ_NET_RX);
+    raise_softirq(SOFTIRQ_NET_TX);
+}
+
+/**
+ * Get the global VirtIO network device
+ */
+virtio_net_device_t *virtio_net_get_device(void)
+{
+    return g_net_device;
+}
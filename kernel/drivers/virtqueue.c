@@ -0,0 +1,360 @@
+/*
+ * VirtIO MMIO Transport and Split Virtqueues
+ *
+ * The parts of a VirtIO driver that do not depend on the device: the
+ * reset and feature handshake, and the split ring every request goes
+ * through. With VIRTIO_RING_F_EVENT_IDX the driver rings the doorbell
+ * only when the device asked for it, and tells the device after which
+ * completion to interrupt, so a busy queue costs one exit and one
+ * interrupt per batch rather than per request.
+ */
+
+#include <drivers/virtqueue.h>
+#include <mm/dma.h>
+#include <arch/barrier.h>
+#include <kernel/errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Reset a device and negotiate features with it
+ */
+int virtio_mmio_negotiate(uintptr_t base_addr, uint32_t device_id,
+                          uint64_t driver_features, uint64_t *features)
+{
+    if (VIRTIO_MMIO_READ32(base_addr, VIRTIO_MMIO_MAGIC_VALUE) != VIRTIO_MAGIC ||
+        VIRTIO_MMIO_READ32(base_addr, VIRTIO_MMIO_DEVICE_ID) != device_id) {
+        RETURN_ERRNO(THUNDEROS_EVIRTIO_BADDEV);
+    }
+    
+    /* Reset device */
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_STATUS, 0);
+    
+    /* Device initialization sequence per VirtIO spec */
+    uint32_t status = VIRTIO_STATUS_ACKNOWLEDGE;
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_STATUS, status);
+    
+    status |= VIRTIO_STATUS_DRIVER;
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_STATUS, status);
+    
+    /* Read device features */
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 0);
+    uint32_t features_low = VIRTIO_MMIO_READ32(base_addr, VIRTIO_MMIO_DEVICE_FEATURES);
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 1);
+    uint32_t features_high = VIRTIO_MMIO_READ32(base_addr, VIRTIO_MMIO_DEVICE_FEATURES);
+    
+    /* Accept only what the driver implements: taking e.g. a packed ring
+     * or an event index it never maintains would break the queue */
+    uint64_t accepted = (((uint64_t)features_high << 32) | features_low) & driver_features;
+    
+    /* Negotiate features */
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 0);
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_DRIVER_FEATURES, (uint32_t)accepted);
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 1);
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_DRIVER_FEATURES, (uint32_t)(accepted >> 32));
+    
+    status |= VIRTIO_STATUS_FEATURES_OK;
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_STATUS, status);
+    
+    /* Verify features accepted */
+    if (!(VIRTIO_MMIO_READ32(base_addr, VIRTIO_MMIO_STATUS) & VIRTIO_STATUS_FEATURES_OK)) {
+        RETURN_ERRNO(THUNDEROS_EVIRTIO_BADDEV);
+    }
+    
+    *features = accepted;
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Tell a device its driver is ready
+ */
+int virtio_mmio_driver_ok(uintptr_t base_addr)
+{
+    uint32_t status = VIRTIO_MMIO_READ32(base_addr, VIRTIO_MMIO_STATUS);
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_STATUS, status | VIRTIO_STATUS_DRIVER_OK);
+    
+    /* Verify device accepted DRIVER_OK */
+    if (!(VIRTIO_MMIO_READ32(base_addr, VIRTIO_MMIO_STATUS) & VIRTIO_STATUS_DRIVER_OK)) {
+        RETURN_ERRNO(THUNDEROS_EVIRTIO_BADDEV);
+    }
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Reset a device that could not be set up
+ */
+void virtio_mmio_reset(uintptr_t base_addr)
+{
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_STATUS, 0);
+}
+
+/**
+ * Read and acknowledge a device's pending interrupts
+ */
+uint32_t virtio_mmio_ack_interrupt(uintptr_t base_addr)
+{
+    uint32_t int_status = VIRTIO_MMIO_READ32(base_addr, VIRTIO_MMIO_INTERRUPT_STATUS);
+    if (int_status) {
+        VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_INTERRUPT_ACK, int_status);
+    }
+    return int_status;
+}
+
+/**
+ * Initialize virtqueue with descriptor, available, and used rings
+ */
+int virtqueue_init(virtqueue_t *vq, uintptr_t base_addr, uint32_t index,
+                   uint32_t queue_size, int event_idx)
+{
+    if (queue_size == 0 || queue_size > VIRTQ_MAX_SIZE) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    /* A device queue that cannot hold the size asked for is not used */
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_QUEUE_SEL, index);
+    if (VIRTIO_MMIO_READ32(base_addr, VIRTIO_MMIO_QUEUE_NUM_MAX) < queue_size) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    vq->base_addr = base_addr;
+    vq->index = index;
+    vq->queue_size = queue_size;
+    vq->last_seen_used = 0;
+    vq->event_idx = event_idx ? 1 : 0;
+    vq->num_free = queue_size;
+    
+    for (uint32_t i = 0; i < VIRTQ_MAX_SIZE; i++) {
+        vq->token[i] = NULL;
+    }
+    
+    /* Calculate sizes for each ring (including used_event/avail_event) */
+    size_t desc_size = sizeof(virtq_desc_t) * queue_size;
+    size_t avail_size = sizeof(uint16_t) * (3 + queue_size);
+    size_t used_size = sizeof(uint16_t) * 3 + sizeof(virtq_used_elem_t) * queue_size;
+    
+    /* Allocate descriptor ring using DMA allocator */
+    dma_region_t *desc_region = dma_alloc(desc_size, DMA_ZERO);
+    if (!desc_region) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    vq->desc = (virtq_desc_t *)desc_region->virt_addr;
+    vq->desc_phys = desc_region->phys_addr;
+    
+    /* Allocate available ring */
+    dma_region_t *avail_region = dma_alloc(avail_size, DMA_ZERO);
+    if (!avail_region) {
+        dma_free(desc_region);
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    vq->avail = (virtq_avail_t *)avail_region->virt_addr;
+    vq->avail_phys = avail_region->phys_addr;
+    
+    /* Allocate used ring */
+    dma_region_t *used_region = dma_alloc(used_size, DMA_ZERO);
+    if (!used_region) {
+        dma_free(desc_region);
+        dma_free(avail_region);
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    vq->used = (virtq_used_t *)used_region->virt_addr;
+    vq->used_phys = used_region->phys_addr;
+    
+    /* Initialize free descriptor list (link all descriptors together) */
+    for (uint32_t i = 0; i < queue_size - 1; i++) {
+        vq->desc[i].next = (uint16_t)(i + 1);
+    }
+    vq->desc[queue_size - 1].next = 0;
+    vq->free_head = 0;
+    
+    /* Configure queue in device */
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_QUEUE_SEL, index);
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_QUEUE_NUM, queue_size);
+    
+    /* Write descriptor ring address (split 64-bit address into low/high) */
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_QUEUE_DESC_LOW, (uint32_t)(vq->desc_phys & 0xFFFFFFFF));
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_QUEUE_DESC_HIGH, (uint32_t)(vq->desc_phys >> 32));
+    
+    /* Write available ring address */
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_QUEUE_AVAIL_LOW, (uint32_t)(vq->avail_phys & 0xFFFFFFFF));
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_QUEUE_AVAIL_HIGH, (uint32_t)(vq->avail_phys >> 32));
+    
+    /* Write used ring address */
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_QUEUE_USED_LOW, (uint32_t)(vq->used_phys & 0xFFFFFFFF));
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_QUEUE_USED_HIGH, (uint32_t)(vq->used_phys >> 32));
+    
+    /* Mark queue as ready */
+    VIRTIO_MMIO_WRITE32(base_addr, VIRTIO_MMIO_QUEUE_READY, 1);
+    
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Allocate a chain of descriptors from the free list
+ */
+int virtqueue_alloc_desc_chain(virtqueue_t *vq, uint16_t *head, uint32_t count)
+{
+    if (count == 0 || vq->num_free < count) {
+        RETURN_ERRNO(THUNDEROS_EBUSY);
+    }
+    
+    *head = vq->free_head;
+    uint16_t current = vq->free_head;
+    
+    /* Advance free_head by 'count' descriptors */
+    for (uint32_t i = 0; i < count; i++) {
+        current = vq->desc[current].next;
+    }
+    vq->free_head = current;
+    vq->num_free -= count;
+    
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Free a descriptor chain back to the free list
+ */
+void virtqueue_free_desc_chain(virtqueue_t *vq, uint16_t head)
+{
+    /* Count descriptors in chain */
+    uint16_t count = 1;
+    uint16_t current = head;
+    while (vq->desc[current].flags & VIRTQ_DESC_F_NEXT) {
+        current = vq->desc[current].next;
+        count++;
+    }
+    
+    /* Add chain back to free list */
+    vq->desc[current].next = vq->free_head;
+    vq->free_head = head;
+    vq->num_free += count;
+}
+
+/**
+ * Add descriptor to available ring
+ */
+void virtqueue_add_to_avail(virtqueue_t *vq, uint16_t head)
+{
+    uint16_t avail_idx = vq->avail->idx % vq->queue_size;
+    vq->avail->ring[avail_idx] = head;
+    
+    /* Memory barrier to ensure descriptor writes complete before index update */
+    write_barrier();
+    
+    vq->avail->idx++;
+}
+
+/**
+ * Get buffer from used ring
+ */
+int virtqueue_get_used_buf(virtqueue_t *vq, uint16_t *head, uint32_t *len)
+{
+    /* Memory barrier to ensure we read latest used ring index */
+    read_barrier();
+    
+    if (vq->last_seen_used == *(volatile uint16_t *)&vq->used->idx) {
+        return -1;  // No new completions
+    }
+    
+    /* The entry must be read after the index that published it */
+    read_barrier();
+    uint16_t used_idx = vq->last_seen_used % vq->queue_size;
+    *head = (uint16_t)vq->used->ring[used_idx].id;
+    *len = vq->used->ring[used_idx].len;
+    
+    vq->last_seen_used++;
+    return 0;
+}
+
+/**
+ * Check whether the device has finished chains not yet taken
+ */
+int virtqueue_has_used(virtqueue_t *vq)
+{
+    read_barrier();
+    return *(volatile uint16_t *)&vq->used->idx != vq->last_seen_used;
+}
+
+/**
+ * Ring the doorbell for entries added since old_idx, unless the device
+ * said it does not need it
+ *
+ * With VIRTIO_RING_F_EVENT_IDX the device publishes the avail index it
+ * wants to hear about next; one still working through the ring picks up
+ * later entries without being told. Otherwise VIRTQ_USED_F_NO_NOTIFY
+ * says the same for the whole ring.
+ */
+int virtqueue_kick(virtqueue_t *vq, uint16_t old_idx)
+{
+    /* The new avail index must be visible before reading the device's wish */
+    memory_barrier();
+    
+    uint16_t new_idx = vq->avail->idx;
+    int needed;
+    if (vq->event_idx) {
+        uint16_t event = VRING_AVAIL_EVENT(vq);
+        needed = (uint16_t)(new_idx - event - 1) < (uint16_t)(new_idx - old_idx);
+    } else {
+        needed = !(*(volatile uint16_t *)&vq->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+    }
+    
+    if (!needed) {
+        return 0;
+    }
+    
+    /* Write queue index to QUEUE_NOTIFY register */
+    VIRTIO_MMIO_WRITE32(vq->base_addr, VIRTIO_MMIO_QUEUE_NOTIFY, vq->index);
+    
+    /* Memory barrier after notify */
+    write_barrier();
+    return 1;
+}
+
+/**
+ * Ask the device not to interrupt for this queue
+ *
+ * With VIRTIO_RING_F_EVENT_IDX the device ignores the flag: used_event is
+ * left where it is, behind which the device interrupts once at most.
+ */
+void virtqueue_disable_cb(virtqueue_t *vq)
+{
+    *(volatile uint16_t *)&vq->avail->flags |= VIRTQ_AVAIL_F_NO_INTERRUPT;
+}
+
+/**
+ * Ask for an interrupt at the next chain finished after those taken
+ */
+int virtqueue_enable_cb(virtqueue_t *vq)
+{
+    *(volatile uint16_t *)&vq->avail->flags &= (uint16_t)~VIRTQ_AVAIL_F_NO_INTERRUPT;
+    if (vq->event_idx) {
+        VRING_USED_EVENT(vq) = vq->last_seen_used;
+    }
+    
+    /* A completion between the scan and the update would not interrupt:
+     * the caller looks once more */
+    memory_barrier();
+    return virtqueue_has_used(vq);
+}
+
+/**
+ * Ask for an interrupt only once most of the chains in flight finish
+ */
+int virtqueue_enable_cb_delayed(virtqueue_t *vq, uint16_t in_flight)
+{
+    if (!vq->event_idx) {
+        return virtqueue_enable_cb(vq);
+    }
+    
+    *(volatile uint16_t *)&vq->avail->flags &= (uint16_t)~VIRTQ_AVAIL_F_NO_INTERRUPT;
+    VRING_USED_EVENT(vq) = (uint16_t)(vq->last_seen_used + (in_flight * 3) / 4);
+    
+    memory_barrier();
+    
+    /* Already past the point asked for: no interrupt will come for it */
+    uint16_t used = *(volatile uint16_t *)&vq->used->idx;
+    return (uint16_t)(used - vq->last_seen_used) > (uint16_t)((in_flight * 3) / 4);
+}
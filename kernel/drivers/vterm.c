@@ -15,7 +15,14 @@
 #include <kernel/signal.h>
 #include <kernel/process.h>
 #include <kernel/constants.h>
+#include <kernel/workqueue.h>
+#include <kernel/hrtimer.h>
+#include <kernel/wait_queue.h>
+#include <kernel/poll.h>
+#include <kernel/uaccess.h>
+#include <arch/interrupt.h>
 #include <hal/hal_uart.h>
+#include <hal/hal_timer.h>
 #include <stddef.h>
 
 /* Virtual terminal array */
@@ -33,6 +40,35 @@ static vterm_input_state_t g_input_state = {0};
 /* Initialization flag */
 static int g_initialized = 0;
 
+/* Full-screen redraw after a switch, off the input poll in the timer interrupt */
+static void vterm_redraw_work(work_t *work);
+static work_t g_redraw_work = WORK_INIT(vterm_redraw_work);
+
+/* Output is drawn and sent to the display at most once per VTERM_FRAME_US:
+   a flush queues the frame work, or arms the timer that queues it */
+static void vterm_frame_work(work_t *work);
+static work_t g_frame_work = WORK_INIT(vterm_frame_work);
+static hrtimer_t g_frame_timer;
+static uint64_t g_last_frame_us = 0;
+
+/* The framebuffer belongs to someone else (see vterm_display_suspend()) */
+static int g_display_suspended = 0;
+
+/* What the framebuffer shows: a cell is only drawn again once it differs */
+static vterm_cell_t g_screen[VTERM_MAX_ROWS][VTERM_MAX_COLS];
+
+/* Where the cursor was drawn, if it still is */
+static int g_cursor_drawn = 0;
+static uint32_t g_cursor_col = 0;
+static uint32_t g_cursor_row = 0;
+static uint8_t g_cursor_color = 0;
+
+/* Cells drawn since the last flush: columns [col0, col1) of rows [row0, row1) */
+static uint32_t g_damage_col0 = 0;
+static uint32_t g_damage_col1 = 0;
+static uint32_t g_damage_row0 = 0;
+static uint32_t g_damage_row1 = 0;
+
 /* Default terminal colors */
 #define DEFAULT_FG_COLOR    7   /* Light gray */
 #define DEFAULT_BG_COLOR    0   /* Black */
@@ -66,7 +102,16 @@ static const uint32_t ansi_colors[16] = {
 static void vterm_scroll_up(vterm_t *term);
 static void vterm_newline(vterm_t *term);
 static void vterm_draw_cell(uint32_t col, uint32_t row, vterm_cell_t *cell);
-static int input_buffer_put_to(int index, char c);
+static void vterm_putc_internal(vterm_t *term, char c);
+static void ldisc_receive(int index, char c);
+static void ldisc_discard_line(int index);
+static void ldisc_flush_echo(void);
+static void ldisc_init(int index);
+static void vterm_input_irq(void);
+static void vterm_frame_timer(void *data);
+
+/* Set once the UART interrupts on input; the timer then stops polling */
+static int g_input_irq = 0;
 
 /**
  * Initialize a single terminal
@@ -120,6 +165,12 @@ static void init_terminal(vterm_t *term, int index)
     
     /* No foreground process initially */
     term->fg_pid = -1;
+    
+    /* Nothing to draw until written to */
+    for (uint32_t row = 0; row < VTERM_MAX_ROWS; row++) {
+        term->dirty_start[row] = 0;
+        term->dirty_end[row] = 0;
+    }
 }
 
 /**
@@ -135,6 +186,7 @@ int vterm_init(void)
     /* Initialize all terminals (works with or without framebuffer) */
     for (int i = 0; i < VTERM_MAX_TERMINALS; i++) {
         init_terminal(&g_terminals[i], i);
+        ldisc_init(i);
     }
     
     /* Reset input state */
@@ -145,6 +197,13 @@ int vterm_init(void)
     g_active_terminal = 0;
     g_initialized = 1;
     
+    /* Take input as it arrives; without the interrupt the timer polls */
+    if (hal_uart_enable_rx_interrupt(vterm_input_irq) == 0) {
+        g_input_irq = 1;
+    }
+    
+    hrtimer_setup(&g_frame_timer, vterm_frame_timer, NULL);
+    
     /* If framebuffer is available, draw initial screen */
     if (fbcon_available()) {
         vterm_refresh();
@@ -192,21 +251,30 @@ int vterm_get_active_index(void)
 }
 
 /**
- * Draw a single cell to the framebuffer
+ * Colors a cell is drawn in
  */
-static void vterm_draw_cell(uint32_t col, uint32_t row, vterm_cell_t *cell)
+static void vterm_cell_colors(const vterm_cell_t *cell, uint32_t *fg, uint32_t *bg)
 {
-    if (!fbcon_available()) return;
-    
-    uint32_t fg = ansi_colors[cell->fg_color & 0x0F];
-    uint32_t bg = ansi_colors[cell->bg_color & 0x0F];
+    *fg = ansi_colors[cell->fg_color & 0x0F];
+    *bg = ansi_colors[cell->bg_color & 0x0F];
     
     /* Handle reverse attribute */
     if (cell->attrs & VTERM_ATTR_REVERSE) {
-        uint32_t tmp = fg;
-        fg = bg;
-        bg = tmp;
+        uint32_t tmp = *fg;
+        *fg = *bg;
+        *bg = tmp;
     }
+}
+
+/**
+ * Draw a single cell to the framebuffer
+ */
+static void vterm_draw_cell(uint32_t col, uint32_t row, vterm_cell_t *cell)
+{
+    if (!fbcon_available()) return;
+    
+    uint32_t fg, bg;
+    vterm_cell_colors(cell, &fg, &bg);
     
     uint32_t x = col * FONT_WIDTH;
     uint32_t y = row * FONT_HEIGHT;
@@ -215,34 +283,335 @@ static void vterm_draw_cell(uint32_t col, uint32_t row, vterm_cell_t *cell)
 }
 
 /**
- * Refresh the display from the active terminal's buffer
+ * Note that a cell of a terminal changed
  */
-void vterm_refresh(void)
+static void vterm_touch(vterm_t *term, uint32_t col, uint32_t row)
 {
-    if (!g_initialized || !fbcon_available()) return;
+    if (term->dirty_start[row] == term->dirty_end[row]) {
+        term->dirty_start[row] = (uint8_t)col;
+        term->dirty_end[row] = (uint8_t)(col + 1);
+        return;
+    }
+    if (col < term->dirty_start[row]) term->dirty_start[row] = (uint8_t)col;
+    if (col >= term->dirty_end[row]) term->dirty_end[row] = (uint8_t)(col + 1);
+}
+
+/**
+ * Note that every cell of a terminal changed
+ */
+static void vterm_touch_all(vterm_t *term)
+{
+    for (uint32_t row = 0; row < term->rows; row++) {
+        term->dirty_start[row] = 0;
+        term->dirty_end[row] = (uint8_t)term->cols;
+    }
+}
+
+/**
+ * Add cells just drawn to the region the next flush sends
+ */
+static void vterm_damage(uint32_t col0, uint32_t row0, uint32_t col1, uint32_t row1)
+{
+    if (g_damage_col0 == g_damage_col1) {
+        g_damage_col0 = col0;
+        g_damage_col1 = col1;
+        g_damage_row0 = row0;
+        g_damage_row1 = row1;
+        return;
+    }
+    if (col0 < g_damage_col0) g_damage_col0 = col0;
+    if (col1 > g_damage_col1) g_damage_col1 = col1;
+    if (row0 < g_damage_row0) g_damage_row0 = row0;
+    if (row1 > g_damage_row1) g_damage_row1 = row1;
+}
+
+static int vterm_cell_equal(const vterm_cell_t *a, const vterm_cell_t *b)
+{
+    return a->ch == b->ch && a->fg_color == b->fg_color &&
+           a->bg_color == b->bg_color && a->attrs == b->attrs;
+}
+
+static int vterm_cell_same_attrs(const vterm_cell_t *a, const vterm_cell_t *b)
+{
+    return a->fg_color == b->fg_color && a->bg_color == b->bg_color &&
+           a->attrs == b->attrs;
+}
+
+/**
+ * Number of lines in a terminal's scrollback
+ */
+static uint32_t scrollback_count(const vterm_t *term)
+{
+    return term->scrollback.next - term->scrollback.first;
+}
+
+/**
+ * Append the line scrolling off the top of a terminal to its scrollback
+ */
+static void scrollback_push(vterm_t *term, const vterm_cell_t *cells)
+{
+    vterm_scrollback_t *sb = &term->scrollback;
+    
+    /* Blanks at the end of the line are left implied */
+    uint32_t len = term->cols;
+    while (len > 0 && cells[len - 1].ch == ' ' &&
+           cells[len - 1].bg_color == DEFAULT_BG_COLOR &&
+           cells[len - 1].attrs == VTERM_ATTR_NONE) {
+        len--;
+    }
     
+    /* Encode: the length, then one header per run of equal attributes */
+    uint8_t line[1 + VTERM_MAX_COLS * 4];
+    uint32_t n = 0;
+    line[n++] = (uint8_t)len;
+    uint32_t col = 0;
+    while (col < len) {
+        uint32_t end = col + 1;
+        while (end < len && vterm_cell_same_attrs(&cells[end], &cells[col])) {
+            end++;
+        }
+        line[n++] = (uint8_t)(end - col);
+        line[n++] = (uint8_t)((cells[col].fg_color & 0x0F) | (cells[col].bg_color << 4));
+        line[n++] = cells[col].attrs;
+        for (; col < end; col++) {
+            line[n++] = (uint8_t)cells[col].ch;
+        }
+    }
+    
+    /* Drop the oldest lines until this one fits */
+    while (sb->next != sb->first &&
+           (sb->next - sb->first == VTERM_SCROLLBACK_LINES ||
+            sb->pos + n - sb->start[sb->first % VTERM_SCROLLBACK_LINES] > VTERM_SCROLLBACK_BYTES)) {
+        sb->first++;
+    }
+    
+    sb->start[sb->next % VTERM_SCROLLBACK_LINES] = sb->pos;
+    for (uint32_t i = 0; i < n; i++) {
+        sb->data[(sb->pos + i) & (VTERM_SCROLLBACK_BYTES - 1)] = line[i];
+    }
+    sb->pos += n;
+    sb->next++;
+}
+
+/**
+ * Expand a scrollback line (0 is the oldest kept) into a row of cells
+ */
+static void scrollback_get(const vterm_t *term, uint32_t index, vterm_cell_t *cells)
+{
+    const vterm_scrollback_t *sb = &term->scrollback;
+    uint32_t pos = sb->start[(sb->first + index) % VTERM_SCROLLBACK_LINES];
+    
+    uint32_t len = sb->data[pos++ & (VTERM_SCROLLBACK_BYTES - 1)];
+    uint32_t col = 0;
+    while (col < len) {
+        uint32_t count = sb->data[pos++ & (VTERM_SCROLLBACK_BYTES - 1)];
+        uint8_t colors = sb->data[pos++ & (VTERM_SCROLLBACK_BYTES - 1)];
+        uint8_t attrs = sb->data[pos++ & (VTERM_SCROLLBACK_BYTES - 1)];
+        for (; count > 0 && col < len; count--, col++) {
+            cells[col].ch = (char)sb->data[pos++ & (VTERM_SCROLLBACK_BYTES - 1)];
+            cells[col].fg_color = colors & 0x0F;
+            cells[col].bg_color = colors >> 4;
+            cells[col].attrs = attrs;
+        }
+    }
+    for (; col < term->cols; col++) {
+        cells[col].ch = ' ';
+        cells[col].fg_color = DEFAULT_FG_COLOR;
+        cells[col].bg_color = DEFAULT_BG_COLOR;
+        cells[col].attrs = VTERM_ATTR_NONE;
+    }
+}
+
+/**
+ * Cells a row of the display shows while looking back: scrollback lines
+ * first, then the top of the screen buffer
+ */
+static void vterm_view_row(const vterm_t *term, uint32_t row, vterm_cell_t *cells)
+{
+    uint32_t count = scrollback_count(term);
+    uint32_t line = count - term->view_offset + row;
+    
+    if (line < count) {
+        scrollback_get(term, line, cells);
+        return;
+    }
+    for (uint32_t col = 0; col < term->cols; col++) {
+        cells[col] = term->buffer[line - count][col];
+    }
+}
+
+/**
+ * Draw the changed cells [start, end) of a row
+ */
+static void vterm_render_row(const vterm_cell_t *cells, uint32_t row,
+                             uint32_t start, uint32_t end, int all)
+{
+    /* Adjacent changed cells in the same colors are drawn as one run */
+    char run[VTERM_MAX_COLS];
+    uint32_t run_col = 0;
+    uint32_t run_len = 0;
+    uint32_t run_fg = 0;
+    uint32_t run_bg = 0;
+    uint32_t first = end;
+    uint32_t last = start;
+    for (uint32_t col = start; col < end; col++) {
+        const vterm_cell_t *cell = &cells[col];
+        if (!all && vterm_cell_equal(cell, &g_screen[row][col])) continue;
+        
+        uint32_t fg, bg;
+        vterm_cell_colors(cell, &fg, &bg);
+        if (run_len > 0 && (run_col + run_len != col || fg != run_fg || bg != run_bg)) {
+            font_draw_run(run_col * FONT_WIDTH, row * FONT_HEIGHT, run, run_len,
+                          run_fg, run_bg);
+            run_len = 0;
+        }
+        if (run_len == 0) {
+            run_col = col;
+            run_fg = fg;
+            run_bg = bg;
+        }
+        run[run_len++] = cell->ch;
+        
+        g_screen[row][col] = *cell;
+        if (col < first) first = col;
+        last = col;
+        if (g_cursor_drawn && col == g_cursor_col && row == g_cursor_row) {
+            g_cursor_drawn = 0;
+        }
+    }
+    if (run_len > 0) {
+        font_draw_run(run_col * FONT_WIDTH, row * FONT_HEIGHT, run, run_len,
+                      run_fg, run_bg);
+    }
+    if (first <= last) {
+        vterm_damage(first, row, last + 1, row + 1);
+    }
+}
+
+/**
+ * Draw the changed cells and the cursor of the active terminal
+ * 
+ * @param all Draw every changed cell, even one the screen already shows
+ */
+static void vterm_render(int all)
+{
     vterm_t *term = &g_terminals[g_active_terminal];
+    int looking_back = term->view_offset > 0;
+    
+    /* History is drawn over the cursor */
+    if (looking_back && g_cursor_drawn) {
+        g_screen[g_cursor_row][g_cursor_col].ch = 0;
+        g_cursor_drawn = 0;
+    }
     
-    /* Redraw all cells */
     for (uint32_t row = 0; row < term->rows; row++) {
-        for (uint32_t col = 0; col < term->cols; col++) {
-            vterm_draw_cell(col, row, &term->buffer[row][col]);
+        uint32_t start = term->dirty_start[row];
+        uint32_t end = term->dirty_end[row];
+        
+        /* The window into the scrollback is put together only here, as it
+           is drawn; cells the screen already shows are skipped */
+        if (looking_back) {
+            vterm_cell_t cells[VTERM_MAX_COLS];
+            term->dirty_start[row] = 0;
+            term->dirty_end[row] = 0;
+            vterm_view_row(term, row, cells);
+            vterm_render_row(cells, row, 0, term->cols, all);
+            continue;
+        }
+        
+        if (start == end) continue;
+        term->dirty_start[row] = 0;
+        term->dirty_end[row] = 0;
+        vterm_render_row(term->buffer[row], row, start, end, all);
+    }
+    
+    int visible = !looking_back && term->cursor_visible && term->cursor_row < term->rows;
+    uint8_t color = term->fg_color;
+    
+    /* Take the cursor off a cell it left */
+    if (g_cursor_drawn && (!visible || g_cursor_col != term->cursor_col ||
+                           g_cursor_row != term->cursor_row || g_cursor_color != color)) {
+        if (g_cursor_row < term->rows && g_cursor_col < term->cols) {
+            vterm_cell_t *cell = &term->buffer[g_cursor_row][g_cursor_col];
+            vterm_draw_cell(g_cursor_col, g_cursor_row, cell);
+            g_screen[g_cursor_row][g_cursor_col] = *cell;
+            vterm_damage(g_cursor_col, g_cursor_row, g_cursor_col + 1, g_cursor_row + 1);
         }
+        g_cursor_drawn = 0;
     }
     
-    /* Draw cursor if visible */
-    if (term->cursor_visible && term->cursor_row < term->rows) {
+    if (visible && !g_cursor_drawn) {
         uint32_t x = term->cursor_col * FONT_WIDTH;
         uint32_t y = term->cursor_row * FONT_HEIGHT;
         
         /* Draw underscore cursor */
-        uint32_t fg = ansi_colors[term->fg_color];
-        for (uint32_t cy = FONT_HEIGHT - 2; cy < FONT_HEIGHT; cy++) {
-            for (uint32_t cx = 0; cx < FONT_WIDTH; cx++) {
-                fb_set_pixel(x + cx, y + cy, fg);
-            }
-        }
+        fb_fill_rect(x, y + FONT_HEIGHT - 2, FONT_WIDTH, 2, ansi_colors[color]);
+        g_cursor_drawn = 1;
+        g_cursor_col = term->cursor_col;
+        g_cursor_row = term->cursor_row;
+        g_cursor_color = color;
+        vterm_damage(g_cursor_col, g_cursor_row, g_cursor_col + 1, g_cursor_row + 1);
+    }
+}
+
+/**
+ * Refresh the display from the active terminal's buffer
+ */
+void vterm_refresh(void)
+{
+    if (!g_initialized || !fbcon_available()) return;
+    
+    int irq_state = interrupt_save_disable();
+    vterm_touch_all(&g_terminals[g_active_terminal]);
+    g_cursor_drawn = 0;
+    if (!g_display_suspended) {
+        vterm_render(1);
+    }
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Draw what changed and send it to the display
+ * 
+ * The cells are drawn with interrupts off, so neither a switch nor a
+ * writer scrolling the screen finds them half done. The flush comes
+ * after; with the GPU's completion interrupt it only queues commands.
+ */
+static void vterm_draw_frame(void)
+{
+    int irq_state = interrupt_save_disable();
+    if (g_display_suspended) {
+        interrupt_restore(irq_state);
+        return;
     }
+    vterm_render(0);
+    uint32_t col0 = g_damage_col0;
+    uint32_t col1 = g_damage_col1;
+    uint32_t row0 = g_damage_row0;
+    uint32_t row1 = g_damage_row1;
+    g_damage_col0 = 0;
+    g_damage_col1 = 0;
+    g_last_frame_us = hal_timer_get_time_us();
+    interrupt_restore(irq_state);
+    
+    if (col0 == col1) return;
+    fb_swap_buffers(col0 * FONT_WIDTH, row0 * FONT_HEIGHT,
+                    (col1 - col0) * FONT_WIDTH, (row1 - row0) * FONT_HEIGHT);
+}
+
+static void vterm_frame_work(work_t *work)
+{
+    (void)work;
+    vterm_draw_frame();
+}
+
+/**
+ * The next frame is due (timer interrupt)
+ */
+static void vterm_frame_timer(void *data)
+{
+    (void)data;
+    queue_work(&g_frame_work);
 }
 
 /**
@@ -261,19 +630,20 @@ void vterm_draw_status_bar(void)
     
     uint32_t y = status_row * FONT_HEIGHT;
     
-    /* Clear the status bar row */
-    for (uint32_t col = 0; col < term->cols; col++) {
-        uint32_t x = col * FONT_WIDTH;
-        fb_fill_rect(x, y, FONT_WIDTH, FONT_HEIGHT, bg);
+    int irq_state = interrupt_save_disable();
+    if (g_display_suspended) {
+        interrupt_restore(irq_state);
+        return;
     }
+    vterm_damage(0, status_row, term->cols, status_row + 1);
+    
+    /* Clear the status bar row */
+    fb_fill_rect(0, y, term->cols * FONT_WIDTH, FONT_HEIGHT, bg);
     
     /* Draw "ThunderOS" at the left */
     const char *title = " ThunderOS ";
-    uint32_t x = 0;
-    for (const char *p = title; *p; p++) {
-        font_draw_char(x, y, *p, fg, bg);
-        x += FONT_WIDTH;
-    }
+    font_draw_string(0, y, title, fg, bg);
+    uint32_t x = font_string_width(title);
     
     /* Draw terminal tabs */
     x += FONT_WIDTH * 2;  /* Add some spacing */
@@ -291,16 +661,9 @@ void vterm_draw_status_bar(void)
         }
         
         /* Draw " VTn " */
-        font_draw_char(x, y, ' ', tab_fg, tab_bg);
-        x += FONT_WIDTH;
-        font_draw_char(x, y, 'V', tab_fg, tab_bg);
-        x += FONT_WIDTH;
-        font_draw_char(x, y, 'T', tab_fg, tab_bg);
-        x += FONT_WIDTH;
-        font_draw_char(x, y, '1' + i, tab_fg, tab_bg);
-        x += FONT_WIDTH;
-        font_draw_char(x, y, ' ', tab_fg, tab_bg);
-        x += FONT_WIDTH;
+        char tab[5] = { ' ', 'V', 'T', (char)('1' + i), ' ' };
+        font_draw_run(x, y, tab, sizeof(tab), tab_fg, tab_bg);
+        x += sizeof(tab) * FONT_WIDTH;
         
         /* Space between tabs */
         x += FONT_WIDTH;
@@ -312,10 +675,21 @@ void vterm_draw_status_bar(void)
     for (const char *p = help; *p; p++) help_len++;
     
     x = (term->cols - help_len) * FONT_WIDTH;
-    for (const char *p = help; *p; p++) {
-        font_draw_char(x, y, *p, fg, bg);
-        x += FONT_WIDTH;
-    }
+    font_draw_string(x, y, help, fg, bg);
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Show the terminal just switched to
+ * 
+ * Every cell was marked changed at the switch; only those that differ
+ * from the previous terminal's are drawn.
+ */
+static void vterm_redraw_work(work_t *work)
+{
+    (void)work;
+    vterm_draw_status_bar();
+    vterm_draw_frame();
 }
 
 /**
@@ -343,10 +717,9 @@ int vterm_switch(int index)
     /* Update input terminal tracking */
     g_input_terminal = index;
     
-    /* Refresh display */
-    vterm_refresh();
-    vterm_draw_status_bar();
-    vterm_flush();
+    /* Refresh display (repeated switches share one redraw) */
+    vterm_touch_all(&g_terminals[index]);
+    queue_work(&g_redraw_work);
     
     /* Log to UART */
     hal_uart_puts("[VT] Switched to ");
@@ -357,11 +730,78 @@ int vterm_switch(int index)
     return 0;
 }
 
+/**
+ * Move the screen contents up by one line
+ * 
+ * The framebuffer scrolls without drawing the glyphs again, so afterwards
+ * only the cells that differ from the line above, and the bottom line,
+ * are drawn.
+ */
+/**
+ * Forget what the screen shows, so every cell is drawn again
+ */
+static void vterm_screen_invalidate(void)
+{
+    for (uint32_t row = 0; row < VTERM_MAX_ROWS; row++) {
+        for (uint32_t col = 0; col < VTERM_MAX_COLS; col++) {
+            g_screen[row][col].ch = 0;
+        }
+    }
+    g_cursor_drawn = 0;
+}
+
+static void vterm_scroll_screen(vterm_t *term)
+{
+    /* The pixels and g_screen move together, never under a frame */
+    int irq_state = interrupt_save_disable();
+    
+    if (g_display_suspended ||
+        fb_scroll_up(term->rows * FONT_HEIGHT, FONT_HEIGHT) < 0) {
+        /* Leave the screen as it is and draw every cell again */
+        vterm_screen_invalidate();
+        interrupt_restore(irq_state);
+        return;
+    }
+    
+    for (uint32_t row = 0; row < term->rows - 1; row++) {
+        for (uint32_t col = 0; col < term->cols; col++) {
+            g_screen[row][col] = g_screen[row + 1][col];
+        }
+    }
+    
+    /* What the bottom line shows now is stale */
+    for (uint32_t col = 0; col < term->cols; col++) {
+        g_screen[term->rows - 1][col].ch = 0;
+    }
+    
+    /* The cursor moved up with its line, or off the top */
+    if (g_cursor_drawn) {
+        if (g_cursor_row == 0) {
+            g_cursor_drawn = 0;
+        } else {
+            g_cursor_row--;
+        }
+    }
+    
+    vterm_damage(0, 0, term->cols, term->rows);
+    interrupt_restore(irq_state);
+}
+
 /**
  * Scroll the terminal up by one line
  */
 static void vterm_scroll_up(vterm_t *term)
 {
+    scrollback_push(term, term->buffer[0]);
+    
+    if (term->view_offset > 0) {
+        /* Looking back: keep showing the same lines */
+        uint32_t count = scrollback_count(term);
+        term->view_offset = term->view_offset < count ? term->view_offset + 1 : count;
+    } else if (term == &g_terminals[g_active_terminal] && fbcon_available()) {
+        vterm_scroll_screen(term);
+    }
+    
     /* Move all rows up */
     for (uint32_t row = 0; row < term->rows - 1; row++) {
         for (uint32_t col = 0; col < term->cols; col++) {
@@ -376,6 +816,8 @@ static void vterm_scroll_up(vterm_t *term)
         term->buffer[term->rows - 1][col].bg_color = term->bg_color;
         term->buffer[term->rows - 1][col].attrs = VTERM_ATTR_NONE;
     }
+    
+    vterm_touch_all(term);
 }
 
 /**
@@ -407,71 +849,7 @@ void vterm_putc(char c)
         return;
     }
     
-    vterm_t *term = &g_terminals[g_active_terminal];
-    
-    /* Handle control characters */
-    switch (c) {
-    case '\n':
-        vterm_newline(term);
-        /* Redraw from current cursor position to end */
-        if (term == &g_terminals[g_active_terminal]) {
-            vterm_refresh();
-        }
-        return;
-        
-    case '\r':
-        term->cursor_col = 0;
-        return;
-        
-    case '\b':
-        if (term->cursor_col > 0) {
-            term->cursor_col--;
-            /* Clear the cell */
-            term->buffer[term->cursor_row][term->cursor_col].ch = ' ';
-            /* Redraw */
-            if (term == &g_terminals[g_active_terminal]) {
-                vterm_draw_cell(term->cursor_col, term->cursor_row, 
-                               &term->buffer[term->cursor_row][term->cursor_col]);
-            }
-        }
-        return;
-        
-    case '\t':
-        /* Tab to next VTERM_TAB_WIDTH-column boundary */
-        do {
-            vterm_putc(' ');
-        } while (term->cursor_col % VTERM_TAB_WIDTH != 0 && term->cursor_col < term->cols);
-        return;
-        
-    case '\0':
-        return;
-        
-    default:
-        break;
-    }
-    
-    /* Skip non-printable characters */
-    if (c < 0x20 || c > 0x7E) {
-        return;
-    }
-    
-    /* Store character in buffer */
-    term->buffer[term->cursor_row][term->cursor_col].ch = c;
-    term->buffer[term->cursor_row][term->cursor_col].fg_color = term->fg_color;
-    term->buffer[term->cursor_row][term->cursor_col].bg_color = term->bg_color;
-    term->buffer[term->cursor_row][term->cursor_col].attrs = term->attrs;
-    
-    /* Draw to screen if this is the active terminal */
-    if (term == &g_terminals[g_active_terminal]) {
-        vterm_draw_cell(term->cursor_col, term->cursor_row,
-                       &term->buffer[term->cursor_row][term->cursor_col]);
-    }
-    
-    /* Advance cursor */
-    term->cursor_col++;
-    if (term->cursor_col >= term->cols) {
-        vterm_newline(term);
-    }
+    vterm_putc_internal(&g_terminals[g_active_terminal], c);
 }
 
 /**
@@ -514,8 +892,8 @@ void vterm_clear(void)
     term->cursor_col = 0;
     term->cursor_row = 0;
     
-    /* Redraw */
-    vterm_refresh();
+    /* Drawn at the next flush */
+    vterm_touch_all(term);
     vterm_draw_status_bar();
 }
 
@@ -575,11 +953,89 @@ void vterm_flush(void)
         return;
     }
     
-    /* Only flush to framebuffer if available */
-    if (fbcon_available()) {
-        fb_flush();
-    }
     /* In UART-only mode, output is already immediate */
+    if (!fbcon_available()) return;
+    
+    /* Until the worker runs, draw at once */
+    if (!workqueue_running()) {
+        vterm_draw_frame();
+        return;
+    }
+    
+    /* A frame already on the way shows this output too */
+    int irq_state = interrupt_save_disable();
+    if (!g_frame_work.pending && !hrtimer_pending(&g_frame_timer)) {
+        uint64_t due = g_last_frame_us + VTERM_FRAME_US;
+        if (hal_timer_get_time_us() >= due) {
+            queue_work(&g_frame_work);
+        } else {
+            hrtimer_start(&g_frame_timer, due);
+        }
+    }
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Move the active terminal's view through its scrollback
+ */
+uint32_t vterm_scroll_view(int lines)
+{
+    if (!g_initialized || !fbcon_available()) return 0;
+    
+    int irq_state = interrupt_save_disable();
+    vterm_t *term = &g_terminals[g_active_terminal];
+    int64_t offset = (int64_t)term->view_offset + lines;
+    if (offset < 0) offset = 0;
+    if (offset > (int64_t)scrollback_count(term)) offset = scrollback_count(term);
+    
+    int moved = (uint32_t)offset != term->view_offset;
+    if (moved) {
+        term->view_offset = (uint32_t)offset;
+        vterm_touch_all(term);
+    }
+    uint32_t view_offset = term->view_offset;
+    interrupt_restore(irq_state);
+    
+    if (moved) {
+        vterm_flush();
+    }
+    return view_offset;
+}
+
+/**
+ * Get the number of lines in a terminal's scrollback
+ */
+uint32_t vterm_scrollback_lines(int index)
+{
+    if (!g_initialized || index < 0 || index >= VTERM_MAX_TERMINALS) return 0;
+    return scrollback_count(&g_terminals[index]);
+}
+
+/**
+ * Stop drawing on the framebuffer
+ */
+void vterm_display_suspend(void)
+{
+    int irq_state = interrupt_save_disable();
+    g_display_suspended = 1;
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Take the framebuffer back and draw the whole active terminal again
+ */
+void vterm_display_resume(void)
+{
+    int irq_state = interrupt_save_disable();
+    g_display_suspended = 0;
+    vterm_screen_invalidate();
+    if (g_initialized) {
+        vterm_touch_all(&g_terminals[g_active_terminal]);
+    }
+    interrupt_restore(irq_state);
+    
+    vterm_draw_status_bar();
+    vterm_flush();
 }
 
 /**
@@ -598,6 +1054,9 @@ void vterm_flush(void)
  *   Alt+F1 = ESC ESC O P  or  ESC [ 1 ; 3 P  (xterm)
  *   Alt+Fn = ESC [ n ; 3 ~  (xterm modifier format)
  * 
+ * Shift+PgUp and Shift+PgDn (ESC [ 5 ; 2 ~ and ESC [ 6 ; 2 ~) move
+ * through the scrollback by half a screen; any other key goes back.
+ * 
  * For simplicity, we also support direct Alt+1 through Alt+6:
  *   Alt+1 = ESC 1
  *   Alt+2 = ESC 2
@@ -642,7 +1101,7 @@ char vterm_process_input(char c)
             g_input_state.in_escape = 0;
             g_input_state.escape_len = 0;
             /* Pass the ESC and the character to userspace */
-            input_buffer_put_to(g_active_terminal, 0x1B);
+            ldisc_receive(g_active_terminal, 0x1B);
             return c;
         }
         
@@ -668,8 +1127,8 @@ char vterm_process_input(char c)
                 break;
             }
             /* Unknown ESC O x sequence, pass through */
-            input_buffer_put_to(g_active_terminal, 0x1B);
-            input_buffer_put_to(g_active_terminal, 'O');
+            ldisc_receive(g_active_terminal, 0x1B);
+            ldisc_receive(g_active_terminal, 'O');
             return c;
         }
         
@@ -680,9 +1139,9 @@ char vterm_process_input(char c)
                 g_input_state.in_escape = 0;
                 g_input_state.escape_len = 0;
                 /* Buffer the entire escape sequence for userspace */
-                input_buffer_put_to(g_active_terminal, 0x1B);  /* ESC */
-                input_buffer_put_to(g_active_terminal, '[');
-                input_buffer_put_to(g_active_terminal, c);     /* A/B/C/D */
+                ldisc_receive(g_active_terminal, 0x1B);  /* ESC */
+                ldisc_receive(g_active_terminal, '[');
+                ldisc_receive(g_active_terminal, c);     /* A/B/C/D */
                 return 0;  /* Consumed - chars are in buffer */
             }
         }
@@ -694,6 +1153,15 @@ char vterm_process_input(char c)
                 g_input_state.in_escape = 0;
                 g_input_state.escape_len = 0;
                 
+                /* Shift+PgUp / Shift+PgDn: ESC [ 5 ; 2 ~ and ESC [ 6 ; 2 ~ */
+                if (g_input_state.escape_len == 5 &&
+                    (g_input_state.escape_buf[1] == '5' || g_input_state.escape_buf[1] == '6') &&
+                    g_input_state.escape_buf[2] == ';' && g_input_state.escape_buf[3] == '2') {
+                    int half = (int)(g_terminals[g_active_terminal].rows / 2);
+                    vterm_scroll_view(g_input_state.escape_buf[1] == '5' ? half : -half);
+                    return 0;
+                }
+                
                 /* Parse function key number */
                 if (g_input_state.escape_buf[1] == '1') {
                     if (g_input_state.escape_len == 4) {
@@ -726,7 +1194,7 @@ char vterm_process_input(char c)
             }
             
             /* Keep accumulating if it looks like a valid sequence in progress */
-            if (g_input_state.escape_len < 7 && (c >= '0' && c <= '9')) {
+            if (g_input_state.escape_len < 7 && ((c >= '0' && c <= '9') || c == ';')) {
                 return 0;
             }
             
@@ -736,10 +1204,10 @@ char vterm_process_input(char c)
             g_input_state.in_escape = 0;
             g_input_state.escape_len = 0;
             /* Pass ESC [ and any accumulated digits to userspace */
-            input_buffer_put_to(g_active_terminal, 0x1B);
-            input_buffer_put_to(g_active_terminal, '[');
+            ldisc_receive(g_active_terminal, 0x1B);
+            ldisc_receive(g_active_terminal, '[');
             for (int i = 1; i < saved_len - 1; i++) {
-                input_buffer_put_to(g_active_terminal, g_input_state.escape_buf[i]);
+                ldisc_receive(g_active_terminal, g_input_state.escape_buf[i]);
             }
             return c;
         }
@@ -764,6 +1232,8 @@ char vterm_process_input(char c)
             struct process *fg_proc = process_get(term->fg_pid);
             if (fg_proc && fg_proc->state != PROC_UNUSED) {
                 signal_send(fg_proc, SIGINT);
+                /* What was typed of a line goes with it */
+                ldisc_discard_line(g_active_terminal);
                 /* Echo ^C to show it was received */
                 vterm_putc('^');
                 vterm_putc('C');
@@ -780,6 +1250,8 @@ char vterm_process_input(char c)
             struct process *fg_proc = process_get(term->fg_pid);
             if (fg_proc && fg_proc->state != PROC_UNUSED) {
                 signal_send(fg_proc, SIGTSTP);
+                /* What was typed of a line goes with it */
+                ldisc_discard_line(g_active_terminal);
                 /* Echo ^Z to show it was received */
                 vterm_putc('^');
                 vterm_putc('Z');
@@ -789,7 +1261,10 @@ char vterm_process_input(char c)
         return 0;  /* Consumed */
     }
     
-    /* Regular character */
+    /* Regular character; typing goes back to the live screen */
+    if (g_terminals[g_active_terminal].view_offset > 0) {
+        vterm_scroll_view(-(int)g_terminals[g_active_terminal].view_offset);
+    }
     return c;
 }
 
@@ -803,7 +1278,7 @@ char vterm_process_input(char c)
 /**
  * Internal function to write character to a specific terminal
  */
-static void vterm_putc_internal(vterm_t *term, int index, char c)
+static void vterm_putc_internal(vterm_t *term, char c)
 {
     if (!term) return;
     
@@ -813,29 +1288,7 @@ static void vterm_putc_internal(vterm_t *term, int index, char c)
     /* Handle control characters */
     switch (c) {
     case '\n':
-        /* Move to next line */
-        term->cursor_row++;
-        term->cursor_col = 0;
-        if (term->cursor_row >= term->rows) {
-            /* Scroll up */
-            for (uint32_t row = 0; row < term->rows - 1; row++) {
-                for (uint32_t col = 0; col < term->cols; col++) {
-                    term->buffer[row][col] = term->buffer[row + 1][col];
-                }
-            }
-            /* Clear bottom row */
-            for (uint32_t col = 0; col < term->cols; col++) {
-                term->buffer[term->rows - 1][col].ch = ' ';
-                term->buffer[term->rows - 1][col].fg_color = term->fg_color;
-                term->buffer[term->rows - 1][col].bg_color = term->bg_color;
-                term->buffer[term->rows - 1][col].attrs = VTERM_ATTR_NONE;
-            }
-            term->cursor_row = term->rows - 1;
-        }
-        /* Redraw if this is the active terminal */
-        if (index == g_active_terminal) {
-            vterm_refresh();
-        }
+        vterm_newline(term);
         return;
         
     case '\r':
@@ -846,17 +1299,14 @@ static void vterm_putc_internal(vterm_t *term, int index, char c)
         if (term->cursor_col > 0) {
             term->cursor_col--;
             term->buffer[term->cursor_row][term->cursor_col].ch = ' ';
-            if (index == g_active_terminal) {
-                vterm_draw_cell(term->cursor_col, term->cursor_row, 
-                               &term->buffer[term->cursor_row][term->cursor_col]);
-            }
+            vterm_touch(term, term->cursor_col, term->cursor_row);
         }
         return;
         
     case '\t':
         /* Tab to next VTERM_TAB_WIDTH-column boundary */
         do {
-            vterm_putc_internal(term, index, ' ');
+            vterm_putc_internal(term, ' ');
         } while (term->cursor_col % VTERM_TAB_WIDTH != 0 && term->cursor_col < term->cols);
         return;
         
@@ -872,41 +1322,17 @@ static void vterm_putc_internal(vterm_t *term, int index, char c)
         return;
     }
     
-    /* Store character in buffer */
+    /* Store character in buffer; it is drawn at the next flush */
     term->buffer[term->cursor_row][term->cursor_col].ch = c;
     term->buffer[term->cursor_row][term->cursor_col].fg_color = term->fg_color;
     term->buffer[term->cursor_row][term->cursor_col].bg_color = term->bg_color;
     term->buffer[term->cursor_row][term->cursor_col].attrs = term->attrs;
-    
-    /* Draw to screen if this is the active terminal */
-    if (index == g_active_terminal) {
-        vterm_draw_cell(term->cursor_col, term->cursor_row,
-                       &term->buffer[term->cursor_row][term->cursor_col]);
-    }
+    vterm_touch(term, term->cursor_col, term->cursor_row);
     
     /* Advance cursor */
     term->cursor_col++;
     if (term->cursor_col >= term->cols) {
-        term->cursor_row++;
-        term->cursor_col = 0;
-        if (term->cursor_row >= term->rows) {
-            /* Scroll */
-            for (uint32_t row = 0; row < term->rows - 1; row++) {
-                for (uint32_t col = 0; col < term->cols; col++) {
-                    term->buffer[row][col] = term->buffer[row + 1][col];
-                }
-            }
-            for (uint32_t col = 0; col < term->cols; col++) {
-                term->buffer[term->rows - 1][col].ch = ' ';
-                term->buffer[term->rows - 1][col].fg_color = term->fg_color;
-                term->buffer[term->rows - 1][col].bg_color = term->bg_color;
-                term->buffer[term->rows - 1][col].attrs = VTERM_ATTR_NONE;
-            }
-            term->cursor_row = term->rows - 1;
-            if (index == g_active_terminal) {
-                vterm_refresh();
-            }
-        }
+        vterm_newline(term);
     }
 }
 
@@ -927,7 +1353,7 @@ void vterm_putc_to(int index, char c)
     }
     
     vterm_t *term = &g_terminals[index];
-    vterm_putc_internal(term, index, c);
+    vterm_putc_internal(term, c);
     
     /* In UART-only mode, echo to UART if writing to active terminal */
     if (!fbcon_available() && index == g_active_terminal) {
@@ -935,6 +1361,43 @@ void vterm_putc_to(int index, char c)
     }
 }
 
+/**
+ * Write a buffer to a virtual terminal, drawn in one flush
+ */
+void vterm_write(int index, const char *buf, size_t len)
+{
+    if (!buf || len == 0) return;
+    
+    if (!g_initialized) {
+        /* Fallback to UART */
+        hal_uart_write(buf, (unsigned int)len);
+        return;
+    }
+    
+    if (index < 0 || index >= VTERM_MAX_TERMINALS) {
+        /* Default to active terminal */
+        index = g_active_terminal;
+    }
+    
+    /* The whole buffer lands before a frame or an echo can come between */
+    int irq_state = interrupt_save_disable();
+    vterm_t *term = &g_terminals[index];
+    for (size_t i = 0; i < len; i++) {
+        vterm_putc_internal(term, buf[i]);
+    }
+    int active = index == g_active_terminal;
+    interrupt_restore(irq_state);
+    
+    if (!active) return;
+    
+    /* In UART-only mode the UART is the display: one queued write */
+    if (fbcon_available()) {
+        vterm_flush();
+    } else {
+        hal_uart_write(buf, (unsigned int)len);
+    }
+}
+
 /**
  * Write a string to a specific virtual terminal
  */
@@ -1016,6 +1479,7 @@ char vterm_getc_from(int index)
     
     /* Process through terminal system for VT switching */
     c = vterm_process_input(c);
+    ldisc_flush_echo();
     
     return c;
 }
@@ -1023,17 +1487,44 @@ char vterm_getc_from(int index)
 /*
  * Per-terminal input buffers for console multiplexing.
  * Each VT has its own input queue so multiple shells can run independently.
+ * 
+ * A line discipline stands in front of each queue. In raw mode a
+ * character goes on the queue as it arrives. In canonical mode, the
+ * default, it goes into a line being edited, where erase (DEL or ^H)
+ * takes back the last character and kill (^U) the whole line; a newline
+ * (CR reads as one) or ^D moves the line to the queue and wakes the
+ * readers, who get at most a line per read. The ^D stays on the queue
+ * to end the read that reaches it, so on an empty line it reads as end
+ * of file (a read of 0 bytes). With VTERM_ECHO the input
+ * is echoed to its terminal, gathered and drawn once per batch of input.
  */
-#define INPUT_BUFFER_SIZE 64
-
 typedef struct {
-    char buffer[INPUT_BUFFER_SIZE];
+    char buffer[VTERM_INPUT_BUFFER_SIZE];
     volatile int head;
     volatile int tail;
+    
+    /* Canonical line being edited */
+    char line[VTERM_LINE_MAX];
+    int line_len;
+    
+    /* VTERM_ICANON, VTERM_ECHO */
+    uint32_t lflag;
+    
+    /* Echo not drawn yet */
+    char echo[VTERM_ECHO_BATCH];
+    int echo_len;
 } vterm_input_buffer_t;
 
 static vterm_input_buffer_t g_input_buffers[VTERM_MAX_TERMINALS];
 
+/* Readers and pollers waiting for input, per terminal (zeroed = empty) */
+static wait_queue_t g_input_waiters[VTERM_MAX_TERMINALS];
+
+/* Line editing characters */
+#define CHAR_EOF    0x04    /* ^D */
+#define CHAR_KILL   0x15    /* ^U */
+#define CHAR_DEL    0x7F
+
 /**
  * Check if input buffer for a terminal has data
  */
@@ -1055,19 +1546,19 @@ static int input_buffer_get_from(int index)
         return -1;
     }
     char c = buf->buffer[buf->tail];
-    buf->tail = (buf->tail + 1) % INPUT_BUFFER_SIZE;
+    buf->tail = (buf->tail + 1) % VTERM_INPUT_BUFFER_SIZE;
     return (unsigned char)c;
 }
 
 /**
- * Put character in a terminal's input buffer
+ * Put character in a terminal's input buffer (the caller wakes readers)
  * Returns 0 on success, -1 if full
  */
 static int input_buffer_put_to(int index, char c)
 {
     if (index < 0 || index >= VTERM_MAX_TERMINALS) return -1;
     vterm_input_buffer_t *buf = &g_input_buffers[index];
-    int next = (buf->head + 1) % INPUT_BUFFER_SIZE;
+    int next = (buf->head + 1) % VTERM_INPUT_BUFFER_SIZE;
     if (next == buf->tail) {
         return -1;  /* Buffer full */
     }
@@ -1076,6 +1567,14 @@ static int input_buffer_put_to(int index, char c)
     return 0;
 }
 
+/**
+ * Free space in a terminal's input buffer
+ */
+static int input_buffer_room(vterm_input_buffer_t *buf)
+{
+    return (buf->tail - buf->head - 1 + VTERM_INPUT_BUFFER_SIZE) % VTERM_INPUT_BUFFER_SIZE;
+}
+
 /* Legacy single-buffer functions for backward compatibility */
 static int input_buffer_available(void)
 {
@@ -1087,12 +1586,154 @@ static int input_buffer_get(void)
     return input_buffer_get_from(g_active_terminal);
 }
 
+/**
+ * Reset a terminal's line discipline to canonical mode with echo
+ */
+static void ldisc_init(int index)
+{
+    vterm_input_buffer_t *in = &g_input_buffers[index];
+    in->lflag = VTERM_ICANON | VTERM_ECHO;
+    in->line_len = 0;
+    in->echo_len = 0;
+}
+
+/**
+ * Draw the echo gathered for every terminal
+ */
+static void ldisc_flush_echo(void)
+{
+    for (int i = 0; i < VTERM_MAX_TERMINALS; i++) {
+        vterm_input_buffer_t *in = &g_input_buffers[i];
+        if (in->echo_len > 0) {
+            int len = in->echo_len;
+            in->echo_len = 0;
+            vterm_write(i, in->echo, (size_t)len);
+        }
+    }
+}
+
+/**
+ * Echo input to a terminal, if it echoes
+ */
+static void ldisc_echo(int index, const char *s, int len)
+{
+    vterm_input_buffer_t *in = &g_input_buffers[index];
+    if (!(in->lflag & VTERM_ECHO)) {
+        return;
+    }
+    for (int i = 0; i < len; i++) {
+        if (in->echo_len == VTERM_ECHO_BATCH) {
+            ldisc_flush_echo();
+        }
+        in->echo[in->echo_len++] = s[i];
+    }
+}
+
+/**
+ * Move the line being edited to the input buffer and wake the readers
+ * 
+ * @param eof Nonzero for ^D, queued after the line to end the read there
+ */
+static void ldisc_commit(int index, int eof)
+{
+    vterm_input_buffer_t *in = &g_input_buffers[index];
+    
+    /* A line that does not fit is lost, as input past a full buffer is */
+    if (in->line_len + (eof ? 1 : 0) > input_buffer_room(in)) {
+        in->line_len = 0;
+        return;
+    }
+    for (int i = 0; i < in->line_len; i++) {
+        input_buffer_put_to(index, in->line[i]);
+    }
+    if (eof) {
+        input_buffer_put_to(index, CHAR_EOF);
+    }
+    in->line_len = 0;
+    wait_queue_wake(&g_input_waiters[index]);
+}
+
+/**
+ * Drop the line being edited (the terminal was interrupted), drawing
+ * the echo so far before whatever reports the interruption
+ */
+static void ldisc_discard_line(int index)
+{
+    g_input_buffers[index].line_len = 0;
+    ldisc_flush_echo();
+}
+
+/**
+ * Take a character of input for a terminal
+ */
+static void ldisc_receive(int index, char c)
+{
+    if (index < 0 || index >= VTERM_MAX_TERMINALS) return;
+    vterm_input_buffer_t *in = &g_input_buffers[index];
+    
+    if (!(in->lflag & VTERM_ICANON)) {
+        if (input_buffer_put_to(index, c) == 0) {
+            ldisc_echo(index, &c, 1);
+            wait_queue_wake(&g_input_waiters[index]);
+        }
+        return;
+    }
+    
+    switch (c) {
+    case '\r':
+    case '\n':
+        /* line[] always keeps room for the newline */
+        in->line[in->line_len++] = '\n';
+        ldisc_echo(index, "\r\n", 2);
+        ldisc_commit(index, 0);
+        return;
+        
+    case CHAR_EOF:
+        ldisc_commit(index, 1);
+        return;
+        
+    case CHAR_DEL:
+    case '\b':
+        if (in->line_len > 0) {
+            in->line_len--;
+            ldisc_echo(index, "\b \b", 3);
+        }
+        return;
+        
+    case CHAR_KILL:
+        while (in->line_len > 0) {
+            in->line_len--;
+            ldisc_echo(index, "\b \b", 3);
+        }
+        return;
+        
+    default:
+        if (in->line_len < VTERM_LINE_MAX - 1) {
+            in->line[in->line_len++] = c;
+            ldisc_echo(index, &c, 1);
+        }
+        return;
+    }
+}
+
+/**
+ * Feed a character to a terminal's line discipline as if typed
+ */
+void vterm_input_char(int index, char c)
+{
+    int irq_state = interrupt_save_disable();
+    ldisc_receive(index, c);
+    ldisc_flush_echo();
+    interrupt_restore(irq_state);
+}
+
 /**
  * Poll for keyboard input and handle VT switching
  * 
- * This is called from timer interrupt to allow VT switching
- * even when no process is reading input. Regular characters
- * are buffered to the ACTIVE terminal's input queue.
+ * Called from the UART receive interrupt, or from the timer interrupt
+ * where that is not available, so VT switching works even when no
+ * process is reading input. Regular characters go to the ACTIVE
+ * terminal's line discipline.
  */
 int vterm_poll_input(void)
 {
@@ -1110,15 +1751,34 @@ int vterm_poll_input(void)
             /* Character was consumed by VT switch or escape processing */
             processed = 1;
         } else {
-            /* Regular character - buffer to active terminal's input queue */
-            input_buffer_put_to(g_active_terminal, result);
+            /* Regular character - to the active terminal's input */
+            ldisc_receive(g_active_terminal, result);
             processed = 1;
         }
     }
     
+    /* Echo the whole batch in one draw */
+    ldisc_flush_echo();
+    
     return processed;
 }
 
+/**
+ * UART receive interrupt: buffer the input and wake its readers
+ */
+static void vterm_input_irq(void)
+{
+    vterm_poll_input();
+}
+
+/**
+ * Check whether input still has to be polled from the timer
+ */
+int vterm_input_needs_polling(void)
+{
+    return !g_input_irq;
+}
+
 /**
  * Get a character that was buffered during polling for a specific terminal
  */
@@ -1135,6 +1795,138 @@ int vterm_has_buffered_input_for(int index)
     return input_buffer_available_for(index);
 }
 
+/**
+ * Read a terminal's input: a line at most in canonical mode
+ */
+int vterm_read_input(int index, char *buf, size_t count)
+{
+    if (index < 0 || index >= VTERM_MAX_TERMINALS) return -1;
+    vterm_input_buffer_t *in = &g_input_buffers[index];
+    
+    int irq_state = interrupt_save_disable();
+    int canonical = in->lflag & VTERM_ICANON;
+    int result = -1;
+    size_t n = 0;
+    while (n < count) {
+        int c = input_buffer_get_from(index);
+        if (c < 0) {
+            break;
+        }
+        
+        /* A ^D ends the read, with what came before it */
+        if (canonical && c == CHAR_EOF) {
+            result = 0;
+            break;
+        }
+        buf[n++] = (char)c;
+        if (canonical && c == '\n') {
+            break;
+        }
+    }
+    interrupt_restore(irq_state);
+    
+    return n > 0 ? (int)n : result;
+}
+
+/**
+ * Get a terminal's line discipline settings
+ */
+int vterm_get_termios(int index, vterm_termios_t *termios)
+{
+    if (index < 0 || index >= VTERM_MAX_TERMINALS || !termios) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    termios->lflag = g_input_buffers[index].lflag;
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Change a terminal's line discipline settings
+ */
+int vterm_set_termios(int index, const vterm_termios_t *termios)
+{
+    if (index < 0 || index >= VTERM_MAX_TERMINALS || !termios) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    vterm_input_buffer_t *in = &g_input_buffers[index];
+    
+    int irq_state = interrupt_save_disable();
+    uint32_t old = in->lflag;
+    in->lflag = termios->lflag & (VTERM_ICANON | VTERM_ECHO);
+    if ((old & VTERM_ICANON) && !(in->lflag & VTERM_ICANON)) {
+        /* Raw reads take what was typed of a line as it is */
+        if (in->line_len > 0) {
+            ldisc_commit(index, 0);
+        }
+    }
+    interrupt_restore(irq_state);
+    
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Console ioctl(): TCGETS and TCSETS
+ */
+int vterm_ioctl(int index, uint32_t request, uint64_t arg)
+{
+    if (!g_initialized) {
+        RETURN_ERRNO(THUNDEROS_ENOTTY);
+    }
+    if (index < 0 || index >= VTERM_MAX_TERMINALS) {
+        index = g_active_terminal;
+    }
+    
+    vterm_termios_t termios;
+    switch (request) {
+    case TCGETS:
+        vterm_get_termios(index, &termios);
+        if (copy_to_user((void *)arg, &termios, sizeof(termios)) != 0) {
+            /* errno already set by copy_to_user */
+            return -1;
+        }
+        clear_errno();
+        return 0;
+        
+    case TCSETS:
+        if (copy_from_user(&termios, (const void *)arg, sizeof(termios)) != 0) {
+            /* errno already set by copy_from_user */
+            return -1;
+        }
+        return vterm_set_termios(index, &termios);
+        
+    default:
+        RETURN_ERRNO(THUNDEROS_ENOTTY);
+    }
+}
+
+/**
+ * Poll method of a terminal's input buffer
+ */
+int vterm_input_poll(int index, struct poll_table *pt)
+{
+    if (index < 0 || index >= VTERM_MAX_TERMINALS) return 0;
+    poll_wait(pt, &g_input_waiters[index]);
+    return input_buffer_available_for(index) ? POLLIN : 0;
+}
+
+/**
+ * Sleep until a terminal has buffered input
+ */
+void vterm_wait_input(int index)
+{
+    if (index < 0 || index >= VTERM_MAX_TERMINALS) return;
+    
+    /* Interrupts stay off from the check until we are on the queue, so
+     * input buffered by the timer in between cannot be missed */
+    int irq_state = interrupt_save_disable();
+    if (!input_buffer_available_for(index)) {
+        wait_queue_sleep(&g_input_waiters[index]);
+    }
+    interrupt_restore(irq_state);
+}
+
 /**
  * Get a character that was buffered during polling
  * Called from sys_read to get pre-buffered input
@@ -0,0 +1,577 @@
+/*
+ * bcache.c - Block buffer cache
+ *
+ * Buffers sit in a hash table keyed by (device, block) and on one LRU
+ * list, most recently used first. Eviction walks from the tail for a
+ * buffer nobody holds, writing it back first if it is dirty. The device
+ * is the virtio block device (the device handle only identifies it).
+ *
+ * Device I/O goes through the block request queue: each buffer is one
+ * blk_io_t, and batched I/O is plugged so the queue sees every buffer
+ * before merging consecutive blocks and ordering the requests. Reads a
+ * caller waits for are served ahead of write-back.
+ *
+ * Device I/O sleeps, so other processes can use the cache meanwhile. A
+ * buffer under I/O is BUF_BUSY and holds a reference of its own: it is
+ * never evicted or queued twice, and bread()/bget() wait for the I/O to
+ * finish before handing it out. A busy buffer modified by its holder is
+ * marked BUF_REDIRTY so the write in flight does not mark it clean.
+ *
+ * A BUF_HELD buffer keeps the reference bhold() took, so it is never
+ * evicted, and write-back skips it even when it is dirty.
+ *
+ * The "bcache" shrinker frees unreferenced buffers from the LRU end
+ * under memory pressure; kswapd (SHRINK_MAY_SLEEP) writes dirty ones
+ * back first, as eviction does.
+ */
+
+#include "../../include/fs/bcache.h"
+#include "../../include/drivers/blk_queue.h"
+#include "../../include/mm/kmalloc.h"
+#include "../../include/mm/slab.h"
+#include "../../include/mm/reclaim.h"
+#include "../../include/arch/interrupt.h"
+#include "../../include/kernel/constants.h"
+#include "../../include/kernel/errno.h"
+#include "../../include/kernel/process.h"
+#include "../../include/kernel/wait_queue.h"
+#include <stddef.h>
+
+#define BCACHE_BUCKETS 64
+
+static buf_t *g_buckets[BCACHE_BUCKETS];
+static buf_t *g_lru_head = NULL;       /* Most recently used */
+static buf_t *g_lru_tail = NULL;       /* First eviction candidate */
+static kmem_cache_t *g_buf_cache = NULL;
+static wait_queue_t g_io_wait = WAIT_QUEUE_INIT;  /* Waiting for a busy buffer */
+static bcache_stats_t g_stats;
+
+static void bcache_release(buf_t *b);
+static int bcache_write_all(void);
+static size_t bcache_shrink_count(shrinker_t *shrinker);
+static size_t bcache_shrink_scan(shrinker_t *shrinker, size_t nr, uint32_t flags);
+
+static shrinker_t g_shrinker = { "bcache", bcache_shrink_count, bcache_shrink_scan, 0, 0, NULL };
+
+static uint32_t bcache_bucket(void *device, uint32_t block) {
+    uint32_t hash = block * 2654435761u ^ (uint32_t)((uintptr_t)device >> 4);
+    return hash % BCACHE_BUCKETS;
+}
+
+static void lru_unlink(buf_t *b) {
+    if (b->lru_prev) {
+        b->lru_prev->lru_next = b->lru_next;
+    } else {
+        g_lru_head = b->lru_next;
+    }
+    if (b->lru_next) {
+        b->lru_next->lru_prev = b->lru_prev;
+    } else {
+        g_lru_tail = b->lru_prev;
+    }
+    b->lru_prev = NULL;
+    b->lru_next = NULL;
+}
+
+static void lru_push_front(buf_t *b) {
+    b->lru_prev = NULL;
+    b->lru_next = g_lru_head;
+    if (g_lru_head) {
+        g_lru_head->lru_prev = b;
+    } else {
+        g_lru_tail = b;
+    }
+    g_lru_head = b;
+}
+
+/**
+ * Mark a buffer as under I/O; the I/O holds a reference until it ends
+ */
+static void bcache_io_begin(buf_t *b) {
+    b->flags |= BUF_BUSY;
+    b->refcount++;
+}
+
+/**
+ * Record the outcome of a buffer's I/O and let waiters at it
+ *
+ * Also runs from the device interrupt, so it only updates state: a
+ * buffer left invalid and unreferenced is freed by the next eviction.
+ */
+static void bcache_io_end(buf_t *b, int write, int ok) {
+    if (ok && write) {
+        if (b->flags & BUF_REDIRTY) {
+            b->flags &= ~BUF_REDIRTY;      /* Changed meanwhile: stays dirty */
+        } else {
+            b->flags &= ~BUF_DIRTY;
+            g_stats.dirty--;
+        }
+        g_stats.writes++;
+    } else if (ok) {
+        b->flags |= BUF_VALID;
+    }
+    b->flags &= ~BUF_BUSY;
+    b->refcount--;
+    wait_queue_wake(&g_io_wait);
+}
+
+/**
+ * Wait until nobody is doing I/O on a buffer
+ */
+static void bcache_wait(buf_t *b) {
+    // Interrupts stay off from the check until we are on the queue
+    int irq_state = interrupt_save_disable();
+    while ((b->flags & BUF_BUSY) && process_current()) {
+        wait_queue_sleep_irqoff(&g_io_wait);
+    }
+    interrupt_restore(irq_state);
+}
+
+/* Device completion of a buffer's I/O */
+static void bcache_io_done(blk_io_t *io, int ok) {
+    bcache_io_end((buf_t *)io->arg, io->write, ok);
+}
+
+/**
+ * Hand a buffer's I/O to the request queue, or to a plug collecting it
+ */
+static void bcache_start(buf_t *b, int write, blk_plug_t *plug, blk_batch_t *batch) {
+    uint64_t sector = ((uint64_t)b->block * b->size) / SECTOR_SIZE;
+    bcache_io_begin(b);
+    blk_io_init(&b->io, sector, b->data, b->size, write, bcache_io_done, b);
+    if (plug) {
+        blk_plug_add(plug, &b->io, batch);
+    } else {
+        blk_submit(&b->io, batch);
+    }
+}
+
+/**
+ * Transfer a buffer to or from the device and wait for it
+ */
+static int bcache_io(buf_t *b, int write) {
+    blk_batch_t batch;
+    blk_batch_init(&batch);
+    bcache_start(b, write, NULL, &batch);
+    if (blk_batch_wait(&batch) != 0) {
+        RETURN_ERRNO(THUNDEROS_EIO);
+    }
+    return 0;
+}
+
+/**
+ * Write a dirty buffer to the device
+ */
+static int bcache_flush(buf_t *b) {
+    if (!(b->flags & BUF_DIRTY)) {
+        return 0;
+    }
+    if (bcache_io(b, 1) != 0) {
+        /* errno already set by bcache_io */
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Unhash and free a buffer nobody holds
+ */
+static void bcache_free(buf_t *b) {
+    buf_t **link = &g_buckets[bcache_bucket(b->device, b->block)];
+    while (*link && *link != b) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = b->hash_next;
+    }
+    lru_unlink(b);
+    g_stats.buffers--;
+    kfree(b->data);
+    kmem_cache_free(g_buf_cache, b);
+}
+
+/**
+ * Drop unreferenced buffers from the LRU end until under the limit
+ *
+ * A dirty buffer that cannot be written stays; when every buffer is held
+ * the cache grows past the limit until some are released. Writing one
+ * back sleeps, after which the list may have changed, so the walk starts
+ * over from the tail; it gives up after one pass worth of writes.
+ */
+static void bcache_shrink(void) {
+    uint32_t writes = 0;
+    buf_t *b = g_lru_tail;
+    while (b && g_stats.buffers >= BCACHE_MAX_BUFFERS) {
+        buf_t *prev = b->lru_prev;
+        if (b->refcount != 0) {
+            b = prev;
+            continue;
+        }
+        if (!(b->flags & BUF_DIRTY)) {
+            bcache_free(b);
+            g_stats.evictions++;
+            b = prev;
+            continue;
+        }
+        if (writes++ >= BCACHE_MAX_BUFFERS) {
+            break;
+        }
+        bcache_flush(b);
+        b = g_lru_tail;
+    }
+}
+
+/**
+ * Buffers reclaim could look at
+ */
+static size_t bcache_shrink_count(shrinker_t *shrinker) {
+    (void)shrinker;
+    return g_stats.buffers;
+}
+
+/**
+ * Free up to nr unreferenced buffers from the LRU end
+ *
+ * With SHRINK_MAY_SLEEP a dirty one is written back and the walk starts
+ * over from the tail, where it is now clean, as in bcache_shrink().
+ */
+static size_t bcache_shrink_scan(shrinker_t *shrinker, size_t nr, uint32_t flags) {
+    (void)shrinker;
+    size_t freed = 0;
+    size_t writes = 0;
+
+    int irq_state = interrupt_save_disable();
+    buf_t *b = g_lru_tail;
+    for (size_t seen = 0; b && seen < nr; seen++) {
+        buf_t *prev = b->lru_prev;
+        if (b->refcount == 0 && !(b->flags & BUF_DIRTY)) {
+            bcache_free(b);
+            g_stats.evictions++;
+            freed++;
+        } else if (b->refcount == 0 && (flags & SHRINK_MAY_SLEEP) && writes++ < nr) {
+            if (bcache_flush(b) != 0) {
+                clear_errno();    /* Stays dirty for the next sync */
+            }
+            prev = g_lru_tail;
+        }
+        b = prev;
+    }
+    interrupt_restore(irq_state);
+    return freed;
+}
+
+static buf_t *bcache_find(void *device, uint32_t block) {
+    buf_t *b = g_buckets[bcache_bucket(device, block)];
+    while (b) {
+        if (b->device == device && b->block == block) {
+            return b;
+        }
+        b = b->hash_next;
+    }
+    return NULL;
+}
+
+/**
+ * Get a block the caller will overwrite entirely, without reading it
+ */
+static buf_t *bcache_get(void *device, uint32_t block, uint32_t size) {
+    if (size == 0 || size % SECTOR_SIZE != 0) {
+        RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+    }
+
+    if (!g_buf_cache) {
+        g_buf_cache = kmem_cache_create("bcache_buf", sizeof(buf_t), 0, NULL);
+        if (!g_buf_cache) {
+            RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+        }
+        register_shrinker(&g_shrinker);
+    }
+
+    // Make room first: it may sleep, and nothing below does until the
+    // new buffer is hashed
+    bcache_shrink();
+
+    buf_t *b = bcache_find(device, block);
+    if (b) {
+        b->refcount++;
+        bcache_wait(b);
+    }
+    if (b && b->size != size) {
+        // Same block read with another block size: drop the old copy.
+        // While it is hashed nobody else can add the block, so once it
+        // is freed nothing below sleeps before ours replaces it.
+        if (b->refcount != 1 || bcache_flush(b) != 0 || b->refcount != 1) {
+            b->refcount--;
+            RETURN_ERRNO_NULL(THUNDEROS_EBUSY);
+        }
+        b->refcount--;
+        bcache_free(b);
+        b = NULL;
+    }
+    if (b) {
+        lru_unlink(b);
+        lru_push_front(b);
+        clear_errno();
+        return b;
+    }
+
+    b = (buf_t *)kmem_cache_alloc(g_buf_cache);
+    if (!b) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+    b->data = (uint8_t *)kmalloc(size);
+    if (!b->data) {
+        kmem_cache_free(g_buf_cache, b);
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+
+    b->device = device;
+    b->block = block;
+    b->size = size;
+    b->flags = 0;
+    b->refcount = 1;
+    uint32_t bucket = bcache_bucket(device, block);
+    b->hash_next = g_buckets[bucket];
+    g_buckets[bucket] = b;
+    lru_push_front(b);
+    g_stats.buffers++;
+
+    clear_errno();
+    return b;
+}
+
+/**
+ * Get a block, reading it from the device on a miss
+ */
+static buf_t *bcache_read(void *device, uint32_t block, uint32_t size) {
+    buf_t *b = bcache_get(device, block, size);
+    if (!b) {
+        /* errno already set by bcache_get */
+        return NULL;
+    }
+
+    if (b->flags & BUF_VALID) {
+        g_stats.hits++;
+        return b;
+    }
+
+    g_stats.misses++;
+    if (bcache_io(b, 0) != 0) {
+        bcache_release(b);
+        RETURN_ERRNO_NULL(THUNDEROS_EIO);
+    }
+    clear_errno();
+    return b;
+}
+
+/**
+ * Read the uncached blocks of a run into the cache ahead of bread()
+ */
+static int bcache_read_ahead(void *device, uint32_t block, uint32_t count, uint32_t size) {
+    int result = 0;
+    while (count > 0) {
+        uint32_t batch = count < BCACHE_MAX_MERGE ? count : BCACHE_MAX_MERGE;
+        buf_t *held[BCACHE_MAX_MERGE];
+        uint32_t queued = 0;
+        blk_batch_t io_batch;
+        blk_plug_t plug;
+        blk_batch_init(&io_batch);
+        blk_plug_init(&plug);
+
+        for (uint32_t i = 0; i < batch; i++) {
+            buf_t *b = bcache_find(device, block + i);
+            if (b && b->size == size && (b->flags & BUF_VALID)) {
+                continue;
+            }
+            b = bcache_get(device, block + i, size);
+            if (!b) {
+                result = -1;
+                continue;
+            }
+            if (b->flags & BUF_VALID) {
+                bcache_release(b);
+                continue;
+            }
+            held[queued++] = b;
+            bcache_start(b, 0, &plug, &io_batch);
+        }
+
+        blk_unplug(&plug);
+        if (queued > 0) {
+            g_stats.misses += queued;
+            if (blk_batch_wait(&io_batch) != 0) {
+                result = -1;
+            }
+        }
+        // Buffers that stayed invalid are freed by their last brelse()
+        for (uint32_t i = 0; i < queued; i++) {
+            bcache_release(held[i]);
+        }
+
+        block += batch;
+        count -= batch;
+    }
+
+    if (result == 0) {
+        clear_errno();
+    } else {
+        set_errno(THUNDEROS_EIO);
+    }
+    return result;
+}
+
+/**
+ * Mark a buffer modified
+ */
+static void bcache_mark_dirty(buf_t *b) {
+    b->flags |= BUF_VALID;
+    if (b->flags & BUF_BUSY) {
+        // Being written from the old contents: keep it dirty afterwards
+        b->flags |= BUF_REDIRTY;
+    }
+    if (b->flags & BUF_DIRTY) {
+        return;
+    }
+    b->flags |= BUF_DIRTY;
+    g_stats.dirty++;
+
+    if (g_stats.dirty > BCACHE_DIRTY_LIMIT + g_stats.held) {
+        // Best effort: anything that fails stays dirty for the next sync
+        bcache_write_all();
+        clear_errno();
+    }
+}
+
+/**
+ * Hold a modified buffer back from write-back
+ */
+static void bcache_hold(buf_t *b) {
+    b->flags |= BUF_VALID;
+    if (b->flags & BUF_HELD) {
+        return;
+    }
+    b->flags |= BUF_HELD;
+    b->refcount++;
+    g_stats.held++;
+}
+
+/**
+ * Let a held buffer be written back
+ */
+static void bcache_unhold(buf_t *b) {
+    if (!(b->flags & BUF_HELD)) {
+        return;
+    }
+    b->flags &= ~BUF_HELD;
+    g_stats.held--;
+    bcache_mark_dirty(b);
+    bcache_release(b);
+}
+
+/**
+ * Drop a reference taken by bread() or bget()
+ */
+static void bcache_release(buf_t *b) {
+    if (!b || b->refcount == 0) {
+        return;
+    }
+    b->refcount--;
+
+    // A bget() buffer released without being filled holds nothing useful
+    if (b->refcount == 0 && !(b->flags & BUF_VALID)) {
+        bcache_free(b);
+    }
+}
+
+/**
+ * Write every dirty buffer to the device
+ *
+ * Buffers already being written are left to that write; one marked
+ * BUF_REDIRTY meanwhile is picked up by the next sync. Held buffers wait
+ * for bunhold().
+ */
+static int bcache_write_all(void) {
+    blk_batch_t batch;
+    blk_plug_t plug;
+    blk_batch_init(&batch);
+    blk_plug_init(&plug);
+    for (buf_t *b = g_lru_head; b; b = b->lru_next) {
+        if ((b->flags & (BUF_DIRTY | BUF_BUSY | BUF_HELD)) == BUF_DIRTY) {
+            bcache_start(b, 1, &plug, &batch);
+        }
+    }
+    blk_unplug(&plug);
+    if (blk_batch_wait(&batch) != 0) {
+        set_errno(THUNDEROS_EIO);
+        return -1;
+    }
+    clear_errno();
+    return 0;
+}
+
+/*
+ * The public entry points run with interrupts off, the kernel's usual
+ * exclusive access; sleeping for I/O inside gives it up only there.
+ */
+
+buf_t *bget(void *device, uint32_t block, uint32_t size) {
+    int irq_state = interrupt_save_disable();
+    buf_t *b = bcache_get(device, block, size);
+    interrupt_restore(irq_state);
+    return b;
+}
+
+buf_t *bread(void *device, uint32_t block, uint32_t size) {
+    int irq_state = interrupt_save_disable();
+    buf_t *b = bcache_read(device, block, size);
+    interrupt_restore(irq_state);
+    return b;
+}
+
+int bread_ahead(void *device, uint32_t block, uint32_t count, uint32_t size) {
+    int irq_state = interrupt_save_disable();
+    int result = bcache_read_ahead(device, block, count, size);
+    interrupt_restore(irq_state);
+    return result;
+}
+
+void bwrite(buf_t *b) {
+    int irq_state = interrupt_save_disable();
+    bcache_mark_dirty(b);
+    interrupt_restore(irq_state);
+}
+
+void bhold(buf_t *b) {
+    int irq_state = interrupt_save_disable();
+    bcache_hold(b);
+    interrupt_restore(irq_state);
+}
+
+void bunhold(buf_t *b) {
+    int irq_state = interrupt_save_disable();
+    bcache_unhold(b);
+    interrupt_restore(irq_state);
+}
+
+void brelse(buf_t *b) {
+    int irq_state = interrupt_save_disable();
+    bcache_release(b);
+    interrupt_restore(irq_state);
+}
+
+int bcache_sync(void) {
+    int irq_state = interrupt_save_disable();
+    int result = bcache_write_all();
+    interrupt_restore(irq_state);
+    return result;
+}
+
+/**
+ * Get block cache statistics
+ */
+void bcache_get_stats(bcache_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+    *stats = g_stats;
+}
@@ -0,0 +1,314 @@
+/*
+ * dcache.c - Directory entry cache
+ *
+ * Entries sit in a hash table keyed by (fs, directory inode, name) and
+ * on one LRU list, most recently used first. Directories are identified
+ * by inode number rather than by node, so an entry stays valid when the
+ * directory's own entry is evicted and its node freed. Path lookups only
+ * run in process context under the big kernel lock, so the table takes
+ * no lock of its own.
+ *
+ * The "dcache" shrinker drops entries from the LRU end under memory
+ * pressure, which also frees the nodes only they kept alive: the inode
+ * cache holds nothing else. Dropping a node's last reference may write
+ * its inode, so without SHRINK_MAY_SLEEP only negative entries and
+ * entries whose node someone else holds are dropped.
+ */
+
+#include "../../include/fs/dcache.h"
+#include "../../include/mm/slab.h"
+#include "../../include/mm/reclaim.h"
+#include "../../include/kernel/constants.h"
+#include "../../include/kernel/errno.h"
+#include <stddef.h>
+
+#define DCACHE_BUCKETS 64
+
+typedef struct dentry {
+    vfs_filesystem_t *fs;              /* Filesystem of the directory */
+    uint32_t dir_inode;                /* Directory the name is in */
+    uint32_t hash;                     /* Full hash of (dir_inode, name) */
+    char name[MAX_PATH_COMPONENT_LEN]; /* Component name */
+    vfs_node_t *node;                  /* Referenced node, NULL = negative */
+    struct dentry *next;               /* Hash chain */
+    struct dentry *lru_prev;           /* Toward more recently used */
+    struct dentry *lru_next;           /* Toward less recently used */
+} dentry_t;
+
+static dentry_t *g_buckets[DCACHE_BUCKETS];
+static dentry_t *g_lru_head = NULL;    /* Most recently used */
+static dentry_t *g_lru_tail = NULL;    /* Next to evict */
+static kmem_cache_t *g_dentry_cache = NULL;
+static dcache_stats_t g_stats;
+
+static size_t dcache_shrink_count(shrinker_t *shrinker);
+static size_t dcache_shrink_scan(shrinker_t *shrinker, size_t nr, uint32_t flags);
+
+static shrinker_t g_shrinker = { "dcache", dcache_shrink_count, dcache_shrink_scan, 0, 0, NULL };
+
+static uint32_t dcache_hash(uint32_t dir_inode, const char *name) {
+    uint32_t hash = dir_inode * 2654435761u;
+    while (*name) {
+        hash = hash * 31 + (uint8_t)*name++;
+    }
+    return hash;
+}
+
+static int dcache_name_equal(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static void lru_unlink(dentry_t *d) {
+    if (d->lru_prev) {
+        d->lru_prev->lru_next = d->lru_next;
+    } else {
+        g_lru_head = d->lru_next;
+    }
+    if (d->lru_next) {
+        d->lru_next->lru_prev = d->lru_prev;
+    } else {
+        g_lru_tail = d->lru_prev;
+    }
+    d->lru_prev = NULL;
+    d->lru_next = NULL;
+}
+
+static void lru_push_front(dentry_t *d) {
+    d->lru_prev = NULL;
+    d->lru_next = g_lru_head;
+    if (g_lru_head) {
+        g_lru_head->lru_prev = d;
+    } else {
+        g_lru_tail = d;
+    }
+    g_lru_head = d;
+}
+
+static dentry_t *dcache_find(vfs_filesystem_t *fs, uint32_t dir_inode, const char *name, uint32_t hash) {
+    dentry_t *d = g_buckets[hash % DCACHE_BUCKETS];
+    while (d) {
+        if (d->hash == hash && d->fs == fs && d->dir_inode == dir_inode &&
+            dcache_name_equal(d->name, name)) {
+            return d;
+        }
+        d = d->next;
+    }
+    return NULL;
+}
+
+/**
+ * Unhash and free an entry, dropping its node reference
+ */
+static void dcache_remove(dentry_t *d) {
+    dentry_t **link = &g_buckets[d->hash % DCACHE_BUCKETS];
+    while (*link && *link != d) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = d->next;
+    }
+    lru_unlink(d);
+
+    if (d->node) {
+        vfs_node_put(d->node);
+    } else {
+        g_stats.negative--;
+    }
+    g_stats.entries--;
+    kmem_cache_free(g_dentry_cache, d);
+}
+
+/**
+ * Cache the result of a lookup (node NULL: the name does not exist)
+ *
+ * Failing to allocate only means the next lookup asks the filesystem again.
+ */
+static void dcache_insert(vfs_node_t *dir, const char *name, uint32_t hash, vfs_node_t *node) {
+    if (!g_dentry_cache) {
+        g_dentry_cache = kmem_cache_create("dentry", sizeof(dentry_t), 0, NULL);
+        if (!g_dentry_cache) {
+            return;
+        }
+        register_shrinker(&g_shrinker);
+    }
+
+    if (g_stats.entries >= DCACHE_MAX_ENTRIES && g_lru_tail) {
+        dcache_remove(g_lru_tail);
+        g_stats.evictions++;
+    }
+
+    dentry_t *d = (dentry_t *)kmem_cache_alloc(g_dentry_cache);
+    if (!d) {
+        return;
+    }
+
+    d->fs = dir->fs;
+    d->dir_inode = dir->inode;
+    d->hash = hash;
+    uint32_t i = 0;
+    while (name[i] && i < MAX_PATH_COMPONENT_LEN - 1) {
+        d->name[i] = name[i];
+        i++;
+    }
+    d->name[i] = '\0';
+    d->node = node;
+    if (node) {
+        vfs_node_get(node);
+    } else {
+        g_stats.negative++;
+    }
+
+    uint32_t bucket = hash % DCACHE_BUCKETS;
+    d->next = g_buckets[bucket];
+    g_buckets[bucket] = d;
+    lru_push_front(d);
+    g_stats.entries++;
+}
+
+/**
+ * Entries reclaim could drop
+ */
+static size_t dcache_shrink_count(shrinker_t *shrinker) {
+    (void)shrinker;
+    return g_stats.entries;
+}
+
+/**
+ * Drop up to nr entries from the LRU end
+ *
+ * Putting a node may sleep, after which the list may have changed, so
+ * with SHRINK_MAY_SLEEP every drop starts again from the tail.
+ */
+static size_t dcache_shrink_scan(shrinker_t *shrinker, size_t nr, uint32_t flags) {
+    (void)shrinker;
+    size_t dropped = 0;
+
+    if (flags & SHRINK_MAY_SLEEP) {
+        while (dropped < nr && g_lru_tail) {
+            dcache_remove(g_lru_tail);
+            g_stats.evictions++;
+            dropped++;
+        }
+        return dropped;
+    }
+
+    dentry_t *d = g_lru_tail;
+    for (size_t seen = 0; d && seen < nr; seen++) {
+        dentry_t *prev = d->lru_prev;
+        if (!d->node || d->node->refcount > 1) {
+            dcache_remove(d);
+            g_stats.evictions++;
+            dropped++;
+        }
+        d = prev;
+    }
+    return dropped;
+}
+
+/**
+ * Look up a name in a directory, asking the filesystem on a miss
+ */
+vfs_node_t *dcache_lookup(vfs_node_t *dir, const char *name) {
+    if (!dir || !name) {
+        RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+    }
+
+    // Names that come and go on their own go straight to the filesystem
+    if (dir->fs && (dir->fs->flags & VFS_FS_NOCACHE)) {
+        if (!dir->ops || !dir->ops->lookup) {
+            RETURN_ERRNO_NULL(THUNDEROS_EIO);
+        }
+        /* errno set by lookup */
+        return dir->ops->lookup(dir, name);
+    }
+
+    uint32_t hash = dcache_hash(dir->inode, name);
+    dentry_t *d = dcache_find(dir->fs, dir->inode, name, hash);
+    if (d) {
+        g_stats.hits++;
+        lru_unlink(d);
+        lru_push_front(d);
+        if (!d->node) {
+            RETURN_ERRNO_NULL(THUNDEROS_ENOENT);
+        }
+        vfs_node_get(d->node);
+        clear_errno();
+        return d->node;
+    }
+
+    g_stats.misses++;
+    if (!dir->ops || !dir->ops->lookup) {
+        RETURN_ERRNO_NULL(THUNDEROS_EIO);
+    }
+
+    vfs_node_t *node = dir->ops->lookup(dir, name);
+    if (node) {
+        // The lookup's reference goes to the caller; the entry takes its own
+        dcache_insert(dir, name, hash, node);
+        clear_errno();
+        return node;
+    }
+
+    // Only a clean "no such name" is worth remembering, not I/O errors
+    if (get_errno() == THUNDEROS_ENOENT) {
+        dcache_insert(dir, name, hash, NULL);
+    }
+    /* errno already set by lookup */
+    return NULL;
+}
+
+/**
+ * Forget what is cached for one name
+ */
+void dcache_invalidate(vfs_node_t *dir, const char *name) {
+    if (!dir || !name) {
+        return;
+    }
+
+    dentry_t *d = dcache_find(dir->fs, dir->inode, name, dcache_hash(dir->inode, name));
+    if (d) {
+        dcache_remove(d);
+    }
+}
+
+/**
+ * Drop every entry matching fs and, unless all_dirs is set, dir_inode
+ */
+static void dcache_invalidate_matching(vfs_filesystem_t *fs, uint32_t dir_inode, int all_dirs) {
+    dentry_t *d = g_lru_head;
+    while (d) {
+        dentry_t *next = d->lru_next;
+        if (d->fs == fs && (all_dirs || d->dir_inode == dir_inode)) {
+            dcache_remove(d);
+        }
+        d = next;
+    }
+}
+
+/**
+ * Forget every entry in a directory
+ */
+void dcache_invalidate_dir(vfs_filesystem_t *fs, uint32_t inode) {
+    dcache_invalidate_matching(fs, inode, 0);
+}
+
+/**
+ * Forget every entry of a filesystem
+ */
+void dcache_invalidate_fs(vfs_filesystem_t *fs) {
+    dcache_invalidate_matching(fs, 0, 1);
+}
+
+/**
+ * Get dentry cache statistics
+ */
+void dcache_get_stats(dcache_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+    *stats = g_stats;
+}
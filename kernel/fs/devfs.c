@@ -0,0 +1,207 @@
+/*
+ * devfs.c - Device filesystem
+ *
+ * The root directory keeps its nodes in a list in registration order; a
+ * node's position in an iterate cursor is its inode number, so listing
+ * resumes correctly however it is split up. Positions 0 and 1 are "."
+ * and "..".
+ */
+
+#include "../../include/fs/devfs.h"
+#include "../../include/fs/ext2.h"
+#include "../../include/mm/kmalloc.h"
+#include "../../include/kernel/errno.h"
+#include "../../include/kernel/kstring.h"
+#include <stddef.h>
+
+/**
+ * Device node and the list link, allocated together
+ */
+typedef struct devfs_node {
+    vfs_node_t node;
+    struct devfs_node *next;           /* Next registered node */
+} devfs_node_t;
+
+static vfs_node_t *devfs_lookup(vfs_node_t *dir, const char *name);
+static int devfs_iterate(vfs_node_t *dir, uint32_t *pos, vfs_filldir_t fill, void *ctx);
+
+/* Operations of the root directory; device nodes have their driver's */
+static vfs_ops_t devfs_ops = {
+    .read = NULL,
+    .write = NULL,
+    .open = NULL,
+    .close = NULL,
+    .lookup = devfs_lookup,
+    .iterate = devfs_iterate,
+    .create = NULL,                    /* Only drivers add nodes */
+    .mkdir = NULL,
+    .unlink = NULL,
+    .rmdir = NULL,
+    .release = NULL,                   /* Nothing is ever freed */
+    .write_inode = NULL,
+};
+
+/* The one devfs (set up on first use) */
+static vfs_filesystem_t g_devfs;
+static vfs_node_t g_devfs_root;
+static int g_devfs_ready = 0;
+
+/* Registered nodes, oldest first */
+static devfs_node_t *g_devfs_nodes = NULL;
+static devfs_node_t *g_devfs_last = NULL;
+static uint32_t g_devfs_next_inode = DEVFS_ROOT_INO + 1;
+
+/**
+ * Set up the filesystem and its root directory
+ */
+static void devfs_setup(void) {
+    if (g_devfs_ready) {
+        return;
+    }
+
+    kmemset(&g_devfs, 0, sizeof(g_devfs));
+    kstrcpy(g_devfs.name, "devfs");
+    g_devfs.ops = &devfs_ops;
+    g_devfs.root = &g_devfs_root;
+    g_devfs.flags = VFS_FS_MEMORY;
+
+    kmemset(&g_devfs_root, 0, sizeof(g_devfs_root));
+    kstrcpy(g_devfs_root.name, "/");
+    g_devfs_root.inode = DEVFS_ROOT_INO;
+    g_devfs_root.type = VFS_TYPE_DIRECTORY;
+    g_devfs_root.mode = EXT2_S_IFDIR | DEVFS_ROOT_MODE;
+    g_devfs_root.fs = &g_devfs;
+    g_devfs_root.ops = &devfs_ops;
+    g_devfs_root.refcount = 1;         /* Held by the filesystem */
+    g_devfs_ready = 1;
+}
+
+/**
+ * Compare a name with a node's
+ */
+static int devfs_name_is(vfs_node_t *node, const char *name) {
+    uint32_t i = 0;
+    while (name[i] && node->name[i] == name[i]) {
+        i++;
+    }
+    return name[i] == node->name[i];
+}
+
+/**
+ * Find a node by name (no reference taken)
+ */
+static vfs_node_t *devfs_find(const char *name) {
+    for (devfs_node_t *dev = g_devfs_nodes; dev; dev = dev->next) {
+        if (devfs_name_is(&dev->node, name)) {
+            return &dev->node;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Add a device node to /dev
+ */
+vfs_node_t *devfs_register(const char *name, uint16_t mode, vfs_ops_t *ops,
+                           uint64_t size, void *data) {
+    if (!name || !ops) {
+        RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+    }
+    size_t len = kstrlen(name);
+    if (len == 0 || len >= sizeof(g_devfs_root.name)) {
+        RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (name[i] == '/') {
+            RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+        }
+    }
+
+    devfs_setup();
+    if (devfs_find(name)) {
+        RETURN_ERRNO_NULL(THUNDEROS_EEXIST);
+    }
+
+    devfs_node_t *dev = (devfs_node_t *)kmalloc(sizeof(devfs_node_t));
+    if (!dev) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+    kmemset(dev, 0, sizeof(*dev));
+
+    vfs_node_t *node = &dev->node;
+    kstrcpy(node->name, name);
+    node->inode = g_devfs_next_inode++;
+    node->size = size;
+    node->type = VFS_TYPE_DEVICE;
+    node->mode = (uint16_t)(EXT2_S_IFCHR | (mode & 0xFFF));
+    node->fs = &g_devfs;
+    node->fs_data = data;
+    node->ops = ops;
+    node->refcount = 1;                /* Held by the name, for good */
+
+    if (g_devfs_last) {
+        g_devfs_last->next = dev;
+    } else {
+        g_devfs_nodes = dev;
+    }
+    g_devfs_last = dev;
+    clear_errno();
+    return node;
+}
+
+static vfs_node_t *devfs_lookup(vfs_node_t *dir, const char *name) {
+    if (dir != &g_devfs_root || !name) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOTDIR);
+    }
+    vfs_node_t *node = devfs_find(name);
+    if (!node) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOENT);
+    }
+    vfs_node_get(node);
+    clear_errno();
+    return node;
+}
+
+static int devfs_iterate(vfs_node_t *dir, uint32_t *pos, vfs_filldir_t fill, void *ctx) {
+    if (!dir || !pos || !fill) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (dir != &g_devfs_root) {
+        RETURN_ERRNO(THUNDEROS_ENOTDIR);
+    }
+
+    if (*pos == 0) {
+        if (fill(ctx, ".", 1, DEVFS_ROOT_INO) != 0) {
+            goto done;
+        }
+        *pos = 1;
+    }
+    if (*pos == 1) {
+        if (fill(ctx, "..", 2, DEVFS_ROOT_INO) != 0) {
+            goto done;
+        }
+        *pos = DEVFS_ROOT_INO + 1;
+    }
+    for (devfs_node_t *dev = g_devfs_nodes; dev; dev = dev->next) {
+        vfs_node_t *node = &dev->node;
+        if (node->inode < *pos) {
+            continue;
+        }
+        if (fill(ctx, node->name, (uint32_t)kstrlen(node->name), node->inode) != 0) {
+            break;
+        }
+        *pos = node->inode + 1;
+    }
+done:
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Get the device filesystem
+ */
+vfs_filesystem_t *devfs_mount(void) {
+    devfs_setup();
+    clear_errno();
+    return &g_devfs;
+}
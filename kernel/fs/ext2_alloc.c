@@ -1,172 +1,219 @@
 /*
  * ext2_alloc.c - ext2 block and inode allocation
+ *
+ * Each group's bitmaps are read through the block cache the first time
+ * they are needed and then stay pinned (a reference is held until
+ * unmount), so allocation never goes back to the device for them. Free
+ * bits are found a 64-bit word at a time. A changed bitmap goes into the
+ * journal with the group descriptor counting it; the superblock's totals
+ * are only written with the superblock.
  */
 
 #include "../include/fs/ext2.h"
-#include "../include/drivers/virtio_blk.h"
+#include "../include/fs/ext2_journal.h"
+#include "../include/fs/bcache.h"
 #include "../include/mm/kmalloc.h"
 #include "../include/hal/hal_uart.h"
 #include "../include/kernel/errno.h"
 #include "../include/kernel/constants.h"
+#include "../include/kernel/kstring.h"
+#include "../include/kernel/bitops.h"
 #include <stddef.h>
 
+#define BITS_PER_WORD 64
+
 /**
- * Read a block from the block device
+ * First clear bit in [start, limit), or limit if there is none
+ *
+ * Bit i of a bitmap is bit i % 8 of byte i / 8, which on a little-endian
+ * machine is bit i % 64 of 64-bit word i / 64.
  */
-static int read_block(void *device, uint32_t block_num, void *buffer, uint32_t block_size) {
-    (void)device;
-    
-    uint32_t sector = (block_num * block_size) / SECTOR_SIZE;
-    uint32_t num_sectors = block_size / SECTOR_SIZE;
-    
-    for (uint32_t i = 0; i < num_sectors; i++) {
-        int ret = virtio_blk_read(sector + i, (uint8_t *)buffer + ((size_t)i * SECTOR_SIZE), 1);
-        if (ret != 1) {
-            set_errno(THUNDEROS_EIO);
-            return -1;
+static uint32_t bitmap_find_clear(const uint8_t *bitmap, uint32_t start, uint32_t limit) {
+    const uint64_t *words = (const uint64_t *)bitmap;
+    uint32_t word = start / BITS_PER_WORD;
+    uint64_t clear = ~words[word] & (~0ULL << (start % BITS_PER_WORD));
+
+    while (clear == 0) {
+        word++;
+        if (word * BITS_PER_WORD >= limit) {
+            return limit;
         }
+        clear = ~words[word];
     }
-    
-    clear_errno();
-    return 0;
+
+    uint32_t index = word * BITS_PER_WORD + ctz64(clear);
+    return index < limit ? index : limit;
 }
 
 /**
- * Write a block to the block device
+ * Number of clear bits in a row from start, at most max
  */
-static int write_block(void *device, uint32_t block_num, const void *buffer, uint32_t block_size) {
-    (void)device;
-    
-    uint32_t sector = (block_num * block_size) / SECTOR_SIZE;
-    uint32_t num_sectors = block_size / SECTOR_SIZE;
-    
-    for (uint32_t i = 0; i < num_sectors; i++) {
-        int ret = virtio_blk_write(sector + i, (const uint8_t *)buffer + ((size_t)i * SECTOR_SIZE), 1);
-        if (ret != 1) {
-            set_errno(THUNDEROS_EIO);
-            return -1;
+static uint32_t bitmap_clear_run(const uint8_t *bitmap, uint32_t start, uint32_t max) {
+    const uint64_t *words = (const uint64_t *)bitmap;
+    uint32_t run = 0;
+
+    while (run < max) {
+        uint32_t bit = start + run;
+        uint64_t set = words[bit / BITS_PER_WORD] >> (bit % BITS_PER_WORD);
+        uint32_t span = BITS_PER_WORD - bit % BITS_PER_WORD;
+        if (set != 0) {
+            uint32_t clear = ctz64(set);
+            run += clear < span ? clear : span;
+            break;
         }
+        run += span;
     }
-    
-    clear_errno();
-    return 0;
+    return run < max ? run : max;
 }
 
 /**
- * Allocate a block from block bitmap
- * Returns block number, or 0 on failure
+ * Set or clear a single bit; returns its previous value
  */
-uint32_t ext2_alloc_block(ext2_fs_t *fs, uint32_t group) {
-    if (!fs || group >= fs->num_groups) {
-        set_errno(THUNDEROS_EINVAL);
-        return 0;
-    }
-    
-    ext2_group_desc_t *gd = &fs->group_desc[group];
-    
-    /* Check if group has free blocks */
-    if (gd->bg_free_blocks_count == 0) {
-        set_errno(THUNDEROS_EFS_NOBLK);
-        return 0;
+static int bitmap_assign(uint8_t *bitmap, uint32_t index, int value) {
+    uint8_t mask = (uint8_t)(1 << (index % BITS_PER_BYTE));
+    int old = (bitmap[index / BITS_PER_BYTE] & mask) != 0;
+    if (value) {
+        bitmap[index / BITS_PER_BYTE] |= mask;
+    } else {
+        bitmap[index / BITS_PER_BYTE] &= (uint8_t)~mask;
     }
-    
-    /* Read block bitmap */
-    uint8_t *bitmap = (uint8_t *)kmalloc(fs->block_size);
-    if (!bitmap) {
-        set_errno(THUNDEROS_ENOMEM);
-        return 0;
+    return old;
+}
+
+/**
+ * Get a group's block or inode bitmap, pinning it on first use
+ * Returns the buffer (no extra reference for the caller), or NULL on
+ * failure (errno set)
+ */
+static buf_t *ext2_bitmap(ext2_fs_t *fs, uint32_t group, int inodes) {
+    buf_t **slot = inodes ? &fs->inode_bitmaps[group] : &fs->block_bitmaps[group];
+    if (!*slot) {
+        ext2_group_desc_t *gd = &fs->group_desc[group];
+        uint32_t block = inodes ? gd->bg_inode_bitmap : gd->bg_block_bitmap;
+        *slot = bread(fs->device, block, fs->block_size);
+        /* On failure errno is already set by bread */
     }
-    
-    if (read_block(fs->device, gd->bg_block_bitmap, bitmap, fs->block_size) != 0) {
-        kfree(bitmap);
-        /* errno already set by read_block */
+    return *slot;
+}
+
+/**
+ * Number of blocks a group covers (the last one may be short)
+ */
+static uint32_t ext2_group_blocks(ext2_fs_t *fs, uint32_t group) {
+    uint32_t blocks_per_group = fs->superblock->s_blocks_per_group;
+    uint32_t data_blocks = fs->superblock->s_blocks_count - fs->superblock->s_first_data_block;
+    uint32_t remaining = data_blocks - group * blocks_per_group;
+    return remaining < blocks_per_group ? remaining : blocks_per_group;
+}
+
+/**
+ * Allocate a run of consecutive blocks, starting as close after goal as
+ * the bitmaps allow
+ */
+uint32_t ext2_alloc_blocks(ext2_fs_t *fs, uint32_t goal, uint32_t count, uint32_t *allocated) {
+    if (!fs || !fs->block_bitmaps || count == 0 || !allocated) {
+        set_errno(THUNDEROS_EINVAL);
         return 0;
     }
-    
-    /* Find first free block */
+    *allocated = 0;
+
+    uint32_t first_data_block = fs->superblock->s_first_data_block;
     uint32_t blocks_per_group = fs->superblock->s_blocks_per_group;
-    for (uint32_t i = 0; i < blocks_per_group; i++) {
-        uint32_t byte = i / BITS_PER_BYTE;
-        uint32_t bit = i % BITS_PER_BYTE;
-        
-        if (!(bitmap[byte] & (1 << bit))) {
-            /* Found free block */
-            bitmap[byte] |= (1 << bit);
-            
-            /* Write bitmap back */
-            if (write_block(fs->device, gd->bg_block_bitmap, bitmap, fs->block_size) != 0) {
-                kfree(bitmap);
-                /* errno already set by write_block */
-                return 0;
-            }
-            
-            /* Update group descriptor */
-            gd->bg_free_blocks_count--;
-            
-            /* Update superblock */
-            fs->superblock->s_free_blocks_count--;
-            
-            kfree(bitmap);
-            clear_errno();
-            return group * blocks_per_group + i;
+    if (goal < first_data_block || goal >= fs->superblock->s_blocks_count) {
+        goal = first_data_block;
+    }
+    uint32_t goal_group = (goal - first_data_block) / blocks_per_group;
+    uint32_t goal_bit = (goal - first_data_block) % blocks_per_group;
+
+    /* The goal's group from the goal on, every other group, then the
+     * part of the goal's group before the goal */
+    for (uint32_t pass = 0; pass <= fs->num_groups; pass++) {
+        uint32_t group = (goal_group + pass) % fs->num_groups;
+        ext2_group_desc_t *gd = &fs->group_desc[group];
+        if (gd->bg_free_blocks_count == 0) {
+            continue;
+        }
+
+        buf_t *b = ext2_bitmap(fs, group, 0);
+        if (!b) {
+            /* errno already set by ext2_bitmap */
+            return 0;
+        }
+
+        uint32_t limit = ext2_group_blocks(fs, group);
+        uint32_t start = pass == 0 ? goal_bit : 0;
+        if (pass == fs->num_groups && goal_bit < limit) {
+            limit = goal_bit;
+        }
+        if (start >= limit) {
+            continue;
+        }
+        uint32_t bit = bitmap_find_clear(b->data, start, limit);
+        if (bit == limit) {
+            continue;
         }
+
+        uint32_t max = count < gd->bg_free_blocks_count ? count : gd->bg_free_blocks_count;
+        if (max > ext2_group_blocks(fs, group) - bit) {
+            max = ext2_group_blocks(fs, group) - bit;
+        }
+        uint32_t run = bitmap_clear_run(b->data, bit, max);
+        for (uint32_t i = 0; i < run; i++) {
+            bitmap_assign(b->data, bit + i, 1);
+        }
+        ext2_journal_dirty(fs, b);
+
+        gd->bg_free_blocks_count -= run;
+        fs->superblock->s_free_blocks_count -= run;
+        ext2_write_group_desc(fs, group);   /* Best effort: fsck recounts */
+
+        *allocated = run;
+        clear_errno();
+        return first_data_block + group * blocks_per_group + bit;
     }
-    
-    kfree(bitmap);
+
     set_errno(THUNDEROS_EFS_NOBLK);
     return 0;
 }
 
+/**
+ * Allocate one block, as close after goal as possible
+ */
+uint32_t ext2_alloc_block(ext2_fs_t *fs, uint32_t goal) {
+    uint32_t allocated;
+    return ext2_alloc_blocks(fs, goal, 1, &allocated);
+}
+
 /**
  * Free a block to block bitmap
  */
 int ext2_free_block(ext2_fs_t *fs, uint32_t block_num) {
-    if (!fs || block_num == 0) {
+    if (!fs || !fs->block_bitmaps || block_num < fs->superblock->s_first_data_block ||
+        block_num >= fs->superblock->s_blocks_count) {
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
-    
+
     /* Determine which group contains this block */
     uint32_t blocks_per_group = fs->superblock->s_blocks_per_group;
-    uint32_t group = block_num / blocks_per_group;
-    uint32_t offset = block_num % blocks_per_group;
-    
-    if (group >= fs->num_groups) {
-        RETURN_ERRNO(THUNDEROS_EINVAL);
-    }
-    
-    ext2_group_desc_t *gd = &fs->group_desc[group];
-    
-    /* Read block bitmap */
-    uint8_t *bitmap = (uint8_t *)kmalloc(fs->block_size);
-    if (!bitmap) {
-        RETURN_ERRNO(THUNDEROS_ENOMEM);
-    }
-    
-    if (read_block(fs->device, gd->bg_block_bitmap, bitmap, fs->block_size) != 0) {
-        kfree(bitmap);
-        /* errno already set by read_block */
+    uint32_t index = block_num - fs->superblock->s_first_data_block;
+    uint32_t group = index / blocks_per_group;
+    uint32_t offset = index % blocks_per_group;
+
+    buf_t *b = ext2_bitmap(fs, group, 0);
+    if (!b) {
+        /* errno already set by ext2_bitmap */
         return -1;
     }
-    
-    /* Clear the bit */
-    uint32_t byte = offset / BITS_PER_BYTE;
-    uint32_t bit = offset % BITS_PER_BYTE;
-    bitmap[byte] &= ~(1 << bit);
-    
-    /* Write bitmap back */
-    if (write_block(fs->device, gd->bg_block_bitmap, bitmap, fs->block_size) != 0) {
-        kfree(bitmap);
-        /* errno already set by write_block */
-        return -1;
+
+    /* Counts only change if the block really was in use */
+    if (bitmap_assign(b->data, offset, 0)) {
+        ext2_journal_dirty(fs, b);
+        fs->group_desc[group].bg_free_blocks_count++;
+        fs->superblock->s_free_blocks_count++;
+        ext2_write_group_desc(fs, group);
+        ext2_journal_revoke(fs, block_num);
     }
-    
-    /* Update group descriptor */
-    gd->bg_free_blocks_count++;
-    
-    /* Update superblock */
-    fs->superblock->s_free_blocks_count++;
-    
-    kfree(bitmap);
+
     clear_errno();
     return 0;
 }
@@ -176,119 +223,112 @@ int ext2_free_block(ext2_fs_t *fs, uint32_t block_num) {
  * Returns inode number, or 0 on failure
  */
 uint32_t ext2_alloc_inode(ext2_fs_t *fs, uint32_t group) {
-    if (!fs || group >= fs->num_groups) {
+    if (!fs || !fs->inode_bitmaps || group >= fs->num_groups) {
         set_errno(THUNDEROS_EINVAL);
         return 0;
     }
-    
+
     ext2_group_desc_t *gd = &fs->group_desc[group];
-    
+
     /* Check if group has free inodes */
     if (gd->bg_free_inodes_count == 0) {
         set_errno(THUNDEROS_EFS_NOINODE);
         return 0;
     }
-    
-    /* Read inode bitmap */
-    uint8_t *bitmap = (uint8_t *)kmalloc(fs->block_size);
-    if (!bitmap) {
-        set_errno(THUNDEROS_ENOMEM);
-        return 0;
-    }
-    
-    if (read_block(fs->device, gd->bg_inode_bitmap, bitmap, fs->block_size) != 0) {
-        kfree(bitmap);
-        /* errno already set by read_block */
+
+    buf_t *b = ext2_bitmap(fs, group, 1);
+    if (!b) {
+        /* errno already set by ext2_bitmap */
         return 0;
     }
-    
+
     /* Find first free inode */
     uint32_t inodes_per_group = fs->superblock->s_inodes_per_group;
-    for (uint32_t i = 0; i < inodes_per_group; i++) {
-        uint32_t byte = i / BITS_PER_BYTE;
-        uint32_t bit = i % BITS_PER_BYTE;
-        
-        if (!(bitmap[byte] & (1 << bit))) {
-            /* Found free inode */
-            bitmap[byte] |= (1 << bit);
-            
-            /* Write bitmap back */
-            if (write_block(fs->device, gd->bg_inode_bitmap, bitmap, fs->block_size) != 0) {
-                kfree(bitmap);
-                /* errno already set by write_block */
-                return 0;
-            }
-            
-            /* Update group descriptor */
-            gd->bg_free_inodes_count--;
-            
-            /* Update superblock */
-            fs->superblock->s_free_inodes_count--;
-            
-            kfree(bitmap);
-            clear_errno();
-            return group * inodes_per_group + i + 1;  /* Inodes are 1-indexed */
-        }
+    uint32_t i = bitmap_find_clear(b->data, 0, inodes_per_group);
+    if (i == inodes_per_group) {
+        set_errno(THUNDEROS_EFS_NOINODE);
+        return 0;
     }
-    
-    kfree(bitmap);
-    set_errno(THUNDEROS_EFS_NOINODE);
-    return 0;
+
+    bitmap_assign(b->data, i, 1);
+    ext2_journal_dirty(fs, b);
+
+    gd->bg_free_inodes_count--;
+    fs->superblock->s_free_inodes_count--;
+    ext2_write_group_desc(fs, group);
+
+    clear_errno();
+    return group * inodes_per_group + i + 1;  /* Inodes are 1-indexed */
 }
 
 /**
  * Free an inode to inode bitmap
  */
 int ext2_free_inode(ext2_fs_t *fs, uint32_t inode_num) {
-    if (!fs || inode_num == 0) {
+    if (!fs || !fs->inode_bitmaps || inode_num == 0) {
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
-    
+
     /* Inodes are 1-indexed */
     uint32_t inode_index = inode_num - 1;
-    
+
     /* Determine which group contains this inode */
     uint32_t inodes_per_group = fs->superblock->s_inodes_per_group;
     uint32_t group = inode_index / inodes_per_group;
     uint32_t offset = inode_index % inodes_per_group;
-    
+
     if (group >= fs->num_groups) {
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
-    
-    ext2_group_desc_t *gd = &fs->group_desc[group];
-    
-    /* Read inode bitmap */
-    uint8_t *bitmap = (uint8_t *)kmalloc(fs->block_size);
-    if (!bitmap) {
-        RETURN_ERRNO(THUNDEROS_ENOMEM);
-    }
-    
-    if (read_block(fs->device, gd->bg_inode_bitmap, bitmap, fs->block_size) != 0) {
-        kfree(bitmap);
-        /* errno already set by read_block */
+
+    buf_t *b = ext2_bitmap(fs, group, 1);
+    if (!b) {
+        /* errno already set by ext2_bitmap */
         return -1;
     }
-    
-    /* Clear the bit */
-    uint32_t byte = offset / BITS_PER_BYTE;
-    uint32_t bit = offset % BITS_PER_BYTE;
-    bitmap[byte] &= ~(1 << bit);
-    
-    /* Write bitmap back */
-    if (write_block(fs->device, gd->bg_inode_bitmap, bitmap, fs->block_size) != 0) {
-        kfree(bitmap);
-        /* errno already set by write_block */
-        return -1;
+
+    if (bitmap_assign(b->data, offset, 0)) {
+        ext2_journal_dirty(fs, b);
+        fs->group_desc[group].bg_free_inodes_count++;
+        fs->superblock->s_free_inodes_count++;
+        ext2_write_group_desc(fs, group);
+    }
+
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Set up the per-group bitmap slots; bitmaps are pinned as they are used
+ */
+int ext2_bitmaps_init(ext2_fs_t *fs) {
+    size_t size = fs->num_groups * sizeof(buf_t *);
+    fs->block_bitmaps = (buf_t **)kmalloc(size);
+    fs->inode_bitmaps = (buf_t **)kmalloc(size);
+    if (!fs->block_bitmaps || !fs->inode_bitmaps) {
+        ext2_bitmaps_release(fs);
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
     }
-    
-    /* Update group descriptor */
-    gd->bg_free_inodes_count++;
-    
-    /* Update superblock */
-    fs->superblock->s_free_inodes_count++;
-    
-    kfree(bitmap);
+    kmemset(fs->block_bitmaps, 0, size);
+    kmemset(fs->inode_bitmaps, 0, size);
     clear_errno();
     return 0;
 }
+
+/**
+ * Unpin every bitmap (dirty ones are still written by bcache_sync())
+ */
+void ext2_bitmaps_release(ext2_fs_t *fs) {
+    for (uint32_t group = 0; group < fs->num_groups; group++) {
+        if (fs->block_bitmaps) {
+            brelse(fs->block_bitmaps[group]);
+        }
+        if (fs->inode_bitmaps) {
+            brelse(fs->inode_bitmaps[group]);
+        }
+    }
+    kfree(fs->block_bitmaps);
+    kfree(fs->inode_bitmaps);
+    fs->block_bitmaps = NULL;
+    fs->inode_bitmaps = NULL;
+}
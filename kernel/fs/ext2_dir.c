@@ -1,5 +1,22 @@
 /*
  * ext2_dir.c - ext2 directory operations
+ *
+ * Lookups and readdir go through an in-memory index of the directory,
+ * built with one pass over its blocks the first time it is used: a hash
+ * table of names for lookups, and an array of entries in directory order
+ * for listing. A listing's cursor is a byte offset into the directory, so
+ * it stays valid while entries before or after it come and go. create, mkdir, unlink and rmdir keep it in step with the
+ * entries they change, so it never has to be rebuilt while it is cached.
+ * The EXT2_DIR_INDEX_MAX most recently used directories of a filesystem
+ * stay indexed.
+ *
+ * A directory written by ext3/ext4 with a valid hash tree (EXT2_INDEX_FL)
+ * is searched through the tree until it is indexed here, which reads one
+ * block per tree level instead of the whole directory. This driver does
+ * not maintain the tree: adding an entry clears EXT2_INDEX_FL, as Linux's
+ * ext2 does, and the directory is linear from then on.
+ *
+ * Everything here runs under the filesystem's lock.
  */
 
 #include "../include/fs/ext2.h"
@@ -7,8 +24,49 @@
 #include "../include/mm/kmalloc.h"
 #include "../include/kernel/errno.h"
 #include "../include/kernel/constants.h"
+#include "../include/kernel/kstring.h"
 #include <stddef.h>
 
+/* Smallest directory entry: inode, rec_len, name_len, file_type */
+#define DIRENT_HEADER_LEN 8
+
+/* htree hash versions (dx_root_info.hash_version) */
+#define DX_HASH_LEGACY             0
+#define DX_HASH_HALF_MD4           1
+#define DX_HASH_TEA                2
+#define DX_HASH_UNSIGNED_DELTA     3    /* Added when the superblock says unsigned */
+
+/* Deepest hash tree followed (ext4 "largedir" allows 3 levels) */
+#define DX_MAX_LEVELS              3
+
+/* Where the tree starts in block 0: after the "." and ".." entries */
+#define DX_ROOT_INFO_OFFSET        24
+
+/**
+ * One name of an indexed directory
+ */
+typedef struct ext2_dir_name {
+    struct ext2_dir_name *hash_next;   /* Hash chain */
+    uint32_t hash;                     /* ext2_dir_name_hash() of the name */
+    uint32_t offset;                   /* Byte offset of the entry in the directory */
+    uint32_t inode;                    /* Inode the entry names */
+    uint8_t file_type;                 /* EXT2_FT_* */
+    uint8_t name_len;
+    char name[];                       /* name_len bytes, not terminated */
+} ext2_dir_name_t;
+
+/**
+ * In-memory index of one directory
+ */
+typedef struct ext2_dir_index {
+    struct ext2_dir_index *next;       /* Toward less recently used */
+    uint32_t dir_inode;                /* Directory inode number */
+    uint32_t count;                    /* Entries, including "." and ".." */
+    uint32_t capacity;                 /* Slots in order[] */
+    ext2_dir_name_t **order;           /* Entries by increasing offset */
+    ext2_dir_name_t *buckets[EXT2_DIR_INDEX_BUCKETS];
+} ext2_dir_index_t;
+
 /**
  * String length
  */
@@ -21,87 +79,851 @@ static uint32_t strlen(const char *str) {
 }
 
 /**
- * String comparison (up to n characters)
+ * Compare a name against a directory entry's, both of known length
  */
-static int strncmp(const char *s1, const char *s2, uint32_t n) {
-    for (uint32_t i = 0; i < n; i++) {
-        if (s1[i] != s2[i]) {
-            return (unsigned char)s1[i] - (unsigned char)s2[i];
-        }
-        if (s1[i] == '\0') {
+static int name_equal(const char *a, uint32_t a_len, const char *b, uint32_t b_len) {
+    if (a_len != b_len) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < a_len; i++) {
+        if (a[i] != b[i]) {
             return 0;
         }
     }
-    return 0;
+    return 1;
 }
 
 /**
- * Lookup a file in a directory by name
+ * Hash of a name for the in-memory index (FNV-1a)
  */
-uint32_t ext2_lookup(ext2_fs_t *fs, ext2_inode_t *dir_inode, const char *name) {
-    if (!fs || !dir_inode || !name) {
-        hal_uart_puts("ext2: Invalid parameters to ext2_lookup\n");
-        set_errno(THUNDEROS_EINVAL);
+static uint32_t ext2_dir_name_hash(const char *name, uint32_t len) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Check one entry of a directory block; returns its rec_len, or 0 if the
+ * entry is malformed (scanning the block must stop there)
+ */
+static uint32_t dirent_check(const uint8_t *block, uint32_t offset, uint32_t block_size) {
+    const ext2_dirent_t *entry = (const ext2_dirent_t *)(block + offset);
+    uint32_t rec_len = entry->rec_len;
+    if (rec_len < DIRENT_HEADER_LEN || rec_len > block_size - offset ||
+        (rec_len & 3) != 0 || DIRENT_HEADER_LEN + (uint32_t)entry->name_len > rec_len) {
         return 0;
     }
-    
-    /* Verify this is a directory */
+    return rec_len;
+}
+
+/**
+ * Read logical block n of a directory
+ * Returns 0 on success, -1 on error (errno set)
+ */
+static int dir_read_block(ext2_fs_t *fs, ext2_inode_t *dir_inode, uint32_t n, uint8_t *block) {
+    int ret = ext2_read_file(fs, dir_inode, NULL, n * fs->block_size, block, fs->block_size);
+    if (ret < 0) {
+        /* errno already set by ext2_read_file */
+        return -1;
+    }
+    if ((uint32_t)ret != fs->block_size) {
+        RETURN_ERRNO(THUNDEROS_EFS_BADDIR);
+    }
+    return 0;
+}
+
+/**
+ * Find a name in one directory block; returns its inode, or 0
+ */
+static uint32_t dir_block_find(const uint8_t *block, uint32_t block_size,
+                               const char *name, uint32_t name_len) {
+    uint32_t offset = 0;
+    while (offset + DIRENT_HEADER_LEN <= block_size) {
+        uint32_t rec_len = dirent_check(block, offset, block_size);
+        if (rec_len == 0) {
+            break;
+        }
+        const ext2_dirent_t *entry = (const ext2_dirent_t *)(block + offset);
+        if (entry->inode != 0 && name_equal(entry->name, entry->name_len, name, name_len)) {
+            return entry->inode;
+        }
+        offset += rec_len;
+    }
+    return 0;
+}
+
+/**
+ * Check that an inode is a directory and a name is usable in it
+ */
+static int dir_check(ext2_inode_t *dir_inode, const char *name, uint32_t *name_len) {
     if ((dir_inode->i_mode & EXT2_S_IFMT) != EXT2_S_IFDIR) {
         hal_uart_puts("ext2: Inode is not a directory\n");
-        set_errno(THUNDEROS_EFS_BADDIR);
+        RETURN_ERRNO(THUNDEROS_EFS_BADDIR);
+    }
+    if (name) {
+        *name_len = strlen(name);
+        if (*name_len == 0 || *name_len > EXT2_NAME_LEN) {
+            hal_uart_puts("ext2: Invalid filename length\n");
+            RETURN_ERRNO(THUNDEROS_EINVAL);
+        }
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * htree name hashes (as computed by ext3/ext4)
+ * ------------------------------------------------------------------------ */
+
+#define ROL32(x, s) (((x) << (s)) | ((x) >> (32 - (s))))
+
+/* MD4 basic functions: selection, majority, parity */
+#define MD4_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MD4_G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define MD4_H(x, y, z) ((x) ^ (y) ^ (z))
+#define MD4_ROUND(f, a, b, c, d, x, s) ((a) += f((b), (c), (d)) + (x), (a) = ROL32((a), (s)))
+#define MD4_K2 013240474631U
+#define MD4_K3 015666365641U
+
+/**
+ * Half-MD4: the three MD4 rounds over eight words, without padding
+ */
+static void dx_half_md4(uint32_t buf[4], const uint32_t in[8]) {
+    uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+    MD4_ROUND(MD4_F, a, b, c, d, in[0], 3);
+    MD4_ROUND(MD4_F, d, a, b, c, in[1], 7);
+    MD4_ROUND(MD4_F, c, d, a, b, in[2], 11);
+    MD4_ROUND(MD4_F, b, c, d, a, in[3], 19);
+    MD4_ROUND(MD4_F, a, b, c, d, in[4], 3);
+    MD4_ROUND(MD4_F, d, a, b, c, in[5], 7);
+    MD4_ROUND(MD4_F, c, d, a, b, in[6], 11);
+    MD4_ROUND(MD4_F, b, c, d, a, in[7], 19);
+
+    MD4_ROUND(MD4_G, a, b, c, d, in[1] + MD4_K2, 3);
+    MD4_ROUND(MD4_G, d, a, b, c, in[3] + MD4_K2, 5);
+    MD4_ROUND(MD4_G, c, d, a, b, in[5] + MD4_K2, 9);
+    MD4_ROUND(MD4_G, b, c, d, a, in[7] + MD4_K2, 13);
+    MD4_ROUND(MD4_G, a, b, c, d, in[0] + MD4_K2, 3);
+    MD4_ROUND(MD4_G, d, a, b, c, in[2] + MD4_K2, 5);
+    MD4_ROUND(MD4_G, c, d, a, b, in[4] + MD4_K2, 9);
+    MD4_ROUND(MD4_G, b, c, d, a, in[6] + MD4_K2, 13);
+
+    MD4_ROUND(MD4_H, a, b, c, d, in[3] + MD4_K3, 3);
+    MD4_ROUND(MD4_H, d, a, b, c, in[7] + MD4_K3, 9);
+    MD4_ROUND(MD4_H, c, d, a, b, in[2] + MD4_K3, 11);
+    MD4_ROUND(MD4_H, b, c, d, a, in[6] + MD4_K3, 15);
+    MD4_ROUND(MD4_H, a, b, c, d, in[1] + MD4_K3, 3);
+    MD4_ROUND(MD4_H, d, a, b, c, in[5] + MD4_K3, 9);
+    MD4_ROUND(MD4_H, c, d, a, b, in[0] + MD4_K3, 11);
+    MD4_ROUND(MD4_H, b, c, d, a, in[4] + MD4_K3, 15);
+
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+/**
+ * TEA: sixteen rounds mixing four words into the first two of buf
+ */
+static void dx_tea(uint32_t buf[4], const uint32_t in[4]) {
+    uint32_t sum = 0;
+    uint32_t b0 = buf[0], b1 = buf[1];
+
+    for (int n = 0; n < 16; n++) {
+        sum += 0x9E3779B9U;
+        b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+        b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+    }
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+/**
+ * Character value as the hash sees it (ext3 hashed plain char, whose
+ * sign depends on the machine mkfs ran on)
+ */
+static inline int32_t dx_char(const char *name, uint32_t i, int is_unsigned) {
+    return is_unsigned ? (int32_t)(uint8_t)name[i] : (int32_t)(int8_t)name[i];
+}
+
+/**
+ * Pack up to num * 4 bytes of a name into words, padded with its length
+ */
+static void dx_str2hashbuf(const char *name, uint32_t len, uint32_t *buf, int num,
+                           int is_unsigned) {
+    uint32_t pad = len | (len << 8);
+    pad |= pad << 16;
+
+    uint32_t val = pad;
+    if (len > (uint32_t)num * 4) {
+        len = (uint32_t)num * 4;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        val = (uint32_t)dx_char(name, i, is_unsigned) + (val << 8);
+        if ((i % 4) == 3) {
+            *buf++ = val;
+            val = pad;
+            num--;
+        }
+    }
+    if (--num >= 0) {
+        *buf++ = val;
+    }
+    while (--num >= 0) {
+        *buf++ = pad;
+    }
+}
+
+/**
+ * Hash of a name in an htree directory (bit 0 is always clear)
+ */
+static uint32_t dx_hash(const char *name, uint32_t len, uint32_t version, const uint32_t seed[4]) {
+    uint32_t buf[4] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
+    uint32_t in[8];
+    uint32_t hash = 0;
+
+    if (seed[0] || seed[1] || seed[2] || seed[3]) {
+        for (int i = 0; i < 4; i++) {
+            buf[i] = seed[i];
+        }
+    }
+
+    int is_unsigned = version >= DX_HASH_UNSIGNED_DELTA;
+    switch (version % DX_HASH_UNSIGNED_DELTA) {
+    case DX_HASH_LEGACY: {
+        uint32_t hash0 = 0x12A3FE2D, hash1 = 0x37ABE8F9;
+        for (uint32_t i = 0; i < len; i++) {
+            hash = hash1 + (hash0 ^ ((uint32_t)dx_char(name, i, is_unsigned) * 7152373U));
+            if (hash & 0x80000000) {
+                hash -= 0x7FFFFFFF;
+            }
+            hash1 = hash0;
+            hash0 = hash;
+        }
+        hash = hash0 << 1;
+        break;
+    }
+    case DX_HASH_HALF_MD4:
+        for (uint32_t done = 0; done < len || done == 0; done += 32) {
+            dx_str2hashbuf(name + done, len - done, in, 8, is_unsigned);
+            dx_half_md4(buf, in);
+            if (len - done <= 32) {
+                break;
+            }
+        }
+        hash = buf[1];
+        break;
+    default:
+        for (uint32_t done = 0; done < len || done == 0; done += 16) {
+            dx_str2hashbuf(name + done, len - done, in, 4, is_unsigned);
+            dx_tea(buf, in);
+            if (len - done <= 16) {
+                break;
+            }
+        }
+        hash = buf[0];
+        break;
+    }
+
+    hash &= ~1U;
+    if (hash == (0x7FFFFFFFU << 1)) {
+        hash = (0x7FFFFFFFU - 1) << 1;
+    }
+    return hash;
+}
+
+/* ------------------------------------------------------------------------
+ * htree lookup
+ * ------------------------------------------------------------------------ */
+
+/**
+ * Index entry of a hash tree node; in the first, hash holds the node's
+ * limit and count instead
+ */
+typedef struct {
+    uint32_t hash;
+    uint32_t block;
+} __attribute__((packed)) dx_entry_t;
+
+/**
+ * Position in one level of the tree
+ */
+typedef struct {
+    dx_entry_t *entries;
+    uint32_t count;
+    dx_entry_t *at;                    /* Entry followed down */
+} dx_frame_t;
+
+static inline uint32_t dx_count(const dx_entry_t *entries) {
+    return entries[0].hash >> 16;
+}
+
+static inline uint32_t dx_limit(const dx_entry_t *entries) {
+    return entries[0].hash & 0xFFFF;
+}
+
+static inline uint32_t dx_block(const dx_entry_t *entry) {
+    return entry->block & 0x0FFFFFFF;
+}
+
+/**
+ * Fill a frame from a node's entry table; returns 0 if it is malformed
+ */
+static int dx_frame_init(dx_frame_t *frame, uint8_t *node, uint32_t offset,
+                         uint32_t block_size, uint32_t hash) {
+    dx_entry_t *entries = (dx_entry_t *)(node + offset);
+    uint32_t count = dx_count(entries);
+    if (count == 0 || count > dx_limit(entries) ||
+        dx_limit(entries) > (block_size - offset) / sizeof(dx_entry_t)) {
         return 0;
     }
-    
-    uint32_t name_len = strlen(name);
-    if (name_len == 0 || name_len > EXT2_NAME_LEN) {
-        hal_uart_puts("ext2: Invalid filename length\n");
-        set_errno(THUNDEROS_EINVAL);
+
+    /* Last entry whose hash is not above the one wanted */
+    dx_entry_t *p = entries + 1;
+    dx_entry_t *q = entries + count - 1;
+    while (p <= q) {
+        dx_entry_t *m = p + (q - p) / 2;
+        if (m->hash > hash) {
+            q = m - 1;
+        } else {
+            p = m + 1;
+        }
+    }
+
+    frame->entries = entries;
+    frame->count = count;
+    frame->at = p - 1;
+    return 1;
+}
+
+/**
+ * Search an htree directory through its hash tree
+ * Returns the inode (0 if not there) and sets *done; if the tree cannot
+ * be used, *done is left 0 and the caller falls back to a full search
+ */
+static uint32_t dx_lookup(ext2_fs_t *fs, ext2_inode_t *dir_inode, const char *name,
+                          uint32_t name_len, int *done) {
+    *done = 0;
+    uint32_t block_size = fs->block_size;
+    uint8_t *blocks = (uint8_t *)kmalloc((size_t)(DX_MAX_LEVELS + 1) * block_size);
+    if (!blocks) {
         return 0;
     }
-    
-    /* Allocate buffer for directory data */
-    uint8_t *dir_buffer = (uint8_t *)kmalloc(dir_inode->i_size);
-    if (!dir_buffer) {
-        hal_uart_puts("ext2: Failed to allocate directory buffer\n");
+
+    uint32_t result = 0;
+    dx_frame_t frames[DX_MAX_LEVELS];
+    uint8_t *root = blocks;
+    uint8_t *leaf = blocks + (size_t)DX_MAX_LEVELS * block_size;
+
+    if (dir_read_block(fs, dir_inode, 0, root) != 0) {
+        goto out;
+    }
+
+    /* dx_root_info: reserved_zero, hash_version, info_length, indirect_levels */
+    const uint8_t *info = root + DX_ROOT_INFO_OFFSET;
+    uint32_t version = info[4];
+    uint32_t info_length = info[5];
+    uint32_t levels = (uint32_t)info[6] + 1;
+    if (*(const uint32_t *)info != 0 || version > DX_HASH_TEA || info_length < 8 ||
+        levels > DX_MAX_LEVELS ||
+        DX_ROOT_INFO_OFFSET + info_length + sizeof(dx_entry_t) > block_size) {
+        goto out;
+    }
+    if (version <= DX_HASH_TEA && !(fs->superblock->s_flags & EXT2_FLAGS_SIGNED_HASH)) {
+        version += DX_HASH_UNSIGNED_DELTA;
+    }
+    uint32_t seed[4];
+    kmemcpy(seed, fs->superblock->s_hash_seed, sizeof(seed));  /* Packed field */
+    uint32_t hash = dx_hash(name, name_len, version, seed);
+
+    /* Walk down to the leaf whose hash range holds the name */
+    if (!dx_frame_init(&frames[0], root, DX_ROOT_INFO_OFFSET + info_length, block_size, hash)) {
+        goto out;
+    }
+    for (uint32_t level = 1; level < levels; level++) {
+        uint8_t *node = blocks + (size_t)level * block_size;
+        if (dir_read_block(fs, dir_inode, dx_block(frames[level - 1].at), node) != 0 ||
+            !dx_frame_init(&frames[level], node, DIRENT_HEADER_LEN, block_size, hash)) {
+            goto out;
+        }
+    }
+
+    for (;;) {
+        if (dir_read_block(fs, dir_inode, dx_block(frames[levels - 1].at), leaf) != 0) {
+            goto out;
+        }
+        result = dir_block_find(leaf, block_size, name, name_len);
+        if (result != 0) {
+            break;
+        }
+
+        /* Names with the same hash can spill into the next leaf, which
+         * then starts at that hash (with bit 0 set) */
+        uint32_t level = levels - 1;
+        while (++frames[level].at >= frames[level].entries + frames[level].count) {
+            if (level == 0) {
+                goto found;
+            }
+            level--;
+        }
+        if ((frames[level].at->hash & ~1U) != hash) {
+            break;
+        }
+        while (level + 1 < levels) {
+            uint8_t *node = blocks + (size_t)(level + 1) * block_size;
+            if (dir_read_block(fs, dir_inode, dx_block(frames[level].at), node) != 0 ||
+                !dx_frame_init(&frames[level + 1], node, DIRENT_HEADER_LEN, block_size, 0)) {
+                goto out;
+            }
+            frames[level + 1].at = frames[level + 1].entries;
+            level++;
+        }
+    }
+
+found:
+    *done = 1;
+out:
+    kfree(blocks);
+    return result;
+}
+
+/* ------------------------------------------------------------------------
+ * In-memory index
+ * ------------------------------------------------------------------------ */
+
+/**
+ * Find a directory's index and make it the most recently used
+ */
+static ext2_dir_index_t *dir_index_find(ext2_fs_t *fs, uint32_t dir_inode_num) {
+    ext2_dir_index_t **link = &fs->dir_indexes;
+    while (*link) {
+        ext2_dir_index_t *index = *link;
+        if (index->dir_inode == dir_inode_num) {
+            *link = index->next;
+            index->next = fs->dir_indexes;
+            fs->dir_indexes = index;
+            return index;
+        }
+        link = &index->next;
+    }
+    return NULL;
+}
+
+static void dir_index_free(ext2_dir_index_t *index) {
+    for (uint32_t i = 0; i < index->count; i++) {
+        kfree(index->order[i]);
+    }
+    kfree(index->order);
+    kfree(index);
+}
+
+/**
+ * Position in order[] of the first entry at or after a byte offset
+ */
+static uint32_t dir_index_position(ext2_dir_index_t *index, uint32_t offset) {
+    uint32_t low = 0;
+    uint32_t high = index->count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (index->order[mid]->offset < offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/**
+ * Add a name to an index, at its place in directory order
+ * Returns 0 on success, -1 on error (errno set)
+ */
+static int dir_index_insert(ext2_dir_index_t *index, const char *name, uint32_t name_len,
+                            uint32_t offset, uint32_t inode, uint8_t file_type) {
+    if (index->count == index->capacity) {
+        uint32_t capacity = index->capacity ? index->capacity * 2 : 32;
+        ext2_dir_name_t **order = (ext2_dir_name_t **)kmalloc(capacity * sizeof(*order));
+        if (!order) {
+            RETURN_ERRNO(THUNDEROS_ENOMEM);
+        }
+        if (index->count > 0) {
+            kmemcpy(order, index->order, index->count * sizeof(*order));
+        }
+        kfree(index->order);
+        index->order = order;
+        index->capacity = capacity;
+    }
+
+    ext2_dir_name_t *entry = (ext2_dir_name_t *)kmalloc(sizeof(ext2_dir_name_t) + name_len);
+    if (!entry) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    entry->hash = ext2_dir_name_hash(name, name_len);
+    entry->offset = offset;
+    entry->inode = inode;
+    entry->file_type = file_type;
+    entry->name_len = (uint8_t)name_len;
+    kmemcpy(entry->name, name, name_len);
+
+    ext2_dir_name_t **bucket = &index->buckets[entry->hash % EXT2_DIR_INDEX_BUCKETS];
+    entry->hash_next = *bucket;
+    *bucket = entry;
+
+    /* Building the index appends; a new entry may fill a hole earlier on */
+    uint32_t position = index->count;
+    if (position > 0 && index->order[position - 1]->offset > offset) {
+        position = dir_index_position(index, offset);
+        for (uint32_t i = index->count; i > position; i--) {
+            index->order[i] = index->order[i - 1];
+        }
+    }
+    index->order[position] = entry;
+    index->count++;
+    return 0;
+}
+
+/**
+ * Find a name in an index
+ */
+static ext2_dir_name_t *dir_index_lookup(ext2_dir_index_t *index, const char *name,
+                                         uint32_t name_len) {
+    uint32_t hash = ext2_dir_name_hash(name, name_len);
+    ext2_dir_name_t *entry = index->buckets[hash % EXT2_DIR_INDEX_BUCKETS];
+    while (entry) {
+        if (entry->hash == hash && name_equal(entry->name, entry->name_len, name, name_len)) {
+            return entry;
+        }
+        entry = entry->hash_next;
+    }
+    return NULL;
+}
+
+/**
+ * Get a directory's index, reading the directory to build it if needed
+ * Returns the index, or NULL on error (errno set)
+ */
+static ext2_dir_index_t *dir_index_get(ext2_fs_t *fs, uint32_t dir_inode_num,
+                                       ext2_inode_t *dir_inode) {
+    ext2_dir_index_t *index = dir_index_find(fs, dir_inode_num);
+    if (index) {
+        return index;
+    }
+
+    index = (ext2_dir_index_t *)kmalloc(sizeof(ext2_dir_index_t));
+    uint8_t *block = (uint8_t *)kmalloc(fs->block_size);
+    if (!index || !block) {
+        kfree(index);
+        kfree(block);
+        set_errno(THUNDEROS_ENOMEM);
+        return NULL;
+    }
+    kmemset(index, 0, sizeof(*index));
+    index->dir_inode = dir_inode_num;
+
+    uint32_t blocks = dir_inode->i_size / fs->block_size;
+    for (uint32_t n = 0; n < blocks; n++) {
+        if (dir_read_block(fs, dir_inode, n, block) != 0) {
+            goto fail;
+        }
+        uint32_t offset = 0;
+        while (offset + DIRENT_HEADER_LEN <= fs->block_size) {
+            uint32_t rec_len = dirent_check(block, offset, fs->block_size);
+            if (rec_len == 0) {
+                break;
+            }
+            ext2_dirent_t *entry = (ext2_dirent_t *)(block + offset);
+            if (entry->inode != 0 &&
+                dir_index_insert(index, entry->name, entry->name_len, n * fs->block_size + offset,
+                                 entry->inode, entry->file_type) != 0) {
+                goto fail;
+            }
+            offset += rec_len;
+        }
+    }
+    kfree(block);
+
+    /* Keep the most recently used; drop the least recently used one */
+    index->next = fs->dir_indexes;
+    fs->dir_indexes = index;
+    uint32_t kept = 1;
+    for (ext2_dir_index_t **link = &index->next; *link; kept++) {
+        if (kept == EXT2_DIR_INDEX_MAX) {
+            dir_index_free(*link);
+            *link = NULL;
+            break;
+        }
+        link = &(*link)->next;
+    }
+    return index;
+
+fail:
+    /* errno already set by dir_read_block or dir_index_insert */
+    kfree(block);
+    dir_index_free(index);
+    return NULL;
+}
+
+/**
+ * Search a directory block by block, without an index
+ */
+static uint32_t dir_scan(ext2_fs_t *fs, ext2_inode_t *dir_inode, const char *name,
+                         uint32_t name_len) {
+    uint8_t *block = (uint8_t *)kmalloc(fs->block_size);
+    if (!block) {
         set_errno(THUNDEROS_ENOMEM);
         return 0;
     }
-    
-    /* Read directory contents */
-    int ret = ext2_read_file(fs, dir_inode, 0, dir_buffer, dir_inode->i_size);
-    if (ret < 0) {
-        hal_uart_puts("ext2: Failed to read directory\n");
-        kfree(dir_buffer);
-        /* errno already set by ext2_read_file */
+    uint32_t result = 0;
+    uint32_t blocks = dir_inode->i_size / fs->block_size;
+    for (uint32_t n = 0; n < blocks && result == 0; n++) {
+        if (dir_read_block(fs, dir_inode, n, block) != 0) {
+            kfree(block);
+            /* errno already set by dir_read_block */
+            return 0;
+        }
+        result = dir_block_find(block, fs->block_size, name, name_len);
+    }
+    kfree(block);
+    if (result == 0) {
+        set_errno(THUNDEROS_ENOENT);
+        return 0;
+    }
+    clear_errno();
+    return result;
+}
+
+/**
+ * Lookup a file in a directory by name
+ */
+uint32_t ext2_lookup(ext2_fs_t *fs, uint32_t dir_inode_num, ext2_inode_t *dir_inode,
+                     const char *name) {
+    if (!fs || !dir_inode || !name) {
+        hal_uart_puts("ext2: Invalid parameters to ext2_lookup\n");
+        set_errno(THUNDEROS_EINVAL);
         return 0;
     }
-    
-    /* Parse directory entries */
+
+    uint32_t name_len;
+    if (dir_check(dir_inode, name, &name_len) != 0) {
+        /* errno already set by dir_check */
+        return 0;
+    }
+
+    ext2_dir_index_t *index = dir_index_find(fs, dir_inode_num);
+
+    /* Not indexed yet: an intact hash tree finds it without reading it all */
+    if (!index && (dir_inode->i_flags & EXT2_INDEX_FL) &&
+        (fs->superblock->s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX)) {
+        int done;
+        uint32_t inode = dx_lookup(fs, dir_inode, name, name_len, &done);
+        if (done) {
+            if (inode == 0) {
+                set_errno(THUNDEROS_ENOENT);
+                return 0;
+            }
+            clear_errno();
+            return inode;
+        }
+    }
+
+    if (!index) {
+        index = dir_index_get(fs, dir_inode_num, dir_inode);
+        if (!index) {
+            /* Could not index it: a plain search still works */
+            return dir_scan(fs, dir_inode, name, name_len);
+        }
+    }
+
+    ext2_dir_name_t *entry = dir_index_lookup(index, name, name_len);
+    if (!entry) {
+        set_errno(THUNDEROS_ENOENT);
+        return 0;  /* Not found */
+    }
+    clear_errno();
+    return entry->inode;
+}
+
+/**
+ * Prefetch the inodes named in a directory block
+ */
+static void dir_block_prefetch_inodes(ext2_fs_t *fs, const uint8_t *block) {
+    uint32_t inodes[EXT2_INODE_PREFETCH_MAX];
+    uint32_t n = 0;
     uint32_t offset = 0;
-    while (offset < dir_inode->i_size) {
-        ext2_dirent_t *entry = (ext2_dirent_t *)(dir_buffer + offset);
-        
-        /* Check for invalid entry */
-        if (entry->rec_len == 0) {
+    while (offset + DIRENT_HEADER_LEN <= fs->block_size && n < EXT2_INODE_PREFETCH_MAX) {
+        uint32_t rec_len = dirent_check(block, offset, fs->block_size);
+        if (rec_len == 0) {
             break;
         }
-        
-        /* Check if this entry matches the name we're looking for */
-        if (entry->inode != 0 && entry->name_len == name_len) {
-            if (strncmp(entry->name, name, name_len) == 0) {
-                uint32_t inode_num = entry->inode;
-                kfree(dir_buffer);
-                clear_errno();
-                return inode_num;
+        const ext2_dirent_t *entry = (const ext2_dirent_t *)(block + offset);
+        if (entry->inode != 0) {
+            inodes[n++] = entry->inode;
+        }
+        offset += rec_len;
+    }
+    ext2_prefetch_inodes(fs, inodes, n);
+}
+
+/**
+ * Pass a directory's entries to fill straight from its blocks (used when
+ * the directory cannot be indexed)
+ */
+static int dir_iterate_blocks(ext2_fs_t *fs, ext2_inode_t *dir_inode, uint32_t *pos,
+                              ext2_filldir_t fill, void *ctx, char *name) {
+    uint8_t *block = (uint8_t *)kmalloc(fs->block_size);
+    if (!block) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    uint32_t blocks = dir_inode->i_size / fs->block_size;
+    for (uint32_t n = *pos / fs->block_size; n < blocks; n++) {
+        if (dir_read_block(fs, dir_inode, n, block) != 0) {
+            kfree(block);
+            /* errno already set by dir_read_block */
+            return -1;
+        }
+        dir_block_prefetch_inodes(fs, block);
+        /* Walk from the block start: *pos may no longer be an entry boundary */
+        uint32_t offset = 0;
+        while (offset + DIRENT_HEADER_LEN <= fs->block_size) {
+            uint32_t rec_len = dirent_check(block, offset, fs->block_size);
+            if (rec_len == 0) {
+                break;
             }
+            ext2_dirent_t *entry = (ext2_dirent_t *)(block + offset);
+            if (n * fs->block_size + offset >= *pos && entry->inode != 0) {
+                kmemcpy(name, entry->name, entry->name_len);
+                name[entry->name_len] = '\0';
+                if (fill(ctx, name, entry->name_len, entry->inode) != 0) {
+                    kfree(block);
+                    clear_errno();
+                    return 0;
+                }
+                *pos = n * fs->block_size + offset + rec_len;
+            }
+            offset += rec_len;
+        }
+        *pos = (n + 1) * fs->block_size;
+    }
+    kfree(block);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Prefetch the inodes of the next EXT2_INODE_PREFETCH_MAX entries in
+ * directory order, from the i-th
+ */
+static void dir_prefetch_inodes(ext2_fs_t *fs, ext2_dir_index_t *index, uint32_t i) {
+    uint32_t inodes[EXT2_INODE_PREFETCH_MAX];
+    uint32_t n = 0;
+    for (; i < index->count && n < EXT2_INODE_PREFETCH_MAX; i++) {
+        inodes[n++] = index->order[i]->inode;
+    }
+    ext2_prefetch_inodes(fs, inodes, n);
+}
+
+/**
+ * Pass the entries at or after a byte offset of a directory to fill
+ */
+int ext2_iterate_dir(ext2_fs_t *fs, uint32_t dir_inode_num, ext2_inode_t *dir_inode,
+                     uint32_t *pos, ext2_filldir_t fill, void *ctx) {
+    if (!fs || !dir_inode || !pos || !fill) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (dir_check(dir_inode, NULL, NULL) != 0) {
+        /* errno already set by dir_check */
+        return -1;
+    }
+
+    char name[EXT2_NAME_LEN + 1];
+    ext2_dir_index_t *index = dir_index_get(fs, dir_inode_num, dir_inode);
+    if (!index) {
+        /* Could not index it: read the blocks instead */
+        return dir_iterate_blocks(fs, dir_inode, pos, fill, ctx, name);
+    }
+
+    uint32_t i = dir_index_position(index, *pos);
+    uint32_t first = i;
+    for (; i < index->count; i++) {
+        ext2_dir_name_t *entry = index->order[i];
+        /* A listing is usually followed by a stat() of each entry */
+        if ((i - first) % EXT2_INODE_PREFETCH_MAX == 0) {
+            dir_prefetch_inodes(fs, index, i);
+        }
+        kmemcpy(name, entry->name, entry->name_len);
+        name[entry->name_len] = '\0';
+        if (fill(ctx, name, entry->name_len, entry->inode) != 0) {
+            break;
+        }
+        /* Anything after this entry, even one added later, is still ahead */
+        *pos = entry->offset + 1;
+    }
+    if (i == index->count && *pos < dir_inode->i_size) {
+        *pos = dir_inode->i_size;
+    }
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Record an entry added on disk
+ */
+void ext2_dir_index_add(ext2_fs_t *fs, uint32_t dir_inode_num, const char *name,
+                        uint32_t offset, uint32_t inode, uint8_t file_type) {
+    ext2_dir_index_t *index = dir_index_find(fs, dir_inode_num);
+    if (index && dir_index_insert(index, name, strlen(name), offset, inode, file_type) != 0) {
+        /* Out of memory: forget the index rather than keep it wrong */
+        ext2_dir_index_drop(fs, dir_inode_num);
+        clear_errno();
+    }
+}
+
+/**
+ * Record an entry removed on disk
+ */
+void ext2_dir_index_remove(ext2_fs_t *fs, uint32_t dir_inode_num, const char *name) {
+    ext2_dir_index_t *index = dir_index_find(fs, dir_inode_num);
+    if (!index) {
+        return;
+    }
+    uint32_t name_len = strlen(name);
+    ext2_dir_name_t *entry = dir_index_lookup(index, name, name_len);
+    if (!entry) {
+        return;
+    }
+
+    ext2_dir_name_t **link = &index->buckets[entry->hash % EXT2_DIR_INDEX_BUCKETS];
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+
+    /* Later entries move up one, so directory order is kept */
+    uint32_t i = dir_index_position(index, entry->offset);
+    index->count--;
+    for (; i < index->count; i++) {
+        index->order[i] = index->order[i + 1];
+    }
+    kfree(entry);
+}
+
+/**
+ * Forget a directory's index (every directory's if dir_inode_num is 0)
+ */
+void ext2_dir_index_drop(ext2_fs_t *fs, uint32_t dir_inode_num) {
+    ext2_dir_index_t **link = &fs->dir_indexes;
+    while (*link) {
+        ext2_dir_index_t *index = *link;
+        if (dir_inode_num == 0 || index->dir_inode == dir_inode_num) {
+            *link = index->next;
+            dir_index_free(index);
+        } else {
+            link = &index->next;
         }
-        
-        offset += entry->rec_len;
     }
-    
-    kfree(dir_buffer);
-    set_errno(THUNDEROS_ENOENT);
-    return 0;  /* Not found */
 }
 
 /**
@@ -112,64 +934,50 @@ int ext2_list_dir(ext2_fs_t *fs, ext2_inode_t *dir_inode, ext2_dir_callback_t ca
         hal_uart_puts("ext2: Invalid parameters to ext2_list_dir\n");
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
-    
-    /* Verify this is a directory */
-    if ((dir_inode->i_mode & EXT2_S_IFMT) != EXT2_S_IFDIR) {
-        hal_uart_puts("ext2: Inode is not a directory\n");
-        RETURN_ERRNO(THUNDEROS_EFS_BADDIR);
-    }
-    
-    /* Allocate buffer for directory data */
-    uint8_t *dir_buffer = (uint8_t *)kmalloc(dir_inode->i_size);
-    if (!dir_buffer) {
-        hal_uart_puts("ext2: Failed to allocate directory buffer\n");
-        RETURN_ERRNO(THUNDEROS_ENOMEM);
-    }
-    
-    /* Read directory contents */
-    int ret = ext2_read_file(fs, dir_inode, 0, dir_buffer, dir_inode->i_size);
-    if (ret < 0) {
-        hal_uart_puts("ext2: Failed to read directory\n");
-        kfree(dir_buffer);
-        /* errno already set by ext2_read_file */
+
+    if (dir_check(dir_inode, NULL, NULL) != 0) {
+        /* errno already set by dir_check */
         return -1;
     }
-    
-    /* Allocate buffer for null-terminated name */
+
+    uint8_t *block = (uint8_t *)kmalloc(fs->block_size);
     char *name_buffer = (char *)kmalloc(EXT2_NAME_LEN + 1);
-    if (!name_buffer) {
-        hal_uart_puts("ext2: Failed to allocate name buffer\n");
-        kfree(dir_buffer);
+    if (!block || !name_buffer) {
+        hal_uart_puts("ext2: Failed to allocate directory buffer\n");
+        kfree(block);
+        kfree(name_buffer);
         RETURN_ERRNO(THUNDEROS_ENOMEM);
     }
-    
-    /* Parse directory entries */
-    uint32_t offset = 0;
-    while (offset < dir_inode->i_size) {
-        ext2_dirent_t *entry = (ext2_dirent_t *)(dir_buffer + offset);
-        
-        /* Check for invalid entry */
-        if (entry->rec_len == 0) {
-            break;
+
+    uint32_t blocks = dir_inode->i_size / fs->block_size;
+    for (uint32_t n = 0; n < blocks; n++) {
+        if (dir_read_block(fs, dir_inode, n, block) != 0) {
+            hal_uart_puts("ext2: Failed to read directory\n");
+            kfree(name_buffer);
+            kfree(block);
+            /* errno already set by dir_read_block */
+            return -1;
         }
-        
-        /* Process valid entries */
-        if (entry->inode != 0) {
-            /* Copy name and null-terminate */
-            for (uint32_t i = 0; i < entry->name_len; i++) {
-                name_buffer[i] = entry->name[i];
+
+        uint32_t offset = 0;
+        while (offset + DIRENT_HEADER_LEN <= fs->block_size) {
+            uint32_t rec_len = dirent_check(block, offset, fs->block_size);
+            if (rec_len == 0) {
+                break;
             }
-            name_buffer[entry->name_len] = '\0';
-            
-            /* Call callback with entry information */
-            callback(name_buffer, entry->inode, entry->file_type);
+            ext2_dirent_t *entry = (ext2_dirent_t *)(block + offset);
+            if (entry->inode != 0) {
+                /* Copy name and null-terminate */
+                kmemcpy(name_buffer, entry->name, entry->name_len);
+                name_buffer[entry->name_len] = '\0';
+                callback(name_buffer, entry->inode, entry->file_type);
+            }
+            offset += rec_len;
         }
-        
-        offset += entry->rec_len;
     }
-    
+
     kfree(name_buffer);
-    kfree(dir_buffer);
+    kfree(block);
     clear_errno();
     return 0;
 }
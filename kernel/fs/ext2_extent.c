@@ -0,0 +1,491 @@
+/*
+ * ext2_extent.c - ext4 extent trees
+ *
+ * An inode with EXT4_EXTENTS_FL keeps the root of a tree in i_block in
+ * place of a block map: a header and up to four entries. Leaf entries
+ * are extents, runs of up to 32768 file blocks in consecutive disk
+ * blocks; index entries point at tree blocks, each starting with a
+ * header of its own. Entries in a node are sorted by first file block,
+ * so a lookup is one binary search per level, and a file made of a few
+ * large extents is mapped without reading any block at all.
+ *
+ * Block numbers are 32 bits here as everywhere else in the driver: an
+ * entry using the high 16 bits is treated as corruption.
+ */
+
+#include "../include/fs/ext2.h"
+#include "../include/fs/ext2_journal.h"
+#include "../include/fs/bcache.h"
+#include "../include/hal/hal_uart.h"
+#include "../include/kernel/errno.h"
+#include "../include/kernel/kstring.h"
+#include <stddef.h>
+
+/* Entries that fit in i_block after the header */
+#define EXT4_EXT_ROOT_ENTRIES \
+    ((EXT2_N_BLOCKS * sizeof(uint32_t) - sizeof(ext4_extent_header_t)) / sizeof(ext4_extent_t))
+
+/* No hole runs past this */
+#define EXT4_EXT_LAST_BLOCK 0xFFFFFFFFu
+
+/**
+ * One node on the way from the root to a leaf
+ */
+typedef struct {
+    buf_t *buf;                     /* Tree block (NULL for the root in i_block) */
+    ext4_extent_header_t *header;
+    int slot;                       /* Last entry starting at or before the block (-1: none) */
+} ext_level_t;
+
+static inline ext4_extent_t *ext_leaf(ext4_extent_header_t *h) {
+    return (ext4_extent_t *)(h + 1);
+}
+
+static inline ext4_extent_idx_t *ext_index(ext4_extent_header_t *h) {
+    return (ext4_extent_idx_t *)(h + 1);
+}
+
+/**
+ * First file block of entry i (extents and index entries both start with it)
+ */
+static inline uint32_t ext_entry_start(ext4_extent_header_t *h, uint32_t i) {
+    return h->eh_depth == 0 ? ext_leaf(h)[i].ee_block : ext_index(h)[i].ei_block;
+}
+
+static inline int ext_uninit(const ext4_extent_t *ex) {
+    return ex->ee_len > EXT4_EXT_INIT_MAX_LEN;
+}
+
+static inline uint32_t ext_len(const ext4_extent_t *ex) {
+    return ext_uninit(ex) ? ex->ee_len - EXT4_EXT_INIT_MAX_LEN : ex->ee_len;
+}
+
+/**
+ * Entries that fit in a tree block
+ */
+static inline uint32_t ext_block_capacity(ext2_fs_t *fs) {
+    return (fs->block_size - sizeof(ext4_extent_header_t)) / sizeof(ext4_extent_t);
+}
+
+static int ext_header_ok(const ext4_extent_header_t *h, uint32_t capacity) {
+    return h->eh_magic == EXT4_EXT_MAGIC && h->eh_max > 0 && h->eh_max <= capacity &&
+           h->eh_entries <= h->eh_max && h->eh_depth <= EXT4_EXT_MAX_DEPTH;
+}
+
+/**
+ * Last entry of a node starting at or before file_block, or -1 if none
+ */
+static int ext_search(ext4_extent_header_t *h, uint32_t file_block) {
+    int lo = 0;
+    int hi = (int)h->eh_entries - 1;
+    int slot = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (ext_entry_start(h, (uint32_t)mid) <= file_block) {
+            slot = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return slot;
+}
+
+static void ext_path_release(ext_level_t *path, int depth) {
+    for (int level = 0; level <= depth; level++) {
+        brelse(path[level].buf);
+    }
+}
+
+/**
+ * Note a change to a node (the root reaches disk with the inode)
+ */
+static void ext_dirty(ext2_fs_t *fs, ext_level_t *level) {
+    if (level->buf) {
+        ext2_journal_dirty(fs, level->buf);
+    }
+}
+
+/**
+ * Walk from the root to the leaf that holds, or would hold, file_block
+ *
+ * Every tree block on the way is held in path[1..depth] until
+ * ext_path_release(). *bound is lowered to the first file block of the
+ * next entry along the way, which ends any hole found in the leaf.
+ * Returns the leaf's depth, or -1 on error (errno set)
+ */
+static int ext_find(ext2_fs_t *fs, ext2_inode_t *inode, uint32_t file_block,
+                    ext_level_t *path, uint32_t *bound) {
+    ext4_extent_header_t *root = (ext4_extent_header_t *)inode->i_block;
+    if (!ext_header_ok(root, EXT4_EXT_ROOT_ENTRIES)) {
+        hal_uart_puts("ext2: Bad extent tree root\n");
+        RETURN_ERRNO(THUNDEROS_EFS_CORRUPT);
+    }
+
+    int depth = root->eh_depth;
+    path[0].buf = NULL;
+    path[0].header = root;
+    *bound = EXT4_EXT_LAST_BLOCK;
+
+    for (int level = 0; ; level++) {
+        ext4_extent_header_t *h = path[level].header;
+        int slot = ext_search(h, file_block);
+        path[level].slot = slot;
+        if (slot + 1 < (int)h->eh_entries && ext_entry_start(h, (uint32_t)(slot + 1)) < *bound) {
+            *bound = ext_entry_start(h, (uint32_t)(slot + 1));
+        }
+        if (level == depth) {
+            break;
+        }
+
+        /* Blocks before the first index entry would go in its node */
+        ext4_extent_idx_t *idx = &ext_index(h)[slot < 0 ? 0 : slot];
+        buf_t *b = NULL;
+        if (h->eh_entries > 0 && idx->ei_leaf_hi == 0) {
+            b = bread(fs->device, idx->ei_leaf_lo, fs->block_size);
+            if (!b) {
+                ext_path_release(path, level);
+                /* errno already set by bread */
+                return -1;
+            }
+        }
+        ext4_extent_header_t *child = b ? (ext4_extent_header_t *)b->data : NULL;
+        if (!child || !ext_header_ok(child, ext_block_capacity(fs)) ||
+            child->eh_depth != depth - level - 1) {
+            brelse(b);
+            ext_path_release(path, level);
+            hal_uart_puts("ext2: Bad extent tree node\n");
+            RETURN_ERRNO(THUNDEROS_EFS_CORRUPT);
+        }
+        path[level + 1].buf = b;
+        path[level + 1].header = child;
+    }
+    return depth;
+}
+
+/**
+ * Find the extent, or the hole, holding a file block of an extent-mapped inode
+ */
+int ext2_extent_map(ext2_fs_t *fs, ext2_inode_t *inode, uint32_t file_block,
+                    ext2_map_cache_t *run, int *uninit) {
+    ext_level_t path[EXT4_EXT_MAX_DEPTH + 1];
+    uint32_t bound;
+    int depth = ext_find(fs, inode, file_block, path, &bound);
+    if (depth < 0) {
+        /* errno already set by ext_find */
+        return -1;
+    }
+
+    ext4_extent_header_t *leaf = path[depth].header;
+    int slot = path[depth].slot;
+    run->file_block = file_block;
+    if (uninit) {
+        *uninit = 0;
+    }
+
+    if (slot >= 0) {
+        ext4_extent_t *ex = &ext_leaf(leaf)[slot];
+        uint32_t into = file_block - ex->ee_block;
+        if (into < ext_len(ex)) {
+            if (ex->ee_start_hi != 0) {
+                ext_path_release(path, depth);
+                RETURN_ERRNO(THUNDEROS_EFS_CORRUPT);
+            }
+            run->count = ext_len(ex) - into;
+            run->disk_block = ex->ee_start_lo + into;
+            if (ext_uninit(ex)) {
+                if (uninit) {
+                    *uninit = 1;
+                } else {
+                    run->disk_block = 0;
+                }
+            }
+            ext_path_release(path, depth);
+            clear_errno();
+            return 0;
+        }
+    }
+
+    /* A hole, up to the next extent */
+    run->count = bound > file_block ? bound - file_block : 1;
+    run->disk_block = 0;
+    ext_path_release(path, depth);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Allocate a tree block near goal and fill it with zeros
+ * Returns the block number with the buffer in *out, or 0 on failure
+ */
+static uint32_t ext_alloc_node(ext2_fs_t *fs, uint32_t goal, buf_t **out) {
+    uint32_t block = ext2_alloc_block(fs, goal);
+    if (block == 0) {
+        /* errno already set by ext2_alloc_block */
+        return 0;
+    }
+
+    /* Overwritten entirely, so no need to read the old contents */
+    buf_t *b = bget(fs->device, block, fs->block_size);
+    if (!b) {
+        int err = get_errno();
+        ext2_free_block(fs, block);
+        set_errno(err);
+        return 0;
+    }
+    kmemset(b->data, 0, fs->block_size);
+    *out = b;
+    return block;
+}
+
+/**
+ * Make room for one more entry on the way to a full leaf
+ *
+ * The deepest node on the path with room gets a new child: the node
+ * below it on the path is split, half its entries going to the new one.
+ * When the block goes past the last entry of that node (a file growing
+ * at its end) only what comes after is moved, so appending leaves full
+ * nodes behind. With no room anywhere, the root's entries move down to a
+ * new block and the tree grows a level.
+ * Returns 0 on success, -1 on error (errno set)
+ */
+static int ext_make_room(ext2_fs_t *fs, ext_level_t *path, int depth,
+                         uint32_t file_block, uint32_t goal) {
+    int level = depth - 1;
+    while (level >= 0 && path[level].header->eh_entries >= path[level].header->eh_max) {
+        level--;
+    }
+
+    buf_t *b = NULL;
+    if (level < 0) {
+        ext4_extent_header_t *root = path[0].header;
+        if (root->eh_depth >= EXT4_EXT_MAX_DEPTH) {
+            RETURN_ERRNO(THUNDEROS_EFBIG);
+        }
+        uint32_t block = ext_alloc_node(fs, goal, &b);
+        if (block == 0) {
+            /* errno already set by ext_alloc_node */
+            return -1;
+        }
+        ext4_extent_header_t *node = (ext4_extent_header_t *)b->data;
+        kmemcpy(node, root, sizeof(*root) + root->eh_entries * sizeof(ext4_extent_t));
+        node->eh_max = (uint16_t)ext_block_capacity(fs);
+        ext2_journal_dirty(fs, b);
+        brelse(b);
+
+        ext4_extent_idx_t *idx = ext_index(root);
+        idx->ei_block = root->eh_entries > 0 ? ext_entry_start(root, 0) : 0;
+        idx->ei_leaf_lo = block;
+        idx->ei_leaf_hi = 0;
+        idx->ei_unused = 0;
+        root->eh_entries = 1;
+        root->eh_depth++;
+        clear_errno();
+        return 0;
+    }
+
+    ext4_extent_header_t *parent = path[level].header;
+    ext4_extent_header_t *child = path[level + 1].header;
+    uint32_t entries = child->eh_entries;
+    uint32_t keep = entries / 2;
+    if (path[level + 1].slot == (int)entries - 1) {
+        /* A leaf keeps everything; an index node has to hand on its last entry */
+        keep = child->eh_depth == 0 ? entries : entries - 1;
+    }
+    uint32_t start = keep < entries ? ext_entry_start(child, keep) : file_block;
+
+    uint32_t block = ext_alloc_node(fs, goal, &b);
+    if (block == 0) {
+        /* errno already set by ext_alloc_node */
+        return -1;
+    }
+    ext4_extent_header_t *node = (ext4_extent_header_t *)b->data;
+    node->eh_magic = EXT4_EXT_MAGIC;
+    node->eh_entries = (uint16_t)(entries - keep);
+    node->eh_max = (uint16_t)ext_block_capacity(fs);
+    node->eh_depth = child->eh_depth;
+    kmemcpy(ext_leaf(node), ext_leaf(child) + keep, (entries - keep) * sizeof(ext4_extent_t));
+    ext2_journal_dirty(fs, b);
+    brelse(b);
+
+    child->eh_entries = (uint16_t)keep;
+    ext_dirty(fs, &path[level + 1]);
+
+    /* The new node goes right after the one it was split from */
+    ext4_extent_idx_t *idx = ext_index(parent);
+    uint32_t at = (uint32_t)(path[level].slot < 0 ? 0 : path[level].slot) + 1;
+    for (uint32_t i = parent->eh_entries; i > at; i--) {
+        idx[i] = idx[i - 1];
+    }
+    idx[at].ei_block = start;
+    idx[at].ei_leaf_lo = block;
+    idx[at].ei_leaf_hi = 0;
+    idx[at].ei_unused = 0;
+    parent->eh_entries++;
+    ext_dirty(fs, &path[level]);
+
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Map a file block of an extent-mapped inode to a newly allocated disk block
+ */
+int ext2_extent_insert(ext2_fs_t *fs, ext2_inode_t *inode, uint32_t file_block,
+                       uint32_t disk_block) {
+    /* Each pass either inserts or splits one node, so the depth bounds the passes */
+    for (int pass = 0; pass <= 2 * (EXT4_EXT_MAX_DEPTH + 1); pass++) {
+        ext_level_t path[EXT4_EXT_MAX_DEPTH + 1];
+        uint32_t bound;
+        int depth = ext_find(fs, inode, file_block, path, &bound);
+        if (depth < 0) {
+            /* errno already set by ext_find */
+            return -1;
+        }
+
+        ext4_extent_header_t *leaf = path[depth].header;
+        ext4_extent_t *extents = ext_leaf(leaf);
+        int slot = path[depth].slot;
+
+        /* The block right after an extent, on the disk as in the file */
+        if (slot >= 0) {
+            ext4_extent_t *ex = &extents[slot];
+            if (!ext_uninit(ex) && ex->ee_len < EXT4_EXT_INIT_MAX_LEN &&
+                ex->ee_block + ex->ee_len == file_block &&
+                ex->ee_start_hi == 0 && ex->ee_start_lo + ex->ee_len == disk_block) {
+                ex->ee_len++;
+                ext_dirty(fs, &path[depth]);
+                ext_path_release(path, depth);
+                clear_errno();
+                return 0;
+            }
+        }
+
+        if (leaf->eh_entries < leaf->eh_max) {
+            uint32_t at = (uint32_t)(slot + 1);
+            for (uint32_t i = leaf->eh_entries; i > at; i--) {
+                extents[i] = extents[i - 1];
+            }
+            extents[at].ee_block = file_block;
+            extents[at].ee_len = 1;
+            extents[at].ee_start_hi = 0;
+            extents[at].ee_start_lo = disk_block;
+            leaf->eh_entries++;
+            ext_dirty(fs, &path[depth]);
+
+            /* A new first entry may start before the index entries above it */
+            for (int level = depth - 1; level >= 0 && at == 0; level--) {
+                ext4_extent_idx_t *idx = &ext_index(path[level].header)[0];
+                if (path[level].slot > 0 || idx->ei_block <= file_block) {
+                    break;
+                }
+                idx->ei_block = file_block;
+                ext_dirty(fs, &path[level]);
+            }
+
+            ext_path_release(path, depth);
+            clear_errno();
+            return 0;
+        }
+
+        int ret = ext_make_room(fs, path, depth, file_block, disk_block);
+        ext_path_release(path, depth);
+        if (ret != 0) {
+            /* errno already set by ext_make_room */
+            return -1;
+        }
+    }
+
+    RETURN_ERRNO(THUNDEROS_EFS_CORRUPT);
+}
+
+/**
+ * Zero the uninitialized extent holding a file block and mark it initialized
+ *
+ * The whole extent is zeroed so it stays a single extent; preallocated
+ * space is rarely written a block at a time far from where it starts.
+ */
+int ext2_extent_initialize(ext2_fs_t *fs, ext2_inode_t *inode, uint32_t file_block) {
+    ext_level_t path[EXT4_EXT_MAX_DEPTH + 1];
+    uint32_t bound;
+    int depth = ext_find(fs, inode, file_block, path, &bound);
+    if (depth < 0) {
+        /* errno already set by ext_find */
+        return -1;
+    }
+
+    int slot = path[depth].slot;
+    ext4_extent_t *ex = slot >= 0 ? &ext_leaf(path[depth].header)[slot] : NULL;
+    if (!ex || !ext_uninit(ex) || file_block - ex->ee_block >= ext_len(ex)) {
+        ext_path_release(path, depth);
+        clear_errno();
+        return 0;
+    }
+
+    uint32_t len = ext_len(ex);
+    for (uint32_t i = 0; i < len; i++) {
+        buf_t *b = bget(fs->device, ex->ee_start_lo + i, fs->block_size);
+        if (!b) {
+            ext_path_release(path, depth);
+            /* errno already set by bget */
+            return -1;
+        }
+        kmemset(b->data, 0, fs->block_size);
+        bwrite(b);
+        brelse(b);
+    }
+    ex->ee_len = (uint16_t)len;
+    ext_dirty(fs, &path[depth]);
+
+    ext_path_release(path, depth);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Free the blocks a node maps, and the tree blocks below it
+ */
+static void ext_free_node(ext2_fs_t *fs, ext4_extent_header_t *h) {
+    for (uint32_t i = 0; i < h->eh_entries; i++) {
+        if (h->eh_depth == 0) {
+            ext4_extent_t *ex = &ext_leaf(h)[i];
+            if (ex->ee_start_hi != 0) {
+                continue;
+            }
+            for (uint32_t j = 0; j < ext_len(ex); j++) {
+                ext2_free_block(fs, ex->ee_start_lo + j);
+            }
+            continue;
+        }
+
+        ext4_extent_idx_t *idx = &ext_index(h)[i];
+        if (idx->ei_leaf_hi != 0) {
+            continue;
+        }
+        buf_t *b = bread(fs->device, idx->ei_leaf_lo, fs->block_size);
+        if (b) {
+            ext4_extent_header_t *child = (ext4_extent_header_t *)b->data;
+            if (ext_header_ok(child, ext_block_capacity(fs)) && child->eh_depth == h->eh_depth - 1) {
+                ext_free_node(fs, child);
+            }
+            brelse(b);
+        }
+        ext2_free_block(fs, idx->ei_leaf_lo);
+    }
+}
+
+/**
+ * Free every block of an extent-mapped inode, tree blocks included
+ */
+int ext2_extent_free(ext2_fs_t *fs, ext2_inode_t *inode) {
+    ext4_extent_header_t *root = (ext4_extent_header_t *)inode->i_block;
+    if (ext_header_ok(root, EXT4_EXT_ROOT_ENTRIES)) {
+        ext_free_node(fs, root);
+    }
+
+    kmemset(inode->i_block, 0, sizeof(inode->i_block));
+    root->eh_magic = EXT4_EXT_MAGIC;
+    root->eh_max = (uint16_t)EXT4_EXT_ROOT_ENTRIES;
+    clear_errno();
+    return 0;
+}
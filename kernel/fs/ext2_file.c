@@ -3,195 +3,310 @@
  */
 
 #include "../include/fs/ext2.h"
-#include "../include/drivers/virtio_blk.h"
-#include "../include/mm/kmalloc.h"
+#include "../include/fs/bcache.h"
 #include "../include/hal/hal_uart.h"
 #include "../include/kernel/errno.h"
 #include "../include/kernel/constants.h"
+#include "../include/kernel/kstring.h"
 #include <stddef.h>
 
 /**
- * Read a block from the block device
+ * Read one entry of an indirect block
+ * Returns 0 on success with the block number stored there (0 for a hole)
+ * in *block_num, or -1 on failure (errno set)
  */
-static int read_block(void *device, uint32_t block_num, void *buffer, uint32_t block_size) {
-    (void)device;  /* Device parameter unused - we use global device */
-    
-    /* Calculate sector number (sectors are SECTOR_SIZE bytes) */
-    uint32_t sector = (block_num * block_size) / SECTOR_SIZE;
-    uint32_t num_sectors = block_size / SECTOR_SIZE;
-    
-    /* Read sectors */
-    for (uint32_t i = 0; i < num_sectors; i++) {
-        int ret = virtio_blk_read(sector + i, 
-                                  (uint8_t *)buffer + ((size_t)i * SECTOR_SIZE), 1);
-        if (ret != 1) {
-            set_errno(THUNDEROS_EIO);
-            return -1;
-        }
+static int read_block_pointer(ext2_fs_t *fs, uint32_t block, uint32_t index,
+                              uint32_t *block_num) {
+    buf_t *b = bread(fs->device, block, fs->block_size);
+    if (!b) {
+        /* errno already set by bread */
+        return -1;
     }
     
-    clear_errno();
+    *block_num = ((uint32_t *)b->data)[index];
+    brelse(b);
     return 0;
 }
 
 /**
- * Get the block number for a given file block index
- * Handles direct, indirect, double-indirect, and triple-indirect blocks
+ * Find the indirect block that holds the disk block of a file block
+ * Walks single, double and triple indirection down to the last level.
+ * Returns 0 on success with the block (0 if a hole covers it) in *block_num,
+ * or -1 on failure (errno set)
  */
-static uint32_t get_block_number(ext2_fs_t *fs, ext2_inode_t *inode, uint32_t file_block) {
-    uint32_t *indirect_buffer = NULL;
-    uint32_t *dindirect_buffer = NULL;
-    uint32_t block_num = 0;
+static int get_indirect_block(ext2_fs_t *fs, ext2_inode_t *inode, uint32_t file_block,
+                              uint32_t *block_num) {
     uint32_t ptrs_per_block = fs->block_size / sizeof(uint32_t);
     
-    /* Direct blocks */
-    if (file_block < EXT2_NDIR_BLOCKS) {
-        return inode->i_block[file_block];
-    }
-    
     file_block -= EXT2_NDIR_BLOCKS;
     
     /* Indirect block */
     if (file_block < ptrs_per_block) {
-        if (inode->i_block[EXT2_IND_BLOCK] == 0) {
-            return 0;
-        }
-        
-        indirect_buffer = (uint32_t *)kmalloc(fs->block_size);
-        if (!indirect_buffer) {
-            set_errno(THUNDEROS_ENOMEM);
-            return 0;
-        }
-        
-        if (read_block(fs->device, inode->i_block[EXT2_IND_BLOCK], 
-                      indirect_buffer, fs->block_size) != 0) {
-            kfree(indirect_buffer);
-            /* errno already set by read_block */
-            return 0;
-        }
-        
-        block_num = indirect_buffer[file_block];
-        kfree(indirect_buffer);
-        return block_num;
+        *block_num = inode->i_block[EXT2_IND_BLOCK];
+        return 0;
     }
     
     file_block -= ptrs_per_block;
     
-    /* Double-indirect block */
+    /* Double-indirect block: one of the indirect blocks it points at */
     if (file_block < ptrs_per_block * ptrs_per_block) {
+        *block_num = 0;
         if (inode->i_block[EXT2_DIND_BLOCK] == 0) {
             return 0;
         }
-        
-        /* Read double-indirect block */
-        dindirect_buffer = (uint32_t *)kmalloc(fs->block_size);
-        if (!dindirect_buffer) {
-            set_errno(THUNDEROS_ENOMEM);
+        uint32_t indirect_index = file_block / ptrs_per_block;
+        return read_block_pointer(fs, inode->i_block[EXT2_DIND_BLOCK], indirect_index, block_num);
+    }
+    
+    file_block -= ptrs_per_block * ptrs_per_block;
+    
+    /* Triple-indirect block: double-indirect, then indirect block */
+    if (file_block < ptrs_per_block * ptrs_per_block * ptrs_per_block) {
+        *block_num = 0;
+        if (inode->i_block[EXT2_TIND_BLOCK] == 0) {
             return 0;
         }
         
-        if (read_block(fs->device, inode->i_block[EXT2_DIND_BLOCK], 
-                      dindirect_buffer, fs->block_size) != 0) {
-            kfree(dindirect_buffer);
-            /* errno already set by read_block */
-            return 0;
+        uint32_t dindirect_index = file_block / (ptrs_per_block * ptrs_per_block);
+        uint32_t dindirect_block_num;
+        if (read_block_pointer(fs, inode->i_block[EXT2_TIND_BLOCK], dindirect_index,
+                               &dindirect_block_num) != 0) {
+            return -1;
         }
-        
-        /* Get indirect block number */
-        uint32_t indirect_index = file_block / ptrs_per_block;
-        uint32_t indirect_block_num = dindirect_buffer[indirect_index];
-        kfree(dindirect_buffer);
-        
-        if (indirect_block_num == 0) {
+        if (dindirect_block_num == 0) {
             return 0;
         }
         
-        /* Read indirect block */
-        indirect_buffer = (uint32_t *)kmalloc(fs->block_size);
-        if (!indirect_buffer) {
-            set_errno(THUNDEROS_ENOMEM);
-            return 0;
+        uint32_t indirect_index = (file_block / ptrs_per_block) % ptrs_per_block;
+        return read_block_pointer(fs, dindirect_block_num, indirect_index, block_num);
+    }
+    
+    /* Past what the block map can reach (ext2_read_file() stops at max_file_size) */
+    RETURN_ERRNO(THUNDEROS_EFBIG);
+}
+
+/**
+ * Length of the run starting at pointers[index]: it goes on while the
+ * following entries continue it on disk, or are holes after a hole
+ */
+static uint32_t pointer_run(const uint32_t *pointers, uint32_t index, uint32_t count) {
+    uint32_t first = pointers[index];
+    uint32_t run = 1;
+    while (index + run < count && pointers[index + run] == (first ? first + run : 0)) {
+        run++;
+    }
+    return run;
+}
+
+/**
+ * Look a file block up in an inode's block map, leaving the run it starts in *map
+ * Returns 0 on success, -1 on error (errno set)
+ */
+static int map_block_pointers(ext2_fs_t *fs, ext2_inode_t *inode, ext2_map_cache_t *map,
+                              uint32_t file_block) {
+    map->file_block = file_block;
+    
+    /* Direct blocks */
+    if (file_block < EXT2_NDIR_BLOCKS) {
+        uint32_t pointers[EXT2_NDIR_BLOCKS];
+        kmemcpy(pointers, inode->i_block, sizeof(pointers));
+        map->disk_block = pointers[file_block];
+        map->count = pointer_run(pointers, file_block, EXT2_NDIR_BLOCKS);
+        return 0;
+    }
+    
+    /* The stretch of the file one indirect block maps */
+    uint32_t ptrs_per_block = fs->block_size / sizeof(uint32_t);
+    uint32_t first = file_block - (file_block - EXT2_NDIR_BLOCKS) % ptrs_per_block;
+    uint32_t indirect = 0;
+    for (uint32_t i = 0; i < EXT2_MAP_CACHE_INDIRECT; i++) {
+        if (map->indirect[i].block != 0 && map->indirect[i].file_block == first) {
+            indirect = map->indirect[i].block;
+            break;
         }
-        
-        if (read_block(fs->device, indirect_block_num, 
-                      indirect_buffer, fs->block_size) != 0) {
-            kfree(indirect_buffer);
-            /* errno already set by read_block */
+    }
+    
+    if (indirect == 0) {
+        if (get_indirect_block(fs, inode, file_block, &indirect) != 0) {
+            map->count = 0;
+            /* errno already set by get_indirect_block */
+            return -1;
+        }
+        if (indirect == 0) {
+            /* No indirect block: its whole stretch is a hole */
+            map->disk_block = 0;
+            map->count = first + ptrs_per_block - file_block;
             return 0;
         }
-        
-        /* Get data block number */
-        uint32_t data_index = file_block % ptrs_per_block;
-        block_num = indirect_buffer[data_index];
-        kfree(indirect_buffer);
-        return block_num;
+        ext2_map_indirect_t *slot = &map->indirect[map->next_indirect];
+        map->next_indirect = (map->next_indirect + 1) % EXT2_MAP_CACHE_INDIRECT;
+        slot->file_block = first;
+        slot->block = indirect;
+    }
+    
+    buf_t *b = bread(fs->device, indirect, fs->block_size);
+    if (!b) {
+        map->count = 0;
+        /* errno already set by bread */
+        return -1;
+    }
+    const uint32_t *pointers = (const uint32_t *)b->data;
+    map->disk_block = pointers[file_block - first];
+    map->count = pointer_run(pointers, file_block - first, ptrs_per_block);
+    brelse(b);
+    return 0;
+}
+
+/**
+ * Forget everything a map cache holds
+ */
+void ext2_map_cache_reset(ext2_map_cache_t *map) {
+    kmemset(map, 0, sizeof(*map));
+}
+
+/**
+ * Map a file block to its disk block (0 for a hole)
+ *
+ * A block inside the run in *map is mapped from it. Otherwise the extent
+ * tree or block map is looked up and the run found there (an extent, a
+ * stretch of consecutive pointers, or a hole) is left in *map.
+ * Returns 0 on success, -1 on error (errno set)
+ */
+int ext2_map_block(ext2_fs_t *fs, ext2_inode_t *inode, ext2_map_cache_t *map,
+                   uint32_t file_block, uint32_t *block_num) {
+    if (map->count == 0 || file_block - map->file_block >= map->count) {
+        int ret = (inode->i_flags & EXT4_EXTENTS_FL)
+                  ? ext2_extent_map(fs, inode, file_block, map, NULL)
+                  : map_block_pointers(fs, inode, map, file_block);
+        if (ret != 0) {
+            map->count = 0;
+            /* errno already set by the lookup */
+            return -1;
+        }
     }
     
-    /* Triple-indirect block - not implemented for now */
-    /* Most files won't need this (would need to be > 4GB on 1KB blocks) */
-    hal_uart_puts("ext2: Triple-indirect blocks not yet supported\n");
-    set_errno(THUNDEROS_EFBIG);
+    *block_num = map->disk_block ? map->disk_block + (file_block - map->file_block) : 0;
     return 0;
 }
 
+/**
+ * Bring a range of a file's blocks into the block cache, merging
+ * physically consecutive blocks into single device requests
+ *
+ * Best effort: anything not read here is read by bread() when copied.
+ */
+static void prefetch_blocks(ext2_fs_t *fs, ext2_inode_t *inode, ext2_map_cache_t *map,
+                            uint32_t first, uint32_t last) {
+    uint32_t run_start = 0;
+    uint32_t run_len = 0;
+
+    for (uint32_t file_block = first; file_block <= last; file_block++) {
+        uint32_t block_num;
+        if (ext2_map_block(fs, inode, map, file_block, &block_num) != 0) {
+            break;
+        }
+        if (run_len > 0 && block_num == run_start + run_len) {
+            run_len++;
+            continue;
+        }
+        if (run_len > 0) {
+            bread_ahead(fs->device, run_start, run_len, fs->block_size);
+        }
+        run_start = block_num;
+        run_len = block_num ? 1 : 0;
+    }
+    if (run_len > 0) {
+        bread_ahead(fs->device, run_start, run_len, fs->block_size);
+    }
+    clear_errno();
+}
+
+/**
+ * Size of an inode's file in bytes
+ *
+ * Directories keep their ACL block in the word regular files use for
+ * the top of their size.
+ */
+uint64_t ext2_inode_size(const ext2_inode_t *inode) {
+    if ((inode->i_mode & EXT2_S_IFMT) != EXT2_S_IFREG) {
+        return inode->i_size;
+    }
+    return ((uint64_t)inode->i_size_high << 32) | inode->i_size;
+}
+
 /**
  * Read data from a file
  */
-int ext2_read_file(ext2_fs_t *fs, ext2_inode_t *inode, uint32_t offset, 
-                   void *buffer, uint32_t size) {
+int ext2_read_file(ext2_fs_t *fs, ext2_inode_t *inode, ext2_map_cache_t *map,
+                   uint64_t offset, void *buffer, uint32_t size) {
     if (!fs || !inode || !buffer) {
         hal_uart_puts("ext2: Invalid parameters to ext2_read_file\n");
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
     
+    /* Without a cache from the caller, runs are still reused within this read */
+    ext2_map_cache_t local;
+    if (!map) {
+        ext2_map_cache_reset(&local);
+        map = &local;
+    }
+    
     /* Check if offset is beyond file size */
-    if (offset >= inode->i_size) {
+    uint64_t file_size = ext2_inode_size(inode);
+    if (offset >= file_size || size == 0) {
         clear_errno();
         return 0;
     }
     
     /* Adjust size if it would read past end of file */
-    if (offset + size > inode->i_size) {
-        size = inode->i_size - offset;
+    if (size > file_size - offset) {
+        size = (uint32_t)(file_size - offset);
     }
     
     uint8_t *dest = (uint8_t *)buffer;
     uint32_t bytes_read = 0;
-    
-    /* Allocate temporary buffer for block reads */
-    uint8_t *block_buffer = (uint8_t *)kmalloc(fs->block_size);
-    if (!block_buffer) {
-        hal_uart_puts("ext2: Failed to allocate block buffer\n");
-        RETURN_ERRNO(THUNDEROS_ENOMEM);
-    }
+    uint32_t last_block = (uint32_t)((offset + size - 1) / fs->block_size);
+    uint32_t prefetched = 0;    /* Blocks before this are already fetched */
     
     while (bytes_read < size) {
         /* Calculate which file block we need */
-        uint32_t file_block = (offset + bytes_read) / fs->block_size;
-        uint32_t block_offset = (offset + bytes_read) % fs->block_size;
+        uint32_t file_block = (uint32_t)((offset + bytes_read) / fs->block_size);
+        uint32_t block_offset = (uint32_t)((offset + bytes_read) % fs->block_size);
+        
+        /* Fetch the next stretch of the range in as few requests as possible */
+        if (file_block >= prefetched) {
+            uint32_t end = file_block + BCACHE_MAX_MERGE - 1;
+            if (end > last_block) {
+                end = last_block;
+            }
+            prefetch_blocks(fs, inode, map, file_block, end);
+            prefetched = end + 1;
+        }
         
         /* Get the actual block number on disk */
-        uint32_t block_num = get_block_number(fs, inode, file_block);
+        uint32_t block_num;
+        if (ext2_map_block(fs, inode, map, file_block, &block_num) != 0) {
+            /* errno already set by ext2_map_block */
+            return -1;
+        }
         if (block_num == 0) {
             /* Sparse file - zero block */
             uint32_t to_copy = fs->block_size - block_offset;
             if (to_copy > size - bytes_read) {
                 to_copy = size - bytes_read;
             }
-            for (uint32_t i = 0; i < to_copy; i++) {
-                dest[bytes_read + i] = 0;
-            }
+            kmemset(dest + bytes_read, 0, to_copy);
             bytes_read += to_copy;
             continue;
         }
         
         /* Read the block */
-        if (read_block(fs->device, block_num, block_buffer, fs->block_size) != 0) {
+        buf_t *b = bread(fs->device, block_num, fs->block_size);
+        if (!b) {
             hal_uart_puts("ext2: Failed to read data block ");
             hal_uart_put_uint32(block_num);
             hal_uart_puts("\n");
-            kfree(block_buffer);
-            /* errno already set by read_block */
+            /* errno already set by bread */
             return -1;
         }
         
@@ -201,14 +316,12 @@ int ext2_read_file(ext2_fs_t *fs, ext2_inode_t *inode, uint32_t offset,
             to_copy = size - bytes_read;
         }
         
-        for (uint32_t i = 0; i < to_copy; i++) {
-            dest[bytes_read + i] = block_buffer[block_offset + i];
-        }
+        kmemcpy(dest + bytes_read, b->data + block_offset, to_copy);
+        brelse(b);
         
         bytes_read += to_copy;
     }
     
-    kfree(block_buffer);
     clear_errno();
     return bytes_read;
 }
@@ -3,67 +3,19 @@
  */
 
 #include "../include/fs/ext2.h"
-#include "../include/drivers/virtio_blk.h"
-#include "../include/mm/kmalloc.h"
+#include "../include/fs/ext2_journal.h"
+#include "../include/fs/bcache.h"
 #include "../include/hal/hal_uart.h"
 #include "../include/kernel/errno.h"
 #include "../include/kernel/constants.h"
+#include "../include/kernel/kstring.h"
 #include <stddef.h>
 
 /**
- * Read a block from the block device
+ * Find the inode-table block holding an inode, and the inode's offset in it
  */
-static int read_block(void *device, uint32_t block_num, void *buffer, uint32_t block_size) {
-    (void)device;  /* Device parameter unused - we use global device */
-    
-    /* Calculate sector number (sectors are SECTOR_SIZE bytes) */
-    uint32_t sector = (block_num * block_size) / SECTOR_SIZE;
-    uint32_t num_sectors = block_size / SECTOR_SIZE;
-    
-    /* Read sectors */
-    for (uint32_t i = 0; i < num_sectors; i++) {
-        int ret = virtio_blk_read(sector + i, 
-                                  (uint8_t *)buffer + ((size_t)i * SECTOR_SIZE), 1);
-        if (ret != 1) {
-            set_errno(THUNDEROS_EIO);
-            return -1;
-        }
-    }
-    
-    clear_errno();
-    return 0;
-}
-
-/**
- * Write a block to the block device
- */
-static int write_block(void *device, uint32_t block_num, const void *buffer, uint32_t block_size) {
-    (void)device;
-    
-    uint32_t sector = (block_num * block_size) / SECTOR_SIZE;
-    uint32_t num_sectors = block_size / SECTOR_SIZE;
-    
-    for (uint32_t i = 0; i < num_sectors; i++) {
-        int ret = virtio_blk_write(sector + i, (const uint8_t *)buffer + ((size_t)i * SECTOR_SIZE), 1);
-        if (ret != 1) {
-            set_errno(THUNDEROS_EIO);
-            return -1;
-        }
-    }
-    
-    clear_errno();
-    return 0;
-}
-
-/**
- * Read an inode from disk
- */
-int ext2_read_inode(ext2_fs_t *fs, uint32_t inode_num, ext2_inode_t *inode) {
-    if (!fs || !inode || inode_num == 0) {
-        hal_uart_puts("ext2: Invalid parameters to ext2_read_inode\n");
-        RETURN_ERRNO(THUNDEROS_EINVAL);
-    }
-    
+static int ext2_inode_location(ext2_fs_t *fs, uint32_t inode_num, uint32_t *block,
+                               uint32_t *offset) {
     if (inode_num > fs->superblock->s_inodes_count) {
         hal_uart_puts("ext2: Inode number ");
         hal_uart_put_uint32(inode_num);
@@ -91,39 +43,45 @@ int ext2_read_inode(ext2_fs_t *fs, uint32_t inode_num, ext2_inode_t *inode) {
     uint32_t inode_table_index = inode_index % fs->superblock->s_inodes_per_group;
     
     /* Calculate which block in the inode table contains this inode */
-    uint32_t inode_block = gd->bg_inode_table + (inode_table_index / fs->inodes_per_block);
+    *block = gd->bg_inode_table + (inode_table_index / fs->inodes_per_block);
     
     /* Calculate offset within the block */
     uint32_t inode_size = fs->superblock->s_inode_size > 0 ? 
                           fs->superblock->s_inode_size : EXT2_INODE_SIZE;
-    uint32_t block_offset = (inode_table_index % fs->inodes_per_block) * inode_size;
+    *offset = (inode_table_index % fs->inodes_per_block) * inode_size;
+    return 0;
+}
+
+/**
+ * Read an inode from disk
+ */
+int ext2_read_inode(ext2_fs_t *fs, uint32_t inode_num, ext2_inode_t *inode) {
+    if (!fs || !inode || inode_num == 0) {
+        hal_uart_puts("ext2: Invalid parameters to ext2_read_inode\n");
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
     
-    /* Allocate temporary buffer for the block */
-    uint8_t *block_buffer = (uint8_t *)kmalloc(fs->block_size);
-    if (!block_buffer) {
-        hal_uart_puts("ext2: Failed to allocate block buffer for inode\n");
-        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    uint32_t inode_block, block_offset;
+    if (ext2_inode_location(fs, inode_num, &inode_block, &block_offset) != 0) {
+        /* errno already set by ext2_inode_location */
+        return -1;
     }
     
-    /* Read the block containing the inode */
-    int ret = read_block(fs->device, inode_block, block_buffer, fs->block_size);
-    if (ret != 0) {
+    /* Read the block containing the inode (usually cached: it holds its
+     * neighbours too, and directory walks prefetch it) */
+    buf_t *b = bread(fs->device, inode_block, fs->block_size);
+    if (!b) {
         hal_uart_puts("ext2: Failed to read inode block ");
         hal_uart_put_uint32(inode_block);
         hal_uart_puts("\n");
-        kfree(block_buffer);
-        /* errno already set by read_block */
+        /* errno already set by bread */
         return -1;
     }
     
     /* Copy the inode data */
-    uint8_t *src = block_buffer + block_offset;
-    uint8_t *dst = (uint8_t *)inode;
-    for (uint32_t i = 0; i < sizeof(ext2_inode_t); i++) {
-        dst[i] = src[i];
-    }
+    kmemcpy(inode, b->data + block_offset, sizeof(ext2_inode_t));
     
-    kfree(block_buffer);
+    brelse(b);
     clear_errno();
     return 0;
 }
@@ -137,78 +95,75 @@ int ext2_write_inode(ext2_fs_t *fs, uint32_t inode_num, ext2_inode_t *inode) {
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
     
-    if (inode_num > fs->superblock->s_inodes_count) {
-        hal_uart_puts("ext2: Inode number ");
-        hal_uart_put_uint32(inode_num);
-        hal_uart_puts(" out of range\n");
-        RETURN_ERRNO(THUNDEROS_EFS_BADINO);
-    }
-    
-    /* Inodes are numbered starting from 1, so subtract 1 for index */
-    uint32_t inode_index = inode_num - 1;
-    
-    /* Determine which block group contains this inode */
-    uint32_t group = inode_index / fs->superblock->s_inodes_per_group;
-    
-    if (group >= fs->num_groups) {
-        hal_uart_puts("ext2: Block group ");
-        hal_uart_put_uint32(group);
-        hal_uart_puts(" out of range\n");
-        RETURN_ERRNO(THUNDEROS_EFS_BADINO);
-    }
-    
-    /* Get the group descriptor */
-    ext2_group_desc_t *gd = &fs->group_desc[group];
-    
-    /* Calculate inode index within the group */
-    uint32_t inode_table_index = inode_index % fs->superblock->s_inodes_per_group;
-    
-    /* Calculate which block in the inode table contains this inode */
-    uint32_t inode_block = gd->bg_inode_table + (inode_table_index / fs->inodes_per_block);
-    
-    /* Calculate offset within the block */
-    uint32_t inode_size = fs->superblock->s_inode_size > 0 ? 
-                          fs->superblock->s_inode_size : EXT2_INODE_SIZE;
-    uint32_t block_offset = (inode_table_index % fs->inodes_per_block) * inode_size;
-    
-    /* Allocate temporary buffer for the block */
-    uint8_t *block_buffer = (uint8_t *)kmalloc(fs->block_size);
-    if (!block_buffer) {
-        hal_uart_puts("ext2: Failed to allocate block buffer for inode write\n");
-        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    uint32_t inode_block, block_offset;
+    if (ext2_inode_location(fs, inode_num, &inode_block, &block_offset) != 0) {
+        /* errno already set by ext2_inode_location */
+        return -1;
     }
     
-    /* Read the block containing the inode first */
-    int ret = read_block(fs->device, inode_block, block_buffer, fs->block_size);
-    if (ret != 0) {
+    /* Get the block containing the inode, from the cache unless evicted */
+    buf_t *b = bread(fs->device, inode_block, fs->block_size);
+    if (!b) {
         hal_uart_puts("ext2: Failed to read inode block for write ");
         hal_uart_put_uint32(inode_block);
         hal_uart_puts("\n");
-        kfree(block_buffer);
-        /* errno already set by read_block */
+        /* errno already set by bread */
         return -1;
     }
     
-    /* Update the inode data in the buffer */
-    uint8_t *src = (uint8_t *)inode;
-    uint8_t *dst = block_buffer + block_offset;
-    for (uint32_t i = 0; i < sizeof(ext2_inode_t); i++) {
-        dst[i] = src[i];
+    /* Update the inode data in the buffer; it reaches disk on write-back */
+    kmemcpy(b->data + block_offset, inode, sizeof(ext2_inode_t));
+    ext2_journal_dirty(fs, b);
+    
+    brelse(b);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Bring the inode-table blocks holding some inodes into the block cache
+ *
+ * The blocks are sorted and read as runs, one device request per run;
+ * gaps of up to EXT2_INODE_PREFETCH_GAP blocks are read too rather than
+ * splitting a run. Best effort: a block not read here is read by bread()
+ * when the inode is.
+ */
+void ext2_prefetch_inodes(ext2_fs_t *fs, const uint32_t *inodes, uint32_t count) {
+    uint32_t blocks[EXT2_INODE_PREFETCH_MAX];
+    uint32_t n = 0;
+    
+    if (count > EXT2_INODE_PREFETCH_MAX) {
+        count = EXT2_INODE_PREFETCH_MAX;
     }
     
-    /* Write the block back to disk */
-    ret = write_block(fs->device, inode_block, block_buffer, fs->block_size);
-    if (ret != 0) {
-        hal_uart_puts("ext2: Failed to write inode block ");
-        hal_uart_put_uint32(inode_block);
-        hal_uart_puts("\n");
-        kfree(block_buffer);
-        /* errno already set by write_block */
-        return -1;
+    /* Sorted and without duplicates: neighbours share a block */
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t block, offset;
+        if (inodes[i] == 0 || ext2_inode_location(fs, inodes[i], &block, &offset) != 0) {
+            continue;
+        }
+        uint32_t j = n;
+        while (j > 0 && blocks[j - 1] > block) {
+            j--;
+        }
+        if (j > 0 && blocks[j - 1] == block) {
+            continue;
+        }
+        for (uint32_t k = n; k > j; k--) {
+            blocks[k] = blocks[k - 1];
+        }
+        blocks[j] = block;
+        n++;
     }
     
-    kfree(block_buffer);
+    uint32_t i = 0;
+    while (i < n) {
+        uint32_t first = blocks[i];
+        uint32_t last = first;
+        for (i++; i < n && blocks[i] - last <= EXT2_INODE_PREFETCH_GAP + 1; i++) {
+            last = blocks[i];
+        }
+        bread_ahead(fs->device, first, last - first + 1, fs->block_size);
+    }
     clear_errno();
-    return 0;
 }
-
@@ -0,0 +1,788 @@
+/*
+ * ext2_journal.c - ext3-style metadata journal
+ *
+ * The log is written forward from s_first only: a commit that leaves
+ * fewer than EXT2_JOURNAL_RESERVE blocks, or fills the set of logged
+ * blocks, is followed by a checkpoint (everything written home and
+ * flushed) after which the log is empty and starts over. Replay follows
+ * the JBD2 layout in full, wrapping included, so a log left by another
+ * implementation is read as well.
+ *
+ * Log blocks are transferred straight through the block request queue,
+ * not the block cache: nothing reads them back during normal operation.
+ */
+
+#include "../include/fs/ext2_journal.h"
+#include "../include/fs/ext2.h"
+#include "../include/fs/bcache.h"
+#include "../include/drivers/blk_queue.h"
+#include "../include/drivers/virtio_blk.h"
+#include "../include/mm/kmalloc.h"
+#include "../include/hal/hal_uart.h"
+#include "../include/kernel/errno.h"
+#include "../include/kernel/constants.h"
+#include "../include/kernel/kstring.h"
+#include <stddef.h>
+
+#define REVOKE_BUCKETS 64
+
+/**
+ * Journal of a mounted filesystem (fs->journal)
+ */
+struct ext2_journal {
+    ext2_inode_t inode;             /* The journal's inode */
+    ext2_map_cache_t map;           /* Log block lookups */
+    uint32_t first;                 /* First log block */
+    uint32_t last;                  /* One past the last log block */
+    uint32_t head;                  /* Next log block to write */
+    int live;                       /* Nonzero once the log holds a commit */
+    uint32_t tid;                   /* Running transaction's sequence number */
+    uint8_t *sb;                    /* Journal superblock block */
+    uint8_t *desc;                  /* Descriptor block being built */
+    uint8_t *revoke;                /* Revoke block being built */
+    uint8_t *commit;                /* Commit block */
+    buf_t *bufs[EXT2_JOURNAL_MAX_BUFFERS];      /* Held by the running transaction */
+    uint8_t *copies[EXT2_JOURNAL_MAX_BUFFERS];  /* Escaped copy (NULL: log the buffer) */
+    uint32_t nbufs;
+    uint32_t revokes[EXT2_JOURNAL_MAX_REVOKES]; /* Freed by the running transaction */
+    uint32_t nrevokes;
+    uint32_t logged[EXT2_JOURNAL_LOGGED];       /* Home blocks in the log, plus one (0: free) */
+    uint32_t nlogged;
+    blk_io_t io[EXT2_JOURNAL_RESERVE + 1];      /* One commit's writes */
+};
+
+typedef struct ext2_journal ext2_journal_t;
+
+/**
+ * Block revoked during replay, by the newest transaction revoking it
+ */
+typedef struct revoke_entry {
+    uint32_t block;
+    uint32_t tid;
+    struct revoke_entry *next;
+} revoke_entry_t;
+
+/* Replay passes over the log */
+enum { PASS_SCAN, PASS_REVOKE, PASS_REPLAY };
+
+/* The journal is big-endian */
+
+static inline uint32_t jbd2_get32(const void *p) {
+    const uint8_t *b = (const uint8_t *)p;
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+static inline void jbd2_put32(void *p, uint32_t value) {
+    uint8_t *b = (uint8_t *)p;
+    b[0] = (uint8_t)(value >> 24);
+    b[1] = (uint8_t)(value >> 16);
+    b[2] = (uint8_t)(value >> 8);
+    b[3] = (uint8_t)value;
+}
+
+static inline uint16_t jbd2_get16(const void *p) {
+    const uint8_t *b = (const uint8_t *)p;
+    return (uint16_t)((b[0] << 8) | b[1]);
+}
+
+static inline void jbd2_put16(void *p, uint16_t value) {
+    uint8_t *b = (uint8_t *)p;
+    b[0] = (uint8_t)(value >> 8);
+    b[1] = (uint8_t)value;
+}
+
+/**
+ * Start a log metadata block
+ */
+static void jbd2_header(uint8_t *block, uint32_t size, uint32_t type, uint32_t tid) {
+    jbd2_header_t *h = (jbd2_header_t *)block;
+    kmemset(block, 0, size);
+    jbd2_put32(&h->h_magic, JBD2_MAGIC_NUMBER);
+    jbd2_put32(&h->h_blocktype, type);
+    jbd2_put32(&h->h_sequence, tid);
+}
+
+/**
+ * Log block after pos, wrapping to the first
+ */
+static uint32_t journal_next(ext2_journal_t *j, uint32_t pos) {
+    return pos + 1 >= j->last ? j->first : pos + 1;
+}
+
+/**
+ * Device sector of a journal block
+ */
+static int journal_sector(ext2_fs_t *fs, ext2_journal_t *j, uint32_t log_block,
+                          uint64_t *sector) {
+    uint32_t block;
+    if (log_block >= j->last ||
+        ext2_map_block(fs, &j->inode, &j->map, log_block, &block) != 0 || block == 0) {
+        RETURN_ERRNO(THUNDEROS_EFS_CORRUPT);
+    }
+    *sector = ((uint64_t)block * fs->block_size) / SECTOR_SIZE;
+    return 0;
+}
+
+/**
+ * Read or write one journal block and wait for it
+ */
+static int journal_io(ext2_fs_t *fs, ext2_journal_t *j, uint32_t log_block,
+                      void *buf, int write) {
+    uint64_t sector;
+    if (journal_sector(fs, j, log_block, &sector) != 0) {
+        /* errno already set by journal_sector */
+        return -1;
+    }
+
+    blk_batch_t batch;
+    blk_io_t io;
+    blk_batch_init(&batch);
+    blk_io_init(&io, sector, buf, fs->block_size, write, NULL, NULL);
+    blk_submit(&io, &batch);
+    if (blk_batch_wait(&batch) != 0) {
+        RETURN_ERRNO(THUNDEROS_EIO);
+    }
+    return 0;
+}
+
+/**
+ * Write the journal superblock, recording where the log starts
+ */
+static int journal_write_sb(ext2_fs_t *fs, ext2_journal_t *j, uint32_t start) {
+    jbd2_superblock_t *jsb = (jbd2_superblock_t *)j->sb;
+    jbd2_put32(&jsb->s_start, start);
+    jbd2_put32(&jsb->s_sequence, j->tid);
+    return journal_io(fs, j, 0, j->sb, 1);
+}
+
+static void journal_free(ext2_journal_t *j) {
+    kfree(j->sb);
+    kfree(j->desc);
+    kfree(j->revoke);
+    kfree(j->commit);
+    kfree(j);
+}
+
+/* Set of home blocks the log holds copies of, for ext2_journal_revoke() */
+
+static uint32_t logged_slot(uint32_t block) {
+    return (block * 2654435761u) % EXT2_JOURNAL_LOGGED;
+}
+
+static int logged_contains(ext2_journal_t *j, uint32_t block) {
+    for (uint32_t i = logged_slot(block); j->logged[i]; i = (i + 1) % EXT2_JOURNAL_LOGGED) {
+        if (j->logged[i] == block + 1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void logged_add(ext2_journal_t *j, uint32_t block) {
+    uint32_t i = logged_slot(block);
+    while (j->logged[i]) {
+        if (j->logged[i] == block + 1) {
+            return;
+        }
+        i = (i + 1) % EXT2_JOURNAL_LOGGED;
+    }
+    j->logged[i] = block + 1;
+    j->nlogged++;
+}
+
+/**
+ * Write everything home and empty the log
+ *
+ * Runs between transactions, when nothing is held: afterwards no
+ * committed change exists only in the log.
+ */
+static int journal_checkpoint(ext2_fs_t *fs, ext2_journal_t *j) {
+    if (bcache_sync() != 0 || virtio_blk_flush() != 0) {
+        set_errno(THUNDEROS_EIO);
+        return -1;
+    }
+    if (j->live && journal_write_sb(fs, j, 0) != 0) {
+        /* errno already set by journal_write_sb */
+        return -1;
+    }
+    j->head = j->first;
+    j->live = 0;
+    kmemset(j->logged, 0, sizeof(j->logged));
+    j->nlogged = 0;
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Whether the running transaction holds a buffer for a block
+ */
+static int journal_holds(ext2_journal_t *j, uint32_t block) {
+    for (uint32_t i = 0; i < j->nbufs; i++) {
+        if (j->bufs[i]->block == block) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Commit the running transaction
+ */
+int ext2_journal_commit(ext2_fs_t *fs) {
+    ext2_journal_t *j = fs ? fs->journal : NULL;
+    if (!j || (j->nbufs == 0 && j->nrevokes == 0)) {
+        clear_errno();
+        return 0;
+    }
+
+    /* Normally done right after the commit that used the room up */
+    if ((j->last - j->head < EXT2_JOURNAL_RESERVE ||
+         j->nlogged + EXT2_JOURNAL_MAX_BUFFERS > EXT2_JOURNAL_LOGGED / 2) &&
+        journal_checkpoint(fs, j) != 0) {
+        /* errno already set by journal_checkpoint */
+        return -1;
+    }
+
+    /* Ordered mode: file data, and what earlier commits left, land first */
+    if (bcache_sync() != 0) {
+        /* errno already set by bcache_sync */
+        return -1;
+    }
+
+    blk_batch_t batch;
+    blk_plug_t plug;
+    blk_batch_init(&batch);
+    blk_plug_init(&plug);
+    uint32_t pos = j->head;
+    uint32_t ios = 0;
+    int result = 0;
+    uint64_t sector;
+
+    /* The first commit after a checkpoint is where replay starts */
+    if (!j->live) {
+        jbd2_superblock_t *jsb = (jbd2_superblock_t *)j->sb;
+        jbd2_put32(&jsb->s_start, j->head);
+        jbd2_put32(&jsb->s_sequence, j->tid);
+        if (journal_sector(fs, j, 0, &sector) != 0) {
+            result = -1;
+        } else {
+            blk_io_init(&j->io[ios], sector, j->sb, fs->block_size, 1, NULL, NULL);
+            blk_plug_add(&plug, &j->io[ios++], &batch);
+        }
+    }
+
+    /* Descriptor, then the copies in the order it lists them */
+    if (j->nbufs > 0 && result == 0) {
+        jbd2_header(j->desc, fs->block_size, JBD2_DESCRIPTOR_BLOCK, j->tid);
+        uint32_t offset = sizeof(jbd2_header_t);
+        for (uint32_t i = 0; i < j->nbufs; i++) {
+            buf_t *b = j->bufs[i];
+            uint16_t flags = i > 0 ? JBD2_FLAG_SAME_UUID : 0;
+            if (i == j->nbufs - 1) {
+                flags |= JBD2_FLAG_LAST_TAG;
+            }
+
+            /* A block that looks like a log block is logged with the magic zeroed */
+            j->copies[i] = NULL;
+            if (jbd2_get32(b->data) == JBD2_MAGIC_NUMBER) {
+                j->copies[i] = (uint8_t *)kmalloc(fs->block_size);
+                if (!j->copies[i]) {
+                    set_errno(THUNDEROS_ENOMEM);
+                    result = -1;
+                    break;
+                }
+                kmemcpy(j->copies[i], b->data, fs->block_size);
+                jbd2_put32(j->copies[i], 0);
+                flags |= JBD2_FLAG_ESCAPE;
+            }
+
+            jbd2_tag_t *tag = (jbd2_tag_t *)(j->desc + offset);
+            jbd2_put32(&tag->t_blocknr, b->block);
+            jbd2_put16(&tag->t_flags, flags);
+            offset += sizeof(jbd2_tag_t);
+            if (i == 0) {
+                kmemcpy(j->desc + offset, ((jbd2_superblock_t *)j->sb)->s_uuid, 16);
+                offset += 16;
+            }
+        }
+
+        uint8_t *block = j->desc;
+        for (uint32_t i = 0; i <= j->nbufs && result == 0; i++) {
+            if (journal_sector(fs, j, pos++, &sector) != 0) {
+                result = -1;
+                break;
+            }
+            blk_io_init(&j->io[ios], sector, block, fs->block_size, 1, NULL, NULL);
+            blk_plug_add(&plug, &j->io[ios++], &batch);
+            if (i < j->nbufs) {
+                block = j->copies[i] ? j->copies[i] : j->bufs[i]->data;
+            }
+        }
+    }
+
+    if (j->nrevokes > 0 && result == 0) {
+        jbd2_header(j->revoke, fs->block_size, JBD2_REVOKE_BLOCK, j->tid);
+        jbd2_revoke_header_t *rh = (jbd2_revoke_header_t *)j->revoke;
+        uint32_t *blocks = (uint32_t *)(rh + 1);
+        for (uint32_t i = 0; i < j->nrevokes; i++) {
+            jbd2_put32(&blocks[i], j->revokes[i]);
+        }
+        jbd2_put32(&rh->r_count, sizeof(*rh) + j->nrevokes * sizeof(uint32_t));
+        if (journal_sector(fs, j, pos++, &sector) != 0) {
+            result = -1;
+        } else {
+            blk_io_init(&j->io[ios], sector, j->revoke, fs->block_size, 1, NULL, NULL);
+            blk_plug_add(&plug, &j->io[ios++], &batch);
+        }
+    }
+
+    /* Consecutive log blocks leave as a few large requests */
+    blk_unplug(&plug);
+    if (ios > 0 && blk_batch_wait(&batch) != 0) {
+        set_errno(THUNDEROS_EIO);
+        result = -1;
+    }
+    for (uint32_t i = 0; i < j->nbufs; i++) {
+        kfree(j->copies[i]);
+        j->copies[i] = NULL;
+    }
+
+    /* The transaction counts once its commit block is on disk, after the rest */
+    if (result == 0 && virtio_blk_flush() != 0) {
+        set_errno(THUNDEROS_EIO);
+        result = -1;
+    }
+    if (result == 0) {
+        jbd2_header(j->commit, fs->block_size, JBD2_COMMIT_BLOCK, j->tid);
+        if (journal_io(fs, j, pos++, j->commit, 1) != 0 || virtio_blk_flush() != 0) {
+            set_errno(THUNDEROS_EIO);
+            result = -1;
+        }
+    }
+    if (result != 0) {
+        hal_uart_puts("ext2: Journal commit failed\n");
+        /* errno already set above */
+        return -1;
+    }
+
+    /* Committed: the buffers reach their home locations with write-back */
+    for (uint32_t i = 0; i < j->nbufs; i++) {
+        logged_add(j, j->bufs[i]->block);
+        bunhold(j->bufs[i]);
+    }
+    j->nbufs = 0;
+    j->nrevokes = 0;
+    j->head = pos;
+    j->live = 1;
+    j->tid++;
+
+    if (j->last - j->head < EXT2_JOURNAL_RESERVE ||
+        j->nlogged + EXT2_JOURNAL_MAX_BUFFERS > EXT2_JOURNAL_LOGGED / 2) {
+        /* Best effort: retried before the next commit */
+        journal_checkpoint(fs, j);
+    }
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Add a modified metadata buffer to the running transaction
+ */
+void ext2_journal_dirty(ext2_fs_t *fs, buf_t *b) {
+    ext2_journal_t *j = fs->journal;
+    if (!j) {
+        bwrite(b);
+        return;
+    }
+    if (b->flags & BUF_HELD) {
+        return;         /* Already in the transaction */
+    }
+    if (j->nbufs == EXT2_JOURNAL_MAX_BUFFERS && ext2_journal_commit(fs) != 0) {
+        /* Nowhere to log it: written in place, as without a journal */
+        bwrite(b);
+        return;
+    }
+
+    /* Logged again after being freed: the copy is current, keep it */
+    for (uint32_t i = 0; i < j->nrevokes; i++) {
+        if (j->revokes[i] == b->block) {
+            j->revokes[i] = j->revokes[--j->nrevokes];
+            break;
+        }
+    }
+
+    bhold(b);
+    j->bufs[j->nbufs++] = b;
+}
+
+/**
+ * Note that a block was freed
+ */
+void ext2_journal_revoke(ext2_fs_t *fs, uint32_t block) {
+    ext2_journal_t *j = fs->journal;
+    if (!j || (!logged_contains(j, block) && !journal_holds(j, block))) {
+        return;
+    }
+    for (uint32_t i = 0; i < j->nrevokes; i++) {
+        if (j->revokes[i] == block) {
+            return;
+        }
+    }
+    if (j->nrevokes == EXT2_JOURNAL_MAX_REVOKES && ext2_journal_commit(fs) != 0) {
+        hal_uart_puts("ext2: Cannot revoke block ");
+        hal_uart_put_uint32(block);
+        hal_uart_puts("\n");
+        return;
+    }
+    j->revokes[j->nrevokes++] = block;
+}
+
+/**
+ * End an operation's part of the running transaction
+ */
+int ext2_journal_end_op(ext2_fs_t *fs) {
+    ext2_journal_t *j = fs->journal;
+    if (j && (j->nbufs * 2 >= EXT2_JOURNAL_MAX_BUFFERS ||
+              j->nrevokes * 2 >= EXT2_JOURNAL_MAX_REVOKES)) {
+        return ext2_journal_commit(fs);
+    }
+    clear_errno();
+    return 0;
+}
+
+/* Replay */
+
+static revoke_entry_t *revoke_find(revoke_entry_t **table, uint32_t block) {
+    for (revoke_entry_t *e = table[block % REVOKE_BUCKETS]; e; e = e->next) {
+        if (e->block == block) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static int revoke_record(revoke_entry_t **table, uint32_t block, uint32_t tid) {
+    revoke_entry_t *e = revoke_find(table, block);
+    if (e) {
+        if (tid > e->tid) {
+            e->tid = tid;
+        }
+        return 0;
+    }
+    e = (revoke_entry_t *)kmalloc(sizeof(revoke_entry_t));
+    if (!e) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    e->block = block;
+    e->tid = tid;
+    e->next = table[block % REVOKE_BUCKETS];
+    table[block % REVOKE_BUCKETS] = e;
+    return 0;
+}
+
+static void revoke_clear(revoke_entry_t **table) {
+    for (int i = 0; i < REVOKE_BUCKETS; i++) {
+        while (table[i]) {
+            revoke_entry_t *next = table[i]->next;
+            kfree(table[i]);
+            table[i] = next;
+        }
+    }
+}
+
+/**
+ * Copy one logged block to its home location
+ */
+static int journal_replay_block(ext2_fs_t *fs, ext2_journal_t *j, uint32_t pos,
+                                 uint32_t home, uint16_t flags, uint8_t *data) {
+    if (home >= fs->superblock->s_blocks_count) {
+        RETURN_ERRNO(THUNDEROS_EFS_CORRUPT);
+    }
+    if (journal_io(fs, j, pos, data, 0) != 0) {
+        /* errno already set by journal_io */
+        return -1;
+    }
+    if (flags & JBD2_FLAG_ESCAPE) {
+        jbd2_put32(data, JBD2_MAGIC_NUMBER);
+    }
+
+    buf_t *b = bget(fs->device, home, fs->block_size);
+    if (!b) {
+        /* errno already set by bget */
+        return -1;
+    }
+    kmemcpy(b->data, data, fs->block_size);
+    bwrite(b);
+    brelse(b);
+    return 0;
+}
+
+/**
+ * Walk the log from s_start
+ *
+ * PASS_SCAN finds the first transaction without a commit block (*end);
+ * the other passes stop there. PASS_REVOKE collects revoked blocks and
+ * PASS_REPLAY copies home every logged block not revoked by its own or
+ * a later transaction.
+ */
+static int journal_pass(ext2_fs_t *fs, ext2_journal_t *j, int pass, uint32_t *end,
+                        revoke_entry_t **revoked, uint8_t *block, uint8_t *data) {
+    jbd2_superblock_t *jsb = (jbd2_superblock_t *)j->sb;
+    uint32_t pos = jbd2_get32(&jsb->s_start);
+    uint32_t tid = jbd2_get32(&jsb->s_sequence);
+
+    while (pass == PASS_SCAN || tid != *end) {
+        if (journal_io(fs, j, pos, block, 0) != 0) {
+            /* errno already set by journal_io */
+            return -1;
+        }
+        jbd2_header_t *h = (jbd2_header_t *)block;
+        if (jbd2_get32(&h->h_magic) != JBD2_MAGIC_NUMBER ||
+            jbd2_get32(&h->h_sequence) != tid) {
+            break;      /* Past the last transaction written */
+        }
+        pos = journal_next(j, pos);
+
+        uint32_t type = jbd2_get32(&h->h_blocktype);
+        if (type == JBD2_DESCRIPTOR_BLOCK) {
+            uint32_t offset = sizeof(jbd2_header_t);
+            while (offset + sizeof(jbd2_tag_t) <= fs->block_size) {
+                jbd2_tag_t *tag = (jbd2_tag_t *)(block + offset);
+                uint32_t home = jbd2_get32(&tag->t_blocknr);
+                uint16_t flags = jbd2_get16(&tag->t_flags);
+                offset += sizeof(jbd2_tag_t);
+                if (!(flags & JBD2_FLAG_SAME_UUID)) {
+                    offset += 16;
+                }
+                if (pass == PASS_REPLAY) {
+                    revoke_entry_t *e = revoke_find(revoked, home);
+                    if ((!e || e->tid < tid) &&
+                        journal_replay_block(fs, j, pos, home, flags, data) != 0) {
+                        /* errno already set by journal_replay_block */
+                        return -1;
+                    }
+                }
+                pos = journal_next(j, pos);
+                if (flags & JBD2_FLAG_LAST_TAG) {
+                    break;
+                }
+            }
+        } else if (type == JBD2_COMMIT_BLOCK) {
+            tid++;
+        } else if (type == JBD2_REVOKE_BLOCK) {
+            if (pass != PASS_REVOKE) {
+                continue;
+            }
+            jbd2_revoke_header_t *rh = (jbd2_revoke_header_t *)block;
+            uint32_t count = jbd2_get32(&rh->r_count);
+            if (count > fs->block_size) {
+                RETURN_ERRNO(THUNDEROS_EFS_CORRUPT);
+            }
+            for (uint32_t offset = sizeof(*rh); offset + sizeof(uint32_t) <= count;
+                 offset += sizeof(uint32_t)) {
+                if (revoke_record(revoked, jbd2_get32(block + offset), tid) != 0) {
+                    /* errno already set by revoke_record */
+                    return -1;
+                }
+            }
+        } else {
+            break;
+        }
+    }
+
+    if (pass == PASS_SCAN) {
+        *end = tid;
+    }
+    return 0;
+}
+
+/**
+ * Replay every committed transaction in the log
+ */
+static int journal_recover(ext2_fs_t *fs, ext2_journal_t *j) {
+    uint8_t *block = (uint8_t *)kmalloc(fs->block_size);
+    uint8_t *data = (uint8_t *)kmalloc(fs->block_size);
+    revoke_entry_t *revoked[REVOKE_BUCKETS];
+    kmemset(revoked, 0, sizeof(revoked));
+    uint32_t end = 0;
+
+    int result = -1;
+    if (!block || !data) {
+        set_errno(THUNDEROS_ENOMEM);
+    } else if (journal_pass(fs, j, PASS_SCAN, &end, revoked, block, data) == 0 &&
+               journal_pass(fs, j, PASS_REVOKE, &end, revoked, block, data) == 0 &&
+               journal_pass(fs, j, PASS_REPLAY, &end, revoked, block, data) == 0) {
+        result = bcache_sync();
+        if (result == 0 && virtio_blk_flush() != 0) {
+            set_errno(THUNDEROS_EIO);
+            result = -1;
+        }
+    }
+    revoke_clear(revoked);
+    kfree(block);
+    kfree(data);
+    if (result != 0) {
+        /* errno already set by the pass that failed */
+        return -1;
+    }
+
+    hal_uart_puts("ext2: Journal replayed ");
+    hal_uart_put_uint32(end - jbd2_get32(&((jbd2_superblock_t *)j->sb)->s_sequence));
+    hal_uart_puts(" transactions\n");
+    j->tid = end;
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Replay the journal if needed and start journaling metadata
+ */
+int ext2_journal_load(ext2_fs_t *fs) {
+    ext2_superblock_t *es = fs->superblock;
+    int recover = (es->s_feature_incompat & EXT3_FEATURE_INCOMPAT_RECOVER) != 0;
+    fs->journal = NULL;
+
+    if (es->s_rev_level < EXT2_DYNAMIC_REV ||
+        !(es->s_feature_compat & EXT3_FEATURE_COMPAT_HAS_JOURNAL)) {
+        clear_errno();
+        return 0;
+    }
+    if (es->s_journal_inum == 0) {
+        hal_uart_puts("ext2: External journals are not supported\n");
+        if (recover) {
+            RETURN_ERRNO(THUNDEROS_EFS_INVAL);
+        }
+        clear_errno();
+        return 0;
+    }
+
+    ext2_journal_t *j = (ext2_journal_t *)kmalloc(sizeof(ext2_journal_t));
+    if (!j) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    kmemset(j, 0, sizeof(ext2_journal_t));
+    j->sb = (uint8_t *)kmalloc(fs->block_size);
+    j->desc = (uint8_t *)kmalloc(fs->block_size);
+    j->revoke = (uint8_t *)kmalloc(fs->block_size);
+    j->commit = (uint8_t *)kmalloc(fs->block_size);
+    if (!j->sb || !j->desc || !j->revoke || !j->commit) {
+        journal_free(j);
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+
+    if (ext2_read_inode(fs, es->s_journal_inum, &j->inode) != 0) {
+        journal_free(j);
+        /* errno already set by ext2_read_inode */
+        return -1;
+    }
+    ext2_map_cache_reset(&j->map);
+    j->last = (uint32_t)(ext2_inode_size(&j->inode) / fs->block_size);
+    if (j->last == 0 || journal_io(fs, j, 0, j->sb, 0) != 0) {
+        journal_free(j);
+        hal_uart_puts("ext2: Cannot read the journal superblock\n");
+        RETURN_ERRNO(THUNDEROS_EFS_CORRUPT);
+    }
+
+    jbd2_superblock_t *jsb = (jbd2_superblock_t *)j->sb;
+    uint32_t type = jbd2_get32(&jsb->s_header.h_blocktype);
+    uint32_t maxlen = jbd2_get32(&jsb->s_maxlen);
+    uint32_t first = jbd2_get32(&jsb->s_first);
+    if (jbd2_get32(&jsb->s_header.h_magic) != JBD2_MAGIC_NUMBER ||
+        (type != JBD2_SUPERBLOCK_V1 && type != JBD2_SUPERBLOCK_V2) ||
+        jbd2_get32(&jsb->s_blocksize) != fs->block_size ||
+        maxlen > j->last || first == 0 || first >= maxlen) {
+        journal_free(j);
+        hal_uart_puts("ext2: Bad journal superblock\n");
+        RETURN_ERRNO(THUNDEROS_EFS_CORRUPT);
+    }
+    j->first = first;
+    j->last = maxlen;
+    j->tid = jbd2_get32(&jsb->s_sequence);
+    int needs_replay = jbd2_get32(&jsb->s_start) != 0;
+
+    uint32_t incompat = type == JBD2_SUPERBLOCK_V2 ? jbd2_get32(&jsb->s_feature_incompat) : 0;
+    if (incompat & ~JBD2_FEATURE_INCOMPAT_SUPPORTED) {
+        hal_uart_puts("ext2: Unsupported journal features ");
+        hal_uart_put_hex(incompat & ~JBD2_FEATURE_INCOMPAT_SUPPORTED);
+        hal_uart_puts("\n");
+        journal_free(j);
+        if (needs_replay) {
+            RETURN_ERRNO(THUNDEROS_EFS_INVAL);
+        }
+        clear_errno();
+        return 0;
+    }
+
+    if (needs_replay) {
+        if (journal_recover(fs, j) != 0 || ext2_reload_super(fs) != 0) {
+            journal_free(j);
+            /* errno already set by the replay */
+            return -1;
+        }
+        es = fs->superblock;
+    }
+
+    /* Our log needs revoke blocks and room for one whole commit at least */
+    if (type != JBD2_SUPERBLOCK_V2 || j->last - j->first < 2 * EXT2_JOURNAL_RESERVE) {
+        hal_uart_puts("ext2: Journal too old or too small, not journaling\n");
+        int result = 0;
+        if (needs_replay) {
+            es->s_feature_incompat &= ~EXT3_FEATURE_INCOMPAT_RECOVER;
+            if (journal_write_sb(fs, j, 0) != 0 || ext2_write_super(fs) != 0 ||
+                bcache_sync() != 0) {
+                result = -1;
+            }
+        }
+        journal_free(j);
+        /* errno already set if result is -1 */
+        return result;
+    }
+
+    jbd2_put32(&jsb->s_feature_incompat, incompat | JBD2_FEATURE_INCOMPAT_REVOKE);
+    j->head = j->first;
+    if (journal_write_sb(fs, j, 0) != 0) {
+        journal_free(j);
+        /* errno already set by journal_write_sb */
+        return -1;
+    }
+
+    /* Until unmount the log may hold transactions to replay */
+    es->s_feature_incompat |= EXT3_FEATURE_INCOMPAT_RECOVER;
+    if (ext2_write_super(fs) != 0 || bcache_sync() != 0 || virtio_blk_flush() != 0) {
+        journal_free(j);
+        set_errno(THUNDEROS_EIO);
+        return -1;
+    }
+
+    fs->journal = j;
+    hal_uart_puts("ext2: Journal of ");
+    hal_uart_put_uint32(j->last);
+    hal_uart_puts(" blocks, transaction ");
+    hal_uart_put_uint32(j->tid);
+    hal_uart_puts("\n");
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Commit, write everything home and mark the journal empty
+ */
+void ext2_journal_unload(ext2_fs_t *fs) {
+    ext2_journal_t *j = fs->journal;
+    if (!j) {
+        return;
+    }
+
+    int clean = ext2_journal_commit(fs) == 0 && journal_checkpoint(fs, j) == 0;
+    fs->journal = NULL;
+    if (clean) {
+        fs->superblock->s_feature_incompat &= ~EXT3_FEATURE_INCOMPAT_RECOVER;
+        if (ext2_write_super(fs) == 0 && bcache_sync() == 0) {
+            virtio_blk_flush();
+        }
+    } else {
+        /* The held buffers stay pinned: their changes are not safe anywhere else */
+        hal_uart_puts("ext2: Journal left for replay at next mount\n");
+    }
+    journal_free(j);
+}
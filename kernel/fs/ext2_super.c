@@ -3,34 +3,123 @@
  */
 
 #include "../include/fs/ext2.h"
+#include "../include/fs/ext2_journal.h"
+#include "../include/fs/bcache.h"
 #include "../include/drivers/virtio_blk.h"
 #include "../include/mm/kmalloc.h"
 #include "../include/mm/dma.h"
 #include "../include/hal/hal_uart.h"
 #include "../include/kernel/errno.h"
 #include "../include/kernel/constants.h"
+#include "../include/kernel/kstring.h"
 #include <stddef.h>
 
 /**
- * Read a block from the block device
+ * Largest file size a filesystem can hold
+ *
+ * The block map reaches 12 + p + p^2 + p^3 blocks for p pointers per
+ * block, and i_blocks counts SECTOR_SIZE units in 32 bits, indirect
+ * blocks included. Without a revision 1 superblock there is no
+ * EXT2_FEATURE_RO_COMPAT_LARGE_FILE to turn on.
  */
-static int read_block(void *device, uint32_t block_num, void *buffer, uint32_t block_size) {
-    (void)device;  /* Device parameter unused - we use global device */
-    
-    /* Calculate sector number (sectors are SECTOR_SIZE bytes) */
-    uint32_t sector = (block_num * block_size) / SECTOR_SIZE;
-    uint32_t num_sectors = block_size / SECTOR_SIZE;
-    
-    /* Read sectors */
-    for (uint32_t i = 0; i < num_sectors; i++) {
-        int ret = virtio_blk_read(sector + i, 
-                                  (uint8_t *)buffer + ((size_t)i * SECTOR_SIZE), 1);
-        if (ret != 1) {
-            set_errno(THUNDEROS_EIO);
+static uint64_t ext2_max_file_size(ext2_fs_t *fs) {
+    if (fs->superblock->s_rev_level == EXT2_GOOD_OLD_REV) {
+        return EXT2_SMALL_FILE_MAX;
+    }
+    
+    uint64_t ptrs = fs->block_size / sizeof(uint32_t);
+    uint64_t mapped = EXT2_NDIR_BLOCKS + ptrs + ptrs * ptrs + ptrs * ptrs * ptrs;
+    
+    uint64_t counted = 0xFFFFFFFFULL / (fs->block_size / SECTOR_SIZE);
+    uint64_t indirect = counted / ptrs + counted / (ptrs * ptrs) + 3;
+    counted -= indirect;
+    
+    return (mapped < counted ? mapped : counted) * fs->block_size;
+}
+
+/**
+ * Write the in-memory superblock back (through the block cache)
+ */
+int ext2_write_super(ext2_fs_t *fs) {
+    if (!fs || !fs->superblock) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    buf_t *b = bread(fs->device, EXT2_SUPERBLOCK_OFFSET / fs->block_size, fs->block_size);
+    if (!b) {
+        /* errno already set by bread */
+        return -1;
+    }
+    kmemcpy(b->data + EXT2_SUPERBLOCK_OFFSET % fs->block_size, fs->superblock,
+            EXT2_SUPERBLOCK_SIZE);
+    ext2_journal_dirty(fs, b);
+    brelse(b);
+    
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Write a group's descriptor back (the whole block of the table holding it)
+ */
+int ext2_write_group_desc(ext2_fs_t *fs, uint32_t group) {
+    if (!fs || !fs->group_desc || group >= fs->num_groups) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    uint32_t index = group / fs->desc_per_block;
+    buf_t *b = bread(fs->device, fs->superblock->s_first_data_block + 1 + index, fs->block_size);
+    if (!b) {
+        /* errno already set by bread */
+        return -1;
+    }
+    kmemcpy(b->data, (uint8_t *)fs->group_desc + (size_t)index * fs->block_size, fs->block_size);
+    ext2_journal_dirty(fs, b);
+    brelse(b);
+    
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Read the group descriptor table (it starts in the block after the superblock)
+ */
+static int ext2_read_group_desc(ext2_fs_t *fs) {
+    uint32_t gdt_blocks = (fs->num_groups + fs->desc_per_block - 1) / fs->desc_per_block;
+    uint32_t gdt_block = fs->superblock->s_first_data_block + 1;
+    for (uint32_t i = 0; i < gdt_blocks; i++) {
+        buf_t *b = bread(fs->device, gdt_block + i, fs->block_size);
+        if (!b) {
+            /* errno already set by bread */
             return -1;
         }
+        kmemcpy((uint8_t *)fs->group_desc + ((size_t)i * fs->block_size), b->data, fs->block_size);
+        brelse(b);
     }
+    return 0;
+}
+
+/**
+ * Read the superblock and group descriptors again through the block cache
+ */
+int ext2_reload_super(ext2_fs_t *fs) {
+    buf_t *b = bread(fs->device, EXT2_SUPERBLOCK_OFFSET / fs->block_size, fs->block_size);
+    if (!b) {
+        /* errno already set by bread */
+        return -1;
+    }
+    kmemcpy(fs->superblock, b->data + EXT2_SUPERBLOCK_OFFSET % fs->block_size,
+            EXT2_SUPERBLOCK_SIZE);
+    brelse(b);
     
+    /* Replay only rewrites blocks: the geometry read at mount still holds */
+    if (fs->superblock->s_magic != EXT2_SUPER_MAGIC) {
+        RETURN_ERRNO(THUNDEROS_EFS_BADSUPER);
+    }
+    if (ext2_read_group_desc(fs) != 0) {
+        /* errno already set by ext2_read_group_desc */
+        return -1;
+    }
     clear_errno();
     return 0;
 }
@@ -47,6 +136,12 @@ int ext2_mount(ext2_fs_t *fs, void *device) {
     fs->device = device;
     fs->superblock = NULL;
     fs->group_desc = NULL;
+    fs->block_bitmaps = NULL;
+    fs->inode_bitmaps = NULL;
+    fs->dir_indexes = NULL;
+    fs->journal = NULL;
+    mutex_init(&fs->lock);
+    fs->lock_depth = 0;
     
     /* Allocate buffer for superblock (EXT2_MIN_BLOCK_SIZE bytes) */
     fs->superblock = (ext2_superblock_t *)kmalloc(EXT2_SUPERBLOCK_SIZE);
@@ -66,27 +161,30 @@ int ext2_mount(ext2_fs_t *fs, void *device) {
         RETURN_ERRNO(THUNDEROS_EIO);
     }
     
-    /* Read sector 2 (offset 1024) into first 512 bytes of superblock */
-    ret = virtio_blk_read(2, sb_buffer, 1);
-    if (ret != 1) {
+    /* Read sectors 2-3 (offset 1024) into the superblock */
+    ret = virtio_blk_read(2, sb_buffer, EXT2_SUPERBLOCK_SIZE / SECTOR_SIZE);
+    if (ret != EXT2_SUPERBLOCK_SIZE / SECTOR_SIZE) {
         kfree(fs->superblock);
         fs->superblock = NULL;
         RETURN_ERRNO(THUNDEROS_EIO);
     }
     
-    /* Read sector 3 (offset 1536) into second 512 bytes of superblock */
-    ret = virtio_blk_read(3, sb_buffer + SECTOR_SIZE, 1);
-    if (ret != 1) {
+    /* Verify magic number */
+    if (fs->superblock->s_magic != EXT2_SUPER_MAGIC) {
         kfree(fs->superblock);
         fs->superblock = NULL;
-        RETURN_ERRNO(THUNDEROS_EIO);
+        RETURN_ERRNO(THUNDEROS_EFS_BADSUPER);
     }
     
-    /* Verify magic number */
-    if (fs->superblock->s_magic != EXT2_SUPER_MAGIC) {
+    /* An incompatible feature we do not know would be misread (64-bit block numbers, say) */
+    if (fs->superblock->s_rev_level >= EXT2_DYNAMIC_REV &&
+        (fs->superblock->s_feature_incompat & ~EXT2_FEATURE_INCOMPAT_SUPPORTED)) {
+        hal_uart_puts("ext2: Unsupported incompatible features ");
+        hal_uart_put_hex(fs->superblock->s_feature_incompat & ~EXT2_FEATURE_INCOMPAT_SUPPORTED);
+        hal_uart_puts("\n");
         kfree(fs->superblock);
         fs->superblock = NULL;
-        RETURN_ERRNO(THUNDEROS_EFS_BADSUPER);
+        RETURN_ERRNO(THUNDEROS_EFS_INVAL);
     }
     
     /* Calculate block size */
@@ -111,6 +209,8 @@ int ext2_mount(ext2_fs_t *fs, void *device) {
     /* Calculate group descriptors per block */
     fs->desc_per_block = fs->block_size / sizeof(ext2_group_desc_t);
     
+    fs->max_file_size = ext2_max_file_size(fs);
+    
     /* Allocate buffer for group descriptors */
     uint32_t gdt_blocks = (fs->num_groups + fs->desc_per_block - 1) / fs->desc_per_block;
     uint32_t gdt_size = gdt_blocks * fs->block_size;
@@ -121,20 +221,33 @@ int ext2_mount(ext2_fs_t *fs, void *device) {
         RETURN_ERRNO(THUNDEROS_ENOMEM);
     }
     
-    /* Read group descriptor table (starts in block after superblock) */
-    uint32_t gdt_block = fs->superblock->s_first_data_block + 1;
-    for (uint32_t i = 0; i < gdt_blocks; i++) {
-        ret = read_block(device, gdt_block + i, 
-                        (uint8_t *)fs->group_desc + ((size_t)i * fs->block_size),
-                        fs->block_size);
-        if (ret != 0) {
-            kfree(fs->group_desc);
-            kfree(fs->superblock);
-            fs->group_desc = NULL;
-            fs->superblock = NULL;
-            /* errno already set by read_block */
-            return -1;
-        }
+    if (ext2_read_group_desc(fs) != 0) {
+        kfree(fs->group_desc);
+        kfree(fs->superblock);
+        fs->group_desc = NULL;
+        fs->superblock = NULL;
+        /* errno already set by ext2_read_group_desc */
+        return -1;
+    }
+    
+    if (ext2_bitmaps_init(fs) != 0) {
+        kfree(fs->group_desc);
+        kfree(fs->superblock);
+        fs->group_desc = NULL;
+        fs->superblock = NULL;
+        /* errno already set by ext2_bitmaps_init */
+        return -1;
+    }
+    
+    /* Replay what a crash left in the journal before anything reads the tree */
+    if (ext2_journal_load(fs) != 0) {
+        ext2_bitmaps_release(fs);
+        kfree(fs->group_desc);
+        kfree(fs->superblock);
+        fs->group_desc = NULL;
+        fs->superblock = NULL;
+        /* errno already set by ext2_journal_load */
+        return -1;
     }
     
     clear_errno();
@@ -149,6 +262,12 @@ void ext2_unmount(ext2_fs_t *fs) {
         return;
     }
     
+    /* Blocks still waiting to be written */
+    ext2_journal_unload(fs);
+    ext2_dir_index_drop(fs, 0);
+    ext2_bitmaps_release(fs);
+    bcache_sync();
+    
     if (fs->group_desc) {
         kfree(fs->group_desc);
         fs->group_desc = NULL;
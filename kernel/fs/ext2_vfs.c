@@ -3,36 +3,69 @@
  */
 
 #include "../../include/fs/ext2.h"
+#include "../../include/fs/ext2_journal.h"
 #include "../../include/fs/vfs.h"
+#include "../../include/fs/icache.h"
+#include "../../include/fs/bcache.h"
+#include "../../include/drivers/virtio_blk.h"
 #include "../../include/mm/kmalloc.h"
+#include "../../include/mm/slab.h"
 #include "../../include/hal/hal_uart.h"
 #include "../../include/kernel/errno.h"
+#include "../../include/kernel/mutex.h"
+#include "../../include/kernel/process.h"
 #include <stddef.h>
 
 /* Forward declarations for ext2 VFS operations */
-static int ext2_vfs_read(vfs_node_t *node, uint32_t offset, void *buffer, uint32_t size);
-static int ext2_vfs_write(vfs_node_t *node, uint32_t offset, const void *buffer, uint32_t size);
+static int ext2_vfs_read(vfs_node_t *node, uint64_t offset, void *buffer, uint32_t size);
+static int ext2_vfs_write(vfs_node_t *node, uint64_t offset, const void *buffer, uint32_t size);
 static vfs_node_t *ext2_vfs_lookup(vfs_node_t *dir, const char *name);
-static int ext2_vfs_readdir(vfs_node_t *dir, uint32_t index, char *name, uint32_t *inode);
+static int ext2_vfs_iterate(vfs_node_t *dir, uint32_t *pos, vfs_filldir_t fill, void *ctx);
 static int ext2_vfs_create(vfs_node_t *dir, const char *name, uint32_t mode);
 static int ext2_vfs_mkdir(vfs_node_t *dir, const char *name, uint32_t mode);
 static int ext2_vfs_unlink(vfs_node_t *dir, const char *name);
 static int ext2_vfs_rmdir(vfs_node_t *dir, const char *name);
+static void ext2_vfs_release(vfs_node_t *node);
+static int ext2_vfs_write_inode(vfs_node_t *node);
+static void ext2_vfs_close(vfs_node_t *node);
+static int ext2_vfs_sync_fs(vfs_filesystem_t *vfs_fs);
 
 /* ext2 VFS operations table */
 static vfs_ops_t ext2_vfs_ops = {
     .read = ext2_vfs_read,
     .write = ext2_vfs_write,
     .open = NULL,   /* No special open handling needed */
-    .close = NULL,  /* No special close handling needed */
+    .close = ext2_vfs_close,
     .lookup = ext2_vfs_lookup,
-    .readdir = ext2_vfs_readdir,
+    .iterate = ext2_vfs_iterate,
     .create = ext2_vfs_create,
     .mkdir = ext2_vfs_mkdir,
     .unlink = ext2_vfs_unlink,
     .rmdir = ext2_vfs_rmdir,
+    .release = ext2_vfs_release,
+    .write_inode = ext2_vfs_write_inode,
+    .sync = ext2_vfs_sync_fs,
 };
 
+/**
+ * A node's in-memory inode (node->fs_data)
+ *
+ * The inode comes first, so fs_data is also usable as an ext2_inode_t.
+ */
+typedef struct {
+    ext2_inode_t inode;
+    ext2_map_cache_t map;           /* Block lookups made through the node */
+} ext2_vfs_inode_t;
+
+/* Object caches for inodes and VFS nodes created on lookup misses.
+ * Nodes come back through ext2_vfs_release() with their last reference. */
+static kmem_cache_t *ext2_inode_cache = NULL;
+static kmem_cache_t *vfs_node_cache = NULL;
+
+/* Set if the write-back thread could not start: operations write or
+ * commit their changes themselves */
+static int ext2_vfs_sync_each = 0;
+
 /**
  * String copy
  */
@@ -45,10 +78,54 @@ static void strcpy_safe(char *dst, const char *src, uint32_t max_len) {
     dst[i] = '\0';
 }
 
+/**
+ * Finish an operation's disk updates
+ *
+ * Nothing is written now: without a journal the dirty blocks wait for the
+ * write-back thread, fsync() or the block cache's dirty limit. With one,
+ * the operation joins the running transaction and reaches disk with the
+ * next commit: from the same thread, or once the transaction fills up.
+ */
+static int ext2_vfs_sync(ext2_fs_t *fs) {
+    if (!fs->journal) {
+        return ext2_vfs_sync_each ? bcache_sync() : 0;
+    }
+    return ext2_vfs_sync_each ? ext2_journal_commit(fs) : ext2_journal_end_op(fs);
+}
+
+/**
+ * Write everything out and flush the device cache (fsync(), sync())
+ *
+ * A commit flushes after its commit block, but the data and checkpointed
+ * blocks bcache_sync() writes still need their own flush.
+ */
+static int ext2_vfs_sync_fs_locked(ext2_fs_t *fs) {
+    if (fs->journal && ext2_journal_commit(fs) != 0) {
+        /* errno already set by ext2_journal_commit */
+        return -1;
+    }
+    if (bcache_sync() != 0) {
+        /* errno already set by bcache_sync */
+        return -1;
+    }
+    if (virtio_blk_flush() != 0) {
+        RETURN_ERRNO(THUNDEROS_EIO);
+    }
+    return 0;
+}
+
+/**
+ * Read an inode into a node's copy, dropping what was cached about the old one
+ */
+static int ext2_vfs_read_inode(ext2_fs_t *fs, uint32_t inode_num, ext2_inode_t *inode) {
+    ext2_map_cache_reset(&((ext2_vfs_inode_t *)inode)->map);
+    return ext2_read_inode(fs, inode_num, inode);
+}
+
 /**
  * Read from ext2 file via VFS
  */
-static int ext2_vfs_read(vfs_node_t *node, uint32_t offset, void *buffer, uint32_t size) {
+static int ext2_vfs_read_locked(vfs_node_t *node, uint64_t offset, void *buffer, uint32_t size) {
     if (!node || !node->fs || !node->fs->fs_data || !node->fs_data) {
         set_errno(THUNDEROS_EINVAL);
         return -1;
@@ -57,13 +134,14 @@ static int ext2_vfs_read(vfs_node_t *node, uint32_t offset, void *buffer, uint32
     ext2_fs_t *ext2_fs = (ext2_fs_t *)node->fs->fs_data;
     ext2_inode_t *inode = (ext2_inode_t *)node->fs_data;
     
-    return ext2_read_file(ext2_fs, inode, offset, buffer, size);
+    return ext2_read_file(ext2_fs, inode, &((ext2_vfs_inode_t *)inode)->map,
+                          offset, buffer, size);
 }
 
 /**
  * Write to ext2 file via VFS
  */
-static int ext2_vfs_write(vfs_node_t *node, uint32_t offset, const void *buffer, uint32_t size) {
+static int ext2_vfs_write_locked(vfs_node_t *node, uint64_t offset, const void *buffer, uint32_t size) {
     if (!node || !node->fs || !node->fs->fs_data || !node->fs_data) {
         set_errno(THUNDEROS_EINVAL);
         return -1;
@@ -72,20 +150,26 @@ static int ext2_vfs_write(vfs_node_t *node, uint32_t offset, const void *buffer,
     ext2_fs_t *ext2_fs = (ext2_fs_t *)node->fs->fs_data;
     ext2_inode_t *inode = (ext2_inode_t *)node->fs_data;
     
-    int bytes_written = ext2_write_file(ext2_fs, inode, offset, buffer, size);
-    if (bytes_written < 0) {
-        /* errno already set by ext2_write_file */
+    /* Write-back can still reach a node whose last link just went */
+    if (inode->i_links_count == 0) {
+        set_errno(THUNDEROS_ENOENT);
         return -1;
     }
     
-    /* Write updated inode back to disk (size, blocks, etc. were modified) */
-    if (ext2_write_inode(ext2_fs, node->inode, inode) != 0) {
-        /* errno already set by ext2_write_inode */
+    int bytes_written = ext2_write_file(ext2_fs, inode, &((ext2_vfs_inode_t *)inode)->map,
+                                        offset, buffer, size);
+    if (bytes_written < 0) {
+        /* errno already set by ext2_write_file */
         return -1;
     }
     
-    /* Update VFS node size */
-    node->size = inode->i_size;
+    /* Size and block list changed: written back on close or last put */
+    icache_mark_dirty(node);
+    
+    /* Update VFS node size; write-back can trail writes already cached */
+    if (ext2_inode_size(inode) > node->size) {
+        node->size = ext2_inode_size(inode);
+    }
     
     return bytes_written;
 }
@@ -93,7 +177,7 @@ static int ext2_vfs_write(vfs_node_t *node, uint32_t offset, const void *buffer,
 /**
  * Lookup file in ext2 directory via VFS
  */
-static vfs_node_t *ext2_vfs_lookup(vfs_node_t *dir, const char *name) {
+static vfs_node_t *ext2_vfs_lookup_locked(vfs_node_t *dir, const char *name) {
     if (!dir || !dir->fs || !dir->fs->fs_data || !dir->fs_data) {
         set_errno(THUNDEROS_EINVAL);
         return NULL;
@@ -103,36 +187,42 @@ static vfs_node_t *ext2_vfs_lookup(vfs_node_t *dir, const char *name) {
     ext2_inode_t *dir_inode = (ext2_inode_t *)dir->fs_data;
     
     /* Lookup inode number */
-    uint32_t inode_num = ext2_lookup(ext2_fs, dir_inode, name);
+    uint32_t inode_num = ext2_lookup(ext2_fs, dir->inode, dir_inode, name);
     if (inode_num == 0) {
         set_errno(THUNDEROS_ENOENT);
         return NULL;
     }
     
+    /* Another name, or a descriptor, may already have the inode live */
+    vfs_node_t *cached = icache_find(dir->fs, inode_num);
+    if (cached) {
+        return cached;
+    }
+    
     /* Allocate and read inode */
-    ext2_inode_t *inode = (ext2_inode_t *)kmalloc(sizeof(ext2_inode_t));
+    ext2_inode_t *inode = (ext2_inode_t *)kmem_cache_alloc(ext2_inode_cache);
     if (!inode) {
         set_errno(THUNDEROS_ENOMEM);
         return NULL;
     }
     
-    if (ext2_read_inode(ext2_fs, inode_num, inode) != 0) {
-        kfree(inode);
+    if (ext2_vfs_read_inode(ext2_fs, inode_num, inode) != 0) {
+        kmem_cache_free(ext2_inode_cache, inode);
         /* errno already set by ext2_read_inode */
         return NULL;
     }
     
     /* Create VFS node */
-    vfs_node_t *node = (vfs_node_t *)kmalloc(sizeof(vfs_node_t));
+    vfs_node_t *node = (vfs_node_t *)kmem_cache_alloc(vfs_node_cache);
     if (!node) {
-        kfree(inode);
+        kmem_cache_free(ext2_inode_cache, inode);
         set_errno(THUNDEROS_ENOMEM);
         return NULL;
     }
     
     strcpy_safe(node->name, name, sizeof(node->name));
     node->inode = inode_num;
-    node->size = inode->i_size;
+    node->size = ext2_inode_size(inode);
     node->type = ((inode->i_mode & EXT2_S_IFMT) == EXT2_S_IFDIR) ? 
                  VFS_TYPE_DIRECTORY : VFS_TYPE_FILE;
     node->flags = 0;
@@ -142,21 +232,25 @@ static vfs_node_t *ext2_vfs_lookup(vfs_node_t *dir, const char *name) {
     node->fs = dir->fs;
     node->fs_data = inode;
     node->ops = &ext2_vfs_ops;
+    node->refcount = 1;
+    node->hash_next = NULL;
+    node->parent = NULL;
+    icache_insert(node);
     
     return node;
 }
 
 /**
- * Read directory entry by index via VFS
+ * List directory entries via VFS
  * 
  * @param directory VFS directory node
- * @param entry_index Index of directory entry to read
- * @param entry_name Buffer to store entry name
- * @param entry_inode Pointer to store entry inode number
+ * @param pos Directory cursor (byte offset of the next entry), advanced
+ * @param fill Called for each entry until it returns non-zero
+ * @param ctx Passed to fill
  * @return 0 on success, -1 on error
  */
-static int ext2_vfs_readdir(vfs_node_t *directory, uint32_t entry_index, char *entry_name, uint32_t *entry_inode) {
-    if (!directory || !directory->fs || !directory->fs->fs_data || !directory->fs_data || !entry_name || !entry_inode) {
+static int ext2_vfs_iterate_locked(vfs_node_t *directory, uint32_t *pos, vfs_filldir_t fill, void *ctx) {
+    if (!directory || !directory->fs || !directory->fs->fs_data || !directory->fs_data || !pos || !fill) {
         set_errno(THUNDEROS_EINVAL);
         return -1;
     }
@@ -170,67 +264,79 @@ static int ext2_vfs_readdir(vfs_node_t *directory, uint32_t entry_index, char *e
         return -1;
     }
     
-    /* Allocate buffer for directory data */
-    uint8_t *directory_buffer = (uint8_t *)kmalloc(directory_inode->i_size);
-    if (!directory_buffer) {
-        set_errno(THUNDEROS_ENOMEM);
+    /* One pass from the cursor, served from the directory's index */
+    if (ext2_iterate_dir(ext2_filesystem, directory->inode, directory_inode, pos, fill, ctx) != 0) {
+        /* errno already set by ext2_iterate_dir */
         return -1;
     }
     
-    /* Read directory contents */
-    int read_result = ext2_read_file(ext2_filesystem, directory_inode, 0, directory_buffer, directory_inode->i_size);
-    if (read_result < 0) {
-        kfree(directory_buffer);
-        /* errno already set by ext2_read_file */
-        return -1;
-    }
-    
-    /* Find the entry at the requested index */
-    uint32_t buffer_offset = 0;
-    uint32_t current_index = 0;
-    int entry_found = 0;
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Re-read a directory's inode after an entry was added or removed
+ * 
+ * Nodes stay cached, so without this the copy would keep the old size
+ * and block list and miss entries that went into a new block.
+ */
+static void ext2_vfs_refresh_dir(vfs_node_t *dir) {
+    ext2_fs_t *ext2_fs = (ext2_fs_t *)dir->fs->fs_data;
+    ext2_inode_t *inode = (ext2_inode_t *)dir->fs_data;
     
-    while (buffer_offset < directory_inode->i_size) {
-        ext2_dirent_t *directory_entry = (ext2_dirent_t *)(directory_buffer + buffer_offset);
-        
-        /* Check for invalid entry */
-        if (directory_entry->rec_len == 0) {
-            break;
-        }
-        
-        /* Count only valid entries */
-        if (directory_entry->inode != 0) {
-            if (current_index == entry_index) {
-                /* Found the requested entry - copy name and null-terminate */
-                for (uint32_t char_index = 0; char_index < directory_entry->name_len && char_index < EXT2_NAME_LEN; char_index++) {
-                    entry_name[char_index] = directory_entry->name[char_index];
-                }
-                entry_name[directory_entry->name_len] = '\0';
-                *entry_inode = directory_entry->inode;
-                entry_found = 1;
-                break;
-            }
-            current_index++;
-        }
-        
-        buffer_offset += directory_entry->rec_len;
+    if (inode && ext2_vfs_read_inode(ext2_fs, dir->inode, inode) == 0) {
+        dir->size = inode->i_size;
     }
+}
+
+/**
+ * Find the live node of a name about to be removed, written back
+ * 
+ * ext2_remove_file() and ext2_remove_dir() work on the on-disk inode, so
+ * pending size and block changes must be there first or the blocks they
+ * added would leak.
+ */
+static vfs_node_t *ext2_vfs_removing(vfs_node_t *dir, const char *name) {
+    ext2_fs_t *ext2_fs = (ext2_fs_t *)dir->fs->fs_data;
+    ext2_inode_t *dir_inode = (ext2_inode_t *)dir->fs_data;
     
-    kfree(directory_buffer);
-    
-    if (entry_found) {
-        clear_errno();
-        return 0;
+    if (!dir_inode) {
+        return NULL;
+    }
+    uint32_t inode_num = ext2_lookup(ext2_fs, dir->inode, dir_inode, name);
+    if (inode_num == 0) {
+        return NULL;
+    }
+    vfs_node_t *node = icache_find(dir->fs, inode_num);
+    icache_writeback(node);
+    return node;
+}
+
+/**
+ * Bring a live node in line with a removal that succeeded
+ * 
+ * An inode that lost its last link is gone: its node leaves the cache so
+ * it is never written over a freed (or reused) inode. One that still has
+ * links only had its link count changed on disk.
+ */
+static void ext2_vfs_removed(vfs_node_t *node) {
+    if (!node) {
+        return;
     }
     
-    set_errno(THUNDEROS_ENOENT);
-    return -1;
+    ext2_fs_t *ext2_fs = (ext2_fs_t *)node->fs->fs_data;
+    ext2_inode_t *inode = (ext2_inode_t *)node->fs_data;
+    if (ext2_vfs_read_inode(ext2_fs, node->inode, inode) != 0 ||
+        inode->i_links_count == 0) {
+        icache_remove(node);
+    }
+    vfs_node_put(node);
 }
 
 /**
  * Create file in ext2 directory via VFS
  */
-static int ext2_vfs_create(vfs_node_t *dir, const char *name, uint32_t mode) {
+static int ext2_vfs_create_locked(vfs_node_t *dir, const char *name, uint32_t mode) {
     if (!dir || !dir->fs || !dir->fs->fs_data) {
         set_errno(THUNDEROS_EINVAL);
         return -1;
@@ -240,13 +346,19 @@ static int ext2_vfs_create(vfs_node_t *dir, const char *name, uint32_t mode) {
     uint32_t dir_inode_num = dir->inode;
     
     uint32_t new_inode = ext2_create_file(ext2_fs, dir_inode_num, name, mode);
-    return (new_inode == 0) ? -1 : 0;
+    if (new_inode == 0) {
+        /* errno already set by ext2_create_file */
+        return -1;
+    }
+    ext2_vfs_refresh_dir(dir);
+    ext2_vfs_sync(ext2_fs);
+    return 0;
 }
 
 /**
  * Create directory in ext2 via VFS
  */
-static int ext2_vfs_mkdir(vfs_node_t *dir, const char *name, uint32_t mode) {
+static int ext2_vfs_mkdir_locked(vfs_node_t *dir, const char *name, uint32_t mode) {
     if (!dir || !dir->fs || !dir->fs->fs_data) {
         set_errno(THUNDEROS_EINVAL);
         return -1;
@@ -256,13 +368,19 @@ static int ext2_vfs_mkdir(vfs_node_t *dir, const char *name, uint32_t mode) {
     uint32_t dir_inode_num = dir->inode;
     
     uint32_t new_inode = ext2_create_dir(ext2_fs, dir_inode_num, name, mode);
-    return (new_inode == 0) ? -1 : 0;
+    if (new_inode == 0) {
+        /* errno already set by ext2_create_dir */
+        return -1;
+    }
+    ext2_vfs_refresh_dir(dir);
+    ext2_vfs_sync(ext2_fs);
+    return 0;
 }
 
 /**
  * Remove file from ext2 directory via VFS
  */
-static int ext2_vfs_unlink(vfs_node_t *dir, const char *name) {
+static int ext2_vfs_unlink_locked(vfs_node_t *dir, const char *name) {
     if (!dir || !dir->fs || !dir->fs->fs_data) {
         set_errno(THUNDEROS_EINVAL);
         return -1;
@@ -271,13 +389,23 @@ static int ext2_vfs_unlink(vfs_node_t *dir, const char *name) {
     ext2_fs_t *ext2_fs = (ext2_fs_t *)dir->fs->fs_data;
     uint32_t dir_inode_num = dir->inode;
     
-    return ext2_remove_file(ext2_fs, dir_inode_num, name);
+    vfs_node_t *target = ext2_vfs_removing(dir, name);
+    if (ext2_remove_file(ext2_fs, dir_inode_num, name) != 0) {
+        vfs_node_put(target);
+        /* errno already set by ext2_remove_file */
+        return -1;
+    }
+    ext2_vfs_removed(target);
+    ext2_vfs_refresh_dir(dir);
+    ext2_vfs_sync(ext2_fs);
+    clear_errno();
+    return 0;
 }
 
 /**
  * Remove directory from ext2 via VFS
  */
-static int ext2_vfs_rmdir(vfs_node_t *dir, const char *name) {
+static int ext2_vfs_rmdir_locked(vfs_node_t *dir, const char *name) {
     if (!dir || !dir->fs || !dir->fs->fs_data) {
         set_errno(THUNDEROS_EINVAL);
         return -1;
@@ -286,7 +414,243 @@ static int ext2_vfs_rmdir(vfs_node_t *dir, const char *name) {
     ext2_fs_t *ext2_fs = (ext2_fs_t *)dir->fs->fs_data;
     uint32_t dir_inode_num = dir->inode;
     
-    return ext2_remove_dir(ext2_fs, dir_inode_num, name);
+    vfs_node_t *target = ext2_vfs_removing(dir, name);
+    if (ext2_remove_dir(ext2_fs, dir_inode_num, name) != 0) {
+        vfs_node_put(target);
+        /* errno already set by ext2_remove_dir */
+        return -1;
+    }
+    ext2_vfs_removed(target);
+    ext2_vfs_refresh_dir(dir);
+    ext2_vfs_sync(ext2_fs);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Write a node's inode back (the inode cache calls this for dirty nodes)
+ */
+static int ext2_vfs_write_inode_locked(vfs_node_t *node) {
+    if (!node || !node->fs || !node->fs->fs_data || !node->fs_data) {
+        set_errno(THUNDEROS_EINVAL);
+        return -1;
+    }
+    
+    ext2_fs_t *ext2_fs = (ext2_fs_t *)node->fs->fs_data;
+    ext2_inode_t *inode = (ext2_inode_t *)node->fs_data;
+    
+    /* chmod() and chown() only change the node */
+    inode->i_mode = node->mode;
+    inode->i_uid = node->uid;
+    inode->i_gid = node->gid;
+    
+    if (ext2_write_inode(ext2_fs, node->inode, inode) != 0) {
+        /* errno already set by ext2_write_inode */
+        return -1;
+    }
+    return ext2_vfs_sync(ext2_fs);
+}
+
+/**
+ * End the operation the writes through a descriptor were part of
+ */
+static void ext2_vfs_close_locked(vfs_node_t *node) {
+    ext2_fs_t *ext2_fs = (ext2_fs_t *)node->fs->fs_data;
+    ext2_vfs_sync(ext2_fs);
+}
+
+/**
+ * Free a node and its inode copy once nothing references it
+ */
+static void ext2_vfs_release(vfs_node_t *node) {
+    if (node->fs_data) {
+        kmem_cache_free(ext2_inode_cache, node->fs_data);
+    }
+    kmem_cache_free(vfs_node_cache, node);
+}
+
+/**
+ * The filesystem behind a node, or NULL if it has none
+ */
+static ext2_fs_t *ext2_vfs_fs(vfs_node_t *node) {
+    return (node && node->fs) ? (ext2_fs_t *)node->fs->fs_data : NULL;
+}
+
+/**
+ * Serialise operations on one filesystem
+ * 
+ * Block I/O sleeps, and ext2 operations are not written to interleave:
+ * two allocations could pick the same free block. Each VFS operation runs
+ * under the filesystem's mutex; one reached from inside another (unlink
+ * writing back the inode it removes) only counts depth.
+ */
+static void ext2_vfs_lock(ext2_fs_t *fs) {
+    if (fs->lock_depth > 0 && fs->lock.owner == process_current()) {
+        fs->lock_depth++;
+        return;
+    }
+    mutex_lock(&fs->lock);
+    fs->lock_depth = 1;
+}
+
+static void ext2_vfs_unlock(ext2_fs_t *fs) {
+    if (--fs->lock_depth == 0) {
+        mutex_unlock(&fs->lock);
+    }
+}
+
+/**
+ * Write-back thread: bounds how long a change waits in memory
+ *
+ * Commits the running transaction, or without a journal writes the dirty
+ * blocks in place. Neither flushes the device cache; fsync() does.
+ */
+static void ext2_vfs_writeback_main(void *arg) {
+    ext2_fs_t *fs = (ext2_fs_t *)arg;
+    
+    for (;;) {
+        process_sleep_us(EXT2_JOURNAL_COMMIT_INTERVAL_US);
+        ext2_vfs_lock(fs);
+        if (fs->journal) {
+            ext2_journal_commit(fs);
+        } else {
+            bcache_sync();
+        }
+        ext2_vfs_unlock(fs);
+        clear_errno();
+    }
+}
+
+/* VFS entry points: each runs the operation under the filesystem lock */
+
+static int ext2_vfs_read(vfs_node_t *node, uint64_t offset, void *buffer, uint32_t size) {
+    ext2_fs_t *fs = ext2_vfs_fs(node);
+    if (!fs) {
+        set_errno(THUNDEROS_EINVAL);
+        return -1;
+    }
+    ext2_vfs_lock(fs);
+    int result = ext2_vfs_read_locked(node, offset, buffer, size);
+    ext2_vfs_unlock(fs);
+    return result;
+}
+
+static int ext2_vfs_write(vfs_node_t *node, uint64_t offset, const void *buffer, uint32_t size) {
+    ext2_fs_t *fs = ext2_vfs_fs(node);
+    if (!fs) {
+        set_errno(THUNDEROS_EINVAL);
+        return -1;
+    }
+    ext2_vfs_lock(fs);
+    int result = ext2_vfs_write_locked(node, offset, buffer, size);
+    ext2_vfs_unlock(fs);
+    return result;
+}
+
+static vfs_node_t *ext2_vfs_lookup(vfs_node_t *dir, const char *name) {
+    ext2_fs_t *fs = ext2_vfs_fs(dir);
+    if (!fs) {
+        set_errno(THUNDEROS_EINVAL);
+        return NULL;
+    }
+    ext2_vfs_lock(fs);
+    vfs_node_t *result = ext2_vfs_lookup_locked(dir, name);
+    ext2_vfs_unlock(fs);
+    return result;
+}
+
+static int ext2_vfs_iterate(vfs_node_t *dir, uint32_t *pos, vfs_filldir_t fill, void *ctx) {
+    ext2_fs_t *fs = ext2_vfs_fs(dir);
+    if (!fs) {
+        set_errno(THUNDEROS_EINVAL);
+        return -1;
+    }
+    ext2_vfs_lock(fs);
+    int result = ext2_vfs_iterate_locked(dir, pos, fill, ctx);
+    ext2_vfs_unlock(fs);
+    return result;
+}
+
+static int ext2_vfs_create(vfs_node_t *dir, const char *name, uint32_t mode) {
+    ext2_fs_t *fs = ext2_vfs_fs(dir);
+    if (!fs) {
+        set_errno(THUNDEROS_EINVAL);
+        return -1;
+    }
+    ext2_vfs_lock(fs);
+    int result = ext2_vfs_create_locked(dir, name, mode);
+    ext2_vfs_unlock(fs);
+    return result;
+}
+
+static int ext2_vfs_mkdir(vfs_node_t *dir, const char *name, uint32_t mode) {
+    ext2_fs_t *fs = ext2_vfs_fs(dir);
+    if (!fs) {
+        set_errno(THUNDEROS_EINVAL);
+        return -1;
+    }
+    ext2_vfs_lock(fs);
+    int result = ext2_vfs_mkdir_locked(dir, name, mode);
+    ext2_vfs_unlock(fs);
+    return result;
+}
+
+static int ext2_vfs_unlink(vfs_node_t *dir, const char *name) {
+    ext2_fs_t *fs = ext2_vfs_fs(dir);
+    if (!fs) {
+        set_errno(THUNDEROS_EINVAL);
+        return -1;
+    }
+    ext2_vfs_lock(fs);
+    int result = ext2_vfs_unlink_locked(dir, name);
+    ext2_vfs_unlock(fs);
+    return result;
+}
+
+static int ext2_vfs_rmdir(vfs_node_t *dir, const char *name) {
+    ext2_fs_t *fs = ext2_vfs_fs(dir);
+    if (!fs) {
+        set_errno(THUNDEROS_EINVAL);
+        return -1;
+    }
+    ext2_vfs_lock(fs);
+    int result = ext2_vfs_rmdir_locked(dir, name);
+    ext2_vfs_unlock(fs);
+    return result;
+}
+
+static int ext2_vfs_write_inode(vfs_node_t *node) {
+    ext2_fs_t *fs = ext2_vfs_fs(node);
+    if (!fs) {
+        set_errno(THUNDEROS_EINVAL);
+        return -1;
+    }
+    ext2_vfs_lock(fs);
+    int result = ext2_vfs_write_inode_locked(node);
+    ext2_vfs_unlock(fs);
+    return result;
+}
+
+static void ext2_vfs_close(vfs_node_t *node) {
+    ext2_fs_t *fs = ext2_vfs_fs(node);
+    if (!fs) {
+        return;
+    }
+    ext2_vfs_lock(fs);
+    ext2_vfs_close_locked(node);
+    ext2_vfs_unlock(fs);
+}
+
+static int ext2_vfs_sync_fs(vfs_filesystem_t *vfs_fs) {
+    ext2_fs_t *fs = vfs_fs ? (ext2_fs_t *)vfs_fs->fs_data : NULL;
+    if (!fs) {
+        set_errno(THUNDEROS_EINVAL);
+        return -1;
+    }
+    ext2_vfs_lock(fs);
+    int result = ext2_vfs_sync_fs_locked(fs);
+    ext2_vfs_unlock(fs);
+    return result;
 }
 
 /**
@@ -298,6 +662,18 @@ vfs_filesystem_t *ext2_vfs_mount(ext2_fs_t *ext2_fs) {
         return NULL;
     }
     
+    /* Create object caches on first mount */
+    if (!ext2_inode_cache) {
+        ext2_inode_cache = kmem_cache_create("ext2_inode", sizeof(ext2_vfs_inode_t), 0, NULL);
+    }
+    if (!vfs_node_cache) {
+        vfs_node_cache = kmem_cache_create("vfs_node", sizeof(vfs_node_t), 0, NULL);
+    }
+    if (!ext2_inode_cache || !vfs_node_cache) {
+        set_errno(THUNDEROS_ENOMEM);
+        return NULL;
+    }
+    
     /* Allocate VFS filesystem structure */
     vfs_filesystem_t *vfs_fs = (vfs_filesystem_t *)kmalloc(sizeof(vfs_filesystem_t));
     if (!vfs_fs) {
@@ -306,24 +682,24 @@ vfs_filesystem_t *ext2_vfs_mount(ext2_fs_t *ext2_fs) {
     }
     
     /* Read root inode */
-    ext2_inode_t *root_inode = (ext2_inode_t *)kmalloc(sizeof(ext2_inode_t));
+    ext2_inode_t *root_inode = (ext2_inode_t *)kmem_cache_alloc(ext2_inode_cache);
     if (!root_inode) {
         kfree(vfs_fs);
         set_errno(THUNDEROS_ENOMEM);
         return NULL;
     }
     
-    if (ext2_read_inode(ext2_fs, EXT2_ROOT_INO, root_inode) != 0) {
-        kfree(root_inode);
+    if (ext2_vfs_read_inode(ext2_fs, EXT2_ROOT_INO, root_inode) != 0) {
+        kmem_cache_free(ext2_inode_cache, root_inode);
         kfree(vfs_fs);
         /* errno already set by ext2_read_inode */
         return NULL;
     }
     
     /* Create root VFS node */
-    vfs_node_t *root_node = (vfs_node_t *)kmalloc(sizeof(vfs_node_t));
+    vfs_node_t *root_node = (vfs_node_t *)kmem_cache_alloc(vfs_node_cache);
     if (!root_node) {
-        kfree(root_inode);
+        kmem_cache_free(ext2_inode_cache, root_inode);
         kfree(vfs_fs);
         set_errno(THUNDEROS_ENOMEM);
         return NULL;
@@ -331,7 +707,7 @@ vfs_filesystem_t *ext2_vfs_mount(ext2_fs_t *ext2_fs) {
     
     strcpy_safe(root_node->name, "/", sizeof(root_node->name));
     root_node->inode = EXT2_ROOT_INO;
-    root_node->size = root_inode->i_size;
+    root_node->size = ext2_inode_size(root_inode);
     root_node->type = VFS_TYPE_DIRECTORY;
     root_node->flags = 0;
     root_node->mode = root_inode->i_mode;  /* Copy permission bits */
@@ -340,12 +716,24 @@ vfs_filesystem_t *ext2_vfs_mount(ext2_fs_t *ext2_fs) {
     root_node->fs = vfs_fs;
     root_node->fs_data = root_inode;
     root_node->ops = &ext2_vfs_ops;
+    root_node->refcount = 1;           /* Held by the filesystem */
+    root_node->hash_next = NULL;
+    root_node->parent = NULL;
+    icache_insert(root_node);
     
     /* Initialize filesystem structure */
     strcpy_safe(vfs_fs->name, "ext2", sizeof(vfs_fs->name));
     vfs_fs->fs_data = ext2_fs;
     vfs_fs->root = root_node;
     vfs_fs->ops = &ext2_vfs_ops;
+    vfs_fs->max_file_size = ext2_fs->max_file_size;
+    vfs_fs->flags = 0;
+    
+    /* Without it changes would wait until the cache or a transaction fills */
+    if (!kthread_create(ext2_fs->journal ? "jbd" : "ext2wb", ext2_vfs_writeback_main, ext2_fs)) {
+        hal_uart_puts("ext2: No write-back thread, writing after every operation\n");
+        ext2_vfs_sync_each = 1;
+    }
     
     return vfs_fs;
 }
@@ -3,86 +3,181 @@
  */
 
 #include "../include/fs/ext2.h"
-#include "../include/drivers/virtio_blk.h"
+#include "../include/fs/ext2_journal.h"
+#include "../include/fs/bcache.h"
 #include "../include/mm/kmalloc.h"
 #include "../include/hal/hal_uart.h"
 #include "../include/kernel/errno.h"
 #include "../include/kernel/constants.h"
+#include "../include/kernel/kstring.h"
 #include <stddef.h>
 
+/* Most blocks one write reserves in a row */
+#define EXT2_MAX_RUN 64
+
 /**
- * Read a block from the block device
+ * Blocks one ext2_write_file() call hands out, in disk order
+ *
+ * A run of consecutive blocks is reserved at the first allocation, sized
+ * for the rest of the write, so a multi-block write lands contiguously
+ * along with the indirect blocks it needs. Later runs start at goal, the
+ * block after the last one the file got.
  */
-static int read_block(void *device, uint32_t block_num, void *buffer, uint32_t block_size) {
-    (void)device;
-    
-    uint32_t sector = (block_num * block_size) / SECTOR_SIZE;
-    uint32_t num_sectors = block_size / SECTOR_SIZE;
-    
-    for (uint32_t i = 0; i < num_sectors; i++) {
-        int ret = virtio_blk_read(sector + i, (uint8_t *)buffer + ((size_t)i * SECTOR_SIZE), 1);
-        if (ret != 1) {
-            set_errno(THUNDEROS_EIO);
-            return -1;
+typedef struct {
+    uint32_t goal;      /* Block to allocate next (0 for no preference) */
+    uint32_t next;      /* First reserved block not yet used */
+    uint32_t left;      /* Reserved blocks not yet used */
+    uint32_t want;      /* Blocks the rest of the write still needs */
+} block_run_t;
+
+/**
+ * Take the next block of a run, reserving more when it is used up
+ * Returns block number, or 0 on failure
+ */
+static uint32_t block_run_take(ext2_fs_t *fs, block_run_t *run) {
+    if (run->left == 0) {
+        uint32_t want = run->want ? run->want : 1;
+        if (want > EXT2_MAX_RUN) {
+            want = EXT2_MAX_RUN;
         }
+        run->next = ext2_alloc_blocks(fs, run->goal, want, &run->left);
+        if (run->next == 0) {
+            /* errno already set by ext2_alloc_blocks */
+            return 0;
+        }
+    }
+    uint32_t block_num = run->next++;
+    run->left--;
+    run->goal = run->next;
+    return block_num;
+}
+
+/**
+ * Give back what a run reserved but did not use (errno is left alone)
+ */
+static void block_run_release(ext2_fs_t *fs, block_run_t *run) {
+    int err = get_errno();
+    while (run->left > 0) {
+        ext2_free_block(fs, run->next++);
+        run->left--;
+    }
+    if (err) {
+        set_errno(err);
+    }
+}
+
+/**
+ * Allocate a block and fill it with zeros
+ * Takes it from run if given, else from anywhere. An indirect block
+ * (metadata set) is journaled; a data block is not.
+ * Returns block number, or 0 on failure
+ */
+static uint32_t alloc_zeroed_block(ext2_fs_t *fs, block_run_t *run, int metadata) {
+    uint32_t block_num = run ? block_run_take(fs, run) : ext2_alloc_block(fs, 0);
+    if (block_num == 0) {
+        /* errno already set by the allocator */
+        return 0;
     }
     
-    clear_errno();
-    return 0;
+    /* Overwritten entirely, so no need to read the old contents */
+    buf_t *b = bget(fs->device, block_num, fs->block_size);
+    if (!b) {
+        ext2_free_block(fs, block_num);
+        /* errno already set by bget */
+        return 0;
+    }
+    kmemset(b->data, 0, fs->block_size);
+    if (metadata) {
+        ext2_journal_dirty(fs, b);
+    } else {
+        bwrite(b);
+    }
+    brelse(b);
+    return block_num;
 }
 
 /**
- * Write a block to the block device
+ * Get (or, if run is given, fill in) one entry of an indirect block
+ * metadata says whether the entry points at another indirect block
+ * Returns the block number stored there, or 0 if none or on failure
  */
-static int write_block(void *device, uint32_t block_num, const void *buffer, uint32_t block_size) {
-    (void)device;
+static uint32_t get_or_alloc_pointer(ext2_fs_t *fs, uint32_t block, uint32_t index,
+                                     block_run_t *run, int metadata) {
+    buf_t *b = bread(fs->device, block, fs->block_size);
+    if (!b) {
+        /* errno already set by bread */
+        return 0;
+    }
     
-    uint32_t sector = (block_num * block_size) / 512;
-    uint32_t num_sectors = block_size / 512;
+    uint32_t *pointers = (uint32_t *)b->data;
+    if (pointers[index] == 0 && run) {
+        pointers[index] = alloc_zeroed_block(fs, run, metadata);
+        if (pointers[index] != 0) {
+            /* Write updated indirect block */
+            ext2_journal_dirty(fs, b);
+        }
+    }
     
-    for (uint32_t i = 0; i < num_sectors; i++) {
-        int ret = virtio_blk_write(sector + i, (const uint8_t *)buffer + ((size_t)i * 512), 1);
-        if (ret != 1) {
-            set_errno(THUNDEROS_EIO);
-            return -1;
+    uint32_t block_num = pointers[index];
+    brelse(b);
+    return block_num;
+}
+
+/**
+ * get_or_alloc_block() for an inode mapped by extents
+ * A block of an uninitialized extent is initialized before it is written
+ */
+static uint32_t get_or_alloc_extent(ext2_fs_t *fs, ext2_inode_t *inode,
+                                    uint32_t file_block, block_run_t *run) {
+    ext2_map_cache_t found;
+    int uninit;
+    if (ext2_extent_map(fs, inode, file_block, &found, &uninit) != 0) {
+        /* errno already set by ext2_extent_map */
+        return 0;
+    }
+    if (found.disk_block != 0) {
+        if (uninit && run && ext2_extent_initialize(fs, inode, file_block) != 0) {
+            /* errno already set by ext2_extent_initialize */
+            return 0;
         }
+        return found.disk_block;
+    }
+    if (!run) {
+        return 0;
     }
     
-    clear_errno();
-    return 0;
+    uint32_t block_num = alloc_zeroed_block(fs, run, 0);
+    if (block_num == 0) {
+        /* errno already set by alloc_zeroed_block */
+        return 0;
+    }
+    if (ext2_extent_insert(fs, inode, file_block, block_num) != 0) {
+        int err = get_errno();
+        ext2_free_block(fs, block_num);
+        set_errno(err);
+        return 0;
+    }
+    return block_num;
 }
 
 /**
  * Get or allocate a block number for a given file block index
- * Handles direct, indirect, and double-indirect blocks
- * If allocate is true, allocates blocks as needed
+ * Handles direct, indirect, double-indirect, and triple-indirect blocks
+ * If run is given, allocates blocks as needed from it
  */
 static uint32_t get_or_alloc_block(ext2_fs_t *fs, ext2_inode_t *inode, 
-                                    uint32_t file_block, int allocate) {
-    uint32_t *indirect_buffer = NULL;
-    uint32_t *dindirect_buffer = NULL;
-    uint32_t block_num = 0;
+                                    uint32_t file_block, block_run_t *run) {
     uint32_t ptrs_per_block = fs->block_size / sizeof(uint32_t);
     
+    if (inode->i_flags & EXT4_EXTENTS_FL) {
+        return get_or_alloc_extent(fs, inode, file_block, run);
+    }
+    
     /* Direct blocks */
     if (file_block < EXT2_NDIR_BLOCKS) {
-        if (inode->i_block[file_block] == 0 && allocate) {
-            /* Allocate new block */
-            inode->i_block[file_block] = ext2_alloc_block(fs, 0);
-            if (inode->i_block[file_block] == 0) {
-                return 0;
-            }
-            /* Zero the new block */
-            uint8_t *zero_buf = (uint8_t *)kmalloc(fs->block_size);
-            if (!zero_buf) {
-                set_errno(THUNDEROS_ENOMEM);
-                return 0;
-            }
-            for (uint32_t i = 0; i < fs->block_size; i++) {
-                zero_buf[i] = 0;
-            }
-            write_block(fs->device, inode->i_block[file_block], zero_buf, fs->block_size);
-            kfree(zero_buf);
+        if (inode->i_block[file_block] == 0 && run) {
+            /* Allocate new zeroed block */
+            inode->i_block[file_block] = alloc_zeroed_block(fs, run, 0);
         }
         return inode->i_block[file_block];
     }
@@ -93,65 +188,16 @@ static uint32_t get_or_alloc_block(ext2_fs_t *fs, ext2_inode_t *inode,
     if (file_block < ptrs_per_block) {
         /* Allocate indirect block if needed */
         if (inode->i_block[EXT2_IND_BLOCK] == 0) {
-            if (!allocate) {
+            if (!run) {
                 return 0;
             }
-            inode->i_block[EXT2_IND_BLOCK] = ext2_alloc_block(fs, 0);
+            inode->i_block[EXT2_IND_BLOCK] = alloc_zeroed_block(fs, run, 1);
             if (inode->i_block[EXT2_IND_BLOCK] == 0) {
                 return 0;
             }
-            /* Zero the indirect block */
-            uint8_t *zero_buf = (uint8_t *)kmalloc(fs->block_size);
-            if (!zero_buf) {
-                set_errno(THUNDEROS_ENOMEM);
-                return 0;
-            }
-            for (uint32_t i = 0; i < fs->block_size; i++) {
-                zero_buf[i] = 0;
-            }
-            write_block(fs->device, inode->i_block[EXT2_IND_BLOCK], zero_buf, fs->block_size);
-            kfree(zero_buf);
-        }
-        
-        /* Read indirect block */
-        indirect_buffer = (uint32_t *)kmalloc(fs->block_size);
-        if (!indirect_buffer) {
-            return 0;
-        }
-        
-        if (read_block(fs->device, inode->i_block[EXT2_IND_BLOCK], 
-                      indirect_buffer, fs->block_size) != 0) {
-            kfree(indirect_buffer);
-            return 0;
         }
         
-        /* Check if data block needs allocation */
-        if (indirect_buffer[file_block] == 0 && allocate) {
-            indirect_buffer[file_block] = ext2_alloc_block(fs, 0);
-            if (indirect_buffer[file_block] == 0) {
-                kfree(indirect_buffer);
-                return 0;
-            }
-            /* Write updated indirect block */
-            write_block(fs->device, inode->i_block[EXT2_IND_BLOCK], 
-                       indirect_buffer, fs->block_size);
-            /* Zero the new data block */
-            uint8_t *zero_buf = (uint8_t *)kmalloc(fs->block_size);
-            if (!zero_buf) {
-                kfree(indirect_buffer);
-                set_errno(THUNDEROS_ENOMEM);
-                return 0;
-            }
-            for (uint32_t i = 0; i < fs->block_size; i++) {
-                zero_buf[i] = 0;
-            }
-            write_block(fs->device, indirect_buffer[file_block], zero_buf, fs->block_size);
-            kfree(zero_buf);
-        }
-        
-        block_num = indirect_buffer[file_block];
-        kfree(indirect_buffer);
-        return block_num;
+        return get_or_alloc_pointer(fs, inode->i_block[EXT2_IND_BLOCK], file_block, run, 0);
     }
     
     file_block -= ptrs_per_block;
@@ -160,115 +206,92 @@ static uint32_t get_or_alloc_block(ext2_fs_t *fs, ext2_inode_t *inode,
     if (file_block < ptrs_per_block * ptrs_per_block) {
         /* Allocate double-indirect block if needed */
         if (inode->i_block[EXT2_DIND_BLOCK] == 0) {
-            if (!allocate) {
+            if (!run) {
                 return 0;
             }
-            inode->i_block[EXT2_DIND_BLOCK] = ext2_alloc_block(fs, 0);
+            inode->i_block[EXT2_DIND_BLOCK] = alloc_zeroed_block(fs, run, 1);
             if (inode->i_block[EXT2_DIND_BLOCK] == 0) {
                 return 0;
             }
-            /* Zero the double-indirect block */
-            uint8_t *zero_buf = (uint8_t *)kmalloc(fs->block_size);
-            if (!zero_buf) {
-                set_errno(THUNDEROS_ENOMEM);
-                return 0;
-            }
-            for (uint32_t i = 0; i < fs->block_size; i++) {
-                zero_buf[i] = 0;
-            }
-            write_block(fs->device, inode->i_block[EXT2_DIND_BLOCK], zero_buf, fs->block_size);
-            kfree(zero_buf);
-        }
-        
-        /* Read double-indirect block */
-        dindirect_buffer = (uint32_t *)kmalloc(fs->block_size);
-        if (!dindirect_buffer) {
-            return 0;
-        }
-        
-        if (read_block(fs->device, inode->i_block[EXT2_DIND_BLOCK], 
-                      dindirect_buffer, fs->block_size) != 0) {
-            kfree(dindirect_buffer);
-            return 0;
         }
         
         /* Get or allocate indirect block */
         uint32_t indirect_index = file_block / ptrs_per_block;
-        uint32_t indirect_block_num = dindirect_buffer[indirect_index];
+        uint32_t indirect_block_num = get_or_alloc_pointer(fs, inode->i_block[EXT2_DIND_BLOCK],
+                                                           indirect_index, run, 1);
+        if (indirect_block_num == 0) {
+            return 0;
+        }
         
-        if (indirect_block_num == 0 && allocate) {
-            indirect_block_num = ext2_alloc_block(fs, 0);
-            if (indirect_block_num == 0) {
-                kfree(dindirect_buffer);
+        /* Get or allocate data block */
+        uint32_t data_index = file_block % ptrs_per_block;
+        return get_or_alloc_pointer(fs, indirect_block_num, data_index, run, 0);
+    }
+    
+    file_block -= ptrs_per_block * ptrs_per_block;
+    
+    /* Triple-indirect block */
+    if (file_block < ptrs_per_block * ptrs_per_block * ptrs_per_block) {
+        /* Allocate triple-indirect block if needed */
+        if (inode->i_block[EXT2_TIND_BLOCK] == 0) {
+            if (!run) {
                 return 0;
             }
-            dindirect_buffer[indirect_index] = indirect_block_num;
-            /* Write updated double-indirect block */
-            write_block(fs->device, inode->i_block[EXT2_DIND_BLOCK], 
-                       dindirect_buffer, fs->block_size);
-            /* Zero the new indirect block */
-            uint8_t *zero_buf = (uint8_t *)kmalloc(fs->block_size);
-            if (!zero_buf) {
-                kfree(dindirect_buffer);
-                set_errno(THUNDEROS_ENOMEM);
+            inode->i_block[EXT2_TIND_BLOCK] = alloc_zeroed_block(fs, run, 1);
+            if (inode->i_block[EXT2_TIND_BLOCK] == 0) {
                 return 0;
             }
-            for (uint32_t i = 0; i < fs->block_size; i++) {
-                zero_buf[i] = 0;
-            }
-            write_block(fs->device, indirect_block_num, zero_buf, fs->block_size);
-            kfree(zero_buf);
         }
         
-        kfree(dindirect_buffer);
-        
-        if (indirect_block_num == 0) {
+        /* Get or allocate double-indirect, then indirect block */
+        uint32_t dindirect_index = file_block / (ptrs_per_block * ptrs_per_block);
+        uint32_t dindirect_block_num = get_or_alloc_pointer(fs, inode->i_block[EXT2_TIND_BLOCK],
+                                                            dindirect_index, run, 1);
+        if (dindirect_block_num == 0) {
             return 0;
         }
         
-        /* Read indirect block */
-        indirect_buffer = (uint32_t *)kmalloc(fs->block_size);
-        if (!indirect_buffer) {
-            return 0;
-        }
-        
-        if (read_block(fs->device, indirect_block_num, 
-                      indirect_buffer, fs->block_size) != 0) {
-            kfree(indirect_buffer);
+        uint32_t indirect_index = (file_block / ptrs_per_block) % ptrs_per_block;
+        uint32_t indirect_block_num = get_or_alloc_pointer(fs, dindirect_block_num,
+                                                           indirect_index, run, 1);
+        if (indirect_block_num == 0) {
             return 0;
         }
         
         /* Get or allocate data block */
         uint32_t data_index = file_block % ptrs_per_block;
-        if (indirect_buffer[data_index] == 0 && allocate) {
-            indirect_buffer[data_index] = ext2_alloc_block(fs, 0);
-            if (indirect_buffer[data_index] == 0) {
-                kfree(indirect_buffer);
-                return 0;
-            }
-            /* Write updated indirect block */
-            write_block(fs->device, indirect_block_num, indirect_buffer, fs->block_size);
-            /* Zero the new data block */
-            uint8_t *zero_buf = (uint8_t *)kmalloc(fs->block_size);
-            if (!zero_buf) {
-                kfree(indirect_buffer);
-                set_errno(THUNDEROS_ENOMEM);
-                return 0;
-            }
-            for (uint32_t i = 0; i < fs->block_size; i++) {
-                zero_buf[i] = 0;
-            }
-            write_block(fs->device, indirect_buffer[data_index], zero_buf, fs->block_size);
-            kfree(zero_buf);
+        return get_or_alloc_pointer(fs, indirect_block_num, data_index, run, 0);
+    }
+    
+    /* Past what the block map can reach (writes stop at max_file_size) */
+    set_errno(THUNDEROS_EFBIG);
+    return 0;
+}
+
+/**
+ * Set the size of an inode's file
+ */
+int ext2_inode_set_size(ext2_fs_t *fs, ext2_inode_t *inode, uint64_t size) {
+    if (size > fs->max_file_size) {
+        RETURN_ERRNO(THUNDEROS_EFBIG);
+    }
+    
+    /* The first file past 2 GiB turns the feature on for the filesystem */
+    if (size > EXT2_SMALL_FILE_MAX &&
+        !(fs->superblock->s_feature_ro_compat & EXT2_FEATURE_RO_COMPAT_LARGE_FILE)) {
+        fs->superblock->s_feature_ro_compat |= EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
+        if (ext2_write_super(fs) != 0) {
+            fs->superblock->s_feature_ro_compat &= ~EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
+            /* errno already set by ext2_write_super */
+            return -1;
         }
-        
-        block_num = indirect_buffer[data_index];
-        kfree(indirect_buffer);
-        return block_num;
     }
     
-    /* Triple-indirect block - not implemented */
-    hal_uart_puts("ext2: Triple-indirect blocks not yet supported\n");
+    inode->i_size = (uint32_t)size;
+    if ((inode->i_mode & EXT2_S_IFMT) == EXT2_S_IFREG) {
+        inode->i_size_high = (uint32_t)(size >> 32);
+    }
+    clear_errno();
     return 0;
 }
 
@@ -276,36 +299,56 @@ static uint32_t get_or_alloc_block(ext2_fs_t *fs, ext2_inode_t *inode,
  * Write data to a file
  * Returns number of bytes written, or -1 on error
  */
-int ext2_write_file(ext2_fs_t *fs, ext2_inode_t *inode, uint32_t offset,
-                    const void *buffer, uint32_t size) {
+int ext2_write_file(ext2_fs_t *fs, ext2_inode_t *inode, ext2_map_cache_t *map,
+                    uint64_t offset, const void *buffer, uint32_t size) {
     if (!fs || !inode || !buffer || size == 0 || fs->block_size == 0) {
         hal_uart_puts("ext2: Invalid parameters to ext2_write_file\n");
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
     
+    /* Holes the cached run covers may be filled below; indirect blocks
+     * already in use never move, so those stay cached */
+    if (map) {
+        map->count = 0;
+    }
+    
+    /* Nothing past what the block map can reach */
+    if (offset >= fs->max_file_size) {
+        RETURN_ERRNO(THUNDEROS_EFBIG);
+    }
+    if (size > fs->max_file_size - offset) {
+        size = (uint32_t)(fs->max_file_size - offset);
+    }
+    
     const uint8_t *src = (const uint8_t *)buffer;
     uint32_t bytes_written = 0;
+    uint32_t last_file_block = (uint32_t)((offset + size - 1) / fs->block_size);
     
-    /* Allocate temporary buffer for block operations */
-    uint8_t *block_buffer = (uint8_t *)kmalloc(fs->block_size);
-    if (!block_buffer) {
-        hal_uart_puts("ext2: Failed to allocate block buffer\n");
-        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    /* New blocks go right after the one before the write, if any */
+    block_run_t run = { 0, 0, 0, 0 };
+    uint32_t first_file_block = (uint32_t)(offset / fs->block_size);
+    if (first_file_block > 0) {
+        uint32_t prev = get_or_alloc_block(fs, inode, first_file_block - 1, NULL);
+        run.goal = prev ? prev + 1 : 0;
     }
     
     while (bytes_written < size) {
         /* Calculate which file block we need */
-        uint32_t file_block = (offset + bytes_written) / fs->block_size;
-        uint32_t block_offset = (offset + bytes_written) % fs->block_size;
+        uint32_t file_block = (uint32_t)((offset + bytes_written) / fs->block_size);
+        uint32_t block_offset = (uint32_t)((offset + bytes_written) % fs->block_size);
         
         /* Get or allocate the actual block number on disk */
-        uint32_t block_num = get_or_alloc_block(fs, inode, file_block, 1);
+        run.want = last_file_block - file_block + 1;
+        uint32_t block_num = get_or_alloc_block(fs, inode, file_block, &run);
         if (block_num == 0) {
             hal_uart_puts("ext2: Failed to allocate block for file write\n");
-            kfree(block_buffer);
+            block_run_release(fs, &run);
             /* errno already set by get_or_alloc_block */
             return -1;
         }
+        if (run.left == 0) {
+            run.goal = block_num + 1;
+        }
         
         /* Calculate how much to write in this block */
         uint32_t to_write = fs->block_size - block_offset;
@@ -314,44 +357,47 @@ int ext2_write_file(ext2_fs_t *fs, ext2_inode_t *inode, uint32_t offset,
         }
         
         /* If we're writing a partial block, read it first */
-        if (block_offset != 0 || to_write < fs->block_size) {
-            if (read_block(fs->device, block_num, block_buffer, fs->block_size) != 0) {
-                /* If read fails, zero the buffer (might be a new block) */
-                for (uint32_t i = 0; i < fs->block_size; i++) {
-                    block_buffer[i] = 0;
-                }
-            }
-        }
-        
-        /* Copy data into block buffer */
-        for (uint32_t i = 0; i < to_write; i++) {
-            block_buffer[block_offset + i] = src[bytes_written + i];
-        }
-        
-        /* Write the block back to disk */
-        if (write_block(fs->device, block_num, block_buffer, fs->block_size) != 0) {
-            hal_uart_puts("ext2: Failed to write data block ");
+        int partial = block_offset != 0 || to_write < fs->block_size;
+        buf_t *b = partial ? bread(fs->device, block_num, fs->block_size)
+                           : bget(fs->device, block_num, fs->block_size);
+        if (!b) {
+            hal_uart_puts("ext2: Failed to read data block ");
             hal_uart_put_uint32(block_num);
             hal_uart_puts("\n");
-            kfree(block_buffer);
-            /* errno already set by write_block */
+            block_run_release(fs, &run);
+            /* errno already set by bread */
             return -1;
         }
         
+        /* Copy data into the block; it reaches disk on write-back.
+         * Directory blocks are metadata and go through the journal. */
+        kmemcpy(b->data + block_offset, src + bytes_written, to_write);
+        if ((inode->i_mode & EXT2_S_IFMT) == EXT2_S_IFDIR) {
+            ext2_journal_dirty(fs, b);
+        } else {
+            bwrite(b);
+        }
+        brelse(b);
+        
         bytes_written += to_write;
     }
+    block_run_release(fs, &run);
     
     /* Update inode size if we wrote past the end */
-    if (offset + bytes_written > inode->i_size) {
-        inode->i_size = offset + bytes_written;
+    uint64_t file_size = ext2_inode_size(inode);
+    if (offset + bytes_written > file_size) {
+        file_size = offset + bytes_written;
+        if (ext2_inode_set_size(fs, inode, file_size) != 0) {
+            /* errno already set by ext2_inode_set_size */
+            return -1;
+        }
     }
     
     /* Update i_blocks (number of SECTOR_SIZE-byte blocks) */
     /* For simplicity, recalculate based on allocated blocks */
-    uint32_t total_blocks = (inode->i_size + fs->block_size - 1) / fs->block_size;
-    inode->i_blocks = (total_blocks * fs->block_size) / SECTOR_SIZE;
+    uint64_t total_blocks = (file_size + fs->block_size - 1) / fs->block_size;
+    inode->i_blocks = (uint32_t)(total_blocks * fs->block_size / SECTOR_SIZE);
     
-    kfree(block_buffer);
     return bytes_written;
 }
 
@@ -380,7 +426,9 @@ static void strncpy(char *dst, const char *src, uint32_t n) {
 
 /**
  * Add a directory entry to a directory
- * Returns inode number of new entry on success, 0 on failure
+ * Only the block that gets the entry is written back: the first one with
+ * room for it, or a new one appended to the directory.
+ * Returns 0 on success, -1 on failure
  */
 static int add_dir_entry(ext2_fs_t *fs, ext2_inode_t *dir_inode, uint32_t dir_inode_num,
                          const char *name, uint32_t inode_num, uint8_t file_type) {
@@ -394,96 +442,89 @@ static int add_dir_entry(ext2_fs_t *fs, ext2_inode_t *dir_inode, uint32_t dir_in
     uint32_t required_len = 8 + name_len;  /* inode(4) + rec_len(2) + name_len(1) + type(1) + name */
     required_len = (required_len + 3) & ~3;  /* Align to 4 bytes */
     
-    /* Allocate buffer for directory data */
-    uint32_t dir_size = dir_inode->i_size;
-    uint8_t *dir_buffer = (uint8_t *)kmalloc(dir_size + required_len + SECTOR_SIZE);  /* Extra space */
-    if (!dir_buffer) {
+    uint8_t *block = (uint8_t *)kmalloc(fs->block_size);
+    if (!block) {
         hal_uart_puts("ext2: Failed to allocate directory buffer\n");
         RETURN_ERRNO(THUNDEROS_ENOMEM);
     }
     
-    /* Read current directory contents */
-    if (dir_size > 0) {
-        int ret = ext2_read_file(fs, dir_inode, 0, dir_buffer, dir_size);
+    /* Find space for new entry, a block at a time */
+    uint32_t blocks = dir_inode->i_size / fs->block_size;
+    uint32_t block_index = 0;
+    ext2_dirent_t *new_entry = NULL;
+    
+    for (; block_index < blocks && !new_entry; block_index++) {
+        int ret = ext2_read_file(fs, dir_inode, NULL, block_index * fs->block_size, block, fs->block_size);
         if (ret < 0) {
             hal_uart_puts("ext2: Failed to read directory\n");
-            kfree(dir_buffer);
+            kfree(block);
             /* errno already set by ext2_read_file */
             return -1;
         }
-    }
-    
-    /* Find space for new entry */
-    uint32_t offset = 0;
-    ext2_dirent_t *new_entry = NULL;
-    
-    while (offset < dir_size) {
-        ext2_dirent_t *entry = (ext2_dirent_t *)(dir_buffer + offset);
-        
-        if (entry->rec_len == 0) {
-            break;
-        }
         
-        /* Calculate actual size used by this entry */
-        uint32_t actual_len = 8 + entry->name_len;
-        actual_len = (actual_len + 3) & ~3;
-        
-        /* Check if there's space in this entry */
-        if (entry->inode != 0 && entry->rec_len >= actual_len + required_len) {
-            /* Split this entry */
-            uint32_t old_rec_len = entry->rec_len;
-            entry->rec_len = actual_len;
+        uint32_t offset = 0;
+        while (offset < fs->block_size) {
+            ext2_dirent_t *entry = (ext2_dirent_t *)(block + offset);
+            if (entry->rec_len == 0) {
+                break;
+            }
             
-            /* Create new entry after this one */
-            new_entry = (ext2_dirent_t *)(dir_buffer + offset + actual_len);
-            new_entry->inode = inode_num;
-            new_entry->rec_len = old_rec_len - actual_len;
-            new_entry->name_len = name_len;
-            new_entry->file_type = file_type;
-            strncpy(new_entry->name, name, name_len);
-            break;
+            /* Calculate actual size used by this entry */
+            uint32_t actual_len = 8 + entry->name_len;
+            actual_len = (actual_len + 3) & ~3;
+            
+            if (entry->inode == 0 && entry->rec_len >= required_len) {
+                /* Reuse an entry left empty by a removal */
+                new_entry = entry;
+                break;
+            }
+            if (entry->inode != 0 && entry->rec_len >= actual_len + required_len) {
+                /* Split this entry */
+                uint32_t old_rec_len = entry->rec_len;
+                entry->rec_len = actual_len;
+                new_entry = (ext2_dirent_t *)(block + offset + actual_len);
+                new_entry->rec_len = old_rec_len - actual_len;
+                break;
+            }
+            
+            offset += entry->rec_len;
         }
-        
-        offset += entry->rec_len;
     }
     
-    /* If no space found, append at end */
+    /* If no space found, append a block at the end */
     if (!new_entry) {
-        new_entry = (ext2_dirent_t *)(dir_buffer + dir_size);
-        new_entry->inode = inode_num;
-        new_entry->rec_len = fs->block_size - (dir_size % fs->block_size);
-        if (new_entry->rec_len == fs->block_size && dir_size > 0) {
-            new_entry->rec_len = fs->block_size;
-        }
-        if (dir_size == 0) {
-            new_entry->rec_len = fs->block_size;
-        }
-        new_entry->name_len = name_len;
-        new_entry->file_type = file_type;
-        strncpy(new_entry->name, name, name_len);
-        
-        dir_size += new_entry->rec_len;
-    }
-    
-    /* Write directory back */
-    int ret = ext2_write_file(fs, dir_inode, 0, dir_buffer, dir_size);
+        kmemset(block, 0, fs->block_size);
+        new_entry = (ext2_dirent_t *)block;
+        new_entry->rec_len = fs->block_size;
+        block_index = blocks + 1;
+    }
+    uint32_t entry_offset = (block_index - 1) * fs->block_size + (uint32_t)((uint8_t *)new_entry - block);
+    new_entry->inode = inode_num;
+    new_entry->name_len = name_len;
+    new_entry->file_type = file_type;
+    strncpy(new_entry->name, name, name_len);
+    
+    /* Write the changed block back */
+    int ret = ext2_write_file(fs, dir_inode, NULL, (block_index - 1) * fs->block_size, block, fs->block_size);
+    kfree(block);
     if (ret < 0) {
         hal_uart_puts("ext2: Failed to write directory\n");
-        kfree(dir_buffer);
         /* errno already set by ext2_write_file */
         return -1;
     }
     
+    /* The hash tree, if any, does not know the new entry */
+    dir_inode->i_flags &= ~EXT2_INDEX_FL;
+    
     /* Update directory inode */
     ret = ext2_write_inode(fs, dir_inode_num, dir_inode);
     if (ret < 0) {
         hal_uart_puts("ext2: Failed to update directory inode\n");
-        kfree(dir_buffer);
         /* errno already set by ext2_write_inode */
         return -1;
     }
     
-    kfree(dir_buffer);
+    ext2_dir_index_add(fs, dir_inode_num, name, entry_offset, inode_num, file_type);
     clear_errno();
     return 0;
 }
@@ -516,7 +557,7 @@ uint32_t ext2_create_file(ext2_fs_t *fs, uint32_t dir_inode_num, const char *nam
     }
     
     /* Check if file already exists */
-    uint32_t existing = ext2_lookup(fs, &dir_inode, name);
+    uint32_t existing = ext2_lookup(fs, dir_inode_num, &dir_inode, name);
     if (existing != 0) {
         hal_uart_puts("ext2: File already exists\n");
         set_errno(THUNDEROS_EEXIST);
@@ -595,7 +636,7 @@ uint32_t ext2_create_dir(ext2_fs_t *fs, uint32_t dir_inode_num, const char *name
     }
     
     /* Check if directory already exists */
-    uint32_t existing = ext2_lookup(fs, &dir_inode, name);
+    uint32_t existing = ext2_lookup(fs, dir_inode_num, &dir_inode, name);
     if (existing != 0) {
         hal_uart_puts("ext2: Directory already exists\n");
         set_errno(THUNDEROS_EEXIST);
@@ -671,7 +712,7 @@ uint32_t ext2_create_dir(ext2_fs_t *fs, uint32_t dir_inode_num, const char *name
     dotdot->name[1] = '.';
     
     /* Write directory data */
-    ret = ext2_write_file(fs, &new_inode, 0, dir_data, fs->block_size);
+    ret = ext2_write_file(fs, &new_inode, NULL, 0, dir_data, fs->block_size);
     kfree(dir_data);
     
     if (ret < 0) {
@@ -724,79 +765,65 @@ static int strncmp_local(const char *s1, const char *s2, uint32_t n) {
     return 0;
 }
 
+/**
+ * Free an indirect block and every block below it
+ * depth is 1 for an indirect block, 2 for double, 3 for triple
+ */
+static void free_indirect_tree(ext2_fs_t *fs, uint32_t block, uint32_t depth) {
+    uint32_t ptrs_per_block = fs->block_size / sizeof(uint32_t);
+    
+    buf_t *b = bread(fs->device, block, fs->block_size);
+    if (b) {
+        uint32_t *pointers = (uint32_t *)b->data;
+        for (uint32_t i = 0; i < ptrs_per_block; i++) {
+            if (pointers[i] == 0) {
+                continue;
+            }
+            if (depth > 1) {
+                free_indirect_tree(fs, pointers[i], depth - 1);
+            } else {
+                ext2_free_block(fs, pointers[i]);
+            }
+        }
+        brelse(b);
+    }
+    ext2_free_block(fs, block);
+}
+
 /**
  * Free all data blocks used by an inode
- * Handles direct, indirect, and double-indirect blocks
+ * Handles block maps (direct to triple-indirect) and extent trees
  */
 static int free_inode_blocks(ext2_fs_t *fs, ext2_inode_t *inode) {
     if (!fs || !inode) {
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
     
-    uint32_t ptrs_per_block = fs->block_size / sizeof(uint32_t);
-    
-    /* Free direct blocks */
-    for (uint32_t i = 0; i < EXT2_NDIR_BLOCKS; i++) {
-        if (inode->i_block[i] != 0) {
-            ext2_free_block(fs, inode->i_block[i]);
-            inode->i_block[i] = 0;
-        }
-    }
-    
-    /* Free indirect block and its data blocks */
-    if (inode->i_block[EXT2_IND_BLOCK] != 0) {
-        uint32_t *indirect = (uint32_t *)kmalloc(fs->block_size);
-        if (indirect) {
-            if (read_block(fs->device, inode->i_block[EXT2_IND_BLOCK], 
-                          indirect, fs->block_size) == 0) {
-                for (uint32_t i = 0; i < ptrs_per_block; i++) {
-                    if (indirect[i] != 0) {
-                        ext2_free_block(fs, indirect[i]);
-                    }
-                }
+    if (inode->i_flags & EXT4_EXTENTS_FL) {
+        /* Leaves an empty tree, so the inode stays extent-mapped */
+        ext2_extent_free(fs, inode);
+    } else {
+        /* Free direct blocks */
+        for (uint32_t i = 0; i < EXT2_NDIR_BLOCKS; i++) {
+            if (inode->i_block[i] != 0) {
+                ext2_free_block(fs, inode->i_block[i]);
+                inode->i_block[i] = 0;
             }
-            kfree(indirect);
         }
-        ext2_free_block(fs, inode->i_block[EXT2_IND_BLOCK]);
-        inode->i_block[EXT2_IND_BLOCK] = 0;
-    }
-    
-    /* Free double-indirect block and its data blocks */
-    if (inode->i_block[EXT2_DIND_BLOCK] != 0) {
-        uint32_t *dindirect = (uint32_t *)kmalloc(fs->block_size);
-        if (dindirect) {
-            if (read_block(fs->device, inode->i_block[EXT2_DIND_BLOCK], 
-                          dindirect, fs->block_size) == 0) {
-                for (uint32_t i = 0; i < ptrs_per_block; i++) {
-                    if (dindirect[i] != 0) {
-                        uint32_t *indirect = (uint32_t *)kmalloc(fs->block_size);
-                        if (indirect) {
-                            if (read_block(fs->device, dindirect[i], 
-                                          indirect, fs->block_size) == 0) {
-                                for (uint32_t j = 0; j < ptrs_per_block; j++) {
-                                    if (indirect[j] != 0) {
-                                        ext2_free_block(fs, indirect[j]);
-                                    }
-                                }
-                            }
-                            kfree(indirect);
-                        }
-                        ext2_free_block(fs, dindirect[i]);
-                    }
-                }
+        
+        /* Free the indirect trees and the data blocks they point at */
+        for (uint32_t i = EXT2_IND_BLOCK; i <= EXT2_TIND_BLOCK; i++) {
+            if (inode->i_block[i] != 0) {
+                free_indirect_tree(fs, inode->i_block[i], i - EXT2_IND_BLOCK + 1);
+                inode->i_block[i] = 0;
             }
-            kfree(dindirect);
         }
-        ext2_free_block(fs, inode->i_block[EXT2_DIND_BLOCK]);
-        inode->i_block[EXT2_DIND_BLOCK] = 0;
-    }
-    
-    /* Triple-indirect not implemented - just clear it */
-    if (inode->i_block[EXT2_TIND_BLOCK] != 0) {
-        inode->i_block[EXT2_TIND_BLOCK] = 0;
     }
     
     inode->i_size = 0;
+    if ((inode->i_mode & EXT2_S_IFMT) == EXT2_S_IFREG) {
+        inode->i_size_high = 0;
+    }
     inode->i_blocks = 0;
     
     clear_errno();
@@ -805,6 +832,7 @@ static int free_inode_blocks(ext2_fs_t *fs, ext2_inode_t *inode) {
 
 /**
  * Remove a directory entry from a directory
+ * Only the block that held the entry is written back.
  * Returns 0 on success, -1 on error
  */
 static int remove_dir_entry(ext2_fs_t *fs, ext2_inode_t *dir_inode, 
@@ -814,77 +842,72 @@ static int remove_dir_entry(ext2_fs_t *fs, ext2_inode_t *dir_inode,
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
     
-    /* Allocate buffer for directory data */
-    uint32_t dir_size = dir_inode->i_size;
-    uint8_t *dir_buffer = (uint8_t *)kmalloc(dir_size);
-    if (!dir_buffer) {
+    uint8_t *block = (uint8_t *)kmalloc(fs->block_size);
+    if (!block) {
         RETURN_ERRNO(THUNDEROS_ENOMEM);
     }
     
-    /* Read current directory contents */
-    int ret = ext2_read_file(fs, dir_inode, 0, dir_buffer, dir_size);
-    if (ret < 0) {
-        kfree(dir_buffer);
-        /* errno already set by ext2_read_file */
-        return -1;
-    }
-    
-    /* Find the entry to remove */
-    uint32_t offset = 0;
-    ext2_dirent_t *prev_entry = NULL;
+    /* Find the entry to remove, a block at a time */
+    uint32_t blocks = dir_inode->i_size / fs->block_size;
     int found = 0;
+    uint32_t block_index = 0;
     
-    while (offset < dir_size) {
-        ext2_dirent_t *entry = (ext2_dirent_t *)(dir_buffer + offset);
-        
-        if (entry->rec_len == 0) {
-            break;
+    for (; block_index < blocks && !found; block_index++) {
+        int ret = ext2_read_file(fs, dir_inode, NULL, block_index * fs->block_size, block, fs->block_size);
+        if (ret < 0) {
+            kfree(block);
+            /* errno already set by ext2_read_file */
+            return -1;
         }
         
-        /* Check if this is the entry we're looking for */
-        if (entry->inode != 0 && entry->name_len == name_len) {
-            if (strncmp_local(entry->name, name, name_len) == 0) {
-                /* Found it - remove by merging with previous or setting inode to 0 */
+        uint32_t offset = 0;
+        ext2_dirent_t *prev_entry = NULL;
+        while (offset < fs->block_size) {
+            ext2_dirent_t *entry = (ext2_dirent_t *)(block + offset);
+            if (entry->rec_len == 0) {
+                break;
+            }
+            
+            /* Check if this is the entry we're looking for */
+            if (entry->inode != 0 && entry->name_len == name_len &&
+                strncmp_local(entry->name, name, name_len) == 0) {
                 if (prev_entry != NULL) {
-                    /* Extend previous entry to cover this one */
+                    /* Extend the entry before it in this block to cover it */
                     prev_entry->rec_len += entry->rec_len;
                 } else {
-                    /* First entry - just mark inode as 0 */
+                    /* First entry of the block - just mark inode as 0 */
                     entry->inode = 0;
                 }
                 found = 1;
                 break;
             }
-        }
-        
-        /* Remember valid entry as previous */
-        if (entry->inode != 0) {
+            
             prev_entry = entry;
+            offset += entry->rec_len;
         }
-        
-        offset += entry->rec_len;
     }
     
     if (!found) {
-        kfree(dir_buffer);
+        kfree(block);
         RETURN_ERRNO(THUNDEROS_ENOENT);
     }
     
-    /* Write directory back */
-    ret = ext2_write_file(fs, dir_inode, 0, dir_buffer, dir_size);
+    /* Write the changed block back */
+    int ret = ext2_write_file(fs, dir_inode, NULL, (block_index - 1) * fs->block_size, block, fs->block_size);
+    kfree(block);
     if (ret < 0) {
-        kfree(dir_buffer);
+        /* errno already set by ext2_write_file */
         return -1;
     }
     
     /* Update directory inode */
     ret = ext2_write_inode(fs, dir_inode_num, dir_inode);
     if (ret < 0) {
-        kfree(dir_buffer);
+        /* errno already set by ext2_write_inode */
         return -1;
     }
     
-    kfree(dir_buffer);
+    ext2_dir_index_remove(fs, dir_inode_num, name);
     clear_errno();
     return 0;
 }
@@ -907,7 +930,7 @@ static int is_dir_empty(ext2_fs_t *fs, ext2_inode_t *dir_inode) {
     }
     
     /* Read directory contents */
-    int ret = ext2_read_file(fs, dir_inode, 0, dir_buffer, dir_inode->i_size);
+    int ret = ext2_read_file(fs, dir_inode, NULL, 0, dir_buffer, dir_inode->i_size);
     if (ret < 0) {
         kfree(dir_buffer);
         return -1;
@@ -971,7 +994,7 @@ int ext2_remove_file(ext2_fs_t *fs, uint32_t dir_inode_num, const char *name) {
     }
     
     /* Look up the file to remove */
-    uint32_t file_inode_num = ext2_lookup(fs, &dir_inode, name);
+    uint32_t file_inode_num = ext2_lookup(fs, dir_inode_num, &dir_inode, name);
     if (file_inode_num == 0) {
         RETURN_ERRNO(THUNDEROS_ENOENT);
     }
@@ -1066,7 +1089,7 @@ int ext2_remove_dir(ext2_fs_t *fs, uint32_t dir_inode_num, const char *name) {
     }
     
     /* Look up the directory to remove */
-    uint32_t target_inode_num = ext2_lookup(fs, &parent_inode, name);
+    uint32_t target_inode_num = ext2_lookup(fs, dir_inode_num, &parent_inode, name);
     if (target_inode_num == 0) {
         RETURN_ERRNO(THUNDEROS_ENOENT);
     }
@@ -1108,6 +1131,9 @@ int ext2_remove_dir(ext2_fs_t *fs, uint32_t dir_inode_num, const char *name) {
         /* Log error but continue */
     }
     
+    /* Its inode number may next belong to another directory */
+    ext2_dir_index_drop(fs, target_inode_num);
+    
     /* Free the directory's data blocks */
     ret = free_inode_blocks(fs, &target_inode);
     if (ret < 0) {
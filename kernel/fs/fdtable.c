@@ -0,0 +1,262 @@
+/*
+ * fdtable.c - Per-process file descriptor tables
+ *
+ * files[] and open_map always cover the same slots. next_fd only moves
+ * up past slots found in use and back down when one below it is freed,
+ * so the search for a free slot starts at or below the lowest one.
+ */
+
+#include "../../include/fs/fdtable.h"
+#include "../../include/mm/kmalloc.h"
+#include "../../include/kernel/errno.h"
+#include "../../include/kernel/kstring.h"
+#include "../../include/kernel/bitops.h"
+#include "../../include/kernel/process.h"
+#include <stddef.h>
+
+#define BITS_PER_WORD 64
+
+/* Table of processes without one of their own */
+static fdtable_t g_kernel_table;
+
+/**
+ * Grow a table to at least min_size slots
+ * Returns 0 on success, -1 on error (errno set)
+ */
+static int fdtable_grow(fdtable_t *table, uint32_t min_size) {
+    if (min_size > VFS_MAX_OPEN_FILES) {
+        RETURN_ERRNO(THUNDEROS_EMFILE);
+    }
+    uint32_t size = table->size ? table->size : FDTABLE_INITIAL_FDS;
+    while (size < min_size) {
+        size *= 2;
+    }
+    if (size > VFS_MAX_OPEN_FILES) {
+        size = VFS_MAX_OPEN_FILES;
+    }
+    if (size <= table->size) {
+        clear_errno();
+        return 0;
+    }
+
+    vfs_file_t **files = (vfs_file_t **)kmalloc(size * sizeof(vfs_file_t *));
+    uint64_t *open_map = (uint64_t *)kmalloc(size / BITS_PER_WORD * sizeof(uint64_t));
+    if (!files || !open_map) {
+        kfree(files);
+        kfree(open_map);
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    kmemset(files, 0, size * sizeof(vfs_file_t *));
+    kmemset(open_map, 0, size / BITS_PER_WORD * sizeof(uint64_t));
+    if (table->size > 0) {
+        kmemcpy(files, table->files, table->size * sizeof(vfs_file_t *));
+        kmemcpy(open_map, table->open_map, table->size / BITS_PER_WORD * sizeof(uint64_t));
+    }
+    kfree(table->files);
+    kfree(table->open_map);
+    table->files = files;
+    table->open_map = open_map;
+    table->size = size;
+    clear_errno();
+    return 0;
+}
+
+static void fdtable_set(fdtable_t *table, uint32_t fd, vfs_file_t *file) {
+    table->files[fd] = file;
+    table->open_map[fd / BITS_PER_WORD] |= 1ULL << (fd % BITS_PER_WORD);
+}
+
+/**
+ * Put the console on descriptors 0, 1 and 2 of an empty table
+ * Returns 0 on success, -1 on error (errno set)
+ */
+static int fdtable_add_console(fdtable_t *table) {
+    vfs_file_t *input = vfs_file_alloc();
+    vfs_file_t *output = vfs_file_alloc();
+    if (!input || !output || fdtable_grow(table, FDTABLE_INITIAL_FDS) != 0) {
+        vfs_file_put(input);
+        vfs_file_put(output);
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+
+    /* stdout and stderr share one open file, as after a shell's 2>&1 */
+    input->type = VFS_TYPE_CONSOLE;
+    input->flags = O_RDONLY;
+    output->type = VFS_TYPE_CONSOLE;
+    output->flags = O_WRONLY;
+    vfs_file_get(output);
+
+    fdtable_set(table, VFS_FD_STDIN, input);
+    fdtable_set(table, VFS_FD_STDOUT, output);
+    fdtable_set(table, VFS_FD_STDERR, output);
+    table->next_fd = VFS_FD_FIRST_REGULAR;
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Create a table with the console on descriptors 0, 1 and 2
+ */
+fdtable_t *fdtable_create(void) {
+    fdtable_t *table = (fdtable_t *)kmalloc(sizeof(fdtable_t));
+    if (!table) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+    kmemset(table, 0, sizeof(*table));
+    if (fdtable_add_console(table) != 0) {
+        fdtable_destroy(table);
+        /* errno already set by fdtable_add_console */
+        return NULL;
+    }
+    table->users = 1;
+    return table;
+}
+
+/**
+ * Copy a table for a forked child
+ */
+fdtable_t *fdtable_clone(fdtable_t *table) {
+    fdtable_t *copy = (fdtable_t *)kmalloc(sizeof(fdtable_t));
+    if (!copy) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+    kmemset(copy, 0, sizeof(*copy));
+    if (fdtable_grow(copy, table->size) != 0) {
+        fdtable_destroy(copy);
+        /* errno already set by fdtable_grow */
+        return NULL;
+    }
+
+    for (uint32_t fd = 0; fd < table->size; fd++) {
+        if (table->files[fd]) {
+            vfs_file_get(table->files[fd]);
+            fdtable_set(copy, fd, table->files[fd]);
+        }
+    }
+    copy->next_fd = table->next_fd;
+    copy->users = 1;
+    clear_errno();
+    return copy;
+}
+
+/**
+ * Take another reference to a table
+ */
+fdtable_t *fdtable_share(fdtable_t *table) {
+    table->users++;
+    return table;
+}
+
+/**
+ * Drop a reference to a table, freeing it with the last
+ */
+void fdtable_destroy(fdtable_t *table) {
+    if (!table) {
+        return;
+    }
+    /* Tables still being set up have no users yet */
+    if (table->users > 1) {
+        table->users--;
+        return;
+    }
+    for (uint32_t fd = 0; fd < table->size; fd++) {
+        vfs_file_put(fdtable_remove(table, (int)fd));
+    }
+    kfree(table->files);
+    kfree(table->open_map);
+    kfree(table);
+}
+
+/**
+ * Get the calling process's table
+ */
+fdtable_t *fdtable_current(void) {
+    struct process *proc = process_current();
+    if (proc && proc->files) {
+        return proc->files;
+    }
+
+    /* Set up on first use: the kernel opens files before any process has a table */
+    if (g_kernel_table.size == 0 && fdtable_add_console(&g_kernel_table) != 0) {
+        /* errno already set by fdtable_add_console */
+        return NULL;
+    }
+    return &g_kernel_table;
+}
+
+/**
+ * Put an open file on the lowest free descriptor
+ */
+int fdtable_alloc(fdtable_t *table, vfs_file_t *file) {
+    uint32_t word = table->next_fd / BITS_PER_WORD;
+    uint32_t words = table->size / BITS_PER_WORD;
+    uint64_t clear = 0;
+
+    if (word < words) {
+        clear = ~table->open_map[word] & (~0ULL << (table->next_fd % BITS_PER_WORD));
+        while (clear == 0 && ++word < words) {
+            clear = ~table->open_map[word];
+        }
+    }
+
+    uint32_t fd;
+    if (clear != 0) {
+        fd = word * BITS_PER_WORD + ctz64(clear);
+    } else {
+        /* Every slot is in use: the first new one is free */
+        fd = table->size;
+        if (fdtable_grow(table, table->size + 1) != 0) {
+            /* errno already set by fdtable_grow */
+            return -1;
+        }
+    }
+
+    fdtable_set(table, fd, file);
+    table->next_fd = fd + 1;
+    clear_errno();
+    return (int)fd;
+}
+
+/**
+ * Put an open file on a given descriptor
+ */
+int fdtable_install(fdtable_t *table, int fd, vfs_file_t *file, vfs_file_t **replaced) {
+    if (fd < 0 || fd >= VFS_MAX_OPEN_FILES) {
+        RETURN_ERRNO(THUNDEROS_EBADF);
+    }
+    if ((uint32_t)fd >= table->size && fdtable_grow(table, (uint32_t)fd + 1) != 0) {
+        /* errno already set by fdtable_grow */
+        return -1;
+    }
+
+    *replaced = table->files[fd];
+    fdtable_set(table, (uint32_t)fd, file);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Get the open file on a descriptor
+ */
+vfs_file_t *fdtable_get(fdtable_t *table, int fd) {
+    if (!table || fd < 0 || (uint32_t)fd >= table->size) {
+        return NULL;
+    }
+    return table->files[fd];
+}
+
+/**
+ * Free a descriptor
+ */
+vfs_file_t *fdtable_remove(fdtable_t *table, int fd) {
+    vfs_file_t *file = fdtable_get(table, fd);
+    if (!file) {
+        return NULL;
+    }
+    table->files[fd] = NULL;
+    table->open_map[fd / BITS_PER_WORD] &= ~(1ULL << (fd % BITS_PER_WORD));
+    if ((uint32_t)fd < table->next_fd) {
+        table->next_fd = (uint32_t)fd;
+    }
+    return file;
+}
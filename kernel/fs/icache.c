@@ -0,0 +1,138 @@
+/*
+ * icache.c - In-memory inode cache
+ *
+ * Live nodes are chained through vfs_node_t.hash_next in a hash table
+ * keyed by (fs, inode). VFS_NODE_HASHED marks a node as being in the
+ * table and VFS_NODE_DIRTY one whose metadata still has to be written.
+ * There is no separate dirty list: syncing walks the table, which only
+ * holds nodes someone references. Everything runs under the big kernel
+ * lock, so the table takes no lock of its own.
+ */
+
+#include "../../include/fs/icache.h"
+#include "../../include/kernel/errno.h"
+#include <stddef.h>
+
+#define ICACHE_BUCKETS 64
+
+static vfs_node_t *g_buckets[ICACHE_BUCKETS];
+static icache_stats_t g_stats;
+
+static uint32_t icache_bucket(vfs_filesystem_t *fs, uint32_t inode) {
+    uint32_t hash = inode * 2654435761u ^ (uint32_t)((uintptr_t)fs >> 4);
+    return hash % ICACHE_BUCKETS;
+}
+
+/**
+ * Find the live node for an inode
+ */
+vfs_node_t *icache_find(vfs_filesystem_t *fs, uint32_t inode) {
+    vfs_node_t *node = g_buckets[icache_bucket(fs, inode)];
+    while (node) {
+        if (node->fs == fs && node->inode == inode) {
+            g_stats.hits++;
+            vfs_node_get(node);
+            return node;
+        }
+        node = node->hash_next;
+    }
+    g_stats.misses++;
+    return NULL;
+}
+
+/**
+ * Add a newly built node
+ */
+void icache_insert(vfs_node_t *node) {
+    if (!node || (node->flags & VFS_NODE_HASHED)) {
+        return;
+    }
+
+    uint32_t bucket = icache_bucket(node->fs, node->inode);
+    node->hash_next = g_buckets[bucket];
+    g_buckets[bucket] = node;
+    node->flags |= VFS_NODE_HASHED;
+    g_stats.inodes++;
+}
+
+/**
+ * Take a node out of the cache without writing it
+ */
+void icache_remove(vfs_node_t *node) {
+    if (!node || !(node->flags & VFS_NODE_HASHED)) {
+        return;
+    }
+
+    vfs_node_t **link = &g_buckets[icache_bucket(node->fs, node->inode)];
+    while (*link && *link != node) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = node->hash_next;
+    }
+    node->hash_next = NULL;
+
+    if (node->flags & VFS_NODE_DIRTY) {
+        g_stats.dirty--;
+    }
+    node->flags &= ~(VFS_NODE_HASHED | VFS_NODE_DIRTY);
+    g_stats.inodes--;
+}
+
+/**
+ * Note that a node's metadata changed
+ */
+void icache_mark_dirty(vfs_node_t *node) {
+    // A node out of the cache belongs to a deleted inode: nothing to write
+    if (!node || !(node->flags & VFS_NODE_HASHED) || (node->flags & VFS_NODE_DIRTY)) {
+        return;
+    }
+    node->flags |= VFS_NODE_DIRTY;
+    g_stats.dirty++;
+}
+
+/**
+ * Write a node's metadata back now if it is dirty
+ */
+int icache_writeback(vfs_node_t *node) {
+    if (!node || !(node->flags & VFS_NODE_DIRTY)) {
+        return 0;
+    }
+    if (!node->ops || !node->ops->write_inode) {
+        RETURN_ERRNO(THUNDEROS_EIO);
+    }
+
+    g_stats.writebacks++;
+    if (node->ops->write_inode(node) != 0) {
+        /* errno already set by write_inode */
+        return -1;
+    }
+    node->flags &= ~VFS_NODE_DIRTY;
+    g_stats.dirty--;
+    return 0;
+}
+
+/**
+ * Write back every dirty node of a filesystem
+ */
+int icache_sync(vfs_filesystem_t *fs) {
+    int result = 0;
+    for (uint32_t i = 0; i < ICACHE_BUCKETS; i++) {
+        for (vfs_node_t *node = g_buckets[i]; node; node = node->hash_next) {
+            if ((!fs || node->fs == fs) && icache_writeback(node) != 0) {
+                result = -1;
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * Get inode cache statistics
+ */
+void icache_get_stats(icache_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+    *stats = g_stats;
+}
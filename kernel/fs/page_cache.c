@@ -0,0 +1,776 @@
+/*
+ * page_cache.c - File page cache
+ *
+ * Entries live in a small hash table keyed by (fs, inode, index). The
+ * cache owns one reference to every page it holds and records itself in
+ * the page's struct page (mapping = entry), which is how a mapped page is
+ * recognised as cached when it is dirtied.
+ *
+ * write() only copies into cached pages and marks them dirty; the
+ * filesystem sees the data, and allocates blocks for it, when the page
+ * is written back. A page dirtied by write() records the node as its
+ * owner and holds a reference to it, so the node outlives its last
+ * close until the flusher thread has written it. The flusher wakes every
+ * PAGE_CACHE_FLUSH_INTERVAL_US and writes back, a whole file at a time,
+ * every file with a page dirty for PAGE_CACHE_DIRTY_EXPIRE_US, so a file
+ * written in small pieces reaches the filesystem as one sequential pass.
+ *
+ * A page nobody maps is marked clean before it is written, so a write()
+ * meanwhile dirties it again. Mapped pages are only marked clean when
+ * written back with no mappings left: without a reverse map there is no
+ * way to write-protect other processes' PTEs, so a page that may still be
+ * written stays dirty. Filesystem I/O is done with the table unlocked.
+ *
+ * Pages are kept for as long as memory allows. Every page of a disk
+ * filesystem sits on the reclaim LRU lists (mm/reclaim.h), and the
+ * "page_cache" shrinker evicts from their tail the pages that are clean
+ * and unmapped; a read that finds a page in the cache marks it used. A
+ * shrinker that runs into dirty pages wakes the flusher to write them.
+ *
+ * On a memory filesystem (VFS_FS_MEMORY) the cached page is the file
+ * data: there is nothing to read on a miss or write back, so its pages
+ * are never dirty, never on the LRU and never evicted.
+ */
+
+#include "../../include/fs/page_cache.h"
+#include "../../include/fs/icache.h"
+#include "../../include/mm/pmm.h"
+#include "../../include/mm/page.h"
+#include "../../include/mm/slab.h"
+#include "../../include/mm/reclaim.h"
+#include "../../include/kernel/kstring.h"
+#include "../../include/kernel/errno.h"
+#include "../../include/kernel/process.h"
+#include "../../include/hal/hal_timer.h"
+#include "../../include/arch/interrupt.h"
+#include <stddef.h>
+
+#define PAGE_CACHE_BUCKETS 1024
+
+typedef struct page_cache_entry {
+    vfs_filesystem_t *fs;              /* Filesystem of the inode */
+    uint32_t inode;                    /* Inode number */
+    uint32_t index;                    /* Page index within the file */
+    uintptr_t page;                    /* Physical address of cached data */
+    vfs_node_t *owner;                 /* Node write() dirtied it through (holds a ref) */
+    uint64_t dirtied_us;               /* When it last went from clean to dirty */
+    struct page_cache_entry *next;     /* Hash chain */
+} page_cache_entry_t;
+
+static page_cache_entry_t *g_buckets[PAGE_CACHE_BUCKETS];
+static kmem_cache_t *g_entry_cache = NULL;
+static page_cache_stats_t g_stats;
+static struct process *g_flusher = NULL;
+static volatile int g_flusher_idle = 0;    /* Asleep between passes */
+static volatile int g_flusher_urgent = 0;  /* Reclaim wants every dirty page written */
+
+static size_t page_cache_shrink_count(shrinker_t *shrinker);
+static size_t page_cache_shrink_scan(shrinker_t *shrinker, size_t nr, uint32_t flags);
+
+static shrinker_t g_shrinker = { "page_cache", page_cache_shrink_count, page_cache_shrink_scan,
+                                 0, 0, NULL };
+
+static inline uint32_t page_cache_hash(uint32_t inode, uint32_t index) {
+    return (inode * 31 + index) % PAGE_CACHE_BUCKETS;
+}
+
+/**
+ * Check whether an entry's page is the only copy of its data
+ */
+static inline int page_cache_is_memory(const page_cache_entry_t *entry) {
+    return (entry->fs->flags & VFS_FS_MEMORY) != 0;
+}
+
+/**
+ * Find a cached page (interrupts must be disabled)
+ */
+static page_cache_entry_t *page_cache_lookup(vfs_filesystem_t *fs, uint32_t inode, uint32_t index) {
+    page_cache_entry_t *entry = g_buckets[page_cache_hash(inode, index)];
+    while (entry) {
+        if (entry->fs == fs && entry->inode == inode && entry->index == index) {
+            return entry;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+/**
+ * Remove an entry and drop the cache's page reference (interrupts disabled)
+ *
+ * @return The entry's owner, whose reference the caller must drop once
+ *         it is done with the table (putting a node may sleep)
+ */
+static vfs_node_t *page_cache_remove(page_cache_entry_t **link) {
+    page_cache_entry_t *entry = *link;
+    vfs_node_t *owner = entry->owner;
+    *link = entry->next;
+
+    struct page *pg = phys_to_page(entry->page);
+    if (pg) {
+        lru_del(pg);
+        pg->mapping = NULL;
+        pg->flags &= ~PG_DIRTY;
+    }
+
+    if (page_cache_is_memory(entry)) {
+        g_stats.memory--;
+    }
+    put_page(entry->page);
+    kmem_cache_free(g_entry_cache, entry);
+    g_stats.pages--;
+    return owner;
+}
+
+/**
+ * Mark an entry's page dirty on behalf of write() (interrupts disabled)
+ */
+static void page_cache_dirty(page_cache_entry_t *entry, vfs_node_t *node) {
+    if (page_cache_is_memory(entry)) {
+        return;
+    }
+    struct page *pg = phys_to_page(entry->page);
+    if (pg && !(pg->flags & PG_DIRTY)) {
+        pg->flags |= PG_DIRTY;
+        g_stats.dirty++;
+        entry->dirtied_us = hal_timer_get_time_us();
+    }
+    if (!entry->owner) {
+        vfs_node_get(node);
+        entry->owner = node;
+    }
+}
+
+/**
+ * Evict a page from the LRU if it is clean and unmapped (interrupts
+ * disabled, from lru_shrink())
+ *
+ * @return 1 if the page was evicted, 0 if it is in use
+ */
+static int page_cache_evict_page(struct page *pg) {
+    /* The LRU is shared with the swap cache (mm/swap.h) */
+    if (pg->flags & PG_SWAPCACHE) {
+        return 0;
+    }
+    page_cache_entry_t *entry = (page_cache_entry_t *)pg->mapping;
+    if (!entry || (pg->flags & PG_DIRTY) || page_refcount(entry->page) != 1) {
+        return 0;
+    }
+
+    page_cache_entry_t **link = &g_buckets[page_cache_hash(entry->inode, entry->index)];
+    while (*link && *link != entry) {
+        link = &(*link)->next;
+    }
+    if (!*link) {
+        return 0;
+    }
+    page_cache_remove(link);   /* Clean, so no owner */
+    g_stats.evictions++;
+    return 1;
+}
+
+/**
+ * Cached pages reclaim could look at
+ */
+static size_t page_cache_shrink_count(shrinker_t *shrinker) {
+    (void)shrinker;
+    return g_stats.pages - g_stats.memory;
+}
+
+/**
+ * Evict up to nr clean, unmapped pages, least recently used first
+ */
+static size_t page_cache_shrink_scan(shrinker_t *shrinker, size_t nr, uint32_t flags) {
+    (void)shrinker;
+    (void)flags;
+    size_t evicted = lru_shrink(nr, page_cache_evict_page);
+
+    /* Dirty pages can only go once written: have the flusher write them all */
+    if (evicted < nr && g_stats.dirty > 0 && g_flusher && g_flusher_idle) {
+        g_flusher_urgent = 1;
+        process_wakeup(g_flusher);
+    }
+    return evicted;
+}
+
+/**
+ * Get a file page; on a miss read it in if fill is set, else leave it zero
+ * (always zero on a memory filesystem: a missing page is a hole)
+ */
+static uintptr_t page_cache_get(vfs_node_t *node, uint32_t index, int fill, int *major) {
+    if (major) {
+        *major = 0;
+    }
+    if (!node || node->type != VFS_TYPE_FILE || !node->ops || !node->ops->read) {
+        set_errno(THUNDEROS_EINVAL);
+        return 0;
+    }
+
+    if (!g_entry_cache) {
+        g_entry_cache = kmem_cache_create("page_cache", sizeof(page_cache_entry_t), 0, NULL);
+        if (!g_entry_cache) {
+            set_errno(THUNDEROS_ENOMEM);
+            return 0;
+        }
+        register_shrinker(&g_shrinker);
+    }
+
+    int irq_state = interrupt_save_disable();
+    page_cache_entry_t *entry = page_cache_lookup(node->fs, node->inode, index);
+    if (entry) {
+        uintptr_t page = entry->page;
+        get_page(page);
+        lru_mark_accessed(phys_to_page(page));
+        g_stats.hits++;
+        interrupt_restore(irq_state);
+        clear_errno();
+        return page;
+    }
+    interrupt_restore(irq_state);
+
+    /* Miss: fill a fresh page from the filesystem */
+    uintptr_t page = pmm_alloc_zeroed_page();
+    if (!page) {
+        set_errno(THUNDEROS_ENOMEM);
+        return 0;
+    }
+
+    uint64_t offset = (uint64_t)index * PAGE_SIZE;
+    int memory = (node->fs->flags & VFS_FS_MEMORY) != 0;
+    if (fill && !memory && offset < node->size) {
+        uint32_t len = node->size - offset > PAGE_SIZE ? PAGE_SIZE
+                                                       : (uint32_t)(node->size - offset);
+        if (node->ops->read(node, offset, (void *)page, len) < 0) {
+            pmm_free_page(page);
+            /* errno already set by read */
+            return 0;
+        }
+    }
+
+    page_cache_entry_t *new_entry = (page_cache_entry_t *)kmem_cache_alloc(g_entry_cache);
+    if (!new_entry) {
+        pmm_free_page(page);
+        set_errno(THUNDEROS_ENOMEM);
+        return 0;
+    }
+
+    irq_state = interrupt_save_disable();
+
+    /* Someone else may have filled the same page while we read */
+    entry = page_cache_lookup(node->fs, node->inode, index);
+    if (entry) {
+        uintptr_t cached = entry->page;
+        get_page(cached);
+        g_stats.hits++;
+        interrupt_restore(irq_state);
+        kmem_cache_free(g_entry_cache, new_entry);
+        pmm_free_page(page);
+        clear_errno();
+        return cached;
+    }
+
+    new_entry->fs = node->fs;
+    new_entry->inode = node->inode;
+    new_entry->index = index;
+    new_entry->page = page;
+    new_entry->owner = NULL;
+    new_entry->dirtied_us = 0;
+
+    uint32_t bucket = page_cache_hash(node->inode, index);
+    new_entry->next = g_buckets[bucket];
+    g_buckets[bucket] = new_entry;
+
+    struct page *pg = phys_to_page(page);
+    if (pg) {
+        pg->mapping = new_entry;
+        if (!memory) {
+            lru_add(pg);
+        }
+    }
+
+    g_stats.pages++;
+    g_stats.misses++;
+    if (memory) {
+        g_stats.memory++;
+    }
+    if (major) {
+        *major = 1;
+    }
+
+    /* One reference for the cache (from the PMM), one for the caller */
+    get_page(page);
+
+    interrupt_restore(irq_state);
+    clear_errno();
+    return page;
+}
+
+/**
+ * Get a file page, reading it into the cache on a miss
+ */
+uintptr_t page_cache_get_page(vfs_node_t *node, uint32_t index, int *major) {
+    return page_cache_get(node, index, 1, major);
+}
+
+/**
+ * Get a file page only if it is already cached
+ */
+uintptr_t page_cache_find_page(vfs_node_t *node, uint32_t index) {
+    if (!node || !g_entry_cache) {
+        return 0;
+    }
+
+    int irq_state = interrupt_save_disable();
+    uintptr_t page = 0;
+    page_cache_entry_t *entry = page_cache_lookup(node->fs, node->inode, index);
+    if (entry) {
+        page = entry->page;
+        get_page(page);
+        lru_mark_accessed(phys_to_page(page));
+        g_stats.hits++;
+    }
+    interrupt_restore(irq_state);
+    return page;
+}
+
+/**
+ * Bring pages into the cache ahead of use; stops early on any failure
+ */
+static void page_cache_readahead(vfs_node_t *node, uint32_t first, uint32_t count) {
+    for (uint32_t index = first; index < first + count; index++) {
+        int major = 0;
+        uintptr_t page = page_cache_get_page(node, index, &major);
+        if (!page) {
+            clear_errno();
+            return;
+        }
+        put_page(page);
+        if (major) {
+            g_stats.readahead++;
+        }
+    }
+}
+
+/**
+ * Read file data through the cache, reading ahead on sequential access
+ */
+int page_cache_read(vfs_node_t *node, uint64_t offset, void *buffer, uint32_t size,
+                    vfs_readahead_t *ra) {
+    if (!node || !buffer || !ra) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (size == 0 || offset >= node->size) {
+        clear_errno();
+        return 0;
+    }
+    if (size > node->size - offset) {
+        size = (uint32_t)(node->size - offset);
+    }
+
+    uint32_t first = (uint32_t)(offset / PAGE_SIZE);
+    uint32_t last = (uint32_t)((offset + size - 1) / PAGE_SIZE);
+    uint32_t eof_pages = (uint32_t)((node->size + PAGE_SIZE - 1) / PAGE_SIZE);
+
+    /* Continuing from the previous read (in the same page or the next),
+     * or starting at the beginning, counts as streaming */
+    int sequential = (ra->prev_index == VFS_RA_NONE) ? first == 0
+                     : (first == ra->prev_index || first == ra->prev_index + 1);
+    if (!sequential) {
+        ra->window = PAGE_CACHE_RA_MIN_PAGES;
+        ra->end = last + 1;
+    }
+
+    uint8_t *dest = (uint8_t *)buffer;
+    uint32_t done = 0;
+    while (done < size) {
+        uint64_t pos = offset + done;
+        uint32_t in_page = (uint32_t)(pos % PAGE_SIZE);
+        uint32_t chunk = PAGE_SIZE - in_page;
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+
+        uintptr_t page = page_cache_get_page(node, (uint32_t)(pos / PAGE_SIZE), NULL);
+        if (!page) {
+            if (done > 0) {
+                break;
+            }
+            /* errno already set by page_cache_get_page */
+            return -1;
+        }
+        kmemcpy(dest + done, (const void *)(page + in_page), chunk);
+        put_page(page);
+        done += chunk;
+    }
+    ra->prev_index = last;
+
+    /* Read the next window once the reader is within half a window of
+     * the end of the last one (a memory filesystem has nothing to read) */
+    if (sequential && !(node->fs->flags & VFS_FS_MEMORY) && last + 1 + ra->window / 2 >= ra->end) {
+        uint32_t start = ra->end > last + 1 ? ra->end : last + 1;
+        uint32_t count = ra->window;
+        if (start < eof_pages) {
+            if (count > eof_pages - start) {
+                count = eof_pages - start;
+            }
+            page_cache_readahead(node, start, count);
+            ra->end = start + count;
+        }
+        if (ra->window < PAGE_CACHE_RA_MAX_PAGES) {
+            ra->window *= 2;
+        }
+    }
+
+    clear_errno();
+    return (int)done;
+}
+
+/**
+ * Mark a cached page as modified
+ */
+void page_cache_set_dirty(uintptr_t page) {
+    struct page *pg = phys_to_page(page);
+    if (!pg) {
+        return;
+    }
+
+    int irq_state = interrupt_save_disable();
+    /* Pages dropped from the cache (e.g. unlinked file) have no owner */
+    if (pg->mapping && !(pg->flags & PG_DIRTY) &&
+        !page_cache_is_memory((page_cache_entry_t *)pg->mapping)) {
+        pg->flags |= PG_DIRTY;
+        g_stats.dirty++;
+        ((page_cache_entry_t *)pg->mapping)->dirtied_us = hal_timer_get_time_us();
+    }
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Move *index to the first page of an inode cached at or after it
+ *
+ * @return 1 if there is one up to last, 0 if not
+ */
+static int page_cache_next_cached(vfs_filesystem_t *fs, uint32_t inode, uint64_t *index,
+                                  uint64_t last) {
+    uint64_t next = last + 1;
+    int irq_state = interrupt_save_disable();
+    for (int i = 0; i < PAGE_CACHE_BUCKETS; i++) {
+        for (page_cache_entry_t *entry = g_buckets[i]; entry; entry = entry->next) {
+            if (entry->fs == fs && entry->inode == inode && entry->index >= *index &&
+                entry->index < next) {
+                next = entry->index;
+            }
+        }
+    }
+    interrupt_restore(irq_state);
+
+    if (next > last) {
+        return 0;
+    }
+    *index = next;
+    return 1;
+}
+
+/**
+ * Write dirty cached pages of a file range back to the filesystem
+ */
+int page_cache_writeback(vfs_node_t *node, uint64_t offset, uint64_t size) {
+    if (!node) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (size == 0 || g_stats.dirty == 0 || offset >= node->size ||
+        !node->ops || !node->ops->write) {
+        clear_errno();
+        return 0;
+    }
+
+    /* Nothing past end of file is ever written back */
+    uint64_t end = size > node->size - offset ? node->size : offset + size;
+    uint64_t first = offset / PAGE_SIZE;
+    uint64_t last = (end - 1) / PAGE_SIZE;
+
+    /* A range wider than the cache (a large sparse file) is walked by
+     * cached page instead of by index */
+    int by_entry = last - first >= g_stats.pages;
+
+    for (uint64_t index = first; index <= last; index++) {
+        if (by_entry && !page_cache_next_cached(node->fs, node->inode, &index, last)) {
+            break;
+        }
+
+        int irq_state = interrupt_save_disable();
+        page_cache_entry_t *entry = page_cache_lookup(node->fs, node->inode, (uint32_t)index);
+        uintptr_t page = 0;
+        vfs_node_t *owner = NULL;
+        int cleaned = 0;
+        if (entry) {
+            struct page *pg = phys_to_page(entry->page);
+            if (pg && (pg->flags & PG_DIRTY)) {
+                page = entry->page;
+                /* Unmapped: clean it now, so a write() during ours
+                 * dirties it again */
+                if (page_refcount(page) == 1) {
+                    pg->flags &= ~PG_DIRTY;
+                    g_stats.dirty--;
+                    owner = entry->owner;
+                    entry->owner = NULL;
+                    cleaned = 1;
+                }
+                get_page(page);
+            }
+        }
+        interrupt_restore(irq_state);
+
+        if (!page) {
+            continue;
+        }
+
+        uint64_t page_offset = index * PAGE_SIZE;
+        uint32_t len = node->size - page_offset > PAGE_SIZE ? PAGE_SIZE
+                                                            : (uint32_t)(node->size - page_offset);
+
+        if (node->ops->write(node, page_offset, (const void *)page, len) < 0) {
+            /* Still newer than the filesystem: dirty it again for a retry */
+            irq_state = interrupt_save_disable();
+            struct page *pg = phys_to_page(page);
+            if (cleaned && pg && pg->mapping) {
+                page_cache_entry_t *owned = (page_cache_entry_t *)pg->mapping;
+                if (!(pg->flags & PG_DIRTY)) {
+                    pg->flags |= PG_DIRTY;
+                    g_stats.dirty++;
+                }
+                if (!owned->owner) {
+                    owned->owner = owner;
+                    owner = NULL;
+                }
+            }
+            interrupt_restore(irq_state);
+            put_page(page);
+            vfs_node_put(owner);
+            /* errno already set by write */
+            return -1;
+        }
+        g_stats.writebacks++;
+
+        /* Mapped: clean only if no mapping can write it again (cache + our ref) */
+        irq_state = interrupt_save_disable();
+        struct page *pg = phys_to_page(page);
+        if (!cleaned && pg && pg->mapping && (pg->flags & PG_DIRTY) &&
+            page_refcount(page) == 2) {
+            page_cache_entry_t *owned = (page_cache_entry_t *)pg->mapping;
+            pg->flags &= ~PG_DIRTY;
+            g_stats.dirty--;
+            owner = owned->owner;
+            owned->owner = NULL;
+        }
+        interrupt_restore(irq_state);
+
+        put_page(page);
+        vfs_node_put(owner);
+    }
+
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Write file data into the cache, leaving it for write-back
+ */
+int page_cache_write(vfs_node_t *node, uint64_t offset, const void *buffer, uint32_t size) {
+    if (!node || !buffer) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    const uint8_t *src = (const uint8_t *)buffer;
+    uint32_t done = 0;
+
+    while (done < size) {
+        uint64_t pos = offset + done;
+        uint32_t index = (uint32_t)(pos / PAGE_SIZE);
+        uint32_t in_page = (uint32_t)(pos % PAGE_SIZE);
+        uint32_t chunk = PAGE_SIZE - in_page;
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+
+        /* Only a page partly overwritten and holding file data is read */
+        int fill = (in_page != 0 || chunk < PAGE_SIZE) && (uint64_t)index * PAGE_SIZE < node->size;
+        uintptr_t page = page_cache_get(node, index, fill, NULL);
+        if (!page) {
+            if (done > 0) {
+                break;
+            }
+            /* errno already set by page_cache_get */
+            return -1;
+        }
+        kmemcpy((void *)(page + in_page), src + done, chunk);
+
+        int irq_state = interrupt_save_disable();
+        page_cache_entry_t *entry = page_cache_lookup(node->fs, node->inode, index);
+        if (entry && entry->page == page) {
+            page_cache_dirty(entry, node);
+        }
+        interrupt_restore(irq_state);
+        put_page(page);
+
+        done += chunk;
+        if (pos + chunk > node->size) {
+            node->size = pos + chunk;
+        }
+    }
+
+    /* Too much waiting: past the hard limit the writer pays for its own
+     * file, past the background one the flusher starts early */
+    if (g_stats.dirty >= PAGE_CACHE_DIRTY_LIMIT) {
+        if (page_cache_writeback(node, 0, node->size) != 0) {
+            clear_errno();    /* Stays dirty for the flusher to retry */
+        }
+    } else if (g_stats.dirty >= PAGE_CACHE_DIRTY_BACKGROUND && g_flusher_idle) {
+        process_wakeup(g_flusher);
+    }
+
+    clear_errno();
+    return (int)done;
+}
+
+/**
+ * Drop every cached page of an inode
+ */
+void page_cache_invalidate(vfs_filesystem_t *fs, uint32_t inode) {
+    /* Dirty pages of one inode all name its one live node */
+    vfs_node_t *owner = NULL;
+    uint32_t owner_refs = 0;
+    int irq_state = interrupt_save_disable();
+
+    for (int i = 0; i < PAGE_CACHE_BUCKETS; i++) {
+        page_cache_entry_t **link = &g_buckets[i];
+        while (*link) {
+            if ((*link)->fs == fs && (*link)->inode == inode) {
+                struct page *pg = phys_to_page((*link)->page);
+                if (pg && (pg->flags & PG_DIRTY)) {
+                    g_stats.dirty--;
+                }
+                vfs_node_t *node = page_cache_remove(link);
+                if (node) {
+                    owner = node;
+                    owner_refs++;
+                }
+            } else {
+                link = &(*link)->next;
+            }
+        }
+    }
+
+    interrupt_restore(irq_state);
+
+    while (owner_refs-- > 0) {
+        vfs_node_put(owner);
+    }
+}
+
+/**
+ * Write back the files that have a page dirtied by write() more than
+ * expire_us ago (every such file if 0), each as a whole
+ */
+static int page_cache_flush(vfs_filesystem_t *fs, uint64_t expire_us) {
+    int result = 0;
+
+    // Bounded: each file written cleans a page at least, and a file whose
+    // pages cannot be cleaned is not retried forever
+    uint32_t max_files = g_stats.dirty;
+    for (uint32_t files = 0; files < max_files; files++) {
+        uint64_t now = hal_timer_get_time_us();
+        vfs_node_t *node = NULL;
+
+        int irq_state = interrupt_save_disable();
+        for (int i = 0; i < PAGE_CACHE_BUCKETS && !node; i++) {
+            for (page_cache_entry_t *entry = g_buckets[i]; entry; entry = entry->next) {
+                if (entry->owner && (!fs || entry->fs == fs) &&
+                    now - entry->dirtied_us >= expire_us) {
+                    node = entry->owner;
+                    vfs_node_get(node);
+                    break;
+                }
+            }
+        }
+        interrupt_restore(irq_state);
+
+        if (!node) {
+            break;
+        }
+        uint32_t dirty_before = g_stats.dirty;
+        if (page_cache_writeback(node, 0, node->size) != 0) {
+            result = -1;
+        }
+        vfs_node_put(node);
+        if (result != 0 || g_stats.dirty >= dirty_before) {
+            break;
+        }
+    }
+
+    if (result == 0) {
+        clear_errno();
+    }
+    return result;
+}
+
+/**
+ * Write every file's dirty pages back to its filesystem
+ */
+int page_cache_sync(vfs_filesystem_t *fs) {
+    return page_cache_flush(fs, 0);
+}
+
+/**
+ * Flusher thread body
+ */
+static void page_cache_flusher_main(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        g_flusher_idle = 1;
+        process_sleep_us(PAGE_CACHE_FLUSH_INTERVAL_US);
+        g_flusher_idle = 0;
+
+        // Woken early for too many dirty pages, or by reclaim: write them
+        // all, not just old ones
+        uint64_t expire = g_stats.dirty >= PAGE_CACHE_DIRTY_BACKGROUND || g_flusher_urgent
+                          ? 0 : PAGE_CACHE_DIRTY_EXPIRE_US;
+        g_flusher_urgent = 0;
+        uint32_t written = g_stats.writebacks;
+        page_cache_flush(NULL, expire);
+
+        // Writing back changed sizes and block lists: push those to disk too
+        if (g_stats.writebacks != written) {
+            icache_sync(NULL);
+        }
+        clear_errno();
+    }
+}
+
+/**
+ * Start the flusher thread
+ */
+int page_cache_start_flusher(void) {
+    struct process *proc = kthread_create("flush", page_cache_flusher_main, NULL);
+    if (!proc) {
+        /* errno already set by kthread_create */
+        return -1;
+    }
+    g_flusher = proc;
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Get page cache statistics
+ */
+void page_cache_get_stats(page_cache_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+
+    int irq_state = interrupt_save_disable();
+    *stats = g_stats;
+    interrupt_restore(irq_state);
+}
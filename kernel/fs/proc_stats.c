@@ -0,0 +1,618 @@
+/*
+ * proc_stats.c - System-wide files of /proc
+ *
+ * Each file reads the subsystem's own *_get_stats() accessor, so it shows
+ * the same numbers as the kernel's boot-time reports, without a syscall
+ * per value. Files with one line per object (IRQs, CPUs, syscalls) are
+ * iterators and stop asking as soon as the reader's buffer is full.
+ */
+
+#include "../../include/fs/procfs.h"
+#include "../../include/fs/page_cache.h"
+#include "../../include/fs/bcache.h"
+#include "../../include/fs/dcache.h"
+#include "../../include/fs/icache.h"
+#include "../../include/drivers/blk_queue.h"
+#include "../../include/mm/pmm.h"
+#include "../../include/mm/kmalloc.h"
+#include "../../include/mm/dma.h"
+#include "../../include/mm/reclaim.h"
+#include "../../include/mm/swap.h"
+#include "../../include/mm/ksm.h"
+#include "../../include/mm/kstack.h"
+#include "../../include/mm/paging.h"
+#include "../../include/arch/interrupt.h"
+#include "../../include/kernel/smp.h"
+#include "../../include/kernel/scheduler.h"
+#include "../../include/kernel/syscall.h"
+#include "../../include/kernel/acct.h"
+#include "../../include/kernel/lockstat.h"
+#include "../../include/kernel/schedlat.h"
+#include "../../include/kernel/bootstage.h"
+#include "../../include/kernel/rgroup.h"
+#include "../../include/kernel/config.h"
+#include <stddef.h>
+
+#define PAGE_KB (PAGE_SIZE / 1024)
+
+/* ------------------------------------------------------------------ */
+/* meminfo                                                            */
+/* ------------------------------------------------------------------ */
+
+static void meminfo_show(seq_file_t *m, void *v) {
+    (void)v;
+    size_t total, free;
+    size_t orders[PMM_MAX_ORDER + 1];
+    kmalloc_stats_t slab;
+    size_t dma_regions, dma_bytes;
+    page_cache_stats_t pc;
+    bcache_stats_t bc;
+    reclaim_stats_t rc;
+    swap_stats_t sw;
+    ksm_stats_t ksm;
+    pmm_pcp_stats_t pcp;
+    kstack_stats_t ks;
+    process_teardown_stats_t td;
+
+    pmm_get_stats(&total, &free);
+    pmm_get_order_stats(orders);
+    pmm_get_pcp_stats(&pcp);
+    kmalloc_get_stats(&slab);
+    dma_get_stats(&dma_regions, &dma_bytes);
+    page_cache_get_stats(&pc);
+    bcache_get_stats(&bc);
+    reclaim_get_stats(&rc);
+    swap_get_stats(&sw);
+    ksm_get_stats(&ksm);
+    kstack_get_stats(&ks);
+    process_get_teardown_stats(&td);
+
+    seq_put_field(m, "mem_total_kb", (uint64_t)total * PAGE_KB);
+    seq_put_field(m, "mem_free_kb", (uint64_t)free * PAGE_KB);
+    seq_put_field(m, "mem_used_kb", (uint64_t)(total - free) * PAGE_KB);
+    seq_puts(m, "free_blocks_by_order");
+    for (int order = 0; order <= PMM_MAX_ORDER; order++) {
+        seq_putc(m, ' ');
+        seq_put_dec(m, orders[order], 0);
+    }
+    seq_putc(m, '\n');
+    seq_put_field(m, "pcp_kb", (uint64_t)pcp.pages * PAGE_KB);
+    seq_put_field(m, "pcp_hits", pcp.hits);
+    seq_put_field(m, "pcp_refills", pcp.refills);
+    seq_put_field(m, "pcp_drains", pcp.drains);
+    seq_put_field(m, "slab_kb", (uint64_t)slab.slab_pages * PAGE_KB);
+    seq_put_field(m, "slab_objects", slab.slab_objects);
+    seq_put_field(m, "kmalloc_large_kb", (uint64_t)slab.large_pages * PAGE_KB);
+    seq_put_field(m, "dma_regions", dma_regions);
+    seq_put_field(m, "dma_kb", dma_bytes / 1024);
+    seq_put_field(m, "page_cache_kb", (uint64_t)pc.pages * PAGE_KB);
+    seq_put_field(m, "page_cache_dirty_kb", (uint64_t)pc.dirty * PAGE_KB);
+    seq_put_field(m, "buffers", bc.buffers);
+    seq_put_field(m, "buffers_dirty", bc.dirty);
+    seq_put_field(m, "lru_active_kb", (uint64_t)rc.lru_active * PAGE_KB);
+    seq_put_field(m, "lru_inactive_kb", (uint64_t)rc.lru_inactive * PAGE_KB);
+    seq_put_field(m, "wmark_low_kb", (uint64_t)rc.wmark_low * PAGE_KB);
+    seq_put_field(m, "wmark_high_kb", (uint64_t)rc.wmark_high * PAGE_KB);
+    seq_put_field(m, "kswapd_wakeups", rc.kswapd_wakeups);
+    seq_put_field(m, "kswapd_reclaimed_kb", rc.kswapd_reclaimed * PAGE_KB);
+    seq_put_field(m, "direct_reclaims", rc.direct_reclaims);
+    seq_put_field(m, "direct_reclaimed_kb", rc.direct_reclaimed * PAGE_KB);
+    seq_put_field(m, "kswapd_waits", rc.kswapd_waits);
+    seq_put_field(m, "lru_scanned", rc.lru_scanned);
+    seq_put_field(m, "lru_activated", rc.lru_activated);
+    seq_put_field(m, "lru_deactivated", rc.lru_deactivated);
+    seq_put_field(m, "swap_total_kb", sw.total_slots * PAGE_KB);
+    seq_put_field(m, "swap_free_kb", sw.free_slots * PAGE_KB);
+    seq_put_field(m, "swap_cached_kb", sw.cache_pages * PAGE_KB);
+    seq_put_field(m, "swap_ins", sw.swap_ins);
+    seq_put_field(m, "swap_outs", sw.swap_outs);
+    seq_put_field(m, "swap_readahead", sw.readahead);
+    seq_put_field(m, "swap_readahead_hits", sw.readahead_hits);
+    seq_put_field(m, "swap_io_errors", sw.io_errors);
+    seq_put_field(m, "ksm_pages_shared", ksm.pages_shared);
+    seq_put_field(m, "ksm_pages_sharing", ksm.pages_sharing);
+    seq_put_field(m, "ksm_pages_unshared", ksm.pages_unshared);
+    seq_put_field(m, "ksm_pages_scanned", ksm.pages_scanned);
+    seq_put_field(m, "ksm_merged", ksm.merged);
+    seq_put_field(m, "ksm_zero_merged", ksm.zero_merged);
+    seq_put_field(m, "ksm_full_scans", ksm.full_scans);
+    seq_put_field(m, "kstacks", ks.in_use);
+    seq_put_field(m, "kstacks_cached", ks.cached);
+    seq_put_field(m, "kstack_cache_hits", ks.cache_hits);
+    seq_put_field(m, "teardowns_pending", td.pending);
+    seq_put_field(m, "teardowns_deferred", td.deferred);
+    seq_put_field(m, "teardowns_direct", td.direct);
+}
+
+/* ------------------------------------------------------------------ */
+/* interrupts                                                         */
+/* ------------------------------------------------------------------ */
+
+/* Records (kept in v as pos + 1): 0 the header, then each registered IRQ
+ * at its number */
+static void *interrupts_record(seq_file_t *m, uint64_t *pos) {
+    (void)m;
+    interrupt_stats_t stats;
+    while (*pos > 0 && *pos < MAX_INTERRUPT_SOURCES && !interrupt_get_stats((uint32_t)*pos, &stats)) {
+        (*pos)++;
+    }
+    return *pos < MAX_INTERRUPT_SOURCES ? (void *)(uintptr_t)(*pos + 1) : NULL;
+}
+
+static void *interrupts_start(seq_file_t *m, uint64_t *pos) {
+    return interrupts_record(m, pos);
+}
+
+static void *interrupts_next(seq_file_t *m, void *v, uint64_t *pos) {
+    (void)v;
+    (*pos)++;
+    return interrupts_record(m, pos);
+}
+
+static void interrupts_show(seq_file_t *m, void *v) {
+    uint32_t irq = (uint32_t)((uintptr_t)v - 1);
+
+    if (irq == 0) {
+        seq_puts(m, " irq name         count");
+        for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+            if (cpu_get(cpu)) {
+                seq_puts(m, "       cpu");
+                seq_put_dec(m, (uint64_t)cpu, 0);
+            }
+        }
+        seq_puts(m, "   total_us     max_us max_lat_us\n");
+        return;
+    }
+
+    interrupt_stats_t stats;
+    interrupt_get_stats(irq, &stats);
+    const char *name = interrupt_get_name(irq);
+    seq_put_dec(m, irq, 4);
+    seq_putc(m, ' ');
+    seq_put_col(m, name ? name : "-", 8);
+    seq_put_dec(m, stats.count, 10);
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (cpu_get(cpu)) {
+            seq_put_dec(m, stats.cpu_count[cpu], 11);
+        }
+    }
+    seq_put_dec(m, stats.total_us, 11);
+    seq_put_dec(m, stats.max_us, 11);
+    seq_put_dec(m, stats.max_latency_us, 11);
+    seq_putc(m, '\n');
+}
+
+/* ------------------------------------------------------------------ */
+/* blkstat and cachestat                                              */
+/* ------------------------------------------------------------------ */
+
+static void blkstat_show(seq_file_t *m, void *v) {
+    (void)v;
+    blk_stats_t stats;
+    blk_get_stats(&stats);
+    seq_put_field(m, "ios", stats.ios);
+    seq_put_field(m, "requests", stats.requests);
+    seq_put_field(m, "merged", stats.merged);
+    seq_put_field(m, "expired", stats.expired);
+    seq_put_field(m, "reads_first", stats.reads_first);
+    seq_put_field(m, "peak_queued", stats.peak_queued);
+}
+
+static void cachestat_row(seq_file_t *m, const char *name, uint32_t entries,
+                          uint32_t dirty, uint32_t hits, uint32_t misses) {
+    seq_put_col(m, name, 10);
+    seq_put_dec(m, entries, 8);
+    seq_put_dec(m, dirty, 8);
+    seq_put_dec(m, hits, 11);
+    seq_put_dec(m, misses, 11);
+    seq_put_ratio(m, hits, misses, 7);
+    seq_putc(m, '\n');
+}
+
+static void cachestat_show(seq_file_t *m, void *v) {
+    (void)v;
+    page_cache_stats_t pc;
+    bcache_stats_t bc;
+    dcache_stats_t dc;
+    icache_stats_t ic;
+    page_cache_get_stats(&pc);
+    bcache_get_stats(&bc);
+    dcache_get_stats(&dc);
+    icache_get_stats(&ic);
+
+    seq_puts(m, "cache      entries   dirty       hits     misses   hit%\n");
+    cachestat_row(m, "page", pc.pages, pc.dirty, pc.hits, pc.misses);
+    cachestat_row(m, "buffer", bc.buffers, bc.dirty, bc.hits, bc.misses);
+    cachestat_row(m, "dentry", dc.entries, 0, dc.hits, dc.misses);
+    cachestat_row(m, "inode", ic.inodes, ic.dirty, ic.hits, ic.misses);
+}
+
+/* ------------------------------------------------------------------ */
+/* sched                                                              */
+/* ------------------------------------------------------------------ */
+
+/* Records (kept in v as pos + 1): 0 the header, then 1 + cpu for each CPU present */
+static void *sched_record(seq_file_t *m, uint64_t *pos) {
+    (void)m;
+    while (*pos > 0 && *pos <= MAX_CPUS && !cpu_get((int)*pos - 1)) {
+        (*pos)++;
+    }
+    return *pos <= MAX_CPUS ? (void *)(uintptr_t)(*pos + 1) : NULL;
+}
+
+static void *sched_start(seq_file_t *m, uint64_t *pos) {
+    return sched_record(m, pos);
+}
+
+static void *sched_next(seq_file_t *m, void *v, uint64_t *pos) {
+    (void)v;
+    (*pos)++;
+    return sched_record(m, pos);
+}
+
+static void sched_show(seq_file_t *m, void *v) {
+    uint64_t rec = (uint64_t)(uintptr_t)v - 1;
+
+    if (rec == 0) {
+        seq_puts(m, "cpu  running  dl_queued  rt_queued fair_queued fair_weight min_vruntime_us\n");
+        return;
+    }
+
+    int cpu = (int)rec - 1;
+    sched_rq_stats_t stats;
+    if (scheduler_get_rq_stats(cpu, &stats) != 0) {
+        return;
+    }
+    struct process *running = cpu_get(cpu)->current;
+    seq_put_dec(m, (uint64_t)cpu, 3);
+    if (running) {
+        seq_put_dec(m, (uint64_t)running->pid, 9);
+    } else {
+        seq_puts(m, "        -");
+    }
+    seq_put_dec(m, stats.dl_queued, 11);
+    seq_put_dec(m, stats.rt_queued, 11);
+    seq_put_dec(m, stats.fair_queued, 12);
+    seq_put_dec(m, stats.fair_weight, 12);
+    seq_put_dec(m, stats.min_vruntime, 16);
+    seq_putc(m, '\n');
+}
+
+/* ------------------------------------------------------------------ */
+/* syscalls                                                           */
+/* ------------------------------------------------------------------ */
+
+/* Records (kept in v as pos + 1): 0 the header, then 1 + nr for each syscall made since boot */
+static void *syscalls_record(seq_file_t *m, uint64_t *pos) {
+    (void)m;
+    while (*pos > 0 && *pos <= SYSCALL_COUNT &&
+           !(syscall_lookup(*pos - 1) && acct_syscall_stats(*pos - 1)->count > 0)) {
+        (*pos)++;
+    }
+    return *pos <= SYSCALL_COUNT ? (void *)(uintptr_t)(*pos + 1) : NULL;
+}
+
+static void *syscalls_start(seq_file_t *m, uint64_t *pos) {
+    return syscalls_record(m, pos);
+}
+
+static void *syscalls_next(seq_file_t *m, void *v, uint64_t *pos) {
+    (void)v;
+    (*pos)++;
+    return syscalls_record(m, pos);
+}
+
+static void syscalls_show(seq_file_t *m, void *v) {
+    uint64_t rec = (uint64_t)(uintptr_t)v - 1;
+
+    if (rec == 0) {
+        seq_puts(m, "syscall          calls   total_us     avg_us     max_us"
+                    "  calls by log2 usecs (<1 1 2 4 ...)\n");
+        return;
+    }
+
+    const syscall_entry_t *entry = syscall_lookup(rec - 1);
+    const acct_syscall_stats_t *stats = acct_syscall_stats(rec - 1);
+    seq_put_col(m, entry->name, 12);
+    seq_put_dec(m, stats->count, 10);
+    seq_put_dec(m, stats->total_us, 11);
+    seq_put_dec(m, stats->total_us / stats->count, 11);
+    seq_put_dec(m, stats->max_us, 11);
+    // Never empty: every call counted is in a bucket
+    seq_put_hist(m, " ", stats->hist, ACCT_HIST_BUCKETS);
+}
+
+/* ------------------------------------------------------------------ */
+/* lockstat                                                           */
+/* ------------------------------------------------------------------ */
+
+/* Records (kept in v as pos + 1): 0 the header, then 1 + index for each
+ * class in use */
+static void *lockstat_record(seq_file_t *m, uint64_t *pos) {
+    (void)m;
+    while (*pos > 0 && *pos <= LOCKSTAT_MAX_CLASSES && !lockstat_get((uint32_t)*pos - 1)) {
+        (*pos)++;
+    }
+    return *pos <= LOCKSTAT_MAX_CLASSES ? (void *)(uintptr_t)(*pos + 1) : NULL;
+}
+
+static void *lockstat_start(seq_file_t *m, uint64_t *pos) {
+    return lockstat_record(m, pos);
+}
+
+static void *lockstat_next(seq_file_t *m, void *v, uint64_t *pos) {
+    (void)v;
+    (*pos)++;
+    return lockstat_record(m, pos);
+}
+
+static void lockstat_show(seq_file_t *m, void *v) {
+    uint64_t rec = (uint64_t)(uintptr_t)v - 1;
+
+    if (rec == 0) {
+#ifndef LOCKSTAT
+        seq_puts(m, "# locks report only in LOCK_STATS=1 builds\n");
+#endif
+        seq_puts(m, "kind     class                 acquired  contended    wait_us max_wait_us"
+                    "    hold_us max_hold_us  max_wait_site\n");
+        return;
+    }
+
+    const lockstat_class_t *cls = lockstat_get((uint32_t)rec - 1);
+    seq_put_col(m, lockstat_kind_name(cls->kind), 9);
+    if (cls->name) {
+        seq_put_col(m, cls->name, 20);
+    } else {
+        // Set up (or first taken) there: addr2line -e build/thunderos.elf
+        char site[20];
+        seq_file_t out = { .buf = site, .size = sizeof(site) - 1 };
+        seq_put_hex(&out, (uintptr_t)cls->key);
+        site[out.len] = '\0';
+        seq_put_col(m, site, 20);
+    }
+    seq_put_dec(m, cls->acquisitions, 10);
+    seq_put_dec(m, cls->contended, 11);
+    seq_put_dec(m, cls->wait_us, 11);
+    seq_put_dec(m, cls->max_wait_us, 12);
+    seq_put_dec(m, cls->hold_us, 11);
+    seq_put_dec(m, cls->max_hold_us, 12);
+    seq_puts(m, "  ");
+    if (cls->max_wait_site) {
+        seq_put_hex(m, cls->max_wait_site);
+    } else {
+        seq_putc(m, '-');
+    }
+    seq_putc(m, '\n');
+    seq_put_hist(m, "  wait_hist", cls->wait_hist, LOCKSTAT_HIST_BUCKETS);
+    seq_put_hist(m, "  hold_hist", cls->hold_hist, LOCKSTAT_HIST_BUCKETS);
+}
+
+/* ------------------------------------------------------------------ */
+/* schedlat                                                           */
+/* ------------------------------------------------------------------ */
+
+/* Records (kept in v as pos + 1): 0 the class header, 1 + index for each
+ * class, then the interrupts-off line, the worst list's header and one
+ * for each wait in it */
+#define SCHEDLAT_REC_IRQOFF     (1 + SCHEDLAT_CLASSES)
+#define SCHEDLAT_REC_WORST      (SCHEDLAT_REC_IRQOFF + 1)
+
+static void *schedlat_record(seq_file_t *m, uint64_t *pos) {
+    (void)m;
+    schedlat_record_t record;
+    if (*pos > SCHEDLAT_REC_WORST && schedlat_get_worst((uint32_t)(*pos - SCHEDLAT_REC_WORST - 1), &record) < 0) {
+        return NULL;
+    }
+    return (void *)(uintptr_t)(*pos + 1);
+}
+
+static void *schedlat_start(seq_file_t *m, uint64_t *pos) {
+    return schedlat_record(m, pos);
+}
+
+static void *schedlat_next(seq_file_t *m, void *v, uint64_t *pos) {
+    (void)v;
+    (*pos)++;
+    return schedlat_record(m, pos);
+}
+
+/* A code address, for addr2line -e build/thunderos.elf, or "-" */
+static void schedlat_put_site(seq_file_t *m, uintptr_t site) {
+    if (site) {
+        seq_put_hex(m, site);
+    } else {
+        seq_putc(m, '-');
+    }
+}
+
+static void schedlat_show(seq_file_t *m, void *v) {
+    uint64_t rec = (uint64_t)(uintptr_t)v - 1;
+
+    if (rec == 0) {
+#ifndef SCHEDLAT_IRQOFF
+        seq_puts(m, "# interrupts-off sections are timed only in IRQOFF_TRACE=1 builds\n");
+#endif
+        seq_puts(m, "class         count   total_us     max_us\n");
+        return;
+    }
+
+    if (rec < SCHEDLAT_REC_IRQOFF) {
+        const schedlat_class_t *cls = schedlat_get_class((uint32_t)rec - 1);
+        seq_put_col(m, schedlat_class_name((uint32_t)rec - 1), 9);
+        seq_put_dec(m, cls->count, 10);
+        seq_put_dec(m, cls->total_us, 11);
+        seq_put_dec(m, cls->max_us, 11);
+        seq_putc(m, '\n');
+        seq_put_hist(m, "  hist", cls->hist, SCHEDLAT_HIST_BUCKETS);
+        return;
+    }
+
+    if (rec == SCHEDLAT_REC_IRQOFF) {
+        schedlat_irqoff_t irqoff;
+        schedlat_get_irqoff(&irqoff);
+        seq_put_col(m, "irqoff", 9);
+        seq_put_dec(m, irqoff.count, 10);
+        seq_put_dec(m, irqoff.total_us, 11);
+        seq_put_dec(m, irqoff.max_us, 11);
+        if (irqoff.count) {
+            seq_puts(m, "  cpu ");
+            seq_put_dec(m, irqoff.max_cpu, 0);
+            seq_puts(m, " at ");
+            schedlat_put_site(m, irqoff.max_site);
+        }
+        seq_putc(m, '\n');
+        seq_put_hist(m, "  hist", irqoff.hist, SCHEDLAT_HIST_BUCKETS);
+        return;
+    }
+
+    if (rec == SCHEDLAT_REC_WORST) {
+        seq_puts(m, "latency_us   pid name            class    cpu  prev prev_name        irqoff_us"
+                    "  waker       irqoff_site\n");
+        return;
+    }
+
+    schedlat_record_t r;
+    if (schedlat_get_worst((uint32_t)(rec - SCHEDLAT_REC_WORST - 1), &r) < 0) {
+        return;
+    }
+    seq_put_dec(m, r.latency_us, 10);
+    seq_put_dec(m, (uint64_t)r.pid, 6);
+    seq_putc(m, ' ');
+    seq_put_col(m, r.name, 16);
+    seq_put_col(m, schedlat_class_name(r.lat_class), 9);
+    seq_put_dec(m, r.cpu, 3);
+    seq_put_dec(m, (uint64_t)r.prev_pid, 6);
+    seq_putc(m, ' ');
+    seq_put_col(m, r.prev_pid ? r.prev_name : "(idle)", 16);
+    seq_put_dec(m, r.irqoff_us, 10);
+    seq_puts(m, "  ");
+    schedlat_put_site(m, r.wake_site);
+    seq_puts(m, "  ");
+    schedlat_put_site(m, r.irqoff_site);
+    seq_putc(m, '\n');
+}
+
+/* ------------------------------------------------------------------ */
+/* rgroups                                                            */
+/* ------------------------------------------------------------------ */
+
+/* Records (kept in v as pos + 1): 0 the header, then 1 + id for each group */
+static void *rgroups_record(seq_file_t *m, uint64_t *pos) {
+    (void)m;
+    while (*pos > 0 && *pos <= RGROUP_MAX && !rgroup_get((int)*pos - 1)) {
+        (*pos)++;
+    }
+    return *pos <= RGROUP_MAX ? (void *)(uintptr_t)(*pos + 1) : NULL;
+}
+
+static void *rgroups_start(seq_file_t *m, uint64_t *pos) {
+    return rgroups_record(m, pos);
+}
+
+static void *rgroups_next(seq_file_t *m, void *v, uint64_t *pos) {
+    (void)v;
+    (*pos)++;
+    return rgroups_record(m, pos);
+}
+
+static void rgroups_show(seq_file_t *m, void *v) {
+    uint64_t rec = (uint64_t)(uintptr_t)v - 1;
+
+    if (rec == 0) {
+        seq_puts(m, " id name             procs  quota_us period_us    usage_us  periods"
+                    " throttled throttled_us   mem_kb limit_kb  peak_kb failcnt\n");
+        return;
+    }
+
+    const rgroup_t *group = rgroup_get((int)rec - 1);
+    seq_put_dec(m, (uint64_t)group->id, 3);
+    seq_putc(m, ' ');
+    seq_put_col(m, group->name, 16);
+    seq_put_dec(m, group->nr_procs, 6);
+    seq_put_dec(m, group->cpu_quota_us, 10);
+    seq_put_dec(m, group->cpu_period_us, 10);
+    seq_put_dec(m, group->cpu_usage_us, 12);
+    seq_put_dec(m, group->nr_periods, 9);
+    seq_put_dec(m, group->nr_throttled, 10);
+    seq_put_dec(m, group->throttled_us, 13);
+    seq_put_dec(m, group->mem_pages * PAGE_KB, 9);
+    seq_put_dec(m, group->mem_limit_pages * PAGE_KB, 9);
+    seq_put_dec(m, group->mem_peak_pages * PAGE_KB, 9);
+    seq_put_dec(m, group->mem_failcnt, 8);
+    seq_putc(m, '\n');
+}
+
+/* ------------------------------------------------------------------ */
+/* boottime, bootlog                                                  */
+/* ------------------------------------------------------------------ */
+
+/* Records (kept in v as pos + 1): 0 the header, then 1 + index for each stage */
+static void *boottime_record(seq_file_t *m, uint64_t *pos) {
+    (void)m;
+    return (*pos == 0 || bootstage_get((uint32_t)*pos - 1)) ? (void *)(uintptr_t)(*pos + 1) : NULL;
+}
+
+static void *boottime_start(seq_file_t *m, uint64_t *pos) {
+    return boottime_record(m, pos);
+}
+
+static void *boottime_next(seq_file_t *m, void *v, uint64_t *pos) {
+    (void)v;
+    (*pos)++;
+    return boottime_record(m, pos);
+}
+
+static void boottime_show(seq_file_t *m, void *v) {
+    uint64_t rec = (uint64_t)(uintptr_t)v - 1;
+
+    if (rec == 0) {
+        seq_puts(m, "stage          start_us     end_us    took_us  cpu\n");
+        return;
+    }
+
+    const bootstage_t *stage = bootstage_get((uint32_t)rec - 1);
+    seq_put_col(m, stage->name, 12);
+    seq_put_dec(m, stage->start_us, 11);
+    seq_put_dec(m, stage->end_us, 11);
+    seq_put_dec(m, stage->end_us - stage->start_us, 11);
+    seq_put_dec(m, (uint64_t)stage->cpu, 5);
+    seq_putc(m, '\n');
+}
+
+static void bootlog_show(seq_file_t *m, void *v) {
+    (void)v;
+    uint32_t len;
+    const char *log = bootstage_log(&len);
+    for (uint32_t i = 0; i < len && !seq_full(m); i++) {
+        seq_putc(m, log[i]);
+    }
+}
+
+static const seq_operations_t meminfo_ops = { NULL, NULL, meminfo_show };
+static const seq_operations_t interrupts_ops = { interrupts_start, interrupts_next, interrupts_show };
+static const seq_operations_t blkstat_ops = { NULL, NULL, blkstat_show };
+static const seq_operations_t cachestat_ops = { NULL, NULL, cachestat_show };
+static const seq_operations_t sched_ops = { sched_start, sched_next, sched_show };
+static const seq_operations_t syscalls_ops = { syscalls_start, syscalls_next, syscalls_show };
+static const seq_operations_t lockstat_ops = { lockstat_start, lockstat_next, lockstat_show };
+static const seq_operations_t schedlat_ops = { schedlat_start, schedlat_next, schedlat_show };
+static const seq_operations_t rgroups_ops = { rgroups_start, rgroups_next, rgroups_show };
+static const seq_operations_t boottime_ops = { boottime_start, boottime_next, boottime_show };
+static const seq_operations_t bootlog_ops = { NULL, NULL, bootlog_show };
+
+/**
+ * Register the system files
+ */
+void procfs_register_stats(void) {
+    procfs_create("meminfo", &meminfo_ops, NULL);
+    procfs_create("interrupts", &interrupts_ops, NULL);
+    procfs_create("blkstat", &blkstat_ops, NULL);
+    procfs_create("cachestat", &cachestat_ops, NULL);
+    procfs_create("sched", &sched_ops, NULL);
+    procfs_create("syscalls", &syscalls_ops, NULL);
+    procfs_create("lockstat", &lockstat_ops, NULL);
+    procfs_create("schedlat", &schedlat_ops, NULL);
+    procfs_create("rgroups", &rgroups_ops, NULL);
+    procfs_create("boottime", &boottime_ops, NULL);
+    procfs_create("bootlog", &bootlog_ops, NULL);
+}
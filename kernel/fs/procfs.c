@@ -0,0 +1,536 @@
+/*
+ * procfs.c - Process and system information filesystem
+ *
+ * The root and the files registered with procfs_create() are permanent.
+ * Every other node is allocated by the lookup that finds it, remembers
+ * which process (by pid) and which file it stands for, and is freed by
+ * release; a read looks the process up again, so a node outliving its
+ * process never touches a reused slot.
+ *
+ * Files are rendered by seq_read() on each read, from the first record
+ * to the end of the read's range, so a reader taking small pieces sees
+ * one consistent text only if nothing changed in between, as with
+ * Linux's /proc.
+ *
+ * Root iterate cursor: 0 ".", 1 "..", 2 "self", then PROCFS_FIRST_FILE
+ * plus the registered file's index, then PROCFS_FIRST_SLOT plus the
+ * process table slot, so listing resumes correctly however it is split
+ * up. A pid directory's cursor is 2 plus the index in procfs_pid_files.
+ */
+
+#include "../../include/fs/procfs.h"
+#include "../../include/fs/ext2.h"
+#include "../../include/kernel/process.h"
+#include "../../include/kernel/syscall.h"
+#include "../../include/kernel/acct.h"
+#include "../../include/kernel/rgroup.h"
+#include "../../include/mm/kmalloc.h"
+#include "../../include/kernel/errno.h"
+#include "../../include/kernel/kstring.h"
+#include <stddef.h>
+
+/* Inode numbers: registered files from 2, then 8 per pid (the directory,
+ * then its files) */
+#define PROCFS_FILE_INO(index) (2 + (uint32_t)(index))
+#define PROCFS_PID_INO(pid, kind) ((((uint32_t)(pid) + 3) << 3) | (uint32_t)(kind))
+
+/* Root cursor positions */
+#define PROCFS_FIRST_FILE 3
+#define PROCFS_FIRST_SLOT (PROCFS_FIRST_FILE + PROCFS_MAX_FILES)
+
+/* Modes: directories r-xr-xr-x, files r--r--r-- */
+#define PROCFS_DIR_MODE  0555
+#define PROCFS_FILE_MODE 0444
+
+/**
+ * Node and what it stands for, allocated together
+ */
+typedef struct procfs_node {
+    vfs_node_t node;
+    pid_t pid;                         /* Process shown, or -1 for system files */
+    const seq_operations_t *ops;       /* Records (NULL for directories) */
+    void *data;                        /* seq_file_t::private of system files */
+} procfs_node_t;
+
+static int procfs_read(vfs_node_t *node, uint64_t offset, void *buffer, uint32_t size);
+static vfs_node_t *procfs_lookup(vfs_node_t *dir, const char *name);
+static int procfs_iterate(vfs_node_t *dir, uint32_t *pos, vfs_filldir_t fill, void *ctx);
+static void procfs_release(vfs_node_t *node);
+
+static vfs_ops_t procfs_ops = {
+    .read = procfs_read,
+    .write = NULL,
+    .open = NULL,
+    .close = NULL,
+    .lookup = procfs_lookup,
+    .iterate = procfs_iterate,
+    .create = NULL,                    /* Read-only */
+    .mkdir = NULL,
+    .unlink = NULL,
+    .rmdir = NULL,
+    .release = procfs_release,
+    .write_inode = NULL,
+};
+
+/* The one procfs (set up on first use) */
+static vfs_filesystem_t g_procfs;
+static vfs_node_t g_procfs_root;
+static int g_procfs_ready = 0;
+
+/* Registered root files, in registration order */
+static procfs_node_t *g_procfs_files[PROCFS_MAX_FILES];
+static uint32_t g_procfs_nfiles = 0;
+
+static const char *procfs_state_names[] = {
+    "unused", "embryo", "ready", "running", "sleeping", "stopped", "zombie",
+};
+
+/* ------------------------------------------------------------------ */
+/* Per-process files (seq_file_t::private is the process)             */
+/* ------------------------------------------------------------------ */
+
+static const char *procfs_state_name(struct process *proc) {
+    return proc->state <= PROC_ZOMBIE ? procfs_state_names[proc->state] : "?";
+}
+
+static void stat_show(seq_file_t *m, void *v) {
+    (void)v;
+    struct process *proc = (struct process *)m->private;
+    struct process *mm = proc->group_leader;   /* Memory is the process's */
+    seq_put_field(m, "pid", (uint64_t)proc->pid);
+    seq_puts(m, "name ");
+    seq_puts(m, proc->name);
+    seq_puts(m, "\nstate ");
+    seq_puts(m, procfs_state_name(proc));
+    seq_putc(m, '\n');
+    seq_put_field(m, "ppid", mm->parent ? (uint64_t)mm->parent->pid : 0);
+    seq_put_field(m, "utime_us", proc->acct.utime_us);
+    seq_put_field(m, "stime_us", proc->acct.stime_us);
+    seq_put_field(m, "nvcsw", proc->acct.nvcsw);
+    seq_put_field(m, "nivcsw", proc->acct.nivcsw);
+    seq_put_field(m, "syscalls", proc->acct.syscalls);
+    seq_put_field(m, "syscall_us", proc->acct.syscall_us);
+    seq_put_field(m, "io_read_bytes", proc->acct.io_read_bytes);
+    seq_put_field(m, "io_write_bytes", proc->acct.io_write_bytes);
+    seq_put_field(m, "io_wait_us", proc->acct.io_wait_us);
+    seq_put_field(m, "minor_faults", mm->minor_faults);
+    seq_put_field(m, "major_faults", mm->major_faults);
+    seq_put_field(m, "rss_pages", mm->rss_pages);
+    seq_put_field(m, "peak_rss_pages", mm->peak_rss_pages);
+}
+
+/* "key N\n", or "key -\n" when n is negative */
+static void put_field_signed(seq_file_t *m, const char *key, int64_t n) {
+    seq_puts(m, key);
+    seq_putc(m, ' ');
+    if (n >= 0) {
+        seq_put_dec(m, (uint64_t)n, 0);
+    } else {
+        seq_putc(m, '-');
+    }
+    seq_putc(m, '\n');
+}
+
+static void status_show(seq_file_t *m, void *v) {
+    (void)v;
+    struct process *proc = (struct process *)m->private;
+    struct process *mm = proc->group_leader;   /* Memory is the process's */
+    seq_puts(m, "name ");
+    seq_puts(m, proc->name);
+    seq_puts(m, "\nstate ");
+    seq_puts(m, procfs_state_name(proc));
+    seq_putc(m, '\n');
+    seq_put_field(m, "pid", (uint64_t)proc->pid);
+    seq_put_field(m, "tgid", (uint64_t)process_tgid(proc));
+    seq_put_field(m, "threads", mm->nr_threads);
+    seq_put_field(m, "ppid", mm->parent ? (uint64_t)mm->parent->pid : 0);
+    seq_put_field(m, "pgid", (uint64_t)proc->pgid);
+    seq_put_field(m, "sid", (uint64_t)proc->sid);
+    seq_put_field(m, "uid", proc->uid);
+    seq_put_field(m, "euid", proc->euid);
+    seq_put_field(m, "gid", proc->gid);
+    seq_put_field(m, "egid", proc->egid);
+    put_field_signed(m, "tty", proc->controlling_tty);
+    put_field_signed(m, "rgroup", proc->rgroup ? proc->rgroup->id : -1);
+    seq_put_field(m, "priority", proc->priority);
+    seq_put_field(m, "base_priority", proc->base_priority);
+    seq_put_field(m, "vruntime_us", proc->vruntime);
+    put_field_signed(m, "last_cpu", proc->last_cpu);
+    seq_put_field(m, "cpu_ticks", proc->cpu_time);
+    seq_put_field(m, "rss_kb", mm->rss_pages * (PAGE_SIZE / 1024));
+    seq_put_field(m, "peak_rss_kb", mm->peak_rss_pages * (PAGE_SIZE / 1024));
+    seq_put_field(m, "page_table_pages", mm->pt_pages);
+    seq_put_field(m, "heap_kb", (mm->heap_end - mm->heap_start) / 1024);
+    seq_put_field(m, "pending_signals", proc->pending_signals);
+    seq_put_field(m, "blocked_signals", proc->blocked_signals);
+}
+
+/* Records (kept in v as pos + 1): 0 the header, 1 + nr each syscall the
+ * process made, then the histogram */
+#define PID_SYSCALLS_HIST ((uint64_t)SYSCALL_COUNT + 1)
+
+static void *pid_syscalls_record(seq_file_t *m, uint64_t *pos) {
+    struct process *proc = (struct process *)m->private;
+    const acct_syscall_t *sys = proc->acct.sys;
+    while (*pos > 0 && *pos < PID_SYSCALLS_HIST &&
+           !(sys && sys[*pos - 1].count > 0 && syscall_lookup(*pos - 1))) {
+        (*pos)++;
+    }
+    return *pos <= PID_SYSCALLS_HIST ? (void *)(uintptr_t)(*pos + 1) : NULL;
+}
+
+static void *pid_syscalls_start(seq_file_t *m, uint64_t *pos) {
+    return pid_syscalls_record(m, pos);
+}
+
+static void *pid_syscalls_next(seq_file_t *m, void *v, uint64_t *pos) {
+    (void)v;
+    (*pos)++;
+    return pid_syscalls_record(m, pos);
+}
+
+static void pid_syscalls_show(seq_file_t *m, void *v) {
+    struct process *proc = (struct process *)m->private;
+    uint64_t rec = (uint64_t)(uintptr_t)v - 1;
+
+    if (rec == 0) {
+        seq_puts(m, "syscall          calls   total_us     avg_us\n");
+    } else if (rec == PID_SYSCALLS_HIST) {
+        const uint64_t *hist = proc->acct.syscall_hist;
+        int last = ACCT_HIST_BUCKETS - 1;
+        while (last > 0 && hist[last] == 0) {
+            last--;
+        }
+        seq_puts(m, "\n      usecs      calls\n");
+        for (int b = 0; b <= last; b++) {
+            uint64_t low = b == 0 ? 0 : (uint64_t)1 << (b - 1);
+            seq_put_dec(m, low, 11);
+            seq_putc(m, b == ACCT_HIST_BUCKETS - 1 ? '+' : ' ');
+            seq_put_dec(m, hist[b], 10);
+            seq_putc(m, '\n');
+        }
+    } else {
+        const acct_syscall_t *sys = &proc->acct.sys[rec - 1];
+        seq_put_col(m, syscall_lookup(rec - 1)->name, 12);
+        seq_put_dec(m, sys->count, 10);
+        seq_put_dec(m, sys->total_us, 11);
+        seq_put_dec(m, sys->total_us / sys->count, 11);
+        seq_putc(m, '\n');
+    }
+}
+
+static const seq_operations_t stat_ops = { NULL, NULL, stat_show };
+static const seq_operations_t status_ops = { NULL, NULL, status_show };
+static const seq_operations_t pid_syscalls_ops = {
+    pid_syscalls_start, pid_syscalls_next, pid_syscalls_show,
+};
+
+/* Files of a pid directory (inode kind = index + 1) */
+static const struct {
+    const char *name;
+    const seq_operations_t *ops;
+} procfs_pid_files[] = {
+    { "stat", &stat_ops },
+    { "status", &status_ops },
+    { "syscalls", &pid_syscalls_ops },
+};
+
+#define PROCFS_PID_NFILES ((uint32_t)(sizeof(procfs_pid_files) / sizeof(procfs_pid_files[0])))
+
+/* ------------------------------------------------------------------ */
+/* Nodes                                                              */
+/* ------------------------------------------------------------------ */
+
+/**
+ * Set up the filesystem, its root directory and the system files
+ */
+static void procfs_setup(void) {
+    if (g_procfs_ready) {
+        return;
+    }
+
+    kmemset(&g_procfs, 0, sizeof(g_procfs));
+    kstrcpy(g_procfs.name, "procfs");
+    g_procfs.ops = &procfs_ops;
+    g_procfs.root = &g_procfs_root;
+    g_procfs.flags = VFS_FS_RDONLY | VFS_FS_NOCACHE;
+
+    kmemset(&g_procfs_root, 0, sizeof(g_procfs_root));
+    kstrcpy(g_procfs_root.name, "/");
+    g_procfs_root.inode = PROCFS_ROOT_INO;
+    g_procfs_root.type = VFS_TYPE_DIRECTORY;
+    g_procfs_root.mode = EXT2_S_IFDIR | PROCFS_DIR_MODE;
+    g_procfs_root.fs = &g_procfs;
+    g_procfs_root.ops = &procfs_ops;
+    g_procfs_root.refcount = 1;        /* Held by the filesystem */
+    g_procfs_ready = 1;
+
+    procfs_register_stats();
+}
+
+/**
+ * Make a node (the reference is the caller's)
+ */
+static procfs_node_t *procfs_new_node(const char *name, uint32_t inode, pid_t pid,
+                                      const seq_operations_t *ops) {
+    procfs_node_t *pn = (procfs_node_t *)kmalloc(sizeof(procfs_node_t));
+    if (!pn) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+    kmemset(pn, 0, sizeof(*pn));
+    pn->pid = pid;
+    pn->ops = ops;
+
+    vfs_node_t *node = &pn->node;
+    kstrncpy(node->name, name, sizeof(node->name) - 1);
+    if (ops) {
+        node->type = VFS_TYPE_PROC;
+        node->mode = EXT2_S_IFREG | PROCFS_FILE_MODE;
+    } else {
+        node->type = VFS_TYPE_DIRECTORY;
+        node->mode = EXT2_S_IFDIR | PROCFS_DIR_MODE;
+    }
+    node->inode = inode;
+    node->fs = &g_procfs;
+    node->fs_data = pn;
+    node->ops = &procfs_ops;
+    node->refcount = 1;
+    clear_errno();
+    return pn;
+}
+
+/**
+ * Make a node for a pid directory (kind 0) or one of its files
+ */
+static vfs_node_t *procfs_new_pid_node(const char *name, struct process *proc, uint32_t kind) {
+    const seq_operations_t *ops = kind ? procfs_pid_files[kind - 1].ops : NULL;
+    procfs_node_t *pn = procfs_new_node(name, PROCFS_PID_INO(proc->pid, kind), proc->pid, ops);
+    if (!pn) {
+        /* errno already set by procfs_new_node */
+        return NULL;
+    }
+    pn->node.uid = proc->uid;
+    pn->node.gid = proc->gid;
+    return &pn->node;
+}
+
+/**
+ * Compare two names
+ */
+static int procfs_name_is(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+/**
+ * Add a file to /proc
+ */
+vfs_node_t *procfs_create(const char *name, const seq_operations_t *ops, void *data) {
+    if (!name || !ops || !ops->show || (ops->start && !ops->next)) {
+        RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+    }
+    size_t len = kstrlen(name);
+    if (len == 0 || len >= sizeof(g_procfs_root.name)) {
+        RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (name[i] == '/') {
+            RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+        }
+    }
+
+    procfs_setup();
+    // "self" and numbers are process directories
+    if (procfs_name_is(name, "self") || (name[0] >= '0' && name[0] <= '9')) {
+        RETURN_ERRNO_NULL(THUNDEROS_EEXIST);
+    }
+    for (uint32_t i = 0; i < g_procfs_nfiles; i++) {
+        if (procfs_name_is(name, g_procfs_files[i]->node.name)) {
+            RETURN_ERRNO_NULL(THUNDEROS_EEXIST);
+        }
+    }
+    if (g_procfs_nfiles == PROCFS_MAX_FILES) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOSPC);
+    }
+
+    procfs_node_t *pn = procfs_new_node(name, PROCFS_FILE_INO(g_procfs_nfiles), -1, ops);
+    if (!pn) {
+        /* errno already set by procfs_new_node */
+        return NULL;
+    }
+    pn->data = data;
+    g_procfs_files[g_procfs_nfiles++] = pn;  /* Its reference, held for good */
+    clear_errno();
+    return &pn->node;
+}
+
+/**
+ * Parse a pid directory name, or return -1
+ */
+static pid_t procfs_parse_pid(const char *name) {
+    if (!name[0]) {
+        return -1;
+    }
+    int64_t pid = 0;
+    for (const char *c = name; *c; c++) {
+        if (*c < '0' || *c > '9' || pid > 0x7FFFFFFF / 10) {
+            return -1;
+        }
+        pid = pid * 10 + (*c - '0');
+    }
+    return (pid_t)pid;
+}
+
+/**
+ * The live process a node shows, or NULL (errno ESRCH)
+ */
+static struct process *procfs_process(procfs_node_t *pn) {
+    struct process *proc = process_get(pn->pid);
+    if (!proc || proc->state == PROC_UNUSED) {
+        RETURN_ERRNO_NULL(THUNDEROS_ESRCH);
+    }
+    return proc;
+}
+
+static vfs_node_t *procfs_lookup(vfs_node_t *dir, const char *name) {
+    if (!dir || !name || dir->type != VFS_TYPE_DIRECTORY) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOTDIR);
+    }
+
+    if (dir == &g_procfs_root) {
+        for (uint32_t i = 0; i < g_procfs_nfiles; i++) {
+            if (procfs_name_is(name, g_procfs_files[i]->node.name)) {
+                vfs_node_get(&g_procfs_files[i]->node);
+                clear_errno();
+                return &g_procfs_files[i]->node;
+            }
+        }
+        struct process *proc;
+        if (procfs_name_is(name, "self")) {
+            proc = process_current();
+        } else {
+            pid_t pid = procfs_parse_pid(name);
+            proc = pid < 0 ? NULL : process_get(pid);
+        }
+        if (!proc || proc->state == PROC_UNUSED) {
+            RETURN_ERRNO_NULL(THUNDEROS_ENOENT);
+        }
+        return procfs_new_pid_node(name, proc, 0);
+    }
+
+    struct process *proc = procfs_process((procfs_node_t *)dir->fs_data);
+    if (!proc) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOENT);
+    }
+    for (uint32_t i = 0; i < PROCFS_PID_NFILES; i++) {
+        if (procfs_name_is(name, procfs_pid_files[i].name)) {
+            return procfs_new_pid_node(name, proc, i + 1);
+        }
+    }
+    RETURN_ERRNO_NULL(THUNDEROS_ENOENT);
+}
+
+/**
+ * Pass entries on from *pos, as devfs does (see the cursor layout above)
+ */
+static int procfs_iterate(vfs_node_t *dir, uint32_t *pos, vfs_filldir_t fill, void *ctx) {
+    if (!dir || !pos || !fill) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (dir->type != VFS_TYPE_DIRECTORY) {
+        RETURN_ERRNO(THUNDEROS_ENOTDIR);
+    }
+
+    static const char *dots[] = { ".", ".." };
+    while (*pos < 2) {
+        uint32_t ino = *pos == 0 ? dir->inode : PROCFS_ROOT_INO;
+        if (fill(ctx, dots[*pos], *pos + 1, ino) != 0) {
+            goto done;
+        }
+        (*pos)++;
+    }
+
+    if (dir != &g_procfs_root) {
+        procfs_node_t *pn = (procfs_node_t *)dir->fs_data;
+        while (*pos < 2 + PROCFS_PID_NFILES) {
+            uint32_t i = *pos - 2;
+            const char *name = procfs_pid_files[i].name;
+            if (fill(ctx, name, (uint32_t)kstrlen(name), PROCFS_PID_INO(pn->pid, i + 1)) != 0) {
+                goto done;
+            }
+            (*pos)++;
+        }
+        goto done;
+    }
+
+    if (*pos == 2) {
+        struct process *self = process_current();
+        if (self && fill(ctx, "self", 4, PROCFS_PID_INO(self->pid, 0)) != 0) {
+            goto done;
+        }
+        *pos = PROCFS_FIRST_FILE;
+    }
+    while (*pos < PROCFS_FIRST_SLOT) {
+        uint32_t i = *pos - PROCFS_FIRST_FILE;
+        if (i < g_procfs_nfiles) {
+            vfs_node_t *node = &g_procfs_files[i]->node;
+            if (fill(ctx, node->name, (uint32_t)kstrlen(node->name), node->inode) != 0) {
+                goto done;
+            }
+        }
+        (*pos)++;
+    }
+    for (int slot = (int)(*pos - PROCFS_FIRST_SLOT); slot < process_get_max_count(); slot++) {
+        struct process *proc = process_get_by_index(slot);
+        if (proc && proc->pid >= 0) {
+            char name[12];
+            seq_file_t out = { .buf = name, .size = sizeof(name) - 1 };
+            seq_put_dec(&out, (uint64_t)proc->pid, 0);
+            name[out.len] = '\0';
+            if (fill(ctx, name, out.len, PROCFS_PID_INO(proc->pid, 0)) != 0) {
+                break;
+            }
+        }
+        *pos = PROCFS_FIRST_SLOT + (uint32_t)slot + 1;
+    }
+done:
+    clear_errno();
+    return 0;
+}
+
+static int procfs_read(vfs_node_t *node, uint64_t offset, void *buffer, uint32_t size) {
+    if (!node) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (node->type != VFS_TYPE_PROC) {
+        RETURN_ERRNO(THUNDEROS_EISDIR);
+    }
+
+    procfs_node_t *pn = (procfs_node_t *)node->fs_data;
+    if (pn->pid < 0) {
+        return seq_read(pn->ops, pn->data, offset, buffer, size);
+    }
+    struct process *proc = procfs_process(pn);
+    if (!proc) {
+        /* errno already set by procfs_process */
+        return -1;
+    }
+    return seq_read(pn->ops, proc, offset, buffer, size);
+}
+
+static void procfs_release(vfs_node_t *node) {
+    /* Only pid nodes ever lose their last reference */
+    kfree(node->fs_data);
+}
+
+/**
+ * Get the process filesystem
+ */
+vfs_filesystem_t *procfs_mount(void) {
+    procfs_setup();
+    clear_errno();
+    return &g_procfs;
+}
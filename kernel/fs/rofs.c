@@ -0,0 +1,557 @@
+/*
+ * rofs.c - Compressed read-only image filesystem
+ *
+ * The metadata region stays in memory for as long as the filesystem is
+ * mounted and nodes point straight into it. It is checked once at mount
+ * (every inode's entries and blocks in range, every name terminated), so
+ * the operations below trust it.
+ *
+ * Reading a block goes through one pair of buffers per filesystem, under
+ * its mutex: the sectors holding the stored block, and the block once
+ * decompressed, which stays until another block is wanted.
+ */
+
+#include "../../include/fs/rofs.h"
+#include "../../include/fs/ext2.h"
+#include "../../include/fs/icache.h"
+#include "../../include/drivers/virtio_blk.h"
+#include "../../include/mm/kmalloc.h"
+#include "../../include/mm/slab.h"
+#include "../../include/kernel/errno.h"
+#include "../../include/kernel/kstring.h"
+#include "../../include/kernel/lz4.h"
+#include "../../include/kernel/mutex.h"
+#include <stddef.h>
+
+/* Most sectors read with one request */
+#define ROFS_IO_SECTORS 128
+
+/* Position of the first entry after "." and ".." */
+#define ROFS_FIRST_POS 2
+
+/**
+ * One mounted image (fs->fs_data)
+ */
+typedef struct {
+    rofs_super_t super;
+    uint8_t *meta;                     /* Superblock to the end of the names */
+    const rofs_inode_t *inodes;        /* Indexed by inode number less ROFS_ROOT_INO */
+    const rofs_dirent_t *dirents;
+    const rofs_block_t *blocks;
+    const char *names;
+    mutex_t lock;                      /* Guards the buffers below */
+    uint8_t *io;                       /* Sectors holding one stored block */
+    uint8_t *cache;                    /* Last block decompressed */
+    uint32_t cache_inode;              /* Its inode (0: nothing cached) */
+    uint32_t cache_index;              /* Its index in the file */
+} rofs_fs_t;
+
+static int rofs_read(vfs_node_t *node, uint64_t offset, void *buffer, uint32_t size);
+static int rofs_write(vfs_node_t *node, uint64_t offset, const void *buffer, uint32_t size);
+static vfs_node_t *rofs_lookup(vfs_node_t *dir, const char *name);
+static int rofs_iterate(vfs_node_t *dir, uint32_t *pos, vfs_filldir_t fill, void *ctx);
+static int rofs_create(vfs_node_t *dir, const char *name, uint32_t mode);
+static int rofs_mkdir(vfs_node_t *dir, const char *name, uint32_t mode);
+static int rofs_unlink(vfs_node_t *dir, const char *name);
+static int rofs_rmdir(vfs_node_t *dir, const char *name);
+static void rofs_release(vfs_node_t *node);
+
+static vfs_ops_t rofs_ops = {
+    .read = rofs_read,
+    .write = rofs_write,
+    .open = NULL,
+    .close = NULL,
+    .lookup = rofs_lookup,
+    .iterate = rofs_iterate,
+    .create = rofs_create,
+    .mkdir = rofs_mkdir,
+    .unlink = rofs_unlink,
+    .rmdir = rofs_rmdir,
+    .release = rofs_release,
+    .write_inode = NULL,               /* Metadata never changes */
+    .sync = NULL,                      /* Nothing is ever written */
+};
+
+/* Nodes of every rofs (created on first mount) */
+static kmem_cache_t *rofs_node_cache = NULL;
+
+static inline rofs_fs_t *rofs_fs(vfs_node_t *node) {
+    return (rofs_fs_t *)node->fs->fs_data;
+}
+
+static inline const rofs_inode_t *rofs_inode(vfs_node_t *node) {
+    return (const rofs_inode_t *)node->fs_data;
+}
+
+/**
+ * Blocks a file of this many bytes takes
+ */
+static uint64_t rofs_blocks_in(const rofs_fs_t *rfs, uint64_t size) {
+    return (size + rfs->super.block_size - 1) / rfs->super.block_size;
+}
+
+/**
+ * Read sectors, in requests of at most ROFS_IO_SECTORS
+ */
+static int rofs_read_sectors(uint64_t sector, uint8_t *buffer, uint32_t count) {
+    while (count > 0) {
+        uint32_t n = count > ROFS_IO_SECTORS ? ROFS_IO_SECTORS : count;
+        if (virtio_blk_read(sector, buffer, n) != (int)n) {
+            RETURN_ERRNO(THUNDEROS_EIO);
+        }
+        sector += n;
+        buffer += (size_t)n * VIRTIO_BLK_SECTOR_SIZE;
+        count -= n;
+    }
+    return 0;
+}
+
+/**
+ * Get the node for an inode, from the inode cache or newly built
+ */
+static vfs_node_t *rofs_node(vfs_filesystem_t *fs, uint32_t ino, const char *name) {
+    vfs_node_t *cached = icache_find(fs, ino);
+    if (cached) {
+        return cached;
+    }
+
+    vfs_node_t *node = (vfs_node_t *)kmem_cache_alloc(rofs_node_cache);
+    if (!node) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+    kmemset(node, 0, sizeof(*node));
+
+    rofs_fs_t *rfs = (rofs_fs_t *)fs->fs_data;
+    const rofs_inode_t *inode = &rfs->inodes[ino - ROFS_ROOT_INO];
+    kstrncpy(node->name, name, sizeof(node->name) - 1);
+    node->inode = ino;
+    node->mode = inode->mode;
+    node->uid = inode->uid;
+    node->gid = inode->gid;
+    if ((inode->mode & EXT2_S_IFMT) == EXT2_S_IFDIR) {
+        node->type = VFS_TYPE_DIRECTORY;
+        node->size = inode->size * sizeof(rofs_dirent_t);
+    } else {
+        node->type = VFS_TYPE_FILE;
+        node->size = inode->size;
+    }
+    node->fs = fs;
+    node->fs_data = (void *)inode;
+    node->ops = &rofs_ops;
+    node->refcount = 1;
+    icache_insert(node);
+    return node;
+}
+
+/**
+ * Get one block of a file, decompressed, into rfs->cache
+ *
+ * Called with rfs->lock held.
+ */
+static int rofs_load_block(rofs_fs_t *rfs, vfs_node_t *node, uint32_t index) {
+    if (rfs->cache_inode == node->inode && rfs->cache_index == index) {
+        return 0;
+    }
+
+    const rofs_inode_t *inode = rofs_inode(node);
+    const rofs_block_t *block = &rfs->blocks[inode->start + index];
+    uint32_t block_size = rfs->super.block_size;
+    uint64_t start = (uint64_t)index * block_size;
+    uint32_t want = inode->size - start < block_size ? (uint32_t)(inode->size - start)
+                                                      : block_size;
+    uint32_t stored = block->length & ROFS_BLOCK_LEN_MASK;
+
+    /* Nothing cached while the buffer is being refilled */
+    rfs->cache_inode = 0;
+
+    if (stored == 0) {
+        kmemset(rfs->cache, 0, want);
+    } else {
+        uint64_t first = block->offset / VIRTIO_BLK_SECTOR_SIZE;
+        uint64_t end = (uint64_t)block->offset + stored;
+        uint32_t count = (uint32_t)((end + VIRTIO_BLK_SECTOR_SIZE - 1) / VIRTIO_BLK_SECTOR_SIZE - first);
+        if (rofs_read_sectors(first, rfs->io, count) != 0) {
+            /* errno already set by rofs_read_sectors */
+            return -1;
+        }
+        const uint8_t *data = rfs->io + block->offset % VIRTIO_BLK_SECTOR_SIZE;
+
+        if (block->length & ROFS_BLOCK_RAW) {
+            if (stored != want) {
+                RETURN_ERRNO(THUNDEROS_EFS_CORRUPT);
+            }
+            kmemcpy(rfs->cache, data, want);
+        } else if (lz4_decompress(data, stored, rfs->cache, block_size) != (int)want) {
+            RETURN_ERRNO(THUNDEROS_EFS_CORRUPT);
+        }
+    }
+
+    rfs->cache_inode = node->inode;
+    rfs->cache_index = index;
+    return 0;
+}
+
+/**
+ * Read a file: the page cache asks for one page at a time, which never
+ * spans more than one block
+ */
+static int rofs_read(vfs_node_t *node, uint64_t offset, void *buffer, uint32_t size) {
+    if (node->type != VFS_TYPE_FILE) {
+        RETURN_ERRNO(THUNDEROS_EISDIR);
+    }
+    if (offset >= node->size) {
+        clear_errno();
+        return 0;
+    }
+    if (size > node->size - offset) {
+        size = (uint32_t)(node->size - offset);
+    }
+
+    rofs_fs_t *rfs = rofs_fs(node);
+    uint32_t block_size = rfs->super.block_size;
+    uint8_t *out = (uint8_t *)buffer;
+    uint32_t done = 0;
+
+    mutex_lock(&rfs->lock);
+    while (done < size) {
+        uint64_t pos = offset + done;
+        uint32_t index = (uint32_t)(pos / block_size);
+        uint32_t in_block = (uint32_t)(pos % block_size);
+        uint32_t len = block_size - in_block;
+        if (len > size - done) {
+            len = size - done;
+        }
+        if (rofs_load_block(rfs, node, index) != 0) {
+            mutex_unlock(&rfs->lock);
+            /* errno already set by rofs_load_block */
+            return -1;
+        }
+        kmemcpy(out + done, rfs->cache + in_block, len);
+        done += len;
+    }
+    mutex_unlock(&rfs->lock);
+
+    clear_errno();
+    return (int)done;
+}
+
+static int rofs_write(vfs_node_t *node, uint64_t offset, const void *buffer, uint32_t size) {
+    (void)node;
+    (void)offset;
+    (void)buffer;
+    (void)size;
+    RETURN_ERRNO(THUNDEROS_EFS_RDONLY);
+}
+
+/**
+ * Compare a name with a directory entry's, bytewise
+ */
+static int rofs_name_cmp(const rofs_fs_t *rfs, const rofs_dirent_t *entry, const char *name) {
+    const uint8_t *a = (const uint8_t *)name;
+    const uint8_t *b = (const uint8_t *)(rfs->names + entry->name);
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return (int)*a - (int)*b;
+}
+
+static vfs_node_t *rofs_lookup(vfs_node_t *dir, const char *name) {
+    if (!dir || !name || dir->type != VFS_TYPE_DIRECTORY) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOTDIR);
+    }
+
+    /* Entries are sorted by name */
+    rofs_fs_t *rfs = rofs_fs(dir);
+    const rofs_inode_t *inode = rofs_inode(dir);
+    const rofs_dirent_t *entries = &rfs->dirents[inode->start];
+    uint32_t low = 0;
+    uint32_t high = (uint32_t)inode->size;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        int cmp = rofs_name_cmp(rfs, &entries[mid], name);
+        if (cmp == 0) {
+            vfs_node_t *node = rofs_node(dir->fs, entries[mid].inode, name);
+            if (!node) {
+                /* errno already set by rofs_node */
+                return NULL;
+            }
+            clear_errno();
+            return node;
+        }
+        if (cmp < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    RETURN_ERRNO_NULL(THUNDEROS_ENOENT);
+}
+
+static int rofs_iterate(vfs_node_t *dir, uint32_t *pos, vfs_filldir_t fill, void *ctx) {
+    if (!dir || !pos || !fill) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (dir->type != VFS_TYPE_DIRECTORY) {
+        RETURN_ERRNO(THUNDEROS_ENOTDIR);
+    }
+
+    rofs_fs_t *rfs = rofs_fs(dir);
+    const rofs_inode_t *inode = rofs_inode(dir);
+    if (*pos == 0) {
+        if (fill(ctx, ".", 1, dir->inode) != 0) {
+            goto done;
+        }
+        *pos = 1;
+    }
+    if (*pos == 1) {
+        if (fill(ctx, "..", 2, inode->parent) != 0) {
+            goto done;
+        }
+        *pos = ROFS_FIRST_POS;
+    }
+    while (*pos - ROFS_FIRST_POS < inode->size) {
+        const rofs_dirent_t *entry = &rfs->dirents[inode->start + *pos - ROFS_FIRST_POS];
+        if (fill(ctx, rfs->names + entry->name, entry->name_len, entry->inode) != 0) {
+            break;
+        }
+        (*pos)++;
+    }
+done:
+    clear_errno();
+    return 0;
+}
+
+static int rofs_create(vfs_node_t *dir, const char *name, uint32_t mode) {
+    (void)dir;
+    (void)name;
+    (void)mode;
+    RETURN_ERRNO(THUNDEROS_EFS_RDONLY);
+}
+
+static int rofs_mkdir(vfs_node_t *dir, const char *name, uint32_t mode) {
+    (void)dir;
+    (void)name;
+    (void)mode;
+    RETURN_ERRNO(THUNDEROS_EFS_RDONLY);
+}
+
+static int rofs_unlink(vfs_node_t *dir, const char *name) {
+    (void)dir;
+    (void)name;
+    RETURN_ERRNO(THUNDEROS_EFS_RDONLY);
+}
+
+static int rofs_rmdir(vfs_node_t *dir, const char *name) {
+    (void)dir;
+    (void)name;
+    RETURN_ERRNO(THUNDEROS_EFS_RDONLY);
+}
+
+/**
+ * Free a node with its last reference (its inode stays in the metadata)
+ */
+static void rofs_release(vfs_node_t *node) {
+    kmem_cache_free(rofs_node_cache, node);
+}
+
+/**
+ * Check the superblock of an image: is it one, and one we can read
+ */
+static int rofs_check_super(const rofs_super_t *super) {
+    if (super->magic != ROFS_MAGIC) {
+        RETURN_ERRNO(THUNDEROS_EFS_BADSUPER);
+    }
+    uint32_t block_size = super->block_size;
+    if (super->version != ROFS_VERSION ||
+        (super->compression != ROFS_COMP_NONE && super->compression != ROFS_COMP_LZ4) ||
+        block_size < ROFS_MIN_BLOCK_SIZE || block_size > ROFS_MAX_BLOCK_SIZE ||
+        (block_size & (block_size - 1)) != 0) {
+        RETURN_ERRNO(THUNDEROS_EFS_BADSUPER);
+    }
+
+    /* The regions must add up to the metadata size, and fit the device */
+    uint64_t meta = sizeof(rofs_super_t) +
+                    (uint64_t)super->inode_count * sizeof(rofs_inode_t) +
+                    (uint64_t)super->dirent_count * sizeof(rofs_dirent_t) +
+                    (uint64_t)super->block_count * sizeof(rofs_block_t) +
+                    super->names_size;
+    if (super->inode_count == 0 || meta != super->meta_size ||
+        super->image_size < super->meta_size ||
+        super->image_size > virtio_blk_get_capacity() * VIRTIO_BLK_SECTOR_SIZE) {
+        RETURN_ERRNO(THUNDEROS_EFS_CORRUPT);
+    }
+    return 0;
+}
+
+/**
+ * Check that everything the metadata points at is in range
+ */
+static int rofs_check_meta(const rofs_fs_t *rfs) {
+    const rofs_super_t *super = &rfs->super;
+    for (uint32_t i = 0; i < super->inode_count; i++) {
+        const rofs_inode_t *inode = &rfs->inodes[i];
+        uint32_t type = inode->mode & EXT2_S_IFMT;
+        uint64_t count;
+        uint64_t limit;
+        if (type == EXT2_S_IFDIR) {
+            if (inode->parent < ROFS_ROOT_INO || inode->parent > super->inode_count ||
+                (rfs->inodes[inode->parent - ROFS_ROOT_INO].mode & EXT2_S_IFMT) != EXT2_S_IFDIR) {
+                goto corrupt;
+            }
+            count = inode->size;
+            limit = super->dirent_count;
+        } else if (type == EXT2_S_IFREG) {
+            count = rofs_blocks_in(rfs, inode->size);
+            limit = super->block_count;
+        } else {
+            goto corrupt;
+        }
+        if (inode->start > limit || count > limit - inode->start) {
+            goto corrupt;
+        }
+    }
+    if ((rfs->inodes[0].mode & EXT2_S_IFMT) != EXT2_S_IFDIR) {
+        goto corrupt;
+    }
+
+    for (uint32_t i = 0; i < super->dirent_count; i++) {
+        const rofs_dirent_t *entry = &rfs->dirents[i];
+        if (entry->inode < ROFS_ROOT_INO || entry->inode > super->inode_count ||
+            entry->name_len == 0 || entry->name_len >= VFS_MAX_PATH ||
+            entry->name >= super->names_size ||
+            entry->name_len >= super->names_size - entry->name ||
+            rfs->names[entry->name + entry->name_len] != '\0' ||
+            (uint32_t)kstrlen(rfs->names + entry->name) != entry->name_len) {
+            goto corrupt;
+        }
+    }
+
+    for (uint32_t i = 0; i < super->block_count; i++) {
+        const rofs_block_t *block = &rfs->blocks[i];
+        uint32_t stored = block->length & ROFS_BLOCK_LEN_MASK;
+        if (stored == 0) {
+            /* A block of zeroes */
+            if (block->length != 0) {
+                goto corrupt;
+            }
+        } else if (stored > super->block_size || block->offset < super->meta_size ||
+                   (uint64_t)block->offset + stored > super->image_size ||
+                   (super->compression == ROFS_COMP_NONE && !(block->length & ROFS_BLOCK_RAW))) {
+            goto corrupt;
+        }
+    }
+    return 0;
+
+corrupt:
+    RETURN_ERRNO(THUNDEROS_EFS_CORRUPT);
+}
+
+/**
+ * Free a half-mounted image
+ */
+static void rofs_free(rofs_fs_t *rfs) {
+    kfree(rfs->meta);
+    kfree(rfs->io);
+    kfree(rfs->cache);
+    kfree(rfs);
+}
+
+/**
+ * Mount the rofs image on the block device
+ */
+vfs_filesystem_t *rofs_mount(void) {
+    if (!rofs_node_cache) {
+        rofs_node_cache = kmem_cache_create("rofs_node", sizeof(vfs_node_t), 0, NULL);
+        if (!rofs_node_cache) {
+            RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+        }
+    }
+
+    rofs_fs_t *rfs = (rofs_fs_t *)kmalloc(sizeof(rofs_fs_t));
+    if (!rfs) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+    kmemset(rfs, 0, sizeof(*rfs));
+    mutex_init(&rfs->lock);
+
+    /* The superblock says how much metadata to read */
+    uint8_t *sector = (uint8_t *)kmalloc(VIRTIO_BLK_SECTOR_SIZE);
+    if (!sector) {
+        rofs_free(rfs);
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+    if (rofs_read_sectors(0, sector, 1) != 0) {
+        kfree(sector);
+        rofs_free(rfs);
+        /* errno already set by rofs_read_sectors */
+        return NULL;
+    }
+    kmemcpy(&rfs->super, sector, sizeof(rofs_super_t));
+    kfree(sector);
+    if (rofs_check_super(&rfs->super) != 0) {
+        rofs_free(rfs);
+        /* errno already set by rofs_check_super */
+        return NULL;
+    }
+
+    /* All of it at once: nothing below reads metadata from the disk again */
+    const rofs_super_t *super = &rfs->super;
+    uint32_t meta_sectors = (super->meta_size + VIRTIO_BLK_SECTOR_SIZE - 1) / VIRTIO_BLK_SECTOR_SIZE;
+    rfs->meta = (uint8_t *)kmalloc((size_t)meta_sectors * VIRTIO_BLK_SECTOR_SIZE);
+    rfs->io = (uint8_t *)kmalloc(super->block_size + 2 * VIRTIO_BLK_SECTOR_SIZE);
+    rfs->cache = (uint8_t *)kmalloc(super->block_size);
+    if (!rfs->meta || !rfs->io || !rfs->cache) {
+        rofs_free(rfs);
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+    if (rofs_read_sectors(0, rfs->meta, meta_sectors) != 0) {
+        rofs_free(rfs);
+        /* errno already set by rofs_read_sectors */
+        return NULL;
+    }
+
+    uint8_t *p = rfs->meta + sizeof(rofs_super_t);
+    rfs->inodes = (const rofs_inode_t *)p;
+    p += (size_t)super->inode_count * sizeof(rofs_inode_t);
+    rfs->dirents = (const rofs_dirent_t *)p;
+    p += (size_t)super->dirent_count * sizeof(rofs_dirent_t);
+    rfs->blocks = (const rofs_block_t *)p;
+    p += (size_t)super->block_count * sizeof(rofs_block_t);
+    rfs->names = (const char *)p;
+    if (rofs_check_meta(rfs) != 0) {
+        rofs_free(rfs);
+        /* errno already set by rofs_check_meta */
+        return NULL;
+    }
+
+    vfs_filesystem_t *fs = (vfs_filesystem_t *)kmalloc(sizeof(vfs_filesystem_t));
+    if (!fs) {
+        rofs_free(rfs);
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+    kmemset(fs, 0, sizeof(*fs));
+    kstrcpy(fs->name, "rofs");
+    fs->fs_data = rfs;
+    fs->ops = &rofs_ops;
+    fs->max_file_size = 0;             /* Nothing grows */
+    fs->flags = VFS_FS_RDONLY;
+
+    /* Held by the filesystem */
+    fs->root = rofs_node(fs, ROFS_ROOT_INO, "/");
+    if (!fs->root) {
+        kfree(fs);
+        rofs_free(rfs);
+        /* errno already set by rofs_node */
+        return NULL;
+    }
+    clear_errno();
+    return fs;
+}
+
+/**
+ * Bytes the image takes on the device
+ */
+uint64_t rofs_image_size(vfs_filesystem_t *fs) {
+    return ((rofs_fs_t *)fs->fs_data)->super.image_size;
+}
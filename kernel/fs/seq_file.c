@@ -0,0 +1,138 @@
+/*
+ * seq_file.c - Text generated record by record
+ */
+
+#include "../../include/fs/seq_file.h"
+#include "../../include/kernel/errno.h"
+#include "../../include/kernel/kstring.h"
+#include <stddef.h>
+
+/**
+ * Render a file and copy out the part at offset
+ */
+int seq_read(const seq_operations_t *ops, void *private, uint64_t offset,
+             void *buffer, uint32_t size) {
+    if (!ops || !ops->show || (!buffer && size > 0)) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    seq_file_t m = {
+        .buf = (char *)buffer,
+        .size = size,
+        .len = 0,
+        .skip = offset,
+        .private = private,
+    };
+
+    if (!ops->start) {
+        ops->show(&m, SEQ_START_TOKEN);
+    } else {
+        uint64_t pos = 0;
+        for (void *v = ops->start(&m, &pos); v && !seq_full(&m);
+             v = ops->next(&m, v, &pos)) {
+            ops->show(&m, v);
+        }
+    }
+
+    clear_errno();
+    return (int)m.len;
+}
+
+void seq_putc(seq_file_t *m, char c) {
+    if (m->skip > 0) {
+        m->skip--;
+    } else if (m->len < m->size) {
+        m->buf[m->len++] = c;
+    }
+}
+
+void seq_puts(seq_file_t *m, const char *s) {
+    while (*s) {
+        seq_putc(m, *s++);
+    }
+}
+
+/**
+ * Decimal number, right-aligned in width columns
+ */
+void seq_put_dec(seq_file_t *m, uint64_t n, uint32_t width) {
+    char digits[20];
+    uint32_t i = 0;
+    do {
+        digits[i++] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n);
+    while (width > i) {
+        seq_putc(m, ' ');
+        width--;
+    }
+    while (i > 0) {
+        seq_putc(m, digits[--i]);
+    }
+}
+
+void seq_put_hex(seq_file_t *m, uint64_t n) {
+    int shift = 60;
+    while (shift > 0 && ((n >> shift) & 0xF) == 0) {
+        shift -= 4;
+    }
+    seq_puts(m, "0x");
+    for (; shift >= 0; shift -= 4) {
+        seq_putc(m, "0123456789abcdef"[(n >> shift) & 0xF]);
+    }
+}
+
+/**
+ * String, left-aligned in width columns
+ */
+void seq_put_col(seq_file_t *m, const char *s, uint32_t width) {
+    uint32_t len = (uint32_t)kstrlen(s);
+    seq_puts(m, s);
+    do {
+        seq_putc(m, ' ');
+    } while (++len < width);
+}
+
+void seq_put_field(seq_file_t *m, const char *key, uint64_t value) {
+    seq_puts(m, key);
+    seq_putc(m, ' ');
+    seq_put_dec(m, value, 0);
+    seq_putc(m, '\n');
+}
+
+/**
+ * Histogram line, up to the last bucket in use
+ */
+void seq_put_hist(seq_file_t *m, const char *label, const uint32_t *hist, uint32_t buckets) {
+    int last = (int)buckets - 1;
+    while (last >= 0 && hist[last] == 0) {
+        last--;
+    }
+    if (last < 0) {
+        return;
+    }
+    seq_puts(m, label);
+    for (int b = 0; b <= last; b++) {
+        seq_putc(m, ' ');
+        seq_put_dec(m, hist[b], 0);
+    }
+    seq_putc(m, '\n');
+}
+
+/**
+ * Percentage with one decimal, right-aligned in width columns
+ */
+void seq_put_ratio(seq_file_t *m, uint64_t part, uint64_t rest, uint32_t width) {
+    uint64_t total = part + rest;
+    if (total == 0) {
+        while (width-- > 1) {
+            seq_putc(m, ' ');
+        }
+        seq_putc(m, '-');
+        return;
+    }
+    uint64_t tenths = (part * 1000 + total / 2) / total;
+    seq_put_dec(m, tenths / 10, width > 2 ? width - 2 : 0);
+    seq_putc(m, '.');
+    seq_putc(m, (char)('0' + tenths % 10));
+}
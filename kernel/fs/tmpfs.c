@@ -0,0 +1,362 @@
+/*
+ * tmpfs.c - Memory filesystem
+ *
+ * A directory keeps its entries in a list in creation order. Every entry
+ * gets a position from its directory's counter when it is created, so an
+ * iterate cursor stays valid across removals: it resumes at the first
+ * entry at or after it. Positions 0 and 1 are "." and "..".
+ */
+
+#include "../../include/fs/tmpfs.h"
+#include "../../include/fs/ext2.h"
+#include "../../include/fs/page_cache.h"
+#include "../../include/mm/kmalloc.h"
+#include "../../include/mm/slab.h"
+#include "../../include/kernel/errno.h"
+#include "../../include/kernel/kstring.h"
+#include "../../include/kernel/process.h"
+#include <stddef.h>
+
+/* Position of the first entry after "." and ".." */
+#define TMPFS_FIRST_POS 2
+
+/**
+ * A node's tmpfs data (node->fs_data)
+ */
+typedef struct tmpfs_inode {
+    uint32_t parent;                   /* Inode number of the directory holding it */
+    uint32_t pos;                      /* Position in that directory */
+    int removed;                       /* Name gone: no new entries under it */
+    struct vfs_node *next;             /* Next entry of the same directory */
+    struct vfs_node *children;         /* Entries, oldest first (directories) */
+    struct vfs_node *last_child;       /* Newest entry */
+    uint32_t next_pos;                 /* Position for the next entry */
+} tmpfs_inode_t;
+
+/**
+ * Node and its tmpfs data, allocated together
+ */
+typedef struct {
+    vfs_node_t node;
+    tmpfs_inode_t tmp;
+} tmpfs_node_t;
+
+/**
+ * One mounted tmpfs (fs->fs_data)
+ */
+typedef struct {
+    uint32_t next_inode;               /* Number for the next node */
+} tmpfs_fs_t;
+
+static int tmpfs_read(vfs_node_t *node, uint64_t offset, void *buffer, uint32_t size);
+static int tmpfs_write(vfs_node_t *node, uint64_t offset, const void *buffer, uint32_t size);
+static vfs_node_t *tmpfs_lookup(vfs_node_t *dir, const char *name);
+static int tmpfs_iterate(vfs_node_t *dir, uint32_t *pos, vfs_filldir_t fill, void *ctx);
+static int tmpfs_create(vfs_node_t *dir, const char *name, uint32_t mode);
+static int tmpfs_mkdir(vfs_node_t *dir, const char *name, uint32_t mode);
+static int tmpfs_unlink(vfs_node_t *dir, const char *name);
+static int tmpfs_rmdir(vfs_node_t *dir, const char *name);
+static void tmpfs_release(vfs_node_t *node);
+
+static vfs_ops_t tmpfs_ops = {
+    .read = tmpfs_read,
+    .write = tmpfs_write,
+    .open = NULL,
+    .close = NULL,
+    .lookup = tmpfs_lookup,
+    .iterate = tmpfs_iterate,
+    .create = tmpfs_create,
+    .mkdir = tmpfs_mkdir,
+    .unlink = tmpfs_unlink,
+    .rmdir = tmpfs_rmdir,
+    .release = tmpfs_release,
+    .write_inode = NULL,               /* Nothing to write back to */
+};
+
+/* Nodes of every tmpfs (created on first mount) */
+static kmem_cache_t *tmpfs_node_cache = NULL;
+
+static inline tmpfs_inode_t *tmpfs_inode(vfs_node_t *node) {
+    return (tmpfs_inode_t *)node->fs_data;
+}
+
+/**
+ * Compare a name with a node's
+ */
+static int tmpfs_name_is(vfs_node_t *node, const char *name) {
+    uint32_t i = 0;
+    while (name[i] && node->name[i] == name[i]) {
+        i++;
+    }
+    return name[i] == node->name[i];
+}
+
+/**
+ * Find an entry of a directory (no reference taken)
+ */
+static vfs_node_t *tmpfs_find(vfs_node_t *dir, const char *name) {
+    for (vfs_node_t *child = tmpfs_inode(dir)->children; child; child = tmpfs_inode(child)->next) {
+        if (tmpfs_name_is(child, name)) {
+            return child;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Allocate a node owned by the calling process
+ */
+static vfs_node_t *tmpfs_alloc_node(vfs_filesystem_t *fs, uint32_t type, uint16_t mode) {
+    tmpfs_node_t *entry = (tmpfs_node_t *)kmem_cache_alloc(tmpfs_node_cache);
+    if (!entry) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+    kmemset(entry, 0, sizeof(*entry));
+
+    struct process *proc = process_current();
+    vfs_node_t *node = &entry->node;
+    node->inode = ((tmpfs_fs_t *)fs->fs_data)->next_inode++;
+    node->type = type;
+    node->mode = mode;
+    node->uid = proc ? proc->euid : 0;
+    node->gid = proc ? proc->egid : 0;
+    node->fs = fs;
+    node->fs_data = &entry->tmp;
+    node->ops = &tmpfs_ops;
+    node->refcount = 1;                /* Held by the name, or the filesystem for the root */
+    entry->tmp.next_pos = TMPFS_FIRST_POS;
+    return node;
+}
+
+/**
+ * Add an entry to a directory
+ */
+static int tmpfs_add(vfs_node_t *dir, const char *name, uint32_t type, uint16_t mode) {
+    if (!dir || !name || dir->type != VFS_TYPE_DIRECTORY) {
+        RETURN_ERRNO(THUNDEROS_ENOTDIR);
+    }
+    uint32_t len = (uint32_t)kstrlen(name);
+    if (len == 0 || len >= sizeof(dir->name)) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    tmpfs_inode_t *dir_tmp = tmpfs_inode(dir);
+    if (dir_tmp->removed) {
+        RETURN_ERRNO(THUNDEROS_ENOENT);
+    }
+    if (tmpfs_find(dir, name)) {
+        RETURN_ERRNO(THUNDEROS_EEXIST);
+    }
+
+    vfs_node_t *node = tmpfs_alloc_node(dir->fs, type, mode);
+    if (!node) {
+        /* errno already set by tmpfs_alloc_node */
+        return -1;
+    }
+    kstrcpy(node->name, name);
+
+    tmpfs_inode_t *tmp = tmpfs_inode(node);
+    tmp->parent = dir->inode;
+    tmp->pos = dir_tmp->next_pos++;
+    if (dir_tmp->last_child) {
+        tmpfs_inode(dir_tmp->last_child)->next = node;
+    } else {
+        dir_tmp->children = node;
+    }
+    dir_tmp->last_child = node;
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Take an entry out of a directory and drop the name's reference
+ */
+static void tmpfs_remove(vfs_node_t *dir, vfs_node_t *node) {
+    tmpfs_inode_t *dir_tmp = tmpfs_inode(dir);
+    vfs_node_t *prev = NULL;
+    for (vfs_node_t *child = dir_tmp->children; child != node; child = tmpfs_inode(child)->next) {
+        prev = child;
+    }
+
+    tmpfs_inode_t *tmp = tmpfs_inode(node);
+    if (prev) {
+        tmpfs_inode(prev)->next = tmp->next;
+    } else {
+        dir_tmp->children = tmp->next;
+    }
+    if (dir_tmp->last_child == node) {
+        dir_tmp->last_child = prev;
+    }
+    tmp->next = NULL;
+    tmp->removed = 1;
+    vfs_node_put(node);
+}
+
+/**
+ * Read a file: the page cache only asks for what it does not hold, which
+ * is a hole
+ */
+static int tmpfs_read(vfs_node_t *node, uint64_t offset, void *buffer, uint32_t size) {
+    (void)offset;
+    if (node->type != VFS_TYPE_FILE) {
+        RETURN_ERRNO(THUNDEROS_EISDIR);
+    }
+    kmemset(buffer, 0, size);
+    clear_errno();
+    return (int)size;
+}
+
+/**
+ * Write a file: the data already is in the page cache, and stays there
+ */
+static int tmpfs_write(vfs_node_t *node, uint64_t offset, const void *buffer, uint32_t size) {
+    (void)node;
+    (void)offset;
+    (void)buffer;
+    clear_errno();
+    return (int)size;
+}
+
+static vfs_node_t *tmpfs_lookup(vfs_node_t *dir, const char *name) {
+    if (!dir || !name || dir->type != VFS_TYPE_DIRECTORY) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOTDIR);
+    }
+    vfs_node_t *node = tmpfs_find(dir, name);
+    if (!node) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOENT);
+    }
+    vfs_node_get(node);
+    clear_errno();
+    return node;
+}
+
+static int tmpfs_iterate(vfs_node_t *dir, uint32_t *pos, vfs_filldir_t fill, void *ctx) {
+    if (!dir || !pos || !fill) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (dir->type != VFS_TYPE_DIRECTORY) {
+        RETURN_ERRNO(THUNDEROS_ENOTDIR);
+    }
+
+    tmpfs_inode_t *dir_tmp = tmpfs_inode(dir);
+    if (*pos == 0) {
+        if (fill(ctx, ".", 1, dir->inode) != 0) {
+            goto done;
+        }
+        *pos = 1;
+    }
+    if (*pos == 1) {
+        uint32_t parent = dir->inode == TMPFS_ROOT_INO ? dir->inode : dir_tmp->parent;
+        if (fill(ctx, "..", 2, parent) != 0) {
+            goto done;
+        }
+        *pos = TMPFS_FIRST_POS;
+    }
+    for (vfs_node_t *child = dir_tmp->children; child; child = tmpfs_inode(child)->next) {
+        uint32_t child_pos = tmpfs_inode(child)->pos;
+        if (child_pos < *pos) {
+            continue;
+        }
+        if (fill(ctx, child->name, (uint32_t)kstrlen(child->name), child->inode) != 0) {
+            break;
+        }
+        *pos = child_pos + 1;
+    }
+done:
+    clear_errno();
+    return 0;
+}
+
+static int tmpfs_create(vfs_node_t *dir, const char *name, uint32_t mode) {
+    return tmpfs_add(dir, name, VFS_TYPE_FILE, (uint16_t)(EXT2_S_IFREG | (mode & 0xFFF)));
+}
+
+static int tmpfs_mkdir(vfs_node_t *dir, const char *name, uint32_t mode) {
+    return tmpfs_add(dir, name, VFS_TYPE_DIRECTORY, (uint16_t)(EXT2_S_IFDIR | (mode & 0xFFF)));
+}
+
+static int tmpfs_unlink(vfs_node_t *dir, const char *name) {
+    vfs_node_t *node = tmpfs_lookup(dir, name);
+    if (!node) {
+        /* errno already set by tmpfs_lookup */
+        return -1;
+    }
+    int is_dir = node->type == VFS_TYPE_DIRECTORY;
+    vfs_node_put(node);
+    if (is_dir) {
+        RETURN_ERRNO(THUNDEROS_EISDIR);
+    }
+    tmpfs_remove(dir, node);
+    clear_errno();
+    return 0;
+}
+
+static int tmpfs_rmdir(vfs_node_t *dir, const char *name) {
+    vfs_node_t *node = tmpfs_lookup(dir, name);
+    if (!node) {
+        /* errno already set by tmpfs_lookup */
+        return -1;
+    }
+    int is_dir = node->type == VFS_TYPE_DIRECTORY;
+    int empty = tmpfs_inode(node)->children == NULL;
+    vfs_node_put(node);
+    if (!is_dir) {
+        RETURN_ERRNO(THUNDEROS_ENOTDIR);
+    }
+    if (!empty) {
+        RETURN_ERRNO(THUNDEROS_ENOTEMPTY);
+    }
+    tmpfs_remove(dir, node);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Free a node with its last reference, and the file data with it
+ */
+static void tmpfs_release(vfs_node_t *node) {
+    if (node->type == VFS_TYPE_FILE) {
+        page_cache_invalidate(node->fs, node->inode);
+    }
+    kmem_cache_free(tmpfs_node_cache, (tmpfs_node_t *)node);
+}
+
+/**
+ * Create an empty tmpfs
+ */
+vfs_filesystem_t *tmpfs_mount(void) {
+    if (!tmpfs_node_cache) {
+        tmpfs_node_cache = kmem_cache_create("tmpfs_node", sizeof(tmpfs_node_t), 0, NULL);
+        if (!tmpfs_node_cache) {
+            RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+        }
+    }
+
+    vfs_filesystem_t *fs = (vfs_filesystem_t *)kmalloc(sizeof(vfs_filesystem_t));
+    tmpfs_fs_t *tmp_fs = (tmpfs_fs_t *)kmalloc(sizeof(tmpfs_fs_t));
+    if (!fs || !tmp_fs) {
+        kfree(fs);
+        kfree(tmp_fs);
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+    kmemset(fs, 0, sizeof(*fs));
+    tmp_fs->next_inode = TMPFS_ROOT_INO;
+
+    kstrcpy(fs->name, "tmpfs");
+    fs->fs_data = tmp_fs;
+    fs->ops = &tmpfs_ops;
+    fs->max_file_size = 0;             /* Bounded by the page cache and memory */
+    fs->flags = VFS_FS_MEMORY;
+
+    fs->root = tmpfs_alloc_node(fs, VFS_TYPE_DIRECTORY, EXT2_S_IFDIR | TMPFS_ROOT_MODE);
+    if (!fs->root) {
+        kfree(tmp_fs);
+        kfree(fs);
+        /* errno already set by tmpfs_alloc_node */
+        return NULL;
+    }
+    kstrcpy(fs->root->name, "/");
+    tmpfs_inode(fs->root)->parent = TMPFS_ROOT_INO;
+    clear_errno();
+    return fs;
+}
@@ -4,12 +4,29 @@
 
 #include "../../include/fs/vfs.h"
 #include "../../include/fs/ext2.h"
+#include "../../include/fs/page_cache.h"
+#include "../../include/fs/dcache.h"
+#include "../../include/fs/icache.h"
+#include "../../include/fs/fdtable.h"
 #include "../../include/hal/hal_uart.h"
 #include "../../include/mm/kmalloc.h"
+#include "../../include/mm/slab.h"
+#include "../../include/mm/page.h"
 #include "../../include/kernel/errno.h"
 #include "../../include/kernel/pipe.h"
+#include "../../include/kernel/poll.h"
+#include "../../include/kernel/eventpoll.h"
+#include "../../include/kernel/shm.h"
+#include "../../include/kernel/signalfd.h"
+#include "../../include/net/socket.h"
+#include "../../include/kernel/perf_event.h"
+#include "../../include/kernel/aio.h"
 #include "../../include/kernel/process.h"
 #include "../../include/kernel/constants.h"
+#include "../../include/kernel/rcu.h"
+#include "../../include/kernel/elf_loader.h"
+#include "../../include/kernel/kstring.h"
+#include "../../include/drivers/vterm.h"
 #include <stddef.h>
 
 /* ========================================================================
@@ -22,12 +39,28 @@
  * Global state
  * ======================================================================== */
 
-/* Global file descriptor table (per-process would be better, but global for now) */
-static vfs_file_t g_file_table[VFS_MAX_OPEN_FILES];
+/* Open files (created on first use) */
+static kmem_cache_t *g_file_cache = NULL;
 
-/* Root filesystem */
+/* Root filesystem (published with rcu_assign_pointer(), read without locks) */
 static vfs_filesystem_t *g_root_fs = NULL;
 
+/**
+ * Filesystem mounted on a directory below the root
+ * 
+ * Slots are filled once and never emptied: a slot is in use once its fs
+ * is published, after its path and directory.
+ */
+typedef struct {
+    char path[VFS_MAX_PATH];           /* Normalized mount point */
+    vfs_node_t *covered;               /* Its directory in the filesystem above
+                                          (reference held; NULL if it went away
+                                          when the root was replaced) */
+    vfs_filesystem_t *fs;              /* Published with rcu_assign_pointer() */
+} vfs_mount_t;
+
+static vfs_mount_t g_mounts[VFS_MAX_MOUNTS];
+
 /* ========================================================================
  * Forward declarations
  * ======================================================================== */
@@ -35,6 +68,68 @@ static vfs_filesystem_t *g_root_fs = NULL;
 static int normalize_build_absolute(const char *path, char *working, size_t working_size);
 static int normalize_resolve_components(const char *working, char *normalized, size_t size);
 
+/* ========================================================================
+ * Root mount
+ * ======================================================================== */
+
+/**
+ * Get the root directory of the root filesystem
+ * 
+ * Every path lookup starts here, so it takes no lock. A filesystem
+ * replaced as root is only torn down after a grace period, by which time
+ * no one is still reading it here.
+ * 
+ * @return Root directory node, or NULL if nothing is mounted
+ */
+static vfs_node_t *vfs_root_node(void) {
+    rcu_read_lock();
+    vfs_filesystem_t *fs = rcu_dereference(g_root_fs);
+    vfs_node_t *root = fs ? fs->root : NULL;
+    rcu_read_unlock();
+    return root;
+}
+
+/**
+ * Check whether a node is on a filesystem that is never written
+ */
+static int vfs_node_readonly(vfs_node_t *node) {
+    return node->fs && (node->fs->flags & VFS_FS_RDONLY);
+}
+
+/**
+ * Get the filesystem mounted on a directory, if any
+ */
+static vfs_filesystem_t *vfs_mounted_on(vfs_node_t *dir) {
+    vfs_filesystem_t *found = NULL;
+    
+    rcu_read_lock();
+    for (int i = 0; i < VFS_MAX_MOUNTS && !found; i++) {
+        vfs_filesystem_t *fs = rcu_dereference(g_mounts[i].fs);
+        if (fs && g_mounts[i].covered == dir) {
+            found = fs;
+        }
+    }
+    rcu_read_unlock();
+    return found;
+}
+
+/**
+ * Get the directory a filesystem is mounted on (no reference taken), or
+ * NULL for the root filesystem and filesystems not mounted anywhere
+ */
+static vfs_node_t *vfs_mount_covered(vfs_filesystem_t *fs) {
+    vfs_node_t *covered = NULL;
+    
+    rcu_read_lock();
+    for (int i = 0; i < VFS_MAX_MOUNTS && !covered; i++) {
+        if (rcu_dereference(g_mounts[i].fs) == fs) {
+            covered = g_mounts[i].covered;
+        }
+    }
+    rcu_read_unlock();
+    return covered;
+}
+
 /* ========================================================================
  * Path normalization helpers
  * ======================================================================== */
@@ -195,27 +290,42 @@ int vfs_normalize_path(const char *path, char *normalized, size_t size) {
  * Initialize VFS
  */
 int vfs_init(void) {
-    /* Initialize file descriptor table */
-    for (int i = 0; i < VFS_MAX_OPEN_FILES; i++) {
-        g_file_table[i].node = NULL;
-        g_file_table[i].flags = 0;
-        g_file_table[i].pos = 0;
-        g_file_table[i].in_use = 0;
-        g_file_table[i].pipe = NULL;
-        g_file_table[i].type = VFS_TYPE_FILE;
-    }
-    
-    /* Reserve stdin/stdout/stderr */
-    g_file_table[VFS_FD_STDIN].in_use = 1;
-    g_file_table[VFS_FD_STDOUT].in_use = 1;
-    g_file_table[VFS_FD_STDERR].in_use = 1;
-    
+    /* Descriptor tables are per process (see fdtable.c) */
     g_root_fs = NULL;
     
     hal_uart_puts("vfs: Initialized\n");
     return 0;
 }
 
+/**
+ * Find each mount point again in a new root filesystem
+ * 
+ * Slots are visited in mount order, so a mount inside another mounted
+ * filesystem is found through the one it is in.
+ */
+static void vfs_mount_rebind(void) {
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (!g_mounts[i].fs) {
+            continue;
+        }
+        vfs_node_t *old = g_mounts[i].covered;
+        /* Not crossed while it still names the old directory */
+        vfs_node_t *dir = vfs_resolve_path(g_mounts[i].path);
+        if (dir && dir->type != VFS_TYPE_DIRECTORY) {
+            vfs_node_put(dir);
+            dir = NULL;
+        }
+        if (!dir) {
+            hal_uart_puts("vfs: Mount point gone with the old root: ");
+            hal_uart_puts(g_mounts[i].path);
+            hal_uart_puts("\n");
+        }
+        g_mounts[i].covered = dir;
+        vfs_node_put(old);
+    }
+    clear_errno();
+}
+
 /**
  * Mount a filesystem at root
  */
@@ -225,7 +335,18 @@ int vfs_mount_root(vfs_filesystem_t *fs) {
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
     
-    g_root_fs = fs;
+    vfs_filesystem_t *old_fs = g_root_fs;
+    rcu_assign_pointer(g_root_fs, fs);
+    
+    /* Lookups may still be walking the old root: let them finish */
+    if (old_fs) {
+        synchronize_rcu();
+        vfs_mount_rebind();
+        dcache_invalidate_fs(old_fs);
+        page_cache_sync(old_fs);
+        icache_sync(old_fs);
+    }
+    
     hal_uart_puts("vfs: Mounted root filesystem (");
     hal_uart_puts(fs->name);
     hal_uart_puts(")\n");
@@ -234,42 +355,215 @@ int vfs_mount_root(vfs_filesystem_t *fs) {
 }
 
 /**
- * Allocate a file descriptor
+ * Mount a filesystem on a directory
  */
-int vfs_alloc_fd(void) {
-    for (int i = VFS_FD_FIRST_REGULAR; i < VFS_MAX_OPEN_FILES; i++) {
-        if (!g_file_table[i].in_use) {
-            g_file_table[i].in_use = 1;
-            g_file_table[i].node = NULL;
-            g_file_table[i].pos = 0;
-            g_file_table[i].flags = 0;
-            g_file_table[i].pipe = NULL;
-            g_file_table[i].type = VFS_TYPE_FILE;
-            return i;
+int vfs_mount(const char *path, vfs_filesystem_t *fs) {
+    if (!path || !fs || !fs->root) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    /* Kept as text, to be found again if the root is replaced */
+    char normalized[VFS_MAX_PATH];
+    if (vfs_normalize_path(path, normalized, sizeof(normalized)) != 0) {
+        /* errno already set by vfs_normalize_path */
+        return -1;
+    }
+    
+    vfs_node_t *dir = vfs_resolve_path(path);
+    if (!dir) {
+        /* errno already set by vfs_resolve_path */
+        return -1;
+    }
+    /* A filesystem root is "/" (replaced with vfs_mount_root()) or
+     * already a mount point */
+    if (dir == dir->fs->root) {
+        vfs_node_put(dir);
+        RETURN_ERRNO(THUNDEROS_EBUSY);
+    }
+    if (dir->type != VFS_TYPE_DIRECTORY) {
+        vfs_node_put(dir);
+        RETURN_ERRNO(THUNDEROS_ENOTDIR);
+    }
+    
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (g_mounts[i].fs) {
+            continue;
+        }
+        kstrcpy(g_mounts[i].path, normalized);
+        g_mounts[i].covered = dir;     /* Keeps our reference */
+        rcu_assign_pointer(g_mounts[i].fs, fs);
+        
+        hal_uart_puts("vfs: Mounted ");
+        hal_uart_puts(fs->name);
+        hal_uart_puts(" on ");
+        hal_uart_puts(normalized);
+        hal_uart_puts("\n");
+        clear_errno();
+        return 0;
+    }
+    vfs_node_put(dir);
+    RETURN_ERRNO(THUNDEROS_ENOMEM);
+}
+
+/**
+ * Allocate an open file
+ */
+vfs_file_t *vfs_file_alloc(void) {
+    if (!g_file_cache) {
+        g_file_cache = kmem_cache_create("vfs_file", sizeof(vfs_file_t), 0, NULL);
+        if (!g_file_cache) {
+            RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+        }
+    }
+    
+    vfs_file_t *file = (vfs_file_t *)kmem_cache_alloc(g_file_cache);
+    if (!file) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+    kmemset(file, 0, sizeof(*file));
+    file->refcount = 1;
+    file->type = VFS_TYPE_FILE;
+    file->ra.prev_index = VFS_RA_NONE;
+    file->ra.window = PAGE_CACHE_RA_MIN_PAGES;
+    return file;
+}
+
+/**
+ * Take another reference to an open file
+ */
+void vfs_file_get(vfs_file_t *file) {
+    if (file) {
+        file->refcount++;
+    }
+}
+
+/**
+ * Drop a reference to an open file, releasing it with the last one
+ */
+void vfs_file_put(vfs_file_t *file) {
+    if (!file || --file->refcount > 0) {
+        return;
+    }
+    
+    /* Drop epoll registrations on this file before what they watch goes */
+    if (file->epitems) {
+        eventpoll_file_release(file);
+    }
+    
+    /* Handle epoll instance close */
+    if (file->type == VFS_TYPE_EPOLL && file->epoll) {
+        eventpoll_put((eventpoll_t*)file->epoll);
+    }
+    
+    /* Handle shared memory close (mappings hold their own references) */
+    if (file->type == VFS_TYPE_SHM && file->shm) {
+        shm_put((shm_object_t*)file->shm);
+    }
+    
+    /* Handle signalfd close */
+    if (file->type == VFS_TYPE_SIGNALFD && file->signalfd) {
+        signalfd_put((signalfd_t*)file->signalfd);
+    }
+    
+    /* Handle socket close */
+    if (file->type == VFS_TYPE_SOCKET && file->socket) {
+        socket_put((socket_t*)file->socket);
+    }
+    
+    /* Handle performance counter close */
+    if (file->type == VFS_TYPE_PERF && file->perf) {
+        perf_event_release((perf_event_t*)file->perf);
+    }
+    
+    /* Handle asynchronous I/O context close (running requests finish first) */
+    if (file->type == VFS_TYPE_AIO && file->aio) {
+        aio_put((aio_ctx_t*)file->aio);
+    }
+    
+    /* Handle pipe close */
+    if (file->type == VFS_TYPE_PIPE && file->pipe) {
+        pipe_t *pipe = (pipe_t*)file->pipe;
+        
+        /* Close appropriate end based on flags (O_RDONLY is 0) */
+        if (file->flags & O_WRONLY) {
+            pipe_close_write(pipe);
+        } else {
+            pipe_close_read(pipe);
+        }
+        
+        /* Free pipe if both ends closed */
+        if (pipe_can_free(pipe)) {
+            pipe_free(pipe);
         }
     }
-    /* No free descriptors */
-    RETURN_ERRNO(THUNDEROS_EMFILE);
+    
+    /* Write back metadata the file changed (a failure would only show in
+     * the file's size, not in close()'s result) */
+    icache_writeback(file->node);
+    
+    /* Call filesystem close if available */
+    if (file->node && file->node->ops && file->node->ops->close) {
+        file->node->ops->close(file->node);
+    }
+    vfs_node_put(file->node);
+    
+    kmem_cache_free(g_file_cache, file);
+}
+
+/**
+ * Allocate a file descriptor with a new open file
+ */
+int vfs_alloc_fd(void) {
+    fdtable_t *table = fdtable_current();
+    if (!table) {
+        /* errno already set by fdtable_current */
+        return -1;
+    }
+    
+    vfs_file_t *file = vfs_file_alloc();
+    if (!file) {
+        /* errno already set by vfs_file_alloc */
+        return -1;
+    }
+    
+    int fd = fdtable_alloc(table, file);
+    if (fd < 0) {
+        kmem_cache_free(g_file_cache, file);
+        /* errno already set by fdtable_alloc */
+        return -1;
+    }
+    return fd;
 }
 
 /**
- * Free a file descriptor
+ * Free a descriptor from vfs_alloc_fd() that was never set up
  */
 void vfs_free_fd(int fd) {
-    if (fd >= 0 && fd < VFS_MAX_OPEN_FILES) {
-        g_file_table[fd].in_use = 0;
-        g_file_table[fd].node = NULL;
-        g_file_table[fd].pos = 0;
-        g_file_table[fd].flags = 0;
-        g_file_table[fd].pipe = NULL;
-        g_file_table[fd].type = VFS_TYPE_FILE;
+    vfs_file_t *file = fdtable_remove(fdtable_current(), fd);
+    if (file) {
+        kmem_cache_free(g_file_cache, file);
+    }
+}
+
+/**
+ * Put an open file (descriptors passed over a socket) on the lowest
+ * free descriptor; the descriptor takes over the caller's reference
+ */
+int vfs_install_file(vfs_file_t *file) {
+    fdtable_t *table = fdtable_current();
+    if (!table) {
+        /* errno already set by fdtable_current */
+        return -1;
     }
+    /* errno set by fdtable_alloc */
+    return fdtable_alloc(table, file);
 }
 
 /**
  * Duplicate a file descriptor
  * 
  * Makes newfd be the copy of oldfd, closing newfd first if necessary.
+ * Both then share one open file: position, flags and all.
  * 
  * @param oldfd The file descriptor to duplicate
  * @param newfd The target file descriptor number
@@ -283,8 +577,9 @@ int vfs_dup2(int oldfd, int newfd) {
     }
     
     /* Get the source file */
-    if (oldfd < 0 || oldfd >= VFS_MAX_OPEN_FILES || !g_file_table[oldfd].in_use) {
-        set_errno(THUNDEROS_EBADF);
+    vfs_file_t *file = vfs_get_file(oldfd);
+    if (!file) {
+        /* errno already set by vfs_get_file */
         return -1;
     }
     
@@ -293,24 +588,17 @@ int vfs_dup2(int oldfd, int newfd) {
         return newfd;
     }
     
-    vfs_file_t *old_file = &g_file_table[oldfd];
-    vfs_file_t *new_file = &g_file_table[newfd];
-    
-    /* Close newfd if it's open */
-    if (new_file->in_use) {
-        vfs_close(newfd);
+    /* Point newfd at the same open file, then close what it held */
+    vfs_file_t *replaced;
+    vfs_file_get(file);
+    if (fdtable_install(fdtable_current(), newfd, file, &replaced) != 0) {
+        vfs_file_put(file);
+        /* errno already set by fdtable_install */
+        return -1;
     }
+    vfs_file_put(replaced);
     
-    /* Copy the file descriptor */
-    new_file->node = old_file->node;
-    new_file->flags = old_file->flags;
-    new_file->pos = old_file->pos;
-    new_file->in_use = 1;
-    new_file->pipe = old_file->pipe;
-    new_file->type = old_file->type;
-    
-    /* Note: Pipe reference counting is handled by vfs_close */
-    
+    clear_errno();
     return newfd;
 }
 
@@ -318,143 +606,297 @@ int vfs_dup2(int oldfd, int newfd) {
  * Get file structure from descriptor
  */
 vfs_file_t *vfs_get_file(int fd) {
-    if (fd < 0 || fd >= VFS_MAX_OPEN_FILES || !g_file_table[fd].in_use) {
+    vfs_file_t *file = fdtable_get(fdtable_current(), fd);
+    if (!file) {
         set_errno(THUNDEROS_EBADF);
         return NULL;
     }
-    return &g_file_table[fd];
+    return file;
 }
+
 /**
- * vfs_resolve_path - Resolve a path to a VFS node
+ * Check whether a descriptor is the console
+ */
+int vfs_is_console(int fd) {
+    vfs_file_t *file = fdtable_get(fdtable_current(), fd);
+    return file && file->type == VFS_TYPE_CONSOLE;
+}
+
+/* ========================================================================
+ * Path walk
+ * ======================================================================== */
+
+/**
+ * Get the node a walk of path starts from
  * 
- * Supports both absolute and relative paths. Relative paths are resolved
- * against the current process's working directory.
+ * @return Root directory, or for a relative path the process's working
+ *         directory, with a reference held; NULL if nothing is mounted
+ */
+static vfs_node_t *vfs_walk_start(const char *path) {
+    vfs_node_t *start = NULL;
+    if (path[0] != '/') {
+        struct process *proc = process_current();
+        start = proc ? proc->cwd_node : NULL;
+    }
+    if (!start) {
+        start = vfs_root_node();
+    }
+    vfs_node_get(start);
+    return start;
+}
+
+/**
+ * Remember the directory a lookup found a directory in, so ".." needs no
+ * lookup (without rename a directory never moves)
+ */
+static void vfs_set_parent(vfs_node_t *dir, vfs_node_t *node) {
+    if (node->type == VFS_TYPE_DIRECTORY && !node->parent && node != node->fs->root) {
+        vfs_node_get(dir);
+        node->parent = dir;
+    }
+}
+
+/**
+ * Step into a node a lookup in dir found
  * 
- * @param path Path to resolve (absolute or relative)
- * @return VFS node on success, NULL on error (errno set)
+ * A directory something is mounted on is left for the mounted root.
  * 
- * @errno THUNDEROS_EFS_NOTMNT - No root filesystem mounted
- * @errno THUNDEROS_EINVAL - Invalid path
- * @errno THUNDEROS_ENOENT - Path component not found
+ * @return The node to continue from, with the reference that was node's
  */
-vfs_node_t *vfs_resolve_path(const char *path) {
-    if (!g_root_fs) {
-        set_errno(THUNDEROS_EFS_NOTMNT);
-        return NULL;
-    }
+static vfs_node_t *vfs_walk_down(vfs_node_t *dir, vfs_node_t *node) {
+    vfs_set_parent(dir, node);
     
-    if (!path) {
-        set_errno(THUNDEROS_EINVAL);
-        return NULL;
+    vfs_filesystem_t *mounted = vfs_mounted_on(node);
+    if (mounted) {
+        vfs_node_get(mounted->root);
+        vfs_node_put(node);
+        node = mounted->root;
     }
+    return node;
+}
+
+/**
+ * Step from a directory to its parent
+ * 
+ * ".." of a mounted filesystem's root is taken in the directory it is
+ * mounted on; ".." of the root is the root.
+ * 
+ * @return Parent with the reference that was dir's, or NULL on error
+ *         (errno set, dir's reference dropped)
+ */
+static vfs_node_t *vfs_walk_up(vfs_node_t *dir) {
+    vfs_node_t *root = vfs_root_node();
     
-    /* Normalize path (handles relative paths, ., ..) */
-    char normalized_path[VFS_MAX_PATH];
-    if (vfs_normalize_path(path, normalized_path, VFS_MAX_PATH) < 0) {
-        /* errno already set by vfs_normalize_path */
-        return NULL;
+    while (dir != root && dir == dir->fs->root) {
+        vfs_node_t *covered = vfs_mount_covered(dir->fs);
+        if (!covered) {
+            return dir;
+        }
+        vfs_node_get(covered);
+        vfs_node_put(dir);
+        dir = covered;
     }
-    
-    /* Root directory special case */
-    if (normalized_path[0] == '/' && normalized_path[1] == '\0') {
-        return g_root_fs->root;
+    if (dir == root) {
+        return dir;
     }
     
-    /* Skip leading slash and walk the path */
-    const char *cursor = normalized_path + 1;
-    vfs_node_t *current_node = g_root_fs->root;
-    char component_name[MAX_PATH_COMPONENT_LEN];
+    vfs_node_t *parent = dir->parent;
+    if (parent) {
+        vfs_node_get(parent);
+    } else {
+        /* Not reached by a walk: only the filesystem knows */
+        parent = dcache_lookup(dir, "..");
+    }
+    vfs_node_put(dir);
+    /* On failure errno is already set by dcache_lookup */
+    return parent;
+}
+
+/**
+ * Walk path up to end, a component at a time
+ * 
+ * Works on the path as given: empty components and "." are skipped and
+ * ".." follows parent links, so nothing is copied but each component
+ * name, for the dentry cache.
+ * 
+ * @param path Path (absolute, or relative to the working directory)
+ * @param end  Where in path to stop
+ * @return Node with a reference held, or NULL on error (errno set)
+ */
+static vfs_node_t *vfs_walk(const char *path, const char *end) {
+    vfs_node_t *node = vfs_walk_start(path);
+    if (!node) {
+        RETURN_ERRNO_NULL(THUNDEROS_EFS_NOTMNT);
+    }
     
-    while (*cursor) {
-        /* Extract path component */
-        uint32_t name_index = 0;
-        while (*cursor && *cursor != '/') {
-            if (name_index < MAX_PATH_COMPONENT_LEN - 1) {
-                component_name[name_index++] = *cursor;
-            }
+    char name[MAX_PATH_COMPONENT_LEN];
+    const char *cursor = path;
+    while (cursor < end) {
+        if (*cursor == '/') {
+            cursor++;
+            continue;
+        }
+        const char *start = cursor;
+        while (cursor < end && *cursor != '/') {
             cursor++;
         }
-        component_name[name_index] = '\0';
+        size_t len = (size_t)(cursor - start);
         
-        if (name_index == 0) {
-            /* Skip empty components (shouldn't happen after normalize) */
-            if (*cursor == '/') {
-                cursor++;
+        if (len == 1 && start[0] == '.') {
+            continue;
+        }
+        if (node->type != VFS_TYPE_DIRECTORY) {
+            vfs_node_put(node);
+            RETURN_ERRNO_NULL(THUNDEROS_ENOTDIR);
+        }
+        if (len == 2 && start[0] == '.' && start[1] == '.') {
+            node = vfs_walk_up(node);
+            if (!node) {
+                /* errno already set by vfs_walk_up */
+                return NULL;
             }
             continue;
         }
-        
-        /* Lookup component in current directory */
-        if (!current_node->ops || !current_node->ops->lookup) {
-            set_errno(THUNDEROS_EIO);
-            return NULL;
+        /* No filesystem holds a name this long */
+        if (len >= MAX_PATH_COMPONENT_LEN) {
+            vfs_node_put(node);
+            RETURN_ERRNO_NULL(THUNDEROS_ENOENT);
         }
+        kmemcpy(name, start, len);
+        name[len] = '\0';
         
-        vfs_node_t *next_node = current_node->ops->lookup(current_node, component_name);
-        if (!next_node) {
-            /* errno already set by lookup */
+        vfs_node_t *next = dcache_lookup(node, name);
+        if (!next) {
+            vfs_node_put(node);
+            /* errno already set by dcache_lookup */
             return NULL;
         }
-        
-        current_node = next_node;
-        
-        /* Skip separator */
-        if (*cursor == '/') {
-            cursor++;
-        }
+        next = vfs_walk_down(node, next);
+        vfs_node_put(node);
+        node = next;
     }
     
-    return current_node;
+    return node;
 }
 
 /**
- * Open a file
+ * vfs_resolve_path - Resolve a path to a VFS node
+ * 
+ * Supports both absolute and relative paths. Relative paths start from
+ * the current process's working directory node. Each component goes
+ * through the dentry cache, so only names not seen before reach the
+ * filesystem.
+ * 
+ * @param path Path to resolve (absolute or relative)
+ * @return VFS node with a reference held for the caller (drop it with
+ *         vfs_node_put()), NULL on error (errno set)
+ * 
+ * @errno THUNDEROS_EFS_NOTMNT - No root filesystem mounted
+ * @errno THUNDEROS_EINVAL - Invalid path
+ * @errno THUNDEROS_ENOENT - Path component not found
+ * @errno THUNDEROS_ENOTDIR - A component before the last is not a directory
  */
-int vfs_open(const char *path, uint32_t flags) {
+vfs_node_t *vfs_resolve_path(const char *path) {
     if (!path) {
-        hal_uart_puts("vfs: NULL path\n");
-        RETURN_ERRNO(THUNDEROS_EINVAL);
+        set_errno(THUNDEROS_EINVAL);
+        return NULL;
     }
-    
-    /* Normalize path to absolute */
-    char normalized[VFS_MAX_PATH];
-    if (vfs_normalize_path(path, normalized, sizeof(normalized)) != 0) {
-        /* errno already set */
-        return -1;
+    return vfs_walk(path, path + kstrlen(path));
+}
+
+/**
+ * Resolve the directory a path names an entry in
+ * 
+ * @param path Path whose last component is a name, not "." or ".."
+ * @param name Receives the last component (MAX_PATH_COMPONENT_LEN bytes)
+ * @return Parent directory with a reference held, NULL on error (errno
+ *         set; THUNDEROS_EINVAL if there is no such last component)
+ */
+static vfs_node_t *vfs_resolve_parent(const char *path, char *name) {
+    const char *end = path + kstrlen(path);
+    while (end > path && end[-1] == '/') {
+        end--;
+    }
+    const char *start = end;
+    while (start > path && start[-1] != '/') {
+        start--;
     }
     
-    /* Resolve path */
-    vfs_node_t *node = vfs_resolve_path(normalized);
+    size_t len = (size_t)(end - start);
+    if (len == 0 || len >= MAX_PATH_COMPONENT_LEN ||
+        (len == 1 && start[0] == '.') || (len == 2 && start[0] == '.' && start[1] == '.')) {
+        RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+    }
+    kmemcpy(name, start, len);
+    name[len] = '\0';
     
-    /* If file doesn't exist and O_CREAT is set, create it */
-    if (!node && (flags & O_CREAT)) {
-        /* Extract parent directory and filename */
-        /* For now, only support files in root directory */
-        if (normalized[0] == '/' && normalized[1] != '\0') {
-            const char *filename = normalized + 1;
-            
-            /* Check if filename contains '/' */
-            const char *p = filename;
-            while (*p && *p != '/') p++;
-            if (*p == '/') {
-                hal_uart_puts("vfs: O_CREAT only supports root directory for now\n");
-                RETURN_ERRNO(THUNDEROS_EINVAL);
-            }
-            
-            /* Create file in root directory */
-            vfs_node_t *root = g_root_fs->root;
-            if (root->ops && root->ops->create) {
-                int ret = root->ops->create(root, filename, VFS_DEFAULT_FILE_MODE);
-                if (ret != 0) {
-                    hal_uart_puts("vfs: Failed to create file\n");
-                    /* errno already set by create */
-                    return -1;
-                }
-                
-                /* Try to resolve again */
-                node = vfs_resolve_path(normalized);
+    vfs_node_t *dir = vfs_walk(path, start);
+    if (dir && dir->type != VFS_TYPE_DIRECTORY) {
+        vfs_node_put(dir);
+        RETURN_ERRNO_NULL(THUNDEROS_ENOTDIR);
+    }
+    /* On failure errno is already set by vfs_walk */
+    return dir;
+}
+
+/**
+ * Take a reference to a node
+ */
+void vfs_node_get(vfs_node_t *node) {
+    if (node) {
+        node->refcount++;
+    }
+}
+
+/**
+ * Drop a reference to a node, letting its filesystem free it with the last
+ */
+void vfs_node_put(vfs_node_t *node) {
+    // A directory's last reference may be the last one on its parent
+    while (node && --node->refcount == 0) {
+        vfs_node_t *parent = node->parent;
+        // Nothing else can write it back once it is out of the inode cache
+        icache_writeback(node);
+        icache_remove(node);
+        if (node->ops && node->ops->release) {
+            node->ops->release(node);
+        }
+        node = parent;
+    }
+}
+
+/**
+ * Open a file
+ */
+int vfs_open(const char *path, uint32_t flags) {
+    if (!path) {
+        hal_uart_puts("vfs: NULL path\n");
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    /* Resolve path */
+    vfs_node_t *node = vfs_resolve_path(path);
+    
+    /* If file doesn't exist and O_CREAT is set, create it */
+    if (!node && (flags & O_CREAT)) {
+        char filename[MAX_PATH_COMPONENT_LEN];
+        vfs_node_t *dir = vfs_resolve_parent(path, filename);
+        if (dir && dir->ops && dir->ops->create) {
+            int ret = dir->ops->create(dir, filename, VFS_DEFAULT_FILE_MODE);
+            if (ret != 0) {
+                vfs_node_put(dir);
+                hal_uart_puts("vfs: Failed to create file\n");
+                /* errno already set by create */
+                return -1;
             }
+            
+            /* The name is cached as missing */
+            dcache_invalidate(dir, filename);
+            
+            /* Look it up again, in the directory we already have */
+            node = dcache_lookup(dir, filename);
         }
+        vfs_node_put(dir);
     }
     
     if (!node) {
@@ -473,9 +915,12 @@ int vfs_open(const char *path, uint32_t flags) {
     } else {
         access_mode = VFS_ACCESS_READ;  /* O_RDONLY is 0 */
     }
+    if (flags & O_TRUNC) {
+        access_mode |= VFS_ACCESS_WRITE;  /* Truncating writes, whatever the mode */
+    }
     
     if (vfs_check_permission(node, access_mode) != 0) {
-        kfree(node);
+        vfs_node_put(node);
         /* errno already set by vfs_check_permission */
         return -1;
     }
@@ -483,34 +928,39 @@ int vfs_open(const char *path, uint32_t flags) {
     /* Allocate file descriptor */
     int fd = vfs_alloc_fd();
     if (fd < 0) {
+        vfs_node_put(node);
         hal_uart_puts("vfs: No free file descriptors\n");
         /* errno already set by vfs_alloc_fd */
         return -1;
     }
     
-    /* Initialize file descriptor */
-    g_file_table[fd].node = node;
-    g_file_table[fd].flags = flags;
-    g_file_table[fd].pos = 0;
+    /* Initialize the open file (it keeps our node reference) */
+    vfs_file_t *file = vfs_get_file(fd);
+    file->node = node;
+    file->flags = flags;
+    file->pos = 0;
     
     /* Call filesystem open if available */
     if (node->ops && node->ops->open) {
         int ret = node->ops->open(node, flags);
         if (ret != 0) {
             vfs_free_fd(fd);
+            vfs_node_put(node);
             /* errno already set by open */
             return -1;
         }
     }
     
-    /* If O_TRUNC, truncate file to zero */
-    if (flags & O_TRUNC) {
+    /* If O_TRUNC, truncate file to zero (devices ignore it) */
+    if ((flags & O_TRUNC) && node->type != VFS_TYPE_DEVICE) {
         node->size = 0;
+        page_cache_invalidate(node->fs, node->inode);
+        elf_cache_invalidate(node->fs, node->inode);
     }
     
     /* If O_APPEND, seek to end */
     if (flags & O_APPEND) {
-        g_file_table[fd].pos = node->size;
+        file->pos = node->size;
     }
     
     clear_errno();
@@ -527,53 +977,53 @@ int vfs_close(int fd) {
         return -1;
     }
     
-    /* Handle pipe close */
-    if (file->type == VFS_TYPE_PIPE && file->pipe) {
-        pipe_t *pipe = (pipe_t*)file->pipe;
-        
-        /* Close appropriate end based on flags */
-        if (file->flags & O_RDONLY) {
-            pipe_close_read(pipe);
-        } else if (file->flags & O_WRONLY) {
-            pipe_close_write(pipe);
-        }
-        
-        /* Free pipe if both ends closed */
-        if (pipe_can_free(pipe)) {
-            pipe_free(pipe);
-        }
-    }
-    
-    /* Call filesystem close if available */
-    if (file->node && file->node->ops && file->node->ops->close) {
-        file->node->ops->close(file->node);
-    }
-    
-    /* Free the file descriptor */
-    vfs_free_fd(fd);
+    /* The open file goes with its last descriptor */
+    vfs_file_put(fdtable_remove(fdtable_current(), fd));
     clear_errno();
     return 0;
 }
 
 /**
- * Read from a file
+ * Read from a pipe or signalfd (nonblock: don't wait, whatever O_NONBLOCK says)
  */
-int vfs_read(int fd, void *buffer, uint32_t size) {
-    vfs_file_t *file = vfs_get_file(fd);
-    if (!file) {
-        /* errno already set by vfs_get_file */
-        return -1;
-    }
+static int vfs_stream_read(vfs_file_t *file, void *buffer, uint32_t size, int nonblock) {
+    nonblock |= (file->flags & O_NONBLOCK) != 0;
     
     /* Handle pipe read */
     if (file->type == VFS_TYPE_PIPE) {
         if (!file->pipe) {
             RETURN_ERRNO(THUNDEROS_EINVAL);
         }
-        return pipe_read((pipe_t*)file->pipe, buffer, size);
+        return pipe_read((pipe_t*)file->pipe, buffer, size, nonblock);
     }
     
-    /* Regular file read */
+    /* Handle signalfd read */
+    if (!file->signalfd) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    return signalfd_read((signalfd_t*)file->signalfd, buffer, size, nonblock);
+}
+
+/**
+ * Read or write a stream socket, or receive one datagram (UDP sockets
+ * are not connected, so only sendto() and sendmmsg() send on them)
+ */
+static int vfs_socket_io(vfs_file_t *file, const vfs_iovec_t *iov, int iovcnt, int write) {
+    socket_t *sock = (socket_t*)file->socket;
+    if (!sock) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    int nonblock = (file->flags & O_NONBLOCK) != 0;
+    if (write) {
+        return socket_sendmsg(sock, NULL, iov, iovcnt, NULL, nonblock, NULL);
+    }
+    return socket_recvmsg(sock, iov, iovcnt, NULL, nonblock, 0, NULL, NULL);
+}
+
+/**
+ * Check that a regular file descriptor may be read
+ */
+static int vfs_check_readable(vfs_file_t *file) {
     if (!file->node) {
         RETURN_ERRNO(THUNDEROS_EBADF);
     }
@@ -589,35 +1039,69 @@ int vfs_read(int fd, void *buffer, uint32_t size) {
         hal_uart_puts("vfs: No read operation\n");
         RETURN_ERRNO(THUNDEROS_EIO);
     }
-    
-    /* Read from current position */
-    int bytes_read = file->node->ops->read(file->node, file->pos, buffer, size);
-    if (bytes_read > 0) {
-        file->pos += bytes_read;
+    return 0;
+}
+
+/**
+ * Read from a checked regular file at a given position
+ * 
+ * Does not move the file position.
+ */
+static int vfs_read_at(vfs_file_t *file, uint64_t pos, void *buffer, uint32_t size) {
+    /* Regular files through the page cache, which also holds what shared
+     * mappings stored */
+    if (file->node->type == VFS_TYPE_FILE) {
+        return page_cache_read(file->node, pos, buffer, size, &file->ra);
     }
-    
-    return bytes_read;
+    return file->node->ops->read(file->node, pos, buffer, size);
 }
 
 /**
- * Write to a file
+ * Read from a file
  */
-int vfs_write(int fd, const void *buffer, uint32_t size) {
+int vfs_read(int fd, void *buffer, uint32_t size) {
     vfs_file_t *file = vfs_get_file(fd);
     if (!file) {
         /* errno already set by vfs_get_file */
         return -1;
     }
     
-    /* Handle pipe write */
-    if (file->type == VFS_TYPE_PIPE) {
-        if (!file->pipe) {
-            RETURN_ERRNO(THUNDEROS_EINVAL);
-        }
-        return pipe_write((pipe_t*)file->pipe, buffer, size);
+    if (file->type == VFS_TYPE_PIPE || file->type == VFS_TYPE_SIGNALFD) {
+        return vfs_stream_read(file, buffer, size, 0);
     }
     
-    /* Regular file write */
+    if (file->type == VFS_TYPE_SOCKET) {
+        vfs_iovec_t iov = { buffer, size };
+        return vfs_socket_io(file, &iov, 1, 0);
+    }
+    
+    if (file->type == VFS_TYPE_PERF) {
+        return perf_event_read((perf_event_t*)file->perf, buffer, size);
+    }
+    
+    if (file->type == VFS_TYPE_AIO) {
+        return aio_read((aio_ctx_t*)file->aio, buffer, size, (file->flags & O_NONBLOCK) != 0);
+    }
+    
+    /* Regular file read */
+    if (vfs_check_readable(file) != 0) {
+        /* errno already set by vfs_check_readable */
+        return -1;
+    }
+    
+    /* Read from current position */
+    int bytes_read = vfs_read_at(file, file->pos, buffer, size);
+    if (bytes_read > 0) {
+        file->pos += bytes_read;
+    }
+    
+    return bytes_read;
+}
+
+/**
+ * Check that a regular file descriptor may be written
+ */
+static int vfs_check_writable(vfs_file_t *file) {
     if (!file->node) {
         RETURN_ERRNO(THUNDEROS_EBADF);
     }
@@ -633,217 +1117,495 @@ int vfs_write(int fd, const void *buffer, uint32_t size) {
         hal_uart_puts("vfs: No write operation\n");
         RETURN_ERRNO(THUNDEROS_EIO);
     }
+    return 0;
+}
+
+/**
+ * Write to a checked regular file at a given position
+ * 
+ * Does not move the file position.
+ */
+static int vfs_write_at(vfs_file_t *file, uint64_t pos, const void *buffer, uint32_t size) {
+    /* Devices take writes themselves */
+    if (file->node->type == VFS_TYPE_DEVICE) {
+        return file->node->ops->write(file->node, pos, buffer, size);
+    }
     
-    /* Write at current position */
-    int bytes_written = file->node->ops->write(file->node, file->pos, buffer, size);
-    if (bytes_written > 0) {
-        file->pos += bytes_written;
-        
-        /* Update file size if we wrote past end */
-        if (file->pos > file->node->size) {
-            file->node->size = file->pos;
+    /* Refused now rather than at write-back, where nobody would see the error */
+    uint64_t max_size = PAGE_CACHE_MAX_FILE_SIZE;
+    if (file->node->fs && file->node->fs->max_file_size != 0 &&
+        file->node->fs->max_file_size < max_size) {
+        max_size = file->node->fs->max_file_size;
+    }
+    if (size > 0) {
+        if (pos >= max_size) {
+            RETURN_ERRNO(THUNDEROS_EFBIG);
+        }
+        if (size > max_size - pos) {
+            size = (uint32_t)(max_size - pos);
         }
     }
     
+    /* Left in the page cache; the filesystem allocates and writes on write-back */
+    int bytes_written = page_cache_write(file->node, pos, buffer, size);
+    if (bytes_written > 0) {
+        elf_cache_invalidate(file->node->fs, file->node->inode);
+    }
+    /* On failure errno is already set by page_cache_write */
     return bytes_written;
 }
 
 /**
- * Seek within a file
+ * Write to a file
  */
-int vfs_seek(int fd, int offset, int whence) {
+int vfs_write(int fd, const void *buffer, uint32_t size) {
     vfs_file_t *file = vfs_get_file(fd);
-    if (!file || !file->node) {
+    if (!file) {
         /* errno already set by vfs_get_file */
         return -1;
     }
     
-    uint32_t new_pos;
-    
-    switch (whence) {
-        case SEEK_SET:
-            new_pos = offset;
-            break;
-            
-        case SEEK_CUR:
-            new_pos = file->pos + offset;
-            break;
-            
-        case SEEK_END:
-            new_pos = file->node->size + offset;
-            break;
-            
-        default:
-            hal_uart_puts("vfs: Invalid whence value\n");
+    /* Handle pipe write */
+    if (file->type == VFS_TYPE_PIPE) {
+        if (!file->pipe) {
             RETURN_ERRNO(THUNDEROS_EINVAL);
+        }
+        return pipe_write((pipe_t*)file->pipe, buffer, size, (file->flags & O_NONBLOCK) != 0);
     }
     
-    file->pos = new_pos;
-    clear_errno();
-    return new_pos;
-}
-
-/**
- * Create a directory
- */
-int vfs_mkdir(const char *path, uint32_t mode) {
-    if (!g_root_fs || !path) {
-        RETURN_ERRNO(THUNDEROS_EINVAL);
+    if (file->type == VFS_TYPE_SOCKET) {
+        vfs_iovec_t iov = { (void *)buffer, size };
+        return vfs_socket_io(file, &iov, 1, 1);
     }
     
-    /* Normalize path to absolute */
-    char normalized[VFS_MAX_PATH];
-    if (vfs_normalize_path(path, normalized, sizeof(normalized)) != 0) {
-        /* errno already set */
+    /* Regular file write */
+    if (vfs_check_writable(file) != 0) {
+        /* errno already set by vfs_check_writable */
         return -1;
     }
     
-    /* For now, only support directories in root */
-    if (normalized[0] != '/' || normalized[1] == '\0') {
-        RETURN_ERRNO(THUNDEROS_EINVAL);
+    /* Write at current position */
+    int bytes_written = vfs_write_at(file, file->pos, buffer, size);
+    if (bytes_written > 0) {
+        file->pos += bytes_written;
     }
     
-    const char *dirname = normalized + 1;
-    
-    /* Check if name contains '/' */
-    const char *p = dirname;
-    while (*p && *p != '/') p++;
-    if (*p == '/') {
-        hal_uart_puts("vfs: mkdir only supports root directory for now\n");
+    return bytes_written;
+}
+
+/**
+ * Check that an open file is a regular file open for a transfer
+ */
+int vfs_file_check_io(vfs_file_t *file, int write) {
+    if (file->type != VFS_TYPE_FILE || !file->node || file->node->type != VFS_TYPE_FILE) {
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
-    
-    vfs_node_t *root = g_root_fs->root;
-    if (!root->ops || !root->ops->mkdir) {
-        hal_uart_puts("vfs: No mkdir operation\n");
-        RETURN_ERRNO(THUNDEROS_EIO);
-    }
-    
-    return root->ops->mkdir(root, dirname, mode);
+    return write ? vfs_check_writable(file) : vfs_check_readable(file);
 }
 
 /**
- * Remove a directory
+ * Read an open regular file at a given position
  */
-int vfs_rmdir(const char *path) {
-    if (!g_root_fs || !path) {
-        RETURN_ERRNO(THUNDEROS_EINVAL);
+int vfs_file_pread(vfs_file_t *file, uint64_t pos, void *buffer, uint32_t size) {
+    if (vfs_file_check_io(file, 0) != 0) {
+        /* errno already set by vfs_file_check_io */
+        return -1;
     }
-    
-    /* Normalize path to absolute */
-    char normalized[VFS_MAX_PATH];
-    if (vfs_normalize_path(path, normalized, sizeof(normalized)) != 0) {
-        /* errno already set */
+    return vfs_read_at(file, pos, buffer, size);
+}
+
+/**
+ * Write an open regular file at a given position
+ */
+int vfs_file_pwrite(vfs_file_t *file, uint64_t pos, const void *buffer, uint32_t size) {
+    if (vfs_file_check_io(file, 1) != 0) {
+        /* errno already set by vfs_file_check_io */
         return -1;
     }
-    
-    /* Can't remove root */
-    if (normalized[0] != '/' || normalized[1] == '\0') {
+    return vfs_write_at(file, pos, buffer, size);
+}
+
+/**
+ * Check an iovec array: count in range and a total that fits the result
+ */
+static int vfs_iov_check(const vfs_iovec_t *iov, int iovcnt) {
+    if (iovcnt < 0 || iovcnt > VFS_IOV_MAX || (iovcnt > 0 && !iov)) {
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
-    
-    /* Find the last slash to separate parent path and directory name */
-    char *last_slash = NULL;
-    for (char *p = normalized; *p; p++) {
-        if (*p == '/') last_slash = p;
-    }
-    
-    vfs_node_t *parent_dir;
-    const char *dirname;
-    
-    if (last_slash == normalized) {
-        /* Directory is in root (e.g., /emptydir) */
-        parent_dir = g_root_fs->root;
-        dirname = normalized + 1;
-    } else {
-        /* Directory is in a subdirectory (e.g., /foo/bar) */
-        *last_slash = '\0';  /* Temporarily terminate to get parent path */
-        parent_dir = vfs_resolve_path(normalized);
-        *last_slash = '/';   /* Restore */
-        
-        if (!parent_dir) {
-            RETURN_ERRNO(THUNDEROS_ENOENT);
+    uint64_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].len > VFS_IO_MAX - total) {
+            RETURN_ERRNO(THUNDEROS_EINVAL);
         }
-        dirname = last_slash + 1;
+        total += iov[i].len;
     }
-    
-    if (!parent_dir->ops || !parent_dir->ops->rmdir) {
-        hal_uart_puts("vfs: No rmdir operation\n");
-        RETURN_ERRNO(THUNDEROS_EIO);
+    return 0;
+}
+
+/**
+ * Starting position of a vectored transfer (offset NULL: the file position)
+ */
+static int vfs_iov_start(vfs_file_t *file, const int64_t *offset, uint64_t *pos) {
+    if (!offset) {
+        *pos = file->pos;
+        return 0;
     }
-    
-    /* Check write permission on parent directory */
-    if (vfs_check_permission(parent_dir, VFS_ACCESS_WRITE) != 0) {
-        /* errno already set by vfs_check_permission */
-        return -1;
+    if (*offset < 0) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
     }
-    
-    return parent_dir->ops->rmdir(parent_dir, dirname);
+    *pos = (uint64_t)*offset;
+    return 0;
 }
 
 /**
- * Remove a file
+ * Read into several buffers in one call
  */
-int vfs_unlink(const char *path) {
-    if (!g_root_fs || !path) {
-        RETURN_ERRNO(THUNDEROS_EINVAL);
+int vfs_readv(int fd, const vfs_iovec_t *iov, int iovcnt, int64_t *offset) {
+    vfs_file_t *file = vfs_get_file(fd);
+    if (!file) {
+        /* errno already set by vfs_get_file */
+        return -1;
     }
-    
-    /* Normalize path to absolute */
-    char normalized[VFS_MAX_PATH];
-    if (vfs_normalize_path(path, normalized, sizeof(normalized)) != 0) {
-        /* errno already set */
+    if (vfs_iov_check(iov, iovcnt) != 0) {
+        /* errno already set by vfs_iov_check */
         return -1;
     }
     
-    /* Must have a filename */
-    if (normalized[0] != '/' || normalized[1] == '\0') {
-        RETURN_ERRNO(THUNDEROS_EINVAL);
-    }
+    int done = 0;
     
-    /* Find the last slash to separate parent path and filename */
-    char *last_slash = NULL;
-    for (char *p = normalized; *p; p++) {
-        if (*p == '/') last_slash = p;
+    /* A datagram fills the buffers in turn */
+    if (file->type == VFS_TYPE_SOCKET) {
+        if (offset) {
+            RETURN_ERRNO(THUNDEROS_ESPIPE);
+        }
+        return vfs_socket_io(file, iov, iovcnt, 0);
     }
     
-    vfs_node_t *parent_dir;
-    const char *filename;
-    
-    if (last_slash == normalized) {
-        /* File is in root (e.g., /deleteme.txt) */
-        parent_dir = g_root_fs->root;
-        filename = normalized + 1;
-    } else {
-        /* File is in a subdirectory (e.g., /foo/bar.txt) */
-        *last_slash = '\0';  /* Temporarily terminate to get parent path */
-        parent_dir = vfs_resolve_path(normalized);
-        *last_slash = '/';   /* Restore */
-        
-        if (!parent_dir) {
-            RETURN_ERRNO(THUNDEROS_ENOENT);
+    if (file->type == VFS_TYPE_PIPE || file->type == VFS_TYPE_SIGNALFD) {
+        if (offset) {
+            RETURN_ERRNO(THUNDEROS_ESPIPE);
+        }
+        for (int i = 0; i < iovcnt; i++) {
+            if (iov[i].len == 0) {
+                continue;
+            }
+            /* Only the first buffer waits; later ones take what is there */
+            int n = vfs_stream_read(file, iov[i].base, (uint32_t)iov[i].len, done > 0);
+            if (n < 0) {
+                if (done == 0) {
+                    /* errno already set by vfs_stream_read */
+                    return -1;
+                }
+                break;
+            }
+            done += n;
+            if ((uint32_t)n < iov[i].len) {
+                break;
+            }
         }
-        filename = last_slash + 1;
+        clear_errno();
+        return done;
     }
     
-    if (!parent_dir->ops || !parent_dir->ops->unlink) {
-        hal_uart_puts("vfs: No unlink operation\n");
-        RETURN_ERRNO(THUNDEROS_EIO);
+    uint64_t pos;
+    if (vfs_check_readable(file) != 0 || vfs_iov_start(file, offset, &pos) != 0) {
+        /* errno already set */
+        return -1;
     }
     
-    /* Check write permission on parent directory */
-    if (vfs_check_permission(parent_dir, VFS_ACCESS_WRITE) != 0) {
-        /* errno already set by vfs_check_permission */
-        return -1;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].len == 0) {
+            continue;
+        }
+        int n = vfs_read_at(file, pos, iov[i].base, (uint32_t)iov[i].len);
+        if (n < 0) {
+            if (done == 0) {
+                /* errno already set by vfs_read_at */
+                return -1;
+            }
+            break;
+        }
+        pos += n;
+        done += n;
+        if ((uint32_t)n < iov[i].len) {
+            break;  /* End of file */
+        }
     }
     
-    return parent_dir->ops->unlink(parent_dir, filename);
+    if (offset) {
+        *offset = (int64_t)pos;
+    } else {
+        file->pos = pos;
+    }
+    clear_errno();
+    return done;
+}
+
+/**
+ * Write from several buffers in one call
+ */
+int vfs_writev(int fd, const vfs_iovec_t *iov, int iovcnt, int64_t *offset) {
+    vfs_file_t *file = vfs_get_file(fd);
+    if (!file) {
+        /* errno already set by vfs_get_file */
+        return -1;
+    }
+    if (vfs_iov_check(iov, iovcnt) != 0) {
+        /* errno already set by vfs_iov_check */
+        return -1;
+    }
+    
+    int done = 0;
+    
+    if (file->type == VFS_TYPE_SOCKET) {
+        if (offset) {
+            RETURN_ERRNO(THUNDEROS_ESPIPE);
+        }
+        return vfs_socket_io(file, iov, iovcnt, 1);
+    }
+    
+    if (file->type == VFS_TYPE_PIPE) {
+        if (offset) {
+            RETURN_ERRNO(THUNDEROS_ESPIPE);
+        }
+        if (!file->pipe) {
+            RETURN_ERRNO(THUNDEROS_EINVAL);
+        }
+        for (int i = 0; i < iovcnt; i++) {
+            if (iov[i].len == 0) {
+                continue;
+            }
+            int n = pipe_write((pipe_t*)file->pipe, iov[i].base, (uint32_t)iov[i].len,
+                               (file->flags & O_NONBLOCK) != 0);
+            if (n < 0) {
+                if (done == 0) {
+                    /* errno already set by pipe_write */
+                    return -1;
+                }
+                break;
+            }
+            done += n;
+            if ((uint32_t)n < iov[i].len) {
+                break;
+            }
+        }
+        clear_errno();
+        return done;
+    }
+    
+    uint64_t pos;
+    if (vfs_check_writable(file) != 0 || vfs_iov_start(file, offset, &pos) != 0) {
+        /* errno already set */
+        return -1;
+    }
+    
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].len == 0) {
+            continue;
+        }
+        int n = vfs_write_at(file, pos, iov[i].base, (uint32_t)iov[i].len);
+        if (n < 0) {
+            if (done == 0) {
+                /* errno already set by vfs_write_at */
+                return -1;
+            }
+            break;
+        }
+        pos += n;
+        done += n;
+        if ((uint32_t)n < iov[i].len) {
+            break;
+        }
+    }
+    
+    if (offset) {
+        *offset = (int64_t)pos;
+    } else {
+        file->pos = pos;
+    }
+    clear_errno();
+    return done;
+}
+
+/**
+ * Seek within a file
+ */
+int64_t vfs_seek(int fd, int64_t offset, int whence) {
+    vfs_file_t *file = vfs_get_file(fd);
+    if (!file) {
+        /* errno already set by vfs_get_file */
+        return -1;
+    }
+    if (!file->node) {
+        RETURN_ERRNO(THUNDEROS_ESPIPE);
+    }
+    
+    int64_t base;
+    
+    switch (whence) {
+        case SEEK_SET:
+            base = 0;
+            break;
+            
+        case SEEK_CUR:
+            base = (int64_t)file->pos;
+            break;
+            
+        case SEEK_END:
+            base = (int64_t)file->node->size;
+            break;
+            
+        default:
+            hal_uart_puts("vfs: Invalid whence value\n");
+            RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    /* Neither a negative position nor one past INT64_MAX */
+    if (offset < -base || (offset > 0 && offset > INT64_MAX - base)) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    file->pos = (uint64_t)(base + offset);
+    clear_errno();
+    return (int64_t)file->pos;
+}
+
+/**
+ * Create a directory
+ */
+int vfs_mkdir(const char *path, uint32_t mode) {
+    if (!vfs_root_node() || !path) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    char dirname[MAX_PATH_COMPONENT_LEN];
+    vfs_node_t *parent_dir = vfs_resolve_parent(path, dirname);
+    if (!parent_dir) {
+        /* errno already set by vfs_resolve_parent */
+        return -1;
+    }
+    
+    int ret = -1;
+    if (!parent_dir->ops || !parent_dir->ops->mkdir) {
+        hal_uart_puts("vfs: No mkdir operation\n");
+        set_errno(THUNDEROS_EIO);
+    } else {
+        ret = parent_dir->ops->mkdir(parent_dir, dirname, mode);
+        if (ret == 0) {
+            /* The name may be cached as missing */
+            dcache_invalidate(parent_dir, dirname);
+        }
+    }
+    /* On failure errno is already set by mkdir */
+    
+    vfs_node_put(parent_dir);
+    return ret;
+}
+
+/**
+ * Remove a directory
+ */
+int vfs_rmdir(const char *path) {
+    if (!vfs_root_node() || !path) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    /* Can't remove root ("/" has no last component) */
+    char dirname[MAX_PATH_COMPONENT_LEN];
+    vfs_node_t *parent_dir = vfs_resolve_parent(path, dirname);
+    if (!parent_dir) {
+        /* errno already set by vfs_resolve_parent */
+        return -1;
+    }
+    
+    /* Remember the inode so entries cached under it can be dropped */
+    uint32_t inode = 0;
+    int mounted = 0;
+    vfs_node_t *target = dcache_lookup(parent_dir, dirname);
+    if (target) {
+        inode = target->inode;
+        mounted = vfs_mounted_on(target) != NULL;
+        vfs_node_put(target);
+    }
+    
+    int ret = -1;
+    if (mounted) {
+        /* Can't remove a directory something is mounted on */
+        set_errno(THUNDEROS_EBUSY);
+    } else if (!parent_dir->ops || !parent_dir->ops->rmdir) {
+        hal_uart_puts("vfs: No rmdir operation\n");
+        set_errno(THUNDEROS_EIO);
+    } else if (vfs_check_permission(parent_dir, VFS_ACCESS_WRITE) == 0) {
+        ret = parent_dir->ops->rmdir(parent_dir, dirname);
+        if (ret == 0) {
+            dcache_invalidate(parent_dir, dirname);
+            if (inode != 0) {
+                dcache_invalidate_dir(parent_dir->fs, inode);
+            }
+        }
+    }
+    /* On failure errno is already set by the check or rmdir */
+    
+    vfs_node_put(parent_dir);
+    return ret;
+}
+
+/**
+ * Remove a file
+ */
+int vfs_unlink(const char *path) {
+    if (!vfs_root_node() || !path) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    /* Must have a filename */
+    char filename[MAX_PATH_COMPONENT_LEN];
+    vfs_node_t *parent_dir = vfs_resolve_parent(path, filename);
+    if (!parent_dir) {
+        /* errno already set by vfs_resolve_parent */
+        return -1;
+    }
+    
+    /* Remember the inode so its cached pages can be dropped */
+    uint32_t inode = 0;
+    int mounted = 0;
+    vfs_node_t *target = dcache_lookup(parent_dir, filename);
+    if (target) {
+        inode = target->inode;
+        mounted = vfs_mounted_on(target) != NULL;
+        vfs_node_put(target);
+    }
+    
+    int ret = -1;
+    if (mounted) {
+        set_errno(THUNDEROS_EBUSY);
+    } else if (!parent_dir->ops || !parent_dir->ops->unlink) {
+        hal_uart_puts("vfs: No unlink operation\n");
+        set_errno(THUNDEROS_EIO);
+    } else if (vfs_check_permission(parent_dir, VFS_ACCESS_WRITE) == 0) {
+        ret = parent_dir->ops->unlink(parent_dir, filename);
+        if (ret == 0) {
+            dcache_invalidate(parent_dir, filename);
+            /* A memory filesystem's pages are the file: they go when
+             * its last reference does */
+            if (inode != 0 && !(parent_dir->fs->flags & VFS_FS_MEMORY)) {
+                page_cache_invalidate(parent_dir->fs, inode);
+            }
+            if (inode != 0) {
+                elf_cache_invalidate(parent_dir->fs, inode);
+            }
+        }
+    }
+    /* On failure errno is already set by the check or unlink */
+    
+    vfs_node_put(parent_dir);
+    return ret;
 }
 
 /**
  * Get file status
  */
-int vfs_stat(const char *path, uint32_t *size, uint32_t *type) {
+int vfs_stat(const char *path, uint64_t *size, uint32_t *type) {
     vfs_node_t *node = vfs_resolve_path(path);
     if (!node) {
         /* errno already set by vfs_resolve_path */
@@ -857,6 +1619,7 @@ int vfs_stat(const char *path, uint32_t *size, uint32_t *type) {
         *type = node->type;
     }
     
+    vfs_node_put(node);
     clear_errno();
     return 0;
 }
@@ -883,9 +1646,11 @@ int vfs_stat_full(const char *path, vfs_stat_t *statbuf) {
     statbuf->st_mode = node->mode;
     statbuf->st_uid = node->uid;
     statbuf->st_gid = node->gid;
-    statbuf->st_size = node->size;
+    statbuf->st_size = (uint32_t)node->size;
+    statbuf->st_size_high = (uint32_t)(node->size >> 32);
     statbuf->st_type = node->type;
     
+    vfs_node_put(node);
     clear_errno();
     return 0;
 }
@@ -895,6 +1660,7 @@ int vfs_stat_full(const char *path, vfs_stat_t *statbuf) {
  */
 int vfs_exists(const char *path) {
     vfs_node_t *node = vfs_resolve_path(path);
+    vfs_node_put(node);
     return node != NULL;
 }
 
@@ -911,15 +1677,22 @@ int vfs_exists(const char *path) {
  * - If process egid matches file gid, use group permissions  
  * - Otherwise, use other permissions
  * 
+ * Nobody, root included, may write to a read-only filesystem.
+ * 
  * @param node     VFS node to check
  * @param mode     Access mode (VFS_ACCESS_READ, VFS_ACCESS_WRITE, VFS_ACCESS_EXEC)
- * @return 0 if access allowed, -1 if denied (errno set to THUNDEROS_EACCES)
+ * @return 0 if access allowed, -1 if denied (errno set to THUNDEROS_EACCES,
+ *         or THUNDEROS_EFS_RDONLY for a write to a read-only filesystem)
  */
 int vfs_check_permission(vfs_node_t *node, int mode) {
     if (!node) {
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
     
+    if ((mode & VFS_ACCESS_WRITE) && vfs_node_readonly(node)) {
+        RETURN_ERRNO(THUNDEROS_EFS_RDONLY);
+    }
+    
     struct process *proc = process_current();
     if (!proc) {
         /* No current process (kernel context), allow access */
@@ -981,29 +1754,27 @@ int vfs_chmod(const char *path, uint32_t new_mode) {
         return -1;
     }
     
+    if (vfs_node_readonly(node)) {
+        vfs_node_put(node);
+        RETURN_ERRNO(THUNDEROS_EFS_RDONLY);
+    }
+    
     struct process *proc = process_current();
     
     /* Only root or file owner can change permissions */
     if (proc && proc->euid != 0 && proc->euid != node->uid) {
-        kfree(node);
+        vfs_node_put(node);
         RETURN_ERRNO(THUNDEROS_EACCES);
     }
     
     /* Update the node's mode (preserve file type bits, update permission bits) */
     node->mode = (node->mode & EXT2_S_IFMT) | (new_mode & 0xFFF);
     
-    /* Update the inode on disk if this is ext2 */
-    if (node->fs_data) {
-        ext2_inode_t *inode = (ext2_inode_t *)node->fs_data;
-        inode->i_mode = node->mode;
-        
-        ext2_fs_t *ext2_fs = (ext2_fs_t *)node->fs->fs_data;
-        if (ext2_fs) {
-            ext2_write_inode(ext2_fs, node->inode, inode);
-        }
-    }
+    /* Write it through: nothing else may touch the inode for a while */
+    icache_mark_dirty(node);
+    icache_writeback(node);
     
-    kfree(node);
+    vfs_node_put(node);
     clear_errno();
     return 0;
 }
@@ -1027,11 +1798,16 @@ int vfs_chown(const char *path, uint16_t uid, uint16_t gid) {
         return -1;
     }
     
+    if (vfs_node_readonly(node)) {
+        vfs_node_put(node);
+        RETURN_ERRNO(THUNDEROS_EFS_RDONLY);
+    }
+    
     struct process *proc = process_current();
     
     /* Only root can change ownership */
     if (proc && proc->euid != 0) {
-        kfree(node);
+        vfs_node_put(node);
         RETURN_ERRNO(THUNDEROS_EACCES);
     }
     
@@ -1039,19 +1815,11 @@ int vfs_chown(const char *path, uint16_t uid, uint16_t gid) {
     node->uid = uid;
     node->gid = gid;
     
-    /* Update the inode on disk if this is ext2 */
-    if (node->fs_data) {
-        ext2_inode_t *inode = (ext2_inode_t *)node->fs_data;
-        inode->i_uid = uid;
-        inode->i_gid = gid;
-        
-        ext2_fs_t *ext2_fs = (ext2_fs_t *)node->fs->fs_data;
-        if (ext2_fs) {
-            ext2_write_inode(ext2_fs, node->inode, inode);
-        }
-    }
+    /* Write it through: nothing else may touch the inode for a while */
+    icache_mark_dirty(node);
+    icache_writeback(node);
     
-    kfree(node);
+    vfs_node_put(node);
     clear_errno();
     return 0;
 }
@@ -1067,10 +1835,11 @@ int vfs_chown(const char *path, uint16_t uid, uint16_t gid) {
  * pipefd[0] is the read end, pipefd[1] is the write end.
  * 
  * @param pipefd Array of 2 integers to store file descriptors
+ * @param flags  O_NONBLOCK or 0, for both ends
  * @return 0 on success, -1 on error
  */
-int vfs_create_pipe(int pipefd[2]) {
-    if (!pipefd) {
+int vfs_create_pipe(int pipefd[2], uint32_t flags) {
+    if (!pipefd || (flags & ~O_NONBLOCK)) {
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
     
@@ -1099,18 +1868,16 @@ int vfs_create_pipe(int pipefd[2]) {
     }
     
     /* Set up read end (pipefd[0]) */
-    g_file_table[read_fd].pipe = pipe;
-    g_file_table[read_fd].type = VFS_TYPE_PIPE;
-    g_file_table[read_fd].flags = O_RDONLY;
-    g_file_table[read_fd].node = NULL;
-    g_file_table[read_fd].pos = 0;
+    vfs_file_t *read_file = vfs_get_file(read_fd);
+    read_file->pipe = pipe;
+    read_file->type = VFS_TYPE_PIPE;
+    read_file->flags = O_RDONLY | flags;
     
     /* Set up write end (pipefd[1]) */
-    g_file_table[write_fd].pipe = pipe;
-    g_file_table[write_fd].type = VFS_TYPE_PIPE;
-    g_file_table[write_fd].flags = O_WRONLY;
-    g_file_table[write_fd].node = NULL;
-    g_file_table[write_fd].pos = 0;
+    vfs_file_t *write_file = vfs_get_file(write_fd);
+    write_file->pipe = pipe;
+    write_file->type = VFS_TYPE_PIPE;
+    write_file->flags = O_WRONLY | flags;
     
     /* Return file descriptors */
     pipefd[0] = read_fd;
@@ -1119,3 +1886,761 @@ int vfs_create_pipe(int pipefd[2]) {
     clear_errno();
     return 0;
 }
+
+/**
+ * Check whether a descriptor is in non-blocking mode
+ */
+int vfs_is_nonblock(int fd) {
+    vfs_file_t *file = fdtable_get(fdtable_current(), fd);
+    return file && (file->flags & O_NONBLOCK) != 0;
+}
+
+/**
+ * Control an open file
+ * 
+ * @param fd   File descriptor
+ * @param cmd  F_* command
+ * @param arg  Command argument
+ * @return Command result, -1 on error
+ */
+int vfs_fcntl(int fd, int cmd, uint64_t arg) {
+    vfs_file_t *file = vfs_get_file(fd);
+    if (!file) {
+        /* errno already set by vfs_get_file */
+        return -1;
+    }
+    
+    switch (cmd) {
+        case F_GETFL:
+            clear_errno();
+            return (int)file->flags;
+            
+        case F_SETFL:
+            file->flags = (file->flags & ~VFS_SETFL_MASK) | ((uint32_t)arg & VFS_SETFL_MASK);
+            clear_errno();
+            return 0;
+            
+        default:
+            break;
+    }
+    
+    if (file->type != VFS_TYPE_PIPE || !file->pipe) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    switch (cmd) {
+        case F_GETPIPE_SZ:
+            return pipe_get_size((pipe_t*)file->pipe);
+            
+        case F_SETPIPE_SZ:
+            /* errno set by pipe_set_size */
+            return pipe_set_size((pipe_t*)file->pipe, (size_t)arg);
+            
+        default:
+            RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+}
+
+/**
+ * Send a device-specific request to an open device
+ * 
+ * @param fd      File descriptor
+ * @param request Request number
+ * @param arg     Request argument
+ * @return Request result, -1 on error
+ */
+int vfs_ioctl(int fd, uint32_t request, uint64_t arg) {
+    vfs_file_t *file = vfs_get_file(fd);
+    if (!file) {
+        /* errno already set by vfs_get_file */
+        return -1;
+    }
+    
+    if (file->type == VFS_TYPE_PERF) {
+        return perf_event_ioctl((perf_event_t*)file->perf, request, arg);
+    }
+    
+    if (file->type == VFS_TYPE_CONSOLE) {
+        /* The line discipline of the caller's terminal; errno set there */
+        return vterm_ioctl(process_get_tty(process_current()), request, arg);
+    }
+    
+    vfs_node_t *node = file->node;
+    if (!node || !node->ops || !node->ops->ioctl) {
+        RETURN_ERRNO(THUNDEROS_ENOTTY);
+    }
+    /* errno set by the device */
+    return node->ops->ioctl(node, request, arg);
+}
+
+/* ========================================================================
+ * Splice Support
+ *
+ * Data moves between files and pipes by page reference where it can:
+ * file pages go into a pipe straight from the page cache, and pipe pages
+ * are written to a file from where they lie, so nothing passes through
+ * a user buffer. Offsets, when given, are used instead of the file
+ * position and the position is left alone.
+ * ======================================================================== */
+
+/**
+ * Look up a regular file that may be read through the page cache
+ */
+static vfs_file_t *vfs_get_readable_file(int fd) {
+    vfs_file_t *file = vfs_get_file(fd);
+    if (!file) {
+        /* errno already set by vfs_get_file */
+        return NULL;
+    }
+    if (file->type != VFS_TYPE_FILE || !file->node) {
+        RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+    }
+    
+    /* Check if opened for reading */
+    if ((file->flags & O_WRONLY) && !(file->flags & O_RDWR)) {
+        hal_uart_puts("vfs: File not open for reading\n");
+        RETURN_ERRNO_NULL(THUNDEROS_EACCES);
+    }
+    return file;
+}
+
+/**
+ * Look up the pipe behind a descriptor, or NULL (without errno) if it is
+ * not a pipe
+ */
+static pipe_t *vfs_fd_pipe(vfs_file_t *file) {
+    if (file->type == VFS_TYPE_PIPE) {
+        return (pipe_t*)file->pipe;
+    }
+    return NULL;
+}
+
+/**
+ * Queue file pages in a pipe by reference
+ * 
+ * Blocks for room only before the first page, so a process splicing
+ * more than the pipe holds gets a short count instead of waiting on
+ * itself.
+ */
+static int vfs_file_to_pipe(vfs_file_t *in, int64_t *off, pipe_t *pipe, uint32_t len,
+                            int nonblock) {
+    if (off && *off < 0) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    uint64_t pos = off ? (uint64_t)*off : in->pos;
+    uint32_t done = 0;
+    
+    while (done < len && pos < in->node->size) {
+        if (done > 0 && pipe->nr_bufs >= pipe->max_bufs) {
+            break;
+        }
+        
+        uint32_t in_page = pos % PAGE_SIZE;
+        uint32_t chunk = PAGE_SIZE - in_page;
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+        if (chunk > in->node->size - pos) {
+            chunk = (uint32_t)(in->node->size - pos);
+        }
+        
+        uintptr_t page = page_cache_get_page(in->node, (uint32_t)(pos / PAGE_SIZE), NULL);
+        if (!page) {
+            if (done == 0) {
+                /* errno already set by page_cache_get_page */
+                return -1;
+            }
+            break;
+        }
+        
+        /* The pipe takes over our reference */
+        if (pipe_splice_page(pipe, page, in_page, chunk, nonblock) < 0) {
+            put_page(page);
+            if (done == 0) {
+                /* errno already set by pipe_splice_page */
+                return -1;
+            }
+            break;
+        }
+        
+        done += chunk;
+        pos += chunk;
+    }
+    
+    if (off) {
+        *off = (int64_t)pos;
+    } else {
+        in->pos = pos;
+    }
+    
+    clear_errno();
+    return (int)done;
+}
+
+/**
+ * pipe_splice_out() consumer writing into a regular file
+ */
+typedef struct {
+    vfs_file_t *file;
+    uint64_t pos;
+} vfs_splice_sink_t;
+
+static int vfs_splice_sink(void *ctx, const void *data, uint32_t len) {
+    vfs_splice_sink_t *sink = (vfs_splice_sink_t *)ctx;
+    int written = vfs_write_at(sink->file, sink->pos, data, len);
+    if (written > 0) {
+        sink->pos += (uint64_t)written;
+    }
+    return written;
+}
+
+/**
+ * Write pipe data into a file straight from the pipe's pages
+ */
+static int vfs_pipe_to_file(pipe_t *pipe, vfs_file_t *out, int64_t *off, uint32_t len,
+                            int nonblock) {
+    if (off && *off < 0) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (vfs_check_writable(out) != 0) {
+        /* errno already set by vfs_check_writable */
+        return -1;
+    }
+    
+    vfs_splice_sink_t sink = { out, off ? (uint64_t)*off : out->pos };
+    int moved = pipe_splice_out(pipe, vfs_splice_sink, &sink, len, nonblock);
+    if (moved < 0) {
+        /* errno already set by pipe_splice_out */
+        return -1;
+    }
+    
+    if (off) {
+        *off = (int64_t)sink.pos;
+    } else {
+        out->pos = sink.pos;
+    }
+    return moved;
+}
+
+/**
+ * Move data between a pipe and a file without a user copy
+ * 
+ * @param fd_in   Source descriptor
+ * @param off_in  Source offset (NULL for the file position; must be NULL for a pipe)
+ * @param fd_out  Destination descriptor
+ * @param off_out Destination offset (as off_in)
+ * @param len     Maximum bytes to move
+ * @param flags   SPLICE_F_* flags
+ * @return Bytes moved, 0 at end of input, -1 on error
+ */
+int vfs_splice(int fd_in, int64_t *off_in, int fd_out, int64_t *off_out, uint32_t len,
+               unsigned int flags) {
+    vfs_file_t *in = vfs_get_file(fd_in);
+    vfs_file_t *out = vfs_get_file(fd_out);
+    if (!in || !out) {
+        /* errno already set by vfs_get_file */
+        return -1;
+    }
+    
+    pipe_t *in_pipe = vfs_fd_pipe(in);
+    pipe_t *out_pipe = vfs_fd_pipe(out);
+    
+    /* A pipe and a socket: an AF_UNIX stream moves the pages on through
+     * its own pipes */
+    vfs_file_t *sock_file = in_pipe ? out : in;
+    if ((in_pipe || out_pipe) && sock_file->type == VFS_TYPE_SOCKET) {
+        if (off_in || off_out) {
+            RETURN_ERRNO(THUNDEROS_ESPIPE);
+        }
+        socket_t *sock = (socket_t *)sock_file->socket;
+        int nonblock = (flags & SPLICE_F_NONBLOCK) || ((in->flags | out->flags) & O_NONBLOCK);
+        socket_get(sock);
+        int moved = in_pipe ? socket_splice_write(sock, in_pipe, len, nonblock)
+                            : socket_splice_read(sock, out_pipe, len, nonblock);
+        socket_put(sock);
+        /* errno set by socket_splice_write/socket_splice_read */
+        return moved;
+    }
+    
+    /* Exactly one end must be a pipe, and pipes have no offset */
+    if ((in_pipe != NULL) == (out_pipe != NULL)) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if ((in_pipe && off_in) || (out_pipe && off_out)) {
+        RETURN_ERRNO(THUNDEROS_ESPIPE);
+    }
+    
+    if (out_pipe) {
+        if (!vfs_get_readable_file(fd_in)) {
+            /* errno already set by vfs_get_readable_file */
+            return -1;
+        }
+        int nonblock = (flags & SPLICE_F_NONBLOCK) || (out->flags & O_NONBLOCK);
+        return vfs_file_to_pipe(in, off_in, out_pipe, len, nonblock);
+    }
+    
+    if (out->type != VFS_TYPE_FILE) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    int nonblock = (flags & SPLICE_F_NONBLOCK) || (in->flags & O_NONBLOCK);
+    return vfs_pipe_to_file(in_pipe, out, off_out, len, nonblock);
+}
+
+/**
+ * Duplicate pipe data into another pipe without consuming it
+ * 
+ * @param fd_in  Read end of the source pipe
+ * @param fd_out Write end of the destination pipe
+ * @param len    Maximum bytes to duplicate
+ * @param flags  SPLICE_F_* flags
+ * @return Bytes duplicated, 0 at end of input, -1 on error
+ */
+int vfs_tee(int fd_in, int fd_out, uint32_t len, unsigned int flags) {
+    vfs_file_t *in = vfs_get_file(fd_in);
+    vfs_file_t *out = vfs_get_file(fd_out);
+    if (!in || !out) {
+        /* errno already set by vfs_get_file */
+        return -1;
+    }
+    
+    pipe_t *in_pipe = vfs_fd_pipe(in);
+    pipe_t *out_pipe = vfs_fd_pipe(out);
+    if (!in_pipe || !out_pipe) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    int nonblock = (flags & SPLICE_F_NONBLOCK) || ((in->flags | out->flags) & O_NONBLOCK);
+    
+    /* errno set by pipe_tee */
+    return pipe_tee(in_pipe, out_pipe, len, nonblock);
+}
+
+/**
+ * Copy file data to a pipe or another file from the page cache
+ * 
+ * @param out_fd Destination (pipe or regular file)
+ * @param in_fd  Source regular file
+ * @param offset Source offset (NULL for the file position)
+ * @param count  Maximum bytes to copy
+ * @return Bytes copied, 0 at end of file, -1 on error
+ */
+int vfs_sendfile(int out_fd, int in_fd, int64_t *offset, uint32_t count) {
+    vfs_file_t *in = vfs_get_readable_file(in_fd);
+    if (!in) {
+        /* errno already set by vfs_get_readable_file */
+        return -1;
+    }
+    vfs_file_t *out = vfs_get_file(out_fd);
+    if (!out) {
+        /* errno already set by vfs_get_file */
+        return -1;
+    }
+    
+    pipe_t *out_pipe = vfs_fd_pipe(out);
+    if (out_pipe) {
+        return vfs_file_to_pipe(in, offset, out_pipe, count, (out->flags & O_NONBLOCK) != 0);
+    }
+    
+    if (out->type != VFS_TYPE_FILE || out == in) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (vfs_check_writable(out) != 0) {
+        /* errno already set by vfs_check_writable */
+        return -1;
+    }
+    if (offset && *offset < 0) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    /* File to file: one copy, from the cached page into the destination */
+    uint64_t pos = offset ? (uint64_t)*offset : in->pos;
+    uint32_t done = 0;
+    int error = 0;
+    
+    while (done < count && pos < in->node->size) {
+        uint32_t in_page = pos % PAGE_SIZE;
+        uint32_t chunk = PAGE_SIZE - in_page;
+        if (chunk > count - done) {
+            chunk = count - done;
+        }
+        if (chunk > in->node->size - pos) {
+            chunk = (uint32_t)(in->node->size - pos);
+        }
+        
+        uintptr_t page = page_cache_get_page(in->node, (uint32_t)(pos / PAGE_SIZE), NULL);
+        if (!page) {
+            error = 1;
+            break;
+        }
+        int written = vfs_write_at(out, out->pos, (const char *)page + in_page, chunk);
+        put_page(page);
+        if (written <= 0) {
+            error = written < 0;
+            break;
+        }
+        
+        out->pos += (uint64_t)written;
+        done += (uint32_t)written;
+        pos += (uint64_t)written;
+        if ((uint32_t)written < chunk) {
+            break;
+        }
+    }
+    
+    if (offset) {
+        *offset = (int64_t)pos;
+    } else {
+        in->pos = pos;
+    }
+    
+    if (error && done == 0) {
+        /* errno already set by page_cache_get_page or the write */
+        return -1;
+    }
+    clear_errno();
+    return (int)done;
+}
+
+/* ========================================================================
+ * Readiness Polling
+ * ======================================================================== */
+
+/**
+ * Get the readiness of an open file
+ */
+int vfs_poll_file(vfs_file_t *file, struct poll_table *pt) {
+    switch (file->type) {
+        case VFS_TYPE_PIPE:
+            return pipe_poll((pipe_t*)file->pipe, (file->flags & O_WRONLY) != 0, pt);
+            
+        case VFS_TYPE_EPOLL:
+            return eventpoll_poll((eventpoll_t*)file->epoll, pt);
+            
+        case VFS_TYPE_SIGNALFD:
+            return signalfd_poll((signalfd_t*)file->signalfd, pt);
+            
+        case VFS_TYPE_SOCKET:
+            return socket_poll((socket_t*)file->socket, pt);
+            
+        case VFS_TYPE_AIO:
+            return aio_poll((aio_ctx_t*)file->aio, pt);
+            
+        default:
+            /* Disk I/O never waits for another process */
+            return POLLIN | POLLOUT;
+    }
+}
+
+/**
+ * Create an epoll instance and a descriptor for it
+ */
+int vfs_create_epoll(void) {
+    eventpoll_t *ep = eventpoll_create();
+    if (!ep) {
+        /* errno already set by eventpoll_create */
+        return -1;
+    }
+    
+    int fd = vfs_alloc_fd();
+    if (fd < 0) {
+        eventpoll_put(ep);
+        /* errno already set by vfs_alloc_fd */
+        return -1;
+    }
+    
+    vfs_file_t *file = vfs_get_file(fd);
+    file->type = VFS_TYPE_EPOLL;
+    file->epoll = ep;
+    file->flags = O_RDONLY;
+    
+    clear_errno();
+    return fd;
+}
+
+/**
+ * Get the epoll instance behind a descriptor
+ */
+struct eventpoll *vfs_get_epoll(int fd) {
+    vfs_file_t *file = vfs_get_file(fd);
+    if (!file) {
+        /* errno already set by vfs_get_file */
+        return NULL;
+    }
+    if (file->type != VFS_TYPE_EPOLL || !file->epoll) {
+        RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+    }
+    return (struct eventpoll*)file->epoll;
+}
+
+/**
+ * Get a descriptor for a shared memory object
+ */
+int vfs_open_shm(struct shm_object *shm, uint32_t flags) {
+    int fd = vfs_alloc_fd();
+    if (fd < 0) {
+        /* errno already set by vfs_alloc_fd */
+        return -1;
+    }
+    
+    vfs_file_t *file = vfs_get_file(fd);
+    file->type = VFS_TYPE_SHM;
+    file->shm = shm;
+    file->flags = flags;
+    
+    clear_errno();
+    return fd;
+}
+
+/**
+ * Get the shared memory object behind a descriptor
+ */
+struct shm_object *vfs_get_shm(int fd) {
+    vfs_file_t *file = vfs_get_file(fd);
+    if (!file) {
+        /* errno already set by vfs_get_file */
+        return NULL;
+    }
+    if (file->type != VFS_TYPE_SHM || !file->shm) {
+        RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+    }
+    return (struct shm_object*)file->shm;
+}
+
+/**
+ * Change the size of an open file
+ */
+int vfs_ftruncate(int fd, uint64_t length) {
+    vfs_file_t *file = vfs_get_file(fd);
+    if (!file) {
+        /* errno already set by vfs_get_file */
+        return -1;
+    }
+    
+    /* Filesystems have no truncate operation yet */
+    if (file->type != VFS_TYPE_SHM || !file->shm) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (!(file->flags & O_RDWR)) {
+        RETURN_ERRNO(THUNDEROS_EBADF);
+    }
+    
+    return shm_truncate((shm_object_t*)file->shm, length);
+}
+
+/**
+ * Write a filesystem's buffered changes to its device and flush its cache
+ */
+static int vfs_sync_fs(vfs_filesystem_t *fs) {
+    if (!fs || !fs->ops || !fs->ops->sync) {
+        return 0;
+    }
+    return fs->ops->sync(fs);
+}
+
+/**
+ * Make an open file durable
+ */
+int vfs_fsync(int fd, int datasync) {
+    (void)datasync;    /* Every pending node change is needed for the data */
+    
+    vfs_file_t *file = vfs_get_file(fd);
+    if (!file) {
+        /* errno already set by vfs_get_file */
+        return -1;
+    }
+    vfs_node_t *node = file->node;
+    if (!node || (file->type != VFS_TYPE_FILE && file->type != VFS_TYPE_DIRECTORY)) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    /* Data first, so the inode written next describes blocks on disk */
+    if (page_cache_writeback(node, 0, node->size) != 0) {
+        /* errno already set by page_cache_writeback */
+        return -1;
+    }
+    if (icache_writeback(node) != 0) {
+        /* errno already set by write_inode */
+        return -1;
+    }
+    if (vfs_sync_fs(node->fs) != 0) {
+        /* errno already set by the filesystem */
+        return -1;
+    }
+    
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Make every mounted filesystem durable
+ */
+int vfs_sync(void) {
+    int result = 0;
+    
+    if (page_cache_sync(NULL) != 0) {
+        result = -1;
+    }
+    if (icache_sync(NULL) != 0) {
+        result = -1;
+    }
+    
+    /* Syncing sleeps, so no read-side section: the root is only replaced
+     * while booting, and mount slots are never emptied */
+    rcu_read_lock();
+    vfs_filesystem_t *root = rcu_dereference(g_root_fs);
+    rcu_read_unlock();
+    if (vfs_sync_fs(root) != 0) {
+        result = -1;
+    }
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        rcu_read_lock();
+        vfs_filesystem_t *fs = rcu_dereference(g_mounts[i].fs);
+        rcu_read_unlock();
+        if (vfs_sync_fs(fs) != 0) {
+            result = -1;
+        }
+    }
+    
+    if (result == 0) {
+        clear_errno();
+    } else {
+        set_errno(THUNDEROS_EIO);
+    }
+    return result;
+}
+
+/**
+ * Create a signalfd and a descriptor for it
+ */
+int vfs_create_signalfd(uint64_t mask, uint32_t flags) {
+    signalfd_t *sfd = signalfd_create(mask);
+    if (!sfd) {
+        /* errno already set by signalfd_create */
+        return -1;
+    }
+    
+    int fd = vfs_alloc_fd();
+    if (fd < 0) {
+        signalfd_put(sfd);
+        /* errno already set by vfs_alloc_fd */
+        return -1;
+    }
+    
+    vfs_file_t *file = vfs_get_file(fd);
+    file->type = VFS_TYPE_SIGNALFD;
+    file->signalfd = sfd;
+    file->flags = O_RDONLY | (flags & O_NONBLOCK);
+    
+    clear_errno();
+    return fd;
+}
+
+/**
+ * Get the signalfd behind a descriptor
+ */
+struct signalfd *vfs_get_signalfd(int fd) {
+    vfs_file_t *file = vfs_get_file(fd);
+    if (!file) {
+        /* errno already set by vfs_get_file */
+        return NULL;
+    }
+    if (file->type != VFS_TYPE_SIGNALFD || !file->signalfd) {
+        RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+    }
+    return (struct signalfd*)file->signalfd;
+}
+
+/**
+ * Make a descriptor for a socket
+ */
+int vfs_create_socket(struct socket *sock, uint32_t flags) {
+    int fd = vfs_alloc_fd();
+    if (fd < 0) {
+        /* errno already set by vfs_alloc_fd */
+        return -1;
+    }
+    
+    vfs_file_t *file = vfs_get_file(fd);
+    file->type = VFS_TYPE_SOCKET;
+    file->socket = sock;
+    file->flags = O_RDWR | (flags & O_NONBLOCK);
+    
+    clear_errno();
+    return fd;
+}
+
+/**
+ * Get the socket behind a descriptor
+ */
+struct socket *vfs_get_socket(int fd) {
+    vfs_file_t *file = vfs_get_file(fd);
+    if (!file) {
+        /* errno already set by vfs_get_file */
+        return NULL;
+    }
+    if (file->type != VFS_TYPE_SOCKET || !file->socket) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOTSOCK);
+    }
+    return (struct socket*)file->socket;
+}
+
+/**
+ * Make a descriptor for a performance counter
+ */
+int vfs_create_perf_event(struct perf_event *event) {
+    int fd = vfs_alloc_fd();
+    if (fd < 0) {
+        /* errno already set by vfs_alloc_fd */
+        return -1;
+    }
+    
+    vfs_file_t *file = vfs_get_file(fd);
+    file->type = VFS_TYPE_PERF;
+    file->perf = event;
+    file->flags = O_RDONLY;
+    
+    clear_errno();
+    return fd;
+}
+
+/**
+ * Create an asynchronous I/O context and a descriptor for it
+ */
+int vfs_create_aio(uint32_t flags) {
+    aio_ctx_t *ctx = aio_create();
+    if (!ctx) {
+        /* errno already set by aio_create */
+        return -1;
+    }
+    
+    int fd = vfs_alloc_fd();
+    if (fd < 0) {
+        aio_put(ctx);
+        /* errno already set by vfs_alloc_fd */
+        return -1;
+    }
+    
+    vfs_file_t *file = vfs_get_file(fd);
+    file->type = VFS_TYPE_AIO;
+    file->aio = ctx;
+    file->flags = O_RDONLY | (flags & O_NONBLOCK);
+    
+    clear_errno();
+    return fd;
+}
+
+/**
+ * Get the asynchronous I/O context behind a descriptor
+ */
+struct aio_ctx *vfs_get_aio(int fd) {
+    vfs_file_t *file = vfs_get_file(fd);
+    if (!file) {
+        /* errno already set by vfs_get_file */
+        return NULL;
+    }
+    if (file->type != VFS_TYPE_AIO || !file->aio) {
+        RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+    }
+    return (struct aio_ctx*)file->aio;
+}
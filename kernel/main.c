@@ -10,7 +10,11 @@
 #include "mm/kmalloc.h"
 #include "mm/paging.h"
 #include "mm/dma.h"
+#include "mm/reclaim.h"
+#include "mm/swap.h"
+#include "mm/kstack.h"
 #include "kernel/kstring.h"
+#include "kernel/errno.h"
 #include "kernel/process.h"
 #include "kernel/scheduler.h"
 #include "kernel/time.h"
@@ -18,16 +22,36 @@
 #include "kernel/syscall.h"
 #include "kernel/shell.h"
 #include "kernel/pipe.h"
+#include "kernel/workqueue.h"
+#include "kernel/softirq.h"
+#include "kernel/trace.h"
+#include "kernel/schedlat.h"
+#include "kernel/prof.h"
+#include "kernel/perf_event.h"
 #include "kernel/elf_loader.h"
 #include "kernel/constants.h"
+#include "kernel/fdt.h"
+#include "kernel/smp.h"
+#include "kernel/spinlock.h"
+#include "kernel/bootstage.h"
+#include "kernel/vdso.h"
 #include "drivers/virtio_blk.h"
 #include "drivers/virtio_gpu.h"
+#include "drivers/virtio_net.h"
 #include "drivers/framebuffer.h"
 #include "drivers/fbconsole.h"
 #include "drivers/vterm.h"
+#include "drivers/fbdev.h"
 #include "drivers/font.h"
 #include "fs/ext2.h"
 #include "fs/vfs.h"
+#include "fs/page_cache.h"
+#include "fs/tmpfs.h"
+#include "fs/devfs.h"
+#include "fs/procfs.h"
+#include "fs/rofs.h"
+#include "net/skbuff.h"
+#include "net/net.h"
 
 /* Constants */
 #define TEST_ALLOC_SIZE         256
@@ -47,12 +71,17 @@ extern void test_elf_all(void);
 extern void run_memory_isolation_tests(void);
 #endif
 
+#ifdef ENABLE_KERNEL_BENCH
+extern void run_kernel_benchmarks(void);
+#endif
+
 /* Forward declarations for helper functions */
 static void print_boot_banner(void);
 static void init_interrupts(void);
 static void init_memory(void);
 static int init_block_device(void);
 static int init_gpu_device(void);
+static int init_net_device(void);
 static int init_filesystem(void);
 static void launch_shell(void);
 static void halt_cpu(void);
@@ -90,23 +119,63 @@ static void init_interrupts(void) {
 
     hal_timer_init(TIMER_INTERVAL_US);
     hal_uart_puts("[OK] Timer interrupts enabled\n");
+
+    if (hal_uart_enable_interrupts() == 0) {
+        hal_uart_puts("[OK] UART interrupts enabled\n");
+    }
 }
 
 /*
- * Initialize physical memory manager, virtual memory, and DMA allocator.
+ * Initialize physical memory manager, virtual memory, DMA allocator and
+ * packet buffers.
  */
 static void init_memory(void) {
     uintptr_t kernel_end_addr = (uintptr_t)_kernel_end;
-    size_t free_memory_size = RAM_END_ADDRESS - kernel_end_addr;
+    uintptr_t ram_end = RAM_END_ADDRESS;
+
+    // Size RAM from the device tree; fall back to the build-time default.
+    // The blob itself sits in RAM and may be reused once the PMM is up.
+    uintptr_t ram_base;
+    size_t ram_size;
+    if (fdt_get_memory(boot_fdt_addr, &ram_base, &ram_size) == 0 &&
+        ram_base == KERNEL_LOAD_ADDRESS && ram_base + ram_size > kernel_end_addr) {
+        ram_end = ram_base + ram_size;
+        hal_uart_puts("[OK] Device tree: ");
+        kprint_dec(ram_size / (1024 * 1024));
+        hal_uart_puts("MB RAM\n");
+    } else {
+        hal_uart_puts("[WARN] No device tree memory node, assuming default RAM size\n");
+    }
+
+    size_t free_memory_size = ram_end - kernel_end_addr;
 
     pmm_init(kernel_end_addr, free_memory_size);
     hal_uart_puts("[OK] Memory management initialized\n");
 
-    paging_init(KERNEL_LOAD_ADDRESS, kernel_end_addr);
+    paging_init(KERNEL_LOAD_ADDRESS, kernel_end_addr, ram_end);
     hal_uart_puts("[OK] Virtual memory initialized\n");
 
     dma_init();
     hal_uart_puts("[OK] DMA allocator initialized\n");
+
+    // Also before the first user page table, which shares its page tables
+    if (kstack_init() != 0) {
+        hal_uart_puts("[FAIL] No memory for the kernel stack area\n");
+        halt_cpu();
+    }
+    hal_uart_puts("[OK] Kernel stacks: ");
+    kprint_dec(KSTACK_SLOTS);
+    hal_uart_puts(" guarded slots\n");
+
+    // Before the first user page table, which maps it
+    if (vdso_init() == 0) {
+        hal_uart_puts("[OK] vDSO clock ready\n");
+    } else {
+        hal_uart_puts("[WARN] No vDSO: clock_gettime() traps\n");
+    }
+
+    skb_init();
+    hal_uart_puts("[OK] Packet buffers initialized\n");
 }
 
 #ifdef ENABLE_KERNEL_TESTS
@@ -232,6 +301,11 @@ static int init_gpu_device(void) {
                     }
                 }
             }
+            
+            /* Direct framebuffer access for user programs */
+            if (fbdev_init() == 0) {
+                hal_uart_puts("[OK] Framebuffer device at /dev/fb0\n");
+            }
             return 0;
         }
     }
@@ -247,18 +321,62 @@ static int init_gpu_device(void) {
 }
 
 /*
- * Mount ext2 filesystem and register with VFS.
- * Returns 0 on success, -1 on failure.
+ * Probe the VirtIO MMIO slots for a network device.
  */
-static int init_filesystem(void) {
-    virtio_blk_device_t *block_device = virtio_blk_get_device();
-    if (!block_device) {
-        return -1;
+static int init_net_device(void) {
+    for (int probe_index = 0; probe_index < VIRTIO_PROBE_COUNT; probe_index++) {
+        uint64_t device_address = VIRTIO_BASE_ADDRESS + (probe_index * VIRTIO_ADDRESS_STRIDE);
+        int irq_number = probe_index + 1;
+
+        if (virtio_net_init(device_address, irq_number) == 0) {
+            hal_uart_puts("[OK] VirtIO network device initialized\n");
+            return 0;
+        }
     }
 
+    hal_uart_puts("[INFO] No VirtIO network device found\n");
+    return -1;
+}
+
+/*
+ * Device probes that need neither the root filesystem nor each other run
+ * on the workqueue, so their waits on the device overlap the block device
+ * and mount on the main path. Each records its own boot stage.
+ */
+static void gpu_probe_work_fn(work_t *work) {
+    (void)work;
+    uint64_t start = hal_timer_get_time_us();
+
+    /* Optional - console works without it */
+    init_gpu_device();
+    bootstage_record("gpu", start);
+}
+
+static void net_probe_work_fn(work_t *work) {
+    (void)work;
+    uint64_t start = hal_timer_get_time_us();
+
+    /* Optional as well; the stack runs on loopback without one */
+    init_net_device();
+    if (net_init() == 0) {
+        hal_uart_puts("[OK] Network stack up (10.0.3.15/24)\n");
+    } else {
+        hal_uart_puts("[OK] Network stack up (loopback only)\n");
+    }
+    bootstage_record("net", start);
+}
+
+static work_t gpu_probe_work = WORK_INIT(gpu_probe_work_fn);
+static work_t net_probe_work = WORK_INIT(net_probe_work_fn);
+
+/*
+ * Mount the ext2 filesystem on the block device for the VFS.
+ * Returns the filesystem, or NULL on failure.
+ */
+static vfs_filesystem_t *init_ext2_root(virtio_blk_device_t *block_device) {
     if (ext2_mount(&g_root_ext2_fs, block_device) != 0) {
         hal_uart_puts("[FAIL] Failed to mount ext2 filesystem\n");
-        return -1;
+        return NULL;
     }
 
     hal_uart_puts("[OK] ext2 filesystem mounted successfully!\n");
@@ -278,15 +396,111 @@ static int init_filesystem(void) {
     vfs_filesystem_t *vfs_fs = ext2_vfs_mount(&g_root_ext2_fs);
     if (!vfs_fs) {
         hal_uart_puts("[WARN] Failed to mount ext2 into VFS\n");
+        return NULL;
+    }
+    return vfs_fs;
+}
+
+/*
+ * Start swapping to the area at the first 1MB boundary past the root
+ * filesystem (`make fs` puts one there), if the disk has one.
+ */
+static void init_swap(uint64_t root_bytes) {
+    uint64_t sector = (root_bytes + VIRTIO_BLK_SECTOR_SIZE - 1) / VIRTIO_BLK_SECTOR_SIZE;
+    sector = (sector + SWAP_ALIGN_SECTORS - 1) & ~(uint64_t)(SWAP_ALIGN_SECTORS - 1);
+
+    if (swap_on(sector) != 0) {
+        if (get_errno() == THUNDEROS_EINVAL) {
+            hal_uart_puts("[--] No swap area\n");
+        } else {
+            hal_uart_puts("[WARN] Failed to start swap: ");
+            hal_uart_puts(thunderos_strerror(get_errno()));
+            hal_uart_puts("\n");
+        }
+        return;
+    }
+
+    swap_stats_t stats;
+    swap_get_stats(&stats);
+    hal_uart_puts("[OK] Swap: ");
+    hal_uart_put_uint32((uint32_t)(stats.total_slots * (PAGE_SIZE / 1024)));
+    hal_uart_puts(" KB at sector ");
+    hal_uart_put_uint32((uint32_t)sector);
+    hal_uart_puts("\n");
+}
+
+/*
+ * Mount the root filesystem (a rofs image, else ext2), then tmpfs on /tmp,
+ * devfs on /dev and procfs on /proc, and start swap past the root.
+ * Returns 0 on success, -1 on failure.
+ */
+static int init_filesystem(void) {
+    virtio_blk_device_t *block_device = virtio_blk_get_device();
+    if (!block_device) {
         return -1;
     }
 
+    uint64_t root_bytes;
+    vfs_filesystem_t *vfs_fs = rofs_mount();
+    if (vfs_fs) {
+        hal_uart_puts("[OK] rofs image mounted read-only\n");
+        root_bytes = rofs_image_size(vfs_fs);
+    } else if (get_errno() != THUNDEROS_EFS_BADSUPER) {
+        hal_uart_puts("[FAIL] Failed to mount rofs image: ");
+        hal_uart_puts(thunderos_strerror(get_errno()));
+        hal_uart_puts("\n");
+        return -1;
+    } else {
+        vfs_fs = init_ext2_root(block_device);
+        if (!vfs_fs) {
+            return -1;
+        }
+        root_bytes = (uint64_t)g_root_ext2_fs.superblock->s_blocks_count * g_root_ext2_fs.block_size;
+    }
+
     if (vfs_mount_root(vfs_fs) != 0) {
         hal_uart_puts("[WARN] Failed to set VFS root\n");
         return -1;
     }
 
     hal_uart_puts("[OK] VFS root filesystem mounted\n");
+    init_swap(root_bytes);
+
+    /* Scratch files stay in memory, off the disk */
+    if (!vfs_exists("/tmp") && vfs_mkdir("/tmp", 0755) != 0) {
+        hal_uart_puts("[WARN] Failed to create /tmp\n");
+        return 0;
+    }
+    vfs_filesystem_t *tmp_fs = tmpfs_mount();
+    if (!tmp_fs || vfs_mount("/tmp", tmp_fs) != 0) {
+        hal_uart_puts("[WARN] Failed to mount tmpfs on /tmp\n");
+        return 0;
+    }
+    hal_uart_puts("[OK] tmpfs mounted on /tmp\n");
+
+    /* Device nodes, whenever their drivers register them */
+    if (!vfs_exists("/dev") && vfs_mkdir("/dev", 0755) != 0) {
+        hal_uart_puts("[WARN] Failed to create /dev\n");
+        return 0;
+    }
+    vfs_filesystem_t *dev_fs = devfs_mount();
+    if (!dev_fs || vfs_mount("/dev", dev_fs) != 0) {
+        hal_uart_puts("[WARN] Failed to mount devfs on /dev\n");
+        return 0;
+    }
+    hal_uart_puts("[OK] devfs mounted on /dev\n");
+
+    /* Process accounting, generated on each read */
+    if (!vfs_exists("/proc") && vfs_mkdir("/proc", 0555) != 0) {
+        hal_uart_puts("[WARN] Failed to create /proc\n");
+        return 0;
+    }
+    vfs_filesystem_t *proc_fs = procfs_mount();
+    if (!proc_fs || vfs_mount("/proc", proc_fs) != 0) {
+        hal_uart_puts("[WARN] Failed to mount procfs on /proc\n");
+        return 0;
+    }
+    hal_uart_puts("[OK] procfs mounted on /proc\n");
     return 0;
 }
 
@@ -367,29 +581,93 @@ static void halt_cpu(void) {
  * Main kernel entry point.
  */
 void kernel_main(void) {
+    /* Before anything prints: a quiet boot holds the output back */
+    bootstage_init();
+
     hal_uart_init();
     hal_uart_puts("[OK] UART initialized\n");
+    bootstage_mark("uart");
+
+    /* Per-CPU state first: everything after this may use cpu_this() */
+    smp_init();
+    softirq_init();
+    schedlat_init();
+    bootstage_mark("smp");
 
     print_boot_banner();
     init_interrupts();
+    bootstage_mark("interrupts");
     init_memory();
+    bootstage_mark("memory");
+
+    /* Trace rings for every CPU, and /dev/trace to drain them */
+    if (trace_init() == 0) {
+        hal_uart_puts("[OK] Tracing ready (/dev/trace)\n");
+    }
+
+    /* Sampling profiler; its rings are allocated when it is first started */
+    if (prof_init() == 0) {
+        hal_uart_puts("[OK] Profiler ready (/dev/prof)\n");
+    }
+
+    /* Hardware counters through the SBI PMU, for perf_event_open() */
+    if (perf_init() == 0) {
+        hal_uart_puts("[OK] Performance counters ready\n");
+    } else {
+        hal_uart_puts("[--] No performance counters (SBI PMU)\n");
+    }
+    bootstage_mark("debug");
 
 #ifdef ENABLE_KERNEL_TESTS
     run_memory_tests();
+    bootstage_mark("tests");
 #endif
 
     process_init();
     scheduler_init();
+    smp_boot_secondaries();
+    bootstage_mark("processes");
 
     pipe_init();
     hal_uart_puts("[OK] Pipe subsystem initialized\n");
 
+    if (workqueue_init() == 0) {
+        hal_uart_puts("[OK] Workqueue started\n");
+    }
+
+    if (interrupt_start_threads() == 0) {
+        hal_uart_puts("[OK] IRQ threads started\n");
+    }
+
+    if (reclaim_start_kswapd() == 0) {
+        hal_uart_puts("[OK] Page reclaim thread started\n");
+    }
+
+    if (process_start_reaper() == 0) {
+        hal_uart_puts("[OK] Reaper thread started\n");
+    }
+    bootstage_mark("kthreads");
+
+    /* GPU and network probe on the worker while the root gets mounted */
+    queue_work(&gpu_probe_work);
+    queue_work(&net_probe_work);
+
     if (init_block_device() == 0) {
+        bootstage_mark("block");
         init_filesystem();
+        if (page_cache_start_flusher() == 0) {
+            hal_uart_puts("[OK] Page cache flusher started\n");
+        }
+        bootstage_mark("filesystem");
     }
 
-    /* Try to initialize GPU (optional - console works without it) */
-    init_gpu_device();
+    flush_workqueue();
+    bootstage_done("probes");
+
+#ifdef ENABLE_KERNEL_BENCH
+    /* Everything the benchmarks touch, the root filesystem included, is up */
+    run_kernel_benchmarks();
+#endif
 
 #ifdef TEST_MODE
     hal_uart_puts("\n");
@@ -397,6 +675,7 @@ void kernel_main(void) {
     hal_uart_puts("  Test Mode - Halting\n");
     hal_uart_puts("=================================\n");
     hal_uart_puts("[OK] All kernel tests completed\n");
+    spinlock_stats_dump();
 #else
     launch_shell();
 #endif
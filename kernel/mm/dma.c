@@ -8,6 +8,7 @@
 #include "mm/kmalloc.h"
 #include "hal/hal_uart.h"
 #include "kernel/kstring.h"
+#include "arch/interrupt.h"
 
 // Linked list of allocated DMA regions for tracking
 static dma_region_t *dma_regions_head = NULL;
@@ -145,3 +146,195 @@ void dma_get_stats(size_t *allocated_regions, size_t *allocated_bytes) {
         *allocated_bytes = total_bytes;
     }
 }
+
+/*
+ * DMA Pools
+ * 
+ * Pool pages are ordinary dma_alloc() regions. A free buffer stores the
+ * next free buffer and its own physical address in its first two words,
+ * which is why buffers are at least DMA_POOL_MIN_SIZE bytes.
+ */
+
+#define DMA_POOL_MIN_SIZE (2 * sizeof(uintptr_t))
+
+// Free buffer header (only valid while the buffer is free)
+typedef struct dma_pool_free {
+    struct dma_pool_free *next;
+    uintptr_t phys_addr;
+} dma_pool_free_t;
+
+// One page of pool buffers
+typedef struct dma_pool_chunk {
+    dma_region_t *region;
+    struct dma_pool_chunk *next;
+} dma_pool_chunk_t;
+
+struct dma_pool {
+    const char *name;
+    size_t stride;              // Buffer size rounded up to alignment
+    size_t per_page;            // Buffers per page
+    dma_pool_free_t *free_list; // Free buffers, physical address cached
+    dma_pool_chunk_t *chunks;   // Pages owned by the pool
+    size_t in_use;
+    size_t capacity;
+};
+
+/**
+ * Add one page of buffers to a pool
+ */
+static int dma_pool_grow(dma_pool_t *pool) {
+    dma_pool_chunk_t *chunk = (dma_pool_chunk_t *)kmalloc(sizeof(dma_pool_chunk_t));
+    if (chunk == NULL) {
+        return -1;
+    }
+    
+    chunk->region = dma_alloc(PAGE_SIZE, 0);
+    if (chunk->region == NULL) {
+        kfree(chunk);
+        return -1;
+    }
+    
+    uintptr_t virt = (uintptr_t)chunk->region->virt_addr;
+    uintptr_t phys = chunk->region->phys_addr;
+    
+    int irq_state = interrupt_save_disable();
+    
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+    
+    // Push back to front so buffers are handed out in address order
+    for (size_t i = pool->per_page; i > 0; i--) {
+        dma_pool_free_t *buf = (dma_pool_free_t *)(virt + (i - 1) * pool->stride);
+        buf->phys_addr = phys + (i - 1) * pool->stride;
+        buf->next = pool->free_list;
+        pool->free_list = buf;
+    }
+    pool->capacity += pool->per_page;
+    
+    interrupt_restore(irq_state);
+    return 0;
+}
+
+/**
+ * Create a DMA pool
+ */
+dma_pool_t *dma_pool_create(const char *name, size_t size, size_t align) {
+    if (size == 0 || size > PAGE_SIZE || (align & (align - 1)) != 0 ||
+        align > PAGE_SIZE) {
+        return NULL;
+    }
+    
+    if (align < sizeof(uintptr_t)) {
+        align = sizeof(uintptr_t);
+    }
+    if (size < DMA_POOL_MIN_SIZE) {
+        size = DMA_POOL_MIN_SIZE;
+    }
+    
+    dma_pool_t *pool = (dma_pool_t *)kmalloc(sizeof(dma_pool_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+    
+    pool->name = name;
+    pool->stride = (size + align - 1) & ~(align - 1);
+    pool->per_page = PAGE_SIZE / pool->stride;
+    pool->free_list = NULL;
+    pool->chunks = NULL;
+    pool->in_use = 0;
+    pool->capacity = 0;
+    
+    if (dma_pool_grow(pool) != 0) {
+        kfree(pool);
+        hal_uart_puts("dma_pool_create: failed to allocate pool page\n");
+        return NULL;
+    }
+    
+    return pool;
+}
+
+/**
+ * Allocate a buffer from a DMA pool
+ */
+void *dma_pool_alloc(dma_pool_t *pool, uint32_t flags, uintptr_t *phys) {
+    if (pool == NULL || phys == NULL) {
+        return NULL;
+    }
+    
+    int irq_state = interrupt_save_disable();
+    
+    while (pool->free_list == NULL) {
+        // Grow with interrupts enabled: dma_alloc() may take a while
+        interrupt_restore(irq_state);
+        if (dma_pool_grow(pool) != 0) {
+            return NULL;
+        }
+        irq_state = interrupt_save_disable();
+    }
+    
+    dma_pool_free_t *buf = pool->free_list;
+    pool->free_list = buf->next;
+    pool->in_use++;
+    *phys = buf->phys_addr;
+    
+    interrupt_restore(irq_state);
+    
+    if (flags & DMA_ZERO) {
+        kmemset(buf, 0, pool->stride);
+    }
+    
+    return buf;
+}
+
+/**
+ * Return a buffer to its DMA pool
+ */
+void dma_pool_free(dma_pool_t *pool, void *vaddr, uintptr_t phys) {
+    if (pool == NULL || vaddr == NULL) {
+        return;
+    }
+    
+    dma_pool_free_t *buf = (dma_pool_free_t *)vaddr;
+    
+    int irq_state = interrupt_save_disable();
+    buf->phys_addr = phys;
+    buf->next = pool->free_list;
+    pool->free_list = buf;
+    pool->in_use--;
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Destroy a DMA pool and free its pages
+ */
+int dma_pool_destroy(dma_pool_t *pool) {
+    if (pool == NULL) {
+        return 0;
+    }
+    if (pool->in_use != 0) {
+        return -1;
+    }
+    
+    dma_pool_chunk_t *chunk = pool->chunks;
+    while (chunk != NULL) {
+        dma_pool_chunk_t *next = chunk->next;
+        dma_free(chunk->region);
+        kfree(chunk);
+        chunk = next;
+    }
+    
+    kfree(pool);
+    return 0;
+}
+
+/**
+ * Get DMA pool statistics
+ */
+void dma_pool_get_stats(dma_pool_t *pool, size_t *in_use, size_t *capacity) {
+    if (in_use != NULL) {
+        *in_use = pool ? pool->in_use : 0;
+    }
+    if (capacity != NULL) {
+        *capacity = pool ? pool->capacity : 0;
+    }
+}
@@ -1,12 +1,20 @@
 /*
  * Kernel Memory Allocator Implementation
- * 
- * Simple page-based allocator for now.
- * For allocations < PAGE_SIZE, we allocate a full page (wasteful but simple).
- * Future: Implement slab allocator for small objects.
+ *
+ * Two-tier allocator:
+ * - Small requests (up to KMALLOC_MAX_SLAB_SIZE) are served from a set
+ *   of generic size-class caches in the slab allocator (mm/slab.h).
+ * - Larger requests fall back to whole pages from the PMM with a
+ *   kmalloc_header at the start of the first page, padded out when
+ *   kmalloc_aligned() needs a coarser alignment than the header leaves.
+ *
+ * kfree() asks the slab layer first (objects from named kmem caches
+ * included), and otherwise rounds the byte before the pointer down to its
+ * page and checks the magic number stored at the start of that page.
  */
 
 #include "mm/kmalloc.h"
+#include "mm/slab.h"
 #include "mm/pmm.h"
 #include "kernel/panic.h"
 #include "kernel/errno.h"
@@ -22,20 +30,66 @@ struct kmalloc_header {
 #define KMALLOC_MAGIC 0xDEADBEEF
 #define HEADER_SIZE sizeof(struct kmalloc_header)
 
+// Generic size-class caches backing small kmalloc() requests. The last
+// class is trimmed so two objects fit in a page next to the slab header.
+static const size_t kmalloc_class_sizes[KMALLOC_NUM_SIZE_CLASSES] = {
+    16, 32, 64, 128, 256, 512, 1024, KMALLOC_MAX_SLAB_SIZE
+};
+
+static const char *kmalloc_class_names[KMALLOC_NUM_SIZE_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2016"
+};
+
+static kmem_cache_t *kmalloc_caches[KMALLOC_NUM_SIZE_CLASSES];
+static int kmalloc_initialized = 0;
+
+// Pages handed out for large (non-slab) allocations
+static size_t large_pages_in_use = 0;
+
 /**
- * Allocate kernel memory
+ * Create the size-class caches on first use
  */
-void *kmalloc(size_t size) {
-    if (size == 0) {
-        return NULL;
+static void kmalloc_init(void) {
+    for (int i = 0; i < KMALLOC_NUM_SIZE_CLASSES; i++) {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_class_names[i],
+                                              kmalloc_class_sizes[i], 0, NULL);
+        if (!kmalloc_caches[i]) {
+            kernel_panic("kmalloc: Failed to create size-class caches");
+        }
     }
-    
-    // Calculate total size including header
-    size_t total_size = size + HEADER_SIZE;
-    
+    kmalloc_initialized = 1;
+}
+
+/**
+ * Map a request size to the smallest class that fits it
+ *
+ * @return Class index, or -1 if the request is too large for a slab
+ */
+static int kmalloc_class_for_size(size_t size) {
+    for (int i = 0; i < KMALLOC_NUM_SIZE_CLASSES; i++) {
+        if (size <= kmalloc_class_sizes[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Allocate whole pages for requests too large for a slab
+ *
+ * The pointer returned is aligned to align (a power of 2, at most
+ * PAGE_SIZE), so it lies past the header but within the first page or
+ * right at its end.
+ */
+static void *large_alloc(size_t size, size_t align) {
+    // Header first, then pad up to the alignment
+    size_t offset = (HEADER_SIZE + align - 1) & ~(align - 1);
+    size_t total_size = offset + size;
+
     // Calculate number of pages needed
     size_t pages_needed = (total_size + PAGE_SIZE - 1) / PAGE_SIZE;
-    
+
     // Allocate page(s)
     uintptr_t page_addr;
     if (pages_needed == 1) {
@@ -43,22 +97,51 @@ void *kmalloc(size_t size) {
     } else {
         page_addr = pmm_alloc_pages(pages_needed);
     }
-    
+
     if (page_addr == 0) {
-        set_errno(THUNDEROS_ENOMEM);
         return NULL;
     }
-    
+
     // Set up allocation header
     struct kmalloc_header *header = (struct kmalloc_header *)page_addr;
     header->size = size;
     header->pages = pages_needed;
     header->magic = KMALLOC_MAGIC;
-    
+
+    large_pages_in_use += pages_needed;
+
+    // Return pointer after header (and padding)
+    return (void *)(page_addr + offset);
+}
+
+/**
+ * Allocate kernel memory
+ */
+void *kmalloc(size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    if (!kmalloc_initialized) {
+        kmalloc_init();
+    }
+
+    void *ptr;
+    int class_index = kmalloc_class_for_size(size);
+    if (class_index >= 0) {
+        ptr = kmem_cache_alloc(kmalloc_caches[class_index]);
+    } else {
+        ptr = large_alloc(size, sizeof(void *));
+    }
+
+    if (ptr == NULL) {
+        set_errno(THUNDEROS_ENOMEM);
+        return NULL;
+    }
+
     // Clear errno on success
     clear_errno();
-    // Return pointer after header
-    return (void *)(page_addr + HEADER_SIZE);
+    return ptr;
 }
 
 /**
@@ -68,17 +151,30 @@ void kfree(void *ptr) {
     if (ptr == NULL) {
         return;
     }
-    
-    // Get header
-    struct kmalloc_header *header = (struct kmalloc_header *)((uintptr_t)ptr - HEADER_SIZE);
-    
+
+    // Slab objects (from the size classes or any named cache) go back
+    // to the cache that owns their page
+    kmem_cache_t *cache = kmem_cache_of(ptr);
+    if (cache) {
+        kmem_cache_free(cache, ptr);
+        return;
+    }
+
+    // Get header (a page-aligned pointer from kmalloc_aligned() sits
+    // right past the end of the header's page)
+    uintptr_t page_addr = PAGE_ALIGN_DOWN((uintptr_t)ptr - 1);
+    struct kmalloc_header *header = (struct kmalloc_header *)page_addr;
+
     // Validate magic number
-    if (header->magic != KMALLOC_MAGIC) {
+    if ((uintptr_t)ptr - page_addr < HEADER_SIZE || header->magic != KMALLOC_MAGIC) {
         kernel_panic("kfree: Invalid pointer or corrupted heap header");
     }
-    
+
+    // Invalidate header so a double free is caught
+    header->magic = 0;
+    large_pages_in_use -= header->pages;
+
     // Free pages
-    uintptr_t page_addr = (uintptr_t)header;
     if (header->pages == 1) {
         pmm_free_page(page_addr);
     } else {
@@ -88,15 +184,55 @@ void kfree(void *ptr) {
 
 /**
  * Allocate aligned kernel memory
+ *
+ * Size-class objects are only KMALLOC_MIN_ALIGN aligned (they follow the
+ * slab header at their size's stride), and large allocations only 8 (they
+ * follow the page header), so anything else gets pages of its own with
+ * the header padded out to the alignment.
  */
 void *kmalloc_aligned(size_t size, size_t align) {
-    // For now, just use kmalloc (pages are already 4KB aligned)
-    // TODO: Implement proper alignment support
-    if (align <= PAGE_SIZE) {
+    if (size == 0) {
+        return NULL;
+    }
+    if (align == 0 || (align & (align - 1)) != 0) {
+        set_errno(THUNDEROS_EINVAL);
+        return NULL;
+    }
+    if (align > PAGE_SIZE) {
+        hal_uart_puts("kmalloc_aligned: Alignment > PAGE_SIZE not yet supported\n");
+        set_errno(THUNDEROS_ENOSYS);
+        return NULL;
+    }
+
+    if (align <= KMALLOC_MIN_ALIGN && size <= KMALLOC_MAX_SLAB_SIZE) {
         return kmalloc(size);
     }
-    
-    hal_uart_puts("kmalloc_aligned: Alignment > PAGE_SIZE not yet supported\n");
-    set_errno(THUNDEROS_ENOSYS);
-    return NULL;
+
+    void *ptr = large_alloc(size, align);
+    if (ptr == NULL) {
+        set_errno(THUNDEROS_ENOMEM);
+        return NULL;
+    }
+    clear_errno();
+    return ptr;
+}
+
+/**
+ * Get allocator statistics
+ */
+void kmalloc_get_stats(kmalloc_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+
+    stats->slab_pages = 0;
+    stats->slab_objects = 0;
+    for (int i = 0; i < KMALLOC_NUM_SIZE_CLASSES; i++) {
+        kmem_cache_stats_t cs = {0};
+        kmem_cache_get_stats(kmalloc_caches[i], &cs);
+        stats->class_objects[i] = cs.objects_in_use;
+        stats->slab_pages += cs.slabs * cs.slab_pages;
+        stats->slab_objects += cs.objects_in_use;
+    }
+    stats->large_pages = large_pages_in_use;
 }
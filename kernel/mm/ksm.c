@@ -0,0 +1,431 @@
+/*
+ * Same-page merging (ksmd)
+ *
+ * Both tables chain ksm_node_t by hash; a node taken out of the unstable
+ * table to be merged with becomes the stable node, so nothing allocates
+ * between write-protecting a batch and merging it. ksmd runs under the
+ * big kernel lock and does not sleep from the first write-protection of a
+ * batch to its merge: faults on the pages wait for the lock, and the only
+ * stores that could still reach them go through TLB entries from before
+ * the batch's flush.
+ */
+
+#include "mm/ksm.h"
+#include "mm/paging.h"
+#include "mm/pmm.h"
+#include "mm/page.h"
+#include "mm/kmalloc.h"
+#include "fs/vfs.h"
+#include "kernel/process.h"
+#include "kernel/errno.h"
+#include "kernel/smp.h"
+
+typedef struct ksm_node {
+    struct ksm_node *next;              // Hash chain
+    uint64_t hash;
+    uintptr_t page;                     // Stable: the table's reference
+    struct process *proc;               // Unstable: where the page was seen
+    pid_t pid;
+    uint64_t addr;
+} ksm_node_t;
+
+// A write-protected page and what to map in its place
+typedef struct {
+    struct process *proc;
+    pte_t *pte;
+    uintptr_t page;
+    uintptr_t target;                   // Zero page, stable or unstable page
+    ksm_node_t *node;                   // Unstable partner to make stable
+    int zero;
+} ksm_candidate_t;
+
+static ksm_node_t *stable[KSM_BUCKETS];
+static ksm_node_t *unstable[KSM_BUCKETS];
+static size_t stable_count = 0;
+static size_t unstable_count = 0;
+
+static ksm_candidate_t batch[KSM_BATCH];
+static size_t batch_count = 0;
+
+static struct process *ksmd = NULL;
+static uint64_t zero_hash;
+static ksm_stats_t stats;
+
+// Clock hand, as for the swap sweep
+static int scan_index = 0;
+static uint64_t scan_addr = 0;
+
+static inline size_t ksm_bucket(uint64_t hash) {
+    return (size_t)(hash ^ (hash >> 32)) & (KSM_BUCKETS - 1);
+}
+
+// Helper: FNV-1a over the page's words
+static uint64_t ksm_hash(uintptr_t page) {
+    const uint64_t *words = (const uint64_t *)page;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        hash = (hash ^ words[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int ksm_pages_equal(uintptr_t a, uintptr_t b) {
+    const uint64_t *wa = (const uint64_t *)a;
+    const uint64_t *wb = (const uint64_t *)b;
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        if (wa[i] != wb[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int ksm_page_is_zero(uintptr_t page) {
+    const uint64_t *words = (const uint64_t *)page;
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        if (words[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Helper: Private memory a merged page may stand in for
+static int vma_mergeable(const vm_area_t *vma) {
+    if (!(vma->flags & VM_MERGEABLE) || (vma->flags & VM_SHARED) || vma->shm) {
+        return 0;
+    }
+    return !vma->file || vma->file->type != VFS_TYPE_DEVICE;
+}
+
+static int process_scannable(const struct process *proc) {
+    return proc && proc == proc->group_leader && !proc->kthread_fn && proc->page_table &&
+           proc->state != PROC_EMBRYO && proc->state != PROC_ZOMBIE;
+}
+
+// Helper: Page an entry maps if it is anonymous and not merged yet, else 0
+static uintptr_t ksm_pte_page(pte_t val) {
+    if (!(val & PTE_V) || !(val & PTE_U)) {
+        return 0;
+    }
+    uintptr_t page = PTE_TO_PA(val);
+    struct page *pg = phys_to_page(page);
+    if (!pg || page == pmm_zero_page() || (pg->flags & (PG_SLAB | PG_KSM)) || pg->mapping) {
+        return 0;
+    }
+    return page;
+}
+
+static void ksm_write_protect(pte_t *pte) {
+    if (*pte & PTE_W) {
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+    }
+}
+
+// Helper: Merged page with a hash, unless the swap cache took it since
+static ksm_node_t *stable_find(uint64_t hash) {
+    for (ksm_node_t *node = stable[ksm_bucket(hash)]; node; node = node->next) {
+        if (node->hash == hash && !phys_to_page(node->page)->mapping) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+// Helper: Make a node stable, taking the table's reference to its page
+static void stable_add(ksm_node_t *node, uintptr_t page) {
+    node->page = page;
+    node->proc = NULL;
+    get_page(page);
+    phys_to_page(page)->flags |= PG_KSM;
+
+    size_t bucket = ksm_bucket(node->hash);
+    node->next = stable[bucket];
+    stable[bucket] = node;
+    stable_count++;
+}
+
+static void unstable_link(ksm_node_t *node) {
+    size_t bucket = ksm_bucket(node->hash);
+    node->next = unstable[bucket];
+    unstable[bucket] = node;
+    unstable_count++;
+}
+
+static void unstable_insert(struct process *proc, uint64_t addr, uintptr_t page, uint64_t hash) {
+    if (unstable_count >= KSM_UNSTABLE_MAX) {
+        return;
+    }
+    ksm_node_t *node = kmalloc(sizeof(ksm_node_t));
+    if (!node) {
+        return;
+    }
+    node->hash = hash;
+    node->page = page;
+    node->proc = proc;
+    node->pid = proc->pid;
+    node->addr = addr;
+    unstable_link(node);
+}
+
+/**
+ * Take the first other page with a hash out of the unstable table
+ */
+static ksm_node_t *unstable_take(uint64_t hash, uintptr_t page) {
+    ksm_node_t **link = &unstable[ksm_bucket(hash)];
+    for (ksm_node_t *node = *link; node; link = &node->next, node = node->next) {
+        if (node->hash == hash && node->page != page) {
+            *link = node->next;
+            unstable_count--;
+            return node;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Find the entry still mapping an unstable node's page where it was seen
+ *
+ * @return The entry, or NULL if the process, mapping or page changed since
+ */
+static pte_t *unstable_pte(const ksm_node_t *node) {
+    struct process *proc = node->proc;
+    if (proc->state == PROC_UNUSED || proc->pid != node->pid || !process_scannable(proc)) {
+        return NULL;
+    }
+    vm_area_t *vma = process_find_vma(proc, node->addr);
+    if (!vma || !vma_mergeable(vma)) {
+        return NULL;
+    }
+    pte_t *pte = get_user_pte(proc->page_table, node->addr);
+    if (!pte || ksm_pte_page(*pte) != node->page) {
+        return NULL;
+    }
+    return pte;
+}
+
+/**
+ * Compare each page of the batch with its match and merge it
+ *
+ * The first flush makes the write-protection hold on every CPU; the
+ * second keeps the dropped pages from being read until they are freed.
+ */
+static void ksm_merge_batch(void) {
+    uintptr_t release[KSM_BATCH];
+    size_t nrelease = 0;
+
+    if (batch_count == 0) {
+        return;
+    }
+    tlb_flush(0);
+    smp_flush_tlb_others();
+
+    for (size_t i = 0; i < batch_count; i++) {
+        ksm_candidate_t *c = &batch[i];
+        if (c->node && (phys_to_page(c->target)->flags & PG_KSM)) {
+            // Another page of this batch made the same page stable
+            kfree(c->node);
+            c->node = NULL;
+        }
+
+        int same = c->zero ? ksm_page_is_zero(c->page) : ksm_pages_equal(c->page, c->target);
+        if (!same) {
+            // Stale hash or collision; the pages stay write-protected
+            if (c->node) {
+                unstable_link(c->node);
+            }
+            continue;
+        }
+
+        if (c->node) {
+            stable_add(c->node, c->target);
+        }
+        *c->pte = PA_TO_PTE(c->target, *c->pte & 0x3FF);
+        get_page(c->target);
+        release[nrelease++] = c->page;
+        if (c->zero) {
+            process_account_rss(c->proc, -1);
+            stats.zero_merged++;
+        } else {
+            stats.merged++;
+        }
+    }
+    batch_count = 0;
+
+    if (nrelease > 0) {
+        tlb_flush(0);
+        smp_flush_tlb_others();
+        for (size_t i = 0; i < nrelease; i++) {
+            put_page(release[i]);
+        }
+    }
+}
+
+/**
+ * Hash one page and queue it for merging if something matches it
+ *
+ * @return 1 if the page was hashed, 0 if it is not one to merge
+ */
+static int ksm_scan_pte(struct process *proc, uint64_t addr, pte_t *pte) {
+    uintptr_t page = ksm_pte_page(*pte);
+    if (!page) {
+        return 0;
+    }
+    stats.pages_scanned++;
+
+    uint64_t hash = ksm_hash(page);
+    ksm_candidate_t *c = &batch[batch_count];
+    c->proc = proc;
+    c->pte = pte;
+    c->page = page;
+    c->node = NULL;
+    c->zero = 0;
+
+    ksm_node_t *node;
+    if (hash == zero_hash) {
+        c->target = pmm_zero_page();
+        c->zero = 1;
+    } else if ((node = stable_find(hash)) != NULL) {
+        c->target = node->page;
+    } else if ((node = unstable_take(hash, page)) != NULL) {
+        pte_t *other = unstable_pte(node);
+        if (!other) {
+            kfree(node);
+            unstable_insert(proc, addr, page, hash);
+            return 1;
+        }
+        ksm_write_protect(other);
+        c->target = node->page;
+        c->node = node;
+    } else {
+        unstable_insert(proc, addr, page, hash);
+        return 1;
+    }
+
+    ksm_write_protect(pte);
+    if (++batch_count == KSM_BATCH) {
+        ksm_merge_batch();
+    }
+    return 1;
+}
+
+/**
+ * End a pass: forget the unstable table, and drop merged pages only the
+ * stable table still holds (or that went to the swap cache)
+ */
+static void ksm_pass_done(void) {
+    for (size_t bucket = 0; bucket < KSM_BUCKETS; bucket++) {
+        while (unstable[bucket]) {
+            ksm_node_t *node = unstable[bucket];
+            unstable[bucket] = node->next;
+            kfree(node);
+        }
+
+        ksm_node_t **link = &stable[bucket];
+        while (*link) {
+            ksm_node_t *node = *link;
+            struct page *pg = phys_to_page(node->page);
+            if (pg->refcount > 1 && !pg->mapping) {
+                link = &node->next;
+                continue;
+            }
+            *link = node->next;
+            pg->flags &= ~PG_KSM;
+            put_page(node->page);
+            kfree(node);
+            stable_count--;
+        }
+    }
+    unstable_count = 0;
+    stats.full_scans++;
+}
+
+/**
+ * Scan mergeable mappings from the clock hand
+ *
+ * @param nr Pages to hash
+ */
+static void ksm_scan(size_t nr) {
+    size_t scanned = 0;
+    int max = process_get_max_count();
+
+    for (int visited = 0; visited <= max && scanned < nr; visited++) {
+        struct process *proc = process_get_by_index(scan_index);
+        if (process_scannable(proc)) {
+            for (vm_area_t *vma = proc->vm_areas; vma && scanned < nr; vma = vma->next) {
+                if (vma->end <= scan_addr || !vma_mergeable(vma)) {
+                    continue;
+                }
+                uint64_t addr = vma->start > scan_addr ? vma->start : scan_addr;
+                while (addr < vma->end && scanned < nr) {
+                    pte_t *pte = get_user_pte(proc->page_table, addr);
+                    if (!pte) {
+                        // No level-0 table: skip to the next 2MB boundary
+                        addr = (addr + MEGAPAGE_SIZE) & ~(MEGAPAGE_SIZE - 1);
+                        continue;
+                    }
+                    scanned += ksm_scan_pte(proc, addr, pte);
+                    addr += PAGE_SIZE;
+                }
+                scan_addr = addr;
+            }
+            if (scanned >= nr) {
+                break;
+            }
+        }
+        scan_index = (scan_index + 1) % max;
+        scan_addr = 0;
+        if (scan_index == 0) {
+            // The batch may name unstable pages and stable ones to drop
+            ksm_merge_batch();
+            ksm_pass_done();
+        }
+    }
+    ksm_merge_batch();
+}
+
+/**
+ * ksmd thread body
+ */
+static void ksmd_main(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        process_sleep_us(KSM_SCAN_INTERVAL_US);
+        ksm_scan(KSM_PAGES_PER_SCAN);
+        clear_errno();
+    }
+}
+
+int ksm_start(void) {
+    if (ksmd) {
+        clear_errno();
+        return 0;
+    }
+    zero_hash = ksm_hash(pmm_zero_page());
+
+    struct process *proc = kthread_create("ksmd", ksmd_main, NULL);
+    if (!proc) {
+        // errno already set by kthread_create
+        return -1;
+    }
+    ksmd = proc;
+    clear_errno();
+    return 0;
+}
+
+void ksm_get_stats(ksm_stats_t *out) {
+    *out = stats;
+    out->pages_shared = stable_count;
+    out->pages_unshared = unstable_count;
+    out->pages_sharing = 0;
+    for (size_t bucket = 0; bucket < KSM_BUCKETS; bucket++) {
+        for (ksm_node_t *node = stable[bucket]; node; node = node->next) {
+            // The table's reference and the first mapping's are not sharing
+            uint32_t refs = page_refcount(node->page);
+            if (refs > 2) {
+                out->pages_sharing += refs - 2;
+            }
+        }
+    }
+}
@@ -0,0 +1,242 @@
+/*
+ * Kernel Stack Implementation
+ *
+ * slot_state says, per slot, whether the stack there is unmapped, handed
+ * out or cached; cached slots are also on a LIFO so the most recently
+ * freed stack, likeliest to still be in the caches, goes out first.
+ * Unmapped slots go out next-fit from a cursor. Everything runs under
+ * the big kernel lock and with interrupts disabled, as stacks are freed
+ * from process_free() under process_lock; the pages of a new stack are
+ * allocated with interrupts restored so the allocation may reclaim.
+ */
+
+#include "mm/kstack.h"
+#include "mm/paging.h"
+#include "mm/pmm.h"
+#include "mm/reclaim.h"
+#include "kernel/process.h"
+#include "kernel/errno.h"
+#include "kernel/smp.h"
+#include "arch/interrupt.h"
+
+_Static_assert(KERNEL_STACK_SIZE == (1UL << KSTACK_GUARD_SHIFT), "a stack must fill half a slot");
+_Static_assert(PTE_INDEX(KSTACK_AREA_BASE, 2) == KSTACK_AREA_VPN2, "KSTACK_AREA_BASE out of date");
+_Static_assert(KSTACK_SLOTS * KSTACK_SLOT_SIZE % MEGAPAGE_SIZE == 0, "area must cover whole level-0 tables");
+
+#define KSTACK_PAGES (KERNEL_STACK_SIZE / PAGE_SIZE)
+
+// slot_state values
+#define SLOT_UNMAPPED   0
+#define SLOT_IN_USE     1
+#define SLOT_CACHED     2
+
+static uint8_t slot_state[KSTACK_SLOTS];
+static uint16_t cache[KSTACK_CACHE];     // Cached slots, most recently freed last
+static size_t cache_count;
+static size_t cursor;                    // Next unmapped slot to try
+
+static kstack_stats_t stats;
+
+static size_t kstack_shrink_count(shrinker_t *shrinker);
+static size_t kstack_shrink_scan(shrinker_t *shrinker, size_t nr, uint32_t flags);
+
+static shrinker_t kstack_shrinker = { "kstack", kstack_shrink_count, kstack_shrink_scan, 0, 0, NULL };
+
+// Helper: Lowest address of a slot's stack (above its guard)
+static uintptr_t slot_stack(size_t slot) {
+    return KSTACK_AREA_BASE + slot * KSTACK_SLOT_SIZE + KERNEL_STACK_SIZE;
+}
+
+// Helper: Unmap the first n pages of a slot's stack and free them
+static void slot_unmap(size_t slot, size_t n) {
+    page_table_t *kpt = get_kernel_page_table();
+    uintptr_t stack = slot_stack(slot);
+    uintptr_t pages[KSTACK_PAGES];
+
+    for (size_t i = 0; i < n; i++) {
+        uintptr_t va = stack + i * PAGE_SIZE;
+        pages[i] = 0;
+        if (virt_to_phys(kpt, va, &pages[i]) == 0) {
+            unmap_page(kpt, va);
+        }
+    }
+
+    // Other harts may still hold the translations
+    smp_flush_tlb_others();
+    for (size_t i = 0; i < n; i++) {
+        if (pages[i]) {
+            pmm_free_page(pages[i]);
+        }
+    }
+}
+
+/**
+ * Build the area's page tables and register the shrinker
+ */
+int kstack_init(void) {
+    if (paging_prepare_kernel_range(KSTACK_AREA_BASE, KSTACK_AREA_END) != 0) {
+        // errno already set
+        return -1;
+    }
+    register_shrinker(&kstack_shrinker);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Allocate a kernel stack: a cached one, else map a free slot
+ */
+uintptr_t kstack_alloc(void) {
+    int irq_state = interrupt_save_disable();
+
+    if (cache_count > 0) {
+        size_t slot = cache[--cache_count];
+        slot_state[slot] = SLOT_IN_USE;
+        stats.cached--;
+        stats.in_use++;
+        stats.allocs++;
+        stats.cache_hits++;
+        interrupt_restore(irq_state);
+        return slot_stack(slot);
+    }
+
+    // Reserve an unmapped slot
+    size_t slot = KSTACK_SLOTS;
+    for (size_t i = 0; i < KSTACK_SLOTS; i++) {
+        size_t s = (cursor + i) % KSTACK_SLOTS;
+        if (slot_state[s] == SLOT_UNMAPPED) {
+            slot = s;
+            break;
+        }
+    }
+    if (slot == KSTACK_SLOTS) {
+        stats.failures++;
+        interrupt_restore(irq_state);
+        set_errno(THUNDEROS_ENOMEM);
+        return 0;
+    }
+    slot_state[slot] = SLOT_IN_USE;
+    cursor = (slot + 1) % KSTACK_SLOTS;
+    interrupt_restore(irq_state);
+
+    // Single pages: the stack is contiguous only in the area
+    page_table_t *kpt = get_kernel_page_table();
+    uintptr_t stack = slot_stack(slot);
+    for (size_t i = 0; i < KSTACK_PAGES; i++) {
+        uintptr_t page = pmm_alloc_page();
+        if (!page || map_page(kpt, stack + i * PAGE_SIZE, page, PTE_KERNEL_DATA) != 0) {
+            if (page) {
+                pmm_free_page(page);
+            }
+            irq_state = interrupt_save_disable();
+            slot_unmap(slot, i);
+            slot_state[slot] = SLOT_UNMAPPED;
+            stats.failures++;
+            interrupt_restore(irq_state);
+            set_errno(THUNDEROS_ENOMEM);
+            return 0;
+        }
+    }
+
+    irq_state = interrupt_save_disable();
+    stats.in_use++;
+    stats.allocs++;
+    interrupt_restore(irq_state);
+    return stack;
+}
+
+/**
+ * Free a kernel stack: cache it if there is room, else unmap it
+ */
+void kstack_free(uintptr_t stack) {
+    if (stack == 0) {
+        return;
+    }
+    if (stack < KSTACK_AREA_BASE || stack >= KSTACK_AREA_END ||
+        (stack & (KSTACK_SLOT_SIZE - 1)) != KERNEL_STACK_SIZE) {
+        return;
+    }
+
+    size_t slot = (stack - KSTACK_AREA_BASE) >> KSTACK_SLOT_SHIFT;
+    int irq_state = interrupt_save_disable();
+    if (slot_state[slot] != SLOT_IN_USE) {
+        interrupt_restore(irq_state);
+        return;
+    }
+
+    stats.in_use--;
+    if (cache_count < KSTACK_CACHE) {
+        cache[cache_count++] = (uint16_t)slot;
+        slot_state[slot] = SLOT_CACHED;
+        stats.cached++;
+    } else {
+        slot_unmap(slot, KSTACK_PAGES);
+        slot_state[slot] = SLOT_UNMAPPED;
+        stats.unmapped++;
+    }
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Get the top of the kernel stack holding an address
+ */
+uintptr_t kstack_top(uintptr_t addr) {
+    if (addr < KSTACK_AREA_BASE || addr >= KSTACK_AREA_END || kstack_is_guard(addr)) {
+        return 0;
+    }
+    return (addr & ~(KSTACK_SLOT_SIZE - 1)) + KSTACK_SLOT_SIZE;
+}
+
+/**
+ * Check whether an address lies on a guard of the area
+ */
+int kstack_is_guard(uintptr_t addr) {
+    if (addr < KSTACK_AREA_BASE || addr >= KSTACK_AREA_END) {
+        return 0;
+    }
+    return ((addr >> KSTACK_GUARD_SHIFT) & 1) == 0;
+}
+
+/**
+ * Cached stacks reclaim could unmap
+ */
+static size_t kstack_shrink_count(shrinker_t *shrinker) {
+    (void)shrinker;
+    return cache_count;
+}
+
+/**
+ * Unmap up to nr cached stacks, least recently freed first
+ */
+static size_t kstack_shrink_scan(shrinker_t *shrinker, size_t nr, uint32_t flags) {
+    (void)shrinker;
+    (void)flags;
+
+    int irq_state = interrupt_save_disable();
+    size_t n = nr < cache_count ? nr : cache_count;
+    for (size_t i = 0; i < n; i++) {
+        slot_unmap(cache[i], KSTACK_PAGES);
+        slot_state[cache[i]] = SLOT_UNMAPPED;
+    }
+    for (size_t i = n; i < cache_count; i++) {
+        cache[i - n] = cache[i];
+    }
+    cache_count -= n;
+    stats.cached -= n;
+    stats.unmapped += n;
+    interrupt_restore(irq_state);
+    return n;
+}
+
+/**
+ * Get kernel stack statistics
+ */
+void kstack_get_stats(kstack_stats_t *out) {
+    if (!out) {
+        return;
+    }
+
+    int irq_state = interrupt_save_disable();
+    *out = stats;
+    interrupt_restore(irq_state);
+}
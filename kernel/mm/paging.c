@@ -4,11 +4,15 @@
 
 #include "mm/paging.h"
 #include "mm/pmm.h"
+#include "mm/page.h"
 #include "mm/kmalloc.h"
+#include "mm/swap.h"
 #include "hal/hal_uart.h"
 #include "kernel/kstring.h"
 #include "kernel/errno.h"
 #include "kernel/constants.h"
+#include "kernel/smp.h"
+#include "kernel/vdso.h"
 #include "arch/sbi.h"
 
 // Kernel root page table (allocated statically for bootstrap)
@@ -17,46 +21,42 @@ static page_table_t kernel_page_table __attribute__((aligned(PAGE_SIZE)));
 // Track if paging is enabled
 static int paging_enabled = 0;
 
+// ASID allocator: supported ASID bits (0 = none), current generation and
+// next free ASID in it. ASID 0 is reserved for the kernel page table.
+static unsigned int asid_bits = 0;
+static uint64_t asid_generation = 1;
+static uint64_t asid_next = 1;
+
+// Leaves used for the RAM direct map, per level (4KB, 2MB, 1GB)
+static size_t direct_map_leaves[3];
+
 /**
  * Allocate a page table
  * Returns zeroed page table
  */
 static page_table_t *alloc_page_table(void) {
-    uintptr_t page = pmm_alloc_page();
-    if (page == 0) {
-        return NULL;
-    }
-    
-    // Zero out the page table
-    page_table_t *pt = (page_table_t *)page;
-    for (int i = 0; i < PT_ENTRIES; i++) {
-        pt->entries[i] = 0;
-    }
-    
-    return pt;
+    // Zeroed page: every entry starts invalid
+    return (page_table_t *)pmm_alloc_zeroed_page();
 }
 
 /**
- * Walk page table and get PTE for virtual address
+ * Walk page table down to the PTE for vaddr at the given level
  * Creates intermediate tables if create=1
+ * 
+ * Level 0 entries map 4KB pages, level 1 2MB megapages and level 2 1GB
+ * gigapages. Returns NULL if a larger leaf already covers vaddr.
  */
-static pte_t *walk_page_table(page_table_t *root, uintptr_t vaddr, int create) {
+static pte_t *walk_page_table_level(page_table_t *root, uintptr_t vaddr,
+                                    int target_level, int create) {
     page_table_t *pt = root;
     
-    // Walk through 3 levels
-    for (int level = 2; level > 0; level--) {
-        // Get VPN for this level
-        int vpn;
-        if (level == 2) vpn = VPN_2(vaddr);
-        else if (level == 1) vpn = VPN_1(vaddr);
-        else vpn = VPN_0(vaddr);
-        
-        pte_t *pte = &pt->entries[vpn];
+    for (int level = 2; level > target_level; level--) {
+        pte_t *pte = &pt->entries[PTE_INDEX(vaddr, level)];
         
         if (*pte & PTE_V) {
             // Entry exists
             if (PTE_IS_LEAF(*pte)) {
-                // Shouldn't have leaf at non-leaf level
+                // Covered by a superpage
                 return NULL;
             }
             // Get next level page table
@@ -80,9 +80,91 @@ static pte_t *walk_page_table(page_table_t *root, uintptr_t vaddr, int create) {
         }
     }
     
-    // Return pointer to leaf PTE (level 0)
-    int vpn0 = VPN_0(vaddr);
-    return &pt->entries[vpn0];
+    return &pt->entries[PTE_INDEX(vaddr, target_level)];
+}
+
+/**
+ * Walk page table and get the 4KB leaf PTE for virtual address
+ * Creates intermediate tables if create=1
+ */
+static pte_t *walk_page_table(page_table_t *root, uintptr_t vaddr, int create) {
+    return walk_page_table_level(root, vaddr, 0, create);
+}
+
+/**
+ * Find the leaf PTE mapping vaddr, whatever its size
+ * 
+ * @param level Output: level of the leaf (0 = 4KB, 1 = 2MB, 2 = 1GB)
+ * @return Leaf PTE, or NULL if vaddr is not mapped
+ */
+static pte_t *find_leaf_pte(page_table_t *root, uintptr_t vaddr, int *level) {
+    page_table_t *pt = root;
+    
+    for (int l = 2; l >= 0; l--) {
+        pte_t *pte = &pt->entries[PTE_INDEX(vaddr, l)];
+        if (!(*pte & PTE_V)) {
+            return NULL;
+        }
+        if (PTE_IS_LEAF(*pte)) {
+            *level = l;
+            return pte;
+        }
+        pt = (page_table_t *)PTE_TO_PA(*pte);
+    }
+    
+    return NULL;
+}
+
+/**
+ * MMIO windows the kernel needs while running on a user page table. Each
+ * covers one 2MB level-0 table under root entry 0 that is built once in
+ * the kernel page table and linked into every user page table.
+ */
+static const uintptr_t shared_mmio_bases[] = {
+    QEMU_CLINT_BASE,   // CLINT
+    QEMU_UART0_BASE,   // UART and VirtIO MMIO (same 2MB window)
+};
+
+#define NUM_SHARED_MMIO (sizeof(shared_mmio_bases) / sizeof(shared_mmio_bases[0]))
+
+/**
+ * Get the kernel's level-1 table for root entry 0
+ */
+static page_table_t *kernel_low_l1(void) {
+    pte_t root0 = kernel_page_table.entries[0];
+    if (!(root0 & PTE_V) || PTE_IS_LEAF(root0)) {
+        return NULL;
+    }
+    return (page_table_t *)PTE_TO_PA(root0);
+}
+
+/**
+ * Check whether vaddr lies in a shared kernel MMIO window
+ */
+static int in_shared_mmio_window(uintptr_t vaddr) {
+    for (size_t i = 0; i < NUM_SHARED_MMIO; i++) {
+        if ((vaddr & ~(MEGAPAGE_SIZE - 1)) == shared_mmio_bases[i]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Check whether a level-0 table is one of the shared kernel MMIO tables
+ */
+static int is_shared_kernel_table(page_table_t *pt) {
+    page_table_t *l1 = kernel_low_l1();
+    if (!l1) {
+        return 0;
+    }
+    for (size_t i = 0; i < NUM_SHARED_MMIO; i++) {
+        pte_t pte = l1->entries[PTE_INDEX(shared_mmio_bases[i], 1)];
+        if ((pte & PTE_V) && (page_table_t *)PTE_TO_PA(pte) == pt) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
 /**
@@ -95,6 +177,12 @@ int map_page(page_table_t *page_table, uintptr_t vaddr, uintptr_t paddr, uint64_
         RETURN_ERRNO(THUNDEROS_EINVAL);
     }
     
+    // The kernel MMIO tables are shared by every user page table
+    if (page_table != &kernel_page_table && in_shared_mmio_window(vaddr)) {
+        hal_uart_puts("map_page: address reserved for kernel MMIO\n");
+        RETURN_ERRNO(THUNDEROS_EEXIST);
+    }
+    
     // Walk page table (create intermediate tables)
     pte_t *pte = walk_page_table(page_table, vaddr, 1);
     if (pte == NULL) {
@@ -141,16 +229,288 @@ int unmap_page(page_table_t *page_table, uintptr_t vaddr) {
 }
 
 /**
- * Translate virtual address to physical address
+ * Build the kernel page tables covering a virtual range
  */
-int virt_to_phys(page_table_t *page_table, uintptr_t vaddr, uintptr_t *paddr) {
+int paging_prepare_kernel_range(uintptr_t start, uintptr_t end) {
+    if ((start | end) & (MEGAPAGE_SIZE - 1)) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    
+    // One level-0 table per 2MB, created by the walk
+    for (uintptr_t addr = start; addr < end; addr += MEGAPAGE_SIZE) {
+        if (walk_page_table(&kernel_page_table, addr, 1) == NULL) {
+            RETURN_ERRNO(THUNDEROS_ENOMEM);
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Check whether threads on other CPUs may hold translations from a table
+ *
+ * Only a process's own threads share its page table, so the table of
+ * anything but the running thread group needs no shootdown.
+ */
+static int page_table_shared(page_table_t *page_table) {
+    struct process *proc = process_current();
+    return proc && proc->page_table == page_table && proc->group_leader->nr_threads > 1;
+}
+
+/**
+ * Unmap a user page and drop its reference
+ */
+int unmap_user_page(page_table_t *page_table, uintptr_t vaddr) {
     pte_t *pte = walk_page_table(page_table, vaddr, 0);
+    if (pte != NULL && PTE_IS_SWAP(*pte)) {
+        // Swapped out: nothing in the TLB, only the slot to let go
+        swap_entry_free(PTE_TO_SWAP(*pte));
+        *pte = 0;
+        return 0;
+    }
     if (pte == NULL || !(*pte & PTE_V)) {
+        // Nothing mapped here (e.g. never touched)
+        return 0;
+    }
+    
+    // Leave kernel mappings (e.g. shared MMIO) alone
+    if (!(*pte & PTE_U)) {
+        return 0;
+    }
+    
+    uintptr_t paddr = PTE_TO_PA(*pte);
+    
+    *pte = 0;
+    tlb_flush(vaddr);
+    if (page_table_shared(page_table)) {
+        smp_flush_tlb_others();
+    }
+    put_page(paddr);
+    
+    return 0;
+}
+
+/**
+ * Start a batched unmap
+ */
+void tlb_gather_init(mmu_gather_t *tlb, page_table_t *page_table) {
+    tlb->page_table = page_table;
+    tlb->start = UINTPTR_MAX;
+    tlb->end = 0;
+    tlb->nr_pages = 0;
+    tlb->unmapped = 0;
+}
+
+/**
+ * Flush the gathered range and release the queued pages
+ */
+static void tlb_gather_flush(mmu_gather_t *tlb) {
+    if (tlb->start < tlb->end) {
+        tlb_flush_range(tlb->start, tlb->end);
+        if (page_table_shared(tlb->page_table)) {
+            smp_flush_tlb_others();
+        }
+    }
+    
+    // Translations are gone: now the pages may be reused
+    for (size_t i = 0; i < tlb->nr_pages; i++) {
+        put_page(tlb->pages[i]);
+    }
+    
+    tlb->start = UINTPTR_MAX;
+    tlb->end = 0;
+    tlb->nr_pages = 0;
+}
+
+/**
+ * Unmap a range of user pages into a batch
+ */
+void tlb_gather_unmap_range(mmu_gather_t *tlb, uintptr_t start, uintptr_t end) {
+    uintptr_t vaddr = start;
+    
+    while (vaddr < end) {
+        pte_t *pte = walk_page_table(tlb->page_table, vaddr, 0);
+        if (pte == NULL) {
+            // No level-0 table: skip to the next 2MB boundary
+            vaddr = (vaddr + MEGAPAGE_SIZE) & ~(MEGAPAGE_SIZE - 1);
+            continue;
+        }
+        
+        if (PTE_IS_SWAP(*pte)) {
+            swap_entry_free(PTE_TO_SWAP(*pte));
+            *pte = 0;
+        }
+        
+        // Leave holes and kernel mappings (e.g. shared MMIO) alone
+        if ((*pte & PTE_V) && (*pte & PTE_U)) {
+            if (tlb->nr_pages == MMU_GATHER_BATCH) {
+                tlb_gather_flush(tlb);
+            }
+            
+            uintptr_t paddr = PTE_TO_PA(*pte);
+            tlb->pages[tlb->nr_pages++] = paddr;
+            if (paddr != pmm_zero_page()) {
+                tlb->unmapped++;
+            }
+            *pte = 0;
+            
+            if (vaddr < tlb->start) {
+                tlb->start = vaddr;
+            }
+            if (vaddr + PAGE_SIZE > tlb->end) {
+                tlb->end = vaddr + PAGE_SIZE;
+            }
+        }
+        
+        vaddr += PAGE_SIZE;
+    }
+}
+
+/**
+ * Finish a batched unmap
+ */
+void tlb_gather_finish(mmu_gather_t *tlb) {
+    tlb_gather_flush(tlb);
+}
+
+/**
+ * Share a user page copy-on-write
+ */
+int share_user_page_cow(page_table_t *src, page_table_t *dst, uintptr_t vaddr) {
+    pte_t *src_pte = walk_page_table(src, vaddr, 0);
+    if (src_pte != NULL && PTE_IS_SWAP(*src_pte)) {
+        // Swapped out: the child names the same slot
+        if (swap_entry_dup(PTE_TO_SWAP(*src_pte)) != 0) {
+            /* errno already set by swap_entry_dup */
+            return -1;
+        }
+        pte_t *dst_pte = walk_page_table(dst, vaddr, 1);
+        if (dst_pte == NULL) {
+            swap_entry_free(PTE_TO_SWAP(*src_pte));
+            RETURN_ERRNO(THUNDEROS_ENOMEM);
+        }
+        *dst_pte = *src_pte;
+        return 0;
+    }
+    if (src_pte == NULL || !(*src_pte & PTE_V)) {
+        // Nothing mapped here (e.g. untouched stack)
+        return 0;
+    }
+    
+    uintptr_t paddr = PTE_TO_PA(*src_pte);
+    uint64_t flags = *src_pte & 0x3FF;
+    
+    // Writable pages become read-only in both tables until written
+    if (flags & PTE_W) {
+        flags = (flags & ~PTE_W) | PTE_COW;
+        *src_pte = PA_TO_PTE(paddr, flags);
+    }
+    
+    if (map_page(dst, vaddr, paddr, flags) != 0) {
+        /* errno already set by map_page */
+        return -1;
+    }
+    
+    get_page(paddr);
+    return 0;
+}
+
+/**
+ * Resolve a copy-on-write fault
+ */
+int handle_cow_fault(page_table_t *page_table, uintptr_t vaddr) {
+    vaddr = PAGE_ALIGN_DOWN(vaddr);
+    
+    pte_t *pte = walk_page_table(page_table, vaddr, 0);
+    if (pte == NULL || !(*pte & PTE_V) || !(*pte & PTE_COW)) {
         RETURN_ERRNO(THUNDEROS_EFAULT);
     }
     
-    // Get physical page number and add offset
-    uintptr_t offset = vaddr & (PAGE_SIZE - 1);
+    uintptr_t paddr = PTE_TO_PA(*pte);
+    uint64_t flags = (*pte & 0x3FF & ~PTE_COW) | PTE_W;
+    
+    if (page_refcount(paddr) <= 1) {
+        // Every other sharer already copied or exited: reuse the page
+        *pte = PA_TO_PTE(paddr, flags);
+        tlb_flush(vaddr);
+        clear_errno();
+        return 0;
+    }
+    
+    uintptr_t copy;
+    if (paddr == pmm_zero_page()) {
+        // First write to untouched anonymous memory: nothing to copy
+        copy = pmm_alloc_zeroed_page();
+        if (copy == 0) {
+            RETURN_ERRNO(THUNDEROS_ENOMEM);
+        }
+    } else {
+        copy = pmm_alloc_page();
+        if (copy == 0) {
+            RETURN_ERRNO(THUNDEROS_ENOMEM);
+        }
+        
+        // Identity-mapped kernel: physical addresses are directly accessible
+        kmemcpy((void *)copy, (void *)paddr, PAGE_SIZE);
+    }
+    
+    *pte = PA_TO_PTE(copy, flags);
+    tlb_flush(vaddr);
+    if (page_table_shared(page_table)) {
+        smp_flush_tlb_others();    // Other threads may still read the old page
+    }
+    put_page(paddr);
+    
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Give a present user page write access
+ */
+int make_user_page_writable(page_table_t *page_table, uintptr_t vaddr) {
+    vaddr = PAGE_ALIGN_DOWN(vaddr);
+    
+    pte_t *pte = walk_page_table(page_table, vaddr, 0);
+    if (pte == NULL || !(*pte & PTE_V) || !(*pte & PTE_U)) {
+        RETURN_ERRNO(THUNDEROS_EFAULT);
+    }
+    
+    *pte |= PTE_W;
+    tlb_flush(vaddr);
+    
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Check a present user page's permissions
+ */
+int user_page_permits(page_table_t *page_table, uintptr_t vaddr, uint64_t perm) {
+    int level;
+    pte_t *pte = find_leaf_pte(page_table, vaddr, &level);
+    return pte != NULL && (*pte & PTE_U) && (*pte & perm) == perm;
+}
+
+/**
+ * Find the 4KB leaf entry for a user address
+ */
+pte_t *get_user_pte(page_table_t *page_table, uintptr_t vaddr) {
+    return walk_page_table(page_table, vaddr, 0);
+}
+
+/**
+ * Translate virtual address to physical address
+ */
+int virt_to_phys(page_table_t *page_table, uintptr_t vaddr, uintptr_t *paddr) {
+    int level;
+    pte_t *pte = find_leaf_pte(page_table, vaddr, &level);
+    if (pte == NULL) {
+        RETURN_ERRNO(THUNDEROS_EFAULT);
+    }
+    
+    // Get physical page number and add offset within the (super)page
+    uintptr_t offset = vaddr & (PTE_LEVEL_SIZE(level) - 1);
     *paddr = PTE_TO_PA(*pte) + offset;
     
     return 0;
@@ -169,6 +529,38 @@ void tlb_flush(uintptr_t vaddr) {
     }
 }
 
+/**
+ * Flush TLB entries tagged with one ASID
+ */
+void tlb_flush_asid(uint64_t asid) {
+    if (asid_bits == 0) {
+        // Untagged: every switch flushed already
+        return;
+    }
+    uint64_t hw_asid = asid & ((1UL << asid_bits) - 1);
+    asm volatile("sfence.vma zero, %0" :: "r"(hw_asid) : "memory");
+}
+
+/**
+ * Flush TLB for a range
+ */
+void tlb_flush_range(uintptr_t start, uintptr_t end) {
+    start &= ~(uintptr_t)(PAGE_SIZE - 1);
+    
+    if (end <= start) {
+        return;
+    }
+    
+    if ((end - start) / PAGE_SIZE > TLB_FLUSH_RANGE_MAX) {
+        tlb_flush(0);
+        return;
+    }
+    
+    for (uintptr_t addr = start; addr < end; addr += PAGE_SIZE) {
+        asm volatile("sfence.vma %0, zero" :: "r"(addr) : "memory");
+    }
+}
+
 /**
  * Get kernel page table
  */
@@ -200,13 +592,61 @@ static void enable_paging(page_table_t *root) {
     // Flush TLB
     tlb_flush(0);
     
+    // Probe how many ASID bits the hart implements: unimplemented bits
+    // read back as zero
+    uint64_t probe;
+    asm volatile("csrw satp, %0" :: "r"(satp | SATP_ASID_MASK));
+    asm volatile("csrr %0, satp" : "=r"(probe));
+    asm volatile("csrw satp, %0" :: "r"(satp));
+    
+    probe = (probe & SATP_ASID_MASK) >> SATP_ASID_SHIFT;
+    asid_bits = 0;
+    while (probe & 1) {
+        asid_bits++;
+        probe >>= 1;
+    }
+    
     paging_enabled = 1;
 }
 
+/**
+ * Identity map [start, end) in the kernel page table
+ * 
+ * Uses 1GB and 2MB leaves wherever the range covers a whole aligned
+ * superpage, and 4KB pages for the ragged edges.
+ */
+static int map_direct_range(uintptr_t start, uintptr_t end, uint64_t flags) {
+    uintptr_t addr = start;
+    
+    while (addr < end) {
+        int level = 0;
+        if ((addr & (GIGAPAGE_SIZE - 1)) == 0 && end - addr >= GIGAPAGE_SIZE) {
+            level = 2;
+        } else if ((addr & (MEGAPAGE_SIZE - 1)) == 0 && end - addr >= MEGAPAGE_SIZE) {
+            level = 1;
+        }
+        
+        pte_t *pte = walk_page_table_level(&kernel_page_table, addr, level, 1);
+        if (pte == NULL || (*pte & PTE_V)) {
+            hal_uart_puts("map_direct_range: failed at 0x");
+            kprint_hex(addr);
+            hal_uart_puts("\n");
+            return -1;
+        }
+        
+        // Kernel mappings are global: present in every address space
+        *pte = PA_TO_PTE(addr, flags | PTE_V | PTE_G);
+        direct_map_leaves[level]++;
+        addr += PTE_LEVEL_SIZE(level);
+    }
+    
+    return 0;
+}
+
 /**
  * Initialize paging
  */
-void paging_init(uintptr_t kernel_start, uintptr_t kernel_end) {
+void paging_init(uintptr_t kernel_start, uintptr_t kernel_end, uintptr_t ram_end) {
     hal_uart_puts("Initializing virtual memory (Sv39)...\n");
     
     // Zero out kernel page table
@@ -214,48 +654,41 @@ void paging_init(uintptr_t kernel_start, uintptr_t kernel_end) {
         kernel_page_table.entries[i] = 0;
     }
     
-    // Identity map kernel region (for early boot)
-    // This allows us to continue executing after enabling paging
+    // Identity map all RAM so PMM and kmalloc work, using the largest
+    // leaves that fit. The megapages around the kernel image are also
+    // executable so we can keep running after enabling paging.
+    // QEMU virt machine: RAM starts at 0x80000000, size from the device tree
+    uintptr_t ram_start = QEMU_RAM_START;
+    uintptr_t text_start = kernel_start & ~(MEGAPAGE_SIZE - 1);
+    uintptr_t text_end = (kernel_end + MEGAPAGE_SIZE - 1) & ~(MEGAPAGE_SIZE - 1);
+    if (text_end > ram_end) {
+        text_end = ram_end;
+    }
+    
     hal_uart_puts("Identity mapping kernel: 0x");
     kprint_hex(kernel_start);
     hal_uart_puts(" - 0x");
     kprint_hex(kernel_end);
     hal_uart_puts("\n");
     
-    uintptr_t addr = kernel_start & ~(PAGE_SIZE - 1);  // Align down
-    uintptr_t end = (kernel_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);  // Align up
+    hal_uart_puts("Identity mapping all RAM (");
+    kprint_dec((ram_end - ram_start) / (1024 * 1024));
+    hal_uart_puts("MB)\n");
     
-    while (addr < end) {
-        if (map_page(&kernel_page_table, addr, addr, PTE_KERNEL_DATA | PTE_X) != 0) {
-            hal_uart_puts("Failed to identity map kernel\n");
-            return;
-        }
-        addr += PAGE_SIZE;
+    if (map_direct_range(ram_start, text_start, PTE_KERNEL_DATA) != 0 ||
+        map_direct_range(text_start, text_end, PTE_KERNEL_DATA | PTE_X) != 0 ||
+        map_direct_range(text_end, ram_end, PTE_KERNEL_DATA) != 0) {
+        hal_uart_puts("Failed to identity map RAM\n");
+        return;
     }
     
-    // Identity map all available RAM so PMM and kmalloc work
-    // QEMU virt machine: 128MB from 0x80000000 to 0x88000000
-    hal_uart_puts("Identity mapping all RAM (128MB)\n");
-    
-    uintptr_t ram_start = QEMU_RAM_START;
-    uintptr_t ram_end = QEMU_RAM_END;
-    
-    addr = ram_start;
-    while (addr < ram_end) {
-        // Skip kernel pages (already mapped)
-        if (addr >= kernel_start && addr < end) {
-            addr += PAGE_SIZE;
-            continue;
-        }
-        
-        if (map_page(&kernel_page_table, addr, addr, PTE_KERNEL_DATA) != 0) {
-            hal_uart_puts("Failed to identity map RAM at 0x");
-            kprint_hex(addr);
-            hal_uart_puts("\n");
-            return;
-        }
-        addr += PAGE_SIZE;
-    }
+    hal_uart_puts("Direct map: ");
+    kprint_dec(direct_map_leaves[2]);
+    hal_uart_puts(" x 1GB, ");
+    kprint_dec(direct_map_leaves[1]);
+    hal_uart_puts(" x 2MB, ");
+    kprint_dec(direct_map_leaves[0]);
+    hal_uart_puts(" x 4KB\n");
     
     // Map UART MMIO region
     hal_uart_puts("Mapping UART MMIO\n");
@@ -280,6 +713,13 @@ void paging_init(uintptr_t kernel_start, uintptr_t kernel_end) {
         return;
     }
     
+    // Map the RTC, read once at boot for CLOCK_REALTIME (kernel/vdso.h)
+    hal_uart_puts("Mapping RTC MMIO\n");
+    if (map_page(&kernel_page_table, QEMU_RTC_BASE, QEMU_RTC_BASE, PTE_KERNEL_DATA) != 0) {
+        hal_uart_puts("Failed to map RTC\n");
+        return;
+    }
+    
     // Map QEMU test device (QEMU_TEST_DEVICE_ADDR)
     hal_uart_puts("Mapping QEMU test device\n");
     if (map_page(&kernel_page_table, QEMU_TEST_DEVICE_ADDR, QEMU_TEST_DEVICE_ADDR, PTE_KERNEL_DATA) != 0) {
@@ -334,9 +774,25 @@ static void free_page_table_recursive(page_table_t *pt, int level) {
             uintptr_t child_pa = PTE_TO_PA(pte);
             page_table_t *child_pt = (page_table_t *)child_pa;
             
+            // Shared kernel MMIO tables belong to the kernel page table
+            if (level == 1 && is_shared_kernel_table(child_pt)) {
+                continue;
+            }
+            
             // Recursively free child
             free_page_table_recursive(child_pt, level - 1);
         }
+    } else {
+        // Leaf table: drop the reference each user mapping holds. Kernel
+        // MMIO mappings in user tables have no PTE_U and no struct page.
+        for (int i = 0; i < PT_ENTRIES; i++) {
+            pte_t pte = pt->entries[i];
+            if ((pte & PTE_V) && (pte & PTE_U)) {
+                put_page(PTE_TO_PA(pte));
+            } else if (PTE_IS_SWAP(pte)) {
+                swap_entry_free(PTE_TO_SWAP(pte));
+            }
+        }
     }
     
     // Free this page table itself
@@ -347,8 +803,9 @@ static void free_page_table_recursive(page_table_t *pt, int level) {
  * Free a page table and all its child page tables
  * 
  * This function walks the entire page table hierarchy and frees all
- * allocated page table pages. It does NOT free the actual data pages
- * mapped by the page table - those should be freed separately.
+ * allocated page table pages. Each user data page still mapped drops one
+ * reference (put_page), so pages not shared with another address space
+ * are freed along with the table.
  * 
  * WARNING: Do not call this on the kernel page table!
  * 
@@ -367,6 +824,98 @@ void free_page_table(page_table_t *page_table) {
     free_page_table_recursive(page_table, 2);
 }
 
+/**
+ * Free up to nr level-0 tables of a page table, then the rest
+ */
+int free_page_table_partial(page_table_t *page_table, size_t nr) {
+    if (!page_table || page_table == &kernel_page_table) {
+        return 1;
+    }
+    
+    // Same ownership rules as free_page_table_recursive()
+    size_t freed = 0;
+    for (int i = 0; i < 2; i++) {
+        pte_t root = page_table->entries[i];
+        if (!(root & PTE_V) || PTE_IS_LEAF(root)) {
+            continue;
+        }
+        page_table_t *l1 = (page_table_t *)PTE_TO_PA(root);
+        for (int j = 0; j < PT_ENTRIES; j++) {
+            pte_t pte = l1->entries[j];
+            if (!(pte & PTE_V) || PTE_IS_LEAF(pte)) {
+                continue;
+            }
+            page_table_t *l0 = (page_table_t *)PTE_TO_PA(pte);
+            if (is_shared_kernel_table(l0)) {
+                continue;
+            }
+            if (freed == nr) {
+                return 0;
+            }
+            free_page_table_recursive(l0, 0);
+            l1->entries[j] = 0;
+            freed++;
+        }
+    }
+    
+    free_page_table_recursive(page_table, 2);
+    return 1;
+}
+
+/**
+ * Count user pages and table pages below one page table
+ */
+static void page_table_usage_recursive(page_table_t *pt, int level,
+                                       size_t *user_pages, size_t *table_pages) {
+    (*table_pages)++;
+    
+    if (level == 0) {
+        if (user_pages) {
+            uintptr_t zero = pmm_zero_page();
+            for (int i = 0; i < PT_ENTRIES; i++) {
+                pte_t pte = pt->entries[i];
+                if ((pte & PTE_V) && (pte & PTE_U) && PTE_TO_PA(pte) != zero) {
+                    (*user_pages)++;
+                }
+            }
+        }
+        return;
+    }
+    
+    // Same ownership rules as free_page_table_recursive()
+    int end_index = (level == 2) ? 2 : PT_ENTRIES;
+    for (int i = 0; i < end_index; i++) {
+        pte_t pte = pt->entries[i];
+        if (!(pte & PTE_V) || PTE_IS_LEAF(pte)) {
+            continue;
+        }
+        
+        page_table_t *child_pt = (page_table_t *)PTE_TO_PA(pte);
+        if (level == 1 && is_shared_kernel_table(child_pt)) {
+            continue;
+        }
+        
+        page_table_usage_recursive(child_pt, level - 1, user_pages, table_pages);
+    }
+}
+
+/**
+ * Count the memory a user page table maps and occupies
+ */
+void page_table_usage(page_table_t *page_table, size_t *user_pages, size_t *table_pages) {
+    size_t tables = 0;
+    
+    if (user_pages) {
+        *user_pages = 0;
+    }
+    if (page_table && page_table != &kernel_page_table) {
+        page_table_usage_recursive(page_table, 2, user_pages, &tables);
+    }
+    if (table_pages) {
+        *table_pages = tables;
+    }
+}
+
 /**
  * Create a new page table for a user process
  * 
@@ -375,6 +924,7 @@ void free_page_table(page_table_t *page_table) {
  * 2. Copying kernel memory mappings (VPN[2] = 2-511)
  * 3. Leaving user space empty (VPN[2] = 0-1)
  * 4. Mapping MMIO regions for kernel-mode syscall handling
+ * 5. Mapping the vDSO pages (kernel/vdso.h)
  * 
  * The returned page table allows user code to execute with memory isolation,
  * while keeping kernel memory accessible for trap handling and system calls.
@@ -399,32 +949,30 @@ page_table_t *create_user_page_table(void) {
         user_pt->entries[i] = kernel_page_table.entries[i];
     }
     
-    // Entries 0-1 (user space) remain zero/unmapped
-    // This prevents user code from accessing uninitialized memory
+    // Entries 0-1 (user space) start out unmapped, except for links to
+    // the kernel's MMIO tables so supervisor code can still reach the
+    // UART, VirtIO and CLINT after switching to this page table
     user_pt->entries[0] = 0;
     user_pt->entries[1] = 0;
     
-    // Map UART MMIO region so supervisor mode can write to console
-    // After switching to user page table, kernel trap handlers still need
-    // to access UART for debug output and logging
-    if (map_page(user_pt, QEMU_UART0_BASE, QEMU_UART0_BASE, PTE_KERNEL_DATA) != 0) {
-        kfree(user_pt);
-        return NULL;
-    }
-    
-    // Map VirtIO MMIO regions for block device and GPU access
-    // Kernel needs this during syscalls that access filesystem and graphics
-    for (uintptr_t addr = QEMU_VIRTIO_BASE; addr <= QEMU_VIRTIO_END; addr += QEMU_VIRTIO_STRIDE) {
-        if (map_page(user_pt, addr, addr, PTE_KERNEL_DATA) != 0) {
-            kfree(user_pt);
+    page_table_t *kernel_l1 = kernel_low_l1();
+    if (kernel_l1) {
+        page_table_t *user_l1 = alloc_page_table();
+        if (user_l1 == NULL) {
+            pmm_free_page((uintptr_t)user_pt);
             return NULL;
         }
+        
+        for (size_t i = 0; i < NUM_SHARED_MMIO; i++) {
+            int index = PTE_INDEX(shared_mmio_bases[i], 1);
+            user_l1->entries[index] = kernel_l1->entries[index];
+        }
+        user_pt->entries[0] = PA_TO_PTE((uintptr_t)user_l1, PTE_V);
     }
     
-    // Map CLINT MMIO region for timer and interrupt handling
-    // Supervisor mode needs this for IPI and scheduling timer management
-    if (map_page(user_pt, QEMU_CLINT_BASE, QEMU_CLINT_BASE, PTE_KERNEL_DATA) != 0) {
-        kfree(user_pt);
+    // Clocks readable without a trap, in every address space
+    if (vdso_map(user_pt) != 0) {
+        free_page_table(user_pt);
         return NULL;
     }
     
@@ -466,18 +1014,13 @@ int map_user_code(page_table_t *page_table, uintptr_t user_vaddr,
     size_t src_offset = 0;  // Track total source bytes copied
     
     for (size_t i = 0; i < num_pages; i++) {
-        // Allocate physical page from physical memory manager
-        uintptr_t phys_page = pmm_alloc_page();
+        // Allocate a zeroed page (security: clear any old data)
+        uintptr_t phys_page = pmm_alloc_zeroed_page();
         if (phys_page == 0) {
             // TODO: Clean up previously allocated pages
             RETURN_ERRNO(THUNDEROS_ENOMEM);
         }
-        
-        // Zero the page first (security: clear any old data)
         uint8_t *page_ptr = (uint8_t *)phys_page;
-        for (size_t j = 0; j < PAGE_SIZE; j++) {
-            page_ptr[j] = 0;
-        }
         
         // Determine how many bytes to copy to this page
         size_t copy_size = PAGE_SIZE;
@@ -498,9 +1041,7 @@ int map_user_code(page_table_t *page_table, uintptr_t user_vaddr,
         }
         
         // Copy code bytes from kernel memory to physical page
-        for (size_t j = 0; j < copy_size; j++) {
-            copy_dest[j] = src[src_offset + j];
-        }
+        kmemcpy(copy_dest, src + src_offset, copy_size);
         
         // Update source offset for next page
         src_offset += copy_size;
@@ -564,8 +1105,8 @@ int map_user_memory(page_table_t *page_table, uintptr_t user_vaddr,
         uintptr_t phys_page;
         
         if (allocate_pages) {
-            // Allocate new anonymous page from physical memory manager
-            phys_page = pmm_alloc_page();
+            // Allocate new zeroed page (prevents information leakage)
+            phys_page = pmm_alloc_zeroed_page();
             if (phys_page == 0) {
                 // Free all previously allocated pages
                 for (size_t j = 0; j < allocated_count; j++) {
@@ -577,12 +1118,6 @@ int map_user_memory(page_table_t *page_table, uintptr_t user_vaddr,
             
             // Track this allocation for potential cleanup
             allocated_pages[allocated_count++] = phys_page;
-            
-            // Zero the page for security (prevent information leakage)
-            uint8_t *page_ptr = (uint8_t *)phys_page;
-            for (size_t j = 0; j < PAGE_SIZE; j++) {
-                page_ptr[j] = 0;
-            }
         } else {
             // Use provided physical address
             phys_page = phys_addr + (i * PAGE_SIZE);
@@ -611,6 +1146,60 @@ int map_user_memory(page_table_t *page_table, uintptr_t user_vaddr,
     return 0;
 }
 
+/**
+ * Switch to a process page table, tagged with its ASID
+ * 
+ * *asid holds the generation in its upper bits and the hardware ASID in
+ * the low asid_bits. A context from an older generation (or 0) gets a
+ * fresh ASID; once a generation is used up the whole TLB is flushed and
+ * numbering starts again. Each CPU flushes its own TLB the first time it
+ * switches under a new generation.
+ */
+void switch_page_table_asid(page_table_t *page_table, uint64_t *asid) {
+    if (!page_table || !asid) {
+        hal_uart_puts("switch_page_table_asid: NULL argument\n");
+        return;
+    }
+    
+    if (asid_bits == 0) {
+        // No hardware ASIDs: every switch has to flush
+        switch_page_table(page_table);
+        return;
+    }
+    
+    uint64_t asid_mask = (1UL << asid_bits) - 1;
+    
+    if ((*asid >> asid_bits) != asid_generation) {
+        if (asid_next > asid_mask) {
+            // Generation used up: forget every ASID handed out so far
+            asid_generation++;
+            asid_next = 1;
+        }
+        *asid = (asid_generation << asid_bits) | asid_next++;
+    }
+    
+    struct cpu *cpu = cpu_this();
+    if (cpu->asid_generation != asid_generation) {
+        // Our TLB may still hold entries from the previous generation
+        tlb_flush(0);
+        cpu->asid_generation = asid_generation;
+    }
+    
+    uintptr_t root_pa = (uintptr_t)page_table;
+    uint64_t satp = SATP_MODE_SV39 |
+                    ((*asid & asid_mask) << SATP_ASID_SHIFT) |
+                    (root_pa >> SATP_PPN_SHIFT);
+    
+    // Already running on it (same root, same ASID): nothing to write
+    uint64_t current_satp;
+    asm volatile("csrr %0, satp" : "=r"(current_satp));
+    if (current_satp == satp) {
+        return;
+    }
+    
+    asm volatile("csrw satp, %0" :: "r"(satp) : "memory");
+}
+
 /**
  * Switch to a different page table
  * 
@@ -1,17 +1,48 @@
 /*
  * Physical Memory Manager Implementation
  * 
- * Uses a bitmap allocator for simplicity and efficiency.
- * Each bit represents one 4KB page: 0=free, 1=allocated
+ * Binary buddy allocator. Free memory is kept as naturally aligned blocks
+ * of 2^order pages (order 0..PMM_MAX_ORDER) on per-order free lists, so
+ * allocating and freeing are O(log n) regardless of how full memory is.
+ * Freed blocks are merged with their buddy whenever it is also free.
+ * 
+ * A bitmap (1 bit per 4KB page, 0=free, 1=allocated) is kept alongside
+ * the free lists to validate frees. The bitmap, the per-page order array
+ * and the struct page array (mm/page.h) are sized from the amount of RAM
+ * at boot and carved out of the first pages after the kernel image, so
+ * there is no fixed memory cap. pmm_alloc_pages() trims the unused
+ * tail of a power-of-two block and pmm_free_pages()/pmm_free_page() accept
+ * any page-aligned sub-range, so callers may free pages of a multi-page
+ * allocation individually.
+ * 
+ * Single pages are allocated and freed through per-CPU page caches: a
+ * stack of free pages per CPU, refilled from and drained to the buddy
+ * lists PMM_PCP_BATCH pages at a time. Most page allocations then skip
+ * splitting and merging, and get back the page freed last on the same
+ * CPU, which is likely still in its cache. Cached pages are free in the
+ * bitmap and count as free memory. A CPU only touches its own list,
+ * except to drain them all when the buddy lists come up short.
+ * 
+ * Allocations that leave free memory below the low watermark wake kswapd,
+ * and one that finds nothing free reclaims from the caches directly
+ * before giving up (mm/reclaim.h).
  */
 
 #include "mm/pmm.h"
+#include "mm/page.h"
+#include "mm/reclaim.h"
 #include "kernel/panic.h"
 #include "hal/hal_uart.h"
+#include "kernel/kstring.h"
+#include "kernel/smp.h"
+#include "kernel/config.h"
+#include "arch/interrupt.h"
 
 // Bitmap allocation constants
 #define BITS_PER_BYTE 8
-#define BITMAP_SIZE 4096  // Supports up to 32MB with 4KB pages (4096 bytes * 8 bits/byte * 4KB/page)
+
+// Marks a page that is not the head of a free block
+#define ORDER_NONE 0xFF
 
 // Hexadecimal conversion constants
 #define HEX_BUFFER_SIZE 17      // 16 hex digits + null terminator
@@ -24,14 +55,48 @@
 #define DECIMAL_BUFFER_SIZE 20  // Max digits in 64-bit number
 #define DECIMAL_BASE 10
 
+// Free block link, stored in the first page of each free block
+struct free_block {
+    struct free_block *next;
+    struct free_block *prev;
+};
+
 // Memory region information
 static uintptr_t memory_start = 0;
+static uintptr_t base_pfn = 0;
 static size_t total_pages = 0;
 static size_t free_pages = 0;
+static size_t metadata_pages = 0;
 
 // Bitmap to track page allocation
 // Each byte represents 8 pages (1 bit per page)
-static uint8_t page_bitmap[BITMAP_SIZE];
+static uint8_t *page_bitmap = NULL;
+static size_t bitmap_size = 0;
+
+// Order of the free block starting at each page, or ORDER_NONE
+static uint8_t *free_order = NULL;
+
+// Per-page metadata, indexed by page number
+static struct page *page_array = NULL;
+
+// Per-order free lists and block counts
+static struct free_block *free_lists[PMM_MAX_ORDER + 1];
+static size_t free_counts[PMM_MAX_ORDER + 1];
+
+// Pages zeroed ahead of time, handed out by pmm_alloc_zeroed_page()
+static uintptr_t zero_pool[PMM_ZERO_POOL_SIZE];
+static size_t zero_pool_pages = 0;
+
+// Per-CPU page caches; the top of each stack is the page freed last
+struct pcp_list {
+    uintptr_t pages[PMM_PCP_HIGH];
+    size_t count;
+};
+static struct pcp_list pcp_lists[MAX_CPUS];
+static pmm_pcp_stats_t pcp_stats;       // pages: on all lists together
+
+// Shared page of zeros (pmm_zero_page), pinned by its PMM reference
+static uintptr_t zero_page = 0;
 
 // Helper: Check if a bit is set in the bitmap
 static inline int bitmap_test(size_t page_num) {
@@ -54,27 +119,244 @@ static inline void bitmap_clear(size_t page_num) {
     page_bitmap[byte_index] &= ~(1 << bit_index);
 }
 
+// Helper: Page index <-> block link (memory is identity mapped)
+static inline struct free_block *page_to_block(size_t page_num) {
+    return (struct free_block *)(memory_start + page_num * PAGE_SIZE);
+}
+
+static inline size_t block_to_page(struct free_block *block) {
+    return ((uintptr_t)block - memory_start) / PAGE_SIZE;
+}
+
+static void free_list_push(unsigned int order, size_t page_num) {
+    struct free_block *block = page_to_block(page_num);
+    block->prev = NULL;
+    block->next = free_lists[order];
+    if (free_lists[order]) {
+        free_lists[order]->prev = block;
+    }
+    free_lists[order] = block;
+    free_counts[order]++;
+    free_order[page_num] = (uint8_t)order;
+}
+
+static void free_list_remove(unsigned int order, size_t page_num) {
+    struct free_block *block = page_to_block(page_num);
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        free_lists[order] = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    free_counts[order]--;
+    free_order[page_num] = ORDER_NONE;
+}
+
+/**
+ * Free one aligned block, merging with free buddies
+ * 
+ * Buddies are computed from absolute page frame numbers so blocks stay
+ * naturally aligned in physical memory.
+ */
+static void buddy_free_block(size_t page_num, unsigned int order) {
+    while (order < PMM_MAX_ORDER) {
+        uintptr_t pfn = base_pfn + page_num;
+        uintptr_t buddy_pfn = pfn ^ ((uintptr_t)1 << order);
+        if (buddy_pfn < base_pfn) {
+            break;
+        }
+        size_t buddy = buddy_pfn - base_pfn;
+        if (buddy >= total_pages || free_order[buddy] != order) {
+            break;
+        }
+        free_list_remove(order, buddy);
+        if (buddy < page_num) {
+            page_num = buddy;
+        }
+        order++;
+    }
+    free_list_push(order, page_num);
+}
+
+/**
+ * Return a run of pages to the free lists
+ * 
+ * Splits the run into the largest naturally aligned blocks it contains.
+ * Caller must already have cleared the pages in the bitmap.
+ */
+static void buddy_free_range(size_t page_num, size_t count) {
+    while (count > 0) {
+        uintptr_t pfn = base_pfn + page_num;
+        unsigned int order = 0;
+        while (order < PMM_MAX_ORDER &&
+               (pfn & (((uintptr_t)1 << (order + 1)) - 1)) == 0 &&
+               ((size_t)1 << (order + 1)) <= count) {
+            order++;
+        }
+        buddy_free_block(page_num, order);
+        page_num += (size_t)1 << order;
+        count -= (size_t)1 << order;
+    }
+}
+
+// Helper: Mark a page allocated, with a fresh descriptor holding one reference
+static void page_set_allocated(size_t page_num) {
+    bitmap_set(page_num);
+    page_array[page_num].refcount = 1;
+    page_array[page_num].flags = 0;
+    page_array[page_num].mapping = NULL;
+    page_array[page_num].lru_prev = NULL;
+    page_array[page_num].lru_next = NULL;
+}
+
+/**
+ * Allocate a run of pages
+ * 
+ * Takes the smallest block that fits, splits off unused halves and frees
+ * any tail beyond the requested count.
+ * 
+ * @return Page index of first page, or (size_t)-1 if no block is large enough
+ */
+static size_t buddy_alloc(size_t num_pages) {
+    unsigned int order = 0;
+    while (((size_t)1 << order) < num_pages) {
+        order++;
+    }
+    if (order > PMM_MAX_ORDER) {
+        return (size_t)-1;
+    }
+
+    unsigned int current = order;
+    while (current <= PMM_MAX_ORDER && !free_lists[current]) {
+        current++;
+    }
+    if (current > PMM_MAX_ORDER) {
+        return (size_t)-1;
+    }
+
+    size_t page_num = block_to_page(free_lists[current]);
+    free_list_remove(current, page_num);
+
+    // Split down to the requested order, freeing the upper halves
+    while (current > order) {
+        current--;
+        free_list_push(current, page_num + ((size_t)1 << current));
+    }
+
+    for (size_t i = 0; i < num_pages; i++) {
+        page_set_allocated(page_num + i);
+    }
+    free_pages -= num_pages;
+
+    // Give back the unused tail of the block
+    size_t block_pages = (size_t)1 << order;
+    if (block_pages > num_pages) {
+        buddy_free_range(page_num + num_pages, block_pages - num_pages);
+    }
+
+    return page_num;
+}
+
+/**
+ * Validate a page address for freeing
+ * 
+ * @return Page index, or (size_t)-1 if the address is invalid or already free
+ */
+static size_t validate_free(uintptr_t page_addr) {
+    // Validate address is page-aligned
+    if (page_addr & (PAGE_SIZE - 1)) {
+        hal_uart_puts("PMM: Error - address not page-aligned\n");
+        return (size_t)-1;
+    }
+    
+    // Validate address is in managed region
+    if (page_addr < memory_start) {
+        hal_uart_puts("PMM: Error - address below managed region\n");
+        return (size_t)-1;
+    }
+    
+    // Calculate page number
+    size_t page_num = (page_addr - memory_start) / PAGE_SIZE;
+    
+    if (page_num >= total_pages) {
+        hal_uart_puts("PMM: Error - address above managed region\n");
+        return (size_t)-1;
+    }
+    
+    // Check if page is actually allocated
+    if (!bitmap_test(page_num)) {
+        hal_uart_puts("PMM: Warning - freeing already-free page\n");
+        return (size_t)-1;
+    }
+
+    return page_num;
+}
+
 /**
  * Initialize the physical memory manager
  */
 void pmm_init(uintptr_t mem_start, size_t mem_size) {
-    // Store memory region info
-    memory_start = PAGE_ALIGN_UP(mem_start);
-    total_pages = mem_size / PAGE_SIZE;
+    uintptr_t region_start = PAGE_ALIGN_UP(mem_start);
+    uintptr_t region_end = PAGE_ALIGN_DOWN(mem_start + mem_size);
+    size_t region_pages = region_end > region_start ? (region_end - region_start) / PAGE_SIZE : 0;
     
-    // Limit to bitmap capacity
-    size_t max_pages = (size_t)BITMAP_SIZE * BITS_PER_BYTE;
-    if (total_pages > max_pages) {
-        total_pages = max_pages;
+    // Size the metadata for the whole region and place it at the start.
+    // Sizing it for region_pages slightly over-provisions (by the metadata
+    // pages themselves), which keeps the arithmetic simple.
+    bitmap_size = (region_pages + BITS_PER_BYTE - 1) / BITS_PER_BYTE;
+    size_t page_array_offset = (bitmap_size + region_pages + sizeof(struct page) - 1) &
+                               ~(sizeof(struct page) - 1);
+    size_t metadata_bytes = page_array_offset + region_pages * sizeof(struct page);
+    metadata_pages = (metadata_bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    
+    if (metadata_pages >= region_pages) {
+        kernel_panic("PMM: Not enough memory for page metadata");
     }
     
+    page_bitmap = (uint8_t *)region_start;
+    free_order = page_bitmap + bitmap_size;
+    page_array = (struct page *)(region_start + page_array_offset);
+    
+    // Store memory region info
+    memory_start = region_start + metadata_pages * PAGE_SIZE;
+    base_pfn = memory_start >> PAGE_SHIFT;
+    total_pages = region_pages - metadata_pages;
+    
     free_pages = total_pages;
+    reclaim_init(total_pages);
     
     // Initialize bitmap: all pages start as free (0)
-    for (size_t i = 0; i < BITMAP_SIZE; i++) {
+    for (size_t i = 0; i < bitmap_size; i++) {
         page_bitmap[i] = 0;
     }
     
+    for (size_t i = 0; i < total_pages; i++) {
+        free_order[i] = ORDER_NONE;
+        page_array[i].refcount = 0;
+        page_array[i].flags = 0;
+        page_array[i].mapping = NULL;
+        page_array[i].lru_prev = NULL;
+        page_array[i].lru_next = NULL;
+    }
+    
+    for (unsigned int order = 0; order <= PMM_MAX_ORDER; order++) {
+        free_lists[order] = NULL;
+        free_counts[order] = 0;
+    }
+    
+    // Hand all of memory to the buddy free lists
+    buddy_free_range(0, total_pages);
+    
+    zero_pool_pages = 0;
+    size_t zero_page_num = buddy_alloc(1);
+    if (zero_page_num == (size_t)-1) {
+        kernel_panic("PMM: No memory for the zero page");
+    }
+    zero_page = memory_start + zero_page_num * PAGE_SIZE;
+    kmemset((void *)zero_page, 0, PAGE_SIZE);
+    
     // Print initialization info
     hal_uart_puts("PMM: Initialized\n");
     hal_uart_puts("  Memory start: 0x");
@@ -108,29 +390,218 @@ void pmm_init(uintptr_t mem_start, size_t mem_size) {
     }
     hal_uart_puts("\n");
     
+    hal_uart_puts("  Metadata pages: ");
+    kprint_dec(metadata_pages);
+    hal_uart_puts("\n");
+    
     hal_uart_puts("  Page size: 4KB\n");
 }
 
+/**
+ * Wake kswapd once free memory falls below the low watermark
+ */
+static inline void check_watermark(void) {
+    if (free_pages + zero_pool_pages + pcp_stats.pages < reclaim_wmark_low()) {
+        reclaim_wake_kswapd();
+    }
+}
+
+/**
+ * Give the oldest pages of a per-CPU list back to the buddy allocator
+ * (interrupts disabled)
+ */
+static void pcp_drain(struct pcp_list *pcp, size_t nr) {
+    if (nr > pcp->count) {
+        nr = pcp->count;
+    }
+    for (size_t i = 0; i < nr; i++) {
+        free_pages++;
+        buddy_free_block((pcp->pages[i] - memory_start) / PAGE_SIZE, 0);
+    }
+    for (size_t i = nr; i < pcp->count; i++) {
+        pcp->pages[i - nr] = pcp->pages[i];
+    }
+    pcp->count -= nr;
+    pcp_stats.pages -= nr;
+    if (nr > 0) {
+        pcp_stats.drains++;
+    }
+}
+
+/**
+ * Fill an empty per-CPU list from the buddy allocator, with one run if
+ * there is a free block that large (interrupts disabled)
+ */
+static void pcp_refill(struct pcp_list *pcp) {
+    size_t run = buddy_alloc(PMM_PCP_BATCH);
+    
+    // Stacked top-down, so a run is handed out in address order
+    for (size_t i = 0; i < PMM_PCP_BATCH; i++) {
+        size_t page_num;
+        if (run != (size_t)-1) {
+            page_num = run + (PMM_PCP_BATCH - 1 - i);
+        } else {
+            // Fragmented: as many single pages as there are
+            page_num = buddy_alloc(1);
+            if (page_num == (size_t)-1) {
+                break;
+            }
+        }
+        bitmap_clear(page_num);
+        page_array[page_num].refcount = 0;
+        pcp->pages[pcp->count++] = memory_start + page_num * PAGE_SIZE;
+        pcp_stats.pages++;
+    }
+    if (pcp->count > 0) {
+        pcp_stats.refills++;
+    }
+}
+
+/**
+ * Return every CPU's cached pages to the buddy allocator
+ */
+void pmm_drain_pcp(void) {
+    // Under the big kernel lock no other CPU is in here
+    int irq_state = interrupt_save_disable();
+    for (int i = 0; i < MAX_CPUS; i++) {
+        pcp_drain(&pcp_lists[i], pcp_lists[i].count);
+    }
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Take a single page from this CPU's cache, the buddy allocator (through
+ * the cache) or, failing both, the pool
+ * 
+ * @return Physical address, or 0 if nothing is free
+ */
+static uintptr_t try_alloc_page(void) {
+    int irq_state = interrupt_save_disable();
+    struct pcp_list *pcp = &pcp_lists[cpu_this()->id];
+    if (pcp->count == 0) {
+        pcp_refill(pcp);
+    }
+    if (pcp->count == 0 && pcp_stats.pages > 0) {
+        // Other CPUs hold what is left
+        pmm_drain_pcp();
+        pcp_refill(pcp);
+    }
+    
+    uintptr_t page = 0;
+    if (pcp->count > 0) {
+        page = pcp->pages[--pcp->count];
+        pcp_stats.pages--;
+        pcp_stats.hits++;
+        page_set_allocated((page - memory_start) / PAGE_SIZE);
+    } else if (zero_pool_pages > 0) {
+        // Last resort: the pre-zeroed pool
+        page = zero_pool[--zero_pool_pages];
+    }
+    interrupt_restore(irq_state);
+    return page;
+}
+
 /**
  * Allocate a single physical page
  */
 uintptr_t pmm_alloc_page(void) {
-    // Find first free page in bitmap
-    for (size_t page_num = 0; page_num < total_pages; page_num++) {
-        if (!bitmap_test(page_num)) {
-            // Found a free page!
-            bitmap_set(page_num);
-            free_pages--;
-            
-            // Calculate physical address
-            uintptr_t page_addr = memory_start + (page_num * PAGE_SIZE);
-            return page_addr;
+    uintptr_t page = try_alloc_page();
+    
+    // Nothing free: give back cache memory and try once more
+    if (!page && reclaim_direct(RECLAIM_DIRECT_BATCH) > 0) {
+        page = try_alloc_page();
+    }
+    
+    if (!page) {
+        // Out of memory!
+        hal_uart_puts("PMM: Out of memory!\n");
+        return 0;
+    }
+    
+    check_watermark();
+    return page;
+}
+
+/**
+ * Allocate a zero-filled page, from the pre-zeroed pool if possible
+ */
+uintptr_t pmm_alloc_zeroed_page(void) {
+    int irq_state = interrupt_save_disable();
+    if (zero_pool_pages > 0) {
+        uintptr_t page = zero_pool[--zero_pool_pages];
+        interrupt_restore(irq_state);
+        check_watermark();
+        return page;
+    }
+    interrupt_restore(irq_state);
+    
+    uintptr_t page = pmm_alloc_page();
+    if (page) {
+        kmemset((void *)page, 0, PAGE_SIZE);
+    }
+    return page;
+}
+
+/**
+ * Zero free pages into the pre-zeroed pool
+ */
+size_t pmm_zero_pool_refill(size_t max_pages) {
+    size_t added = 0;
+    
+    while (added < max_pages) {
+        int irq_state = interrupt_save_disable();
+        if (zero_pool_pages >= PMM_ZERO_POOL_SIZE || free_pages <= PMM_ZERO_POOL_RESERVE) {
+            interrupt_restore(irq_state);
+            break;
         }
+        size_t page_num = buddy_alloc(1);
+        interrupt_restore(irq_state);
+        
+        if (page_num == (size_t)-1) {
+            break;
+        }
+        
+        // Zero with interrupts enabled; the page is ours until pooled
+        uintptr_t page = memory_start + (page_num * PAGE_SIZE);
+        kmemset((void *)page, 0, PAGE_SIZE);
+        
+        irq_state = interrupt_save_disable();
+        if (zero_pool_pages >= PMM_ZERO_POOL_SIZE) {
+            interrupt_restore(irq_state);
+            pmm_free_page(page);
+            break;
+        }
+        zero_pool[zero_pool_pages++] = page;
+        interrupt_restore(irq_state);
+        added++;
     }
     
-    // Out of memory!
-    hal_uart_puts("PMM: Out of memory!\n");
-    return 0;
+    return added;
+}
+
+/**
+ * Return every pooled page to the buddy allocator
+ */
+static void zero_pool_drain(void) {
+    int irq_state = interrupt_save_disable();
+    while (zero_pool_pages > 0) {
+        pmm_free_page(zero_pool[--zero_pool_pages]);
+    }
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Get the number of pages in the pre-zeroed pool
+ */
+size_t pmm_zero_pool_count(void) {
+    return zero_pool_pages;
+}
+
+/**
+ * Get the shared zero page
+ */
+uintptr_t pmm_zero_page(void) {
+    return zero_page;
 }
 
 /**
@@ -145,33 +616,36 @@ uintptr_t pmm_alloc_pages(size_t num_pages) {
         return pmm_alloc_page();
     }
     
-    // Check if request exceeds total pages (prevent underflow)
-    if (num_pages > total_pages) {
-        hal_uart_puts("PMM: Request exceeds total pages\n");
+    // Check if request exceeds what one buddy block can hold
+    if (num_pages > total_pages || num_pages > ((size_t)1 << PMM_MAX_ORDER)) {
+        hal_uart_puts("PMM: Request exceeds largest block\n");
         return 0;
     }
     
-    // Search for contiguous free pages
-    for (size_t start_page = 0; start_page <= total_pages - num_pages; start_page++) {
-        // Check if we have num_pages contiguous free pages starting at start_page
-        int found = 1;
-        for (size_t i = 0; i < num_pages; i++) {
-            if (bitmap_test(start_page + i)) {
-                found = 0;
-                break;
-            }
-        }
-        
-        if (found) {
-            // Allocate all pages
-            for (size_t i = 0; i < num_pages; i++) {
-                bitmap_set(start_page + i);
-                free_pages--;
-            }
-            
-            // Return physical address of first page
-            return memory_start + (start_page * PAGE_SIZE);
-        }
+    int irq_state = interrupt_save_disable();
+    size_t page_num = buddy_alloc(num_pages);
+    interrupt_restore(irq_state);
+    
+    // Pooled and cached pages may be what keeps a run from forming
+    if (page_num == (size_t)-1 && (zero_pool_pages > 0 || pcp_stats.pages > 0)) {
+        zero_pool_drain();
+        pmm_drain_pcp();
+        irq_state = interrupt_save_disable();
+        page_num = buddy_alloc(num_pages);
+        interrupt_restore(irq_state);
+    }
+    
+    // Then cache memory, though what it frees need not be contiguous
+    if (page_num == (size_t)-1 && reclaim_direct(num_pages + RECLAIM_DIRECT_BATCH) > 0) {
+        irq_state = interrupt_save_disable();
+        page_num = buddy_alloc(num_pages);
+        interrupt_restore(irq_state);
+    }
+    
+    if (page_num != (size_t)-1) {
+        check_watermark();
+        // Return physical address of first page
+        return memory_start + (page_num * PAGE_SIZE);
     }
     
     // Could not find contiguous pages
@@ -195,54 +669,161 @@ uintptr_t pmm_alloc_pages(size_t num_pages) {
  * Free a previously allocated page
  */
 void pmm_free_page(uintptr_t page_addr) {
-    // Validate address is page-aligned
-    if (page_addr & (PAGE_SIZE - 1)) {
-        hal_uart_puts("PMM: Error - address not page-aligned\n");
+    int irq_state = interrupt_save_disable();
+    
+    size_t page_num = validate_free(page_addr);
+    if (page_num != (size_t)-1) {
+        // Free the page onto this CPU's cache, making room if it is full
+        bitmap_clear(page_num);
+        page_array[page_num].refcount = 0;
+        struct pcp_list *pcp = &pcp_lists[cpu_this()->id];
+        if (pcp->count == PMM_PCP_HIGH) {
+            pcp_drain(pcp, PMM_PCP_BATCH);
+        }
+        pcp->pages[pcp->count++] = page_addr;
+        pcp_stats.pages++;
+    }
+    
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Free multiple contiguous physical pages
+ */
+void pmm_free_pages(uintptr_t page_addr, size_t num_pages) {
+    if (num_pages == 0) {
         return;
     }
     
-    // Validate address is in managed region
-    if (page_addr < memory_start) {
-        hal_uart_puts("PMM: Error - address below managed region\n");
+    int irq_state = interrupt_save_disable();
+    
+    // Free maximal runs of valid pages in one go so they coalesce into
+    // large blocks directly; invalid pages are reported and skipped
+    size_t run_start = 0;
+    size_t run_len = 0;
+    for (size_t i = 0; i < num_pages; i++) {
+        size_t page_num = validate_free(page_addr + (i * PAGE_SIZE));
+        if (page_num == (size_t)-1) {
+            if (run_len > 0) {
+                buddy_free_range(run_start, run_len);
+                run_len = 0;
+            }
+            continue;
+        }
+        bitmap_clear(page_num);
+        page_array[page_num].refcount = 0;
+        free_pages++;
+        if (run_len == 0) {
+            run_start = page_num;
+        }
+        run_len++;
+    }
+    if (run_len > 0) {
+        buddy_free_range(run_start, run_len);
+    }
+    
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Get memory statistics
+ */
+void pmm_get_stats(size_t *total, size_t *free) {
+    if (total) *total = total_pages;
+    // Pooled and cached pages are still available to pmm_alloc_page()
+    if (free) *free = free_pages + zero_pool_pages + pcp_stats.pages;
+}
+
+/**
+ * Get per-CPU page cache statistics
+ */
+void pmm_get_pcp_stats(pmm_pcp_stats_t *stats) {
+    if (!stats) {
         return;
     }
     
-    // Calculate page number
-    size_t page_num = (page_addr - memory_start) / PAGE_SIZE;
+    int irq_state = interrupt_save_disable();
+    *stats = pcp_stats;
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Get number of free blocks of each order
+ */
+void pmm_get_order_stats(size_t counts[PMM_MAX_ORDER + 1]) {
+    if (!counts) {
+        return;
+    }
     
+    int irq_state = interrupt_save_disable();
+    for (unsigned int order = 0; order <= PMM_MAX_ORDER; order++) {
+        counts[order] = free_counts[order];
+    }
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Look up the struct page for a physical address
+ */
+struct page *phys_to_page(uintptr_t paddr) {
+    if (paddr < memory_start) {
+        return NULL;
+    }
+    
+    size_t page_num = (paddr - memory_start) / PAGE_SIZE;
     if (page_num >= total_pages) {
-        hal_uart_puts("PMM: Error - address above managed region\n");
-        return;
+        return NULL;
     }
     
-    // Check if page is actually allocated
-    if (!bitmap_test(page_num)) {
-        hal_uart_puts("PMM: Warning - freeing already-free page\n");
+    return &page_array[page_num];
+}
+
+/**
+ * Get the physical address described by a struct page
+ */
+uintptr_t page_to_phys(struct page *page) {
+    return memory_start + (uintptr_t)(page - page_array) * PAGE_SIZE;
+}
+
+/**
+ * Take an extra reference to a page
+ */
+void get_page(uintptr_t paddr) {
+    struct page *page = phys_to_page(paddr);
+    if (!page) {
         return;
     }
     
-    // Free the page
-    bitmap_clear(page_num);
-    free_pages++;
+    if (page->refcount == 0) {
+        kernel_panic("get_page: page is not allocated");
+    }
+    
+    __sync_add_and_fetch(&page->refcount, 1);
 }
 
 /**
- * Free multiple contiguous physical pages
+ * Drop a reference to a page, freeing it with the last one
  */
-void pmm_free_pages(uintptr_t page_addr, size_t num_pages) {
-    if (num_pages == 0) {
+void put_page(uintptr_t paddr) {
+    struct page *page = phys_to_page(paddr);
+    if (!page) {
         return;
     }
     
-    for (size_t i = 0; i < num_pages; i++) {
-        pmm_free_page(page_addr + (i * PAGE_SIZE));
+    if (page->refcount == 0) {
+        hal_uart_puts("PMM: Warning - put_page on free page\n");
+        return;
+    }
+    
+    if (__sync_sub_and_fetch(&page->refcount, 1) == 0) {
+        pmm_free_page(PAGE_ALIGN_DOWN(paddr));
     }
 }
 
 /**
- * Get memory statistics
+ * Get the reference count of a page
  */
-void pmm_get_stats(size_t *total, size_t *free) {
-    if (total) *total = total_pages;
-    if (free) *free = free_pages;
+uint32_t page_refcount(uintptr_t paddr) {
+    struct page *page = phys_to_page(paddr);
+    return page ? page->refcount : 0;
 }
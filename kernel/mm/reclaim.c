@@ -0,0 +1,407 @@
+/*
+ * Memory Reclaim Implementation
+ *
+ * The LRU lists are doubly linked through struct page, heads at the most
+ * recently used end. Shrinkers sit on a singly linked list, newest
+ * first: caches built on the slab allocator register after it, so each
+ * pass runs them before the slab shrinker returns the slabs they
+ * emptied. Everything here runs under the big kernel lock;
+ * the lists are also touched with interrupts disabled, since direct
+ * reclaim may run from an allocation made anywhere.
+ *
+ * Progress is measured in free pages rather than in the objects
+ * shrinkers report: dropping a dentry only frees a page once its slab
+ * empties.
+ */
+
+#include "mm/reclaim.h"
+#include "mm/pmm.h"
+#include "mm/page.h"
+#include "kernel/process.h"
+#include "kernel/wait_queue.h"
+#include "kernel/errno.h"
+#include "arch/interrupt.h"
+
+// LRU lists
+static struct page *lru_heads[2];        // [0] inactive, [1] active
+static struct page *lru_tails[2];
+static size_t lru_counts[2];
+
+static shrinker_t *shrinkers = NULL;
+
+static size_t wmark_low = RECLAIM_WMARK_LOW_FLOOR;
+static size_t wmark_high = 2 * RECLAIM_WMARK_LOW_FLOOR;
+
+static reclaim_stats_t stats;
+
+static int direct_running = 0;           // Direct reclaim in progress
+static struct process *kswapd = NULL;
+static volatile int kswapd_idle = 0;     // Asleep and may be woken
+static int kswapd_backoff = 0;           // Last pass freed nothing: wait out the interval
+static volatile int kswapd_wanted = 0;   // Someone is waiting in reclaim_wait()
+static volatile uint64_t kswapd_passes;  // Passes run, for reclaim_wait()
+static size_t kswapd_last_freed;         // Pages the last pass freed
+static wait_queue_t kswapd_done = WAIT_QUEUE_INIT;  // Woken after each pass
+
+/**
+ * Compute the watermarks
+ */
+void reclaim_init(size_t total_pages) {
+    wmark_low = total_pages / RECLAIM_WMARK_LOW_DIV;
+    if (wmark_low < RECLAIM_WMARK_LOW_FLOOR) {
+        wmark_low = RECLAIM_WMARK_LOW_FLOOR;
+    }
+    wmark_high = 2 * wmark_low;
+}
+
+/**
+ * Register a shrinker, ahead of the ones already there
+ */
+void register_shrinker(shrinker_t *shrinker) {
+    if (!shrinker || !shrinker->count || !shrinker->scan) {
+        return;
+    }
+
+    int irq_state = interrupt_save_disable();
+    for (shrinker_t *s = shrinkers; s; s = s->next) {
+        if (s == shrinker) {
+            interrupt_restore(irq_state);
+            return;
+        }
+    }
+    shrinker->next = shrinkers;
+    shrinkers = shrinker;
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Unregister a shrinker
+ */
+void unregister_shrinker(shrinker_t *shrinker) {
+    int irq_state = interrupt_save_disable();
+    shrinker_t **link = &shrinkers;
+    while (*link && *link != shrinker) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = shrinker->next;
+        shrinker->next = NULL;
+    }
+    interrupt_restore(irq_state);
+}
+
+// Helper: Unlink a page from list (interrupts disabled)
+static void lru_unlink(struct page *page, int list) {
+    if (page->lru_prev) {
+        page->lru_prev->lru_next = page->lru_next;
+    } else {
+        lru_heads[list] = page->lru_next;
+    }
+    if (page->lru_next) {
+        page->lru_next->lru_prev = page->lru_prev;
+    } else {
+        lru_tails[list] = page->lru_prev;
+    }
+    page->lru_prev = NULL;
+    page->lru_next = NULL;
+    lru_counts[list]--;
+}
+
+// Helper: Link a page at the head of list (interrupts disabled)
+static void lru_push_front(struct page *page, int list) {
+    page->lru_prev = NULL;
+    page->lru_next = lru_heads[list];
+    if (lru_heads[list]) {
+        lru_heads[list]->lru_prev = page;
+    } else {
+        lru_tails[list] = page;
+    }
+    lru_heads[list] = page;
+    lru_counts[list]++;
+    if (list) {
+        page->flags |= PG_ACTIVE;
+    } else {
+        page->flags &= ~PG_ACTIVE;
+    }
+}
+
+/**
+ * Put a page at the head of the inactive list
+ */
+void lru_add(struct page *page) {
+    if (!page || (page->flags & PG_LRU)) {
+        return;
+    }
+
+    int irq_state = interrupt_save_disable();
+    page->flags |= PG_LRU;
+    page->flags &= ~PG_REFERENCED;
+    lru_push_front(page, 0);
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Take a page off its LRU list
+ */
+void lru_del(struct page *page) {
+    if (!page) {
+        return;
+    }
+
+    int irq_state = interrupt_save_disable();
+    if (page->flags & PG_LRU) {
+        lru_unlink(page, (page->flags & PG_ACTIVE) ? 1 : 0);
+        page->flags &= ~(PG_LRU | PG_ACTIVE | PG_REFERENCED);
+    }
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Note a use of a page; the second while inactive activates it
+ */
+void lru_mark_accessed(struct page *page) {
+    if (!page) {
+        return;
+    }
+
+    int irq_state = interrupt_save_disable();
+    if ((page->flags & (PG_LRU | PG_ACTIVE | PG_REFERENCED)) == (PG_LRU | PG_REFERENCED)) {
+        lru_unlink(page, 0);
+        lru_push_front(page, 1);
+        page->flags &= ~PG_REFERENCED;
+        stats.lru_activated++;
+    } else if (page->flags & PG_LRU) {
+        page->flags |= PG_REFERENCED;
+    }
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Move up to nr pages from the active tail to the inactive list while
+ * the active list is the longer one (interrupts disabled)
+ *
+ * A page used since the last look gets another round on the active list.
+ */
+static void lru_balance(size_t nr) {
+    while (nr-- > 0 && lru_counts[1] > lru_counts[0]) {
+        struct page *page = lru_tails[1];
+        lru_unlink(page, 1);
+        if (page->flags & PG_REFERENCED) {
+            page->flags &= ~PG_REFERENCED;
+            lru_push_front(page, 1);
+        } else {
+            lru_push_front(page, 0);
+            stats.lru_deactivated++;
+        }
+    }
+}
+
+/**
+ * Reclaim from the inactive list
+ */
+size_t lru_shrink(size_t nr, int (*evict)(struct page *page)) {
+    size_t evicted = 0;
+
+    int irq_state = interrupt_save_disable();
+    lru_balance(nr);
+
+    struct page *page = lru_tails[0];
+    while (page && nr-- > 0) {
+        struct page *prev = page->lru_prev;
+        stats.lru_scanned++;
+
+        if (page->flags & PG_REFERENCED) {
+            // Used since it was last looked at: keep it
+            lru_unlink(page, 0);
+            page->flags &= ~PG_REFERENCED;
+            lru_push_front(page, 1);
+            stats.lru_activated++;
+        } else if (evict(page)) {
+            evicted++;
+        } else if (page->flags & PG_LRU) {
+            // Busy (mapped or dirty): try the others first
+            lru_unlink(page, 0);
+            lru_push_front(page, 0);
+        }
+        page = prev;
+    }
+
+    interrupt_restore(irq_state);
+    return evicted;
+}
+
+// Helper: Free pages, as the PMM counts them
+static size_t free_page_count(void) {
+    size_t free;
+    pmm_get_stats(NULL, &free);
+    return free;
+}
+
+/**
+ * Free memory through the shrinkers, asking for more on each pass
+ */
+size_t reclaim_pages(size_t nr_pages, uint32_t flags) {
+    size_t before = free_page_count();
+    size_t freed = 0;
+
+    for (int priority = RECLAIM_PRIORITY_MAX; priority >= 0 && freed < nr_pages; priority--) {
+        for (shrinker_t *shrinker = shrinkers; shrinker && freed < nr_pages;
+             shrinker = shrinker->next) {
+            size_t nr = shrinker->count(shrinker) >> priority;
+            if (nr == 0) {
+                continue;
+            }
+            shrinker->scanned += nr;
+            shrinker->freed += shrinker->scan(shrinker, nr, flags);
+
+            size_t now = free_page_count();
+            freed = now > before ? now - before : 0;
+        }
+    }
+
+    return freed;
+}
+
+/**
+ * Reclaim on behalf of a failed allocation
+ */
+size_t reclaim_direct(size_t nr_pages) {
+    int irq_state = interrupt_save_disable();
+    if (!irq_state || direct_running) {
+        interrupt_restore(irq_state);
+        return 0;
+    }
+
+    direct_running = 1;
+    stats.direct_reclaims++;
+    size_t freed = reclaim_pages(nr_pages, 0);
+    stats.direct_reclaimed += freed;
+    direct_running = 0;
+
+    interrupt_restore(irq_state);
+    return freed;
+}
+
+/**
+ * Wake kswapd if it is asleep
+ */
+void reclaim_wake_kswapd(void) {
+    if (kswapd && kswapd_idle && !kswapd_backoff) {
+        kswapd_idle = 0;
+        process_wakeup(kswapd);
+    }
+}
+
+/**
+ * kswapd thread body
+ */
+static void kswapd_main(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        if (!kswapd_wanted) {
+            kswapd_idle = 1;
+            process_sleep_us(RECLAIM_KSWAPD_INTERVAL_US);
+            kswapd_idle = 0;
+            kswapd_backoff = 0;
+        }
+
+        size_t free = free_page_count();
+        int wanted = kswapd_wanted;
+        kswapd_wanted = 0;
+        if (free >= wmark_low && !wanted) {
+            continue;
+        }
+
+        // A waiter above the high watermark still wants a batch freed
+        size_t target = free < wmark_high ? wmark_high : free + RECLAIM_DIRECT_BATCH;
+        size_t total = 0;
+        stats.kswapd_wakeups++;
+        while (free < target) {
+            size_t freed = reclaim_pages(target - free, SHRINK_MAY_SLEEP);
+            total += freed;
+            if (freed == 0) {
+                // Nothing left to give back: allocations stop waking us
+                // until the next interval
+                kswapd_backoff = 1;
+                break;
+            }
+            free = free_page_count();
+        }
+        stats.kswapd_reclaimed += total;
+
+        kswapd_last_freed = total;
+        kswapd_passes++;
+        wait_queue_wake(&kswapd_done);
+        clear_errno();
+    }
+}
+
+/**
+ * Sleep until kswapd has run a pass
+ */
+int reclaim_wait(void) {
+    if (!kswapd || process_current() == kswapd) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+
+    // Interrupts stay off from the check until we are on the queue
+    int irq_state = interrupt_save_disable();
+    uint64_t pass = kswapd_passes;
+    kswapd_wanted = 1;
+    kswapd_backoff = 0;
+    if (kswapd_idle) {
+        kswapd_idle = 0;
+        process_wakeup(kswapd);
+    }
+    while (kswapd_passes == pass) {
+        wait_queue_sleep_irqoff(&kswapd_done);
+    }
+    stats.kswapd_waits++;
+    size_t freed = kswapd_last_freed;
+    interrupt_restore(irq_state);
+
+    if (freed == 0) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Start the kswapd thread
+ */
+int reclaim_start_kswapd(void) {
+    struct process *proc = kthread_create("kswapd", kswapd_main, NULL);
+    if (!proc) {
+        // errno already set by kthread_create
+        return -1;
+    }
+    kswapd = proc;
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Get the low watermark
+ */
+size_t reclaim_wmark_low(void) {
+    return wmark_low;
+}
+
+/**
+ * Get reclaim statistics
+ */
+void reclaim_get_stats(reclaim_stats_t *out) {
+    if (!out) {
+        return;
+    }
+
+    int irq_state = interrupt_save_disable();
+    *out = stats;
+    out->lru_inactive = lru_counts[0];
+    out->lru_active = lru_counts[1];
+    out->wmark_low = wmark_low;
+    out->wmark_high = wmark_high;
+    interrupt_restore(irq_state);
+}
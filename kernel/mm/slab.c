@@ -0,0 +1,455 @@
+/*
+ * Slab Allocator Implementation
+ *
+ * A slab is one (or, for objects larger than a page, a few) contiguous
+ * PMM page(s) holding objects of a single cache. The slab header sits
+ * at the start of the first page, so the owning slab of any object is
+ * found by rounding its address down to a page boundary. This only
+ * holds if every object starts in the first page, so multi-page slabs
+ * hold exactly one object.
+ *
+ * Free objects are kept on a per-slab singly-linked list. For caches
+ * without a constructor the link lives in the object's first word; for
+ * caches with one it lives just past the object so constructed state
+ * survives a free/alloc round trip.
+ *
+ * Each cache keeps one empty slab rather than returning it at once; the
+ * "slab" shrinker hands those back under memory pressure.
+ */
+
+#include "mm/slab.h"
+#include "mm/pmm.h"
+#include "mm/page.h"
+#include "mm/reclaim.h"
+#include "kernel/panic.h"
+#include "kernel/errno.h"
+#include "arch/interrupt.h"
+
+// Slab header (stored at start of each slab's first page)
+struct slab {
+    uint32_t magic;        // SLAB_MAGIC
+    uint32_t in_use;       // Objects currently allocated from this slab
+    void *free_list;       // Singly-linked list of free objects
+    kmem_cache_t *cache;   // Owning cache
+    struct slab *next;     // Next slab in the cache partial list
+    struct slab *prev;     // Previous slab in the cache partial list
+};
+
+_Static_assert(sizeof(struct slab) <= SLAB_HEADER_SIZE, "slab header too large");
+
+#define SLAB_MAGIC 0x51AB51AB
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((a) - 1))
+
+struct kmem_cache {
+    const char *name;
+    size_t size;             // Requested object size
+    size_t stride;           // Distance between objects
+    size_t first_offset;     // Offset of first object from slab start
+    size_t freeptr_offset;   // Offset of free-list link within object
+    size_t objects_per_slab;
+    size_t slab_pages;       // Pages per slab
+    kmem_ctor_t ctor;
+    struct slab *partial;    // Slabs with at least one free object
+    size_t slabs;            // Slabs owned by this cache
+    size_t in_use;           // Objects handed out
+    int active;              // Slot in use
+};
+
+static kmem_cache_t cache_pool[KMEM_MAX_CACHES];
+
+static size_t slab_shrinker_count(shrinker_t *shrinker);
+static size_t slab_shrinker_scan(shrinker_t *shrinker, size_t nr, uint32_t flags);
+
+static shrinker_t slab_shrinker = { "slab", slab_shrinker_count, slab_shrinker_scan, 0, 0, NULL };
+static int slab_shrinker_registered = 0;
+
+static void slab_list_remove(kmem_cache_t *cache, struct slab *slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        cache->partial = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+static void slab_list_push(kmem_cache_t *cache, struct slab *slab) {
+    slab->prev = NULL;
+    slab->next = cache->partial;
+    if (cache->partial) {
+        cache->partial->prev = slab;
+    }
+    cache->partial = slab;
+}
+
+static inline void **obj_freeptr(kmem_cache_t *cache, void *obj) {
+    return (void **)((uintptr_t)obj + cache->freeptr_offset);
+}
+
+static inline void *freeptr_obj(kmem_cache_t *cache, void **link) {
+    return (void *)((uintptr_t)link - cache->freeptr_offset);
+}
+
+/**
+ * Allocate a fresh slab and construct its objects
+ *
+ * Called with interrupts as the allocating caller had them, so the page
+ * allocation may reclaim; the caller links the slab in.
+ */
+static struct slab *slab_grow(kmem_cache_t *cache) {
+    uintptr_t page;
+    if (cache->slab_pages == 1) {
+        page = pmm_alloc_page();
+    } else {
+        page = pmm_alloc_pages(cache->slab_pages);
+    }
+    if (page == 0) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < cache->slab_pages; i++) {
+        struct page *pg = phys_to_page(page + i * PAGE_SIZE);
+        if (pg) {
+            pg->flags |= PG_SLAB;
+            pg->mapping = cache;
+        }
+    }
+
+    struct slab *slab = (struct slab *)page;
+    slab->magic = SLAB_MAGIC;
+    slab->in_use = 0;
+    slab->free_list = NULL;
+    slab->cache = cache;
+    slab->next = NULL;
+    slab->prev = NULL;
+
+    // Thread objects onto the free list back to front so allocation
+    // hands them out in ascending address order
+    uintptr_t first = page + cache->first_offset;
+    for (size_t i = cache->objects_per_slab; i > 0; i--) {
+        void *obj = (void *)(first + (i - 1) * cache->stride);
+        if (cache->ctor) {
+            cache->ctor(obj);
+        }
+        void **link = obj_freeptr(cache, obj);
+        *link = slab->free_list;
+        slab->free_list = link;
+    }
+
+    return slab;
+}
+
+/**
+ * Return a slab's pages to the PMM
+ */
+static void slab_release(kmem_cache_t *cache, struct slab *slab) {
+    slab->magic = 0;
+    cache->slabs--;
+    for (size_t i = 0; i < cache->slab_pages; i++) {
+        struct page *pg = phys_to_page((uintptr_t)slab + i * PAGE_SIZE);
+        if (pg) {
+            pg->flags &= ~PG_SLAB;
+            pg->mapping = NULL;
+        }
+    }
+    if (cache->slab_pages == 1) {
+        pmm_free_page((uintptr_t)slab);
+    } else {
+        pmm_free_pages((uintptr_t)slab, cache->slab_pages);
+    }
+}
+
+/**
+ * Create an object cache
+ */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                kmem_ctor_t ctor) {
+    if (size == 0) {
+        set_errno(THUNDEROS_EINVAL);
+        return NULL;
+    }
+
+    if (align < SLAB_MIN_ALIGN) {
+        align = SLAB_MIN_ALIGN;
+    }
+    if ((align & (align - 1)) != 0 || align > PAGE_SIZE) {
+        set_errno(THUNDEROS_EINVAL);
+        return NULL;
+    }
+
+    if (!slab_shrinker_registered) {
+        slab_shrinker_registered = 1;
+        register_shrinker(&slab_shrinker);
+    }
+
+    int irq_state = interrupt_save_disable();
+
+    kmem_cache_t *cache = NULL;
+    for (int i = 0; i < KMEM_MAX_CACHES; i++) {
+        if (!cache_pool[i].active) {
+            cache = &cache_pool[i];
+            cache->active = 1;
+            break;
+        }
+    }
+
+    interrupt_restore(irq_state);
+
+    if (!cache) {
+        set_errno(THUNDEROS_ENOMEM);
+        return NULL;
+    }
+
+    cache->name = name;
+    cache->size = size;
+    cache->ctor = ctor;
+    cache->partial = NULL;
+    cache->slabs = 0;
+    cache->in_use = 0;
+
+    // Constructed objects keep their free-list link past the object
+    size_t raw;
+    if (ctor) {
+        cache->freeptr_offset = ALIGN_UP(size, sizeof(void *));
+        raw = cache->freeptr_offset + sizeof(void *);
+    } else {
+        cache->freeptr_offset = 0;
+        raw = size < sizeof(void *) ? sizeof(void *) : size;
+    }
+
+    cache->stride = ALIGN_UP(raw, align);
+    cache->first_offset = ALIGN_UP((size_t)SLAB_HEADER_SIZE, align);
+
+    if (cache->first_offset + cache->stride <= PAGE_SIZE) {
+        cache->slab_pages = 1;
+        cache->objects_per_slab = (PAGE_SIZE - cache->first_offset) / cache->stride;
+    } else {
+        cache->slab_pages = (cache->first_offset + cache->stride + PAGE_SIZE - 1) / PAGE_SIZE;
+        cache->objects_per_slab = 1;
+    }
+
+    clear_errno();
+    return cache;
+}
+
+/**
+ * Destroy an object cache
+ */
+int kmem_cache_destroy(kmem_cache_t *cache) {
+    if (!cache || !cache->active) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    int irq_state = interrupt_save_disable();
+
+    if (cache->in_use > 0) {
+        interrupt_restore(irq_state);
+        RETURN_ERRNO(THUNDEROS_EBUSY);
+    }
+
+    // With nothing in use, every slab is on the partial list
+    while (cache->partial) {
+        struct slab *slab = cache->partial;
+        slab_list_remove(cache, slab);
+        slab_release(cache, slab);
+    }
+
+    cache->active = 0;
+
+    interrupt_restore(irq_state);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Allocate an object from a cache
+ */
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    if (!cache) {
+        set_errno(THUNDEROS_EINVAL);
+        return NULL;
+    }
+
+    int irq_state = interrupt_save_disable();
+
+    struct slab *slab = cache->partial;
+    if (!slab) {
+        interrupt_restore(irq_state);
+        slab = slab_grow(cache);
+        irq_state = interrupt_save_disable();
+        if (!slab) {
+            interrupt_restore(irq_state);
+            set_errno(THUNDEROS_ENOMEM);
+            return NULL;
+        }
+        cache->slabs++;
+        slab_list_push(cache, slab);
+    }
+
+    void **link = (void **)slab->free_list;
+    slab->free_list = *link;
+    slab->in_use++;
+    cache->in_use++;
+
+    // Full slabs leave the partial list until an object comes back
+    if (!slab->free_list) {
+        slab_list_remove(cache, slab);
+    }
+
+    interrupt_restore(irq_state);
+
+    clear_errno();
+    return freeptr_obj(cache, link);
+}
+
+/**
+ * Return an object to its cache
+ */
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    if (!obj) {
+        return;
+    }
+
+    struct slab *slab = (struct slab *)PAGE_ALIGN_DOWN((uintptr_t)obj);
+    if (slab->magic != SLAB_MAGIC || slab->cache != cache) {
+        kernel_panic("kmem_cache_free: Object does not belong to cache");
+    }
+
+    // Catch pointers into the middle of an object or into the slab header
+    uintptr_t first = (uintptr_t)slab + cache->first_offset;
+    uintptr_t offset = (uintptr_t)obj - first;
+    if ((uintptr_t)obj < first || offset % cache->stride != 0 ||
+        offset / cache->stride >= cache->objects_per_slab) {
+        kernel_panic("kmem_cache_free: Invalid object pointer");
+    }
+
+    int irq_state = interrupt_save_disable();
+
+    int was_full = (slab->free_list == NULL);
+
+    void **link = obj_freeptr(cache, obj);
+    *link = slab->free_list;
+    slab->free_list = link;
+    slab->in_use--;
+    cache->in_use--;
+
+    if (was_full) {
+        slab_list_push(cache, slab);
+    }
+
+    // Release empty slabs, but keep the last one so a cache that
+    // bounces between 0 and 1 objects doesn't thrash the PMM
+    if (slab->in_use == 0 && (slab->next || slab->prev)) {
+        slab_list_remove(cache, slab);
+        slab_release(cache, slab);
+    }
+
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Return a cache's empty slabs to the PMM
+ */
+size_t kmem_cache_shrink(kmem_cache_t *cache) {
+    if (!cache || !cache->active) {
+        return 0;
+    }
+
+    size_t released = 0;
+    int irq_state = interrupt_save_disable();
+
+    struct slab *slab = cache->partial;
+    while (slab) {
+        struct slab *next = slab->next;
+        if (slab->in_use == 0) {
+            slab_list_remove(cache, slab);
+            slab_release(cache, slab);
+            released++;
+        }
+        slab = next;
+    }
+
+    interrupt_restore(irq_state);
+    return released;
+}
+
+/**
+ * Count the empty slabs every cache keeps
+ */
+static size_t slab_shrinker_count(shrinker_t *shrinker) {
+    (void)shrinker;
+    size_t empty = 0;
+
+    int irq_state = interrupt_save_disable();
+    for (int i = 0; i < KMEM_MAX_CACHES; i++) {
+        if (!cache_pool[i].active) {
+            continue;
+        }
+        for (struct slab *slab = cache_pool[i].partial; slab; slab = slab->next) {
+            if (slab->in_use == 0) {
+                empty++;
+            }
+        }
+    }
+    interrupt_restore(irq_state);
+    return empty;
+}
+
+/**
+ * Release up to nr empty slabs, cache by cache
+ */
+static size_t slab_shrinker_scan(shrinker_t *shrinker, size_t nr, uint32_t flags) {
+    (void)shrinker;
+    (void)flags;
+    size_t released = 0;
+
+    for (int i = 0; i < KMEM_MAX_CACHES && released < nr; i++) {
+        released += kmem_cache_shrink(&cache_pool[i]);
+    }
+    return released;
+}
+
+/**
+ * Find the cache that owns a pointer
+ *
+ * Asks the page's struct page rather than the slab header: any other
+ * page may hold SLAB_MAGIC at that offset (a page-aligned
+ * kmalloc_aligned() block starts with its owner's data).
+ */
+kmem_cache_t *kmem_cache_of(const void *ptr) {
+    if (!ptr) {
+        return NULL;
+    }
+
+    struct page *pg = phys_to_page((uintptr_t)ptr);
+    if (!pg || !(pg->flags & PG_SLAB)) {
+        return NULL;
+    }
+    return (kmem_cache_t *)pg->mapping;
+}
+
+/**
+ * Get cache statistics
+ */
+void kmem_cache_get_stats(kmem_cache_t *cache, kmem_cache_stats_t *stats) {
+    if (!cache || !stats) {
+        return;
+    }
+
+    stats->object_size = cache->size;
+    stats->objects_in_use = cache->in_use;
+    stats->objects_per_slab = cache->objects_per_slab;
+    stats->slabs = cache->slabs;
+    stats->slab_pages = cache->slab_pages;
+}
+
+/**
+ * Get cache name
+ */
+const char *kmem_cache_name(kmem_cache_t *cache) {
+    return cache ? cache->name : NULL;
+}
@@ -0,0 +1,714 @@
+/*
+ * Swap Implementation
+ *
+ * swap_map keeps, per slot, how many entries name it and whether the
+ * swap cache has its page (SWAP_HAS_CACHE); a slot is free when it is
+ * zero. The header slot and bad pages are SWAP_MAP_BAD and never handed
+ * out. Slots go out next-fit from a cursor, so the pages of one sweep
+ * land in one run of the area and reach the device as a few merged
+ * writes.
+ *
+ * Each cache entry carries the I/O for its page, so a request never
+ * outlives its memory, and an entry being read or written is never
+ * removed. Everything runs under the big kernel lock; the cache is also
+ * touched with interrupts disabled, as completions change entry states
+ * and lru_shrink() calls back with interrupts off.
+ */
+
+#include "mm/swap.h"
+#include "mm/reclaim.h"
+#include "mm/paging.h"
+#include "mm/pmm.h"
+#include "mm/page.h"
+#include "mm/slab.h"
+#include "mm/kmalloc.h"
+#include "drivers/blk_queue.h"
+#include "drivers/virtio_blk.h"
+#include "fs/vfs.h"
+#include "kernel/process.h"
+#include "kernel/kstring.h"
+#include "kernel/errno.h"
+#include "kernel/smp.h"
+#include "kernel/wait_queue.h"
+#include "arch/interrupt.h"
+
+#define SWAP_HAS_CACHE      0x8000      // swap_map: the cache has the slot's page
+#define SWAP_COUNT_MASK     0x7FFF      // swap_map: entries naming the slot
+#define SWAP_MAP_BAD        0xFFFF      // swap_map: header or bad page
+
+#define SWAP_CACHE_BUCKETS  256
+#define SECTORS_PER_SLOT    (PAGE_SIZE / VIRTIO_BLK_SECTOR_SIZE)
+
+// Cache entry states
+#define SWAP_CACHE_CLEAN    0           // Same as the slot
+#define SWAP_CACHE_DIRTY    1           // Not written yet
+#define SWAP_CACHE_WRITING  2
+#define SWAP_CACHE_READING  3           // Contents not there yet
+#define SWAP_CACHE_FAILED   4           // Read failed: the reader drops it
+
+// What the sweep did with one PTE
+#define SWEEP_SKIP          0           // Not a page it can swap
+#define SWEEP_AGED          1           // Accessed since the last sweep: kept
+#define SWEEP_OUT           2           // Unmapped into the swap cache
+
+typedef struct swap_cache_entry {
+    uint64_t slot;
+    uintptr_t page;                     // The cache's reference
+    volatile uint8_t state;             // SWAP_CACHE_*
+    uint8_t readahead;                  // Read ahead, not faulted on yet
+    blk_io_t io;                        // Read or write in flight
+    struct swap_cache_entry *next;      // Hash chain
+} swap_cache_entry_t;
+
+static uint64_t swap_start;             // Sector of the header page
+static uint16_t *swap_map = NULL;       // Per slot; NULL = no swap
+static uint64_t swap_slots;             // Slots, header included
+static uint64_t swap_next = 1;          // Next-fit cursor
+static uint64_t swap_dirty;             // Entries waiting to be written
+
+static swap_cache_entry_t *swap_buckets[SWAP_CACHE_BUCKETS];
+static kmem_cache_t *swap_entry_cache = NULL;
+static wait_queue_t swap_read_wait = WAIT_QUEUE_INIT;  // Woken as reads finish
+
+static swap_stats_t stats;
+
+// Clock hand of the sweep: process table index and address in it
+static int scan_index = 0;
+static uint64_t scan_addr = 0;
+
+static size_t swap_shrink_count(shrinker_t *shrinker);
+static size_t swap_shrink_scan(shrinker_t *shrinker, size_t nr, uint32_t flags);
+
+static shrinker_t swap_shrinker = { "swap", swap_shrink_count, swap_shrink_scan, 0, 0, NULL };
+
+static inline uint64_t slot_sector(uint64_t slot) {
+    return swap_start + slot * SECTORS_PER_SLOT;
+}
+
+static inline int slot_valid(uint64_t slot) {
+    return swap_map && slot > 0 && slot < swap_slots && swap_map[slot] != SWAP_MAP_BAD;
+}
+
+// Helper: Find a slot's cache entry (interrupts disabled)
+static swap_cache_entry_t *swap_cache_find(uint64_t slot) {
+    for (swap_cache_entry_t *entry = swap_buckets[slot % SWAP_CACHE_BUCKETS]; entry;
+         entry = entry->next) {
+        if (entry->slot == slot) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Helper: Hand out a free slot, next-fit (0 if the area is full)
+static uint64_t slot_alloc(void) {
+    if (stats.free_slots == 0) {
+        return 0;
+    }
+    for (uint64_t i = 1; i < swap_slots; i++) {
+        uint64_t slot = swap_next;
+        swap_next = slot + 1 < swap_slots ? slot + 1 : 1;
+        if (swap_map[slot] == 0) {
+            stats.free_slots--;
+            return slot;
+        }
+    }
+    return 0;
+}
+
+// Helper: Cache a page for a slot, taking over one of the caller's
+// references (interrupts disabled)
+static swap_cache_entry_t *swap_cache_add(uint64_t slot, uintptr_t page, uint8_t state) {
+    swap_cache_entry_t *entry = (swap_cache_entry_t *)kmem_cache_alloc(swap_entry_cache);
+    if (!entry) {
+        return NULL;
+    }
+    entry->slot = slot;
+    entry->page = page;
+    entry->state = state;
+    entry->readahead = 0;
+
+    uint32_t bucket = slot % SWAP_CACHE_BUCKETS;
+    entry->next = swap_buckets[bucket];
+    swap_buckets[bucket] = entry;
+    swap_map[slot] |= SWAP_HAS_CACHE;
+
+    struct page *pg = phys_to_page(page);
+    pg->mapping = entry;
+    pg->flags |= PG_SWAPCACHE;
+    lru_add(pg);
+
+    stats.cache_pages++;
+    if (state == SWAP_CACHE_DIRTY) {
+        swap_dirty++;
+    }
+    return entry;
+}
+
+// Helper: Drop a cache entry and its reference, freeing the slot if no
+// entry names it (interrupts disabled; not while I/O is in flight)
+static void swap_cache_remove(swap_cache_entry_t *entry) {
+    swap_cache_entry_t **link = &swap_buckets[entry->slot % SWAP_CACHE_BUCKETS];
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+
+    struct page *pg = phys_to_page(entry->page);
+    lru_del(pg);
+    pg->mapping = NULL;
+    pg->flags &= ~PG_SWAPCACHE;
+
+    if (entry->state == SWAP_CACHE_DIRTY) {
+        swap_dirty--;
+    }
+    swap_map[entry->slot] &= ~SWAP_HAS_CACHE;
+    if (swap_map[entry->slot] == 0) {
+        stats.free_slots++;
+    }
+    stats.cache_pages--;
+
+    put_page(entry->page);
+    kmem_cache_free(swap_entry_cache, entry);
+}
+
+/**
+ * Count one more entry naming a slot
+ */
+int swap_entry_dup(uint64_t slot) {
+    int irq_state = interrupt_save_disable();
+    if (!slot_valid(slot) || (swap_map[slot] & SWAP_COUNT_MASK) == 0) {
+        interrupt_restore(irq_state);
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if ((swap_map[slot] & SWAP_COUNT_MASK) == SWAP_MAP_MAX) {
+        interrupt_restore(irq_state);
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    swap_map[slot]++;
+    interrupt_restore(irq_state);
+    return 0;
+}
+
+/**
+ * Drop an entry naming a slot
+ */
+void swap_entry_free(uint64_t slot) {
+    int irq_state = interrupt_save_disable();
+    if (!slot_valid(slot) || (swap_map[slot] & SWAP_COUNT_MASK) == 0) {
+        interrupt_restore(irq_state);
+        return;
+    }
+
+    swap_map[slot]--;
+    if ((swap_map[slot] & SWAP_COUNT_MASK) == 0) {
+        // Nobody can fault on the slot again: its page is of no use to
+        // the cache (one in I/O goes once that finishes)
+        swap_cache_entry_t *entry = (swap_map[slot] & SWAP_HAS_CACHE) ? swap_cache_find(slot) : NULL;
+        if (entry && (entry->state == SWAP_CACHE_CLEAN || entry->state == SWAP_CACHE_DIRTY)) {
+            swap_cache_remove(entry);
+        } else if (swap_map[slot] == 0) {
+            stats.free_slots++;
+        }
+    }
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Number of entries naming a slot
+ */
+uint32_t swap_entry_count(uint64_t slot) {
+    return slot_valid(slot) ? swap_map[slot] & SWAP_COUNT_MASK : 0;
+}
+
+// Helper: A slot read finished (interrupt handler)
+static void swap_read_done(blk_io_t *io, int ok) {
+    swap_cache_entry_t *entry = (swap_cache_entry_t *)io->arg;
+    entry->state = ok ? SWAP_CACHE_CLEAN : SWAP_CACHE_FAILED;
+    if (!ok) {
+        stats.io_errors++;
+    }
+    wait_queue_wake(&swap_read_wait);
+}
+
+// Helper: A slot write finished (interrupt handler)
+static void swap_write_done(blk_io_t *io, int ok) {
+    swap_cache_entry_t *entry = (swap_cache_entry_t *)io->arg;
+    if (ok) {
+        entry->state = SWAP_CACHE_CLEAN;
+        stats.swap_outs++;
+    } else {
+        // Kept, and written again by the next pass
+        entry->state = SWAP_CACHE_DIRTY;
+        swap_dirty++;
+        stats.io_errors++;
+    }
+}
+
+// Helper: Cache a fresh page for a slot and queue its read
+static swap_cache_entry_t *swap_read_start(uint64_t slot, uintptr_t page,
+                                           blk_plug_t *plug, blk_batch_t *batch) {
+    int irq_state = interrupt_save_disable();
+    swap_cache_entry_t *entry = swap_cache_add(slot, page, SWAP_CACHE_READING);
+    interrupt_restore(irq_state);
+    if (!entry) {
+        return NULL;
+    }
+    blk_io_init(&entry->io, slot_sector(slot), (void *)page, PAGE_SIZE, 0, swap_read_done, entry);
+    blk_plug_add(plug, &entry->io, batch);
+    return entry;
+}
+
+/**
+ * Read a slot that is not cached, with the used and uncached slots of its
+ * cluster, into the cache
+ *
+ * @return 0 once the slot is cached, -1 on error (errno set)
+ */
+static int swap_read_cluster(uint64_t slot) {
+    uintptr_t page = pmm_alloc_page();
+    if (!page) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+
+    blk_batch_t batch;
+    blk_plug_t plug;
+    blk_batch_init(&batch);
+    blk_plug_init(&plug);
+
+    swap_cache_entry_t *target = swap_read_start(slot, page, &plug, &batch);
+    if (!target) {
+        pmm_free_page(page);
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+
+    // Guessing costs memory: only while there is plenty
+    size_t free;
+    pmm_get_stats(NULL, &free);
+    uint64_t first = slot & ~(uint64_t)(SWAP_CLUSTER - 1);
+    for (uint64_t s = first; free > reclaim_wmark_low() && s < first + SWAP_CLUSTER; s++) {
+        if (s == slot || !slot_valid(s) || (swap_map[s] & SWAP_HAS_CACHE) ||
+            (swap_map[s] & SWAP_COUNT_MASK) == 0) {
+            continue;
+        }
+        uintptr_t ra_page = pmm_alloc_page();
+        if (!ra_page) {
+            break;
+        }
+        swap_cache_entry_t *entry = swap_read_start(s, ra_page, &plug, &batch);
+        if (!entry) {
+            pmm_free_page(ra_page);
+            break;
+        }
+        entry->readahead = 1;
+        stats.readahead++;
+    }
+
+    blk_unplug(&plug);
+    blk_batch_wait(&batch);    // Failures show in the entries' states
+    stats.swap_ins++;
+
+    // Drop what could not be read; a reader waiting for one sees it gone
+    // and tries for itself
+    int irq_state = interrupt_save_disable();
+    int failed = target->state == SWAP_CACHE_FAILED;
+    for (uint64_t s = first; s < first + SWAP_CLUSTER; s++) {
+        swap_cache_entry_t *entry = slot_valid(s) ? swap_cache_find(s) : NULL;
+        if (entry && entry->state == SWAP_CACHE_FAILED) {
+            swap_cache_remove(entry);
+        }
+    }
+    interrupt_restore(irq_state);
+
+    if (failed) {
+        RETURN_ERRNO(THUNDEROS_EIO);
+    }
+    return 0;
+}
+
+/**
+ * Get the page with a slot's contents
+ */
+uintptr_t swap_in(uint64_t slot, int *major) {
+    *major = 0;
+
+    int irq_state = interrupt_save_disable();
+    for (;;) {
+        if (!slot_valid(slot) || (swap_map[slot] & SWAP_COUNT_MASK) == 0) {
+            interrupt_restore(irq_state);
+            set_errno(THUNDEROS_EFAULT);
+            return 0;
+        }
+
+        swap_cache_entry_t *entry = swap_cache_find(slot);
+        if (!entry) {
+            interrupt_restore(irq_state);
+            if (swap_read_cluster(slot) != 0) {
+                /* errno already set by swap_read_cluster */
+                return 0;
+            }
+            *major = 1;
+            irq_state = interrupt_save_disable();
+            continue;
+        }
+        if (entry->state == SWAP_CACHE_READING) {
+            // Someone else's read, perhaps readahead: wait for it
+            wait_queue_sleep_irqoff(&swap_read_wait);
+            continue;
+        }
+        if (entry->state == SWAP_CACHE_FAILED) {
+            interrupt_restore(irq_state);
+            set_errno(THUNDEROS_EIO);
+            return 0;
+        }
+
+        if (entry->readahead) {
+            entry->readahead = 0;
+            stats.readahead_hits++;
+        }
+        uintptr_t page = entry->page;
+        get_page(page);
+        lru_mark_accessed(phys_to_page(page));
+        interrupt_restore(irq_state);
+        clear_errno();
+        return page;
+    }
+}
+
+// Helper: Can pages of this VMA be swapped? Anonymous and private file
+// memory only; the rest belongs to a file, device or shm object
+static int vma_swappable(const vm_area_t *vma) {
+    if (vma->shm) {
+        return 0;
+    }
+    return !vma->file || (!(vma->flags & VM_SHARED) && vma->file->type != VFS_TYPE_DEVICE);
+}
+
+// Helper: Age or unmap one PTE of a swappable VMA
+static int swap_out_pte(struct process *proc, pte_t *pte) {
+    pte_t val = *pte;
+    if (!(val & PTE_V) || !(val & PTE_U)) {
+        return SWEEP_SKIP;
+    }
+
+    // Page cache pages of private file mappings are not ours to write
+    uintptr_t paddr = PTE_TO_PA(val);
+    struct page *pg = phys_to_page(paddr);
+    if (!pg || paddr == pmm_zero_page() || (pg->flags & PG_SLAB) ||
+        (pg->mapping && !(pg->flags & PG_SWAPCACHE))) {
+        return SWEEP_SKIP;
+    }
+
+    if (val & PTE_A) {
+        *pte = val & ~PTE_A;
+        return SWEEP_AGED;
+    }
+
+    int irq_state = interrupt_save_disable();
+    uint64_t slot;
+    if (pg->flags & PG_SWAPCACHE) {
+        // Swapped in and mapped read-only, so the slot still matches it;
+        // a slot nothing names is on its way out of the cache
+        swap_cache_entry_t *entry = (swap_cache_entry_t *)pg->mapping;
+        uint32_t count = swap_map[entry->slot] & SWAP_COUNT_MASK;
+        if (count == 0 || count == SWAP_MAP_MAX) {
+            interrupt_restore(irq_state);
+            return SWEEP_SKIP;
+        }
+        slot = entry->slot;
+        swap_map[slot]++;
+        put_page(paddr);            // The cache keeps its own reference
+    } else {
+        slot = slot_alloc();
+        if (!slot) {
+            interrupt_restore(irq_state);
+            return SWEEP_SKIP;
+        }
+        swap_map[slot] = 1;
+        if (!swap_cache_add(slot, paddr, SWAP_CACHE_DIRTY)) {
+            swap_map[slot] = 0;
+            stats.free_slots++;
+            interrupt_restore(irq_state);
+            return SWEEP_SKIP;
+        }
+        // The mapping's reference is the cache's now
+    }
+    *pte = SWAP_TO_PTE(slot);
+    interrupt_restore(irq_state);
+
+    process_account_rss(proc, -1);
+    return SWEEP_OUT;
+}
+
+/**
+ * Sweep page tables from the clock hand
+ *
+ * @param nr Resident pages to look at
+ * @return Pages unmapped into the swap cache
+ */
+static size_t swap_sweep(size_t nr) {
+    size_t scanned = 0;
+    size_t unmapped = 0;
+    int max = process_get_max_count();
+
+    for (int visited = 0; visited <= max; visited++) {
+        struct process *proc = process_get_by_index(scan_index);
+        if (proc && proc == proc->group_leader && !proc->kthread_fn && proc->page_table &&
+            proc->state != PROC_EMBRYO && proc->state != PROC_ZOMBIE) {
+            for (vm_area_t *vma = proc->vm_areas; vma; vma = vma->next) {
+                if (vma->end <= scan_addr || !vma_swappable(vma)) {
+                    continue;
+                }
+                uint64_t addr = vma->start > scan_addr ? vma->start : scan_addr;
+                while (addr < vma->end && scanned < nr && unmapped < SWAP_WRITE_BATCH) {
+                    pte_t *pte = get_user_pte(proc->page_table, addr);
+                    if (!pte) {
+                        // No level-0 table: skip to the next 2MB boundary
+                        addr = (addr + MEGAPAGE_SIZE) & ~(MEGAPAGE_SIZE - 1);
+                        continue;
+                    }
+                    int result = swap_out_pte(proc, pte);
+                    if (result != SWEEP_SKIP) {
+                        scanned++;
+                    }
+                    if (result == SWEEP_OUT) {
+                        unmapped++;
+                    }
+                    addr += PAGE_SIZE;
+                }
+                scan_addr = addr;
+                if (scanned >= nr || unmapped >= SWAP_WRITE_BATCH) {
+                    break;
+                }
+            }
+            if (scanned >= nr || unmapped >= SWAP_WRITE_BATCH) {
+                break;
+            }
+        }
+        scan_index = (scan_index + 1) % max;
+        scan_addr = 0;
+    }
+
+    if (scanned > 0) {
+        // Other CPUs may run these processes with the old entries cached;
+        // until they drop them, evicted pages could still be written
+        tlb_flush(0);
+        smp_flush_tlb_others();
+    }
+    return unmapped;
+}
+
+/**
+ * Write out the dirty cache entries, then free the pages only the cache
+ * holds: nothing touched them since the sweep
+ *
+ * @return Pages freed
+ */
+static size_t swap_writeback(void) {
+    uint64_t written[2 * SWAP_WRITE_BATCH];
+    size_t n = 0;
+    blk_batch_t batch;
+    blk_plug_t plug;
+    blk_batch_init(&batch);
+    blk_plug_init(&plug);
+
+    int irq_state = interrupt_save_disable();
+    for (uint32_t b = 0; b < SWAP_CACHE_BUCKETS && swap_dirty > 0 && n < 2 * SWAP_WRITE_BATCH; b++) {
+        swap_cache_entry_t *next;
+        for (swap_cache_entry_t *entry = swap_buckets[b]; entry && n < 2 * SWAP_WRITE_BATCH;
+             entry = next) {
+            next = entry->next;
+            if (entry->state != SWAP_CACHE_DIRTY) {
+                continue;
+            }
+            if ((swap_map[entry->slot] & SWAP_COUNT_MASK) == 0) {
+                swap_cache_remove(entry);   // Unmapped meanwhile: nothing to save
+                continue;
+            }
+            entry->state = SWAP_CACHE_WRITING;
+            swap_dirty--;
+            blk_io_init(&entry->io, slot_sector(entry->slot), (void *)entry->page, PAGE_SIZE, 1,
+                        swap_write_done, entry);
+            blk_plug_add(&plug, &entry->io, &batch);
+            written[n++] = entry->slot;
+        }
+    }
+    interrupt_restore(irq_state);
+    if (n == 0) {
+        return 0;
+    }
+
+    blk_unplug(&plug);
+    blk_batch_wait(&batch);    // Failed writes are dirty again
+
+    size_t freed = 0;
+    irq_state = interrupt_save_disable();
+    for (size_t i = 0; i < n; i++) {
+        // Looked up again: a fault may have taken it meanwhile
+        swap_cache_entry_t *entry = swap_cache_find(written[i]);
+        if (!entry || entry->state != SWAP_CACHE_CLEAN) {
+            continue;
+        }
+        int unused = page_refcount(entry->page) == 1;
+        if (unused || (swap_map[entry->slot] & SWAP_COUNT_MASK) == 0) {
+            swap_cache_remove(entry);
+            freed += unused;
+        }
+    }
+    interrupt_restore(irq_state);
+    return freed;
+}
+
+/**
+ * Drop a clean cached page nobody maps, or one whose slot nothing names
+ * (interrupts disabled, from lru_shrink())
+ */
+static int swap_cache_evict_page(struct page *pg) {
+    if (!(pg->flags & PG_SWAPCACHE)) {
+        return 0;
+    }
+    swap_cache_entry_t *entry = (swap_cache_entry_t *)pg->mapping;
+    if (entry->state != SWAP_CACHE_CLEAN) {
+        return 0;
+    }
+    if ((swap_map[entry->slot] & SWAP_COUNT_MASK) != 0 && page_refcount(entry->page) != 1) {
+        return 0;
+    }
+    swap_cache_remove(entry);
+    return 1;
+}
+
+/**
+ * Pages reclaim could swap: everything resident, while slots are left
+ */
+static size_t swap_shrink_count(shrinker_t *shrinker) {
+    (void)shrinker;
+    size_t pages = stats.cache_pages;
+    if (stats.free_slots == 0) {
+        return pages;
+    }
+    for (int i = 0; i < process_get_max_count(); i++) {
+        struct process *proc = process_get_by_index(i);
+        if (proc && proc == proc->group_leader) {
+            pages += proc->rss_pages;
+        }
+    }
+    return pages;
+}
+
+/**
+ * Free cached pages nobody uses; allowed to sleep, also sweep and write
+ */
+static size_t swap_shrink_scan(shrinker_t *shrinker, size_t nr, uint32_t flags) {
+    (void)shrinker;
+    size_t freed = 0;
+
+    if (stats.cache_pages > 0) {
+        freed = lru_shrink(nr < stats.cache_pages ? nr : stats.cache_pages, swap_cache_evict_page);
+    }
+
+    // Writing means waiting for the device
+    if ((flags & SHRINK_MAY_SLEEP) && freed < nr) {
+        swap_sweep(nr - freed);
+        freed += swap_writeback();
+    }
+    return freed;
+}
+
+// Helper: Compare the header's magic
+static int swap_magic_ok(const uint8_t *header) {
+    const char *magic = SWAP_MAGIC;
+    for (int i = 0; i < SWAP_MAGIC_LEN; i++) {
+        if (header[PAGE_SIZE - SWAP_MAGIC_LEN + i] != (uint8_t)magic[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Start swapping to an area
+ */
+int swap_on(uint64_t start_sector) {
+    if (swap_map) {
+        RETURN_ERRNO(THUNDEROS_EBUSY);
+    }
+
+    // Room for the header and a slot
+    uint64_t capacity = virtio_blk_get_capacity();
+    if (start_sector + 2 * SECTORS_PER_SLOT > capacity) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    uint8_t *header = (uint8_t *)pmm_alloc_page();
+    if (!header) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    if (virtio_blk_read(start_sector, header, SECTORS_PER_SLOT) != (int)SECTORS_PER_SLOT) {
+        pmm_free_page((uintptr_t)header);
+        RETURN_ERRNO(THUNDEROS_EIO);
+    }
+    if (!swap_magic_ok(header) || *(uint32_t *)(header + SWAP_HDR_VERSION) != SWAP_VERSION) {
+        pmm_free_page((uintptr_t)header);
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    // The header counts itself; the disk may end sooner than it says
+    uint64_t slots = (uint64_t)*(uint32_t *)(header + SWAP_HDR_LAST_PAGE) + 1;
+    uint64_t fit = (capacity - start_sector) / SECTORS_PER_SLOT;
+    if (slots > fit) {
+        slots = fit;
+    }
+    if (slots < 2) {
+        pmm_free_page((uintptr_t)header);
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    if (!swap_entry_cache) {
+        swap_entry_cache = kmem_cache_create("swap_cache", sizeof(swap_cache_entry_t), 0, NULL);
+    }
+    uint16_t *map = (uint16_t *)kmalloc(slots * sizeof(uint16_t));
+    if (!swap_entry_cache || !map) {
+        kfree(map);
+        pmm_free_page((uintptr_t)header);
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    kmemset(map, 0, slots * sizeof(uint16_t));
+    map[0] = SWAP_MAP_BAD;
+    uint64_t usable = slots - 1;
+
+    uint32_t nr_bad = *(uint32_t *)(header + SWAP_HDR_NR_BADPAGES);
+    uint32_t max_bad = (PAGE_SIZE - SWAP_MAGIC_LEN - SWAP_HDR_BADPAGES) / sizeof(uint32_t);
+    const uint32_t *bad = (const uint32_t *)(header + SWAP_HDR_BADPAGES);
+    for (uint32_t i = 0; i < nr_bad && i < max_bad; i++) {
+        if (bad[i] < slots && map[bad[i]] == 0) {
+            map[bad[i]] = SWAP_MAP_BAD;
+            usable--;
+        }
+    }
+    pmm_free_page((uintptr_t)header);
+
+    swap_start = start_sector;
+    swap_slots = slots;
+    swap_next = 1;
+    stats.total_slots = usable;
+    stats.free_slots = usable;
+    swap_map = map;
+    register_shrinker(&swap_shrinker);
+
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Get swap statistics
+ */
+void swap_get_stats(swap_stats_t *out) {
+    if (!out) {
+        return;
+    }
+
+    int irq_state = interrupt_save_disable();
+    *out = stats;
+    interrupt_restore(irq_state);
+}
@@ -0,0 +1,277 @@
+/**
+ * ARP
+ *
+ * The cache is a small array searched linearly; sixteen entries is far
+ * more than the one gateway and handful of neighbours a node talks to.
+ * Entries are changed with interrupts off, as replies arrive in the
+ * receive interrupt.
+ */
+
+#include "net/arp.h"
+#include "net/ip.h"
+#include "hal/hal_timer.h"
+#include "arch/interrupt.h"
+#include "kernel/kstring.h"
+#include "kernel/errno.h"
+
+#define ARP_STATE_FREE          0
+#define ARP_STATE_INCOMPLETE    1   // Request sent, packets may be waiting
+#define ARP_STATE_RESOLVED      2
+
+typedef struct {
+    uint32_t addr;
+    uint8_t mac[ETH_ALEN];
+    uint8_t state;
+    uint8_t retries;            // Requests sent while incomplete
+    uint64_t updated_us;        // Last request, or when resolved
+    sk_buff_head_t pending;     // Packets waiting for resolution
+} arp_entry_t;
+
+static arp_entry_t arp_cache[ARP_CACHE_SIZE];
+
+static const uint8_t eth_broadcast[ETH_ALEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+/**
+ * Push an Ethernet header and send
+ */
+static int eth_output(sk_buff_t *skb, const uint8_t *dst, uint16_t type,
+                      net_tx_batch_t *batch)
+{
+    if (skb_headroom(skb) < ETH_HLEN && skb_cow_head(skb, ETH_HLEN) != 0) {
+        skb_free(skb);
+        /* errno already set by skb_cow_head */
+        return -1;
+    }
+
+    eth_header_t *eth = (eth_header_t *)skb_push(skb, ETH_HLEN);
+    kmemcpy(eth->dst, dst, ETH_ALEN);
+    kmemcpy(eth->src, g_net_config.mac, ETH_ALEN);
+    eth->type = htons(type);
+
+    return net_dev_xmit(skb, batch);
+}
+
+/**
+ * Send an ARP request or reply
+ */
+static void arp_send(uint16_t op, const uint8_t *tha, uint32_t tpa, const uint8_t *dst)
+{
+    sk_buff_t *skb = skb_alloc(SKB_DEFAULT_HEADROOM + sizeof(arp_packet_t));
+    if (!skb) {
+        return;
+    }
+    skb_reserve(skb, SKB_DEFAULT_HEADROOM);
+
+    arp_packet_t *arp = (arp_packet_t *)skb_put(skb, sizeof(arp_packet_t));
+    arp->htype = htons(ARP_HRD_ETHER);
+    arp->ptype = htons(ETH_P_IP);
+    arp->hlen = ETH_ALEN;
+    arp->plen = 4;
+    arp->op = htons(op);
+    kmemcpy(arp->sha, g_net_config.mac, ETH_ALEN);
+    arp->spa = g_net_config.addr;
+    kmemcpy(arp->tha, tha, ETH_ALEN);
+    arp->tpa = tpa;
+
+    if (op == ARP_OP_REQUEST) {
+        g_net_stats.arp_requests++;
+    } else {
+        g_net_stats.arp_replies++;
+    }
+    eth_output(skb, dst, ETH_P_ARP, NULL);
+}
+
+/**
+ * Broadcast a request for an address
+ */
+static void arp_request(uint32_t addr)
+{
+    static const uint8_t unknown[ETH_ALEN] = { 0 };
+    arp_send(ARP_OP_REQUEST, unknown, addr, eth_broadcast);
+}
+
+static arp_entry_t *arp_lookup(uint32_t addr)
+{
+    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
+        if (arp_cache[i].state != ARP_STATE_FREE && arp_cache[i].addr == addr) {
+            return &arp_cache[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Empty an entry, dropping what waits on it
+ */
+static void arp_release(arp_entry_t *entry)
+{
+    g_net_stats.arp_queue_drops += skb_queue_len(&entry->pending);
+    skb_queue_purge(&entry->pending);
+    entry->state = ARP_STATE_FREE;
+}
+
+/**
+ * Take a free entry, or the least recently updated one
+ */
+static arp_entry_t *arp_alloc(uint32_t addr)
+{
+    arp_entry_t *victim = &arp_cache[0];
+    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
+        arp_entry_t *entry = &arp_cache[i];
+        if (entry->state == ARP_STATE_FREE) {
+            victim = entry;
+            break;
+        }
+        if (entry->updated_us < victim->updated_us) {
+            victim = entry;
+        }
+    }
+
+    if (victim->state != ARP_STATE_FREE) {
+        arp_release(victim);
+    }
+    victim->addr = addr;
+    victim->retries = 0;
+    victim->updated_us = 0;
+    skb_queue_init(&victim->pending);
+    return victim;
+}
+
+/**
+ * Record a mapping and send the packets waiting for it
+ */
+static void arp_update(arp_entry_t *entry, const uint8_t *mac)
+{
+    kmemcpy(entry->mac, mac, ETH_ALEN);
+    entry->state = ARP_STATE_RESOLVED;
+    entry->retries = 0;
+    entry->updated_us = hal_timer_get_time_us();
+
+    net_tx_batch_t batch;
+    batch.count = 0;
+
+    sk_buff_t *skb;
+    while ((skb = skb_dequeue(&entry->pending)) != NULL) {
+        eth_output(skb, entry->mac, ETH_P_IP, &batch);
+    }
+    net_tx_flush(&batch);
+}
+
+/**
+ * Handle a received ARP packet
+ */
+void arp_rx(sk_buff_t *skb)
+{
+    if (!g_net_config.up || skb_headlen(skb) < sizeof(arp_packet_t)) {
+        skb_free(skb);
+        return;
+    }
+
+    arp_packet_t *arp = (arp_packet_t *)skb->data;
+    if (ntohs(arp->htype) != ARP_HRD_ETHER || ntohs(arp->ptype) != ETH_P_IP ||
+        arp->hlen != ETH_ALEN || arp->plen != 4) {
+        skb_free(skb);
+        return;
+    }
+
+    /* Refresh a mapping we have; learn one from anyone asking for us */
+    int for_us = arp->tpa == g_net_config.addr;
+    arp_entry_t *entry = arp_lookup(arp->spa);
+    if (!entry && for_us) {
+        entry = arp_alloc(arp->spa);
+    }
+    if (entry) {
+        arp_update(entry, arp->sha);
+    }
+
+    if (for_us && ntohs(arp->op) == ARP_OP_REQUEST) {
+        arp_send(ARP_OP_REPLY, arp->sha, arp->spa, arp->sha);
+    }
+
+    skb_free(skb);
+}
+
+/**
+ * Send an IPv4 packet to a next hop on the local network
+ */
+int arp_output(sk_buff_t *skb, uint32_t next_hop, net_tx_batch_t *batch)
+{
+    /* Limited and directed broadcasts need no resolution */
+    if ((next_hop | g_net_config.netmask) == INADDR_BROADCAST) {
+        return eth_output(skb, eth_broadcast, ETH_P_IP, batch);
+    }
+
+    /*
+     * The cache is only touched with interrupts off; requests are sent
+     * after, as a full transmit ring may make the sender sleep.
+     */
+    int irq_state = interrupt_save_disable();
+    uint64_t now = hal_timer_get_time_us();
+    int request = 0;
+
+    arp_entry_t *entry = arp_lookup(next_hop);
+    if (entry && entry->state == ARP_STATE_RESOLVED) {
+        /* Old mappings keep working while a fresh request goes out */
+        if (now - entry->updated_us > ARP_TIMEOUT_US) {
+            entry->updated_us = now;
+            request = 1;
+        }
+        uint8_t mac[ETH_ALEN];
+        kmemcpy(mac, entry->mac, ETH_ALEN);
+        interrupt_restore(irq_state);
+
+        if (request) {
+            arp_request(next_hop);
+        }
+        return eth_output(skb, mac, ETH_P_IP, batch);
+    }
+
+    int error = 0;
+    if (!entry) {
+        entry = arp_alloc(next_hop);
+        entry->state = ARP_STATE_INCOMPLETE;
+        request = 1;
+    } else if (now - entry->updated_us >= ARP_RETRY_US) {
+        if (++entry->retries >= ARP_MAX_RETRIES) {
+            arp_release(entry);
+            error = THUNDEROS_EHOSTUNREACH;
+        } else {
+            request = 1;
+        }
+    }
+
+    if (!error && skb_queue_len(&entry->pending) >= ARP_MAX_PENDING) {
+        error = THUNDEROS_ENOBUFS;
+    }
+    if (error) {
+        g_net_stats.arp_queue_drops++;
+        interrupt_restore(irq_state);
+        skb_free(skb);
+        RETURN_ERRNO(error);
+    }
+
+    skb_queue_tail(&entry->pending, skb);
+    if (request) {
+        entry->updated_us = now;
+    }
+    interrupt_restore(irq_state);
+
+    if (request) {
+        arp_request(next_hop);
+    }
+    return 0;
+}
+
+/**
+ * Forget every cache entry
+ */
+void arp_flush(void)
+{
+    int irq_state = interrupt_save_disable();
+    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
+        if (arp_cache[i].state != ARP_STATE_FREE) {
+            arp_release(&arp_cache[i]);
+        }
+    }
+    interrupt_restore(irq_state);
+}
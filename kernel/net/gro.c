@@ -0,0 +1,230 @@
+/**
+ * Generic Receive Offload
+ *
+ * Runs in the driver's receive pass with interrupts off; the driver
+ * calls net_gro_flush() at the end of each pass, so nothing is held for
+ * longer than the pass takes. Segments are checked in full before they
+ * merge (IP header checksum, TCP checksum unless the device vouched for
+ * it), and the merged packet is marked SKB_CSUM_UNNECESSARY, as its TCP
+ * checksum no longer covers it.
+ */
+
+#include "net/gro.h"
+#include "net/ip.h"
+#include "net/tcp.h"
+
+/**
+ * A flow being merged
+ */
+typedef struct {
+    sk_buff_t *head;            // First segment, headers and all (NULL: free)
+    sk_buff_t *last;            // Last packet chained, or head
+    uint32_t saddr;
+    uint32_t daddr;
+    uint16_t sport;
+    uint16_t dport;
+    uint32_t next_seq;          // Sequence number a merging segment starts at
+    uint16_t mss;               // Payload of the first segment
+    uint16_t segs;              // Segments merged
+    uint32_t age;               // When the flow started, for eviction
+} gro_flow_t;
+
+static gro_flow_t gro_flows[GRO_MAX_FLOWS];
+static uint32_t gro_clock;
+
+/**
+ * Hand a flow's packet up and free the slot
+ */
+static void gro_flush_flow(gro_flow_t *flow)
+{
+    sk_buff_t *skb = flow->head;
+    flow->head = NULL;
+
+    ip_header_t *iph = (ip_header_t *)skb->data;
+    if (flow->segs > 1) {
+        iph->tot_len = htons((uint16_t)skb->len);
+        iph->check = 0;
+        iph->check = net_csum_fold(net_csum_partial(iph, IP_HLEN, 0));
+        skb->gso_size = flow->mss;
+        g_net_stats.gro_flows_flushed++;
+    }
+    ip_rx(skb);
+}
+
+/**
+ * The held flow a TCP packet belongs to, if any
+ */
+static gro_flow_t *gro_find_flow(const ip_header_t *iph, const tcp_header_t *th)
+{
+    for (uint32_t i = 0; i < GRO_MAX_FLOWS; i++) {
+        gro_flow_t *flow = &gro_flows[i];
+        if (flow->head && flow->saddr == iph->saddr && flow->daddr == iph->daddr &&
+            flow->sport == th->source && flow->dport == th->dest) {
+            return flow;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Whether a packet is a TCP data segment that may merge
+ *
+ * @param payload Output: TCP payload bytes
+ */
+static int gro_segment_ok(sk_buff_t *skb, uint32_t *payload)
+{
+    const ip_header_t *iph = (const ip_header_t *)skb->data;
+    if (iph->version_ihl != 0x45 || iph->protocol != IPPROTO_TCP ||
+        (ntohs(iph->frag_off) & (IP_FLAG_MF | IP_OFFSET_MASK)) ||
+        ntohs(iph->tot_len) != skb->len || skb->data_len ||
+        net_csum_fold(net_csum_partial(iph, IP_HLEN, 0)) != 0) {
+        return 0;
+    }
+
+    const tcp_header_t *th = (const tcp_header_t *)(skb->data + IP_HLEN);
+    uint32_t doff = (uint32_t)(th->doff >> 4) * 4;
+    if (doff < TCP_HLEN || IP_HLEN + doff >= skb->len || (th->flags & ~TCP_PSH) != TCP_ACK) {
+        return 0;
+    }
+
+    uint32_t tcp_len = skb->len - IP_HLEN;
+    if (skb->ip_summed != SKB_CSUM_UNNECESSARY) {
+        uint32_t sum = tcp_pseudo_sum(iph->saddr, iph->daddr, tcp_len);
+        if (net_csum_fold(net_csum_skb(skb, IP_HLEN, tcp_len, sum)) != 0) {
+            return 0;
+        }
+        skb->ip_summed = SKB_CSUM_UNNECESSARY;
+    }
+
+    *payload = tcp_len - doff;
+    return 1;
+}
+
+/**
+ * Whether two segments carry the same ACK and options
+ */
+static int gro_same_header(const tcp_header_t *a, const tcp_header_t *b)
+{
+    if (a->ack_seq != b->ack_seq || a->doff != b->doff) {
+        return 0;
+    }
+    const uint8_t *pa = (const uint8_t *)a + TCP_HLEN;
+    const uint8_t *pb = (const uint8_t *)b + TCP_HLEN;
+    uint32_t optlen = (uint32_t)(a->doff >> 4) * 4 - TCP_HLEN;
+    for (uint32_t i = 0; i < optlen; i++) {
+        if (pa[i] != pb[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Start holding a flow, flushing the oldest if every slot is taken
+ */
+static void gro_start_flow(sk_buff_t *skb, uint32_t payload)
+{
+    const ip_header_t *iph = (const ip_header_t *)skb->data;
+    const tcp_header_t *th = (const tcp_header_t *)(skb->data + IP_HLEN);
+
+    gro_flow_t *flow = NULL;
+    for (uint32_t i = 0; i < GRO_MAX_FLOWS; i++) {
+        if (!gro_flows[i].head) {
+            flow = &gro_flows[i];
+            break;
+        }
+        if (!flow || gro_clock - gro_flows[i].age > gro_clock - flow->age) {
+            flow = &gro_flows[i];
+        }
+    }
+    if (flow->head) {
+        gro_flush_flow(flow);
+    }
+
+    flow->head = skb;
+    flow->last = skb;
+    flow->saddr = iph->saddr;
+    flow->daddr = iph->daddr;
+    flow->sport = th->source;
+    flow->dport = th->dest;
+    flow->next_seq = ntohl(th->seq) + payload;
+    flow->mss = (uint16_t)payload;
+    flow->segs = 1;
+    flow->age = gro_clock++;
+}
+
+/**
+ * Take a received IPv4 packet
+ */
+void net_gro_receive(sk_buff_t *skb)
+{
+    uint32_t payload;
+
+    if (skb_headlen(skb) < IP_HLEN + TCP_HLEN) {
+        ip_rx(skb);
+        return;
+    }
+    const ip_header_t *iph = (const ip_header_t *)skb->data;
+    const tcp_header_t *th = (const tcp_header_t *)(skb->data + IP_HLEN);
+    if (iph->protocol != IPPROTO_TCP) {
+        ip_rx(skb);
+        return;
+    }
+
+    gro_flow_t *flow = gro_find_flow(iph, th);
+    if (!gro_segment_ok(skb, &payload)) {
+        /* A control segment or a bad one: after what the flow holds */
+        if (flow) {
+            gro_flush_flow(flow);
+        }
+        ip_rx(skb);
+        return;
+    }
+
+    if (flow) {
+        sk_buff_t *head = flow->head;
+        tcp_header_t *head_th = (tcp_header_t *)(head->data + IP_HLEN);
+        if (ntohl(th->seq) != flow->next_seq || payload > flow->mss ||
+            flow->segs == GRO_MAX_SEGS || head->len + payload > GRO_MAX_SIZE ||
+            !gro_same_header(head_th, th)) {
+            gro_flush_flow(flow);
+            flow = NULL;
+        } else {
+            /* The head speaks for the merged packet: latest window, any PSH */
+            head_th->window = th->window;
+            head_th->flags |= th->flags & TCP_PSH;
+            int end = (th->flags & TCP_PSH) || payload < flow->mss;
+
+            skb_pull(skb, skb->len - payload);
+            skb_append_chained(head, flow->last, skb);
+            flow->last = skb;
+            flow->next_seq += payload;
+            flow->segs++;
+            g_net_stats.gro_merged++;
+
+            /* The sender paused here: nothing more to wait for */
+            if (end) {
+                gro_flush_flow(flow);
+            }
+            return;
+        }
+    }
+
+    if (th->flags & TCP_PSH) {
+        ip_rx(skb);
+        return;
+    }
+    gro_start_flow(skb, payload);
+}
+
+/**
+ * Hand every held packet to ip_rx()
+ */
+void net_gro_flush(void)
+{
+    for (uint32_t i = 0; i < GRO_MAX_FLOWS; i++) {
+        if (gro_flows[i].head) {
+            gro_flush_flow(&gro_flows[i]);
+        }
+    }
+}
@@ -0,0 +1,215 @@
+/**
+ * IPv4 and ICMP Echo
+ *
+ * Received packets are checked (version, header length and checksum,
+ * total length, destination) and handed to UDP, TCP or ICMP with the
+ * network and transport header offsets set, so the layers above can
+ * still find the addresses after pulling the headers off. Headers must
+ * be in the linear part; payload may be in fragments, as it is in TCP
+ * segments coming back through loopback, or in chained packets, as GRO
+ * merges them. Transport checksums the device does not take are
+ * finished on the way out.
+ */
+
+#include "net/ip.h"
+#include "net/arp.h"
+#include "net/udp.h"
+#include "net/tcp.h"
+#include "kernel/errno.h"
+
+static uint16_t ip_next_id;
+
+/**
+ * Whether a destination address is one we accept packets for
+ */
+static int ip_accepts(uint32_t daddr)
+{
+    if (net_is_local_addr(daddr) || daddr == INADDR_BROADCAST) {
+        return 1;
+    }
+    /* Directed broadcast of our network */
+    return g_net_config.up &&
+           daddr == (g_net_config.addr | ~g_net_config.netmask);
+}
+
+/**
+ * Answer an echo request
+ */
+static void icmp_rx(sk_buff_t *skb)
+{
+    const ip_header_t *iph = ip_hdr(skb);
+    uint32_t len = skb->len;
+
+    if (len < sizeof(icmp_header_t) || skb_headlen(skb) < sizeof(icmp_header_t) ||
+        net_csum_fold(net_csum_skb(skb, 0, len, 0)) != 0) {
+        g_net_stats.ip_rx_errors++;
+        skb_free(skb);
+        return;
+    }
+
+    /* Requests to broadcast addresses go unanswered */
+    icmp_header_t *icmp = (icmp_header_t *)skb->data;
+    if (icmp->type != ICMP_ECHO_REQUEST || !net_is_local_addr(iph->daddr) ||
+        SKB_DEFAULT_HEADROOM + len > SKB_MAX_LINEAR) {
+        skb_free(skb);
+        return;
+    }
+
+    sk_buff_t *reply = skb_alloc(SKB_DEFAULT_HEADROOM + len);
+    if (!reply) {
+        skb_free(skb);
+        return;
+    }
+    skb_reserve(reply, SKB_DEFAULT_HEADROOM);
+
+    icmp_header_t *out = (icmp_header_t *)skb_put(reply, len);
+    skb_copy_bits(skb, 0, out, len);
+    out->type = ICMP_ECHO_REPLY;
+    out->check = 0;
+    out->check = net_csum_fold(net_csum_partial(out, len, 0));
+
+    uint32_t saddr = iph->daddr;
+    uint32_t daddr = iph->saddr;
+    skb_free(skb);
+
+    g_net_stats.icmp_echo++;
+    ip_output(reply, saddr, daddr, IPPROTO_ICMP, NULL);
+}
+
+/**
+ * Handle a received IPv4 packet
+ */
+void ip_rx(sk_buff_t *skb)
+{
+    g_net_stats.ip_rx++;
+
+    if (skb_headlen(skb) < IP_HLEN) {
+        goto bad;
+    }
+
+    ip_header_t *iph = (ip_header_t *)skb->data;
+    uint32_t ihl = (uint32_t)(iph->version_ihl & 0x0F) * 4;
+    if ((iph->version_ihl >> 4) != 4 || ihl < IP_HLEN || ihl > skb_headlen(skb)) {
+        goto bad;
+    }
+    if (net_csum_fold(net_csum_partial(iph, ihl, 0)) != 0) {
+        goto bad;
+    }
+
+    uint32_t tot_len = ntohs(iph->tot_len);
+    if (tot_len < ihl || tot_len > skb->len) {
+        goto bad;
+    }
+
+    if (ntohs(iph->frag_off) & (IP_FLAG_MF | IP_OFFSET_MASK)) {
+        g_net_stats.ip_rx_fragments++;
+        skb_free(skb);
+        return;
+    }
+    if (!ip_accepts(iph->daddr)) {
+        g_net_stats.ip_rx_not_local++;
+        skb_free(skb);
+        return;
+    }
+
+    /* Drop Ethernet padding, then step over the header */
+    skb_trim(skb, tot_len);
+    skb_set_network_header(skb, 0);
+    skb_pull(skb, ihl);
+    skb_set_transport_header(skb, 0);
+
+    switch (iph->protocol) {
+        case IPPROTO_UDP:
+            udp_rx(skb);
+            break;
+
+        case IPPROTO_TCP:
+            tcp_rx(skb);
+            break;
+
+        case IPPROTO_ICMP:
+            icmp_rx(skb);
+            break;
+
+        default:
+            skb_free(skb);
+            break;
+    }
+    return;
+
+bad:
+    g_net_stats.ip_rx_errors++;
+    skb_free(skb);
+}
+
+/**
+ * Source address for packets to a destination
+ */
+uint32_t ip_select_source(uint32_t daddr)
+{
+    if (net_is_loopback(daddr)) {
+        return INADDR_LOOPBACK;
+    }
+    return g_net_config.up ? g_net_config.addr : INADDR_ANY;
+}
+
+/**
+ * Send a transport packet over IPv4
+ */
+int ip_output(sk_buff_t *skb, uint32_t saddr, uint32_t daddr, uint8_t protocol,
+              net_tx_batch_t *batch)
+{
+    if (skb_headroom(skb) < IP_HLEN + ETH_HLEN &&
+        skb_cow_head(skb, IP_HLEN + ETH_HLEN) != 0) {
+        skb_free(skb);
+        /* errno already set by skb_cow_head */
+        return -1;
+    }
+
+    ip_header_t *iph = (ip_header_t *)skb_push(skb, IP_HLEN);
+    iph->version_ihl = 0x45;
+    iph->tos = 0;
+    iph->tot_len = htons((uint16_t)skb->len);
+    iph->id = htons(ip_next_id++);
+    iph->frag_off = htons(IP_FLAG_DF);
+    iph->ttl = IP_DEFAULT_TTL;
+    iph->protocol = protocol;
+    iph->check = 0;
+    iph->saddr = saddr;
+    iph->daddr = daddr;
+    iph->check = net_csum_fold(net_csum_partial(iph, IP_HLEN, 0));
+
+    skb_set_network_header(skb, 0);
+    skb->protocol = ETH_P_IP;
+    g_net_stats.ip_tx++;
+
+    /* Local destinations loop straight back, as a receive interrupt would;
+     * nothing on the way can corrupt them, so no checksum is needed */
+    if (net_is_local_addr(daddr)) {
+        if (skb->ip_summed == SKB_CSUM_PARTIAL) {
+            skb->ip_summed = SKB_CSUM_UNNECESSARY;
+        }
+        g_net_stats.ip_loopback++;
+        net_loopback_xmit(skb);
+        return 0;
+    }
+
+    if (!g_net_config.up) {
+        skb_free(skb);
+        RETURN_ERRNO(THUNDEROS_ENETDOWN);
+    }
+    if (skb->gso_size && !(g_net_config.offloads & NET_OFFLOAD_TSO)) {
+        skb_free(skb);
+        RETURN_ERRNO(THUNDEROS_EMSGSIZE);
+    }
+    if (skb->ip_summed == SKB_CSUM_PARTIAL && !(g_net_config.offloads & NET_OFFLOAD_TX_CSUM)) {
+        net_csum_finish(skb);
+    }
+
+    uint32_t next_hop = daddr;
+    if ((daddr & g_net_config.netmask) != (g_net_config.addr & g_net_config.netmask) &&
+        daddr != INADDR_BROADCAST) {
+        next_hop = g_net_config.gateway;
+    }
+    return arp_output(skb, next_hop, batch);
+}
@@ -0,0 +1,251 @@
+/**
+ * Network Stack Core
+ *
+ * Interface configuration, the receive entry point the driver calls,
+ * and the transmit batches the protocol layers hand their frames to.
+ */
+
+#include "net/net.h"
+#include "net/arp.h"
+#include "net/ip.h"
+#include "net/tcp.h"
+#include "net/gro.h"
+#include "drivers/virtio_net.h"
+#include "arch/interrupt.h"
+#include "kernel/kstring.h"
+#include "kernel/errno.h"
+
+net_config_t g_net_config;
+net_stats_t g_net_stats;
+
+/* Packets for this host waiting for the delivery in progress to return */
+static sk_buff_head_t net_loopback_queue;
+static int net_loopback_busy;
+
+/**
+ * Initialize the network stack
+ */
+int net_init(void)
+{
+    kmemset(&g_net_config, 0, sizeof(g_net_config));
+    kmemset(&g_net_stats, 0, sizeof(g_net_stats));
+    skb_queue_init(&net_loopback_queue);
+    tcp_init();
+
+    if (!virtio_net_available()) {
+        return -1;
+    }
+
+    virtio_net_get_mac(g_net_config.mac);
+    g_net_config.addr = NET_DEFAULT_ADDR;
+    g_net_config.netmask = NET_DEFAULT_NETMASK;
+    g_net_config.gateway = NET_DEFAULT_GATEWAY;
+    g_net_config.up = 1;
+    if (virtio_net_has_feature(VIRTIO_NET_F_CSUM)) {
+        g_net_config.offloads |= NET_OFFLOAD_TX_CSUM;
+    }
+    if (virtio_net_has_feature(VIRTIO_NET_F_HOST_TSO4)) {
+        g_net_config.offloads |= NET_OFFLOAD_TSO;
+    }
+
+    virtio_net_set_rx_handler(net_rx);
+    virtio_net_set_rx_done(net_gro_flush);
+    return 0;
+}
+
+/**
+ * Receive a frame from the device
+ */
+void net_rx(sk_buff_t *skb)
+{
+    g_net_stats.rx_frames++;
+
+    if (skb_headlen(skb) < ETH_HLEN) {
+        skb_free(skb);
+        return;
+    }
+
+    eth_header_t *eth = (eth_header_t *)skb->data;
+    skb->protocol = ntohs(eth->type);
+    skb_pull(skb, ETH_HLEN);
+
+    switch (skb->protocol) {
+        case ETH_P_IP:
+            net_gro_receive(skb);
+            break;
+
+        case ETH_P_ARP:
+            arp_rx(skb);
+            break;
+
+        default:
+            g_net_stats.rx_unknown++;
+            skb_free(skb);
+            break;
+    }
+}
+
+/**
+ * Send a complete frame, or add it to a batch
+ */
+int net_dev_xmit(sk_buff_t *skb, net_tx_batch_t *batch)
+{
+    if (!batch) {
+        return virtio_net_xmit(skb);
+    }
+
+    batch->skbs[batch->count++] = skb;
+    if (batch->count == NET_TX_BATCH) {
+        net_tx_flush(batch);
+    }
+    return 0;
+}
+
+/**
+ * Send whatever a batch holds
+ */
+void net_tx_flush(net_tx_batch_t *batch)
+{
+    if (batch->count == 0) {
+        return;
+    }
+
+    /* The driver counts what it could not send; datagrams carry no promise */
+    virtio_net_xmit_batch(batch->skbs, batch->count);
+    batch->count = 0;
+}
+
+/**
+ * Deliver a packet addressed to this host
+ */
+void net_loopback_xmit(sk_buff_t *skb)
+{
+    int irq_state = interrupt_save_disable();
+    skb_queue_tail(&net_loopback_queue, skb);
+
+    /* The outermost caller delivers, including what deliveries send */
+    if (!net_loopback_busy) {
+        net_loopback_busy = 1;
+        while ((skb = skb_dequeue(&net_loopback_queue)) != NULL) {
+            ip_rx(skb);
+        }
+        net_loopback_busy = 0;
+    }
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Whether an address belongs to this host
+ */
+int net_is_local_addr(uint32_t addr)
+{
+    if (net_is_loopback(addr)) {
+        return 1;
+    }
+    return g_net_config.up && addr == g_net_config.addr;
+}
+
+/**
+ * Add data to a ones' complement checksum
+ *
+ * Words are summed in memory order, so the folded result can be stored
+ * as is (RFC 1071, section 2(B)).
+ */
+uint32_t net_csum_partial(const void *data, uint32_t len, uint32_t sum)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint64_t acc = sum;
+
+    while (len >= 4) {
+        acc += (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+               ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+        p += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        acc += (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+        acc += p[0];
+    }
+
+    /* Fold the 64-bit sum of 32-bit words down to 16 bits */
+    acc = (acc & 0xFFFFFFFF) + (acc >> 32);
+    acc = (acc & 0xFFFFFFFF) + (acc >> 32);
+    acc = (acc & 0xFFFF) + (acc >> 16);
+    acc = (acc & 0xFFFF) + (acc >> 16);
+    return (uint32_t)acc;
+}
+
+/**
+ * Finish the checksum of an SKB_CSUM_PARTIAL packet in software
+ */
+void net_csum_finish(sk_buff_t *skb)
+{
+    uint32_t start = skb->csum_start - (uint32_t)(skb->data - skb->head);
+    uint16_t *field = (uint16_t *)(skb->data + start + skb->csum_offset);
+
+    /* The field holds the pseudo-header sum, so it is summed with the rest */
+    *field = net_csum_fold(net_csum_skb(skb, start, skb->len - start, 0));
+    skb->ip_summed = SKB_CSUM_NONE;
+    g_net_stats.csum_soft++;
+}
+
+/**
+ * Add bytes of a packet to a ones' complement checksum
+ */
+uint32_t net_csum_skb(const sk_buff_t *skb, uint32_t offset, uint32_t len, uint32_t sum)
+{
+    uint32_t pos = 0;           // Bytes summed so far, for the byte order
+
+    uint32_t headlen = skb_headlen(skb);
+    if (offset < headlen) {
+        uint32_t n = headlen - offset < len ? headlen - offset : len;
+        sum = net_csum_partial(skb->data + offset, n, sum);
+        pos = n;
+        len -= n;
+        offset = 0;
+    } else {
+        offset -= headlen;
+    }
+
+    const skb_shared_info_t *shinfo = skb_shinfo(skb);
+    for (uint32_t i = 0; i < shinfo->nr_frags && len > 0; i++) {
+        const skb_frag_t *frag = &shinfo->frags[i];
+        if (offset >= frag->size) {
+            offset -= frag->size;
+            continue;
+        }
+        uint32_t n = frag->size - offset < len ? frag->size - offset : len;
+        uint32_t part = net_csum_partial((uint8_t *)skb_frag_address(frag) + offset, n, 0);
+        if (pos & 1) {
+            /* A chunk starting at an odd position has its bytes swapped */
+            part = ((part & 0xFF) << 8) | (part >> 8);
+        }
+        sum += part;
+        pos += n;
+        len -= n;
+        offset = 0;
+    }
+
+    for (const sk_buff_t *chained = shinfo->frag_list; chained && len > 0;
+         chained = chained->next) {
+        if (offset >= chained->len) {
+            offset -= chained->len;
+            continue;
+        }
+        uint32_t n = chained->len - offset < len ? chained->len - offset : len;
+        /* Folded to 16 bits, so the swap below sees the whole sum */
+        uint32_t part = (uint16_t)~net_csum_fold(net_csum_skb(chained, offset, n, 0));
+        if (pos & 1) {
+            part = ((part & 0xFF) << 8) | (part >> 8);
+        }
+        sum += part;
+        pos += n;
+        len -= n;
+        offset = 0;
+    }
+    return sum;
+}
@@ -0,0 +1,506 @@
+/**
+ * Packet Buffers (sk_buff)
+ *
+ * Descriptors come from the "skbuff" kmem_cache and head buffers from
+ * the "skb_head" DMA pool, so allocating a packet is two free-list pops.
+ * Fragment pages are reference counted with get_page()/put_page(), so
+ * clones and split packets share them instead of copying.
+ */
+
+#include "net/skbuff.h"
+#include "mm/slab.h"
+#include "mm/dma.h"
+#include "mm/page.h"
+#include "kernel/kstring.h"
+#include "kernel/errno.h"
+#include "kernel/panic.h"
+
+static kmem_cache_t *skb_cache = NULL;
+static dma_pool_t *skb_head_pool = NULL;
+static skb_stats_t skb_stats;
+
+/**
+ * Initialize the packet buffer subsystem
+ */
+void skb_init(void)
+{
+    skb_cache = kmem_cache_create("skbuff", sizeof(sk_buff_t), 0, NULL);
+    if (!skb_cache) {
+        kernel_panic("skb_init: Failed to create skbuff cache");
+    }
+
+    /* Cache-line aligned so device DMA never shares a line with a neighbour */
+    skb_head_pool = dma_pool_create("skb_head", SKB_HEAD_SIZE, 64);
+    if (!skb_head_pool) {
+        kernel_panic("skb_init: Failed to create skb_head pool");
+    }
+}
+
+/**
+ * Give a descriptor a fresh, empty head buffer
+ */
+static int skb_alloc_head(sk_buff_t *skb)
+{
+    uintptr_t phys;
+    uint8_t *buf = dma_pool_alloc(skb_head_pool, 0, &phys);
+    if (!buf) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+
+    skb->head = buf;
+    skb->data = buf;
+    skb->tail = buf;
+    skb->end = buf + SKB_MAX_LINEAR;
+    skb->head_phys = phys;
+
+    skb_shared_info_t *shinfo = skb_shinfo(skb);
+    shinfo->dataref = 1;
+    shinfo->nr_frags = 0;
+    shinfo->frag_list = NULL;
+
+    __sync_add_and_fetch(&skb_stats.heads_in_use, 1);
+    return 0;
+}
+
+/**
+ * Drop a descriptor's hold on its head buffer and fragments
+ */
+static void skb_release_data(sk_buff_t *skb)
+{
+    skb_shared_info_t *shinfo = skb_shinfo(skb);
+    if (__sync_sub_and_fetch(&shinfo->dataref, 1) != 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < shinfo->nr_frags; i++) {
+        put_page(shinfo->frags[i].page);
+    }
+    sk_buff_t *chained = shinfo->frag_list;
+    while (chained) {
+        sk_buff_t *next = chained->next;
+        skb_free(chained);
+        chained = next;
+    }
+    dma_pool_free(skb_head_pool, skb->head, skb->head_phys);
+    __sync_sub_and_fetch(&skb_stats.heads_in_use, 1);
+}
+
+/**
+ * Allocate a packet buffer
+ */
+sk_buff_t *skb_alloc(uint32_t size)
+{
+    if (size > SKB_MAX_LINEAR) {
+        RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+    }
+
+    sk_buff_t *skb = kmem_cache_alloc(skb_cache);
+    if (!skb) {
+        /* errno already set by kmem_cache_alloc */
+        return NULL;
+    }
+    kmemset(skb, 0, sizeof(*skb));
+
+    if (skb_alloc_head(skb) != 0) {
+        kmem_cache_free(skb_cache, skb);
+        /* errno already set by skb_alloc_head */
+        return NULL;
+    }
+
+    __sync_add_and_fetch(&skb_stats.allocs, 1);
+    __sync_add_and_fetch(&skb_stats.skbs_in_use, 1);
+    clear_errno();
+    return skb;
+}
+
+/**
+ * Free a packet buffer
+ */
+void skb_free(sk_buff_t *skb)
+{
+    if (!skb) {
+        return;
+    }
+
+    skb_release_data(skb);
+    kmem_cache_free(skb_cache, skb);
+    __sync_sub_and_fetch(&skb_stats.skbs_in_use, 1);
+}
+
+/**
+ * Make a second descriptor over the same data
+ */
+sk_buff_t *skb_clone(sk_buff_t *skb)
+{
+    sk_buff_t *clone = kmem_cache_alloc(skb_cache);
+    if (!clone) {
+        /* errno already set by kmem_cache_alloc */
+        return NULL;
+    }
+
+    *clone = *skb;
+    clone->next = NULL;
+    clone->prev = NULL;
+    __sync_add_and_fetch(&skb_shinfo(skb)->dataref, 1);
+    skb->cloned = 1;
+    clone->cloned = 1;
+
+    __sync_add_and_fetch(&skb_stats.clones, 1);
+    __sync_add_and_fetch(&skb_stats.skbs_in_use, 1);
+    clear_errno();
+    return clone;
+}
+
+/**
+ * Give a packet buffer a private linear area with some headroom
+ *
+ * The whole used part of the old buffer, headroom included, is copied so
+ * header offsets recorded before data stay valid.
+ */
+int skb_cow_head(sk_buff_t *skb, uint32_t headroom)
+{
+    uint32_t old_headroom = skb_headroom(skb);
+    if (!skb_cloned(skb) && old_headroom >= headroom) {
+        return 0;
+    }
+    if (skb_shinfo(skb)->frag_list) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    uint32_t shift = headroom > old_headroom ? headroom - old_headroom : 0;
+    uint32_t used = (uint32_t)(skb->tail - skb->head);
+    if (shift + used > SKB_MAX_LINEAR) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    sk_buff_t old = *skb;
+    if (skb_alloc_head(skb) != 0) {
+        *skb = old;
+        /* errno already set by skb_alloc_head */
+        return -1;
+    }
+
+    kmemcpy(skb->head + shift, old.head, used);
+    skb->data = skb->head + shift + old_headroom;
+    skb->tail = skb->head + shift + used;
+    skb->network_header += shift;
+    skb->transport_header += shift;
+    skb->csum_start += shift;
+    skb->cloned = 0;
+
+    /* Fragments are shared with the old buffer: one more reference each */
+    skb_shared_info_t *old_shinfo = skb_shinfo(&old);
+    skb_shared_info_t *shinfo = skb_shinfo(skb);
+    shinfo->nr_frags = old_shinfo->nr_frags;
+    for (uint32_t i = 0; i < old_shinfo->nr_frags; i++) {
+        shinfo->frags[i] = old_shinfo->frags[i];
+        get_page(shinfo->frags[i].page);
+    }
+
+    skb_release_data(&old);
+    __sync_add_and_fetch(&skb_stats.copies, 1);
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Split a packet buffer in two
+ */
+sk_buff_t *skb_split(sk_buff_t *skb, uint32_t len)
+{
+    if (len >= skb->len || skb_shinfo(skb)->frag_list) {
+        RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+    }
+
+    /* The fragment list is rewritten below, so it must be ours alone */
+    if (skb_cloned(skb) && skb_cow_head(skb, skb_headroom(skb)) != 0) {
+        /* errno already set by skb_cow_head */
+        return NULL;
+    }
+
+    /* Linear bytes past len are copied; the rest gets room for headers */
+    uint32_t headlen = skb_headlen(skb);
+    uint32_t copy = len < headlen ? headlen - len : 0;
+    uint32_t reserve = SKB_DEFAULT_HEADROOM;
+    if (reserve + copy > SKB_MAX_LINEAR) {
+        reserve = SKB_MAX_LINEAR - copy;
+    }
+
+    sk_buff_t *rest = skb_alloc(reserve + copy);
+    if (!rest) {
+        /* errno already set by skb_alloc */
+        return NULL;
+    }
+    skb_reserve(rest, reserve);
+    rest->protocol = skb->protocol;
+
+    if (copy > 0) {
+        kmemcpy(skb_put(rest, copy), skb->data + len, copy);
+        skb->tail = skb->data + len;
+    }
+
+    skb_shared_info_t *shinfo = skb_shinfo(skb);
+    skb_shared_info_t *rest_shinfo = skb_shinfo(rest);
+    uint32_t pos = headlen;
+    uint32_t kept = 0;
+    uint32_t moved_bytes = 0;
+    for (uint32_t i = 0; i < shinfo->nr_frags; i++) {
+        skb_frag_t *frag = &shinfo->frags[i];
+        uint32_t size = frag->size;
+
+        if (pos + size <= len) {
+            /* Entirely before the cut */
+            shinfo->frags[kept++] = *frag;
+        } else if (pos >= len) {
+            /* Entirely after it */
+            rest_shinfo->frags[rest_shinfo->nr_frags++] = *frag;
+            moved_bytes += size;
+        } else {
+            /* Cut in two: both halves point into the page */
+            uint32_t head_part = len - pos;
+            skb_frag_t *tail_frag = &rest_shinfo->frags[rest_shinfo->nr_frags++];
+            tail_frag->page = frag->page;
+            tail_frag->offset = frag->offset + head_part;
+            tail_frag->size = size - head_part;
+            get_page(frag->page);
+            moved_bytes += tail_frag->size;
+
+            frag->size = head_part;
+            shinfo->frags[kept++] = *frag;
+        }
+        pos += size;
+    }
+    shinfo->nr_frags = kept;
+
+    rest->data_len = moved_bytes;
+    rest->len += moved_bytes;
+    skb->data_len -= moved_bytes;
+    skb->len = len;
+
+    clear_errno();
+    return rest;
+}
+
+/**
+ * Attach a page fragment at the end of the packet
+ */
+int skb_add_frag(sk_buff_t *skb, uintptr_t page, uint32_t offset, uint32_t size)
+{
+    skb_shared_info_t *shinfo = skb_shinfo(skb);
+
+    /* Data continuing the last fragment in the same page extends it */
+    if (shinfo->nr_frags > 0) {
+        skb_frag_t *last = &shinfo->frags[shinfo->nr_frags - 1];
+        if (last->page == page && last->offset + last->size == offset) {
+            last->size += size;
+            put_page(page);
+            goto added;
+        }
+    }
+
+    if (shinfo->nr_frags == SKB_MAX_FRAGS) {
+        RETURN_ERRNO(THUNDEROS_ENOSPC);
+    }
+
+    skb_frag_t *frag = &shinfo->frags[shinfo->nr_frags++];
+    frag->page = page;
+    frag->offset = offset;
+    frag->size = size;
+
+added:
+    skb->len += size;
+    skb->data_len += size;
+    return 0;
+}
+
+/**
+ * Chain a packet behind another, on its frag_list
+ */
+void skb_append_chained(sk_buff_t *skb, sk_buff_t *last, sk_buff_t *piece)
+{
+    piece->next = NULL;
+    piece->prev = NULL;
+    if (last == skb) {
+        skb_shinfo(skb)->frag_list = piece;
+    } else {
+        last->next = piece;
+    }
+    skb->len += piece->len;
+    skb->data_len += piece->len;
+}
+
+/**
+ * Copy bytes out of a packet, across the linear part, fragments and
+ * chained packets
+ */
+int skb_copy_bits(const sk_buff_t *skb, uint32_t offset, void *to, uint32_t len)
+{
+    if (offset > skb->len || len > skb->len - offset) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    uint8_t *dest = to;
+    uint32_t headlen = skb_headlen(skb);
+    if (offset < headlen) {
+        uint32_t chunk = headlen - offset < len ? headlen - offset : len;
+        kmemcpy(dest, skb->data + offset, chunk);
+        dest += chunk;
+        len -= chunk;
+        offset = headlen;
+    }
+
+    skb_shared_info_t *shinfo = skb_shinfo(skb);
+    uint32_t pos = headlen;
+    for (uint32_t i = 0; i < shinfo->nr_frags && len > 0; i++) {
+        const skb_frag_t *frag = &shinfo->frags[i];
+        if (offset < pos + frag->size) {
+            uint32_t start = offset - pos;
+            uint32_t chunk = frag->size - start < len ? frag->size - start : len;
+            kmemcpy(dest, (uint8_t *)skb_frag_address(frag) + start, chunk);
+            dest += chunk;
+            len -= chunk;
+            offset += chunk;
+        }
+        pos += frag->size;
+    }
+
+    for (const sk_buff_t *chained = shinfo->frag_list; chained && len > 0;
+         chained = chained->next) {
+        if (offset < pos + chained->len) {
+            uint32_t start = offset - pos;
+            uint32_t chunk = chained->len - start < len ? chained->len - start : len;
+            skb_copy_bits(chained, start, dest, chunk);
+            dest += chunk;
+            len -= chunk;
+            offset += chunk;
+        }
+        pos += chained->len;
+    }
+    return 0;
+}
+
+/**
+ * Get packet buffer statistics
+ */
+void skb_get_stats(skb_stats_t *stats)
+{
+    *stats = skb_stats;
+}
+
+/**
+ * Initialize an empty queue
+ */
+void skb_queue_init(sk_buff_head_t *list)
+{
+    list->next = NULL;
+    list->prev = NULL;
+    list->qlen = 0;
+}
+
+/**
+ * Add a packet at the end of a queue
+ */
+void skb_queue_tail(sk_buff_head_t *list, sk_buff_t *skb)
+{
+    skb->next = NULL;
+    skb->prev = list->prev;
+    if (list->prev) {
+        list->prev->next = skb;
+    } else {
+        list->next = skb;
+    }
+    list->prev = skb;
+    list->qlen++;
+}
+
+/**
+ * Add a packet at the front of a queue
+ */
+void skb_queue_head(sk_buff_head_t *list, sk_buff_t *skb)
+{
+    skb->prev = NULL;
+    skb->next = list->next;
+    if (list->next) {
+        list->next->prev = skb;
+    } else {
+        list->prev = skb;
+    }
+    list->next = skb;
+    list->qlen++;
+}
+
+/**
+ * Take the packet at the front of a queue
+ *
+ * @return Packet, or NULL if the queue is empty
+ */
+sk_buff_t *skb_dequeue(sk_buff_head_t *list)
+{
+    sk_buff_t *skb = list->next;
+    if (!skb) {
+        return NULL;
+    }
+
+    list->next = skb->next;
+    if (list->next) {
+        list->next->prev = NULL;
+    } else {
+        list->prev = NULL;
+    }
+    list->qlen--;
+    skb->next = NULL;
+    skb->prev = NULL;
+    return skb;
+}
+
+/**
+ * Add a packet after another in a queue (prev NULL: at the front)
+ */
+void skb_insert_after(sk_buff_head_t *list, sk_buff_t *prev, sk_buff_t *skb)
+{
+    if (!prev) {
+        skb_queue_head(list, skb);
+        return;
+    }
+
+    skb->prev = prev;
+    skb->next = prev->next;
+    if (prev->next) {
+        prev->next->prev = skb;
+    } else {
+        list->prev = skb;
+    }
+    prev->next = skb;
+    list->qlen++;
+}
+
+/**
+ * Take a packet out of the middle of a queue
+ */
+void skb_unlink(sk_buff_head_t *list, sk_buff_t *skb)
+{
+    if (skb->prev) {
+        skb->prev->next = skb->next;
+    } else {
+        list->next = skb->next;
+    }
+    if (skb->next) {
+        skb->next->prev = skb->prev;
+    } else {
+        list->prev = skb->prev;
+    }
+    list->qlen--;
+    skb->next = NULL;
+    skb->prev = NULL;
+}
+
+/**
+ * Free every packet in a queue
+ */
+void skb_queue_purge(sk_buff_head_t *list)
+{
+    sk_buff_t *skb;
+    while ((skb = skb_dequeue(list)) != NULL) {
+        skb_free(skb);
+    }
+}
@@ -0,0 +1,637 @@
+/**
+ * Sockets
+ *
+ * The receive queue is filled from the receive interrupt (or loopback,
+ * with interrupts off) and emptied by readers with interrupts off; a
+ * reader that finds it empty sleeps on the socket's wait queue through
+ * a poll waiter, so signals and deadlines work as they do for poll().
+ * Stream sockets hand everything to their TCP connection, AF_UNIX
+ * sockets to net/unix.c.
+ */
+
+#include "net/socket.h"
+#include "net/udp.h"
+#include "net/tcp.h"
+#include "net/unix.h"
+#include "hal/hal_timer.h"
+#include "arch/interrupt.h"
+#include "kernel/uaccess.h"
+#include "kernel/kstring.h"
+#include "kernel/errno.h"
+#include "mm/kmalloc.h"
+
+/**
+ * Create a socket
+ */
+socket_t *socket_create(int domain, int type, int protocol)
+{
+    if (domain != AF_INET && domain != AF_UNIX) {
+        RETURN_ERRNO_NULL(THUNDEROS_EAFNOSUPPORT);
+    }
+    type &= SOCK_TYPE_MASK;
+    if (domain == AF_UNIX) {
+        if ((type != SOCK_DGRAM && type != SOCK_STREAM) || protocol != 0) {
+            RETURN_ERRNO_NULL(THUNDEROS_EPROTONOSUPPORT);
+        }
+    } else if (type == SOCK_DGRAM && (protocol == 0 || protocol == IPPROTO_UDP)) {
+        protocol = IPPROTO_UDP;
+    } else if (type == SOCK_STREAM && (protocol == 0 || protocol == IPPROTO_TCP)) {
+        protocol = IPPROTO_TCP;
+    } else {
+        RETURN_ERRNO_NULL(THUNDEROS_EPROTONOSUPPORT);
+    }
+
+    socket_t *sock = kmalloc(sizeof(socket_t));
+    if (!sock) {
+        RETURN_ERRNO_NULL(THUNDEROS_ENOMEM);
+    }
+    kmemset(sock, 0, sizeof(socket_t));
+    sock->refcount = 1;
+    sock->family = (uint16_t)domain;
+    sock->type = (uint16_t)type;
+    sock->protocol = (uint16_t)protocol;
+    sock->rcvbuf = SOCKET_RCVBUF;
+    sock->sndbuf = SOCKET_RCVBUF;  // UDP only reports it: datagrams are never queued
+    skb_queue_init(&sock->rx_queue);
+    wait_queue_init(&sock->wait_queue);
+
+    if (domain == AF_UNIX) {
+        if (type == SOCK_STREAM) {
+            /* The buffers are the pipes' */
+            sock->rcvbuf = PIPE_DEF_SIZE;
+            sock->sndbuf = PIPE_DEF_SIZE;
+        }
+        if (unix_sock_create(sock) != 0) {
+            kfree(sock);
+            /* errno already set by unix_sock_create */
+            return NULL;
+        }
+    } else if (type == SOCK_STREAM && tcp_sock_create(sock) != 0) {
+        kfree(sock);
+        /* errno already set by tcp_sock_create */
+        return NULL;
+    }
+
+    clear_errno();
+    return sock;
+}
+
+/**
+ * Create a pair of connected sockets
+ */
+int socket_create_pair(int domain, int type, int protocol, socket_t *pair[2])
+{
+    if (domain == AF_INET) {
+        RETURN_ERRNO(THUNDEROS_EOPNOTSUPP);
+    }
+
+    pair[0] = socket_create(domain, type, protocol);
+    if (!pair[0]) {
+        /* errno already set by socket_create */
+        return -1;
+    }
+    pair[1] = socket_create(domain, type, protocol);
+    if (!pair[1]) {
+        socket_put(pair[0]);
+        /* errno already set by socket_create */
+        return -1;
+    }
+    if (unix_pair(pair[0], pair[1]) != 0) {
+        socket_put(pair[0]);
+        socket_put(pair[1]);
+        /* errno already set by unix_pair */
+        return -1;
+    }
+    clear_errno();
+    return 0;
+}
+
+void socket_get(socket_t *sock)
+{
+    sock->refcount++;
+}
+
+/**
+ * Drop a reference
+ */
+void socket_put(socket_t *sock)
+{
+    if (--sock->refcount > 0) {
+        return;
+    }
+
+    if (sock->family == AF_UNIX) {
+        unix_release(sock);
+        kfree(sock);
+        return;
+    }
+
+    /* The connection frees the socket when it is done with it */
+    if (sock->type == SOCK_STREAM) {
+        tcp_close(sock);
+        return;
+    }
+
+    /* Out of the port table first, so nothing more is queued */
+    if (sock->local_port) {
+        udp_unbind(sock);
+    }
+
+    int irq_state = interrupt_save_disable();
+    skb_queue_purge(&sock->rx_queue);
+    interrupt_restore(irq_state);
+
+    kfree(sock);
+}
+
+/**
+ * Put back the files a message carried
+ */
+void socket_scm_release(socket_scm_t *scm)
+{
+    for (uint32_t i = 0; i < scm->nfds; i++) {
+        vfs_file_put(scm->files[i]);
+    }
+    scm->nfds = 0;
+}
+
+/**
+ * Bind a socket to a local address and port, or a name
+ */
+int socket_bind(socket_t *sock, const socket_addr_t *addr)
+{
+    if (addr->family != sock->family) {
+        RETURN_ERRNO(THUNDEROS_EAFNOSUPPORT);
+    }
+    if (sock->family == AF_UNIX) {
+        return unix_bind(sock, &addr->un);
+    }
+    if (sock->local_port) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (addr->in.sin_addr != INADDR_ANY && !net_is_local_addr(addr->in.sin_addr)) {
+        RETURN_ERRNO(THUNDEROS_EADDRNOTAVAIL);
+    }
+
+    int ret;
+    if (sock->type == SOCK_STREAM) {
+        ret = tcp_bind(sock, addr->in.sin_addr, addr->in.sin_port);
+    } else {
+        ret = udp_bind(sock, addr->in.sin_addr, addr->in.sin_port);
+    }
+    if (ret != 0) {
+        /* errno already set by tcp_bind/udp_bind */
+        return -1;
+    }
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Send one datagram, or data on a stream
+ */
+int socket_sendmsg(socket_t *sock, const socket_addr_t *dest,
+                   const vfs_iovec_t *iov, int iovcnt, net_tx_batch_t *batch,
+                   int nonblock, socket_scm_t *scm)
+{
+    if (sock->family == AF_UNIX) {
+        if (dest && sock->type == SOCK_DGRAM && dest->family != AF_UNIX) {
+            RETURN_ERRNO(THUNDEROS_EAFNOSUPPORT);
+        }
+        return unix_sendmsg(sock, dest ? &dest->un : NULL, iov, iovcnt, nonblock, scm);
+    }
+    if (scm && scm->nfds) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    if (sock->type == SOCK_STREAM) {
+        return tcp_sendmsg(sock, iov, iovcnt, nonblock);
+    }
+
+    if (!dest) {
+        RETURN_ERRNO(THUNDEROS_EDESTADDRREQ);
+    }
+    if (dest->family != AF_INET) {
+        RETURN_ERRNO(THUNDEROS_EAFNOSUPPORT);
+    }
+
+    if (!sock->local_port && udp_bind(sock, INADDR_ANY, 0) != 0) {
+        /* errno already set by udp_bind */
+        return -1;
+    }
+
+    int sent = udp_sendmsg(sock, dest->in.sin_addr, dest->in.sin_port, iov, iovcnt, batch);
+    if (sent < 0) {
+        /* errno already set by udp_sendmsg */
+        return -1;
+    }
+    clear_errno();
+    return sent;
+}
+
+/**
+ * Take the oldest datagram off the queue, if there is one
+ */
+static sk_buff_t *socket_try_dequeue(socket_t *sock)
+{
+    int irq_state = interrupt_save_disable();
+    sk_buff_t *skb = skb_dequeue(&sock->rx_queue);
+    if (skb) {
+        sock->rx_queued -= socket_truesize(skb);
+    }
+    interrupt_restore(irq_state);
+    return skb;
+}
+
+/**
+ * Take the oldest datagram off the queue, waiting for one if allowed
+ */
+sk_buff_t *socket_dequeue(socket_t *sock, int nonblock, uint64_t deadline_us)
+{
+    sk_buff_t *skb = socket_try_dequeue(sock);
+    if (skb) {
+        return skb;
+    }
+    if (nonblock) {
+        RETURN_ERRNO_NULL(THUNDEROS_EAGAIN);
+    }
+
+    wait_queue_entry_t entry;
+    poll_waiter_t pw;
+    poll_waiter_init(&pw, &entry, 1);
+    poll_wait(&pw.pt, &sock->wait_queue);
+
+    int error = 0;
+    while ((skb = socket_try_dequeue(sock)) == NULL) {
+        if (poll_signal_pending()) {
+            error = THUNDEROS_EINTR;
+            break;
+        }
+        if (deadline_us && hal_timer_get_time_us() >= deadline_us) {
+            error = THUNDEROS_EAGAIN;
+            break;
+        }
+        poll_waiter_sleep(&pw, deadline_us);
+    }
+
+    poll_waiter_release(&pw);
+
+    if (error) {
+        RETURN_ERRNO_NULL(error);
+    }
+    return skb;
+}
+
+/**
+ * Copy bytes of a packet out to user memory
+ */
+int socket_copy_to_user(const sk_buff_t *skb, uint32_t offset, void *to, uint32_t len)
+{
+    uint8_t *dst = (uint8_t *)to;
+
+    uint32_t headlen = skb_headlen(skb);
+    if (offset < headlen) {
+        uint32_t n = headlen - offset < len ? headlen - offset : len;
+        if (copy_to_user(dst, skb->data + offset, n) != 0) {
+            return -1;
+        }
+        dst += n;
+        len -= n;
+        offset = 0;
+    } else {
+        offset -= headlen;
+    }
+
+    const skb_shared_info_t *shinfo = skb_shinfo(skb);
+    for (uint32_t i = 0; i < shinfo->nr_frags && len > 0; i++) {
+        const skb_frag_t *frag = &shinfo->frags[i];
+        if (offset >= frag->size) {
+            offset -= frag->size;
+            continue;
+        }
+        uint32_t n = frag->size - offset < len ? frag->size - offset : len;
+        if (copy_to_user(dst, (uint8_t *)skb_frag_address(frag) + offset, n) != 0) {
+            return -1;
+        }
+        dst += n;
+        len -= n;
+        offset = 0;
+    }
+
+    /* Segments merged on receive */
+    for (const sk_buff_t *chained = shinfo->frag_list; chained && len > 0;
+         chained = chained->next) {
+        if (offset >= chained->len) {
+            offset -= chained->len;
+            continue;
+        }
+        uint32_t n = chained->len - offset < len ? chained->len - offset : len;
+        if (socket_copy_to_user(chained, offset, dst, n) != 0) {
+            return -1;
+        }
+        dst += n;
+        len -= n;
+        offset = 0;
+    }
+    return 0;
+}
+
+/**
+ * Copy a datagram's payload out to user buffers
+ */
+int socket_copy_to_iov(const sk_buff_t *skb, const vfs_iovec_t *iov, int iovcnt)
+{
+    uint32_t copied = 0;
+    for (int i = 0; i < iovcnt && copied < skb->len; i++) {
+        uint32_t n = skb->len - copied;
+        if (iov[i].len < n) {
+            n = (uint32_t)iov[i].len;
+        }
+        if (n && socket_copy_to_user(skb, copied, iov[i].base, n) != 0) {
+            /* errno already set by copy_to_user */
+            return -1;
+        }
+        copied += n;
+    }
+    return (int)copied;
+}
+
+/**
+ * Receive one datagram, or data on a stream
+ */
+int socket_recvmsg(socket_t *sock, const vfs_iovec_t *iov, int iovcnt,
+                   socket_addr_t *from, int nonblock, uint64_t deadline_us,
+                   int *msg_flags, socket_scm_t *scm)
+{
+    if (sock->family == AF_UNIX) {
+        return unix_recvmsg(sock, iov, iovcnt, from ? &from->un : NULL, nonblock,
+                            deadline_us, msg_flags, scm);
+    }
+    if (scm) {
+        scm->nfds = 0;
+    }
+
+    if (sock->type == SOCK_STREAM) {
+        int received = tcp_recvmsg(sock, iov, iovcnt, nonblock, deadline_us);
+        if (received >= 0) {
+            if (msg_flags) {
+                *msg_flags = 0;
+            }
+            if (from && tcp_getpeer(sock, &from->in) != 0) {
+                kmemset(from, 0, sizeof(*from));
+            }
+            clear_errno();
+        }
+        return received;
+    }
+
+    sk_buff_t *skb = socket_dequeue(sock, nonblock, deadline_us);
+    if (!skb) {
+        /* errno already set by socket_dequeue */
+        return -1;
+    }
+
+    int copied = socket_copy_to_iov(skb, iov, iovcnt);
+    if (copied < 0) {
+        skb_free(skb);
+        /* errno already set by socket_copy_to_iov */
+        return -1;
+    }
+
+    if (msg_flags) {
+        *msg_flags = (uint32_t)copied < skb->len ? MSG_TRUNC : 0;
+    }
+    if (from) {
+        kmemset(from, 0, sizeof(*from));
+        from->in.sin_family = AF_INET;
+        from->in.sin_port = udp_hdr(skb)->source;
+        from->in.sin_addr = ip_hdr(skb)->saddr;
+    }
+
+    skb_free(skb);
+    clear_errno();
+    return copied;
+}
+
+/**
+ * Queue a received datagram
+ */
+int socket_deliver(socket_t *sock, sk_buff_t *skb)
+{
+    uint32_t truesize = socket_truesize(skb);
+    if (sock->rx_queued + truesize > sock->rcvbuf) {
+        sock->rx_drops++;
+        skb_free(skb);
+        return -1;
+    }
+
+    skb_queue_tail(&sock->rx_queue, skb);
+    sock->rx_queued += truesize;
+    wait_queue_wake(&sock->wait_queue);
+    return 0;
+}
+
+/**
+ * Readiness of a socket
+ */
+int socket_poll(socket_t *sock, poll_table_t *pt)
+{
+    if (sock->family == AF_UNIX) {
+        return unix_poll(sock, pt);
+    }
+    if (sock->type == SOCK_STREAM) {
+        return tcp_poll(sock, pt);
+    }
+
+    poll_wait(pt, &sock->wait_queue);
+
+    /* Sending never waits for the socket, only (briefly) for the device */
+    int mask = POLLOUT;
+    if (skb_queue_len(&sock->rx_queue) > 0) {
+        mask |= POLLIN;
+    }
+    return mask;
+}
+
+/**
+ * Connect a stream socket, or set an AF_UNIX datagram socket's peer
+ */
+int socket_connect(socket_t *sock, const socket_addr_t *addr, int nonblock)
+{
+    if (sock->family == AF_UNIX) {
+        if (addr->family != AF_UNIX) {
+            RETURN_ERRNO(THUNDEROS_EAFNOSUPPORT);
+        }
+        return unix_connect(sock, &addr->un, nonblock);
+    }
+    if (sock->type != SOCK_STREAM) {
+        RETURN_ERRNO(THUNDEROS_EOPNOTSUPP);
+    }
+    if (addr->family != AF_INET) {
+        RETURN_ERRNO(THUNDEROS_EAFNOSUPPORT);
+    }
+    return tcp_connect(sock, &addr->in, nonblock);
+}
+
+/**
+ * Listen for connections
+ */
+int socket_listen(socket_t *sock, int backlog)
+{
+    if (sock->type != SOCK_STREAM) {
+        RETURN_ERRNO(THUNDEROS_EOPNOTSUPP);
+    }
+    if (sock->family == AF_UNIX) {
+        return unix_listen(sock, backlog);
+    }
+    return tcp_listen(sock, backlog);
+}
+
+/**
+ * Accept a connection
+ */
+socket_t *socket_accept(socket_t *sock, socket_addr_t *peer, int nonblock)
+{
+    if (sock->type != SOCK_STREAM) {
+        RETURN_ERRNO_NULL(THUNDEROS_EOPNOTSUPP);
+    }
+
+    if (sock->family == AF_UNIX) {
+        socket_t *conn = unix_accept(sock, nonblock);
+        if (conn && peer) {
+            unix_getname(conn, 1, &peer->un);
+        }
+        /* errno set by unix_accept */
+        return conn;
+    }
+
+    socket_t *conn = tcp_accept(sock, nonblock);
+    if (!conn) {
+        /* errno already set by tcp_accept */
+        return NULL;
+    }
+    if (peer && tcp_getpeer(conn, &peer->in) != 0) {
+        /* Reset since it was established: still a connection to hand out */
+        kmemset(peer, 0, sizeof(*peer));
+        peer->in.sin_family = AF_INET;
+    }
+    clear_errno();
+    return conn;
+}
+
+/**
+ * Shut down a stream socket
+ */
+int socket_shutdown(socket_t *sock, int how)
+{
+    if (how != SHUT_RD && how != SHUT_WR && how != SHUT_RDWR) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (sock->family == AF_UNIX) {
+        return unix_shutdown(sock, how);
+    }
+    if (sock->type != SOCK_STREAM) {
+        RETURN_ERRNO(THUNDEROS_ENOTCONN);
+    }
+    return tcp_shutdown(sock, how);
+}
+
+static uint32_t socket_clamp_buf(int value)
+{
+    if (value < SOCKET_BUF_MIN) {
+        return SOCKET_BUF_MIN;
+    }
+    if (value > SOCKET_BUF_MAX) {
+        return SOCKET_BUF_MAX;
+    }
+    return (uint32_t)value;
+}
+
+/**
+ * Set an int option
+ */
+int socket_setsockopt(socket_t *sock, int level, int name, int value)
+{
+    if (level == IPPROTO_TCP && sock->tcp) {
+        return tcp_setsockopt(sock, name, value);
+    }
+    if (level != SOL_SOCKET) {
+        RETURN_ERRNO(THUNDEROS_ENOPROTOOPT);
+    }
+
+    switch (name) {
+    case SO_REUSEADDR:
+        sock->reuseaddr = value != 0;
+        break;
+    case SO_SNDBUF:
+        sock->sndbuf = socket_clamp_buf(value);
+        break;
+    case SO_RCVBUF:
+        sock->rcvbuf = socket_clamp_buf(value);
+        if (sock->family == AF_UNIX) {
+            unix_set_rcvbuf(sock);
+        }
+        break;
+    default:
+        RETURN_ERRNO(THUNDEROS_ENOPROTOOPT);
+    }
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Get an int option
+ */
+int socket_getsockopt(socket_t *sock, int level, int name, int *value)
+{
+    if (level == IPPROTO_TCP && sock->tcp) {
+        return tcp_getsockopt(sock, name, value);
+    }
+    if (level != SOL_SOCKET) {
+        RETURN_ERRNO(THUNDEROS_ENOPROTOOPT);
+    }
+
+    switch (name) {
+    case SO_REUSEADDR:
+        *value = sock->reuseaddr;
+        break;
+    case SO_TYPE:
+        *value = sock->type;
+        break;
+    case SO_ERROR:
+        *value = sock->tcp ? tcp_take_error(sock) : 0;
+        break;
+    case SO_SNDBUF:
+        *value = (int)sock->sndbuf;
+        break;
+    case SO_RCVBUF:
+        *value = (int)sock->rcvbuf;
+        break;
+    default:
+        RETURN_ERRNO(THUNDEROS_ENOPROTOOPT);
+    }
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Move data from a pipe onto a stream
+ */
+int socket_splice_write(socket_t *sock, struct pipe *pipe, uint32_t len, int nonblock)
+{
+    if (sock->family != AF_UNIX || sock->type != SOCK_STREAM) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    return unix_splice_write(sock, pipe, len, nonblock);
+}
+
+/**
+ * Move received stream data into a pipe
+ */
+int socket_splice_read(socket_t *sock, struct pipe *pipe, uint32_t len, int nonblock)
+{
+    if (sock->family != AF_UNIX || sock->type != SOCK_STREAM) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    return unix_splice_read(sock, pipe, len, nonblock);
+}
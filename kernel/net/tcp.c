@@ -0,0 +1,1243 @@
+/**
+ * TCP
+ *
+ * The connection table, the socket calls and the timers. Segments are
+ * processed in tcp_input.c and built in tcp_output.c.
+ *
+ * A connection is referenced by its socket (or, before accept(), by its
+ * listener's list), by the table while it is hashed, by its work item
+ * while that is queued, and by callers for the length of a call. The
+ * socket_t goes with the last reference, not with the socket's own
+ * count: a closed socket's connection lives on until it is CLOSED.
+ */
+
+#include <stddef.h>
+#include "net/tcp.h"
+#include "hal/hal_timer.h"
+#include "arch/interrupt.h"
+#include "kernel/config.h"
+#include "kernel/uaccess.h"
+#include "kernel/kstring.h"
+#include "kernel/errno.h"
+#include "mm/kmalloc.h"
+#include "mm/pmm.h"
+#include "mm/page.h"
+
+/* Slow start has no limit until the first loss */
+#define TCP_INFINITE_SSTHRESH   0x7FFFFFFF
+
+static tcp_sock_t *tcp_hash[TCP_HASH_SIZE];
+
+/* Next ephemeral port to try, host order */
+static uint32_t tcp_next_port = TCP_EPHEMERAL_FIRST;
+
+/* Secret for initial sequence numbers */
+static uint32_t tcp_secret;
+
+static inline uint32_t tcp_hashfn(uint16_t port)
+{
+    return ntohs(port) & (TCP_HASH_SIZE - 1);
+}
+
+void tcp_init(void)
+{
+    tcp_secret = (uint32_t)hal_timer_get_time_us() * 0x9E3779B1U ^ (uint32_t)(uintptr_t)tcp_hash;
+}
+
+/**
+ * Initial sequence number: a clock plus a keyed hash of the connection
+ * (RFC 6528), so a new incarnation starts past the old one's numbers
+ */
+static uint32_t tcp_new_iss(uint32_t saddr, uint32_t daddr, uint16_t sport, uint16_t dport)
+{
+    uint32_t h = tcp_secret;
+    h = (h ^ saddr) * 0x9E3779B1U;
+    h = (h ^ daddr) * 0x9E3779B1U;
+    h = (h ^ (((uint32_t)sport << 16) | dport)) * 0x9E3779B1U;
+    h ^= h >> 16;
+    return h + (uint32_t)(hal_timer_get_time_us() / 4);
+}
+
+/**
+ * Sum of the pseudo-header that the checksum covers
+ */
+uint32_t tcp_pseudo_sum(uint32_t saddr, uint32_t daddr, uint32_t len)
+{
+    uint32_t sum = 0;
+    sum += saddr & 0xFFFF;
+    sum += saddr >> 16;
+    sum += daddr & 0xFFFF;
+    sum += daddr >> 16;
+    sum += htons(IPPROTO_TCP);
+    sum += htons((uint16_t)len);
+    return sum;
+}
+
+/*
+ * References
+ */
+
+void tcp_sock_hold(tcp_sock_t *tp)
+{
+    int irq_state = interrupt_save_disable();
+    tp->refs++;
+    interrupt_restore(irq_state);
+}
+
+void tcp_sock_put(tcp_sock_t *tp)
+{
+    int irq_state = interrupt_save_disable();
+    uint32_t refs = --tp->refs;
+    interrupt_restore(irq_state);
+    if (refs > 0) {
+        return;
+    }
+
+    ktimer_cancel(&tp->rtx_timer);
+    ktimer_cancel(&tp->delack_timer);
+    skb_queue_purge(&tp->write_queue);
+    skb_queue_purge(&tp->rcv_queue);
+    skb_queue_purge(&tp->ooo_queue);
+    skb_queue_purge(&tp->backlog);
+    if (tp->tx_page) {
+        put_page(tp->tx_page);
+    }
+    kfree(tp->sock);
+    kfree(tp);
+}
+
+/*
+ * Connection table (interrupts off)
+ */
+
+static void tcp_hash_insert(tcp_sock_t *tp)
+{
+    uint32_t bucket = tcp_hashfn(tp->sock->local_port);
+    tp->hash_next = tcp_hash[bucket];
+    tcp_hash[bucket] = tp;
+    tp->hashed = 1;
+    tp->refs++;
+}
+
+/**
+ * Take a connection out of the table; the table's reference is the caller's
+ */
+static void tcp_unhash(tcp_sock_t *tp)
+{
+    tcp_sock_t **link = &tcp_hash[tcp_hashfn(tp->sock->local_port)];
+    while (*link) {
+        if (*link == tp) {
+            *link = tp->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    tp->hash_next = NULL;
+    tp->hashed = 0;
+}
+
+/**
+ * Find the connection for a segment, or else the listener for its port
+ */
+static tcp_sock_t *tcp_lookup(uint32_t laddr, uint16_t lport, uint32_t raddr, uint16_t rport)
+{
+    tcp_sock_t *listener = NULL;
+
+    for (tcp_sock_t *tp = tcp_hash[tcp_hashfn(lport)]; tp; tp = tp->hash_next) {
+        const socket_t *sock = tp->sock;
+        if (sock->local_port != lport || tp->state == TCP_CLOSED) {
+            continue;
+        }
+        if (tp->state == TCP_LISTEN) {
+            if (sock->local_addr == INADDR_ANY || sock->local_addr == laddr) {
+                listener = tp;
+            }
+            continue;
+        }
+        if (tp->remote_port == rport && tp->remote_addr == raddr && sock->local_addr == laddr) {
+            return tp;
+        }
+    }
+    return listener;
+}
+
+/**
+ * Is a port taken for an address?
+ *
+ * @param reuse SO_REUSEADDR: only a listener takes the port
+ */
+static int tcp_port_in_use(uint16_t port, uint32_t addr, int reuse)
+{
+    for (tcp_sock_t *tp = tcp_hash[tcp_hashfn(port)]; tp; tp = tp->hash_next) {
+        const socket_t *sock = tp->sock;
+        if (sock->local_port != port) {
+            continue;
+        }
+        if (reuse && tp->state != TCP_LISTEN) {
+            continue;
+        }
+        if (addr == INADDR_ANY || sock->local_addr == INADDR_ANY || sock->local_addr == addr) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Bind to a local address and port
+ */
+int tcp_bind(socket_t *sock, uint32_t addr, uint16_t port)
+{
+    int irq_state = interrupt_save_disable();
+
+    if (port == 0) {
+        uint32_t range = TCP_EPHEMERAL_LAST - TCP_EPHEMERAL_FIRST + 1;
+        for (uint32_t tries = 0; tries < range; tries++) {
+            uint16_t candidate = htons((uint16_t)tcp_next_port);
+            if (++tcp_next_port > TCP_EPHEMERAL_LAST) {
+                tcp_next_port = TCP_EPHEMERAL_FIRST;
+            }
+            if (!tcp_port_in_use(candidate, addr, 0)) {
+                port = candidate;
+                break;
+            }
+        }
+    } else if (tcp_port_in_use(port, addr, sock->reuseaddr)) {
+        port = 0;
+    }
+
+    if (port == 0) {
+        interrupt_restore(irq_state);
+        RETURN_ERRNO(THUNDEROS_EADDRINUSE);
+    }
+
+    sock->local_addr = addr;
+    sock->local_port = port;
+    tcp_hash_insert(sock->tcp);
+
+    interrupt_restore(irq_state);
+    return 0;
+}
+
+/*
+ * State
+ */
+
+void tcp_set_state(tcp_sock_t *tp, uint8_t state)
+{
+    tp->state = state;
+}
+
+void tcp_wake(tcp_sock_t *tp)
+{
+    wait_queue_wake(&tp->sock->wait_queue);
+}
+
+/**
+ * The connection is over: stop its timers, drop what is left to send
+ * and take it out of the table and its listener's list
+ *
+ * Data already received stays for the reader.
+ */
+void tcp_done(tcp_sock_t *tp)
+{
+    tcp_set_state(tp, TCP_CLOSED);
+    tp->shutdown = TCP_RCV_SHUTDOWN | TCP_SEND_SHUTDOWN;
+    ktimer_cancel(&tp->rtx_timer);
+    ktimer_cancel(&tp->delack_timer);
+
+    skb_queue_purge(&tp->write_queue);
+    skb_queue_purge(&tp->ooo_queue);
+    tp->send_head = NULL;
+    tp->num_sacks = 0;
+    tp->sacked_out = 0;
+    tp->lost_out = 0;
+    tp->retrans_out = 0;
+    tp->ack_pending = 0;
+
+    int irq_state = interrupt_save_disable();
+    int drop_hash = tp->hashed;
+    if (tp->hashed) {
+        tcp_unhash(tp);
+    }
+    tcp_sock_t *parent = tp->parent;
+    if (parent) {
+        tcp_sock_t **link = &parent->children;
+        while (*link && *link != tp) {
+            link = &(*link)->child_next;
+        }
+        if (*link) {
+            *link = tp->child_next;
+            parent->child_count--;
+        }
+        tp->child_next = NULL;
+        tp->parent = NULL;
+    }
+    interrupt_restore(irq_state);
+
+    tcp_wake(tp);
+    if (parent) {
+        /* Nobody accepted it: the list's reference was its only owner */
+        tcp_sock_put(tp);
+    }
+    if (drop_hash) {
+        tcp_sock_put(tp);
+    }
+}
+
+/**
+ * Arm the retransmission timer
+ */
+void tcp_reset_timer(tcp_sock_t *tp, uint32_t delay_us)
+{
+    uint64_t ticks = (delay_us + TIMER_INTERVAL_US - 1) / TIMER_INTERVAL_US;
+    if (ticks == 0) {
+        ticks = 1;
+    }
+    ktimer_add(&tp->rtx_timer, hal_timer_get_ticks() + ticks);
+}
+
+/*
+ * Ownership (see net/tcp.h)
+ */
+
+static void tcp_lock(tcp_sock_t *tp)
+{
+    mutex_lock(&tp->lock);
+    tp->owned = 1;
+}
+
+/**
+ * Process what arrived while owned, then let go
+ */
+static void tcp_unlock(tcp_sock_t *tp)
+{
+    int irq_state = interrupt_save_disable();
+    sk_buff_t *skb;
+    while ((skb = skb_dequeue(&tp->backlog)) != NULL) {
+        tcp_rcv(tp, skb);
+    }
+    tp->owned = 0;
+    interrupt_restore(irq_state);
+
+    mutex_unlock(&tp->lock);
+}
+
+/**
+ * Sleep until woken, letting go of the connection meanwhile
+ *
+ * @return 0, or the error that ended the wait
+ */
+static int tcp_wait(tcp_sock_t *tp, poll_waiter_t *pw, uint64_t deadline_us)
+{
+    if (poll_signal_pending()) {
+        return THUNDEROS_EINTR;
+    }
+    if (deadline_us && hal_timer_get_time_us() >= deadline_us) {
+        return THUNDEROS_EAGAIN;
+    }
+
+    tcp_unlock(tp);
+    poll_waiter_sleep(pw, deadline_us);
+    tcp_lock(tp);
+    return 0;
+}
+
+/*
+ * Timers: they fire in the timer interrupt and queue the work item,
+ * which owns the connection while it handles them
+ */
+
+static void tcp_work(work_t *work)
+{
+    tcp_sock_t *tp = (tcp_sock_t *)((uint8_t *)work - offsetof(tcp_sock_t, work));
+
+    tcp_lock(tp);
+
+    int irq_state = interrupt_save_disable();
+    uint32_t events = tp->events;
+    tp->events = 0;
+    interrupt_restore(irq_state);
+
+    if (tp->state != TCP_CLOSED) {
+        if (events & TCP_EV_RETRANSMIT) {
+            tcp_rtx_timeout(tp);
+        }
+        if ((events & TCP_EV_DELACK) && tp->ack_pending && tp->state != TCP_CLOSED) {
+            tcp_send_ack(tp);
+        }
+    }
+
+    tcp_unlock(tp);
+    tcp_sock_put(tp);
+}
+
+static void tcp_timer_event(tcp_sock_t *tp, ktimer_t *timer, uint32_t event)
+{
+    tp->events |= event;
+
+    if (!workqueue_running()) {
+        /* Too early for the worker (nothing runs TCP yet): look again later */
+        ktimer_add(timer, hal_timer_get_ticks() + 1);
+        return;
+    }
+    tp->refs++;
+    if (!queue_work(&tp->work)) {
+        tp->refs--;
+    }
+}
+
+static void tcp_rtx_timer_fn(void *data)
+{
+    tcp_sock_t *tp = data;
+    tcp_timer_event(tp, &tp->rtx_timer, TCP_EV_RETRANSMIT);
+}
+
+static void tcp_delack_timer_fn(void *data)
+{
+    tcp_sock_t *tp = data;
+    tcp_timer_event(tp, &tp->delack_timer, TCP_EV_DELACK);
+}
+
+/*
+ * Receive
+ */
+
+/**
+ * Handle a received TCP segment
+ */
+void tcp_rx(sk_buff_t *skb)
+{
+    const ip_header_t *iph = ip_hdr(skb);
+
+    if (skb_headlen(skb) < TCP_HLEN || !net_is_local_addr(iph->daddr)) {
+        goto bad;
+    }
+    tcp_header_t *th = (tcp_header_t *)skb->data;
+    uint32_t doff = (uint32_t)(th->doff >> 4) * 4;
+    if (doff < TCP_HLEN || doff > skb_headlen(skb)) {
+        goto bad;
+    }
+    /* The device, GRO or loopback may have vouched for the checksum already */
+    if (skb->ip_summed != SKB_CSUM_UNNECESSARY) {
+        uint32_t sum = tcp_pseudo_sum(iph->saddr, iph->daddr, skb->len);
+        if (net_csum_fold(net_csum_skb(skb, 0, skb->len, sum)) != 0) {
+            goto bad;
+        }
+    }
+
+    tcp_skb_cb_t *tcb = TCP_SKB_CB(skb);
+    tcb->seq = ntohl(th->seq);
+    tcb->end_seq = tcb->seq + (skb->len - doff) +
+                   ((th->flags & TCP_SYN) ? 1 : 0) + ((th->flags & TCP_FIN) ? 1 : 0);
+    tcb->sent_us = 0;
+    tcb->flags = th->flags;
+    tcb->sacked = 0;
+
+    skb_set_transport_header(skb, 0);
+    skb_pull(skb, doff);
+    g_net_stats.tcp_rx++;
+
+    tcp_sock_t *tp = tcp_lookup(iph->daddr, th->dest, iph->saddr, th->source);
+    if (!tp) {
+        tcp_send_reset(skb);
+        skb_free(skb);
+        return;
+    }
+
+    tcp_sock_hold(tp);
+    if (!tp->owned) {
+        tcp_rcv(tp, skb);
+    } else if (skb_queue_len(&tp->backlog) < TCP_BACKLOG_SEGS) {
+        skb_queue_tail(&tp->backlog, skb);
+    } else {
+        skb_free(skb);
+    }
+    tcp_sock_put(tp);
+    return;
+
+bad:
+    g_net_stats.tcp_rx_errors++;
+    skb_free(skb);
+}
+
+/*
+ * Connections
+ */
+
+/**
+ * Give a stream socket its connection state
+ */
+int tcp_sock_create(socket_t *sock)
+{
+    tcp_sock_t *tp = kmalloc(sizeof(tcp_sock_t));
+    if (!tp) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    kmemset(tp, 0, sizeof(tcp_sock_t));
+
+    tp->sock = sock;
+    tp->refs = 1;
+    tp->state = TCP_CLOSED;
+    tp->mss = TCP_MSS_DEFAULT;
+    tp->rcv_mss = TCP_MSS_DEFAULT;
+    tp->cwnd = TCP_INIT_CWND * TCP_MSS_DEFAULT;
+    tp->ssthresh = TCP_INFINITE_SSTHRESH;
+    tp->rto_us = TCP_RTO_INIT_US;
+    skb_queue_init(&tp->write_queue);
+    skb_queue_init(&tp->rcv_queue);
+    skb_queue_init(&tp->ooo_queue);
+    skb_queue_init(&tp->backlog);
+    ktimer_setup(&tp->rtx_timer, tcp_rtx_timer_fn, tp);
+    ktimer_setup(&tp->delack_timer, tcp_delack_timer_fn, tp);
+    work_init(&tp->work, tcp_work);
+    mutex_init(&tp->lock);
+
+    sock->tcp = tp;
+    sock->sndbuf = TCP_SNDBUF_DEFAULT;
+    sock->rcvbuf = TCP_RCVBUF_DEFAULT;
+    return 0;
+}
+
+/**
+ * A SYN for a listener: a new connection in SYN_RECV, on its list
+ * (interrupts off)
+ */
+tcp_sock_t *tcp_create_child(tcp_sock_t *listener, uint32_t local_addr, uint32_t remote_addr,
+                             uint16_t remote_port)
+{
+    socket_t *lsock = listener->sock;
+    socket_t *sock = socket_create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (!sock) {
+        /* errno already set by socket_create */
+        return NULL;
+    }
+    sock->local_addr = local_addr;
+    sock->local_port = lsock->local_port;
+    sock->sndbuf = lsock->sndbuf;
+    sock->rcvbuf = lsock->rcvbuf;
+    sock->reuseaddr = lsock->reuseaddr;
+
+    tcp_sock_t *tp = sock->tcp;
+    tp->nodelay = listener->nodelay;
+    tp->user_mss = listener->user_mss;
+    tp->remote_addr = remote_addr;
+    tp->remote_port = remote_port;
+    tp->iss = tcp_new_iss(local_addr, remote_addr, sock->local_port, remote_port);
+    tcp_set_state(tp, TCP_SYN_RECV);
+    tcp_hash_insert(tp);
+
+    /* The list holds the reference the socket will have once accepted */
+    tp->parent = listener;
+    tcp_sock_t **link = &listener->children;
+    while (*link) {
+        link = &(*link)->child_next;
+    }
+    *link = tp;
+    listener->child_count++;
+    return tp;
+}
+
+/**
+ * A connection on a listener's list is established: wake accept()
+ */
+void tcp_child_ready(tcp_sock_t *child)
+{
+    if (child->parent) {
+        tcp_wake(child->parent);
+    }
+}
+
+/**
+ * Open a connection
+ */
+int tcp_connect(socket_t *sock, const struct sockaddr_in *dest, int nonblock)
+{
+    tcp_sock_t *tp = sock->tcp;
+    int error = 0;
+
+    tcp_lock(tp);
+
+    if (tp->state == TCP_SYN_SENT) {
+        error = THUNDEROS_EALREADY;
+        goto out;
+    }
+    if (tp->state != TCP_CLOSED || skb_queue_len(&tp->rcv_queue) > 0) {
+        error = THUNDEROS_EISCONN;
+        goto out;
+    }
+    if (dest->sin_addr == INADDR_ANY || dest->sin_addr == INADDR_BROADCAST) {
+        error = THUNDEROS_EADDRNOTAVAIL;
+        goto out;
+    }
+    if (dest->sin_port == 0) {
+        error = THUNDEROS_ECONNREFUSED;
+        goto out;
+    }
+
+    if (sock->local_addr == INADDR_ANY) {
+        sock->local_addr = ip_select_source(dest->sin_addr);
+        if (sock->local_addr == INADDR_ANY) {
+            error = THUNDEROS_ENETDOWN;
+            goto out;
+        }
+    }
+    /* Bound by bind(), or a port of its own now (again, after a failure) */
+    if (!tp->hashed && tcp_bind(sock, sock->local_addr, sock->local_port) != 0) {
+        error = get_errno();
+        goto out;
+    }
+
+    tp->remote_addr = dest->sin_addr;
+    tp->remote_port = dest->sin_port;
+    tp->iss = tcp_new_iss(sock->local_addr, tp->remote_addr, sock->local_port, tp->remote_port);
+    tp->shutdown = 0;
+    tp->error = 0;
+    tp->fin_rcvd = 0;
+    tp->retransmits = 0;
+    tp->rto_us = TCP_RTO_INIT_US;
+    tp->srtt_us = 0;
+    tp->rcv_wscale = TCP_WSCALE;
+    tcp_set_state(tp, TCP_SYN_SENT);
+
+    if (tcp_send_syn(tp) != 0 && !tp->write_queue.next) {
+        error = get_errno();
+        tcp_done(tp);
+        goto out;
+    }
+    if (nonblock) {
+        error = THUNDEROS_EINPROGRESS;
+        goto out;
+    }
+
+    wait_queue_entry_t entry;
+    poll_waiter_t pw;
+    poll_waiter_init(&pw, &entry, 1);
+    poll_wait(&pw.pt, &sock->wait_queue);
+    while (tp->state == TCP_SYN_SENT && error == 0) {
+        error = tcp_wait(tp, &pw, 0);
+    }
+    poll_waiter_release(&pw);
+
+    if (error == 0 && tp->state == TCP_CLOSED) {
+        error = tp->error ? tp->error : THUNDEROS_ECONNREFUSED;
+        tp->error = 0;
+    }
+
+out:
+    tcp_unlock(tp);
+    if (error) {
+        RETURN_ERRNO(error);
+    }
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Accept connections
+ */
+int tcp_listen(socket_t *sock, int backlog)
+{
+    tcp_sock_t *tp = sock->tcp;
+    int error = 0;
+
+    if (backlog <= 0) {
+        backlog = TCP_BACKLOG_DEFAULT;
+    }
+    if (backlog > TCP_BACKLOG_MAX) {
+        backlog = TCP_BACKLOG_MAX;
+    }
+
+    tcp_lock(tp);
+
+    if (tp->state == TCP_LISTEN) {
+        tp->backlog_max = (uint32_t)backlog;
+        goto out;
+    }
+    if (tp->state != TCP_CLOSED || tp->remote_port) {
+        error = THUNDEROS_EINVAL;
+        goto out;
+    }
+    if (!tp->hashed && tcp_bind(sock, sock->local_addr, 0) != 0) {
+        error = get_errno();
+        goto out;
+    }
+
+    /* SO_REUSEADDR shares a port with connections, never with a listener */
+    int irq_state = interrupt_save_disable();
+    if (tcp_port_in_use(sock->local_port, sock->local_addr, 1)) {
+        error = THUNDEROS_EADDRINUSE;
+    } else {
+        tp->backlog_max = (uint32_t)backlog;
+        tcp_set_state(tp, TCP_LISTEN);
+    }
+    interrupt_restore(irq_state);
+
+out:
+    tcp_unlock(tp);
+    if (error) {
+        RETURN_ERRNO(error);
+    }
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Take the oldest established connection off a listener's list
+ */
+static tcp_sock_t *tcp_take_child(tcp_sock_t *tp)
+{
+    int irq_state = interrupt_save_disable();
+    tcp_sock_t **link = &tp->children;
+    while (*link && (*link)->state < TCP_ESTABLISHED) {
+        link = &(*link)->child_next;
+    }
+    tcp_sock_t *child = *link;
+    if (child) {
+        *link = child->child_next;
+        child->child_next = NULL;
+        child->parent = NULL;
+        tp->child_count--;
+    }
+    interrupt_restore(irq_state);
+    return child;
+}
+
+/**
+ * Take a connection off a listener
+ */
+socket_t *tcp_accept(socket_t *sock, int nonblock)
+{
+    tcp_sock_t *tp = sock->tcp;
+    tcp_sock_t *child = NULL;
+    int error = 0;
+
+    tcp_lock(tp);
+
+    wait_queue_entry_t entry;
+    poll_waiter_t pw;
+    poll_waiter_init(&pw, &entry, 1);
+    poll_wait(&pw.pt, &sock->wait_queue);
+
+    for (;;) {
+        if (tp->state != TCP_LISTEN) {
+            error = THUNDEROS_EINVAL;
+            break;
+        }
+        child = tcp_take_child(tp);
+        if (child) {
+            break;
+        }
+        if (nonblock) {
+            error = THUNDEROS_EAGAIN;
+            break;
+        }
+        error = tcp_wait(tp, &pw, 0);
+        if (error) {
+            break;
+        }
+    }
+
+    poll_waiter_release(&pw);
+    tcp_unlock(tp);
+
+    if (!child) {
+        RETURN_ERRNO_NULL(error);
+    }
+    clear_errno();
+    return child->sock;
+}
+
+/**
+ * Why a connection takes no more data, or 0 if it does
+ */
+static int tcp_send_error(tcp_sock_t *tp)
+{
+    if (tp->error) {
+        int error = tp->error;
+        tp->error = 0;
+        return error;
+    }
+    if (tp->shutdown & TCP_SEND_SHUTDOWN) {
+        return THUNDEROS_EPIPE;
+    }
+    switch (tp->state) {
+    case TCP_ESTABLISHED:
+    case TCP_CLOSE_WAIT:
+        return 0;
+    case TCP_CLOSED:
+        return tp->remote_port ? THUNDEROS_EPIPE : THUNDEROS_ENOTCONN;
+    case TCP_LISTEN:
+        return THUNDEROS_ENOTCONN;
+    default:
+        return THUNDEROS_EPIPE;
+    }
+}
+
+/**
+ * Queue data for sending
+ */
+int tcp_sendmsg(socket_t *sock, const vfs_iovec_t *iov, int iovcnt, int nonblock)
+{
+    tcp_sock_t *tp = sock->tcp;
+    uint64_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].len;
+    }
+
+    tcp_lock(tp);
+
+    wait_queue_entry_t entry;
+    poll_waiter_t pw;
+    poll_waiter_init(&pw, &entry, 1);
+    poll_wait(&pw.pt, &sock->wait_queue);
+
+    uint64_t copied = 0;
+    int error = 0;
+    int i = 0;
+    uint64_t iov_off = 0;
+
+    while (tp->state == TCP_SYN_SENT && !error) {
+        error = nonblock ? THUNDEROS_EAGAIN : tcp_wait(tp, &pw, 0);
+    }
+
+    while (!error && copied < total) {
+        error = tcp_send_error(tp);
+        if (error) {
+            break;
+        }
+
+        uint32_t queued = tp->write_seq - tp->snd_una;
+        if (queued >= sock->sndbuf) {
+            /* Send what we have while waiting for the peer to take it */
+            tcp_write_xmit(tp, 1);
+            if (nonblock) {
+                error = THUNDEROS_EAGAIN;
+                break;
+            }
+            error = tcp_wait(tp, &pw, 0);
+            continue;
+        }
+
+        /* Append to the last segment if it is unsent and short */
+        sk_buff_t *skb = tp->write_queue.prev;
+        if (!skb || !tp->send_head || skb->len >= tp->mss || skb_cloned(skb) ||
+            (TCP_SKB_CB(skb)->flags & TCP_FIN) || skb_shinfo(skb)->nr_frags >= SKB_MAX_FRAGS) {
+            skb = skb_alloc(SKB_DEFAULT_HEADROOM);
+            if (!skb) {
+                error = THUNDEROS_ENOBUFS;
+                break;
+            }
+            skb_reserve(skb, SKB_DEFAULT_HEADROOM);
+            tcp_skb_cb_t *tcb = TCP_SKB_CB(skb);
+            tcb->seq = tp->write_seq;
+            tcb->end_seq = tp->write_seq;
+            tcb->sent_us = 0;
+            tcb->flags = TCP_ACK;
+            tcb->sacked = 0;
+            skb_queue_tail(&tp->write_queue, skb);
+            if (!tp->send_head) {
+                tp->send_head = skb;
+            }
+        }
+
+        if (!tp->tx_page || tp->tx_page_off == PAGE_SIZE) {
+            if (tp->tx_page) {
+                put_page(tp->tx_page);
+            }
+            tp->tx_page = pmm_alloc_page();
+            tp->tx_page_off = 0;
+            if (!tp->tx_page) {
+                error = THUNDEROS_ENOBUFS;
+                break;
+            }
+        }
+
+        uint64_t n = total - copied;
+        if (n > tp->mss - skb->len) {
+            n = tp->mss - skb->len;
+        }
+        if (n > sock->sndbuf - queued) {
+            n = sock->sndbuf - queued;
+        }
+        if (n > PAGE_SIZE - tp->tx_page_off) {
+            n = PAGE_SIZE - tp->tx_page_off;
+        }
+        while (iov[i].len == iov_off) {
+            i++;
+            iov_off = 0;
+        }
+        if (n > iov[i].len - iov_off) {
+            n = iov[i].len - iov_off;
+        }
+
+        void *dst = (void *)(tp->tx_page + tp->tx_page_off);
+        if (copy_from_user(dst, (const uint8_t *)iov[i].base + iov_off, (size_t)n) != 0) {
+            error = THUNDEROS_EFAULT;
+            break;
+        }
+        /* The segment takes a reference; ours stays for the rest of the page */
+        get_page(tp->tx_page);
+        if (skb_add_frag(skb, tp->tx_page, tp->tx_page_off, (uint32_t)n) != 0) {
+            put_page(tp->tx_page);
+            error = THUNDEROS_ENOBUFS;
+            break;
+        }
+
+        tp->tx_page_off += (uint32_t)n;
+        TCP_SKB_CB(skb)->end_seq += (uint32_t)n;
+        tp->write_seq += (uint32_t)n;
+        copied += n;
+        iov_off += n;
+
+        if (skb->len >= tp->mss) {
+            tcp_write_xmit(tp, 0);
+        }
+    }
+
+    if (copied) {
+        sk_buff_t *tail = tp->write_queue.prev;
+        if (tail && tp->send_head) {
+            TCP_SKB_CB(tail)->flags |= TCP_PSH;
+        }
+        tcp_write_xmit(tp, 1);
+    }
+
+    poll_waiter_release(&pw);
+    tcp_unlock(tp);
+
+    if (copied) {
+        clear_errno();
+        return (int)copied;
+    }
+    if (error) {
+        RETURN_ERRNO(error);
+    }
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Receive data
+ */
+int tcp_recvmsg(socket_t *sock, const vfs_iovec_t *iov, int iovcnt, int nonblock,
+                uint64_t deadline_us)
+{
+    tcp_sock_t *tp = sock->tcp;
+    int error = 0;
+    int eof = 0;
+
+    tcp_lock(tp);
+
+    if (tp->state == TCP_LISTEN || (tp->state == TCP_CLOSED && !tp->remote_port)) {
+        tcp_unlock(tp);
+        RETURN_ERRNO(THUNDEROS_ENOTCONN);
+    }
+
+    wait_queue_entry_t entry;
+    poll_waiter_t pw;
+    poll_waiter_init(&pw, &entry, 1);
+    poll_wait(&pw.pt, &sock->wait_queue);
+
+    while (!tp->rcv_queue.next) {
+        if (tp->error) {
+            error = tp->error;
+            tp->error = 0;
+            break;
+        }
+        if (tp->fin_rcvd || (tp->shutdown & TCP_RCV_SHUTDOWN) || tp->state == TCP_CLOSED) {
+            eof = 1;
+            break;
+        }
+        if (nonblock) {
+            error = THUNDEROS_EAGAIN;
+            break;
+        }
+        error = tcp_wait(tp, &pw, deadline_us);
+        if (error) {
+            break;
+        }
+    }
+    poll_waiter_release(&pw);
+
+    uint64_t copied = 0;
+    int i = 0;
+    uint64_t iov_off = 0;
+    sk_buff_t *skb;
+    while (!error && !eof && i < iovcnt && (skb = tp->rcv_queue.next) != NULL) {
+        uint32_t off = tp->copied_seq - TCP_SKB_CB(skb)->seq;
+        if (off >= skb->len) {
+            /* Overlapped by the segment before it */
+            skb_free(skb_dequeue(&tp->rcv_queue));
+            continue;
+        }
+
+        uint64_t n = skb->len - off;
+        if (n > iov[i].len - iov_off) {
+            n = iov[i].len - iov_off;
+        }
+        if (n && socket_copy_to_user(skb, off, (uint8_t *)iov[i].base + iov_off, (uint32_t)n) != 0) {
+            error = THUNDEROS_EFAULT;
+            break;
+        }
+        tp->copied_seq += (uint32_t)n;
+        copied += n;
+        iov_off += n;
+        if (iov_off == iov[i].len) {
+            i++;
+            iov_off = 0;
+        }
+        if (off + n == skb->len) {
+            skb_free(skb_dequeue(&tp->rcv_queue));
+        }
+    }
+
+    if (copied) {
+        tcp_window_update(tp);
+    }
+    tcp_unlock(tp);
+
+    if (copied) {
+        clear_errno();
+        return (int)copied;
+    }
+    if (error) {
+        RETURN_ERRNO(error);
+    }
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Shut down one or both directions
+ */
+int tcp_shutdown(socket_t *sock, int how)
+{
+    tcp_sock_t *tp = sock->tcp;
+    int error = 0;
+
+    tcp_lock(tp);
+
+    if (tp->state == TCP_CLOSED || tp->state == TCP_LISTEN || tp->state == TCP_SYN_SENT) {
+        error = THUNDEROS_ENOTCONN;
+        goto out;
+    }
+
+    if (how == SHUT_RD || how == SHUT_RDWR) {
+        tp->shutdown |= TCP_RCV_SHUTDOWN;
+    }
+    if ((how == SHUT_WR || how == SHUT_RDWR) && !(tp->shutdown & TCP_SEND_SHUTDOWN)) {
+        tp->shutdown |= TCP_SEND_SHUTDOWN;
+        if (tp->state == TCP_ESTABLISHED) {
+            tcp_set_state(tp, TCP_FIN_WAIT1);
+            tcp_send_fin(tp);
+        } else if (tp->state == TCP_CLOSE_WAIT) {
+            tcp_set_state(tp, TCP_LAST_ACK);
+            tcp_send_fin(tp);
+        }
+    }
+    tcp_wake(tp);
+
+out:
+    tcp_unlock(tp);
+    if (error) {
+        RETURN_ERRNO(error);
+    }
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Reset the connections a closing listener never handed out
+ */
+static void tcp_close_children(tcp_sock_t *tp)
+{
+    for (;;) {
+        int irq_state = interrupt_save_disable();
+        tcp_sock_t *child = tp->children;
+        if (child) {
+            child->refs++;
+        }
+        interrupt_restore(irq_state);
+        if (!child) {
+            break;
+        }
+
+        tcp_lock(child);
+        if (child->state != TCP_CLOSED) {
+            tcp_send_active_reset(child);
+        }
+        tcp_done(child);
+        tcp_unlock(child);
+        tcp_sock_put(child);
+    }
+}
+
+/**
+ * Close a stream socket whose last reference went
+ */
+void tcp_close(socket_t *sock)
+{
+    tcp_sock_t *tp = sock->tcp;
+
+    tcp_lock(tp);
+    tp->orphan = 1;
+
+    switch (tp->state) {
+    case TCP_LISTEN:
+        tcp_set_state(tp, TCP_CLOSED);
+        tcp_close_children(tp);
+        tcp_done(tp);
+        break;
+    case TCP_CLOSED:
+    case TCP_SYN_SENT:
+        tcp_done(tp);
+        break;
+    default:
+        if (tp->rcv_queue.next && tp->copied_seq != tp->rcv_nxt) {
+            /* Unread data: the peer must not think it was taken (RFC 2525 2.17) */
+            tcp_send_active_reset(tp);
+            tcp_done(tp);
+        } else if (tp->state == TCP_ESTABLISHED || tp->state == TCP_SYN_RECV) {
+            tp->shutdown |= TCP_SEND_SHUTDOWN;
+            tcp_set_state(tp, TCP_FIN_WAIT1);
+            tcp_send_fin(tp);
+        } else if (tp->state == TCP_CLOSE_WAIT) {
+            tp->shutdown |= TCP_SEND_SHUTDOWN;
+            tcp_set_state(tp, TCP_LAST_ACK);
+            tcp_send_fin(tp);
+        } else if (tp->state == TCP_FIN_WAIT2) {
+            tcp_reset_timer(tp, TCP_FIN_TIMEOUT_US);
+        }
+        /* FIN_WAIT1, CLOSING, LAST_ACK and TIME_WAIT finish on their own */
+        break;
+    }
+
+    tcp_unlock(tp);
+    tcp_sock_put(tp);
+}
+
+/*
+ * Options and status
+ */
+
+int tcp_setsockopt(socket_t *sock, int name, int value)
+{
+    tcp_sock_t *tp = sock->tcp;
+    int error = 0;
+
+    tcp_lock(tp);
+    switch (name) {
+    case TCP_NODELAY:
+        tp->nodelay = value != 0;
+        if (tp->nodelay && tp->state >= TCP_ESTABLISHED) {
+            /* What Nagle was holding back goes now */
+            tcp_write_xmit(tp, 1);
+        }
+        break;
+    case TCP_MAXSEG:
+        if (value < 64 || value > TCP_MSS_ETH) {
+            error = THUNDEROS_EINVAL;
+        } else {
+            tp->user_mss = (uint16_t)value;
+        }
+        break;
+    default:
+        error = THUNDEROS_ENOPROTOOPT;
+        break;
+    }
+    tcp_unlock(tp);
+
+    if (error) {
+        RETURN_ERRNO(error);
+    }
+    clear_errno();
+    return 0;
+}
+
+int tcp_getsockopt(socket_t *sock, int name, int *value)
+{
+    tcp_sock_t *tp = sock->tcp;
+
+    switch (name) {
+    case TCP_NODELAY:
+        *value = tp->nodelay;
+        break;
+    case TCP_MAXSEG:
+        if (tp->state >= TCP_ESTABLISHED) {
+            *value = tp->mss;
+        } else {
+            *value = tp->user_mss ? tp->user_mss : TCP_MSS_DEFAULT;
+        }
+        break;
+    default:
+        RETURN_ERRNO(THUNDEROS_ENOPROTOOPT);
+    }
+    clear_errno();
+    return 0;
+}
+
+int tcp_take_error(socket_t *sock)
+{
+    tcp_sock_t *tp = sock->tcp;
+    int irq_state = interrupt_save_disable();
+    int error = tp->error;
+    tp->error = 0;
+    interrupt_restore(irq_state);
+    return error;
+}
+
+int tcp_getpeer(socket_t *sock, struct sockaddr_in *addr)
+{
+    tcp_sock_t *tp = sock->tcp;
+    if (tp->state < TCP_ESTABLISHED) {
+        RETURN_ERRNO(THUNDEROS_ENOTCONN);
+    }
+    kmemset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = tp->remote_port;
+    addr->sin_addr = tp->remote_addr;
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Readiness of a stream socket
+ */
+int tcp_poll(socket_t *sock, poll_table_t *pt)
+{
+    tcp_sock_t *tp = sock->tcp;
+    int mask = 0;
+
+    poll_wait(pt, &sock->wait_queue);
+
+    int irq_state = interrupt_save_disable();
+    if (tp->state == TCP_LISTEN) {
+        for (tcp_sock_t *child = tp->children; child; child = child->child_next) {
+            if (child->state >= TCP_ESTABLISHED) {
+                mask |= POLLIN;
+                break;
+            }
+        }
+    } else {
+        int connected = tp->state >= TCP_ESTABLISHED;
+        int gone = tp->state == TCP_CLOSED && tp->remote_port;
+
+        if (tp->rcv_queue.next || tp->fin_rcvd || (tp->shutdown & TCP_RCV_SHUTDOWN) || gone) {
+            mask |= POLLIN;
+        }
+        if (connected && !(tp->shutdown & TCP_SEND_SHUTDOWN) &&
+            tp->write_seq - tp->snd_una < sock->sndbuf) {
+            mask |= POLLOUT;
+        }
+        if (tp->error) {
+            mask |= POLLERR;
+        }
+        /* A connect that failed is done too: POLLOUT, then SO_ERROR says how */
+        if (gone) {
+            mask |= POLLOUT | POLLHUP;
+        }
+    }
+    interrupt_restore(irq_state);
+    return mask;
+}
@@ -0,0 +1,969 @@
+/**
+ * TCP Input
+ *
+ * The state machine of RFC 9293 3.10.7 for one segment, with the ACK
+ * side of congestion control: the SACK scoreboard on the write queue,
+ * round-trip sampling, and NewReno fast recovery. Received data goes on
+ * the receive queue in order, or on the out-of-order queue until the
+ * hole in front of it is filled.
+ */
+
+#include "net/tcp.h"
+#include "hal/hal_timer.h"
+#include "kernel/config.h"
+#include "kernel/kstring.h"
+#include "kernel/errno.h"
+
+/**
+ * Options of a received segment
+ */
+typedef struct {
+    uint16_t mss;               // 0 if absent
+    uint8_t wscale_ok;
+    uint8_t wscale;
+    uint8_t sack_ok;
+    uint8_t num_sacks;
+    tcp_sack_block_t sacks[TCP_MAX_SACKS];
+} tcp_options_t;
+
+static uint16_t tcp_get16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t tcp_get32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void tcp_parse_options(const tcp_header_t *th, tcp_options_t *opt)
+{
+    kmemset(opt, 0, sizeof(*opt));
+
+    const uint8_t *p = (const uint8_t *)th + TCP_HLEN;
+    uint32_t len = (uint32_t)(th->doff >> 4) * 4 - TCP_HLEN;
+    int syn = th->flags & TCP_SYN;
+
+    while (len > 0) {
+        uint8_t kind = p[0];
+        if (kind == TCPOPT_EOL) {
+            break;
+        }
+        if (kind == TCPOPT_NOP) {
+            p++;
+            len--;
+            continue;
+        }
+        if (len < 2 || p[1] < 2 || p[1] > len) {
+            break;
+        }
+        uint8_t olen = p[1];
+
+        switch (kind) {
+        case TCPOPT_MSS:
+            if (syn && olen == 4) {
+                opt->mss = tcp_get16(p + 2);
+            }
+            break;
+        case TCPOPT_WSCALE:
+            if (syn && olen == 3) {
+                opt->wscale_ok = 1;
+                opt->wscale = p[2] > 14 ? 14 : p[2];
+            }
+            break;
+        case TCPOPT_SACK_PERM:
+            if (syn && olen == 2) {
+                opt->sack_ok = 1;
+            }
+            break;
+        case TCPOPT_SACK:
+            if (olen >= 10 && (olen - 2) % 8 == 0) {
+                uint32_t n = (uint32_t)(olen - 2) / 8;
+                for (uint32_t i = 0; i < n && opt->num_sacks < TCP_MAX_SACKS; i++) {
+                    tcp_sack_block_t *b = &opt->sacks[opt->num_sacks++];
+                    b->start = tcp_get32(p + 2 + 8 * i);
+                    b->end = tcp_get32(p + 6 + 8 * i);
+                }
+            }
+            break;
+        }
+        p += olen;
+        len -= olen;
+    }
+}
+
+/**
+ * Bytes in the network: sent, less what the peer has (SACKed) or what
+ * is lost, plus what was sent again (RFC 6675 "pipe")
+ */
+uint32_t tcp_in_flight(const tcp_sock_t *tp)
+{
+    uint32_t out = tp->snd_nxt - tp->snd_una + tp->retrans_out;
+    uint32_t left = tp->sacked_out + tp->lost_out;
+    if (!tp->sack_ok) {
+        /* Without SACK each duplicate ACK is a segment that left */
+        left += tp->dupacks * tp->mss;
+    }
+    return out > left ? out - left : 0;
+}
+
+static inline uint32_t tcp_skb_seqlen(const sk_buff_t *skb)
+{
+    return TCP_SKB_CB(skb)->end_seq - TCP_SKB_CB(skb)->seq;
+}
+
+/**
+ * Take a segment's marks out of the scoreboard counts
+ */
+static void tcp_skb_unmark(tcp_sock_t *tp, sk_buff_t *skb)
+{
+    tcp_skb_cb_t *tcb = TCP_SKB_CB(skb);
+    uint32_t len = tcp_skb_seqlen(skb);
+
+    if (tcb->sacked & TCPCB_SACKED) {
+        tp->sacked_out -= len;
+    } else if (tcb->sacked & TCPCB_LOST) {
+        tp->lost_out -= len;
+        if (tcb->sacked & TCPCB_RETRANS) {
+            tp->retrans_out -= len;
+        }
+    }
+    tcb->sacked &= TCPCB_RETRANS;
+}
+
+/**
+ * Fold a round-trip sample into the estimates (RFC 6298 2)
+ */
+static void tcp_rtt_estimator(tcp_sock_t *tp, uint32_t m)
+{
+    if (m == 0) {
+        m = 1;
+    }
+    if (tp->srtt_us == 0) {
+        tp->srtt_us = m;
+        tp->rttvar_us = m / 2;
+    } else {
+        uint32_t delta = m > tp->srtt_us ? m - tp->srtt_us : tp->srtt_us - m;
+        tp->rttvar_us = (3 * tp->rttvar_us + delta) / 4;
+        tp->srtt_us = (7 * tp->srtt_us + m) / 8;
+    }
+
+    /* The variance term is at least the timer's granularity */
+    uint32_t var = 4 * tp->rttvar_us;
+    if (var < TIMER_INTERVAL_US) {
+        var = TIMER_INTERVAL_US;
+    }
+    uint32_t rto = tp->srtt_us + var;
+    if (rto < TCP_RTO_MIN_US) {
+        rto = TCP_RTO_MIN_US;
+    }
+    if (rto > TCP_RTO_MAX_US) {
+        rto = TCP_RTO_MAX_US;
+    }
+    tp->rto_us = rto;
+}
+
+/**
+ * Free the segments an ACK covers, and sample the round trip
+ *
+ * Only a segment sent once gives a sample (Karn's algorithm).
+ */
+static void tcp_clean_rtx_queue(tcp_sock_t *tp, uint32_t ack)
+{
+    uint64_t sent_us = 0;
+    sk_buff_t *skb;
+
+    while ((skb = tp->write_queue.next) != NULL && skb != tp->send_head) {
+        tcp_skb_cb_t *tcb = TCP_SKB_CB(skb);
+        if (tcp_after(tcb->end_seq, ack)) {
+            break;
+        }
+        if (!(tcb->sacked & TCPCB_RETRANS)) {
+            sent_us = tcb->sent_us;
+        }
+        tcp_skb_unmark(tp, skb);
+        skb_unlink(&tp->write_queue, skb);
+        skb_free(skb);
+    }
+
+    if (sent_us) {
+        tcp_rtt_estimator(tp, (uint32_t)(hal_timer_get_time_us() - sent_us));
+    }
+}
+
+/**
+ * Mark what the SACK blocks cover
+ */
+static void tcp_sacktag(tcp_sock_t *tp, const tcp_options_t *opt)
+{
+    for (uint32_t i = 0; i < opt->num_sacks; i++) {
+        uint32_t start = opt->sacks[i].start;
+        uint32_t end = opt->sacks[i].end;
+
+        /* Only blocks inside what is outstanding mean anything */
+        if (!tcp_before(start, end) || !tcp_after(start, tp->snd_una) ||
+            tcp_after(end, tp->snd_nxt)) {
+            continue;
+        }
+
+        for (sk_buff_t *skb = tp->write_queue.next; skb && skb != tp->send_head;
+             skb = skb->next) {
+            tcp_skb_cb_t *tcb = TCP_SKB_CB(skb);
+            if (!tcp_before(tcb->seq, end)) {
+                break;
+            }
+            if (tcp_before(tcb->seq, start) || tcp_after(tcb->end_seq, end) ||
+                (tcb->sacked & TCPCB_SACKED)) {
+                continue;
+            }
+
+            tcp_skb_unmark(tp, skb);
+            tcb->sacked |= TCPCB_SACKED;
+            tp->sacked_out += tcp_skb_seqlen(skb);
+            if (tcp_after(tcb->end_seq, tp->high_sacked)) {
+                tp->high_sacked = tcb->end_seq;
+            }
+        }
+    }
+}
+
+/**
+ * Mark segments lost: with SACK, the holes below the highest SACKed
+ * segment; without, the first unacknowledged segment
+ */
+static void tcp_mark_lost(tcp_sock_t *tp)
+{
+    for (sk_buff_t *skb = tp->write_queue.next; skb && skb != tp->send_head; skb = skb->next) {
+        tcp_skb_cb_t *tcb = TCP_SKB_CB(skb);
+        if (tp->sack_ok && !tcp_before(tcb->seq, tp->high_sacked)) {
+            break;
+        }
+        if (!(tcb->sacked & (TCPCB_SACKED | TCPCB_LOST))) {
+            tcb->sacked = (uint8_t)((tcb->sacked & ~TCPCB_RETRANS) | TCPCB_LOST);
+            tp->lost_out += tcp_skb_seqlen(skb);
+        }
+        if (!tp->sack_ok) {
+            break;
+        }
+    }
+}
+
+/**
+ * Send the first lost segment again now, whatever the window says
+ * (RFC 5681 3.2 step 2)
+ */
+static void tcp_retransmit_head(tcp_sock_t *tp)
+{
+    sk_buff_t *skb = tp->write_queue.next;
+    if (skb && skb != tp->send_head &&
+        (TCP_SKB_CB(skb)->sacked & (TCPCB_LOST | TCPCB_RETRANS)) == TCPCB_LOST) {
+        tcp_retransmit_skb(tp, skb);
+    }
+}
+
+/**
+ * Grow the congestion window for newly acknowledged bytes (RFC 5681 3.1,
+ * with appropriate byte counting, RFC 3465)
+ */
+static void tcp_cong_avoid(tcp_sock_t *tp, uint32_t acked)
+{
+    /* Only a window that is being used is known to be right */
+    if (!tp->cwnd_limited) {
+        return;
+    }
+
+    if (tp->cwnd < tp->ssthresh) {
+        uint32_t limit = 2 * (uint32_t)tp->mss;
+        tp->cwnd += acked < limit ? acked : limit;
+    } else {
+        tp->bytes_acked += acked;
+        if (tp->bytes_acked >= tp->cwnd) {
+            tp->bytes_acked -= tp->cwnd;
+            tp->cwnd += tp->mss;
+        }
+    }
+}
+
+static void tcp_enter_recovery(tcp_sock_t *tp)
+{
+    uint32_t flight = tp->snd_nxt - tp->snd_una;
+    uint32_t floor = 2 * (uint32_t)tp->mss;
+
+    tp->ssthresh = flight / 2 > floor ? flight / 2 : floor;
+    tp->cwnd = tp->ssthresh;
+    tp->bytes_acked = 0;
+    tp->recover = tp->snd_nxt;
+    tp->ca_state = TCP_CA_RECOVERY;
+    g_net_stats.tcp_fast_retransmits++;
+
+    tcp_mark_lost(tp);
+    tcp_retransmit_head(tp);
+}
+
+/**
+ * Congestion control for one ACK
+ *
+ * @param acked Bytes newly acknowledged
+ * @param dupack The ACK repeats snd_una with nothing else in it
+ */
+static void tcp_cong_control(tcp_sock_t *tp, uint32_t acked, int dupack)
+{
+    switch (tp->ca_state) {
+    case TCP_CA_OPEN:
+        if (acked) {
+            tp->dupacks = 0;
+            tcp_cong_avoid(tp, acked);
+        } else if (dupack) {
+            tp->dupacks++;
+        }
+        if (tp->dupacks >= TCP_DUPACK_THRESH ||
+            tp->sacked_out >= TCP_DUPACK_THRESH * (uint32_t)tp->mss) {
+            tcp_enter_recovery(tp);
+        }
+        break;
+
+    case TCP_CA_RECOVERY:
+        if (!tcp_before(tp->snd_una, tp->recover)) {
+            /* All that was out when the loss was seen is acknowledged */
+            tp->cwnd = tp->ssthresh;
+            tp->dupacks = 0;
+            tp->ca_state = TCP_CA_OPEN;
+            break;
+        }
+        if (acked) {
+            /* Partial ACK (RFC 6582): the next hole is lost too */
+            tp->dupacks = 0;
+            tcp_mark_lost(tp);
+            tcp_retransmit_head(tp);
+        } else if (dupack) {
+            tp->dupacks++;
+            if (tp->sack_ok) {
+                tcp_mark_lost(tp);
+            }
+        }
+        break;
+
+    case TCP_CA_LOSS:
+        if (!tcp_before(tp->snd_una, tp->recover)) {
+            tp->dupacks = 0;
+            tp->ca_state = TCP_CA_OPEN;
+        }
+        if (acked) {
+            tcp_cong_avoid(tp, acked);
+        }
+        break;
+    }
+
+    if (tp->ca_state != TCP_CA_OPEN) {
+        tcp_xmit_retransmit_queue(tp);
+    }
+}
+
+/**
+ * Process the ACK field of a segment
+ *
+ * @return 0 if processed (or old and ignored), -1 if it acknowledges
+ *         something not sent yet
+ */
+static int tcp_ack(tcp_sock_t *tp, const sk_buff_t *skb, const tcp_options_t *opt)
+{
+    const tcp_header_t *th = tcp_hdr(skb);
+    const tcp_skb_cb_t *tcb = TCP_SKB_CB(skb);
+    uint32_t ack = ntohl(th->ack_seq);
+
+    if (tcp_after(ack, tp->snd_nxt)) {
+        return -1;
+    }
+    if (tcp_before(ack, tp->snd_una)) {
+        return 0;
+    }
+
+    /* Window updates from the newest segment only (RFC 9293 3.10.7.4) */
+    int window_changed = 0;
+    if (tcp_before(tp->snd_wl1, tcb->seq) ||
+        (tp->snd_wl1 == tcb->seq && !tcp_before(ack, tp->snd_wl2))) {
+        uint32_t wnd = (uint32_t)ntohs(th->window) << tp->snd_wscale;
+        window_changed = wnd != tp->snd_wnd;
+        tp->snd_wnd = wnd;
+        tp->snd_wl1 = tcb->seq;
+        tp->snd_wl2 = ack;
+    }
+
+    if (tp->sack_ok && opt->num_sacks) {
+        tcp_sacktag(tp, opt);
+    }
+
+    uint32_t acked = ack - tp->snd_una;
+    int dupack = 0;
+    if (acked) {
+        tcp_clean_rtx_queue(tp, ack);
+        tp->snd_una = ack;
+        tp->retransmits = 0;
+        if (tcp_before(tp->high_sacked, ack)) {
+            tp->high_sacked = ack;
+        }
+
+        if (tp->snd_una == tp->snd_nxt) {
+            ktimer_cancel(&tp->rtx_timer);
+        } else {
+            tcp_reset_timer(tp, tp->rto_us);
+        }
+        tcp_wake(tp);
+    } else {
+        dupack = skb->len == 0 && !window_changed && tp->snd_una != tp->snd_nxt &&
+                 !(th->flags & (TCP_SYN | TCP_FIN));
+    }
+
+    tcp_cong_control(tp, acked, dupack);
+    return 0;
+}
+
+/**
+ * Rebuild the SACK blocks from the out-of-order queue
+ *
+ * @param recent A sequence number just received, whose block goes first
+ *               (RFC 2018 4), or any if have_recent is 0
+ */
+static void tcp_sack_rebuild(tcp_sock_t *tp, uint32_t recent, int have_recent)
+{
+    tp->num_sacks = 0;
+    if (!tp->sack_ok) {
+        return;
+    }
+
+    uint32_t start = 0;
+    uint32_t end = 0;
+    int open = 0;
+    for (sk_buff_t *skb = tp->ooo_queue.next;; skb = skb->next) {
+        if (skb && open && !tcp_after(TCP_SKB_CB(skb)->seq, end)) {
+            if (tcp_after(TCP_SKB_CB(skb)->end_seq, end)) {
+                end = TCP_SKB_CB(skb)->end_seq;
+            }
+            continue;
+        }
+
+        if (open) {
+            tcp_sack_block_t block = { start, end };
+            if (have_recent && !tcp_before(recent, start) && tcp_before(recent, end)) {
+                uint32_t n = tp->num_sacks < TCP_MAX_SACKS ? tp->num_sacks : TCP_MAX_SACKS - 1;
+                for (uint32_t i = n; i > 0; i--) {
+                    tp->sacks[i] = tp->sacks[i - 1];
+                }
+                tp->sacks[0] = block;
+                tp->num_sacks = (uint8_t)(n + 1);
+            } else if (tp->num_sacks < TCP_MAX_SACKS) {
+                tp->sacks[tp->num_sacks++] = block;
+            }
+        }
+        if (!skb) {
+            break;
+        }
+        start = TCP_SKB_CB(skb)->seq;
+        end = TCP_SKB_CB(skb)->end_seq;
+        open = 1;
+    }
+}
+
+static void tcp_enter_time_wait(tcp_sock_t *tp)
+{
+    tcp_set_state(tp, TCP_TIME_WAIT);
+    ktimer_cancel(&tp->delack_timer);
+    tcp_reset_timer(tp, TCP_TIMEWAIT_US);
+}
+
+/**
+ * The peer's FIN is in sequence
+ */
+static void tcp_fin(tcp_sock_t *tp)
+{
+    tp->fin_rcvd = 1;
+
+    switch (tp->state) {
+    case TCP_SYN_RECV:
+    case TCP_ESTABLISHED:
+        tcp_set_state(tp, TCP_CLOSE_WAIT);
+        break;
+    case TCP_FIN_WAIT1:
+        /* Our FIN is not acknowledged yet (or we would be in FIN_WAIT2) */
+        tcp_set_state(tp, TCP_CLOSING);
+        break;
+    case TCP_FIN_WAIT2:
+        tcp_enter_time_wait(tp);
+        break;
+    }
+    tcp_wake(tp);
+}
+
+/**
+ * Append an in-order segment to the receive queue
+ */
+static void tcp_queue_rcv(tcp_sock_t *tp, sk_buff_t *skb)
+{
+    const tcp_skb_cb_t *tcb = TCP_SKB_CB(skb);
+    int fin = tcb->flags & TCP_FIN;
+
+    tp->rcv_nxt = tcb->end_seq;
+    if (skb->len) {
+        skb_queue_tail(&tp->rcv_queue, skb);
+    } else {
+        skb_free(skb);
+    }
+    if (fin) {
+        tcp_fin(tp);
+    }
+}
+
+/**
+ * Queue received data, and acknowledge it now or later
+ */
+static void tcp_data_queue(tcp_sock_t *tp, sk_buff_t *skb)
+{
+    tcp_skb_cb_t *tcb = TCP_SKB_CB(skb);
+
+    if (!tcp_after(tcb->end_seq, tp->rcv_nxt)) {
+        /* All of it is old: the peer missed our ACK */
+        skb_free(skb);
+        tcp_send_ack(tp);
+        return;
+    }
+    /* Nothing may land beyond the window offered (the reader's buffer) */
+    if (tcp_after(tcb->end_seq - (tcb->flags & TCP_FIN ? 1 : 0), tp->rcv_nxt + tcp_receive_space(tp))) {
+        skb_free(skb);
+        tcp_send_ack(tp);
+        return;
+    }
+
+    /* A merged packet says how big the segments it came from were */
+    uint32_t seg_len = skb->gso_size ? skb->gso_size : skb->len;
+    if (seg_len > tp->rcv_mss) {
+        tp->rcv_mss = (uint16_t)(seg_len < 65535 ? seg_len : 65535);
+    }
+
+    if (tcp_after(tcb->seq, tp->rcv_nxt)) {
+        /* Out of order: keep it sorted, and say what we have (RFC 2018) */
+        sk_buff_t *prev = NULL;
+        for (sk_buff_t *o = tp->ooo_queue.next; o; o = o->next) {
+            if (tcp_after(TCP_SKB_CB(o)->seq, tcb->seq)) {
+                break;
+            }
+            prev = o;
+        }
+        if (prev && !tcp_after(tcb->end_seq, TCP_SKB_CB(prev)->end_seq)) {
+            skb_free(skb);
+        } else {
+            skb_insert_after(&tp->ooo_queue, prev, skb);
+            g_net_stats.tcp_ooo++;
+        }
+        tcp_sack_rebuild(tp, tcb->seq, 1);
+        tcp_send_ack(tp);
+        return;
+    }
+
+    int filled_hole = skb_queue_len(&tp->ooo_queue) > 0;
+    tp->unacked_bytes += skb->len;
+    tcp_queue_rcv(tp, skb);
+
+    /* What was waiting behind the hole may follow now */
+    sk_buff_t *o;
+    while (!tp->fin_rcvd && (o = tp->ooo_queue.next) != NULL &&
+           !tcp_after(TCP_SKB_CB(o)->seq, tp->rcv_nxt)) {
+        skb_unlink(&tp->ooo_queue, o);
+        if (!tcp_after(TCP_SKB_CB(o)->end_seq, tp->rcv_nxt)) {
+            skb_free(o);
+            continue;
+        }
+        tp->unacked_bytes += o->len;
+        tcp_queue_rcv(tp, o);
+    }
+    if (filled_hole) {
+        tcp_sack_rebuild(tp, 0, 0);
+    }
+    tcp_wake(tp);
+
+    /* Every second full segment at once, the rest after a delay (RFC 9293 3.8.6.3) */
+    if (filled_hole || tp->fin_rcvd || tp->unacked_bytes >= 2 * (uint32_t)tp->rcv_mss) {
+        tcp_send_ack(tp);
+    } else {
+        tcp_send_delayed_ack(tp);
+        g_net_stats.tcp_delayed_acks++;
+    }
+}
+
+/**
+ * Is a segment inside the receive window (RFC 9293 3.10.7.4)?
+ */
+static int tcp_sequence_ok(const tcp_sock_t *tp, uint32_t seq, uint32_t end_seq)
+{
+    uint32_t wnd = tp->rcv_wup + tp->rcv_wnd - tp->rcv_nxt;
+    if (tcp_before(tp->rcv_wup + tp->rcv_wnd, tp->rcv_nxt)) {
+        wnd = 0;
+    }
+
+    if (seq == end_seq || wnd == 0) {
+        if (wnd == 0) {
+            return seq == tp->rcv_nxt;
+        }
+        return !tcp_before(seq, tp->rcv_nxt) && tcp_before(seq, tp->rcv_nxt + wnd);
+    }
+    /* Either end inside the window will do */
+    return (!tcp_before(seq, tp->rcv_nxt) && tcp_before(seq, tp->rcv_nxt + wnd)) ||
+           (tcp_after(end_seq, tp->rcv_nxt) && !tcp_after(end_seq, tp->rcv_nxt + wnd));
+}
+
+/**
+ * Take the negotiated options from a SYN
+ */
+static void tcp_syn_negotiate(tcp_sock_t *tp, const tcp_header_t *th, const tcp_options_t *opt)
+{
+    uint32_t mss = opt->mss ? opt->mss : TCP_MSS_DEFAULT;
+    if (mss > TCP_MSS_ETH) {
+        mss = TCP_MSS_ETH;
+    }
+    if (tp->user_mss && mss > tp->user_mss) {
+        mss = tp->user_mss;
+    }
+    if (mss < 64) {
+        mss = 64;
+    }
+    tp->mss = (uint16_t)mss;
+    tp->rcv_mss = (uint16_t)mss;
+    tp->cwnd = TCP_INIT_CWND * mss;
+
+    tp->sack_ok = opt->sack_ok;
+    if (opt->wscale_ok) {
+        tp->snd_wscale = opt->wscale;
+        tp->rcv_wscale = TCP_WSCALE;
+    } else {
+        tp->snd_wscale = 0;
+        tp->rcv_wscale = 0;
+    }
+
+    tp->irs = ntohl(th->seq);
+    tp->rcv_nxt = tp->irs + 1;
+    tp->copied_seq = tp->rcv_nxt;
+    tp->rcv_wup = tp->rcv_nxt;
+    /* The window in a SYN is never scaled */
+    tp->snd_wnd = ntohs(th->window);
+    tp->snd_wl1 = tp->irs;
+}
+
+/**
+ * A segment for a listener: a SYN makes a connection in SYN_RECV
+ */
+static void tcp_rcv_listen(tcp_sock_t *tp, sk_buff_t *skb, const tcp_options_t *opt)
+{
+    const tcp_header_t *th = tcp_hdr(skb);
+    const ip_header_t *iph = ip_hdr(skb);
+
+    if (th->flags & TCP_RST) {
+        goto drop;
+    }
+    if (th->flags & TCP_ACK) {
+        tcp_send_reset(skb);
+        goto drop;
+    }
+    if (!(th->flags & TCP_SYN)) {
+        goto drop;
+    }
+    /* A full backlog drops the SYN; the peer sends it again later */
+    if (tp->child_count >= tp->backlog_max) {
+        goto drop;
+    }
+
+    tcp_sock_t *child = tcp_create_child(tp, iph->daddr, iph->saddr, th->source);
+    if (!child) {
+        goto drop;
+    }
+    tcp_syn_negotiate(child, th, opt);
+    if (tcp_send_syn(child) != 0 && !child->write_queue.next) {
+        /* Not even queued, so no timer will send it */
+        tcp_done(child);
+    }
+
+drop:
+    skb_free(skb);
+}
+
+/**
+ * A segment in SYN_SENT: the SYN-ACK completes the connection
+ */
+static void tcp_rcv_syn_sent(tcp_sock_t *tp, sk_buff_t *skb, const tcp_options_t *opt)
+{
+    const tcp_header_t *th = tcp_hdr(skb);
+    uint32_t ack = ntohl(th->ack_seq);
+
+    if ((th->flags & TCP_ACK) && ack != tp->snd_nxt) {
+        tcp_send_reset(skb);
+        goto drop;
+    }
+    if (th->flags & TCP_RST) {
+        if (th->flags & TCP_ACK) {
+            tp->error = THUNDEROS_ECONNREFUSED;
+            tcp_done(tp);
+        }
+        goto drop;
+    }
+    /* No simultaneous open: a bare SYN waits for our SYN to be answered */
+    if ((th->flags & (TCP_SYN | TCP_ACK)) != (TCP_SYN | TCP_ACK)) {
+        goto drop;
+    }
+
+    tcp_syn_negotiate(tp, th, opt);
+    tp->snd_wl2 = ack;
+    tcp_clean_rtx_queue(tp, ack);
+    tp->snd_una = ack;
+    tp->retransmits = 0;
+    ktimer_cancel(&tp->rtx_timer);
+
+    tcp_set_state(tp, TCP_ESTABLISHED);
+    tcp_send_ack(tp);
+    tcp_wake(tp);
+
+drop:
+    skb_free(skb);
+}
+
+/**
+ * Reset received: the connection is gone
+ */
+static void tcp_reset(tcp_sock_t *tp)
+{
+    tp->error = tp->state == TCP_CLOSE_WAIT ? THUNDEROS_EPIPE : THUNDEROS_ECONNRESET;
+    skb_queue_purge(&tp->rcv_queue);
+    tcp_done(tp);
+}
+
+/**
+ * Process one segment for a connection (interrupts off, not owned)
+ *
+ * @param skb Segment, header pulled, TCP_SKB_CB() filled in; consumed
+ */
+void tcp_rcv(tcp_sock_t *tp, sk_buff_t *skb)
+{
+    const tcp_header_t *th = tcp_hdr(skb);
+    tcp_skb_cb_t *tcb = TCP_SKB_CB(skb);
+    uint8_t flags = th->flags;
+
+    tcp_options_t opt;
+    tcp_parse_options(th, &opt);
+
+    switch (tp->state) {
+    case TCP_CLOSED:
+        tcp_send_reset(skb);
+        skb_free(skb);
+        return;
+    case TCP_LISTEN:
+        tcp_rcv_listen(tp, skb, &opt);
+        return;
+    case TCP_SYN_SENT:
+        tcp_rcv_syn_sent(tp, skb, &opt);
+        return;
+    case TCP_TIME_WAIT:
+        /* Only a FIN sent again needs an answer, and a fresh 2 MSL */
+        if (flags & TCP_RST) {
+            tcp_done(tp);
+        } else if (flags & TCP_FIN) {
+            tcp_send_ack(tp);
+            tcp_reset_timer(tp, TCP_TIMEWAIT_US);
+        }
+        skb_free(skb);
+        return;
+    }
+
+    /* Our SYN-ACK was lost: the peer sends its SYN again */
+    if (tp->state == TCP_SYN_RECV && (flags & TCP_SYN) && ntohl(th->seq) == tp->irs) {
+        if (tp->write_queue.next) {
+            tcp_retransmit_skb(tp, tp->write_queue.next);
+        }
+        skb_free(skb);
+        return;
+    }
+
+    if (!tcp_sequence_ok(tp, tcb->seq, tcb->end_seq)) {
+        if (!(flags & TCP_RST)) {
+            tcp_send_ack(tp);
+        }
+        skb_free(skb);
+        return;
+    }
+    if (flags & TCP_RST) {
+        tcp_reset(tp);
+        skb_free(skb);
+        return;
+    }
+    if (flags & TCP_SYN) {
+        /* Challenge ACK (RFC 5961 4) */
+        tcp_send_ack(tp);
+        skb_free(skb);
+        return;
+    }
+    if (!(flags & TCP_ACK)) {
+        skb_free(skb);
+        return;
+    }
+
+    if (tp->state == TCP_SYN_RECV) {
+        uint32_t ack = ntohl(th->ack_seq);
+        if (!tcp_after(ack, tp->snd_una) || tcp_after(ack, tp->snd_nxt)) {
+            tcp_send_reset(skb);
+            skb_free(skb);
+            return;
+        }
+        tp->snd_wnd = (uint32_t)ntohs(th->window) << tp->snd_wscale;
+        tp->snd_wl1 = tcb->seq;
+        tp->snd_wl2 = ack;
+        tcp_set_state(tp, TCP_ESTABLISHED);
+        tcp_child_ready(tp);
+    }
+
+    if (tcp_ack(tp, skb, &opt) != 0) {
+        tcp_send_ack(tp);
+        skb_free(skb);
+        return;
+    }
+
+    /* Our FIN acknowledged? */
+    if (tp->snd_una == tp->write_seq) {
+        switch (tp->state) {
+        case TCP_FIN_WAIT1:
+            tcp_set_state(tp, TCP_FIN_WAIT2);
+            if (tp->orphan) {
+                tcp_reset_timer(tp, TCP_FIN_TIMEOUT_US);
+            }
+            tcp_wake(tp);
+            break;
+        case TCP_CLOSING:
+            tcp_enter_time_wait(tp);
+            break;
+        case TCP_LAST_ACK:
+            tcp_done(tp);
+            skb_free(skb);
+            return;
+        }
+    }
+
+    if (skb->len || (flags & TCP_FIN)) {
+        switch (tp->state) {
+        case TCP_ESTABLISHED:
+        case TCP_FIN_WAIT1:
+        case TCP_FIN_WAIT2:
+            if (tp->orphan && skb->len) {
+                /* Nobody will read it (RFC 9293 3.10.7.4, RFC 2525 2.17) */
+                tcp_send_active_reset(tp);
+                tcp_done(tp);
+                skb_free(skb);
+                return;
+            }
+            tcp_data_queue(tp, skb);
+            break;
+        default:
+            /* The peer's FIN is in, so this is old; say where we are */
+            tcp_send_ack(tp);
+            skb_free(skb);
+            break;
+        }
+    } else {
+        skb_free(skb);
+    }
+
+    if (tp->state != TCP_CLOSED) {
+        tcp_write_xmit(tp, 1);
+    }
+}
+
+/**
+ * The retransmission timer fired (owned, from the work item)
+ *
+ * Also runs the zero-window probe, the SYN retries and the end of
+ * TIME_WAIT and of an orphan's FIN_WAIT2.
+ */
+void tcp_rtx_timeout(tcp_sock_t *tp)
+{
+    switch (tp->state) {
+    case TCP_CLOSED:
+    case TCP_LISTEN:
+        return;
+    case TCP_TIME_WAIT:
+        tcp_done(tp);
+        return;
+    case TCP_FIN_WAIT2:
+        if (tp->orphan) {
+            tcp_done(tp);
+        }
+        return;
+    }
+
+    sk_buff_t *head = tp->write_queue.next;
+    if (!head) {
+        return;
+    }
+
+    if (tp->snd_una == tp->snd_nxt) {
+        /* Nothing in flight, data waiting: the window is shut, probe it */
+        if (!tp->send_head) {
+            return;
+        }
+        if (tp->orphan && tp->retransmits >= TCP_RETRIES) {
+            tcp_send_active_reset(tp);
+            tcp_done(tp);
+            return;
+        }
+        tcp_send_probe(tp);
+        if (tp->retransmits < TCP_RETRIES) {
+            tp->retransmits++;
+        }
+        uint64_t delay = (uint64_t)tp->rto_us << tp->retransmits;
+        tcp_reset_timer(tp, delay < TCP_RTO_MAX_US ? (uint32_t)delay : TCP_RTO_MAX_US);
+        return;
+    }
+
+    int syn = tp->state == TCP_SYN_SENT || tp->state == TCP_SYN_RECV;
+    if (tp->retransmits >= (syn ? TCP_SYN_RETRIES : TCP_RETRIES)) {
+        tp->error = THUNDEROS_ETIMEDOUT;
+        if (!syn) {
+            tcp_send_active_reset(tp);
+        }
+        tcp_done(tp);
+        return;
+    }
+    tp->retransmits++;
+    g_net_stats.tcp_timeouts++;
+
+    if (!syn) {
+        /* A SACKed head means the peer dropped what it SACKed (reneging) */
+        if (TCP_SKB_CB(head)->sacked & TCPCB_SACKED) {
+            for (sk_buff_t *skb = head; skb && skb != tp->send_head; skb = skb->next) {
+                tcp_skb_unmark(tp, skb);
+            }
+            tp->high_sacked = tp->snd_una;
+        }
+
+        /* RFC 5681 3.1: one segment, and everything not SACKed is lost */
+        if (tp->ca_state != TCP_CA_LOSS) {
+            uint32_t flight = tp->snd_nxt - tp->snd_una;
+            uint32_t floor = 2 * (uint32_t)tp->mss;
+            tp->ssthresh = flight / 2 > floor ? flight / 2 : floor;
+        }
+        tp->cwnd = tp->mss;
+        tp->bytes_acked = 0;
+        tp->dupacks = 0;
+        tp->recover = tp->snd_nxt;
+        tp->ca_state = TCP_CA_LOSS;
+
+        for (sk_buff_t *skb = head; skb && skb != tp->send_head; skb = skb->next) {
+            tcp_skb_cb_t *tcb = TCP_SKB_CB(skb);
+            if (tcb->sacked & TCPCB_SACKED) {
+                continue;
+            }
+            tcp_skb_unmark(tp, skb);
+            tcb->sacked = TCPCB_LOST;
+            tp->lost_out += tcp_skb_seqlen(skb);
+        }
+    }
+
+    tcp_retransmit_skb(tp, head);
+
+    /* Exponential backoff (RFC 6298 5.5) */
+    tp->rto_us = tp->rto_us * 2 < TCP_RTO_MAX_US ? tp->rto_us * 2 : TCP_RTO_MAX_US;
+    tcp_reset_timer(tp, tp->rto_us);
+}
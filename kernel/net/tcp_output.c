@@ -0,0 +1,629 @@
+/**
+ * TCP Output
+ *
+ * Segments on the write queue are sent as clones: the clone gets its own
+ * head buffer for the headers (skb_cow_head() copies only the headroom)
+ * and shares the payload pages, so the queued segment stays as it was
+ * for a retransmission. A burst goes to the device as one batch.
+ *
+ * The checksum is left to the device (or to ip_output() when it cannot):
+ * the header carries the pseudo-header sum only. With TSO a run of full
+ * segments leaves as one packet whose fragments share the segments'
+ * pages, and the device cuts it back into the same segments.
+ */
+
+#include "net/tcp.h"
+#include "hal/hal_timer.h"
+#include "kernel/config.h"
+#include "kernel/kstring.h"
+#include "kernel/errno.h"
+#include "mm/page.h"
+
+/* Largest option block: SYN options, or four SACK blocks */
+#define TCP_OPT_SPACE       (TCP_MAX_HLEN - TCP_HLEN)
+
+static void tcp_put16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static void tcp_put32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+/**
+ * Receive space from rcv_nxt on: the buffer less what is unread
+ *
+ * Out-of-order data sits inside this range, so it needs no room of its own.
+ */
+uint32_t tcp_receive_space(const tcp_sock_t *tp)
+{
+    uint32_t rcvbuf = tp->sock->rcvbuf;
+    uint32_t unread = tp->rcv_nxt - tp->copied_seq;
+    return unread < rcvbuf ? rcvbuf - unread : 0;
+}
+
+/**
+ * What is left of the window last advertised
+ */
+static uint32_t tcp_current_window(const tcp_sock_t *tp)
+{
+    uint32_t right = tp->rcv_wup + tp->rcv_wnd;
+    return tcp_after(right, tp->rcv_nxt) ? right - tp->rcv_nxt : 0;
+}
+
+/**
+ * Choose the window to advertise, and remember it
+ */
+static uint16_t tcp_select_window(tcp_sock_t *tp)
+{
+    uint32_t cur = tcp_current_window(tp);
+    uint32_t win = tcp_receive_space(tp);
+
+    /* Receiver-side silly window avoidance: no small openings (RFC 9293 3.8.6.2.2) */
+    uint32_t threshold = tp->sock->rcvbuf / 2 < tp->rcv_mss ? tp->sock->rcvbuf / 2 : tp->rcv_mss;
+    if (win < threshold) {
+        win = 0;
+    }
+    /* Never take back what was offered */
+    if (win < cur) {
+        win = cur;
+    }
+
+    uint32_t scale = tp->rcv_wscale;
+    uint32_t max = 65535U << scale;
+    if (win > max) {
+        win = max;
+    }
+    /* Round up, so the right edge does not move left by the scaling */
+    win = (win + (1U << scale) - 1) & ~((1U << scale) - 1);
+
+    tp->rcv_wnd = win;
+    tp->rcv_wup = tp->rcv_nxt;
+    return (uint16_t)(win >> scale);
+}
+
+/**
+ * Options of a SYN: MSS, and SACK and window scaling when allowed
+ */
+static uint32_t tcp_syn_options(const tcp_sock_t *tp, uint8_t *p)
+{
+    /* A SYN offers everything; a SYN-ACK answers what the SYN offered */
+    int offer = tp->state == TCP_SYN_SENT;
+    uint32_t len = 0;
+
+    p[len++] = TCPOPT_MSS;
+    p[len++] = 4;
+    tcp_put16(&p[len], tp->user_mss ? tp->user_mss : TCP_MSS_ETH);
+    len += 2;
+
+    if (offer || tp->sack_ok) {
+        p[len++] = TCPOPT_NOP;
+        p[len++] = TCPOPT_NOP;
+        p[len++] = TCPOPT_SACK_PERM;
+        p[len++] = 2;
+    }
+    if (offer || tp->rcv_wscale) {
+        p[len++] = TCPOPT_NOP;
+        p[len++] = TCPOPT_WSCALE;
+        p[len++] = 3;
+        p[len++] = TCP_WSCALE;
+    }
+    return len;
+}
+
+/**
+ * SACK blocks for what the out-of-order queue holds
+ */
+static uint32_t tcp_sack_options(const tcp_sock_t *tp, uint8_t *p)
+{
+    if (!tp->sack_ok || tp->num_sacks == 0) {
+        return 0;
+    }
+
+    uint32_t len = 0;
+    p[len++] = TCPOPT_NOP;
+    p[len++] = TCPOPT_NOP;
+    p[len++] = TCPOPT_SACK;
+    p[len++] = (uint8_t)(2 + 8 * tp->num_sacks);
+    for (uint32_t i = 0; i < tp->num_sacks; i++) {
+        tcp_put32(&p[len], tp->sacks[i].start);
+        tcp_put32(&p[len + 4], tp->sacks[i].end);
+        len += 8;
+    }
+    return len;
+}
+
+/**
+ * Push the header in front of a segment and send it
+ *
+ * @param clone Send a clone and keep skb (queued segments)
+ */
+static int tcp_transmit_skb(tcp_sock_t *tp, sk_buff_t *skb, int clone, net_tx_batch_t *batch)
+{
+    const tcp_skb_cb_t *tcb = TCP_SKB_CB(skb);
+
+    if (clone) {
+        skb = skb_clone(skb);
+        if (!skb) {
+            /* errno already set by skb_clone */
+            return -1;
+        }
+    }
+    /* A clone shares its headroom: headers go in a private copy */
+    if (skb_cow_head(skb, SKB_DEFAULT_HEADROOM) != 0) {
+        skb_free(skb);
+        /* errno already set by skb_cow_head */
+        return -1;
+    }
+
+    uint8_t opts[TCP_OPT_SPACE];
+    uint32_t optlen;
+    if (tcb->flags & TCP_SYN) {
+        optlen = tcp_syn_options(tp, opts);
+    } else {
+        optlen = tcp_sack_options(tp, opts);
+    }
+    uint32_t hlen = TCP_HLEN + optlen;
+
+    tcp_header_t *th = (tcp_header_t *)skb_push(skb, hlen);
+    skb_set_transport_header(skb, 0);
+    th->source = tp->sock->local_port;
+    th->dest = tp->remote_port;
+    th->seq = htonl(tcb->seq);
+    th->doff = (uint8_t)((hlen / 4) << 4);
+    th->flags = tcb->flags;
+    th->urg_ptr = 0;
+    kmemcpy((uint8_t *)th + TCP_HLEN, opts, optlen);
+
+    if (tcb->flags & TCP_ACK) {
+        th->ack_seq = htonl(tp->rcv_nxt);
+    } else {
+        th->ack_seq = 0;
+    }
+    if (tcb->flags & TCP_SYN) {
+        /* Windows in a SYN are never scaled */
+        uint32_t space = tcp_receive_space(tp);
+        th->window = htons((uint16_t)(space < 65535 ? space : 65535));
+        tp->rcv_wnd = space < 65535 ? space : 65535;
+        tp->rcv_wup = tp->rcv_nxt;
+    } else {
+        th->window = htons(tcp_select_window(tp));
+    }
+
+    /* The rest of the sum is the device's, or ip_output()'s without one */
+    uint32_t saddr = tp->sock->local_addr;
+    th->check = (uint16_t)~net_csum_fold(tcp_pseudo_sum(saddr, tp->remote_addr, skb->len));
+    skb->ip_summed = SKB_CSUM_PARTIAL;
+    skb->csum_start = skb->transport_header;
+    skb->csum_offset = (uint16_t)offsetof(tcp_header_t, check);
+
+    /* Every segment but the first SYN carries our ACK */
+    if (tcb->flags & TCP_ACK) {
+        tp->ack_pending = 0;
+        tp->unacked_bytes = 0;
+        ktimer_cancel(&tp->delack_timer);
+    }
+
+    g_net_stats.tcp_tx++;
+    if (ip_output(skb, saddr, tp->remote_addr, IPPROTO_TCP, batch) != 0) {
+        /* errno already set by ip_output; the timer sends it again */
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Allocate an empty segment at a sequence number
+ */
+static sk_buff_t *tcp_alloc_skb(uint32_t seq, uint8_t flags)
+{
+    sk_buff_t *skb = skb_alloc(SKB_DEFAULT_HEADROOM);
+    if (!skb) {
+        /* errno already set by skb_alloc */
+        return NULL;
+    }
+    skb_reserve(skb, SKB_DEFAULT_HEADROOM);
+
+    tcp_skb_cb_t *tcb = TCP_SKB_CB(skb);
+    tcb->seq = seq;
+    tcb->end_seq = seq;
+    tcb->sent_us = 0;
+    tcb->flags = flags;
+    tcb->sacked = 0;
+    return skb;
+}
+
+/**
+ * Whether an unsent segment may go, behind ahead bytes about to go
+ * with it
+ */
+static int tcp_may_send(tcp_sock_t *tp, const sk_buff_t *skb, uint32_t ahead, int push)
+{
+    const tcp_skb_cb_t *tcb = TCP_SKB_CB(skb);
+    uint32_t len = tcb->end_seq - tcb->seq;
+
+    if (tcp_in_flight(tp) + ahead + len > tp->cwnd) {
+        tp->cwnd_limited = 1;
+        return 0;
+    }
+    if (tcp_after(tcb->end_seq, tp->snd_una + tp->snd_wnd)) {
+        return 0;
+    }
+    if (skb->len < tp->mss && !skb->next && !(tcb->flags & TCP_FIN)) {
+        /* Nagle (RFC 896): one short segment in flight at a time */
+        if (!push || (!tp->nodelay && (tp->snd_nxt != tp->snd_una || ahead))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Fragments a segment adds to a TSO packet: its last one may continue
+ * in the segment's first
+ */
+static uint32_t tcp_tso_new_frags(const sk_buff_t *prev, const sk_buff_t *skb)
+{
+    const skb_shared_info_t *a = skb_shinfo(prev);
+    const skb_shared_info_t *b = skb_shinfo(skb);
+    uint32_t n = b->nr_frags;
+
+    if (a->nr_frags > 0 && n > 0) {
+        const skb_frag_t *last = &a->frags[a->nr_frags - 1];
+        if (last->page == b->frags[0].page && last->offset + last->size == b->frags[0].offset) {
+            n--;
+        }
+    }
+    return n;
+}
+
+/**
+ * Find how far a TSO packet from send_head on may reach
+ *
+ * Segments before the last must be full, so the device cuts the packet
+ * back into the queued segments; all must be data only, in fragments,
+ * and allowed out by the windows and Nagle.
+ *
+ * @return The last segment to include (the first one alone: no TSO)
+ */
+static sk_buff_t *tcp_tso_extent(tcp_sock_t *tp, sk_buff_t *first, int push)
+{
+    if (!(g_net_config.offloads & NET_OFFLOAD_TSO) || net_is_local_addr(tp->remote_addr)) {
+        return first;
+    }
+
+    sk_buff_t *last = first;
+    uint32_t bytes = first->len;
+    uint32_t frags = skb_shinfo(first)->nr_frags;
+    for (sk_buff_t *skb = first->next; skb; skb = skb->next) {
+        const tcp_skb_cb_t *tcb = TCP_SKB_CB(skb);
+        if (last->len != tp->mss || skb_headlen(last) != 0 || skb_headlen(skb) != 0 ||
+            ((TCP_SKB_CB(last)->flags | tcb->flags) & (TCP_SYN | TCP_FIN)) ||
+            bytes + skb->len > TCP_TSO_MAX_PAYLOAD) {
+            break;
+        }
+        frags += tcp_tso_new_frags(last, skb);
+        if (frags > SKB_MAX_FRAGS || !tcp_may_send(tp, skb, bytes, push)) {
+            break;
+        }
+        bytes += skb->len;
+        last = skb;
+    }
+    return last;
+}
+
+/**
+ * Send segments first to last as one packet for the device to cut up
+ */
+static int tcp_transmit_tso(tcp_sock_t *tp, sk_buff_t *first, sk_buff_t *last,
+                            net_tx_batch_t *batch)
+{
+    sk_buff_t *skb = tcp_alloc_skb(TCP_SKB_CB(first)->seq, 0);
+    if (!skb) {
+        /* errno already set by skb_alloc */
+        return -1;
+    }
+
+    /* The packet holds its own page references; the queue keeps its segments */
+    tcp_skb_cb_t *tcb = TCP_SKB_CB(skb);
+    for (sk_buff_t *seg = first; ; seg = seg->next) {
+        const skb_shared_info_t *shinfo = skb_shinfo(seg);
+        for (uint32_t i = 0; i < shinfo->nr_frags; i++) {
+            const skb_frag_t *frag = &shinfo->frags[i];
+            get_page(frag->page);
+            if (skb_add_frag(skb, frag->page, frag->offset, frag->size) != 0) {
+                put_page(frag->page);
+                skb_free(skb);
+                /* errno already set by skb_add_frag */
+                return -1;
+            }
+        }
+        tcb->flags |= TCP_SKB_CB(seg)->flags;
+        if (seg == last) {
+            break;
+        }
+    }
+    tcb->end_seq = TCP_SKB_CB(last)->end_seq;
+    skb->gso_size = tp->mss;
+
+    if (tcp_transmit_skb(tp, skb, 0, batch) != 0) {
+        /* errno already set by tcp_transmit_skb */
+        return -1;
+    }
+    g_net_stats.tcp_tso++;
+    return 0;
+}
+
+/**
+ * Send new data as the windows and Nagle's algorithm allow
+ *
+ * @param push The sender has nothing more for now: a short last segment
+ *             may go (not with unacknowledged data, under Nagle)
+ * @return Nonzero if anything was sent
+ */
+int tcp_write_xmit(tcp_sock_t *tp, int push)
+{
+    net_tx_batch_t batch;
+    batch.count = 0;
+    int sent = 0;
+
+    tp->cwnd_limited = 0;
+    sk_buff_t *skb;
+    while ((skb = tp->send_head) != NULL) {
+        if (!tcp_may_send(tp, skb, 0, push)) {
+            break;
+        }
+
+        sk_buff_t *last = tcp_tso_extent(tp, skb, push);
+        if (last != skb) {
+            if (tcp_transmit_tso(tp, skb, last, &batch) != 0) {
+                break;
+            }
+        } else if (tcp_transmit_skb(tp, skb, 1, &batch) != 0) {
+            break;
+        }
+
+        uint64_t now = hal_timer_get_time_us();
+        for (sk_buff_t *seg = skb; seg != last->next; seg = seg->next) {
+            TCP_SKB_CB(seg)->sent_us = now;
+        }
+        tp->snd_nxt = TCP_SKB_CB(last)->end_seq;
+        tp->send_head = last->next;
+        sent = 1;
+
+        if (!ktimer_pending(&tp->rtx_timer)) {
+            tcp_reset_timer(tp, tp->rto_us);
+        }
+    }
+    net_tx_flush(&batch);
+
+    /* Data the window shuts out, none in flight: probe when the timer fires */
+    if (tp->send_head && tp->snd_una == tp->snd_nxt && !ktimer_pending(&tp->rtx_timer)) {
+        tcp_reset_timer(tp, tp->rto_us);
+    }
+    return sent;
+}
+
+/**
+ * Send a queued segment again, into a batch
+ */
+static int tcp_retransmit_batch(tcp_sock_t *tp, sk_buff_t *skb, net_tx_batch_t *batch)
+{
+    tcp_skb_cb_t *tcb = TCP_SKB_CB(skb);
+    if (tcp_transmit_skb(tp, skb, 1, batch) != 0) {
+        return -1;
+    }
+
+    if ((tcb->sacked & (TCPCB_LOST | TCPCB_RETRANS)) == TCPCB_LOST) {
+        tp->retrans_out += tcb->end_seq - tcb->seq;
+    }
+    tcb->sacked |= TCPCB_RETRANS;
+    tcb->sent_us = hal_timer_get_time_us();
+    g_net_stats.tcp_retransmits++;
+    return 0;
+}
+
+/**
+ * Send one queued segment again
+ */
+int tcp_retransmit_skb(tcp_sock_t *tp, sk_buff_t *skb)
+{
+    return tcp_retransmit_batch(tp, skb, NULL);
+}
+
+/**
+ * Send again what is marked lost, as the congestion window allows
+ */
+void tcp_xmit_retransmit_queue(tcp_sock_t *tp)
+{
+    net_tx_batch_t batch;
+    batch.count = 0;
+
+    for (sk_buff_t *skb = tp->write_queue.next; skb && skb != tp->send_head; skb = skb->next) {
+        tcp_skb_cb_t *tcb = TCP_SKB_CB(skb);
+        if ((tcb->sacked & (TCPCB_LOST | TCPCB_RETRANS | TCPCB_SACKED)) != TCPCB_LOST) {
+            continue;
+        }
+        if (tcp_in_flight(tp) + (tcb->end_seq - tcb->seq) > tp->cwnd) {
+            tp->cwnd_limited = 1;
+            break;
+        }
+        if (tcp_retransmit_batch(tp, skb, &batch) != 0) {
+            break;
+        }
+    }
+    net_tx_flush(&batch);
+}
+
+/**
+ * Queue and send a SYN (active open) or SYN-ACK (passive)
+ */
+int tcp_send_syn(tcp_sock_t *tp)
+{
+    uint8_t flags = tp->state == TCP_SYN_RECV ? (TCP_SYN | TCP_ACK) : TCP_SYN;
+    sk_buff_t *skb = tcp_alloc_skb(tp->iss, flags);
+    if (!skb) {
+        /* errno already set by skb_alloc */
+        return -1;
+    }
+    TCP_SKB_CB(skb)->end_seq = tp->iss + 1;
+
+    skb_queue_tail(&tp->write_queue, skb);
+    tp->snd_una = tp->iss;
+    tp->snd_nxt = tp->iss + 1;
+    tp->write_seq = tp->iss + 1;
+    TCP_SKB_CB(skb)->sent_us = hal_timer_get_time_us();
+    tcp_reset_timer(tp, tp->rto_us);
+
+    if (tcp_transmit_skb(tp, skb, 1, NULL) != 0) {
+        /* errno already set; the timer tries again */
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Send an ACK now
+ */
+void tcp_send_ack(tcp_sock_t *tp)
+{
+    sk_buff_t *skb = tcp_alloc_skb(tp->snd_nxt, TCP_ACK);
+    if (!skb) {
+        /* Try again from the timer */
+        tcp_send_delayed_ack(tp);
+        return;
+    }
+    tcp_transmit_skb(tp, skb, 0, NULL);
+}
+
+/**
+ * Owe an ACK; the delayed-ACK timer sends it if nothing else does first
+ */
+void tcp_send_delayed_ack(tcp_sock_t *tp)
+{
+    tp->ack_pending = 1;
+    if (!ktimer_pending(&tp->delack_timer)) {
+        uint64_t ticks = (TCP_DELACK_US + TIMER_INTERVAL_US - 1) / TIMER_INTERVAL_US;
+        ktimer_add(&tp->delack_timer, hal_timer_get_ticks() + ticks);
+    }
+}
+
+/**
+ * Probe a zero window: an ACK for old data, which the peer answers with
+ * its current window
+ */
+void tcp_send_probe(tcp_sock_t *tp)
+{
+    sk_buff_t *skb = tcp_alloc_skb(tp->snd_una - 1, TCP_ACK);
+    if (skb) {
+        tcp_transmit_skb(tp, skb, 0, NULL);
+    }
+}
+
+/**
+ * Queue a FIN after the data, and send what may go
+ */
+void tcp_send_fin(tcp_sock_t *tp)
+{
+    sk_buff_t *tail = tp->write_queue.prev;
+
+    if (tail && tp->send_head) {
+        /* The last segment is not sent yet: it carries the FIN */
+        TCP_SKB_CB(tail)->flags |= TCP_FIN;
+        TCP_SKB_CB(tail)->end_seq++;
+    } else {
+        sk_buff_t *skb = tcp_alloc_skb(tp->write_seq, TCP_ACK | TCP_FIN);
+        if (!skb) {
+            /* No FIN without memory: reset instead of hanging */
+            tcp_send_active_reset(tp);
+            tp->error = THUNDEROS_ENOMEM;
+            tcp_done(tp);
+            return;
+        }
+        TCP_SKB_CB(skb)->end_seq++;
+        skb_queue_tail(&tp->write_queue, skb);
+        if (!tp->send_head) {
+            tp->send_head = skb;
+        }
+    }
+    tp->write_seq++;
+    tcp_write_xmit(tp, 1);
+}
+
+/**
+ * Reset our own connection
+ */
+void tcp_send_active_reset(tcp_sock_t *tp)
+{
+    sk_buff_t *skb = tcp_alloc_skb(tp->snd_nxt, TCP_RST | TCP_ACK);
+    if (skb) {
+        g_net_stats.tcp_resets_sent++;
+        tcp_transmit_skb(tp, skb, 0, NULL);
+    }
+}
+
+/**
+ * Answer a segment nobody takes with a RST (RFC 9293 3.10.7.1)
+ */
+void tcp_send_reset(const sk_buff_t *in)
+{
+    const tcp_header_t *th = tcp_hdr(in);
+    const ip_header_t *iph = ip_hdr(in);
+    const tcp_skb_cb_t *in_cb = TCP_SKB_CB(in);
+
+    if ((th->flags & TCP_RST) || !net_is_local_addr(iph->daddr)) {
+        return;
+    }
+
+    sk_buff_t *skb = skb_alloc(SKB_DEFAULT_HEADROOM);
+    if (!skb) {
+        return;
+    }
+    skb_reserve(skb, SKB_DEFAULT_HEADROOM);
+
+    tcp_header_t *out = (tcp_header_t *)skb_push(skb, TCP_HLEN);
+    skb_set_transport_header(skb, 0);
+    kmemset(out, 0, TCP_HLEN);
+    out->source = th->dest;
+    out->dest = th->source;
+    out->doff = (TCP_HLEN / 4) << 4;
+    if (th->flags & TCP_ACK) {
+        out->seq = th->ack_seq;
+        out->flags = TCP_RST;
+    } else {
+        out->ack_seq = htonl(in_cb->end_seq);
+        out->flags = TCP_RST | TCP_ACK;
+    }
+    out->check = net_csum_fold(net_csum_partial(out, TCP_HLEN,
+                                                tcp_pseudo_sum(iph->daddr, iph->saddr, TCP_HLEN)));
+
+    g_net_stats.tcp_resets_sent++;
+    g_net_stats.tcp_tx++;
+    ip_output(skb, iph->daddr, iph->saddr, IPPROTO_TCP, NULL);
+}
+
+/**
+ * After the reader made room: tell the peer when the window grew enough
+ */
+void tcp_window_update(tcp_sock_t *tp)
+{
+    if (tp->state < TCP_ESTABLISHED || tp->fin_rcvd) {
+        return;
+    }
+
+    uint32_t cur = tcp_current_window(tp);
+    uint32_t space = tcp_receive_space(tp);
+    uint32_t step = 2 * (uint32_t)tp->rcv_mss;
+    if (step > tp->sock->rcvbuf / 2) {
+        step = tp->sock->rcvbuf / 2;
+    }
+    if (space >= cur + step) {
+        tcp_send_ack(tp);
+    }
+}
@@ -0,0 +1,207 @@
+/**
+ * UDP
+ *
+ * One socket per port, whatever address it is bound to. The port table
+ * is changed with interrupts off, as the receive interrupt looks
+ * sockets up in it.
+ */
+
+#include "net/udp.h"
+#include "kernel/uaccess.h"
+#include "arch/interrupt.h"
+#include "kernel/errno.h"
+
+static socket_t *udp_hash[UDP_HASH_SIZE];
+
+/* Next ephemeral port to try, host order */
+static uint32_t udp_next_port = UDP_EPHEMERAL_FIRST;
+
+static inline uint32_t udp_hashfn(uint16_t port)
+{
+    return ntohs(port) & (UDP_HASH_SIZE - 1);
+}
+
+/**
+ * Find the socket bound to a port
+ */
+static socket_t *udp_lookup_port(uint16_t port)
+{
+    for (socket_t *sock = udp_hash[udp_hashfn(port)]; sock; sock = sock->hash_next) {
+        if (sock->local_port == port) {
+            return sock;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Sum of the pseudo-header that the checksum covers
+ */
+static uint32_t udp_pseudo_sum(uint32_t saddr, uint32_t daddr, uint16_t len)
+{
+    uint32_t sum = 0;
+    sum += saddr & 0xFFFF;
+    sum += saddr >> 16;
+    sum += daddr & 0xFFFF;
+    sum += daddr >> 16;
+    sum += htons(IPPROTO_UDP);
+    sum += len;
+    return sum;
+}
+
+/**
+ * Handle a received UDP datagram
+ */
+void udp_rx(sk_buff_t *skb)
+{
+    const ip_header_t *iph = ip_hdr(skb);
+
+    if (skb->len < UDP_HLEN) {
+        goto bad;
+    }
+    udp_header_t *uh = (udp_header_t *)skb->data;
+    uint32_t ulen = ntohs(uh->len);
+    if (ulen < UDP_HLEN || ulen > skb->len) {
+        goto bad;
+    }
+    skb_trim(skb, ulen);
+
+    if (uh->check && skb->ip_summed != SKB_CSUM_UNNECESSARY) {
+        uint32_t sum = udp_pseudo_sum(iph->saddr, iph->daddr, uh->len);
+        if (net_csum_fold(net_csum_skb(skb, 0, ulen, sum)) != 0) {
+            goto bad;
+        }
+    }
+
+    socket_t *sock = udp_lookup_port(uh->dest);
+    if (!sock || (sock->local_addr != INADDR_ANY && sock->local_addr != iph->daddr)) {
+        g_net_stats.udp_no_port++;
+        skb_free(skb);
+        return;
+    }
+
+    skb_pull(skb, UDP_HLEN);
+    if (socket_deliver(sock, skb) == 0) {
+        g_net_stats.udp_rx++;
+    } else {
+        g_net_stats.udp_rcvbuf_drops++;
+    }
+    return;
+
+bad:
+    g_net_stats.udp_rx_errors++;
+    skb_free(skb);
+}
+
+/**
+ * Put a socket in the port table
+ */
+int udp_bind(socket_t *sock, uint32_t addr, uint16_t port)
+{
+    int irq_state = interrupt_save_disable();
+
+    if (port == 0) {
+        uint32_t range = UDP_EPHEMERAL_LAST - UDP_EPHEMERAL_FIRST + 1;
+        for (uint32_t tries = 0; tries < range; tries++) {
+            uint16_t candidate = htons((uint16_t)udp_next_port);
+            if (++udp_next_port > UDP_EPHEMERAL_LAST) {
+                udp_next_port = UDP_EPHEMERAL_FIRST;
+            }
+            if (!udp_lookup_port(candidate)) {
+                port = candidate;
+                break;
+            }
+        }
+    } else if (udp_lookup_port(port)) {
+        port = 0;
+    }
+
+    if (port == 0) {
+        interrupt_restore(irq_state);
+        RETURN_ERRNO(THUNDEROS_EADDRINUSE);
+    }
+
+    sock->local_addr = addr;
+    sock->local_port = port;
+    uint32_t bucket = udp_hashfn(port);
+    sock->hash_next = udp_hash[bucket];
+    udp_hash[bucket] = sock;
+
+    interrupt_restore(irq_state);
+    return 0;
+}
+
+/**
+ * Take a socket out of the port table
+ */
+void udp_unbind(socket_t *sock)
+{
+    int irq_state = interrupt_save_disable();
+    socket_t **link = &udp_hash[udp_hashfn(sock->local_port)];
+    while (*link) {
+        if (*link == sock) {
+            *link = sock->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    sock->hash_next = NULL;
+    sock->local_port = 0;
+    interrupt_restore(irq_state);
+}
+
+/**
+ * Build and send one datagram from user memory
+ */
+int udp_sendmsg(socket_t *sock, uint32_t daddr, uint16_t dport,
+                const vfs_iovec_t *iov, int iovcnt, net_tx_batch_t *batch)
+{
+    uint32_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].len > UDP_MAX_PAYLOAD - total) {
+            RETURN_ERRNO(THUNDEROS_EMSGSIZE);
+        }
+        total += (uint32_t)iov[i].len;
+    }
+
+    uint32_t saddr = sock->local_addr != INADDR_ANY ? sock->local_addr : ip_select_source(daddr);
+    if (saddr == INADDR_ANY) {
+        RETURN_ERRNO(THUNDEROS_ENETDOWN);
+    }
+
+    sk_buff_t *skb = skb_alloc(SKB_DEFAULT_HEADROOM + total);
+    if (!skb) {
+        RETURN_ERRNO(THUNDEROS_ENOBUFS);
+    }
+    skb_reserve(skb, SKB_DEFAULT_HEADROOM);
+
+    /* The payload is copied once, from the caller into the packet */
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].len && copy_from_user(skb_put(skb, (uint32_t)iov[i].len), iov[i].base,
+                                         iov[i].len) != 0) {
+            skb_free(skb);
+            /* errno already set by copy_from_user */
+            return -1;
+        }
+    }
+
+    udp_header_t *uh = (udp_header_t *)skb_push(skb, UDP_HLEN);
+    skb_set_transport_header(skb, 0);
+    uh->source = sock->local_port;
+    uh->dest = dport;
+    uh->len = htons((uint16_t)(total + UDP_HLEN));
+    uh->check = 0;
+
+    uint32_t sum = udp_pseudo_sum(saddr, daddr, uh->len);
+    uh->check = net_csum_fold(net_csum_partial(uh, total + UDP_HLEN, sum));
+    if (uh->check == 0) {
+        uh->check = 0xFFFF;     // 0 would mean no checksum
+    }
+
+    if (ip_output(skb, saddr, daddr, IPPROTO_UDP, batch) != 0) {
+        /* errno already set by ip_output */
+        return -1;
+    }
+    g_net_stats.udp_tx++;
+    return (int)total;
+}
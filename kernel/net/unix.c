@@ -0,0 +1,1174 @@
+/**
+ * AF_UNIX sockets
+ *
+ * Everything here runs in process context under the kernel lock; the
+ * receive interrupt never sees these sockets. Stream data goes through
+ * the pipe code (written and read without blocking there, so waits go
+ * through poll waiters and honour signals and deadlines), datagrams
+ * through the socket's receive queue. A socket refers to its peer with
+ * no reference: whichever goes first clears the other's pointer, and
+ * the one released last frees the pipes, so a poll() registered on them
+ * never outlives them.
+ */
+
+#include "net/unix.h"
+#include "hal/hal_timer.h"
+#include "kernel/process.h"
+#include "kernel/uaccess.h"
+#include "kernel/kstring.h"
+#include "kernel/errno.h"
+#include "mm/kmalloc.h"
+#include "mm/pmm.h"
+#include "mm/page.h"
+
+/* A datagram's head buffer starts with the sender's name */
+#define UNIX_SKB_ADDR(skb)  ((struct sockaddr_un *)(skb)->head)
+#define UNIX_SKB_HEADROOM   ((sizeof(struct sockaddr_un) + 7) & ~7u)
+
+/* ... and cb[0] points at the descriptors it carries, if any */
+#define UNIX_SKB_SCM(skb)   (*(unix_scm_t **)&(skb)->cb[0])
+
+static unix_sock_t *unix_names[UNIX_HASH_SIZE];
+
+static int unix_name_eq(const char *a, const char *b)
+{
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static uint32_t unix_hash(const char *path)
+{
+    uint32_t hash = 5381;
+    for (const char *p = path; *p; p++) {
+        hash = hash * 33 + (uint8_t)*p;
+    }
+    return hash % UNIX_HASH_SIZE;
+}
+
+/**
+ * The socket bound to a name, if any
+ */
+static socket_t *unix_lookup(const char *path)
+{
+    for (unix_sock_t *u = unix_names[unix_hash(path)]; u; u = u->hash_next) {
+        if (unix_name_eq(u->path, path)) {
+            return u->sock;
+        }
+    }
+    return NULL;
+}
+
+static void unix_unbind(unix_sock_t *u)
+{
+    unix_sock_t **link = &unix_names[unix_hash(u->path)];
+    while (*link && *link != u) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = u->hash_next;
+    }
+    u->hash_next = NULL;
+    u->path[0] = '\0';
+}
+
+/**
+ * Copy a name out of an address, NUL-terminated
+ *
+ * @return 0, or -1 if it is empty (errno set)
+ */
+static int unix_copy_path(char *dst, const struct sockaddr_un *addr)
+{
+    uint32_t len = 0;
+    while (len < UNIX_PATH_MAX && addr->sun_path[len]) {
+        dst[len] = addr->sun_path[len];
+        len++;
+    }
+    dst[len] = '\0';
+    if (len == 0) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    return 0;
+}
+
+/**
+ * Put back a set of descriptors in flight and free it
+ */
+static void unix_scm_free(unix_scm_t *bundle)
+{
+    socket_scm_release(&bundle->scm);
+    kfree(bundle);
+}
+
+/**
+ * Take over the descriptors of a message about to be sent
+ *
+ * @param bundle Set to the copy, or NULL when there is nothing to pass
+ * @return 0, or -1 (errno set)
+ */
+static int unix_scm_take(socket_scm_t *scm, unix_scm_t **bundle)
+{
+    *bundle = NULL;
+    if (!scm || scm->nfds == 0) {
+        return 0;
+    }
+
+    /* A socket in flight could end up holding itself: nothing would free it */
+    for (uint32_t i = 0; i < scm->nfds; i++) {
+        vfs_file_t *file = scm->files[i];
+        if (file->type == VFS_TYPE_SOCKET && file->socket &&
+            ((socket_t *)file->socket)->family == AF_UNIX) {
+            RETURN_ERRNO(THUNDEROS_EINVAL);
+        }
+    }
+
+    unix_scm_t *copy = kmalloc(sizeof(unix_scm_t));
+    if (!copy) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    copy->next = NULL;
+    copy->seq = 0;
+    copy->scm = *scm;
+    *bundle = copy;
+    return 0;
+}
+
+/**
+ * Hand a set of descriptors to a receiver
+ *
+ * @param scm Receiver's buffer, or NULL to put them back
+ * @param msg_flags Gets MSG_CTRUNC when they are dropped
+ */
+static void unix_scm_deliver(unix_scm_t *bundle, socket_scm_t *scm, int *msg_flags)
+{
+    if (scm) {
+        *scm = bundle->scm;
+        kfree(bundle);
+        return;
+    }
+    *msg_flags |= MSG_CTRUNC;
+    unix_scm_free(bundle);
+}
+
+/**
+ * Put back the descriptors of a stream whose data has been read
+ * without them (splice(), or a shut down reader)
+ */
+static void unix_scm_drop_read(unix_sock_t *u)
+{
+    while (u->scm_head && (u->shut_rd || u->scm_head->seq < u->rx->consumed)) {
+        unix_scm_t *bundle = u->scm_head;
+        u->scm_head = bundle->next;
+        unix_scm_free(bundle);
+    }
+    if (!u->scm_head) {
+        u->scm_tail = NULL;
+    }
+}
+
+static void unix_scm_unlink(unix_sock_t *u, unix_scm_t *bundle)
+{
+    unix_scm_t *prev = NULL;
+    for (unix_scm_t *b = u->scm_head; b; prev = b, b = b->next) {
+        if (b == bundle) {
+            if (prev) {
+                prev->next = b->next;
+            } else {
+                u->scm_head = b->next;
+            }
+            if (u->scm_tail == b) {
+                u->scm_tail = prev;
+            }
+            return;
+        }
+    }
+}
+
+/**
+ * Sleep on a wait queue until a condition holds
+ *
+ * @return 0 once ready() is true, else THUNDEROS_EINTR or (past the
+ *         deadline) THUNDEROS_EAGAIN
+ */
+static int unix_wait(wait_queue_t *wq, int (*ready)(void *), void *arg, uint64_t deadline_us)
+{
+    wait_queue_entry_t entry;
+    poll_waiter_t pw;
+    poll_waiter_init(&pw, &entry, 1);
+    poll_wait(&pw.pt, wq);
+
+    int error = 0;
+    while (!ready(arg)) {
+        if (poll_signal_pending()) {
+            error = THUNDEROS_EINTR;
+            break;
+        }
+        if (deadline_us && hal_timer_get_time_us() >= deadline_us) {
+            error = THUNDEROS_EAGAIN;
+            break;
+        }
+        poll_waiter_sleep(&pw, deadline_us);
+    }
+
+    poll_waiter_release(&pw);
+    return error;
+}
+
+/**
+ * Set up the AF_UNIX state of a new socket
+ */
+int unix_sock_create(socket_t *sock)
+{
+    unix_sock_t *u = kmalloc(sizeof(unix_sock_t));
+    if (!u) {
+        RETURN_ERRNO(THUNDEROS_ENOMEM);
+    }
+    kmemset(u, 0, sizeof(unix_sock_t));
+    u->sock = sock;
+    sock->un = u;
+    return 0;
+}
+
+/**
+ * Close our ends of a stream's pipes (they stay until the release)
+ */
+static void unix_close_rx(unix_sock_t *u)
+{
+    if (u->rx && !u->shut_rd) {
+        pipe_close_read(u->rx);
+    }
+    u->shut_rd = 1;
+    unix_scm_drop_read(u);
+}
+
+static void unix_close_tx(unix_sock_t *u)
+{
+    if (u->tx && !u->shut_wr) {
+        pipe_close_write(u->tx);
+    }
+    u->shut_wr = 1;
+}
+
+/**
+ * Tear down a socket on its last reference
+ */
+void unix_release(socket_t *sock)
+{
+    unix_sock_t *u = sock->un;
+
+    if (u->path[0]) {
+        unix_unbind(u);
+    }
+
+    /* Connections nobody accepted see their end at once */
+    while (u->accept_head) {
+        socket_t *conn = u->accept_head;
+        u->accept_head = conn->un->accept_next;
+        socket_put(conn);
+    }
+
+    unix_close_rx(u);
+    unix_close_tx(u);
+    if (u->peer) {
+        /* The peer still polls the pipes and frees them when it goes */
+        u->peer->un->peer = NULL;
+        wait_queue_wake(&u->peer->wait_queue);
+        u->peer = NULL;
+    } else {
+        pipe_free(u->rx);
+        pipe_free(u->tx);
+    }
+
+    sk_buff_t *skb;
+    while ((skb = skb_dequeue(&sock->rx_queue)) != NULL) {
+        if (UNIX_SKB_SCM(skb)) {
+            unix_scm_free(UNIX_SKB_SCM(skb));
+        }
+        skb_free(skb);
+    }
+    sock->rx_queued = 0;
+
+    kfree(u);
+    sock->un = NULL;
+}
+
+/**
+ * Join two stream sockets with a pipe each way
+ */
+static int unix_link(socket_t *a, socket_t *b)
+{
+    pipe_t *a_rx = pipe_create();
+    if (!a_rx) {
+        /* errno already set by pipe_create */
+        return -1;
+    }
+    pipe_t *b_rx = pipe_create();
+    if (!b_rx) {
+        pipe_free(a_rx);
+        /* errno already set by pipe_create */
+        return -1;
+    }
+
+    a->un->rx = a_rx;
+    a->un->tx = b_rx;
+    b->un->rx = b_rx;
+    b->un->tx = a_rx;
+    unix_set_rcvbuf(a);
+    unix_set_rcvbuf(b);
+    return 0;
+}
+
+/**
+ * Connect two new sockets to each other
+ */
+int unix_pair(socket_t *a, socket_t *b)
+{
+    if (a->type == SOCK_STREAM && unix_link(a, b) != 0) {
+        /* errno already set by unix_link */
+        return -1;
+    }
+    a->un->peer = b;
+    b->un->peer = a;
+    a->un->state = UNIX_CONNECTED;
+    b->un->state = UNIX_CONNECTED;
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Give a socket a name
+ */
+int unix_bind(socket_t *sock, const struct sockaddr_un *addr)
+{
+    unix_sock_t *u = sock->un;
+    if (u->path[0]) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    char path[UNIX_PATH_MAX + 1];
+    if (unix_copy_path(path, addr) != 0) {
+        /* errno already set by unix_copy_path */
+        return -1;
+    }
+    if (unix_lookup(path)) {
+        RETURN_ERRNO(THUNDEROS_EADDRINUSE);
+    }
+
+    kstrcpy(u->path, path);
+    uint32_t bucket = unix_hash(path);
+    u->hash_next = unix_names[bucket];
+    unix_names[bucket] = u;
+    clear_errno();
+    return 0;
+}
+
+static int unix_backlog_room(void *arg)
+{
+    socket_t *listener = (socket_t *)arg;
+    return !listener->un || listener->un->state != UNIX_LISTEN ||
+           listener->un->accept_len < listener->un->backlog;
+}
+
+/**
+ * Connect to a listening stream socket, or set a datagram socket's peer
+ */
+int unix_connect(socket_t *sock, const struct sockaddr_un *addr, int nonblock)
+{
+    unix_sock_t *u = sock->un;
+    char path[UNIX_PATH_MAX + 1];
+    if (unix_copy_path(path, addr) != 0) {
+        /* errno already set by unix_copy_path */
+        return -1;
+    }
+
+    socket_t *target = unix_lookup(path);
+    if (!target) {
+        RETURN_ERRNO(THUNDEROS_ENOENT);
+    }
+    if (target->type != sock->type) {
+        RETURN_ERRNO(THUNDEROS_ECONNREFUSED);
+    }
+
+    if (sock->type == SOCK_DGRAM) {
+        /* Looked up again on each send, so the peer may come and go */
+        kstrcpy(u->peer_path, path);
+        clear_errno();
+        return 0;
+    }
+
+    if (u->state == UNIX_CONNECTED) {
+        RETURN_ERRNO(THUNDEROS_EISCONN);
+    }
+    if (u->state == UNIX_LISTEN) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (target->un->state != UNIX_LISTEN) {
+        RETURN_ERRNO(THUNDEROS_ECONNREFUSED);
+    }
+
+    if (target->un->accept_len >= target->un->backlog) {
+        if (nonblock) {
+            RETURN_ERRNO(THUNDEROS_EAGAIN);
+        }
+        socket_get(target);
+        int error = unix_wait(&target->wait_queue, unix_backlog_room, target, 0);
+        int gone = !target->un || target->un->state != UNIX_LISTEN;
+        socket_put(target);
+        if (error) {
+            RETURN_ERRNO(error);
+        }
+        if (gone) {
+            RETURN_ERRNO(THUNDEROS_ECONNREFUSED);
+        }
+        /* Another connect() may have won the race the other way: at worst
+         * the queue runs one over its backlog */
+        if (u->state != UNIX_UNCONNECTED) {
+            RETURN_ERRNO(THUNDEROS_EISCONN);
+        }
+    }
+
+    /* The server's end exists from now on; accept() only hands it out */
+    socket_t *conn = socket_create(AF_UNIX, SOCK_STREAM, 0);
+    if (!conn) {
+        /* errno already set by socket_create */
+        return -1;
+    }
+    conn->rcvbuf = target->rcvbuf;
+    conn->sndbuf = target->sndbuf;
+    if (unix_link(sock, conn) != 0) {
+        socket_put(conn);
+        /* errno already set by unix_link */
+        return -1;
+    }
+
+    unix_sock_t *cu = conn->un;
+    u->peer = conn;
+    cu->peer = sock;
+    u->state = UNIX_CONNECTED;
+    cu->state = UNIX_CONNECTED;
+    kstrcpy(u->peer_path, path);
+    kstrcpy(cu->peer_path, u->path);
+    /* The accepted end goes by the listener's name, kept out of the table */
+    kstrcpy(cu->path, path);
+
+    unix_sock_t *lu = target->un;
+    if (lu->accept_tail) {
+        lu->accept_tail->un->accept_next = conn;
+    } else {
+        lu->accept_head = conn;
+    }
+    lu->accept_tail = conn;
+    lu->accept_len++;
+    wait_queue_wake(&target->wait_queue);
+
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Listen on a bound stream socket
+ */
+int unix_listen(socket_t *sock, int backlog)
+{
+    unix_sock_t *u = sock->un;
+    if (!u->path[0] || u->state == UNIX_CONNECTED) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+    if (backlog <= 0) {
+        backlog = UNIX_BACKLOG_DEF;
+    } else if (backlog > UNIX_BACKLOG_MAX) {
+        backlog = UNIX_BACKLOG_MAX;
+    }
+    u->backlog = (uint32_t)backlog;
+    u->state = UNIX_LISTEN;
+    /* A bigger backlog may let waiting connectors in */
+    wait_queue_wake(&sock->wait_queue);
+    clear_errno();
+    return 0;
+}
+
+static int unix_accept_ready(void *arg)
+{
+    unix_sock_t *u = (unix_sock_t *)arg;
+    return u->accept_head != NULL;
+}
+
+/**
+ * Take a connection off a listening socket
+ */
+socket_t *unix_accept(socket_t *sock, int nonblock)
+{
+    unix_sock_t *u = sock->un;
+    if (u->state != UNIX_LISTEN) {
+        RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+    }
+
+    if (!u->accept_head) {
+        if (nonblock) {
+            RETURN_ERRNO_NULL(THUNDEROS_EAGAIN);
+        }
+        int error = unix_wait(&sock->wait_queue, unix_accept_ready, u, 0);
+        if (error) {
+            RETURN_ERRNO_NULL(error);
+        }
+    }
+
+    socket_t *conn = u->accept_head;
+    u->accept_head = conn->un->accept_next;
+    if (!u->accept_head) {
+        u->accept_tail = NULL;
+    }
+    conn->un->accept_next = NULL;
+    u->accept_len--;
+    /* Connectors waiting for backlog room */
+    wait_queue_wake(&sock->wait_queue);
+
+    clear_errno();
+    return conn;
+}
+
+static int unix_tx_ready(void *arg)
+{
+    unix_sock_t *u = (unix_sock_t *)arg;
+    return u->shut_wr || pipe_poll(u->tx, 1, NULL) != 0;
+}
+
+/**
+ * Write to the peer of a stream
+ */
+static int unix_stream_sendmsg(socket_t *sock, const vfs_iovec_t *iov, int iovcnt,
+                               int nonblock, socket_scm_t *scm)
+{
+    unix_sock_t *u = sock->un;
+    if (u->state != UNIX_CONNECTED) {
+        RETURN_ERRNO(THUNDEROS_ENOTCONN);
+    }
+    if (u->shut_wr) {
+        RETURN_ERRNO(THUNDEROS_EPIPE);
+    }
+
+    /* The pipe copies with plain loads, so check the buffers up front */
+    struct process *proc = process_current();
+    uint64_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].len &&
+            !process_validate_user_ptr(proc, iov[i].base, iov[i].len, VM_READ | VM_USER)) {
+            RETURN_ERRNO(THUNDEROS_EFAULT);
+        }
+        total += iov[i].len;
+    }
+    if (total == 0) {
+        clear_errno();
+        return 0;
+    }
+
+    unix_scm_t *bundle;
+    if (unix_scm_take(scm, &bundle) != 0) {
+        /* errno already set by unix_scm_take */
+        return -1;
+    }
+
+    uint64_t sent = 0;
+    int error = 0;
+    for (int i = 0; i < iovcnt && !error; i++) {
+        uint64_t off = 0;
+        while (off < iov[i].len) {
+            if (!unix_tx_ready(u)) {
+                if (nonblock) {
+                    error = THUNDEROS_EAGAIN;
+                    break;
+                }
+                error = unix_wait(&u->tx->writers, unix_tx_ready, u, 0);
+                if (error) {
+                    break;
+                }
+            }
+            if (u->shut_wr) {
+                error = THUNDEROS_EPIPE;
+                break;
+            }
+
+            /* The descriptors ride on the first byte */
+            int queued = 0;
+            if (bundle && sent == 0) {
+                if (!u->peer) {
+                    error = THUNDEROS_EPIPE;
+                    break;
+                }
+                unix_sock_t *pu = u->peer->un;
+                bundle->seq = u->tx->consumed + u->tx->data_size;
+                if (pu->scm_tail) {
+                    pu->scm_tail->next = bundle;
+                } else {
+                    pu->scm_head = bundle;
+                }
+                pu->scm_tail = bundle;
+                queued = 1;
+            }
+
+            uint64_t chunk = iov[i].len - off;
+            if (chunk > 0x7fffffff) {
+                chunk = 0x7fffffff;
+            }
+            int n = pipe_write(u->tx, (const uint8_t *)iov[i].base + off, (size_t)chunk, 1);
+            if (n < 0) {
+                if (queued) {
+                    unix_scm_unlink(u->peer->un, bundle);
+                }
+                if (get_errno() == THUNDEROS_EAGAIN) {
+                    continue;
+                }
+                error = get_errno();
+                break;
+            }
+            off += (uint64_t)n;
+            sent += (uint64_t)n;
+        }
+    }
+
+    if (bundle) {
+        if (sent > 0) {
+            /* The references went with the data */
+            scm->nfds = 0;
+        } else {
+            kfree(bundle);
+        }
+    }
+
+    if (sent == 0) {
+        RETURN_ERRNO(error);
+    }
+    clear_errno();
+    return (int)sent;
+}
+
+/**
+ * pipe_splice_out() consumer copying to user buffers
+ */
+typedef struct {
+    const vfs_iovec_t *iov;
+    int iovcnt;
+    int index;
+    uint64_t offset;
+} unix_copy_ctx_t;
+
+static int unix_copy_out(void *ctx, const void *data, uint32_t len)
+{
+    unix_copy_ctx_t *c = (unix_copy_ctx_t *)ctx;
+    uint32_t done = 0;
+
+    while (done < len && c->index < c->iovcnt) {
+        const vfs_iovec_t *v = &c->iov[c->index];
+        uint64_t room = v->len - c->offset;
+        if (room == 0) {
+            c->index++;
+            c->offset = 0;
+            continue;
+        }
+        uint32_t n = len - done < room ? len - done : (uint32_t)room;
+        if (copy_to_user((uint8_t *)v->base + c->offset, (const uint8_t *)data + done, n) != 0) {
+            if (done == 0) {
+                /* errno already set by copy_to_user */
+                return -1;
+            }
+            break;
+        }
+        done += n;
+        c->offset += n;
+    }
+    return (int)done;
+}
+
+static int unix_rx_ready(void *arg)
+{
+    unix_sock_t *u = (unix_sock_t *)arg;
+    return u->shut_rd || u->rx->data_size > 0 || u->rx->write_ref_count == 0;
+}
+
+/**
+ * Read from a stream, stopping short of the next byte sent with descriptors
+ */
+static int unix_stream_recvmsg(socket_t *sock, const vfs_iovec_t *iov, int iovcnt,
+                               int nonblock, uint64_t deadline_us, int *msg_flags,
+                               socket_scm_t *scm)
+{
+    unix_sock_t *u = sock->un;
+    if (u->state != UNIX_CONNECTED) {
+        RETURN_ERRNO(THUNDEROS_ENOTCONN);
+    }
+
+    uint64_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].len;
+    }
+    if (total == 0 || u->shut_rd) {
+        clear_errno();
+        return 0;
+    }
+
+    if (!unix_rx_ready(u)) {
+        if (nonblock) {
+            RETURN_ERRNO(THUNDEROS_EAGAIN);
+        }
+        int error = unix_wait(&u->rx->readers, unix_rx_ready, u, deadline_us);
+        if (error) {
+            RETURN_ERRNO(error);
+        }
+    }
+    if (u->shut_rd || u->rx->data_size == 0) {
+        clear_errno();
+        return 0;
+    }
+
+    /* Descriptors sent with the first byte here come with this read;
+     * the next set marks where it stops */
+    unix_scm_drop_read(u);
+    uint64_t pos = u->rx->consumed;
+    unix_scm_t *bundle = u->scm_head && u->scm_head->seq == pos ? u->scm_head : NULL;
+    unix_scm_t *next = bundle ? bundle->next : u->scm_head;
+    uint64_t limit = total;
+    if (next && next->seq - pos < limit) {
+        limit = next->seq - pos;
+    }
+    if (limit > 0x7fffffff) {
+        limit = 0x7fffffff;
+    }
+
+    unix_copy_ctx_t ctx = { iov, iovcnt, 0, 0 };
+    int n = pipe_splice_out(u->rx, unix_copy_out, &ctx, (size_t)limit, 1);
+    if (n < 0) {
+        /* errno already set by unix_copy_out */
+        return -1;
+    }
+
+    *msg_flags = 0;
+    if (bundle) {
+        u->scm_head = bundle->next;
+        if (!u->scm_head) {
+            u->scm_tail = NULL;
+        }
+        unix_scm_deliver(bundle, scm, msg_flags);
+    }
+    clear_errno();
+    return n;
+}
+
+/**
+ * The socket a datagram socket sends to by default
+ */
+static socket_t *unix_dgram_peer(unix_sock_t *u, int *error)
+{
+    if (u->peer) {
+        return u->peer;
+    }
+    if (u->state == UNIX_CONNECTED) {
+        /* A socketpair() end whose peer is gone */
+        *error = THUNDEROS_ECONNREFUSED;
+        return NULL;
+    }
+    if (!u->peer_path[0]) {
+        *error = THUNDEROS_EDESTADDRREQ;
+        return NULL;
+    }
+    socket_t *peer = unix_lookup(u->peer_path);
+    if (!peer || peer->type != SOCK_DGRAM) {
+        *error = THUNDEROS_ECONNREFUSED;
+        return NULL;
+    }
+    return peer;
+}
+
+/**
+ * Copy a datagram from user memory: the linear area first, then pages
+ */
+static sk_buff_t *unix_dgram_build(const vfs_iovec_t *iov, int iovcnt)
+{
+    sk_buff_t *skb = skb_alloc(SKB_MAX_LINEAR);
+    if (!skb) {
+        /* errno already set by skb_alloc */
+        return NULL;
+    }
+    skb_reserve(skb, UNIX_SKB_HEADROOM);
+    UNIX_SKB_SCM(skb) = NULL;
+
+    /* Our reference to the page being filled; each piece takes its own */
+    uintptr_t page = 0;
+    uint32_t page_off = PAGE_SIZE;
+    int error = 0;
+    for (int i = 0; i < iovcnt && !error; i++) {
+        uint64_t off = 0;
+        while (off < iov[i].len) {
+            const uint8_t *src = (const uint8_t *)iov[i].base + off;
+            uint64_t n = iov[i].len - off;
+
+            if (skb->data_len == 0 && skb_tailroom(skb) > 0) {
+                if (n > skb_tailroom(skb)) {
+                    n = skb_tailroom(skb);
+                }
+                if (copy_from_user(skb->tail, src, (size_t)n) != 0) {
+                    error = THUNDEROS_EFAULT;
+                    break;
+                }
+                skb_put(skb, (uint32_t)n);
+                off += n;
+                continue;
+            }
+
+            if (page_off == PAGE_SIZE) {
+                if (page) {
+                    put_page(page);
+                }
+                page = pmm_alloc_page();
+                page_off = 0;
+                if (!page) {
+                    error = THUNDEROS_ENOBUFS;
+                    break;
+                }
+            }
+            if (n > PAGE_SIZE - page_off) {
+                n = PAGE_SIZE - page_off;
+            }
+            if (copy_from_user((uint8_t *)page + page_off, src, (size_t)n) != 0) {
+                error = THUNDEROS_EFAULT;
+                break;
+            }
+            get_page(page);
+            if (skb_add_frag(skb, page, page_off, (uint32_t)n) != 0) {
+                put_page(page);
+                error = THUNDEROS_EMSGSIZE;
+                break;
+            }
+            page_off += (uint32_t)n;
+            off += n;
+        }
+    }
+    if (page) {
+        put_page(page);
+    }
+
+    if (error) {
+        skb_free(skb);
+        RETURN_ERRNO_NULL(error);
+    }
+    return skb;
+}
+
+/**
+ * Whether a datagram fits the receiver's buffer now
+ */
+typedef struct {
+    socket_t *peer;
+    uint32_t truesize;
+} unix_room_t;
+
+static int unix_dgram_room(void *arg)
+{
+    unix_room_t *room = (unix_room_t *)arg;
+    socket_t *peer = room->peer;
+    return !peer->un || peer->rx_queued + room->truesize <= peer->rcvbuf;
+}
+
+/**
+ * Send one datagram
+ */
+static int unix_dgram_sendmsg(socket_t *sock, const struct sockaddr_un *dest,
+                              const vfs_iovec_t *iov, int iovcnt, int nonblock,
+                              socket_scm_t *scm)
+{
+    unix_sock_t *u = sock->un;
+    char path[UNIX_PATH_MAX + 1];
+    if (dest && unix_copy_path(path, dest) != 0) {
+        /* errno already set by unix_copy_path */
+        return -1;
+    }
+
+    uint64_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].len;
+    }
+    if (total > UNIX_DGRAM_MAX) {
+        RETURN_ERRNO(THUNDEROS_EMSGSIZE);
+    }
+
+    sk_buff_t *skb = unix_dgram_build(iov, iovcnt);
+    if (!skb) {
+        /* errno already set by unix_dgram_build */
+        return -1;
+    }
+    uint32_t truesize = socket_truesize(skb);
+
+    /* Look the receiver up again after each wait: it may have gone */
+    int error = 0;
+    socket_t *peer;
+    for (;;) {
+        if (dest) {
+            peer = unix_lookup(path);
+            if (!peer) {
+                error = THUNDEROS_ENOENT;
+                break;
+            }
+            if (peer->type != SOCK_DGRAM) {
+                error = THUNDEROS_ECONNREFUSED;
+                break;
+            }
+        } else {
+            peer = unix_dgram_peer(u, &error);
+            if (!peer) {
+                break;
+            }
+        }
+        if (truesize > peer->rcvbuf) {
+            error = THUNDEROS_EMSGSIZE;
+            break;
+        }
+
+        unix_room_t room = { peer, truesize };
+        if (unix_dgram_room(&room)) {
+            break;
+        }
+        if (nonblock) {
+            error = THUNDEROS_EAGAIN;
+            break;
+        }
+        socket_get(peer);
+        error = unix_wait(&peer->wait_queue, unix_dgram_room, &room, 0);
+        socket_put(peer);
+        if (error) {
+            break;
+        }
+    }
+    if (error) {
+        skb_free(skb);
+        RETURN_ERRNO(error);
+    }
+
+    unix_scm_t *bundle;
+    if (unix_scm_take(scm, &bundle) != 0) {
+        skb_free(skb);
+        /* errno already set by unix_scm_take */
+        return -1;
+    }
+    if (bundle) {
+        scm->nfds = 0;
+    }
+    UNIX_SKB_SCM(skb) = bundle;
+
+    struct sockaddr_un *from = UNIX_SKB_ADDR(skb);
+    kmemset(from, 0, sizeof(*from));
+    from->sun_family = AF_UNIX;
+    kstrncpy(from->sun_path, u->path, UNIX_PATH_MAX);
+
+    /* The receiver's queue takes the buffer as it is */
+    skb_queue_tail(&peer->rx_queue, skb);
+    peer->rx_queued += truesize;
+    wait_queue_wake(&peer->wait_queue);
+
+    clear_errno();
+    return (int)total;
+}
+
+/**
+ * Receive one datagram
+ */
+static int unix_dgram_recvmsg(socket_t *sock, const vfs_iovec_t *iov, int iovcnt,
+                              struct sockaddr_un *from, int nonblock, uint64_t deadline_us,
+                              int *msg_flags, socket_scm_t *scm)
+{
+    sk_buff_t *skb = socket_dequeue(sock, nonblock, deadline_us);
+    if (!skb) {
+        /* errno already set by socket_dequeue */
+        return -1;
+    }
+    /* Senders waiting for room, and a socketpair() peer polling for it */
+    wait_queue_wake(&sock->wait_queue);
+    if (sock->un->peer) {
+        wait_queue_wake(&sock->un->peer->wait_queue);
+    }
+
+    unix_scm_t *bundle = UNIX_SKB_SCM(skb);
+    int copied = socket_copy_to_iov(skb, iov, iovcnt);
+    if (copied < 0) {
+        if (bundle) {
+            unix_scm_free(bundle);
+        }
+        skb_free(skb);
+        /* errno already set by socket_copy_to_iov */
+        return -1;
+    }
+
+    *msg_flags = (uint32_t)copied < skb->len ? MSG_TRUNC : 0;
+    if (bundle) {
+        unix_scm_deliver(bundle, scm, msg_flags);
+    }
+    if (from) {
+        *from = *UNIX_SKB_ADDR(skb);
+    }
+
+    skb_free(skb);
+    clear_errno();
+    return copied;
+}
+
+/**
+ * Send data on a stream, or one datagram
+ */
+int unix_sendmsg(socket_t *sock, const struct sockaddr_un *dest,
+                 const vfs_iovec_t *iov, int iovcnt, int nonblock, socket_scm_t *scm)
+{
+    if (sock->type == SOCK_STREAM) {
+        return unix_stream_sendmsg(sock, iov, iovcnt, nonblock, scm);
+    }
+    return unix_dgram_sendmsg(sock, dest, iov, iovcnt, nonblock, scm);
+}
+
+/**
+ * Receive data on a stream, or one datagram
+ */
+int unix_recvmsg(socket_t *sock, const vfs_iovec_t *iov, int iovcnt,
+                 struct sockaddr_un *from, int nonblock, uint64_t deadline_us,
+                 int *msg_flags, socket_scm_t *scm)
+{
+    int flags = 0;
+    if (scm) {
+        scm->nfds = 0;
+    }
+
+    int received;
+    if (sock->type == SOCK_STREAM) {
+        received = unix_stream_recvmsg(sock, iov, iovcnt, nonblock, deadline_us, &flags, scm);
+        if (received >= 0 && from) {
+            unix_getname(sock, 1, from);
+        }
+    } else {
+        received = unix_dgram_recvmsg(sock, iov, iovcnt, from, nonblock, deadline_us,
+                                      &flags, scm);
+    }
+
+    if (received >= 0 && msg_flags) {
+        *msg_flags = flags;
+    }
+    return received;
+}
+
+/**
+ * The name of a socket, or of its stream peer
+ */
+void unix_getname(socket_t *sock, int peer, struct sockaddr_un *addr)
+{
+    kmemset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    kstrncpy(addr->sun_path, peer ? sock->un->peer_path : sock->un->path, UNIX_PATH_MAX);
+}
+
+/**
+ * Shut down one or both directions of a stream
+ */
+int unix_shutdown(socket_t *sock, int how)
+{
+    unix_sock_t *u = sock->un;
+    if (sock->type != SOCK_STREAM || u->state != UNIX_CONNECTED) {
+        RETURN_ERRNO(THUNDEROS_ENOTCONN);
+    }
+
+    /* The peer's writes fail with EPIPE; reads see the end of the stream */
+    if (how == SHUT_RD || how == SHUT_RDWR) {
+        unix_close_rx(u);
+    }
+    if (how == SHUT_WR || how == SHUT_RDWR) {
+        unix_close_tx(u);
+    }
+    clear_errno();
+    return 0;
+}
+
+/**
+ * Readiness of a socket
+ */
+int unix_poll(socket_t *sock, poll_table_t *pt)
+{
+    unix_sock_t *u = sock->un;
+
+    if (sock->type == SOCK_DGRAM) {
+        poll_wait(pt, &sock->wait_queue);
+        int mask = 0;
+        if (skb_queue_len(&sock->rx_queue) > 0) {
+            mask |= POLLIN;
+        }
+
+        /* Writable unless the socketpair() peer is full, which wakes us
+         * as it drains; a named receiver may go, so only our own queue is
+         * polled and sending may still wait */
+        socket_t *peer = u->peer;
+        if (!peer || peer->rx_queued + SKB_HEAD_SIZE <= peer->rcvbuf) {
+            mask |= POLLOUT;
+        }
+        return mask;
+    }
+
+    if (u->state == UNIX_LISTEN) {
+        poll_wait(pt, &sock->wait_queue);
+        return u->accept_head ? POLLIN : 0;
+    }
+    if (u->state != UNIX_CONNECTED) {
+        return POLLOUT | POLLHUP;
+    }
+
+    /* A direction shut down does not block: it returns at once */
+    int mask = u->shut_rd ? POLLIN : pipe_poll(u->rx, 0, pt);
+    mask |= u->shut_wr ? POLLOUT : pipe_poll(u->tx, 1, pt);
+    return mask;
+}
+
+/**
+ * Apply SO_RCVBUF to a stream's receive pipe
+ */
+void unix_set_rcvbuf(socket_t *sock)
+{
+    unix_sock_t *u = sock->un;
+    if (!u->rx) {
+        return;
+    }
+    uint32_t size = sock->rcvbuf < PIPE_MAX_SIZE ? sock->rcvbuf : PIPE_MAX_SIZE;
+    /* With more queued than that, the old size stays */
+    pipe_set_size(u->rx, size);
+}
+
+/**
+ * Move data from a pipe to the peer of a stream by page reference
+ */
+int unix_splice_write(socket_t *sock, pipe_t *pipe, uint32_t len, int nonblock)
+{
+    unix_sock_t *u = sock->un;
+    if (u->state != UNIX_CONNECTED) {
+        RETURN_ERRNO(THUNDEROS_ENOTCONN);
+    }
+    if (u->shut_wr) {
+        RETURN_ERRNO(THUNDEROS_EPIPE);
+    }
+    /* errno set by pipe_move */
+    return pipe_move(pipe, u->tx, len, nonblock);
+}
+
+/**
+ * Move received stream data into a pipe by page reference
+ */
+int unix_splice_read(socket_t *sock, pipe_t *pipe, uint32_t len, int nonblock)
+{
+    unix_sock_t *u = sock->un;
+    if (u->state != UNIX_CONNECTED) {
+        RETURN_ERRNO(THUNDEROS_ENOTCONN);
+    }
+    if (u->shut_rd) {
+        clear_errno();
+        return 0;
+    }
+
+    int moved = pipe_move(u->rx, pipe, len, nonblock);
+    if (moved > 0) {
+        unix_scm_drop_read(u);
+    }
+    /* errno set by pipe_move */
+    return moved;
+}
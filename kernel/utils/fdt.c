@@ -0,0 +1,318 @@
+/*
+ * Flattened Device Tree (FDT) Parsing Implementation
+ * 
+ * The blob is a header followed by a structure block of big-endian
+ * 32-bit tokens and a strings block holding property names:
+ * 
+ *   FDT_BEGIN_NODE name\0 [pad]   - enter a node
+ *   FDT_PROP len nameoff data [pad] - property of current node
+ *   FDT_END_NODE                  - leave a node
+ *   FDT_END                       - end of structure block
+ */
+
+#include "kernel/fdt.h"
+#include "kernel/errno.h"
+
+// Structure block tokens
+#define FDT_BEGIN_NODE  0x1
+#define FDT_END_NODE    0x2
+#define FDT_PROP        0x3
+#define FDT_NOP         0x4
+#define FDT_END         0x9
+
+// Header fields (all big-endian uint32)
+struct fdt_header {
+    uint32_t magic;
+    uint32_t totalsize;
+    uint32_t off_dt_struct;
+    uint32_t off_dt_strings;
+    uint32_t off_mem_rsvmap;
+    uint32_t version;
+    uint32_t last_comp_version;
+    uint32_t boot_cpuid_phys;
+    uint32_t size_dt_strings;
+    uint32_t size_dt_struct;
+};
+
+static inline uint32_t be32(const void *p) {
+    const uint8_t *b = (const uint8_t *)p;
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) |
+           ((uint32_t)b[2] << 8) | (uint32_t)b[3];
+}
+
+// Read a value made of 'cells' big-endian 32-bit cells
+static uint64_t read_cells(const uint8_t *p, uint32_t cells) {
+    uint64_t val = 0;
+    for (uint32_t i = 0; i < cells; i++) {
+        val = (val << 32) | be32(p + i * 4);
+    }
+    return val;
+}
+
+static int str_eq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+// Match "memory" or "memory@<unit-address>"
+static int is_memory_node(const char *name) {
+    const char *prefix = "memory";
+    while (*prefix) {
+        if (*name++ != *prefix++) {
+            return 0;
+        }
+    }
+    return *name == '\0' || *name == '@';
+}
+
+// Match "cpu@<unit-address>" (not cpu-map or the /cpus node itself)
+static int is_cpu_node(const char *name) {
+    return name[0] == 'c' && name[1] == 'p' && name[2] == 'u' && name[3] == '@';
+}
+
+static inline uint32_t align4(uint32_t off) {
+    return (off + 3) & ~3u;
+}
+
+/**
+ * Find the first RAM region described by the device tree
+ */
+int fdt_get_memory(uintptr_t fdt, uintptr_t *base, size_t *size) {
+    if (fdt == 0 || !base || !size) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    const struct fdt_header *hdr = (const struct fdt_header *)fdt;
+    if (be32(&hdr->magic) != FDT_MAGIC) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    const uint8_t *structs = (const uint8_t *)fdt + be32(&hdr->off_dt_struct);
+    const char *strings = (const char *)fdt + be32(&hdr->off_dt_strings);
+    uint32_t struct_size = be32(&hdr->size_dt_struct);
+
+    // Defaults from the devicetree spec when the root doesn't say
+    uint32_t address_cells = 2;
+    uint32_t size_cells = 1;
+
+    int depth = 0;
+    int in_memory = 0;
+    uint32_t off = 0;
+
+    while (off + 4 <= struct_size) {
+        uint32_t token = be32(structs + off);
+        off += 4;
+
+        switch (token) {
+        case FDT_BEGIN_NODE: {
+            const char *name = (const char *)structs + off;
+            uint32_t len = 0;
+            while (name[len]) {
+                len++;
+            }
+            off = align4(off + len + 1);
+            depth++;
+            in_memory = (depth == 2 && is_memory_node(name));
+            break;
+        }
+
+        case FDT_END_NODE:
+            depth--;
+            in_memory = 0;
+            break;
+
+        case FDT_PROP: {
+            uint32_t len = be32(structs + off);
+            uint32_t nameoff = be32(structs + off + 4);
+            const uint8_t *data = structs + off + 8;
+            const char *pname = strings + nameoff;
+            off = align4(off + 8 + len);
+
+            if (depth == 1) {
+                if (str_eq(pname, "#address-cells") && len == 4) {
+                    address_cells = be32(data);
+                } else if (str_eq(pname, "#size-cells") && len == 4) {
+                    size_cells = be32(data);
+                }
+            } else if (in_memory && str_eq(pname, "reg") &&
+                       len >= (address_cells + size_cells) * 4) {
+                *base = (uintptr_t)read_cells(data, address_cells);
+                *size = (size_t)read_cells(data + address_cells * 4, size_cells);
+                clear_errno();
+                return 0;
+            }
+            break;
+        }
+
+        case FDT_NOP:
+            break;
+
+        case FDT_END:
+        default:
+            RETURN_ERRNO(THUNDEROS_ENOENT);
+        }
+    }
+
+    RETURN_ERRNO(THUNDEROS_ENOENT);
+}
+
+/**
+ * List the harts described by the device tree
+ */
+int fdt_get_cpus(uintptr_t fdt, unsigned long *hartids, int max) {
+    if (fdt == 0 || !hartids || max <= 0) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    const struct fdt_header *hdr = (const struct fdt_header *)fdt;
+    if (be32(&hdr->magic) != FDT_MAGIC) {
+        RETURN_ERRNO(THUNDEROS_EINVAL);
+    }
+
+    const uint8_t *structs = (const uint8_t *)fdt + be32(&hdr->off_dt_struct);
+    const char *strings = (const char *)fdt + be32(&hdr->off_dt_strings);
+    uint32_t struct_size = be32(&hdr->size_dt_struct);
+
+    // /cpus normally says #address-cells = <1>; that is also the default
+    uint32_t address_cells = 1;
+
+    int depth = 0;
+    int in_cpus = 0;
+    int in_cpu = 0;
+    int count = 0;
+    uint32_t off = 0;
+
+    while (off + 4 <= struct_size) {
+        uint32_t token = be32(structs + off);
+        off += 4;
+
+        switch (token) {
+        case FDT_BEGIN_NODE: {
+            const char *name = (const char *)structs + off;
+            uint32_t len = 0;
+            while (name[len]) {
+                len++;
+            }
+            off = align4(off + len + 1);
+            depth++;
+            if (depth == 2) {
+                in_cpus = str_eq(name, "cpus");
+            }
+            in_cpu = (in_cpus && depth == 3 && is_cpu_node(name));
+            break;
+        }
+
+        case FDT_END_NODE:
+            if (depth == 2) {
+                in_cpus = 0;
+            }
+            depth--;
+            in_cpu = 0;
+            break;
+
+        case FDT_PROP: {
+            uint32_t len = be32(structs + off);
+            uint32_t nameoff = be32(structs + off + 4);
+            const uint8_t *data = structs + off + 8;
+            const char *pname = strings + nameoff;
+            off = align4(off + 8 + len);
+
+            if (in_cpus && depth == 2 && str_eq(pname, "#address-cells") && len == 4) {
+                address_cells = be32(data);
+            } else if (in_cpu && str_eq(pname, "reg") && len >= address_cells * 4) {
+                if (count < max) {
+                    hartids[count++] = (unsigned long)read_cells(data, address_cells);
+                }
+                in_cpu = 0;
+            }
+            break;
+        }
+
+        case FDT_NOP:
+            break;
+
+        case FDT_END:
+            clear_errno();
+            return count;
+
+        default:
+            RETURN_ERRNO(THUNDEROS_EINVAL);
+        }
+    }
+
+    clear_errno();
+    return count;
+}
+
+/**
+ * Get the kernel command line
+ */
+const char *fdt_get_bootargs(uintptr_t fdt) {
+    if (fdt == 0) {
+        RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+    }
+
+    const struct fdt_header *hdr = (const struct fdt_header *)fdt;
+    if (be32(&hdr->magic) != FDT_MAGIC) {
+        RETURN_ERRNO_NULL(THUNDEROS_EINVAL);
+    }
+
+    const uint8_t *structs = (const uint8_t *)fdt + be32(&hdr->off_dt_struct);
+    const char *strings = (const char *)fdt + be32(&hdr->off_dt_strings);
+    uint32_t struct_size = be32(&hdr->size_dt_struct);
+
+    int depth = 0;
+    int in_chosen = 0;
+    uint32_t off = 0;
+
+    while (off + 4 <= struct_size) {
+        uint32_t token = be32(structs + off);
+        off += 4;
+
+        switch (token) {
+        case FDT_BEGIN_NODE: {
+            const char *name = (const char *)structs + off;
+            uint32_t len = 0;
+            while (name[len]) {
+                len++;
+            }
+            off = align4(off + len + 1);
+            depth++;
+            in_chosen = (depth == 2 && str_eq(name, "chosen"));
+            break;
+        }
+
+        case FDT_END_NODE:
+            depth--;
+            in_chosen = 0;
+            break;
+
+        case FDT_PROP: {
+            uint32_t len = be32(structs + off);
+            uint32_t nameoff = be32(structs + off + 4);
+            const char *data = (const char *)structs + off + 8;
+            off = align4(off + 8 + len);
+
+            // The string must end inside the property
+            if (in_chosen && str_eq(strings + nameoff, "bootargs") &&
+                len > 0 && data[len - 1] == '\0') {
+                clear_errno();
+                return data;
+            }
+            break;
+        }
+
+        case FDT_NOP:
+            break;
+
+        case FDT_END:
+        default:
+            RETURN_ERRNO_NULL(THUNDEROS_ENOENT);
+        }
+    }
+
+    RETURN_ERRNO_NULL(THUNDEROS_ENOENT);
+}
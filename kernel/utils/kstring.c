@@ -79,23 +79,142 @@ size_t kstrlen(const char *str) {
     return len;
 }
 
+/* Word accesses to byte buffers: may_alias keeps them legal to mix */
+typedef uint64_t __attribute__((may_alias)) kword_t;
+
+/* Below this, aligning first costs more than it saves */
+#define KMEM_WORD_MIN 16
+
 /**
  * Set memory to a value
+ * 
+ * Stores bytes up to an 8-byte boundary, then whole words, four per pass.
  */
 void *kmemset(void *s, int c, size_t n) {
     unsigned char *p = s;
+    
+    if (n >= KMEM_WORD_MIN) {
+        while ((uintptr_t)p & 7) {
+            *p++ = (unsigned char)c;
+            n--;
+        }
+        
+        kword_t word = (unsigned char)c * 0x0101010101010101ULL;
+        kword_t *w = (kword_t *)p;
+        while (n >= 32) {
+            w[0] = word;
+            w[1] = word;
+            w[2] = word;
+            w[3] = word;
+            w += 4;
+            n -= 32;
+        }
+        while (n >= 8) {
+            *w++ = word;
+            n -= 8;
+        }
+        p = (unsigned char *)w;
+    }
+    
     while (n--) {
         *p++ = (unsigned char)c;
     }
     return s;
 }
 
+/**
+ * Set memory to a repeated 32-bit value
+ * 
+ * Stores one value if needed to reach an 8-byte boundary, then the value
+ * twice per word, four words per pass.
+ */
+void *kmemset32(void *s, uint32_t value, size_t count) {
+    uint32_t *p = s;
+    
+    if (count >= KMEM_WORD_MIN / 4) {
+        if ((uintptr_t)p & 4) {
+            *p++ = value;
+            count--;
+        }
+        
+        kword_t word = ((kword_t)value << 32) | value;
+        kword_t *w = (kword_t *)p;
+        while (count >= 8) {
+            w[0] = word;
+            w[1] = word;
+            w[2] = word;
+            w[3] = word;
+            w += 4;
+            count -= 8;
+        }
+        while (count >= 2) {
+            *w++ = word;
+            count -= 2;
+        }
+        p = (uint32_t *)w;
+    }
+    
+    while (count--) {
+        *p++ = value;
+    }
+    return s;
+}
+
 /**
  * Copy memory
+ * 
+ * Aligns the destination, then copies whole words. A source at another
+ * offset is read as aligned words too, each output word spliced from
+ * two of them, since misaligned accesses may trap. Every aligned word
+ * read holds at least one source byte, so nothing past the page of the
+ * last byte is touched.
  */
 void *kmemcpy(void *dest, const void *src, size_t n) {
     unsigned char *d = dest;
     const unsigned char *s = src;
+    
+    if (n >= KMEM_WORD_MIN) {
+        while ((uintptr_t)d & 7) {
+            *d++ = *s++;
+            n--;
+        }
+        
+        kword_t *dw = (kword_t *)d;
+        unsigned int offset = (uintptr_t)s & 7;
+        
+        if (offset == 0) {
+            const kword_t *sw = (const kword_t *)s;
+            while (n >= 32) {
+                dw[0] = sw[0];
+                dw[1] = sw[1];
+                dw[2] = sw[2];
+                dw[3] = sw[3];
+                dw += 4;
+                sw += 4;
+                n -= 32;
+            }
+            while (n >= 8) {
+                *dw++ = *sw++;
+                n -= 8;
+            }
+            s = (const unsigned char *)sw;
+        } else {
+            // Little-endian: the low bytes of each output word come from
+            // the end of one aligned source word, the rest from the next
+            unsigned int shift = offset * 8;
+            const kword_t *sw = (const kword_t *)(s - offset);
+            kword_t lo = *sw++;
+            while (n >= 8) {
+                kword_t hi = *sw++;
+                *dw++ = (lo >> shift) | (hi << (64 - shift));
+                lo = hi;
+                n -= 8;
+            }
+            s = (const unsigned char *)(sw - 1) + offset;
+        }
+        d = (unsigned char *)dw;
+    }
+    
     while (n--) {
         *d++ = *s++;
     }
@@ -0,0 +1,98 @@
+/*
+ * LZ4 Block Decompression
+ *
+ * A sequence starts with a token: the high nibble is the literal length,
+ * the low nibble the match length less LZ4_MIN_MATCH. A nibble of 15 is
+ * continued by bytes added on until one is not 255. The literals follow,
+ * then a 16-bit little-endian offset back into the output, then the
+ * match length extension.
+ */
+
+#include "kernel/lz4.h"
+#include "kernel/errno.h"
+
+/* Shortest match a sequence encodes */
+#define LZ4_MIN_MATCH 4
+
+/* Nibble value continued by extension bytes */
+#define LZ4_RUN_MASK 15
+
+/**
+ * Read a length extension: bytes added on until one is not 255
+ */
+static int lz4_read_length(const uint8_t **ip, const uint8_t *iend, uint32_t *len) {
+    uint8_t byte;
+    do {
+        if (*ip >= iend) {
+            return -1;
+        }
+        byte = *(*ip)++;
+        if (*len > 0xFFFFFFFFu - byte) {
+            return -1;
+        }
+        *len += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+/**
+ * Decompress one LZ4 block
+ */
+int lz4_decompress(const void *src, uint32_t src_len, void *dst, uint32_t dst_len) {
+    const uint8_t *ip = (const uint8_t *)src;
+    const uint8_t *iend = ip + src_len;
+    uint8_t *op = (uint8_t *)dst;
+    uint8_t *ostart = op;
+    uint8_t *oend = op + dst_len;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        /* Literals */
+        uint32_t lit_len = token >> 4;
+        if (lit_len == LZ4_RUN_MASK && lz4_read_length(&ip, iend, &lit_len) != 0) {
+            goto bad;
+        }
+        if (lit_len > (uint32_t)(iend - ip) || lit_len > (uint32_t)(oend - op)) {
+            goto bad;
+        }
+        for (uint32_t i = 0; i < lit_len; i++) {
+            *op++ = *ip++;
+        }
+
+        /* The last sequence ends after its literals */
+        if (ip == iend) {
+            break;
+        }
+
+        /* Match */
+        if (iend - ip < 2) {
+            goto bad;
+        }
+        uint32_t offset = (uint32_t)ip[0] | ((uint32_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (uint32_t)(op - ostart)) {
+            goto bad;
+        }
+        uint32_t match_len = token & LZ4_RUN_MASK;
+        if (match_len == LZ4_RUN_MASK && lz4_read_length(&ip, iend, &match_len) != 0) {
+            goto bad;
+        }
+        match_len += LZ4_MIN_MATCH;
+        if (match_len > (uint32_t)(oend - op)) {
+            goto bad;
+        }
+
+        /* Byte by byte: the match may overlap what it produces */
+        const uint8_t *match = op - offset;
+        for (uint32_t i = 0; i < match_len; i++) {
+            *op++ = *match++;
+        }
+    }
+
+    clear_errno();
+    return (int)(op - ostart);
+
+bad:
+    RETURN_ERRNO(THUNDEROS_EINVAL);
+}
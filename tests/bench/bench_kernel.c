@@ -0,0 +1,264 @@
+/*
+ * Kernel Microbenchmarks
+ *
+ * Times the paths the rest of the kernel leans on: page and object
+ * allocation, page table updates, context switches, wait queue and pipe
+ * round trips through the scheduler, and opening and reading a file
+ * that is already in the page cache. Runs from kernel_main() as the init
+ * process, once the root filesystem is mounted.
+ *
+ * The round-trip benchmarks ping a partner kernel thread at the same
+ * priority as init; the scheduler may run it on another CPU, in which
+ * case the time includes the reschedule IPI. The partners stay asleep
+ * once the benchmarks are done.
+ *
+ * This file is only compiled when ENABLE_KERNEL_BENCH is defined.
+ */
+
+#ifdef ENABLE_KERNEL_BENCH
+
+#include "../framework/kbench.h"
+#include "kernel/process.h"
+#include "kernel/scheduler.h"
+#include "kernel/wait_queue.h"
+#include "kernel/pipe.h"
+#include "mm/pmm.h"
+#include "mm/kmalloc.h"
+#include "mm/paging.h"
+#include "fs/vfs.h"
+#include "arch/interrupt.h"
+
+extern void context_switch_asm(struct context *old, struct context *new);
+
+// Any page-aligned user address: it lives in a page table of our own
+#define BENCH_MAP_VADDR     0x40000000UL
+
+// Read by the file benchmark; make fs puts it in the root directory
+#define BENCH_FILE          "/test.txt"
+#define BENCH_FILE_READ     64
+
+// ========================================
+// pmm_alloc_page / pmm_free_page
+// ========================================
+
+static void pmm_alloc_free(void) {
+    uintptr_t page = pmm_alloc_page();
+    if (page) {
+        pmm_free_page(page);
+    }
+}
+
+// ========================================
+// kmalloc / kfree (a slab-sized object)
+// ========================================
+
+static void kmalloc_kfree(void) {
+    void *ptr = kmalloc(64);
+    if (ptr) {
+        kfree(ptr);
+    }
+}
+
+// ========================================
+// map_page / unmap_page in a user page table
+// ========================================
+
+static page_table_t *map_table;
+static uintptr_t map_target;
+
+static int map_setup(void) {
+    map_table = create_user_page_table();
+    map_target = pmm_alloc_page();
+    if (!map_table || !map_target) {
+        if (map_table) {
+            free_page_table(map_table);
+        }
+        if (map_target) {
+            pmm_free_page(map_target);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+static void map_teardown(void) {
+    free_page_table(map_table);
+    pmm_free_page(map_target);
+}
+
+// Includes the TLB flush of the unmap
+static void map_unmap_page(void) {
+    map_page(map_table, BENCH_MAP_VADDR, map_target, PTE_USER_DATA);
+    unmap_page(map_table, BENCH_MAP_VADDR);
+}
+
+// ========================================
+// context_switch_asm: there and back between two bare contexts
+// ========================================
+
+static struct context switch_main_ctx;
+static struct context switch_partner_ctx;
+static uintptr_t switch_stack;
+
+static void switch_partner(void) {
+    for (;;) {
+        context_switch_asm(&switch_partner_ctx, &switch_main_ctx);
+    }
+}
+
+static int switch_setup(void) {
+    switch_stack = pmm_alloc_page();
+    if (!switch_stack) {
+        return -1;
+    }
+    switch_partner_ctx.ra = (unsigned long)switch_partner;
+    switch_partner_ctx.sp = switch_stack + PAGE_SIZE;
+    switch_partner_ctx.s0 = switch_partner_ctx.sp;
+    return 0;
+}
+
+static void switch_teardown(void) {
+    pmm_free_page(switch_stack);
+}
+
+// Two switches; interrupts off so no trap lands on the partner's stack
+static void context_switch_round_trip(void) {
+    int irq_state = interrupt_save_disable();
+    context_switch_asm(&switch_main_ctx, &switch_partner_ctx);
+    interrupt_restore(irq_state);
+}
+
+// ========================================
+// wait_queue_sleep / wait_queue_wake: ping a partner thread and wait
+// ========================================
+
+static wait_queue_t ping_wq;
+static wait_queue_t pong_wq;
+static volatile unsigned long ping_seq;
+static volatile unsigned long pong_seq;
+static struct process *wq_partner;
+
+static void wq_partner_main(void *arg) {
+    (void)arg;
+    unsigned long seen = 0;
+
+    for (;;) {
+        int irq_state = interrupt_save_disable();
+        while (ping_seq == seen) {
+            wait_queue_sleep(&ping_wq);
+            interrupt_disable();
+        }
+        seen = ping_seq;
+        pong_seq = seen;
+        wait_queue_wake(&pong_wq);
+        interrupt_restore(irq_state);
+    }
+}
+
+// Start a partner thread at init's priority
+static struct process *start_partner(const char *name, void (*fn)(void *)) {
+    struct process *proc = kthread_create(name, fn, NULL);
+    if (!proc) {
+        return NULL;
+    }
+    proc->base_priority = process_current()->base_priority;
+    scheduler_set_priority(proc, proc->base_priority);
+    return proc;
+}
+
+static int wq_setup(void) {
+    if (wq_partner) {
+        return 0;
+    }
+    wait_queue_init(&ping_wq);
+    wait_queue_init(&pong_wq);
+    wq_partner = start_partner("kbench-wq", wq_partner_main);
+    return wq_partner ? 0 : -1;
+}
+
+static void wait_queue_round_trip(void) {
+    int irq_state = interrupt_save_disable();
+    unsigned long seq = ++ping_seq;
+    wait_queue_wake(&ping_wq);
+    while (pong_seq != seq) {
+        wait_queue_sleep(&pong_wq);
+        interrupt_disable();
+    }
+    interrupt_restore(irq_state);
+}
+
+// ========================================
+// pipe_write / pipe_read: a byte to a partner thread and back
+// ========================================
+
+static pipe_t *ping_pipe;
+static pipe_t *pong_pipe;
+static struct process *pipe_partner;
+
+static void pipe_partner_main(void *arg) {
+    (void)arg;
+    char c;
+
+    for (;;) {
+        if (pipe_read(ping_pipe, &c, 1, 0) == 1) {
+            pipe_write(pong_pipe, &c, 1, 0);
+        }
+    }
+}
+
+static int pipe_setup(void) {
+    if (pipe_partner) {
+        return 0;
+    }
+    ping_pipe = pipe_create();
+    pong_pipe = pipe_create();
+    if (!ping_pipe || !pong_pipe) {
+        return -1;
+    }
+    pipe_partner = start_partner("kbench-pipe", pipe_partner_main);
+    return pipe_partner ? 0 : -1;
+}
+
+static void pipe_round_trip(void) {
+    char c = 'x';
+    pipe_write(ping_pipe, &c, 1, 0);
+    pipe_read(pong_pipe, &c, 1, 0);
+}
+
+// ========================================
+// vfs_open / vfs_read / vfs_close on a file in the page cache
+// ========================================
+
+static int vfs_setup(void) {
+    int fd = vfs_open(BENCH_FILE, O_RDONLY);
+    if (fd < 0) {
+        return -1;  // No root filesystem
+    }
+    vfs_close(fd);
+    return 0;
+}
+
+static void vfs_open_read(void) {
+    char buf[BENCH_FILE_READ];
+    int fd = vfs_open(BENCH_FILE, O_RDONLY);
+    if (fd >= 0) {
+        vfs_read(fd, buf, sizeof(buf));
+        vfs_close(fd);
+    }
+}
+
+static struct kbench kernel_benches[] = {
+    KBENCH_CASE(pmm_alloc_free, NULL, NULL),
+    KBENCH_CASE(kmalloc_kfree, NULL, NULL),
+    KBENCH_CASE(map_unmap_page, map_setup, map_teardown),
+    KBENCH_CASE(context_switch_round_trip, switch_setup, switch_teardown),
+    KBENCH_CASE(wait_queue_round_trip, wq_setup, NULL),
+    KBENCH_CASE(pipe_round_trip, pipe_setup, NULL),
+    KBENCH_CASE(vfs_open_read, vfs_setup, NULL),
+};
+
+void run_kernel_benchmarks(void) {
+    kbench_run(kernel_benches, (int)(sizeof(kernel_benches) / sizeof(kernel_benches[0])));
+}
+
+#endif // ENABLE_KERNEL_BENCH
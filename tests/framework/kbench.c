@@ -0,0 +1,123 @@
+/*
+ * Kernel microbenchmark runner implementation
+ */
+
+#include "kbench.h"
+#include "hal/hal_uart.h"
+#include "hal/hal_timer.h"
+#include "kernel/kstring.h"
+#include "kernel/time.h"
+
+// Cycles per sample, sorted once the benchmark is done
+static uint64_t samples[KBENCH_SAMPLES];
+
+// Cost of timing an empty run, taken off every sample
+static uint64_t overhead_cycles;
+
+static void bench_nop(void) {
+}
+
+// Insertion sort: the sample count is small and fixed
+static void sort_samples(void) {
+    for (int i = 1; i < KBENCH_SAMPLES; i++) {
+        uint64_t v = samples[i];
+        int j = i - 1;
+        while (j >= 0 && samples[j] > v) {
+            samples[j + 1] = samples[j];
+            j--;
+        }
+        samples[j + 1] = v;
+    }
+}
+
+// Time run() KBENCH_SAMPLES times into samples[]; returns elapsed timer ticks
+static uint64_t take_samples(void (*run)(void)) {
+    for (int i = 0; i < KBENCH_WARMUP; i++) {
+        run();
+    }
+
+    uint64_t start_time = ktime_read();
+    for (int i = 0; i < KBENCH_SAMPLES; i++) {
+        uint64_t start = kbench_cycles();
+        run();
+        uint64_t cycles = kbench_cycles() - start;
+        samples[i] = cycles > overhead_cycles ? cycles - overhead_cycles : 0;
+    }
+    return ktime_read() - start_time;
+}
+
+static void calibrate(void) {
+    overhead_cycles = 0;
+    take_samples(bench_nop);
+    sort_samples();
+    overhead_cycles = samples[0];
+}
+
+static void print_result(struct kbench *bench) {
+    hal_uart_puts("kbench: ");
+    hal_uart_puts(bench->name);
+    if (bench->status == BENCH_SKIPPED) {
+        hal_uart_puts(" skipped\n");
+        return;
+    }
+    hal_uart_puts(" min=");
+    kprint_dec(bench->min_cycles);
+    hal_uart_puts(" med=");
+    kprint_dec(bench->median_cycles);
+    hal_uart_puts(" p99=");
+    kprint_dec(bench->p99_cycles);
+    hal_uart_puts(" cycles, mean=");
+    kprint_dec(bench->mean_ns);
+    hal_uart_puts(" ns\n");
+}
+
+// Run all benchmarks
+int kbench_run(struct kbench *benches, int num_benches) {
+    int skipped = 0;
+
+    hal_uart_puts("\n");
+    hal_uart_puts("========================================\n");
+    hal_uart_puts("  KBench Microbenchmarks - ThunderOS\n");
+    hal_uart_puts("========================================\n");
+
+    calibrate();
+    hal_uart_puts("Timing overhead: ");
+    kprint_dec(overhead_cycles);
+    hal_uart_puts(" cycles (subtracted)\n\n");
+
+    for (int i = 0; i < num_benches; i++) {
+        struct kbench *bench = &benches[i];
+        bench->status = BENCH_DONE;
+
+        if (bench->setup && bench->setup() != 0) {
+            bench->status = BENCH_SKIPPED;
+            skipped++;
+            print_result(bench);
+            continue;
+        }
+
+        uint64_t ticks = take_samples(bench->run);
+
+        if (bench->teardown) {
+            bench->teardown();
+        }
+
+        // The mean is from the timer, with the timing overhead left in
+        sort_samples();
+        bench->min_cycles = samples[0];
+        bench->median_cycles = samples[KBENCH_SAMPLES / 2];
+        bench->p99_cycles = samples[(KBENCH_SAMPLES * 99) / 100];
+        bench->mean_ns = (ticks * (1000000000UL / TIMER_FREQ_HZ)) / KBENCH_SAMPLES;
+        print_result(bench);
+    }
+
+    hal_uart_puts("\n========================================\n");
+    hal_uart_puts("Benchmarks: ");
+    kprint_dec(num_benches);
+    hal_uart_puts(" (");
+    kprint_dec(skipped);
+    hal_uart_puts(" skipped)\n");
+    hal_uart_puts("========================================\n\n");
+
+    return skipped;
+}
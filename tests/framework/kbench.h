@@ -0,0 +1,66 @@
+/*
+ * Kernel microbenchmark harness for ThunderOS
+ * Companion to kunit: times operations instead of checking them
+ *
+ * Each benchmark times one operation KBENCH_SAMPLES times, after
+ * KBENCH_WARMUP untimed runs, with the cycle counter (rdcycle); the cost
+ * of an empty run is measured first and taken off every sample. Results
+ * are min, median and 99th percentile cycles per operation, plus the mean
+ * time per operation from the timer (rdtime), one line per benchmark:
+ *
+ *   kbench: pmm_alloc_free min=412 med=455 p99=1210 cycles, mean=52 ns
+ *
+ * Only compiled when ENABLE_KERNEL_BENCH is defined (make bench).
+ */
+
+#ifndef KBENCH_H
+#define KBENCH_H
+
+#include <stdint.h>
+
+#ifndef NULL
+#define NULL ((void *)0)
+#endif
+
+// Untimed runs before sampling (fills caches, TLB and free lists)
+#define KBENCH_WARMUP   32
+
+// Timed runs per benchmark
+#define KBENCH_SAMPLES  512
+
+// Benchmark status
+enum bench_status {
+    BENCH_DONE = 0,
+    BENCH_SKIPPED = 1,
+};
+
+// Benchmark structure
+struct kbench {
+    const char *name;
+    int (*setup)(void);         // Optional; nonzero skips the benchmark
+    void (*run)(void);          // The operation timed, once per sample
+    void (*teardown)(void);     // Optional; runs after setup succeeded
+    enum bench_status status;
+    uint64_t min_cycles;
+    uint64_t median_cycles;
+    uint64_t p99_cycles;
+    uint64_t mean_ns;
+};
+
+// Benchmark definition macro (like KUNIT_CASE)
+#define KBENCH_CASE(bench_name, setup_fn, teardown_fn) \
+    { #bench_name, setup_fn, bench_name, teardown_fn, BENCH_DONE, 0, 0, 0, 0 }
+
+/**
+ * Read the cycle counter
+ */
+static inline uint64_t kbench_cycles(void) {
+    uint64_t cycles;
+    __asm__ volatile("rdcycle %0" : "=r"(cycles));
+    return cycles;
+}
+
+// Benchmark suite runner; returns the number of benchmarks skipped
+int kbench_run(struct kbench *benches, int num_benches);
+
+#endif // KBENCH_H
@@ -0,0 +1,148 @@
+#!/bin/bash
+#
+# ThunderOS Kernel Microbenchmarks
+# Boots a BENCH=1 TEST_MODE=1 kernel and collects its kbench results
+#
+# Results go to tests/outputs/bench_results.txt, one "kbench:" line per
+# benchmark. To catch regressions, keep a copy of an earlier run and
+# pass it as BENCH_BASELINE: any median that grew by more than
+# BENCH_THRESHOLD percent (default 20) fails the run.
+#
+#   BENCH_BASELINE=tests/outputs/bench_baseline.txt make bench
+#
+# Exit codes:
+#   0 - Benchmarks ran (and no regression against the baseline)
+#   1 - Build or boot failed, or a benchmark regressed
+#
+
+set -e
+
+# Ensure TERM is set for tput commands (needed for CI environments)
+export TERM="${TERM:-dumb}"
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+ROOT_DIR="${SCRIPT_DIR}/../.."
+BUILD_DIR="${ROOT_DIR}/build"
+OUTPUT_DIR="${SCRIPT_DIR}/../outputs"
+OUTPUT_FILE="${OUTPUT_DIR}/bench_output.txt"
+RESULTS_FILE="${OUTPUT_DIR}/bench_results.txt"
+QEMU_TIMEOUT=60
+BENCH_THRESHOLD="${BENCH_THRESHOLD:-20}"
+
+# QEMU detection
+if command -v qemu-system-riscv64 >/dev/null 2>&1; then
+    QEMU_BIN="${QEMU_BIN:-qemu-system-riscv64}"
+elif [ -x /tmp/qemu-10.1.2/build/qemu-system-riscv64 ]; then
+    QEMU_BIN="/tmp/qemu-10.1.2/build/qemu-system-riscv64"
+else
+    echo "ERROR: qemu-system-riscv64 not found"
+    exit 1
+fi
+
+mkdir -p "${OUTPUT_DIR}"
+
+# Colors
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+YELLOW='\033[1;33m'
+BLUE='\033[0;34m'
+NC='\033[0m'
+
+print_header() {
+    echo ""
+    echo "========================================"
+    echo "  $1"
+    echo "========================================"
+    echo ""
+}
+
+print_pass() { echo -e "  ${GREEN}[PASS]${NC} $1"; }
+print_fail() { echo -e "  ${RED}[FAIL]${NC} $1"; }
+print_info() { echo -e "  ${BLUE}[INFO]${NC} $1"; }
+print_test() { echo -e "\n${YELLOW}[TEST]${NC} $1"; }
+
+# Baseline path is relative to where make was run
+if [ -n "${BENCH_BASELINE}" ] && [ "${BENCH_BASELINE#/}" = "${BENCH_BASELINE}" ]; then
+    BENCH_BASELINE="${ROOT_DIR}/${BENCH_BASELINE}"
+fi
+
+# Build benchmark kernel (no shell) and the filesystem the file benchmark reads
+print_header "ThunderOS Kernel Microbenchmarks"
+print_info "Building benchmark kernel..."
+
+cd "${ROOT_DIR}"
+if make clean >/dev/null 2>&1 && make BENCH=1 TEST_MODE=1 >/dev/null 2>&1; then
+    print_pass "Kernel build successful"
+else
+    print_fail "Kernel build failed"
+    exit 1
+fi
+
+if make fs >/dev/null 2>&1; then
+    print_pass "Filesystem created"
+else
+    print_fail "Filesystem creation failed"
+    exit 1
+fi
+
+# Run QEMU
+print_test "Running benchmarks in QEMU (${QEMU_TIMEOUT}s timeout)"
+
+timeout $((QEMU_TIMEOUT + 2)) "${QEMU_BIN}" \
+    -machine virt \
+    -m 128M \
+    -smp 2 \
+    -nographic \
+    -serial mon:stdio \
+    -bios none \
+    -kernel "${BUILD_DIR}/thunderos.elf" \
+    -global virtio-mmio.force-legacy=false \
+    -drive file="${BUILD_DIR}/fs.img",if=none,format=raw,id=hd0 \
+    -device virtio-blk-device,drive=hd0 \
+    </dev/null > "${OUTPUT_FILE}" 2>&1 || true
+
+grep "^kbench: " "${OUTPUT_FILE}" | tr -d '\r' > "${RESULTS_FILE}" || true
+
+if [ ! -s "${RESULTS_FILE}" ]; then
+    print_fail "No benchmark results (see ${OUTPUT_FILE})"
+    exit 1
+fi
+
+print_header "Benchmark Results"
+cat "${RESULTS_FILE}"
+
+if [ -z "${BENCH_BASELINE}" ]; then
+    exit 0
+fi
+
+if [ ! -f "${BENCH_BASELINE}" ]; then
+    print_fail "Baseline ${BENCH_BASELINE} not found"
+    exit 1
+fi
+
+# Compare medians with the baseline
+print_header "Compared With Baseline (+${BENCH_THRESHOLD}% allowed)"
+
+REGRESSED=0
+while read -r _ name rest; do
+    med=$(echo "${rest}" | sed -n 's/.*med=\([0-9]*\).*/\1/p')
+    base=$(grep "^kbench: ${name} " "${BENCH_BASELINE}" | sed -n 's/.*med=\([0-9]*\).*/\1/p')
+    if [ -z "${med}" ] || [ -z "${base}" ] || [ "${base}" -eq 0 ]; then
+        print_info "${name}: no comparison"
+        continue
+    fi
+    change=$(( (med - base) * 100 / base ))
+    if [ "${change}" -gt "${BENCH_THRESHOLD}" ]; then
+        print_fail "${name}: median ${base} -> ${med} cycles (+${change}%)"
+        REGRESSED=$((REGRESSED + 1))
+    else
+        print_pass "${name}: median ${base} -> ${med} cycles (${change}%)"
+    fi
+done < "${RESULTS_FILE}"
+
+if [ "${REGRESSED}" -ne 0 ]; then
+    echo ""
+    echo -e "${RED}${REGRESSED} benchmark(s) regressed${NC}"
+    exit 1
+fi
+exit 0
@@ -0,0 +1,380 @@
+#!/bin/bash
+#
+# ThunderOS Performance Regression Runner
+# Runs the kernel microbenchmarks and the userland benchmarks and compares
+# the results with a stored baseline
+#
+# Two boots, both headless with the same fixed QEMU settings:
+#   1. A BENCH=1 TEST_MODE=1 kernel; its "kbench:" lines become JSON lines
+#      named kbench_<name>, compared on median_cycles
+#   2. A normal kernel with the shell, which runs "source /bench.sh"; the
+#      userland/bench JSON lines are compared on ns_per_op
+#
+# Results go to tests/outputs/benchmarks.jsonl. A benchmark fails when it
+# got slower than the baseline by more than its threshold (percent):
+# BENCH_THRESHOLD (default 20) unless tests/bench/thresholds.txt names
+# its own. A benchmark that reports an error, or that is in the baseline
+# but not in the run, fails too.
+#
+# Usage: ./run_benchmarks.sh [--update-baseline] [--kernel-only | --user-only]
+#   --update-baseline: store this run as the baseline instead of comparing
+#   --kernel-only:     skip the userland benchmarks
+#   --user-only:       skip the kernel microbenchmarks
+#
+# Environment:
+#   BENCH_BASELINE        Baseline file (default tests/bench/baseline.jsonl)
+#   BENCH_THRESHOLD       Default threshold in percent (default 20)
+#   BENCH_THRESHOLD_FILE  Per-benchmark thresholds (default tests/bench/thresholds.txt)
+#
+# Exit codes:
+#   0 - Benchmarks ran and none regressed (or the baseline was updated)
+#   1 - Build or boot failed, or a benchmark regressed
+#
+
+set -e
+
+# Ensure TERM is set for tput commands (needed for CI environments)
+export TERM="${TERM:-dumb}"
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+ROOT_DIR="$(cd "${SCRIPT_DIR}/../.." && pwd)"
+BUILD_DIR="${ROOT_DIR}/build"
+OUTPUT_DIR="${SCRIPT_DIR}/../outputs"
+KERNEL_OUTPUT="${OUTPUT_DIR}/benchmarks_kernel_output.txt"
+USER_OUTPUT="${OUTPUT_DIR}/benchmarks_user_output.txt"
+RESULTS_FILE="${OUTPUT_DIR}/benchmarks.jsonl"
+
+BENCH_BASELINE="${BENCH_BASELINE:-tests/bench/baseline.jsonl}"
+BENCH_THRESHOLD="${BENCH_THRESHOLD:-20}"
+BENCH_THRESHOLD_FILE="${BENCH_THRESHOLD_FILE:-tests/bench/thresholds.txt}"
+
+# Fixed machine: results are only comparable with a baseline taken on the
+# same settings, so they are recorded with the results and checked
+BENCH_QEMU_SMP=2
+BENCH_QEMU_MEM_MB=128
+
+KERNEL_TIMEOUT=60       # Boot plus kbench
+BOOT_TIMEOUT=60         # Until the shell prompt
+USER_TIMEOUT=300        # For the whole of /bench.sh
+
+SHELL_PROMPT="ush> "
+
+# QEMU detection
+if command -v qemu-system-riscv64 >/dev/null 2>&1; then
+    QEMU_BIN="${QEMU_BIN:-qemu-system-riscv64}"
+elif [ -x /tmp/qemu-10.1.2/build/qemu-system-riscv64 ]; then
+    QEMU_BIN="/tmp/qemu-10.1.2/build/qemu-system-riscv64"
+else
+    echo "ERROR: qemu-system-riscv64 not found"
+    exit 1
+fi
+
+mkdir -p "${OUTPUT_DIR}"
+
+# Colors
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+YELLOW='\033[1;33m'
+BLUE='\033[0;34m'
+NC='\033[0m'
+
+print_header() {
+    echo ""
+    echo "========================================"
+    echo "  $1"
+    echo "========================================"
+    echo ""
+}
+
+print_pass() { echo -e "  ${GREEN}[PASS]${NC} $1"; }
+print_fail() { echo -e "  ${RED}[FAIL]${NC} $1"; }
+print_info() { echo -e "  ${BLUE}[INFO]${NC} $1"; }
+print_test() { echo -e "\n${YELLOW}[TEST]${NC} $1"; }
+
+UPDATE_BASELINE=0
+RUN_KERNEL=1
+RUN_USER=1
+
+# Parse arguments
+for arg in "$@"; do
+    case $arg in
+        --update-baseline)
+            UPDATE_BASELINE=1
+            ;;
+        --kernel-only)
+            RUN_USER=0
+            ;;
+        --user-only)
+            RUN_KERNEL=0
+            ;;
+        *)
+            echo "Usage: $0 [--update-baseline] [--kernel-only | --user-only]"
+            exit 1
+            ;;
+    esac
+done
+
+# Paths are relative to the repository root
+case "${BENCH_BASELINE}" in
+    /*) ;;
+    *) BENCH_BASELINE="${ROOT_DIR}/${BENCH_BASELINE}" ;;
+esac
+case "${BENCH_THRESHOLD_FILE}" in
+    /*) ;;
+    *) BENCH_THRESHOLD_FILE="${ROOT_DIR}/${BENCH_THRESHOLD_FILE}" ;;
+esac
+
+# Boot the kernel in build/ headless; stdin is the serial console
+run_qemu() {
+    local timeout_secs=$1
+
+    timeout $((timeout_secs + 2)) "${QEMU_BIN}" \
+        -machine virt \
+        -m "${BENCH_QEMU_MEM_MB}M" \
+        -smp "${BENCH_QEMU_SMP}" \
+        -nographic \
+        -serial mon:stdio \
+        -bios none \
+        -kernel "${BUILD_DIR}/thunderos.elf" \
+        -global virtio-mmio.force-legacy=false \
+        -drive file="${BUILD_DIR}/fs.img",if=none,format=raw,id=hd0 \
+        -device virtio-blk-device,drive=hd0 \
+        2>&1 || true
+}
+
+# Wait until the shell has printed its prompt $2 times in file $1
+wait_for_prompts() {
+    local file=$1
+    local count=$2
+    local timeout_secs=$3
+    local waited=0
+
+    while [ "${waited}" -lt "${timeout_secs}" ]; do
+        if [ "$(grep -o "${SHELL_PROMPT}" "${file}" 2>/dev/null | wc -l)" -ge "${count}" ]; then
+            return 0
+        fi
+        sleep 1
+        waited=$((waited + 1))
+    done
+    return 1
+}
+
+# Type the benchmark script into the shell and power off once it is done
+drive_shell() {
+    wait_for_prompts "${USER_OUTPUT}" 1 "${BOOT_TIMEOUT}" || return 0
+    echo "source /bench.sh"
+    wait_for_prompts "${USER_OUTPUT}" 2 "${USER_TIMEOUT}" || return 0
+    echo "poweroff"
+    sleep 2
+}
+
+print_header "ThunderOS Performance Regression Run"
+print_info "QEMU: virt, ${BENCH_QEMU_SMP} CPUs, ${BENCH_QEMU_MEM_MB}M"
+
+echo "{\"bench\":\"config\",\"qemu_smp\":${BENCH_QEMU_SMP},\"qemu_mem_mb\":${BENCH_QEMU_MEM_MB}}" > "${RESULTS_FILE}"
+
+cd "${ROOT_DIR}"
+
+# ========================================
+# Kernel microbenchmarks
+# ========================================
+
+if [ "${RUN_KERNEL}" -eq 1 ]; then
+    print_test "Kernel microbenchmarks"
+
+    if make clean >/dev/null 2>&1 && make BENCH=1 TEST_MODE=1 >/dev/null 2>&1 && make fs >/dev/null 2>&1; then
+        print_pass "Benchmark kernel and filesystem built"
+    else
+        print_fail "Benchmark kernel build failed"
+        exit 1
+    fi
+
+    run_qemu "${KERNEL_TIMEOUT}" </dev/null > "${KERNEL_OUTPUT}"
+
+    # kbench: <name> min=<n> med=<n> p99=<n> cycles, mean=<n> ns
+    BEFORE=$(wc -l < "${RESULTS_FILE}")
+    tr -d '\r' < "${KERNEL_OUTPUT}" | sed -n \
+        -e 's/^kbench: \([A-Za-z0-9_]*\) min=\([0-9]*\) med=\([0-9]*\) p99=\([0-9]*\) cycles, mean=\([0-9]*\) ns$/{"bench":"kbench_\1","min_cycles":\2,"median_cycles":\3,"p99_cycles":\4,"mean_ns":\5}/p' \
+        -e 's/^kbench: \([A-Za-z0-9_]*\) skipped$/{"bench":"kbench_\1","error":"skipped"}/p' \
+        >> "${RESULTS_FILE}"
+    FOUND=$(( $(wc -l < "${RESULTS_FILE}") - BEFORE ))
+
+    if [ "${FOUND}" -eq 0 ]; then
+        print_fail "No kernel benchmark results (see ${KERNEL_OUTPUT})"
+        exit 1
+    fi
+    print_pass "${FOUND} kernel benchmark results"
+fi
+
+# ========================================
+# Userland benchmarks
+# ========================================
+
+if [ "${RUN_USER}" -eq 1 ]; then
+    print_test "Userland benchmarks"
+
+    if make clean >/dev/null 2>&1 && make TEST_MODE=0 >/dev/null 2>&1 && make fs >/dev/null 2>&1; then
+        print_pass "Kernel, userland and filesystem built"
+    else
+        print_fail "Kernel or userland build failed"
+        exit 1
+    fi
+
+    : > "${USER_OUTPUT}"
+    drive_shell | run_qemu $((BOOT_TIMEOUT + USER_TIMEOUT)) > "${USER_OUTPUT}"
+
+    BEFORE=$(wc -l < "${RESULTS_FILE}")
+    tr -d '\r' < "${USER_OUTPUT}" | grep '^{"bench":' >> "${RESULTS_FILE}" || true
+    FOUND=$(( $(wc -l < "${RESULTS_FILE}") - BEFORE ))
+
+    if [ "${FOUND}" -eq 0 ]; then
+        print_fail "No userland benchmark results (see ${USER_OUTPUT})"
+        exit 1
+    fi
+    print_pass "${FOUND} userland benchmark results"
+fi
+
+print_header "Benchmark Results"
+cat "${RESULTS_FILE}"
+
+if [ "${UPDATE_BASELINE}" -eq 1 ]; then
+    mkdir -p "$(dirname "${BENCH_BASELINE}")"
+    cp "${RESULTS_FILE}" "${BENCH_BASELINE}"
+    echo ""
+    print_pass "Baseline updated: ${BENCH_BASELINE}"
+    exit 0
+fi
+
+if [ ! -f "${BENCH_BASELINE}" ]; then
+    echo ""
+    print_info "No baseline at ${BENCH_BASELINE}; run with --update-baseline to store one"
+    exit 0
+fi
+
+# ========================================
+# Compare with the baseline
+# ========================================
+
+print_header "Compared With Baseline (+${BENCH_THRESHOLD}% allowed by default)"
+
+THRESHOLDS="/dev/null"
+if [ -f "${BENCH_THRESHOLD_FILE}" ]; then
+    THRESHOLDS="${BENCH_THRESHOLD_FILE}"
+fi
+
+# Each line of the comparison is "<PASS|FAIL|INFO> <message>". A result
+# is identified by its name and parameters (every field that is not a
+# measurement), so pipe_bandwidth at each buffer size compares separately.
+COMPARISON=$(awk -v default_threshold="${BENCH_THRESHOLD}" \
+    -v run_kernel="${RUN_KERNEL}" -v run_user="${RUN_USER}" '
+function parse(line, f,    body, n, parts, i, p, key, value) {
+    split("", f)
+    f["id"] = ""
+    body = line
+    sub(/^[[:space:]]*\{/, "", body)
+    sub(/\}[[:space:]]*$/, "", body)
+    n = split(body, parts, ",")
+    for (i = 1; i <= n; i++) {
+        p = index(parts[i], ":")
+        if (p == 0) {
+            continue
+        }
+        key = substr(parts[i], 1, p - 1)
+        value = substr(parts[i], p + 1)
+        gsub(/"/, "", key)
+        gsub(/"/, "", value)
+        f[key] = value
+        if (key !~ /^(error|iterations|elapsed_ms|kb_per_s|mean_ns)$/ && key !~ /^ns_per_/ && key !~ /_cycles$/) {
+            f["id"] = f["id"] (f["id"] == "" ? "" : " ") (key == "bench" ? value : key "=" value)
+        }
+    }
+}
+function metric_name(f) {
+    return ("median_cycles" in f) ? "median_cycles" : "ns_per_op"
+}
+function selected(name) {
+    return (name ~ /^kbench_/) ? run_kernel : run_user
+}
+FILENAME == ARGV[1] {
+    # Thresholds: "<bench> <percent>", # comments
+    if ($0 !~ /^[[:space:]]*(#|$)/) {
+        threshold[$1] = $2
+    }
+    next
+}
+FILENAME == ARGV[2] {
+    parse($0, f)
+    if (f["bench"] == "config") {
+        base_config = f["id"]
+    } else if (!("error" in f) && selected(f["bench"])) {
+        base[f["id"]] = f[metric_name(f)]
+        base_order[++base_count] = f["id"]
+    }
+    next
+}
+{
+    parse($0, f)
+    name = f["bench"]
+    if (name == "config") {
+        if (base_config != "" && f["id"] != base_config) {
+            print "FAIL baseline settings (" base_config ") differ from this run (" f["id"] ")"
+            config_mismatch = 1
+        }
+        next
+    }
+    if (config_mismatch) {
+        next
+    }
+    seen[f["id"]] = 1
+    if ("error" in f) {
+        print "FAIL " f["id"] ": " f["error"]
+        next
+    }
+    if (!(f["id"] in base)) {
+        print "INFO " f["id"] ": not in baseline"
+        next
+    }
+    metric = metric_name(f)
+    old = base[f["id"]] + 0
+    cur = f[metric] + 0
+    if (old == 0) {
+        print "INFO " f["id"] ": no comparison"
+        next
+    }
+    limit = (name in threshold) ? threshold[name] : default_threshold
+    change = int((cur - old) * 100 / old)
+    text = f["id"] ": " metric " " old " -> " cur " (" (change >= 0 ? "+" : "") change "%)"
+    if (change > limit + 0) {
+        print "FAIL " text ", limit +" limit "%"
+    } else {
+        print "PASS " text
+    }
+}
+END {
+    if (config_mismatch) {
+        exit
+    }
+    for (i = 1; i <= base_count; i++) {
+        if (!(base_order[i] in seen)) {
+            print "FAIL " base_order[i] ": missing from this run"
+        }
+    }
+}
+' "${THRESHOLDS}" "${BENCH_BASELINE}" "${RESULTS_FILE}")
+
+REGRESSED=0
+while read -r status message; do
+    case "${status}" in
+        PASS) print_pass "${message}" ;;
+        FAIL) print_fail "${message}"; REGRESSED=$((REGRESSED + 1)) ;;
+        INFO) print_info "${message}" ;;
+    esac
+done <<< "${COMPARISON}"
+
+echo ""
+if [ "${REGRESSED}" -ne 0 ]; then
+    echo -e "${RED}${REGRESSED} benchmark(s) regressed or failed${NC}"
+    exit 1
+fi
+echo -e "${GREEN}No regressions${NC}"
+exit 0
@@ -7,6 +7,9 @@
  * - Heap isolation (sys_brk)
  * - Memory protection enforcement
  * - Fork memory copying
+ * - VMA tree lookup and gap search
+ * - File-backed mappings through the page cache
+ * - Per-process RSS and page fault accounting
  */
 
 #ifdef ENABLE_KERNEL_TESTS
@@ -16,6 +19,8 @@
 #include "mm/pmm.h"
 #include "mm/kmalloc.h"
 #include "kernel/kstring.h"
+#include "fs/vfs.h"
+#include "fs/page_cache.h"
 #include "hal/hal_uart.h"
 
 // Simple test framework
@@ -54,10 +59,10 @@ static int tests_failed = 0;
 // Test helper to create a minimal test process structure
 static struct process *create_test_process_struct(const char *name) {
     // Static test process structures
-    static struct process test_procs[20];
+    static struct process test_procs[26];
     static int next_test_proc = 0;
     
-    if (next_test_proc >= 20) {
+    if (next_test_proc >= 26) {
         return NULL;
     }
     
@@ -494,6 +499,226 @@ static void test_heap_safety_margins(void) {
     TEST_PASS();
 }
 
+/**
+ * Test 16: VMA tree keeps order and finds gaps
+ */
+static void test_vma_tree_lookup_and_gaps(void) {
+    TEST_START("VMA tree keeps order and finds gaps");
+    
+    struct process *proc = create_test_process_struct("test_proc16");
+    ASSERT(proc != NULL, "Process creation failed");
+    
+    // Insert 16 one-page VMAs out of order, every other page left free
+    for (int i = 0; i < 16; i++) {
+        uint64_t slot = (uint64_t)((i * 7) % 16);
+        uint64_t start = 0x1000000 + slot * 2 * PAGE_SIZE;
+        ASSERT(process_add_vma(proc, start, start + PAGE_SIZE, VM_READ | VM_USER) == 0,
+               "process_add_vma failed");
+    }
+    
+    // List is sorted by address
+    uint64_t last = 0;
+    int count = 0;
+    for (vm_area_t *vma = proc->vm_areas; vma; vma = vma->next) {
+        ASSERT(vma->start > last, "VMA list not sorted");
+        last = vma->start;
+        count++;
+    }
+    ASSERT(count == 16, "Wrong number of VMAs in list");
+    
+    // Every VMA is found, every hole is not
+    for (int i = 0; i < 16; i++) {
+        uint64_t start = 0x1000000 + (uint64_t)i * 2 * PAGE_SIZE;
+        vm_area_t *vma = process_find_vma(proc, start + 0x10);
+        ASSERT(vma != NULL && vma->start == start, "VMA lookup failed");
+        ASSERT(process_find_vma(proc, start + PAGE_SIZE) == NULL, "Hole reported as mapped");
+    }
+    
+    // One-page holes fit one page, not two
+    uint64_t gap = process_find_free_area(proc, 0x1000000, PAGE_SIZE);
+    ASSERT(gap == 0x1000000 + PAGE_SIZE, "First one-page gap not found");
+    gap = process_find_free_area(proc, 0x1000000, 2 * PAGE_SIZE);
+    ASSERT(gap == 0x1000000 + 31 * PAGE_SIZE, "Two-page gap should be after last VMA");
+    
+    // Removing a VMA merges its neighbouring holes
+    vm_area_t *victim = process_find_vma(proc, 0x1000000 + 6 * PAGE_SIZE);
+    ASSERT(victim != NULL, "VMA to remove not found");
+    process_remove_vma(proc, victim);
+    gap = process_find_free_area(proc, 0x1000000, 3 * PAGE_SIZE);
+    ASSERT(gap == 0x1000000 + 5 * PAGE_SIZE, "Merged gap not found");
+    
+    cleanup_test_process(proc);
+    
+    TEST_PASS();
+}
+
+// In-memory file for the file mapping test
+static uint8_t fake_file_data[2 * PAGE_SIZE];
+static int fake_file_writes = 0;
+
+static int fake_file_read(vfs_node_t *node, uint64_t offset, void *buffer, uint32_t size) {
+    (void)node;
+    kmemcpy(buffer, fake_file_data + offset, size);
+    return (int)size;
+}
+
+static int fake_file_write(vfs_node_t *node, uint64_t offset, const void *buffer, uint32_t size) {
+    (void)node;
+    kmemcpy(fake_file_data + offset, buffer, size);
+    fake_file_writes++;
+    return (int)size;
+}
+
+static vfs_ops_t fake_file_ops = {
+    .read = fake_file_read,
+    .write = fake_file_write,
+};
+
+/**
+ * Test 17: File mappings share page cache pages and write back
+ */
+static void test_file_mapping_page_cache(void) {
+    TEST_START("File mappings share page cache pages and write back");
+    
+    static vfs_node_t file;
+    kmemset(&file, 0, sizeof(file));
+    file.inode = 0xFFFF0017;
+    file.type = VFS_TYPE_FILE;
+    file.size = 2 * PAGE_SIZE - 100;
+    file.ops = &fake_file_ops;
+    
+    for (uint32_t i = 0; i < sizeof(fake_file_data); i++) {
+        fake_file_data[i] = (uint8_t)(i * 7 + 1);
+    }
+    fake_file_writes = 0;
+    
+    struct process *proc1 = create_test_process_struct("test_proc17a");
+    struct process *proc2 = create_test_process_struct("test_proc17b");
+    struct process *proc3 = create_test_process_struct("test_proc17c");
+    ASSERT(proc1 && proc2 && proc3, "Process creation failed");
+    
+    uint64_t base = 0x2000000;
+    uint32_t shared = VM_READ | VM_WRITE | VM_USER | VM_SHARED;
+    ASSERT(process_add_file_vma(proc1, base, base + 2 * PAGE_SIZE, shared, &file, 0) == 0,
+           "Shared VMA creation failed");
+    ASSERT(process_add_file_vma(proc2, base, base + 2 * PAGE_SIZE, shared, &file, 0) == 0,
+           "Shared VMA creation failed");
+    ASSERT(process_add_file_vma(proc3, base, base + 2 * PAGE_SIZE,
+                                VM_READ | VM_WRITE | VM_USER, &file, 0) == 0,
+           "Private VMA creation failed");
+    
+    // Read faults in both processes map the same cached page
+    uintptr_t pa1, pa2, pa3;
+    ASSERT(process_handle_page_fault(proc1, base + 8, CAUSE_LOAD_PAGE_FAULT) == 0,
+           "Load fault not handled");
+    ASSERT(process_handle_page_fault(proc2, base + 8, CAUSE_LOAD_PAGE_FAULT) == 0,
+           "Load fault not handled");
+    ASSERT(virt_to_phys(proc1->page_table, base, &pa1) == 0 &&
+           virt_to_phys(proc2->page_table, base, &pa2) == 0, "File page not mapped");
+    ASSERT(pa1 == pa2, "Shared mappings use different pages");
+    ASSERT(*(uint8_t *)(pa1 + 8) == fake_file_data[8], "File page has wrong contents");
+    
+    // Bytes past end of file read as zero
+    ASSERT(process_handle_page_fault(proc1, base + PAGE_SIZE, CAUSE_LOAD_PAGE_FAULT) == 0,
+           "Load fault on last page not handled");
+    uintptr_t tail;
+    ASSERT(virt_to_phys(proc1->page_table, base + PAGE_SIZE, &tail) == 0, "Last page not mapped");
+    ASSERT(*(uint8_t *)(tail + PAGE_SIZE - 100) == 0, "Bytes past EOF not zeroed");
+    
+    // A store dirties the page; syncing writes it to the file
+    ASSERT(process_handle_page_fault(proc1, base, CAUSE_STORE_PAGE_FAULT) == 0,
+           "Store fault not handled");
+    *(uint8_t *)pa1 = 0x5A;
+    vm_area_t *vma1 = process_find_vma(proc1, base);
+    ASSERT(process_sync_vma(vma1, base, base + 2 * PAGE_SIZE) == 0, "Sync failed");
+    ASSERT(fake_file_writes == 1, "Expected exactly one page written back");
+    ASSERT(fake_file_data[0] == 0x5A, "Written data not in file");
+    
+    // A private mapping sees the data but writes go to its own copy
+    ASSERT(process_handle_page_fault(proc3, base, CAUSE_STORE_PAGE_FAULT) == 0,
+           "Private store fault not handled");
+    ASSERT(virt_to_phys(proc3->page_table, base, &pa3) == 0, "Private page not mapped");
+    ASSERT(pa3 != pa1, "Private write did not copy the page");
+    ASSERT(*(uint8_t *)pa3 == 0x5A, "Private copy has wrong contents");
+    
+    cleanup_test_process(proc3);
+    cleanup_test_process(proc2);
+    cleanup_test_process(proc1);
+    page_cache_invalidate(NULL, file.inode);
+    
+    TEST_PASS();
+}
+
+/**
+ * Test 18: Faults and unmaps keep RSS and fault counters accurate
+ */
+static void test_rss_and_fault_accounting(void) {
+    TEST_START("Faults and unmaps keep RSS and fault counters accurate");
+    
+    static vfs_node_t file;
+    kmemset(&file, 0, sizeof(file));
+    file.inode = 0xFFFF0018;
+    file.type = VFS_TYPE_FILE;
+    file.size = PAGE_SIZE;
+    file.ops = &fake_file_ops;
+    
+    struct process *proc1 = create_test_process_struct("test_proc18a");
+    struct process *proc2 = create_test_process_struct("test_proc18b");
+    ASSERT(proc1 && proc2, "Process creation failed");
+    
+    uint64_t anon = 0x3000000;
+    uint64_t mapped = 0x3100000;
+    ASSERT(process_add_vma(proc1, anon, anon + 4 * PAGE_SIZE,
+                           VM_READ | VM_WRITE | VM_USER) == 0, "Anonymous VMA creation failed");
+    
+    // Reading untouched memory maps the zero page: a fault but no RSS
+    ASSERT(process_handle_page_fault(proc1, anon, CAUSE_LOAD_PAGE_FAULT) == 0,
+           "Load fault not handled");
+    ASSERT(proc1->minor_faults == 1 && proc1->rss_pages == 0,
+           "Zero page mapping should not count as resident");
+    
+    // Writing it, and a fresh page, makes both resident
+    ASSERT(process_handle_page_fault(proc1, anon, CAUSE_STORE_PAGE_FAULT) == 0,
+           "Zero page COW fault not handled");
+    ASSERT(process_handle_page_fault(proc1, anon + PAGE_SIZE, CAUSE_STORE_PAGE_FAULT) == 0,
+           "Store fault not handled");
+    ASSERT(proc1->minor_faults == 3 && proc1->rss_pages == 2, "Stores not accounted");
+    
+    // First touch of an uncached file page is a major fault, later ones minor
+    ASSERT(process_add_file_vma(proc1, mapped, mapped + PAGE_SIZE,
+                                VM_READ | VM_USER, &file, 0) == 0, "File VMA creation failed");
+    ASSERT(process_add_file_vma(proc2, mapped, mapped + PAGE_SIZE,
+                                VM_READ | VM_USER, &file, 0) == 0, "File VMA creation failed");
+    ASSERT(process_handle_page_fault(proc1, mapped, CAUSE_LOAD_PAGE_FAULT) == 0,
+           "File fault not handled");
+    ASSERT(process_handle_page_fault(proc2, mapped, CAUSE_LOAD_PAGE_FAULT) == 0,
+           "File fault not handled");
+    ASSERT(proc1->major_faults == 1 && proc2->major_faults == 0 && proc2->minor_faults == 1,
+           "Page cache hit/miss not reflected in fault counts");
+    ASSERT(proc1->rss_pages == 3 && proc2->rss_pages == 1, "File pages not resident");
+    
+    // Incremental counts agree with a page table walk
+    uint64_t rss = proc1->rss_pages;
+    process_update_mm_stats(proc1);
+    ASSERT(proc1->rss_pages == rss, "RSS drifted from page table contents");
+    ASSERT(proc1->pt_pages >= 3, "Page-table pages not counted");
+    
+    // Unmapping lowers RSS but not the peak
+    mmu_gather_t tlb;
+    tlb_gather_init(&tlb, proc1->page_table);
+    tlb_gather_unmap_range(&tlb, anon, anon + 4 * PAGE_SIZE);
+    tlb_gather_finish(&tlb);
+    ASSERT(tlb.unmapped == 2, "Gather should count two resident pages");
+    process_account_rss(proc1, -(int64_t)tlb.unmapped);
+    ASSERT(proc1->rss_pages == 1 && proc1->peak_rss_pages == 3, "Unmap not accounted");
+    
+    cleanup_test_process(proc2);
+    cleanup_test_process(proc1);
+    page_cache_invalidate(NULL, file.inode);
+    
+    TEST_PASS();
+}
+
 /**
  * Main test runner
  */
@@ -521,6 +746,9 @@ void run_memory_isolation_tests(void) {
     test_remove_vma();
     test_cross_process_isolation();
     test_heap_safety_margins();
+    test_vma_tree_lookup_and_gaps();
+    test_file_mapping_page_cache();
+    test_rss_and_fault_accounting();
     
     // Print summary
     hal_uart_puts("\n========================================\n");
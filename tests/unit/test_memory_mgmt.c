@@ -1,7 +1,9 @@
 /*
  * Memory Management Test Program
  * 
- * Tests DMA allocation, address translation, and memory barriers
+ * Tests DMA allocation, address translation, memory barriers, kmalloc,
+ * packet buffers, softirqs, trace rings, page reclaim, kernel stacks and
+ * page table teardown
  * 
  * This file is only compiled when ENABLE_KERNEL_TESTS is defined.
  */
@@ -12,8 +14,89 @@
 #include "mm/dma.h"
 #include "mm/paging.h"
 #include "mm/pmm.h"
+#include "mm/kmalloc.h"
+#include "mm/slab.h"
+#include "mm/page.h"
+#include "mm/reclaim.h"
+#include "mm/swap.h"
+#include "mm/kstack.h"
+#include "net/skbuff.h"
+#include "net/net.h"
 #include "kernel/kstring.h"
+#include "kernel/softirq.h"
+#include "kernel/trace.h"
+#include "kernel/prof.h"
+#include "arch/sbi.h"
+#include "kernel/acct.h"
+#include "kernel/syscall.h"
+#include "fs/procfs.h"
+#include "kernel/lockstat.h"
+#include "kernel/bootstage.h"
+#include "kernel/vdso.h"
+#include "kernel/scheduler.h"
+#include "kernel/smp.h"
+#include "kernel/rgroup.h"
+#include "hal/hal_timer.h"
+#include "kernel/errno.h"
+#include "kernel/constants.h"
+#include "trap.h"
 #include "arch/barrier.h"
+#include "arch/interrupt.h"
+
+// Constructor used by the kmem_cache test: tags each object once
+static void test_cache_ctor(void *obj) {
+    *(uint32_t *)obj = 0xC0FFEE;
+}
+
+// Used by the procfs test: does s start with prefix
+static int test_starts_with(const char *s, const char *prefix) {
+    while (*prefix && *s == *prefix) {
+        s++;
+        prefix++;
+    }
+    return *prefix == '\0';
+}
+
+// File body used by the seq_file test
+static void test_seq_show(seq_file_t *m, void *v) {
+    (void)v;
+    seq_puts(m, "test\n");
+}
+
+// Shrinker and LRU owner used by the reclaim test
+static size_t test_shrink_calls;
+static size_t test_shrink_first_nr;
+static struct page *test_lru_victim;
+
+static size_t test_shrink_count(shrinker_t *shrinker) {
+    (void)shrinker;
+    return 128;
+}
+
+static size_t test_shrink_scan(shrinker_t *shrinker, size_t nr, uint32_t flags) {
+    (void)shrinker;
+    (void)flags;
+    if (test_shrink_calls++ == 0) {
+        test_shrink_first_nr = nr;
+    }
+    return 0;
+}
+
+static int test_lru_evict(struct page *page) {
+    if (page != test_lru_victim) {
+        return 0;
+    }
+    lru_del(page);
+    return 1;
+}
+
+// Tasklet used by the softirq test: counts its runs
+static int test_tasklet_runs;
+
+static void test_tasklet_fn(tasklet_t *tasklet) {
+    (void)tasklet;
+    test_tasklet_runs++;
+}
 
 void test_memory_management(void) {
     hal_uart_puts("\n");
@@ -299,6 +382,1754 @@ void test_memory_management(void) {
         hal_uart_puts("SKIP (region2 is NULL)\n");
     }
     
+    // ========================================
+    // Test 11: kmalloc Slab Size Classes
+    // ========================================
+    hal_uart_puts("\nTest 11: kmalloc Slab Size Classes\n");
+    hal_uart_puts("  Allocating and freeing small objects... ");
+    tests_total++;
+    
+    {
+        kmalloc_stats_t before, during, after;
+        kmalloc_get_stats(&before);
+        
+        void *small[32];
+        int ok = 1;
+        for (int i = 0; i < 32; i++) {
+            small[i] = kmalloc(24);
+            if (small[i] == NULL || ((uintptr_t)small[i] % KMALLOC_MIN_ALIGN) != 0) {
+                ok = 0;
+            }
+        }
+        
+        // 32 objects of the 32-byte class share a single page
+        kmalloc_get_stats(&during);
+        if (during.class_objects[1] != before.class_objects[1] + 32 ||
+            during.slab_pages > before.slab_pages + 1) {
+            ok = 0;
+        }
+        
+        for (int i = 0; i < 32; i++) {
+            kfree(small[i]);
+        }
+        
+        kmalloc_get_stats(&after);
+        if (after.slab_objects != before.slab_objects) {
+            ok = 0;
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 12: kmem_cache Constructed Objects
+    // ========================================
+    hal_uart_puts("\nTest 12: kmem_cache Constructed Objects\n");
+    hal_uart_puts("  Creating cache with constructor... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        kmem_cache_t *cache = kmem_cache_create("test_obj", 40, 0, test_cache_ctor);
+        if (cache == NULL) {
+            ok = 0;
+        } else {
+            uint32_t *a = (uint32_t *)kmem_cache_alloc(cache);
+            uint32_t *b = (uint32_t *)kmem_cache_alloc(cache);
+            if (!a || !b || *a != 0xC0FFEE || *b != 0xC0FFEE || kmem_cache_of(a) != cache) {
+                ok = 0;
+            }
+            
+            // Freeing must not clobber constructed state
+            kmem_cache_free(cache, a);
+            uint32_t *c = (uint32_t *)kmem_cache_alloc(cache);
+            if (c != a || *c != 0xC0FFEE) {
+                ok = 0;
+            }
+            
+            // kfree() hands cache objects back to their owner
+            kfree(b);
+            kmem_cache_free(cache, c);
+            
+            if (kmem_cache_destroy(cache) != 0) {
+                ok = 0;
+            }
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 13: Buddy Allocator Split and Coalesce
+    // ========================================
+    hal_uart_puts("\nTest 13: Buddy Allocator Split and Coalesce\n");
+    hal_uart_puts("  Allocating and freeing page runs... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        size_t free_before, free_after, total;
+        size_t orders_before[PMM_MAX_ORDER + 1];
+        size_t orders_after[PMM_MAX_ORDER + 1];
+        
+        // Single pages are freed to the per-CPU cache: merge them first
+        pmm_drain_pcp();
+        pmm_get_stats(&total, &free_before);
+        pmm_get_order_stats(orders_before);
+        
+        // A 3-page run comes from a naturally aligned 4-page block
+        uintptr_t run = pmm_alloc_pages(3);
+        uintptr_t big = pmm_alloc_pages(16);
+        if (run == 0 || big == 0 ||
+            (run & (4 * PAGE_SIZE - 1)) != 0 || (big & (16 * PAGE_SIZE - 1)) != 0) {
+            ok = 0;
+        }
+        
+        // Pages of a run may be freed individually
+        if (run != 0) {
+            pmm_free_page(run + PAGE_SIZE);
+            pmm_free_page(run);
+            pmm_free_page(run + 2 * PAGE_SIZE);
+        }
+        if (big != 0) {
+            pmm_free_pages(big, 16);
+        }
+        
+        // Everything should merge back into the original blocks
+        pmm_drain_pcp();
+        pmm_get_stats(&total, &free_after);
+        pmm_get_order_stats(orders_after);
+        if (free_after != free_before) {
+            ok = 0;
+        }
+        for (int i = 0; i <= PMM_MAX_ORDER; i++) {
+            if (orders_after[i] != orders_before[i]) {
+                ok = 0;
+            }
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 14: Page Reference Counts
+    // ========================================
+    hal_uart_puts("\nTest 14: Page Reference Counts\n");
+    hal_uart_puts("  Sharing a page between two owners... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        size_t free_before, free_shared, free_after, total;
+        
+        pmm_get_stats(&total, &free_before);
+        uintptr_t page = pmm_alloc_page();
+        if (page == 0 || page_refcount(page) != 1 ||
+            page_to_phys(phys_to_page(page)) != page) {
+            ok = 0;
+        }
+        
+        if (page != 0) {
+            get_page(page);
+            put_page(page);
+            
+            // One owner left: the page must still be allocated
+            pmm_get_stats(&total, &free_shared);
+            if (page_refcount(page) != 1 || free_shared != free_before - 1) {
+                ok = 0;
+            }
+            
+            put_page(page);
+        }
+        
+        pmm_get_stats(&total, &free_after);
+        if (free_after != free_before || page_refcount(page) != 0) {
+            ok = 0;
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 15: Copy-on-Write Sharing
+    // ========================================
+    hal_uart_puts("\nTest 15: Copy-on-Write Sharing\n");
+    hal_uart_puts("  Sharing a page and faulting on both sides... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        size_t free_before, free_after, total;
+        uintptr_t vaddr = 0x10000;
+        
+        pmm_get_stats(&total, &free_before);
+        page_table_t *parent = create_user_page_table();
+        page_table_t *child = create_user_page_table();
+        uintptr_t page = pmm_alloc_page();
+        
+        if (!parent || !child || page == 0 ||
+            map_page(parent, vaddr, page, PTE_USER_DATA) != 0 ||
+            share_user_page_cow(parent, child, vaddr) != 0 ||
+            page_refcount(page) != 2) {
+            ok = 0;
+        }
+        
+        // First writer gets a private copy
+        uintptr_t child_paddr = 0;
+        if (ok && (handle_cow_fault(child, vaddr) != 0 ||
+                   virt_to_phys(child, vaddr, &child_paddr) != 0 ||
+                   child_paddr == page || page_refcount(page) != 1)) {
+            ok = 0;
+        }
+        
+        // Last owner keeps the original page
+        uintptr_t parent_paddr = 0;
+        if (ok && (handle_cow_fault(parent, vaddr) != 0 ||
+                   virt_to_phys(parent, vaddr, &parent_paddr) != 0 ||
+                   parent_paddr != page)) {
+            ok = 0;
+        }
+        
+        // No longer COW: a second fault is not ours to handle
+        if (ok && handle_cow_fault(parent, vaddr) == 0) {
+            ok = 0;
+        }
+        
+        if (parent) {
+            free_page_table(parent);
+        }
+        if (child) {
+            free_page_table(child);
+        }
+        
+        pmm_get_stats(&total, &free_after);
+        if (free_after != free_before) {
+            ok = 0;
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 16: Zero Page and Pre-Zeroed Pool
+    // ========================================
+    hal_uart_puts("\nTest 16: Zero Page and Pre-Zeroed Pool\n");
+    hal_uart_puts("  Pooling zeroed pages and breaking zero-page COW... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        size_t free_before, free_after, total;
+        uintptr_t zero = pmm_zero_page();
+        
+        pmm_get_stats(&total, &free_before);
+        
+        if (zero == 0 || page_refcount(zero) == 0) {
+            ok = 0;
+        }
+        for (size_t i = 0; ok && i < PAGE_SIZE; i++) {
+            if (((uint8_t *)zero)[i] != 0) {
+                ok = 0;
+            }
+        }
+        
+        // Dirty a page, free it, and make sure the pool hands out zeros
+        uintptr_t dirty = pmm_alloc_page();
+        if (dirty) {
+            kmemset((void *)dirty, 0xAB, PAGE_SIZE);
+            pmm_free_page(dirty);
+        }
+        size_t pooled = pmm_zero_pool_count();
+        size_t added = pmm_zero_pool_refill(PMM_ZERO_POOL_IDLE_BATCH);
+        if (pmm_zero_pool_count() != pooled + added) {
+            ok = 0;
+        }
+        
+        uintptr_t page = pmm_alloc_zeroed_page();
+        if (page == 0 || (added > 0 && pmm_zero_pool_count() != pooled + added - 1)) {
+            ok = 0;
+        }
+        for (size_t i = 0; ok && i < PAGE_SIZE; i++) {
+            if (((uint8_t *)page)[i] != 0) {
+                ok = 0;
+            }
+        }
+        if (page) {
+            pmm_free_page(page);
+        }
+        
+        // Writing a zero-page mapping gets a fresh page, not a copy
+        uintptr_t vaddr = 0x10000;
+        uint32_t zero_refs = page_refcount(zero);
+        page_table_t *pt = create_user_page_table();
+        uintptr_t paddr = 0;
+        if (!pt || map_page(pt, vaddr, zero, PTE_USER_RO | PTE_COW) != 0) {
+            ok = 0;
+        } else {
+            get_page(zero);
+            if (handle_cow_fault(pt, vaddr) != 0 ||
+                virt_to_phys(pt, vaddr, &paddr) != 0 ||
+                paddr == zero || *(uint8_t *)paddr != 0 ||
+                page_refcount(zero) != zero_refs) {
+                ok = 0;
+            }
+        }
+        if (pt) {
+            free_page_table(pt);
+        }
+        
+        // Pooled pages still count as free
+        pmm_get_stats(&total, &free_after);
+        if (free_after != free_before) {
+            ok = 0;
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 17: DMA Pool
+    // ========================================
+    hal_uart_puts("\nTest 17: DMA Pool\n");
+    hal_uart_puts("  Allocating pooled buffers across pages... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        size_t regions_before, bytes_before;
+        dma_get_stats(&regions_before, &bytes_before);
+        
+        // 200-byte buffers aligned to 64 -> 16 per page, so 40 need 3 pages
+        #define TEST_POOL_BUFS 40
+        void *bufs[TEST_POOL_BUFS];
+        uintptr_t phys[TEST_POOL_BUFS];
+        size_t in_use, capacity;
+        
+        dma_pool_t *pool = dma_pool_create("test_pool", 200, 64);
+        if (!pool) {
+            ok = 0;
+        }
+        
+        for (int i = 0; ok && i < TEST_POOL_BUFS; i++) {
+            bufs[i] = dma_pool_alloc(pool, DMA_ZERO, &phys[i]);
+            if (!bufs[i] || ((uintptr_t)bufs[i] & 63) != 0 ||
+                phys[i] != translate_virt_to_phys((uintptr_t)bufs[i]) ||
+                ((uintptr_t)bufs[i] & (PAGE_SIZE - 1)) + 200 > PAGE_SIZE) {
+                ok = 0;
+                break;
+            }
+            for (int j = 0; j < 200; j++) {
+                if (((uint8_t *)bufs[i])[j] != 0) {
+                    ok = 0;
+                }
+            }
+            kmemset(bufs[i], i, 200);
+            for (int j = 0; j < i; j++) {
+                if (bufs[j] == bufs[i]) {
+                    ok = 0;
+                }
+            }
+        }
+        
+        dma_pool_get_stats(pool, &in_use, &capacity);
+        if (ok && (in_use != TEST_POOL_BUFS || capacity != 48)) {
+            ok = 0;
+        }
+        
+        // Buffers did not overlap: each still holds its own pattern
+        for (int i = 0; ok && i < TEST_POOL_BUFS; i++) {
+            if (((uint8_t *)bufs[i])[199] != (uint8_t)i) {
+                ok = 0;
+            }
+        }
+        
+        // A freed buffer comes straight back with the same address
+        if (ok) {
+            dma_pool_free(pool, bufs[5], phys[5]);
+            uintptr_t again_phys;
+            void *again = dma_pool_alloc(pool, 0, &again_phys);
+            if (again != bufs[5] || again_phys != phys[5]) {
+                ok = 0;
+            }
+            
+            // Busy pools refuse to be destroyed
+            if (dma_pool_destroy(pool) != -1) {
+                ok = 0;
+            }
+            
+            for (int i = 0; i < TEST_POOL_BUFS; i++) {
+                dma_pool_free(pool, bufs[i], phys[i]);
+            }
+        }
+        #undef TEST_POOL_BUFS
+        
+        if (pool && dma_pool_destroy(pool) != 0) {
+            ok = 0;
+        }
+        
+        size_t regions_after, bytes_after;
+        dma_get_stats(&regions_after, &bytes_after);
+        if (regions_after != regions_before || bytes_after != bytes_before) {
+            ok = 0;
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 18: Packet Buffers
+    // ========================================
+    hal_uart_puts("\nTest 18: Packet Buffers (headroom, clone, split)\n");
+    hal_uart_puts("  Pushing, cloning and splitting a packet... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        skb_stats_t before, after;
+        skb_get_stats(&before);
+        
+        // 100 linear bytes behind the default headroom, then one page fragment
+        sk_buff_t *skb = skb_alloc(SKB_DEFAULT_HEADROOM + 100);
+        uintptr_t page = pmm_alloc_page();
+        if (!skb || !page) {
+            ok = 0;
+        } else {
+            skb_reserve(skb, SKB_DEFAULT_HEADROOM);
+            uint8_t *payload = skb_put(skb, 100);
+            for (int i = 0; i < 100; i++) {
+                payload[i] = (uint8_t)i;
+            }
+            for (int i = 0; i < 1000; i++) {
+                ((uint8_t *)page)[i] = (uint8_t)(100 + i);
+            }
+            if (skb_add_frag(skb, page, 0, 1000) != 0) {
+                ok = 0;
+            }
+            
+            // Headers go in front without moving the payload
+            uint8_t *hdr = skb_push(skb, 14);
+            if (hdr != payload - 14 || skb->len != 1114 || skb_headlen(skb) != 114) {
+                ok = 0;
+            }
+            kmemset(hdr, 0xEE, 14);
+            
+            // A clone shares the head buffer and the page
+            sk_buff_t *clone = skb_clone(skb);
+            if (!clone || !skb_cloned(skb) || clone->data != skb->data) {
+                ok = 0;
+            }
+            
+            // Writing headers into the clone copies only its linear part
+            if (clone && skb_cow_head(clone, 64) == 0) {
+                if (clone->data == skb->data || skb_cloned(skb) ||
+                    page_refcount(page) != 2) {
+                    ok = 0;
+                }
+            } else {
+                ok = 0;
+            }
+            skb_free(clone);
+            if (page_refcount(page) != 1) {
+                ok = 0;
+            }
+            
+            // Split inside the fragment: both halves keep a page reference
+            sk_buff_t *rest = skb_split(skb, 614);
+            if (!rest || skb->len != 614 || rest->len != 500 ||
+                page_refcount(page) != 2) {
+                ok = 0;
+            }
+            
+            uint8_t check[4];
+            if (rest && (skb_copy_bits(rest, 0, check, 4) != 0 ||
+                         check[0] != (uint8_t)(100 + 500) || check[3] != (uint8_t)(100 + 503))) {
+                ok = 0;
+            }
+            if (skb_copy_bits(skb, 14, check, 2) != 0 || check[0] != 0 || check[1] != 1) {
+                ok = 0;
+            }
+            if (skb_copy_bits(skb, 600, check, 20) != -1) {
+                ok = 0;  // Past the end
+            }
+            
+            skb_free(rest);
+            skb_free(skb);
+            skb = NULL;
+            page = 0;  // Freed with the last fragment reference
+        }
+        if (page) {
+            put_page(page);
+        }
+        skb_free(skb);
+        
+        skb_get_stats(&after);
+        if (after.skbs_in_use != before.skbs_in_use ||
+            after.heads_in_use != before.heads_in_use) {
+            ok = 0;
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 19: Chained Packets
+    // ========================================
+    hal_uart_puts("\nTest 19: Chained Packets (frag_list, copy, checksum)\n");
+    hal_uart_puts("  Reading across packets chained by receive offload... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        skb_stats_t before, after;
+        skb_get_stats(&before);
+        
+        // 30 bytes in the head, then 31 and 40 in chained packets: odd boundaries
+        static const uint32_t sizes[3] = { 30, 31, 40 };
+        uint8_t flat[101];
+        sk_buff_t *head = NULL;
+        sk_buff_t *last = NULL;
+        uint32_t n = 0;
+        for (int p = 0; p < 3 && ok; p++) {
+            sk_buff_t *piece = skb_alloc(sizes[p]);
+            if (!piece) {
+                ok = 0;
+                break;
+            }
+            uint8_t *data = skb_put(piece, sizes[p]);
+            for (uint32_t i = 0; i < sizes[p]; i++, n++) {
+                flat[n] = (uint8_t)(n * 7 + 3);
+                data[i] = flat[n];
+            }
+            if (!head) {
+                head = piece;
+                last = piece;
+            } else {
+                skb_append_chained(head, last, piece);
+                last = piece;
+            }
+        }
+        
+        if (ok && (head->len != 101 || skb_headlen(head) != 30)) {
+            ok = 0;
+        }
+        
+        // Copies and sums match the flat bytes from any offset
+        uint8_t out[101];
+        if (ok && skb_copy_bits(head, 0, out, 101) != 0) {
+            ok = 0;
+        }
+        for (uint32_t i = 0; ok && i < 101; i++) {
+            if (out[i] != flat[i]) {
+                ok = 0;
+            }
+        }
+        if (ok && (skb_copy_bits(head, 45, out, 40) != 0 || out[0] != flat[45] ||
+                   out[39] != flat[84])) {
+            ok = 0;
+        }
+        for (uint32_t off = 0; ok && off < 40; off += 3) {
+            uint32_t len = 101 - off - (off & 1);
+            if (net_csum_fold(net_csum_skb(head, off, len, 0)) !=
+                net_csum_fold(net_csum_partial(flat + off, len, 0))) {
+                ok = 0;
+            }
+        }
+        
+        // A chained packet cannot be copied or split in place
+        if (ok && (skb_cow_head(head, SKB_DEFAULT_HEADROOM) != -1 || skb_split(head, 50) != NULL)) {
+            ok = 0;
+        }
+        
+        // Freeing the head frees what is chained to it
+        skb_free(head);
+        skb_get_stats(&after);
+        if (after.skbs_in_use != before.skbs_in_use ||
+            after.heads_in_use != before.heads_in_use) {
+            ok = 0;
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 20: Softirqs and Tasklets
+    // ========================================
+    hal_uart_puts("\nTest 20: Softirqs and Tasklets\n");
+    hal_uart_puts("  Scheduling a tasklet twice and running softirqs... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        tasklet_t tasklet;
+        tasklet_init(&tasklet, test_tasklet_fn);
+        test_tasklet_runs = 0;
+        uint64_t runs_before = softirq_count(SOFTIRQ_TASKLET);
+        
+        // Scheduling a pending tasklet again is a no-op
+        if (tasklet_schedule(&tasklet) != 1 || tasklet_schedule(&tasklet) != 0) {
+            ok = 0;
+        }
+        
+        // It runs once, and may be scheduled again afterwards
+        do_softirq();
+        if (test_tasklet_runs != 1 || tasklet.pending ||
+            softirq_count(SOFTIRQ_TASKLET) <= runs_before || in_softirq()) {
+            ok = 0;
+        }
+        if (tasklet_schedule(&tasklet) != 1) {
+            ok = 0;
+        }
+        do_softirq();
+        if (test_tasklet_runs != 2) {
+            ok = 0;
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 21: Trace Rings
+    // ========================================
+    hal_uart_puts("\nTest 21: Trace Rings\n");
+    hal_uart_puts("  Recording, draining and overflowing a ring... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        trace_record_t recs[4];
+        trace_stats_t stats;
+        int irq_state = interrupt_save_disable();
+        
+        // Only enabled events are recorded, in order
+        trace_reset();
+        trace_set_events(1u << TRACE_BLK_SUBMIT);
+        trace_event(TRACE_BLK_SUBMIT, 123, 456);
+        trace_event(TRACE_BLK_COMPLETE, 123, 1);
+        trace_event(TRACE_BLK_SUBMIT, 124, 457);
+        uint32_t taken = trace_drain(recs, 4);
+        if (taken != 2 || recs[0].event != TRACE_BLK_SUBMIT ||
+            recs[0].arg0 != 123 || recs[0].arg1 != 456 || recs[1].arg0 != 124 ||
+            recs[0].cpu != 0 || recs[1].timestamp < recs[0].timestamp) {
+            ok = 0;
+        }
+        
+        // A full ring drops what comes after, and counts it
+        for (int i = 0; i < TRACE_RING_RECORDS + 5; i++) {
+            trace_event(TRACE_BLK_SUBMIT, i, 0);
+        }
+        trace_get_stats(&stats);
+        if (stats.buffered != TRACE_RING_RECORDS || stats.lost != 5 ||
+            stats.recorded != TRACE_RING_RECORDS + 2) {
+            ok = 0;
+        }
+        if (trace_drain(recs, 1) != 1 || recs[0].arg0 != 0) {
+            ok = 0;
+        }
+        
+        // Reset empties the rings and zeroes the counts
+        trace_set_events(0);
+        trace_reset();
+        trace_get_stats(&stats);
+        if (stats.buffered != 0 || stats.lost != 0 || stats.recorded != 0 ||
+            stats.events != 0 || trace_drain(recs, 4) != 0) {
+            ok = 0;
+        }
+        interrupt_restore(irq_state);
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 22: Profiler Samples
+    // ========================================
+    hal_uart_puts("\nTest 22: Profiler Samples\n");
+    hal_uart_puts("  Sampling kernel and user frames... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        prof_sample_t samples[3];
+        prof_stats_t stats;
+        struct trap_frame tf;
+        uint64_t sp;
+        
+        // Periods outside the limits are refused
+        if (prof_start(PROF_MIN_PERIOD_US - 1) != -1) {
+            ok = 0;
+        }
+        
+        int irq_state = interrupt_save_disable();
+        if (prof_start(0) != 0) {
+            ok = 0;
+        }
+        prof_get_stats(&stats);
+        if (stats.period_us != PROF_DEFAULT_PERIOD_US || stats.buffered != 0) {
+            ok = 0;
+        }
+        
+        // Kernel frame interrupted here: the first caller found is ours
+        asm volatile("mv %0, sp" : "=r"(sp));
+        kmemset(&tf, 0, sizeof(tf));
+        tf.sepc = (uint64_t)test_memory_management;
+        tf.sstatus = 1UL << SSTATUS_SPP_BIT;
+        tf.sp = sp;
+        tf.s0 = (uint64_t)__builtin_frame_address(0);
+        prof_sample(&tf);
+        
+        // User frames get no callchain
+        tf.sepc = 0x10000;
+        tf.sstatus = 0;
+        prof_sample(&tf);
+        prof_stop();
+        
+        if (prof_drain(samples, 3) != 2) {
+            ok = 0;
+        } else if (samples[0].pc != (uint64_t)test_memory_management || samples[0].flags != 0 ||
+                   samples[0].depth < 1 || samples[0].cpu != 0 ||
+                   samples[0].callchain[0] != (uint64_t)__builtin_return_address(0) ||
+                   samples[1].pc != 0x10000 || samples[1].flags != PROF_SAMPLE_USER ||
+                   samples[1].depth != 0) {
+            ok = 0;
+        }
+        
+        prof_reset();
+        prof_get_stats(&stats);
+        if (stats.samples != 0 || stats.buffered != 0 || stats.period_us != 0) {
+            ok = 0;
+        }
+        interrupt_restore(irq_state);
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 23: SBI PMU Counters
+    // ========================================
+    hal_uart_puts("\nTest 23: SBI PMU Counters\n");
+    hal_uart_puts("  Claiming and releasing counters... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        unsigned long info = 0;
+        unsigned long idx = 0;
+        long num = sbi_pmu_num_counters();
+        unsigned long all = (1UL << num) - 1;
+        unsigned long cycles = SBI_PMU_EVENT(SBI_PMU_TYPE_HW, SBI_PMU_HW_CPU_CYCLES);
+        unsigned long instret = SBI_PMU_EVENT(SBI_PMU_TYPE_HW, SBI_PMU_HW_INSTRUCTIONS);
+        
+        if (sbi_probe_extension(SBI_EXT_PMU) != 1 || num < 3) {
+            ok = 0;
+        }
+        
+        // Index 0 is cycle, 64 bits wide; index 1 (time) is no counter
+        if (sbi_pmu_counter_get_info(0, &info) != SBI_SUCCESS ||
+            SBI_PMU_INFO_CSR(info) != 0xC00 || SBI_PMU_INFO_WIDTH(info) != 64 ||
+            sbi_pmu_counter_get_info(1, &info) != SBI_ERR_INVALID_PARAM) {
+            ok = 0;
+        }
+        
+        // Only cycle counts cycles, and it has one owner at a time
+        if (sbi_pmu_counter_config_matching(0, all, SBI_PMU_CFG_FLAG_AUTO_START,
+                                            cycles, 0, &idx) != SBI_SUCCESS || idx != 0 ||
+            sbi_pmu_counter_config_matching(0, all, SBI_PMU_CFG_FLAG_AUTO_START,
+                                            cycles, 0, &idx) != SBI_ERR_NOT_SUPPORTED ||
+            sbi_pmu_counter_stop(0, 1, SBI_PMU_STOP_FLAG_RESET) != SBI_SUCCESS ||
+            sbi_pmu_counter_stop(0, 1, SBI_PMU_STOP_FLAG_RESET) != SBI_ERR_INVALID_PARAM) {
+            ok = 0;
+        }
+        if (sbi_pmu_counter_config_matching(0, all, 0, instret, 0, &idx) != SBI_SUCCESS ||
+            idx != 2 || sbi_pmu_counter_stop(2, 1, SBI_PMU_STOP_FLAG_RESET) != SBI_SUCCESS) {
+            ok = 0;
+        }
+        
+        // Any other event goes on an hpmcounter, if the hart has one
+        unsigned long dtlb_miss = SBI_PMU_EVENT(SBI_PMU_TYPE_CACHE, 3 << 3 | 0 << 1 | 1);
+        long ret = sbi_pmu_counter_config_matching(0, all, SBI_PMU_CFG_FLAG_CLEAR_VALUE,
+                                                   dtlb_miss, 0, &idx);
+        if (num > 3) {
+            if (ret != SBI_SUCCESS || idx < 3 ||
+                sbi_pmu_counter_start(idx, 1, 0, 0) != SBI_SUCCESS ||
+                sbi_pmu_counter_stop(idx, 1, SBI_PMU_STOP_FLAG_RESET) != SBI_SUCCESS) {
+                ok = 0;
+            }
+        } else if (ret != SBI_ERR_NOT_SUPPORTED) {
+            ok = 0;
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 24: Syscall Accounting and procfs
+    // ========================================
+    hal_uart_puts("\nTest 24: Syscall Accounting and procfs\n");
+    hal_uart_puts("  Counting a syscall and reading it back... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        
+        // Buckets: <1us, then [2^(b-1), 2^b), the last open-ended
+        if (acct_hist_bucket(0) != 0 || acct_hist_bucket(1) != 1 ||
+            acct_hist_bucket(3) != 2 || acct_hist_bucket(4) != 3 ||
+            acct_hist_bucket(1UL << 40) != ACCT_HIST_BUCKETS - 1) {
+            ok = 0;
+        }
+        
+        const acct_syscall_stats_t *stats = acct_syscall_stats(SYS_GETPID);
+        uint64_t count = stats ? stats->count : 0;
+        uint32_t in_bucket = stats ? stats->hist[acct_hist_bucket(5)] : 0;
+        acct_syscall(SYS_GETPID, 5);
+        if (!stats || stats->count != count + 1 ||
+            stats->hist[acct_hist_bucket(5)] != in_bucket + 1 || stats->max_us < 5 ||
+            acct_syscall_stats(SYSCALL_COUNT) != NULL) {
+            ok = 0;
+        }
+        
+        // /proc/syscalls lists it by name; /proc/self/stat starts with the pid
+        char text[512];
+        vfs_node_t *root = procfs_mount()->root;
+        vfs_node_t *all = root->ops->lookup(root, "syscalls");
+        int len = all ? all->ops->read(all, 0, text, sizeof(text) - 1) : -1;
+        if (len <= 0) {
+            ok = 0;
+        } else {
+            text[len] = '\0';
+            int found = 0;
+            for (int i = 0; text[i] && !found; i++) {
+                found = text[i] == '\n' && test_starts_with(&text[i + 1], "getpid ");
+            }
+            ok = ok && found;
+        }
+        vfs_node_put(all);
+        
+        vfs_node_t *self = root->ops->lookup(root, "self");
+        vfs_node_t *stat = self ? self->ops->lookup(self, "stat") : NULL;
+        len = stat ? stat->ops->read(stat, 0, text, sizeof(text) - 1) : -1;
+        if (len < 4) {
+            ok = 0;
+        } else {
+            text[len] = '\0';
+            ok = ok && test_starts_with(text, "pid ");
+        }
+        
+        // Reads past the end return nothing; unknown names are not there
+        if (stat && stat->ops->read(stat, 1 << 20, text, sizeof(text)) != 0) {
+            ok = 0;
+        }
+        if (root->ops->lookup(root, "4000000") || get_errno() != THUNDEROS_ENOENT ||
+            (self && self->ops->lookup(self, "nosuch"))) {
+            ok = 0;
+        }
+        vfs_node_put(stat);
+        vfs_node_put(self);
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 25: seq_file and /proc System Files
+    // ========================================
+    hal_uart_puts("\nTest 25: seq_file and /proc System Files\n");
+    hal_uart_puts("  Reading /proc/meminfo whole and in pieces... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        vfs_node_t *root = procfs_mount()->root;
+        
+        // Registered names are taken once; pid names are never free
+        static const seq_operations_t none = { NULL, NULL, NULL };
+        static const seq_operations_t one = { NULL, NULL, test_seq_show };
+        if (procfs_create("test", &none, NULL) || get_errno() != THUNDEROS_EINVAL ||
+            procfs_create("meminfo", &one, NULL) || get_errno() != THUNDEROS_EEXIST ||
+            procfs_create("self", &one, NULL) || get_errno() != THUNDEROS_EEXIST ||
+            procfs_create("42", &one, NULL) || get_errno() != THUNDEROS_EEXIST) {
+            ok = 0;
+        }
+        vfs_node_t *mem = root->ops->lookup(root, "meminfo");
+        
+        char whole[512];
+        char piece[512];
+        int len = mem ? mem->ops->read(mem, 0, whole, sizeof(whole) - 1) : -1;
+        if (len <= 0) {
+            ok = 0;
+        } else {
+            whole[len] = '\0';
+            ok = ok && test_starts_with(whole, "mem_total_kb ");
+            
+            // Seven bytes at a time gives the same text (nothing changed)
+            int got = 0;
+            while (got < len) {
+                int n = mem->ops->read(mem, (uint64_t)got, piece + got, 7);
+                if (n <= 0) {
+                    break;
+                }
+                got += n;
+            }
+            piece[got] = '\0';
+            ok = ok && got == len && test_starts_with(piece, whole);
+        }
+        vfs_node_put(mem);
+        
+        // Iterated files list the boot CPU with its header first
+        vfs_node_t *sched = root->ops->lookup(root, "sched");
+        len = sched ? sched->ops->read(sched, 0, whole, sizeof(whole) - 1) : -1;
+        if (len <= 0) {
+            ok = 0;
+        } else {
+            whole[len] = '\0';
+            ok = ok && test_starts_with(whole, "cpu ");
+        }
+        vfs_node_put(sched);
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 26: Lock Class Statistics
+    // ========================================
+    hal_uart_puts("\nTest 26: Lock Class Statistics\n");
+    hal_uart_puts("  Counting waits and holds of a class... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        static const char key[] = "test_lock";
+        
+        // Same kind and key: same class; the other kind is another
+        lockstat_class_t *cls = lockstat_class(LOCKSTAT_MUTEX, key, key);
+        if (lockstat_class(LOCKSTAT_MUTEX, key, key) != cls ||
+            lockstat_class(LOCKSTAT_CONDVAR, key, key) == cls) {
+            ok = 0;
+        }
+        
+        if (lockstat_bucket(0) != 0 || lockstat_bucket(1) != 1 || lockstat_bucket(5) != 3 ||
+            lockstat_bucket(1UL << 40) != LOCKSTAT_HIST_BUCKETS - 1) {
+            ok = 0;
+        }
+        
+        lockstat_acquired(cls);
+        lockstat_acquired(cls);
+        lockstat_waited(cls, 5, 0x1234);
+        lockstat_waited(cls, 2, 0x5678);
+        lockstat_held(cls, 9);
+        if (cls->acquisitions != 2 || cls->contended != 2 || cls->wait_us != 7 ||
+            cls->max_wait_us != 5 || cls->max_wait_site != 0x1234 ||
+            cls->wait_hist[3] != 1 || cls->wait_hist[2] != 1 ||
+            cls->hold_us != 9 || cls->max_hold_us != 9 || cls->hold_hist[4] != 1) {
+            ok = 0;
+        }
+        
+        // /proc/lockstat lists it by kind and name (after every class
+        // a LOCK_STATS=1 boot has made, hence the size)
+        static char text[8192];
+        vfs_node_t *root = procfs_mount()->root;
+        vfs_node_t *file = root->ops->lookup(root, "lockstat");
+        int len = file ? file->ops->read(file, 0, text, sizeof(text) - 1) : -1;
+        int found = 0;
+        if (len > 0) {
+            text[len] = '\0';
+            for (int i = 0; text[i] && !found; i++) {
+                found = (i == 0 || text[i - 1] == '\n') &&
+                        test_starts_with(&text[i], "mutex    test_lock ");
+            }
+        }
+        ok = ok && found;
+        vfs_node_put(file);
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 27: Boot Timeline
+    // ========================================
+    hal_uart_puts("\nTest 27: Boot Timeline\n");
+    hal_uart_puts("  Stages so far and /proc/boottime... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        
+        // The firmware stage starts at reset; main-path stages follow on
+        const bootstage_t *first = bootstage_get(0);
+        const bootstage_t *uart = bootstage_get(1);
+        if (!first || !test_starts_with(first->name, "firmware") || first->start_us != 0 ||
+            !uart || !test_starts_with(uart->name, "uart") || uart->start_us != first->end_us) {
+            ok = 0;
+        }
+        for (uint32_t i = 0; bootstage_get(i); i++) {
+            if (bootstage_get(i)->end_us < bootstage_get(i)->start_us) {
+                ok = 0;
+            }
+        }
+        if (bootstage_get(BOOTSTAGE_MAX)) {
+            ok = 0;
+        }
+        
+        static char text[2048];
+        vfs_node_t *root = procfs_mount()->root;
+        vfs_node_t *file = root->ops->lookup(root, "boottime");
+        int len = file ? file->ops->read(file, 0, text, sizeof(text) - 1) : -1;
+        if (len > 0) {
+            text[len] = '\0';
+            const char *line = text;
+            while (*line && *line != '\n') {
+                line++;
+            }
+            ok = ok && test_starts_with(text, "stage ") && *line &&
+                 test_starts_with(line + 1, "firmware ");
+        } else {
+            ok = 0;
+        }
+        vfs_node_put(file);
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 28: vDSO Clocks
+    // ========================================
+    hal_uart_puts("\nTest 28: vDSO Clocks\n");
+    hal_uart_puts("  Clocks and user mappings... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        
+        struct timespec a, b;
+        if (vdso_clock_gettime(CLOCK_MONOTONIC, &a) != 0 ||
+            vdso_clock_gettime(CLOCK_MONOTONIC, &b) != 0 ||
+            b.tv_sec * 1000000000L + b.tv_nsec < a.tv_sec * 1000000000L + a.tv_nsec ||
+            a.tv_nsec < 0 || a.tv_nsec >= 1000000000L) {
+            ok = 0;
+        }
+        if (vdso_clock_gettime(2, &a) != -1 || get_errno() != THUNDEROS_EINVAL) {
+            ok = 0;
+        }
+        
+        // Every user table maps both pages, each mapping with its own reference
+        page_table_t *pt = create_user_page_table();
+        uintptr_t data_pa = 0, text_pa = 0;
+        if (!pt || virt_to_phys(pt, VDSO_DATA_ADDR, &data_pa) != 0 ||
+            virt_to_phys(pt, VDSO_TEXT_ADDR, &text_pa) != 0) {
+            ok = 0;
+        } else {
+            const vdso_data_t *vd = (const vdso_data_t *)data_pa;
+            uint32_t refs = page_refcount(text_pa);
+            if (vd->magic != VDSO_MAGIC || vd->clock_gettime < VDSO_TEXT_ADDR ||
+                vd->clock_gettime >= VDSO_TEXT_ADDR + PAGE_SIZE) {
+                ok = 0;
+            }
+            free_page_table(pt);
+            pt = NULL;
+            if (page_refcount(text_pa) != refs - 1) {
+                ok = 0;
+            }
+        }
+        if (pt) {
+            free_page_table(pt);
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 29: Scheduling Policies
+    // ========================================
+    hal_uart_puts("\nTest 29: Scheduling Policies\n");
+    hal_uart_puts("  Policies and deadline admission... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        
+        // Never queued or run: only the attributes and bandwidth change
+        static struct process dl_procs[MAX_CPUS + 2];
+        for (int i = 0; i < MAX_CPUS + 2; i++) {
+            kmemset(&dl_procs[i], 0, sizeof(dl_procs[i]));
+            scheduler_init_process(&dl_procs[i]);
+            dl_procs[i].last_cpu = -1;
+            dl_procs[i].priority = 10;
+            dl_procs[i].base_priority = 10;
+        }
+        struct process *p = &dl_procs[0];
+        
+        sched_attr_t attr, got;
+        kmemset(&attr, 0, sizeof(attr));
+        attr.sched_policy = SCHED_NORMAL;
+        attr.sched_nice = 3;
+        scheduler_getattr(p, &got);
+        if (got.sched_policy != SCHED_NORMAL || got.sched_nice != 0 ||
+            scheduler_setattr(p, &attr) != 0 || p->priority != SCHED_RT_LEVELS + 3) {
+            ok = 0;
+        }
+        
+        attr.sched_policy = SCHED_FIFO;
+        attr.sched_priority = SCHED_RT_LEVELS;
+        scheduler_getattr(p, &got);
+        if (got.sched_nice != 3 || scheduler_setattr(p, &attr) != 0 || p->priority != 0) {
+            ok = 0;
+        }
+        scheduler_getattr(p, &got);
+        if (got.sched_policy != SCHED_FIFO || got.sched_priority != SCHED_RT_LEVELS) {
+            ok = 0;
+        }
+        attr.sched_priority = 0;
+        if (scheduler_setattr(p, &attr) != -1 || get_errno() != THUNDEROS_EINVAL) {
+            ok = 0;
+        }
+        
+        // 1ms every 5ms; the period defaults to the deadline
+        kmemset(&attr, 0, sizeof(attr));
+        attr.sched_policy = SCHED_DEADLINE;
+        attr.sched_runtime = 1000000;
+        attr.sched_deadline = 5000000;
+        if (scheduler_setattr(p, &attr) != 0) {
+            ok = 0;
+        }
+        scheduler_getattr(p, &got);
+        if (got.sched_policy != SCHED_DEADLINE || got.sched_period != 5000000 ||
+            p->dl_budget_us != 1000 || p->dl_throttled) {
+            ok = 0;
+        }
+        attr.sched_runtime = 6000000;
+        if (scheduler_setattr(p, &attr) != -1 || get_errno() != THUNDEROS_EINVAL) {
+            ok = 0;
+        }
+        
+        // 90% each: refused before the CPUs' 95% is oversubscribed
+        attr.sched_runtime = 4500000;
+        int admitted = 0, refused = 0;
+        for (int i = 1; i < MAX_CPUS + 2 && !refused; i++) {
+            if (scheduler_setattr(&dl_procs[i], &attr) == 0) {
+                admitted++;
+            } else {
+                refused = get_errno() == THUNDEROS_EBUSY ? i : -1;
+            }
+        }
+        if (refused <= 0 || admitted < 1 || admitted > cpu_online_count()) {
+            ok = 0;
+        } else {
+            // An exit frees its share for the next
+            scheduler_exit(&dl_procs[1]);
+            if (scheduler_setattr(&dl_procs[refused], &attr) != 0) {
+                ok = 0;
+            }
+        }
+        
+        for (int i = 0; i < MAX_CPUS + 2; i++) {
+            scheduler_exit(&dl_procs[i]);
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 30: Resource Groups
+    // ========================================
+    hal_uart_puts("\nTest 30: Resource Groups\n");
+    hal_uart_puts("  CPU quota and memory limit... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        int id = rgroup_create("unit-test");
+        rgroup_t *group = rgroup_get(id);
+        if (id <= 0 || !group || rgroup_create("unit-test") != -1 || get_errno() != THUNDEROS_EEXIST) {
+            ok = 0;
+        }
+        
+        if (group) {
+            rgroup_limits_t limits = { 0, 0, 0 };
+            limits.cpu_quota_us = 10;
+            if (rgroup_set_limits(id, &limits) != -1 || get_errno() != THUNDEROS_EINVAL ||
+                rgroup_set_limits(0, &limits) != -1) {
+                ok = 0;
+            }
+            
+            // 5ms every 50ms: throttled once 5ms is charged
+            limits.cpu_quota_us = 5000;
+            limits.cpu_period_us = 50000;
+            limits.mem_limit_bytes = 4 * PAGE_SIZE;
+            uint64_t now = hal_timer_get_time_us();
+            if (rgroup_set_limits(id, &limits) != 0 ||
+                rgroup_charge_cpu(group, 3000, now) != 0 ||
+                rgroup_cpu_remaining(group) != 2000 ||
+                rgroup_charge_cpu(group, 2500, now) == 0 ||
+                !rgroup_cpu_throttled(group) || group->nr_throttled != 1 ||
+                rgroup_cpu_remaining(group) != 0) {
+                ok = 0;
+            }
+            
+            // A new setting is a new period
+            if (rgroup_set_limits(id, &limits) != 0 || rgroup_cpu_throttled(group) ||
+                rgroup_cpu_remaining(group) != 5000) {
+                ok = 0;
+            }
+            
+            // Four pages fit, the fifth does not
+            rgroup_charge_mem(group, 3);
+            if (rgroup_mem_allow(group, 1) != 0 || rgroup_mem_allow(group, 2) != -1 ||
+                get_errno() != THUNDEROS_ENOMEM || group->mem_failcnt != 1) {
+                ok = 0;
+            }
+            limits.mem_limit_bytes = 2 * PAGE_SIZE;
+            if (rgroup_set_limits(id, &limits) != -1 || get_errno() != THUNDEROS_EBUSY) {
+                ok = 0;
+            }
+            rgroup_charge_mem(group, -3);
+            
+            // Members keep it
+            static struct process rg_parent, rg_child;
+            kmemset(&rg_parent, 0, sizeof(rg_parent));
+            kmemset(&rg_child, 0, sizeof(rg_child));
+            rg_parent.rgroup = group;
+            rgroup_fork(&rg_child, NULL);
+            rgroup_fork(&rg_child, &rg_parent);
+            if (rg_child.rgroup != group || group->nr_procs != 1 ||
+                rgroup_destroy(id) != -1 || get_errno() != THUNDEROS_EBUSY) {
+                ok = 0;
+            }
+            rgroup_exit(&rg_child);
+            
+            if (rgroup_destroy(id) != 0 || rgroup_get(id) != NULL) {
+                ok = 0;
+            }
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 31: Page Reclaim
+    // ========================================
+    hal_uart_puts("\nTest 31: Page Reclaim\n");
+    hal_uart_puts("  LRU lists, shrinkers and empty slabs... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        reclaim_stats_t before, after;
+        reclaim_get_stats(&before);
+        if (before.wmark_low < RECLAIM_WMARK_LOW_FLOOR || before.wmark_high != 2 * before.wmark_low) {
+            ok = 0;
+        }
+        
+        // Three pages, newest at the head; a second use activates one
+        uintptr_t addrs[3] = { pmm_alloc_page(), pmm_alloc_page(), pmm_alloc_page() };
+        struct page *pages[3];
+        for (int i = 0; i < 3; i++) {
+            pages[i] = phys_to_page(addrs[i]);
+            if (!pages[i]) {
+                ok = 0;
+            }
+        }
+        
+        if (ok) {
+            for (int i = 0; i < 3; i++) {
+                lru_add(pages[i]);
+            }
+            lru_mark_accessed(pages[1]);
+            lru_mark_accessed(pages[1]);
+            reclaim_get_stats(&after);
+            if (after.lru_inactive != before.lru_inactive + 2 ||
+                after.lru_active != before.lru_active + 1 ||
+                !(pages[1]->flags & PG_ACTIVE)) {
+                ok = 0;
+            }
+            
+            // Only the victim goes; the others stay on their lists.
+            // Other caches' pages may be older, so look at all of them
+            test_lru_victim = pages[0];
+            if (lru_shrink(after.lru_inactive + after.lru_active, test_lru_evict) != 1 || (pages[0]->flags & PG_LRU) ||
+                !(pages[2]->flags & PG_LRU) || (pages[2]->flags & PG_ACTIVE)) {
+                ok = 0;
+            }
+            
+            for (int i = 0; i < 3; i++) {
+                lru_del(pages[i]);
+                if (pages[i]->flags & (PG_LRU | PG_ACTIVE | PG_REFERENCED)) {
+                    ok = 0;
+                }
+                pmm_free_page(addrs[i]);
+            }
+        }
+        
+        // Registered last, a shrinker is asked first, for the smallest share
+        static shrinker_t test_shrinker = { "test", test_shrink_count, test_shrink_scan, 0, 0, NULL };
+        test_shrink_calls = 0;
+        register_shrinker(&test_shrinker);
+        reclaim_pages(1, 0);
+        unregister_shrinker(&test_shrinker);
+        size_t calls = test_shrink_calls;
+        if (calls == 0 || test_shrink_first_nr != (128 >> RECLAIM_PRIORITY_MAX) ||
+            test_shrinker.scanned < test_shrink_first_nr) {
+            ok = 0;
+        }
+        reclaim_pages(1, 0);
+        if (test_shrink_calls != calls) {
+            ok = 0;
+        }
+        
+        // A cache keeps its last empty slab until shrunk
+        kmem_cache_t *cache = kmem_cache_create("reclaim_test", 64, 0, NULL);
+        void *obj = cache ? kmem_cache_alloc(cache) : NULL;
+        kmem_cache_stats_t cstats;
+        if (!obj) {
+            ok = 0;
+        } else {
+            kmem_cache_free(cache, obj);
+            kmem_cache_get_stats(cache, &cstats);
+            if (cstats.slabs != 1 || kmem_cache_shrink(cache) != 1) {
+                ok = 0;
+            }
+            kmem_cache_get_stats(cache, &cstats);
+            if (cstats.slabs != 0) {
+                ok = 0;
+            }
+        }
+        if (cache) {
+            kmem_cache_destroy(cache);
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 32: Swap Entries
+    // ========================================
+    hal_uart_puts("\nTest 32: Swap Entries\n");
+    hal_uart_puts("  PTE encoding and swap off (no area yet)... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        
+        // A swap entry is never valid and keeps its slot
+        pte_t entry = SWAP_TO_PTE(12345);
+        if (!PTE_IS_SWAP(entry) || (entry & PTE_V) || PTE_TO_SWAP(entry) != 12345) {
+            ok = 0;
+        }
+        if (PTE_IS_SWAP(PA_TO_PTE(0x80200000UL, PTE_USER_DATA | PTE_SWAP)) || PTE_IS_SWAP(0)) {
+            ok = 0;
+        }
+        
+        // Before swap_on() (the disk is not even probed) nothing names a slot
+        swap_stats_t stats;
+        swap_get_stats(&stats);
+        if (stats.total_slots != 0 || stats.cache_pages != 0 || swap_entry_count(1) != 0) {
+            ok = 0;
+        }
+        if (swap_entry_dup(1) != -1 || get_errno() != THUNDEROS_EINVAL) {
+            ok = 0;
+        }
+        int major = 1;
+        if (swap_in(1, &major) != 0 || get_errno() != THUNDEROS_EFAULT || major != 0) {
+            ok = 0;
+        }
+        swap_entry_free(1);     // Ignored
+        if (swap_on(0) != -1) {
+            ok = 0;
+        }
+        swap_get_stats(&stats);
+        if (stats.total_slots != 0 || stats.free_slots != 0) {
+            ok = 0;
+        }
+        clear_errno();
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 33: Per-CPU Page Caches
+    // ========================================
+    hal_uart_puts("\nTest 33: Per-CPU Page Caches\n");
+    hal_uart_puts("  Hot page reuse, refill and drain... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        size_t total, free_before, free_now;
+        pmm_pcp_stats_t before, now;
+        
+        // An empty cache refills a batch from the buddy allocator
+        pmm_drain_pcp();
+        pmm_get_stats(&total, &free_before);
+        pmm_get_pcp_stats(&before);
+        uintptr_t page = pmm_alloc_page();
+        pmm_get_pcp_stats(&now);
+        if (page == 0 || before.pages != 0 || now.refills != before.refills + 1 ||
+            now.pages != PMM_PCP_BATCH - 1 || now.hits != before.hits + 1) {
+            ok = 0;
+        }
+        
+        // The page freed last is the next one handed out
+        if (page) {
+            pmm_free_page(page);
+            if (pmm_alloc_page() != page) {
+                ok = 0;
+            }
+            pmm_free_page(page);
+        }
+        
+        // Up to PMM_PCP_HIGH pages stay cached, then a batch goes back
+        uintptr_t pages[PMM_PCP_HIGH + 1];
+        size_t n = 0;
+        while (n < PMM_PCP_HIGH + 1 && (pages[n] = pmm_alloc_page()) != 0) {
+            n++;
+        }
+        pmm_drain_pcp();
+        pmm_get_pcp_stats(&before);
+        for (size_t i = 0; i < n; i++) {
+            pmm_free_page(pages[i]);
+        }
+        pmm_get_pcp_stats(&now);
+        if (n != PMM_PCP_HIGH + 1 || now.drains != before.drains + 1 ||
+            now.pages != PMM_PCP_HIGH + 1 - PMM_PCP_BATCH) {
+            ok = 0;
+        }
+        
+        // Cached pages count as free, and draining keeps them free
+        pmm_get_stats(&total, &free_now);
+        if (free_now != free_before) {
+            ok = 0;
+        }
+        pmm_drain_pcp();
+        pmm_get_pcp_stats(&now);
+        pmm_get_stats(&total, &free_now);
+        if (now.pages != 0 || free_now != free_before) {
+            ok = 0;
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 34: Kernel Stacks
+    // ========================================
+    hal_uart_puts("\nTest 34: Kernel Stacks\n");
+    hal_uart_puts("  Guarded slots and stack reuse... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        kstack_stats_t before, now;
+        uintptr_t paddr;
+        
+        kstack_get_stats(&before);
+        uintptr_t stack = kstack_alloc();
+        uintptr_t top = stack + KERNEL_STACK_SIZE;
+        if (stack < KSTACK_AREA_BASE || stack >= KSTACK_AREA_END ||
+            kstack_top(stack) != top || kstack_top(top - 1) != top ||
+            !kstack_is_guard(stack - 1) || kstack_is_guard(stack)) {
+            ok = 0;
+        }
+        
+        // Every page of the stack is mapped, the guard below it is not
+        page_table_t *kpt = get_kernel_page_table();
+        for (uintptr_t va = stack; ok && va < top; va += PAGE_SIZE) {
+            if (virt_to_phys(kpt, va, &paddr) != 0) {
+                ok = 0;
+            }
+        }
+        if (virt_to_phys(kpt, stack - PAGE_SIZE, &paddr) == 0) {
+            ok = 0;
+        }
+        if (ok) {
+            kmemset((void *)stack, 0x5A, KERNEL_STACK_SIZE);
+            if (((volatile uint8_t *)stack)[KERNEL_STACK_SIZE - 1] != 0x5A) {
+                ok = 0;
+            }
+        }
+        
+        // A freed stack stays mapped and is the next one handed out
+        kstack_free(stack);
+        uintptr_t again = kstack_alloc();
+        kstack_get_stats(&now);
+        if (again != stack || now.cache_hits != before.cache_hits + 1 ||
+            now.in_use != before.in_use + 1) {
+            ok = 0;
+        }
+        kstack_free(again);
+        
+        kstack_get_stats(&now);
+        if (now.in_use != before.in_use) {
+            ok = 0;
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 35: Partial Page Table Teardown
+    // ========================================
+    hal_uart_puts("\nTest 35: Partial Page Table Teardown\n");
+    hal_uart_puts("  Freeing a page table a leaf table at a time... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        size_t total, free_before, free_after;
+        pmm_get_stats(&total, &free_before);
+        
+        // One page in each of four 2MB regions: four level-0 tables
+        page_table_t *pt = create_user_page_table();
+        if (!pt) {
+            ok = 0;
+        }
+        for (uintptr_t i = 0; ok && i < 4; i++) {
+            if (map_user_memory(pt, 0x40000000 + i * MEGAPAGE_SIZE, 0, PAGE_SIZE, 1) != 0) {
+                ok = 0;
+            }
+        }
+        
+        // Each call frees one; the last frees what is left
+        int calls = 0;
+        if (pt) {
+            while (calls < 64 && !free_page_table_partial(pt, 1)) {
+                calls++;
+            }
+            calls++;
+        }
+        if (calls < 5 || calls >= 64) {
+            ok = 0;
+        }
+        
+        pmm_get_stats(&total, &free_after);
+        if (free_after != free_before) {
+            ok = 0;
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 36: kmalloc_aligned
+    // ========================================
+    hal_uart_puts("\nTest 36: kmalloc_aligned\n");
+    hal_uart_puts("  Allocating at 16 bytes to page alignment... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        kmalloc_stats_t before, after;
+        kmalloc_get_stats(&before);
+        
+        // Slab-sized and larger requests, at every alignment up to a page
+        static const size_t sizes[] = { 24, 1000, 5000 };
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            for (size_t align = KMALLOC_MIN_ALIGN; align <= PAGE_SIZE; align <<= 1) {
+                uint8_t *p = kmalloc_aligned(sizes[s], align);
+                if (p == NULL || ((uintptr_t)p % align) != 0) {
+                    ok = 0;
+                }
+                if (p) {
+                    p[0] = 1;
+                    p[sizes[s] - 1] = 1;
+                    kfree(p);
+                }
+            }
+        }
+        
+        if (kmalloc_aligned(64, 48) != NULL || kmalloc_aligned(64, 2 * PAGE_SIZE) != NULL) {
+            ok = 0;
+        }
+        
+        // Everything went back, with the large path's header
+        kmalloc_get_stats(&after);
+        if (after.slab_objects != before.slab_objects || after.large_pages != before.large_pages) {
+            ok = 0;
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
+    // ========================================
+    // Test 37: Page-Aligned Block Holding a Slab Magic
+    // ========================================
+    hal_uart_puts("\nTest 37: Page-Aligned Block Holding a Slab Magic\n");
+    hal_uart_puts("  Freeing a block that starts like a slab header... ");
+    tests_total++;
+    
+    {
+        int ok = 1;
+        kmalloc_stats_t before, after;
+        kmalloc_get_stats(&before);
+        
+        // The block starts a page of its own: fill it as a slab header
+        // would be (magic 0x51AB51AB, then a real cache further in)
+        kmem_cache_t *cache = kmem_cache_create("test_magic", 64, 0, NULL);
+        uint32_t *p = kmalloc_aligned(256, PAGE_SIZE);
+        if (p == NULL || cache == NULL) {
+            ok = 0;
+        }
+        if (p) {
+            kmemset(p, 0, 256);
+            p[0] = 0x51AB51AB;
+            ((kmem_cache_t **)p)[2] = cache;
+            if (kmem_cache_of(p) != NULL) {
+                ok = 0;
+            }
+            kfree(p);
+        }
+        
+        // A slab object is still found through its page
+        void *obj = cache ? kmem_cache_alloc(cache) : NULL;
+        if (obj == NULL || kmem_cache_of(obj) != cache) {
+            ok = 0;
+        }
+        if (obj) {
+            kmem_cache_free(cache, obj);
+        }
+        if (cache && kmem_cache_destroy(cache) != 0) {
+            ok = 0;
+        }
+        
+        kmalloc_get_stats(&after);
+        if (after.large_pages != before.large_pages) {
+            ok = 0;
+        }
+        
+        if (ok) {
+            hal_uart_puts("PASS\n");
+            tests_passed++;
+        } else {
+            hal_uart_puts("FAIL\n");
+        }
+    }
+    
     // ========================================
     // Summary
     // ========================================
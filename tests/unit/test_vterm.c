@@ -21,6 +21,10 @@ extern int vterm_switch(int terminal);
 extern void vterm_write_char(int terminal, char c);
 extern void vterm_write_string(int terminal, const char *str);
 extern int vterm_has_buffered_input_for(int terminal);
+extern void vterm_puts_to(int index, const char *str);
+extern unsigned int vterm_scrollback_lines(int index);
+extern void vterm_input_char(int index, char c);
+extern int vterm_read_input(int index, char *buf, size_t count);
 
 void test_vterm_features(void) {
     hal_uart_puts("\n");
@@ -136,6 +140,81 @@ void test_vterm_features(void) {
     hal_uart_puts(")\n");
     tests_passed++;
     
+    /* ========================================
+     * Test 6: Scrollback Keeps Lines That Scroll Off
+     * ======================================== */
+    hal_uart_puts("\nTest 6: Scrollback\n");
+    hal_uart_puts("  Writing 100 lines to VT6... ");
+    tests_total++;
+    
+    /* VT6 (index 5) has at most 36 rows, so at least 50 lines scroll off */
+    unsigned int before = vterm_scrollback_lines(5);
+    for (int i = 0; i < 100; i++) {
+        vterm_puts_to(5, "scrollback line\n");
+    }
+    unsigned int after = vterm_scrollback_lines(5);
+    
+    if (after >= before + 50 && after <= 512) {
+        hal_uart_puts("PASS (");
+        kprint_dec(after);
+        hal_uart_puts(" lines kept)\n");
+        tests_passed++;
+    } else {
+        hal_uart_puts("FAIL (");
+        kprint_dec(before);
+        hal_uart_puts(" -> ");
+        kprint_dec(after);
+        hal_uart_puts(")\n");
+    }
+    
+    /* ========================================
+     * Test 7: Canonical Line Discipline
+     * ======================================== */
+    hal_uart_puts("\nTest 7: Canonical Line Discipline\n");
+    hal_uart_puts("  Typing lines with erase, kill and ^D on VT6... ");
+    tests_total++;
+    
+    /* Nothing is readable until the line ends; erase and kill edit it */
+    char line[16];
+    const char *typed = "xy\x15" "ab\x7f" "c";
+    for (const char *p = typed; *p; p++) {
+        vterm_input_char(5, *p);
+    }
+    int pending = vterm_read_input(5, line, sizeof(line));
+    vterm_input_char(5, '\r');
+    vterm_input_char(5, 'd');
+    vterm_input_char(5, '\n');
+    int first = vterm_read_input(5, line, sizeof(line));
+    int first_ok = first == 3 && line[0] == 'a' && line[1] == 'c' && line[2] == '\n';
+    int second = vterm_read_input(5, line, sizeof(line));
+    
+    /* ^D passes a partial line, and on an empty line reads as end of file */
+    vterm_input_char(5, 'e');
+    vterm_input_char(5, 0x04);
+    vterm_input_char(5, 0x04);
+    int partial = vterm_read_input(5, line, sizeof(line));
+    int eof = vterm_read_input(5, line, sizeof(line));
+    int empty = vterm_read_input(5, line, sizeof(line));
+    
+    if (pending == -1 && first_ok && second == 2 && partial == 1 && eof == 0 && empty == -1) {
+        hal_uart_puts("PASS\n");
+        tests_passed++;
+    } else {
+        hal_uart_puts("FAIL (");
+        kprint_dec(pending);
+        hal_uart_puts(", ");
+        kprint_dec(first);
+        hal_uart_puts(", ");
+        kprint_dec(second);
+        hal_uart_puts(", ");
+        kprint_dec(partial);
+        hal_uart_puts(", ");
+        kprint_dec(eof);
+        hal_uart_puts(", ");
+        kprint_dec(empty);
+        hal_uart_puts(")\n");
+    }
+    
     /* ========================================
      * Summary
      * ======================================== */
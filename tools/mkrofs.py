@@ -0,0 +1,285 @@
+#!/usr/bin/env python3
+"""
+mkrofs.py - Build a compressed read-only (rofs) filesystem image
+
+Packs a directory tree into the image format described in
+include/fs/rofs.h: all metadata at the front, then file data in blocks
+compressed one by one with LZ4. A block that does not shrink is stored
+as-is, a block of zeroes takes no space, and identical blocks are stored
+once.
+
+Usage:
+    python3 tools/mkrofs.py [-b BLOCK_SIZE] [--no-compress] SOURCE_DIR IMAGE
+
+Files are owned by root unless --owner is given. Set SOURCE_DATE_EPOCH for
+a reproducible build time. Only regular files and directories are packed;
+anything else is skipped with a warning.
+"""
+
+import argparse
+import hashlib
+import os
+import stat
+import struct
+import sys
+import time
+
+ROFS_MAGIC = 0x53464F52
+ROFS_VERSION = 1
+ROFS_COMP_NONE = 0
+ROFS_COMP_LZ4 = 1
+ROFS_MIN_BLOCK_SIZE = 4096
+ROFS_MAX_BLOCK_SIZE = 65536
+ROFS_BLOCK_RAW = 0x80000000
+
+SUPER_FORMAT = "<IHHIIIIIIII24x"   # 64 bytes
+INODE_FORMAT = "<HHHHIIQ"          # 24 bytes
+DIRENT_FORMAT = "<IIHH"            # 12 bytes
+BLOCK_FORMAT = "<II"               # 8 bytes
+
+SECTOR_SIZE = 512
+IMAGE_ALIGN = 4096                 # Image padded to whole pages
+
+EXT2_S_IFREG = 0x8000
+EXT2_S_IFDIR = 0x4000
+
+# LZ4 block format limits
+LZ4_MIN_MATCH = 4
+LZ4_LAST_LITERALS = 5              # The block ends with at least this many literals
+LZ4_MF_LIMIT = 12                  # No match starts this close to the end
+LZ4_MAX_OFFSET = 65535
+
+
+def lz4_length(out, length):
+    """Append a length extension (bytes of 255, then the rest)"""
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+
+def lz4_sequence(out, literals, offset, match_len):
+    """Append one sequence; match_len 0 for the closing literals-only one"""
+    lit_len = len(literals)
+    ml = match_len - LZ4_MIN_MATCH if match_len else 0
+    out.append((min(lit_len, 15) << 4) | min(ml, 15))
+    if lit_len >= 15:
+        lz4_length(out, lit_len - 15)
+    out += literals
+    if match_len:
+        out += struct.pack("<H", offset)
+        if ml >= 15:
+            lz4_length(out, ml - 15)
+
+
+def lz4_compress(data):
+    """Compress one block (greedy matching on 4-byte hashes)"""
+    n = len(data)
+    out = bytearray()
+    table = {}
+    anchor = 0
+    i = 0
+    while i < n - LZ4_MF_LIMIT:
+        key = data[i:i + LZ4_MIN_MATCH]
+        candidate = table.get(key)
+        table[key] = i
+        if candidate is None or i - candidate > LZ4_MAX_OFFSET:
+            i += 1
+            continue
+
+        # Forwards, stopping short of the closing literals
+        match_len = LZ4_MIN_MATCH
+        max_len = n - LZ4_LAST_LITERALS - i
+        while match_len < max_len and data[candidate + match_len] == data[i + match_len]:
+            match_len += 1
+
+        # Backwards, into literals not yet written
+        while i > anchor and candidate > 0 and data[i - 1] == data[candidate - 1]:
+            i -= 1
+            candidate -= 1
+            match_len += 1
+
+        lz4_sequence(out, data[anchor:i], i - candidate, match_len)
+        i += match_len
+        anchor = i
+    lz4_sequence(out, data[anchor:], 0, 0)
+    return bytes(out)
+
+
+class Inode:
+    def __init__(self, number, mode, parent):
+        self.number = number
+        self.mode = mode
+        self.parent = parent        # Directories: inode number of the one holding it
+        self.entries = []           # Directories: (name bytes, Inode)
+        self.path = None            # Files: where the data comes from
+        self.size = 0
+
+
+def scan(source, warn):
+    """Number every directory and file under source, root first"""
+    root = Inode(1, EXT2_S_IFDIR | (os.stat(source).st_mode & 0o7777), 1)
+    inodes = [root]
+    links = {}
+    queue = [(source, root)]
+    while queue:
+        path, directory = queue.pop(0)
+        for name in sorted(os.listdir(path), key=os.fsencode):
+            full = os.path.join(path, name)
+            st = os.lstat(full)
+            encoded = os.fsencode(name)
+            if len(encoded) > 255:
+                warn("name too long, skipped: %s" % full)
+                continue
+            if stat.S_ISDIR(st.st_mode):
+                child = Inode(len(inodes) + 1, EXT2_S_IFDIR | (st.st_mode & 0o7777),
+                              directory.number)
+                inodes.append(child)
+                queue.append((full, child))
+            elif stat.S_ISREG(st.st_mode):
+                key = (st.st_dev, st.st_ino)
+                child = links.get(key) if st.st_nlink > 1 else None
+                if child is None:
+                    child = Inode(len(inodes) + 1, EXT2_S_IFREG | (st.st_mode & 0o7777), 0)
+                    child.path = full
+                    child.size = st.st_size
+                    inodes.append(child)
+                    links[key] = child
+            else:
+                warn("not a regular file or directory, skipped: %s" % full)
+                continue
+            directory.entries.append((encoded, child))
+    return inodes
+
+
+def build(source, block_size, compress, owner, warn):
+    inodes = scan(source, warn)
+    uid, gid = owner
+
+    # Names, each stored once
+    names = bytearray()
+    name_offsets = {}
+
+    def name_offset(name):
+        if name not in name_offsets:
+            name_offsets[name] = len(names)
+            names.extend(name + b"\0")
+        return name_offsets[name]
+
+    dirents = []
+    blocks = []
+    starts = {}
+    for inode in inodes:
+        if inode.mode & EXT2_S_IFDIR:
+            starts[inode.number] = len(dirents)
+            for name, child in inode.entries:
+                dirents.append(struct.pack(DIRENT_FORMAT, child.number,
+                                           name_offset(name), len(name), 0))
+        else:
+            starts[inode.number] = len(blocks)
+            blocks.extend([None] * ((inode.size + block_size - 1) // block_size))
+
+    meta_size = (struct.calcsize(SUPER_FORMAT) +
+                 len(inodes) * struct.calcsize(INODE_FORMAT) +
+                 len(dirents) * struct.calcsize(DIRENT_FORMAT) +
+                 len(blocks) * struct.calcsize(BLOCK_FORMAT) +
+                 len(names))
+
+    # Data, after the metadata on a sector boundary
+    data = bytearray()
+    data_start = (meta_size + SECTOR_SIZE - 1) // SECTOR_SIZE * SECTOR_SIZE
+    stored = {}
+    raw_bytes = 0
+    for inode in inodes:
+        if inode.path is None:
+            continue
+        with open(inode.path, "rb") as f:
+            contents = f.read()
+        if len(contents) != inode.size:
+            raise SystemExit("mkrofs: %s changed while being read" % inode.path)
+        raw_bytes += len(contents)
+        for i in range(0, len(contents), block_size):
+            chunk = contents[i:i + block_size]
+            if chunk.count(0) == len(chunk):
+                entry = (0, 0)
+            else:
+                digest = hashlib.sha256(chunk).digest()
+                entry = stored.get(digest)
+                if entry is None:
+                    packed = lz4_compress(chunk) if compress else None
+                    offset = data_start + len(data)
+                    if packed is not None and len(packed) < len(chunk):
+                        data += packed
+                        entry = (offset, len(packed))
+                    else:
+                        data += chunk
+                        entry = (offset, len(chunk) | ROFS_BLOCK_RAW)
+                    stored[digest] = entry
+            blocks[starts[inode.number] + i // block_size] = struct.pack(BLOCK_FORMAT, *entry)
+
+    image_size = data_start + len(data)
+    image_size = (image_size + IMAGE_ALIGN - 1) // IMAGE_ALIGN * IMAGE_ALIGN
+    if image_size > 0xFFFFFFFF:
+        raise SystemExit("mkrofs: image would be larger than 4 GiB")
+
+    build_time = int(os.environ.get("SOURCE_DATE_EPOCH", time.time()))
+    image = bytearray(struct.pack(SUPER_FORMAT, ROFS_MAGIC, ROFS_VERSION,
+                                  ROFS_COMP_LZ4 if compress else ROFS_COMP_NONE,
+                                  block_size, len(inodes), len(dirents), len(blocks),
+                                  len(names), meta_size, image_size, build_time))
+    for inode in inodes:
+        if inode.mode & EXT2_S_IFDIR:
+            size, parent = len(inode.entries), inode.parent
+        else:
+            size, parent = inode.size, 0
+        image += struct.pack(INODE_FORMAT, inode.mode, uid, gid, 0, parent,
+                             starts[inode.number], size)
+    for entry in dirents:
+        image += entry
+    for entry in blocks:
+        image += entry
+    image += names
+    assert len(image) == meta_size
+    image += bytes(data_start - meta_size)
+    image += data
+    image += bytes(image_size - len(image))
+    return image, len(inodes), raw_bytes
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build a rofs filesystem image")
+    parser.add_argument("source", help="directory to pack")
+    parser.add_argument("image", help="image file to write")
+    parser.add_argument("-b", "--block-size", type=int, default=16384,
+                        help="bytes of file data per compressed block (default 16384)")
+    parser.add_argument("--no-compress", action="store_true",
+                        help="store every block uncompressed")
+    parser.add_argument("--owner", default="0:0", metavar="UID:GID",
+                        help="owner of every file (default 0:0)")
+    args = parser.parse_args()
+
+    block_size = args.block_size
+    if (block_size < ROFS_MIN_BLOCK_SIZE or block_size > ROFS_MAX_BLOCK_SIZE or
+            block_size & (block_size - 1)):
+        parser.error("block size must be a power of two from %d to %d" %
+                     (ROFS_MIN_BLOCK_SIZE, ROFS_MAX_BLOCK_SIZE))
+    try:
+        uid, gid = (int(x) for x in args.owner.split(":"))
+    except ValueError:
+        parser.error("owner must be UID:GID")
+    if not os.path.isdir(args.source):
+        parser.error("%s is not a directory" % args.source)
+
+    def warn(message):
+        print("mkrofs: warning: " + message, file=sys.stderr)
+
+    image, inode_count, raw_bytes = build(args.source, block_size, not args.no_compress,
+                                          (uid, gid), warn)
+    with open(args.image, "wb") as f:
+        f.write(image)
+    print("mkrofs: %d inodes, %d KiB of files in a %d KiB image" %
+          (inode_count, raw_bytes // 1024, len(image) // 1024))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""
+mkswap.py - Append a swap area to a disk image
+
+Pads the image to the next 1 MiB boundary, where the kernel looks for a
+swap area past the root filesystem, and appends SIZE bytes starting with
+a header page in the Linux mkswap layout (see include/mm/swap.h): the
+version and the index of the last page at byte 1024, "SWAPSPACE2" in the
+last 10 bytes of the page. The rest of the area is left zero.
+
+Usage:
+    python3 tools/mkswap.py IMAGE SIZE
+
+SIZE is in bytes, or with a K, M or G suffix (e.g. 16M); 0 adds nothing.
+"""
+
+import argparse
+import os
+import struct
+
+PAGE_SIZE = 4096
+SWAP_ALIGN = 1024 * 1024
+SWAP_MAGIC = b"SWAPSPACE2"
+SWAP_VERSION = 1
+HEADER_FORMAT = "<III"             # version, last_page, nr_badpages
+HEADER_OFFSET = 1024
+
+
+def parse_size(text):
+    units = {"K": 1024, "M": 1024 * 1024, "G": 1024 * 1024 * 1024}
+    scale = units.get(text[-1:].upper(), 1)
+    digits = text[:-1] if scale != 1 else text
+    if not digits.isdigit():
+        raise ValueError(text)
+    return int(digits) * scale
+
+
+def header(pages):
+    page = bytearray(PAGE_SIZE)
+    struct.pack_into(HEADER_FORMAT, page, HEADER_OFFSET, SWAP_VERSION, pages - 1, 0)
+    page[PAGE_SIZE - len(SWAP_MAGIC):] = SWAP_MAGIC
+    return bytes(page)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Append a swap area to a disk image")
+    parser.add_argument("image", help="disk image to extend")
+    parser.add_argument("size", help="bytes of swap (K, M or G suffix allowed)")
+    args = parser.parse_args()
+
+    try:
+        size = parse_size(args.size)
+    except ValueError:
+        parser.error("bad size: %s" % args.size)
+    if size == 0:
+        return
+    pages = size // PAGE_SIZE
+    if pages < 2:
+        parser.error("a swap area needs at least two pages (header and a slot)")
+    if not os.path.isfile(args.image):
+        parser.error("%s does not exist" % args.image)
+
+    start = (os.path.getsize(args.image) + SWAP_ALIGN - 1) // SWAP_ALIGN * SWAP_ALIGN
+    with open(args.image, "r+b") as f:
+        f.seek(start)
+        f.write(header(pages))
+        f.truncate(start + pages * PAGE_SIZE)
+    print("mkswap: %d KiB of swap at byte %d" % (pages * PAGE_SIZE // 1024, start))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""
+prof_report.py - Summarize a ThunderOS profile dump
+
+Reads the samples "prof dump <file>" wrote from /dev/prof (see
+include/kernel/prof.h), symbolizes kernel addresses against the kernel
+ELF and prints, like perf report, the share of samples that landed in
+each function. With --callers each kernel function is followed by the
+call chains it was reached through.
+
+Usage:
+    python3 tools/prof_report.py [--elf build/thunderos.elf] [--callers]
+                                 [--cpu N] [--pid N] [--top N] DUMP
+
+Kernel samples print as "[k] function", user samples as "[.] pid N"
+(user stacks are not walked and user images are not symbolized) and
+samples in the idle loop under "[k] idle".
+"""
+
+import argparse
+import bisect
+import struct
+import sys
+from collections import Counter, defaultdict
+
+SAMPLE_DEPTH = 6
+SAMPLE_FORMAT = f"<QIHBB{SAMPLE_DEPTH}Q"     # 64 bytes
+SAMPLE_SIZE = struct.calcsize(SAMPLE_FORMAT)
+
+SAMPLE_USER = 0x01
+PID_IDLE = 0xFFFFFFFF
+
+STT_FUNC = 2
+SHT_SYMTAB = 2
+
+
+class Symbols:
+    """Function symbols of an ELF64 little-endian executable"""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            data = f.read()
+        if data[:4] != b"\x7fELF" or data[4] != 2 or data[5] != 1:
+            raise ValueError(f"{path}: not a little-endian ELF64 file")
+
+        shoff, = struct.unpack_from("<Q", data, 0x28)
+        shentsize, shnum = struct.unpack_from("<HH", data, 0x3A)
+        sections = [struct.unpack_from("<IIQQQQIIQQ", data, shoff + i * shentsize)
+                    for i in range(shnum)]
+
+        funcs = {}
+        for _, sh_type, _, _, offset, size, link, _, _, entsize in sections:
+            if sh_type != SHT_SYMTAB:
+                continue
+            strtab = sections[link]
+            for off in range(offset, offset + size, entsize):
+                name, info, _, _, value, sym_size = struct.unpack_from("<IBBHQQ", data, off)
+                if info & 0xF != STT_FUNC or value == 0:
+                    continue
+                start = strtab[4] + name
+                funcs[value] = (data[start:data.index(b"\0", start)].decode(), sym_size)
+
+        self.starts = sorted(funcs)
+        self.funcs = [funcs[a] for a in self.starts]
+
+    def lookup(self, addr):
+        i = bisect.bisect_right(self.starts, addr) - 1
+        if i >= 0:
+            name, size = self.funcs[i]
+            if addr < self.starts[i] + max(size, 1):
+                return name
+        return f"{addr:#x}"
+
+
+def read_samples(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) % SAMPLE_SIZE:
+        print(f"warning: {len(data) % SAMPLE_SIZE} trailing bytes ignored", file=sys.stderr)
+    samples = []
+    for off in range(0, len(data) - SAMPLE_SIZE + 1, SAMPLE_SIZE):
+        pc, pid, cpu, flags, depth, *chain = struct.unpack_from(SAMPLE_FORMAT, data, off)
+        samples.append((pc, pid, cpu, flags, chain[:depth]))
+    return samples
+
+
+def sample_symbol(symbols, pc, pid, flags):
+    if flags & SAMPLE_USER:
+        return f"[.] pid {pid}"
+    if pid == PID_IDLE:
+        return "[k] idle"
+    return f"[k] {symbols.lookup(pc)}"
+
+
+def report(samples, symbols, top, callers):
+    by_symbol = Counter()
+    chains = defaultdict(Counter)
+    kernel = user = idle = 0
+
+    for pc, pid, cpu, flags, chain in samples:
+        symbol = sample_symbol(symbols, pc, pid, flags)
+        by_symbol[symbol] += 1
+        if flags & SAMPLE_USER:
+            user += 1
+        elif pid == PID_IDLE:
+            idle += 1
+        else:
+            kernel += 1
+            if callers:
+                chains[symbol][" <- ".join(symbols.lookup(ra) for ra in chain) or "(none)"] += 1
+
+    total = len(samples)
+    print(f"# Samples: {total} (kernel {kernel}, user {user}, idle {idle})")
+    print("#")
+    print(f"# {'Overhead':>8}  {'Samples':>8}  Symbol")
+    for symbol, count in by_symbol.most_common(top):
+        print(f"  {count * 100 / total:7.2f}%  {count:8}  {symbol}")
+        for chain, n in chains[symbol].most_common(5):
+            print(f"  {'':8}  {'':8}    {n * 100 / count:5.1f}%  {chain}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Summarize a ThunderOS profile dump")
+    parser.add_argument("dump", help="file written by 'prof dump'")
+    parser.add_argument("--elf", default="build/thunderos.elf",
+                        help="kernel image the samples came from (default build/thunderos.elf)")
+    parser.add_argument("--callers", "-g", action="store_true",
+                        help="show the call chains into each kernel function")
+    parser.add_argument("--cpu", type=int, help="only samples taken on this CPU")
+    parser.add_argument("--pid", type=int, help="only samples of this process")
+    parser.add_argument("--top", type=int, default=30,
+                        help="functions to list (default 30)")
+    args = parser.parse_args()
+
+    samples = read_samples(args.dump)
+    if args.cpu is not None:
+        samples = [s for s in samples if s[2] == args.cpu]
+    if args.pid is not None:
+        samples = [s for s in samples if s[1] == args.pid]
+    if not samples:
+        print("no samples", file=sys.stderr)
+        return 1
+
+    report(samples, Symbols(args.elf), args.top, args.callers)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
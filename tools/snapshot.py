@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+"""
+snapshot.py - Boot ThunderOS once and save the running VM for fast resume
+
+Starts QEMU with the given command line and its serial console on our
+stdout, waits for a line of boot output (by default the first shell
+starting), lets the system settle, then stops the VM and has QEMU write
+its whole state - RAM, harts, timers and the virtio devices with their
+queues - to a file through QMP. "make resume" starts QEMU with
+-incoming on that file, so the VM carries on from that point without
+running kernel_main() again: nothing in the guest is re-initialised,
+and no driver needs to know.
+
+The resumed VM must be started with the same machine and devices, and
+against the disk exactly as it was when the state was saved. That is why
+"make resume" opens the image with snapshot=on: each resumed VM starts
+from the same disk and its writes are thrown away.
+
+Usage:
+    python3 tools/snapshot.py --out build/thunderos.snap
+                              [--marker TEXT] [--settle SECONDS]
+                              [--timeout SECONDS] -- QEMU ARGS...
+"""
+
+import argparse
+import json
+import os
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+
+class Qmp:
+    """Minimal QMP client: one command at a time, events skipped"""
+
+    def __init__(self, path, timeout):
+        deadline = time.monotonic() + timeout
+        while True:
+            try:
+                self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+                self.sock.connect(path)
+                break
+            except OSError:
+                self.sock.close()
+                if time.monotonic() > deadline:
+                    raise
+                time.sleep(0.05)
+        self.reader = self.sock.makefile("r")
+        self._read()                            # Greeting
+        self.command("qmp_capabilities")
+
+    def _read(self):
+        line = self.reader.readline()
+        if not line:
+            raise RuntimeError("QMP connection closed")
+        return json.loads(line)
+
+    def command(self, name, **arguments):
+        request = {"execute": name}
+        if arguments:
+            request["arguments"] = arguments
+        self.sock.sendall((json.dumps(request) + "\n").encode())
+        while True:
+            reply = self._read()
+            if "return" in reply:
+                return reply["return"]
+            if "error" in reply:
+                raise RuntimeError(f"{name}: {reply['error'].get('desc', reply['error'])}")
+
+
+def wait_for_marker(qemu, marker, timeout):
+    """Copy the console to stdout until a line holds the marker"""
+    deadline = time.monotonic() + timeout
+    line = b""
+    while time.monotonic() < deadline:
+        byte = qemu.stdout.read(1)
+        if not byte:
+            return False
+        sys.stdout.buffer.write(byte)
+        if byte == b"\n":
+            sys.stdout.flush()
+            if marker.encode() in line:
+                return True
+            line = b""
+        else:
+            line += byte
+    return False
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[1])
+    parser.add_argument("--out", required=True, help="file to write the VM state to")
+    parser.add_argument("--marker", default="[OK] Shell on VT1",
+                        help="console line that means boot is done")
+    parser.add_argument("--settle", type=float, default=1.0,
+                        help="seconds to let the system settle after the marker")
+    parser.add_argument("--timeout", type=float, default=120.0,
+                        help="seconds to wait for the marker")
+    parser.add_argument("qemu", nargs=argparse.REMAINDER, help="-- QEMU command line")
+    args = parser.parse_args()
+
+    command = args.qemu[1:] if args.qemu[:1] == ["--"] else args.qemu
+    if not command:
+        parser.error("no QEMU command line given")
+
+    qmp_path = os.path.join(tempfile.mkdtemp(prefix="thunderos-"), "qmp.sock")
+    command += ["-qmp", f"unix:{qmp_path},server=on,wait=off"]
+    qemu = subprocess.Popen(command, stdin=subprocess.DEVNULL, stdout=subprocess.PIPE)
+
+    try:
+        if not wait_for_marker(qemu, args.marker, args.timeout):
+            print(f"\nsnapshot: boot did not reach '{args.marker}'", file=sys.stderr)
+            return 1
+        time.sleep(args.settle)
+
+        qmp = Qmp(qmp_path, 10.0)
+        qmp.command("stop")
+        out = os.path.abspath(args.out)
+        qmp.command("migrate", uri=f"exec:cat > '{out}'")
+        while True:
+            status = qmp.command("query-migrate").get("status")
+            if status == "completed":
+                break
+            if status in ("failed", "cancelled"):
+                print(f"snapshot: saving the VM {status}", file=sys.stderr)
+                return 1
+            time.sleep(0.1)
+        try:
+            qmp.command("quit")
+        except RuntimeError:
+            pass                                # Gone before it replied
+        size = os.path.getsize(out)
+        print(f"\nsnapshot: saved {out} ({size // (1024 * 1024)} MB)")
+        return 0
+    finally:
+        if qemu.poll() is None:
+            try:
+                qemu.wait(timeout=5)
+            except subprocess.TimeoutExpired:
+                qemu.kill()
+        try:
+            os.unlink(qmp_path)
+            os.rmdir(os.path.dirname(qmp_path))
+        except OSError:
+            pass
+
+
+if __name__ == "__main__":
+    sys.exit(main())
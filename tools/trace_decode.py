@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""
+trace_decode.py - Decode a ThunderOS trace dump
+
+Reads the binary records "trace dump <file>" wrote from /dev/trace (see
+include/kernel/trace.h) and prints them in time order, one per line, or
+with --latency pairs up the enter/exit and submit/complete events and
+prints how long each kind took.
+
+Usage:
+    python3 tools/trace_decode.py [--latency] [--freq HZ] DUMP
+
+Times are in microseconds from the first record. The timer runs at 10 MHz
+on QEMU's virt machine; pass --freq for anything else.
+"""
+
+import argparse
+import struct
+import sys
+from collections import defaultdict
+
+RECORD_FORMAT = "<QHHIQQ"          # 32 bytes
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
+
+TIMER_FREQ_HZ = 10000000
+PID_IDLE = 0xFFFFFFFF
+BLK_WRITE = 1 << 63
+
+EVENTS = [
+    "sched_switch",
+    "syscall_enter",
+    "syscall_exit",
+    "page_fault_enter",
+    "page_fault_exit",
+    "blk_submit",
+    "blk_complete",
+    "irq_enter",
+    "irq_exit",
+]
+
+# scause interrupt numbers
+IRQ_NAMES = {1: "ipi", 5: "timer", 9: "external"}
+
+# Syscall numbers worth naming (include/kernel/syscall.h); others print as numbers
+SYSCALL_NAMES = {
+    0: "exit", 1: "write", 2: "read", 3: "getpid", 4: "sbrk", 7: "fork",
+    9: "wait", 12: "gettime", 13: "open", 14: "close", 20: "execve",
+    24: "mmap", 25: "munmap", 26: "pipe", 27: "getdents", 66: "vfork",
+    91: "ioctl",
+}
+
+
+def read_records(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) % RECORD_SIZE:
+        print(f"warning: {len(data) % RECORD_SIZE} trailing bytes ignored", file=sys.stderr)
+    records = [struct.unpack_from(RECORD_FORMAT, data, off)
+               for off in range(0, len(data) - RECORD_SIZE + 1, RECORD_SIZE)]
+    # Each CPU's ring is in order; merge them
+    records.sort(key=lambda r: r[0])
+    return records
+
+
+def pid_str(pid):
+    return "idle" if pid == PID_IDLE else str(pid)
+
+
+def signed(value):
+    return value - (1 << 64) if value & (1 << 63) else value
+
+
+def describe(event, arg0, arg1):
+    name = EVENTS[event] if event < len(EVENTS) else f"event{event}"
+    if name == "sched_switch":
+        return f"{name} {pid_str(arg0)} -> {pid_str(arg1)}"
+    if name == "syscall_enter":
+        return f"{name} {SYSCALL_NAMES.get(arg0, arg0)} a0={arg1:#x}"
+    if name == "syscall_exit":
+        return f"{name} {SYSCALL_NAMES.get(arg0, arg0)} ret={signed(arg1)}"
+    if name == "page_fault_enter":
+        return f"{name} addr={arg0:#x} scause={arg1}"
+    if name == "page_fault_exit":
+        return f"{name} addr={arg0:#x} {'ok' if arg1 == 0 else 'failed'}"
+    if name == "blk_submit":
+        kind = "write" if arg1 & BLK_WRITE else "read"
+        return f"{name} {kind} sector={arg0} bytes={arg1 & ~BLK_WRITE}"
+    if name == "blk_complete":
+        return f"{name} sector={arg0} {'ok' if arg1 else 'error'}"
+    if name in ("irq_enter", "irq_exit"):
+        source = f" source={arg1}" if arg1 else ""
+        return f"{name} {IRQ_NAMES.get(arg0, arg0)}{source}"
+    return f"{name} {arg0:#x} {arg1:#x}"
+
+
+def print_records(records, freq):
+    start = records[0][0]
+    for ts, event, cpu, pid, arg0, arg1 in records:
+        us = (ts - start) * 1000000 / freq
+        print(f"{us:14.1f} cpu{cpu} {pid_str(pid):>5} {describe(event, arg0, arg1)}")
+
+
+def latencies(records, freq):
+    """Pair start and end events; returns {kind: [durations in us]}"""
+    open_syscalls = {}      # pid -> (ts, number)
+    open_faults = {}        # pid -> ts
+    open_irqs = {}          # (cpu, irq, source) -> ts
+    open_blk = {}           # sector -> (ts, kind)
+    out = defaultdict(list)
+
+    for ts, event, cpu, pid, arg0, arg1 in records:
+        name = EVENTS[event] if event < len(EVENTS) else None
+        if name == "syscall_enter":
+            open_syscalls[pid] = (ts, arg0)
+        elif name == "syscall_exit" and pid in open_syscalls:
+            start, number = open_syscalls.pop(pid)
+            out[f"syscall {SYSCALL_NAMES.get(number, number)}"].append((ts - start) * 1e6 / freq)
+        elif name == "page_fault_enter":
+            open_faults[pid] = ts
+        elif name == "page_fault_exit" and pid in open_faults:
+            out["page fault"].append((ts - open_faults.pop(pid)) * 1e6 / freq)
+        elif name == "irq_enter":
+            open_irqs[(cpu, arg0, arg1)] = ts
+        elif name == "irq_exit" and (cpu, arg0, arg1) in open_irqs:
+            start = open_irqs.pop((cpu, arg0, arg1))
+            source = f" {arg1}" if arg1 else ""
+            out[f"irq {IRQ_NAMES.get(arg0, arg0)}{source}"].append((ts - start) * 1e6 / freq)
+        elif name == "blk_submit":
+            open_blk[arg0] = (ts, "write" if arg1 & BLK_WRITE else "read")
+        elif name == "blk_complete" and arg0 in open_blk:
+            start, kind = open_blk.pop(arg0)
+            out[f"block {kind}"].append((ts - start) * 1e6 / freq)
+    return out
+
+
+def print_latencies(records, freq):
+    table = latencies(records, freq)
+    print(f"{'KIND':24} {'COUNT':>8} {'MEAN_US':>10} {'P50_US':>10} {'P99_US':>10} {'MAX_US':>10}")
+    for kind in sorted(table):
+        times = sorted(table[kind])
+        n = len(times)
+        mean = sum(times) / n
+        print(f"{kind:24} {n:8} {mean:10.1f} {times[n // 2]:10.1f} "
+              f"{times[min(n - 1, n * 99 // 100)]:10.1f} {times[-1]:10.1f}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a ThunderOS trace dump")
+    parser.add_argument("dump", help="file written by 'trace dump'")
+    parser.add_argument("--latency", action="store_true",
+                        help="print per-kind latencies instead of the records")
+    parser.add_argument("--freq", type=int, default=TIMER_FREQ_HZ,
+                        help=f"timer frequency in Hz (default {TIMER_FREQ_HZ})")
+    args = parser.parse_args()
+
+    records = read_records(args.dump)
+    if not records:
+        print("no records", file=sys.stderr)
+        return 1
+    if args.latency:
+        print_latencies(records, args.freq)
+    else:
+        print_records(records, args.freq)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
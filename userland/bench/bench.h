@@ -0,0 +1,372 @@
+/**
+ * bench.h - Shared code for the userland benchmarks (userland/bench)
+ *
+ * Header-only, like lib/futex.h: syscall wrappers, a timing loop and a
+ * JSON line writer. Every benchmark prints one JSON object per result on
+ * stdout and nothing else, so output can go straight to whatever tracks
+ * performance across builds; "source /bench.sh" runs them all into
+ * /tmp/bench.json and prints it. Each line has the benchmark's name, its
+ * parameters, the iterations timed and the elapsed time, plus rates where
+ * they mean something:
+ *
+ *   {"bench":"pipe_bandwidth","buffer":4096,"iterations":512,
+ *    "elapsed_ms":130,"ns_per_op":253906,"kb_per_s":15753}
+ *
+ * (on one line). The clock is SYS_GETTIME, in milliseconds, which the
+ * baselines were taken with (vdso.h has a finer one), so each measurement
+ * runs for at least BENCH_MIN_MS and cheap operations are timed in
+ * batches between clock reads.
+ */
+
+#ifndef USERLAND_BENCH_H
+#define USERLAND_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_GETPID        3
+#define SYS_SBRK          4
+#define SYS_FORK          7
+#define SYS_WAIT          9
+#define SYS_GETTIME       12
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_UNLINK        18
+#define SYS_RMDIR         19
+#define SYS_MKDIR         17
+#define SYS_EXECVE        20
+#define SYS_MMAP          24
+#define SYS_MUNMAP        25
+#define SYS_PIPE          26
+#define SYS_GETDENTS      27
+#define SYS_VFORK         66
+#define SYS_SHM_OPEN      76
+#define SYS_SHM_UNLINK    77
+#define SYS_FTRUNCATE     78
+#define SYS_PREAD64       82
+#define SYS_PWRITE64      83
+
+/* Open flags */
+#define O_RDONLY  0x0000
+#define O_WRONLY  0x0001
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+#define O_TRUNC   0x0200
+
+/* mmap() arguments */
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+#define MAP_ANONYMOUS 0x20
+
+#define STDOUT_FD 1
+
+#define BENCH_PAGE_SIZE 4096
+
+/* Shortest timed run; the clock ticks in milliseconds */
+#define BENCH_MIN_MS    250
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall4(n, a1, a2, a3, a4) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), \
+                 "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall6(n, a1, a2, a3, a4, a5, a6) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long a4_reg asm("a4") = (long)(a5); \
+    register long a5_reg asm("a5") = (long)(a6); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(a4_reg), \
+                 "r"(a5_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while (1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long getpid(void) {
+    return syscall1(SYS_GETPID, 0);
+}
+
+static inline long sbrk(long increment) {
+    return syscall1(SYS_SBRK, increment);
+}
+
+static inline long fork(void) {
+    return syscall1(SYS_FORK, 0);
+}
+
+static inline long vfork(void) {
+    return syscall1(SYS_VFORK, 0);
+}
+
+static inline long waitpid(long pid, int *status) {
+    return syscall3(SYS_WAIT, pid, status, 0);
+}
+
+static inline long execve(const char *path, const char *argv[], const char *envp[]) {
+    return syscall3(SYS_EXECVE, path, argv, envp);
+}
+
+static inline long gettime_ms(void) {
+    return syscall1(SYS_GETTIME, 0);
+}
+
+static inline long open(const char *path, int flags, int mode) {
+    return syscall3(SYS_OPEN, path, flags, mode);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+static inline long mkdir(const char *path, int mode) {
+    return syscall2(SYS_MKDIR, path, mode);
+}
+
+static inline long rmdir(const char *path) {
+    return syscall1(SYS_RMDIR, path);
+}
+
+static inline long pread(int fd, void *buf, size_t len, long offset) {
+    return syscall4(SYS_PREAD64, fd, buf, len, offset);
+}
+
+static inline long pwrite(int fd, const void *buf, size_t len, long offset) {
+    return syscall4(SYS_PWRITE64, fd, buf, len, offset);
+}
+
+static inline long pipe(int fds[2]) {
+    return syscall1(SYS_PIPE, fds);
+}
+
+static inline long getdents(int fd, void *buf, size_t len) {
+    return syscall3(SYS_GETDENTS, fd, buf, len);
+}
+
+static inline long mmap(void *addr, size_t len, int prot, int flags, int fd, long offset) {
+    return syscall6(SYS_MMAP, addr, len, prot, flags, fd, offset);
+}
+
+static inline long munmap(void *addr, size_t len) {
+    return syscall2(SYS_MUNMAP, addr, len);
+}
+
+static inline long shm_open(const char *name, int flags) {
+    return syscall3(SYS_SHM_OPEN, name, flags, 0600);
+}
+
+static inline long shm_unlink(const char *name) {
+    return syscall1(SYS_SHM_UNLINK, name);
+}
+
+static inline long ftruncate(int fd, long length) {
+    return syscall2(SYS_FTRUNCATE, fd, length);
+}
+
+/* String helpers */
+static inline size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static inline int streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+/* Append the decimal form of n to buf at *pos */
+static inline void bench_fmt_num(char *buf, int *pos, long n) {
+    char digits[20];
+    int i = 0;
+
+    if (n < 0) {
+        buf[(*pos)++] = '-';
+        n = -n;
+    }
+    do {
+        digits[i++] = '0' + (n % 10);
+        n /= 10;
+    } while (n > 0);
+    while (i > 0) {
+        buf[(*pos)++] = digits[--i];
+    }
+}
+
+static inline void bench_fmt_str(char *buf, int *pos, const char *s) {
+    while (*s) {
+        buf[(*pos)++] = *s++;
+    }
+}
+
+/* ========================================================================
+ * JSON lines
+ * ======================================================================== */
+
+/* One result line, written with a single write() */
+typedef struct {
+    char buf[256];
+    int len;
+} bench_line_t;
+
+static inline void bench_begin(bench_line_t *line, const char *name) {
+    line->len = 0;
+    bench_fmt_str(line->buf, &line->len, "{\"bench\":\"");
+    bench_fmt_str(line->buf, &line->len, name);
+    bench_fmt_str(line->buf, &line->len, "\"");
+}
+
+static inline void bench_int(bench_line_t *line, const char *key, long value) {
+    bench_fmt_str(line->buf, &line->len, ",\"");
+    bench_fmt_str(line->buf, &line->len, key);
+    bench_fmt_str(line->buf, &line->len, "\":");
+    bench_fmt_num(line->buf, &line->len, value);
+}
+
+static inline void bench_str(bench_line_t *line, const char *key, const char *value) {
+    bench_fmt_str(line->buf, &line->len, ",\"");
+    bench_fmt_str(line->buf, &line->len, key);
+    bench_fmt_str(line->buf, &line->len, "\":\"");
+    bench_fmt_str(line->buf, &line->len, value);
+    bench_fmt_str(line->buf, &line->len, "\"");
+}
+
+static inline void bench_end(bench_line_t *line) {
+    bench_fmt_str(line->buf, &line->len, "}\n");
+    write(STDOUT_FD, line->buf, line->len);
+}
+
+/*
+ * Add the standard timing fields: iterations, elapsed_ms, ns_per_op,
+ * and kb_per_s if bytes were moved. The line is still open for more.
+ */
+static inline void bench_timing(bench_line_t *line, long iterations, long elapsed_ms, long bytes) {
+    if (elapsed_ms <= 0) {
+        elapsed_ms = 1;
+    }
+    bench_int(line, "iterations", iterations);
+    bench_int(line, "elapsed_ms", elapsed_ms);
+    bench_int(line, "ns_per_op", iterations ? elapsed_ms * 1000000 / iterations : 0);
+    if (bytes > 0) {
+        bench_int(line, "kb_per_s", bytes * 1000 / elapsed_ms / 1024);
+    }
+}
+
+/* Report a failed benchmark: {"bench":name,"error":what} */
+static inline void bench_error(const char *name, const char *what) {
+    bench_line_t line;
+    bench_begin(&line, name);
+    bench_str(&line, "error", what);
+    bench_end(&line);
+}
+
+/* ========================================================================
+ * Timing
+ * ======================================================================== */
+
+/* Wait for the clock to tick, so a run starts on a fresh millisecond */
+static inline long bench_clock_start(void) {
+    long start = gettime_ms();
+    long now;
+    while ((now = gettime_ms()) == start);
+    return now;
+}
+
+/*
+ * Run op(arg) in batches of batch calls until BENCH_MIN_MS have passed.
+ * Returns the calls made, and *elapsed_ms the time they took, or -1 if
+ * op returned nonzero (an error).
+ */
+static inline long bench_loop(int (*op)(void *), void *arg, long batch, long *elapsed_ms) {
+    long iterations = 0;
+    long start = bench_clock_start();
+    long now;
+
+    do {
+        for (long i = 0; i < batch; i++) {
+            if (op(arg) != 0) {
+                return -1;
+            }
+            iterations++;
+        }
+        now = gettime_ms();
+    } while (now - start < BENCH_MIN_MS);
+
+    *elapsed_ms = now - start;
+    return iterations;
+}
+
+/* Run op(arg) in a loop and print the standard line for it */
+static inline void bench_run(const char *name, int (*op)(void *), void *arg, long batch) {
+    bench_line_t line;
+    long elapsed_ms;
+    long iterations = bench_loop(op, arg, batch, &elapsed_ms);
+
+    if (iterations < 0) {
+        bench_error(name, "operation failed");
+        return;
+    }
+    bench_begin(&line, name);
+    bench_timing(&line, iterations, elapsed_ms, 0);
+    bench_end(&line);
+}
+
+#endif /* USERLAND_BENCH_H */
@@ -0,0 +1,66 @@
+/**
+ * fault_bench.c - Page fault rate on new heap and anonymous memory
+ *
+ * Grows the heap with sbrk() or maps anonymous memory with mmap(),
+ * writes one byte per page so each page is faulted in (or, if the
+ * kernel populated it up front, just touched), then gives the memory
+ * back. Each iteration covers REGION_PAGES pages, so ns_per_page is the
+ * cost of one fault including its share of the setup and teardown.
+ *
+ * Output (JSON lines, see bench.h), each with "pages":<per iteration>:
+ *   fault_sbrk, fault_mmap
+ */
+
+#include "bench.h"
+
+#define REGION_PAGES  256
+#define REGION_SIZE   (REGION_PAGES * BENCH_PAGE_SIZE)
+
+static void touch(volatile char *base) {
+    for (long off = 0; off < REGION_SIZE; off += BENCH_PAGE_SIZE) {
+        base[off] = 1;
+    }
+}
+
+static int op_sbrk(void *arg) {
+    (void)arg;
+    long base = sbrk(REGION_SIZE);
+    if (base == -1) {
+        return -1;
+    }
+    touch((volatile char *)base);
+    return sbrk(-REGION_SIZE) == -1 ? -1 : 0;
+}
+
+static int op_mmap(void *arg) {
+    (void)arg;
+    long base = mmap(NULL, REGION_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == -1 || base == 0) {
+        return -1;
+    }
+    touch((volatile char *)base);
+    return munmap((void *)base, REGION_SIZE) < 0 ? -1 : 0;
+}
+
+static void run(const char *name, int (*op)(void *)) {
+    long elapsed_ms;
+    long iterations = bench_loop(op, NULL, 1, &elapsed_ms);
+    if (iterations < 0) {
+        bench_error(name, "out of memory");
+        return;
+    }
+
+    bench_line_t line;
+    bench_begin(&line, name);
+    bench_int(&line, "pages", REGION_PAGES);
+    bench_timing(&line, iterations, elapsed_ms, 0);
+    bench_int(&line, "ns_per_page", elapsed_ms * 1000000 / (iterations * REGION_PAGES));
+    bench_end(&line);
+}
+
+void _start(void) {
+    run("fault_sbrk", op_sbrk);
+    run("fault_mmap", op_mmap);
+    exit(0);
+}
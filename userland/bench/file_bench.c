@@ -0,0 +1,113 @@
+/**
+ * file_bench.c - File read and write throughput
+ *
+ * Writes a FILE_SIZE file sequentially in BLOCK_SIZE writes, reads it
+ * back sequentially, then reads and writes RANDOM_OPS blocks at
+ * pseudo-random block offsets with pread()/pwrite(). Writes land in the
+ * page cache and reach the disk later, so these are cached numbers;
+ * the first read after the write finds every page cached as well.
+ *
+ * Output (JSON lines, see bench.h), each with "block":<bytes>:
+ *   file_seq_write, file_seq_read, file_rand_read, file_rand_write
+ */
+
+#include "bench.h"
+
+#define BENCH_PATH   "/tmp/file_bench.dat"
+#define FILE_SIZE    (1024 * 1024)
+#define BLOCK_SIZE   4096
+#define FILE_BLOCKS  (FILE_SIZE / BLOCK_SIZE)
+#define RANDOM_OPS   1024
+
+static char block[BLOCK_SIZE];
+
+/* Linear congruential generator: the same block order every run */
+static uint32_t rand_state = 12345;
+
+static long next_block(void) {
+    rand_state = rand_state * 1103515245 + 12345;
+    return (rand_state >> 16) % FILE_BLOCKS;
+}
+
+static void report(const char *name, long ops, long elapsed) {
+    bench_line_t line;
+    bench_begin(&line, name);
+    bench_int(&line, "block", BLOCK_SIZE);
+    bench_timing(&line, ops, elapsed, ops * BLOCK_SIZE);
+    bench_end(&line);
+}
+
+/* Sequential pass over the file; returns the elapsed ms or -1 */
+static long sequential(int writing) {
+    int fd = open(BENCH_PATH, writing ? (O_WRONLY | O_CREAT | O_TRUNC) : O_RDONLY, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    long start = bench_clock_start();
+    int ok = 1;
+    for (long i = 0; i < FILE_BLOCKS && ok; i++) {
+        long n = writing ? write(fd, block, BLOCK_SIZE) : read(fd, block, BLOCK_SIZE);
+        ok = n == BLOCK_SIZE;
+    }
+    long elapsed = gettime_ms() - start;
+    close(fd);
+    return ok ? elapsed : -1;
+}
+
+/* RANDOM_OPS blocks at random offsets; returns the elapsed ms or -1 */
+static long random_access(int writing) {
+    int fd = open(BENCH_PATH, O_RDWR, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    long start = bench_clock_start();
+    int ok = 1;
+    for (long i = 0; i < RANDOM_OPS && ok; i++) {
+        long offset = next_block() * BLOCK_SIZE;
+        long n = writing ? pwrite(fd, block, BLOCK_SIZE, offset) :
+                           pread(fd, block, BLOCK_SIZE, offset);
+        ok = n == BLOCK_SIZE;
+    }
+    long elapsed = gettime_ms() - start;
+    close(fd);
+    return ok ? elapsed : -1;
+}
+
+void _start(void) {
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        block[i] = (char)i;
+    }
+
+    long elapsed = sequential(1);
+    if (elapsed < 0) {
+        bench_error("file_seq_write", "cannot write " BENCH_PATH);
+        exit(1);
+    }
+    report("file_seq_write", FILE_BLOCKS, elapsed);
+
+    elapsed = sequential(0);
+    if (elapsed < 0) {
+        bench_error("file_seq_read", "read failed");
+    } else {
+        report("file_seq_read", FILE_BLOCKS, elapsed);
+    }
+
+    elapsed = random_access(0);
+    if (elapsed < 0) {
+        bench_error("file_rand_read", "pread failed");
+    } else {
+        report("file_rand_read", RANDOM_OPS, elapsed);
+    }
+
+    elapsed = random_access(1);
+    if (elapsed < 0) {
+        bench_error("file_rand_write", "pwrite failed");
+    } else {
+        report("file_rand_write", RANDOM_OPS, elapsed);
+    }
+
+    unlink(BENCH_PATH);
+    exit(0);
+}
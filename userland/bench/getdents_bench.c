@@ -0,0 +1,99 @@
+/**
+ * getdents_bench.c - Listing large directories
+ *
+ * Fills a directory with ENTRIES empty files and times full listings:
+ * open(), getdents() until it returns 0, close(). Repeated listings find
+ * the directory's blocks cached, so this is the cost of walking and
+ * copying out the entries. The files and directory are removed after.
+ *
+ * Output (JSON lines, see bench.h), one per directory size:
+ *   getdents_list {"entries":<files>,"ns_per_entry":<ns>}
+ */
+
+#include "bench.h"
+
+#define BENCH_DIR   "/tmp/getdents_bench"
+
+static const int entry_counts[] = { 64, 256, 1024 };
+
+/* Room for many entries per call; each is at most 8 + 256 bytes */
+static char dirent_buf[8192];
+
+static char path[64];
+
+/* path = BENCH_DIR "/f<n>" */
+static const char *entry_path(int n) {
+    int pos = 0;
+    bench_fmt_str(path, &pos, BENCH_DIR "/f");
+    bench_fmt_num(path, &pos, n);
+    path[pos] = '\0';
+    return path;
+}
+
+/* Grow the directory from files f0..f<from-1> up to count; returns the files there */
+static int populate(int from, int count) {
+    for (int i = from; i < count; i++) {
+        int fd = open(entry_path(i), O_WRONLY | O_CREAT, 0644);
+        if (fd < 0) {
+            return i;
+        }
+        close(fd);
+    }
+    return count;
+}
+
+static void cleanup(int count) {
+    for (int i = 0; i < count; i++) {
+        unlink(entry_path(i));
+    }
+    rmdir(BENCH_DIR);
+}
+
+/* List the directory once */
+static int op_list(void *arg) {
+    (void)arg;
+    int fd = open(BENCH_DIR, O_RDONLY, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    long n;
+    while ((n = getdents(fd, dirent_buf, sizeof(dirent_buf))) > 0);
+    close(fd);
+    return n < 0 ? -1 : 0;
+}
+
+void _start(void) {
+    int created = 0;
+
+    rmdir(BENCH_DIR);
+    if (mkdir(BENCH_DIR, 0755) < 0) {
+        bench_error("getdents_list", "cannot create " BENCH_DIR);
+        exit(1);
+    }
+
+    for (unsigned i = 0; i < sizeof(entry_counts) / sizeof(entry_counts[0]); i++) {
+        int count = entry_counts[i];
+        created = populate(created, count);
+        if (created < count) {
+            bench_error("getdents_list", "cannot create files");
+            break;
+        }
+
+        long elapsed_ms;
+        long iterations = bench_loop(op_list, NULL, 1, &elapsed_ms);
+        if (iterations < 0) {
+            bench_error("getdents_list", "getdents failed");
+            break;
+        }
+
+        bench_line_t line;
+        bench_begin(&line, "getdents_list");
+        bench_int(&line, "entries", count);
+        bench_timing(&line, iterations, elapsed_ms, 0);
+        bench_int(&line, "ns_per_entry", elapsed_ms * 1000000 / (iterations * count));
+        bench_end(&line);
+    }
+
+    cleanup(created);
+    exit(0);
+}
@@ -0,0 +1,77 @@
+/**
+ * pipe_bench.c - Pipe bandwidth at several buffer sizes
+ *
+ * The parent writes PIPE_TOTAL bytes into a pipe, BUFFER bytes per
+ * write(), to a forked child that reads them with the same buffer size
+ * until end of file. The time runs from the first write to the child's
+ * exit, so it covers both copies and every sleep and wakeup between the
+ * two; small buffers show the per-call cost, large ones the copy rate.
+ *
+ * Output (JSON lines, see bench.h), one per buffer size:
+ *   pipe_bandwidth {"buffer":<bytes>}
+ */
+
+#include "bench.h"
+
+/* Bytes moved per buffer size */
+#define PIPE_TOTAL  (2 * 1024 * 1024)
+
+#define MAX_BUFFER  65536
+
+static const long buffer_sizes[] = { 64, 512, 4096, 16384, 65536 };
+
+static char buffer[MAX_BUFFER];
+
+/* Move PIPE_TOTAL bytes through a pipe; returns the elapsed ms or -1 */
+static long pipe_transfer(long size) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        return -1;
+    }
+
+    long pid = fork();
+    if (pid == 0) {
+        close(fds[1]);
+        while (read(fds[0], buffer, size) > 0);
+        exit(0);
+    }
+    close(fds[0]);
+    if (pid < 0) {
+        close(fds[1]);
+        return -1;
+    }
+
+    long start = bench_clock_start();
+    long sent = 0;
+    while (sent < PIPE_TOTAL) {
+        long n = write(fds[1], buffer, size);
+        if (n <= 0) {
+            break;
+        }
+        sent += n;
+    }
+    close(fds[1]);
+
+    int status = 0;
+    waitpid(pid, &status);
+    long elapsed = gettime_ms() - start;
+    return sent == PIPE_TOTAL ? elapsed : -1;
+}
+
+void _start(void) {
+    for (unsigned i = 0; i < sizeof(buffer_sizes) / sizeof(buffer_sizes[0]); i++) {
+        long size = buffer_sizes[i];
+        long elapsed = pipe_transfer(size);
+        if (elapsed < 0) {
+            bench_error("pipe_bandwidth", "transfer failed");
+            continue;
+        }
+
+        bench_line_t line;
+        bench_begin(&line, "pipe_bandwidth");
+        bench_int(&line, "buffer", size);
+        bench_timing(&line, PIPE_TOTAL / size, elapsed, PIPE_TOTAL);
+        bench_end(&line);
+    }
+    exit(0);
+}
@@ -0,0 +1,75 @@
+/**
+ * spawn_bench.c - Process creation latency
+ *
+ * Times a child from creation to its parent's waitpid() returning:
+ * fork() of a child that exits at once, then fork()+execve() and
+ * vfork()+execve() of this program with "child" as its argument, which
+ * also exits at once. The exec numbers include loading the ELF, whose
+ * image the exec cache keeps after the first run.
+ *
+ * Output (JSON lines, see bench.h):
+ *   spawn_fork_wait, spawn_fork_exec_wait, spawn_vfork_exec_wait
+ */
+
+#include "bench.h"
+
+#define SELF_PATH "/bin/spawn_bench"
+
+static const char *child_argv[] = { SELF_PATH, "child", NULL };
+static const char *child_envp[] = { NULL };
+
+static int op_fork_wait(void *arg) {
+    (void)arg;
+    long pid = fork();
+    if (pid == 0) {
+        exit(0);
+    }
+    if (pid < 0) {
+        return -1;
+    }
+    int status = 0;
+    waitpid(pid, &status);
+    return 0;
+}
+
+static int op_fork_exec_wait(void *arg) {
+    (void)arg;
+    long pid = fork();
+    if (pid == 0) {
+        execve(SELF_PATH, child_argv, child_envp);
+        exit(127);
+    }
+    if (pid < 0) {
+        return -1;
+    }
+    int status = 0;
+    waitpid(pid, &status);
+    return status == 0 ? 0 : -1;
+}
+
+static int op_vfork_exec_wait(void *arg) {
+    (void)arg;
+    long pid = vfork();
+    if (pid == 0) {
+        execve(SELF_PATH, child_argv, child_envp);
+        exit(127);
+    }
+    if (pid < 0) {
+        return -1;
+    }
+    int status = 0;
+    waitpid(pid, &status);
+    return status == 0 ? 0 : -1;
+}
+
+/* Entry point - argc in a0, argv in a1 */
+void _start(long argc, char **argv) {
+    if (argc > 1 && streq(argv[1], "child")) {
+        exit(0);
+    }
+
+    bench_run("spawn_fork_wait", op_fork_wait, NULL, 1);
+    bench_run("spawn_fork_exec_wait", op_fork_exec_wait, NULL, 1);
+    bench_run("spawn_vfork_exec_wait", op_vfork_exec_wait, NULL, 1);
+    exit(0);
+}
@@ -0,0 +1,153 @@
+/**
+ * sync_bench.c - Mutex and condition variable costs
+ *
+ * Uncontended lock/unlock pairs of a kernel mutex (two syscalls) and of
+ * a futex umutex_t (lib/futex.h, no syscalls), then ping-pong between
+ * this process and a forked child: each waits on a condition variable
+ * for its turn, hands the turn over and signals. The round trips are
+ * done once with the kernel's mutex and condvar syscalls and once with
+ * umutex_t/ucond_t in shared memory, and each costs two wakeups and two
+ * context switches.
+ *
+ * Output (JSON lines, see bench.h):
+ *   mutex_uncontended, umutex_uncontended,
+ *   condvar_ping_pong, ucond_ping_pong
+ */
+
+#include "bench.h"
+#include "../lib/futex.h"
+
+#define SYS_MUTEX_CREATE  46
+#define SYS_MUTEX_LOCK    47
+#define SYS_MUTEX_UNLOCK  49
+#define SYS_MUTEX_DESTROY 50
+#define SYS_COND_CREATE   51
+#define SYS_COND_WAIT     52
+#define SYS_COND_SIGNAL   53
+#define SYS_COND_DESTROY  55
+
+#define SHM_NAME   "/sync_bench"
+
+/* Round trips per ping-pong run */
+#define ROUNDS     2000
+
+/* Lock/unlock pairs between clock reads */
+#define BATCH      1000
+
+/* Shared with the child: whose turn it is, and the futex primitives */
+typedef struct {
+    volatile uint32_t turn;         /* 1 = child's, 0 = parent's */
+    umutex_t mutex;
+    ucond_t cond;
+} shared_t;
+
+static shared_t *shared;
+
+static int kmutex;
+static int kcond;
+static umutex_t local_mutex = UMUTEX_INIT;
+
+static int op_mutex(void *arg) {
+    (void)arg;
+    syscall1(SYS_MUTEX_LOCK, kmutex);
+    syscall1(SYS_MUTEX_UNLOCK, kmutex);
+    return 0;
+}
+
+static int op_umutex(void *arg) {
+    (void)arg;
+    umutex_lock(&local_mutex);
+    umutex_unlock(&local_mutex);
+    return 0;
+}
+
+/* Wait for turn == want, then hand it over: kernel primitives */
+static void kernel_pass(uint32_t want) {
+    syscall1(SYS_MUTEX_LOCK, kmutex);
+    while (shared->turn != want) {
+        syscall2(SYS_COND_WAIT, kcond, kmutex);
+    }
+    shared->turn = !want;
+    syscall1(SYS_COND_SIGNAL, kcond);
+    syscall1(SYS_MUTEX_UNLOCK, kmutex);
+}
+
+/* The same with futex primitives */
+static void futex_pass(uint32_t want) {
+    umutex_lock(&shared->mutex);
+    while (shared->turn != want) {
+        ucond_wait(&shared->cond, &shared->mutex);
+    }
+    shared->turn = !want;
+    ucond_signal(&shared->cond);
+    umutex_unlock(&shared->mutex);
+}
+
+/* ROUNDS round trips with a child; returns the elapsed ms or -1 */
+static long ping_pong(void (*pass)(uint32_t)) {
+    shared->turn = 0;
+
+    long pid = fork();
+    if (pid == 0) {
+        for (int i = 0; i < ROUNDS; i++) {
+            pass(1);
+        }
+        exit(0);
+    }
+    if (pid < 0) {
+        return -1;
+    }
+
+    long start = bench_clock_start();
+    for (int i = 0; i < ROUNDS; i++) {
+        pass(0);
+    }
+    int status = 0;
+    waitpid(pid, &status);
+    return gettime_ms() - start;
+}
+
+static void report_ping_pong(const char *name, long elapsed) {
+    if (elapsed < 0) {
+        bench_error(name, "fork failed");
+        return;
+    }
+    bench_line_t line;
+    bench_begin(&line, name);
+    bench_timing(&line, ROUNDS, elapsed, 0);
+    bench_end(&line);
+}
+
+void _start(void) {
+    kmutex = syscall1(SYS_MUTEX_CREATE, 0);
+    kcond = syscall1(SYS_COND_CREATE, 0);
+    if (kmutex < 0 || kcond < 0) {
+        bench_error("mutex_uncontended", "cannot create mutex or condvar");
+        exit(1);
+    }
+
+    shm_unlink(SHM_NAME);
+    int fd = shm_open(SHM_NAME, O_RDWR | O_CREAT);
+    long addr = -1;
+    if (fd >= 0 && ftruncate(fd, BENCH_PAGE_SIZE) == 0) {
+        addr = mmap(NULL, BENCH_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (addr <= 0) {
+        bench_error("condvar_ping_pong", "cannot map shared memory");
+        exit(1);
+    }
+    shared = (shared_t *)addr;
+    umutex_init(&shared->mutex);
+    ucond_init(&shared->cond);
+
+    bench_run("mutex_uncontended", op_mutex, NULL, BATCH);
+    bench_run("umutex_uncontended", op_umutex, NULL, BATCH);
+    report_ping_pong("condvar_ping_pong", ping_pong(kernel_pass));
+    report_ping_pong("ucond_ping_pong", ping_pong(futex_pass));
+
+    syscall1(SYS_COND_DESTROY, kcond);
+    syscall1(SYS_MUTEX_DESTROY, kmutex);
+    close(fd);
+    shm_unlink(SHM_NAME);
+    exit(0);
+}
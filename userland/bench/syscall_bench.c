@@ -0,0 +1,35 @@
+/**
+ * syscall_bench.c - Null syscall round trip
+ *
+ * getpid() does no work in the kernel, so its cost is trap entry and
+ * exit alone. An unknown syscall number measures the same path through
+ * the dispatcher's error return.
+ *
+ * Output (JSON lines, see bench.h):
+ *   syscall_getpid, syscall_invalid
+ */
+
+#include "bench.h"
+
+#define SYS_INVALID 999
+
+/* Calls between clock reads */
+#define BATCH 1000
+
+static int op_getpid(void *arg) {
+    (void)arg;
+    getpid();
+    return 0;
+}
+
+static int op_invalid(void *arg) {
+    (void)arg;
+    syscall1(SYS_INVALID, 0);
+    return 0;
+}
+
+void _start(void) {
+    bench_run("syscall_getpid", op_getpid, NULL, BATCH);
+    bench_run("syscall_invalid", op_invalid, NULL, BATCH);
+    exit(0);
+}
@@ -5,6 +5,8 @@
  * line editing, and support for built-in and external commands.
  */
 
+#include <stdint.h>
+
 /* ========================================================================
  * External syscall wrappers (defined in syscall.S)
  * ======================================================================== */
@@ -27,6 +29,7 @@ extern long syscall3(long syscall_num, long arg0, long arg1, long arg2);
 #define SYS_KILL    11
 #define SYS_OPEN    13
 #define SYS_CLOSE   14
+#define SYS_STAT    16
 #define SYS_MKDIR   17
 #define SYS_RMDIR   19
 #define SYS_EXECVE  20
@@ -36,6 +39,8 @@ extern long syscall3(long syscall_num, long arg0, long arg1, long arg2);
 #define SYS_GETCWD  29
 #define SYS_DUP2    35
 #define SYS_SETFGPID 36
+#define SYS_VFORK   66
+#define SYS_IOCTL   91
 
 /* Signal numbers */
 #define SIGCONT     18
@@ -48,6 +53,7 @@ extern long syscall3(long syscall_num, long arg0, long arg1, long arg2);
 #define MAX_CMD_LEN         256
 #define INPUT_BUFFER_SIZE   256
 #define READ_BUFFER_SIZE    256
+#define INPUT_READ_SIZE     64
 #define PATH_BUFFER_SIZE    64
 #define MAX_ENV_VARS        32
 #define MAX_ENV_NAME        32
@@ -55,6 +61,9 @@ extern long syscall3(long syscall_num, long arg0, long arg1, long arg2);
 #define EXPANDED_CMD_SIZE   512
 #define MAX_ARGS            16
 #define MAX_JOBS            8
+#define MAX_PIPELINE_STAGES 8
+#define CMD_HASH_SIZE       32      /* Command path cache slots (power of two) */
+#define MAX_CMD_NAME        32
 
 #define STDIN_FD            0
 #define STDOUT_FD           1
@@ -83,6 +92,15 @@ extern long syscall3(long syscall_num, long arg0, long arg1, long arg2);
 #define ESC_STATE_GOT_ESC   1
 #define ESC_STATE_GOT_CSI   2
 
+/* Terminal line discipline (matches kernel) */
+#define TCSETS              0x5402
+#define TTY_ICANON          0x0002  /* Canonical: the kernel edits and echoes lines */
+#define TTY_ECHO            0x0008
+
+struct tty_termios {
+    unsigned int lflag;
+};
+
 /* Directory entry structure (matches kernel) */
 struct thunderos_dirent {
     unsigned int   d_ino;       /* Inode number */
@@ -95,6 +113,20 @@ struct thunderos_dirent {
 #define DT_REG   1  /* Regular file */
 #define DT_DIR   2  /* Directory */
 
+/* stat() result (must match kernel vfs_stat_t) */
+typedef struct {
+    uint32_t st_ino;
+    uint16_t st_mode;
+    uint16_t st_uid;
+    uint16_t st_gid;
+    uint16_t st_pad;
+    uint32_t st_size;
+    uint32_t st_type;
+    uint32_t st_size_high;
+} stat_t;
+
+#define STAT_TYPE_FILE  1
+
 /* ========================================================================
  * String constants
  * ======================================================================== */
@@ -121,6 +153,7 @@ static const char *HELP_TEXT =
     "  unset    - Remove environment variable\n"
     "  env      - List environment variables\n"
     "  history  - Show command history\n"
+    "  hash     - Show cached command paths (-r: forget them)\n"
     "  jobs     - List stopped/background jobs\n"
     "  fg       - Resume job in foreground\n"
     "  bg       - Resume job in background\n"
@@ -137,6 +170,7 @@ static const char *HELP_TEXT =
     "\n"
     "System utilities:\n"
     "  ps       - List processes\n"
+    "  irqstat  - Interrupt statistics and steering\n"
     "  kill     - Send signal to process\n"
     "  sleep    - Sleep for seconds\n"
     "  uname    - System information\n"
@@ -158,7 +192,7 @@ static const char *HELP_TEXT =
     "  - Tab: Filename completion\n"
     "  - Up/Down arrows: Navigate command history\n"
     "  - $VAR or ${VAR}: Variable expansion\n"
-    "  - cmd1 | cmd2: Pipe output to input\n"
+    "  - cmd1 | cmd2 | ...: Pipelines (up to 8 stages)\n"
     "  - < file: Redirect input\n"
     "  - > file: Redirect output (overwrite)\n"
     "  - >> file: Redirect output (append)\n"
@@ -187,7 +221,6 @@ static const char *MSG_REDIR_ERROR = "Error: Cannot open output file\n";
 static const char *NEWLINE = "\n";
 static const char *CRLF = "\r\n";
 static const char *BACKSPACE_ERASE = "\b \b";
-static const char *BIN_PREFIX = "/bin/";
 
 /* ========================================================================
  * Global state
@@ -229,6 +262,16 @@ static env_var_t g_env_vars[MAX_ENV_VARS];
 /* Expanded command buffer (after variable substitution) */
 static char g_expanded_buffer[EXPANDED_CMD_SIZE];
 
+/* Command path cache: name -> path found on $PATH, emptied when PATH changes */
+typedef struct {
+    char name[MAX_CMD_NAME];
+    char path[PATH_BUFFER_SIZE];
+    int hits;
+    int in_use;
+} cmd_hash_entry_t;
+
+static cmd_hash_entry_t g_cmd_hash[CMD_HASH_SIZE];
+
 /* I/O redirection state */
 static char *g_redir_output_file;
 static int g_redir_append;
@@ -258,9 +301,16 @@ static int env_set(const char *name, const char *value);
 static int env_unset(const char *name);
 static void env_expand(const char *input, char *output, int max_len);
 
+/* Command path cache */
+static void cmd_hash_clear(void);
+static const char *cmd_lookup(const char *name);
+
 /* I/O redirection */
 static void parse_redirections(char *cmd, char **input_file, char **output_file, int *append);
 
+/* Terminal modes */
+static void tty_set_canonical(int canonical);
+
 /* Input line management */
 static void input_clear_line(void);
 static void input_set_from_history(int index);
@@ -292,7 +342,8 @@ static void handle_builtin_jobs(void);
 /* Main processing */
 static void process_command(void);
 static int find_pipe_char(const char *cmd);
-static void execute_pipeline(char *left_cmd, char *right_cmd);
+static int split_pipeline(char *cmd, char **stages);
+static void execute_pipeline(char **stages, int count);
 static void handle_arrow_up(void);
 static void handle_arrow_down(void);
 static void handle_escape_sequence(char input_char);
@@ -300,6 +351,7 @@ static void handle_printable_char(char input_char);
 static void handle_backspace(void);
 static void handle_newline(void);
 static void handle_tab(void);
+static void handle_input_char(char input_char);
 /* ========================================================================
  * String utilities
  * ======================================================================== */
@@ -336,6 +388,20 @@ static void print_char(char c) {
     syscall3(SYS_WRITE, STDOUT_FD, (long)&c, 1);
 }
 
+/* ========================================================================
+ * Terminal modes
+ * ======================================================================== */
+
+/**
+ * Switch the terminal between canonical mode with echo, for commands,
+ * and raw mode without echo, where the shell edits the line itself
+ */
+static void tty_set_canonical(int canonical) {
+    struct tty_termios termios;
+    termios.lflag = canonical ? (TTY_ICANON | TTY_ECHO) : 0;
+    syscall3(SYS_IOCTL, STDIN_FD, TCSETS, (long)&termios);
+}
+
 /**
  * Check if two strings are equal up to a given length
  */
@@ -488,6 +554,11 @@ static const char *env_get(const char *name) {
  * Set environment variable
  */
 static int env_set(const char *name, const char *value) {
+    /* Commands may now resolve elsewhere */
+    if (strings_equal(name, "PATH", 5)) {
+        cmd_hash_clear();
+    }
+    
     /* Check if already exists */
     for (int i = 0; i < MAX_ENV_VARS; i++) {
         if (g_env_vars[i].in_use) {
@@ -517,6 +588,9 @@ static int env_set(const char *name, const char *value) {
  * Unset environment variable
  */
 static int env_unset(const char *name) {
+    if (strings_equal(name, "PATH", 5)) {
+        cmd_hash_clear();
+    }
     for (int i = 0; i < MAX_ENV_VARS; i++) {
         if (g_env_vars[i].in_use) {
             int name_len = (int)str_length(name);
@@ -585,6 +659,156 @@ static void env_expand(const char *input, char *output, int max_len) {
     output[out_pos] = '\0';
 }
 
+/* ========================================================================
+ * Command path cache
+ * ======================================================================== */
+
+/**
+ * Forget every cached command path
+ */
+static void cmd_hash_clear(void) {
+    for (int i = 0; i < CMD_HASH_SIZE; i++) {
+        g_cmd_hash[i].in_use = 0;
+    }
+}
+
+/**
+ * Slot a name hashes to (FNV-1a)
+ */
+static int cmd_hash_slot(const char *name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash = (hash ^ (unsigned char)*name++) * 16777619u;
+    }
+    return (int)(hash & (CMD_HASH_SIZE - 1));
+}
+
+/**
+ * Search each directory on $PATH for a regular file called name
+ * Returns 0 with the full path in path, or -1 if none has it
+ */
+static int path_search(const char *name, char *path) {
+    const char *dirs = env_get("PATH");
+    stat_t st;
+    
+    while (dirs && *dirs) {
+        /* Next directory, up to ':' */
+        int len = 0;
+        while (*dirs && *dirs != ':') {
+            if (len < PATH_BUFFER_SIZE - 1) {
+                path[len++] = *dirs;
+            }
+            dirs++;
+        }
+        if (*dirs == ':') {
+            dirs++;
+        }
+        if (len == 0) {
+            continue;
+        }
+        
+        if (path[len - 1] != '/' && len < PATH_BUFFER_SIZE - 1) {
+            path[len++] = '/';
+        }
+        for (int i = 0; name[i] && len < PATH_BUFFER_SIZE - 1; i++) {
+            path[len++] = name[i];
+        }
+        path[len] = '\0';
+        
+        if (syscall2(SYS_STAT, (long)path, (long)&st) == 0 && st.st_type == STAT_TYPE_FILE) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Find the program a command name runs
+ * 
+ * A hit costs no system calls; a miss stats each $PATH directory in
+ * turn and caches what it finds, replacing the slot's entry when the
+ * probe finds no free one. Names not found are not cached.
+ * 
+ * @return Full path (valid until the cache changes), or NULL
+ */
+static const char *cmd_lookup(const char *name) {
+    int name_len = (int)str_length(name);
+    if (name_len == 0 || name_len >= MAX_CMD_NAME) {
+        return (const char *)0;
+    }
+    
+    /* Linear probe: a hit, or the first free slot */
+    int home = cmd_hash_slot(name);
+    int slot = home;
+    for (int i = 0; i < CMD_HASH_SIZE; i++) {
+        cmd_hash_entry_t *e = &g_cmd_hash[(home + i) & (CMD_HASH_SIZE - 1)];
+        if (!e->in_use) {
+            slot = (home + i) & (CMD_HASH_SIZE - 1);
+            break;
+        }
+        if (strings_equal(e->name, name, name_len + 1)) {
+            e->hits++;
+            return e->path;
+        }
+    }
+    
+    char found[PATH_BUFFER_SIZE];
+    if (path_search(name, found) != 0) {
+        return (const char *)0;
+    }
+    cmd_hash_entry_t *e = &g_cmd_hash[slot];
+    copy_string(e->name, name, MAX_CMD_NAME);
+    copy_string(e->path, found, PATH_BUFFER_SIZE);
+    e->hits = 1;
+    e->in_use = 1;
+    return e->path;
+}
+
+/**
+ * Handle 'hash' command - list the cached command paths, or (-r) forget them
+ */
+static void handle_builtin_hash(int arg_start, int input_len) {
+    g_expanded_buffer[input_len] = '\0';
+    if (arg_start < input_len) {
+        if (strings_equal(&g_expanded_buffer[arg_start], "-r", 3)) {
+            cmd_hash_clear();
+        } else {
+            print_string("Usage: hash [-r]\n");
+        }
+        return;
+    }
+    
+    int any = 0;
+    char num_buf[12];
+    for (int i = 0; i < CMD_HASH_SIZE; i++) {
+        if (!g_cmd_hash[i].in_use) {
+            continue;
+        }
+        if (!any) {
+            print_string("hits    command\n");
+            any = 1;
+        }
+        /* Right-align the hit count in 4 columns */
+        int hits = g_cmd_hash[i].hits;
+        int pos = 11;
+        num_buf[pos] = '\0';
+        do {
+            num_buf[--pos] = '0' + (hits % 10);
+            hits /= 10;
+        } while (hits > 0 && pos > 0);
+        while (pos > 7) {
+            num_buf[--pos] = ' ';
+        }
+        print_string(&num_buf[pos]);
+        print_string("    ");
+        print_string(g_cmd_hash[i].path);
+        print_string(NEWLINE);
+    }
+    if (!any) {
+        print_string("hash: hash table empty\n");
+    }
+}
+
 /* ========================================================================
  * I/O Redirection parsing
  * ======================================================================== */
@@ -766,10 +990,12 @@ static void exec_external_with_args(const char *path, int arg_start, int input_l
     /* Null-terminate argv */
     argv[argc] = (char *)0;
     
-    long child_pid = syscall0(SYS_FORK);
+    /* The child only execs, so it can borrow our memory instead of
+     * copying it; we resume once it has exec'd or exited */
+    long child_pid = syscall0(SYS_VFORK);
     
     if (child_pid == 0) {
-        /* Child process */
+        /* Child process: touch nothing but envp before exec */
         const char *envp[] = { 0 };
         syscall3(SYS_EXECVE, (long)path, (long)argv, (long)envp);
         
@@ -1161,24 +1387,18 @@ static void handle_builtin_bg(int arg_start, int input_len) {
 }
 
 /**
- * Handle external command - fork and exec from /bin with arguments
+ * Handle external command - fork and exec the program $PATH names, with arguments
  */
 static void handle_external_command(const char *binary_name, int arg_start, int input_len) {
-    /* Build path: /bin/<binary_name> */
-    int path_idx = 0;
-    int prefix_idx = 0;
-    
-    while (BIN_PREFIX[prefix_idx]) {
-        g_path_buffer[path_idx++] = BIN_PREFIX[prefix_idx++];
-    }
-    
-    int name_idx = 0;
-    while (binary_name[name_idx] && path_idx < PATH_BUFFER_SIZE - 1) {
-        g_path_buffer[path_idx++] = binary_name[name_idx++];
+    const char *path = cmd_lookup(binary_name);
+    if (!path) {
+        print_string("ush: ");
+        print_string(binary_name);
+        print_string(": command not found\n");
+        return;
     }
-    g_path_buffer[path_idx] = '\0';
     
-    exec_external_with_args(g_path_buffer, arg_start, input_len);
+    exec_external_with_args(path, arg_start, input_len);
 }
 
 /**
@@ -1321,6 +1541,19 @@ static void execute_script_line(const char *line) {
     /* Expand environment variables */
     env_expand(g_input_buffer, g_expanded_buffer, EXPANDED_CMD_SIZE);
     
+    /* Pipelines run as in interactive use */
+    if (find_pipe_char(g_expanded_buffer) >= 0) {
+        char *stages[MAX_PIPELINE_STAGES];
+        int count = split_pipeline(g_expanded_buffer, stages);
+        if (count < 0) {
+            print_string("Error: Empty or too long pipeline\n");
+        } else {
+            execute_pipeline(stages, count);
+        }
+        g_input_pos = saved_pos;
+        return;
+    }
+    
     /* Parse for I/O redirections */
     char *input_file = (char *)0;
     char *output_file = (char *)0;
@@ -1391,6 +1624,8 @@ static void execute_script_line(const char *line) {
         handle_builtin_export(arg_start, expanded_len);
     } else if (command_matches(g_expanded_buffer, cmd_len, "unset")) {
         handle_builtin_unset(arg_start, expanded_len);
+    } else if (command_matches(g_expanded_buffer, cmd_len, "hash")) {
+        handle_builtin_hash(arg_start, expanded_len);
     } else if (command_matches(g_expanded_buffer, cmd_len, "ls")) {
         handle_external_command("ls", arg_start, expanded_len);
     } else if (command_matches(g_expanded_buffer, cmd_len, "pwd")) {
@@ -1442,58 +1677,113 @@ static int find_pipe_char(const char *cmd) {
 }
 
 /**
- * Execute a simple command (no pipes) - used by pipeline
- * Forks, execs, and waits
+ * Split a command at each '|' into trimmed stages
+ * Returns the number of stages, or -1 if one is empty or there are too many
  */
-static void exec_simple_command(const char *cmd) {
-    /* Skip leading whitespace */
-    while (*cmd == ' ' || *cmd == '\t') cmd++;
-    
-    if (*cmd == '\0') return;
+static int split_pipeline(char *cmd, char **stages) {
+    int count = 0;
+    char *p = cmd;
     
-    /* Parse command name */
-    char cmd_name[64];
+    while (1) {
+        /* Skip leading whitespace */
+        while (*p == ' ' || *p == '\t') p++;
+        if (count == MAX_PIPELINE_STAGES) {
+            return -1;
+        }
+        stages[count++] = p;
+        
+        /* Find the end of the stage and trim trailing whitespace */
+        char *end = p;
+        while (*end && *end != '|') end++;
+        char next = *end;
+        char *trim = end;
+        while (trim > p && (trim[-1] == ' ' || trim[-1] == '\t')) trim--;
+        *trim = '\0';
+        if (trim == p) {
+            return -1;
+        }
+        
+        if (next != '|') {
+            return count;
+        }
+        p = end + 1;
+    }
+}
+
+/**
+ * Program a pipeline stage runs: a path given as such, else found on $PATH
+ * Returns NULL (after saying so) if there is none
+ */
+static const char *stage_program(const char *cmd) {
+    /* Command name, up to the first space or redirection */
+    static char name[PATH_BUFFER_SIZE];
     int i = 0;
-    while (cmd[i] && cmd[i] != ' ' && cmd[i] != '\t' && i < 63) {
-        cmd_name[i] = cmd[i];
+    while (cmd[i] && cmd[i] != ' ' && cmd[i] != '\t' && cmd[i] != '<' && cmd[i] != '>' &&
+           i < PATH_BUFFER_SIZE - 1) {
+        name[i] = cmd[i];
         i++;
     }
-    cmd_name[i] = '\0';
+    name[i] = '\0';
     
-    /* Build path */
-    char path[PATH_BUFFER_SIZE];
-    path[0] = '/'; path[1] = 'b'; path[2] = 'i'; path[3] = 'n'; path[4] = '/';
-    int j = 5;
-    for (int k = 0; cmd_name[k] && j < PATH_BUFFER_SIZE - 1; k++) {
-        path[j++] = cmd_name[k];
+    if (name[0] == '/' || name[0] == '.') {
+        return name;
+    }
+    const char *path = cmd_lookup(name);
+    if (!path) {
+        print_string("ush: ");
+        print_string(name);
+        print_string(": command not found\n");
+    }
+    return path;
+}
+
+/**
+ * Execute one stage of a pipeline (in the forked child): apply its own
+ * redirections, then exec path with the stage's arguments
+ */
+static void exec_simple_command(char *cmd, const char *path) {
+    /* Redirections override the pipe ends */
+    char *input_file;
+    char *output_file;
+    int append;
+    parse_redirections(cmd, &input_file, &output_file, &append);
+    if (input_file && input_file[0]) {
+        long fd = syscall3(SYS_OPEN, (long)input_file, O_RDONLY, 0);
+        if (fd < 0) {
+            print_string("Error: Cannot open input file\n");
+            syscall1(SYS_EXIT, 1);
+        }
+        syscall2(SYS_DUP2, fd, STDIN_FD);
+        syscall1(SYS_CLOSE, fd);
+    }
+    if (output_file && output_file[0]) {
+        int flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+        long fd = syscall3(SYS_OPEN, (long)output_file, flags, FILE_MODE);
+        if (fd < 0) {
+            print_string(MSG_REDIR_ERROR);
+            syscall1(SYS_EXIT, 1);
+        }
+        syscall2(SYS_DUP2, fd, STDOUT_FD);
+        syscall1(SYS_CLOSE, fd);
     }
-    path[j] = '\0';
     
-    /* Skip to arguments */
-    while (cmd[i] == ' ' || cmd[i] == '\t') i++;
+    /* Skip the command name; argv[0] is the program path */
+    while (*cmd && *cmd != ' ' && *cmd != '\t') cmd++;
     
-    /* Build argv */
     const char *argv[MAX_ARGS];
     int argc = 0;
     argv[argc++] = path;
     
-    /* Parse remaining arguments */
-    static char arg_buf[256];
-    int arg_idx = 0;
-    const char *arg_start_ptr = &cmd[i];
-    
-    while (*arg_start_ptr && argc < MAX_ARGS - 1) {
-        while (*arg_start_ptr == ' ' || *arg_start_ptr == '\t') arg_start_ptr++;
-        if (!*arg_start_ptr) break;
+    /* Split the arguments in place (this is the child's copy) */
+    while (*cmd && argc < MAX_ARGS - 1) {
+        while (*cmd == ' ' || *cmd == '\t') cmd++;
+        if (!*cmd) break;
         
-        argv[argc++] = &arg_buf[arg_idx];
-        while (*arg_start_ptr && *arg_start_ptr != ' ' && *arg_start_ptr != '\t') {
-            if (arg_idx < 255) {
-                arg_buf[arg_idx++] = *arg_start_ptr;
-            }
-            arg_start_ptr++;
+        argv[argc++] = cmd;
+        while (*cmd && *cmd != ' ' && *cmd != '\t') cmd++;
+        if (*cmd) {
+            *cmd++ = '\0';
         }
-        arg_buf[arg_idx++] = '\0';
     }
     argv[argc] = (char *)0;
     
@@ -1503,59 +1793,87 @@ static void exec_simple_command(const char *cmd) {
     
     /* If we get here, exec failed */
     print_string("exec failed: ");
-    print_string(cmd_name);
+    print_string(path);
     print_string("\n");
     syscall1(SYS_EXIT, 1);
 }
 
 /**
- * Execute a pipeline: left_cmd | right_cmd
+ * Execute a pipeline: stages[0] | stages[1] | ... | stages[count - 1]
+ * 
+ * Every program is looked up before anything starts, then all pipes are
+ * made and every stage forked up front, so the stages run concurrently
+ * and a slow one only stalls its neighbours when a pipe fills or drains.
  */
-static void execute_pipeline(char *left_cmd, char *right_cmd) {
-    int pipefd[2];
-    
-    /* Create pipe */
-    if (syscall1(SYS_PIPE, (long)pipefd) < 0) {
-        print_string("Error: Cannot create pipe\n");
-        return;
+static void execute_pipeline(char **stages, int count) {
+    const char *paths[MAX_PIPELINE_STAGES];
+    char path_bufs[MAX_PIPELINE_STAGES][PATH_BUFFER_SIZE];
+    int pipes[MAX_PIPELINE_STAGES - 1][2];
+    long pids[MAX_PIPELINE_STAGES];
+    int npipes = 0;
+    int started = 0;
+    
+    /* Resolve every stage (copies: a later lookup may reuse a cache slot) */
+    for (int i = 0; i < count; i++) {
+        const char *path = stage_program(stages[i]);
+        if (!path) {
+            return;
+        }
+        copy_string(path_bufs[i], path, PATH_BUFFER_SIZE);
+        paths[i] = path_bufs[i];
     }
     
-    /* Fork for left command (writes to pipe) */
-    long left_pid = syscall0(SYS_FORK);
-    
-    if (left_pid == 0) {
-        /* Left child: stdout -> pipe write end */
-        syscall1(SYS_CLOSE, pipefd[0]);  /* Close read end */
-        syscall2(SYS_DUP2, pipefd[1], STDOUT_FD);
-        syscall1(SYS_CLOSE, pipefd[1]);
-        
-        exec_simple_command(left_cmd);
-        /* Never returns */
+    /* Create the pipes, pipes[i] joining stage i to stage i + 1 */
+    for (; npipes < count - 1; npipes++) {
+        if (syscall1(SYS_PIPE, (long)pipes[npipes]) < 0) {
+            print_string("Error: Cannot create pipe\n");
+            break;
+        }
     }
     
-    /* Fork for right command (reads from pipe) */
-    long right_pid = syscall0(SYS_FORK);
-    
-    if (right_pid == 0) {
-        /* Right child: stdin <- pipe read end */
-        syscall1(SYS_CLOSE, pipefd[1]);  /* Close write end */
-        syscall2(SYS_DUP2, pipefd[0], STDIN_FD);
-        syscall1(SYS_CLOSE, pipefd[0]);
-        
-        exec_simple_command(right_cmd);
-        /* Never returns */
+    /* Start every stage before waiting for any */
+    if (npipes == count - 1) {
+        for (; started < count; started++) {
+            long pid = syscall0(SYS_FORK);
+            if (pid < 0) {
+                print_string("Error: Cannot fork pipeline stage\n");
+                break;
+            }
+            if (pid == 0) {
+                /* Child: stdin from the previous pipe, stdout to the next */
+                if (started > 0) {
+                    syscall2(SYS_DUP2, pipes[started - 1][0], STDIN_FD);
+                }
+                if (started < count - 1) {
+                    syscall2(SYS_DUP2, pipes[started][1], STDOUT_FD);
+                }
+                for (int j = 0; j < npipes; j++) {
+                    syscall1(SYS_CLOSE, pipes[j][0]);
+                    syscall1(SYS_CLOSE, pipes[j][1]);
+                }
+                exec_simple_command(stages[started], paths[started]);
+                /* Never returns */
+            }
+            pids[started] = pid;
+        }
     }
     
-    /* Parent: close both ends, set foreground, and wait for children */
-    syscall1(SYS_CLOSE, pipefd[0]);
-    syscall1(SYS_CLOSE, pipefd[1]);
+    /* Parent: close every end, so each reader sees EOF once its writer exits */
+    for (int j = 0; j < npipes; j++) {
+        syscall1(SYS_CLOSE, pipes[j][0]);
+        syscall1(SYS_CLOSE, pipes[j][1]);
+    }
+    if (started == 0) {
+        return;
+    }
     
-    /* Set right_pid as foreground for Ctrl+C (typically the last in pipeline) */
-    syscall1(SYS_SETFGPID, right_pid);
+    /* The last stage is foreground for Ctrl+C */
+    syscall1(SYS_SETFGPID, pids[started - 1]);
     
     int status;
-    syscall3(SYS_WAIT, left_pid, (long)&status, 0);
-    syscall3(SYS_WAIT, right_pid, (long)&status, 0);
+    for (int i = 0; i < started; i++) {
+        syscall3(SYS_WAIT, pids[i], (long)&status, 0);
+    }
     
     /* Clear foreground process */
     syscall1(SYS_SETFGPID, -1);
@@ -1579,23 +1897,14 @@ static void process_command(void) {
     env_expand(g_input_buffer, g_expanded_buffer, EXPANDED_CMD_SIZE);
     
     /* Check for pipe */
-    int pipe_pos = find_pipe_char(g_expanded_buffer);
-    if (pipe_pos >= 0) {
-        /* Split command at pipe */
-        g_expanded_buffer[pipe_pos] = '\0';
-        char *left_cmd = g_expanded_buffer;
-        char *right_cmd = &g_expanded_buffer[pipe_pos + 1];
-        
-        /* Trim whitespace from left command */
-        int left_end = pipe_pos - 1;
-        while (left_end >= 0 && (left_cmd[left_end] == ' ' || left_cmd[left_end] == '\t')) {
-            left_cmd[left_end--] = '\0';
+    if (find_pipe_char(g_expanded_buffer) >= 0) {
+        char *stages[MAX_PIPELINE_STAGES];
+        int count = split_pipeline(g_expanded_buffer, stages);
+        if (count < 0) {
+            print_string("Error: Empty or too long pipeline\n");
+        } else {
+            execute_pipeline(stages, count);
         }
-        
-        /* Skip leading whitespace on right command */
-        while (*right_cmd == ' ' || *right_cmd == '\t') right_cmd++;
-        
-        execute_pipeline(left_cmd, right_cmd);
         return;
     }
     
@@ -1675,6 +1984,8 @@ static void process_command(void) {
         handle_builtin_env();
     } else if (command_matches(g_expanded_buffer, cmd_len, "history")) {
         handle_builtin_history();
+    } else if (command_matches(g_expanded_buffer, cmd_len, "hash")) {
+        handle_builtin_hash(arg_start, expanded_len);
     } else if (command_matches(g_expanded_buffer, cmd_len, "source")) {
         handle_builtin_source(arg_start, expanded_len);
     } else if (command_matches(g_expanded_buffer, cmd_len, "fg")) {
@@ -1697,6 +2008,8 @@ static void process_command(void) {
         handle_external_command("clock", arg_start, expanded_len);
     } else if (command_matches(g_expanded_buffer, cmd_len, "ps")) {
         handle_external_command("ps", arg_start, expanded_len);
+    } else if (command_matches(g_expanded_buffer, cmd_len, "irqstat")) {
+        handle_external_command("irqstat", arg_start, expanded_len);
     } else if (command_matches(g_expanded_buffer, cmd_len, "uname")) {
         handle_external_command("uname", arg_start, expanded_len);
     } else if (command_matches(g_expanded_buffer, cmd_len, "uptime")) {
@@ -1799,7 +2112,12 @@ static void handle_backspace(void) {
 static void handle_newline(void) {
     print_string(CRLF);
     g_browsing_history = 0;
+    
+    /* Commands read lines the kernel edits; the prompt edits its own */
+    tty_set_canonical(1);
     process_command();
+    tty_set_canonical(0);
+    
     g_input_pos = 0;
     print_string(SHELL_PROMPT);
 }
@@ -1958,6 +2276,34 @@ static void handle_tab(void) {
     /* If multiple matches and no common extension, could beep or show options */
 }
 
+/**
+ * Handle one character of input at the prompt
+ */
+static void handle_input_char(char input_char) {
+    /* Handle escape sequences */
+    if (g_escape_state != ESC_STATE_NORMAL) {
+        handle_escape_sequence(input_char);
+        return;
+    }
+    
+    /* Check for escape character */
+    if (input_char == CHAR_ESC) {
+        g_escape_state = ESC_STATE_GOT_ESC;
+        return;
+    }
+    
+    /* Handle special characters */
+    if (input_char == '\r' || input_char == '\n') {
+        handle_newline();
+    } else if (input_char == CHAR_TAB) {
+        handle_tab();
+    } else if (input_char == CHAR_BACKSPACE || input_char == CHAR_BACKSPACE_ALT) {
+        handle_backspace();
+    } else if (input_char >= 32 && input_char < 127) {
+        handle_printable_char(input_char);
+    }
+}
+
 /* ========================================================================
  * Main entry point
  * ======================================================================== */
@@ -1983,37 +2329,21 @@ void _start(void) {
     print_string(SHELL_BANNER);
     print_string(SHELL_PROMPT);
     
-    /* Main input loop */
+    /* The prompt edits its own line */
+    tty_set_canonical(0);
+    
+    /* Main input loop: everything typed or pasted so far per read */
     while (1) {
-        char input_char;
-        long bytes_read = syscall3(SYS_READ, STDIN_FD, (long)&input_char, 1);
+        char input[INPUT_READ_SIZE];
+        long bytes_read = syscall3(SYS_READ, STDIN_FD, (long)input, INPUT_READ_SIZE);
         
-        if (bytes_read != 1) {
+        if (bytes_read <= 0) {
             syscall0(SYS_YIELD);
             continue;
         }
         
-        /* Handle escape sequences */
-        if (g_escape_state != ESC_STATE_NORMAL) {
-            handle_escape_sequence(input_char);
-            continue;
-        }
-        
-        /* Check for escape character */
-        if (input_char == CHAR_ESC) {
-            g_escape_state = ESC_STATE_GOT_ESC;
-            continue;
-        }
-        
-        /* Handle special characters */
-        if (input_char == '\r' || input_char == '\n') {
-            handle_newline();
-        } else if (input_char == CHAR_TAB) {
-            handle_tab();
-        } else if (input_char == CHAR_BACKSPACE || input_char == CHAR_BACKSPACE_ALT) {
-            handle_backspace();
-        } else if (input_char >= 32 && input_char < 127) {
-            handle_printable_char(input_char);
+        for (long i = 0; i < bytes_read; i++) {
+            handle_input_char(input[i]);
         }
     }
 }
@@ -24,6 +24,7 @@ struct stat {
     uint16_t st_pad;
     uint32_t st_size;
     uint32_t st_type;
+    uint32_t st_size_high;
 };
 
 // System call wrapper
@@ -4,9 +4,9 @@
  * Supports -l for long format with permissions
  */
 
+#include "../lib/ustdio.h"
+
 // ThunderOS syscall numbers
-#define SYS_EXIT     0
-#define SYS_WRITE    1
 #define SYS_OPEN     13
 #define SYS_CLOSE    14
 #define SYS_STAT     16
@@ -16,10 +16,7 @@
 // Open flags
 #define O_RDONLY    0x0000
 
-typedef unsigned long size_t;
 typedef long ssize_t;
-typedef unsigned short uint16_t;
-typedef unsigned int uint32_t;
 
 // Stat structure (must match kernel vfs_stat_t)
 struct stat {
@@ -28,8 +25,9 @@ struct stat {
     uint16_t st_uid;      // Owner user ID
     uint16_t st_gid;      // Owner group ID
     uint16_t st_pad;      // Padding for alignment
-    uint32_t st_size;     // File size in bytes
+    uint32_t st_size;     // File size in bytes (low 32 bits)
     uint32_t st_type;     // VFS file type
+    uint32_t st_size_high; // File size in bytes (high 32 bits)
 };
 
 // Directory entry structure (must match kernel)
@@ -55,105 +53,30 @@ struct thunderos_dirent {
 #define S_IWOTH  0x0002  // Other write
 #define S_IXOTH  0x0001  // Other execute
 
-// System call wrapper
-static inline long syscall(long n, long a0, long a1, long a2) {
-    register long syscall_num asm("a7") = n;
-    register long arg0 asm("a0") = a0;
-    register long arg1 asm("a1") = a1;
-    register long arg2 asm("a2") = a2;
-    
-    asm volatile("ecall"
-                 : "+r"(arg0)
-                 : "r"(syscall_num), "r"(arg1), "r"(arg2)
-                 : "memory");
-    
-    return arg0;
-}
-
-// Helper functions
-static size_t strlen(const char *s) {
-    size_t len = 0;
-    while (s[len]) len++;
-    return len;
-}
-
-static void print(const char *s) {
-    syscall(SYS_WRITE, 1, (long)s, strlen(s));
-}
-
-static void print_char(char c) {
-    syscall(SYS_WRITE, 1, (long)&c, 1);
-}
-
-// Print a number
-static void print_num(unsigned int n) {
-    char buf[16];
-    int i = 0;
-    
-    if (n == 0) {
-        print("0");
-        return;
-    }
-    
-    while (n > 0) {
-        buf[i++] = '0' + (n % 10);
-        n /= 10;
-    }
-    
-    // Print in reverse
-    while (i > 0) {
-        print_char(buf[--i]);
-    }
-}
-
-// Print number with padding
-static void print_num_padded(unsigned int n, int width) {
-    char buf[16];
-    int i = 0;
-    int len;
-    
-    if (n == 0) {
-        len = 1;
-    } else {
-        unsigned int tmp = n;
-        len = 0;
-        while (tmp > 0) {
-            len++;
-            tmp /= 10;
-        }
-    }
-    
-    // Print leading spaces
-    for (i = len; i < width; i++) {
-        print_char(' ');
-    }
-    
-    print_num(n);
-}
-
 // Print permission string like "rwxr-xr-x"
 static void print_permissions(uint16_t mode, uint32_t type) {
+    char perms[11];
+    
     // File type character
-    if (type == VFS_TYPE_DIRECTORY) {
-        print_char('d');
-    } else {
-        print_char('-');
-    }
+    perms[0] = (type == VFS_TYPE_DIRECTORY) ? 'd' : '-';
     
     // Owner permissions
-    print_char((mode & S_IRUSR) ? 'r' : '-');
-    print_char((mode & S_IWUSR) ? 'w' : '-');
-    print_char((mode & S_IXUSR) ? 'x' : '-');
+    perms[1] = (mode & S_IRUSR) ? 'r' : '-';
+    perms[2] = (mode & S_IWUSR) ? 'w' : '-';
+    perms[3] = (mode & S_IXUSR) ? 'x' : '-';
     
     // Group permissions
-    print_char((mode & S_IRGRP) ? 'r' : '-');
-    print_char((mode & S_IWGRP) ? 'w' : '-');
-    print_char((mode & S_IXGRP) ? 'x' : '-');
+    perms[4] = (mode & S_IRGRP) ? 'r' : '-';
+    perms[5] = (mode & S_IWGRP) ? 'w' : '-';
+    perms[6] = (mode & S_IXGRP) ? 'x' : '-';
     
     // Other permissions
-    print_char((mode & S_IROTH) ? 'r' : '-');
-    print_char((mode & S_IWOTH) ? 'w' : '-');
-    print_char((mode & S_IXOTH) ? 'x' : '-');
+    perms[7] = (mode & S_IROTH) ? 'r' : '-';
+    perms[8] = (mode & S_IWOTH) ? 'w' : '-';
+    perms[9] = (mode & S_IXOTH) ? 'x' : '-';
+    perms[10] = '\0';
+    
+    fputs(perms, stdout);
 }
 
 // Simple string concatenation for paths
@@ -184,23 +107,21 @@ void _start(void) {
     int long_format = 1;
     
     // Get current working directory
-    char *cwd = (char *)syscall(SYS_GETCWD, (long)cwd_buf, sizeof(cwd_buf), 0);
+    char *cwd = (char *)syscall2(SYS_GETCWD, (long)cwd_buf, sizeof(cwd_buf));
     const char *path = (cwd != 0) ? cwd : "/";
     
     // Open the directory
-    int fd = (int)syscall(SYS_OPEN, (long)path, O_RDONLY, 0);
+    int fd = (int)syscall3(SYS_OPEN, (long)path, O_RDONLY, 0);
     if (fd < 0) {
-        print("ls: cannot access '");
-        print(path);
-        print("': No such file or directory\n");
-        syscall(SYS_EXIT, 1, 0, 0);
+        fprintf(stderr, "ls: cannot access '%s': No such file or directory\n", path);
+        exit(1);
     }
     
     // Read directory entries
     ssize_t nread;
     int first = 1;
     
-    while ((nread = syscall(SYS_GETDENTS, fd, (long)dirent_buf, sizeof(dirent_buf))) > 0) {
+    while ((nread = syscall3(SYS_GETDENTS, fd, (long)dirent_buf, sizeof(dirent_buf))) > 0) {
         // Process each entry
         char *ptr = dirent_buf;
         char *end = dirent_buf + nread;
@@ -221,34 +142,21 @@ void _start(void) {
                 strcat_path(path_buf, path, entry->d_name);
                 
                 // Get file status
-                if (syscall(SYS_STAT, (long)path_buf, (long)&statbuf, 0) == 0) {
-                    // Print permissions
+                if (syscall2(SYS_STAT, (long)path_buf, (long)&statbuf) == 0) {
+                    // Permissions, uid:gid and size (right-aligned, 8 chars)
                     print_permissions(statbuf.st_mode, statbuf.st_type);
-                    print(" ");
-                    
-                    // Print uid:gid
-                    print_num(statbuf.st_uid);
-                    print(":");
-                    print_num(statbuf.st_gid);
-                    print(" ");
-                    
-                    // Print size (right-aligned, 8 chars)
-                    print_num_padded(statbuf.st_size, 8);
-                    print(" ");
+                    printf(" %u:%u %8lu ", statbuf.st_uid, statbuf.st_gid,
+                           ((unsigned long)statbuf.st_size_high << 32) | statbuf.st_size);
                 } else {
                     // Couldn't stat, print placeholder
-                    print("----------    ?:?        ? ");
+                    fputs("----------    ?:?        ? ", stdout);
                 }
                 
                 // Print name
-                print(entry->d_name);
-                print("\n");
+                puts(entry->d_name);
             } else {
-                if (!first) {
-                    print("  ");
-                }
+                printf(first ? "%s" : "  %s", entry->d_name);
                 first = 0;
-                print(entry->d_name);
             }
             
             ptr += entry->d_reclen;
@@ -256,9 +164,9 @@ void _start(void) {
     }
     
     if (!long_format && !first) {
-        print("\n");
+        putchar('\n');
     }
     
-    syscall(SYS_CLOSE, fd, 0, 0);
-    syscall(SYS_EXIT, 0, 0, 0);
+    syscall1(SYS_CLOSE, fd);
+    exit(0);
 }
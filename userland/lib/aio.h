@@ -0,0 +1,85 @@
+/**
+ * aio.h - Asynchronous file reads and writes
+ *
+ * Header-only: include it from any program. uaio_setup() returns a
+ * context descriptor; uaio_prep() fills in requests and uaio_submit()
+ * queues a whole array of them in one trap. Completions are read from
+ * the context with uaio_getevents(), in the order the requests finished,
+ * and poll() reports the descriptor readable while one is waiting.
+ *
+ * A read's buffer is filled when its completion is read back, so it must
+ * stay mapped until then. A write's data is copied at submission.
+ *
+ * The layouts must match include/kernel/aio.h.
+ */
+
+#ifndef USERLAND_AIO_H
+#define USERLAND_AIO_H
+
+#include <stdint.h>
+
+#define SYS_READ        2
+#define SYS_AIO_SETUP   129
+#define SYS_AIO_SUBMIT  130
+
+#define UAIO_OP_READ        0
+#define UAIO_OP_WRITE       1
+
+#define UAIO_MAX_IO         (64 * 1024)
+#define UAIO_MAX_REQUESTS   64
+
+typedef struct {
+    uint64_t user_data;             /* Returned in the completion */
+    uint32_t opcode;                /* UAIO_OP_READ or UAIO_OP_WRITE */
+    int32_t fd;
+    uint64_t buf;
+    uint64_t offset;
+    uint32_t len;                   /* At most UAIO_MAX_IO */
+    uint32_t flags;                 /* Must be 0 */
+} uaio_iocb_t;
+
+typedef struct {
+    uint64_t user_data;
+    int64_t result;                 /* Bytes transferred, or -1 */
+    int32_t error;                  /* errno when result is -1 */
+    uint32_t reserved;
+} uaio_event_t;
+
+static inline long uaio_syscall3(long n, long arg0, long arg1, long arg2) {
+    register long a0 asm("a0") = arg0;
+    register long a1 asm("a1") = arg1;
+    register long a2 asm("a2") = arg2;
+    register long a7 asm("a7") = n;
+    asm volatile("ecall" : "+r"(a0) : "r"(a1), "r"(a2), "r"(a7) : "memory");
+    return a0;
+}
+
+/* Returns the context descriptor, or -1; flags is 0 or O_NONBLOCK */
+static inline int uaio_setup(int flags) {
+    return (int)uaio_syscall3(SYS_AIO_SETUP, flags, 0, 0);
+}
+
+static inline void uaio_prep(uaio_iocb_t *iocb, uint64_t user_data, uint32_t opcode, int fd,
+                             void *buf, uint32_t len, uint64_t offset) {
+    iocb->user_data = user_data;
+    iocb->opcode = opcode;
+    iocb->fd = fd;
+    iocb->buf = (uint64_t)buf;
+    iocb->offset = offset;
+    iocb->len = len;
+    iocb->flags = 0;
+}
+
+/* Returns the number of requests queued, or -1 if the first was refused */
+static inline long uaio_submit(int ctx, uaio_iocb_t *iocbs, uint32_t nr) {
+    return uaio_syscall3(SYS_AIO_SUBMIT, ctx, (long)iocbs, nr);
+}
+
+/* Returns the number of completions stored (waiting for one unless the
+ * context is non-blocking), or -1 */
+static inline long uaio_getevents(int ctx, uaio_event_t *events, uint32_t max) {
+    long n = uaio_syscall3(SYS_READ, ctx, (long)events, max * sizeof(uaio_event_t));
+    return n < 0 ? n : n / (long)sizeof(uaio_event_t);
+}
+
+#endif /* USERLAND_AIO_H */
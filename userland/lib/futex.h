@@ -0,0 +1,153 @@
+/**
+ * futex.h - User-space mutexes and condition variables on SYS_FUTEX
+ *
+ * Header-only: include it from any program. Locking and unlocking an
+ * uncontended umutex_t is one atomic instruction each, and signalling a
+ * ucond_t nobody waits on is none; the kernel is only entered to sleep on
+ * or wake a contended word.
+ *
+ * The words are process-private unless they live in a MAP_SHARED mapping,
+ * which is how processes sharing them across fork() must allocate them.
+ *
+ * umutex_t follows the three-state design from Drepper's "Futexes Are
+ * Tricky": 0 = unlocked, 1 = locked, 2 = locked and maybe contended, so
+ * unlock only calls FUTEX_WAKE when someone may be asleep.
+ */
+
+#ifndef USERLAND_FUTEX_H
+#define USERLAND_FUTEX_H
+
+#include <stdint.h>
+
+#define SYS_FUTEX       63
+
+#define FUTEX_WAIT      0
+#define FUTEX_WAKE      1
+#define FUTEX_REQUEUE   3
+
+#define UMUTEX_UNLOCKED     0
+#define UMUTEX_LOCKED       1
+#define UMUTEX_CONTENDED    2
+
+typedef struct {
+    volatile uint32_t state;
+} umutex_t;
+
+typedef struct {
+    volatile uint32_t seq;          /* Bumped by every signal/broadcast */
+    volatile uint32_t waiters;      /* Processes in ucond_wait() */
+    umutex_t *mutex;                /* Mutex the waiters use, for broadcast */
+} ucond_t;
+
+#define UMUTEX_INIT { .state = UMUTEX_UNLOCKED }
+#define UCOND_INIT  { .seq = 0, .waiters = 0, .mutex = 0 }
+
+/* long futex(uaddr, op, val, val2, uaddr2) */
+static inline long futex(volatile uint32_t *uaddr, int op, uint32_t val,
+                         uint32_t val2, volatile uint32_t *uaddr2) {
+    register long a0 asm("a0") = (long)uaddr;
+    register long a1 asm("a1") = op;
+    register long a2 asm("a2") = val;
+    register long a3 asm("a3") = val2;
+    register long a4 asm("a4") = (long)uaddr2;
+    register long a7 asm("a7") = SYS_FUTEX;
+    asm volatile("ecall"
+                 : "+r"(a0)
+                 : "r"(a1), "r"(a2), "r"(a3), "r"(a4), "r"(a7)
+                 : "memory");
+    return a0;
+}
+
+static inline uint32_t futex_cmpxchg(volatile uint32_t *word, uint32_t expected, uint32_t desired) {
+    __atomic_compare_exchange_n(word, &expected, desired, 0,
+                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    return expected;
+}
+
+/* ========================================================================
+ * Mutex
+ * ======================================================================== */
+
+static inline void umutex_init(umutex_t *m) {
+    m->state = UMUTEX_UNLOCKED;
+}
+
+/* Returns 0 if acquired, -1 if the mutex was held */
+static inline int umutex_trylock(umutex_t *m) {
+    return futex_cmpxchg(&m->state, UMUTEX_UNLOCKED, UMUTEX_LOCKED) == UMUTEX_UNLOCKED ? 0 : -1;
+}
+
+static inline void umutex_lock(umutex_t *m) {
+    uint32_t c = futex_cmpxchg(&m->state, UMUTEX_UNLOCKED, UMUTEX_LOCKED);
+    if (c == UMUTEX_UNLOCKED) {
+        return;
+    }
+
+    /* Contended: mark it so, then sleep until we take it from unlocked */
+    if (c != UMUTEX_CONTENDED) {
+        c = __atomic_exchange_n(&m->state, UMUTEX_CONTENDED, __ATOMIC_ACQUIRE);
+    }
+    while (c != UMUTEX_UNLOCKED) {
+        futex(&m->state, FUTEX_WAIT, UMUTEX_CONTENDED, 0, 0);
+        c = __atomic_exchange_n(&m->state, UMUTEX_CONTENDED, __ATOMIC_ACQUIRE);
+    }
+}
+
+static inline void umutex_unlock(umutex_t *m) {
+    if (__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != UMUTEX_LOCKED) {
+        /* Was contended: a sleeper may be waiting for this */
+        __atomic_store_n(&m->state, UMUTEX_UNLOCKED, __ATOMIC_RELEASE);
+        futex(&m->state, FUTEX_WAKE, 1, 0, 0);
+    }
+}
+
+/* ========================================================================
+ * Condition variable
+ * ======================================================================== */
+
+static inline void ucond_init(ucond_t *cv) {
+    cv->seq = 0;
+    cv->waiters = 0;
+    cv->mutex = 0;
+}
+
+/* Caller holds m; holds it again on return. Re-check the condition. */
+static inline void ucond_wait(ucond_t *cv, umutex_t *m) {
+    uint32_t seq = cv->seq;
+
+    cv->mutex = m;
+    __atomic_fetch_add(&cv->waiters, 1, __ATOMIC_RELAXED);
+    umutex_unlock(m);
+
+    /* Returns at once if a signal already bumped seq */
+    futex(&cv->seq, FUTEX_WAIT, seq, 0, 0);
+
+    /* Others may have been requeued onto m: take it as contended */
+    while (__atomic_exchange_n(&m->state, UMUTEX_CONTENDED, __ATOMIC_ACQUIRE) != UMUTEX_UNLOCKED) {
+        futex(&m->state, FUTEX_WAIT, UMUTEX_CONTENDED, 0, 0);
+    }
+    __atomic_fetch_sub(&cv->waiters, 1, __ATOMIC_RELAXED);
+}
+
+static inline void ucond_signal(ucond_t *cv) {
+    __atomic_fetch_add(&cv->seq, 1, __ATOMIC_RELEASE);
+    if (cv->waiters) {
+        futex(&cv->seq, FUTEX_WAKE, 1, 0, 0);
+    }
+}
+
+static inline void ucond_broadcast(ucond_t *cv) {
+    __atomic_fetch_add(&cv->seq, 1, __ATOMIC_RELEASE);
+    if (!cv->waiters) {
+        return;
+    }
+
+    /* Wake one; the rest would only block on the mutex, so move them there */
+    if (cv->mutex) {
+        futex(&cv->seq, FUTEX_REQUEUE, 1, 0x7fffffff, &cv->mutex->state);
+    } else {
+        futex(&cv->seq, FUTEX_WAKE, 0x7fffffff, 0, 0);
+    }
+}
+
+#endif /* USERLAND_FUTEX_H */
@@ -0,0 +1,122 @@
+/**
+ * ring.h - Batched syscalls through a submission ring
+ *
+ * Header-only: include it from any program. Queue syscalls with
+ * uring_get_sqe() and uring_prep(), run the whole batch with one
+ * uring_submit() trap, then collect results with uring_peek_cqe() and
+ * uring_cqe_seen(). Completions come back in submission order.
+ *
+ * The ring lives in the caller's memory: pass uring_init() a buffer of
+ * at least URING_BYTES(entries) bytes, 8-byte aligned, that stays mapped
+ * as long as the ring is used.
+ *
+ * The layout must match include/kernel/ring.h.
+ */
+
+#ifndef USERLAND_RING_H
+#define USERLAND_RING_H
+
+#include <stdint.h>
+
+#define SYS_RING_SETUP  64
+#define SYS_RING_ENTER  65
+
+#define URING_MAX_ENTRIES   256
+
+typedef struct {
+    volatile uint32_t sq_head;      /* Advanced by the kernel */
+    volatile uint32_t sq_tail;      /* Advanced by us */
+    volatile uint32_t cq_head;      /* Advanced by us */
+    volatile uint32_t cq_tail;      /* Advanced by the kernel */
+    uint32_t entries;
+    uint32_t reserved;
+} uring_header_t;
+
+typedef struct {
+    uint64_t user_data;             /* Returned in the completion */
+    uint32_t opcode;                /* Syscall number */
+    uint32_t flags;                 /* Must be 0 */
+    uint64_t args[6];
+} uring_sqe_t;
+
+typedef struct {
+    uint64_t user_data;
+    int64_t result;                 /* Syscall return value */
+    int32_t error;                  /* errno when result is -1 */
+    uint32_t reserved;
+} uring_cqe_t;
+
+typedef struct {
+    uring_header_t *hdr;
+    uring_sqe_t *sq;
+    uring_cqe_t *cq;
+    uint32_t mask;
+} uring_t;
+
+#define URING_BYTES(entries) \
+    (sizeof(uring_header_t) + (entries) * (sizeof(uring_sqe_t) + sizeof(uring_cqe_t)))
+
+static inline long uring_syscall2(long n, long arg0, long arg1) {
+    register long a0 asm("a0") = arg0;
+    register long a1 asm("a1") = arg1;
+    register long a7 asm("a7") = n;
+    asm volatile("ecall" : "+r"(a0) : "r"(a1), "r"(a7) : "memory");
+    return a0;
+}
+
+/* Returns 0, or -1 if the kernel rejected the buffer or entry count */
+static inline int uring_init(uring_t *r, void *mem, uint32_t entries) {
+    if (uring_syscall2(SYS_RING_SETUP, (long)mem, entries) < 0) {
+        return -1;
+    }
+    r->hdr = (uring_header_t *)mem;
+    r->sq = (uring_sqe_t *)(r->hdr + 1);
+    r->cq = (uring_cqe_t *)(r->sq + entries);
+    r->mask = entries - 1;
+    return 0;
+}
+
+/* Next free submission slot, or 0 if the queue is full */
+static inline uring_sqe_t *uring_get_sqe(uring_t *r) {
+    uint32_t tail = r->hdr->sq_tail;
+    if (tail - __atomic_load_n(&r->hdr->sq_head, __ATOMIC_ACQUIRE) > r->mask) {
+        return 0;
+    }
+    return &r->sq[tail & r->mask];
+}
+
+/* Fill in the slot from uring_get_sqe() and queue it */
+static inline void uring_prep(uring_t *r, uring_sqe_t *sqe, uint64_t user_data, uint32_t opcode,
+                              uint64_t a0, uint64_t a1, uint64_t a2) {
+    sqe->user_data = user_data;
+    sqe->opcode = opcode;
+    sqe->flags = 0;
+    sqe->args[0] = a0;
+    sqe->args[1] = a1;
+    sqe->args[2] = a2;
+    sqe->args[3] = 0;
+    sqe->args[4] = 0;
+    sqe->args[5] = 0;
+    __atomic_store_n(&r->hdr->sq_tail, r->hdr->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Run everything queued; returns the number of entries the kernel ran */
+static inline long uring_submit(uring_t *r) {
+    return uring_syscall2(SYS_RING_ENTER, r->hdr->sq_tail - r->hdr->sq_head, 0);
+}
+
+/* Oldest unread completion, or 0 if there is none */
+static inline uring_cqe_t *uring_peek_cqe(uring_t *r) {
+    uint32_t head = r->hdr->cq_head;
+    if (head == __atomic_load_n(&r->hdr->cq_tail, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    return &r->cq[head & r->mask];
+}
+
+/* Done with the completion from uring_peek_cqe(): free its slot */
+static inline void uring_cqe_seen(uring_t *r) {
+    __atomic_store_n(&r->hdr->cq_head, r->hdr->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* USERLAND_RING_H */
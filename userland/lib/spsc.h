@@ -0,0 +1,220 @@
+/**
+ * spsc.h - Single-producer/single-consumer message queue in shared memory
+ *
+ * Header-only: include it from any program. The queue is a ring of
+ * fixed-size slots placed in memory both processes map MAP_SHARED (a
+ * shm_open() object, or an inherited shared mapping). Sending and
+ * receiving are plain loads and stores plus one release/acquire pair;
+ * the kernel is only entered through SYS_FUTEX when one side has to
+ * sleep, on the empty -> non-empty and full -> non-full transitions, and
+ * only if the other side is actually asleep.
+ *
+ * head and tail are free-running 32-bit counters, each written by one
+ * side only: tail by the producer, head by the consumer. A side about to
+ * sleep raises its waiting flag, then looks at the other counter again
+ * before FUTEX_WAIT on it; the other side publishes its counter, then
+ * looks at the flag. With a full fence between the two steps on both
+ * sides, at least one of them sees the other, so no wakeup is lost.
+ *
+ * Exactly one process may send and one may receive.
+ */
+
+#ifndef USERLAND_SPSC_H
+#define USERLAND_SPSC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "futex.h"
+
+#define SPSC_MAGIC      0x53505343u     /* "SPSC" */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t slots;                 /* Power of two */
+    uint32_t slot_size;             /* Payload bytes per slot */
+    uint32_t reserved;
+    /* Written by the producer, own 64 bytes so the sides don't share a line */
+    volatile uint32_t tail;
+    volatile uint32_t producer_waiting;
+    uint32_t pad0[14];
+    /* Written by the consumer */
+    volatile uint32_t head;
+    volatile uint32_t consumer_waiting;
+    uint32_t pad1[14];
+} spsc_header_t;
+
+typedef struct {
+    uint32_t len;                   /* Bytes of payload in use */
+    uint32_t reserved;
+    /* Payload follows */
+} spsc_slot_t;
+
+typedef struct {
+    spsc_header_t *hdr;
+    uint8_t *slots;
+    uint32_t mask;
+    uint32_t stride;                /* Bytes per slot including spsc_slot_t */
+} spsc_t;
+
+/* Slot stride: header plus payload, kept 8-byte aligned */
+#define SPSC_STRIDE(slot_size) \
+    ((sizeof(spsc_slot_t) + (slot_size) + 7) & ~(size_t)7)
+
+/* Memory needed for a queue */
+#define SPSC_BYTES(slots, slot_size) \
+    (sizeof(spsc_header_t) + (size_t)(slots) * SPSC_STRIDE(slot_size))
+
+static inline void spsc_copy(void *dst, const void *src, uint32_t len) {
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+    while (len--) {
+        *d++ = *s++;
+    }
+}
+
+static inline spsc_slot_t *spsc_slot(spsc_t *q, uint32_t index) {
+    return (spsc_slot_t *)(q->slots + (size_t)(index & q->mask) * q->stride);
+}
+
+static inline void spsc_bind(spsc_t *q, void *mem) {
+    q->hdr = (spsc_header_t *)mem;
+    q->slots = (uint8_t *)(q->hdr + 1);
+    q->mask = q->hdr->slots - 1;
+    q->stride = (uint32_t)SPSC_STRIDE(q->hdr->slot_size);
+}
+
+/*
+ * Lay out a new queue in mem (SPSC_BYTES(slots, slot_size) bytes,
+ * 8-byte aligned). Done once, by either side, before the other attaches.
+ * Returns 0, or -1 if slots is not a power of two.
+ */
+static inline int spsc_init(spsc_t *q, void *mem, uint32_t slots, uint32_t slot_size) {
+    if (slots == 0 || (slots & (slots - 1)) != 0 || slot_size == 0) {
+        return -1;
+    }
+    spsc_header_t *hdr = (spsc_header_t *)mem;
+    hdr->slots = slots;
+    hdr->slot_size = slot_size;
+    hdr->reserved = 0;
+    hdr->tail = 0;
+    hdr->producer_waiting = 0;
+    hdr->head = 0;
+    hdr->consumer_waiting = 0;
+    __atomic_store_n(&hdr->magic, SPSC_MAGIC, __ATOMIC_RELEASE);
+    spsc_bind(q, mem);
+    return 0;
+}
+
+/* Use a queue another process laid out. Returns 0, or -1 if there is none. */
+static inline int spsc_attach(spsc_t *q, void *mem) {
+    spsc_header_t *hdr = (spsc_header_t *)mem;
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SPSC_MAGIC) {
+        return -1;
+    }
+    spsc_bind(q, mem);
+    return 0;
+}
+
+/* ========================================================================
+ * Producer
+ * ======================================================================== */
+
+/* Queue one message without blocking. Returns 0, or -1 if full or too long. */
+static inline int spsc_try_send(spsc_t *q, const void *msg, uint32_t len) {
+    spsc_header_t *hdr = q->hdr;
+    uint32_t tail = hdr->tail;
+
+    if (len > hdr->slot_size ||
+        tail - __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE) > q->mask) {
+        return -1;
+    }
+
+    spsc_slot_t *slot = spsc_slot(q, tail);
+    slot->len = len;
+    spsc_copy(slot + 1, msg, len);
+    __atomic_store_n(&hdr->tail, tail + 1, __ATOMIC_RELEASE);
+
+    /* Pairs with the fence in spsc_recv() */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (hdr->consumer_waiting) {
+        futex(&hdr->tail, FUTEX_WAKE, 1, 0, 0);
+    }
+    return 0;
+}
+
+/* Queue one message, sleeping while the queue is full. Returns 0, or -1 if too long. */
+static inline int spsc_send(spsc_t *q, const void *msg, uint32_t len) {
+    spsc_header_t *hdr = q->hdr;
+
+    if (len > hdr->slot_size) {
+        return -1;
+    }
+    while (spsc_try_send(q, msg, len) != 0) {
+        uint32_t head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+
+        hdr->producer_waiting = 1;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        /* Still full after announcing ourselves: sleep until head moves */
+        if (hdr->tail - hdr->head > q->mask) {
+            futex(&hdr->head, FUTEX_WAIT, head, 0, 0);
+        }
+        hdr->producer_waiting = 0;
+    }
+    return 0;
+}
+
+/* ========================================================================
+ * Consumer
+ * ======================================================================== */
+
+/*
+ * Take one message without blocking into buf (at least slot_size bytes).
+ * Returns its length, or -1 if the queue is empty.
+ */
+static inline long spsc_try_recv(spsc_t *q, void *buf) {
+    spsc_header_t *hdr = q->hdr;
+    uint32_t head = hdr->head;
+
+    if (head == __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+
+    spsc_slot_t *slot = spsc_slot(q, head);
+    uint32_t len = slot->len;
+    spsc_copy(buf, slot + 1, len);
+    __atomic_store_n(&hdr->head, head + 1, __ATOMIC_RELEASE);
+
+    /* Pairs with the fence in spsc_send() */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (hdr->producer_waiting) {
+        futex(&hdr->head, FUTEX_WAKE, 1, 0, 0);
+    }
+    return len;
+}
+
+/* Take one message, sleeping while the queue is empty. Returns its length. */
+static inline long spsc_recv(spsc_t *q, void *buf) {
+    spsc_header_t *hdr = q->hdr;
+    long len;
+
+    while ((len = spsc_try_recv(q, buf)) < 0) {
+        uint32_t tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+
+        hdr->consumer_waiting = 1;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        /* Still empty after announcing ourselves: sleep until tail moves */
+        if (hdr->head == hdr->tail) {
+            futex(&hdr->tail, FUTEX_WAIT, tail, 0, 0);
+        }
+        hdr->consumer_waiting = 0;
+    }
+    return len;
+}
+
+/* Messages queued right now (a snapshot) */
+static inline uint32_t spsc_count(spsc_t *q) {
+    return __atomic_load_n(&q->hdr->tail, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&q->hdr->head, __ATOMIC_ACQUIRE);
+}
+
+#endif /* USERLAND_SPSC_H */
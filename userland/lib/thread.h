@@ -0,0 +1,114 @@
+/**
+ * thread.h - Threads on SYS_CLONE
+ *
+ * Header-only, like futex.h. A thread shares the address space, file
+ * descriptors and signal handlers of the process that creates it and
+ * runs on a stack the caller provides. Its tp register points at its
+ * thread_t (0 in the first thread), and thread_join() sleeps on the
+ * thread_t's alive word, which the kernel zeroes and wakes as a futex
+ * when the thread exits (CLONE_CHILD_CLEARTID).
+ *
+ * Use exit_group() rather than exit() to end the whole process: exit()
+ * only ends the calling thread.
+ */
+
+#ifndef USERLAND_THREAD_H
+#define USERLAND_THREAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "futex.h"
+
+#define SYS_CLONE           119
+#define SYS_GETTID          120
+#define SYS_EXIT_GROUP      121
+
+#define CLONE_VM                0x00000100
+#define CLONE_FILES             0x00000400
+#define CLONE_SIGHAND           0x00000800
+#define CLONE_THREAD            0x00010000
+#define CLONE_SETTLS            0x00080000
+#define CLONE_CHILD_CLEARTID    0x00200000
+
+#define CLONE_THREAD_FLAGS  (CLONE_VM | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD)
+
+typedef int (*thread_fn_t)(void *arg);
+
+typedef struct {
+    volatile uint32_t alive;        /* Nonzero until the thread exits */
+    long tid;
+} thread_t;
+
+/*
+ * long clone(flags, stack, tls, ctid), running fn(arg) in the new thread
+ *
+ * The thread starts on a copy of our registers, so fn and arg ride along
+ * in t0 and t1; its return value is its exit status.
+ */
+static inline long clone_thread(uint64_t flags, void *stack_top, void *tls,
+                                volatile uint32_t *ctid, thread_fn_t fn, void *arg) {
+    register long a0 asm("a0") = (long)flags;
+    register long a1 asm("a1") = (long)stack_top;
+    register long a2 asm("a2") = (long)tls;
+    register long a3 asm("a3") = (long)ctid;
+    register long a7 asm("a7") = SYS_CLONE;
+    register long t0 asm("t0") = (long)fn;
+    register long t1 asm("t1") = (long)arg;
+    asm volatile("ecall\n"
+                 "bnez a0, 1f\n"
+                 "mv a0, t1\n"
+                 "jalr t0\n"
+                 "li a7, 0\n"           /* SYS_EXIT with fn's return value */
+                 "ecall\n"
+                 "1:\n"
+                 : "+r"(a0)
+                 : "r"(a1), "r"(a2), "r"(a3), "r"(a7), "r"(t0), "r"(t1)
+                 : "ra", "memory");
+    return a0;
+}
+
+/* Start fn(arg) on stack[0, size); returns the thread ID, or -1 */
+static inline long thread_create(thread_t *t, thread_fn_t fn, void *arg,
+                                 void *stack, size_t size) {
+    void *top = (void *)(((uintptr_t)stack + size) & ~(uintptr_t)15);
+
+    t->alive = 1;
+    t->tid = clone_thread(CLONE_THREAD_FLAGS | CLONE_SETTLS | CLONE_CHILD_CLEARTID,
+                          top, t, &t->alive, fn, arg);
+    if (t->tid < 0) {
+        t->alive = 0;
+    }
+    return t->tid;
+}
+
+/* Wait for a thread to exit */
+static inline void thread_join(thread_t *t) {
+    uint32_t alive;
+    while ((alive = __atomic_load_n(&t->alive, __ATOMIC_ACQUIRE)) != 0) {
+        futex(&t->alive, FUTEX_WAIT, alive, 0, 0);
+    }
+}
+
+/* The calling thread's thread_t, or 0 in the first thread */
+static inline thread_t *thread_self(void) {
+    thread_t *t;
+    asm volatile("mv %0, tp" : "=r"(t));
+    return t;
+}
+
+static inline long gettid(void) {
+    register long a0 asm("a0");
+    register long a7 asm("a7") = SYS_GETTID;
+    asm volatile("ecall" : "=r"(a0) : "r"(a7) : "memory");
+    return a0;
+}
+
+static inline void exit_group(int status) {
+    register long a0 asm("a0") = status;
+    register long a7 asm("a7") = SYS_EXIT_GROUP;
+    asm volatile("ecall" : "+r"(a0) : "r"(a7) : "memory");
+    for (;;) {
+    }
+}
+
+#endif /* USERLAND_THREAD_H */
@@ -0,0 +1,441 @@
+/**
+ * umalloc.h - malloc() and free() for userland programs
+ *
+ * Header-only, like futex.h. Memory comes from the kernel in two ways:
+ *
+ *   Spans       Requests up to UMALLOC_SMALL_MAX bytes are rounded up to
+ *               one of 32 size classes (16-byte steps to 128, then four
+ *               per doubling) and carved from 64KB spans of the heap,
+ *               each span holding one class. sbrk() grows the heap
+ *               UMALLOC_SBRK_SPANS spans at a time, and a span hands out
+ *               blocks from a bump pointer before its free list, so its
+ *               pages are touched only as they are used.
+ *   Mappings    Larger requests get an mmap() of their own, and free()
+ *               munmap()s it.
+ *
+ * Each thread allocates from and frees to a cache of per-class free
+ * lists, so most malloc()/free() pairs never leave it. A cache that runs
+ * dry takes a batch of blocks from the spans; one that grows past twice
+ * a batch gives a batch back. Threads pick a cache by their thread_t
+ * address (thread.h), so a cache is normally used by one thread and its
+ * umutex_t costs one atomic instruction; threads that collide still work,
+ * sharing the cache.
+ *
+ * When every block of a span is back, the span is free for any class.
+ * Past the first UMALLOC_HOT_SPANS free spans, madvise(MADV_DONTNEED)
+ * returns a free span's pages (all but its header page) to the kernel;
+ * the address range stays, and is zero-filled again when reused.
+ *
+ * The names are the standard ones, so a program including this must not
+ * define its own malloc() and friends.
+ */
+
+#ifndef USERLAND_UMALLOC_H
+#define USERLAND_UMALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "futex.h"
+#include "ustring.h"
+
+#define SYS_SBRK        4
+#define SYS_MMAP        24
+#define SYS_MUNMAP      25
+#define SYS_MADVISE     128
+
+#define PROT_READ       0x1
+#define PROT_WRITE      0x2
+#define MAP_PRIVATE     0x02
+#define MAP_ANONYMOUS   0x20
+#define MADV_DONTNEED   4
+
+#define UMALLOC_PAGE_SIZE   4096UL
+#define UMALLOC_ALIGN       16UL
+
+#define UMALLOC_SPAN_SIZE   (64 * 1024UL)   /* Spans are aligned to their size */
+#define UMALLOC_SBRK_SPANS  4               /* Spans per sbrk() */
+#define UMALLOC_HOT_SPANS   2               /* Free spans kept resident */
+#define UMALLOC_CLASSES     32
+#define UMALLOC_SMALL_MAX   8192UL          /* Largest size class */
+#define UMALLOC_CACHES      8               /* Thread caches */
+#define UMALLOC_CACHE_BYTES (16 * 1024UL)   /* Aim of a batch, in bytes */
+#define UMALLOC_BATCH_MAX   64
+
+/* Header of a mapping, just before the block */
+#define UMALLOC_MAP_HEADER  UMALLOC_ALIGN
+
+/* Free block: the link lives in the block */
+typedef struct umalloc_block {
+    struct umalloc_block *next;
+} umalloc_block_t;
+
+/* Span header, at the start of the span; blocks follow */
+typedef struct umalloc_span {
+    struct umalloc_span *prev;      /* On a class's partial list, or the free list */
+    struct umalloc_span *next;
+    umalloc_block_t *free;          /* Blocks given back */
+    uintptr_t bump;                 /* Next never-used block */
+    uint32_t size;                  /* Block size */
+    uint32_t used;                  /* Blocks out, counting those in caches */
+    uint32_t capacity;
+    int cls;                        /* Size class, or -1 while free */
+    int released;                   /* Free, with its pages given back */
+} umalloc_span_t;
+
+#define UMALLOC_SPAN_HEADER \
+    ((sizeof(umalloc_span_t) + UMALLOC_ALIGN - 1) & ~(UMALLOC_ALIGN - 1))
+
+/* Thread cache */
+typedef struct {
+    umutex_t lock;
+    umalloc_block_t *free[UMALLOC_CLASSES];
+    uint32_t count[UMALLOC_CLASSES];
+} umalloc_cache_t;
+
+/* Allocator statistics */
+typedef struct {
+    uint64_t sbrk_calls;            /* sbrk()s that grew the heap */
+    uint64_t spans;                 /* Spans carved from the heap */
+    uint64_t spans_released;        /* Free spans madvise()d away */
+    uint64_t refills;               /* Batches taken from the spans */
+    uint64_t flushes;               /* Batches given back to the spans */
+    uint64_t mmaps;                 /* Large blocks mapped */
+    uint64_t munmaps;               /* Large blocks unmapped */
+} umalloc_stats_t;
+
+/* Allocator state; the spans and the heap are under lock */
+typedef struct {
+    umutex_t lock;
+    umalloc_span_t *partial[UMALLOC_CLASSES];   /* Spans with blocks to hand out */
+    umalloc_span_t *free_spans;                 /* Most recently freed first */
+    uint32_t hot_spans;                         /* Free spans not released */
+    uintptr_t heap_lo;                          /* Spans live in [heap_lo, heap_hi) */
+    uintptr_t heap_hi;
+    uintptr_t heap_top;                         /* Spans carved up to here */
+    umalloc_stats_t stats;
+    umalloc_cache_t caches[UMALLOC_CACHES];
+} umalloc_state_t;
+
+static umalloc_state_t umalloc_state __attribute__((unused));
+
+static inline long umalloc_syscall(long n, long arg0, long arg1, long arg2,
+                                   long arg3, long arg4, long arg5) {
+    register long a0 asm("a0") = arg0;
+    register long a1 asm("a1") = arg1;
+    register long a2 asm("a2") = arg2;
+    register long a3 asm("a3") = arg3;
+    register long a4 asm("a4") = arg4;
+    register long a5 asm("a5") = arg5;
+    register long a7 asm("a7") = n;
+    asm volatile("ecall"
+                 : "+r"(a0)
+                 : "r"(a1), "r"(a2), "r"(a3), "r"(a4), "r"(a5), "r"(a7)
+                 : "memory");
+    return a0;
+}
+
+/* Size class for a request of 1..UMALLOC_SMALL_MAX bytes */
+static inline int umalloc_class(size_t size) {
+    if (size <= 128) {
+        return (int)((size + UMALLOC_ALIGN - 1) / UMALLOC_ALIGN) - 1;
+    }
+    size_t n = size - 1;
+    int lg = 63 - __builtin_clzl(n);
+    return 8 + (lg - 7) * 4 + (int)((n >> (lg - 2)) & 3);
+}
+
+static inline size_t umalloc_class_size(int cls) {
+    if (cls < 8) {
+        return (size_t)(cls + 1) * UMALLOC_ALIGN;
+    }
+    return (size_t)(5 + (cls - 8) % 4) << ((cls - 8) / 4 + 5);
+}
+
+/* Blocks moved between a cache and the spans at a time */
+static inline uint32_t umalloc_batch(int cls) {
+    size_t n = UMALLOC_CACHE_BYTES / 2 / umalloc_class_size(cls);
+    if (n < 2) {
+        return 2;
+    }
+    return n > UMALLOC_BATCH_MAX ? UMALLOC_BATCH_MAX : (uint32_t)n;
+}
+
+static inline umalloc_cache_t *umalloc_cache(void) {
+    uintptr_t tp;
+    asm volatile("mv %0, tp" : "=r"(tp));
+    return &umalloc_state.caches[(tp >> 4) % UMALLOC_CACHES];
+}
+
+static inline umalloc_span_t *umalloc_span_of(const void *ptr) {
+    return (umalloc_span_t *)((uintptr_t)ptr & ~(UMALLOC_SPAN_SIZE - 1));
+}
+
+static inline int umalloc_in_heap(const void *ptr) {
+    uintptr_t p = (uintptr_t)ptr;
+    return p >= umalloc_state.heap_lo &&
+           p < __atomic_load_n(&umalloc_state.heap_hi, __ATOMIC_ACQUIRE);
+}
+
+static inline void umalloc_list_push(umalloc_span_t **list, umalloc_span_t *span) {
+    span->prev = NULL;
+    span->next = *list;
+    if (*list) {
+        (*list)->prev = span;
+    }
+    *list = span;
+}
+
+static inline void umalloc_list_remove(umalloc_span_t **list, umalloc_span_t *span) {
+    if (span->prev) {
+        span->prev->next = span->next;
+    } else {
+        *list = span->next;
+    }
+    if (span->next) {
+        span->next->prev = span->prev;
+    }
+}
+
+/* A free span, reused or carved from the heap; under lock */
+static inline umalloc_span_t *umalloc_span_get(void) {
+    umalloc_state_t *st = &umalloc_state;
+    umalloc_span_t *span = st->free_spans;
+
+    if (span) {
+        umalloc_list_remove(&st->free_spans, span);
+        if (!span->released) {
+            st->hot_spans--;
+        }
+        return span;
+    }
+
+    if (st->heap_top == st->heap_hi) {
+        /* Grow the heap, aligning a new run of spans to their size */
+        uintptr_t brk = (uintptr_t)umalloc_syscall(SYS_SBRK, 0, 0, 0, 0, 0, 0);
+        if (brk == (uintptr_t)-1) {
+            return NULL;
+        }
+        uintptr_t base = brk;
+        if (brk != st->heap_hi) {
+            /* First span, or someone else moved the break */
+            base = (brk + UMALLOC_SPAN_SIZE - 1) & ~(UMALLOC_SPAN_SIZE - 1);
+            if (st->heap_lo == 0) {
+                st->heap_lo = base;
+            }
+            st->heap_top = base;
+        }
+        long grow = (long)(base - brk) + UMALLOC_SBRK_SPANS * UMALLOC_SPAN_SIZE;
+        if (umalloc_syscall(SYS_SBRK, grow, 0, 0, 0, 0, 0) == -1) {
+            return NULL;
+        }
+        st->stats.sbrk_calls++;
+        __atomic_store_n(&st->heap_hi, base + UMALLOC_SBRK_SPANS * UMALLOC_SPAN_SIZE,
+                         __ATOMIC_RELEASE);
+    }
+
+    span = (umalloc_span_t *)st->heap_top;
+    st->heap_top += UMALLOC_SPAN_SIZE;
+    st->stats.spans++;
+    return span;
+}
+
+/* Give every block of an unused span back; under lock */
+static inline void umalloc_span_put(umalloc_span_t *span) {
+    umalloc_state_t *st = &umalloc_state;
+
+    umalloc_list_remove(&st->partial[span->cls], span);
+    span->cls = -1;
+    span->released = st->hot_spans >= UMALLOC_HOT_SPANS;
+    if (span->released) {
+        umalloc_syscall(SYS_MADVISE, (long)span + UMALLOC_PAGE_SIZE,
+                        UMALLOC_SPAN_SIZE - UMALLOC_PAGE_SIZE, MADV_DONTNEED, 0, 0, 0);
+        st->stats.spans_released++;
+    } else {
+        st->hot_spans++;
+    }
+    umalloc_list_push(&st->free_spans, span);
+}
+
+/* Take up to n blocks of a class from the spans into a list; under lock */
+static inline uint32_t umalloc_take(int cls, uint32_t n, umalloc_block_t **list) {
+    umalloc_state_t *st = &umalloc_state;
+    uint32_t got = 0;
+
+    while (got < n) {
+        umalloc_span_t *span = st->partial[cls];
+        if (!span) {
+            span = umalloc_span_get();
+            if (!span) {
+                break;
+            }
+            span->size = (uint32_t)umalloc_class_size(cls);
+            span->capacity = (uint32_t)((UMALLOC_SPAN_SIZE - UMALLOC_SPAN_HEADER) / span->size);
+            span->bump = (uintptr_t)span + UMALLOC_SPAN_HEADER;
+            span->free = NULL;
+            span->used = 0;
+            span->cls = cls;
+            umalloc_list_push(&st->partial[cls], span);
+        }
+
+        while (got < n && span->used < span->capacity) {
+            umalloc_block_t *b = span->free;
+            if (b) {
+                span->free = b->next;
+            } else {
+                b = (umalloc_block_t *)span->bump;
+                span->bump += span->size;
+            }
+            b->next = *list;
+            *list = b;
+            span->used++;
+            got++;
+        }
+        if (span->used == span->capacity) {
+            umalloc_list_remove(&st->partial[cls], span);
+        }
+    }
+    return got;
+}
+
+/* Give a block back to its span; under lock */
+static inline void umalloc_give(umalloc_block_t *b) {
+    umalloc_state_t *st = &umalloc_state;
+    umalloc_span_t *span = umalloc_span_of(b);
+
+    if (span->used == span->capacity) {
+        umalloc_list_push(&st->partial[span->cls], span);
+    }
+    b->next = span->free;
+    span->free = b;
+    if (--span->used == 0) {
+        umalloc_span_put(span);
+    }
+}
+
+static inline void *umalloc_large(size_t size) {
+    size_t len = (size + UMALLOC_MAP_HEADER + UMALLOC_PAGE_SIZE - 1) & ~(UMALLOC_PAGE_SIZE - 1);
+    if (len < size) {
+        return NULL;
+    }
+    long base = umalloc_syscall(SYS_MMAP, 0, (long)len, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == -1) {
+        return NULL;
+    }
+    __atomic_fetch_add(&umalloc_state.stats.mmaps, 1, __ATOMIC_RELAXED);
+    *(size_t *)base = len;
+    return (char *)base + UMALLOC_MAP_HEADER;
+}
+
+/* Usable size of a block */
+static inline size_t malloc_usable_size(void *ptr) {
+    if (!ptr) {
+        return 0;
+    }
+    if (umalloc_in_heap(ptr)) {
+        return umalloc_span_of(ptr)->size;
+    }
+    return *(size_t *)((char *)ptr - UMALLOC_MAP_HEADER) - UMALLOC_MAP_HEADER;
+}
+
+static inline void *malloc(size_t size) {
+    if (size > UMALLOC_SMALL_MAX) {
+        return umalloc_large(size);
+    }
+
+    int cls = umalloc_class(size ? size : 1);
+    umalloc_cache_t *c = umalloc_cache();
+
+    umutex_lock(&c->lock);
+    if (!c->free[cls]) {
+        umutex_lock(&umalloc_state.lock);
+        c->count[cls] += umalloc_take(cls, umalloc_batch(cls), &c->free[cls]);
+        umalloc_state.stats.refills++;
+        umutex_unlock(&umalloc_state.lock);
+    }
+    umalloc_block_t *b = c->free[cls];
+    if (b) {
+        c->free[cls] = b->next;
+        c->count[cls]--;
+    }
+    umutex_unlock(&c->lock);
+    return b;
+}
+
+static inline void free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    if (!umalloc_in_heap(ptr)) {
+        char *base = (char *)ptr - UMALLOC_MAP_HEADER;
+        umalloc_syscall(SYS_MUNMAP, (long)base, (long)*(size_t *)base, 0, 0, 0, 0);
+        __atomic_fetch_add(&umalloc_state.stats.munmaps, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    int cls = umalloc_span_of(ptr)->cls;
+    umalloc_cache_t *c = umalloc_cache();
+    umalloc_block_t *b = ptr;
+
+    umutex_lock(&c->lock);
+    b->next = c->free[cls];
+    c->free[cls] = b;
+    uint32_t batch = umalloc_batch(cls);
+    if (++c->count[cls] > 2 * batch) {
+        umutex_lock(&umalloc_state.lock);
+        for (uint32_t i = 0; i < batch; i++) {
+            b = c->free[cls];
+            c->free[cls] = b->next;
+            umalloc_give(b);
+        }
+        c->count[cls] -= batch;
+        umalloc_state.stats.flushes++;
+        umutex_unlock(&umalloc_state.lock);
+    }
+    umutex_unlock(&c->lock);
+}
+
+static inline void *calloc(size_t n, size_t size) {
+    if (size != 0 && n > (size_t)-1 / size) {
+        return NULL;
+    }
+    size_t total = n * size;
+    void *ptr = malloc(total);
+    /* Fresh mappings are already zero */
+    if (ptr && total <= UMALLOC_SMALL_MAX) {
+        memset(ptr, 0, total);
+    }
+    return ptr;
+}
+
+static inline void *realloc(void *ptr, size_t size) {
+    if (!ptr) {
+        return malloc(size);
+    }
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    size_t have = malloc_usable_size(ptr);
+    if (size <= have && (size > UMALLOC_SMALL_MAX || !umalloc_in_heap(ptr) ||
+                         umalloc_class(size) == umalloc_span_of(ptr)->cls)) {
+        return ptr;
+    }
+
+    void *grown = malloc(size);
+    if (grown) {
+        memcpy(grown, ptr, size < have ? size : have);
+        free(ptr);
+    }
+    return grown;
+}
+
+/* Copy the allocator statistics */
+static inline void umalloc_get_stats(umalloc_stats_t *out) {
+    umutex_lock(&umalloc_state.lock);
+    *out = umalloc_state.stats;
+    umutex_unlock(&umalloc_state.lock);
+}
+
+#endif /* USERLAND_UMALLOC_H */
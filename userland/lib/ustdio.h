@@ -0,0 +1,469 @@
+/**
+ * ustdio.h - Buffered output streams and printf() for userland programs
+ *
+ * Header-only, like futex.h. Output to stdout collects in the stream's
+ * buffer and reaches the kernel in one write() per buffer instead of one
+ * per fragment:
+ *
+ *   Line buffered   If the descriptor is a terminal (the TCGETS ioctl
+ *                   works), the buffer is written out at every newline,
+ *                   so output appears a line at a time.
+ *   Fully buffered  Otherwise (pipes, files), it is written out when full.
+ *   Unbuffered      stderr, so errors are never held back.
+ *
+ * The mode is chosen at a stream's first write; setvbuf() overrides it.
+ * Buffered output is lost unless the program flushes it, so leave with
+ * exit(), which flushes stdout and stderr, rather than SYS_EXIT, and
+ * fflush(stdout) before anything that waits for the user to have seen it
+ * (a prompt, fork()).
+ *
+ * printf() understands %d %i %u %x %X %o %p %s %c and %%, with the -, 0,
+ * + and space flags, a width and a precision (either may be *), and the
+ * h, hh, l, ll, z and t length modifiers.
+ *
+ * Also the syscall wrappers used here (syscall0() to syscall3()), so a
+ * program needs no copy of its own.
+ */
+
+#ifndef USERLAND_USTDIO_H
+#define USERLAND_USTDIO_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "ustring.h"
+
+#define SYS_EXIT        0
+#define SYS_WRITE       1
+#define SYS_READ        2
+#define SYS_IOCTL       91
+
+#define TCGETS          0x5401
+
+#define STDIN_FILENO    0
+#define STDOUT_FILENO   1
+#define STDERR_FILENO   2
+
+/* Buffering modes (setvbuf()) */
+#define _IOFBF          0
+#define _IOLBF          1
+#define _IONBF          2
+
+#define BUFSIZ          1024
+#define EOF             (-1)
+
+static inline long syscall0(long n) {
+    register long a0 asm("a0");
+    register long a7 asm("a7") = n;
+    asm volatile("ecall" : "=r"(a0) : "r"(a7) : "memory");
+    return a0;
+}
+
+static inline long syscall1(long n, long arg0) {
+    register long a0 asm("a0") = arg0;
+    register long a7 asm("a7") = n;
+    asm volatile("ecall" : "+r"(a0) : "r"(a7) : "memory");
+    return a0;
+}
+
+static inline long syscall2(long n, long arg0, long arg1) {
+    register long a0 asm("a0") = arg0;
+    register long a1 asm("a1") = arg1;
+    register long a7 asm("a7") = n;
+    asm volatile("ecall" : "+r"(a0) : "r"(a1), "r"(a7) : "memory");
+    return a0;
+}
+
+static inline long syscall3(long n, long arg0, long arg1, long arg2) {
+    register long a0 asm("a0") = arg0;
+    register long a1 asm("a1") = arg1;
+    register long a2 asm("a2") = arg2;
+    register long a7 asm("a7") = n;
+    asm volatile("ecall" : "+r"(a0) : "r"(a1), "r"(a2), "r"(a7) : "memory");
+    return a0;
+}
+
+/* Output stream */
+typedef struct {
+    int fd;
+    int mode;                   /* _IOFBF, _IOLBF, _IONBF; -1 until the first write */
+    int error;                  /* A write failed */
+    size_t len;                 /* Bytes waiting in buf */
+    char buf[BUFSIZ];
+} FILE;
+
+static FILE ustdio_streams[3] __attribute__((unused)) = {
+    { STDIN_FILENO, -1, 0, 0, { 0 } },
+    { STDOUT_FILENO, -1, 0, 0, { 0 } },
+    { STDERR_FILENO, _IONBF, 0, 0, { 0 } },
+};
+
+#define stdin   (&ustdio_streams[0])
+#define stdout  (&ustdio_streams[1])
+#define stderr  (&ustdio_streams[2])
+
+static inline int isatty(int fd) {
+    uint32_t termios[4];
+    return syscall3(SYS_IOCTL, fd, TCGETS, (long)termios) == 0;
+}
+
+/* Write all of buf to fd, 0 or EOF */
+static inline int ustdio_write_all(FILE *f, const char *buf, size_t len) {
+    while (len > 0) {
+        long n = syscall3(SYS_WRITE, f->fd, (long)buf, (long)len);
+        if (n <= 0) {
+            f->error = 1;
+            return EOF;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static inline int fflush(FILE *f) {
+    if (f->len == 0) {
+        return 0;
+    }
+    size_t len = f->len;
+    f->len = 0;
+    return ustdio_write_all(f, f->buf, len);
+}
+
+static inline int setvbuf(FILE *f, char *buf, int mode, size_t size) {
+    (void)buf;
+    (void)size;
+    if (mode != _IOFBF && mode != _IOLBF && mode != _IONBF) {
+        return EOF;
+    }
+    fflush(f);
+    f->mode = mode;
+    return 0;
+}
+
+static inline size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *f) {
+    const char *data = ptr;
+    size_t len = size * nmemb;
+
+    if (f->mode < 0) {
+        f->mode = isatty(f->fd) ? _IOLBF : _IOFBF;
+    }
+    if (f->mode == _IONBF) {
+        return ustdio_write_all(f, data, len) == 0 ? nmemb : 0;
+    }
+
+    /* What does not fit goes out with the buffer, or straight if large */
+    if (len > BUFSIZ - f->len) {
+        if (fflush(f) != 0) {
+            return 0;
+        }
+        if (len >= BUFSIZ) {
+            return ustdio_write_all(f, data, len) == 0 ? nmemb : 0;
+        }
+    }
+    memcpy(f->buf + f->len, data, len);
+    f->len += len;
+
+    if (f->mode == _IOLBF && len > 0) {
+        for (size_t i = len; i > 0; i--) {
+            if (data[i - 1] == '\n') {
+                return fflush(f) == 0 ? nmemb : 0;
+            }
+        }
+    }
+    return nmemb;
+}
+
+static inline int fputs(const char *s, FILE *f) {
+    size_t len = strlen(s);
+    return fwrite(s, 1, len, f) == len ? 0 : EOF;
+}
+
+static inline int fputc(int c, FILE *f) {
+    char ch = (char)c;
+    return fwrite(&ch, 1, 1, f) == 1 ? (unsigned char)ch : EOF;
+}
+
+#define putc(c, f)  fputc(c, f)
+
+static inline int putchar(int c) {
+    return fputc(c, stdout);
+}
+
+static inline int puts(const char *s) {
+    if (fputs(s, stdout) == EOF) {
+        return EOF;
+    }
+    return fputc('\n', stdout);
+}
+
+static inline int ferror(FILE *f) {
+    return f->error;
+}
+
+/* Flush the output streams and end the process */
+static inline void exit(int status) {
+    fflush(stdout);
+    fflush(stderr);
+    syscall1(SYS_EXIT, status);
+    while (1);
+}
+
+/* ========================================================================
+ * Formatting
+ * ======================================================================== */
+
+/* Where formatted output goes: a stream or a string */
+typedef struct {
+    FILE *f;                    /* Stream, or NULL */
+    char *str;                  /* String (f == NULL) */
+    size_t size;                /* Its size */
+    size_t total;               /* Bytes produced, stored or not */
+} ustdio_sink_t;
+
+static inline void ustdio_emit(ustdio_sink_t *out, const char *s, size_t len) {
+    if (out->f) {
+        fwrite(s, 1, len, out->f);
+    } else if (out->total < out->size) {
+        size_t room = out->size - out->total;
+        memcpy(out->str + out->total, s, len < room ? len : room);
+    }
+    out->total += len;
+}
+
+static inline void ustdio_pad(ustdio_sink_t *out, char c, int n) {
+    char pad[16];
+    memset(pad, c, sizeof(pad));
+    while (n > 0) {
+        int chunk = n < (int)sizeof(pad) ? n : (int)sizeof(pad);
+        ustdio_emit(out, pad, (size_t)chunk);
+        n -= chunk;
+    }
+}
+
+/* Flags of a conversion */
+#define USTDIO_LEFT     0x01    /* - */
+#define USTDIO_ZERO     0x02    /* 0 */
+#define USTDIO_PLUS     0x04    /* + */
+#define USTDIO_SPACE    0x08    /* space */
+
+static inline void ustdio_number(ustdio_sink_t *out, unsigned long long v, int negative,
+                                 unsigned base, int upper, int flags, int width, int precision) {
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char buf[24];
+    int len = 0;
+
+    /* Precision 0 prints nothing for 0 */
+    if (v != 0 || precision != 0) {
+        do {
+            buf[sizeof(buf) - 1 - len++] = digits[v % base];
+            v /= base;
+        } while (v != 0);
+    }
+
+    char sign = negative ? '-' : (flags & USTDIO_PLUS) ? '+' : (flags & USTDIO_SPACE) ? ' ' : 0;
+    int zeros = precision > len ? precision - len : 0;
+    int body = len + zeros + (sign ? 1 : 0);
+    int fill = width > body ? width - body : 0;
+
+    if ((flags & USTDIO_ZERO) && !(flags & USTDIO_LEFT) && precision < 0) {
+        zeros += fill;
+        fill = 0;
+    }
+    if (!(flags & USTDIO_LEFT)) {
+        ustdio_pad(out, ' ', fill);
+    }
+    if (sign) {
+        ustdio_emit(out, &sign, 1);
+    }
+    ustdio_pad(out, '0', zeros);
+    ustdio_emit(out, buf + sizeof(buf) - len, (size_t)len);
+    if (flags & USTDIO_LEFT) {
+        ustdio_pad(out, ' ', fill);
+    }
+}
+
+static inline void ustdio_format(ustdio_sink_t *out, const char *fmt, va_list ap) {
+    while (*fmt) {
+        /* Literal text up to the next conversion goes out in one piece */
+        const char *start = fmt;
+        while (*fmt && *fmt != '%') {
+            fmt++;
+        }
+        if (fmt > start) {
+            ustdio_emit(out, start, (size_t)(fmt - start));
+        }
+        if (*fmt == '\0') {
+            break;
+        }
+        fmt++;
+
+        int flags = 0;
+        for (;; fmt++) {
+            if (*fmt == '-') flags |= USTDIO_LEFT;
+            else if (*fmt == '0') flags |= USTDIO_ZERO;
+            else if (*fmt == '+') flags |= USTDIO_PLUS;
+            else if (*fmt == ' ') flags |= USTDIO_SPACE;
+            else break;
+        }
+
+        int width = 0;
+        if (*fmt == '*') {
+            width = va_arg(ap, int);
+            if (width < 0) {
+                flags |= USTDIO_LEFT;
+                width = -width;
+            }
+            fmt++;
+        } else {
+            while (*fmt >= '0' && *fmt <= '9') {
+                width = width * 10 + (*fmt++ - '0');
+            }
+        }
+
+        int precision = -1;
+        if (*fmt == '.') {
+            fmt++;
+            precision = 0;
+            if (*fmt == '*') {
+                precision = va_arg(ap, int);
+                fmt++;
+            } else {
+                while (*fmt >= '0' && *fmt <= '9') {
+                    precision = precision * 10 + (*fmt++ - '0');
+                }
+            }
+        }
+
+        /* Length: 0 int, 1 long, 2 long long, -1 short, -2 char */
+        int length = 0;
+        if (*fmt == 'h') {
+            length = -1;
+            if (*++fmt == 'h') {
+                length = -2;
+                fmt++;
+            }
+        } else if (*fmt == 'l') {
+            length = 1;
+            if (*++fmt == 'l') {
+                length = 2;
+                fmt++;
+            }
+        } else if (*fmt == 'z' || *fmt == 't') {
+            length = 1;
+            fmt++;
+        }
+
+        char conv = *fmt;
+        if (conv == '\0') {
+            break;
+        }
+        fmt++;
+
+        switch (conv) {
+        case 'd':
+        case 'i': {
+            long long v = length >= 2 ? va_arg(ap, long long)
+                        : length == 1 ? va_arg(ap, long) : va_arg(ap, int);
+            if (length == -1) v = (short)v;
+            if (length == -2) v = (signed char)v;
+            unsigned long long mag = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+            ustdio_number(out, mag, v < 0, 10, 0, flags, width, precision);
+            break;
+        }
+
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o': {
+            unsigned long long v = length >= 2 ? va_arg(ap, unsigned long long)
+                                 : length == 1 ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+            if (length == -1) v = (unsigned short)v;
+            if (length == -2) v = (unsigned char)v;
+            unsigned base = conv == 'u' ? 10 : conv == 'o' ? 8 : 16;
+            ustdio_number(out, v, 0, base, conv == 'X', flags & ~(USTDIO_PLUS | USTDIO_SPACE),
+                          width, precision);
+            break;
+        }
+
+        case 'p': {
+            uintptr_t v = (uintptr_t)va_arg(ap, void *);
+            ustdio_emit(out, "0x", 2);
+            ustdio_number(out, v, 0, 16, 0, 0, width > 2 ? width - 2 : 0, -1);
+            break;
+        }
+
+        case 's': {
+            const char *s = va_arg(ap, const char *);
+            if (!s) {
+                s = "(null)";
+            }
+            size_t len = 0;
+            while (s[len] && (precision < 0 || len < (size_t)precision)) {
+                len++;
+            }
+            int fill = width > (int)len ? width - (int)len : 0;
+            if (!(flags & USTDIO_LEFT)) ustdio_pad(out, ' ', fill);
+            ustdio_emit(out, s, len);
+            if (flags & USTDIO_LEFT) ustdio_pad(out, ' ', fill);
+            break;
+        }
+
+        case 'c': {
+            char c = (char)va_arg(ap, int);
+            int fill = width > 1 ? width - 1 : 0;
+            if (!(flags & USTDIO_LEFT)) ustdio_pad(out, ' ', fill);
+            ustdio_emit(out, &c, 1);
+            if (flags & USTDIO_LEFT) ustdio_pad(out, ' ', fill);
+            break;
+        }
+
+        default:
+            /* %% and anything unknown print as themselves */
+            ustdio_emit(out, &conv, 1);
+            break;
+        }
+    }
+}
+
+static inline int vfprintf(FILE *f, const char *fmt, va_list ap) {
+    ustdio_sink_t out = { f, NULL, 0, 0 };
+    ustdio_format(&out, fmt, ap);
+    return f->error ? EOF : (int)out.total;
+}
+
+static inline int fprintf(FILE *f, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vfprintf(f, fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+static inline int printf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vfprintf(stdout, fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+/* Format into str (always terminated if size > 0); returns the full length */
+static inline int vsnprintf(char *str, size_t size, const char *fmt, va_list ap) {
+    ustdio_sink_t out = { NULL, str, size, 0 };
+    ustdio_format(&out, fmt, ap);
+    if (size > 0) {
+        str[out.total < size ? out.total : size - 1] = '\0';
+    }
+    return (int)out.total;
+}
+
+static inline int snprintf(char *str, size_t size, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(str, size, fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+#endif /* USERLAND_USTDIO_H */
@@ -0,0 +1,145 @@
+/**
+ * ustring.h - Memory and string routines for userland programs
+ *
+ * Header-only, like futex.h. memcpy(), memset() and strlen() work a
+ * 64-bit word at a time once the pointers are aligned, falling back to
+ * bytes for the ends and for copies whose source and destination are
+ * aligned differently. strlen() finds a zero byte in a word with the
+ * usual (w - 0x01..01) & ~w & 0x80..80 test; reading the whole aligned
+ * word that holds the terminator never crosses into the next page.
+ *
+ * The names are the standard ones, so a program including this must not
+ * define its own strlen() and friends.
+ */
+
+#ifndef USERLAND_USTRING_H
+#define USERLAND_USTRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Word accesses that may alias anything */
+typedef uint64_t __attribute__((__may_alias__)) uword_t;
+
+#define UWORD_SIZE      sizeof(uword_t)
+#define UWORD_ONES      0x0101010101010101UL
+#define UWORD_HIGHS     0x8080808080808080UL
+
+/* Nonzero if some byte of w is zero */
+#define UWORD_HAS_ZERO(w)   (((w) - UWORD_ONES) & ~(w) & UWORD_HIGHS)
+
+static inline void *memcpy(void *dst, const void *src, size_t n) {
+    unsigned char *d = dst;
+    const unsigned char *s = src;
+
+    if ((((uintptr_t)d ^ (uintptr_t)s) & (UWORD_SIZE - 1)) == 0) {
+        while (n > 0 && ((uintptr_t)d & (UWORD_SIZE - 1)) != 0) {
+            *d++ = *s++;
+            n--;
+        }
+        while (n >= UWORD_SIZE) {
+            *(uword_t *)d = *(const uword_t *)s;
+            d += UWORD_SIZE;
+            s += UWORD_SIZE;
+            n -= UWORD_SIZE;
+        }
+    }
+    while (n > 0) {
+        *d++ = *s++;
+        n--;
+    }
+    return dst;
+}
+
+static inline void *memmove(void *dst, const void *src, size_t n) {
+    unsigned char *d = dst;
+    const unsigned char *s = src;
+
+    if (d <= s || d >= s + n) {
+        return memcpy(dst, src, n);
+    }
+    while (n > 0) {
+        n--;
+        d[n] = s[n];
+    }
+    return dst;
+}
+
+static inline void *memset(void *dst, int c, size_t n) {
+    unsigned char *d = dst;
+    uword_t w = (unsigned char)c * UWORD_ONES;
+
+    while (n > 0 && ((uintptr_t)d & (UWORD_SIZE - 1)) != 0) {
+        *d++ = (unsigned char)c;
+        n--;
+    }
+    while (n >= UWORD_SIZE) {
+        *(uword_t *)d = w;
+        d += UWORD_SIZE;
+        n -= UWORD_SIZE;
+    }
+    while (n > 0) {
+        *d++ = (unsigned char)c;
+        n--;
+    }
+    return dst;
+}
+
+static inline int memcmp(const void *a, const void *b, size_t n) {
+    const unsigned char *p = a;
+    const unsigned char *q = b;
+
+    for (size_t i = 0; i < n; i++) {
+        if (p[i] != q[i]) {
+            return p[i] - q[i];
+        }
+    }
+    return 0;
+}
+
+static inline size_t strlen(const char *s) {
+    const char *p = s;
+
+    while (((uintptr_t)p & (UWORD_SIZE - 1)) != 0) {
+        if (*p == '\0') {
+            return (size_t)(p - s);
+        }
+        p++;
+    }
+    while (!UWORD_HAS_ZERO(*(const uword_t *)p)) {
+        p += UWORD_SIZE;
+    }
+    while (*p != '\0') {
+        p++;
+    }
+    return (size_t)(p - s);
+}
+
+static inline int strcmp(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+static inline int strncmp(const char *a, const char *b, size_t n) {
+    for (; n > 0; n--, a++, b++) {
+        if (*a != *b || *a == '\0') {
+            return (unsigned char)*a - (unsigned char)*b;
+        }
+    }
+    return 0;
+}
+
+static inline char *strcpy(char *dst, const char *src) {
+    memcpy(dst, src, strlen(src) + 1);
+    return dst;
+}
+
+static inline char *strcat(char *dst, const char *src) {
+    strcpy(dst + strlen(dst), src);
+    return dst;
+}
+
+#endif /* USERLAND_USTRING_H */
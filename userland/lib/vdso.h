@@ -0,0 +1,91 @@
+/**
+ * vdso.h - clock_gettime() and gettimeofday() without a trap
+ *
+ * Header-only, like futex.h. The kernel maps a data page and a code page
+ * into every process (include/kernel/vdso.h); the code reads rdtime and
+ * the kernel's timebase in user mode, to the nanosecond. If the data
+ * page has no magic (the kernel could not set the vDSO up), the calls
+ * fall back to SYS_CLOCK_GETTIME.
+ */
+
+#ifndef USERLAND_VDSO_H
+#define USERLAND_VDSO_H
+
+#include <stdint.h>
+
+#define SYS_CLOCK_GETTIME   118
+
+#define CLOCK_REALTIME      0
+#define CLOCK_MONOTONIC     1
+
+#define VDSO_DATA_ADDR      0xE000UL
+#define VDSO_MAGIC          0x4F534476
+
+struct timespec {
+    int64_t tv_sec;
+    int64_t tv_nsec;
+};
+
+struct timeval {
+    int64_t tv_sec;
+    int64_t tv_usec;
+};
+
+/* The start of the data page we use (vdso_data_t) */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;
+    uint32_t shift;
+    uint64_t mult;
+    uint64_t cycle_last;
+    uint64_t mono_base_ns;
+    uint64_t realtime_offset_ns;
+    uint64_t clock_gettime;
+} vdso_data_t;
+
+typedef int (*vdso_clock_gettime_t)(int clock, struct timespec *ts);
+
+/* The vDSO's clock_gettime(), or 0 if there is none */
+static inline vdso_clock_gettime_t vdso_clock_gettime_fn(void) {
+    const volatile vdso_data_t *vd = (const volatile vdso_data_t *)VDSO_DATA_ADDR;
+    return vd->magic == VDSO_MAGIC ? (vdso_clock_gettime_t)(uintptr_t)vd->clock_gettime : 0;
+}
+
+/* long clock_gettime(clock, ts) through the kernel */
+static inline long sys_clock_gettime(int clock, struct timespec *ts) {
+    register long a0 asm("a0") = clock;
+    register long a1 asm("a1") = (long)ts;
+    register long a7 asm("a7") = SYS_CLOCK_GETTIME;
+    asm volatile("ecall" : "+r"(a0) : "r"(a1), "r"(a7) : "memory");
+    return a0;
+}
+
+/* 0 on success, -1 for an unknown clock */
+static inline int clock_gettime(int clock, struct timespec *ts) {
+    vdso_clock_gettime_t fn = vdso_clock_gettime_fn();
+    if (fn) {
+        return fn(clock, ts);
+    }
+    return (int)sys_clock_gettime(clock, ts);
+}
+
+static inline int gettimeofday(struct timeval *tv, void *tz) {
+    (void)tz;
+    struct timespec ts;
+    if (clock_gettime(CLOCK_REALTIME, &ts) != 0) {
+        return -1;
+    }
+    tv->tv_sec = ts.tv_sec;
+    tv->tv_usec = ts.tv_nsec / 1000;
+    return 0;
+}
+
+/* CLOCK_MONOTONIC in nanoseconds */
+static inline uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
+
+#endif /* USERLAND_VDSO_H */
@@ -2,6 +2,7 @@
  * udp_network_test - Test UDP communication with host machine
  * 
  * Sends UDP packets to host and receives echo responses
+ * (needs `make qemu-net` and test_udp_host.py running on the host)
  */
 
 #include <stdint.h>
@@ -9,28 +10,32 @@
 
 #define SYS_WRITE    1
 #define SYS_EXIT     0
-#define SYS_SOCKET   66
-#define SYS_BIND     67
-#define SYS_SENDTO   68
-#define SYS_RECVFROM 69
+#define SYS_POLL     71
+#define SYS_SOCKET   100
+#define SYS_BIND     101
+#define SYS_SENDTO   102
+#define SYS_RECVFROM 103
 
 /* Socket constants */
 #define AF_INET     2
 #define SOCK_DGRAM  2
 #define IPPROTO_UDP 17
+#define MSG_DONTWAIT 0x40
+#define POLLIN      0x0001
 
 /* Test configuration */
 #define HOST_PORT 9999
 #define LOCAL_PORT 12345
 #define TEST_BUF_SIZE 256
 #define NUM_PACKETS 3
+#define ECHO_TIMEOUT_MS 1000
 
 /* Host IP: 10.0.3.1 (TAP network host IP when using TAP networking)
  * For user-mode networking: use 10.0.2.2 (but won't work for UDP)
  * This requires TAP networking setup (see setup_tap_network.sh) */
 #define HOST_IP ((10 << 24) | (0 << 16) | (3 << 8) | (1 << 0))
 
-/* Socket address structure */
+/* Socket address structure (port and address in network byte order) */
 struct sockaddr_in {
     uint16_t sin_family;
     uint16_t sin_port;
@@ -38,6 +43,20 @@ struct sockaddr_in {
     uint8_t sin_zero[8];
 };
 
+struct pollfd {
+    int fd;
+    short events;
+    short revents;
+};
+
+static inline uint16_t htons(uint16_t x) {
+    return (uint16_t)((x << 8) | (x >> 8));
+}
+
+static inline uint32_t htonl(uint32_t x) {
+    return ((x & 0xFF) << 24) | ((x & 0xFF00) << 8) | ((x >> 8) & 0xFF00) | (x >> 24);
+}
+
 /* Syscall wrappers */
 static inline long syscall6(long n, long a0, long a1, long a2, long a3, long a4, long a5) {
     register long syscall_num asm("a7") = n;
@@ -106,7 +125,7 @@ void _start(void) {
     print("Before running this test:\n");
     print("1. On your Ubuntu host, run: python3 test_udp_host.py\n");
     print("2. The host server will listen on port 9999\n");
-    print("3. This test will send packets to 10.0.2.2:9999\n\n");
+    print("3. This test will send packets to 10.0.3.1:9999\n\n");
     print("Press ENTER when ready, or Ctrl+C to cancel...\n");
     print("(Note: Just proceed for automated testing)\n\n");
     
@@ -127,7 +146,7 @@ void _start(void) {
     print("...\n");
     struct sockaddr_in local;
     local.sin_family = AF_INET;
-    local.sin_port = LOCAL_PORT;
+    local.sin_port = htons(LOCAL_PORT);
     local.sin_addr = 0;  /* INADDR_ANY */
     for (int i = 0; i < 8; i++) local.sin_zero[i] = 0;
     
@@ -142,8 +161,8 @@ void _start(void) {
     /* Setup host address */
     struct sockaddr_in host;
     host.sin_family = AF_INET;
-    host.sin_port = HOST_PORT;
-    host.sin_addr = HOST_IP;
+    host.sin_port = htons(HOST_PORT);
+    host.sin_addr = htonl(HOST_IP);
     for (int i = 0; i < 8; i++) host.sin_zero[i] = 0;
     
     print("[INFO] Target host: ");
@@ -182,21 +201,24 @@ void _start(void) {
         print_num(sent);
         print(" bytes\n");
         
-        /* Wait a bit for echo to arrive (give time for network round-trip) */
-        for (volatile int delay = 0; delay < 500000; delay++);
+        /* Wait for the echo (the network round-trip), but not forever */
+        struct pollfd pfd = { sock, POLLIN, 0 };
+        syscall3(SYS_POLL, (long)&pfd, 1, ECHO_TIMEOUT_MS);
         
         /* Try to receive echo (non-blocking, may fail if host not responding) */
         char recv_buf[TEST_BUF_SIZE];
         for (int j = 0; j < TEST_BUF_SIZE; j++) recv_buf[j] = 0;
         struct sockaddr_in from;
         for (int j = 0; j < sizeof(from); j++) ((char*)&from)[j] = 0;
+        uint32_t fromlen = sizeof(from);
         
-        int rcvd = syscall6(SYS_RECVFROM, sock, (long)recv_buf, sizeof(recv_buf), 0, (long)&from, 0);
+        int rcvd = syscall6(SYS_RECVFROM, sock, (long)recv_buf, sizeof(recv_buf), MSG_DONTWAIT,
+                            (long)&from, (long)&fromlen);
         if (rcvd > 0) {
             print("  [PASS] Received echo: ");
             print_num(rcvd);
             print(" bytes from ");
-            print_ip(from.sin_addr);
+            print_ip(htonl(from.sin_addr));
             print("\n");
             
             if (memcmp(msg, recv_buf, sent) == 0) {
@@ -0,0 +1,288 @@
+/*
+ * irqstat - Interrupt statistics and steering
+ *
+ * irqstat                    List the interrupts in use, then the
+ *                            threads of threaded ones
+ * irqstat <irq> cpus <mask>  Allow only the CPUs in mask (hex, a bit per
+ *                            CPU) to take irq; the lowest online one does
+ * irqstat <irq> prio <1-7>   Set irq's priority
+ */
+
+#define SYS_EXIT     0
+#define SYS_WRITE    1
+#define SYS_GETIRQS  115
+#define SYS_IRQCTL   116
+
+#define IRQCTL_SET_AFFINITY 1
+#define IRQCTL_SET_PRIORITY 2
+
+typedef unsigned long size_t;
+
+/* Interrupt info structure (must match kernel) */
+#define IRQ_INFO_NAME_MAX 16
+#define IRQ_INFO_CPUS 8
+typedef struct {
+    unsigned int irq;
+    unsigned int priority;
+    unsigned int affinity;
+    int target;
+    char name[IRQ_INFO_NAME_MAX];
+    unsigned long count;
+    unsigned long cpu_count[IRQ_INFO_CPUS];
+    unsigned long total_us;
+    unsigned long max_us;
+    unsigned long max_latency_us;
+    int thread_pid;
+    unsigned long thread_count;
+    unsigned long thread_total_us;
+    unsigned long thread_max_us;
+    unsigned long thread_max_latency_us;
+} irqinfo_t;
+
+/* System call wrappers */
+static inline long syscall2(long n, long a0, long a1) {
+    register long num asm("a7") = n;
+    register long arg0 asm("a0") = a0;
+    register long arg1 asm("a1") = a1;
+
+    asm volatile("ecall"
+                 : "+r"(arg0)
+                 : "r"(num), "r"(arg1)
+                 : "memory");
+    return arg0;
+}
+
+static inline long syscall3(long n, long a0, long a1, long a2) {
+    register long num asm("a7") = n;
+    register long arg0 asm("a0") = a0;
+    register long arg1 asm("a1") = a1;
+    register long arg2 asm("a2") = a2;
+
+    asm volatile("ecall"
+                 : "+r"(arg0)
+                 : "r"(num), "r"(arg1), "r"(arg2)
+                 : "memory");
+    return arg0;
+}
+
+/* Helper functions */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static int streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static void print(const char *s) {
+    syscall3(SYS_WRITE, 1, (long)s, strlen(s));
+}
+
+static void print_char(char c) {
+    syscall3(SYS_WRITE, 1, (long)&c, 1);
+}
+
+/* Print a number right-aligned in field width, in base 10 or 16 */
+static void print_num_width(unsigned long n, int base, int width) {
+    char buf[24];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = "0123456789abcdef"[n % base];
+            n /= base;
+        }
+    }
+
+    /* Pad with spaces */
+    while (i < width) {
+        print_char(' ');
+        width--;
+    }
+
+    /* Print reversed */
+    while (i > 0) {
+        print_char(buf[--i]);
+    }
+}
+
+/* Print string left-aligned in field width */
+static void print_str_width(const char *s, int width) {
+    int len = strlen(s);
+    print(s);
+    while (len < width) {
+        print_char(' ');
+        len++;
+    }
+}
+
+/* Parse a number in base 10 or 16; -1 if it is not one */
+static long parse_num(const char *s, int base) {
+    long value = 0;
+
+    if (*s == '\0') {
+        return -1;
+    }
+    for (; *s; s++) {
+        int digit;
+        if (*s >= '0' && *s <= '9') {
+            digit = *s - '0';
+        } else if (base == 16 && *s >= 'a' && *s <= 'f') {
+            digit = *s - 'a' + 10;
+        } else if (base == 16 && *s >= 'A' && *s <= 'F') {
+            digit = *s - 'A' + 10;
+        } else {
+            return -1;
+        }
+        value = value * base + digit;
+        if (value > 0x7FFFFFFF) {
+            return -1;
+        }
+    }
+    return value;
+}
+
+static void usage(void) {
+    print("Usage: irqstat [<irq> cpus <hex mask> | <irq> prio <1-7>]\n");
+    syscall2(SYS_EXIT, 1, 0);
+}
+
+/* Interrupt buffer */
+static irqinfo_t irqs[96];
+
+static void list_irqs(void) {
+    long count = syscall2(SYS_GETIRQS, (long)irqs, 96);
+
+    if (count < 0) {
+        print("irqstat: failed to get interrupt list\n");
+        syscall2(SYS_EXIT, 1, 0);
+    }
+
+    /* Columns for the CPUs that took any interrupt, at least CPU0 */
+    int cpus = 1;
+    for (int i = 0; i < count; i++) {
+        for (int cpu = 0; cpu < IRQ_INFO_CPUS; cpu++) {
+            if (irqs[i].cpu_count[cpu] && cpu + 1 > cpus) {
+                cpus = cpu + 1;
+            }
+        }
+    }
+
+    /* Print header */
+    print("IRQ NAME         PRIO CPUS TO      COUNT   TOTAL_US MAX_US MAXLAT");
+    for (int cpu = 0; cpu < cpus; cpu++) {
+        print("    CPU");
+        print_num_width(cpu, 10, 1);
+    }
+    print("\n");
+
+    /* Print each interrupt */
+    for (int i = 0; i < count; i++) {
+        irqinfo_t *q = &irqs[i];
+
+        print_num_width(q->irq, 10, 3);
+        print_char(' ');
+        print_str_width(q->name, 12);
+        print_char(' ');
+        print_num_width(q->priority, 10, 4);
+        print_char(' ');
+        print_num_width(q->affinity, 16, 4);
+        print_char(' ');
+        print_num_width((unsigned long)q->target, 10, 2);
+        print_char(' ');
+        print_num_width(q->count, 10, 10);
+        print_char(' ');
+        print_num_width(q->total_us, 10, 10);
+        print_char(' ');
+        print_num_width(q->max_us, 10, 6);
+        print_char(' ');
+        print_num_width(q->max_latency_us, 10, 6);
+        for (int cpu = 0; cpu < cpus; cpu++) {
+            print_char(' ');
+            print_num_width(q->cpu_count[cpu], 10, 7);
+        }
+        print("\n");
+    }
+
+    /* Threaded handlers, if any */
+    int threaded = 0;
+    for (int i = 0; i < count; i++) {
+        irqinfo_t *q = &irqs[i];
+
+        if (q->thread_pid == 0) {
+            continue;
+        }
+        if (!threaded) {
+            print("\nIRQ NAME          PID       RUNS   TOTAL_US MAX_US MAXLAT\n");
+            threaded = 1;
+        }
+        print_num_width(q->irq, 10, 3);
+        print_char(' ');
+        print_str_width(q->name, 12);
+        print_char(' ');
+        print_num_width((unsigned long)q->thread_pid, 10, 4);
+        print_char(' ');
+        print_num_width(q->thread_count, 10, 10);
+        print_char(' ');
+        print_num_width(q->thread_total_us, 10, 10);
+        print_char(' ');
+        print_num_width(q->thread_max_us, 10, 6);
+        print_char(' ');
+        print_num_width(q->thread_max_latency_us, 10, 6);
+        print("\n");
+    }
+}
+
+/* Entry point - argc in a0, argv in a1 */
+void _start(long argc, char **argv) {
+    /* Initialize gp for global data access */
+    __asm__ volatile (
+        ".option push\n"
+        ".option norelax\n"
+        "1: auipc gp, %%pcrel_hi(__global_pointer$)\n"
+        "   addi gp, gp, %%pcrel_lo(1b)\n"
+        ".option pop\n"
+        ::: "gp"
+    );
+
+    if (argc == 1) {
+        list_irqs();
+        syscall2(SYS_EXIT, 0, 0);
+    }
+    if (argc != 4) {
+        usage();
+    }
+
+    long irq = parse_num(argv[1], 10);
+    int cmd;
+    long arg;
+    if (streq(argv[2], "cpus")) {
+        cmd = IRQCTL_SET_AFFINITY;
+        arg = parse_num(argv[3], 16);
+    } else if (streq(argv[2], "prio")) {
+        cmd = IRQCTL_SET_PRIORITY;
+        arg = parse_num(argv[3], 10);
+    } else {
+        usage();
+        return;
+    }
+    if (irq < 0 || arg < 0) {
+        usage();
+    }
+
+    if (syscall3(SYS_IRQCTL, irq, cmd, arg) < 0) {
+        print("irqstat: cannot change IRQ ");
+        print(argv[1]);
+        print(" (not in use, not allowed, or no such CPU online)\n");
+        syscall2(SYS_EXIT, 1, 0);
+    }
+    syscall2(SYS_EXIT, 0, 0);
+}
@@ -0,0 +1,406 @@
+/*
+ * perfstat - Count hardware events while a command runs, like perf stat
+ *
+ * perfstat [-e event[,event...]] command [args...]
+ *
+ * The command is started with cycles, instructions and the TLB miss
+ * events counting unless -e names others: cycles, instructions,
+ * cache-references, cache-misses, branches, branch-misses,
+ * L1-dcache-loads, L1-dcache-load-misses, L1-icache-load-misses,
+ * dTLB-load-misses, dTLB-store-misses, iTLB-load-misses, or rXXXX for a
+ * raw event selector in hex. A command without a slash is looked for in
+ * /bin.
+ *
+ * Counts cover the command only (the kernel's work for it included), not
+ * perfstat itself. A count that shared its counter with other processes'
+ * events is scaled up and marked with the share of time it was counting.
+ */
+
+#define SYS_EXIT             0
+#define SYS_WRITE            1
+#define SYS_READ             2
+#define SYS_FORK             7
+#define SYS_WAIT             9
+#define SYS_CLOSE            14
+#define SYS_EXECVE           20
+#define SYS_PIPE             26
+#define SYS_PERF_EVENT_OPEN  117
+
+/* perf_event_attr_t types and configs (must match kernel/perf_event.h) */
+#define PERF_TYPE_HARDWARE   0
+#define PERF_TYPE_HW_CACHE   3
+#define PERF_TYPE_RAW        4
+
+#define HW_CACHE(cache, op, result) ((cache) | ((op) << 8) | ((result) << 16))
+#define CACHE_L1D            0
+#define CACHE_L1I            1
+#define CACHE_DTLB           3
+#define CACHE_ITLB           4
+#define OP_READ              0
+#define OP_WRITE             1
+#define RESULT_ACCESS        0
+#define RESULT_MISS          1
+
+#define MAX_EVENTS           8
+
+typedef unsigned long size_t;
+
+/* What to count (must match kernel) */
+typedef struct {
+    unsigned int type;
+    unsigned int flags;
+    unsigned long config;
+} perf_event_attr_t;
+
+/* What read() returns (must match kernel) */
+typedef struct {
+    unsigned long value;
+    unsigned long time_enabled_us;
+    unsigned long time_running_us;
+} perf_count_t;
+
+typedef struct {
+    const char *name;
+    unsigned int type;
+    unsigned long config;
+} event_name_t;
+
+static const event_name_t event_names[] = {
+    { "cycles",                PERF_TYPE_HARDWARE, 0 },
+    { "instructions",          PERF_TYPE_HARDWARE, 1 },
+    { "cache-references",      PERF_TYPE_HARDWARE, 2 },
+    { "cache-misses",          PERF_TYPE_HARDWARE, 3 },
+    { "branches",              PERF_TYPE_HARDWARE, 4 },
+    { "branch-misses",         PERF_TYPE_HARDWARE, 5 },
+    { "L1-dcache-loads",       PERF_TYPE_HW_CACHE, HW_CACHE(CACHE_L1D, OP_READ, RESULT_ACCESS) },
+    { "L1-dcache-load-misses", PERF_TYPE_HW_CACHE, HW_CACHE(CACHE_L1D, OP_READ, RESULT_MISS) },
+    { "L1-icache-load-misses", PERF_TYPE_HW_CACHE, HW_CACHE(CACHE_L1I, OP_READ, RESULT_MISS) },
+    { "dTLB-load-misses",      PERF_TYPE_HW_CACHE, HW_CACHE(CACHE_DTLB, OP_READ, RESULT_MISS) },
+    { "dTLB-store-misses",     PERF_TYPE_HW_CACHE, HW_CACHE(CACHE_DTLB, OP_WRITE, RESULT_MISS) },
+    { "iTLB-load-misses",      PERF_TYPE_HW_CACHE, HW_CACHE(CACHE_ITLB, OP_READ, RESULT_MISS) },
+};
+
+#define NUM_EVENT_NAMES (sizeof(event_names) / sizeof(event_names[0]))
+
+static const char *default_events =
+    "cycles,instructions,dTLB-load-misses,dTLB-store-misses,iTLB-load-misses";
+
+typedef struct {
+    char name[32];
+    perf_event_attr_t attr;
+    long fd;
+} event_t;
+
+static event_t events[MAX_EVENTS];
+static int num_events;
+
+/* System call wrappers */
+static inline long syscall0(long n) {
+    register long num asm("a7") = n;
+    register long ret asm("a0");
+
+    asm volatile("ecall"
+                 : "=r"(ret)
+                 : "r"(num)
+                 : "memory");
+    return ret;
+}
+
+static inline long syscall3(long n, long a0, long a1, long a2) {
+    register long num asm("a7") = n;
+    register long arg0 asm("a0") = a0;
+    register long arg1 asm("a1") = a1;
+    register long arg2 asm("a2") = a2;
+
+    asm volatile("ecall"
+                 : "+r"(arg0)
+                 : "r"(num), "r"(arg1), "r"(arg2)
+                 : "memory");
+    return arg0;
+}
+
+/* Helper functions */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static int streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static void print(const char *s) {
+    syscall3(SYS_WRITE, 1, (long)s, strlen(s));
+}
+
+static void fail(const char *msg) {
+    print("perfstat: ");
+    print(msg);
+    print("\n");
+    syscall3(SYS_EXIT, 1, 0, 0);
+}
+
+/* Right-aligned in width, with thousands separators */
+static void print_count(unsigned long n, int width) {
+    char buf[32];
+    int i = 0;
+    int digits = 0;
+
+    do {
+        if (digits && digits % 3 == 0) {
+            buf[i++] = ',';
+        }
+        buf[i++] = '0' + (n % 10);
+        n /= 10;
+        digits++;
+    } while (n > 0);
+
+    for (int pad = width - i; pad > 0; pad--) {
+        print(" ");
+    }
+    while (i > 0) {
+        syscall3(SYS_WRITE, 1, (long)&buf[--i], 1);
+    }
+}
+
+/* n / 100 with two decimals */
+static void print_hundredths(unsigned long n) {
+    char frac[4] = { '.', '0' + (n / 10) % 10, '0' + n % 10, 0 };
+    print_count(n / 100, 0);
+    print(frac);
+}
+
+static int parse_hex(const char *s, unsigned long *out) {
+    unsigned long n = 0;
+
+    if (!*s) {
+        return -1;
+    }
+    while (*s) {
+        char c = *s++;
+        if (c >= '0' && c <= '9') {
+            n = n * 16 + (c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            n = n * 16 + (c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            n = n * 16 + (c - 'A' + 10);
+        } else {
+            return -1;
+        }
+    }
+    *out = n;
+    return 0;
+}
+
+static void add_event(const char *name) {
+    if (num_events == MAX_EVENTS) {
+        fail("too many events");
+    }
+    event_t *event = &events[num_events];
+
+    size_t len = strlen(name);
+    if (len == 0 || len >= sizeof(event->name)) {
+        fail("bad event name");
+    }
+    for (size_t i = 0; i <= len; i++) {
+        event->name[i] = name[i];
+    }
+
+    if (name[0] == 'r' && parse_hex(name + 1, &event->attr.config) == 0) {
+        event->attr.type = PERF_TYPE_RAW;
+        num_events++;
+        return;
+    }
+    for (size_t i = 0; i < NUM_EVENT_NAMES; i++) {
+        if (streq(name, event_names[i].name)) {
+            event->attr.type = event_names[i].type;
+            event->attr.config = event_names[i].config;
+            num_events++;
+            return;
+        }
+    }
+    print("perfstat: unknown event ");
+    print(name);
+    print("\n");
+    syscall3(SYS_EXIT, 1, 0, 0);
+}
+
+/* Comma-separated list */
+static void add_events(const char *list) {
+    char name[32];
+    size_t len = 0;
+
+    for (;; list++) {
+        if (*list == ',' || *list == 0) {
+            name[len] = 0;
+            add_event(name);
+            len = 0;
+            if (*list == 0) {
+                return;
+            }
+        } else if (len < sizeof(name) - 1) {
+            name[len++] = *list;
+        } else {
+            fail("bad event name");
+        }
+    }
+}
+
+static void usage(void) {
+    print("Usage: perfstat [-e event[,event...]] command [args...]\n");
+    syscall3(SYS_EXIT, 1, 0, 0);
+}
+
+/* Child: wait for the parent's events, then become the command */
+static void run_child(int ready_fd, const char *path, char **argv) {
+    char go;
+    const char *envp[] = { 0 };
+
+    syscall3(SYS_READ, ready_fd, (long)&go, 1);
+    syscall3(SYS_CLOSE, ready_fd, 0, 0);
+    syscall3(SYS_EXECVE, (long)path, (long)argv, (long)envp);
+    print("perfstat: cannot run ");
+    print(path);
+    print("\n");
+    syscall3(SYS_EXIT, 127, 0, 0);
+}
+
+static void report(const char *command) {
+    unsigned long cycles = 0, instructions = 0;
+
+    print("\n Performance counter stats for '");
+    print(command);
+    print("':\n\n");
+
+    for (int i = 0; i < num_events; i++) {
+        event_t *event = &events[i];
+        perf_count_t count;
+
+        if (event->fd < 0) {
+            print("    <not supported>  ");
+            print(event->name);
+            print("\n");
+            continue;
+        }
+        if (syscall3(SYS_READ, event->fd, (long)&count, sizeof(count)) != sizeof(count)) {
+            fail("cannot read a counter");
+        }
+
+        unsigned long value = count.value;
+        int scaled = count.time_running_us < count.time_enabled_us;
+        if (scaled && count.time_running_us) {
+            unsigned long running = count.time_running_us;
+            value = value / running * count.time_enabled_us +
+                    value % running * count.time_enabled_us / running;
+        }
+        if (event->attr.type == PERF_TYPE_HARDWARE && event->attr.config == 0) {
+            cycles = value;
+        } else if (event->attr.type == PERF_TYPE_HARDWARE && event->attr.config == 1) {
+            instructions = value;
+        }
+
+        if (scaled && count.time_running_us == 0) {
+            print("      <not counted>  ");
+            print(event->name);
+            print("\n");
+            continue;
+        }
+        print_count(value, 19);
+        print("  ");
+        print(event->name);
+        if (event->attr.type == PERF_TYPE_HARDWARE && event->attr.config == 1 && cycles) {
+            print("    # ");
+            print_hundredths(instructions * 100 / cycles);
+            print(" insn per cycle");
+        }
+        if (scaled) {
+            print("    (");
+            print_count(count.time_running_us * 100 / count.time_enabled_us, 0);
+            print("%)");
+        }
+        print("\n");
+    }
+    print("\n");
+}
+
+/* Entry point - argc in a0, argv in a1 */
+void _start(long argc, char **argv) {
+    /* Initialize gp for global data access */
+    __asm__ volatile (
+        ".option push\n"
+        ".option norelax\n"
+        "1: auipc gp, %%pcrel_hi(__global_pointer$)\n"
+        "   addi gp, gp, %%pcrel_lo(1b)\n"
+        ".option pop\n"
+        ::: "gp"
+    );
+
+    int arg = 1;
+    if (arg + 1 < argc && streq(argv[arg], "-e")) {
+        add_events(argv[arg + 1]);
+        arg += 2;
+    } else {
+        add_events(default_events);
+    }
+    if (arg >= argc) {
+        usage();
+    }
+
+    static char path[128];
+    const char *command = argv[arg];
+    size_t len = 0;
+    int has_slash = 0;
+    for (const char *p = command; *p; p++) {
+        has_slash |= *p == '/';
+    }
+    if (!has_slash) {
+        for (const char *p = "/bin/"; *p; p++) {
+            path[len++] = *p;
+        }
+    }
+    if (len + strlen(command) >= sizeof(path)) {
+        fail("command name too long");
+    }
+    for (const char *p = command; *p; p++) {
+        path[len++] = *p;
+    }
+    path[len] = 0;
+
+    int ready[2];
+    if (syscall3(SYS_PIPE, (long)ready, 0, 0) < 0) {
+        fail("cannot create a pipe");
+    }
+
+    long pid = syscall0(SYS_FORK);
+    if (pid < 0) {
+        fail("cannot fork");
+    }
+    if (pid == 0) {
+        syscall3(SYS_CLOSE, ready[1], 0, 0);
+        run_child(ready[0], path, &argv[arg]);
+    }
+    syscall3(SYS_CLOSE, ready[0], 0, 0);
+
+    /* The child is blocked on the pipe, so nothing it runs is missed */
+    for (int i = 0; i < num_events; i++) {
+        events[i].fd = syscall3(SYS_PERF_EVENT_OPEN, (long)&events[i].attr, pid, 0);
+    }
+    syscall3(SYS_WRITE, ready[1], (long)"g", 1);
+    syscall3(SYS_CLOSE, ready[1], 0, 0);
+
+    int status = 0;
+    syscall3(SYS_WAIT, pid, (long)&status, 0);
+
+    report(path);
+    for (int i = 0; i < num_events; i++) {
+        if (events[i].fd >= 0) {
+            syscall3(SYS_CLOSE, events[i].fd, 0, 0);
+        }
+    }
+    syscall3(SYS_EXIT, (status >> 8) & 0xFF, 0, 0);
+}
@@ -0,0 +1,231 @@
+/*
+ * prof - Sampling CPU profiler control (/dev/prof)
+ *
+ * prof                       Show the sampling period and the ring counts
+ * prof start [period_us]     Drop what is buffered, then sample every CPU
+ *                            each period (1000 us by default)
+ * prof stop                  Stop sampling
+ * prof dump <file>           Stop sampling and move the buffered samples
+ *                            to file, for tools/prof_report.py
+ */
+
+#define SYS_EXIT     0
+#define SYS_WRITE    1
+#define SYS_READ     2
+#define SYS_OPEN     13
+#define SYS_CLOSE    14
+#define SYS_IOCTL    91
+
+#define O_RDONLY  0x0000
+#define O_WRONLY  0x0001
+#define O_CREAT   0x0040
+#define O_TRUNC   0x0200
+
+/* ioctl() requests (must match kernel/prof.h) */
+#define PROFIO_START      0x5500
+#define PROFIO_STOP       0x5501
+#define PROFIO_GET_STATS  0x5502
+#define PROFIO_RESET      0x5503
+
+typedef unsigned long size_t;
+
+/* Profiler counts (must match kernel) */
+typedef struct {
+    unsigned long samples;
+    unsigned long dropped;
+    unsigned long buffered;
+    unsigned int period_us;
+    unsigned int ring_samples;
+} prof_stats_t;
+
+/* Size of a sample read from /dev/prof */
+#define PROF_SAMPLE_SIZE 64
+
+/* System call wrappers */
+static inline long syscall2(long n, long a0, long a1) {
+    register long num asm("a7") = n;
+    register long arg0 asm("a0") = a0;
+    register long arg1 asm("a1") = a1;
+
+    asm volatile("ecall"
+                 : "+r"(arg0)
+                 : "r"(num), "r"(arg1)
+                 : "memory");
+    return arg0;
+}
+
+static inline long syscall3(long n, long a0, long a1, long a2) {
+    register long num asm("a7") = n;
+    register long arg0 asm("a0") = a0;
+    register long arg1 asm("a1") = a1;
+    register long arg2 asm("a2") = a2;
+
+    asm volatile("ecall"
+                 : "+r"(arg0)
+                 : "r"(num), "r"(arg1), "r"(arg2)
+                 : "memory");
+    return arg0;
+}
+
+/* Helper functions */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static int streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static void print(const char *s) {
+    syscall3(SYS_WRITE, 1, (long)s, strlen(s));
+}
+
+static void print_num(unsigned long n) {
+    char buf[24];
+    int i = 0;
+
+    do {
+        buf[i++] = '0' + (n % 10);
+        n /= 10;
+    } while (n > 0);
+    while (i > 0) {
+        syscall3(SYS_WRITE, 1, (long)&buf[--i], 1);
+    }
+}
+
+static int parse_num(const char *s, unsigned long *out) {
+    unsigned long n = 0;
+
+    if (!*s) {
+        return -1;
+    }
+    while (*s) {
+        if (*s < '0' || *s > '9') {
+            return -1;
+        }
+        n = n * 10 + (*s++ - '0');
+    }
+    *out = n;
+    return 0;
+}
+
+static void fail(const char *msg) {
+    print("prof: ");
+    print(msg);
+    print("\n");
+    syscall2(SYS_EXIT, 1, 0);
+}
+
+static void usage(void) {
+    print("Usage: prof [start [period_us] | stop | dump <file>]\n");
+    syscall2(SYS_EXIT, 1, 0);
+}
+
+static long prof_ioctl(long fd, long request, long arg) {
+    return syscall3(SYS_IOCTL, fd, request, arg);
+}
+
+static void show(long fd) {
+    prof_stats_t stats;
+
+    if (prof_ioctl(fd, PROFIO_GET_STATS, (long)&stats) < 0) {
+        fail("cannot get profiler counts");
+    }
+
+    print("Period:   ");
+    if (stats.period_us == 0) {
+        print("stopped");
+    } else {
+        print_num(stats.period_us);
+        print(" us");
+    }
+    print("\nSamples:  ");
+    print_num(stats.samples);
+    print("\nDropped:  ");
+    print_num(stats.dropped);
+    print("\nBuffered: ");
+    print_num(stats.buffered);
+    print(" (ring of ");
+    print_num(stats.ring_samples);
+    print(" per CPU)\n");
+}
+
+/* Samples moved per read */
+static char buffer[64 * PROF_SAMPLE_SIZE];
+
+static void dump(long fd, const char *path) {
+    /* Samples of this loop would only show the dump itself */
+    if (prof_ioctl(fd, PROFIO_STOP, 0) < 0) {
+        fail("cannot stop the profiler");
+    }
+
+    long out = syscall3(SYS_OPEN, (long)path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        fail("cannot create output file");
+    }
+
+    unsigned long samples = 0;
+    long n;
+    while ((n = syscall3(SYS_READ, fd, (long)buffer, sizeof(buffer))) > 0) {
+        if (syscall3(SYS_WRITE, out, (long)buffer, n) != n) {
+            fail("write failed");
+        }
+        samples += n / PROF_SAMPLE_SIZE;
+    }
+    syscall2(SYS_CLOSE, out, 0);
+    if (n < 0) {
+        fail("read from /dev/prof failed");
+    }
+
+    print_num(samples);
+    print(" samples written to ");
+    print(path);
+    print("\n");
+}
+
+/* Entry point - argc in a0, argv in a1 */
+void _start(long argc, char **argv) {
+    /* Initialize gp for global data access */
+    __asm__ volatile (
+        ".option push\n"
+        ".option norelax\n"
+        "1: auipc gp, %%pcrel_hi(__global_pointer$)\n"
+        "   addi gp, gp, %%pcrel_lo(1b)\n"
+        ".option pop\n"
+        ::: "gp"
+    );
+
+    long fd = syscall3(SYS_OPEN, (long)"/dev/prof", O_RDONLY, 0);
+    if (fd < 0) {
+        fail("cannot open /dev/prof");
+    }
+
+    if (argc == 1) {
+        show(fd);
+    } else if (streq(argv[1], "start") && argc <= 3) {
+        unsigned long period = 0;
+        if (argc == 3 && parse_num(argv[2], &period) < 0) {
+            usage();
+        }
+        if (prof_ioctl(fd, PROFIO_START, (long)period) < 0) {
+            fail("cannot start the profiler (period 100 to 1000000 us)");
+        }
+    } else if (streq(argv[1], "stop") && argc == 2) {
+        if (prof_ioctl(fd, PROFIO_STOP, 0) < 0) {
+            fail("cannot stop the profiler");
+        }
+    } else if (streq(argv[1], "dump") && argc == 3) {
+        dump(fd, argv[2]);
+    } else {
+        usage();
+    }
+
+    syscall2(SYS_CLOSE, fd, 0);
+    syscall2(SYS_EXIT, 0, 0);
+}
@@ -4,11 +4,9 @@
  * Display information about running processes.
  */
 
-#define SYS_EXIT     0
-#define SYS_WRITE    1
-#define SYS_GETPROCS 33
+#include "../lib/ustdio.h"
 
-typedef unsigned long size_t;
+#define SYS_GETPROCS 33
 
 /* Process info structure (must match kernel) */
 #define PROC_NAME_MAX 32
@@ -21,8 +19,21 @@ typedef struct {
     int tty;
     unsigned long cpu_time;
     char name[PROC_NAME_MAX];
+    unsigned long rss_pages;
+    unsigned long peak_rss_pages;
+    unsigned long pt_pages;
+    unsigned long minor_faults;
+    unsigned long major_faults;
+    unsigned long utime_us;
+    unsigned long stime_us;
+    unsigned long nvcsw;
+    unsigned long nivcsw;
+    unsigned long io_wait_us;
 } procinfo_t;
 
+/* Pages reported by the kernel are 4KB */
+#define PAGE_KB 4
+
 /* State names */
 static const char *state_names[] = {
     "UNUSED",   /* 0 */
@@ -33,97 +44,8 @@ static const char *state_names[] = {
     "ZOMBIE"    /* 5 */
 };
 
-/* System call wrapper */
-static inline long syscall2(long n, long a0, long a1) {
-    register long num asm("a7") = n;
-    register long arg0 asm("a0") = a0;
-    register long arg1 asm("a1") = a1;
-    
-    asm volatile("ecall"
-                 : "+r"(arg0)
-                 : "r"(num), "r"(arg1)
-                 : "memory");
-    return arg0;
-}
-
-static inline long syscall3(long n, long a0, long a1, long a2) {
-    register long num asm("a7") = n;
-    register long arg0 asm("a0") = a0;
-    register long arg1 asm("a1") = a1;
-    register long arg2 asm("a2") = a2;
-    
-    asm volatile("ecall"
-                 : "+r"(arg0)
-                 : "r"(num), "r"(arg1), "r"(arg2)
-                 : "memory");
-    return arg0;
-}
-
-/* Helper functions */
-static size_t strlen(const char *s) {
-    size_t len = 0;
-    while (s[len]) len++;
-    return len;
-}
-
-static void print(const char *s) {
-    syscall3(SYS_WRITE, 1, (long)s, strlen(s));
-}
-
-static void print_char(char c) {
-    syscall3(SYS_WRITE, 1, (long)&c, 1);
-}
-
-/* Print integer with right-align in field width */
-static void print_int_width(int n, int width) {
-    char buf[16];
-    int i = 0;
-    int neg = 0;
-    
-    if (n < 0) {
-        neg = 1;
-        n = -n;
-    }
-    
-    if (n == 0) {
-        buf[i++] = '0';
-    } else {
-        while (n > 0) {
-            buf[i++] = '0' + (n % 10);
-            n /= 10;
-        }
-    }
-    
-    if (neg) buf[i++] = '-';
-    
-    /* Pad with spaces */
-    while (i < width) {
-        print_char(' ');
-        width--;
-    }
-    
-    /* Print reversed */
-    while (i > 0) {
-        print_char(buf[--i]);
-    }
-}
-
-static void print_int(int n) {
-    print_int_width(n, 1);
-}
-
-/* Print string left-aligned in field width */
-static void print_str_width(const char *s, int width) {
-    int len = strlen(s);
-    print(s);
-    while (len < width) {
-        print_char(' ');
-        len++;
-    }
-}
-
 /* Process buffer */
-static procinfo_t procs[64];
+static procinfo_t procs[256];
 
 void _start(void) {
     /* Initialize gp for global data access */
@@ -137,60 +59,54 @@ void _start(void) {
     );
     
     /* Get process list */
-    long count = syscall2(SYS_GETPROCS, (long)procs, 64);
+    long count = syscall2(SYS_GETPROCS, (long)procs, 256);
     
     if (count < 0) {
-        print("ps: failed to get process list\n");
-        syscall2(SYS_EXIT, 1, 0);
+        fputs("ps: failed to get process list\n", stderr);
+        exit(1);
     }
     
     /* Print header */
-    print("  PID  PPID  PGID   SID TTY   STATE  TIME CMD\n");
+    puts("  PID  PPID  PGID   SID TTY   STATE  TIME  UTIME  STIME  VCSW IVCSW IOWAIT   RSS  PEAK  PT MINFLT MAJFLT CMD");
     
-    /* Print each process */
+    /* Print each process: one line into the buffer, one write per BUFSIZ */
     for (int i = 0; i < count; i++) {
         procinfo_t *p = &procs[i];
         
-        /* PID */
-        print_int_width(p->pid, 5);
-        print_char(' ');
-        
-        /* PPID */
-        print_int_width(p->ppid, 5);
-        print_char(' ');
-        
-        /* PGID */
-        print_int_width(p->pgid, 5);
-        print_char(' ');
-        
-        /* SID */
-        print_int_width(p->sid, 5);
-        print_char(' ');
+        /* PID, PPID, PGID, SID */
+        printf("%5d %5d %5d %5d ", p->pid, p->ppid, p->pgid, p->sid);
         
         /* TTY */
         if (p->tty >= 0) {
-            print("tty");
-            print_int(p->tty + 1);
+            printf("tty%d ", p->tty + 1);
         } else {
-            print("?   ");
+            fputs("?    ", stdout);
         }
-        print_char(' ');
         
         /* State */
         if (p->state >= 0 && p->state <= 5) {
-            print_str_width(state_names[p->state], 7);
+            printf("%-7s", state_names[p->state]);
         } else {
-            print("???    ");
+            fputs("???    ", stdout);
         }
         
         /* CPU time (simplified - just show ticks) */
-        print_int_width((int)p->cpu_time, 5);
-        print_char(' ');
+        printf("%5d ", (int)p->cpu_time);
+        
+        /* User, system and block I/O wait time in ms, context switches */
+        printf("%6d %6d %5d %5d %6d ", (int)(p->utime_us / 1000), (int)(p->stime_us / 1000),
+               (int)p->nvcsw, (int)p->nivcsw, (int)(p->io_wait_us / 1000));
+        
+        /* Memory in KB, page tables in pages */
+        printf("%5d %5d %3d ", (int)(p->rss_pages * PAGE_KB), (int)(p->peak_rss_pages * PAGE_KB),
+               (int)p->pt_pages);
+        
+        /* Page faults */
+        printf("%6d %6d ", (int)p->minor_faults, (int)p->major_faults);
         
         /* Command name */
-        print(p->name);
-        print("\n");
+        puts(p->name);
     }
     
-    syscall2(SYS_EXIT, 0, 0);
+    exit(0);
 }
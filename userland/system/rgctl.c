@@ -0,0 +1,206 @@
+/*
+ * rgctl - Resource groups
+ *
+ * rgctl                                List the groups (/proc/rgroups)
+ * rgctl create <name>                  Create a group and print its ID
+ * rgctl destroy <id>                   Remove an empty group
+ * rgctl set <id> <quota_us> <period_us> <mem_kb>
+ *                                      Set its limits (0 = unlimited; a
+ *                                      period of 0 is the default 100ms)
+ * rgctl attach <id> <pid>              Move a process and its threads
+ *
+ * For example, at most 20ms of CPU every 100ms and 4MB of memory:
+ *
+ *   rgctl create batch                 (prints 1)
+ *   rgctl set 1 20000 100000 4096
+ *   rgctl attach 1 42
+ */
+
+#define SYS_EXIT            0
+#define SYS_WRITE           1
+#define SYS_READ            2
+#define SYS_OPEN            13
+#define SYS_CLOSE           14
+#define SYS_RGROUP_CREATE   124
+#define SYS_RGROUP_DESTROY  125
+#define SYS_RGROUP_SETLIMIT 126
+#define SYS_RGROUP_ATTACH   127
+
+#define O_RDONLY  0x0000
+
+typedef unsigned long size_t;
+
+/* Limits (must match kernel's rgroup_limits_t) */
+typedef struct {
+    unsigned long cpu_quota_us;
+    unsigned long cpu_period_us;
+    unsigned long mem_limit_bytes;
+} rgroup_limits_t;
+
+/* System call wrappers */
+static inline long syscall2(long n, long a0, long a1) {
+    register long num asm("a7") = n;
+    register long arg0 asm("a0") = a0;
+    register long arg1 asm("a1") = a1;
+
+    asm volatile("ecall"
+                 : "+r"(arg0)
+                 : "r"(num), "r"(arg1)
+                 : "memory");
+    return arg0;
+}
+
+static inline long syscall3(long n, long a0, long a1, long a2) {
+    register long num asm("a7") = n;
+    register long arg0 asm("a0") = a0;
+    register long arg1 asm("a1") = a1;
+    register long arg2 asm("a2") = a2;
+
+    asm volatile("ecall"
+                 : "+r"(arg0)
+                 : "r"(num), "r"(arg1), "r"(arg2)
+                 : "memory");
+    return arg0;
+}
+
+/* Helper functions */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static int streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static void print(const char *s) {
+    syscall3(SYS_WRITE, 1, (long)s, strlen(s));
+}
+
+static void print_num(unsigned long n) {
+    char buf[24];
+    int i = 0;
+
+    do {
+        buf[i++] = '0' + (n % 10);
+        n /= 10;
+    } while (n > 0);
+    while (i > 0) {
+        syscall3(SYS_WRITE, 1, (long)&buf[--i], 1);
+    }
+}
+
+/* Parse a decimal number; -1 if it is not one */
+static long parse_num(const char *s) {
+    long value = 0;
+
+    if (*s == '\0') {
+        return -1;
+    }
+    for (; *s; s++) {
+        if (*s < '0' || *s > '9') {
+            return -1;
+        }
+        value = value * 10 + (*s - '0');
+        if (value > 0xFFFFFFFFFL) {
+            return -1;
+        }
+    }
+    return value;
+}
+
+static void usage(void) {
+    print("Usage: rgctl [create <name> | destroy <id> |\n"
+          "              set <id> <quota_us> <period_us> <mem_kb> | attach <id> <pid>]\n");
+    syscall2(SYS_EXIT, 1, 0);
+}
+
+static void fail(const char *what) {
+    print("rgctl: ");
+    print(what);
+    print(" failed (not root, no such group or process, or out of range)\n");
+    syscall2(SYS_EXIT, 1, 0);
+}
+
+static char buf[512];
+
+static void list_groups(void) {
+    long fd = syscall3(SYS_OPEN, (long)"/proc/rgroups", O_RDONLY, 0);
+    if (fd < 0) {
+        print("rgctl: cannot open /proc/rgroups\n");
+        syscall2(SYS_EXIT, 1, 0);
+    }
+
+    long n;
+    while ((n = syscall3(SYS_READ, fd, (long)buf, sizeof(buf))) > 0) {
+        syscall3(SYS_WRITE, 1, (long)buf, n);
+    }
+    syscall2(SYS_CLOSE, fd, 0);
+}
+
+/* Entry point - argc in a0, argv in a1 */
+void _start(long argc, char **argv) {
+    /* Initialize gp for global data access */
+    __asm__ volatile (
+        ".option push\n"
+        ".option norelax\n"
+        "1: auipc gp, %%pcrel_hi(__global_pointer$)\n"
+        "   addi gp, gp, %%pcrel_lo(1b)\n"
+        ".option pop\n"
+        ::: "gp"
+    );
+
+    if (argc == 1) {
+        list_groups();
+        syscall2(SYS_EXIT, 0, 0);
+    }
+
+    if (argc == 3 && streq(argv[1], "create")) {
+        long id = syscall2(SYS_RGROUP_CREATE, (long)argv[2], 0);
+        if (id < 0) {
+            fail("create");
+        }
+        print_num((unsigned long)id);
+        print("\n");
+    } else if (argc == 3 && streq(argv[1], "destroy")) {
+        long id = parse_num(argv[2]);
+        if (id < 0) {
+            usage();
+        }
+        if (syscall2(SYS_RGROUP_DESTROY, id, 0) < 0) {
+            fail("destroy (a group with members stays)");
+        }
+    } else if (argc == 6 && streq(argv[1], "set")) {
+        long id = parse_num(argv[2]);
+        long quota = parse_num(argv[3]);
+        long period = parse_num(argv[4]);
+        long mem_kb = parse_num(argv[5]);
+        if (id < 0 || quota < 0 || period < 0 || mem_kb < 0) {
+            usage();
+        }
+        rgroup_limits_t limits;
+        limits.cpu_quota_us = (unsigned long)quota;
+        limits.cpu_period_us = (unsigned long)period;
+        limits.mem_limit_bytes = (unsigned long)mem_kb * 1024;
+        if (syscall2(SYS_RGROUP_SETLIMIT, id, (long)&limits) < 0) {
+            fail("set");
+        }
+    } else if (argc == 4 && streq(argv[1], "attach")) {
+        long id = parse_num(argv[2]);
+        long pid = parse_num(argv[3]);
+        if (id < 0 || pid < 0) {
+            usage();
+        }
+        if (syscall2(SYS_RGROUP_ATTACH, id, pid) < 0) {
+            fail("attach");
+        }
+    } else {
+        usage();
+    }
+    syscall2(SYS_EXIT, 0, 0);
+}
@@ -0,0 +1,254 @@
+/*
+ * trace - Kernel tracepoint control (/dev/trace)
+ *
+ * trace                      Show the enabled events and the ring counts
+ * trace on [event ...]       Drop what is buffered, then record the events
+ *                            given (sched syscall fault block irq; all of
+ *                            them by default)
+ * trace off                  Stop recording
+ * trace dump <file>          Stop recording and move the buffered records
+ *                            to file, for tools/trace_decode.py
+ */
+
+#define SYS_EXIT     0
+#define SYS_WRITE    1
+#define SYS_READ     2
+#define SYS_OPEN     13
+#define SYS_CLOSE    14
+#define SYS_IOCTL    91
+
+#define O_RDONLY  0x0000
+#define O_WRONLY  0x0001
+#define O_CREAT   0x0040
+#define O_TRUNC   0x0200
+
+/* ioctl() requests (must match kernel/trace.h) */
+#define TRACEIO_SET_EVENTS  0x5400
+#define TRACEIO_GET_EVENTS  0x5401
+#define TRACEIO_GET_STATS   0x5402
+#define TRACEIO_RESET       0x5403
+
+typedef unsigned long size_t;
+
+/* Trace counts (must match kernel) */
+typedef struct {
+    unsigned long recorded;
+    unsigned long lost;
+    unsigned long buffered;
+    unsigned int events;
+    unsigned int ring_records;
+} trace_stats_t;
+
+/* Size of a record read from /dev/trace */
+#define TRACE_RECORD_SIZE 32
+
+/* Event groups, by the bits of their TRACE_* events */
+static const struct {
+    const char *name;
+    unsigned int mask;
+} events[] = {
+    { "sched",   0x001 },   /* TRACE_SCHED_SWITCH */
+    { "syscall", 0x006 },   /* TRACE_SYSCALL_ENTER/EXIT */
+    { "fault",   0x018 },   /* TRACE_PAGE_FAULT_ENTER/EXIT */
+    { "block",   0x060 },   /* TRACE_BLK_SUBMIT/COMPLETE */
+    { "irq",     0x180 },   /* TRACE_IRQ_ENTER/EXIT */
+};
+
+#define NUM_EVENTS (sizeof(events) / sizeof(events[0]))
+
+/* System call wrappers */
+static inline long syscall2(long n, long a0, long a1) {
+    register long num asm("a7") = n;
+    register long arg0 asm("a0") = a0;
+    register long arg1 asm("a1") = a1;
+
+    asm volatile("ecall"
+                 : "+r"(arg0)
+                 : "r"(num), "r"(arg1)
+                 : "memory");
+    return arg0;
+}
+
+static inline long syscall3(long n, long a0, long a1, long a2) {
+    register long num asm("a7") = n;
+    register long arg0 asm("a0") = a0;
+    register long arg1 asm("a1") = a1;
+    register long arg2 asm("a2") = a2;
+
+    asm volatile("ecall"
+                 : "+r"(arg0)
+                 : "r"(num), "r"(arg1), "r"(arg2)
+                 : "memory");
+    return arg0;
+}
+
+/* Helper functions */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static int streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static void print(const char *s) {
+    syscall3(SYS_WRITE, 1, (long)s, strlen(s));
+}
+
+static void print_num(unsigned long n) {
+    char buf[24];
+    int i = 0;
+
+    do {
+        buf[i++] = '0' + (n % 10);
+        n /= 10;
+    } while (n > 0);
+    while (i > 0) {
+        syscall3(SYS_WRITE, 1, (long)&buf[--i], 1);
+    }
+}
+
+static void fail(const char *msg) {
+    print("trace: ");
+    print(msg);
+    print("\n");
+    syscall2(SYS_EXIT, 1, 0);
+}
+
+static void usage(void) {
+    print("Usage: trace [on [sched|syscall|fault|block|irq ...] | off | dump <file>]\n");
+    syscall2(SYS_EXIT, 1, 0);
+}
+
+static long trace_ioctl(long fd, long request, long arg) {
+    return syscall3(SYS_IOCTL, fd, request, arg);
+}
+
+static void show(long fd) {
+    trace_stats_t stats;
+
+    if (trace_ioctl(fd, TRACEIO_GET_STATS, (long)&stats) < 0) {
+        fail("cannot get trace counts");
+    }
+
+    print("Events:  ");
+    if (stats.events == 0) {
+        print("none");
+    }
+    for (size_t i = 0; i < NUM_EVENTS; i++) {
+        if (stats.events & events[i].mask) {
+            print(events[i].name);
+            print(" ");
+        }
+    }
+    print("\nRecorded: ");
+    print_num(stats.recorded);
+    print("\nLost:     ");
+    print_num(stats.lost);
+    print("\nBuffered: ");
+    print_num(stats.buffered);
+    print(" (ring of ");
+    print_num(stats.ring_records);
+    print(" per CPU)\n");
+}
+
+static void trace_on(long fd, int argc, char **argv) {
+    unsigned int mask = 0;
+
+    for (int i = 2; i < argc; i++) {
+        size_t e;
+        for (e = 0; e < NUM_EVENTS; e++) {
+            if (streq(argv[i], events[e].name)) {
+                mask |= events[e].mask;
+                break;
+            }
+        }
+        if (e == NUM_EVENTS) {
+            usage();
+        }
+    }
+    if (mask == 0) {
+        for (size_t e = 0; e < NUM_EVENTS; e++) {
+            mask |= events[e].mask;
+        }
+    }
+
+    if (trace_ioctl(fd, TRACEIO_RESET, 0) < 0 ||
+        trace_ioctl(fd, TRACEIO_SET_EVENTS, mask) < 0) {
+        fail("cannot start tracing");
+    }
+}
+
+/* Records moved per read */
+static char buffer[128 * TRACE_RECORD_SIZE];
+
+static void dump(long fd, const char *path) {
+    /* Or this loop's own syscalls would keep the rings from emptying */
+    if (trace_ioctl(fd, TRACEIO_SET_EVENTS, 0) < 0) {
+        fail("cannot stop tracing");
+    }
+
+    long out = syscall3(SYS_OPEN, (long)path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        fail("cannot create output file");
+    }
+
+    unsigned long records = 0;
+    long n;
+    while ((n = syscall3(SYS_READ, fd, (long)buffer, sizeof(buffer))) > 0) {
+        if (syscall3(SYS_WRITE, out, (long)buffer, n) != n) {
+            fail("write failed");
+        }
+        records += n / TRACE_RECORD_SIZE;
+    }
+    syscall2(SYS_CLOSE, out, 0);
+    if (n < 0) {
+        fail("read from /dev/trace failed");
+    }
+
+    print_num(records);
+    print(" records written to ");
+    print(path);
+    print("\n");
+}
+
+/* Entry point - argc in a0, argv in a1 */
+void _start(long argc, char **argv) {
+    /* Initialize gp for global data access */
+    __asm__ volatile (
+        ".option push\n"
+        ".option norelax\n"
+        "1: auipc gp, %%pcrel_hi(__global_pointer$)\n"
+        "   addi gp, gp, %%pcrel_lo(1b)\n"
+        ".option pop\n"
+        ::: "gp"
+    );
+
+    long fd = syscall3(SYS_OPEN, (long)"/dev/trace", O_RDONLY, 0);
+    if (fd < 0) {
+        fail("cannot open /dev/trace");
+    }
+
+    if (argc == 1) {
+        show(fd);
+    } else if (streq(argv[1], "on")) {
+        trace_on(fd, (int)argc, argv);
+    } else if (streq(argv[1], "off") && argc == 2) {
+        if (trace_ioctl(fd, TRACEIO_SET_EVENTS, 0) < 0) {
+            fail("cannot stop tracing");
+        }
+    } else if (streq(argv[1], "dump") && argc == 3) {
+        dump(fd, argv[2]);
+    } else {
+        usage();
+    }
+
+    syscall2(SYS_CLOSE, fd, 0);
+    syscall2(SYS_EXIT, 0, 0);
+}
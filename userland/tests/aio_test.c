@@ -0,0 +1,205 @@
+/**
+ * aio_test.c - Test program for asynchronous file I/O (lib/aio.h)
+ *
+ * Tests:
+ * 1. Bad requests and descriptors are refused at submission
+ * 2. Writes at given offsets complete and land in the file
+ * 3. Dozens of scattered reads in flight at once return the right data
+ * 4. poll() reports the context readable once something has finished
+ * 5. Reads at end of file return 0, and a context closed with requests
+ *    in flight is cleaned up
+ */
+
+#include "../lib/ustdio.h"
+#include "../lib/aio.h"
+
+/* Syscall numbers */
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_UNLINK        18
+#define SYS_POLL          71
+
+/* Open flags */
+#define O_RDONLY    0x0000
+#define O_WRONLY    0x0001
+#define O_RDWR      0x0002
+#define O_CREAT     0x0040
+#define O_TRUNC     0x0200
+#define O_NONBLOCK  0x0800
+
+#define POLLIN      0x0001
+
+#define FILE_PATH   "/tmp/aio_test.dat"
+#define CHUNK       4096
+#define CHUNKS      16
+#define READS       48
+#define READ_SIZE   500
+
+struct pollfd {
+    int fd;
+    short events;
+    short revents;
+};
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    printf("%s %s\n", ok ? "[PASS]" : "[FAIL]", name);
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+/* Byte the file holds at an offset */
+static unsigned char pattern(uint64_t offset) {
+    return (unsigned char)(offset * 7 + offset / 251);
+}
+
+static unsigned char chunks[CHUNKS][CHUNK];
+static unsigned char reads[READS][READ_SIZE];
+static uaio_iocb_t iocbs[READS];
+static uaio_event_t events[READS];
+
+/* Collect completions until count have come back */
+static int collect(int ctx, int count) {
+    int got = 0;
+    while (got < count) {
+        long n = uaio_getevents(ctx, events + got, (uint32_t)(count - got));
+        if (n <= 0) {
+            break;
+        }
+        got += (int)n;
+    }
+    return got;
+}
+
+void _start(void) {
+    printf("\n");
+    printf("========================================\n");
+    printf("     Asynchronous I/O Test Program\n");
+    printf("========================================\n\n");
+
+    int fd = (int)syscall3(SYS_OPEN, (long)FILE_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int ctx = uaio_setup(O_NONBLOCK);
+    check(fd >= 0 && ctx >= 0, "file and context created");
+
+    /* Test 1: Refused requests */
+    printf("\n[TEST 1] Refused requests...\n");
+    uaio_prep(&iocbs[0], 0, 7, fd, chunks[0], 16, 0);
+    check(uaio_submit(ctx, iocbs, 1) == -1, "an unknown opcode is refused");
+    uaio_prep(&iocbs[0], 0, UAIO_OP_READ, fd, chunks[0], UAIO_MAX_IO + 1, 0);
+    check(uaio_submit(ctx, iocbs, 1) == -1, "an oversized transfer is refused");
+    uaio_prep(&iocbs[0], 0, UAIO_OP_READ, 99, chunks[0], 16, 0);
+    check(uaio_submit(ctx, iocbs, 1) == -1, "a closed descriptor is refused");
+    uaio_prep(&iocbs[0], 0, UAIO_OP_READ, fd, chunks[0], 16, 0);
+    check(uaio_submit(fd, iocbs, 1) == -1, "a file is not a context");
+    check(uaio_getevents(ctx, events, 1) == -1, "nothing to read yet");
+
+    /* Test 2: Writes */
+    printf("\n[TEST 2] Writes at offsets...\n");
+    for (int i = 0; i < CHUNKS; i++) {
+        for (int j = 0; j < CHUNK; j++) {
+            chunks[i][j] = pattern((uint64_t)i * CHUNK + j);
+        }
+        /* Back to front, so only the offsets put them in place */
+        int c = CHUNKS - 1 - i;
+        uaio_prep(&iocbs[i], 100 + c, UAIO_OP_WRITE, fd, chunks[c], CHUNK, (uint64_t)c * CHUNK);
+    }
+    check(uaio_submit(ctx, iocbs, CHUNKS) == CHUNKS, "all writes queued");
+    /* The data is already copied: the buffers may change now */
+    memset(chunks, 0, sizeof(chunks));
+    struct pollfd pfd = { ctx, POLLIN, 0 };
+    syscall3(SYS_POLL, (long)&pfd, 1, -1);
+    int got = collect(ctx, CHUNKS);
+    int writes_ok = got == CHUNKS;
+    for (int i = 0; i < got; i++) {
+        if (events[i].result != CHUNK || events[i].error != 0 ||
+            events[i].user_data < 100 || events[i].user_data >= 100 + CHUNKS) {
+            writes_ok = 0;
+        }
+    }
+    check(writes_ok, "every write completed in full");
+
+    int rfd = (int)syscall3(SYS_OPEN, (long)FILE_PATH, O_RDONLY, 0);
+    long n = syscall3(SYS_READ, rfd, (long)chunks, sizeof(chunks));
+    int file_ok = n == (long)sizeof(chunks);
+    for (long i = 0; file_ok && i < n; i++) {
+        if (chunks[i / CHUNK][i % CHUNK] != pattern((uint64_t)i)) {
+            file_ok = 0;
+        }
+    }
+    check(file_ok, "the file holds every chunk in place");
+
+    /* Test 3: Many reads in flight */
+    printf("\n[TEST 3] Scattered reads...\n");
+    for (int i = 0; i < READS; i++) {
+        uint64_t offset = ((uint64_t)i * 7919) % (CHUNKS * CHUNK - READ_SIZE);
+        uaio_prep(&iocbs[i], (uint64_t)i, UAIO_OP_READ, rfd, reads[i], READ_SIZE, offset);
+    }
+    check(uaio_submit(ctx, iocbs, READS) == READS, "48 reads queued in one call");
+
+    /* Test 4: Readiness */
+    printf("\n[TEST 4] poll()...\n");
+    pfd.revents = 0;
+    long ready = syscall3(SYS_POLL, (long)&pfd, 1, 5000);
+    check(ready == 1 && (pfd.revents & POLLIN), "the context polls readable");
+
+    got = collect(ctx, READS);
+    int reads_ok = got == READS;
+    int seen[READS] = { 0 };
+    for (int i = 0; i < got; i++) {
+        uint64_t id = events[i].user_data;
+        if (id >= READS || seen[id] || events[i].result != READ_SIZE) {
+            reads_ok = 0;
+            continue;
+        }
+        seen[id] = 1;
+        for (int j = 0; j < READ_SIZE; j++) {
+            if (reads[id][j] != pattern(iocbs[id].offset + j)) {
+                reads_ok = 0;
+                break;
+            }
+        }
+    }
+    check(reads_ok, "each read returned its own bytes");
+    pfd.revents = 0;
+    check(syscall3(SYS_POLL, (long)&pfd, 1, 0) == 0, "drained, the context is not readable");
+
+    /* Test 5: End of file and early close */
+    printf("\n[TEST 5] End of file and close...\n");
+    uaio_prep(&iocbs[0], 1, UAIO_OP_READ, rfd, reads[0], READ_SIZE, CHUNKS * CHUNK);
+    int wfd = (int)syscall3(SYS_OPEN, (long)FILE_PATH, O_WRONLY, 0);
+    uaio_prep(&iocbs[1], 2, UAIO_OP_READ, wfd, reads[1], READ_SIZE, 0);
+    check(uaio_submit(ctx, iocbs, 2) == 1, "a write-only descriptor stops the batch");
+    got = collect(ctx, 1);
+    check(got == 1 && events[0].user_data == 1 && events[0].result == 0, "a read at end of file returns 0");
+    syscall1(SYS_CLOSE, wfd);
+
+    for (int i = 0; i < READS; i++) {
+        uaio_prep(&iocbs[i], (uint64_t)i, UAIO_OP_READ, rfd, reads[i], READ_SIZE, (uint64_t)i * 100);
+    }
+    check(uaio_submit(ctx, iocbs, READS) == READS, "reads queued before closing");
+    check(syscall1(SYS_CLOSE, ctx) == 0, "the context closes with reads in flight");
+
+    ctx = uaio_setup(0);
+    uaio_prep(&iocbs[0], 5, UAIO_OP_READ, rfd, reads[0], 8, 8);
+    check(ctx >= 0 && uaio_submit(ctx, iocbs, 1) == 1 && collect(ctx, 1) == 1 &&
+          events[0].user_data == 5 && reads[0][0] == pattern(8), "a new context works");
+
+    syscall1(SYS_CLOSE, ctx);
+    syscall1(SYS_CLOSE, rfd);
+    syscall1(SYS_CLOSE, fd);
+    syscall1(SYS_UNLINK, (long)FILE_PATH);
+
+    /* Summary */
+    printf("\n========================================\n");
+    printf("Tests passed: %d\n", tests_passed);
+    printf("Tests failed: %d\n", tests_failed);
+    printf("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
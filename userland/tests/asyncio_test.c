@@ -0,0 +1,323 @@
+/**
+ * asyncio_test.c - Test program for concurrent disk I/O
+ *
+ * Disk requests now sleep until the device interrupt, so several
+ * processes can be inside the filesystem at once, each waiting for its
+ * own I/O. These tests run them side by side and check nothing is lost.
+ *
+ * Tests:
+ * 1. Several processes each write and verify their own file at once
+ * 2. Several processes read the same file at once
+ * 3. Several processes create and remove files in the same directory
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_FORK          7
+#define SYS_WAIT          9
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_UNLINK        18
+
+/* Open flags */
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+
+#define STDOUT_FD 1
+
+/* Processes running at once in each test */
+#define WORKERS     3
+
+/* Each worker's file: 48 KB written and read in 4 KB pieces */
+#define PIECE       4096
+#define PIECES      12
+
+/* Create/remove cycles per worker */
+#define CYCLES      20
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long fork(void) {
+    return syscall1(SYS_FORK, 0);
+}
+
+static inline long waitpid(long pid, int *status) {
+    return syscall3(SYS_WAIT, pid, status, 0);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0644);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static char buf[PIECE];
+
+/* Byte expected at a file offset; salt tells files apart */
+static char pattern(long offset, int salt) {
+    return (char)((offset * 17 + offset / 509 + salt * 31) & 0xFF);
+}
+
+/* "/asyncio_<a><b>" with two letters picking the worker and the cycle */
+static void make_name(char *name, int a, int b) {
+    const char *prefix = "/asyncio_";
+    int i = 0;
+    while (prefix[i]) {
+        name[i] = prefix[i];
+        i++;
+    }
+    name[i++] = 'a' + a;
+    name[i++] = 'a' + b;
+    name[i] = '\0';
+}
+
+/* Write a worker's file; returns 1 if every piece was written */
+static int write_file(const char *path, int salt) {
+    int fd = open(path, O_RDWR | O_CREAT);
+    if (fd < 0) {
+        return 0;
+    }
+    int ok = 1;
+    for (long p = 0; p < PIECES; p++) {
+        for (long i = 0; i < PIECE; i++) {
+            buf[i] = pattern(p * PIECE + i, salt);
+        }
+        if (write(fd, buf, PIECE) != PIECE) {
+            ok = 0;
+            break;
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+/* Read a file back; returns 1 if it holds exactly the pattern */
+static int verify_file(const char *path, int salt) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        return 0;
+    }
+    int ok = 1;
+    for (long p = 0; p < PIECES && ok; p++) {
+        if (read(fd, buf, PIECE) != PIECE) {
+            ok = 0;
+            break;
+        }
+        for (long i = 0; i < PIECE; i++) {
+            if (buf[i] != pattern(p * PIECE + i, salt)) {
+                ok = 0;
+                break;
+            }
+        }
+    }
+    if (read(fd, buf, 1) != 0) {
+        ok = 0;
+    }
+    close(fd);
+    return ok;
+}
+
+/* Each worker's job; returns its exit code (0 on success) */
+static int own_file_worker(int id) {
+    char name[16];
+    make_name(name, id, 0);
+    if (!write_file(name, id) || !verify_file(name, id)) {
+        return 1;
+    }
+    return unlink(name) == 0 ? 0 : 1;
+}
+
+static int shared_read_worker(int id) {
+    (void)id;
+    char name[16];
+    make_name(name, WORKERS, 0);
+    return verify_file(name, WORKERS) ? 0 : 1;
+}
+
+static int create_remove_worker(int id) {
+    char name[16];
+    for (int c = 0; c < CYCLES; c++) {
+        make_name(name, id, c + 1);
+        int fd = open(name, O_RDWR | O_CREAT);
+        if (fd < 0 || write(fd, name, 12) != 12) {
+            return 1;
+        }
+        close(fd);
+        if (unlink(name) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Run WORKERS copies of a job at once; returns how many failed */
+static int run_workers(int (*job)(int)) {
+    long pids[WORKERS];
+    for (int i = 0; i < WORKERS; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            exit(job(i));
+        }
+    }
+    int failed = 0;
+    for (int i = 0; i < WORKERS; i++) {
+        int status = 0;
+        if (pids[i] < 0 || waitpid(pids[i], &status) != pids[i] || ((status >> 8) & 0xFF) != 0) {
+            failed++;
+        }
+    }
+    return failed;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    Concurrent Disk I/O Test Program\n");
+    print("========================================\n\n");
+
+    /* Test 1: Own files */
+    print("[TEST 1] Workers writing their own files...\n");
+    check(run_workers(own_file_worker) == 0, "every worker's file intact");
+
+    /* Test 2: Shared file */
+    print("\n[TEST 2] Workers reading one file...\n");
+    char shared[16];
+    make_name(shared, WORKERS, 0);
+    unlink(shared);
+    check(write_file(shared, WORKERS), "wrote the shared file");
+    check(run_workers(shared_read_worker) == 0, "every worker read it intact");
+    check(unlink(shared) == 0, "removed the shared file");
+
+    /* Test 3: One directory */
+    print("\n[TEST 3] Workers creating and removing files...\n");
+    check(run_workers(create_remove_worker) == 0, "every cycle succeeded");
+    int leftovers = 0;
+    for (int w = 0; w < WORKERS; w++) {
+        for (int c = 0; c < CYCLES; c++) {
+            char name[16];
+            make_name(name, w, c + 1);
+            int fd = open(name, O_RDWR);
+            if (fd >= 0) {
+                close(fd);
+                leftovers++;
+            }
+        }
+    }
+    check(leftovers == 0, "no files left behind");
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
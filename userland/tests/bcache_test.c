@@ -0,0 +1,288 @@
+/**
+ * bcache_test.c - Test program for the block buffer cache
+ *
+ * Tests:
+ * 1. A file larger than the cache (and past the direct and single
+ *    indirect blocks) reads back intact after being written
+ * 2. Partial overwrites in the middle of a block keep the rest of it
+ * 3. Repeated create/write/unlink cycles, which rewrite the same bitmap,
+ *    inode table and directory blocks each time
+ * 4. Space freed by unlink can be allocated again
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_GETTIME       12
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_UNLINK        18
+
+/* Open flags */
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+
+#define STDOUT_FD 1
+
+#define BIG_FILE    "/bcache_big.dat"
+#define SMALL_FILE  "/bcache_small.dat"
+
+/* 300 KB: more than BCACHE_MAX_BUFFERS blocks, and into the double
+ * indirect range on 1 KB blocks */
+#define CHUNK        1000
+#define BIG_CHUNKS   300
+#define CYCLES       50
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long gettime(void) {
+    return syscall1(SYS_GETTIME, 0);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0644);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static char chunk[CHUNK];
+
+/* Byte expected at a file offset */
+static char pattern(long offset) {
+    return (char)((offset * 7 + offset / 997) & 0xFF);
+}
+
+static void fill_chunk(long base) {
+    for (int i = 0; i < CHUNK; i++) {
+        chunk[i] = pattern(base + i);
+    }
+}
+
+/* Write BIG_CHUNKS chunks of the pattern; returns the number written */
+static int write_big_file(void) {
+    int fd = open(BIG_FILE, O_RDWR | O_CREAT);
+    if (fd < 0) {
+        return 0;
+    }
+    int written = 0;
+    for (int c = 0; c < BIG_CHUNKS; c++) {
+        fill_chunk((long)c * CHUNK);
+        if (write(fd, chunk, CHUNK) != CHUNK) {
+            break;
+        }
+        written++;
+    }
+    close(fd);
+    return written;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    Block Cache Test Program\n");
+    print("========================================\n\n");
+
+    /* Left over from an earlier run */
+    unlink(BIG_FILE);
+    unlink(SMALL_FILE);
+
+    /* Test 1: Large file */
+    print("[TEST 1] File larger than the cache...\n");
+    long start = gettime();
+    check(write_big_file() == BIG_CHUNKS, "wrote 300 KB");
+    print("  written in ");
+    print_num(gettime() - start);
+    print(" ms\n");
+
+    int fd = open(BIG_FILE, O_RDWR);
+    int bad_chunks = 0;
+    long total = 0;
+    start = gettime();
+    for (int c = 0; c < BIG_CHUNKS; c++) {
+        long n = read(fd, chunk, CHUNK);
+        if (n != CHUNK) {
+            bad_chunks++;
+            break;
+        }
+        total += n;
+        for (int i = 0; i < CHUNK; i++) {
+            if (chunk[i] != pattern((long)c * CHUNK + i)) {
+                bad_chunks++;
+                break;
+            }
+        }
+    }
+    print("  read back in ");
+    print_num(gettime() - start);
+    print(" ms\n");
+    check(fd >= 0 && total == (long)BIG_CHUNKS * CHUNK, "read back every byte");
+    check(bad_chunks == 0, "contents match");
+    check(read(fd, chunk, CHUNK) == 0, "end of file where expected");
+    close(fd);
+
+    /* Test 2: Partial overwrite */
+    print("\n[TEST 2] Partial block overwrites...\n");
+    fd = open(SMALL_FILE, O_RDWR | O_CREAT);
+    fill_chunk(0);
+    check(fd >= 0 && write(fd, chunk, CHUNK) == CHUNK, "wrote 1000 bytes");
+    close(fd);
+    fd = open(SMALL_FILE, O_RDWR);
+    char patch[10];
+    for (int i = 0; i < 10; i++) {
+        patch[i] = 'X';
+    }
+    /* Replace bytes 0-9 and keep 10-999 */
+    check(write(fd, patch, 10) == 10, "overwrote the first 10 bytes");
+    close(fd);
+    fd = open(SMALL_FILE, O_RDWR);
+    int ok = read(fd, chunk, CHUNK) == CHUNK;
+    for (int i = 0; ok && i < CHUNK; i++) {
+        ok = chunk[i] == (i < 10 ? 'X' : pattern(i));
+    }
+    check(ok, "rest of the block intact");
+    close(fd);
+    unlink(SMALL_FILE);
+
+    /* Test 3: Metadata churn */
+    print("\n[TEST 3] Create/write/unlink cycles...\n");
+    int failures = 0;
+    start = gettime();
+    for (int i = 0; i < CYCLES; i++) {
+        fd = open(SMALL_FILE, O_RDWR | O_CREAT);
+        if (fd < 0 || write(fd, chunk, 100) != 100) {
+            failures++;
+        }
+        close(fd);
+        if (unlink(SMALL_FILE) != 0) {
+            failures++;
+        }
+    }
+    print("  ");
+    print_num(CYCLES);
+    print(" cycles in ");
+    print_num(gettime() - start);
+    print(" ms\n");
+    check(failures == 0, "every cycle succeeded");
+    check(open(SMALL_FILE, O_RDWR) < 0, "file gone afterwards");
+
+    /* Test 4: Freed space is reusable */
+    print("\n[TEST 4] Reusing freed blocks...\n");
+    check(unlink(BIG_FILE) == 0, "large file removed");
+    check(write_big_file() == BIG_CHUNKS, "written again in the freed space");
+    check(unlink(BIG_FILE) == 0, "and removed again");
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
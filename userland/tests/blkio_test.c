@@ -0,0 +1,295 @@
+/**
+ * blkio_test.c - Test program for multi-block device requests
+ *
+ * Tests:
+ * 1. A file written in page-sized pieces reads back intact through
+ *    large reads, which fetch runs of blocks in single requests
+ * 2. Two files written in alternating small pieces, so their blocks
+ *    interleave on disk and every run is short
+ * 3. A large read starting and ending in the middle of blocks
+ * 4. A rewrite spanning several blocks reaches the disk in place
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_GETTIME       12
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_LSEEK         15
+#define SYS_UNLINK        18
+
+/* Open flags */
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+
+#define SEEK_SET  0
+
+#define STDOUT_FD 1
+
+#define SEQ_FILE    "/blkio_seq.dat"
+#define ODD_FILE    "/blkio_odd.dat"
+#define EVEN_FILE   "/blkio_even.dat"
+
+/* 128 KB file written 4 KB at a time and read 32 KB at a time */
+#define PIECE       4096
+#define FILE_SIZE   (32 * PIECE)
+#define BIG_READ    (8 * PIECE)
+
+/* Interleaved files: 64 pieces of 1000 bytes each */
+#define SMALL       1000
+#define SMALL_COUNT 64
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long gettime(void) {
+    return syscall1(SYS_GETTIME, 0);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0644);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long lseek(int fd, long offset, int whence) {
+    return syscall3(SYS_LSEEK, fd, offset, whence);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static char buf[BIG_READ];
+
+/* Byte expected at a file offset; salt tells files apart */
+static char pattern(long offset, int salt) {
+    return (char)((offset * 11 + offset / 1021 + salt) & 0xFF);
+}
+
+static void fill(char *data, long offset, long len, int salt) {
+    for (long i = 0; i < len; i++) {
+        data[i] = pattern(offset + i, salt);
+    }
+}
+
+static int matches(const char *data, long offset, long len, int salt) {
+    for (long i = 0; i < len; i++) {
+        if (data[i] != pattern(offset + i, salt)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Read a whole file in BIG_READ pieces and compare; returns 1 if intact */
+static int verify_file(const char *path, long size, int salt) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        return 0;
+    }
+    int ok = 1;
+    long total = 0;
+    while (total < size) {
+        long n = read(fd, buf, BIG_READ);
+        if (n <= 0 || !matches(buf, total, n, salt)) {
+            ok = 0;
+            break;
+        }
+        total += n;
+    }
+    if (read(fd, buf, 1) != 0) {
+        ok = 0;
+    }
+    close(fd);
+    return ok && total == size;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    Block I/O Test Program\n");
+    print("========================================\n\n");
+
+    /* Left over from an earlier run */
+    unlink(SEQ_FILE);
+    unlink(ODD_FILE);
+    unlink(EVEN_FILE);
+
+    /* Test 1: Sequential file */
+    print("[TEST 1] Large reads of a contiguous file...\n");
+    int fd = open(SEQ_FILE, O_RDWR | O_CREAT);
+    int written = 0;
+    for (long off = 0; off < FILE_SIZE; off += PIECE) {
+        fill(buf, off, PIECE, 0);
+        if (write(fd, buf, PIECE) == PIECE) {
+            written++;
+        }
+    }
+    close(fd);
+    check(fd >= 0 && written == FILE_SIZE / PIECE, "wrote 128 KB");
+    long start = gettime();
+    check(verify_file(SEQ_FILE, FILE_SIZE, 0), "read back intact");
+    print("  ");
+    print_num(FILE_SIZE / BIG_READ);
+    print(" reads of 32 KB in ");
+    print_num(gettime() - start);
+    print(" ms\n");
+
+    /* Test 2: Interleaved files */
+    print("\n[TEST 2] Interleaved files...\n");
+    int odd = open(ODD_FILE, O_RDWR | O_CREAT);
+    int even = open(EVEN_FILE, O_RDWR | O_CREAT);
+    int failures = 0;
+    for (long i = 0; i < SMALL_COUNT; i++) {
+        fill(buf, i * SMALL, SMALL, 1);
+        if (write(odd, buf, SMALL) != SMALL) {
+            failures++;
+        }
+        fill(buf, i * SMALL, SMALL, 2);
+        if (write(even, buf, SMALL) != SMALL) {
+            failures++;
+        }
+    }
+    close(odd);
+    close(even);
+    check(odd >= 0 && even >= 0 && failures == 0, "wrote both files in turns");
+    check(verify_file(ODD_FILE, SMALL * SMALL_COUNT, 1), "first file intact");
+    check(verify_file(EVEN_FILE, SMALL * SMALL_COUNT, 2), "second file intact");
+
+    /* Test 3: Unaligned large read */
+    print("\n[TEST 3] Unaligned large read...\n");
+    fd = open(SEQ_FILE, O_RDWR);
+    lseek(fd, 1500, SEEK_SET);
+    check(read(fd, buf, 20000) == 20000 && matches(buf, 1500, 20000, 0),
+          "20000 bytes from offset 1500");
+    close(fd);
+
+    /* Test 4: Rewrite in place */
+    print("\n[TEST 4] Rewrite spanning several blocks...\n");
+    fd = open(SEQ_FILE, O_RDWR);
+    lseek(fd, 10000, SEEK_SET);
+    fill(buf, 10000, 6000, 3);
+    check(write(fd, buf, 6000) == 6000, "rewrote 6000 bytes at offset 10000");
+    close(fd);
+    fd = open(SEQ_FILE, O_RDWR);
+    check(read(fd, buf, BIG_READ) == BIG_READ && matches(buf, 0, 10000, 0) &&
+          matches(buf + 10000, 10000, 6000, 3) &&
+          matches(buf + 16000, 16000, BIG_READ - 16000, 0),
+          "new bytes in place, the rest unchanged");
+    close(fd);
+
+    check(unlink(SEQ_FILE) == 0 && unlink(ODD_FILE) == 0 && unlink(EVEN_FILE) == 0,
+          "removed the test files");
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,306 @@
+/**
+ * dcache_test.c - Test program for the dentry cache
+ *
+ * Tests:
+ * 1. A missing name stays missing when looked up again (negative entry)
+ * 2. Creating the name makes it visible at once, and changes through one
+ *    descriptor are seen by the next stat()
+ * 3. Unlinking the name makes it missing again
+ * 4. mkdir()/rmdir() are seen the same way, and a directory can be
+ *    recreated under the same name
+ * 5. Repeated lookups of the same paths, hit and miss
+ * 6. More names than the cache holds still resolve correctly
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_GETTIME       12
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_STAT          16
+#define SYS_MKDIR         17
+#define SYS_UNLINK        18
+#define SYS_RMDIR         19
+#define SYS_CHMOD         41
+
+/* Open flags */
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+
+/* vfs_stat_t types */
+#define TYPE_FILE       1
+#define TYPE_DIRECTORY  2
+
+#define STDOUT_FD 1
+
+#define TEST_FILE   "/dcache_test.txt"
+#define TEST_DIR    "/dcache_test_dir"
+
+/* Lookups timed in test 5; more distinct names than the cache holds in 6 */
+#define LOOKUPS     2000
+#define MANY_NAMES  300
+
+typedef struct {
+    uint32_t st_ino;
+    uint16_t st_mode;
+    uint16_t st_uid;
+    uint16_t st_gid;
+    uint16_t st_pad;
+    uint32_t st_size;
+    uint32_t st_type;
+    uint32_t st_size_high;
+} stat_t;
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long gettime(void) {
+    return syscall1(SYS_GETTIME, 0);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0644);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long stat(const char *path, stat_t *st) {
+    return syscall2(SYS_STAT, path, st);
+}
+
+static inline long mkdir(const char *path) {
+    return syscall2(SYS_MKDIR, path, 0755);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+static inline long rmdir(const char *path) {
+    return syscall1(SYS_RMDIR, path);
+}
+
+static inline long chmod(const char *path, int mode) {
+    return syscall2(SYS_CHMOD, path, mode);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+/* "/dcache_missing_<n>" */
+static void missing_name(char *buf, int n) {
+    const char *prefix = "/dcache_missing_";
+    int i = 0;
+    while (prefix[i]) {
+        buf[i] = prefix[i];
+        i++;
+    }
+    buf[i++] = '0' + (n / 100) % 10;
+    buf[i++] = '0' + (n / 10) % 10;
+    buf[i++] = '0' + n % 10;
+    buf[i] = '\0';
+}
+
+/* Time LOOKUPS stat() calls of one path; returns how many succeeded */
+static long time_lookups(const char *path, const char *label) {
+    stat_t st;
+    long found = 0;
+    long start = gettime();
+    for (int i = 0; i < LOOKUPS; i++) {
+        if (stat(path, &st) == 0) {
+            found++;
+        }
+    }
+    print("  ");
+    print(label);
+    print(": ");
+    print_num(LOOKUPS);
+    print(" lookups in ");
+    print_num(gettime() - start);
+    print(" ms\n");
+    return found;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    Dentry Cache Test Program\n");
+    print("========================================\n\n");
+
+    stat_t st;
+
+    /* Left over from an earlier run */
+    unlink(TEST_FILE);
+    rmdir(TEST_DIR);
+
+    /* Test 1: Negative entries */
+    print("[TEST 1] Missing names...\n");
+    check(stat(TEST_FILE, &st) < 0, "missing file not found");
+    check(stat(TEST_FILE, &st) < 0, "still not found the second time");
+    check(open(TEST_FILE, O_RDWR) < 0, "open without O_CREAT fails");
+
+    /* Test 2: Creation */
+    print("\n[TEST 2] Creating the name...\n");
+    int fd = open(TEST_FILE, O_RDWR | O_CREAT);
+    check(fd >= 0, "created with O_CREAT");
+    check(stat(TEST_FILE, &st) == 0 && st.st_type == TYPE_FILE && st.st_size == 0,
+          "new file found at once");
+    char data[100];
+    for (int i = 0; i < 100; i++) {
+        data[i] = (char)i;
+    }
+    check(write(fd, data, sizeof(data)) == sizeof(data), "wrote 100 bytes");
+    check(stat(TEST_FILE, &st) == 0 && st.st_size == sizeof(data), "stat() sees the new size");
+    close(fd);
+    check(chmod(TEST_FILE, 0600) == 0 && stat(TEST_FILE, &st) == 0 && (st.st_mode & 0777) == 0600,
+          "stat() sees chmod()");
+    fd = open(TEST_FILE, O_RDWR);
+    check(fd >= 0, "reopened by name");
+    close(fd);
+
+    /* Test 3: Removal */
+    print("\n[TEST 3] Unlinking the name...\n");
+    check(unlink(TEST_FILE) == 0, "unlinked");
+    check(stat(TEST_FILE, &st) < 0, "gone from stat()");
+    check(open(TEST_FILE, O_RDWR) < 0, "gone from open()");
+    check(unlink(TEST_FILE) < 0, "second unlink fails");
+
+    /* Test 4: Directories */
+    print("\n[TEST 4] mkdir() and rmdir()...\n");
+    check(stat(TEST_DIR, &st) < 0, "directory missing before mkdir()");
+    check(mkdir(TEST_DIR) == 0, "directory created");
+    check(stat(TEST_DIR, &st) == 0 && st.st_type == TYPE_DIRECTORY, "found as a directory");
+    check(stat(TEST_DIR "/inner", &st) < 0, "empty directory has no entries");
+    check(rmdir(TEST_DIR) == 0, "directory removed");
+    check(stat(TEST_DIR, &st) < 0, "gone after rmdir()");
+    check(mkdir(TEST_DIR) == 0 && stat(TEST_DIR, &st) == 0, "recreated under the same name");
+    check(stat(TEST_DIR "/inner", &st) < 0, "recreated directory is empty");
+    rmdir(TEST_DIR);
+
+    /* Test 5: Repeated lookups */
+    print("\n[TEST 5] Repeated lookups...\n");
+    check(time_lookups("/bin/dcache_test", "existing") == LOOKUPS, "existing path found every time");
+    check(time_lookups("/bin/no_such_program", "missing") == 0, "missing path missed every time");
+
+    /* Test 6: More names than the cache holds */
+    print("\n[TEST 6] More names than the cache holds...\n");
+    char name[32];
+    int wrong = 0;
+    for (int n = 0; n < MANY_NAMES; n++) {
+        missing_name(name, n);
+        if (stat(name, &st) == 0) {
+            wrong++;
+        }
+    }
+    for (int n = 0; n < MANY_NAMES; n++) {
+        missing_name(name, n);
+        if (stat(name, &st) == 0) {
+            wrong++;
+        }
+    }
+    check(wrong == 0, "evicted names still missing");
+    check(stat("/bin/dcache_test", &st) == 0 && st.st_type == TYPE_FILE, "existing path still found");
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,291 @@
+/**
+ * delalloc_test.c - Test program for delayed write-back
+ *
+ * write() to a regular file only fills dirty pages in the page cache;
+ * ext2 allocates blocks and writes them when the flusher thread (or a
+ * writer over the dirty limit) writes the file back. Until then readers
+ * must still see the new data and size, and a file removed before
+ * write-back must not leave its data behind.
+ *
+ * Tests:
+ * 1. Many small appends, read back while still open
+ * 2. The same file reopened after the flusher has had time to run
+ * 3. Overwriting part of a page keeps the rest of it
+ * 4. A file unlinked with unwritten data, then created again
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_SLEEP         5
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_LSEEK         15
+#define SYS_UNLINK        18
+
+/* Open flags */
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+#define O_APPEND  0x0400
+
+#define SEEK_SET  0
+#define SEEK_END  2
+
+#define STDOUT_FD 1
+
+/* Log file: RECORDS appends of RECORD bytes (a size that straddles pages) */
+#define RECORD    100
+#define RECORDS   1000
+#define LOG_SIZE  ((long)RECORD * RECORDS)
+
+/* Longer than the flusher's dirty expiry plus one of its periods */
+#define FLUSH_WAIT_MS 7000
+
+/* Overwrite in test 3: inside one page, not on a block boundary */
+#define PATCH_OFFSET 5000
+#define PATCH_LEN    300
+
+#define LOG_FILE  "/delalloc_log"
+#define TMP_FILE  "/delalloc_tmp"
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0644);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long lseek(int fd, long offset, int whence) {
+    return syscall3(SYS_LSEEK, fd, offset, whence);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+static inline long sleep_ms(long ms) {
+    return syscall1(SYS_SLEEP, ms);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static char buf[4096];
+
+/* Byte expected at a log offset; salt tells versions apart */
+static char pattern(long offset, int salt) {
+    return (char)((offset * 13 + offset / 251 + salt * 29) & 0xFF);
+}
+
+/* Append the log record by record; returns 1 if all were written */
+static int append_log(int fd, int salt) {
+    for (long r = 0; r < RECORDS; r++) {
+        for (long i = 0; i < RECORD; i++) {
+            buf[i] = pattern(r * RECORD + i, salt);
+        }
+        if (write(fd, buf, RECORD) != RECORD) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Byte expected in the log after test 3 */
+static char expected(long offset) {
+    if (offset >= PATCH_OFFSET && offset < PATCH_OFFSET + PATCH_LEN) {
+        return pattern(offset, 7);
+    }
+    return pattern(offset, 0);
+}
+
+/* Read the whole log from fd's position 0; returns 1 if it matches */
+static int verify_log(int fd, int patched) {
+    if (lseek(fd, 0, SEEK_SET) != 0) {
+        return 0;
+    }
+    long offset = 0;
+    while (offset < LOG_SIZE) {
+        long n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            return 0;
+        }
+        for (long i = 0; i < n; i++) {
+            char want = patched ? expected(offset + i) : pattern(offset + i, 0);
+            if (buf[i] != want) {
+                return 0;
+            }
+        }
+        offset += n;
+    }
+    return offset == LOG_SIZE && read(fd, buf, 1) == 0;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    Delayed Write-Back Test Program\n");
+    print("========================================\n\n");
+
+    unlink(LOG_FILE);
+    unlink(TMP_FILE);
+
+    /* Test 1: Small appends */
+    print("[TEST 1] Appending small records...\n");
+    int fd = open(LOG_FILE, O_RDWR | O_CREAT | O_APPEND);
+    check(fd >= 0, "created the log");
+    check(fd >= 0 && append_log(fd, 0), "appended every record");
+    check(lseek(fd, 0, SEEK_END) == LOG_SIZE, "size counts every record");
+    check(verify_log(fd, 0), "contents read back before write-back");
+    close(fd);
+
+    /* Test 2: After the flusher */
+    print("\n[TEST 2] Reopening after the flusher has run...\n");
+    sleep_ms(FLUSH_WAIT_MS);
+    fd = open(LOG_FILE, O_RDWR);
+    check(fd >= 0, "reopened the log");
+    check(lseek(fd, 0, SEEK_END) == LOG_SIZE, "size survived write-back");
+    check(verify_log(fd, 0), "contents survived write-back");
+
+    /* Test 3: Partial-page overwrite */
+    print("\n[TEST 3] Overwriting part of a page...\n");
+    for (long i = 0; i < PATCH_LEN; i++) {
+        buf[i] = pattern(PATCH_OFFSET + i, 7);
+    }
+    check(lseek(fd, PATCH_OFFSET, SEEK_SET) == PATCH_OFFSET &&
+          write(fd, buf, PATCH_LEN) == PATCH_LEN, "overwrote the range");
+    check(lseek(fd, 0, SEEK_END) == LOG_SIZE, "size unchanged");
+    check(verify_log(fd, 1), "new range and surrounding bytes correct");
+    close(fd);
+    sleep_ms(FLUSH_WAIT_MS);
+    fd = open(LOG_FILE, O_RDWR);
+    check(fd >= 0 && verify_log(fd, 1), "overwrite survived write-back");
+    if (fd >= 0) {
+        close(fd);
+    }
+    check(unlink(LOG_FILE) == 0, "removed the log");
+
+    /* Test 4: Unlinked before write-back */
+    print("\n[TEST 4] Removing a file before write-back...\n");
+    fd = open(TMP_FILE, O_RDWR | O_CREAT);
+    check(fd >= 0 && append_log(fd, 3), "wrote the file");
+    if (fd >= 0) {
+        close(fd);
+    }
+    check(unlink(TMP_FILE) == 0, "removed it");
+    fd = open(TMP_FILE, O_RDWR | O_CREAT);
+    check(fd >= 0 && lseek(fd, 0, SEEK_END) == 0, "new file of that name is empty");
+    check(fd >= 0 && read(fd, buf, 1) == 0, "reads nothing");
+    if (fd >= 0) {
+        close(fd);
+    }
+    check(unlink(TMP_FILE) == 0, "removed the new file");
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,392 @@
+/**
+ * dirindex_test.c - Test program for ext2 directory lookups
+ *
+ * A directory is indexed in memory the first time it is searched or
+ * listed, and every later create and unlink has to keep that index, the
+ * on-disk blocks and readdir() in agreement.
+ *
+ * Tests:
+ * 1. Creating enough files to span several directory blocks
+ * 2. Every name is found, and names never created are not
+ * 3. getdents() returns each name exactly once
+ * 4. Unlinking every other file; the rest are still found and listed
+ * 5. Creating the removed names again reuses the freed entries
+ * 6. Unlinking names already listed while a listing is under way does
+ *    not make it skip or repeat the rest
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_MKDIR         17
+#define SYS_UNLINK        18
+#define SYS_RMDIR         19
+#define SYS_GETDENTS      27
+
+/* Open flags */
+#define O_RDONLY  0x0000
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+
+#define STDOUT_FD 1
+
+/* More entries than several 1 KiB directory blocks hold */
+#define FILES     500
+
+#define TEST_DIR  "/dirindex_test"
+
+/* Layout of one getdents() record */
+typedef struct {
+    uint32_t d_ino;
+    uint16_t d_reclen;
+    uint8_t  d_type;
+    char     d_name[256];
+} dirent_t;
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0644);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long mkdir(const char *path) {
+    return syscall2(SYS_MKDIR, path, 0755);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+static inline long rmdir(const char *path) {
+    return syscall1(SYS_RMDIR, path);
+}
+
+static inline long getdents(int fd, void *buf, size_t len) {
+    return syscall3(SYS_GETDENTS, fd, buf, len);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static char path[64];
+static dirent_t dirents[16];
+static uint8_t seen[FILES];
+
+/* TEST_DIR/<prefix><3-digit n>; long names fill directory blocks quickly */
+static const char *file_path(const char *prefix, int n) {
+    size_t len = 0;
+    const char *dir = TEST_DIR "/";
+    while (*dir) {
+        path[len++] = *dir++;
+    }
+    while (*prefix) {
+        path[len++] = *prefix++;
+    }
+    path[len++] = '0' + (n / 100) % 10;
+    path[len++] = '0' + (n / 10) % 10;
+    path[len++] = '0' + n % 10;
+    path[len] = '\0';
+    return path;
+}
+
+static const char *PREFIX = "directory_index_entry_";
+
+/* File number of a listed name, or -1 if it is not one of ours */
+static int file_number(const char *name) {
+    size_t prefix_len = strlen(PREFIX);
+    for (size_t i = 0; i < prefix_len; i++) {
+        if (name[i] != PREFIX[i]) {
+            return -1;
+        }
+    }
+    const char *digits = name + prefix_len;
+    if (strlen(digits) != 3) {
+        return -1;
+    }
+    int n = 0;
+    for (int i = 0; i < 3; i++) {
+        if (digits[i] < '0' || digits[i] > '9') {
+            return -1;
+        }
+        n = n * 10 + (digits[i] - '0');
+    }
+    return n < FILES ? n : -1;
+}
+
+static int exists(int n) {
+    int fd = open(file_path(PREFIX, n), O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    close(fd);
+    return 1;
+}
+
+static int create(int n) {
+    int fd = open(file_path(PREFIX, n), O_RDWR | O_CREAT);
+    if (fd < 0) {
+        return 0;
+    }
+    close(fd);
+    return 1;
+}
+
+/* List TEST_DIR; returns 1 if exactly the files with (n % step) == 0
+ * appear, each once, besides "." and ".." */
+static int list_matches(int step) {
+    for (int n = 0; n < FILES; n++) {
+        seen[n] = 0;
+    }
+    int fd = open(TEST_DIR, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    int ok = 1;
+    int dots = 0;
+    long bytes;
+    while ((bytes = getdents(fd, dirents, sizeof(dirents))) > 0) {
+        for (long i = 0; i < bytes / (long)sizeof(dirent_t); i++) {
+            const char *name = dirents[i].d_name;
+            if ((name[0] == '.' && name[1] == '\0') ||
+                (name[0] == '.' && name[1] == '.' && name[2] == '\0')) {
+                dots++;
+                continue;
+            }
+            int n = file_number(name);
+            if (n < 0 || seen[n] || n % step != 0) {
+                ok = 0;
+            } else {
+                seen[n] = 1;
+            }
+        }
+    }
+    close(fd);
+    if (bytes < 0 || dots != 2) {
+        return 0;
+    }
+    for (int n = 0; n < FILES; n++) {
+        if (seen[n] != (n % step == 0)) {
+            ok = 0;
+        }
+    }
+    return ok;
+}
+
+/* Start listing TEST_DIR, unlink every file seen after each getdents()
+ * call, and finish; returns 1 if each file was listed exactly once */
+static int list_while_unlinking(void) {
+    for (int n = 0; n < FILES; n++) {
+        seen[n] = 0;
+    }
+    int fd = open(TEST_DIR, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    int ok = 1;
+    long bytes;
+    while ((bytes = getdents(fd, dirents, sizeof(dirents))) > 0) {
+        for (long i = 0; i < bytes / (long)sizeof(dirent_t); i++) {
+            int n = file_number(dirents[i].d_name);
+            if (n < 0) {
+                continue;
+            }
+            if (seen[n]) {
+                ok = 0;
+            }
+            seen[n] = 1;
+            if (unlink(file_path(PREFIX, n)) != 0) {
+                ok = 0;
+            }
+        }
+    }
+    close(fd);
+    for (int n = 0; n < FILES; n++) {
+        if (!seen[n]) {
+            ok = 0;
+        }
+    }
+    return ok && bytes == 0;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    Directory Index Test Program\n");
+    print("========================================\n\n");
+
+    for (int n = 0; n < FILES; n++) {
+        unlink(file_path(PREFIX, n));
+    }
+    rmdir(TEST_DIR);
+
+    /* Test 1: Create */
+    print("[TEST 1] Creating ");
+    print_num(FILES);
+    print(" files in one directory...\n");
+    check(mkdir(TEST_DIR) == 0, "created the directory");
+    int created = 0;
+    for (int n = 0; n < FILES; n++) {
+        created += create(n);
+    }
+    check(created == FILES, "created every file");
+
+    /* Test 2: Lookup */
+    print("\n[TEST 2] Looking every name up...\n");
+    int found = 0;
+    for (int n = 0; n < FILES; n++) {
+        found += exists(n);
+    }
+    check(found == FILES, "found every name");
+    check(open(file_path("missing_", 7), O_RDONLY) < 0, "missing name not found");
+    check(open(file_path("directory_index_entry_x", 1), O_RDONLY) < 0,
+          "longer name with the same prefix not found");
+
+    /* Test 3: Listing */
+    print("\n[TEST 3] Listing the directory...\n");
+    check(list_matches(1), "each name listed once");
+
+    /* Test 4: Unlink half */
+    print("\n[TEST 4] Unlinking every other file...\n");
+    int removed = 0;
+    for (int n = 1; n < FILES; n += 2) {
+        removed += unlink(file_path(PREFIX, n)) == 0;
+    }
+    check(removed == FILES / 2, "unlinked every odd file");
+    int right = 0;
+    for (int n = 0; n < FILES; n++) {
+        right += exists(n) == (n % 2 == 0);
+    }
+    check(right == FILES, "even files found, odd files gone");
+    check(list_matches(2), "only even files listed");
+
+    /* Test 5: Create again */
+    print("\n[TEST 5] Creating the removed names again...\n");
+    created = 0;
+    for (int n = 1; n < FILES; n += 2) {
+        created += create(n);
+    }
+    check(created == FILES / 2, "recreated every odd file");
+    found = 0;
+    for (int n = 0; n < FILES; n++) {
+        found += exists(n);
+    }
+    check(found == FILES, "found every name");
+    check(list_matches(1), "each name listed once");
+
+    /* Test 6: Unlink during a listing */
+    print("\n[TEST 6] Unlinking files while listing the directory...\n");
+    check(list_while_unlinking(), "each name listed once while being removed");
+    found = 0;
+    for (int n = 0; n < FILES; n++) {
+        found += exists(n);
+    }
+    check(found == 0, "every file gone");
+    check(rmdir(TEST_DIR) == 0, "removed the empty directory");
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,352 @@
+/**
+ * elevator_test.c - Test program for the block request queue
+ *
+ * Disk I/O is queued, merged with neighbouring sectors and reordered
+ * (reads ahead of write-back, each direction swept in sector order)
+ * before it reaches the device. Reordering must never change what a
+ * file holds: these tests issue I/O in awkward orders and mixes and
+ * check every byte comes back.
+ *
+ * Tests:
+ * 1. A process reads a file while another forces write-back
+ * 2. Several files written a piece at a time, in turn
+ * 3. A file written back to front
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_FORK          7
+#define SYS_WAIT          9
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_LSEEK         15
+#define SYS_UNLINK        18
+
+/* Open flags */
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+
+#define SEEK_SET  0
+
+#define STDOUT_FD 1
+
+/* Each file: 48 KB written and read in 4 KB pieces */
+#define PIECE       4096
+#define PIECES      12
+
+/* Files written together, and by the write-back process */
+#define FILES       3
+
+/* Times the reader goes over its file during write-back */
+#define READ_PASSES 4
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long fork(void) {
+    return syscall1(SYS_FORK, 0);
+}
+
+static inline long waitpid(long pid, int *status) {
+    return syscall3(SYS_WAIT, pid, status, 0);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0644);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long lseek(int fd, long offset, int whence) {
+    return syscall3(SYS_LSEEK, fd, offset, whence);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static char buf[PIECE];
+
+/* Byte expected at a file offset; salt tells files apart */
+static char pattern(long offset, int salt) {
+    return (char)((offset * 17 + offset / 509 + salt * 31) & 0xFF);
+}
+
+/* "/elevator_<a>" with a letter picking the file */
+static void make_name(char *name, int a) {
+    const char *prefix = "/elevator_";
+    int i = 0;
+    while (prefix[i]) {
+        name[i] = prefix[i];
+        i++;
+    }
+    name[i++] = 'a' + a;
+    name[i] = '\0';
+}
+
+static void fill_piece(long p, int salt) {
+    for (long i = 0; i < PIECE; i++) {
+        buf[i] = pattern(p * PIECE + i, salt);
+    }
+}
+
+/* Write a file front to back; returns 1 if every piece was written */
+static int write_file(const char *path, int salt) {
+    int fd = open(path, O_RDWR | O_CREAT);
+    if (fd < 0) {
+        return 0;
+    }
+    int ok = 1;
+    for (long p = 0; p < PIECES; p++) {
+        fill_piece(p, salt);
+        if (write(fd, buf, PIECE) != PIECE) {
+            ok = 0;
+            break;
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+/* Read a file back; returns 1 if it holds exactly the pattern */
+static int verify_file(const char *path, int salt) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        return 0;
+    }
+    int ok = 1;
+    for (long p = 0; p < PIECES && ok; p++) {
+        if (read(fd, buf, PIECE) != PIECE) {
+            ok = 0;
+            break;
+        }
+        for (long i = 0; i < PIECE; i++) {
+            if (buf[i] != pattern(p * PIECE + i, salt)) {
+                ok = 0;
+                break;
+            }
+        }
+    }
+    if (read(fd, buf, 1) != 0) {
+        ok = 0;
+    }
+    close(fd);
+    return ok;
+}
+
+/* Dirties more blocks than the cache holds back, forcing write-back */
+static int writeback_worker(void) {
+    char name[16];
+    for (int f = 0; f < FILES; f++) {
+        make_name(name, 1 + f);
+        if (!write_file(name, 1 + f)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    Block Request Queue Test Program\n");
+    print("========================================\n\n");
+
+    char name[16];
+    for (int f = 0; f < 1 + FILES; f++) {
+        make_name(name, f);
+        unlink(name);
+    }
+
+    /* Test 1: Reads during write-back */
+    print("[TEST 1] Reading while another process writes back...\n");
+    char reader_file[16];
+    make_name(reader_file, 0);
+    check(write_file(reader_file, 0), "wrote the reader's file");
+    long pid = fork();
+    if (pid == 0) {
+        exit(writeback_worker());
+    }
+    int reads_ok = 1;
+    for (int pass = 0; pass < READ_PASSES; pass++) {
+        if (!verify_file(reader_file, 0)) {
+            reads_ok = 0;
+        }
+    }
+    int status = 0;
+    check(pid > 0 && waitpid(pid, &status) == pid && ((status >> 8) & 0xFF) == 0,
+          "writer finished");
+    check(reads_ok, "every read pass intact");
+    int written_ok = 1;
+    for (int f = 0; f < FILES; f++) {
+        make_name(name, 1 + f);
+        if (!verify_file(name, 1 + f) || unlink(name) != 0) {
+            written_ok = 0;
+        }
+    }
+    check(written_ok, "written files intact");
+
+    /* Test 2: Interleaved files */
+    print("\n[TEST 2] Writing several files a piece at a time...\n");
+    int fds[FILES];
+    int opened = 1;
+    for (int f = 0; f < FILES; f++) {
+        make_name(name, 1 + f);
+        fds[f] = open(name, O_RDWR | O_CREAT);
+        if (fds[f] < 0) {
+            opened = 0;
+        }
+    }
+    check(opened, "opened every file");
+    int interleaved_ok = opened;
+    for (long p = 0; p < PIECES && interleaved_ok; p++) {
+        for (int f = 0; f < FILES; f++) {
+            fill_piece(p, 1 + f);
+            if (write(fds[f], buf, PIECE) != PIECE) {
+                interleaved_ok = 0;
+            }
+        }
+    }
+    for (int f = 0; f < FILES; f++) {
+        if (fds[f] >= 0) {
+            close(fds[f]);
+        }
+    }
+    check(interleaved_ok, "wrote every piece");
+    int files_ok = 1;
+    for (int f = 0; f < FILES; f++) {
+        make_name(name, 1 + f);
+        if (!verify_file(name, 1 + f) || unlink(name) != 0) {
+            files_ok = 0;
+        }
+    }
+    check(files_ok, "every file intact");
+
+    /* Test 3: Back to front */
+    print("\n[TEST 3] Writing a file back to front...\n");
+    int fd = open(reader_file, O_RDWR);
+    int backward_ok = fd >= 0;
+    for (long p = PIECES - 1; p >= 0 && backward_ok; p--) {
+        fill_piece(p, 5);
+        if (lseek(fd, p * PIECE, SEEK_SET) != p * PIECE || write(fd, buf, PIECE) != PIECE) {
+            backward_ok = 0;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    check(backward_ok, "overwrote every piece");
+    check(verify_file(reader_file, 5), "file holds the new contents");
+    check(unlink(reader_file) == 0, "removed the file");
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,251 @@
+/**
+ * execcache_test.c - Test program for the exec image cache
+ *
+ * Re-execs itself (argv[1] = "child") to check what a new image sees.
+ *
+ * Tests:
+ * 1. Repeated execs of the same binary each start with fresh data and bss,
+ *    including arrays spanning several demand-loaded pages
+ * 2. Text shared with other processes cannot be written
+ * 3. A forked child reads the same text as its parent
+ */
+
+#include <stddef.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_FORK          7
+#define SYS_WAIT          9
+#define SYS_EXECVE        20
+
+#define STDOUT_FD 1
+
+/* Execs in the repeated exec test */
+#define NR_EXECS 10
+
+/* Exit codes of a child run */
+#define CHILD_FRESH   0
+#define CHILD_STALE   1
+
+#define SELF "/bin/execcache_test"
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const char *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long fork(void) {
+    return syscall1(SYS_FORK, 0);
+}
+
+static inline long waitpid(long pid, int *status) {
+    return syscall3(SYS_WAIT, pid, status, 0);
+}
+
+static inline long execve(const char *path, const char *argv[]) {
+    const char *envp[] = { NULL };
+    return syscall3(SYS_EXECVE, path, argv, envp);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static int streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static int exit_code(int status) {
+    return (status >> 8) & 0xFF;
+}
+
+/* Changed by every child run; a new image must start from these again */
+static volatile long initialised = 41;
+static volatile long zeroed;
+
+/* A few pages each, so they cover file, zero and copied pages */
+#define BIG_WORDS 2048
+static volatile long big_data[BIG_WORDS] = { 7, 8, 9 };
+static volatile long big_bss[BIG_WORDS];
+
+/* Run as a child: report whether our data looks freshly loaded */
+static void child_main(void) {
+    int fresh = (initialised == 41 && zeroed == 0);
+    fresh = fresh && big_data[0] == 7 && big_data[1] == 8 && big_data[2] == 9;
+    for (int i = 3; i < BIG_WORDS; i++) {
+        if (big_data[i] != 0) {
+            fresh = 0;
+        }
+    }
+    for (int i = 0; i < BIG_WORDS; i++) {
+        if (big_bss[i] != 0) {
+            fresh = 0;
+        }
+    }
+    
+    initialised = 0;
+    zeroed = 1;
+    for (int i = 0; i < BIG_WORDS; i++) {
+        big_data[i] = -1;
+        big_bss[i] = -1;
+    }
+    exit(fresh ? CHILD_FRESH : CHILD_STALE);
+}
+
+/* Fork and exec ourselves as a child; returns its exit code, or -1 */
+static int run_child(void) {
+    long pid = fork();
+    if (pid == 0) {
+        const char *argv[] = { SELF, "child", NULL };
+        execve(SELF, argv);
+        exit(99);
+    }
+    if (pid < 0) {
+        return -1;
+    }
+    int status = -1;
+    if (waitpid(pid, &status) != pid) {
+        return -1;
+    }
+    return exit_code(status);
+}
+
+/* Main test program */
+void _start(int argc, char **argv) {
+    if (argc > 1 && streq(argv[1], "child")) {
+        child_main();
+    }
+
+    print("\n");
+    print("========================================\n");
+    print("    Exec Image Cache Test Program\n");
+    print("========================================\n\n");
+
+    /* Test 1: Every exec gets its own copy of data and bss */
+    print("[TEST 1] ");
+    print_num(NR_EXECS);
+    print(" execs of the same binary...\n");
+    int fresh = 0;
+    for (int i = 0; i < NR_EXECS; i++) {
+        if (run_child() == CHILD_FRESH) {
+            fresh++;
+        }
+    }
+    check(fresh == NR_EXECS, "every exec starts with fresh .data and .bss");
+    check(initialised == 41 && zeroed == 0, "children's writes did not reach our data");
+
+    /* Test 2: Shared text is read-only */
+    print("\n[TEST 2] Writing to our own text...\n");
+    volatile unsigned int *text = (volatile unsigned int *)(void *)_start;
+    unsigned int first_insn = *text;
+    long pid = fork();
+    if (pid == 0) {
+        *text = 0;
+        exit(0);
+    }
+    int status = -1;
+    check(pid > 0 && waitpid(pid, &status) == pid && exit_code(status) != 0,
+          "write to text kills the writer");
+    check(*text == first_insn, "our text is unchanged");
+    check(run_child() == CHILD_FRESH, "a new exec still runs");
+
+    /* Test 3: A forked child sees the same text */
+    print("\n[TEST 3] Text after fork()...\n");
+    pid = fork();
+    if (pid == 0) {
+        exit(*text == first_insn ? 0 : 1);
+    }
+    status = -1;
+    check(pid > 0 && waitpid(pid, &status) == pid && exit_code(status) == 0,
+          "child reads the parent's text");
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,323 @@
+/**
+ * fb_test.c - Test program for the framebuffer device (/dev/fb0)
+ *
+ * Tests:
+ * 1. FBIOGET_INFO reports a sensible geometry
+ * 2. The framebuffer maps MAP_SHARED and keeps what is drawn in it
+ * 3. FBIO_DAMAGE shows a region, clipped to the screen
+ * 4. Only one process owns the display at a time
+ * 5. A mapping inherited over fork() reaches the same pixels
+ * 6. Invalid mappings and requests are refused
+ * 7. Closing gives the display back
+ *
+ * Without a GPU there is no /dev/fb0 and the test is skipped.
+ */
+
+#include <stddef.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_FORK          7
+#define SYS_WAIT          9
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_MMAP          24
+#define SYS_MUNMAP        25
+#define SYS_IOCTL         91
+
+/* Open flags */
+#define O_RDONLY  0x0000
+#define O_RDWR    0x0002
+
+/* mmap() arguments */
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+
+/* /dev/fb0 requests (drivers/fbdev.h) */
+#define FBIOGET_INFO  0x4600
+#define FBIO_DAMAGE   0x4601
+#define FBDEV_FORMAT_BGRX8888 1
+
+#define STDOUT_FD 1
+
+#define FB_PATH "/dev/fb0"
+
+typedef struct {
+    unsigned int width;
+    unsigned int height;
+    unsigned int stride;
+    unsigned int format;
+    unsigned long size;
+} fbdev_info_t;
+
+typedef struct {
+    unsigned int x;
+    unsigned int y;
+    unsigned int width;
+    unsigned int height;
+} fbdev_rect_t;
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall6(n, a1, a2, a3, a4, a5, a6) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long a4_reg asm("a4") = (long)(a5); \
+    register long a5_reg asm("a5") = (long)(a6); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(a4_reg), \
+                 "r"(a5_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long fork(void) {
+    return syscall1(SYS_FORK, 0);
+}
+
+static inline long waitpid(long pid, int *status) {
+    return syscall3(SYS_WAIT, pid, status, 0);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long mmap(void *addr, size_t len, int prot, int flags, int fd, long offset) {
+    return syscall6(SYS_MMAP, addr, len, prot, flags, fd, offset);
+}
+
+static inline long munmap(void *addr, size_t len) {
+    return syscall2(SYS_MUNMAP, addr, len);
+}
+
+static inline long ioctl(int fd, unsigned int request, void *arg) {
+    return syscall3(SYS_IOCTL, fd, request, arg);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static int exit_code(int status) {
+    return (status >> 8) & 0xFF;
+}
+
+/* Pixel drawn at (x, y): a gradient, BGRX */
+static unsigned int pattern(unsigned int x, unsigned int y) {
+    return ((x & 0xFF) << 16) | ((y & 0xFF) << 8) | ((x ^ y) & 0xFF);
+}
+
+static void draw(unsigned int *pixels, const fbdev_info_t *info) {
+    for (unsigned int y = 0; y < info->height; y++) {
+        unsigned int *row = pixels + (size_t)y * (info->stride / 4);
+        for (unsigned int x = 0; x < info->width; x++) {
+            row[x] = pattern(x, y);
+        }
+    }
+}
+
+static int drawn(const unsigned int *pixels, const fbdev_info_t *info) {
+    for (unsigned int y = 0; y < info->height; y++) {
+        const unsigned int *row = pixels + (size_t)y * (info->stride / 4);
+        for (unsigned int x = 0; x < info->width; x++) {
+            if (row[x] != pattern(x, y)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static long damage(int fd, unsigned int x, unsigned int y, unsigned int width, unsigned int height) {
+    fbdev_rect_t rect = { x, y, width, height };
+    return ioctl(fd, FBIO_DAMAGE, &rect);
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    Framebuffer Device Test Program\n");
+    print("========================================\n\n");
+
+    int fd = open(FB_PATH, O_RDWR);
+    if (fd < 0) {
+        print("  No " FB_PATH " (no GPU?): skipped\n\n");
+        exit(0);
+    }
+
+    /* Test 1: Geometry */
+    print("[TEST 1] FBIOGET_INFO...\n");
+    fbdev_info_t info;
+    check(ioctl(fd, FBIOGET_INFO, &info) == 0, "geometry read");
+    check(info.width > 0 && info.height > 0, "non-zero size");
+    check(info.stride >= info.width * 4, "stride holds a row");
+    check(info.format == FBDEV_FORMAT_BGRX8888, "32-bit BGRX pixels");
+    check(info.size >= (unsigned long)info.stride * info.height, "size holds every row");
+    print("  Screen: ");
+    print_num(info.width);
+    print("x");
+    print_num(info.height);
+    print("\n");
+
+    /* Test 2: Map and draw */
+    print("\n[TEST 2] mmap() and draw...\n");
+    long addr = mmap(NULL, info.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    check(addr > 0, "framebuffer mapped");
+    if (addr <= 0) {
+        close(fd);
+        exit(1);
+    }
+    unsigned int *pixels = (unsigned int *)addr;
+    draw(pixels, &info);
+    check(drawn(pixels, &info), "pixels read back as drawn");
+
+    /* Test 3: Damage */
+    print("\n[TEST 3] FBIO_DAMAGE...\n");
+    check(damage(fd, 0, 0, info.width, info.height) == 0, "whole screen shown");
+    check(damage(fd, info.width / 4, info.height / 4, info.width / 2, info.height / 2) == 0,
+          "part of the screen shown");
+    check(damage(fd, 10, 10, 0xFFFFFFFF, 0xFFFFFFFF) == 0, "oversized region clipped");
+    check(damage(fd, info.width, info.height, 10, 10) == 0, "region off the screen ignored");
+    check(drawn(pixels, &info), "pixels untouched by the flushes");
+
+    /* Test 4: One owner */
+    print("\n[TEST 4] Exclusive ownership...\n");
+    check(open(FB_PATH, O_RDWR) < 0, "second open refused while owned");
+
+    /* Test 5: Inherited mapping */
+    print("\n[TEST 5] Mapping inherited over fork()...\n");
+    int status = 0;
+    long pid = fork();
+    if (pid == 0) {
+        pixels[0] = 0x00FFFFFF;
+        pixels[info.size / 4 - 1] = 0x00FF00FF;
+        exit(damage(fd, 0, 0, info.width, info.height) == 0 ? 0 : 1);
+    }
+    check(pid > 0 && waitpid(pid, &status) == pid && exit_code(status) == 0,
+          "child drew and flushed");
+    check(pixels[0] == 0x00FFFFFF && pixels[info.size / 4 - 1] == 0x00FF00FF,
+          "child's pixels visible in the parent");
+
+    /* Test 6: Invalid use */
+    print("\n[TEST 6] Invalid mappings and requests...\n");
+    check(mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) < 0, "MAP_PRIVATE refused");
+    check(mmap(NULL, info.size + 4096, PROT_READ, MAP_SHARED, fd, 0) < 0,
+          "mapping past the end refused");
+    check(ioctl(fd, 0x1234, &info) < 0, "unknown request refused");
+    check(ioctl(fd, FBIOGET_INFO, (void *)8) < 0, "bad pointer refused");
+    check(ioctl(STDOUT_FD, FBIOGET_INFO, &info) < 0, "request to a non-device refused");
+
+    /* Test 7: Release */
+    print("\n[TEST 7] Closing gives the display back...\n");
+    munmap(pixels, info.size);
+    check(close(fd) == 0, "device closed");
+    fd = open(FB_PATH, O_RDONLY);
+    check(fd >= 0, "device opens again");
+    close(fd);
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
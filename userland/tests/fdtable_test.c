@@ -0,0 +1,291 @@
+/**
+ * fdtable_test.c - Test program for per-process descriptor tables
+ *
+ * Each process has its own table of descriptors; dup2() and fork() make
+ * descriptors that share one open file, which goes away with the last
+ * of them.
+ *
+ * Tests:
+ * 1. Opening more descriptors than a new table has slots
+ * 2. A closed descriptor is the next one handed out
+ * 3. dup2() descriptors share a position
+ * 4. A child closing an inherited descriptor leaves the parent's open
+ * 5. A pipe reads end-of-file once a child holding the write end exits
+ * 6. Closing stdin makes the next open() descriptor 0
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_FORK          7
+#define SYS_WAIT          9
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_LSEEK         15
+#define SYS_UNLINK        18
+#define SYS_PIPE          26
+#define SYS_DUP2          35
+
+/* Open flags */
+#define O_RDONLY  0x0000
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+
+#define SEEK_SET  0
+#define SEEK_CUR  1
+
+#define STDIN_FD  0
+#define STDOUT_FD 1
+
+/* More than the 64 slots a table starts with */
+#define MANY_FDS  200
+
+#define TEST_FILE "/fdtable_test.txt"
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long fork(void) {
+    return syscall1(SYS_FORK, 0);
+}
+
+static inline long waitpid(long pid, int *status) {
+    return syscall3(SYS_WAIT, pid, status, 0);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0644);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long lseek(int fd, long offset, int whence) {
+    return syscall3(SYS_LSEEK, fd, offset, whence);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+static inline long pipe(int fds[2]) {
+    return syscall1(SYS_PIPE, fds);
+}
+
+static inline long dup2(int oldfd, int newfd) {
+    return syscall2(SYS_DUP2, oldfd, newfd);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static int fds[MANY_FDS];
+
+/* Exit status of a child: its exit code */
+static int child_status(long pid) {
+    int status = 0;
+    if (waitpid(pid, &status) != pid) {
+        return -1;
+    }
+    return (status >> 8) & 0xFF;
+}
+
+void _start(void) {
+    print("\n========================================\n");
+    print("  Descriptor Table Test Suite\n");
+    print("========================================\n");
+
+    int fd = open(TEST_FILE, O_RDWR | O_CREAT);
+    check(fd >= 0, "created the test file");
+    if (fd < 0) {
+        exit(1);
+    }
+
+    /* Test 1: Grow past the first slots */
+    print("\n[TEST 1] Opening ");
+    print_num(MANY_FDS);
+    print(" descriptors...\n");
+    int opened = 0;
+    int in_order = 1;
+    for (int i = 0; i < MANY_FDS; i++) {
+        fds[i] = open(TEST_FILE, O_RDONLY);
+        if (fds[i] < 0) {
+            break;
+        }
+        opened++;
+        in_order &= fds[i] == fd + 1 + i;
+    }
+    check(opened == MANY_FDS, "opened every descriptor");
+    check(in_order, "descriptors handed out in order");
+
+    /* Test 2: Lowest free descriptor */
+    print("\n[TEST 2] Reusing a closed descriptor...\n");
+    int middle = fds[MANY_FDS / 2];
+    check(close(middle) == 0, "closed a descriptor in the middle");
+    fds[MANY_FDS / 2] = open(TEST_FILE, O_RDONLY);
+    check(fds[MANY_FDS / 2] == middle, "next open() got it back");
+    int closed = 0;
+    for (int i = 0; i < opened; i++) {
+        closed += close(fds[i]) == 0;
+    }
+    check(closed == opened, "closed every descriptor");
+
+    /* Test 3: dup2() */
+    print("\n[TEST 3] Sharing a position through dup2()...\n");
+    int copy = fd + 10;
+    check(dup2(fd, copy) == copy, "dup2() to an unused descriptor");
+    check(write(fd, "abc", 3) == 3, "wrote through the original");
+    check(write(copy, "de", 2) == 2, "wrote through the copy");
+    check(lseek(fd, 0, SEEK_CUR) == 5, "original at the copy's position");
+    check(close(copy) == 0, "closed the copy");
+    check(lseek(fd, 0, SEEK_SET) == 0, "original still open");
+    char buf[8];
+    check(read(fd, buf, sizeof(buf)) == 5 && buf[0] == 'a' && buf[3] == 'd',
+          "both writes landed in order");
+
+    /* Test 4: fork() */
+    print("\n[TEST 4] Closing an inherited descriptor in a child...\n");
+    long pid = fork();
+    if (pid == 0) {
+        exit(close(fd) == 0 ? 0 : 1);
+    }
+    check(pid > 0 && child_status(pid) == 0, "child closed its copy");
+    check(lseek(fd, 0, SEEK_SET) == 0 && read(fd, buf, 1) == 1 && buf[0] == 'a',
+          "parent's descriptor still open");
+    close(fd);
+    unlink(TEST_FILE);
+
+    /* Test 5: Pipe end-of-file */
+    print("\n[TEST 5] Pipe end-of-file after the writer exits...\n");
+    int pipefd[2];
+    check(pipe(pipefd) == 0, "created a pipe");
+    pid = fork();
+    if (pid == 0) {
+        /* Exit with both ends still open */
+        write(pipefd[1], "x", 1);
+        exit(0);
+    }
+    close(pipefd[1]);
+    check(read(pipefd[0], buf, 1) == 1 && buf[0] == 'x', "read the child's byte");
+    check(read(pipefd[0], buf, 1) == 0, "then end-of-file");
+    check(child_status(pid) == 0, "child exited");
+    close(pipefd[0]);
+
+    /* Test 6: Closing the console */
+    print("\n[TEST 6] Replacing stdin...\n");
+    pid = fork();
+    if (pid == 0) {
+        if (close(STDIN_FD) != 0) {
+            exit(1);
+        }
+        int reopened = open("/", O_RDONLY);
+        exit(reopened == STDIN_FD ? 0 : 2);
+    }
+    check(pid > 0 && child_status(pid) == 0, "child's open() got descriptor 0");
+    check(write(STDOUT_FD, "", 0) == 0, "parent's console still open");
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
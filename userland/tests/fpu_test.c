@@ -0,0 +1,293 @@
+/**
+ * fpu_test.c - Test program for lazy FP context switching
+ *
+ * Re-execs itself (argv[1] = "child") to check the FP state of a new image.
+ *
+ * Tests:
+ * 1. Several processes doing floating-point math while yielding to each
+ *    other all get exact results
+ * 2. The rounding mode in fcsr is per process
+ * 3. A forked child inherits the parent's FP state
+ * 4. exec starts the new image with a clean fcsr
+ */
+
+#include <stddef.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_YIELD         6
+#define SYS_FORK          7
+#define SYS_WAIT          9
+#define SYS_EXECVE        20
+
+#define STDOUT_FD 1
+
+/* Processes and loop length of the concurrent math test */
+#define NR_WORKERS 4
+#define NR_STEPS   200
+
+/* fcsr.frm rounding modes */
+#define FRM_RNE 0
+#define FRM_RTZ 1
+#define FRM_RUP 3
+
+#define SELF "/bin/fpu_test"
+
+/* Syscall helpers */
+#define syscall0(n) ({ \
+    register long a0 asm("a0"); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "=r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const char *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline void yield(void) {
+    syscall0(SYS_YIELD);
+}
+
+static inline long fork(void) {
+    return syscall1(SYS_FORK, 0);
+}
+
+static inline long waitpid(long pid, int *status) {
+    return syscall3(SYS_WAIT, pid, status, 0);
+}
+
+static inline long execve(const char *path, const char *argv[]) {
+    const char *envp[] = { NULL };
+    return syscall3(SYS_EXECVE, path, argv, envp);
+}
+
+/* Rounding mode */
+static inline void set_frm(long mode) {
+    asm volatile("fsrm %0" :: "r"(mode));
+}
+
+static inline long get_frm(void) {
+    long mode;
+    asm volatile("frrm %0" : "=r"(mode));
+    return mode;
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static int streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static int exit_code(int status) {
+    return (status >> 8) & 0xFF;
+}
+
+/* Fork a child running fn; returns its exit code, or -1 */
+static int run_forked(int (*fn)(long), long arg) {
+    long pid = fork();
+    if (pid == 0) {
+        exit(fn(arg));
+    }
+    if (pid < 0) {
+        return -1;
+    }
+    int status = -1;
+    if (waitpid(pid, &status) != pid) {
+        return -1;
+    }
+    return exit_code(status);
+}
+
+/*
+ * Sum k * scale for k < NR_STEPS, yielding every step so the other
+ * workers run with their own values in the same registers. All partial
+ * sums are small multiples of a power of two, so the result is exact.
+ */
+static int worker(long id) {
+    double scale = 1.0 / (double)(1 << id);
+    double sum = 0.0;
+    double k = 0.0;
+    for (int i = 0; i < NR_STEPS; i++) {
+        sum += k * scale;
+        k += 1.0;
+        yield();
+    }
+    double expect = (double)(NR_STEPS * (NR_STEPS - 1) / 2) * scale;
+    return sum == expect ? 0 : 1;
+}
+
+/* Keep a rounding mode across yields */
+static int rounding_worker(long mode) {
+    set_frm(mode);
+    for (int i = 0; i < 20; i++) {
+        yield();
+        if (get_frm() != mode) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int inherit_child(long mode) {
+    return get_frm() == mode ? 0 : 1;
+}
+
+/* Run as a child: a new image must start with the default rounding mode */
+static void child_main(void) {
+    exit(get_frm() == FRM_RNE ? 0 : 1);
+}
+
+/* Main test program */
+void _start(int argc, char **argv) {
+    if (argc > 1 && streq(argv[1], "child")) {
+        child_main();
+    }
+
+    print("\n");
+    print("========================================\n");
+    print("    FP Context Switch Test Program\n");
+    print("========================================\n\n");
+
+    /* Test 1: Concurrent FP math */
+    print("[TEST 1] ");
+    print_num(NR_WORKERS);
+    print(" processes doing FP math...\n");
+    long pids[NR_WORKERS];
+    for (int i = 0; i < NR_WORKERS; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            exit(worker(i));
+        }
+    }
+    int exact = 0;
+    for (int i = 0; i < NR_WORKERS; i++) {
+        int status = -1;
+        if (pids[i] > 0 && waitpid(pids[i], &status) == pids[i] && exit_code(status) == 0) {
+            exact++;
+        }
+    }
+    check(exact == NR_WORKERS, "every worker got an exact result");
+
+    /* Test 2: Rounding mode is per process */
+    print("\n[TEST 2] Rounding modes across switches...\n");
+    long pid = fork();
+    if (pid == 0) {
+        exit(rounding_worker(FRM_RUP));
+    }
+    int ok = rounding_worker(FRM_RTZ) == 0;
+    int status = -1;
+    check(ok && pid > 0 && waitpid(pid, &status) == pid && exit_code(status) == 0,
+          "each process keeps its own rounding mode");
+
+    /* Test 3: FP state is inherited by fork */
+    print("\n[TEST 3] FP state after fork()...\n");
+    set_frm(FRM_RUP);
+    check(run_forked(inherit_child, FRM_RUP) == 0, "child inherits the rounding mode");
+    check(get_frm() == FRM_RUP, "parent keeps its rounding mode");
+
+    /* Test 4: exec resets FP state */
+    print("\n[TEST 4] FP state after exec...\n");
+    pid = fork();
+    if (pid == 0) {
+        const char *child_argv[] = { SELF, "child", NULL };
+        execve(SELF, child_argv);
+        exit(99);
+    }
+    status = -1;
+    check(pid > 0 && waitpid(pid, &status) == pid && exit_code(status) == 0,
+          "new image starts with the default rounding mode");
+    set_frm(FRM_RNE);
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,278 @@
+/**
+ * fsync_test.c - Test program for fsync(), fdatasync() and sync()
+ *
+ * Writes stay in the page cache and block cache until write-back; these
+ * calls return only once they are on the device and its cache flushed.
+ *
+ * Tests:
+ * 1. fsync() after writing a file, which still reads back the same
+ * 2. fdatasync() after overwriting part of it
+ * 3. fsync() on a directory after creating a file in it
+ * 4. fsync() on a file in tmpfs, which has nothing to flush
+ * 5. sync()
+ * 6. Pipes, the console and closed descriptors are refused
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_UNLINK        18
+#define SYS_PIPE          26
+#define SYS_PREAD64       82
+#define SYS_PWRITE64      83
+#define SYS_FSYNC         88
+#define SYS_FDATASYNC     89
+#define SYS_SYNC          90
+
+/* Open flags */
+#define O_RDONLY  0x0000
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+
+#define STDOUT_FD 1
+
+#define TEST_FILE "/fsync_test.txt"
+#define TMP_FILE  "/tmp/fsync_test.txt"
+
+/* Syscall helpers */
+#define syscall0(n) ({ \
+    register long a0 asm("a0"); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "=r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall4(n, a1, a2, a3, a4) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0644);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+static inline long pipe(int fds[2]) {
+    return syscall1(SYS_PIPE, fds);
+}
+
+static inline long pread(int fd, void *buf, size_t len, long offset) {
+    return syscall4(SYS_PREAD64, fd, buf, len, offset);
+}
+
+static inline long pwrite(int fd, const void *buf, size_t len, long offset) {
+    return syscall4(SYS_PWRITE64, fd, buf, len, offset);
+}
+
+static inline long fsync(int fd) {
+    return syscall1(SYS_FSYNC, fd);
+}
+
+static inline long fdatasync(int fd) {
+    return syscall1(SYS_FDATASYNC, fd);
+}
+
+static inline long sync(void) {
+    return syscall0(SYS_SYNC);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static int same(const char *a, const char *b, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (a[i] != b[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* A few pages of a pattern that differs per page */
+#define DATA_SIZE 9000
+static char data[DATA_SIZE];
+static char back[DATA_SIZE];
+
+void _start(void) {
+    print("\n========================================\n");
+    print("  fsync() Test Suite\n");
+    print("========================================\n");
+
+    for (int i = 0; i < DATA_SIZE; i++) {
+        data[i] = (char)('a' + (i * 7 + i / 4096) % 26);
+    }
+
+    /* Test 1: fsync() */
+    print("\n[TEST 1] fsync() after writing a file...\n");
+    long fd = open(TEST_FILE, O_RDWR | O_CREAT);
+    check(fd >= 0, "created the file");
+    check(write(fd, data, DATA_SIZE) == DATA_SIZE, "wrote three pages");
+    check(fsync(fd) == 0, "fsync() succeeded");
+    check(fsync(fd) == 0, "fsync() with nothing dirty succeeded");
+    check(pread(fd, back, DATA_SIZE, 0) == DATA_SIZE && same(back, data, DATA_SIZE),
+          "the file reads back the same");
+
+    /* Test 2: fdatasync() */
+    print("\n[TEST 2] fdatasync() after an overwrite...\n");
+    check(pwrite(fd, "SYNCED", 6, 4094) == 6, "overwrote across a page boundary");
+    check(fdatasync(fd) == 0, "fdatasync() succeeded");
+    check(pread(fd, back, 10, 4092) == 10 && same(back, data + 4092, 2) &&
+          same(back + 2, "SYNCED", 6) && same(back + 8, data + 4100, 2),
+          "only the overwritten bytes changed");
+    close(fd);
+
+    /* Test 3: Directory */
+    print("\n[TEST 3] fsync() on a directory...\n");
+    fd = open("/", O_RDONLY);
+    check(fd >= 0, "opened /");
+    check(fsync(fd) == 0, "fsync() on / succeeded");
+    close(fd);
+    unlink(TEST_FILE);
+
+    /* Test 4: tmpfs */
+    print("\n[TEST 4] fsync() on tmpfs...\n");
+    fd = open(TMP_FILE, O_RDWR | O_CREAT);
+    check(fd >= 0, "created a file in /tmp");
+    check(write(fd, data, 100) == 100, "wrote to it");
+    check(fsync(fd) == 0, "fsync() succeeded");
+    check(pread(fd, back, 100, 0) == 100 && same(back, data, 100), "data still there");
+    close(fd);
+    unlink(TMP_FILE);
+
+    /* Test 5: sync() */
+    print("\n[TEST 5] sync()...\n");
+    fd = open(TEST_FILE, O_RDWR | O_CREAT);
+    check(fd >= 0 && write(fd, data, 3000) == 3000, "wrote a file");
+    check(sync() == 0, "sync() succeeded");
+    close(fd);
+    unlink(TEST_FILE);
+    check(sync() == 0, "sync() after unlink succeeded");
+
+    /* Test 6: Errors */
+    print("\n[TEST 6] Descriptors without a file...\n");
+    int pipefd[2];
+    check(pipe(pipefd) == 0, "created a pipe");
+    check(fsync(pipefd[0]) < 0, "fsync() on a pipe fails");
+    check(fdatasync(pipefd[1]) < 0, "fdatasync() on a pipe fails");
+    close(pipefd[0]);
+    close(pipefd[1]);
+    check(fsync(STDOUT_FD) < 0, "fsync() on the console fails");
+    check(fsync(pipefd[0]) < 0, "fsync() on a closed descriptor fails");
+    check(fsync(-1) < 0, "fsync() on a negative descriptor fails");
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
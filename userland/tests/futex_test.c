@@ -0,0 +1,169 @@
+/**
+ * futex_test.c - Test program for the futex syscall and user-space locks
+ * 
+ * Tests:
+ * 1. Uncontended umutex lock/unlock stays in user space
+ * 2. umutex_trylock on a held mutex fails
+ * 3. FUTEX_WAIT with a stale value returns at once
+ * 4. FUTEX_WAKE and FUTEX_REQUEUE with no sleepers wake nobody
+ * 5. Misaligned and unmapped futex words are rejected
+ * 6. Unknown futex operations are rejected
+ * 7. Signalling a condition variable nobody waits on
+ */
+
+#include <stddef.h>
+#include "../lib/futex.h"
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+
+#define STDOUT_FD 1
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const char *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+    
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+    
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static umutex_t mutex = UMUTEX_INIT;
+static ucond_t cond = UCOND_INIT;
+static volatile uint32_t words[2];
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("       Futex Test Program\n");
+    print("========================================\n\n");
+    
+    /* Test 1: Uncontended lock never marks the mutex contended */
+    print("[TEST 1] Uncontended lock/unlock...\n");
+    umutex_lock(&mutex);
+    int locked = mutex.state == UMUTEX_LOCKED;
+    umutex_unlock(&mutex);
+    check(locked && mutex.state == UMUTEX_UNLOCKED, "uncontended umutex");
+    
+    /* Test 2: trylock on a held mutex */
+    print("\n[TEST 2] Trylock on held mutex...\n");
+    umutex_lock(&mutex);
+    check(umutex_trylock(&mutex) < 0, "trylock fails while held");
+    umutex_unlock(&mutex);
+    check(umutex_trylock(&mutex) == 0, "trylock succeeds once free");
+    umutex_unlock(&mutex);
+    
+    /* Test 3: Stale value must not sleep */
+    print("\n[TEST 3] FUTEX_WAIT with stale value...\n");
+    words[0] = 1;
+    check(futex(&words[0], FUTEX_WAIT, 0, 0, 0) < 0, "wait returns at once");
+    
+    /* Test 4: Nobody to wake */
+    print("\n[TEST 4] Wake with no sleepers...\n");
+    check(futex(&words[0], FUTEX_WAKE, 1, 0, 0) == 0, "wake wakes nobody");
+    check(futex(&words[0], FUTEX_REQUEUE, 1, 1, &words[1]) == 0, "requeue wakes nobody");
+    
+    /* Test 5: Bad futex words */
+    print("\n[TEST 5] Bad futex addresses...\n");
+    volatile uint32_t *misaligned = (volatile uint32_t *)((char *)&words[0] + 1);
+    check(futex(misaligned, FUTEX_WAKE, 1, 0, 0) < 0, "misaligned word rejected");
+    check(futex((volatile uint32_t *)0, FUTEX_WAKE, 1, 0, 0) < 0, "NULL word rejected");
+    
+    /* Test 6: Unknown operation */
+    print("\n[TEST 6] Unknown operation...\n");
+    check(futex(&words[0], 42, 0, 0, 0) < 0, "unknown op rejected");
+    
+    /* Test 7: Signal and broadcast with no waiters stay in user space */
+    print("\n[TEST 7] Condition variable with no waiters...\n");
+    uint32_t seq = cond.seq;
+    ucond_signal(&cond);
+    ucond_broadcast(&cond);
+    check(cond.seq == seq + 2 && cond.waiters == 0, "signal/broadcast bump seq");
+    
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+    
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+    
+    exit(tests_failed > 0 ? 1 : 0);
+}
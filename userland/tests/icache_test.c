@@ -0,0 +1,295 @@
+/**
+ * icache_test.c - Test program for the inode cache
+ *
+ * Tests:
+ * 1. Two descriptors on one file see each other's writes and size
+ * 2. Many small writes through one descriptor all reach the disk
+ * 3. Metadata written back on close survives the node being dropped
+ *    from memory
+ * 4. chmod() through one name is seen by the next open
+ * 5. A removed file's name can be reused for a new, empty file
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_GETTIME       12
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_LSEEK         15
+#define SYS_STAT          16
+#define SYS_UNLINK        18
+#define SYS_CHMOD         41
+
+/* Open flags */
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+
+#define SEEK_SET  0
+
+#define STDOUT_FD 1
+
+#define TEST_FILE   "/icache_test.txt"
+
+/* Small writes in test 2; names looked up in test 3 to push the file's
+ * dentry out of the cache (more than DCACHE_MAX_ENTRIES) */
+#define SMALL_WRITES  200
+#define EVICT_NAMES   300
+
+typedef struct {
+    uint32_t st_ino;
+    uint16_t st_mode;
+    uint16_t st_uid;
+    uint16_t st_gid;
+    uint16_t st_pad;
+    uint32_t st_size;
+    uint32_t st_type;
+    uint32_t st_size_high;
+} stat_t;
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long gettime(void) {
+    return syscall1(SYS_GETTIME, 0);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0644);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long lseek(int fd, long offset, int whence) {
+    return syscall3(SYS_LSEEK, fd, offset, whence);
+}
+
+static inline long stat(const char *path, stat_t *st) {
+    return syscall2(SYS_STAT, path, st);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+static inline long chmod(const char *path, int mode) {
+    return syscall2(SYS_CHMOD, path, mode);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+/* "/icache_evict_<n>" */
+static void evict_name(char *buf, int n) {
+    const char *prefix = "/icache_evict_";
+    int i = 0;
+    while (prefix[i]) {
+        buf[i] = prefix[i];
+        i++;
+    }
+    buf[i++] = '0' + (n / 100) % 10;
+    buf[i++] = '0' + (n / 10) % 10;
+    buf[i++] = '0' + n % 10;
+    buf[i] = '\0';
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    Inode Cache Test Program\n");
+    print("========================================\n\n");
+
+    stat_t st;
+    char buf[64];
+
+    /* Left over from an earlier run */
+    unlink(TEST_FILE);
+
+    /* Test 1: Shared node */
+    print("[TEST 1] Two descriptors on one file...\n");
+    int fd_a = open(TEST_FILE, O_RDWR | O_CREAT);
+    int fd_b = open(TEST_FILE, O_RDWR);
+    check(fd_a >= 0 && fd_b >= 0, "opened twice");
+    check(write(fd_a, "0123456789", 10) == 10, "wrote 10 bytes through the first");
+    check(read(fd_b, buf, sizeof(buf)) == 10 && buf[0] == '0' && buf[9] == '9',
+          "second reads them back");
+    check(write(fd_b, "abcde", 5) == 5, "second appends 5 bytes");
+    check(lseek(fd_a, 0, SEEK_SET) == 0 && read(fd_a, buf, sizeof(buf)) == 15 && buf[10] == 'a',
+          "first sees the new size");
+    check(stat(TEST_FILE, &st) == 0 && st.st_size == 15, "stat() agrees");
+    close(fd_b);
+    close(fd_a);
+
+    /* Test 2: Coalesced write-back */
+    print("\n[TEST 2] Many small writes...\n");
+    int fd = open(TEST_FILE, O_RDWR);
+    check(fd >= 0, "reopened");
+    lseek(fd, 15, SEEK_SET);
+    int short_writes = 0;
+    long start = gettime();
+    for (int i = 0; i < SMALL_WRITES; i++) {
+        char c = (char)('A' + i % 26);
+        if (write(fd, &c, 1) != 1) {
+            short_writes++;
+        }
+    }
+    long elapsed = gettime() - start;
+    print("  ");
+    print_num(SMALL_WRITES);
+    print(" one-byte writes in ");
+    print_num(elapsed);
+    print(" ms\n");
+    check(short_writes == 0, "every write completed");
+    check(stat(TEST_FILE, &st) == 0 && st.st_size == 15 + SMALL_WRITES, "size seen before close");
+    close(fd);
+
+    /* Test 3: Metadata survives the node being freed */
+    print("\n[TEST 3] Dropping the node from memory...\n");
+    char name[32];
+    for (int n = 0; n < EVICT_NAMES; n++) {
+        evict_name(name, n);
+        stat(name, &st);
+    }
+    check(stat(TEST_FILE, &st) == 0 && st.st_size == 15 + SMALL_WRITES, "size read back from disk");
+    fd = open(TEST_FILE, O_RDWR);
+    int content_ok = fd >= 0;
+    if (content_ok) {
+        lseek(fd, 15 + SMALL_WRITES - 26, SEEK_SET);
+        content_ok = read(fd, buf, 26) == 26;
+        for (int i = 0; content_ok && i < 26; i++) {
+            int index = SMALL_WRITES - 26 + i;
+            content_ok = buf[i] == (char)('A' + index % 26);
+        }
+        close(fd);
+    }
+    check(content_ok, "last block of data intact");
+
+    /* Test 4: chmod() */
+    print("\n[TEST 4] Metadata changes...\n");
+    fd = open(TEST_FILE, O_RDWR);
+    check(chmod(TEST_FILE, 0640) == 0, "chmod() while open");
+    check(stat(TEST_FILE, &st) == 0 && (st.st_mode & 0777) == 0640, "stat() sees the mode");
+    close(fd);
+    for (int n = 0; n < EVICT_NAMES; n++) {
+        evict_name(name, n);
+        stat(name, &st);
+    }
+    check(stat(TEST_FILE, &st) == 0 && (st.st_mode & 0777) == 0640, "mode read back from disk");
+
+    /* Test 5: Reuse after removal */
+    print("\n[TEST 5] Removing and recreating...\n");
+    check(unlink(TEST_FILE) == 0, "unlinked");
+    fd = open(TEST_FILE, O_RDWR | O_CREAT);
+    check(fd >= 0, "recreated");
+    check(stat(TEST_FILE, &st) == 0 && st.st_size == 0, "new file is empty");
+    check(read(fd, buf, sizeof(buf)) == 0, "and reads nothing");
+    close(fd);
+    unlink(TEST_FILE);
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
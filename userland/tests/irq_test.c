@@ -0,0 +1,254 @@
+/**
+ * irq_test.c - Test program for interrupt statistics and steering
+ *
+ * Tests:
+ * 1. getirqs() lists the interrupts in use with their drivers' names,
+ *    priorities and counts
+ * 2. irqctl() refuses what it should
+ * 3. Priority and affinity change and read back
+ * 4. The UART's input work runs in an IRQ thread
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_GETIRQS       115
+#define SYS_IRQCTL        116
+
+#define IRQCTL_SET_AFFINITY 1
+#define IRQCTL_SET_PRIORITY 2
+
+#define STDOUT_FD 1
+
+/* Interrupt info structure (must match kernel) */
+#define IRQ_INFO_NAME_MAX 16
+#define IRQ_INFO_CPUS 8
+typedef struct {
+    unsigned int irq;
+    unsigned int priority;
+    unsigned int affinity;
+    int target;
+    char name[IRQ_INFO_NAME_MAX];
+    unsigned long count;
+    unsigned long cpu_count[IRQ_INFO_CPUS];
+    unsigned long total_us;
+    unsigned long max_us;
+    unsigned long max_latency_us;
+    int thread_pid;
+    unsigned long thread_count;
+    unsigned long thread_total_us;
+    unsigned long thread_max_us;
+    unsigned long thread_max_latency_us;
+} irqinfo_t;
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long getirqs(irqinfo_t *buf, size_t max) {
+    return syscall3(SYS_GETIRQS, buf, max, 0);
+}
+
+static inline long irqctl(unsigned int irq, int cmd, unsigned long arg) {
+    return syscall3(SYS_IRQCTL, irq, cmd, arg);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static int streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static irqinfo_t irqs[96];
+
+/**
+ * Entry of the IRQ registered under name, or NULL
+ */
+static irqinfo_t *find_irq(const char *name) {
+    long count = getirqs(irqs, 96);
+    for (long i = 0; i < count; i++) {
+        if (streq(irqs[i].name, name)) {
+            return &irqs[i];
+        }
+    }
+    return NULL;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("     Interrupt Statistics Test\n");
+    print("========================================\n\n");
+
+    /* Test 1: Listing */
+    print("[TEST 1] getirqs()...\n");
+    check(getirqs(NULL, 4) < 0 && getirqs(irqs, 0) < 0, "no buffer refused");
+    long count = getirqs(irqs, 96);
+    check(count > 0, "interrupts in use listed");
+    int ordered = 1;
+    for (long i = 1; i < count; i++) {
+        ordered &= irqs[i].irq > irqs[i - 1].irq;
+    }
+    check(ordered, "in IRQ order");
+    check(getirqs(irqs, 1) == (count > 0 ? 1 : 0), "stops at the buffer's end");
+
+    irqinfo_t *uart = find_irq("uart0");
+    check(uart != NULL && uart->irq == 10 && uart->priority == 5, "uart0: IRQ 10, priority 5");
+
+    irqinfo_t *blk = find_irq("virtio-blk");
+    check(blk != NULL && blk->count > 0, "virtio-blk has interrupted");
+    if (blk) {
+        unsigned long sum = 0;
+        for (int cpu = 0; cpu < IRQ_INFO_CPUS; cpu++) {
+            sum += blk->cpu_count[cpu];
+        }
+        check(sum == blk->count, "per-CPU counts add up");
+        check(blk->max_us <= blk->total_us, "longest run within the total");
+        check(blk->affinity != 0 && blk->target >= 0 &&
+              (blk->affinity & (1U << blk->target)), "taken by a CPU its mask allows");
+        print("  (virtio-blk: ");
+        print_num((long)blk->count);
+        print(" interrupts, ");
+        print_num((long)blk->total_us);
+        print(" us in the handler, max latency ");
+        print_num((long)blk->max_latency_us);
+        print(" us)\n");
+    }
+
+    /* Test 2: Refusals */
+    print("\n[TEST 2] irqctl() refusals...\n");
+    check(irqctl(0, IRQCTL_SET_PRIORITY, 3) < 0, "IRQ 0 refused");
+    check(irqctl(95, IRQCTL_SET_PRIORITY, 3) < 0, "unused IRQ refused");
+    check(irqctl(96, IRQCTL_SET_PRIORITY, 3) < 0, "IRQ past the PLIC refused");
+    check(irqctl(10, 99, 0) < 0, "unknown command refused");
+    check(irqctl(10, IRQCTL_SET_PRIORITY, 0) < 0 && irqctl(10, IRQCTL_SET_PRIORITY, 8) < 0,
+          "priority out of range refused");
+    check(irqctl(10, IRQCTL_SET_AFFINITY, 0) < 0, "empty mask refused");
+    check(irqctl(10, IRQCTL_SET_AFFINITY, 0x80000000UL) < 0, "mask of no online CPU refused");
+
+    /* Test 3: Changes */
+    print("\n[TEST 3] Priority and affinity...\n");
+    check(irqctl(10, IRQCTL_SET_PRIORITY, 4) == 0, "priority set");
+    uart = find_irq("uart0");
+    check(uart != NULL && uart->priority == 4, "and reads back");
+    irqctl(10, IRQCTL_SET_PRIORITY, 5);
+
+    check(irqctl(10, IRQCTL_SET_AFFINITY, 1) == 0, "pinned to CPU 0");
+    uart = find_irq("uart0");
+    check(uart != NULL && uart->affinity == 1 && uart->target == 0, "and reads back");
+    if (irqctl(10, IRQCTL_SET_AFFINITY, 2) == 0) {
+        uart = find_irq("uart0");
+        check(uart != NULL && uart->target == 1, "moved to CPU 1");
+    } else {
+        print("  (one CPU: not moved)\n");
+    }
+    check(irqctl(10, IRQCTL_SET_AFFINITY, 0xFF) == 0, "every CPU allowed again");
+    uart = find_irq("uart0");
+    check(uart != NULL && uart->target == 0, "lowest online CPU takes it");
+
+    /* Test 4: Threaded handlers */
+    print("\n[TEST 4] IRQ threads...\n");
+    uart = find_irq("uart0");
+    check(uart != NULL && uart->thread_pid > 0, "uart0 has a thread");
+    check(uart != NULL && uart->thread_max_us <= uart->thread_total_us,
+          "longest thread run within the total");
+    blk = find_irq("virtio-blk");
+    check(blk != NULL && blk->thread_pid == 0 && blk->thread_count == 0,
+          "virtio-blk handled in the trap only");
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,197 @@
+/**
+ * ksm_test.c - Test program for same-page merging (madvise(MADV_MERGEABLE))
+ *
+ * Tests:
+ * 1. Bad ranges are refused, and marking a private mapping succeeds
+ * 2. Identical pages of a marked mapping are merged by ksmd
+ * 3. Writing a merged page copies it and leaves the others alone
+ * 4. Pages of zeroes are mapped to the zero page
+ * 5. MADV_UNMERGEABLE stops the merging
+ */
+
+#include "../lib/ustdio.h"
+#include "../lib/umalloc.h"
+
+#define SYS_SLEEP         5
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+
+#define O_RDONLY          0x0000
+
+#define MADV_MERGEABLE    12
+#define MADV_UNMERGEABLE  13
+
+#define PAGES             32
+#define ZERO_PAGES        16
+#define WAIT_MS           100
+#define WAIT_ROUNDS       50
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    printf("%s %s\n", ok ? "[PASS]" : "[FAIL]", name);
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static char meminfo[8192];
+
+/* Value of a /proc/meminfo field, or -1 */
+static long meminfo_field(const char *key) {
+    int fd = (int)syscall3(SYS_OPEN, (long)"/proc/meminfo", O_RDONLY, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    long n = syscall3(SYS_READ, fd, (long)meminfo, sizeof(meminfo) - 1);
+    syscall1(SYS_CLOSE, fd);
+    if (n <= 0) {
+        return -1;
+    }
+    meminfo[n] = '\0';
+
+    size_t len = strlen(key);
+    for (char *line = meminfo; *line; ) {
+        if (strncmp(line, key, len) == 0 && line[len] == ' ') {
+            long value = 0;
+            for (char *p = line + len + 1; *p >= '0' && *p <= '9'; p++) {
+                value = value * 10 + (*p - '0');
+            }
+            return value;
+        }
+        while (*line && *line != '\n') {
+            line++;
+        }
+        if (*line) {
+            line++;
+        }
+    }
+    return -1;
+}
+
+/* Wait for a field to reach a value; returns the last value read */
+static long wait_field(const char *key, long target) {
+    long value = meminfo_field(key);
+    for (int i = 0; i < WAIT_ROUNDS && value >= 0 && value < target; i++) {
+        syscall1(SYS_SLEEP, WAIT_MS);
+        value = meminfo_field(key);
+    }
+    return value;
+}
+
+static unsigned char *map_pages(int pages) {
+    long addr = umalloc_syscall(SYS_MMAP, 0, (long)pages * UMALLOC_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return addr == -1 ? NULL : (unsigned char *)addr;
+}
+
+static long advise(void *addr, int pages, int advice) {
+    return umalloc_syscall(SYS_MADVISE, (long)addr, (long)pages * UMALLOC_PAGE_SIZE, advice, 0, 0, 0);
+}
+
+/* Fill a page with a pattern that is the same for every page */
+static void fill(unsigned char *page, unsigned char seed) {
+    for (unsigned long i = 0; i < UMALLOC_PAGE_SIZE; i++) {
+        page[i] = (unsigned char)(seed + i * 13);
+    }
+}
+
+static int holds(const unsigned char *page, unsigned char seed) {
+    for (unsigned long i = 0; i < UMALLOC_PAGE_SIZE; i++) {
+        if (page[i] != (unsigned char)(seed + i * 13)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void _start(void) {
+    printf("\n");
+    printf("========================================\n");
+    printf("     Same-Page Merging Test Program\n");
+    printf("========================================\n\n");
+
+    /* Test 1: Refused and accepted advice */
+    printf("[TEST 1] madvise()...\n");
+    unsigned char *same = map_pages(PAGES);
+    check(same != NULL, "mapping created");
+    check(advise(same + 1, PAGES, MADV_MERGEABLE) == -1, "an unaligned range is refused");
+    check(meminfo_field("ksm_merged") >= 0, "/proc/meminfo reports merging");
+
+    /* Test 2: Merging */
+    printf("\n[TEST 2] Identical pages...\n");
+    for (int i = 0; i < PAGES; i++) {
+        fill(same + i * UMALLOC_PAGE_SIZE, 0x41);
+    }
+    long sharing = meminfo_field("ksm_pages_sharing");
+    long merged = meminfo_field("ksm_merged");
+    check(advise(same, PAGES, MADV_MERGEABLE) == 0, "the mapping is marked mergeable");
+    long now = wait_field("ksm_merged", merged + PAGES - 1);
+    printf("  merged: %ld\n", now - merged);
+    check(now >= merged + PAGES - 1, "all but one page were merged");
+    check(meminfo_field("ksm_pages_sharing") >= sharing + PAGES - 1, "the pages share one copy");
+    int intact = 1;
+    for (int i = 0; i < PAGES; i++) {
+        if (!holds(same + i * UMALLOC_PAGE_SIZE, 0x41)) {
+            intact = 0;
+        }
+    }
+    check(intact, "every page still reads the same");
+
+    /* Test 3: Writing a merged page */
+    printf("\n[TEST 3] Copy on write...\n");
+    fill(same + 5 * UMALLOC_PAGE_SIZE, 0x77);
+    check(holds(same + 5 * UMALLOC_PAGE_SIZE, 0x77), "the written page took the write");
+    check(holds(same + 4 * UMALLOC_PAGE_SIZE, 0x41) && holds(same + 6 * UMALLOC_PAGE_SIZE, 0x41),
+          "its neighbours kept their contents");
+    check(meminfo_field("ksm_pages_sharing") >= sharing + PAGES - 2, "the others still share");
+
+    /* Test 4: Zero pages */
+    printf("\n[TEST 4] Pages of zeroes...\n");
+    unsigned char *zeroes = map_pages(ZERO_PAGES);
+    for (int i = 0; zeroes && i < ZERO_PAGES; i++) {
+        zeroes[i * UMALLOC_PAGE_SIZE] = 1;
+        zeroes[i * UMALLOC_PAGE_SIZE] = 0;
+    }
+    long zero_merged = meminfo_field("ksm_zero_merged");
+    check(zeroes && advise(zeroes, ZERO_PAGES, MADV_MERGEABLE) == 0, "the mapping is marked mergeable");
+    now = wait_field("ksm_zero_merged", zero_merged + ZERO_PAGES);
+    check(now >= zero_merged + ZERO_PAGES, "the pages went to the zero page");
+    int zero_ok = 1;
+    for (int i = 0; zeroes && i < ZERO_PAGES; i++) {
+        if (zeroes[i * UMALLOC_PAGE_SIZE + 100] != 0) {
+            zero_ok = 0;
+        }
+    }
+    zeroes[3 * UMALLOC_PAGE_SIZE] = 9;
+    check(zero_ok && zeroes[3 * UMALLOC_PAGE_SIZE] == 9 && zeroes[4 * UMALLOC_PAGE_SIZE] == 0,
+          "they read as zero and can be written");
+
+    /* Test 5: Unmergeable */
+    printf("\n[TEST 5] MADV_UNMERGEABLE...\n");
+    unsigned char *apart = map_pages(PAGES);
+    check(apart && advise(apart, PAGES, MADV_MERGEABLE) == 0 && advise(apart, PAGES, MADV_UNMERGEABLE) == 0,
+          "the mark is set and cleared");
+    for (int i = 0; apart && i < PAGES; i++) {
+        fill(apart + i * UMALLOC_PAGE_SIZE, 0x19);
+    }
+    merged = meminfo_field("ksm_merged");
+    syscall1(SYS_SLEEP, 5 * WAIT_MS);
+    check(meminfo_field("ksm_merged") == merged, "nothing more was merged");
+
+    umalloc_syscall(SYS_MUNMAP, (long)same, PAGES * UMALLOC_PAGE_SIZE, 0, 0, 0, 0);
+    umalloc_syscall(SYS_MUNMAP, (long)zeroes, ZERO_PAGES * UMALLOC_PAGE_SIZE, 0, 0, 0, 0);
+    umalloc_syscall(SYS_MUNMAP, (long)apart, PAGES * UMALLOC_PAGE_SIZE, 0, 0, 0, 0);
+
+    /* Summary */
+    printf("\n========================================\n");
+    printf("Tests passed: %d\n", tests_passed);
+    printf("Tests failed: %d\n", tests_failed);
+    printf("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
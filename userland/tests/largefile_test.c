@@ -0,0 +1,275 @@
+/**
+ * largefile_test.c - Test program for 64-bit file offsets
+ *
+ * Files may grow past 4 GiB: positions, sizes and the ext2 block map
+ * (through its triple-indirect block) all carry 64-bit offsets.
+ *
+ * Tests:
+ * 1. pwrite64() far past 4 GiB makes a sparse file of that size
+ * 2. The data reads back, and the hole before it reads as zeros
+ * 3. A write across the 4 GiB boundary reads back whole
+ * 4. lseek() reports 64-bit positions and refuses negative ones
+ * 5. stat() gives the size in st_size and st_size_high
+ * 6. Offsets past what the filesystem can hold are refused
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_LSEEK         15
+#define SYS_STAT          16
+#define SYS_UNLINK        18
+#define SYS_PREAD64       82
+#define SYS_PWRITE64      83
+
+/* Open flags */
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+
+#define SEEK_SET  0
+#define SEEK_CUR  1
+#define SEEK_END  2
+
+#define STDOUT_FD 1
+
+#define TEST_FILE "/largefile_test.bin"
+
+#define GIB (1L << 30)
+
+/* Far enough out to need the triple-indirect block on 1 KiB blocks */
+#define FAR_OFFSET (5 * GIB)
+
+/* Must match kernel vfs_stat_t */
+typedef struct {
+    uint32_t st_ino;
+    uint16_t st_mode;
+    uint16_t st_uid;
+    uint16_t st_gid;
+    uint16_t st_pad;
+    uint32_t st_size;
+    uint32_t st_type;
+    uint32_t st_size_high;
+} stat_t;
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall4(n, a1, a2, a3, a4) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0644);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long lseek(int fd, long offset, int whence) {
+    return syscall3(SYS_LSEEK, fd, offset, whence);
+}
+
+static inline long stat(const char *path, stat_t *st) {
+    return syscall2(SYS_STAT, path, st);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+static inline long pread(int fd, void *buf, size_t len, long offset) {
+    return syscall4(SYS_PREAD64, fd, buf, len, offset);
+}
+
+static inline long pwrite(int fd, const void *buf, size_t len, long offset) {
+    return syscall4(SYS_PWRITE64, fd, buf, len, offset);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static int same(const char *a, const char *b, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (a[i] != b[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int all_zero(const char *a, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (a[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void _start(void) {
+    print("\n========================================\n");
+    print("  Large File Test Suite\n");
+    print("========================================\n");
+
+    unlink(TEST_FILE);
+    int fd = open(TEST_FILE, O_RDWR | O_CREAT);
+    check(fd >= 0, "created the test file");
+    if (fd < 0) {
+        exit(1);
+    }
+
+    /* Test 1: Sparse write past 4 GiB */
+    print("\n[TEST 1] pwrite64() at 5 GiB...\n");
+    const char *tail = "large file tail";
+    size_t tail_len = strlen(tail);
+    check(pwrite(fd, tail, tail_len, FAR_OFFSET) == (long)tail_len, "wrote at 5 GiB");
+    check(lseek(fd, 0, SEEK_END) == FAR_OFFSET + (long)tail_len, "size is 5 GiB and the tail");
+
+    /* Test 2: Reading it back */
+    print("\n[TEST 2] Reading back...\n");
+    char buf[64];
+    check(pread(fd, buf, sizeof(buf), FAR_OFFSET) == (long)tail_len && same(buf, tail, tail_len),
+          "tail reads back");
+    check(pread(fd, buf, sizeof(buf), 3 * GIB) == sizeof(buf) && all_zero(buf, sizeof(buf)),
+          "hole reads as zeros");
+    check(pread(fd, buf, sizeof(buf), FAR_OFFSET + (long)tail_len) == 0,
+          "nothing past end of file");
+
+    /* Test 3: Across the 4 GiB boundary */
+    print("\n[TEST 3] Write across 4 GiB...\n");
+    check(pwrite(fd, "boundary", 8, 4 * GIB - 4) == 8, "wrote across the boundary");
+    check(pread(fd, buf, 8, 4 * GIB - 4) == 8 && same(buf, "boundary", 8), "reads back whole");
+    check(pread(fd, buf, 4, 4) == 4 && all_zero(buf, 4), "low offsets untouched");
+
+    /* Test 4: lseek() */
+    print("\n[TEST 4] 64-bit lseek()...\n");
+    check(lseek(fd, 6 * GIB, SEEK_SET) == 6 * GIB, "seek to 6 GiB");
+    check(lseek(fd, -GIB, SEEK_CUR) == FAR_OFFSET, "seek back 1 GiB");
+    check(lseek(fd, -7 * GIB, SEEK_END) < 0, "negative position refused");
+    check(lseek(fd, 0, SEEK_CUR) == FAR_OFFSET, "position untouched by the failure");
+    close(fd);
+
+    /* Test 5: stat() */
+    print("\n[TEST 5] stat() of a large file...\n");
+    stat_t st;
+    uint64_t size = FAR_OFFSET + tail_len;
+    check(stat(TEST_FILE, &st) == 0, "stat() succeeds");
+    check(st.st_size == (uint32_t)size && st.st_size_high == (uint32_t)(size >> 32),
+          "size split over st_size and st_size_high");
+
+    /* Test 6: Limits */
+    print("\n[TEST 6] Past the filesystem's limit...\n");
+    fd = open(TEST_FILE, O_RDWR);
+    check(pwrite(fd, "x", 1, 1L << 50) < 0, "write at 1 PiB refused");
+    check(lseek(fd, 0, SEEK_END) == (long)size, "size unchanged");
+    close(fd);
+    check(unlink(TEST_FILE) == 0, "removed the test file");
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,238 @@
+/**
+ * malloc_test.c - Test program for the userland allocator (lib/umalloc.h)
+ *
+ * Tests:
+ * 1. Size classes cover every small request with the nearest class
+ * 2. malloc() blocks are aligned, distinct, and reused after free()
+ * 3. Thousands of small blocks cost only a few sbrk() calls
+ * 4. Large blocks are mapped, and unmapped by free()
+ * 5. calloc() zeroes and realloc() keeps the contents
+ * 6. madvise(MADV_DONTNEED) drops pages, and free spans are given back
+ * 7. Threads allocating and freeing at once
+ */
+
+#include "../lib/ustdio.h"
+#include "../lib/umalloc.h"
+#include "../lib/thread.h"
+
+#define SMALL_BLOCKS        10000
+#define SPAN_BLOCKS         512
+#define NTHREADS            4
+#define THREAD_ROUNDS       2000
+#define STACK_SIZE          8192
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    printf("%s %s\n", ok ? "[PASS]" : "[FAIL]", name);
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static void *small[SMALL_BLOCKS];
+static void *spans[SPAN_BLOCKS];
+
+static thread_t threads[NTHREADS];
+static char stacks[NTHREADS][STACK_SIZE] __attribute__((aligned(16)));
+static volatile int thread_errors;
+
+/* Allocate, fill, check and free blocks of varying sizes */
+static int churn(void *arg) {
+    long id = (long)arg;
+    void *live[8] = { 0 };
+
+    for (int i = 0; i < THREAD_ROUNDS; i++) {
+        int slot = i % 8;
+        if (live[slot]) {
+            unsigned char *p = live[slot];
+            size_t size = malloc_usable_size(p);
+            for (size_t j = 0; j < size; j += 61) {
+                if (p[j] != (unsigned char)(id + slot)) {
+                    __atomic_fetch_add(&thread_errors, 1, __ATOMIC_RELAXED);
+                    break;
+                }
+            }
+            free(p);
+        }
+        size_t size = 16 + (size_t)((i * 37 + id * 11) % 3000);
+        live[slot] = malloc(size);
+        if (!live[slot]) {
+            __atomic_fetch_add(&thread_errors, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        memset(live[slot], (int)(id + slot), malloc_usable_size(live[slot]));
+    }
+    for (int slot = 0; slot < 8; slot++) {
+        free(live[slot]);
+    }
+    return 0;
+}
+
+void _start(void) {
+    umalloc_stats_t before, after;
+
+    printf("\n");
+    printf("========================================\n");
+    printf("     Userland malloc Test Program\n");
+    printf("========================================\n\n");
+
+    /* Test 1: Size classes */
+    printf("[TEST 1] Size classes...\n");
+    int classes_ok = 1;
+    for (size_t size = 1; size <= UMALLOC_SMALL_MAX; size++) {
+        int cls = umalloc_class(size);
+        if (cls < 0 || cls >= UMALLOC_CLASSES || umalloc_class_size(cls) < size ||
+            (cls > 0 && umalloc_class_size(cls - 1) >= size)) {
+            classes_ok = 0;
+        }
+    }
+    check(classes_ok, "every size maps to the smallest class that fits");
+    check(umalloc_class_size(UMALLOC_CLASSES - 1) == UMALLOC_SMALL_MAX, "the last class is UMALLOC_SMALL_MAX");
+
+    /* Test 2: Basic allocation */
+    printf("\n[TEST 2] malloc() and free()...\n");
+    char *a = malloc(24);
+    char *b = malloc(24);
+    char *z = malloc(0);
+    check(a && b && z && a != b && b != z, "blocks are distinct, even for malloc(0)");
+    check(((uintptr_t)a & (UMALLOC_ALIGN - 1)) == 0 && ((uintptr_t)b & (UMALLOC_ALIGN - 1)) == 0,
+          "blocks are 16-byte aligned");
+    strcpy(a, "hello, heap");
+    check(strcmp(a, "hello, heap") == 0 && malloc_usable_size(a) == 32, "a block holds its class size");
+    free(a);
+    check(malloc(20) == a, "a freed block is reused from the cache");
+    free(a);
+    free(b);
+    free(z);
+    free(NULL);
+
+    /* Test 3: Many small blocks */
+    printf("\n[TEST 3] Small blocks from spans...\n");
+    umalloc_get_stats(&before);
+    int small_ok = 1;
+    for (int i = 0; i < SMALL_BLOCKS; i++) {
+        small[i] = malloc(32);
+        if (!small[i]) {
+            small_ok = 0;
+            break;
+        }
+        *(int *)small[i] = i;
+    }
+    for (int i = 0; small_ok && i < SMALL_BLOCKS; i++) {
+        if (*(int *)small[i] != i) {
+            small_ok = 0;
+        }
+    }
+    umalloc_get_stats(&after);
+    check(small_ok, "10000 blocks hold their values");
+    printf("  sbrk() calls: %lu, spans: %lu\n", (unsigned long)(after.sbrk_calls - before.sbrk_calls),
+           (unsigned long)(after.spans - before.spans));
+    check(after.sbrk_calls - before.sbrk_calls <= SMALL_BLOCKS * 32 / (UMALLOC_SBRK_SPANS * UMALLOC_SPAN_SIZE) + 1,
+          "sbrk() grows the heap several spans at a time");
+    for (int i = 0; i < SMALL_BLOCKS; i++) {
+        free(small[i]);
+    }
+
+    /* Test 4: Large blocks */
+    printf("\n[TEST 4] Large blocks...\n");
+    umalloc_get_stats(&before);
+    unsigned char *big = malloc(100000);
+    umalloc_get_stats(&after);
+    check(big && !umalloc_in_heap(big) && after.mmaps == before.mmaps + 1, "a large block is mapped");
+    check(big && malloc_usable_size(big) >= 100000, "it is big enough");
+    if (big) {
+        big[0] = 1;
+        big[99999] = 2;
+    }
+    free(big);
+    umalloc_get_stats(&after);
+    check(after.munmaps == before.munmaps + 1, "free() unmaps it");
+
+    /* Test 5: calloc() and realloc() */
+    printf("\n[TEST 5] calloc() and realloc()...\n");
+    char *dirty = malloc(200);
+    memset(dirty, 0x5a, 200);
+    free(dirty);
+    unsigned char *zeroed = calloc(50, 4);
+    int zero_ok = zeroed != NULL;
+    for (int i = 0; zero_ok && i < 200; i++) {
+        if (zeroed[i] != 0) {
+            zero_ok = 0;
+        }
+    }
+    check(zero_ok, "calloc() zeroes a reused block");
+    check(calloc((size_t)-1 / 2, 4) == NULL, "calloc() refuses an overflowing size");
+    free(zeroed);
+
+    char *grow = malloc(40);
+    strcpy(grow, "keep me");
+    check(realloc(grow, 45) == grow, "realloc() within the class keeps the block");
+    grow = realloc(grow, 5000);
+    check(grow && strcmp(grow, "keep me") == 0, "realloc() to a larger class keeps the contents");
+    grow = realloc(grow, 50000);
+    check(grow && !umalloc_in_heap(grow) && strcmp(grow, "keep me") == 0, "realloc() into a mapping keeps the contents");
+    free(grow);
+
+    /* Test 6: Giving memory back */
+    printf("\n[TEST 6] madvise() and span release...\n");
+    unsigned char *map = (unsigned char *)umalloc_syscall(SYS_MMAP, 0, 2 * UMALLOC_PAGE_SIZE,
+                                                          PROT_READ | PROT_WRITE,
+                                                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    memset(map, 0xaa, 2 * UMALLOC_PAGE_SIZE);
+    long ret = umalloc_syscall(SYS_MADVISE, (long)map, 2 * UMALLOC_PAGE_SIZE, MADV_DONTNEED, 0, 0, 0);
+    check(ret == 0 && map[0] == 0 && map[UMALLOC_PAGE_SIZE + 100] == 0, "MADV_DONTNEED pages read back as zero");
+    map[0] = 7;
+    check(map[0] == 7, "the mapping stays usable");
+    check(umalloc_syscall(SYS_MADVISE, (long)map + 1, UMALLOC_PAGE_SIZE, MADV_DONTNEED, 0, 0, 0) == -1,
+          "an unaligned range is refused");
+    umalloc_syscall(SYS_MUNMAP, (long)map, 2 * UMALLOC_PAGE_SIZE, 0, 0, 0, 0);
+    check(umalloc_syscall(SYS_MADVISE, (long)map, UMALLOC_PAGE_SIZE, MADV_DONTNEED, 0, 0, 0) == -1,
+          "an unmapped range is refused");
+
+    umalloc_get_stats(&before);
+    for (int i = 0; i < SPAN_BLOCKS; i++) {
+        spans[i] = malloc(1000);
+        memset(spans[i], 0xcc, 1000);
+    }
+    for (int i = 0; i < SPAN_BLOCKS; i++) {
+        free(spans[i]);
+    }
+    umalloc_get_stats(&after);
+    printf("  spans released: %lu\n", (unsigned long)(after.spans_released - before.spans_released));
+    check(after.spans_released > before.spans_released, "emptied spans are given back");
+    for (int i = 0; i < SPAN_BLOCKS; i++) {
+        spans[i] = malloc(1000);
+    }
+    umalloc_get_stats(&before);
+    check(before.spans == after.spans && spans[SPAN_BLOCKS - 1] != NULL, "free spans are reused before the heap grows");
+    for (int i = 0; i < SPAN_BLOCKS; i++) {
+        free(spans[i]);
+    }
+
+    /* Test 7: Threads */
+    printf("\n[TEST 7] Threads...\n");
+    int created = 1;
+    for (long i = 0; i < NTHREADS; i++) {
+        if (thread_create(&threads[i], churn, (void *)i, stacks[i], STACK_SIZE) < 0) {
+            created = 0;
+        }
+    }
+    for (int i = 0; i < NTHREADS; i++) {
+        thread_join(&threads[i]);
+    }
+    check(created, "threads started");
+    check(thread_errors == 0, "no block was lost or overwritten");
+
+    /* Summary */
+    printf("\n========================================\n");
+    printf("Tests passed: %d\n", tests_passed);
+    printf("Tests failed: %d\n", tests_failed);
+    printf("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
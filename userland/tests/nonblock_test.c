@@ -0,0 +1,303 @@
+/**
+ * nonblock_test.c - Test program for O_NONBLOCK
+ *
+ * Tests:
+ * 1. pipe2(O_NONBLOCK) makes both ends fail with EAGAIN instead of blocking
+ * 2. A full non-blocking pipe takes a short write, then refuses more
+ * 3. F_SETFL toggles O_NONBLOCK on an open pipe
+ * 4. SPLICE_F_NONBLOCK on splice() and tee()
+ * 5. A non-blocking terminal read returns at once
+ * 6. Regular files accept O_NONBLOCK
+ */
+
+#include <stddef.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_SLEEP         5
+#define SYS_FORK          7
+#define SYS_WAIT          9
+#define SYS_GETTIME       12
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_UNLINK        18
+#define SYS_FCNTL         67
+#define SYS_SPLICE        68
+#define SYS_TEE           69
+#define SYS_PIPE2         75
+
+/* Open flags */
+#define O_RDWR     0x0002
+#define O_CREAT    0x0040
+#define O_TRUNC    0x0200
+#define O_NONBLOCK 0x0800
+
+/* fcntl commands */
+#define F_GETFL       3
+#define F_SETFL       4
+#define F_SETPIPE_SZ  1031
+
+#define SPLICE_F_NONBLOCK 0x02
+
+#define STDIN_FD  0
+#define STDOUT_FD 1
+
+#define FILE_PATH "/nonblock.dat"
+#define PAGE      4096
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall4(n, a1, a2, a3, a4) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall6(n, a1, a2, a3, a4, a5, a6) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long a4_reg asm("a4") = (long)(a5); \
+    register long a5_reg asm("a5") = (long)(a6); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(a4_reg), \
+                 "r"(a5_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long sleep_ms(long ms) {
+    return syscall1(SYS_SLEEP, ms);
+}
+
+static inline long fork(void) {
+    return syscall1(SYS_FORK, 0);
+}
+
+static inline long waitpid(long pid, int *status) {
+    return syscall3(SYS_WAIT, pid, status, 0);
+}
+
+static inline long gettime(void) {
+    return syscall1(SYS_GETTIME, 0);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0644);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+static inline long fcntl(int fd, int cmd, long arg) {
+    return syscall3(SYS_FCNTL, fd, cmd, arg);
+}
+
+static inline long pipe2(int fds[2], int flags) {
+    return syscall3(SYS_PIPE2, fds, flags, 0);
+}
+
+static inline long splice(int fd_in, long *off_in, int fd_out, long *off_out, size_t len,
+                          unsigned int flags) {
+    return syscall6(SYS_SPLICE, fd_in, off_in, fd_out, off_out, len, flags);
+}
+
+static inline long tee(int fd_in, int fd_out, size_t len, unsigned int flags) {
+    return syscall4(SYS_TEE, fd_in, fd_out, len, flags);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static char buf[2 * PAGE];
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("       O_NONBLOCK Test Program\n");
+    print("========================================\n\n");
+
+    int p[2], q[2];
+    if (pipe2(p, O_NONBLOCK) != 0 || pipe2(q, 0) != 0) {
+        print("[FAIL] setup failed\n");
+        exit(1);
+    }
+
+    /* Test 1: Empty non-blocking pipe */
+    print("[TEST 1] pipe2(O_NONBLOCK)...\n");
+    check((fcntl(p[0], F_GETFL, 0) & O_NONBLOCK) && (fcntl(p[1], F_GETFL, 0) & O_NONBLOCK),
+          "both ends non-blocking");
+    check(!(fcntl(q[0], F_GETFL, 0) & O_NONBLOCK), "plain pipe blocking");
+    long start = gettime();
+    check(read(p[0], buf, 16) < 0, "read from empty pipe fails");
+    check(gettime() - start < 50, "and returns at once");
+    check(write(p[1], "hi", 2) == 2 && read(p[0], buf, 16) == 2, "data still flows");
+    check(pipe2(q, 0x1234) < 0, "unknown pipe2 flags refused");
+
+    /* Test 2: Full non-blocking pipe */
+    print("\n[TEST 2] Writing into a full pipe...\n");
+    check(fcntl(p[1], F_SETPIPE_SZ, PAGE) == PAGE, "capacity cut to one page");
+    long n = write(p[1], buf, PAGE + 1000);
+    print("  Wrote: ");
+    print_num(n);
+    print(" bytes\n");
+    check(n == PAGE, "short write fills the pipe");
+    check(write(p[1], buf, 1) < 0, "next write fails instead of blocking");
+    check(read(p[0], buf, sizeof(buf)) == PAGE, "reader drains it");
+    check(write(p[1], buf, 1) == 1, "room again after the read");
+    read(p[0], buf, 1);
+
+    /* Test 3: Toggling with F_SETFL */
+    print("\n[TEST 3] F_SETFL on an open pipe...\n");
+    long flags = fcntl(p[0], F_GETFL, 0);
+    check(fcntl(p[0], F_SETFL, flags & ~O_NONBLOCK) == 0, "O_NONBLOCK cleared");
+    check(!(fcntl(p[0], F_GETFL, 0) & O_NONBLOCK), "F_GETFL agrees");
+    long pid = fork();
+    if (pid == 0) {
+        sleep_ms(50);
+        write(p[1], "w", 1);
+        exit(0);
+    }
+    start = gettime();
+    check(read(p[0], buf, 1) == 1 && buf[0] == 'w', "read now blocks for the writer");
+    check(gettime() - start >= 40, "and waited for it");
+    int status;
+    waitpid(pid, &status);
+    check(fcntl(p[0], F_SETFL, flags) == 0 && read(p[0], buf, 1) < 0, "set again: fails at once");
+
+    /* Test 4: splice() and tee() flags */
+    print("\n[TEST 4] SPLICE_F_NONBLOCK...\n");
+    int fd = open(FILE_PATH, O_RDWR | O_CREAT | O_TRUNC);
+    check(fd >= 0, "file created");
+    check(splice(q[0], NULL, fd, NULL, 100, SPLICE_F_NONBLOCK) < 0, "splice from empty pipe fails");
+    check(tee(q[0], p[1], 100, SPLICE_F_NONBLOCK) < 0, "tee from empty pipe fails");
+    check(splice(p[0], NULL, fd, NULL, 100, 0) < 0, "O_NONBLOCK on the pipe is enough");
+
+    /* Test 5: Terminal */
+    print("\n[TEST 5] Non-blocking terminal read...\n");
+    long stdin_flags = fcntl(STDIN_FD, F_GETFL, 0);
+    check(fcntl(STDIN_FD, F_SETFL, stdin_flags | O_NONBLOCK) == 0, "stdin set non-blocking");
+    start = gettime();
+    long r = read(STDIN_FD, buf, 1);
+    check((r < 0 || r == 1) && gettime() - start < 50, "read returns at once");
+    fcntl(STDIN_FD, F_SETFL, stdin_flags);
+
+    /* Test 6: Regular file */
+    print("\n[TEST 6] O_NONBLOCK on a regular file...\n");
+    close(fd);
+    fd = open(FILE_PATH, O_RDWR | O_NONBLOCK);
+    check(fd >= 0 && (fcntl(fd, F_GETFL, 0) & O_NONBLOCK), "opened with the flag");
+    check(write(fd, "data", 4) == 4, "writes as usual");
+
+    close(fd);
+    unlink(FILE_PATH);
+    close(p[0]);
+    close(p[1]);
+    close(q[0]);
+    close(q[1]);
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
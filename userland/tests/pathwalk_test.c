@@ -0,0 +1,327 @@
+/**
+ * pathwalk_test.c - Test program for path walks
+ *
+ * Paths are walked a component at a time from the root, or from the
+ * working directory for relative paths, with ".." following each
+ * directory's parent, across mount points too.
+ *
+ * Tests:
+ * 1. "." and ".." and repeated slashes in absolute paths
+ * 2. Relative paths from a working directory, and ".." above it
+ * 3. Creating and removing names through relative paths
+ * 4. ".." out of a mounted filesystem (/tmp) lands in the one below
+ * 5. A file before the last component is not a directory
+ * 6. "." and ".." can not be created or removed
+ * 7. Timing: deep relative lookups against the same absolute ones
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_GETTIME       12
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_STAT          16
+#define SYS_MKDIR         17
+#define SYS_UNLINK        18
+#define SYS_RMDIR         19
+#define SYS_CHDIR         28
+#define SYS_GETCWD        29
+
+/* Open flags */
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+
+#define STDOUT_FD 1
+
+#define TEST_ROOT "/pathwalk_test"
+#define DEEP      "/pathwalk_test/a/b/c/d"
+
+/* stat() calls timed in test 7 */
+#define LOOKUPS   1000
+
+typedef struct {
+    uint32_t st_ino;
+    uint16_t st_mode;
+    uint16_t st_uid;
+    uint16_t st_gid;
+    uint16_t st_pad;
+    uint32_t st_size;
+    uint32_t st_type;
+    uint32_t st_size_high;
+} stat_t;
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long gettime(void) {
+    return syscall1(SYS_GETTIME, 0);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0644);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long stat(const char *path, stat_t *st) {
+    return syscall2(SYS_STAT, path, st);
+}
+
+static inline long mkdir(const char *path) {
+    return syscall2(SYS_MKDIR, path, 0755);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+static inline long rmdir(const char *path) {
+    return syscall1(SYS_RMDIR, path);
+}
+
+static inline long chdir(const char *path) {
+    return syscall1(SYS_CHDIR, path);
+}
+
+static inline long getcwd(char *buf, size_t size) {
+    return syscall2(SYS_GETCWD, buf, size);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static int streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+/* Inode number of a path, 0 if it can not be found */
+static uint32_t ino(const char *path) {
+    stat_t st;
+    return stat(path, &st) == 0 ? st.st_ino : 0;
+}
+
+static int exists(const char *path) {
+    return ino(path) != 0;
+}
+
+/* Time LOOKUPS stat() calls of one path */
+static void time_lookups(const char *path, const char *label) {
+    stat_t st;
+    long found = 0;
+    long start = gettime();
+    for (int i = 0; i < LOOKUPS; i++) {
+        if (stat(path, &st) == 0) {
+            found++;
+        }
+    }
+    print("  ");
+    print(label);
+    print(": ");
+    print_num(LOOKUPS);
+    print(" lookups in ");
+    print_num(gettime() - start);
+    print(" ms\n");
+    check(found == LOOKUPS, "every lookup succeeded");
+}
+
+void _start(void) {
+    print("\n========================================\n");
+    print("  Path Walk Test Suite\n");
+    print("========================================\n");
+
+    mkdir(TEST_ROOT);
+    mkdir(TEST_ROOT "/a");
+    mkdir(TEST_ROOT "/a/b");
+    mkdir(TEST_ROOT "/a/b/c");
+    mkdir(DEEP);
+    long fd = open(TEST_ROOT "/a/file", O_RDWR | O_CREAT);
+    close(fd);
+
+    uint32_t root = ino("/");
+    uint32_t top = ino(TEST_ROOT);
+    uint32_t a = ino(TEST_ROOT "/a");
+    uint32_t b = ino(TEST_ROOT "/a/b");
+    uint32_t deep = ino(DEEP);
+    check(root && top && a && b && deep && fd >= 0, "built the test tree");
+
+    /* Test 1: Absolute paths */
+    print("\n[TEST 1] \".\", \"..\" and slashes in absolute paths...\n");
+    check(ino(TEST_ROOT "/./a//b/") == b, "\".\" and empty components are skipped");
+    check(ino(DEEP "/..") == ino(TEST_ROOT "/a/b/c"), "\"..\" is the parent");
+    check(ino(DEEP "/../../../..") == top, "several \"..\" in a row");
+    check(ino("/..") == root && ino("/../..") == root, "\"..\" of the root is the root");
+    check(ino("/../" "pathwalk_test/a") == a, "and the walk goes on from there");
+
+    /* Test 2: Relative paths */
+    print("\n[TEST 2] Relative paths...\n");
+    char cwd[64];
+    check(chdir(TEST_ROOT "/a/b") == 0, "chdir() into the tree");
+    check(getcwd(cwd, sizeof(cwd)) > 0 && streq(cwd, TEST_ROOT "/a/b"), "getcwd() reports it");
+    check(ino(".") == b, "\".\" is the working directory");
+    check(ino("c/d") == deep, "a path below it");
+    check(ino("..") == a, "\"..\" is its parent");
+    check(ino("../file") == ino(TEST_ROOT "/a/file"), "a file next to it");
+    check(ino("../../..") == root, "up to the root");
+    check(ino("c/d/../../../b/c/d") == deep, "down, up and down again");
+    check(chdir("c/d") == 0 && ino(".") == deep, "a relative chdir()");
+    check(getcwd(cwd, sizeof(cwd)) > 0 && streq(cwd, DEEP), "getcwd() has the full path");
+    check(chdir("../..") == 0 && ino(".") == b, "chdir(\"../..\")");
+
+    /* Test 3: Creating and removing */
+    print("\n[TEST 3] Creating and removing through relative paths...\n");
+    fd = open("new.txt", O_RDWR | O_CREAT);
+    check(fd >= 0, "created new.txt");
+    close(fd);
+    check(exists(TEST_ROOT "/a/b/new.txt"), "it is in the working directory");
+    check(mkdir("../sub") == 0 && exists(TEST_ROOT "/a/sub"), "mkdir(\"../sub\")");
+    check(rmdir("./../sub") == 0 && !exists(TEST_ROOT "/a/sub"), "rmdir(\"./../sub\")");
+    check(unlink("c/../new.txt") == 0 && !exists("new.txt"), "unlink(\"c/../new.txt\")");
+
+    /* Test 4: Mount points */
+    print("\n[TEST 4] \"..\" across a mount point...\n");
+    check(chdir("/tmp") == 0, "chdir(\"/tmp\")");
+    check(ino("..") == root, "\"..\" of /tmp is /");
+    check(ino("../pathwalk_test/a/b") == b, "and leads back into the root filesystem");
+    check(mkdir("walk") == 0 && chdir("walk") == 0, "a directory in tmpfs");
+    check(ino("../..") == root, "two levels up is / again");
+    check(ino("../../tmp") == ino("/tmp"), "and /tmp is the tmpfs root");
+    check(chdir("..") == 0 && rmdir("walk") == 0, "removed it");
+    check(rmdir("/tmp") < 0, "the mount point can not be removed");
+    check(chdir(TEST_ROOT "/a/b") == 0, "back in the tree");
+
+    /* Test 5: Not a directory */
+    print("\n[TEST 5] Files in the middle of a path...\n");
+    check(!exists("../file/x"), "a name under a file");
+    check(!exists("../file/.."), "\"..\" of a file");
+    check(chdir("../file") < 0, "chdir() to a file");
+    check(mkdir("../file/x") < 0, "mkdir() under a file");
+
+    /* Test 6: "." and ".." */
+    print("\n[TEST 6] \".\" and \"..\" as the last component...\n");
+    check(rmdir(".") < 0 && ino(".") == b, "rmdir(\".\") refused");
+    check(rmdir("c/..") < 0 && exists(TEST_ROOT "/a/b/c"), "rmdir(\"c/..\") refused");
+    check(unlink("..") < 0, "unlink(\"..\") refused");
+    check(mkdir("c/d/.") < 0, "mkdir() of an existing \".\" refused");
+
+    /* Test 7: Timing */
+    print("\n[TEST 7] Deep lookups...\n");
+    time_lookups(DEEP, "absolute      ");
+    time_lookups("c/d", "relative      ");
+    time_lookups("c/d/../d", "with \"..\"     ");
+
+    /* Clean up */
+    chdir("/");
+    rmdir(DEEP);
+    rmdir(TEST_ROOT "/a/b/c");
+    rmdir(TEST_ROOT "/a/b");
+    unlink(TEST_ROOT "/a/file");
+    rmdir(TEST_ROOT "/a");
+    rmdir(TEST_ROOT);
+    check(!exists(TEST_ROOT), "cleaned up");
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
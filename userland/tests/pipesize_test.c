@@ -0,0 +1,234 @@
+/**
+ * pipesize_test.c - Test program for pipe capacity and F_SETPIPE_SZ
+ *
+ * Tests:
+ * 1. A new pipe reports the 64KB default capacity
+ * 2. 64KB can be written with nobody reading
+ * 3. Shrinking a full pipe and oversized requests are refused
+ * 4. Requested sizes are rounded up to whole pages
+ * 5. Data comes back intact, in order, across many pages
+ */
+
+#include <stddef.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_CLOSE         14
+#define SYS_PIPE          26
+#define SYS_FCNTL         67
+
+/* fcntl commands */
+#define F_SETPIPE_SZ      1031
+#define F_GETPIPE_SZ      1032
+
+#define STDOUT_FD 1
+
+#define DEF_SIZE   65536
+#define MAX_SIZE   262144
+#define CHUNK      4096
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long pipe(int fds[2]) {
+    return syscall1(SYS_PIPE, fds);
+}
+
+static inline long fcntl(int fd, int cmd, long arg) {
+    return syscall3(SYS_FCNTL, fd, cmd, arg);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static unsigned char chunk[CHUNK];
+
+/* Byte i of the test stream */
+static unsigned char pattern(long i) {
+    return (unsigned char)(i * 7 + (i >> 12));
+}
+
+/* Write len pattern bytes starting at stream offset base; returns bytes written */
+static long write_pattern(int fd, long base, long len) {
+    long done = 0;
+    while (done < len) {
+        long n = len - done < CHUNK ? len - done : CHUNK;
+        for (long i = 0; i < n; i++) {
+            chunk[i] = pattern(base + done + i);
+        }
+        long r = write(fd, chunk, n);
+        if (r <= 0) {
+            break;
+        }
+        done += r;
+    }
+    return done;
+}
+
+/* Read len bytes and compare with the pattern; returns 1 if all match */
+static int read_pattern(int fd, long base, long len) {
+    long done = 0;
+    while (done < len) {
+        long n = len - done < CHUNK ? len - done : CHUNK;
+        long r = read(fd, chunk, n);
+        if (r <= 0) {
+            return 0;
+        }
+        for (long i = 0; i < r; i++) {
+            if (chunk[i] != pattern(base + done + i)) {
+                return 0;
+            }
+        }
+        done += r;
+    }
+    return 1;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    Pipe Size Test Program\n");
+    print("========================================\n\n");
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        print("[FAIL] pipe() failed\n");
+        exit(1);
+    }
+
+    /* Test 1: Default capacity */
+    print("[TEST 1] Default capacity...\n");
+    long size = fcntl(fds[0], F_GETPIPE_SZ, 0);
+    print("  F_GETPIPE_SZ: ");
+    print_num(size);
+    print("\n");
+    check(size == DEF_SIZE, "new pipe holds 64KB");
+    check(fcntl(fds[1], F_GETPIPE_SZ, 0) == size, "both ends report the same size");
+
+    /* Test 2: Fill without a reader */
+    print("\n[TEST 2] Filling the pipe...\n");
+    check(write_pattern(fds[1], 0, DEF_SIZE) == DEF_SIZE, "64KB written without blocking");
+
+    /* Test 3: Refused resizes */
+    print("\n[TEST 3] Refused resizes...\n");
+    check(fcntl(fds[1], F_SETPIPE_SZ, CHUNK) < 0, "cannot shrink below queued data");
+    check(fcntl(fds[1], F_SETPIPE_SZ, MAX_SIZE + 1) < 0, "cannot grow past 256KB");
+    check(fcntl(fds[1], F_SETPIPE_SZ, 0) < 0, "size 0 is refused");
+    check(fcntl(STDOUT_FD, F_GETPIPE_SZ, 0) < 0, "not a pipe is refused");
+    check(fcntl(fds[0], F_GETPIPE_SZ, 0) == DEF_SIZE, "size unchanged after failures");
+
+    /* Test 4: Grow, then fill the extra room */
+    print("\n[TEST 4] Resizing...\n");
+    check(fcntl(fds[1], F_SETPIPE_SZ, MAX_SIZE) == MAX_SIZE, "grow to 256KB while full");
+    check(write_pattern(fds[1], DEF_SIZE, MAX_SIZE - DEF_SIZE) == MAX_SIZE - DEF_SIZE,
+          "extra room is usable");
+
+    /* Test 5: Read everything back */
+    print("\n[TEST 5] Reading back...\n");
+    check(read_pattern(fds[0], 0, MAX_SIZE), "256KB read back in order");
+    check(fcntl(fds[1], F_SETPIPE_SZ, 5000) == 8192, "5000 rounds up to 8192 when empty");
+    check(write_pattern(fds[1], 0, 8192) == 8192 && read_pattern(fds[0], 0, 8192),
+          "small pipe still carries data");
+
+    close(fds[0]);
+    close(fds[1]);
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,328 @@
+/**
+ * poll_test.c - Test program for poll() and epoll
+ *
+ * Tests:
+ * 1. poll() with no timeout reports pipe readiness at once
+ * 2. poll() with a timeout sleeps out the timeout on an idle pipe
+ * 3. A forked writer wakes a poll() waiting forever
+ * 4. Closing the write end reports POLLHUP
+ * 5. epoll is level-triggered by default
+ * 6. EPOLLET reports each new arrival once
+ * 7. A forked writer wakes epoll_wait(); the epoll descriptor polls
+ * 8. epoll_ctl() errors
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_SLEEP         5
+#define SYS_FORK          7
+#define SYS_WAIT          9
+#define SYS_GETTIME       12
+#define SYS_CLOSE         14
+#define SYS_PIPE          26
+#define SYS_POLL          71
+#define SYS_EPOLL_CREATE  72
+#define SYS_EPOLL_CTL     73
+#define SYS_EPOLL_WAIT    74
+
+/* poll() / epoll events */
+#define POLLIN    0x0001
+#define POLLOUT   0x0004
+#define POLLHUP   0x0010
+#define EPOLLIN   POLLIN
+#define EPOLLET   (1u << 31)
+
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+#define STDOUT_FD 1
+
+struct pollfd {
+    int fd;
+    short events;
+    short revents;
+};
+
+struct epoll_event {
+    uint32_t events;
+    uint64_t data;
+};
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall4(n, a1, a2, a3, a4) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long sleep_ms(long ms) {
+    return syscall1(SYS_SLEEP, ms);
+}
+
+static inline long fork(void) {
+    return syscall1(SYS_FORK, 0);
+}
+
+static inline long waitpid(long pid, int *status) {
+    return syscall3(SYS_WAIT, pid, status, 0);
+}
+
+static inline long gettime(void) {
+    return syscall1(SYS_GETTIME, 0);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long pipe(int fds[2]) {
+    return syscall1(SYS_PIPE, fds);
+}
+
+static inline long poll(struct pollfd *fds, unsigned int nfds, int timeout_ms) {
+    return syscall3(SYS_POLL, fds, nfds, timeout_ms);
+}
+
+static inline long epoll_create(int size) {
+    return syscall1(SYS_EPOLL_CREATE, size);
+}
+
+static inline long epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    return syscall4(SYS_EPOLL_CTL, epfd, op, fd, event);
+}
+
+static inline long epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout_ms) {
+    return syscall4(SYS_EPOLL_WAIT, epfd, events, maxevents, timeout_ms);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+/* Fork a child that writes one byte to fd after delay_ms */
+static long spawn_writer(int fd, long delay_ms) {
+    long pid = fork();
+    if (pid == 0) {
+        sleep_ms(delay_ms);
+        write(fd, "w", 1);
+        exit(0);
+    }
+    return pid;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("       poll/epoll Test Program\n");
+    print("========================================\n\n");
+
+    int p[2], h[2];
+    if (pipe(p) != 0 || pipe(h) != 0) {
+        print("[FAIL] setup failed\n");
+        exit(1);
+    }
+
+    struct pollfd fds[2];
+    char c;
+    int status;
+
+    /* Test 1: Immediate poll */
+    print("[TEST 1] poll() with a zero timeout...\n");
+    fds[0].fd = p[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = p[1];
+    fds[1].events = POLLOUT;
+    check(poll(fds, 2, 0) == 1, "only one descriptor ready");
+    check(fds[0].revents == 0, "empty read end not readable");
+    check(fds[1].revents == POLLOUT, "write end writable");
+    write(p[1], "x", 1);
+    check(poll(fds, 1, 0) == 1 && fds[0].revents == POLLIN, "read end readable after a write");
+    read(p[0], &c, 1);
+
+    /* Test 2: Timeout */
+    print("\n[TEST 2] poll() timeout on an idle pipe...\n");
+    long start = gettime();
+    long ready = poll(fds, 1, 100);
+    long elapsed = gettime() - start;
+    print("  Slept: ");
+    print_num(elapsed);
+    print(" ms\n");
+    check(ready == 0, "nothing ready");
+    check(elapsed >= 90, "waited out the timeout");
+
+    /* Test 3: Woken by a writer */
+    print("\n[TEST 3] poll() woken by another process...\n");
+    long pid = spawn_writer(p[1], 50);
+    check(pid > 0, "writer forked");
+    ready = poll(fds, 1, -1);
+    check(ready == 1 && fds[0].revents == POLLIN, "woken with POLLIN");
+    check(read(p[0], &c, 1) == 1 && c == 'w', "the writer's byte is there");
+    waitpid(pid, &status);
+
+    /* Test 4: Hang-up */
+    print("\n[TEST 4] POLLHUP when the writer goes away...\n");
+    close(h[1]);
+    fds[1].fd = h[0];
+    fds[1].events = POLLIN;
+    check(poll(&fds[1], 1, 0) == 1 && (fds[1].revents & POLLHUP), "POLLHUP reported unasked");
+
+    /* Test 5: Level-triggered epoll */
+    print("\n[TEST 5] epoll, level-triggered...\n");
+    int ep = epoll_create(1);
+    check(ep >= 0, "epoll instance created");
+    struct epoll_event ev, out[4];
+    ev.events = EPOLLIN;
+    ev.data = 42;
+    check(epoll_ctl(ep, EPOLL_CTL_ADD, p[0], &ev) == 0, "pipe registered");
+    check(epoll_wait(ep, out, 4, 0) == 0, "nothing ready yet");
+    write(p[1], "ab", 2);
+    check(epoll_wait(ep, out, 4, 0) == 1 && out[0].data == 42 && out[0].events == EPOLLIN,
+          "readable with the user data");
+    check(epoll_wait(ep, out, 4, 0) == 1, "still reported while unread");
+    read(p[0], &c, 1);
+    read(p[0], &c, 1);
+    check(epoll_wait(ep, out, 4, 0) == 0, "quiet once drained");
+
+    /* Test 6: Edge-triggered epoll */
+    print("\n[TEST 6] epoll, edge-triggered...\n");
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data = 7;
+    check(epoll_ctl(ep, EPOLL_CTL_MOD, p[0], &ev) == 0, "switched to EPOLLET");
+    write(p[1], "a", 1);
+    check(epoll_wait(ep, out, 4, 0) == 1 && out[0].data == 7, "new data reported");
+    check(epoll_wait(ep, out, 4, 0) == 0, "not reported again while unread");
+    write(p[1], "b", 1);
+    check(epoll_wait(ep, out, 4, 0) == 1, "next arrival reported");
+    read(p[0], &c, 1);
+    read(p[0], &c, 1);
+
+    /* Test 7: Blocking epoll_wait */
+    print("\n[TEST 7] epoll_wait() woken by another process...\n");
+    pid = spawn_writer(p[1], 50);
+    check(epoll_wait(ep, out, 4, 5000) == 1 && out[0].data == 7, "woken by the write");
+    fds[0].fd = ep;
+    fds[0].events = POLLIN;
+    write(p[1], "c", 1);
+    check(poll(fds, 1, 0) == 1 && fds[0].revents == POLLIN, "epoll descriptor polls readable");
+    read(p[0], &c, 1);
+    read(p[0], &c, 1);
+    waitpid(pid, &status);
+
+    /* Test 8: Errors */
+    print("\n[TEST 8] epoll_ctl() errors...\n");
+    check(epoll_ctl(ep, EPOLL_CTL_ADD, p[0], &ev) < 0, "double add refused");
+    check(epoll_ctl(ep, EPOLL_CTL_DEL, p[0], NULL) == 0, "removed");
+    check(epoll_ctl(ep, EPOLL_CTL_DEL, p[0], NULL) < 0, "second removal refused");
+    check(epoll_ctl(ep, EPOLL_CTL_MOD, p[0], &ev) < 0, "change of unwatched refused");
+    check(epoll_ctl(ep, EPOLL_CTL_ADD, ep, &ev) < 0, "watching itself refused");
+    check(epoll_ctl(p[0], EPOLL_CTL_ADD, p[1], &ev) < 0, "non-epoll descriptor refused");
+
+    close(ep);
+    close(p[0]);
+    close(p[1]);
+    close(h[0]);
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
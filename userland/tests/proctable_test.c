@@ -0,0 +1,210 @@
+/**
+ * proctable_test.c - Test program for process table lookups
+ * 
+ * Tests:
+ * 1. More children than the old 64-slot table alive at once
+ * 2. waitpid() finds each child by PID, out of creation order
+ * 3. waitpid() with no children left fails
+ * 4. A child starts in its parent's process group
+ * 5. setpgid() moves a child into its own group and back
+ */
+
+#include <stddef.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_SLEEP         5
+#define SYS_FORK          7
+#define SYS_WAIT          9
+#define SYS_SETPGID       43
+#define SYS_GETPGID       44
+
+#define STDOUT_FD 1
+
+/* Children forked at once: more than the table used to hold */
+#define NR_CHILDREN 80
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const char *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long fork(void) {
+    return syscall1(SYS_FORK, 0);
+}
+
+static inline long waitpid(long pid, int *status) {
+    return syscall3(SYS_WAIT, pid, status, 0);
+}
+
+static inline long sleep_ms(long ms) {
+    return syscall1(SYS_SLEEP, ms);
+}
+
+static inline long setpgid(long pid, long pgid) {
+    return syscall2(SYS_SETPGID, pid, pgid);
+}
+
+static inline long getpgid(long pid) {
+    return syscall1(SYS_GETPGID, pid);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+    
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+    
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static long children[NR_CHILDREN];
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    Process Table Test Program\n");
+    print("========================================\n\n");
+    
+    /* Test 1: Fork more children than the old table limit */
+    print("[TEST 1] Forking ");
+    print_num(NR_CHILDREN);
+    print(" children...\n");
+    int forked = 0;
+    for (int i = 0; i < NR_CHILDREN; i++) {
+        long pid = fork();
+        if (pid == 0) {
+            /* Stay alive until all siblings exist, then exit with our index */
+            sleep_ms(200);
+            exit(i);
+        }
+        if (pid < 0) {
+            break;
+        }
+        children[i] = pid;
+        forked++;
+    }
+    check(forked == NR_CHILDREN, "all children forked");
+    
+    /* Test 2: Reap each child by PID, newest first */
+    print("\n[TEST 2] Waiting for each child by PID...\n");
+    int reaped = 0;
+    for (int i = forked - 1; i >= 0; i--) {
+        int status = -1;
+        if (waitpid(children[i], &status) == children[i] && ((status >> 8) & 0xFF) == i) {
+            reaped++;
+        }
+    }
+    check(reaped == forked, "every child reaped with its exit code");
+    
+    /* Test 3: Nothing left to wait for */
+    print("\n[TEST 3] Waiting with no children...\n");
+    check(waitpid(-1, NULL) < 0, "waitpid fails with no children");
+    
+    /* Test 4: Process group is inherited */
+    print("\n[TEST 4] Inherited process group...\n");
+    long my_pgid = getpgid(0);
+    long pid = fork();
+    if (pid == 0) {
+        sleep_ms(200);
+        exit(0);
+    }
+    check(pid > 0 && getpgid(pid) == my_pgid, "child in parent's group");
+    
+    /* Test 5: Move the child to its own group and back */
+    print("\n[TEST 5] setpgid() on a child...\n");
+    check(setpgid(pid, pid) == 0 && getpgid(pid) == pid, "child leads its own group");
+    check(setpgid(pid, my_pgid) == 0 && getpgid(pid) == my_pgid, "child rejoins parent's group");
+    check(setpgid(pid, 99999) < 0, "nonexistent group rejected");
+    waitpid(pid, NULL);
+    
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+    
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+    
+    exit(tests_failed > 0 ? 1 : 0);
+}
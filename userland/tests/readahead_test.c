@@ -0,0 +1,312 @@
+/**
+ * readahead_test.c - Test program for cached file reads and readahead
+ *
+ * Tests:
+ * 1. Sequential reads in small chunks return the file intact, and a
+ *    second pass is served from memory
+ * 2. Reads in scattered order and across page boundaries
+ * 3. read() sees data written through another descriptor
+ * 4. read() sees stores through a MAP_SHARED mapping without msync()
+ * 5. Reads at and across end of file
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_GETTIME       12
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_LSEEK         15
+#define SYS_UNLINK        18
+#define SYS_MMAP          24
+#define SYS_MUNMAP        25
+
+/* Open flags */
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+
+/* mmap() arguments */
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define MAP_SHARED    0x01
+
+#define SEEK_SET  0
+
+#define STDOUT_FD 1
+
+#define TEST_FILE   "/readahead_test.dat"
+
+/* 64 KB file: 16 pages, read in 512-byte chunks */
+#define PAGE        4096
+#define FILE_PAGES  16
+#define FILE_SIZE   (FILE_PAGES * PAGE)
+#define SMALL_READ  512
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall6(n, a1, a2, a3, a4, a5, a6) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long a4_reg asm("a4") = (long)(a5); \
+    register long a5_reg asm("a5") = (long)(a6); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(a4_reg), \
+                 "r"(a5_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long gettime(void) {
+    return syscall1(SYS_GETTIME, 0);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0644);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long lseek(int fd, long offset, int whence) {
+    return syscall3(SYS_LSEEK, fd, offset, whence);
+}
+
+static inline long mmap(void *addr, size_t len, int prot, int flags, int fd, long offset) {
+    return syscall6(SYS_MMAP, addr, len, prot, flags, fd, offset);
+}
+
+static inline long munmap(void *addr, size_t len) {
+    return syscall2(SYS_MUNMAP, addr, len);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static char buf[PAGE];
+
+/* Byte expected at a file offset */
+static char pattern(long offset) {
+    return (char)((offset * 13 + offset / 4096) & 0xFF);
+}
+
+static int matches(const char *data, long offset, long len) {
+    for (long i = 0; i < len; i++) {
+        if (data[i] != pattern(offset + i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Read the whole file in SMALL_READ chunks; returns 1 if all intact */
+static int read_sequential(int fd, const char *label) {
+    lseek(fd, 0, SEEK_SET);
+    int ok = 1;
+    long start = gettime();
+    for (long off = 0; off < FILE_SIZE; off += SMALL_READ) {
+        if (read(fd, buf, SMALL_READ) != SMALL_READ || !matches(buf, off, SMALL_READ)) {
+            ok = 0;
+            break;
+        }
+    }
+    print("  ");
+    print(label);
+    print(": ");
+    print_num(FILE_SIZE / SMALL_READ);
+    print(" reads in ");
+    print_num(gettime() - start);
+    print(" ms\n");
+    return ok;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    Readahead Test Program\n");
+    print("========================================\n\n");
+
+    /* Left over from an earlier run */
+    unlink(TEST_FILE);
+
+    int fd = open(TEST_FILE, O_RDWR | O_CREAT);
+    int written = 0;
+    for (long page = 0; page < FILE_PAGES; page++) {
+        for (long i = 0; i < PAGE; i++) {
+            buf[i] = pattern(page * PAGE + i);
+        }
+        if (write(fd, buf, PAGE) == PAGE) {
+            written++;
+        }
+    }
+    close(fd);
+    check(fd >= 0 && written == FILE_PAGES, "created a 64 KB file");
+
+    /* Test 1: Sequential */
+    print("\n[TEST 1] Sequential reads...\n");
+    fd = open(TEST_FILE, O_RDWR);
+    check(read_sequential(fd, "first pass"), "first pass intact");
+    check(read_sequential(fd, "second pass"), "second pass intact");
+
+    /* Test 2: Scattered and unaligned */
+    print("\n[TEST 2] Scattered reads...\n");
+    int ok = 1;
+    for (long n = 0; n < FILE_PAGES; n++) {
+        long page = (n * 7) % FILE_PAGES;
+        lseek(fd, page * PAGE, SEEK_SET);
+        if (read(fd, buf, PAGE) != PAGE || !matches(buf, page * PAGE, PAGE)) {
+            ok = 0;
+        }
+    }
+    check(ok, "whole pages in scattered order");
+    lseek(fd, PAGE - 6, SEEK_SET);
+    check(read(fd, buf, 20) == 20 && matches(buf, PAGE - 6, 20), "read across a page boundary");
+    lseek(fd, 3 * PAGE + 100, SEEK_SET);
+    check(read(fd, buf, 2 * PAGE) == 2 * PAGE && matches(buf, 3 * PAGE + 100, PAGE),
+          "unaligned read spanning three pages");
+
+    /* Test 3: write() coherence */
+    print("\n[TEST 3] Writes through another descriptor...\n");
+    int fd2 = open(TEST_FILE, O_RDWR);
+    lseek(fd2, 2 * PAGE + 10, SEEK_SET);
+    check(write(fd2, "ZZZZ", 4) == 4, "wrote 4 bytes");
+    close(fd2);
+    lseek(fd, 2 * PAGE, SEEK_SET);
+    check(read(fd, buf, 20) == 20 && buf[9] == pattern(2 * PAGE + 9) &&
+          buf[10] == 'Z' && buf[13] == 'Z' && buf[14] == pattern(2 * PAGE + 14),
+          "read() sees the new bytes");
+
+    /* Test 4: Shared mapping coherence */
+    print("\n[TEST 4] Stores through a shared mapping...\n");
+    long addr = mmap(NULL, PAGE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 5 * PAGE);
+    check(addr >= 0, "mapped page 5");
+    if (addr >= 0) {
+        char *map = (char *)addr;
+        map[0] = 'M';
+        map[PAGE - 1] = 'N';
+        lseek(fd, 5 * PAGE, SEEK_SET);
+        check(read(fd, buf, PAGE) == PAGE && buf[0] == 'M' && buf[PAGE - 1] == 'N' &&
+              matches(buf + 1, 5 * PAGE + 1, PAGE - 2),
+              "read() sees the stores");
+        munmap((void *)addr, PAGE);
+    }
+
+    /* Test 5: End of file */
+    print("\n[TEST 5] End of file...\n");
+    lseek(fd, FILE_SIZE - 10, SEEK_SET);
+    check(read(fd, buf, 100) == 10 && matches(buf, FILE_SIZE - 10, 10), "short read at the end");
+    check(read(fd, buf, 100) == 0, "nothing past the end");
+    close(fd);
+    unlink(TEST_FILE);
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,319 @@
+/**
+ * rgroup_test.c - Test program for resource groups
+ * 
+ * Tests:
+ * 1. /proc/rgroups lists the root group
+ * 2. Groups are created, named uniquely and checked
+ * 3. A child under a memory limit is killed past it, and fits under it
+ * 4. A child under a CPU quota is throttled every period
+ * 5. Empty groups are removed, and gone from /proc/rgroups
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../lib/vdso.h"
+
+/* Syscall numbers */
+#define SYS_EXIT            0
+#define SYS_WRITE           1
+#define SYS_READ            2
+#define SYS_SBRK            4
+#define SYS_FORK            7
+#define SYS_WAIT            9
+#define SYS_OPEN            13
+#define SYS_CLOSE           14
+#define SYS_RGROUP_CREATE   124
+#define SYS_RGROUP_DESTROY  125
+#define SYS_RGROUP_SETLIMIT 126
+#define SYS_RGROUP_ATTACH   127
+
+#define O_RDONLY  0
+#define STDOUT_FD 1
+#define PAGE_SIZE 4096
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const char *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long fork(void) {
+    return syscall1(SYS_FORK, 0);
+}
+
+static inline long waitpid(long pid, int *status) {
+    return syscall3(SYS_WAIT, pid, status, 0);
+}
+
+static inline void *sbrk(long increment) {
+    return (void *)syscall1(SYS_SBRK, increment);
+}
+
+/* As include/kernel/rgroup.h */
+typedef struct {
+    uint64_t cpu_quota_us;
+    uint64_t cpu_period_us;
+    uint64_t mem_limit_bytes;
+} rgroup_limits_t;
+
+static inline long rgroup_create(const char *name) {
+    return syscall1(SYS_RGROUP_CREATE, name);
+}
+
+static inline long rgroup_destroy(long id) {
+    return syscall1(SYS_RGROUP_DESTROY, id);
+}
+
+static inline long rgroup_setlimit(long id, uint64_t quota_us, uint64_t period_us, uint64_t mem_bytes) {
+    rgroup_limits_t limits = { quota_us, period_us, mem_bytes };
+    return syscall2(SYS_RGROUP_SETLIMIT, id, &limits);
+}
+
+static inline long rgroup_attach(long id, long pid) {
+    return syscall2(SYS_RGROUP_ATTACH, id, pid);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+    
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+    
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+#define MEM_LIMIT         (256 * 1024)          /* 64 pages */
+#define CPU_QUOTA_US      10000                 /* 10 ms */
+#define CPU_PERIOD_US     100000                /* every 100 ms */
+#define SPIN_NS           350000000UL
+#define GAP_NS            30000000UL            /* Off the CPU for longer than this */
+
+static char procbuf[2048];
+
+/* Does /proc/rgroups have a line naming the group? */
+static int listed(const char *name) {
+    long fd = open("/proc/rgroups", O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    long len = 0, n;
+    while (len < (long)sizeof(procbuf) - 1 &&
+           (n = read(fd, procbuf + len, sizeof(procbuf) - 1 - len)) > 0) {
+        len += n;
+    }
+    close(fd);
+    procbuf[len] = '\0';
+    
+    size_t name_len = strlen(name);
+    for (long i = 0; i + (long)name_len < len; i++) {
+        int match = (i == 0 || procbuf[i - 1] == ' ') && procbuf[i + name_len] == ' ';
+        for (size_t j = 0; match && j < name_len; j++) {
+            match = procbuf[i + j] == name[j];
+        }
+        if (match) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* In a child: join the group, then write to pages of new heap */
+static void touch_pages(long id, long pages) {
+    if (rgroup_attach(id, 0) < 0) {
+        exit(2);
+    }
+    char *heap = (char *)sbrk(pages * PAGE_SIZE);
+    if ((long)heap == -1) {
+        exit(3);
+    }
+    for (long i = 0; i < pages; i++) {
+        heap[i * PAGE_SIZE] = 1;
+    }
+    exit(0);
+}
+
+/* In a child: join the group, spin, and exit with the times we were throttled */
+static void spin(long id) {
+    if (rgroup_attach(id, 0) < 0) {
+        exit(200);
+    }
+    int gaps = 0;
+    uint64_t start = monotonic_ns();
+    uint64_t last = start;
+    while (last - start < SPIN_NS) {
+        uint64_t now = monotonic_ns();
+        if (now - last > GAP_NS) {
+            gaps++;
+        }
+        last = now;
+    }
+    exit(gaps);
+}
+
+static int exit_code(int status) {
+    return (status >> 8) & 0xFF;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("       Resource Group Test Program\n");
+    print("========================================\n\n");
+    
+    /* Test 1: The root group */
+    print("[TEST 1] /proc/rgroups...\n");
+    check(listed("root") == 1, "root group listed");
+    
+    /* Test 2: Create */
+    print("\n[TEST 2] Create groups...\n");
+    long mem = rgroup_create("rgtest-mem");
+    long cpu = rgroup_create("rgtest-cpu");
+    check(mem > 0 && cpu > 0 && mem != cpu, "two groups created");
+    check(rgroup_create("rgtest-mem") < 0, "duplicate name rejected");
+    check(rgroup_create("") < 0, "empty name rejected");
+    check(listed("rgtest-mem") == 1, "new group listed");
+    check(rgroup_setlimit(mem, 10, 0, 0) < 0, "quota under 1ms rejected");
+    check(rgroup_setlimit(mem, 0, 5000000, 0) < 0, "period over 1s rejected");
+    check(rgroup_setlimit(0, 0, 0, MEM_LIMIT) < 0, "root group not limited");
+    check(rgroup_attach(mem, 999999) < 0, "attach of no process rejected");
+    
+    /* Test 3: Memory limit */
+    print("\n[TEST 3] Memory limit...\n");
+    check(rgroup_setlimit(mem, 0, 0, MEM_LIMIT) == 0, "256KB limit set");
+    long pid = fork();
+    if (pid == 0) {
+        touch_pages(mem, 4 * MEM_LIMIT / PAGE_SIZE);
+    }
+    int status = 0;
+    check(pid > 0 && waitpid(pid, &status) == pid && exit_code(status) != 0 &&
+          exit_code(status) != 2 && exit_code(status) != 3,
+          "child writing 1MB killed");
+    pid = fork();
+    if (pid == 0) {
+        touch_pages(mem, 4);
+    }
+    status = -1;
+    check(pid > 0 && waitpid(pid, &status) == pid && exit_code(status) == 0,
+          "child writing 16KB fits");
+    
+    /* Test 4: CPU quota */
+    print("\n[TEST 4] CPU quota...\n");
+    check(rgroup_setlimit(cpu, CPU_QUOTA_US, CPU_PERIOD_US, 0) == 0, "10ms every 100ms set");
+    pid = fork();
+    if (pid == 0) {
+        spin(cpu);
+    }
+    status = -1;
+    int reaped = pid > 0 && waitpid(pid, &status) == pid;
+    print("  Throttled ");
+    print_num(reaped ? exit_code(status) : 0);
+    print(" times in 350ms\n");
+    check(reaped && exit_code(status) >= 2 && exit_code(status) < 200, "quota enforced every period");
+    
+    /* Test 5: Destroy */
+    print("\n[TEST 5] Destroy groups...\n");
+    check(rgroup_destroy(0) < 0, "root group kept");
+    check(rgroup_destroy(mem) == 0 && rgroup_destroy(cpu) == 0, "empty groups removed");
+    check(listed("rgtest-mem") == 0, "gone from /proc/rgroups");
+    check(rgroup_destroy(mem) < 0, "second destroy rejected");
+    
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+    
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+    
+    exit(tests_failed > 0 ? 1 : 0);
+}
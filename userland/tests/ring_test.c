@@ -0,0 +1,208 @@
+/**
+ * ring_test.c - Test program for batched syscall submission rings
+ * 
+ * Tests:
+ * 1. Bad ring sizes and misaligned rings are rejected
+ * 2. A batch of writes and a getpid run in one ring_enter
+ * 3. Completions come back in order with their user_data
+ * 4. Unknown and frame-needing syscalls complete with an error
+ * 5. A full completion queue holds back further submissions
+ */
+
+#include <stddef.h>
+#include "../lib/ring.h"
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_GETPID        3
+#define SYS_FORK          7
+
+#define STDOUT_FD 1
+
+/* Errno values */
+#define EINVAL  22
+#define ENOSYS  38
+
+#define RING_ENTRIES 8
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const char *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+    
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+    
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static uint64_t ring_mem[(URING_BYTES(RING_ENTRIES) + 7) / 8];
+static uring_t ring;
+
+static const char *lines[] = {
+    "  ring: line 1\n",
+    "  ring: line 2\n",
+    "  ring: line 3\n",
+    "  ring: line 4\n",
+};
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("     Submission Ring Test Program\n");
+    print("========================================\n\n");
+    
+    /* Test 1: Bad setups */
+    print("[TEST 1] Rejecting bad rings...\n");
+    check(uring_init(&ring, ring_mem, 3) < 0, "non-power-of-two size rejected");
+    check(uring_init(&ring, ring_mem, 512) < 0, "oversized ring rejected");
+    check(uring_init(&ring, (char *)ring_mem + 4, RING_ENTRIES) < 0, "misaligned ring rejected");
+    check(uring_init(&ring, ring_mem, RING_ENTRIES) == 0, "ring registered");
+    
+    /* Test 2: One trap for a batch */
+    print("\n[TEST 2] Batch of five syscalls...\n");
+    for (int i = 0; i < 4; i++) {
+        uring_prep(&ring, uring_get_sqe(&ring), 100 + i, SYS_WRITE,
+                   STDOUT_FD, (uint64_t)lines[i], strlen(lines[i]));
+    }
+    uring_prep(&ring, uring_get_sqe(&ring), 200, SYS_GETPID, 0, 0, 0);
+    check(uring_submit(&ring) == 5, "all five ran in one submit");
+    
+    /* Test 3: Completions in order */
+    print("\n[TEST 3] Collecting completions...\n");
+    int in_order = 1;
+    for (int i = 0; i < 4; i++) {
+        uring_cqe_t *cqe = uring_peek_cqe(&ring);
+        if (!cqe || cqe->user_data != (uint64_t)(100 + i) ||
+            cqe->result != (int64_t)strlen(lines[i]) || cqe->error != 0) {
+            in_order = 0;
+        }
+        if (cqe) {
+            uring_cqe_seen(&ring);
+        }
+    }
+    check(in_order, "writes completed in order with their lengths");
+    uring_cqe_t *cqe = uring_peek_cqe(&ring);
+    check(cqe && cqe->user_data == 200 && cqe->result == syscall1(SYS_GETPID, 0),
+          "getpid result matches a direct call");
+    if (cqe) {
+        uring_cqe_seen(&ring);
+    }
+    check(uring_peek_cqe(&ring) == 0, "completion queue drained");
+    
+    /* Test 4: Errors come back in the completion */
+    print("\n[TEST 4] Failing submissions...\n");
+    uring_prep(&ring, uring_get_sqe(&ring), 1, 150, 0, 0, 0);
+    uring_prep(&ring, uring_get_sqe(&ring), 2, SYS_FORK, 0, 0, 0);
+    check(uring_submit(&ring) == 2, "both submissions ran");
+    cqe = uring_peek_cqe(&ring);
+    check(cqe && cqe->result == -1 && cqe->error == ENOSYS, "unknown syscall gives ENOSYS");
+    if (cqe) {
+        uring_cqe_seen(&ring);
+    }
+    cqe = uring_peek_cqe(&ring);
+    check(cqe && cqe->result == -1 && cqe->error == EINVAL, "fork gives EINVAL");
+    if (cqe) {
+        uring_cqe_seen(&ring);
+    }
+    
+    /* Test 5: Full CQ */
+    print("\n[TEST 5] Full completion queue...\n");
+    for (int i = 0; i < RING_ENTRIES; i++) {
+        uring_prep(&ring, uring_get_sqe(&ring), i, SYS_GETPID, 0, 0, 0);
+    }
+    check(uring_submit(&ring) == RING_ENTRIES, "a full ring's worth ran");
+    uring_prep(&ring, uring_get_sqe(&ring), 99, SYS_GETPID, 0, 0, 0);
+    check(uring_submit(&ring) == 0, "nothing runs while the CQ is full");
+    for (int i = 0; i < RING_ENTRIES; i++) {
+        uring_cqe_seen(&ring);
+    }
+    check(uring_submit(&ring) == 1, "held-back entry runs once there is room");
+    cqe = uring_peek_cqe(&ring);
+    check(cqe && cqe->user_data == 99, "its completion follows");
+    
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+    
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+    
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,306 @@
+/**
+ * rofs_test.c - Test program for a read-only root image
+ *
+ * Booted from an image made with "make fs ROOTFS=rofs", the root is a
+ * compressed read-only filesystem: files read back as packed, nothing
+ * on it can be changed, and /tmp is still writable. On an ext2 root the
+ * test says so and passes without running.
+ *
+ * Tests:
+ * 1. A small file reads back what was packed
+ * 2. A large file reads the same sequentially and at scattered offsets
+ *    (across compressed block boundaries)
+ * 3. Opening for writing or truncating, creating, removing, chmod() and
+ *    chown() all fail, for root too, and change nothing
+ * 4. /tmp takes new files
+ * 5. Timing: reading the large file again, from the page cache
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_GETTIME       12
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_LSEEK         15
+#define SYS_MKDIR         17
+#define SYS_UNLINK        18
+#define SYS_RMDIR         19
+#define SYS_CHMOD         41
+#define SYS_CHOWN         42
+
+/* Open flags */
+#define O_RDONLY  0x0000
+#define O_WRONLY  0x0001
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+#define O_TRUNC   0x0200
+
+#define SEEK_SET  0
+
+#define STDOUT_FD 1
+
+#define PROBE_DIR  "/rofs_test_probe"
+#define SMALL_FILE "/test.txt"
+#define SMALL_TEXT "Hello from ThunderOS ext2 filesystem!\n"
+#define LARGE_FILE "/bin/ush"
+#define TMP_FILE   "/tmp/rofs_test.txt"
+
+/* Bytes of the large file compared (several 16 KiB blocks) */
+#define LARGE_SIZE 65536
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long gettime(void) {
+    return syscall1(SYS_GETTIME, 0);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0644);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long lseek(int fd, long offset, int whence) {
+    return syscall3(SYS_LSEEK, fd, offset, whence);
+}
+
+static inline long mkdir(const char *path) {
+    return syscall2(SYS_MKDIR, path, 0755);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+static inline long rmdir(const char *path) {
+    return syscall1(SYS_RMDIR, path);
+}
+
+static inline long chmod(const char *path, int mode) {
+    return syscall2(SYS_CHMOD, path, mode);
+}
+
+static inline long chown(const char *path, int uid, int gid) {
+    return syscall3(SYS_CHOWN, path, uid, gid);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static int same(const char *a, const char *b, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (a[i] != b[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static char large[LARGE_SIZE];
+static char chunk[LARGE_SIZE];
+
+/* Read up to len bytes of a file from the start */
+static long read_file(const char *path, char *buf, long len) {
+    long fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    long total = 0;
+    while (total < len) {
+        long n = read(fd, buf + total, (size_t)(len - total));
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+    }
+    close(fd);
+    return total;
+}
+
+/* The small file still holds what was packed */
+static int small_intact(void) {
+    char buf[64];
+    long n = read_file(SMALL_FILE, buf, sizeof(buf));
+    return n == (long)strlen(SMALL_TEXT) && same(buf, SMALL_TEXT, (size_t)n);
+}
+
+void _start(void) {
+    print("\n========================================\n");
+    print("  rofs Test Suite\n");
+    print("========================================\n");
+
+    /* An ext2 root takes the directory */
+    if (mkdir(PROBE_DIR) == 0) {
+        rmdir(PROBE_DIR);
+        print("\n  Root is writable (not a rofs image), nothing to test\n");
+        print("  Build the image with: make fs ROOTFS=rofs\n\n");
+        exit(0);
+    }
+
+    /* Test 1: Small file */
+    print("\n[TEST 1] Reading a small file...\n");
+    check(small_intact(), SMALL_FILE " reads back as packed");
+
+    /* Test 2: Large file */
+    print("\n[TEST 2] Reading a large file...\n");
+    long size = read_file(LARGE_FILE, large, LARGE_SIZE);
+    check(size > 0, "read " LARGE_FILE);
+    long fd = open(LARGE_FILE, O_RDONLY);
+    int scattered = fd >= 0;
+    for (long offset = 1; scattered && offset < size; offset += 6007) {
+        long len = size - offset < 5000 ? size - offset : 5000;
+        scattered = lseek(fd, offset, SEEK_SET) == offset &&
+                    read(fd, chunk, (size_t)len) == len &&
+                    same(chunk, large + offset, (size_t)len);
+    }
+    close(fd);
+    check(scattered, "reads at scattered offsets match");
+
+    /* Test 3: Nothing can be changed */
+    print("\n[TEST 3] Changing the image...\n");
+    check(open(SMALL_FILE, O_RDWR) < 0, "open(O_RDWR) refused");
+    check(open(SMALL_FILE, O_WRONLY) < 0, "open(O_WRONLY) refused");
+    check(open(SMALL_FILE, O_RDONLY | O_TRUNC) < 0, "open(O_TRUNC) refused");
+    check(open("/rofs_test_new.txt", O_RDWR | O_CREAT) < 0, "creating a file refused");
+    check(mkdir(PROBE_DIR) < 0, "mkdir() refused");
+    check(unlink(SMALL_FILE) < 0, "unlink() refused");
+    check(rmdir("/emptydir") < 0, "rmdir() refused");
+    check(chmod(SMALL_FILE, 0777) < 0, "chmod() refused");
+    check(chown(SMALL_FILE, 1, 1) < 0, "chown() refused");
+    check(small_intact(), SMALL_FILE " unchanged");
+    fd = open("/rofs_test_new.txt", O_RDONLY);
+    check(fd < 0, "no file was created");
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    /* Test 4: /tmp */
+    print("\n[TEST 4] Writing under /tmp...\n");
+    fd = open(TMP_FILE, O_RDWR | O_CREAT);
+    check(fd >= 0, "created " TMP_FILE);
+    check(write((int)fd, SMALL_TEXT, strlen(SMALL_TEXT)) == (long)strlen(SMALL_TEXT), "wrote to it");
+    close(fd);
+    char buf[64];
+    long n = read_file(TMP_FILE, buf, sizeof(buf));
+    check(n == (long)strlen(SMALL_TEXT) && same(buf, SMALL_TEXT, (size_t)n), "read it back");
+    check(unlink(TMP_FILE) == 0, "removed it");
+
+    /* Test 5: Timing */
+    print("\n[TEST 5] Reading the large file again...\n");
+    long start = gettime();
+    long again = read_file(LARGE_FILE, chunk, LARGE_SIZE);
+    print("  ");
+    print_num(again);
+    print(" bytes in ");
+    print_num(gettime() - start);
+    print(" ms (cached)\n");
+    check(again == size && same(chunk, large, (size_t)size), "same data");
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -6,6 +6,7 @@
  * 2. Multiple readers can hold lock simultaneously
  * 3. Writer has exclusive access
  * 4. Writers block new readers
+ * 5. Reader-preferring and phase-fair policies, invalid policy rejected
  */
 
 #include <stddef.h>
@@ -24,6 +25,11 @@
 #define SYS_RWLOCK_WRITE_UNLOCK 60
 #define SYS_RWLOCK_DESTROY     61
 
+/* sys_rwlock_create policies */
+#define RWLOCK_PREFER_WRITER    0
+#define RWLOCK_PREFER_READER    1
+#define RWLOCK_PHASE_FAIR       2
+
 #define STDOUT_FD 1
 
 /* Syscall helpers */
@@ -76,8 +82,8 @@ static inline long getpid(void) {
     return syscall0(SYS_GETPID);
 }
 
-static inline long rwlock_create(void) {
-    return syscall0(SYS_RWLOCK_CREATE);
+static inline long rwlock_create(int policy) {
+    return syscall1(SYS_RWLOCK_CREATE, policy);
 }
 
 static inline long rwlock_read_lock(int rwlock_id) {
@@ -168,7 +174,7 @@ void _start(void) {
     
     /* Test 1: Create rwlock */
     print("[TEST 1] Creating rwlock...\n");
-    long rwlock_id = rwlock_create();
+    long rwlock_id = rwlock_create(RWLOCK_PREFER_WRITER);
     if (rwlock_id >= 0) {
         print("  RWLock ID: ");
         print_num(rwlock_id);
@@ -312,6 +318,27 @@ void _start(void) {
         rwlock_read_unlock(rwlock_id);
     }
     
+    /* Test 8: Other policies */
+    print("\n[TEST 8] Reader-preferring and phase-fair rwlocks...\n");
+    int policies[2] = { RWLOCK_PREFER_READER, RWLOCK_PHASE_FAIR };
+    for (int i = 0; i < 2; i++) {
+        long id = rwlock_create(policies[i]);
+        if (id >= 0 &&
+            rwlock_read_lock(id) == 0 && rwlock_read_lock(id) == 0 &&
+            rwlock_read_unlock(id) == 0 && rwlock_read_unlock(id) == 0 &&
+            rwlock_write_lock(id) == 0 && rwlock_write_unlock(id) == 0 &&
+            rwlock_destroy(id) == 0) {
+            test_pass(i == 0 ? "reader-preferring rwlock" : "phase-fair rwlock");
+        } else {
+            test_fail(i == 0 ? "reader-preferring rwlock" : "phase-fair rwlock");
+        }
+    }
+    if (rwlock_create(7) < 0) {
+        test_pass("unknown policy rejected");
+    } else {
+        test_fail("unknown policy should be rejected");
+    }
+    
     /* Summary */
     print("\n========================================\n");
     print("  Test Summary\n");
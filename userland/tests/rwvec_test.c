@@ -0,0 +1,295 @@
+/**
+ * rwvec_test.c - Test program for positioned and vectored I/O
+ *
+ * pread64()/pwrite64() work at an offset and leave the file position
+ * alone; readv()/writev() move several buffers in one call.
+ *
+ * Tests:
+ * 1. writev() of a header and a payload lands as one contiguous write
+ * 2. pread64() at an offset, with the file position untouched
+ * 3. pwrite64() overwrites in place, with the file position untouched
+ * 4. readv() scatters into several buffers and stops short at end of file
+ * 5. preadv() from an offset
+ * 6. writev() and readv() on a pipe; pread64() on a pipe fails
+ * 7. Bad buffer counts and offsets are rejected
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_LSEEK         15
+#define SYS_UNLINK        18
+#define SYS_PIPE          26
+#define SYS_PREAD64       82
+#define SYS_PWRITE64      83
+#define SYS_READV         84
+#define SYS_WRITEV        85
+#define SYS_PREADV        86
+
+/* Open flags */
+#define O_RDONLY  0x0000
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+
+#define SEEK_SET  0
+#define SEEK_CUR  1
+
+#define STDOUT_FD 1
+
+#define TEST_FILE "/rwvec_test.txt"
+
+struct iovec {
+    void  *iov_base;
+    size_t iov_len;
+};
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall4(n, a1, a2, a3, a4) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0644);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long lseek(int fd, long offset, int whence) {
+    return syscall3(SYS_LSEEK, fd, offset, whence);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+static inline long pipe(int fds[2]) {
+    return syscall1(SYS_PIPE, fds);
+}
+
+static inline long pread(int fd, void *buf, size_t len, long offset) {
+    return syscall4(SYS_PREAD64, fd, buf, len, offset);
+}
+
+static inline long pwrite(int fd, const void *buf, size_t len, long offset) {
+    return syscall4(SYS_PWRITE64, fd, buf, len, offset);
+}
+
+static inline long readv(int fd, const struct iovec *iov, int iovcnt) {
+    return syscall3(SYS_READV, fd, iov, iovcnt);
+}
+
+static inline long writev(int fd, const struct iovec *iov, int iovcnt) {
+    return syscall3(SYS_WRITEV, fd, iov, iovcnt);
+}
+
+static inline long preadv(int fd, const struct iovec *iov, int iovcnt, long offset) {
+    return syscall4(SYS_PREADV, fd, iov, iovcnt, offset);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static int same(const char *a, const char *b, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (a[i] != b[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void _start(void) {
+    print("\n========================================\n");
+    print("  Positioned and Vectored I/O Test Suite\n");
+    print("========================================\n");
+
+    int fd = open(TEST_FILE, O_RDWR | O_CREAT);
+    check(fd >= 0, "created the test file");
+    if (fd < 0) {
+        exit(1);
+    }
+
+    /* Test 1: Gather */
+    print("\n[TEST 1] writev() of a header and a payload...\n");
+    char header[4] = { 'H', 'D', 'R', ':' };
+    const char *payload = "0123456789";
+    struct iovec out[3] = {
+        { header, sizeof(header) },
+        { NULL, 0 },
+        { (void *)payload, 10 },
+    };
+    check(writev(fd, out, 3) == 14, "wrote both buffers");
+    check(lseek(fd, 0, SEEK_CUR) == 14, "position moved by the total");
+
+    /* Test 2: pread64() */
+    print("\n[TEST 2] pread64() at an offset...\n");
+    char buf[32];
+    check(pread(fd, buf, 5, 4) == 5 && same(buf, "01234", 5), "read from offset 4");
+    check(pread(fd, buf, sizeof(buf), 10) == 4 && same(buf, "6789", 4),
+          "short read at end of file");
+    check(pread(fd, buf, sizeof(buf), 100) == 0, "nothing past end of file");
+    check(lseek(fd, 0, SEEK_CUR) == 14, "position untouched");
+
+    /* Test 3: pwrite64() */
+    print("\n[TEST 3] pwrite64() in place...\n");
+    check(pwrite(fd, "hdr", 3, 0) == 3, "overwrote the header");
+    check(lseek(fd, 0, SEEK_CUR) == 14, "position untouched");
+    check(pread(fd, buf, 4, 0) == 4 && same(buf, "hdr:", 4), "read it back");
+
+    /* Test 4: Scatter */
+    print("\n[TEST 4] readv() into three buffers...\n");
+    char a[4], b[6], c[8];
+    struct iovec in[3] = { { a, sizeof(a) }, { b, sizeof(b) }, { c, sizeof(c) } };
+    check(lseek(fd, 0, SEEK_SET) == 0, "rewound");
+    check(readv(fd, in, 3) == 14, "read to end of file");
+    check(same(a, "hdr:", 4) && same(b, "012345", 6) && same(c, "6789", 4),
+          "each buffer got its part");
+    check(lseek(fd, 0, SEEK_CUR) == 14, "position moved by the total");
+
+    /* Test 5: preadv() */
+    print("\n[TEST 5] preadv() from an offset...\n");
+    struct iovec two[2] = { { a, 2 }, { b, 3 } };
+    check(preadv(fd, two, 2, 6) == 5 && same(a, "23", 2) && same(b, "456", 3),
+          "read five bytes from offset 6");
+    check(lseek(fd, 0, SEEK_CUR) == 14, "position untouched");
+    close(fd);
+    unlink(TEST_FILE);
+
+    /* Test 6: Pipes */
+    print("\n[TEST 6] Vectored I/O on a pipe...\n");
+    int pipefd[2];
+    check(pipe(pipefd) == 0, "created a pipe");
+    check(writev(pipefd[1], out, 3) == 14, "writev() into the pipe");
+    struct iovec pin[2] = { { a, 4 }, { buf, sizeof(buf) } };
+    check(readv(pipefd[0], pin, 2) == 14 && same(a, "HDR:", 4) && same(buf, payload, 10),
+          "readv() took what was there without waiting for more");
+    check(pread(pipefd[0], buf, 1, 0) < 0, "pread64() on a pipe fails");
+    close(pipefd[0]);
+    close(pipefd[1]);
+
+    /* Test 7: Errors */
+    print("\n[TEST 7] Rejecting bad arguments...\n");
+    fd = open("/", O_RDONLY);
+    check(readv(fd, in, -1) < 0, "negative count");
+    check(readv(fd, in, 1025) < 0, "more than 1024 buffers");
+    check(pread(fd, buf, 1, -1) < 0, "negative offset");
+    struct iovec bad = { (void *)0x10, 16 };
+    check(readv(fd, &bad, 1) < 0, "unmapped buffer");
+    close(fd);
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,255 @@
+/**
+ * sched_test.c - Test program for sched_setattr()/sched_getattr()
+ * 
+ * Tests:
+ * 1. A new process is SCHED_NORMAL at nice 0
+ * 2. Nice values round-trip
+ * 3. SCHED_RR and SCHED_FIFO priorities round-trip
+ * 4. Bad parameters are rejected
+ * 5. SCHED_DEADLINE parameters round-trip
+ * 6. A busy deadline process is throttled to its runtime
+ * 7. Back to SCHED_NORMAL
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../lib/vdso.h"
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_SCHED_SETATTR 122
+#define SYS_SCHED_GETATTR 123
+
+#define STDOUT_FD 1
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall4(n, a1, a2, a3, a4) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const char *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+/* As include/kernel/scheduler.h */
+#define SCHED_NORMAL    0
+#define SCHED_FIFO      1
+#define SCHED_RR        2
+#define SCHED_DEADLINE  6
+
+typedef struct {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+} sched_attr_t;
+
+static inline long sched_setattr(int pid, const sched_attr_t *attr) {
+    return syscall3(SYS_SCHED_SETATTR, pid, attr, 0);
+}
+
+static inline long sched_getattr(int pid, sched_attr_t *attr) {
+    return syscall4(SYS_SCHED_GETATTR, pid, attr, sizeof(*attr), 0);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+    
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+    
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+#define DL_RUNTIME_NS     10000000UL    /* 10 ms */
+#define DL_PERIOD_NS      100000000UL   /* every 100 ms */
+#define SPIN_NS           350000000UL
+#define GAP_NS            30000000UL    /* Off the CPU for longer than this */
+
+static void attr_init(sched_attr_t *attr, uint32_t policy) {
+    uint8_t *p = (uint8_t *)attr;
+    for (size_t i = 0; i < sizeof(*attr); i++) {
+        p[i] = 0;
+    }
+    attr->size = sizeof(*attr);
+    attr->sched_policy = policy;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("       Scheduling Policy Test Program\n");
+    print("========================================\n\n");
+    
+    sched_attr_t attr, got;
+    
+    /* Test 1: Defaults */
+    print("[TEST 1] Default policy...\n");
+    check(sched_getattr(0, &got) == 0, "sched_getattr(0) succeeds");
+    check(got.sched_policy == SCHED_NORMAL && got.sched_nice == 0, "SCHED_NORMAL, nice 0");
+    check(got.size == sizeof(got), "size filled in");
+    
+    /* Test 2: Nice */
+    print("\n[TEST 2] Nice values...\n");
+    attr_init(&attr, SCHED_NORMAL);
+    attr.sched_nice = 5;
+    check(sched_setattr(0, &attr) == 0, "nice 5 accepted");
+    sched_getattr(0, &got);
+    check(got.sched_policy == SCHED_NORMAL && got.sched_nice == 5, "nice 5 read back");
+    
+    /* Test 3: Real-time */
+    print("\n[TEST 3] Real-time policies...\n");
+    attr_init(&attr, SCHED_RR);
+    attr.sched_priority = 3;
+    check(sched_setattr(0, &attr) == 0, "SCHED_RR priority 3 accepted");
+    sched_getattr(0, &got);
+    check(got.sched_policy == SCHED_RR && got.sched_priority == 3, "SCHED_RR read back");
+    attr.sched_policy = SCHED_FIFO;
+    attr.sched_priority = 1;
+    check(sched_setattr(0, &attr) == 0, "SCHED_FIFO priority 1 accepted");
+    sched_getattr(0, &got);
+    check(got.sched_policy == SCHED_FIFO && got.sched_priority == 1, "SCHED_FIFO read back");
+    
+    /* Test 4: Bad parameters */
+    print("\n[TEST 4] Bad parameters...\n");
+    attr.sched_priority = 11;
+    check(sched_setattr(0, &attr) < 0, "priority 11 rejected");
+    attr_init(&attr, 4);
+    check(sched_setattr(0, &attr) < 0, "unknown policy rejected");
+    attr_init(&attr, SCHED_DEADLINE);
+    attr.sched_runtime = DL_PERIOD_NS;
+    attr.sched_deadline = DL_RUNTIME_NS;
+    check(sched_setattr(0, &attr) < 0, "runtime past the deadline rejected");
+    attr_init(&attr, SCHED_NORMAL);
+    attr.size = 8;
+    check(sched_setattr(0, &attr) < 0, "bad size rejected");
+    check(syscall4(SYS_SCHED_GETATTR, 0, &got, 8, 0) < 0, "short buffer rejected");
+    check(sched_getattr(-5, &got) < 0, "bad pid rejected");
+    
+    /* Test 5: Deadline */
+    print("\n[TEST 5] SCHED_DEADLINE...\n");
+    attr_init(&attr, SCHED_DEADLINE);
+    attr.sched_runtime = DL_RUNTIME_NS;
+    attr.sched_deadline = DL_PERIOD_NS;
+    check(sched_setattr(0, &attr) == 0, "10ms every 100ms accepted");
+    sched_getattr(0, &got);
+    check(got.sched_policy == SCHED_DEADLINE && got.sched_runtime == DL_RUNTIME_NS &&
+          got.sched_deadline == DL_PERIOD_NS && got.sched_period == DL_PERIOD_NS,
+          "parameters read back, period from the deadline");
+    
+    /* Test 6: Spin, and watch the clock jump while we are throttled */
+    print("\n[TEST 6] Throttling...\n");
+    int gaps = 0;
+    uint64_t start = monotonic_ns();
+    uint64_t last = start;
+    while (last - start < SPIN_NS) {
+        uint64_t now = monotonic_ns();
+        if (now - last > GAP_NS) {
+            gaps++;
+        }
+        last = now;
+    }
+    print("  Throttled ");
+    print_num(gaps);
+    print(" times in 350ms\n");
+    check(gaps >= 2, "budget enforced every period");
+    
+    /* Test 7: Back to normal */
+    print("\n[TEST 7] Back to SCHED_NORMAL...\n");
+    attr_init(&attr, SCHED_NORMAL);
+    check(sched_setattr(0, &attr) == 0, "SCHED_NORMAL accepted");
+    sched_getattr(0, &got);
+    check(got.sched_policy == SCHED_NORMAL && got.sched_nice == 0, "SCHED_NORMAL read back");
+    
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+    
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+    
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,229 @@
+/**
+ * schedlat_test.c - Test program for the wakeup latency tracer (/proc/schedlat)
+ *
+ * Tests:
+ * 1. /proc/schedlat lists every class and the worst waits
+ * 2. Wakeups from sleep are counted in the fair class
+ * 3. A SCHED_FIFO process's wakeups are counted at its priority
+ * 4. The worst waits are listed, longest first
+ * 5. Back to SCHED_NORMAL, wakeups go to the fair class again
+ */
+
+#include "../lib/ustdio.h"
+
+#define SYS_SLEEP         5
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_SCHED_SETATTR 122
+
+#define O_RDONLY          0x0000
+
+/* As include/kernel/scheduler.h */
+#define SCHED_NORMAL      0
+#define SCHED_FIFO        1
+
+#define RT_PRIORITY       3      /* "rt3": no kernel thread runs there */
+#define WAKEUPS           20
+#define SLEEP_MS          1
+
+typedef struct {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+} sched_attr_t;
+
+static const char *classes[] = {
+    "rt10", "rt9", "rt8", "rt7", "rt6", "rt5", "rt4", "rt3", "rt2", "rt1", "fair", "deadline",
+};
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    printf("%s %s\n", ok ? "[PASS]" : "[FAIL]", name);
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static char schedlat[8192];
+
+/* Read the whole file; 0 on success */
+static int schedlat_read(void) {
+    int fd = (int)syscall3(SYS_OPEN, (long)"/proc/schedlat", O_RDONLY, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    long n = syscall3(SYS_READ, fd, (long)schedlat, sizeof(schedlat) - 1);
+    syscall1(SYS_CLOSE, fd);
+    if (n <= 0) {
+        return -1;
+    }
+    schedlat[n] = '\0';
+    return 0;
+}
+
+static char *next_line(char *line) {
+    while (*line && *line != '\n') {
+        line++;
+    }
+    return *line ? line + 1 : line;
+}
+
+/* Parse the next decimal number, moving *p past it */
+static long parse_number(char **p) {
+    while (**p == ' ') {
+        (*p)++;
+    }
+    if (**p < '0' || **p > '9') {
+        return -1;
+    }
+    long value = 0;
+    while (**p >= '0' && **p <= '9') {
+        value = value * 10 + (**p - '0');
+        (*p)++;
+    }
+    return value;
+}
+
+/* Line of a class (or "irqoff"), or NULL */
+static char *class_line(const char *name) {
+    size_t len = strlen(name);
+    for (char *line = schedlat; *line; line = next_line(line)) {
+        if (strncmp(line, name, len) == 0 && line[len] == ' ') {
+            return line + len;
+        }
+    }
+    return NULL;
+}
+
+/* Column of a class line (0 count, 1 total_us, 2 max_us), or -1 */
+static long class_field(const char *name, int column) {
+    char *p = class_line(name);
+    if (!p) {
+        return -1;
+    }
+    long value = -1;
+    for (int i = 0; i <= column; i++) {
+        value = parse_number(&p);
+    }
+    return value;
+}
+
+/* Wakeups of a class after sleeping count times */
+static long sleep_and_count(const char *name, int count) {
+    for (int i = 0; i < count; i++) {
+        syscall1(SYS_SLEEP, SLEEP_MS);
+    }
+    if (schedlat_read() < 0) {
+        return -1;
+    }
+    return class_field(name, 0);
+}
+
+static long set_policy(uint32_t policy, uint32_t priority) {
+    sched_attr_t attr = { 0 };
+    attr.size = sizeof(attr);
+    attr.sched_policy = policy;
+    attr.sched_priority = priority;
+    return syscall3(SYS_SCHED_SETATTR, 0, (long)&attr, 0);
+}
+
+void _start(void) {
+    printf("\n");
+    printf("========================================\n");
+    printf("     Wakeup Latency Test Program\n");
+    printf("========================================\n\n");
+
+    /* Test 1: The file */
+    printf("[TEST 1] /proc/schedlat...\n");
+    check(schedlat_read() == 0, "the file reads");
+    int listed = 1;
+    for (unsigned i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (!class_line(classes[i])) {
+            listed = 0;
+        }
+    }
+    check(listed, "every class is listed");
+    check(class_line("irqoff") != NULL, "interrupts-off sections are listed");
+    int worst_header = 0;
+    for (char *line = schedlat; *line; line = next_line(line)) {
+        if (strncmp(line, "latency_us", 10) == 0) {
+            worst_header = 1;
+        }
+    }
+    check(worst_header, "the worst waits have a header");
+
+    /* Test 2: Fair wakeups */
+    printf("\n[TEST 2] Fair class...\n");
+    long fair = class_field("fair", 0);
+    long now = sleep_and_count("fair", WAKEUPS);
+    check(now >= fair + WAKEUPS, "each wakeup from sleep is counted");
+
+    /* Test 3: Real-time wakeups */
+    printf("\n[TEST 3] SCHED_FIFO priority 3...\n");
+    long rt = class_field("rt3", 0);
+    long rt_total = class_field("rt3", 1);
+    check(set_policy(SCHED_FIFO, RT_PRIORITY) == 0, "SCHED_FIFO set");
+    now = sleep_and_count("rt3", WAKEUPS);
+    check(now >= rt + WAKEUPS, "its wakeups are counted at its priority");
+    if (now > rt) {
+        printf("  wakeups: %ld, mean %ld us, max %ld us\n", now - rt,
+               (class_field("rt3", 1) - rt_total) / (now - rt), class_field("rt3", 2));
+    }
+
+    /* Test 4: Worst waits */
+    printf("\n[TEST 4] Worst waits...\n");
+    int entries = 0, sorted = 1;
+    long first = -1, last = -1;
+    int in_worst = 0;
+    for (char *line = schedlat; *line; line = next_line(line)) {
+        if (strncmp(line, "latency_us", 10) == 0) {
+            in_worst = 1;
+            continue;
+        }
+        if (!in_worst) {
+            continue;
+        }
+        char *p = line;
+        long latency = parse_number(&p);
+        if (latency < 0) {
+            continue;
+        }
+        if (last >= 0 && latency > last) {
+            sorted = 0;
+        }
+        if (first < 0) {
+            first = latency;
+        }
+        last = latency;
+        entries++;
+    }
+    printf("  listed: %d, longest %ld us\n", entries, first);
+    check(entries > 0, "some waits are listed");
+    check(sorted, "longest first");
+
+    /* Test 5: Back to normal */
+    printf("\n[TEST 5] SCHED_NORMAL again...\n");
+    check(set_policy(SCHED_NORMAL, 0) == 0, "SCHED_NORMAL set");
+    fair = class_field("fair", 0);
+    rt = class_field("rt3", 0);
+    now = sleep_and_count("fair", WAKEUPS);
+    check(now >= fair + WAKEUPS && class_field("rt3", 0) == rt, "wakeups go to the fair class");
+
+    /* Summary */
+    printf("\n========================================\n");
+    printf("Tests passed: %d\n", tests_passed);
+    printf("Tests failed: %d\n", tests_failed);
+    printf("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
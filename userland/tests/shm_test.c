@@ -0,0 +1,315 @@
+/**
+ * shm_test.c - Test program for named shared memory (shm_open)
+ *
+ * Tests:
+ * 1. shm_open() creates, finds and refuses names as it should
+ * 2. A multi-megabyte object is sized with ftruncate() and mapped
+ * 3. A child that opens the object by name sees the parent's frame and
+ *    its reply shows up in the parent's mapping
+ * 4. A mapping inherited over fork() stays shared, not copy-on-write
+ * 5. shm_unlink() removes the name but not existing mappings
+ * 6. Invalid mappings are refused
+ */
+
+#include <stddef.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_FORK          7
+#define SYS_WAIT          9
+#define SYS_CLOSE         14
+#define SYS_MMAP          24
+#define SYS_MUNMAP        25
+#define SYS_SHM_OPEN      76
+#define SYS_SHM_UNLINK    77
+#define SYS_FTRUNCATE     78
+
+/* Open flags */
+#define O_RDONLY  0x0000
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+#define O_EXCL    0x0080
+
+/* mmap() arguments */
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+
+#define STDOUT_FD 1
+
+#define SHM_NAME "/shm_test_frame"
+
+/* One frame: 2MB */
+#define FRAME_SIZE (2L * 1024 * 1024)
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall6(n, a1, a2, a3, a4, a5, a6) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long a4_reg asm("a4") = (long)(a5); \
+    register long a5_reg asm("a5") = (long)(a6); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(a4_reg), \
+                 "r"(a5_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long fork(void) {
+    return syscall1(SYS_FORK, 0);
+}
+
+static inline long waitpid(long pid, int *status) {
+    return syscall3(SYS_WAIT, pid, status, 0);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long mmap(void *addr, size_t len, int prot, int flags, int fd, long offset) {
+    return syscall6(SYS_MMAP, addr, len, prot, flags, fd, offset);
+}
+
+static inline long munmap(void *addr, size_t len) {
+    return syscall2(SYS_MUNMAP, addr, len);
+}
+
+static inline long shm_open(const char *name, int flags) {
+    return syscall3(SYS_SHM_OPEN, name, flags, 0600);
+}
+
+static inline long shm_unlink(const char *name) {
+    return syscall1(SYS_SHM_UNLINK, name);
+}
+
+static inline long ftruncate(int fd, long length) {
+    return syscall2(SYS_FTRUNCATE, fd, length);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static int exit_code(int status) {
+    return (status >> 8) & 0xFF;
+}
+
+/* Word i of frame number seq */
+static unsigned long pattern(long seq, long i) {
+    return (unsigned long)(seq * 0x9E3779B97F4A7C15UL) ^ (unsigned long)i;
+}
+
+static void fill_frame(unsigned long *frame, long seq) {
+    for (long i = 0; i < FRAME_SIZE / (long)sizeof(unsigned long); i++) {
+        frame[i] = pattern(seq, i);
+    }
+}
+
+static int frame_matches(const unsigned long *frame, long seq) {
+    for (long i = 0; i < FRAME_SIZE / (long)sizeof(unsigned long); i++) {
+        if (frame[i] != pattern(seq, i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Child of test 3: open the frame by name, check it, write the next one */
+static int consume_frame(void) {
+    int fd = shm_open(SHM_NAME, O_RDWR);
+    if (fd < 0) {
+        return 1;
+    }
+    long addr = mmap(NULL, FRAME_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr < 0) {
+        return 2;
+    }
+    unsigned long *frame = (unsigned long *)addr;
+    if (!frame_matches(frame, 1)) {
+        return 3;
+    }
+    fill_frame(frame, 2);
+    munmap(frame, FRAME_SIZE);
+    return 0;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    Shared Memory Test Program\n");
+    print("========================================\n\n");
+
+    /* Left over from an earlier run */
+    shm_unlink(SHM_NAME);
+
+    /* Test 1: Names */
+    print("[TEST 1] shm_open() names...\n");
+    int fd = shm_open(SHM_NAME, O_RDWR | O_CREAT | O_EXCL);
+    check(fd >= 0, "object created");
+    check(shm_open(SHM_NAME, O_RDWR | O_CREAT | O_EXCL) < 0, "O_EXCL refuses an existing name");
+    int fd2 = shm_open(SHM_NAME, O_RDONLY);
+    check(fd2 >= 0, "existing object opened without O_CREAT");
+    close(fd2);
+    check(shm_open("/shm_test_missing", O_RDWR) < 0, "missing object without O_CREAT fails");
+    check(shm_open("no_slash", O_RDWR | O_CREAT) < 0, "name without a leading slash refused");
+    check(shm_open("/a/b", O_RDWR | O_CREAT) < 0, "name with a second slash refused");
+
+    /* Test 2: Size and map */
+    print("\n[TEST 2] ftruncate() and mmap()...\n");
+    check(mmap(NULL, FRAME_SIZE, PROT_READ, MAP_SHARED, fd, 0) < 0, "empty object cannot be mapped");
+    check(ftruncate(fd, FRAME_SIZE) == 0, "sized to one frame");
+    long addr = mmap(NULL, FRAME_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    check(addr > 0, "frame mapped");
+    if (addr <= 0) {
+        exit(1);
+    }
+    unsigned long *frame = (unsigned long *)addr;
+    check(frame[0] == 0 && frame[FRAME_SIZE / sizeof(unsigned long) - 1] == 0, "new pages read as zero");
+    fill_frame(frame, 1);
+    print("  Frame: ");
+    print_num(FRAME_SIZE / 1024);
+    print(" KB\n");
+
+    /* Test 3: Another process by name */
+    print("\n[TEST 3] Frame passed to a child by name...\n");
+    int status = 0;
+    long pid = fork();
+    if (pid == 0) {
+        exit(consume_frame());
+    }
+    check(pid > 0 && waitpid(pid, &status) == pid && exit_code(status) == 0,
+          "child saw the frame intact");
+    check(frame_matches(frame, 2), "child's frame visible in the parent");
+
+    /* Test 4: Inherited mapping */
+    print("\n[TEST 4] Mapping inherited over fork()...\n");
+    pid = fork();
+    if (pid == 0) {
+        frame[0] = 0x5A5A;
+        frame[FRAME_SIZE / sizeof(unsigned long) - 1] = 0xA5A5;
+        exit(0);
+    }
+    check(pid > 0 && waitpid(pid, &status) == pid, "child wrote through the inherited mapping");
+    check(frame[0] == 0x5A5A && frame[FRAME_SIZE / sizeof(unsigned long) - 1] == 0xA5A5,
+          "writes are shared, not copied");
+
+    /* Test 5: Unlink */
+    print("\n[TEST 5] shm_unlink()...\n");
+    check(shm_unlink(SHM_NAME) == 0, "name removed");
+    check(shm_open(SHM_NAME, O_RDWR) < 0, "name no longer opens");
+    frame[1] = 0x1234;
+    check(frame[1] == 0x1234 && frame[0] == 0x5A5A, "existing mapping still works");
+    check(shm_unlink(SHM_NAME) < 0, "second unlink fails");
+
+    /* Test 6: Invalid mappings */
+    print("\n[TEST 6] Invalid mappings...\n");
+    check(mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) < 0, "MAP_PRIVATE refused");
+    check(mmap(NULL, FRAME_SIZE + 4096, PROT_READ, MAP_SHARED, fd, 0) < 0, "mapping past the end refused");
+    check(mmap(NULL, 4096, PROT_READ, MAP_SHARED, fd, 100) < 0, "unaligned offset refused");
+
+    munmap(frame, FRAME_SIZE);
+    close(fd);
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,407 @@
+/**
+ * signalfd_test.c - Test program for queued real-time signals and signalfd
+ *
+ * Tests:
+ * 1. sigprocmask() blocks, reports and refuses to block SIGKILL
+ * 2. An empty non-blocking signalfd fails with EAGAIN; short reads fail
+ * 3. Real-time signals queued with sigqueue() come back from one read(),
+ *    lowest signal first, each in send order with its value
+ * 4. Standard signals still coalesce
+ * 5. poll() and epoll report a signalfd readable; a child's signal wakes
+ *    epoll_wait() in the parent
+ * 6. A blocking read sleeps until a signal arrives
+ * 7. The queue has a limit; the mask can be changed on an open signalfd
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_GETPID        3
+#define SYS_SLEEP         5
+#define SYS_FORK          7
+#define SYS_WAIT          9
+#define SYS_KILL          11
+#define SYS_GETTIME       12
+#define SYS_CLOSE         14
+#define SYS_POLL          71
+#define SYS_EPOLL_CREATE  72
+#define SYS_EPOLL_CTL     73
+#define SYS_EPOLL_WAIT    74
+#define SYS_SIGQUEUE      79
+#define SYS_SIGPROCMASK   80
+#define SYS_SIGNALFD      81
+
+/* Signals */
+#define SIGKILL   9
+#define SIGUSR1   10
+#define SIGRTMIN  32
+
+#define SIG_BLOCK     0
+#define SIG_UNBLOCK   1
+#define SIG_SETMASK   2
+
+#define SI_QUEUE      (-1)
+#define SIGQUEUE_MAX  32
+
+#define SIGBIT(sig)   (1UL << (sig))
+
+/* Flags and events */
+#define O_NONBLOCK    0x0800
+#define POLLIN        0x0001
+#define EPOLLIN       POLLIN
+#define EPOLL_CTL_ADD 1
+
+#define STDOUT_FD 1
+
+struct pollfd {
+    int fd;
+    short events;
+    short revents;
+};
+
+struct epoll_event {
+    uint32_t events;
+    uint64_t data;
+};
+
+struct signalfd_siginfo {
+    uint32_t ssi_signo;
+    int32_t  ssi_errno;
+    int32_t  ssi_code;
+    uint32_t ssi_pid;
+    uint32_t ssi_uid;
+    int32_t  ssi_fd;
+    uint32_t ssi_tid;
+    uint32_t ssi_band;
+    uint32_t ssi_overrun;
+    uint32_t ssi_trapno;
+    int32_t  ssi_status;
+    int32_t  ssi_int;
+    uint64_t ssi_ptr;
+    uint8_t  pad[72];
+};
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall4(n, a1, a2, a3, a4) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long getpid(void) {
+    return syscall1(SYS_GETPID, 0);
+}
+
+static inline long sleep_ms(long ms) {
+    return syscall1(SYS_SLEEP, ms);
+}
+
+static inline long fork(void) {
+    return syscall1(SYS_FORK, 0);
+}
+
+static inline long waitpid(long pid, int *status) {
+    return syscall3(SYS_WAIT, pid, status, 0);
+}
+
+static inline long kill(long pid, int sig) {
+    return syscall2(SYS_KILL, pid, sig);
+}
+
+static inline long gettime(void) {
+    return syscall1(SYS_GETTIME, 0);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long poll(struct pollfd *fds, unsigned int nfds, int timeout_ms) {
+    return syscall3(SYS_POLL, fds, nfds, timeout_ms);
+}
+
+static inline long epoll_create(int size) {
+    return syscall1(SYS_EPOLL_CREATE, size);
+}
+
+static inline long epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    return syscall4(SYS_EPOLL_CTL, epfd, op, fd, event);
+}
+
+static inline long epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout_ms) {
+    return syscall4(SYS_EPOLL_WAIT, epfd, events, maxevents, timeout_ms);
+}
+
+static inline long sigqueue(long pid, int sig, long value) {
+    return syscall3(SYS_SIGQUEUE, pid, sig, value);
+}
+
+static inline long sigprocmask(int how, const uint64_t *set, uint64_t *oldset) {
+    return syscall3(SYS_SIGPROCMASK, how, set, oldset);
+}
+
+static inline long signalfd(int fd, const uint64_t *mask, int flags) {
+    return syscall3(SYS_SIGNALFD, fd, mask, flags);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static int exit_code(int status) {
+    return (status >> 8) & 0xFF;
+}
+
+#define MAX_RECORDS 40
+
+static struct signalfd_siginfo records[MAX_RECORDS];
+
+/* Read whatever is pending; returns the number of records */
+static long drain(int fd) {
+    long n = read(fd, records, sizeof(records));
+    return n < 0 ? n : n / (long)sizeof(struct signalfd_siginfo);
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    signalfd Test Program\n");
+    print("========================================\n\n");
+
+    long self = getpid();
+    uint64_t mask = SIGBIT(SIGUSR1) | SIGBIT(SIGRTMIN) | SIGBIT(SIGRTMIN + 1) | SIGBIT(SIGRTMIN + 2);
+    uint64_t old = ~0UL;
+
+    /* Test 1: Blocking */
+    print("[TEST 1] sigprocmask()...\n");
+    check(sigprocmask(SIG_SETMASK, &mask, &old) == 0 && old == 0, "signals blocked, old mask was empty");
+    uint64_t with_kill = mask | SIGBIT(SIGKILL);
+    sigprocmask(SIG_BLOCK, &with_kill, NULL);
+    check(sigprocmask(SIG_BLOCK, NULL, &old) == 0 && old == mask, "SIGKILL stays unblocked");
+    check(sigprocmask(7, &mask, NULL) < 0, "unknown operation refused");
+
+    /* Test 2: Empty descriptor */
+    print("\n[TEST 2] Empty signalfd...\n");
+    int fd = signalfd(-1, &mask, O_NONBLOCK);
+    check(fd >= 0, "signalfd created");
+    check(read(fd, records, sizeof(records)) < 0, "nothing pending: EAGAIN");
+    check(signalfd(-1, &mask, 0x1) < 0, "unknown flags refused");
+    sigqueue(self, SIGRTMIN, 1);
+    check(read(fd, records, sizeof(records[0]) - 1) < 0, "buffer smaller than a record refused");
+    drain(fd);
+
+    /* Test 3: Queued real-time signals */
+    print("\n[TEST 3] Batch of queued signals...\n");
+    int sent = 0;
+    for (long v = 0; v < 5; v++) {
+        if (sigqueue(self, SIGRTMIN + 1, 100 + v) == 0) {
+            sent++;
+        }
+    }
+    for (long v = 0; v < 2; v++) {
+        if (sigqueue(self, SIGRTMIN, 200 + v) == 0) {
+            sent++;
+        }
+    }
+    check(sent == 7, "seven signals queued");
+    long n = drain(fd);
+    check(n == 7, "all seven returned by one read()");
+    int ordered = n == 7;
+    for (int i = 0; ordered && i < 7; i++) {
+        uint32_t want_sig = i < 2 ? SIGRTMIN : SIGRTMIN + 1;
+        long want_val = i < 2 ? 200 + i : 100 + (i - 2);
+        if (records[i].ssi_signo != want_sig || records[i].ssi_int != want_val ||
+            records[i].ssi_ptr != (uint64_t)want_val) {
+            ordered = 0;
+        }
+    }
+    check(ordered, "lowest signal first, each in send order with its value");
+    check(n > 0 && records[0].ssi_code == SI_QUEUE && records[0].ssi_pid == (uint32_t)self,
+          "origin recorded as sigqueue() from this process");
+    check(drain(fd) < 0, "queue empty afterwards");
+
+    /* Test 4: Standard signals */
+    print("\n[TEST 4] Standard signals coalesce...\n");
+    kill(self, SIGUSR1);
+    kill(self, SIGUSR1);
+    kill(self, SIGUSR1);
+    n = drain(fd);
+    check(n == 1 && records[0].ssi_signo == SIGUSR1, "three kill()s, one record");
+
+    /* Test 5: Readiness */
+    print("\n[TEST 5] poll() and epoll...\n");
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    check(poll(&pfd, 1, 0) == 0, "idle signalfd not readable");
+    sigqueue(self, SIGRTMIN + 2, 5);
+    check(poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN), "pending signal makes it readable");
+    drain(fd);
+
+    int epfd = epoll_create(1);
+    struct epoll_event ev = { EPOLLIN, 42 };
+    check(epfd >= 0 && epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0, "signalfd added to epoll");
+    struct epoll_event out[4];
+    check(epoll_wait(epfd, out, 4, 0) == 0, "nothing ready yet");
+
+    int status = 0;
+    long pid = fork();
+    if (pid == 0) {
+        sleep_ms(50);
+        for (long v = 0; v < 3; v++) {
+            sigqueue(self, SIGRTMIN + 1, 300 + v);
+        }
+        exit(0);
+    }
+    long got = epoll_wait(epfd, out, 4, 2000);
+    check(got == 1 && out[0].data == 42, "child's signal woke epoll_wait()");
+    waitpid(pid, &status);
+    n = drain(fd);
+    check(n == 3 && records[2].ssi_int == 302 && records[0].ssi_pid == (uint32_t)pid,
+          "child's three signals read, sender is the child");
+    close(epfd);
+
+    /* Test 6: Blocking read */
+    print("\n[TEST 6] Blocking read...\n");
+    int bfd = signalfd(-1, &mask, 0);
+    pid = fork();
+    if (pid == 0) {
+        sleep_ms(50);
+        exit(sigqueue(self, SIGRTMIN, 77) == 0 ? 0 : 1);
+    }
+    long start = gettime();
+    long bytes = read(bfd, records, sizeof(records));
+    check(bytes == (long)sizeof(struct signalfd_siginfo) && records[0].ssi_int == 77,
+          "read() woke with the signal");
+    check(gettime() - start >= 40, "and it had been waiting");
+    check(pid > 0 && waitpid(pid, &status) == pid && exit_code(status) == 0, "sender done");
+    close(bfd);
+
+    /* Test 7: Limits and mask changes */
+    print("\n[TEST 7] Queue limit and mask changes...\n");
+    int queued = 0;
+    for (long v = 0; v < SIGQUEUE_MAX + 4; v++) {
+        if (sigqueue(self, SIGRTMIN + 1, v) == 0) {
+            queued++;
+        }
+    }
+    check(queued == SIGQUEUE_MAX, "sigqueue() fails once the queue is full");
+    print("  Queued: ");
+    print_num(queued);
+    print("\n");
+    uint64_t only_rt0 = SIGBIT(SIGRTMIN);
+    check(signalfd(fd, &only_rt0, 0) == fd, "mask changed in place");
+    check(drain(fd) < 0, "signals outside the new mask are not read");
+    check(signalfd(fd, &mask, 0) == fd && drain(fd) == SIGQUEUE_MAX, "restored mask reads them all");
+    check(signalfd(STDOUT_FD, &mask, 0) < 0, "changing a non-signalfd refused");
+
+    close(fd);
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,474 @@
+/**
+ * socket_test.c - Test program for UDP sockets, over loopback
+ *
+ * Tests:
+ * 1. socket() and bind() accept and refuse what they should
+ * 2. An empty socket fails with EAGAIN under MSG_DONTWAIT and SOCK_NONBLOCK
+ * 3. Datagrams go both ways over 127.0.0.1 with the sender's address;
+ *    oversized ones are refused and long ones cut short
+ * 4. poll() reports a socket readable once a datagram is queued
+ * 5. sendmmsg() and recvmmsg() move many datagrams per call, in order
+ * 6. The receive buffer has a limit; the excess is dropped
+ * 7. A blocking recvfrom() sleeps until a child's datagram arrives
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_SLEEP         5
+#define SYS_FORK          7
+#define SYS_WAIT          9
+#define SYS_GETTIME       12
+#define SYS_CLOSE         14
+#define SYS_POLL          71
+#define SYS_SOCKET        100
+#define SYS_BIND          101
+#define SYS_SENDTO        102
+#define SYS_RECVFROM      103
+#define SYS_SENDMMSG      104
+#define SYS_RECVMMSG      105
+
+/* Sockets */
+#define AF_INET           2
+#define SOCK_DGRAM        2
+#define SOCK_NONBLOCK     0x0800
+#define IPPROTO_UDP       17
+
+#define MSG_TRUNC         0x20
+#define MSG_DONTWAIT      0x40
+#define MSG_WAITFORONE    0x10000
+
+#define POLLIN            0x0001
+#define POLLOUT           0x0004
+
+#define UDP_MAX_PAYLOAD   1472
+#define RCVBUF_DATAGRAMS  128
+
+#define PORT_A            7001
+#define PORT_B            7002
+#define PORT_C            7003
+
+#define STDOUT_FD 1
+
+struct sockaddr_in {
+    uint16_t sin_family;
+    uint16_t sin_port;
+    uint32_t sin_addr;
+    uint8_t sin_zero[8];
+};
+
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+
+struct msghdr {
+    void *msg_name;
+    uint32_t msg_namelen;
+    struct iovec *msg_iov;
+    size_t msg_iovlen;
+    void *msg_control;
+    size_t msg_controllen;
+    int msg_flags;
+};
+
+struct mmsghdr {
+    struct msghdr msg_hdr;
+    uint32_t msg_len;
+};
+
+struct timespec {
+    long tv_sec;
+    long tv_nsec;
+};
+
+struct pollfd {
+    int fd;
+    short events;
+    short revents;
+};
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall4(n, a1, a2, a3, a4) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall6(n, a1, a2, a3, a4, a5, a6) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long a4_reg asm("a4") = (long)(a5); \
+    register long a5_reg asm("a5") = (long)(a6); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(a4_reg), \
+                 "r"(a5_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long sleep_ms(long ms) {
+    return syscall1(SYS_SLEEP, ms);
+}
+
+static inline long fork(void) {
+    return syscall1(SYS_FORK, 0);
+}
+
+static inline long waitpid(long pid, int *status) {
+    return syscall3(SYS_WAIT, pid, status, 0);
+}
+
+static inline long gettime(void) {
+    return syscall1(SYS_GETTIME, 0);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long poll(struct pollfd *fds, int nfds, int timeout_ms) {
+    return syscall3(SYS_POLL, fds, nfds, timeout_ms);
+}
+
+static inline long socket(int domain, int type, int protocol) {
+    return syscall3(SYS_SOCKET, domain, type, protocol);
+}
+
+static inline long bind(int fd, const struct sockaddr_in *addr, uint32_t len) {
+    return syscall3(SYS_BIND, fd, addr, len);
+}
+
+static inline long sendto(int fd, const void *buf, size_t len, int flags,
+                          const struct sockaddr_in *dest, uint32_t addrlen) {
+    return syscall6(SYS_SENDTO, fd, buf, len, flags, dest, addrlen);
+}
+
+static inline long recvfrom(int fd, void *buf, size_t len, int flags,
+                            struct sockaddr_in *src, uint32_t *addrlen) {
+    return syscall6(SYS_RECVFROM, fd, buf, len, flags, src, addrlen);
+}
+
+static inline long sendmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags) {
+    return syscall4(SYS_SENDMMSG, fd, msgs, vlen, flags);
+}
+
+static inline long recvmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags,
+                            struct timespec *timeout) {
+    return syscall6(SYS_RECVMMSG, fd, msgs, vlen, flags, timeout, 0);
+}
+
+/* Byte order */
+static inline uint16_t htons(uint16_t x) {
+    return (uint16_t)((x << 8) | (x >> 8));
+}
+
+static inline uint32_t htonl(uint32_t x) {
+    return ((x & 0xFF) << 24) | ((x & 0xFF00) << 8) | ((x >> 8) & 0xFF00) | (x >> 24);
+}
+
+#define LOOPBACK htonl(0x7F000001)
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static int exit_code(int status) {
+    return (status >> 8) & 0xFF;
+}
+
+static void make_addr(struct sockaddr_in *sa, uint32_t addr, uint16_t port) {
+    sa->sin_family = AF_INET;
+    sa->sin_port = htons(port);
+    sa->sin_addr = addr;
+    for (int i = 0; i < 8; i++) {
+        sa->sin_zero[i] = 0;
+    }
+}
+
+static int bytes_equal(const void *a, const void *b, size_t n) {
+    const uint8_t *p = a;
+    const uint8_t *q = b;
+    for (size_t i = 0; i < n; i++) {
+        if (p[i] != q[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+#define BATCH 32
+#define FLOOD 200
+
+static struct mmsghdr msgs[FLOOD];
+static struct iovec iovs[FLOOD];
+static struct sockaddr_in names[FLOOD];
+static uint32_t payloads[FLOOD];
+static char big[UDP_MAX_PAYLOAD + 1];
+static char buf[UDP_MAX_PAYLOAD + 64];
+
+/**
+ * Point message i at payloads[i] and names[i]
+ */
+static void setup_msg(int i, const struct sockaddr_in *dest) {
+    iovs[i].iov_base = &payloads[i];
+    iovs[i].iov_len = sizeof(payloads[i]);
+    msgs[i].msg_hdr.msg_name = &names[i];
+    msgs[i].msg_hdr.msg_namelen = sizeof(names[i]);
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_control = NULL;
+    msgs[i].msg_hdr.msg_controllen = 0;
+    msgs[i].msg_hdr.msg_flags = 0;
+    msgs[i].msg_len = 0;
+    if (dest) {
+        names[i] = *dest;
+    }
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("       UDP Socket Test Program\n");
+    print("========================================\n\n");
+
+    struct sockaddr_in addr_a, addr_b, addr_c, from;
+    make_addr(&addr_a, LOOPBACK, PORT_A);
+    make_addr(&addr_b, LOOPBACK, PORT_B);
+    make_addr(&addr_c, LOOPBACK, PORT_C);
+    uint32_t fromlen;
+
+    /* Test 1: Creating and binding */
+    print("[TEST 1] socket() and bind()...\n");
+    int a = socket(AF_INET, SOCK_DGRAM, 0);
+    int b = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    check(a >= 0 && b >= 0, "two UDP sockets created");
+    check(socket(1, SOCK_DGRAM, 0) < 0, "other address families refused");
+    check(socket(AF_INET, 3, 0) < 0, "raw sockets refused");
+    check(socket(AF_INET, SOCK_DGRAM, 6) < 0, "datagram socket with TCP refused");
+    check(bind(a, &addr_a, sizeof(addr_a)) == 0, "bound to 127.0.0.1:7001");
+    check(bind(a, &addr_b, sizeof(addr_b)) < 0, "binding again refused");
+    check(bind(b, &addr_a, sizeof(addr_a)) < 0, "port in use refused");
+    struct sockaddr_in foreign;
+    make_addr(&foreign, htonl(0xC0000201), PORT_B);
+    check(bind(b, &foreign, sizeof(foreign)) < 0, "non-local address refused");
+    check(bind(b, &addr_b, 4) < 0, "short address refused");
+    check(bind(STDOUT_FD, &addr_b, sizeof(addr_b)) < 0, "bind() on a non-socket refused");
+
+    /* Test 2: Non-blocking receive */
+    print("\n[TEST 2] Non-blocking receive...\n");
+    long start = gettime();
+    check(recvfrom(a, buf, sizeof(buf), MSG_DONTWAIT, NULL, NULL) < 0, "MSG_DONTWAIT: empty fails");
+    int nb = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    check(nb >= 0 && bind(nb, &addr_c, sizeof(addr_c)) == 0, "SOCK_NONBLOCK socket bound");
+    check(read(nb, buf, sizeof(buf)) < 0, "read() on it fails");
+    check(gettime() - start < 50, "both at once");
+    close(nb);
+
+    /* Test 3: Round trip over loopback */
+    print("\n[TEST 3] Datagrams over loopback...\n");
+    check(sendto(b, "ping", 4, 0, &addr_a, sizeof(addr_a)) == 4, "unbound socket sends");
+    fromlen = sizeof(from);
+    long n = recvfrom(a, buf, sizeof(buf), 0, &from, &fromlen);
+    check(n == 4 && bytes_equal(buf, "ping", 4), "datagram received");
+    check(fromlen == sizeof(from) && from.sin_family == AF_INET && from.sin_addr == LOOPBACK &&
+          htons(from.sin_port) >= 49152, "sender is 127.0.0.1, ephemeral port");
+    check(sendto(a, "pong", 4, 0, &from, sizeof(from)) == 4, "reply sent to the sender");
+    n = recvfrom(b, buf, sizeof(buf), 0, NULL, NULL);
+    check(n == 4 && bytes_equal(buf, "pong", 4), "reply received");
+    check(sendto(a, "x", 1, 0, NULL, 0) < 0, "no destination refused");
+    check(write(a, "x", 1) < 0, "write() without a destination refused");
+
+    for (int i = 0; i < UDP_MAX_PAYLOAD + 1; i++) {
+        big[i] = (char)(i * 7);
+    }
+    check(sendto(b, big, UDP_MAX_PAYLOAD + 1, 0, &addr_a, sizeof(addr_a)) < 0,
+          "payload over one frame refused");
+    check(sendto(b, big, UDP_MAX_PAYLOAD, 0, &addr_a, sizeof(addr_a)) == UDP_MAX_PAYLOAD,
+          "largest payload sent");
+    n = recvfrom(a, buf, sizeof(buf), 0, NULL, NULL);
+    check(n == UDP_MAX_PAYLOAD && bytes_equal(buf, big, UDP_MAX_PAYLOAD), "and received intact");
+
+    sendto(b, big, 100, 0, &addr_a, sizeof(addr_a));
+    check(read(a, buf, 10) == 10 && bytes_equal(buf, big, 10), "long datagram cut to the buffer");
+    check(recvfrom(a, buf, sizeof(buf), MSG_DONTWAIT, NULL, NULL) < 0, "rest discarded");
+
+    /* Test 4: poll() */
+    print("\n[TEST 4] poll()...\n");
+    struct pollfd pfd = { a, POLLIN | POLLOUT, 0 };
+    check(poll(&pfd, 1, 0) == 1 && pfd.revents == POLLOUT, "writable, not readable");
+    sendto(b, "poll", 4, 0, &addr_a, sizeof(addr_a));
+    pfd.revents = 0;
+    check(poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN), "readable with a datagram queued");
+    recvfrom(a, buf, sizeof(buf), 0, NULL, NULL);
+
+    /* Test 5: sendmmsg() / recvmmsg() */
+    print("\n[TEST 5] sendmmsg() and recvmmsg()...\n");
+    for (int i = 0; i < BATCH; i++) {
+        payloads[i] = 1000 + i;
+        setup_msg(i, &addr_a);
+    }
+    check(sendmmsg(b, msgs, BATCH, 0) == BATCH, "32 datagrams in one call");
+    check(msgs[0].msg_len == 4 && msgs[BATCH - 1].msg_len == 4, "msg_len set");
+
+    for (int i = 0; i < FLOOD; i++) {
+        payloads[i] = 0;
+        setup_msg(i, NULL);
+    }
+    check(recvmmsg(a, msgs, FLOOD, MSG_DONTWAIT, NULL) == BATCH, "all 32 in one recvmmsg()");
+    int in_order = 1;
+    for (int i = 0; i < BATCH; i++) {
+        in_order &= payloads[i] == (uint32_t)(1000 + i) && msgs[i].msg_len == 4 &&
+                    msgs[i].msg_hdr.msg_flags == 0 && names[i].sin_addr == LOOPBACK;
+    }
+    check(in_order, "in order, with lengths and senders");
+
+    struct timespec ts = { 0, 50 * 1000 * 1000 };
+    start = gettime();
+    check(recvmmsg(a, msgs, BATCH, MSG_WAITFORONE, &ts) < 0, "nothing arrives: times out");
+    check(gettime() - start >= 40, "after the timeout");
+
+    sendto(b, "one", 3, 0, &addr_a, sizeof(addr_a));
+    setup_msg(0, NULL);
+    start = gettime();
+    check(recvmmsg(a, msgs, BATCH, MSG_WAITFORONE, NULL) == 1, "MSG_WAITFORONE returns one");
+    check(gettime() - start < 50, "without waiting for more");
+
+    /* Test 6: Receive buffer limit */
+    print("\n[TEST 6] Receive buffer limit...\n");
+    for (int i = 0; i < FLOOD; i++) {
+        payloads[i] = i;
+        setup_msg(i, &addr_a);
+    }
+    check(sendmmsg(b, msgs, FLOOD, 0) == FLOOD, "200 datagrams sent");
+    for (int i = 0; i < FLOOD; i++) {
+        setup_msg(i, NULL);
+    }
+    n = recvmmsg(a, msgs, FLOOD, MSG_DONTWAIT, NULL);
+    check(n == RCVBUF_DATAGRAMS, "the first 128 were queued");
+    check(n > 0 && payloads[n - 1] == (uint32_t)(n - 1), "the rest were dropped");
+
+    /* Test 7: Blocking receive */
+    print("\n[TEST 7] Blocking receive...\n");
+    int status = 0;
+    long pid = fork();
+    if (pid == 0) {
+        sleep_ms(50);
+        int s = socket(AF_INET, SOCK_DGRAM, 0);
+        exit(sendto(s, "wake", 4, 0, &addr_a, sizeof(addr_a)) == 4 ? 0 : 1);
+    }
+    start = gettime();
+    n = recvfrom(a, buf, sizeof(buf), 0, NULL, NULL);
+    check(n == 4 && bytes_equal(buf, "wake", 4), "recvfrom() woke with the child's datagram");
+    check(gettime() - start >= 40, "and it had been waiting");
+    check(pid > 0 && waitpid(pid, &status) == pid && exit_code(status) == 0, "sender done");
+
+    close(a);
+    close(b);
+    int again = socket(AF_INET, SOCK_DGRAM, 0);
+    check(again >= 0 && bind(again, &addr_a, sizeof(addr_a)) == 0, "port free again after close");
+    close(again);
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
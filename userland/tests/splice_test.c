@@ -0,0 +1,325 @@
+/**
+ * splice_test.c - Test program for splice(), tee() and sendfile()
+ *
+ * Tests:
+ * 1. splice() moves a multi-page file into a pipe
+ * 2. tee() duplicates pipe data without consuming it
+ * 3. splice() drains a pipe into a file
+ * 4. sendfile() with an offset copies a file range and leaves the
+ *    file position alone
+ * 5. Invalid combinations are refused
+ */
+
+#include <stddef.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_LSEEK         15
+#define SYS_UNLINK        18
+#define SYS_PIPE          26
+#define SYS_SPLICE        68
+#define SYS_TEE           69
+#define SYS_SENDFILE      70
+
+/* Open flags */
+#define O_RDONLY  0x0000
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+#define O_TRUNC   0x0200
+
+#define SEEK_SET  0
+#define SEEK_CUR  1
+
+#define STDOUT_FD 1
+
+#define SRC_PATH "/splice_src.dat"
+#define DST_PATH "/splice_dst.dat"
+
+/* Spans five pages, the last one partly */
+#define FILE_SIZE 20000
+#define CHUNK     4096
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall4(n, a1, a2, a3, a4) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall6(n, a1, a2, a3, a4, a5, a6) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long a4_reg asm("a4") = (long)(a5); \
+    register long a5_reg asm("a5") = (long)(a6); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(a4_reg), \
+                 "r"(a5_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0644);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long lseek(int fd, long offset, int whence) {
+    return syscall3(SYS_LSEEK, fd, offset, whence);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+static inline long pipe(int fds[2]) {
+    return syscall1(SYS_PIPE, fds);
+}
+
+static inline long splice(int fd_in, long *off_in, int fd_out, long *off_out, size_t len) {
+    return syscall6(SYS_SPLICE, fd_in, off_in, fd_out, off_out, len, 0);
+}
+
+static inline long tee(int fd_in, int fd_out, size_t len) {
+    return syscall4(SYS_TEE, fd_in, fd_out, len, 0);
+}
+
+static inline long sendfile(int out_fd, int in_fd, long *offset, size_t count) {
+    return syscall4(SYS_SENDFILE, out_fd, in_fd, offset, count);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static unsigned char chunk[CHUNK];
+
+/* Byte i of the test file */
+static unsigned char pattern(long i) {
+    return (unsigned char)(i * 13 + (i >> 12));
+}
+
+static int make_source(void) {
+    int fd = open(SRC_PATH, O_RDWR | O_CREAT | O_TRUNC);
+    if (fd < 0) {
+        return 0;
+    }
+    long done = 0;
+    while (done < FILE_SIZE) {
+        long n = FILE_SIZE - done < CHUNK ? FILE_SIZE - done : CHUNK;
+        for (long i = 0; i < n; i++) {
+            chunk[i] = pattern(done + i);
+        }
+        if (write(fd, chunk, n) != n) {
+            close(fd);
+            return 0;
+        }
+        done += n;
+    }
+    close(fd);
+    return 1;
+}
+
+/* Read len bytes from fd and compare with the pattern from base */
+static int read_matches(int fd, long base, long len) {
+    long done = 0;
+    while (done < len) {
+        long n = len - done < CHUNK ? len - done : CHUNK;
+        long r = read(fd, chunk, n);
+        if (r <= 0) {
+            return 0;
+        }
+        for (long i = 0; i < r; i++) {
+            if (chunk[i] != pattern(base + done + i)) {
+                return 0;
+            }
+        }
+        done += r;
+    }
+    return 1;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    splice/tee/sendfile Test Program\n");
+    print("========================================\n\n");
+
+    if (!make_source()) {
+        print("[FAIL] could not create " SRC_PATH "\n");
+        exit(1);
+    }
+
+    int src = open(SRC_PATH, O_RDONLY);
+    int dst = open(DST_PATH, O_RDWR | O_CREAT | O_TRUNC);
+    int p[2], q[2];
+    if (src < 0 || dst < 0 || pipe(p) != 0 || pipe(q) != 0) {
+        print("[FAIL] setup failed\n");
+        exit(1);
+    }
+
+    /* Test 1: File into a pipe */
+    print("[TEST 1] splice() file -> pipe...\n");
+    long moved = splice(src, NULL, p[1], NULL, FILE_SIZE);
+    print("  Moved: ");
+    print_num(moved);
+    print(" bytes\n");
+    check(moved == FILE_SIZE, "whole file queued in the pipe");
+    check(lseek(src, 0, SEEK_CUR) == FILE_SIZE, "file position advanced");
+    check(splice(src, NULL, p[1], NULL, FILE_SIZE) == 0, "splice at end of file returns 0");
+
+    /* Test 2: Duplicate into a second pipe */
+    print("\n[TEST 2] tee() pipe -> pipe...\n");
+    check(tee(p[0], q[1], FILE_SIZE) == FILE_SIZE, "all data duplicated");
+    check(read_matches(q[0], 0, FILE_SIZE), "copy reads back intact");
+
+    /* Test 3: Pipe into a file */
+    print("\n[TEST 3] splice() pipe -> file...\n");
+    long total = 0;
+    while (total < FILE_SIZE) {
+        long n = splice(p[0], NULL, dst, NULL, FILE_SIZE - total);
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+    }
+    check(total == FILE_SIZE, "original data drained into the file");
+    lseek(dst, 0, SEEK_SET);
+    check(read_matches(dst, 0, FILE_SIZE), "file holds the data in order");
+
+    /* Test 4: sendfile with an offset */
+    print("\n[TEST 4] sendfile() with an offset...\n");
+    long off = 5000;
+    lseek(src, 0, SEEK_SET);
+    check(sendfile(q[1], src, &off, 9000) == 9000, "9000 bytes sent from offset 5000");
+    check(off == 14000, "offset advanced");
+    check(lseek(src, 0, SEEK_CUR) == 0, "file position untouched");
+    check(read_matches(q[0], 5000, 9000), "pipe holds the file range");
+
+    lseek(dst, 0, SEEK_SET);
+    off = 100;
+    check(sendfile(dst, src, &off, 1000) == 1000, "file -> file copy");
+    lseek(dst, 0, SEEK_SET);
+    check(read_matches(dst, 100, 1000), "destination file overwritten with the range");
+
+    /* Test 5: Invalid uses */
+    print("\n[TEST 5] Invalid uses...\n");
+    check(splice(src, NULL, dst, NULL, 100) < 0, "file -> file splice refused");
+    off = 0;
+    check(splice(p[0], &off, dst, NULL, 100) < 0, "offset on the pipe end refused");
+    check(tee(p[0], p[1], 100) < 0, "tee into the same pipe refused");
+
+    close(p[0]);
+    close(p[1]);
+    close(q[0]);
+    close(q[1]);
+    close(src);
+    close(dst);
+    unlink(SRC_PATH);
+    unlink(DST_PATH);
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,346 @@
+/**
+ * spsc_test.c - Test program for the shared-memory SPSC queue (lib/spsc.h)
+ *
+ * Tests:
+ * 1. Bad geometry and unformatted memory are refused
+ * 2. Within one process: empty and full queues fail without blocking,
+ *    messages come back in order with their lengths
+ * 3. A child consumer receives a long stream through a small queue, so
+ *    both sides have to sleep and wake each other
+ * 4. A consumer sleeping on an empty queue is woken by the first message
+ */
+
+#include <stddef.h>
+#include "../lib/spsc.h"
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_SLEEP         5
+#define SYS_FORK          7
+#define SYS_WAIT          9
+#define SYS_GETTIME       12
+#define SYS_CLOSE         14
+#define SYS_MMAP          24
+#define SYS_SHM_OPEN      76
+#define SYS_SHM_UNLINK    77
+#define SYS_FTRUNCATE     78
+
+/* Open flags */
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+
+/* mmap() arguments */
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define MAP_SHARED    0x01
+
+#define STDOUT_FD 1
+
+#define SHM_NAME  "/spsc_test"
+
+/* Queue geometry: few slots, so a stream fills it over and over */
+#define SLOTS       16
+#define SLOT_SIZE   256
+#define STREAM_MSGS 20000
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall6(n, a1, a2, a3, a4, a5, a6) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long a4_reg asm("a4") = (long)(a5); \
+    register long a5_reg asm("a5") = (long)(a6); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(a4_reg), \
+                 "r"(a5_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long sleep_ms(long ms) {
+    return syscall1(SYS_SLEEP, ms);
+}
+
+static inline long fork(void) {
+    return syscall1(SYS_FORK, 0);
+}
+
+static inline long waitpid(long pid, int *status) {
+    return syscall3(SYS_WAIT, pid, status, 0);
+}
+
+static inline long gettime(void) {
+    return syscall1(SYS_GETTIME, 0);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long mmap(void *addr, size_t len, int prot, int flags, int fd, long offset) {
+    return syscall6(SYS_MMAP, addr, len, prot, flags, fd, offset);
+}
+
+static inline long shm_open(const char *name, int flags) {
+    return syscall3(SYS_SHM_OPEN, name, flags, 0600);
+}
+
+static inline long shm_unlink(const char *name) {
+    return syscall1(SYS_SHM_UNLINK, name);
+}
+
+static inline long ftruncate(int fd, long length) {
+    return syscall2(SYS_FTRUNCATE, fd, length);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static int exit_code(int status) {
+    return (status >> 8) & 0xFF;
+}
+
+/* Message seq: its length varies, its bytes follow from seq */
+static uint32_t msg_len(uint32_t seq) {
+    return 4 + seq % (SLOT_SIZE - 4);
+}
+
+static void make_msg(uint8_t *msg, uint32_t seq) {
+    uint32_t len = msg_len(seq);
+    msg[0] = (uint8_t)seq;
+    msg[1] = (uint8_t)(seq >> 8);
+    msg[2] = (uint8_t)(seq >> 16);
+    msg[3] = (uint8_t)(seq >> 24);
+    for (uint32_t i = 4; i < len; i++) {
+        msg[i] = (uint8_t)(seq * 7 + i);
+    }
+}
+
+static int msg_ok(const uint8_t *msg, long len, uint32_t seq) {
+    if (len != (long)msg_len(seq)) {
+        return 0;
+    }
+    uint32_t got = msg[0] | (msg[1] << 8) | (msg[2] << 16) | ((uint32_t)msg[3] << 24);
+    if (got != seq) {
+        return 0;
+    }
+    for (long i = 4; i < len; i++) {
+        if (msg[i] != (uint8_t)(seq * 7 + i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static uint8_t msg[SLOT_SIZE];
+
+/* Child of test 3: take the whole stream, in order */
+static int consume_stream(void *mem) {
+    spsc_t q;
+    if (spsc_attach(&q, mem) != 0) {
+        return 1;
+    }
+    for (uint32_t seq = 0; seq < STREAM_MSGS; seq++) {
+        long len = spsc_recv(&q, msg);
+        if (!msg_ok(msg, len, seq)) {
+            return 2;
+        }
+    }
+    return spsc_count(&q) == 0 ? 0 : 3;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    SPSC Queue Test Program\n");
+    print("========================================\n\n");
+
+    shm_unlink(SHM_NAME);
+    int fd = shm_open(SHM_NAME, O_RDWR | O_CREAT);
+    long bytes = (long)SPSC_BYTES(SLOTS, SLOT_SIZE);
+    long addr = -1;
+    if (fd >= 0 && ftruncate(fd, bytes) == 0) {
+        addr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (addr <= 0) {
+        print("[FAIL] could not map the queue\n");
+        exit(1);
+    }
+    void *mem = (void *)addr;
+    spsc_t q;
+
+    /* Test 1: Setup */
+    print("[TEST 1] Setup...\n");
+    check(spsc_attach(&q, mem) != 0, "attach to unformatted memory fails");
+    check(spsc_init(&q, mem, 12, SLOT_SIZE) != 0, "slot count must be a power of two");
+    check(spsc_init(&q, mem, SLOTS, SLOT_SIZE) == 0, "queue laid out");
+    spsc_t q2;
+    check(spsc_attach(&q2, mem) == 0 && q2.mask == SLOTS - 1, "attach sees the geometry");
+
+    /* Test 2: One process */
+    print("\n[TEST 2] Non-blocking use...\n");
+    check(spsc_try_recv(&q, msg) < 0, "empty queue: try_recv fails");
+    int sent = 0;
+    for (uint32_t seq = 0; seq < SLOTS; seq++) {
+        make_msg(msg, seq);
+        if (spsc_try_send(&q, msg, msg_len(seq)) == 0) {
+            sent++;
+        }
+    }
+    check(sent == SLOTS && spsc_count(&q) == SLOTS, "queue holds one message per slot");
+    check(spsc_try_send(&q, msg, 1) < 0, "full queue: try_send fails");
+    int ordered = 1;
+    for (uint32_t seq = 0; seq < SLOTS; seq++) {
+        long len = spsc_try_recv(&q, msg);
+        if (!msg_ok(msg, len, seq)) {
+            ordered = 0;
+        }
+    }
+    check(ordered, "messages drained in order with their lengths");
+    check(spsc_try_send(&q, msg, SLOT_SIZE + 1) < 0, "message longer than a slot refused");
+
+    /* Test 3: Stream to a child */
+    print("\n[TEST 3] Stream through a ");
+    print_num(SLOTS);
+    print("-slot queue...\n");
+    int status = 0;
+    long start = gettime();
+    long pid = fork();
+    if (pid == 0) {
+        exit(consume_stream(mem));
+    }
+    int send_ok = 1;
+    for (uint32_t seq = 0; seq < STREAM_MSGS; seq++) {
+        make_msg(msg, seq);
+        if (spsc_send(&q, msg, msg_len(seq)) != 0) {
+            send_ok = 0;
+        }
+    }
+    check(send_ok, "producer queued the stream");
+    check(pid > 0 && waitpid(pid, &status) == pid && exit_code(status) == 0,
+          "consumer got every message intact and in order");
+    print("  ");
+    print_num(STREAM_MSGS);
+    print(" messages in ");
+    print_num(gettime() - start);
+    print(" ms\n");
+
+    /* Test 4: Wake from empty */
+    print("\n[TEST 4] Consumer asleep on an empty queue...\n");
+    pid = fork();
+    if (pid == 0) {
+        spsc_t cq;
+        spsc_attach(&cq, mem);
+        sleep_ms(50);
+        make_msg(msg, 7);
+        exit(spsc_send(&cq, msg, msg_len(7)) == 0 ? 0 : 1);
+    }
+    start = gettime();
+    long len = spsc_recv(&q, msg);
+    check(msg_ok(msg, len, 7), "first message woke the consumer");
+    check(gettime() - start >= 40, "and it had been waiting");
+    check(pid > 0 && waitpid(pid, &status) == pid && exit_code(status) == 0, "producer done");
+
+    close(fd);
+    shm_unlink(SHM_NAME);
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,139 @@
+/**
+ * stdio_test.c - Test program for the userland runtime (lib/ustdio.h)
+ *
+ * Tests:
+ * 1. snprintf() conversions, flags, widths and truncation
+ * 2. memcpy(), memmove(), memset() and strlen() at every alignment
+ * 3. A fully buffered stream writes a file in one write() per buffer
+ * 4. stdout on the terminal is line buffered
+ */
+
+#include "../lib/ustdio.h"
+
+/* Syscall numbers */
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_UNLINK        18
+
+/* Open flags */
+#define O_RDONLY  0x0000
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+#define O_TRUNC   0x0200
+
+#define FILE_PATH "/tmp/stdio_test.txt"
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    printf("%s %s\n", ok ? "[PASS]" : "[FAIL]", name);
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+/* Format and compare with what it should give */
+static int formats(const char *want, const char *fmt, ...) {
+    char buf[64];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    return n == (int)strlen(want) && strcmp(buf, want) == 0;
+}
+
+static char src[96];
+static char dst[96];
+static FILE file_stream;
+
+void _start(void) {
+    printf("\n");
+    printf("========================================\n");
+    printf("     Userland stdio Test Program\n");
+    printf("========================================\n\n");
+
+    /* Test 1: Formatting */
+    printf("[TEST 1] snprintf()...\n");
+    check(formats("42 -7 +3", "%d %i %+d", 42, -7, 3), "signed conversions");
+    check(formats("ff FF 777 0x1000", "%x %X %o %p", 255, 255, 511, (void *)0x1000), "hex, octal, pointer");
+    check(formats("[   12][12   ][00012]", "[%5d][%-5d][%05d]", 12, 12, 12), "widths and flags");
+    check(formats("[ abc][ab]", "[%*s][%.2s]", 4, "abc", "abc"), "string width and precision");
+    check(formats("18446744073709551615 -9223372036854775808", "%lu %lld",
+                  (unsigned long)-1, (long long)(-9223372036854775807LL - 1)), "64-bit values");
+    check(formats("x 100% (null)", "%c %d%% %s", 'x', 100, (char *)0), "char, percent, null string");
+    char small[6];
+    int full = snprintf(small, sizeof(small), "%s", "truncated");
+    check(full == 9 && strcmp(small, "trunc") == 0, "truncation keeps the full length");
+
+    /* Test 2: Memory and string routines */
+    printf("\n[TEST 2] Word-at-a-time routines...\n");
+    for (int i = 0; i < (int)sizeof(src); i++) {
+        src[i] = (char)('a' + i % 26);
+    }
+    int copies_ok = 1;
+    for (int s = 0; s < 8; s++) {
+        for (int d = 0; d < 8; d++) {
+            memset(dst, 0, sizeof(dst));
+            memcpy(dst + d, src + s, 64);
+            if (memcmp(dst + d, src + s, 64) != 0 || dst[d + 64] != 0 || (d > 0 && dst[d - 1] != 0)) {
+                copies_ok = 0;
+            }
+        }
+    }
+    check(copies_ok, "memcpy at every alignment pair");
+    memcpy(dst, src, 64);
+    memmove(dst + 3, dst, 40);
+    check(memcmp(dst + 3, src, 40) == 0, "memmove overlapping forward");
+    int lengths_ok = 1;
+    for (int start = 0; start < 8; start++) {
+        for (int len = 0; len < 24; len++) {
+            memcpy(dst, src, sizeof(dst));
+            dst[start + len] = '\0';
+            if (strlen(dst + start) != (size_t)len) {
+                lengths_ok = 0;
+            }
+        }
+    }
+    check(lengths_ok, "strlen at every alignment and length");
+    memset(dst + 1, 'z', 30);
+    check(dst[0] != 'z' && dst[1] == 'z' && dst[30] == 'z' && dst[31] != 'z', "memset stays in bounds");
+
+    /* Test 3: Fully buffered file */
+    printf("\n[TEST 3] Buffered file stream...\n");
+    file_stream.fd = (int)syscall3(SYS_OPEN, (long)FILE_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    file_stream.mode = -1;
+    check(file_stream.fd >= 0, "file created");
+    for (int i = 0; i < 100; i++) {
+        fprintf(&file_stream, "line %d\n", i);
+    }
+    check(file_stream.mode == _IOFBF, "a file is fully buffered");
+    check(file_stream.len > 0, "output waits in the buffer");
+    check(fflush(&file_stream) == 0 && file_stream.len == 0, "fflush writes it out");
+    syscall1(SYS_CLOSE, file_stream.fd);
+
+    int fd = (int)syscall3(SYS_OPEN, (long)FILE_PATH, O_RDONLY, 0);
+    static char back[1024];
+    long n = syscall3(SYS_READ, fd, (long)back, sizeof(back));
+    back[n > 0 ? n : 0] = '\0';
+    check(n == 790 && strncmp(back, "line 0\nline 1\n", 14) == 0 &&
+          strcmp(back + n - 8, "line 99\n") == 0, "file holds every line");
+    syscall1(SYS_CLOSE, fd);
+    syscall1(SYS_UNLINK, (long)FILE_PATH);
+
+    /* Test 4: Terminal */
+    printf("\n[TEST 4] stdout on the terminal...\n");
+    check(!isatty(STDOUT_FILENO) || (stdout->mode == _IOLBF && stdout->len == 0),
+          "line buffered, nothing held after a newline");
+
+    /* Summary */
+    printf("\n========================================\n");
+    printf("Tests passed: %d\n", tests_passed);
+    printf("Tests failed: %d\n", tests_failed);
+    printf("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,557 @@
+/**
+ * tcp_test.c - Test program for TCP sockets, over loopback
+ *
+ * Tests:
+ * 1. socket(), bind() and listen() accept and refuse what they should
+ * 2. connect() to a closed port is refused; one to a listener is accepted
+ *    with both addresses right
+ * 3. Data goes both ways, and read() returns what has arrived
+ * 4. Non-blocking accept(), recv() and connect() with poll() and SO_ERROR
+ * 5. 1 MiB from a child arrives complete and in order
+ * 6. shutdown(SHUT_WR) ends the peer's stream, which can still answer;
+ *    writing to a closed peer fails
+ * 7. setsockopt() and getsockopt()
+ * 8. SO_REUSEADDR lets a listener come back while the old connection
+ *    waits in TIME_WAIT
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_SLEEP         5
+#define SYS_FORK          7
+#define SYS_WAIT          9
+#define SYS_GETTIME       12
+#define SYS_CLOSE         14
+#define SYS_POLL          71
+#define SYS_SOCKET        100
+#define SYS_BIND          101
+#define SYS_SENDTO        102
+#define SYS_RECVFROM      103
+#define SYS_CONNECT       106
+#define SYS_LISTEN        107
+#define SYS_ACCEPT        108
+#define SYS_SETSOCKOPT    109
+#define SYS_GETSOCKOPT    110
+#define SYS_SHUTDOWN      111
+
+/* Sockets */
+#define AF_INET           2
+#define SOCK_STREAM       1
+#define SOCK_DGRAM        2
+#define SOCK_NONBLOCK     0x0800
+#define IPPROTO_TCP       6
+
+#define SOL_SOCKET        1
+#define SO_REUSEADDR      2
+#define SO_TYPE           3
+#define SO_ERROR          4
+#define SO_SNDBUF         7
+#define SO_RCVBUF         8
+#define TCP_NODELAY       1
+#define TCP_MAXSEG        2
+
+#define SHUT_RD           0
+#define SHUT_WR           1
+
+#define MSG_DONTWAIT      0x40
+
+#define POLLIN            0x0001
+#define POLLOUT           0x0004
+#define POLLERR           0x0008
+
+#define PORT_A            7101
+#define PORT_B            7102
+#define PORT_CLOSED       7109
+
+#define STDOUT_FD 1
+
+struct sockaddr_in {
+    uint16_t sin_family;
+    uint16_t sin_port;
+    uint32_t sin_addr;
+    uint8_t sin_zero[8];
+};
+
+struct pollfd {
+    int fd;
+    short events;
+    short revents;
+};
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall6(n, a1, a2, a3, a4, a5, a6) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long a4_reg asm("a4") = (long)(a5); \
+    register long a5_reg asm("a5") = (long)(a6); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(a4_reg), \
+                 "r"(a5_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long sleep_ms(long ms) {
+    return syscall1(SYS_SLEEP, ms);
+}
+
+static inline long fork(void) {
+    return syscall1(SYS_FORK, 0);
+}
+
+static inline long waitpid(long pid, int *status) {
+    return syscall3(SYS_WAIT, pid, status, 0);
+}
+
+static inline long gettime(void) {
+    return syscall1(SYS_GETTIME, 0);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long poll(struct pollfd *fds, int nfds, int timeout_ms) {
+    return syscall3(SYS_POLL, fds, nfds, timeout_ms);
+}
+
+static inline long socket(int domain, int type, int protocol) {
+    return syscall3(SYS_SOCKET, domain, type, protocol);
+}
+
+static inline long bind(int fd, const struct sockaddr_in *addr, uint32_t len) {
+    return syscall3(SYS_BIND, fd, addr, len);
+}
+
+static inline long send(int fd, const void *buf, size_t len, int flags) {
+    return syscall6(SYS_SENDTO, fd, buf, len, flags, 0, 0);
+}
+
+static inline long recv(int fd, void *buf, size_t len, int flags) {
+    return syscall6(SYS_RECVFROM, fd, buf, len, flags, 0, 0);
+}
+
+static inline long connect(int fd, const struct sockaddr_in *addr, uint32_t len) {
+    return syscall3(SYS_CONNECT, fd, addr, len);
+}
+
+static inline long listen(int fd, int backlog) {
+    return syscall3(SYS_LISTEN, fd, backlog, 0);
+}
+
+static inline long accept(int fd, struct sockaddr_in *addr, uint32_t *len) {
+    return syscall3(SYS_ACCEPT, fd, addr, len);
+}
+
+static inline long setsockopt(int fd, int level, int name, const void *value, uint32_t len) {
+    return syscall6(SYS_SETSOCKOPT, fd, level, name, value, len, 0);
+}
+
+static inline long getsockopt(int fd, int level, int name, void *value, uint32_t *len) {
+    return syscall6(SYS_GETSOCKOPT, fd, level, name, value, len, 0);
+}
+
+static inline long shutdown(int fd, int how) {
+    return syscall3(SYS_SHUTDOWN, fd, how, 0);
+}
+
+/* Byte order */
+static inline uint16_t htons(uint16_t x) {
+    return (uint16_t)((x << 8) | (x >> 8));
+}
+
+static inline uint32_t htonl(uint32_t x) {
+    return ((x & 0xFF) << 24) | ((x & 0xFF00) << 8) | ((x >> 8) & 0xFF00) | (x >> 24);
+}
+
+#define LOOPBACK htonl(0x7F000001)
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static int exit_code(int status) {
+    return (status >> 8) & 0xFF;
+}
+
+static void make_addr(struct sockaddr_in *sa, uint32_t addr, uint16_t port) {
+    sa->sin_family = AF_INET;
+    sa->sin_port = htons(port);
+    sa->sin_addr = addr;
+    for (int i = 0; i < 8; i++) {
+        sa->sin_zero[i] = 0;
+    }
+}
+
+static int bytes_equal(const void *a, const void *b, size_t n) {
+    const uint8_t *p = a;
+    const uint8_t *q = b;
+    for (size_t i = 0; i < n; i++) {
+        if (p[i] != q[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int set_int(int fd, int level, int name, int value) {
+    return setsockopt(fd, level, name, &value, sizeof(value));
+}
+
+static int get_int(int fd, int level, int name) {
+    int value = -1;
+    uint32_t len = sizeof(value);
+    if (getsockopt(fd, level, name, &value, &len) < 0 || len != sizeof(value)) {
+        return -1;
+    }
+    return value;
+}
+
+/**
+ * Read exactly len bytes, or fewer if the stream ends first
+ */
+static long read_full(int fd, void *dst, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        long n = read(fd, (char *)dst + got, len - got);
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+    }
+    return got;
+}
+
+#define BULK_TOTAL (1024 * 1024)
+#define BULK_CHUNK 3000
+
+static uint8_t chunk[BULK_CHUNK];
+static char buf[4096];
+
+/**
+ * Byte i of the bulk stream
+ */
+static uint8_t pattern(uint32_t i) {
+    return (uint8_t)((i * 31) ^ (i >> 9));
+}
+
+/**
+ * Connect to 127.0.0.1:port and write BULK_TOTAL bytes of pattern()
+ */
+static int bulk_sender(uint16_t port) {
+    struct sockaddr_in to;
+    make_addr(&to, LOOPBACK, port);
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0 || connect(s, &to, sizeof(to)) < 0) {
+        return 1;
+    }
+
+    uint32_t sent = 0;
+    while (sent < BULK_TOTAL) {
+        uint32_t n = BULK_TOTAL - sent < BULK_CHUNK ? BULK_TOTAL - sent : BULK_CHUNK;
+        for (uint32_t i = 0; i < n; i++) {
+            chunk[i] = pattern(sent + i);
+        }
+        long w = write(s, chunk, n);
+        if (w <= 0) {
+            return 2;
+        }
+        sent += w;
+    }
+    close(s);
+    return 0;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("       TCP Socket Test Program\n");
+    print("========================================\n\n");
+
+    struct sockaddr_in addr_a, addr_b, addr_closed, peer;
+    make_addr(&addr_a, LOOPBACK, PORT_A);
+    make_addr(&addr_b, LOOPBACK, PORT_B);
+    make_addr(&addr_closed, LOOPBACK, PORT_CLOSED);
+    uint32_t peerlen;
+    int status = 0;
+
+    /* Test 1: Creating, binding and listening */
+    print("[TEST 1] socket(), bind() and listen()...\n");
+    int lis = socket(AF_INET, SOCK_STREAM, 0);
+    int other = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    check(lis >= 0 && other >= 0, "two TCP sockets created");
+    check(socket(AF_INET, SOCK_STREAM, 17) < 0, "stream socket with UDP refused");
+    check(bind(lis, &addr_a, sizeof(addr_a)) == 0, "bound to 127.0.0.1:7101");
+    check(listen(lis, 8) == 0, "listening");
+    check(bind(other, &addr_a, sizeof(addr_a)) < 0, "port in use refused");
+    check(bind(other, &addr_b, sizeof(addr_b)) == 0 && listen(other, 0) == 0,
+          "second listener on another port");
+    check(connect(other, &addr_a, sizeof(addr_a)) < 0, "listener cannot connect");
+    close(other);
+    int udp = socket(AF_INET, SOCK_DGRAM, 0);
+    check(listen(udp, 1) < 0 && accept(udp, NULL, NULL) < 0, "listen()/accept() on UDP refused");
+    close(udp);
+
+    /* Test 2: Connecting */
+    print("\n[TEST 2] connect() and accept()...\n");
+    int c = socket(AF_INET, SOCK_STREAM, 0);
+    long start = gettime();
+    check(connect(c, &addr_closed, sizeof(addr_closed)) < 0, "closed port refused");
+    check(gettime() - start < 50, "at once (reset, not a timeout)");
+    check(connect(c, &addr_a, sizeof(addr_a)) == 0, "connected after a refusal");
+    check(connect(c, &addr_a, sizeof(addr_a)) < 0, "connecting twice refused");
+    peerlen = sizeof(peer);
+    int s = accept(lis, &peer, &peerlen);
+    check(s >= 0, "accepted");
+    check(peerlen == sizeof(peer) && peer.sin_family == AF_INET && peer.sin_addr == LOOPBACK &&
+          htons(peer.sin_port) >= 49152, "peer is 127.0.0.1, ephemeral port");
+    check(get_int(s, IPPROTO_TCP, TCP_MAXSEG) == 1460, "MSS negotiated at 1460");
+
+    /* Test 3: Data both ways */
+    print("\n[TEST 3] Data both ways...\n");
+    check(write(c, "hello", 5) == 5, "client writes");
+    check(read_full(s, buf, 5) == 5 && bytes_equal(buf, "hello", 5), "server reads it");
+    check(send(s, "world!", 6, 0) == 6, "server sends");
+    check(read_full(c, buf, 6) == 6 && bytes_equal(buf, "world!", 6), "client receives it");
+    write(c, "abc", 3);
+    write(c, "defg", 4);
+    long n = read_full(s, buf, 7);
+    check(n == 7 && bytes_equal(buf, "abcdefg", 7), "two writes read back as one stream");
+
+    /* Test 4: Non-blocking calls */
+    print("\n[TEST 4] Non-blocking calls...\n");
+    start = gettime();
+    check(recv(s, buf, sizeof(buf), MSG_DONTWAIT) < 0, "MSG_DONTWAIT: empty fails");
+    struct pollfd pfd = { s, POLLIN | POLLOUT, 0 };
+    check(poll(&pfd, 1, 0) == 1 && pfd.revents == POLLOUT, "writable, not readable");
+    write(c, "x", 1);
+    pfd.revents = 0;
+    check(poll(&pfd, 1, 100) == 1 && (pfd.revents & POLLIN), "readable with data");
+    recv(s, buf, sizeof(buf), 0);
+
+    int nlis = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    check(nlis >= 0 && bind(nlis, &addr_b, sizeof(addr_b)) == 0 && listen(nlis, 4) == 0,
+          "non-blocking listener");
+    check(accept(nlis, NULL, NULL) < 0, "accept() with none waiting fails");
+    check(gettime() - start < 50, "all at once");
+
+    int nc = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    connect(nc, &addr_b, sizeof(addr_b));
+    pfd.fd = nc;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    check(poll(&pfd, 1, 1000) == 1 && pfd.revents == POLLOUT, "non-blocking connect finishes");
+    check(get_int(nc, SOL_SOCKET, SO_ERROR) == 0, "SO_ERROR: it worked");
+    pfd.fd = nlis;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    check(poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN), "listener readable");
+    int ns = accept(nlis, NULL, NULL);
+    check(ns >= 0, "then accept() works");
+    close(ns);
+    close(nc);
+    close(nlis);
+
+    int rc = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    connect(rc, &addr_closed, sizeof(addr_closed));
+    pfd.fd = rc;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    poll(&pfd, 1, 1000);
+    check(pfd.revents & POLLERR, "refused non-blocking connect: POLLERR");
+    check(get_int(rc, SOL_SOCKET, SO_ERROR) > 0 && get_int(rc, SOL_SOCKET, SO_ERROR) == 0,
+          "SO_ERROR reports it once");
+    close(rc);
+
+    /* Test 5: Bulk transfer */
+    print("\n[TEST 5] 1 MiB from a child...\n");
+    long pid = fork();
+    if (pid == 0) {
+        exit(bulk_sender(PORT_A));
+    }
+    int bs = accept(lis, NULL, NULL);
+    check(bs >= 0, "child's connection accepted");
+    start = gettime();
+    uint32_t total = 0;
+    int intact = 1;
+    for (;;) {
+        n = read(bs, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        for (long i = 0; i < n; i++) {
+            intact &= (uint8_t)buf[i] == pattern(total + i);
+        }
+        total += n;
+    }
+    long elapsed = gettime() - start;
+    check(n == 0 && total == BULK_TOTAL, "all of it, then end of stream");
+    check(intact, "in order and intact");
+    print("  (");
+    print_num(elapsed);
+    print(" ms)\n");
+    check(pid > 0 && waitpid(pid, &status) == pid && exit_code(status) == 0, "sender done");
+    close(bs);
+
+    /* Test 6: Shutdown and close */
+    print("\n[TEST 6] shutdown() and close()...\n");
+    check(shutdown(c, 5) < 0, "bad how refused");
+    check(shutdown(c, SHUT_WR) == 0, "client shuts down writing");
+    check(read(s, buf, sizeof(buf)) == 0, "server reads end of stream");
+    check(write(c, "no", 2) < 0, "client cannot write any more");
+    check(write(s, "bye", 3) == 3, "server still answers");
+    check(read_full(c, buf, 3) == 3 && bytes_equal(buf, "bye", 3), "client reads it");
+    close(s);
+    check(read(c, buf, sizeof(buf)) == 0, "client sees the server's close");
+    close(c);
+
+    c = socket(AF_INET, SOCK_STREAM, 0);
+    connect(c, &addr_a, sizeof(addr_a));
+    s = accept(lis, NULL, NULL);
+    close(s);
+    read(c, buf, sizeof(buf));
+    int failed = 0;
+    for (int i = 0; i < 5 && !failed; i++) {
+        failed = write(c, "late", 4) < 0;
+        sleep_ms(10);
+    }
+    check(failed, "writing to a closed peer fails");
+    close(c);
+
+    /* Test 7: Options */
+    print("\n[TEST 7] setsockopt() and getsockopt()...\n");
+    int o = socket(AF_INET, SOCK_STREAM, 0);
+    check(get_int(o, SOL_SOCKET, SO_TYPE) == SOCK_STREAM, "SO_TYPE");
+    check(get_int(o, IPPROTO_TCP, TCP_NODELAY) == 0, "Nagle on by default");
+    check(set_int(o, IPPROTO_TCP, TCP_NODELAY, 1) == 0 &&
+          get_int(o, IPPROTO_TCP, TCP_NODELAY) == 1, "TCP_NODELAY set");
+    check(set_int(o, SOL_SOCKET, SO_RCVBUF, 1) == 0 &&
+          get_int(o, SOL_SOCKET, SO_RCVBUF) == 4096, "SO_RCVBUF clamped to 4 KiB");
+    check(set_int(o, SOL_SOCKET, SO_SNDBUF, 65536) == 0 &&
+          get_int(o, SOL_SOCKET, SO_SNDBUF) == 65536, "SO_SNDBUF set");
+    check(set_int(o, IPPROTO_TCP, TCP_MAXSEG, 10) < 0, "tiny TCP_MAXSEG refused");
+    check(set_int(o, SOL_SOCKET, 99, 1) < 0 && get_int(o, 99, SO_TYPE) < 0, "unknown options refused");
+    char small = 1;
+    check(setsockopt(o, SOL_SOCKET, SO_REUSEADDR, &small, 1) < 0, "short option refused");
+    close(o);
+
+    /* Test 8: Address reuse */
+    print("\n[TEST 8] SO_REUSEADDR...\n");
+    c = socket(AF_INET, SOCK_STREAM, 0);
+    connect(c, &addr_a, sizeof(addr_a));
+    s = accept(lis, NULL, NULL);
+    close(s);
+    close(c);
+    close(lis);
+    lis = socket(AF_INET, SOCK_STREAM, 0);
+    check(bind(lis, &addr_a, sizeof(addr_a)) < 0, "port busy while in TIME_WAIT");
+    check(set_int(lis, SOL_SOCKET, SO_REUSEADDR, 1) == 0 &&
+          bind(lis, &addr_a, sizeof(addr_a)) == 0 && listen(lis, 4) == 0,
+          "SO_REUSEADDR listener binds");
+    c = socket(AF_INET, SOCK_STREAM, 0);
+    check(connect(c, &addr_a, sizeof(addr_a)) == 0 && (s = accept(lis, NULL, NULL)) >= 0,
+          "and accepts");
+    close(s);
+    close(c);
+    close(lis);
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,268 @@
+/**
+ * thread_test.c - Test program for clone() threads
+ * 
+ * Tests:
+ * 1. A thread runs, and thread_join() returns once it exits
+ * 2. Threads share getpid() but have their own gettid()
+ * 3. CLONE_SETTLS gives a thread its own tp
+ * 4. Heap grown by a thread is visible to the others
+ * 5. Threads incrementing a shared counter under a umutex
+ * 6. Bad flags and stacks are rejected
+ * 7. exit_group() ends every thread of the process
+ */
+
+#include <stddef.h>
+#include "../lib/thread.h"
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_GETPID        3
+#define SYS_SBRK          4
+#define SYS_YIELD         6
+#define SYS_FORK          7
+#define SYS_WAIT          9
+
+#define STDOUT_FD 1
+
+#define NTHREADS            4
+#define STACK_SIZE          4096
+#define INCREMENTS          2000
+
+/* Syscall helpers */
+#define syscall0(n) ({ \
+    register long a0 asm("a0"); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "=r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const char *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long getpid(void) {
+    return syscall0(SYS_GETPID);
+}
+
+static inline void *sbrk(long increment) {
+    return (void *)syscall1(SYS_SBRK, increment);
+}
+
+static inline void yield(void) {
+    syscall0(SYS_YIELD);
+}
+
+static inline long fork(void) {
+    return syscall0(SYS_FORK);
+}
+
+static inline long waitpid(long pid, int *status, int options) {
+    return syscall3(SYS_WAIT, pid, status, options);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+    
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+    
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static uint8_t stacks[NTHREADS][STACK_SIZE] __attribute__((aligned(16)));
+static thread_t threads[NTHREADS];
+
+static volatile int ran;
+static volatile long seen_pid;
+static volatile long seen_tid;
+static thread_t *volatile seen_self;
+static volatile uint32_t *volatile thread_heap;
+
+static umutex_t counter_lock = UMUTEX_INIT;
+static volatile long counter;
+
+static int record_ids(void *arg) {
+    ran = (int)(long)arg;
+    seen_pid = getpid();
+    seen_tid = gettid();
+    seen_self = thread_self();
+    return 0;
+}
+
+static int grow_heap(void *arg) {
+    (void)arg;
+    volatile uint32_t *p = (volatile uint32_t *)sbrk(4096);
+    if ((long)p != -1) {
+        p[0] = 0x7EAD;
+        p[1023] = 0xBEEF;
+        thread_heap = p;
+    }
+    return 0;
+}
+
+static int add_to_counter(void *arg) {
+    (void)arg;
+    for (int i = 0; i < INCREMENTS; i++) {
+        umutex_lock(&counter_lock);
+        counter++;
+        umutex_unlock(&counter_lock);
+    }
+    return 0;
+}
+
+static int spin_forever(void *arg) {
+    (void)arg;
+    for (;;) {
+        yield();
+    }
+    return 0;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("       Thread Test Program\n");
+    print("========================================\n\n");
+    
+    /* Test 1: Create and join */
+    print("[TEST 1] Create and join a thread...\n");
+    long tid = thread_create(&threads[0], record_ids, (void *)42, stacks[0], STACK_SIZE);
+    check(tid > 0, "clone returns a thread ID");
+    thread_join(&threads[0]);
+    check(ran == 42 && threads[0].alive == 0, "thread ran and was joined");
+    
+    /* Test 2: Process and thread IDs */
+    print("\n[TEST 2] getpid and gettid...\n");
+    check(seen_pid == getpid(), "threads share getpid()");
+    check(seen_tid == tid && gettid() == getpid() && seen_tid != gettid(),
+          "each thread has its own gettid()");
+    
+    /* Test 3: Thread pointer */
+    print("\n[TEST 3] CLONE_SETTLS...\n");
+    check(seen_self == &threads[0], "thread's tp is its thread_t");
+    check(thread_self() == 0, "first thread's tp untouched");
+    
+    /* Test 4: Shared heap */
+    print("\n[TEST 4] Heap grown by a thread...\n");
+    thread_create(&threads[0], grow_heap, 0, stacks[0], STACK_SIZE);
+    thread_join(&threads[0]);
+    check(thread_heap && thread_heap[0] == 0x7EAD && thread_heap[1023] == 0xBEEF,
+          "heap visible to the first thread");
+    
+    /* Test 5: Contended counter */
+    print("\n[TEST 5] Shared counter under a umutex...\n");
+    int started = 0;
+    for (int i = 0; i < NTHREADS; i++) {
+        if (thread_create(&threads[i], add_to_counter, 0, stacks[i], STACK_SIZE) > 0) {
+            started++;
+        }
+    }
+    for (int i = 0; i < NTHREADS; i++) {
+        thread_join(&threads[i]);
+    }
+    check(started == NTHREADS, "all threads started");
+    check(counter == (long)NTHREADS * INCREMENTS, "no increment lost");
+    
+    /* Test 6: Bad arguments */
+    print("\n[TEST 6] Bad clone arguments...\n");
+    check(clone_thread(CLONE_VM, stacks[0] + STACK_SIZE, 0, 0, record_ids, 0) < 0,
+          "partial thread flags rejected");
+    check(clone_thread(CLONE_THREAD_FLAGS, stacks[0] + STACK_SIZE - 4, 0, 0, record_ids, 0) < 0,
+          "misaligned stack rejected");
+    check(clone_thread(CLONE_THREAD_FLAGS | CLONE_CHILD_CLEARTID, stacks[0] + STACK_SIZE, 0,
+                       (volatile uint32_t *)0, record_ids, 0) < 0,
+          "NULL ctid rejected");
+    
+    /* Test 7: exit_group ends every thread */
+    print("\n[TEST 7] exit_group with a thread running...\n");
+    long child = fork();
+    if (child == 0) {
+        thread_create(&threads[0], spin_forever, 0, stacks[0], STACK_SIZE);
+        exit_group(7);
+    }
+    int status = 0;
+    long reaped = child > 0 ? waitpid(child, &status, 0) : -1;
+    check(reaped == child && ((status >> 8) & 0xFF) == 7, "child reaped with group status");
+    
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+    
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+    
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,359 @@
+/**
+ * tmpfs_test.c - Test program for tmpfs on /tmp
+ *
+ * Files under /tmp live only in the page cache, so everything here is
+ * checked through the normal file syscalls.
+ *
+ * Tests:
+ * 1. /tmp is a directory that anyone may create files in
+ * 2. Data written across several pages reads back, with the size set
+ * 3. A write past end of file leaves a hole that reads as zeros
+ * 4. Subdirectories: nested create, listing, rmdir of a non-empty one
+ * 5. An unlinked file keeps its data while still open
+ * 6. The mount point itself cannot be removed
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_OPEN          13
+#define SYS_CLOSE         14
+#define SYS_LSEEK         15
+#define SYS_STAT          16
+#define SYS_MKDIR         17
+#define SYS_UNLINK        18
+#define SYS_RMDIR         19
+#define SYS_GETDENTS      27
+
+/* Open flags */
+#define O_RDONLY  0x0000
+#define O_RDWR    0x0002
+#define O_CREAT   0x0040
+
+#define SEEK_SET  0
+
+/* vfs_stat_t types */
+#define TYPE_FILE       1
+#define TYPE_DIRECTORY  2
+
+#define STDOUT_FD 1
+
+#define TEST_FILE   "/tmp/tmpfs_test.txt"
+#define TEST_DIR    "/tmp/tmpfs_test_dir"
+#define NESTED_FILE TEST_DIR "/nested.txt"
+#define HOLE_FILE   "/tmp/tmpfs_test_hole"
+
+/* Spans three pages, the last one partly */
+#define DATA_SIZE   (2 * 4096 + 1000)
+#define HOLE_OFFSET 20000
+
+typedef struct {
+    uint32_t st_ino;
+    uint16_t st_mode;
+    uint16_t st_uid;
+    uint16_t st_gid;
+    uint16_t st_pad;
+    uint32_t st_size;
+    uint32_t st_type;
+    uint32_t st_size_high;
+} stat_t;
+
+/* Layout of one getdents() record */
+typedef struct {
+    uint32_t d_ino;
+    uint16_t d_reclen;
+    uint8_t  d_type;
+    char     d_name[256];
+} dirent_t;
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, path, flags, 0644);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long lseek(int fd, long offset, int whence) {
+    return syscall3(SYS_LSEEK, fd, offset, whence);
+}
+
+static inline long stat(const char *path, stat_t *st) {
+    return syscall2(SYS_STAT, path, st);
+}
+
+static inline long mkdir(const char *path) {
+    return syscall2(SYS_MKDIR, path, 0755);
+}
+
+static inline long unlink(const char *path) {
+    return syscall1(SYS_UNLINK, path);
+}
+
+static inline long rmdir(const char *path) {
+    return syscall1(SYS_RMDIR, path);
+}
+
+static inline long getdents(int fd, void *buf, size_t len) {
+    return syscall3(SYS_GETDENTS, fd, buf, len);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static uint8_t data[DATA_SIZE];
+static uint8_t back[DATA_SIZE];
+static dirent_t dirents[8];
+
+static uint8_t pattern(long i) {
+    return (uint8_t)(i * 7 + (i >> 8));
+}
+
+static int names_equal(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+/* Read a whole file from the start into back; returns bytes read */
+static long read_all(int fd, long size) {
+    long done = 0;
+    lseek(fd, 0, SEEK_SET);
+    while (done < size) {
+        long n = read(fd, back + done, (size_t)(size - done));
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+static int matches_pattern(long size) {
+    for (long i = 0; i < size; i++) {
+        if (back[i] != pattern(i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Count the entries of TEST_DIR: dots and names other than "nested.txt" */
+static int list_dir(int *dots, int *nested, int *others) {
+    *dots = *nested = *others = 0;
+    int fd = open(TEST_DIR, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    long bytes;
+    while ((bytes = getdents(fd, dirents, sizeof(dirents))) > 0) {
+        for (long i = 0; i < bytes / (long)sizeof(dirent_t); i++) {
+            const char *name = dirents[i].d_name;
+            if (names_equal(name, ".") || names_equal(name, "..")) {
+                (*dots)++;
+            } else if (names_equal(name, "nested.txt")) {
+                (*nested)++;
+            } else {
+                (*others)++;
+            }
+        }
+    }
+    close(fd);
+    return bytes == 0;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    tmpfs Test Program\n");
+    print("========================================\n\n");
+
+    unlink(TEST_FILE);
+    unlink(HOLE_FILE);
+    unlink(NESTED_FILE);
+    rmdir(TEST_DIR);
+
+    for (long i = 0; i < DATA_SIZE; i++) {
+        data[i] = pattern(i);
+    }
+
+    /* Test 1: The mount point */
+    print("[TEST 1] Checking /tmp...\n");
+    stat_t st;
+    check(stat("/tmp", &st) == 0 && st.st_type == TYPE_DIRECTORY, "/tmp is a directory");
+    check((st.st_mode & 0777) == 0777, "/tmp is writable by everyone");
+
+    /* Test 2: Write and read back */
+    print("\n[TEST 2] Writing a file across pages...\n");
+    int fd = open(TEST_FILE, O_RDWR | O_CREAT);
+    check(fd >= 0, "created the file");
+    check(write(fd, data, DATA_SIZE) == DATA_SIZE, "wrote every byte");
+    check(read_all(fd, DATA_SIZE) == DATA_SIZE && matches_pattern(DATA_SIZE),
+          "read the data back");
+    close(fd);
+    check(stat(TEST_FILE, &st) == 0 && st.st_type == TYPE_FILE && st.st_size == DATA_SIZE,
+          "stat() reports the size");
+    fd = open(TEST_FILE, O_RDONLY);
+    check(fd >= 0 && read_all(fd, DATA_SIZE) == DATA_SIZE && matches_pattern(DATA_SIZE),
+          "data still there after reopening");
+    close(fd);
+
+    /* Test 3: Holes */
+    print("\n[TEST 3] Writing past end of file...\n");
+    fd = open(HOLE_FILE, O_RDWR | O_CREAT);
+    check(fd >= 0 && lseek(fd, HOLE_OFFSET, SEEK_SET) == HOLE_OFFSET &&
+          write(fd, "end", 3) == 3, "wrote after a hole");
+    int zeros = read_all(fd, HOLE_OFFSET) == HOLE_OFFSET;
+    for (long i = 0; zeros && i < HOLE_OFFSET; i++) {
+        zeros = back[i] == 0;
+    }
+    check(zeros, "the hole reads as zeros");
+    close(fd);
+    check(unlink(HOLE_FILE) == 0, "unlinked it");
+
+    /* Test 4: Subdirectories */
+    print("\n[TEST 4] Using a subdirectory...\n");
+    check(mkdir(TEST_DIR) == 0, "created a directory");
+    check(mkdir(TEST_DIR) < 0, "creating it again fails");
+    fd = open(NESTED_FILE, O_RDWR | O_CREAT);
+    check(fd >= 0 && write(fd, data, 100) == 100, "created a file inside it");
+    close(fd);
+    int dots, nested, others;
+    check(list_dir(&dots, &nested, &others) && dots == 2 && nested == 1 && others == 0,
+          "listing shows ., .. and the file once");
+    check(rmdir(TEST_DIR) < 0, "non-empty directory not removed");
+    check(unlink(TEST_DIR) < 0, "unlink() refuses a directory");
+    check(unlink(NESTED_FILE) == 0 && rmdir(TEST_DIR) == 0, "removed the file and directory");
+    check(stat(TEST_DIR, &st) < 0, "directory gone");
+
+    /* Test 5: Unlink while open */
+    print("\n[TEST 5] Unlinking an open file...\n");
+    fd = open(TEST_FILE, O_RDONLY);
+    check(fd >= 0 && unlink(TEST_FILE) == 0, "unlinked the open file");
+    check(stat(TEST_FILE, &st) < 0, "name gone");
+    for (long i = 0; i < DATA_SIZE; i++) {
+        back[i] = 0;
+    }
+    check(read_all(fd, DATA_SIZE) == DATA_SIZE && matches_pattern(DATA_SIZE),
+          "data still readable through the descriptor");
+    close(fd);
+    fd = open(TEST_FILE, O_RDWR | O_CREAT);
+    check(fd >= 0 && read(fd, back, 16) == 0, "a new file by the same name is empty");
+    close(fd);
+    unlink(TEST_FILE);
+
+    /* Test 6: The mount point stays */
+    print("\n[TEST 6] Removing /tmp...\n");
+    check(rmdir("/tmp") < 0, "rmdir(/tmp) refused");
+    check(stat("/tmp", &st) == 0 && st.st_type == TYPE_DIRECTORY, "/tmp still there");
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,147 @@
+/**
+ * trap_bench.c - Syscall round-trip benchmark
+ *
+ * Times a large number of getpid() calls, the cheapest syscall, so the
+ * result is dominated by trap entry and exit (the fast path in
+ * trap_entry.S). Also checks that registers the fast path does not save
+ * survive a syscall.
+ */
+
+#include <stddef.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_GETPID        3
+#define SYS_GETTIME       12
+
+#define STDOUT_FD 1
+
+/* Calls per timed run */
+#define NR_CALLS 100000
+
+/* Syscall helpers */
+#define syscall0(n) ({ \
+    register long a0 asm("a0"); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "=r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const char *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long getpid(void) {
+    return syscall0(SYS_GETPID);
+}
+
+static inline long gettime_ms(void) {
+    return syscall0(SYS_GETTIME);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/*
+ * s0-s11 are never written to the trap frame on the fast path: check
+ * that a syscall hands them back, along with a temporary it does save.
+ */
+static int registers_survive(void) {
+    register long s2 asm("s2") = 0x1234;
+    register long s11 asm("s11") = 0x5678;
+    register long t3 asm("t3") = 0x9abc;
+    register long a7 asm("a7") = SYS_GETPID;
+    register long a0 asm("a0");
+    asm volatile("ecall"
+                 : "=r"(a0), "+r"(s2), "+r"(s11), "+r"(t3)
+                 : "r"(a7)
+                 : "memory");
+    (void)a0;
+    return s2 == 0x1234 && s11 == 0x5678 && t3 == 0x9abc;
+}
+
+/* Main benchmark program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    Syscall Round-Trip Benchmark\n");
+    print("========================================\n\n");
+
+    int ok = registers_survive();
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print("registers survive a syscall\n\n");
+
+    /* Start on a fresh millisecond */
+    long start = gettime_ms();
+    while (gettime_ms() == start);
+    start = gettime_ms();
+
+    for (int i = 0; i < NR_CALLS; i++) {
+        getpid();
+    }
+    long elapsed = gettime_ms() - start;
+
+    print("  getpid() calls: ");
+    print_num(NR_CALLS);
+    print("\n  Elapsed:        ");
+    print_num(elapsed);
+    print(" ms\n  Per call:       ");
+    print_num(elapsed * 1000000 / NR_CALLS);
+    print(" ns\n");
+    print("========================================\n\n");
+
+    exit(ok ? 0 : 1);
+}
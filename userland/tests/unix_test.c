@@ -0,0 +1,652 @@
+/**
+ * unix_test.c - Test program for AF_UNIX sockets
+ *
+ * Tests:
+ * 1. socketpair() streams carry data both ways; shutdown() and close()
+ *    end them
+ * 2. Named streams: bind(), listen(), connect() and accept()
+ * 3. Datagrams keep their boundaries and the sender's name; a short
+ *    buffer gets MSG_TRUNC
+ * 4. SCM_RIGHTS passes a pipe; descriptors arrive with their own data
+ * 5. Non-blocking sockets and poll()
+ * 6. 1 MiB from a child arrives complete and in order
+ * 7. splice() between a pipe and a stream socket
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_READ          2
+#define SYS_FORK          7
+#define SYS_WAIT          9
+#define SYS_GETTIME       12
+#define SYS_CLOSE         14
+#define SYS_PIPE          26
+#define SYS_SPLICE        68
+#define SYS_POLL          71
+#define SYS_SOCKET        100
+#define SYS_BIND          101
+#define SYS_SENDTO        102
+#define SYS_RECVFROM      103
+#define SYS_CONNECT       106
+#define SYS_LISTEN        107
+#define SYS_ACCEPT        108
+#define SYS_SHUTDOWN      111
+#define SYS_SOCKETPAIR    112
+#define SYS_SENDMSG       113
+#define SYS_RECVMSG       114
+
+/* Sockets */
+#define AF_UNIX           1
+#define AF_INET           2
+#define SOCK_STREAM       1
+#define SOCK_DGRAM        2
+#define SOCK_NONBLOCK     0x0800
+
+#define SOL_SOCKET        1
+#define SCM_RIGHTS        1
+
+#define SHUT_WR           1
+
+#define MSG_CTRUNC        0x08
+#define MSG_TRUNC         0x20
+#define MSG_DONTWAIT      0x40
+
+#define POLLIN            0x0001
+#define POLLOUT           0x0004
+
+#define STDOUT_FD 1
+
+struct sockaddr_un {
+    uint16_t sun_family;
+    char sun_path[108];
+};
+
+struct iovec {
+    void *iov_base;
+    uint64_t iov_len;
+};
+
+struct msghdr {
+    void *msg_name;
+    uint32_t msg_namelen;
+    struct iovec *msg_iov;
+    uint64_t msg_iovlen;
+    void *msg_control;
+    uint64_t msg_controllen;
+    int32_t msg_flags;
+};
+
+struct cmsghdr {
+    uint64_t cmsg_len;
+    int32_t cmsg_level;
+    int32_t cmsg_type;
+};
+
+#define CMSG_LEN(len)     (sizeof(struct cmsghdr) + (len))
+#define CMSG_SPACE(len)   (sizeof(struct cmsghdr) + (((len) + 7) & ~7UL))
+
+struct pollfd {
+    int fd;
+    short events;
+    short revents;
+};
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall4(n, a1, a2, a3, a4) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), \
+                 "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall6(n, a1, a2, a3, a4, a5, a6) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long a3_reg asm("a3") = (long)(a4); \
+    register long a4_reg asm("a4") = (long)(a5); \
+    register long a5_reg asm("a5") = (long)(a6); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(a3_reg), "r"(a4_reg), \
+                 "r"(a5_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, fd, buf, len);
+}
+
+static inline long fork(void) {
+    return syscall1(SYS_FORK, 0);
+}
+
+static inline long waitpid(long pid, int *status) {
+    return syscall3(SYS_WAIT, pid, status, 0);
+}
+
+static inline long gettime(void) {
+    return syscall1(SYS_GETTIME, 0);
+}
+
+static inline long close(int fd) {
+    return syscall1(SYS_CLOSE, fd);
+}
+
+static inline long pipe(int fds[2]) {
+    return syscall1(SYS_PIPE, fds);
+}
+
+static inline long splice(int fd_in, int fd_out, size_t len, unsigned int flags) {
+    return syscall6(SYS_SPLICE, fd_in, 0, fd_out, 0, len, flags);
+}
+
+static inline long poll(struct pollfd *fds, int nfds, int timeout_ms) {
+    return syscall3(SYS_POLL, fds, nfds, timeout_ms);
+}
+
+static inline long socket(int domain, int type, int protocol) {
+    return syscall3(SYS_SOCKET, domain, type, protocol);
+}
+
+static inline long socketpair(int domain, int type, int protocol, int sv[2]) {
+    return syscall4(SYS_SOCKETPAIR, domain, type, protocol, sv);
+}
+
+static inline long bind(int fd, const struct sockaddr_un *addr, uint32_t len) {
+    return syscall3(SYS_BIND, fd, addr, len);
+}
+
+static inline long sendto(int fd, const void *buf, size_t len, int flags,
+                          const struct sockaddr_un *to, uint32_t tolen) {
+    return syscall6(SYS_SENDTO, fd, buf, len, flags, to, tolen);
+}
+
+static inline long recvfrom(int fd, void *buf, size_t len, int flags,
+                            struct sockaddr_un *from, uint32_t *fromlen) {
+    return syscall6(SYS_RECVFROM, fd, buf, len, flags, from, fromlen);
+}
+
+static inline long recv(int fd, void *buf, size_t len, int flags) {
+    return recvfrom(fd, buf, len, flags, NULL, NULL);
+}
+
+static inline long sendmsg(int fd, const struct msghdr *msg, int flags) {
+    return syscall3(SYS_SENDMSG, fd, msg, flags);
+}
+
+static inline long recvmsg(int fd, struct msghdr *msg, int flags) {
+    return syscall3(SYS_RECVMSG, fd, msg, flags);
+}
+
+static inline long connect(int fd, const struct sockaddr_un *addr, uint32_t len) {
+    return syscall3(SYS_CONNECT, fd, addr, len);
+}
+
+static inline long listen(int fd, int backlog) {
+    return syscall3(SYS_LISTEN, fd, backlog, 0);
+}
+
+static inline long accept(int fd, struct sockaddr_un *addr, uint32_t *len) {
+    return syscall3(SYS_ACCEPT, fd, addr, len);
+}
+
+static inline long shutdown(int fd, int how) {
+    return syscall3(SYS_SHUTDOWN, fd, how, 0);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static int streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+static int exit_code(int status) {
+    return (status >> 8) & 0xFF;
+}
+
+/**
+ * Fill in a name; returns the address length, NUL included
+ */
+static uint32_t make_addr(struct sockaddr_un *sa, const char *path) {
+    sa->sun_family = AF_UNIX;
+    size_t len = strlen(path);
+    for (size_t i = 0; i <= len; i++) {
+        sa->sun_path[i] = path[i];
+    }
+    return (uint32_t)(offsetof(struct sockaddr_un, sun_path) + len + 1);
+}
+
+static int bytes_equal(const void *a, const void *b, size_t n) {
+    const uint8_t *p = a;
+    const uint8_t *q = b;
+    for (size_t i = 0; i < n; i++) {
+        if (p[i] != q[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Read exactly len bytes, or fewer if the stream ends first
+ */
+static long read_full(int fd, void *dst, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        long n = read(fd, (char *)dst + got, len - got);
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+    }
+    return got;
+}
+
+/* Control buffer for up to four descriptors, aligned as a cmsghdr */
+typedef union {
+    struct cmsghdr hdr;
+    uint8_t buf[CMSG_SPACE(4 * sizeof(int))];
+} control_t;
+
+/**
+ * Send len bytes with nfds descriptors (0: no control data)
+ */
+static long send_fds(int fd, const void *data, size_t len, const int *fds, int nfds) {
+    control_t control;
+    struct iovec iov = { (void *)data, len };
+    struct msghdr msg = { NULL, 0, &iov, 1, NULL, 0, 0 };
+    if (nfds > 0) {
+        control.hdr.cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        control.hdr.cmsg_level = SOL_SOCKET;
+        control.hdr.cmsg_type = SCM_RIGHTS;
+        int *slot = (int *)(control.buf + sizeof(struct cmsghdr));
+        for (int i = 0; i < nfds; i++) {
+            slot[i] = fds[i];
+        }
+        msg.msg_control = &control;
+        msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+    }
+    return sendmsg(fd, &msg, 0);
+}
+
+/**
+ * Receive into data; *nfds is set to the descriptors that came, stored
+ * in fds (room for four), and *flags to msg_flags
+ */
+static long recv_fds(int fd, void *data, size_t len, int *fds, int *nfds, int *flags) {
+    control_t control;
+    struct iovec iov = { data, len };
+    struct msghdr msg = { NULL, 0, &iov, 1, &control, sizeof(control), 0 };
+    long n = recvmsg(fd, &msg, 0);
+    *nfds = 0;
+    *flags = msg.msg_flags;
+    if (n >= 0 && msg.msg_controllen >= sizeof(struct cmsghdr) &&
+        control.hdr.cmsg_level == SOL_SOCKET && control.hdr.cmsg_type == SCM_RIGHTS) {
+        *nfds = (int)((control.hdr.cmsg_len - sizeof(struct cmsghdr)) / sizeof(int));
+        const int *slot = (const int *)(control.buf + sizeof(struct cmsghdr));
+        for (int i = 0; i < *nfds && i < 4; i++) {
+            fds[i] = slot[i];
+        }
+    }
+    return n;
+}
+
+#define BULK_TOTAL (1024 * 1024)
+#define BULK_CHUNK 3000
+
+static uint8_t chunk[BULK_CHUNK];
+static char buf[8192];
+
+/**
+ * Byte i of the bulk stream
+ */
+static uint8_t pattern(uint32_t i) {
+    return (uint8_t)((i * 31) ^ (i >> 9));
+}
+
+/**
+ * Write BULK_TOTAL bytes of pattern() to fd
+ */
+static int bulk_sender(int fd) {
+    uint32_t sent = 0;
+    while (sent < BULK_TOTAL) {
+        uint32_t n = BULK_TOTAL - sent < BULK_CHUNK ? BULK_TOTAL - sent : BULK_CHUNK;
+        for (uint32_t i = 0; i < n; i++) {
+            chunk[i] = pattern(sent + i);
+        }
+        long w = write(fd, chunk, n);
+        if (w <= 0) {
+            return 2;
+        }
+        sent += w;
+    }
+    close(fd);
+    return 0;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("     AF_UNIX Socket Test Program\n");
+    print("========================================\n\n");
+
+    int sv[2];
+    int status = 0;
+    long n;
+
+    /* Test 1: socketpair() streams */
+    print("[TEST 1] socketpair() streams...\n");
+    check(socketpair(AF_INET, SOCK_STREAM, 0, sv) < 0, "AF_INET pair refused");
+    check(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0 && sv[0] >= 0 && sv[1] >= 0,
+          "stream pair created");
+    check(write(sv[0], "hello", 5) == 5 && read_full(sv[1], buf, 5) == 5 &&
+          bytes_equal(buf, "hello", 5), "one way");
+    check(write(sv[1], "world!", 6) == 6 && read_full(sv[0], buf, 6) == 6 &&
+          bytes_equal(buf, "world!", 6), "and back");
+    write(sv[0], "abc", 3);
+    write(sv[0], "defg", 4);
+    n = read(sv[1], buf, sizeof(buf));
+    check(n == 7 && bytes_equal(buf, "abcdefg", 7), "two writes read back as one stream");
+    check(recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT) < 0, "MSG_DONTWAIT: empty fails");
+    check(shutdown(sv[0], SHUT_WR) == 0 && read(sv[1], buf, sizeof(buf)) == 0,
+          "shutdown(SHUT_WR): peer reads end of stream");
+    check(write(sv[0], "no", 2) < 0, "and cannot write any more");
+    check(write(sv[1], "bye", 3) == 3 && read_full(sv[0], buf, 3) == 3 &&
+          bytes_equal(buf, "bye", 3), "the peer still answers");
+    close(sv[1]);
+    check(read(sv[0], buf, sizeof(buf)) == 0, "close() ends the other way");
+    close(sv[0]);
+
+    /* Test 2: Named streams */
+    print("\n[TEST 2] bind(), listen(), connect(), accept()...\n");
+    struct sockaddr_un srv_addr, missing, peer;
+    uint32_t srv_len = make_addr(&srv_addr, "/tmp/unix_test.srv");
+    uint32_t missing_len = make_addr(&missing, "/tmp/unix_test.none");
+    int lis = socket(AF_UNIX, SOCK_STREAM, 0);
+    int other = socket(AF_UNIX, SOCK_STREAM, 0);
+    check(lis >= 0 && other >= 0, "two stream sockets created");
+    check(socket(AF_UNIX, SOCK_STREAM, 6) < 0, "a protocol refused");
+    check(listen(lis, 4) < 0, "listen() before bind() refused");
+    check(bind(lis, &srv_addr, srv_len) == 0, "bound");
+    check(bind(other, &srv_addr, srv_len) < 0, "name in use refused");
+    check(listen(lis, 4) == 0, "listening");
+    check(connect(other, &missing, missing_len) < 0, "connect() to no name refused");
+
+    int c = socket(AF_UNIX, SOCK_STREAM, 0);
+    check(connect(c, &srv_addr, srv_len) == 0, "connected");
+    struct pollfd pfd = { lis, POLLIN, 0 };
+    check(poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN), "listener readable");
+    uint32_t peerlen = sizeof(peer);
+    int s = accept(lis, &peer, &peerlen);
+    check(s >= 0, "accepted");
+    check(peerlen == sizeof(peer.sun_family) && peer.sun_family == AF_UNIX,
+          "peer unnamed: just the family");
+    check(write(c, "ping", 4) == 4 && read_full(s, buf, 4) == 4 && bytes_equal(buf, "ping", 4),
+          "client to server");
+    check(write(s, "pong", 4) == 4 && read_full(c, buf, 4) == 4 && bytes_equal(buf, "pong", 4),
+          "server to client");
+    check(connect(c, &srv_addr, srv_len) < 0, "connecting twice refused");
+    close(s);
+    close(c);
+    close(lis);
+    check(bind(other, &srv_addr, srv_len) == 0, "the name is free after close()");
+    close(other);
+
+    /* Test 3: Datagrams */
+    print("\n[TEST 3] Datagrams...\n");
+    struct sockaddr_un a_addr, b_addr, from;
+    uint32_t a_len = make_addr(&a_addr, "/tmp/unix_test.a");
+    uint32_t b_len = make_addr(&b_addr, "/tmp/unix_test.b");
+    int da = socket(AF_UNIX, SOCK_DGRAM, 0);
+    int db = socket(AF_UNIX, SOCK_DGRAM, 0);
+    check(da >= 0 && db >= 0 && bind(da, &a_addr, a_len) == 0 && bind(db, &b_addr, b_len) == 0,
+          "two bound datagram sockets");
+    check(sendto(da, "one", 3, 0, NULL, 0) < 0, "no destination refused");
+    check(sendto(da, "one", 3, 0, &b_addr, b_len) == 3 &&
+          sendto(da, "three", 5, 0, &b_addr, b_len) == 5, "two datagrams sent");
+    uint32_t fromlen = sizeof(from);
+    n = recvfrom(db, buf, sizeof(buf), 0, &from, &fromlen);
+    check(n == 3 && bytes_equal(buf, "one", 3), "first arrives alone");
+    check(fromlen == a_len && streq(from.sun_path, "/tmp/unix_test.a"), "with the sender's name");
+
+    struct iovec iov = { buf, 2 };
+    struct msghdr msg = { NULL, 0, &iov, 1, NULL, 0, 0 };
+    n = recvmsg(db, &msg, 0);
+    check(n == 2 && bytes_equal(buf, "th", 2) && (msg.msg_flags & MSG_TRUNC),
+          "short buffer: cut, MSG_TRUNC");
+    check(recv(db, buf, sizeof(buf), MSG_DONTWAIT) < 0, "the rest was discarded");
+    check(connect(db, &a_addr, a_len) == 0 && sendto(db, "back", 4, 0, NULL, 0) == 4 &&
+          recv(da, buf, sizeof(buf), 0) == 4 && bytes_equal(buf, "back", 4),
+          "connect()ed datagram socket sends to its peer");
+    close(da);
+    close(db);
+
+    check(socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) == 0, "datagram pair created");
+    fromlen = sizeof(from);
+    check(write(sv[0], "pair", 4) == 4 &&
+          recvfrom(sv[1], buf, sizeof(buf), 0, &from, &fromlen) == 4 &&
+          fromlen == sizeof(from.sun_family), "unnamed sender: just the family");
+    close(sv[0]);
+    close(sv[1]);
+
+    /* Test 4: Passing descriptors */
+    print("\n[TEST 4] SCM_RIGHTS...\n");
+    int pfds[2];
+    check(pipe(pfds) == 0 && socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0,
+          "pipe and stream pair");
+    check(send_fds(sv[0], "xx", 2, NULL, 0) == 2 && send_fds(sv[0], "yy", 2, &pfds[1], 1) == 2,
+          "data, then data with the pipe's write end");
+    int got[4];
+    int ngot = 0;
+    int flags = 0;
+    n = recv_fds(sv[1], buf, sizeof(buf), got, &ngot, &flags);
+    check(n == 2 && bytes_equal(buf, "xx", 2) && ngot == 0,
+          "the read stops before the descriptor");
+    n = recv_fds(sv[1], buf, sizeof(buf), got, &ngot, &flags);
+    check(n == 2 && bytes_equal(buf, "yy", 2) && ngot == 1 && got[0] != pfds[1],
+          "the descriptor comes with its data, as a new one");
+    check(ngot == 1 && write(got[0], "via", 3) == 3 && read_full(pfds[0], buf, 3) == 3 &&
+          bytes_equal(buf, "via", 3), "it writes to the same pipe");
+    if (ngot == 1) {
+        close(got[0]);
+    }
+
+    check(send_fds(sv[0], "z", 1, &sv[1], 1) < 0, "passing an AF_UNIX socket refused");
+    int bad = 99;
+    check(send_fds(sv[0], "z", 1, &bad, 1) < 0, "passing a closed descriptor refused");
+    check(send_fds(sv[0], "z", 1, &pfds[0], 1) == 1, "sent once more");
+    iov.iov_base = buf;
+    iov.iov_len = sizeof(buf);
+    msg.msg_control = NULL;
+    msg.msg_controllen = 0;
+    msg.msg_flags = 0;
+    n = recvmsg(sv[1], &msg, 0);
+    check(n == 1 && (msg.msg_flags & MSG_CTRUNC), "no control buffer: MSG_CTRUNC");
+    close(sv[0]);
+    close(sv[1]);
+    close(pfds[0]);
+    close(pfds[1]);
+
+    /* Test 5: Non-blocking sockets */
+    print("\n[TEST 5] Non-blocking sockets and poll()...\n");
+    check(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == 0, "non-blocking pair");
+    struct pollfd wp = { sv[0], POLLIN | POLLOUT, 0 };
+    check(poll(&wp, 1, 0) == 1 && wp.revents == POLLOUT, "writable, not readable");
+    long start = gettime();
+    long filled = 0;
+    while ((n = write(sv[0], buf, sizeof(buf))) > 0) {
+        filled += n;
+    }
+    check(n < 0 && filled > 0, "writes until the buffer is full, then fails");
+    check(gettime() - start < 50, "without waiting");
+    wp.events = POLLOUT;
+    wp.revents = 0;
+    check(poll(&wp, 1, 0) == 0, "full: not writable");
+    struct pollfd rp = { sv[1], POLLIN, 0 };
+    check(poll(&rp, 1, 0) == 1 && (rp.revents & POLLIN), "peer readable");
+    long drained = 0;
+    while ((n = read(sv[1], buf, sizeof(buf))) > 0) {
+        drained += n;
+    }
+    check(drained == filled, "everything written is read");
+    wp.revents = 0;
+    check(poll(&wp, 1, 0) == 1 && (wp.revents & POLLOUT), "drained: writable again");
+    close(sv[0]);
+    close(sv[1]);
+
+    /* Test 6: Bulk transfer */
+    print("\n[TEST 6] 1 MiB from a child...\n");
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    long pid = fork();
+    if (pid == 0) {
+        close(sv[1]);
+        exit(bulk_sender(sv[0]));
+    }
+    close(sv[0]);
+    start = gettime();
+    uint32_t total = 0;
+    int intact = 1;
+    for (;;) {
+        n = read(sv[1], buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        for (long i = 0; i < n; i++) {
+            intact &= (uint8_t)buf[i] == pattern(total + i);
+        }
+        total += n;
+    }
+    long elapsed = gettime() - start;
+    check(n == 0 && total == BULK_TOTAL, "all of it, then end of stream");
+    check(intact, "in order and intact");
+    print("  (");
+    print_num(elapsed);
+    print(" ms)\n");
+    check(pid > 0 && waitpid(pid, &status) == pid && exit_code(status) == 0, "sender done");
+    close(sv[1]);
+
+    /* Test 7: splice() */
+    print("\n[TEST 7] splice() with a stream socket...\n");
+    check(pipe(pfds) == 0 && socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0,
+          "pipe and stream pair");
+    write(pfds[1], "spliced out", 11);
+    check(splice(pfds[0], sv[0], 11, 0) == 11 && read_full(sv[1], buf, 11) == 11 &&
+          bytes_equal(buf, "spliced out", 11), "pipe to socket");
+    write(sv[1], "spliced in", 10);
+    check(splice(sv[0], pfds[1], 10, 0) == 10 && read_full(pfds[0], buf, 10) == 10 &&
+          bytes_equal(buf, "spliced in", 10), "socket to pipe");
+    int dgram[2];
+    socketpair(AF_UNIX, SOCK_DGRAM, 0, dgram);
+    write(pfds[1], "d", 1);
+    check(splice(pfds[0], dgram[0], 1, 0) < 0, "datagram socket refused");
+    close(dgram[0]);
+    close(dgram[1]);
+    close(sv[0]);
+    close(sv[1]);
+    close(pfds[0]);
+    close(pfds[1]);
+
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+
+    exit(tests_failed > 0 ? 1 : 0);
+}
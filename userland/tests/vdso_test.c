@@ -0,0 +1,196 @@
+/**
+ * vdso_test.c - Test program for the vDSO clocks
+ * 
+ * Tests:
+ * 1. The kernel mapped a vDSO data page with its magic
+ * 2. CLOCK_MONOTONIC never goes backwards
+ * 3. The vDSO and SYS_CLOCK_GETTIME agree
+ * 4. Unknown clocks are rejected both ways
+ * 5. CLOCK_REALTIME and gettimeofday() read a date after 2020
+ * 6. A vDSO read costs less than a trap
+ */
+
+#include <stddef.h>
+#include "../lib/vdso.h"
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+
+#define STDOUT_FD 1
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const char *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+    
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+    
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+#define READS             1000
+#define EPOCH_2020        1577836800L
+#define AGREE_NS          50000000L    /* 50 ms, one rebase or so */
+
+static int64_t ts_ns(const struct timespec *ts) {
+    return ts->tv_sec * 1000000000L + ts->tv_nsec;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("       vDSO Test Program\n");
+    print("========================================\n\n");
+    
+    /* Test 1: The data page carries the magic and a function */
+    print("[TEST 1] vDSO present...\n");
+    vdso_clock_gettime_t fn = vdso_clock_gettime_fn();
+    check(fn != 0, "vDSO magic and clock_gettime");
+    
+    /* Test 2: Monotonic over many reads */
+    print("\n[TEST 2] CLOCK_MONOTONIC is monotonic...\n");
+    struct timespec ts;
+    int ok = 1;
+    uint64_t last = monotonic_ns();
+    for (int i = 0; i < READS; i++) {
+        uint64_t now = monotonic_ns();
+        if (now < last) {
+            ok = 0;
+        }
+        last = now;
+    }
+    check(ok, "no backwards step");
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    check(ts.tv_nsec >= 0 && ts.tv_nsec < 1000000000L, "tv_nsec in range");
+    
+    /* Test 3: Both paths read the same clock */
+    print("\n[TEST 3] vDSO matches the syscall...\n");
+    struct timespec a, b, c;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    long ret = sys_clock_gettime(CLOCK_MONOTONIC, &b);
+    clock_gettime(CLOCK_MONOTONIC, &c);
+    check(ret == 0, "SYS_CLOCK_GETTIME succeeds");
+    check(ts_ns(&a) <= ts_ns(&b) + AGREE_NS && ts_ns(&b) <= ts_ns(&c) + AGREE_NS,
+          "syscall lies between two vDSO reads");
+    clock_gettime(CLOCK_REALTIME, &a);
+    sys_clock_gettime(CLOCK_REALTIME, &b);
+    int64_t diff = ts_ns(&b) - ts_ns(&a);
+    check(diff > -AGREE_NS && diff < AGREE_NS, "CLOCK_REALTIME agrees");
+    
+    /* Test 4: Unknown clock */
+    print("\n[TEST 4] Unknown clock...\n");
+    check(clock_gettime(7, &ts) == -1, "vDSO rejects clock 7");
+    check(sys_clock_gettime(7, &ts) < 0, "syscall rejects clock 7");
+    
+    /* Test 5: Wall clock from the RTC */
+    print("\n[TEST 5] CLOCK_REALTIME is a date...\n");
+    clock_gettime(CLOCK_REALTIME, &ts);
+    check(ts.tv_sec > EPOCH_2020, "CLOCK_REALTIME after 2020");
+    struct timeval tv;
+    check(gettimeofday(&tv, 0) == 0 && tv.tv_sec >= ts.tv_sec && tv.tv_usec < 1000000L,
+          "gettimeofday");
+    
+    /* Test 6: Cost per call */
+    print("\n[TEST 6] Cost per call...\n");
+    uint64_t t0 = monotonic_ns();
+    for (int i = 0; i < READS; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+    }
+    uint64_t t1 = monotonic_ns();
+    for (int i = 0; i < READS; i++) {
+        sys_clock_gettime(CLOCK_MONOTONIC, &ts);
+    }
+    uint64_t t2 = monotonic_ns();
+    print("  vDSO:    ");
+    print_num((long)((t1 - t0) / READS));
+    print(" ns/call\n  syscall: ");
+    print_num((long)((t2 - t1) / READS));
+    print(" ns/call\n");
+    check(fn == 0 || t1 - t0 < t2 - t1, "vDSO cheaper than a trap");
+    
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+    
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+    
+    exit(tests_failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,212 @@
+/**
+ * vfork_test.c - Test program for vfork()
+ * 
+ * Tests:
+ * 1. The parent waits for the child to exit, and sees what it wrote
+ * 2. A child that execs releases the parent; the parent's stack is intact
+ * 3. A failed execve() leaves the child running on the borrowed memory
+ * 4. Many vfork()s in a row, each reaped with its exit code
+ */
+
+#include <stddef.h>
+
+/* Syscall numbers */
+#define SYS_EXIT          0
+#define SYS_WRITE         1
+#define SYS_WAIT          9
+#define SYS_EXECVE        20
+#define SYS_VFORK         66
+
+#define STDOUT_FD 1
+
+/* Children in the repeated vfork test */
+#define NR_CHILDREN 20
+
+/* Syscall helpers */
+#define syscall1(n, a1) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall2(n, a1, a2) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+#define syscall3(n, a1, a2, a3) ({ \
+    register long a0 asm("a0") = (long)(a1); \
+    register long a1_reg asm("a1") = (long)(a2); \
+    register long a2_reg asm("a2") = (long)(a3); \
+    register long syscall_number asm("a7") = (n); \
+    asm volatile("ecall" : "+r"(a0) : "r"(a1_reg), "r"(a2_reg), "r"(syscall_number) : "memory"); \
+    a0; \
+})
+
+/* Syscall wrappers */
+static inline void exit(int status) {
+    syscall1(SYS_EXIT, status);
+    while(1);
+}
+
+static inline long write(int fd, const char *buf, size_t len) {
+    return syscall3(SYS_WRITE, fd, buf, len);
+}
+
+static inline long vfork(void) {
+    return syscall1(SYS_VFORK, 0);
+}
+
+static inline long waitpid(long pid, int *status) {
+    return syscall3(SYS_WAIT, pid, status, 0);
+}
+
+static inline long execve(const char *path, const char *argv[]) {
+    const char *envp[] = { NULL };
+    return syscall3(SYS_EXECVE, path, argv, envp);
+}
+
+/* String helpers */
+static size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static void print(const char *s) {
+    write(STDOUT_FD, s, strlen(s));
+}
+
+static void print_num(long n) {
+    char buf[20];
+    int i = 0;
+    
+    if (n == 0) {
+        buf[i++] = '0';
+    } else {
+        while (n > 0) {
+            buf[i++] = '0' + (n % 10);
+            n /= 10;
+        }
+    }
+    
+    /* Reverse */
+    char out[20];
+    for (int j = 0; j < i; j++) {
+        out[j] = buf[i - 1 - j];
+    }
+    out[i] = '\0';
+    print(out);
+}
+
+/* Test counter */
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void check(int ok, const char *name) {
+    print(ok ? "[PASS] " : "[FAIL] ");
+    print(name);
+    print("\n");
+    if (ok) {
+        tests_passed++;
+    } else {
+        tests_failed++;
+    }
+}
+
+/* Written by children into the memory they borrow from us */
+static volatile int child_ran = 0;
+static volatile long exec_failed = 0;
+
+static int exit_code(int status) {
+    return (status >> 8) & 0xFF;
+}
+
+/* Main test program */
+void _start(void) {
+    print("\n");
+    print("========================================\n");
+    print("    vfork() Test Program\n");
+    print("========================================\n\n");
+    
+    /* Test 1: Child exits; we only run again after that */
+    print("[TEST 1] vfork() then exit...\n");
+    long pid = vfork();
+    if (pid == 0) {
+        child_ran = 1;
+        exit(7);
+    }
+    check(pid > 0, "vfork() returns the child PID");
+    check(child_ran == 1, "parent resumed after the child, sees its write");
+    int status = -1;
+    check(waitpid(pid, &status) == pid && exit_code(status) == 7, "child reaped with exit code 7");
+    
+    /* Test 2: Child execs a program */
+    print("\n[TEST 2] vfork() then execve()...\n");
+    volatile long sentinel = 0x5a5a5a5a;
+    child_ran = 0;
+    pid = vfork();
+    if (pid == 0) {
+        child_ran = 1;
+        const char *argv[] = { "/bin/hello", NULL };
+        execve("/bin/hello", argv);
+        exit(99);
+    }
+    check(child_ran == 1, "child ran before the parent resumed");
+    check(sentinel == 0x5a5a5a5a, "parent stack intact after the child's exec");
+    status = -1;
+    check(waitpid(pid, &status) == pid && exit_code(status) == 0, "exec'd child exits cleanly");
+    
+    /* Test 3: Failed exec leaves the child on our memory */
+    print("\n[TEST 3] vfork() with a failing execve()...\n");
+    exec_failed = 0;
+    pid = vfork();
+    if (pid == 0) {
+        const char *argv[] = { "/bin/no_such_program", NULL };
+        exec_failed = execve("/bin/no_such_program", argv);
+        exit(3);
+    }
+    check(exec_failed == -1, "execve() failure seen in borrowed memory");
+    status = -1;
+    check(waitpid(pid, &status) == pid && exit_code(status) == 3, "child exits after failed exec");
+    
+    /* Test 4: Repeated vfork() */
+    print("\n[TEST 4] ");
+    print_num(NR_CHILDREN);
+    print(" vfork()s in a row...\n");
+    int reaped = 0;
+    for (int i = 0; i < NR_CHILDREN; i++) {
+        pid = vfork();
+        if (pid == 0) {
+            exit(i);
+        }
+        status = -1;
+        if (pid > 0 && waitpid(pid, &status) == pid && exit_code(status) == i) {
+            reaped++;
+        }
+    }
+    check(reaped == NR_CHILDREN, "every child reaped with its exit code");
+    
+    /* Summary */
+    print("\n========================================\n");
+    print("  Test Summary\n");
+    print("========================================\n");
+    print("  Passed: ");
+    print_num(tests_passed);
+    print("\n  Failed: ");
+    print_num(tests_failed);
+    print("\n");
+    
+    if (tests_failed == 0) {
+        print("\n  ALL TESTS PASSED!\n");
+    } else {
+        print("\n  SOME TESTS FAILED!\n");
+    }
+    print("========================================\n\n");
+    
+    exit(tests_failed > 0 ? 1 : 0);
+}